@@ -10,6 +10,15 @@
 
 #include "FindPattern.h"
 
+#include <emmintrin.h>
+
+#include <cstring>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 inline bool DataCompare(const uint8_t* pData, const uint8_t* bMask, const char* szMask)
 {
 	for (; *szMask; ++szMask, ++pData, ++bMask)
@@ -20,19 +29,116 @@ inline bool DataCompare(const uint8_t* pData, const uint8_t* bMask, const char*
 	return (*szMask) == 0;
 }
 
+static inline int LowestBit(uint32_t value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, value);
+	return static_cast<int>(index);
+#else
+	return __builtin_ctz(value);
+#endif
+}
+
+bool MatchesPattern(uintptr_t address, const uint8_t* bMask, const char* szMask)
+{
+	return address != 0 && DataCompare((const uint8_t*)address, bMask, szMask);
+}
+
 uintptr_t FindPattern(uintptr_t dwAddress, uint32_t dwLen, const uint8_t* bMask, const char* szMask)
 {
-	if (dwAddress == 0)
-		return 0;
+	PatternSearch search = { bMask, szMask, 0 };
+	FindPatterns(dwAddress, dwLen, &search, 1);
+
+	return search.result;
+}
+
+void FindPatterns(uintptr_t dwAddress, uint32_t dwLen, PatternSearch* searches, size_t count)
+{
+	// Each pattern is anchored on its first byte that has to match. Sixteen
+	// places at a time are tested for the anchor byte, and the whole pattern is
+	// only compared where it was found.
+	struct Anchor
+	{
+		PatternSearch* search;
+		uint32_t offset;
+		__m128i value;
+	};
+
+	std::vector<Anchor> anchors;
+	anchors.reserve(count);
 
-	for (uint32_t i = 0; i < dwLen; i++)
+	for (size_t i = 0; i < count; ++i)
 	{
-		if (DataCompare((uint8_t*)(dwAddress + i), bMask, szMask))
-			return (uintptr_t)(dwAddress + i);
+		PatternSearch& search = searches[i];
+		search.result = 0;
+
+		if (dwAddress == 0 || dwLen == 0)
+			continue;
+
+		const char* first = strchr(search.mask, 'x');
+		if (!first)
+		{
+			// nothing to compare, matches right away
+			search.result = dwAddress;
+			continue;
+		}
+
+		uint32_t offset = static_cast<uint32_t>(first - search.mask);
+		anchors.push_back({ &search, offset, _mm_set1_epi8(static_cast<char>(search.pattern[offset])) });
 	}
 
-	return 0;
+	uint32_t pos = 0;
+	for (; !anchors.empty() && pos + 16 <= dwLen; pos += 16)
+	{
+		for (size_t i = 0; i < anchors.size(); )
+		{
+			Anchor& anchor = anchors[i];
+			const uint8_t* data = (const uint8_t*)(dwAddress + pos + anchor.offset);
+
+			__m128i block = _mm_loadu_si128((const __m128i*)data);
+			uint32_t hits = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, anchor.value)));
+
+			bool found = false;
+			while (hits)
+			{
+				uintptr_t address = dwAddress + pos + LowestBit(hits);
+				if (DataCompare((const uint8_t*)address, anchor.search->pattern, anchor.search->mask))
+				{
+					anchor.search->result = address;
+					found = true;
+					break;
+				}
+
+				hits &= hits - 1;
+			}
+
+			if (found)
+			{
+				anchors[i] = anchors.back();
+				anchors.pop_back();
+			}
+			else
+			{
+				++i;
+			}
+		}
+	}
+
+	// whatever is left at the end, one place at a time
+	for (const Anchor& anchor : anchors)
+	{
+		for (uint32_t i = pos; i < dwLen; ++i)
+		{
+			if (DataCompare((const uint8_t*)(dwAddress + i), anchor.search->pattern, anchor.search->mask))
+			{
+				anchor.search->result = dwAddress + i;
+				break;
+			}
+		}
+	}
 }
+
 // --------------------------------------------------------------------------------------
 
 uint32_t GetDWordAt(uintptr_t address, uint32_t numBytes)
@@ -2,6 +2,7 @@
 // FindPattern.h
 //
 
+#include <cstddef>
 #include <cstdint>
 
 #pragma once
@@ -9,6 +10,22 @@
 // Find an address that matches the given pattern/mask, starting at the given dwAddress.
 uintptr_t FindPattern(uintptr_t dwAddress, uint32_t dwLen, const uint8_t* bMask, const char* szMask);
 
+// true if the pattern matches at address
+bool MatchesPattern(uintptr_t address, const uint8_t* bMask, const char* szMask);
+
+struct PatternSearch
+{
+	const uint8_t* pattern;
+	const char* mask;
+
+	// first match, or 0 if there was none
+	uintptr_t result;
+};
+
+// Finds several patterns in the same range in one pass over the memory. Same
+// results as calling FindPattern for each of them.
+void FindPatterns(uintptr_t dwAddress, uint32_t dwLen, PatternSearch* searches, size_t count);
+
 uint32_t GetDWordAt(uintptr_t address, uint32_t numBytes);
 
 uintptr_t GetFunctionAddressAt(uintptr_t address, uint32_t addressOffset, uint32_t numBytes);
@@ -0,0 +1,55 @@
+//
+// FlowField.cpp
+//
+
+#include "FlowField.h"
+
+#include <DetourCommon.h>
+
+#include <algorithm>
+
+void FlowField::Clear()
+{
+	m_destRef = 0;
+	dtVset(m_destPos, 0, 0, 0);
+	m_cells.clear();
+}
+
+void FlowField::SetCells(dtPolyRef destRef, const float* destPos, std::vector<Cell> cells)
+{
+	m_destRef = destRef;
+	dtVcopy(m_destPos, destPos);
+	m_cells = std::move(cells);
+
+	std::sort(m_cells.begin(), m_cells.end(),
+		[](const Cell& a, const Cell& b) { return a.ref < b.ref; });
+}
+
+const FlowField::Cell* FlowField::FindCell(dtPolyRef ref) const
+{
+	auto iter = std::lower_bound(m_cells.begin(), m_cells.end(), ref,
+		[](const Cell& cell, dtPolyRef ref) { return cell.ref < ref; });
+	if (iter == m_cells.end() || iter->ref != ref)
+		return nullptr;
+
+	return &*iter;
+}
+
+int FlowField::GetPath(dtPolyRef startRef, dtPolyRef endRef, dtPolyRef* path, int maxPath) const
+{
+	if (!FindCell(startRef))
+		return 0;
+
+	int count = 0;
+	for (dtPolyRef ref = startRef; ref && count < maxPath; )
+	{
+		path[count++] = ref;
+		if (ref == endRef)
+			break;
+
+		const Cell* cell = FindCell(ref);
+		ref = cell ? cell->next : 0;
+	}
+
+	return count;
+}
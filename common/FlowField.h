@@ -0,0 +1,49 @@
+//
+// FlowField.h
+//
+
+#pragma once
+
+#include <DetourNavMesh.h>
+
+#include <cstdint>
+#include <vector>
+
+// The next polygon toward one destination for every polygon around it, from a
+// single search outward from the destination. Any number of characters headed
+// to the same place can take their path from the field instead of searching
+// for one each. Built by PolyPathSearch::BuildFlowField.
+class FlowField
+{
+public:
+	struct Cell
+	{
+		dtPolyRef ref;
+		dtPolyRef next;                // 0 at the destination
+		float cost;                    // to the destination
+	};
+
+	FlowField() = default;
+
+	void Clear();
+	bool IsEmpty() const { return m_cells.empty(); }
+
+	dtPolyRef GetDestinationRef() const { return m_destRef; }
+	const float* GetDestinationPos() const { return m_destPos; }
+
+	// ordered by ref
+	const std::vector<Cell>& GetCells() const { return m_cells; }
+	void SetCells(dtPolyRef destRef, const float* destPos, std::vector<Cell> cells);
+
+	const Cell* FindCell(dtPolyRef ref) const;
+
+	// the polygons from startRef to the destination, stopping early at endRef if
+	// the path goes through it. Returns the number of polygons, 0 if startRef is
+	// outside of the field.
+	int GetPath(dtPolyRef startRef, dtPolyRef endRef, dtPolyRef* path, int maxPath) const;
+
+private:
+	dtPolyRef m_destRef = 0;
+	float m_destPos[3] = { 0, 0, 0 };
+	std::vector<Cell> m_cells;
+};
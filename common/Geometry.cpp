@@ -0,0 +1,178 @@
+//
+// Geometry.cpp
+//
+
+#include "Geometry.h"
+
+#include <xmmintrin.h>
+
+#include <cfloat>
+#include <cmath>
+
+void GetPointDistances(const glm::vec3& pos, const float* x, const float* y, const float* z,
+	size_t count, bool distance3D, float* distances)
+{
+	const __m128 px = _mm_set1_ps(pos.x), py = _mm_set1_ps(pos.y), pz = _mm_set1_ps(pos.z);
+	const __m128 zscale = _mm_set1_ps(distance3D ? 1.0f : 0.0f);
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(&x[i]), px);
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(&y[i]), py);
+		__m128 dz = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&z[i]), pz), zscale);
+
+		__m128 distSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		_mm_storeu_ps(&distances[i], _mm_sqrt_ps(distSq));
+	}
+
+	for (; i < count; ++i)
+	{
+		float dx = x[i] - pos.x, dy = y[i] - pos.y, dz = distance3D ? z[i] - pos.z : 0.0f;
+		distances[i] = sqrtf(dx * dx + dy * dy + dz * dz);
+	}
+}
+
+int FindNearestPoint(const glm::vec3& pos, const float* x, const float* y, const float* z,
+	size_t count, float maxDistance, float zFilter, bool distance3D, float* distance)
+{
+	const __m128 px = _mm_set1_ps(pos.x), py = _mm_set1_ps(pos.y), pz = _mm_set1_ps(pos.z);
+	const __m128 zscale = _mm_set1_ps(distance3D ? 1.0f : 0.0f);
+	const __m128 zlimit = _mm_set1_ps(zFilter);
+
+	float bestDistSq = maxDistance < FLT_MAX ? maxDistance * maxDistance : FLT_MAX;
+	__m128 best = _mm_set1_ps(bestDistSq);
+	int bestIndex = -1;
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(&x[i]), px);
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(&y[i]), py);
+		__m128 dz = _mm_sub_ps(_mm_loadu_ps(&z[i]), pz);
+
+		__m128 dz3 = _mm_mul_ps(dz, zscale);
+		__m128 distSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz3, dz3));
+
+		__m128 closer = _mm_and_ps(_mm_cmplt_ps(distSq, best),
+			_mm_cmple_ps(_mm_max_ps(dz, _mm_sub_ps(_mm_setzero_ps(), dz)), zlimit));
+
+		int mask = _mm_movemask_ps(closer);
+		if (!mask)
+			continue;
+
+		float dist[4];
+		_mm_storeu_ps(dist, distSq);
+
+		for (int j = 0; j < 4; ++j)
+		{
+			if ((mask & (1 << j)) && dist[j] < bestDistSq)
+			{
+				bestDistSq = dist[j];
+				bestIndex = (int)i + j;
+			}
+		}
+
+		best = _mm_set1_ps(bestDistSq);
+	}
+
+	for (; i < count; ++i)
+	{
+		float dx = x[i] - pos.x, dy = y[i] - pos.y, dz = z[i] - pos.z;
+		float distSq = dx * dx + dy * dy + (distance3D ? dz * dz : 0.0f);
+
+		if (distSq < bestDistSq && fabsf(dz) <= zFilter)
+		{
+			bestDistSq = distSq;
+			bestIndex = (int)i;
+		}
+	}
+
+	if (distance && bestIndex >= 0)
+		*distance = sqrtf(bestDistSq);
+
+	return bestIndex;
+}
+
+void GetPointBounds(const glm::vec3* points, size_t count, glm::vec3& bmin, glm::vec3& bmax)
+{
+	if (count == 0)
+	{
+		bmin = bmax = glm::vec3();
+		return;
+	}
+
+	// one point per register, the fourth lane is unused
+	__m128 vmin = _mm_setr_ps(points[0].x, points[0].y, points[0].z, 0.0f);
+	__m128 vmax = vmin;
+
+	for (size_t i = 1; i < count; ++i)
+	{
+		__m128 v = _mm_setr_ps(points[i].x, points[i].y, points[i].z, 0.0f);
+		vmin = _mm_min_ps(vmin, v);
+		vmax = _mm_max_ps(vmax, v);
+	}
+
+	float result[4];
+	_mm_storeu_ps(result, vmin);
+	bmin = glm::vec3(result[0], result[1], result[2]);
+	_mm_storeu_ps(result, vmax);
+	bmax = glm::vec3(result[0], result[1], result[2]);
+}
+
+void GetPointsInPolygon(const float* x, const float* z, size_t count,
+	const glm::vec3* verts, size_t vertCount, uint8_t* inside)
+{
+	if (vertCount == 0)
+	{
+		for (size_t i = 0; i < count; ++i)
+			inside[i] = 0;
+		return;
+	}
+
+	// crossings along +x, an edge at a time for four points. Edges that are level
+	// with a point never pass the first check, so their division doesn't matter.
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		const __m128 px = _mm_loadu_ps(&x[i]);
+		const __m128 pz = _mm_loadu_ps(&z[i]);
+		__m128 c = _mm_setzero_ps();
+
+		for (size_t k = 0, l = vertCount - 1; k < vertCount; l = k++)
+		{
+			const glm::vec3& vi = verts[k];
+			const glm::vec3& vj = verts[l];
+
+			const __m128 viz = _mm_set1_ps(vi.z);
+			__m128 straddles = _mm_xor_ps(_mm_cmpgt_ps(viz, pz), _mm_cmpgt_ps(_mm_set1_ps(vj.z), pz));
+
+			__m128 crossX = _mm_add_ps(_mm_div_ps(_mm_mul_ps(_mm_set1_ps(vj.x - vi.x), _mm_sub_ps(pz, viz)),
+				_mm_set1_ps(vj.z - vi.z)), _mm_set1_ps(vi.x));
+
+			c = _mm_xor_ps(c, _mm_and_ps(straddles, _mm_cmplt_ps(px, crossX)));
+		}
+
+		int mask = _mm_movemask_ps(c);
+		for (int j = 0; j < 4; ++j)
+			inside[i + j] = (mask >> j) & 1;
+	}
+
+	for (; i < count; ++i)
+	{
+		bool c = false;
+		for (size_t k = 0, l = vertCount - 1; k < vertCount; l = k++)
+		{
+			const glm::vec3& vi = verts[k];
+			const glm::vec3& vj = verts[l];
+
+			if (((vi.z > z[i]) != (vj.z > z[i]))
+				&& (x[i] < (vj.x - vi.x) * (z[i] - vi.z) / (vj.z - vi.z) + vi.x))
+			{
+				c = !c;
+			}
+		}
+
+		inside[i] = c ? 1 : 0;
+	}
+}
@@ -0,0 +1,34 @@
+//
+// Geometry.h
+//
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+
+// Batch versions of the distance and bounds math that is done for every door,
+// item or polygon in a loop. Positions are passed as separate x, y and z arrays
+// and are worked on four at a time. Any count is fine, the ones left over at the
+// end are done one by one.
+
+// Distance from pos to each of the count points. Without distance3D the z
+// difference is left out.
+void GetPointDistances(const glm::vec3& pos, const float* x, const float* y, const float* z,
+	size_t count, bool distance3D, float* distances);
+
+// Index of the point closest to pos, within maxDistance and no further than
+// zFilter above or below it. Returns -1 if there is none, and the distance to
+// it in distance, if given.
+int FindNearestPoint(const glm::vec3& pos, const float* x, const float* y, const float* z,
+	size_t count, float maxDistance, float zFilter, bool distance3D, float* distance = nullptr);
+
+// Bounds of the count points. Both are zero if there are none.
+void GetPointBounds(const glm::vec3* points, size_t count, glm::vec3& bmin, glm::vec3& bmax);
+
+// Whether each of the count points is inside of the polygon on the xz plane,
+// same as dtPointInPolygon. 1 for the points that are, 0 for the rest.
+void GetPointsInPolygon(const float* x, const float* z, size_t count,
+	const glm::vec3* verts, size_t vertCount, uint8_t* inside);
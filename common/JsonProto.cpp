@@ -7,12 +7,16 @@
 #include <google/protobuf/descriptor.h>
 #include <google/protobuf/message.h>
 #include <rapidjson/document.h>
+#include <rapidjson/filewritestream.h>
 #include <rapidjson/prettywriter.h>
 #include <rapidjson/rapidjson.h>
 #include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
 
+#include <cstdio>
 #include <stdexcept>
+#include <unordered_map>
+#include <vector>
 
 inline std::string hex2bin(const std::string &s)
 {
@@ -36,14 +40,14 @@ inline std::string hex2bin(const std::string &s)
 		"\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80" // 0xe0
 		"\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80" // 0xf0
 		"";
-	std::string r;
-	r.reserve(s.size() / 2);
-	for (size_t i = 0; i < s.size(); i += 2) {
-		char hi = lookup[static_cast<unsigned char>(s[i])];
-		char lo = lookup[static_cast<unsigned char>(s[i + 1])];
+	std::string r(s.size() / 2, '\0');
+	const unsigned char* in = (const unsigned char*)s.data();
+	for (size_t i = 0; i < r.size(); ++i) {
+		char hi = lookup[in[i * 2]];
+		char lo = lookup[in[i * 2 + 1]];
 		if (0x80 & (hi | lo))
-			throw std::runtime_error("Invalid hex data: " + s.substr(i, 6));
-		r.push_back((hi << 4) | lo);
+			throw std::runtime_error("Invalid hex data: " + s.substr(i * 2, 6));
+		r[i] = (hi << 4) | lo;
 	}
 	return r;
 }
@@ -51,41 +55,52 @@ inline std::string hex2bin(const std::string &s)
 inline std::string bin2hex(const std::string &s)
 {
 	static const char lookup[] = "0123456789abcdef";
-	std::string r;
-	r.reserve(s.size() * 2);
+	std::string r(s.size() * 2, '\0');
 	for (size_t i = 0; i < s.size(); i++) {
-		unsigned char hi = s[i] >> 4;
-		unsigned char lo = s[i] & 0xf;
-		r.push_back(lookup[hi]);
-		r.push_back(lookup[lo]);
+		unsigned char c = s[i];
+		r[i * 2] = lookup[c >> 4];
+		r[i * 2 + 1] = lookup[c & 0xf];
 	}
 	return r;
 }
 
-inline std::string b64_encode(const std::string &s)
+inline size_t b64_encoded_size(size_t size)
+{
+	return (size + 2) / 3 * 4;
+}
+
+// encodes into out, which has room for b64_encoded_size(size) characters. Whole
+// groups of three bytes go through a branch-free loop, only the tail is special.
+inline void b64_encode(const uint8_t* data, size_t size, char* out)
 {
-	typedef unsigned char u1;
 	static const char lookup[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-	const u1 * data = (const u1 *)s.c_str();
-	std::string r;
-	r.reserve(s.size() * 4 / 3 + 3);
-	for (size_t i = 0; i < s.size(); i += 3) {
-		unsigned n = data[i] << 16;
-		if (i + 1 < s.size()) n |= data[i + 1] << 8;
-		if (i + 2 < s.size()) n |= data[i + 2];
-
-		u1 n0 = (u1)(n >> 18) & 0x3f;
-		u1 n1 = (u1)(n >> 12) & 0x3f;
-		u1 n2 = (u1)(n >> 6) & 0x3f;
-		u1 n3 = (u1)(n) & 0x3f;
-
-		r.push_back(lookup[n0]);
-		r.push_back(lookup[n1]);
-		if (i + 1 < s.size()) r.push_back(lookup[n2]);
-		if (i + 2 < s.size()) r.push_back(lookup[n3]);
+
+	const size_t whole = size - size % 3;
+	for (size_t i = 0; i < whole; i += 3, out += 4) {
+		uint32_t n = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+
+		out[0] = lookup[(n >> 18) & 0x3f];
+		out[1] = lookup[(n >> 12) & 0x3f];
+		out[2] = lookup[(n >> 6) & 0x3f];
+		out[3] = lookup[n & 0x3f];
+	}
+
+	if (size % 3) {
+		uint32_t n = data[whole] << 16;
+		if (size % 3 == 2) n |= data[whole + 1] << 8;
+
+		out[0] = lookup[(n >> 18) & 0x3f];
+		out[1] = lookup[(n >> 12) & 0x3f];
+		out[2] = size % 3 == 2 ? lookup[(n >> 6) & 0x3f] : '=';
+		out[3] = '=';
 	}
-	for (size_t i = 0; i < (3 - s.size() % 3) % 3; i++)
-		r.push_back('=');
+}
+
+inline std::string b64_encode(const std::string &s)
+{
+	std::string r(b64_encoded_size(s.size()), '\0');
+	if (!r.empty())
+		b64_encode((const uint8_t*)s.data(), s.size(), &r[0]);
 	return r;
 }
 
@@ -118,18 +133,32 @@ inline std::string b64_decode(const std::string &s)
 	if (s[s.size() - 1] == '=') pad++;
 	if (s[s.size() - 2] == '=') pad++;
 
-	r.reserve(s.size() * 3 / 4 + 3);
+	// sized up front, groups before the last one can't have padding so they
+	// decode straight into it.
+	r.resize(s.size() / 4 * 3 - pad);
+	const u1* in = (const u1*)s.data();
+	char* out = &r[0];
+
 	for (size_t i = 0; i < s.size(); i += 4) {
-		u1 n0 = lookup[(u1)s[i + 0]];
-		u1 n1 = lookup[(u1)s[i + 1]];
-		u1 n2 = lookup[(u1)s[i + 2]];
-		u1 n3 = lookup[(u1)s[i + 3]];
+		u1 n0 = lookup[in[i + 0]];
+		u1 n1 = lookup[in[i + 1]];
+		u1 n2 = lookup[in[i + 2]];
+		u1 n3 = lookup[in[i + 3]];
 		if (0x80 & (n0 | n1 | n2 | n3))
-			throw std::runtime_error("Invalid hex data: " + s.substr(i, 4));
+			throw std::runtime_error("Invalid base64 data: " + s.substr(i, 4));
 		unsigned n = (n0 << 18) | (n1 << 12) | (n2 << 6) | n3;
-		r.push_back((n >> 16) & 0xff);
-		if (s[i + 2] != '=') r.push_back((n >> 8) & 0xff);
-		if (s[i + 3] != '=') r.push_back((n) & 0xff);
+
+		if (i + 4 < s.size()) {
+			out[0] = (n >> 16) & 0xff;
+			out[1] = (n >> 8) & 0xff;
+			out[2] = n & 0xff;
+			out += 3;
+		}
+		else {
+			out[0] = (n >> 16) & 0xff;
+			if (pad < 2) out[1] = (n >> 8) & 0xff;
+			if (pad < 1) out[2] = n & 0xff;
+		}
 	}
 	return r;
 }
@@ -541,6 +570,191 @@ void ProtoToJsonString(const google::protobuf::Message* msg,
 	JsonToString(value, str, pretty);
 }
 
+//----------------------------------------------------------------------------
+
+namespace
+{
+	struct JsonFieldInfo
+	{
+		const google::protobuf::FieldDescriptor* field;
+		std::string name;
+		google::protobuf::FieldDescriptor::CppType cppType;
+		bool repeated;
+		bool bytes;
+	};
+
+	// Writes messages to a rapidjson writer as it goes. The fields of each message
+	// type are looked up once and reused for every message of that type.
+	template <typename Writer>
+	class ProtoJsonStreamer
+	{
+	public:
+		explicit ProtoJsonStreamer(Writer& writer) : m_writer(writer) {}
+
+		void WriteMessage(const google::protobuf::Message& msg)
+		{
+			const google::protobuf::Reflection* reflection = msg.GetReflection();
+
+			m_writer.StartObject();
+
+			for (const JsonFieldInfo& info : GetFields(msg.GetDescriptor()))
+			{
+				if (info.repeated)
+				{
+					int count = reflection->FieldSize(msg, info.field);
+					if (count == 0)
+						continue;
+
+					m_writer.Key(info.name.c_str(), static_cast<rapidjson::SizeType>(info.name.size()));
+					m_writer.StartArray();
+					for (int index = 0; index < count; ++index)
+						WriteValue(msg, reflection, info, index);
+					m_writer.EndArray();
+				}
+				else if (reflection->HasField(msg, info.field))
+				{
+					m_writer.Key(info.name.c_str(), static_cast<rapidjson::SizeType>(info.name.size()));
+					WriteValue(msg, reflection, info, -1);
+				}
+			}
+
+			m_writer.EndObject();
+		}
+
+	private:
+		const std::vector<JsonFieldInfo>& GetFields(const google::protobuf::Descriptor* descriptor)
+		{
+			auto iter = m_fields.find(descriptor);
+			if (iter != m_fields.end())
+				return iter->second;
+
+			std::vector<JsonFieldInfo>& fields = m_fields[descriptor];
+			fields.reserve(descriptor->field_count());
+
+			for (int index = 0; index < descriptor->field_count(); ++index)
+			{
+				const google::protobuf::FieldDescriptor* field = descriptor->field(index);
+
+				fields.push_back(JsonFieldInfo{ field, field->json_name(), field->cpp_type(),
+					field->is_repeated(), field->type() == google::protobuf::FieldDescriptor::TYPE_BYTES });
+			}
+
+			return fields;
+		}
+
+		// index is -1 for fields that aren't repeated
+		void WriteValue(const google::protobuf::Message& msg,
+			const google::protobuf::Reflection* reflection, const JsonFieldInfo& info, int index)
+		{
+			const google::protobuf::FieldDescriptor* field = info.field;
+			const bool single = index < 0;
+
+			switch (info.cppType)
+			{
+			case google::protobuf::FieldDescriptor::CPPTYPE_DOUBLE:
+				m_writer.Double(single ? reflection->GetDouble(msg, field)
+					: reflection->GetRepeatedDouble(msg, field, index));
+				break;
+			case google::protobuf::FieldDescriptor::CPPTYPE_FLOAT:
+				m_writer.Double(single ? reflection->GetFloat(msg, field)
+					: reflection->GetRepeatedFloat(msg, field, index));
+				break;
+			case google::protobuf::FieldDescriptor::CPPTYPE_INT64:
+				m_writer.Int64(single ? reflection->GetInt64(msg, field)
+					: reflection->GetRepeatedInt64(msg, field, index));
+				break;
+			case google::protobuf::FieldDescriptor::CPPTYPE_UINT64:
+				m_writer.Uint64(single ? reflection->GetUInt64(msg, field)
+					: reflection->GetRepeatedUInt64(msg, field, index));
+				break;
+			case google::protobuf::FieldDescriptor::CPPTYPE_INT32:
+				m_writer.Int(single ? reflection->GetInt32(msg, field)
+					: reflection->GetRepeatedInt32(msg, field, index));
+				break;
+			case google::protobuf::FieldDescriptor::CPPTYPE_UINT32:
+				m_writer.Uint(single ? reflection->GetUInt32(msg, field)
+					: reflection->GetRepeatedUInt32(msg, field, index));
+				break;
+			case google::protobuf::FieldDescriptor::CPPTYPE_BOOL:
+				m_writer.Bool(single ? reflection->GetBool(msg, field)
+					: reflection->GetRepeatedBool(msg, field, index));
+				break;
+			case google::protobuf::FieldDescriptor::CPPTYPE_STRING:
+			{
+				// references avoid copying tile data out of the message
+				std::string scratch;
+				const std::string& value = single
+					? reflection->GetStringReference(msg, field, &scratch)
+					: reflection->GetRepeatedStringReference(msg, field, index, &scratch);
+
+				if (info.bytes)
+					WriteBase64(value);
+				else
+					m_writer.String(value.c_str(), static_cast<rapidjson::SizeType>(value.size()));
+				break;
+			}
+			case google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE:
+				WriteMessage(single ? reflection->GetMessage(msg, field)
+					: reflection->GetRepeatedMessage(msg, field, index));
+				break;
+			case google::protobuf::FieldDescriptor::CPPTYPE_ENUM:
+				m_writer.Int(single ? reflection->GetEnum(msg, field)->number()
+					: reflection->GetRepeatedEnum(msg, field, index)->number());
+				break;
+			default:
+				m_writer.Null();
+				break;
+			}
+		}
+
+		// base64 never needs escaping, so it is written as a raw value from a
+		// buffer that is reused between fields.
+		void WriteBase64(const std::string& value)
+		{
+			m_buffer.resize(b64_encoded_size(value.size()) + 2);
+			m_buffer.front() = '"';
+			b64_encode((const uint8_t*)value.data(), value.size(), &m_buffer[1]);
+			m_buffer.back() = '"';
+
+			m_writer.RawValue(m_buffer.data(), m_buffer.size(), rapidjson::kStringType);
+		}
+
+		Writer& m_writer;
+		std::unordered_map<const google::protobuf::Descriptor*, std::vector<JsonFieldInfo>> m_fields;
+		std::vector<char> m_buffer;
+	};
+}
+
+bool ProtoToJsonFile(const google::protobuf::Message* msg, const std::string& filename,
+	bool pretty /* = false */)
+{
+	FILE* file = nullptr;
+	if (fopen_s(&file, filename.c_str(), "wb") != 0 || !file)
+		return false;
+
+	std::vector<char> buffer(64 * 1024);
+	rapidjson::FileWriteStream stream(file, buffer.data(), buffer.size());
+
+	if (pretty)
+	{
+		rapidjson::PrettyWriter<rapidjson::FileWriteStream> writer(stream);
+		writer.SetIndent(' ', 2);
+		ProtoJsonStreamer<rapidjson::PrettyWriter<rapidjson::FileWriteStream>>(writer).WriteMessage(*msg);
+	}
+	else
+	{
+		rapidjson::Writer<rapidjson::FileWriteStream> writer(stream);
+		ProtoJsonStreamer<rapidjson::Writer<rapidjson::FileWriteStream>>(writer).WriteMessage(*msg);
+	}
+
+	stream.Flush();
+
+	bool success = !ferror(file);
+	success = fclose(file) == 0 && success;
+
+	return success;
+}
+
 bool JsonToProto(const rapidjson::Value* json, google::protobuf::Message* msg)
 {
 	std::string errorMessage;
@@ -19,5 +19,11 @@ namespace google {
 void ProtoToJsonString(const google::protobuf::Message* msg, std::string& str,
 	bool pretty = false);
 
+// Write protobuf as json straight to a file, without building a document or a
+// string of the whole message first. Field names are the json names that
+// protobuf's own json support uses. Returns false if the file couldn't be written.
+bool ProtoToJsonFile(const google::protobuf::Message* msg, const std::string& filename,
+	bool pretty = false);
+
 // Convert json object to protobuf
 bool JsonToProto(const rapidjson::Value* json, google::protobuf::Message* msg);
@@ -0,0 +1,435 @@
+//
+// LandmarkTable.cpp
+//
+
+#include "LandmarkTable.h"
+#include "NavMeshData.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <functional>
+#include <future>
+#include <queue>
+#include <unordered_map>
+
+// most landmarks that a table can have
+static const int MAX_LANDMARKS = 32;
+
+const uint16_t LandmarkTable::UNREACHABLE;
+
+//============================================================================
+
+namespace {
+
+// the midpoints of the edges between polygons, joined to the other edges of the
+// polygons on either side.
+struct PortalGraph
+{
+	std::vector<glm::vec3> positions;
+
+	// the links of portal i are in [offsets[i], offsets[i + 1])
+	std::vector<uint32_t> offsets;
+	std::vector<uint32_t> neighbors;
+	std::vector<float> weights;
+};
+
+std::vector<float> MeasureDistances(const PortalGraph& graph, const std::vector<uint32_t>& sources)
+{
+	std::vector<float> distances(graph.positions.size(), FLT_MAX);
+
+	using OpenEntry = std::pair<float, uint32_t>;
+	std::priority_queue<OpenEntry, std::vector<OpenEntry>, std::greater<OpenEntry>> open;
+
+	for (uint32_t source : sources)
+	{
+		distances[source] = 0.0f;
+		open.emplace(0.0f, source);
+	}
+
+	while (!open.empty())
+	{
+		float dist = open.top().first;
+		uint32_t current = open.top().second;
+		open.pop();
+
+		if (dist > distances[current])
+			continue;
+
+		for (uint32_t i = graph.offsets[current]; i < graph.offsets[current + 1]; ++i)
+		{
+			uint32_t neighbor = graph.neighbors[i];
+			float cost = dist + graph.weights[i];
+
+			if (cost < distances[neighbor])
+			{
+				distances[neighbor] = cost;
+				open.emplace(cost, neighbor);
+			}
+		}
+	}
+
+	return distances;
+}
+
+// where a path crosses from one polygon to the other, as detour places it
+glm::vec3 GetPortalPosition(const dtMeshTile* tile, const dtPoly* poly, const dtLink& link,
+	const dtMeshTile* otherTile, const dtPoly* otherPoly, dtPolyRef ref)
+{
+	if (poly->getType() == DT_POLYTYPE_OFFMESH_CONNECTION)
+		return glm::make_vec3(&tile->verts[poly->verts[link.edge] * 3]);
+
+	if (otherPoly->getType() == DT_POLYTYPE_OFFMESH_CONNECTION)
+	{
+		for (unsigned int i = otherPoly->firstLink; i != DT_NULL_LINK; i = otherTile->links[i].next)
+		{
+			if (otherTile->links[i].ref == ref)
+				return glm::make_vec3(&otherTile->verts[otherPoly->verts[otherTile->links[i].edge] * 3]);
+		}
+	}
+
+	glm::vec3 va = glm::make_vec3(&tile->verts[poly->verts[link.edge] * 3]);
+	glm::vec3 vb = glm::make_vec3(&tile->verts[poly->verts[(link.edge + 1) % poly->vertCount] * 3]);
+
+	// at tile borders only part of the edge is shared
+	float tmin = 0.0f, tmax = 1.0f;
+	if (link.side != 0xff)
+	{
+		tmin = link.bmin / 255.0f;
+		tmax = link.bmax / 255.0f;
+	}
+
+	return glm::mix(va, vb, (tmin + tmax) * 0.5f);
+}
+
+} // namespace
+
+void LandmarkTable::Clear()
+{
+	m_landmarks.clear();
+	m_scale = 0.0f;
+	m_tiles.clear();
+	m_tilesByKey.clear();
+}
+
+void LandmarkTable::SetLandmarks(std::vector<glm::vec3> landmarks, float scale)
+{
+	m_landmarks = std::move(landmarks);
+	m_scale = scale;
+}
+
+void LandmarkTable::AddTile(Tile tile)
+{
+	if (tile.polyCount <= 0
+		|| tile.distances.size() != (size_t)tile.polyCount * m_landmarks.size() * 2)
+	{
+		return;
+	}
+
+	uint64_t key = TileKey(tile.x, tile.y, tile.layer);
+	if (m_tilesByKey.find(key) != m_tilesByKey.end())
+		return;
+
+	m_tilesByKey.emplace(key, static_cast<uint32_t>(m_tiles.size()));
+	m_tiles.push_back(std::move(tile));
+}
+
+const uint16_t* LandmarkTable::GetDistances(const dtMeshTile* tile, int polyIndex) const
+{
+	if (!tile || !tile->header)
+		return nullptr;
+
+	auto iter = m_tilesByKey.find(TileKey(tile->header->x, tile->header->y, tile->header->layer));
+	if (iter == m_tilesByKey.end())
+		return nullptr;
+
+	const Tile& entry = m_tiles[iter->second];
+	if (entry.polyCount != tile->header->polyCount || polyIndex < 0 || polyIndex >= entry.polyCount)
+		return nullptr;
+
+	return &entry.distances[polyIndex * m_landmarks.size() * 2];
+}
+
+float LandmarkTable::GetLowerBound(const uint16_t* a, const uint16_t* b) const
+{
+	int best = 0;
+
+	for (size_t i = 0; i < m_landmarks.size() * 2; i += 2)
+	{
+		if (a[i] == UNREACHABLE || b[i] == UNREACHABLE)
+			continue;
+
+		// the path leaves one polygon by some edge and enters the other by some
+		// edge. Each side may have been rounded by half a step.
+		int diff = std::max((int)b[i] - (int)a[i + 1], (int)a[i] - (int)b[i + 1]) - 1;
+		best = std::max(best, diff);
+	}
+
+	return best * m_scale;
+}
+
+//----------------------------------------------------------------------------
+
+void LandmarkTable::Build(const dtNavMesh& navMesh, int landmarkCount)
+{
+	Clear();
+
+	landmarkCount = std::min(landmarkCount, MAX_LANDMARKS);
+	if (landmarkCount <= 0)
+		return;
+
+	// number the polygons of every tile, leaving out the disabled ones. They're
+	// numbered in tile order, the landmarks picked don't depend on the slots the
+	// tiles were added to.
+	std::vector<uint32_t> firstPoly(navMesh.getMaxTiles(), 0);
+	std::vector<int32_t> polyIds;
+	std::vector<glm::vec3> centers;
+
+	const uint32_t NO_POLY = UINT32_MAX;
+
+	std::vector<const dtMeshTile*> tiles = GetTilesInOrder(navMesh);
+	auto slotOf = [&navMesh](const dtMeshTile* tile)
+	{
+		return navMesh.decodePolyIdTile(navMesh.getTileRef(tile));
+	};
+
+	for (const dtMeshTile* tile : tiles)
+	{
+		firstPoly[slotOf(tile)] = static_cast<uint32_t>(polyIds.size());
+
+		for (int j = 0; j < tile->header->polyCount; ++j)
+		{
+			const dtPoly& poly = tile->polys[j];
+			if (poly.flags & +PolyFlags::Disabled)
+			{
+				polyIds.push_back(-1);
+				continue;
+			}
+
+			glm::vec3 center(0.0f);
+			for (int k = 0; k < poly.vertCount; ++k)
+				center += glm::make_vec3(&tile->verts[poly.verts[k] * 3]);
+			center /= static_cast<float>(std::max<int>(poly.vertCount, 1));
+
+			polyIds.push_back(static_cast<int32_t>(centers.size()));
+			centers.push_back(center);
+		}
+	}
+
+	if (centers.empty())
+		return;
+
+	auto findPoly = [&](dtPolyRef ref)
+	{
+		unsigned int salt, tileIndex, polyIndex;
+		navMesh.decodePolyId(ref, salt, tileIndex, polyIndex);
+
+		if (tileIndex >= firstPoly.size())
+			return NO_POLY;
+
+		const dtMeshTile* tile = navMesh.getTile(tileIndex);
+		if (!tile || !tile->header || (int)polyIndex >= tile->header->polyCount)
+			return NO_POLY;
+
+		int32_t id = polyIds[firstPoly[tileIndex] + polyIndex];
+		return id < 0 ? NO_POLY : static_cast<uint32_t>(id);
+	};
+
+	// one portal for each pair of linked polygons. Links are taken both ways, so
+	// one-way connections can only make the bound looser, never too large.
+	PortalGraph graph;
+	std::unordered_map<uint64_t, uint32_t> portalsByPolys;
+	std::vector<std::vector<uint32_t>> polyPortals(centers.size());
+
+	for (const dtMeshTile* tile : tiles)
+	{
+		const unsigned int i = slotOf(tile);
+
+		for (int j = 0; j < tile->header->polyCount; ++j)
+		{
+			int32_t id = polyIds[firstPoly[i] + j];
+			if (id < 0)
+				continue;
+
+			const dtPoly* poly = &tile->polys[j];
+			dtPolyRef ref = navMesh.getPolyRefBase(tile) | (dtPolyRef)j;
+
+			for (unsigned int k = poly->firstLink; k != DT_NULL_LINK; k = tile->links[k].next)
+			{
+				const dtLink& link = tile->links[k];
+
+				uint32_t other = findPoly(link.ref);
+				if (other == NO_POLY || other == (uint32_t)id)
+					continue;
+
+				uint64_t key = ((uint64_t)std::min<uint32_t>(id, other) << 32) | std::max<uint32_t>(id, other);
+				if (portalsByPolys.find(key) != portalsByPolys.end())
+					continue;
+
+				const dtMeshTile* otherTile = nullptr;
+				const dtPoly* otherPoly = nullptr;
+				navMesh.getTileAndPolyByRefUnsafe(link.ref, &otherTile, &otherPoly);
+
+				uint32_t portal = static_cast<uint32_t>(graph.positions.size());
+				graph.positions.push_back(GetPortalPosition(tile, poly, link, otherTile, otherPoly, ref));
+				portalsByPolys.emplace(key, portal);
+
+				polyPortals[id].push_back(portal);
+				polyPortals[other].push_back(portal);
+			}
+		}
+	}
+
+	portalsByPolys.clear();
+
+	if (graph.positions.empty())
+		return;
+
+	// paths cross a polygon from one of its portals to another
+	std::vector<std::vector<std::pair<uint32_t, float>>> adjacency(graph.positions.size());
+
+	for (const std::vector<uint32_t>& portals : polyPortals)
+	{
+		for (size_t a = 0; a < portals.size(); ++a)
+		{
+			for (size_t b = a + 1; b < portals.size(); ++b)
+			{
+				float dist = glm::distance(graph.positions[portals[a]], graph.positions[portals[b]]);
+				adjacency[portals[a]].emplace_back(portals[b], dist);
+				adjacency[portals[b]].emplace_back(portals[a], dist);
+			}
+		}
+	}
+
+	graph.offsets.reserve(graph.positions.size() + 1);
+	graph.offsets.push_back(0);
+
+	for (const auto& links : adjacency)
+	{
+		for (const auto& link : links)
+		{
+			graph.neighbors.push_back(link.first);
+			graph.weights.push_back(link.second);
+		}
+
+		graph.offsets.push_back(static_cast<uint32_t>(graph.neighbors.size()));
+	}
+
+	adjacency.clear();
+	adjacency.shrink_to_fit();
+
+	// spread the landmarks out: each one is the polygon farthest from the ones
+	// picked so far. Polygons without links are never picked.
+	std::vector<uint32_t> sources;
+	std::vector<float> closest(centers.size(), FLT_MAX);
+	glm::vec3 from = centers[0];
+
+	for (int i = 0; i < landmarkCount; ++i)
+	{
+		uint32_t best = NO_POLY;
+		float bestDist = -1.0f;
+
+		for (uint32_t j = 0; j < centers.size(); ++j)
+		{
+			if (polyPortals[j].empty())
+				continue;
+
+			closest[j] = std::min(closest[j], glm::distance(centers[j], from));
+			if (closest[j] > bestDist)
+			{
+				bestDist = closest[j];
+				best = j;
+			}
+		}
+
+		if (best == NO_POLY || bestDist <= 0.0f)
+			break;
+
+		sources.push_back(best);
+		from = centers[best];
+	}
+
+	if (sources.empty())
+		return;
+
+	std::vector<std::future<std::vector<float>>> searches;
+	for (uint32_t source : sources)
+	{
+		searches.push_back(std::async(std::launch::async, MeasureDistances,
+			std::cref(graph), std::cref(polyPortals[source])));
+	}
+
+	std::vector<std::vector<float>> distances;
+	float maxDist = 0.0f;
+
+	for (auto& search : searches)
+	{
+		distances.push_back(search.get());
+
+		for (float dist : distances.back())
+		{
+			if (dist != FLT_MAX)
+				maxDist = std::max(maxDist, dist);
+		}
+	}
+
+	const size_t count = sources.size();
+
+	std::vector<glm::vec3> landmarks;
+	for (uint32_t source : sources)
+		landmarks.push_back(centers[source]);
+
+	SetLandmarks(std::move(landmarks), std::max(maxDist / (UNREACHABLE - 1), FLT_EPSILON));
+
+	auto quantize = [&](float dist)
+	{
+		float steps = std::min(std::round(dist / m_scale), (float)(UNREACHABLE - 1));
+		return static_cast<uint16_t>(steps);
+	};
+
+	for (const dtMeshTile* tile : tiles)
+	{
+		const unsigned int i = slotOf(tile);
+		if (tile->header->polyCount == 0)
+			continue;
+
+		Tile entry;
+		entry.x = tile->header->x;
+		entry.y = tile->header->y;
+		entry.layer = tile->header->layer;
+		entry.polyCount = tile->header->polyCount;
+		entry.distances.resize(entry.polyCount * count * 2, UNREACHABLE);
+
+		for (int j = 0; j < entry.polyCount; ++j)
+		{
+			int32_t id = polyIds[firstPoly[i] + j];
+			if (id < 0)
+				continue;
+
+			for (size_t k = 0; k < count; ++k)
+			{
+				float nearest = FLT_MAX, farthest = 0.0f;
+
+				for (uint32_t portal : polyPortals[id])
+				{
+					float dist = distances[k][portal];
+					if (dist == FLT_MAX)
+						continue;
+
+					nearest = std::min(nearest, dist);
+					farthest = std::max(farthest, dist);
+				}
+
+				if (nearest == FLT_MAX)
+					continue;
+
+				entry.distances[(j * count + k) * 2] = quantize(nearest);
+				entry.distances[(j * count + k) * 2 + 1] = quantize(farthest);
+			}
+		}
+
+		AddTile(std::move(entry));
+	}
+}
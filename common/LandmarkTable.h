@@ -0,0 +1,79 @@
+//
+// LandmarkTable.h
+//
+
+#pragma once
+
+#include <DetourNavMesh.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Distances from a few landmark polygons to every polygon of the mesh, for the
+// ALT heuristic: by the triangle inequality, the distance between two polygons
+// is at least the difference of their distances to any landmark. In maze-like
+// zones this is a much tighter bound than the straight line, so searches visit
+// far fewer nodes.
+//
+// Searches move between the midpoints of the edges that polygons share, so the
+// distances are measured over those midpoints, with disabled polygons left out.
+// Each polygon keeps the nearest and farthest of its edges from every landmark,
+// quantized to 16 bits, which keeps the bound below the real cost.
+class LandmarkTable
+{
+public:
+	struct Tile
+	{
+		int x = 0;
+		int y = 0;
+		int layer = 0;
+		int polyCount = 0;
+
+		// polyCount rows of a nearest and farthest distance per landmark
+		std::vector<uint16_t> distances;
+	};
+
+	// polygons that a landmark can't reach
+	static const uint16_t UNREACHABLE = 0xffff;
+
+	LandmarkTable() = default;
+
+	// picks landmarkCount landmarks spread over the mesh, and measures the
+	// distance from each of them to every polygon, one landmark per thread.
+	void Build(const dtNavMesh& navMesh, int landmarkCount);
+	void Clear();
+
+	bool IsEmpty() const { return m_tiles.empty(); }
+
+	int GetLandmarkCount() const { return static_cast<int>(m_landmarks.size()); }
+	const std::vector<glm::vec3>& GetLandmarks() const { return m_landmarks; }
+	const std::vector<Tile>& GetTiles() const { return m_tiles; }
+
+	// world units per quantized step
+	float GetScale() const { return m_scale; }
+
+	// used when loading the table from a file.
+	void SetLandmarks(std::vector<glm::vec3> landmarks, float scale);
+	void AddTile(Tile tile);
+
+	// the distances of a polygon, two per landmark, or null if its tile isn't in
+	// the table or has changed since.
+	const uint16_t* GetDistances(const dtMeshTile* tile, int polyIndex) const;
+
+	// lower bound on the distance between the polygons with these distances
+	float GetLowerBound(const uint16_t* a, const uint16_t* b) const;
+
+private:
+	static uint64_t TileKey(int x, int y, int layer)
+	{
+		return ((uint64_t)(uint32_t)x << 32) | ((uint64_t)(uint16_t)y << 16) | (uint16_t)layer;
+	}
+
+	std::vector<glm::vec3> m_landmarks;
+	float m_scale = 0.0f;
+
+	std::vector<Tile> m_tiles;
+	std::unordered_map<uint64_t, uint32_t> m_tilesByKey;
+};
@@ -0,0 +1,37 @@
+//
+// MappedFile.h
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Read-only view of a file mapped into memory. Pages are mapped copy-on-write
+// so that callers may modify the view in place (detour patches tile data when
+// a tile is added) without touching the file on disk, and only pages that are
+// actually written to are backed by private memory.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// map the given file. Returns false if the file could not be opened or mapped.
+	bool Open(const std::string& filename);
+	void Close();
+
+	bool IsOpen() const { return m_data != nullptr; }
+
+	uint8_t* GetData() const { return m_data; }
+	size_t GetSize() const { return m_size; }
+
+private:
+	void* m_file = nullptr;
+	void* m_mapping = nullptr;
+	uint8_t* m_data = nullptr;
+	size_t m_size = 0;
+};
@@ -4,10 +4,17 @@
 
 #include "NavMesh.h"
 #include "common/Enum.h"
+#include "common/Geometry.h"
 #include "common/JsonProto.h"
+#include "common/MappedFile.h"
+#include "common/NavMeshTileCache.h"
+#include "common/NavMeshTilePacking.h"
+#include "common/Profiler.h"
+#include "common/SharedMemory.h"
 #include "common/Utilities.h"
 #include "common/proto/NavMeshFile.pb.h"
 
+#include <google/protobuf/arena.h>
 #include <google/protobuf/io/zero_copy_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
 #include <google/protobuf/util/json_util.h>
@@ -19,13 +26,35 @@
 #include <DetourCommon.h>
 #include <DetourNavMesh.h>
 #include <DetourNavMeshQuery.h>
+#include <DetourNode.h>
 #include <Recast.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <fstream>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <tuple>
 #include <boost/filesystem.hpp>
 
 namespace fs = boost::filesystem;
 
+// mesh files keep tile refs, and the shared memory between clients keeps poly
+// refs, in the 64 bit layout. The plugin and meshgen both have to be built with
+// DT_POLYREF64 to read them.
+static_assert(sizeof(dtPolyRef) == sizeof(uint64_t) && sizeof(dtTileRef) == sizeof(uint64_t),
+	"Detour must be built with DT_POLYREF64");
+
+using stats_clock = std::chrono::steady_clock;
+
+static double MillisecondsSince(stats_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(stats_clock::now() - start).count();
+}
+
 //============================================================================
 
 NavMesh::NavMesh(Context* context, const std::string& dataFolder, const std::string& zoneName)
@@ -35,6 +64,42 @@ NavMesh::NavMesh(Context* context, const std::string& dataFolder, const std::str
 {
 	UpdateDataFile();
 	InitializeAreas();
+
+	// cached paths refer to polygons, so they go away with the navmesh.
+	m_pathCacheConn = OnNavMeshChanged.Connect([this]() { InvalidatePathCache(); });
+	m_pathCacheTilesConn = OnNavMeshTilesChanged.Connect([this]() { InvalidatePathCache(); });
+
+	// refs of tiles that changed are dropped when the heatmap is drawn
+	m_queryHeatmapConn = OnNavMeshChanged.Connect([this]() { m_queryHeatmap.Clear(); });
+
+	// switched off areas have to be switched off in new tiles before anyone
+	// else sees them. Nothing to do until an area is switched.
+	m_areaIndexConn = OnNavMeshChanged.Connect([this]()
+	{
+		ResetAreaIndex();
+		if (m_disabledAreas)
+			UpdateAreaIndex();
+	});
+	m_areaIndexTilesConn = OnNavMeshTilesChanged.Connect([this]()
+	{
+		if (m_disabledAreas)
+			UpdateAreaIndex();
+	});
+
+	// same for runtime volumes, after the area index is up to date
+	m_runtimeVolumeConn = OnNavMeshChanged.Connect([this]()
+	{
+		for (RuntimeVolume& runtimeVolume : m_runtimeVolumes)
+		{
+			runtimeVolume.polys.clear();
+			PaintRuntimeVolume(runtimeVolume);
+		}
+	});
+	m_runtimeVolumeTilesConn = OnNavMeshTilesChanged.Connect([this]()
+	{
+		for (RuntimeVolume& runtimeVolume : m_runtimeVolumes)
+			PaintRuntimeVolume(runtimeVolume);
+	});
 }
 
 NavMesh::~NavMesh()
@@ -48,8 +113,17 @@ void NavMesh::SetZoneName(const std::string& zoneShortName)
 	if (m_zoneName == zoneShortName)
 		return;
 
+	m_disabledAreas = 0;
+	m_runtimeVolumes.clear();
 	ResetNavMesh();
 
+	// the budget grown in the zone we're leaving is picked up again if we come back
+	if (!m_zoneName.empty() && m_grownNodeBudget)
+		m_grownNodeBudgets[m_zoneName] = m_grownNodeBudget;
+
+	auto grown = m_grownNodeBudgets.find(zoneShortName);
+	m_grownNodeBudget = grown != m_grownNodeBudgets.end() ? grown->second : 0;
+
 	if (zoneShortName.empty() || zoneShortName == "UNKNOWN_ZONE")
 	{
 		m_zoneName.clear();
@@ -97,6 +171,8 @@ void NavMesh::SetNavMesh(const std::shared_ptr<dtNavMesh>& navMesh, bool reset)
 	if (navMesh == m_navMesh)
 		return;
 
+	auto lock = BeginTileChange();
+
 	if (reset)
 	{
 		ResetSavedData();
@@ -104,21 +180,42 @@ void NavMesh::SetNavMesh(const std::shared_ptr<dtNavMesh>& navMesh, bool reset)
 
 	m_navMesh = navMesh;
 	m_navMeshQuery.reset();
+	m_mappedFile.reset();
+	m_patchedFiles.clear();
+	m_tileIndex.clear();
+	m_sharedTiles.reset();
+	m_sharedTileOffsets.clear();
+	m_tileBuildHashes.clear();
+	m_agentNavMeshes.clear();
+	m_loadedAgentProfile.clear();
 	m_lastLoadResult = LoadResult::None;
 }
 
 void NavMesh::ResetSavedData(PersistedDataFields fields)
 {
+	auto lock = BeginTileChange();
+
 	if (+(fields & PersistedDataFields::BuildSettings))
 	{
 		m_boundsMin = m_boundsMax = glm::vec3();
 		m_config = NavMeshConfig{};
+		m_buildSourceHash = 0;
+		m_buildTime = 0;
+		m_savedNodeBudget = 0;
 	}
 
 	if (+(fields & PersistedDataFields::MeshTiles))
 	{
 		m_navMesh.reset();
 		m_navMeshQuery.reset();
+		m_mappedFile.reset();
+		m_patchedFiles.clear();
+		m_tileIndex.clear();
+		m_sharedTiles.reset();
+		m_sharedTileOffsets.clear();
+		m_tileBuildHashes.clear();
+		m_agentNavMeshes.clear();
+		m_loadedAgentProfile.clear();
 	}
 
 	if (+(fields & PersistedDataFields::AreaTypes))
@@ -126,10 +223,32 @@ void NavMesh::ResetSavedData(PersistedDataFields fields)
 		InitializeAreas();
 	}
 
+	if (+(fields & PersistedDataFields::TileGraph))
+	{
+		m_tileGraph.Clear();
+	}
+
+	if (+(fields & PersistedDataFields::Landmarks))
+	{
+		m_landmarks.Clear();
+	}
+
+	if (+(fields & PersistedDataFields::PruneSet))
+	{
+		m_prunedTiles.clear();
+		m_pruneSeeds.clear();
+	}
+
+	if (+(fields & PersistedDataFields::TileCache))
+	{
+		m_tileCache.reset();
+	}
+
 	if (+(fields & PersistedDataFields::ConvexVolumes))
 	{
 		m_volumes.clear();
 		m_volumesById.clear();
+		m_volumeBuckets.clear();
 		m_nextVolumeId = 1;
 	}
 }
@@ -150,7 +269,8 @@ std::shared_ptr<dtNavMeshQuery> NavMesh::GetNavMeshQuery()
 			auto query = std::shared_ptr<dtNavMeshQuery>(dtAllocNavMeshQuery(),
 				[](dtNavMeshQuery* ptr) { dtFreeNavMeshQuery(ptr); });
 
-			dtStatus status = query->init(m_navMesh.get(), NAVMESH_QUERY_MAX_NODES);
+			dtStatus status = query->init(m_navMesh.get(),
+				std::min(NAVMESH_QUERY_MAX_NODES, GetQueryNodeBudget()));
 			if (dtStatusFailed(status))
 			{
 				m_ctx->Log(LogLevel::ERROR, "GetNavMeshQuery: Could not init detour navmesh query");
@@ -165,499 +285,3132 @@ std::shared_ptr<dtNavMeshQuery> NavMesh::GetNavMeshQuery()
 	return m_navMeshQuery;
 }
 
-void NavMesh::SetNavMeshBounds(const glm::vec3& min, const glm::vec3& max)
+// maximum number of idle queries kept around
+static const size_t MAX_POOLED_QUERIES = 8;
+
+NavMesh::QueryPool::~QueryPool()
 {
-	m_boundsMin = min;
-	m_boundsMax = max;
+	for (dtNavMeshQuery* query : queries)
+		dtFreeNavMeshQuery(query);
 }
 
-void NavMesh::GetNavMeshBounds(glm::vec3& min, glm::vec3& max)
+std::shared_ptr<dtNavMeshQuery> NavMesh::AcquireNavMeshQuery(int maxNodes)
 {
-	min = m_boundsMin;
-	max = m_boundsMax;
+	if (!m_navMesh)
+		return nullptr;
+
+	if (maxNodes <= 0)
+		maxNodes = std::min(NAVMESH_QUERY_MAX_NODES, GetQueryNodeBudget());
+	maxNodes = std::min(maxNodes, NAVMESH_MAX_NODE_BUDGET);
+
+	if (!m_queryPool || m_queryPool->navMesh.lock() != m_navMesh)
+	{
+		m_queryPool = std::make_shared<QueryPool>();
+		m_queryPool->navMesh = m_navMesh;
+	}
+
+	dtNavMeshQuery* query = nullptr;
+
+	auto& queries = m_queryPool->queries;
+	auto iter = std::find_if(queries.begin(), queries.end(),
+		[maxNodes](dtNavMeshQuery* q) { return q->getNodePool()->getMaxNodes() >= maxNodes; });
+	if (iter != queries.end())
+	{
+		query = *iter;
+		queries.erase(iter);
+	}
+	else
+	{
+		query = dtAllocNavMeshQuery();
+
+		dtStatus status = query->init(m_navMesh.get(), maxNodes);
+		if (dtStatusFailed(status))
+		{
+			m_ctx->Log(LogLevel::ERROR, "AcquireNavMeshQuery: Could not init detour navmesh query");
+			dtFreeNavMeshQuery(query);
+			return nullptr;
+		}
+	}
+
+	// the handle keeps the navmesh alive for as long as the query is in use.
+	std::weak_ptr<QueryPool> weakPool = m_queryPool;
+	std::shared_ptr<dtNavMesh> navMesh = m_navMesh;
+
+	return std::shared_ptr<dtNavMeshQuery>(query,
+		[weakPool, navMesh](dtNavMeshQuery* query)
+	{
+		auto pool = weakPool.lock();
+		if (pool && pool->queries.size() < MAX_POOLED_QUERIES)
+			pool->queries.push_back(query);
+		else
+			dtFreeNavMeshQuery(query);
+	});
 }
 
-//----------------------------------------------------------------------------
+// a search across the mesh opens about this many polygons for each polygon along
+// its path, going around whatever is between the two ends
+static const int NODE_BUDGET_PER_HOP = 16;
 
-static void ToProto(nav::vector3& out_proto, const glm::vec3& v3)
+// The node budget for searches across the largest connected part of the mesh.
+// Its diameter, in polygons, is found by a breadth first search from any of its
+// polygons and another one from the furthest polygon that one reached. A search
+// never needs more nodes than there are polygons in the part.
+static int ComputeQueryNodeBudget(const dtNavMesh* navMesh)
 {
-	out_proto.set_x(v3.x);
-	out_proto.set_y(v3.y);
-	out_proto.set_z(v3.z);
+	if (!navMesh)
+		return 0;
+
+	const int maxTiles = navMesh->getMaxTiles();
+
+	// every polygon, numbered from the first polygon of each tile
+	std::vector<uint32_t> firstPoly(maxTiles, 0);
+	uint32_t polyCount = 0;
+
+	for (int i = 0; i < maxTiles; ++i)
+	{
+		const dtMeshTile* tile = navMesh->getTile(i);
+		firstPoly[i] = polyCount;
+
+		if (tile && tile->header)
+			polyCount += tile->header->polyCount;
+	}
+
+	if (polyCount == 0)
+		return 0;
+
+	std::vector<int> depth(polyCount, -1);
+	std::vector<uint32_t> open;
+
+	// visits everything connected to start that isn't labeled with a depth yet,
+	// returns the furthest polygon and fills in how far it is and how many there are
+	auto search = [&](uint32_t start, int& furthestDepth, uint32_t& count)
+	{
+		open.clear();
+		open.push_back(start);
+		depth[start] = 0;
+
+		uint32_t furthest = start;
+		furthestDepth = 0;
+
+		for (size_t next = 0; next < open.size(); ++next)
+		{
+			uint32_t index = open[next];
+			if (depth[index] > furthestDepth)
+			{
+				furthest = index;
+				furthestDepth = depth[index];
+			}
+
+			int tileIndex = static_cast<int>(std::upper_bound(firstPoly.begin(), firstPoly.end(), index)
+				- firstPoly.begin()) - 1;
+			const dtMeshTile* tile = navMesh->getTile(tileIndex);
+			const dtPoly& poly = tile->polys[index - firstPoly[tileIndex]];
+
+			for (unsigned int link = poly.firstLink; link != DT_NULL_LINK; link = tile->links[link].next)
+			{
+				dtPolyRef ref = tile->links[link].ref;
+				if (!ref)
+					continue;
+
+				uint32_t neighbour = firstPoly[navMesh->decodePolyIdTile(ref)] + navMesh->decodePolyIdPoly(ref);
+				if (depth[neighbour] < 0)
+				{
+					depth[neighbour] = depth[index] + 1;
+					open.push_back(neighbour);
+				}
+			}
+		}
+
+		count = static_cast<uint32_t>(open.size());
+		return furthest;
+	};
+
+	// the largest part, and one of the polygons at the end of it
+	uint32_t largestCount = 0;
+	uint32_t largestEnd = 0;
+
+	for (uint32_t i = 0; i < polyCount; ++i)
+	{
+		if (depth[i] >= 0)
+			continue;
+
+		int furthestDepth;
+		uint32_t count;
+		uint32_t furthest = search(i, furthestDepth, count);
+
+		if (count > largestCount)
+		{
+			largestCount = count;
+			largestEnd = furthest;
+		}
+	}
+
+	// and across it from that end
+	std::fill(depth.begin(), depth.end(), -1);
+
+	int diameter;
+	uint32_t count;
+	search(largestEnd, diameter, count);
+
+	int64_t budget = std::min<int64_t>(static_cast<int64_t>(diameter + 1) * NODE_BUDGET_PER_HOP, largestCount);
+	budget = std::max<int64_t>(dtNextPow2(static_cast<unsigned int>(budget)), NAVMESH_MIN_NODE_BUDGET);
+
+	return static_cast<int>(std::min<int64_t>(budget, NAVMESH_MAX_NODE_BUDGET));
 }
 
-static void FromProto(const nav::vector3& in_proto, glm::vec3& out_vec)
+int NavMesh::GetQueryNodeBudget() const
 {
-	out_vec = glm::vec3{ in_proto.x(), in_proto.y(), in_proto.z() };
+	int budget = m_savedNodeBudget ? m_savedNodeBudget : NAVMESH_PATH_MAX_NODES;
+	return std::max(budget, m_grownNodeBudget.load());
 }
 
-inline glm::vec3 FromProto(const nav::vector3& in_proto)
+int NavMesh::RecordOutOfNodes(int maxNodes)
 {
-	return glm::vec3{ in_proto.x(), in_proto.y(), in_proto.z() };
+	++m_queryNodeStats.outOfNodes;
+
+	if (maxNodes >= NAVMESH_MAX_NODE_BUDGET)
+		return 0;
+
+	return std::min(maxNodes * 2, NAVMESH_MAX_NODE_BUDGET);
 }
 
-static void ToProto(nav::color& out_proto, uint32_t color)
+void NavMesh::RecordNodeRetry(int maxNodes, bool found)
 {
-	out_proto.set_a((color >> 24) & 0xff);
-	out_proto.set_r((color >> 16) & 0xff);
-	out_proto.set_g((color >> 8) & 0xff);
-	out_proto.set_b(color & 0xff);
+	++m_queryNodeStats.retries;
+	if (!found)
+		return;
+
+	++m_queryNodeStats.retriesFound;
+
+	int grown = m_grownNodeBudget;
+	while (grown < maxNodes && !m_grownNodeBudget.compare_exchange_weak(grown, maxNodes))
+	{
+	}
 }
 
-inline uint32_t FromProto(const nav::color& proto)
+//----------------------------------------------------------------------------
+
+static uint64_t TileBuildHashKey(int x, int y, int layer)
 {
-	return ((proto.a() & 0xff) << 24)
-		| ((proto.r() & 0xff) << 16)
-		| ((proto.g() & 0xff) << 8)
-		| (proto.b() & 0xff);
+	return ((uint64_t)(uint32_t)x << 32) | ((uint64_t)(uint16_t)y << 16) | (uint16_t)layer;
 }
 
-static void ToProto(nav::dtNavMeshParams& out_proto, const dtNavMeshParams* params)
+uint64_t NavMesh::GetTileBuildHash(int x, int y, int layer) const
 {
-	out_proto.set_tile_width(params->tileWidth);
-	out_proto.set_tile_height(params->tileHeight);
-	out_proto.set_max_tiles(params->maxTiles);
-	out_proto.set_max_polys(params->maxPolys);
-	ToProto(*out_proto.mutable_origin(), glm::make_vec3(params->orig));
+	auto iter = m_tileBuildHashes.find(TileBuildHashKey(x, y, layer));
+	if (iter == m_tileBuildHashes.end())
+		return 0;
+
+	return iter->second;
 }
 
-static void FromProto(dtNavMeshParams& out_params, const nav::dtNavMeshParams& proto)
+void NavMesh::SetTileBuildHash(int x, int y, int layer, uint64_t hash)
 {
-	out_params.tileWidth = proto.tile_width();
-	out_params.tileHeight = proto.tile_height();
-	out_params.maxTiles = proto.max_tiles();
-	out_params.maxPolys = proto.max_polys();
-
-	glm::vec3 orig = FromProto(proto.origin());
-	dtVcopy(out_params.orig, glm::value_ptr(orig));
+	if (hash == 0)
+		m_tileBuildHashes.erase(TileBuildHashKey(x, y, layer));
+	else
+		m_tileBuildHashes[TileBuildHashKey(x, y, layer)] = hash;
 }
 
-static void ToProto(google::protobuf::RepeatedPtrField<nav::NavMeshTile>& tiles, const dtNavMesh* mesh)
+const NavMesh::PrunedTile* NavMesh::GetPrunedTile(int x, int y, int layer, uint64_t buildHash) const
 {
-	for (int i = 0; i < mesh->getMaxTiles(); ++i)
-	{
-		const dtMeshTile* tile = mesh->getTile(i);
-		if (!tile || !tile->header || !tile->dataSize) continue;
+	auto iter = m_prunedTiles.find(TileBuildHashKey(x, y, layer));
+	if (iter == m_prunedTiles.end() || iter->second.buildHash != buildHash)
+		return nullptr;
 
-		nav::NavMeshTile* ptile = tiles.Add();
-		ptile->set_tile_ref(mesh->getTileRef(tile));
-		ptile->set_tile_data(tile->data, tile->dataSize);
-	}
+	return &iter->second;
 }
 
-static void ToProto(nav::BuildSettings& out_proto, const NavMeshConfig& config)
+void NavMesh::SetPrunedTile(int x, int y, int layer, PrunedTile tile)
 {
-	out_proto.set_config_version(config.configVersion);
-	out_proto.set_tile_size(config.tileSize);
-	out_proto.set_cell_size(config.cellSize);
-	out_proto.set_cell_height(config.cellHeight);
-	out_proto.set_agent_height(config.agentHeight);
-	out_proto.set_agent_radius(config.agentRadius);
-	out_proto.set_agent_max_climb(config.agentMaxClimb);
-	out_proto.set_agent_max_slope(config.agentMaxSlope);
-	out_proto.set_region_min_size(config.regionMinSize);
-	out_proto.set_region_merge_size(config.regionMergeSize);
-	out_proto.set_edge_max_len(config.edgeMaxLen);
-	out_proto.set_edge_max_error(config.edgeMaxError);
-	out_proto.set_verts_per_poly(config.vertsPerPoly);
-	out_proto.set_detail_sample_dist(config.detailSampleDist);
-	out_proto.set_detail_sample_max_error(config.detailSampleMaxError);
-	out_proto.set_partition_type(static_cast<int>(config.partitionType));
+	if (tile.polys.empty())
+		m_prunedTiles.erase(TileBuildHashKey(x, y, layer));
+	else
+		m_prunedTiles[TileBuildHashKey(x, y, layer)] = std::move(tile);
 }
 
-static void FromProto(const nav::BuildSettings& proto, NavMeshConfig& config)
+void NavMesh::RemovePruneSeed(size_t index)
 {
-	// compare the config version?
-	config.configVersion = proto.config_version();
-
-	config.tileSize = proto.tile_size();
-	config.cellSize = proto.cell_size();
-	config.cellHeight = proto.cell_height();
-	config.agentHeight = proto.agent_height();
-	config.agentRadius = proto.agent_radius();
-	config.agentMaxClimb = proto.agent_max_climb();
-	config.agentMaxSlope = proto.agent_max_slope();
-	config.regionMinSize = proto.region_min_size();
-	config.regionMergeSize = proto.region_merge_size();
-	config.edgeMaxLen = proto.edge_max_len();
-	config.edgeMaxError = proto.edge_max_error();
-	config.vertsPerPoly = proto.verts_per_poly();
-	config.detailSampleDist = proto.detail_sample_dist();
-	config.detailSampleMaxError = proto.detail_sample_max_error();
-	config.partitionType = static_cast<PartitionType>(proto.partition_type());
+	if (index < m_pruneSeeds.size())
+		m_pruneSeeds.erase(m_pruneSeeds.begin() + index);
 }
 
-static void ToProto(nav::ConvexVolume& out_proto, const ConvexVolume& volume)
+//----------------------------------------------------------------------------
+
+void NavMesh::BuildTileGraph()
 {
-	out_proto.set_area_type(static_cast<uint32_t>(volume.areaType));
-	out_proto.set_height_min(volume.hmin);
-	out_proto.set_height_max(volume.hmax);
-	out_proto.set_name(volume.name);
-	out_proto.set_id(volume.id);
+	auto lock = BeginTileChange();
 
-	for (const auto& vert : volume.verts)
-	{
-		nav::vector3* out_vert = out_proto.add_vertices();
-		ToProto(*out_vert, vert);
-	}
+	if (m_navMesh)
+		m_tileGraph.Build(*m_navMesh);
+	else
+		m_tileGraph.Clear();
 }
 
-static std::unique_ptr<ConvexVolume> FromProto(const nav::ConvexVolume& proto)
+void NavMesh::BuildLandmarks(int landmarkCount)
 {
-	auto volume = std::make_unique<ConvexVolume>();
-	
-	volume->areaType = proto.area_type();
-	volume->hmin = proto.height_min();
-	volume->hmax = proto.height_max();
-	volume->name = proto.name();
-	volume->id = proto.id();
+	auto lock = LockTilesForWrite();
 
-	for (const auto& vert : proto.vertices())
+	if (m_navMesh)
+		m_landmarks.Build(*m_navMesh, landmarkCount);
+	else
+		m_landmarks.Clear();
+}
+
+//----------------------------------------------------------------------------
+
+NavMeshTileCache* NavMesh::CreateTileCache(const dtTileCacheParams& params)
+{
+	auto tileCache = std::make_unique<NavMeshTileCache>(this);
+	if (!tileCache->Init(params))
 	{
-		volume->verts.push_back(FromProto(vert));
+		m_ctx->Log(LogLevel::ERROR, "Failed to initialize tile cache");
+		m_tileCache.reset();
+		return nullptr;
 	}
 
-	return volume;
+	m_tileCache = std::move(tileCache);
+	return m_tileCache.get();
 }
 
-static void ToProto(nav::PolyAreaType& out_proto, const PolyAreaType& area)
+void NavMesh::ResetTileCache()
 {
-	out_proto.set_id(area.id);
-	out_proto.set_name(area.name);
-	ToProto(*out_proto.mutable_color(), area.color);
-	out_proto.set_flags(area.flags);
-	out_proto.set_cost(area.cost);
+	m_tileCache.reset();
 }
 
-static void FromProto(const nav::PolyAreaType& in_proto, PolyAreaType& area)
+bool NavMesh::UpdateTileCache()
 {
-	area.id = static_cast<uint8_t>(in_proto.id());
-	area.name = in_proto.name();
-	area.color = FromProto(in_proto.color());
-	area.flags = static_cast<uint16_t>(in_proto.flags());
-	area.cost = in_proto.cost();
-	area.valid = true;
+	if (!m_tileCache || !m_navMesh || m_tileCache->IsUpToDate())
+		return false;
+
+	{
+		auto lock = BeginTileChange();
+		if (!m_tileCache->Update(m_navMesh.get()))
+			return false;
+	}
+
+	OnNavMeshTilesChanged();
+	return true;
 }
 
-void NavMesh::LoadFromProto(const nav::NavMeshFile& proto, PersistedDataFields fields)
+//----------------------------------------------------------------------------
+
+// number of paths kept in the path cache
+static const size_t PATH_CACHE_SIZE = 64;
+
+bool NavMesh::FindCachedPath(dtPolyRef startRef, dtPolyRef endRef, uint32_t filterHash,
+	std::vector<dtPolyRef>& path)
 {
-	if (+(fields & PersistedDataFields::MeshTiles))
+	auto iter = m_pathCacheIndex.find(PathCacheKey{ startRef, endRef, filterHash });
+	if (iter == m_pathCacheIndex.end())
 	{
-		// read the tileset
-		const nav::NavMeshTileSet& tileset = proto.tile_set();
+		++m_pathCacheStats.misses;
+		return false;
+	}
 
-		if (tileset.compatibility_version() == NAVMESH_TILE_COMPAT_VERSION)
-		{
-			dtNavMeshParams params;
-			FromProto(params, tileset.mesh_params());
+	// move to the front
+	m_pathCache.splice(m_pathCache.begin(), m_pathCache, iter->second);
 
-			std::shared_ptr<dtNavMesh> navMesh(dtAllocNavMesh(),
-				[](dtNavMesh* ptr) { dtFreeNavMesh(ptr); });
+	path = iter->second->second;
+	++m_pathCacheStats.hits;
+	return true;
+}
 
-			dtStatus status = navMesh->init(&params);
-			if (status == DT_SUCCESS)
-			{
-				// read the mesh tiles and add them to the navmesh one by one.
-				for (const nav::NavMeshTile& tile : tileset.tiles())
+void NavMesh::AddCachedPath(dtPolyRef startRef, dtPolyRef endRef, uint32_t filterHash,
+	const dtPolyRef* path, int pathSize)
+{
+	if (pathSize <= 0)
+		return;
+
+	PathCacheKey key{ startRef, endRef, filterHash };
+
+	auto iter = m_pathCacheIndex.find(key);
+	if (iter != m_pathCacheIndex.end())
+	{
+		m_pathCache.erase(iter->second);
+		m_pathCacheIndex.erase(iter);
+	}
+
+	m_pathCache.emplace_front(key, std::vector<dtPolyRef>(path, path + pathSize));
+	m_pathCacheIndex[key] = m_pathCache.begin();
+
+	while (m_pathCache.size() > PATH_CACHE_SIZE)
+	{
+		m_pathCacheIndex.erase(m_pathCache.back().first);
+		m_pathCache.pop_back();
+	}
+
+	m_pathCacheStats.entries = static_cast<uint32_t>(m_pathCache.size());
+}
+
+void NavMesh::InvalidatePathCache()
+{
+	m_pathCache.clear();
+	m_pathCacheIndex.clear();
+	m_pathCacheStats.entries = 0;
+
+	m_componentsValid = false;
+}
+
+//----------------------------------------------------------------------------
+
+void NavMesh::BuildPolyComponents()
+{
+	m_polyComponents.clear();
+	m_componentGeneration = m_tileGeneration;
+	m_componentsValid = true;
+
+	if (!m_navMesh)
+		return;
+
+	const dtNavMesh* navMesh = m_navMesh.get();
+	const int maxTiles = navMesh->getMaxTiles();
+
+	// union-find over every polygon, numbered from the first polygon of each tile
+	std::vector<uint32_t> firstPoly(maxTiles, 0);
+	uint32_t polyCount = 0;
+
+	for (int i = 0; i < maxTiles; ++i)
+	{
+		const dtMeshTile* tile = navMesh->getTile(i);
+		firstPoly[i] = polyCount;
+
+		if (tile && tile->header)
+			polyCount += tile->header->polyCount;
+	}
+
+	std::vector<uint32_t> parent(polyCount);
+	for (uint32_t i = 0; i < polyCount; ++i)
+		parent[i] = i;
+
+	auto find = [&parent](uint32_t i)
+	{
+		while (parent[i] != i)
+		{
+			parent[i] = parent[parent[i]];
+			i = parent[i];
+		}
+		return i;
+	};
+
+	auto isDisabled = [](const dtPoly& poly)
+	{
+		return (poly.flags & +PolyFlags::Disabled) != 0;
+	};
+
+	for (int i = 0; i < maxTiles; ++i)
+	{
+		const dtMeshTile* tile = navMesh->getTile(i);
+		if (!tile || !tile->header)
+			continue;
+
+		for (int j = 0; j < tile->header->polyCount; ++j)
+		{
+			const dtPoly& poly = tile->polys[j];
+			if (isDisabled(poly))
+				continue;
+
+			for (unsigned int link = poly.firstLink; link != DT_NULL_LINK; link = tile->links[link].next)
+			{
+				const dtMeshTile* neighbourTile = nullptr;
+				const dtPoly* neighbour = nullptr;
+				dtPolyRef ref = tile->links[link].ref;
+
+				if (dtStatusFailed(navMesh->getTileAndPolyByRef(ref, &neighbourTile, &neighbour))
+					|| isDisabled(*neighbour))
 				{
-					dtTileRef ref = tile.tile_ref();
-					const std::string& tiledata = tile.tile_data();
+					continue;
+				}
+
+				uint32_t a = find(firstPoly[i] + j);
+				uint32_t b = find(firstPoly[navMesh->decodePolyIdTile(ref)] + navMesh->decodePolyIdPoly(ref));
+				if (a != b)
+					parent[std::max(a, b)] = std::min(a, b);
+			}
+		}
+	}
+
+	// number the components from 1, leaving 0 for disabled polygons
+	std::vector<uint32_t> labels(polyCount, 0);
+	uint32_t nextLabel = 1;
+
+	m_polyComponents.resize(maxTiles);
+
+	for (int i = 0; i < maxTiles; ++i)
+	{
+		const dtMeshTile* tile = navMesh->getTile(i);
+		if (!tile || !tile->header)
+			continue;
+
+		std::vector<uint32_t>& components = m_polyComponents[i];
+		components.assign(tile->header->polyCount, 0);
+
+		for (int j = 0; j < tile->header->polyCount; ++j)
+		{
+			if (isDisabled(tile->polys[j]))
+				continue;
+
+			uint32_t root = find(firstPoly[i] + j);
+			if (labels[root] == 0)
+				labels[root] = nextLabel++;
+
+			components[j] = labels[root];
+		}
+	}
+}
+
+uint32_t NavMesh::GetPolyComponent(dtPolyRef ref)
+{
+	if (!m_navMesh || !m_navMesh->isValidPolyRef(ref))
+		return 0;
+
+	if (!m_componentsValid || m_componentGeneration != m_tileGeneration)
+		BuildPolyComponents();
+
+	unsigned int tileIndex = m_navMesh->decodePolyIdTile(ref);
+	unsigned int polyIndex = m_navMesh->decodePolyIdPoly(ref);
+	if (tileIndex >= m_polyComponents.size() || polyIndex >= m_polyComponents[tileIndex].size())
+		return 0;
+
+	return m_polyComponents[tileIndex][polyIndex];
+}
+
+bool NavMesh::MaybeReachable(dtPolyRef startRef, dtPolyRef endRef)
+{
+	uint32_t start = GetPolyComponent(startRef);
+	return start != 0 && start == GetPolyComponent(endRef);
+}
+
+bool NavMesh::FindRandomPoint(dtPolyRef startRef, const glm::vec3& center, float radius,
+	uint64_t areaMask, glm::vec3& point)
+{
+	if (!m_navMesh || !m_navMesh->isValidPolyRef(startRef))
+		return false;
+
+	auto lock = LockTiles();
+
+	bool meshChanged = m_samplerMesh != m_navMesh.get();
+	if (meshChanged)
+	{
+		m_polySampler.Clear();
+		m_samplerMesh = m_navMesh.get();
+	}
+	if (meshChanged || m_samplerGeneration != m_tileGeneration)
+	{
+		m_polySampler.Update(*m_navMesh);
+		m_samplerGeneration = m_tileGeneration;
+	}
+
+	// the tables are by the areas the tiles came with, areas can be switched off
+	// or painted over since
+	auto accept = [this, startRef, areaMask](dtPolyRef ref)
+	{
+		unsigned short flags = 0;
+		uint8_t area = 0;
+		m_navMesh->getPolyFlags(ref, &flags);
+		m_navMesh->getPolyArea(ref, &area);
+
+		return (flags & +PolyFlags::Disabled) == 0
+			&& (areaMask & AvoidAreaBit(area)) != 0
+			&& MaybeReachable(startRef, ref);
+	};
+
+	dtPolyRef ref = 0;
+	float pt[3];
+	if (!m_polySampler.Sample(*m_navMesh, glm::value_ptr(center), radius, areaMask, accept, ref, pt))
+		return false;
+
+	// onto the detail mesh
+	if (auto query = AcquireNavMeshQuery())
+	{
+		float height = pt[1];
+		if (dtStatusSucceed(query->getPolyHeight(ref, pt, &height)))
+			pt[1] = height;
+	}
+
+	point = glm::vec3(pt[0], pt[1], pt[2]);
+	return true;
+}
+
+uint32_t NavMesh::HashQueryFilter(const dtQueryFilter& filter)
+{
+	// fnv-1a over everything that affects the result of a search
+	uint32_t hash = 2166136261u;
+	auto combine = [&hash](const void* data, size_t size)
+	{
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash ^= bytes[i];
+			hash *= 16777619u;
+		}
+	};
+
+	uint16_t includeFlags = filter.getIncludeFlags();
+	uint16_t excludeFlags = filter.getExcludeFlags();
+	combine(&includeFlags, sizeof(includeFlags));
+	combine(&excludeFlags, sizeof(excludeFlags));
+
+	for (int i = 0; i < DT_MAX_AREAS; ++i)
+	{
+		float cost = filter.getAreaCost(i);
+		combine(&cost, sizeof(cost));
+	}
+
+	return hash;
+}
+
+//----------------------------------------------------------------------------
+
+void NavMesh::SetNavMeshBounds(const glm::vec3& min, const glm::vec3& max)
+{
+	m_boundsMin = min;
+	m_boundsMax = max;
+}
+
+void NavMesh::SetBuildSource(uint64_t sourceHash)
+{
+	m_buildSourceHash = sourceHash;
+	m_buildTime = std::chrono::duration_cast<std::chrono::seconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void NavMesh::GetNavMeshBounds(glm::vec3& min, glm::vec3& max)
+{
+	min = m_boundsMin;
+	max = m_boundsMax;
+}
+
+//----------------------------------------------------------------------------
+
+static void ToProto(nav::vector3& out_proto, const glm::vec3& v3)
+{
+	out_proto.set_x(v3.x);
+	out_proto.set_y(v3.y);
+	out_proto.set_z(v3.z);
+}
+
+static void FromProto(const nav::vector3& in_proto, glm::vec3& out_vec)
+{
+	out_vec = glm::vec3{ in_proto.x(), in_proto.y(), in_proto.z() };
+}
+
+inline glm::vec3 FromProto(const nav::vector3& in_proto)
+{
+	return glm::vec3{ in_proto.x(), in_proto.y(), in_proto.z() };
+}
+
+static void ToProto(nav::color& out_proto, uint32_t color)
+{
+	out_proto.set_a((color >> 24) & 0xff);
+	out_proto.set_r((color >> 16) & 0xff);
+	out_proto.set_g((color >> 8) & 0xff);
+	out_proto.set_b(color & 0xff);
+}
+
+inline uint32_t FromProto(const nav::color& proto)
+{
+	return ((proto.a() & 0xff) << 24)
+		| ((proto.r() & 0xff) << 16)
+		| ((proto.g() & 0xff) << 8)
+		| (proto.b() & 0xff);
+}
+
+static void ToProto(nav::dtNavMeshParams& out_proto, const dtNavMeshParams* params)
+{
+	out_proto.set_tile_width(params->tileWidth);
+	out_proto.set_tile_height(params->tileHeight);
+	out_proto.set_max_tiles(params->maxTiles);
+	out_proto.set_max_polys(params->maxPolys);
+	ToProto(*out_proto.mutable_origin(), glm::make_vec3(params->orig));
+}
+
+static void FromProto(dtNavMeshParams& out_params, const nav::dtNavMeshParams& proto)
+{
+	out_params.tileWidth = proto.tile_width();
+	out_params.tileHeight = proto.tile_height();
+	out_params.maxTiles = proto.max_tiles();
+	out_params.maxPolys = proto.max_polys();
+
+	glm::vec3 orig = FromProto(proto.origin());
+	dtVcopy(out_params.orig, glm::value_ptr(orig));
+}
+
+static void ToProto(google::protobuf::RepeatedPtrField<nav::NavMeshTile>& tiles, const dtNavMesh* mesh)
+{
+	for (const dtMeshTile* tile : GetTilesInOrder(*mesh))
+	{
+		nav::NavMeshTile* ptile = tiles.Add();
+		ptile->set_tile_ref(mesh->getTileRef(tile));
+		ptile->set_tile_data(tile->data, tile->dataSize);
+	}
+}
+
+static void ToProto(nav::AgentProfile& out_proto, const AgentProfile& profile)
+{
+	out_proto.set_name(profile.name);
+	out_proto.set_agent_height(profile.agentHeight);
+	out_proto.set_agent_radius(profile.agentRadius);
+	out_proto.set_agent_max_climb(profile.agentMaxClimb);
+}
+
+static void FromProto(const nav::AgentProfile& proto, AgentProfile& profile)
+{
+	profile.name = proto.name();
+	profile.agentHeight = proto.agent_height();
+	profile.agentRadius = proto.agent_radius();
+	profile.agentMaxClimb = proto.agent_max_climb();
+}
+
+static void ToProto(nav::BuildSettings& out_proto, const NavMeshConfig& config)
+{
+	out_proto.set_config_version(config.configVersion);
+	out_proto.set_tile_size(config.tileSize);
+	out_proto.set_cell_size(config.cellSize);
+	out_proto.set_cell_height(config.cellHeight);
+	out_proto.set_agent_height(config.agentHeight);
+	out_proto.set_agent_radius(config.agentRadius);
+	out_proto.set_agent_max_climb(config.agentMaxClimb);
+	out_proto.set_agent_max_slope(config.agentMaxSlope);
+	out_proto.set_region_min_size(config.regionMinSize);
+	out_proto.set_region_merge_size(config.regionMergeSize);
+	out_proto.set_edge_max_len(config.edgeMaxLen);
+	out_proto.set_edge_max_error(config.edgeMaxError);
+	out_proto.set_verts_per_poly(config.vertsPerPoly);
+	out_proto.set_detail_sample_dist(config.detailSampleDist);
+	out_proto.set_detail_sample_max_error(config.detailSampleMaxError);
+	out_proto.set_partition_type(static_cast<int>(config.partitionType));
+	out_proto.set_use_tile_cache(config.useTileCache);
+	out_proto.set_prune_unreachable(config.pruneUnreachable);
+	out_proto.set_auto_offmesh_links(config.autoOffMeshLinks);
+	out_proto.set_max_drop_height(config.maxDropHeight);
+	out_proto.set_max_jump_distance(config.maxJumpDistance);
+	out_proto.set_pack_tiles(config.packTiles);
+	out_proto.set_layered_tiles(config.layeredTiles);
+	out_proto.set_merge_polys(config.mergePolys);
+
+	for (const AgentProfile& profile : config.agentProfiles)
+		ToProto(*out_proto.add_agent_profiles(), profile);
+}
+
+static void FromProto(const nav::BuildSettings& proto, NavMeshConfig& config)
+{
+	// compare the config version?
+	config.configVersion = proto.config_version();
+
+	config.tileSize = proto.tile_size();
+	config.cellSize = proto.cell_size();
+	config.cellHeight = proto.cell_height();
+	config.agentHeight = proto.agent_height();
+	config.agentRadius = proto.agent_radius();
+	config.agentMaxClimb = proto.agent_max_climb();
+	config.agentMaxSlope = proto.agent_max_slope();
+	config.regionMinSize = proto.region_min_size();
+	config.regionMergeSize = proto.region_merge_size();
+	config.edgeMaxLen = proto.edge_max_len();
+	config.edgeMaxError = proto.edge_max_error();
+	config.vertsPerPoly = proto.verts_per_poly();
+	config.detailSampleDist = proto.detail_sample_dist();
+	config.detailSampleMaxError = proto.detail_sample_max_error();
+	config.partitionType = static_cast<PartitionType>(proto.partition_type());
+	config.useTileCache = proto.use_tile_cache();
+	config.pruneUnreachable = proto.prune_unreachable();
+	config.autoOffMeshLinks = proto.auto_offmesh_links();
+	if (config.autoOffMeshLinks)
+	{
+		config.maxDropHeight = proto.max_drop_height();
+		config.maxJumpDistance = proto.max_jump_distance();
+	}
+	config.packTiles = proto.pack_tiles();
+	config.layeredTiles = proto.layered_tiles();
+	config.mergePolys = proto.merge_polys();
+
+	config.agentProfiles.resize(proto.agent_profiles_size());
+	for (int i = 0; i < proto.agent_profiles_size(); ++i)
+		FromProto(proto.agent_profiles(i), config.agentProfiles[i]);
+}
+
+static void ToProto(nav::ConvexVolume& out_proto, const ConvexVolume& volume)
+{
+	out_proto.set_area_type(static_cast<uint32_t>(volume.areaType));
+	out_proto.set_height_min(volume.hmin);
+	out_proto.set_height_max(volume.hmax);
+	out_proto.set_name(volume.name);
+	out_proto.set_id(volume.id);
+
+	for (const auto& vert : volume.verts)
+	{
+		nav::vector3* out_vert = out_proto.add_vertices();
+		ToProto(*out_vert, vert);
+	}
+}
+
+static std::unique_ptr<ConvexVolume> FromProto(const nav::ConvexVolume& proto)
+{
+	auto volume = std::make_unique<ConvexVolume>();
+	
+	volume->areaType = proto.area_type();
+	volume->hmin = proto.height_min();
+	volume->hmax = proto.height_max();
+	volume->name = proto.name();
+	volume->id = proto.id();
+
+	for (const auto& vert : proto.vertices())
+	{
+		volume->verts.push_back(FromProto(vert));
+	}
+
+	return volume;
+}
+
+static void ToProto(google::protobuf::RepeatedPtrField<nav::TileBuildHash>& out_proto,
+	const std::unordered_map<uint64_t, uint64_t>& hashes)
+{
+	// written in key order, the map's order depends on how it was filled
+	std::vector<std::pair<uint64_t, uint64_t>> sorted(hashes.begin(), hashes.end());
+	std::sort(sorted.begin(), sorted.end());
+
+	for (const auto& entry : sorted)
+	{
+		nav::TileBuildHash* proto_hash = out_proto.Add();
+		proto_hash->set_x((int32_t)(entry.first >> 32));
+		proto_hash->set_y((int16_t)(entry.first >> 16));
+		proto_hash->set_layer((int16_t)entry.first);
+		proto_hash->set_hash(entry.second);
+	}
+}
+
+static void FromProto(const google::protobuf::RepeatedPtrField<nav::TileBuildHash>& proto,
+	std::unordered_map<uint64_t, uint64_t>& hashes)
+{
+	hashes.clear();
+
+	for (const auto& proto_hash : proto)
+	{
+		hashes[TileBuildHashKey(proto_hash.x(), proto_hash.y(), proto_hash.layer())] = proto_hash.hash();
+	}
+}
+
+static void ToProto(nav::PruneSet& out_proto,
+	const std::unordered_map<uint64_t, NavMesh::PrunedTile>& tiles,
+	const std::vector<glm::vec3>& seeds)
+{
+	std::vector<uint64_t> keys;
+	keys.reserve(tiles.size());
+	for (const auto& entry : tiles)
+		keys.push_back(entry.first);
+	std::sort(keys.begin(), keys.end());
+
+	for (uint64_t key : keys)
+	{
+		const auto& entry = *tiles.find(key);
+		nav::PrunedTile* proto_tile = out_proto.add_tiles();
+		proto_tile->set_x((int32_t)(entry.first >> 32));
+		proto_tile->set_y((int16_t)(entry.first >> 16));
+		proto_tile->set_layer((int16_t)entry.first);
+		proto_tile->set_build_hash(entry.second.buildHash);
+
+		for (uint16_t poly : entry.second.polys)
+			proto_tile->add_polys(poly);
+	}
+
+	for (const glm::vec3& seed : seeds)
+		ToProto(*out_proto.add_seeds(), seed);
+}
+
+static void FromProto(const nav::PruneSet& proto,
+	std::unordered_map<uint64_t, NavMesh::PrunedTile>& tiles,
+	std::vector<glm::vec3>& seeds)
+{
+	tiles.clear();
+	seeds.clear();
+
+	for (const auto& proto_tile : proto.tiles())
+	{
+		NavMesh::PrunedTile& tile = tiles[TileBuildHashKey(proto_tile.x(), proto_tile.y(), proto_tile.layer())];
+		tile.buildHash = proto_tile.build_hash();
+		tile.polys.assign(proto_tile.polys().begin(), proto_tile.polys().end());
+	}
+
+	for (const auto& proto_seed : proto.seeds())
+		seeds.push_back(FromProto(proto_seed));
+}
+
+static void ToProto(nav::TileGraph& out_proto, const TileGraph& graph)
+{
+	for (const TileGraph::Tile& tile : graph.GetTiles())
+	{
+		nav::TileGraphTile* proto_tile = out_proto.add_tiles();
+		proto_tile->set_x(tile.x);
+		proto_tile->set_y(tile.y);
+		proto_tile->set_layer(tile.layer);
+	}
+
+	for (const TileGraph::Portal& portal : graph.GetPortals())
+	{
+		nav::TileGraphPortal* proto_portal = out_proto.add_portals();
+		proto_portal->set_tile_a(portal.tileA);
+		proto_portal->set_tile_b(portal.tileB);
+		ToProto(*proto_portal->mutable_position(), portal.pos);
+	}
+}
+
+static void FromProto(const nav::TileGraph& proto, TileGraph& graph)
+{
+	graph.Clear();
+
+	for (const auto& proto_tile : proto.tiles())
+	{
+		graph.AddTile(proto_tile.x(), proto_tile.y(), proto_tile.layer());
+	}
+
+	for (const auto& proto_portal : proto.portals())
+	{
+		graph.AddPortal(proto_portal.tile_a(), proto_portal.tile_b(),
+			FromProto(proto_portal.position()));
+	}
+}
+
+static void ToProto(nav::LandmarkTable& out_proto, const LandmarkTable& landmarks)
+{
+	for (const glm::vec3& landmark : landmarks.GetLandmarks())
+		ToProto(*out_proto.add_landmarks(), landmark);
+
+	out_proto.set_scale(landmarks.GetScale());
+
+	for (const LandmarkTable::Tile& tile : landmarks.GetTiles())
+	{
+		nav::LandmarkTile* proto_tile = out_proto.add_tiles();
+		proto_tile->set_x(tile.x);
+		proto_tile->set_y(tile.y);
+		proto_tile->set_layer(tile.layer);
+		proto_tile->set_poly_count(tile.polyCount);
+
+		std::string* data = proto_tile->mutable_distances();
+		data->resize(tile.distances.size() * 2);
+
+		for (size_t i = 0; i < tile.distances.size(); ++i)
+		{
+			(*data)[i * 2] = static_cast<char>(tile.distances[i] & 0xff);
+			(*data)[i * 2 + 1] = static_cast<char>(tile.distances[i] >> 8);
+		}
+	}
+}
+
+static void FromProto(const nav::LandmarkTable& proto, LandmarkTable& landmarks)
+{
+	landmarks.Clear();
+
+	std::vector<glm::vec3> points;
+	for (const auto& proto_landmark : proto.landmarks())
+		points.push_back(FromProto(proto_landmark));
+
+	if (points.empty())
+		return;
+
+	landmarks.SetLandmarks(std::move(points), proto.scale());
+
+	for (const auto& proto_tile : proto.tiles())
+	{
+		const std::string& data = proto_tile.distances();
+
+		LandmarkTable::Tile tile;
+		tile.x = proto_tile.x();
+		tile.y = proto_tile.y();
+		tile.layer = proto_tile.layer();
+		tile.polyCount = proto_tile.poly_count();
+		tile.distances.resize(data.size() / 2);
+
+		for (size_t i = 0; i < tile.distances.size(); ++i)
+		{
+			tile.distances[i] = static_cast<uint16_t>((uint8_t)data[i * 2]
+				| ((uint8_t)data[i * 2 + 1] << 8));
+		}
+
+		// tiles that don't match the number of landmarks are dropped
+		landmarks.AddTile(std::move(tile));
+	}
+}
+
+static void ToProto(nav::TileCache& out_proto, const NavMeshTileCache& tileCache)
+{
+	const dtTileCacheParams* params = tileCache.GetParams();
+
+	out_proto.set_compatibility_version(NAVMESH_TILECACHE_COMPAT_VERSION);
+	ToProto(*out_proto.mutable_origin(), glm::make_vec3(params->orig));
+	out_proto.set_cell_size(params->cs);
+	out_proto.set_cell_height(params->ch);
+	out_proto.set_width(params->width);
+	out_proto.set_height(params->height);
+	out_proto.set_walkable_height(params->walkableHeight);
+	out_proto.set_walkable_radius(params->walkableRadius);
+	out_proto.set_walkable_climb(params->walkableClimb);
+	out_proto.set_max_simplification_error(params->maxSimplificationError);
+	out_proto.set_max_tiles(params->maxTiles);
+	out_proto.set_max_obstacles(params->maxObstacles);
+
+	// in tile order, the same way the navmesh tiles are saved
+	struct Layer { int x, y, layer; const uint8_t* data; int dataSize; };
+	std::vector<Layer> layers;
+
+	tileCache.ForEachLayer([&layers](int x, int y, int layer, const uint8_t* data, int dataSize)
+	{
+		layers.push_back({ x, y, layer, data, dataSize });
+	});
+
+	std::sort(layers.begin(), layers.end(), [](const Layer& a, const Layer& b)
+	{
+		return std::tie(a.y, a.x, a.layer) < std::tie(b.y, b.x, b.layer);
+	});
+
+	for (const Layer& layer : layers)
+	{
+		nav::TileCacheLayer* proto_layer = out_proto.add_layers();
+		proto_layer->set_x(layer.x);
+		proto_layer->set_y(layer.y);
+		proto_layer->set_layer(layer.layer);
+		proto_layer->set_data(layer.data, layer.dataSize);
+	}
+}
+
+static void FromProto(dtTileCacheParams& out_params, const nav::TileCache& proto)
+{
+	memset(&out_params, 0, sizeof(dtTileCacheParams));
+
+	glm::vec3 orig = FromProto(proto.origin());
+	dtVcopy(out_params.orig, glm::value_ptr(orig));
+	out_params.cs = proto.cell_size();
+	out_params.ch = proto.cell_height();
+	out_params.width = proto.width();
+	out_params.height = proto.height();
+	out_params.walkableHeight = proto.walkable_height();
+	out_params.walkableRadius = proto.walkable_radius();
+	out_params.walkableClimb = proto.walkable_climb();
+	out_params.maxSimplificationError = proto.max_simplification_error();
+	out_params.maxTiles = proto.max_tiles();
+	out_params.maxObstacles = proto.max_obstacles();
+}
+
+static void ToProto(nav::PolyAreaType& out_proto, const PolyAreaType& area)
+{
+	out_proto.set_id(area.id);
+	out_proto.set_name(area.name);
+	ToProto(*out_proto.mutable_color(), area.color);
+	out_proto.set_flags(area.flags);
+	out_proto.set_cost(area.cost);
+}
+
+static void FromProto(const nav::PolyAreaType& in_proto, PolyAreaType& area)
+{
+	area.id = static_cast<uint8_t>(in_proto.id());
+	area.name = in_proto.name();
+	area.color = FromProto(in_proto.color());
+	area.flags = static_cast<uint16_t>(in_proto.flags());
+	area.cost = in_proto.cost();
+	area.valid = true;
+}
+
+void NavMesh::LoadFromProto(nav::NavMeshFile& proto, PersistedDataFields fields)
+{
+	auto lock = BeginTileChange();
+
+	if (+(fields & PersistedDataFields::MeshTiles))
+	{
+		// read the tileset
+		nav::NavMeshTileSet& tileset = *proto.mutable_tile_set();
+
+		if (tileset.compatibility_version() == NAVMESH_TILE_COMPAT_VERSION)
+		{
+			dtNavMeshParams params;
+			FromProto(params, tileset.mesh_params());
+
+			// the tile data is taken out of the proto rather than copied, the
+			// deleter holds on to it and the tiles are not owned by the navmesh.
+			auto tileData = std::make_shared<std::vector<std::string>>(tileset.tiles_size());
+
+			std::shared_ptr<dtNavMesh> navMesh(dtAllocNavMesh(),
+				[tileData](dtNavMesh* ptr) { dtFreeNavMesh(ptr); });
+
+			dtStatus status = navMesh->init(&params);
+			if (status == DT_SUCCESS)
+			{
+				// read the mesh tiles and add them to the navmesh one by one.
+				for (int i = 0; i < tileset.tiles_size(); ++i)
+				{
+					nav::NavMeshTile& tile = *tileset.mutable_tiles(i);
+					dtTileRef ref = tile.tile_ref();
+					std::string& tiledata = (*tileData)[i];
+					tiledata.swap(*tile.mutable_tile_data());
+
+					if (ref == 0 || tiledata.length() < sizeof(dtMeshHeader))
+						continue;
+
+					uint8_t* data = (uint8_t*)&tiledata[0];
+					dtMeshHeader* tileheader = (dtMeshHeader*)data;
+
+					dtStatus status = navMesh->addTile(data, (int)tiledata.length(), 0, ref, 0);
+					if (status != DT_SUCCESS)
+					{
+						m_ctx->Log(LogLevel::WARNING, "Failed to read tile: %d, %d (%d) = %d",
+							tileheader->x, tileheader->y, tileheader->layer, status);
+					}
+				}
+
+				m_navMesh = std::move(navMesh);
+				FromProto(tileset.build_hashes(), m_tileBuildHashes);
+			}
+			else
+			{
+				m_ctx->Log(LogLevel::ERROR, "loadMesh: failed to initialize navmesh, will continue loading without tiles.");
+			}
+		}
+		else
+		{
+			m_ctx->Log(LogLevel::ERROR, "loadMesh: navmesh has incompatible structure, will continue loading without tiles.");
+		}
+	}
+
+	if (+(fields & PersistedDataFields::BuildSettings))
+	{
+		// load build settings
+		FromProto(proto.build_settings(), m_config);
+
+		m_boundsMin = FromProto(proto.build_settings().bounds_min());
+		m_boundsMax = FromProto(proto.build_settings().bounds_max());
+
+		m_buildSourceHash = proto.build_info().source_hash();
+		m_buildTime = proto.build_info().build_time();
+		m_savedNodeBudget = static_cast<int>(proto.build_info().query_node_budget());
+	}
+
+	if (+(fields & PersistedDataFields::AreaTypes))
+	{
+		// load areas
+		for (const auto& proto_area : proto.areas())
+		{
+			PolyAreaType area;
+			FromProto(proto_area, area);
+
+			UpdateArea(area);
+		}
+	}
+
+	if (+(fields & PersistedDataFields::TileGraph))
+	{
+		// load the tile graph
+		FromProto(proto.tile_graph(), m_tileGraph);
+	}
+
+	if (+(fields & PersistedDataFields::Landmarks))
+	{
+		// load the landmark distances
+		FromProto(proto.landmarks(), m_landmarks);
+	}
+
+	if (+(fields & PersistedDataFields::PruneSet))
+	{
+		// load the pruned polys
+		FromProto(proto.prune_set(), m_prunedTiles, m_pruneSeeds);
+	}
+
+	if (+(fields & PersistedDataFields::TileCache) && proto.has_tile_cache())
+	{
+		// load tile cache layers
+		const nav::TileCache& proto_cache = proto.tile_cache();
+
+		if (proto_cache.compatibility_version() == NAVMESH_TILECACHE_COMPAT_VERSION)
+		{
+			dtTileCacheParams params;
+			FromProto(params, proto_cache);
+
+			if (NavMeshTileCache* tileCache = CreateTileCache(params))
+			{
+				for (const nav::TileCacheLayer& layer : proto_cache.layers())
+				{
+					if (!tileCache->AddLayer((const uint8_t*)layer.data().data(), (int)layer.data().length()))
+					{
+						m_ctx->Log(LogLevel::WARNING, "Failed to read tile cache layer: %d, %d (%d)",
+							layer.x(), layer.y(), layer.layer());
+					}
+				}
+			}
+		}
+		else
+		{
+			m_ctx->Log(LogLevel::WARNING, "loadMesh: tile cache has incompatible structure, obstacles will not be available.");
+		}
+	}
+
+	if (+(fields & PersistedDataFields::ConvexVolumes))
+	{
+		// load convex volumes
+		for (const auto& proto_volume : proto.convex_volumes())
+		{
+			std::unique_ptr<ConvexVolume> vol = FromProto(proto_volume);
+			m_volumesById.emplace(vol->id, vol.get());
+			m_volumes.push_back(std::move(vol));
+		}
+
+		// find the next volume id
+		for (const auto& volume : m_volumes)
+		{
+			m_nextVolumeId = std::max(m_nextVolumeId, volume->id + 1);
+		}
+
+		RebuildConvexVolumeBuckets();
+	}
+}
+
+void NavMesh::SaveToProto(nav::NavMeshFile& proto, PersistedDataFields fields)
+{
+	if (+(fields & PersistedDataFields::BuildSettings))
+	{
+		// save build settings
+		ToProto(*proto.mutable_build_settings(), m_config);
+		ToProto(*proto.mutable_build_settings()->mutable_bounds_min(), m_boundsMin);
+		ToProto(*proto.mutable_build_settings()->mutable_bounds_max(), m_boundsMax);
+
+		if (m_buildTime)
+		{
+			proto.mutable_build_info()->set_build_time(m_buildTime);
+			proto.mutable_build_info()->set_source_hash(m_buildSourceHash);
+		}
+	}
+
+	if (+(fields & PersistedDataFields::MeshTiles))
+	{
+		// save the navmesh data
+		nav::NavMeshTileSet* tileset = proto.mutable_tile_set();
+		tileset->set_compatibility_version(NAVMESH_TILE_COMPAT_VERSION);
+		ToProto(*tileset->mutable_mesh_params(), m_navMesh->getParams());
+		ToProto(*tileset->mutable_tiles(), m_navMesh.get());
+		ToProto(*tileset->mutable_build_hashes(), m_tileBuildHashes);
+	}
+
+	if (+(fields & PersistedDataFields::TileGraph))
+	{
+		// save the tile graph
+		ToProto(*proto.mutable_tile_graph(), m_tileGraph);
+	}
+
+	if (+(fields & PersistedDataFields::Landmarks) && !m_landmarks.IsEmpty())
+	{
+		// save the landmark distances
+		ToProto(*proto.mutable_landmarks(), m_landmarks);
+	}
+
+	if (+(fields & PersistedDataFields::PruneSet))
+	{
+		// save the pruned polys
+		ToProto(*proto.mutable_prune_set(), m_prunedTiles, m_pruneSeeds);
+	}
+
+	if (+(fields & PersistedDataFields::TileCache) && m_tileCache)
+	{
+		// save tile cache layers
+		ToProto(*proto.mutable_tile_cache(), *m_tileCache);
+	}
+
+	if (+(fields & PersistedDataFields::ConvexVolumes))
+	{
+		// save convex volumes
+		for (const auto& volume : m_volumes)
+		{
+			nav::ConvexVolume* proto_vol = proto.add_convex_volumes();
+			ToProto(*proto_vol, *volume);
+		}
+	}
+
+	if (+(fields & PersistedDataFields::AreaTypes))
+	{
+		// save area definitions
+		for (const PolyAreaType* area : m_polyAreaList)
+		{
+			// only serialize user defined areas
+			if (area->id == (uint8_t)PolyArea::Unwalkable)
+				continue;
+
+			if (!IsUserDefinedPolyArea(area->id))
+			{
+				if (area->id < DefaultPolyAreas.size()
+					&& *area == DefaultPolyAreas[area->id])
+				{
+					continue;
+				}
+			}
+
+			nav::PolyAreaType* proto_area = proto.add_areas();
+			ToProto(*proto_area, *area);
+		}
+	}
+}
+
+NavMesh::LoadResult NavMesh::LoadNavMeshFile()
+{
+	if (m_dataFile.empty())
+	{
+		return LoadResult::MissingFile;
+	}
+
+	ApplyPendingPatch();
+
+	m_lastLoadResult = LoadMesh(m_dataFile.c_str());
+	OnNavMeshChanged();
+
+	return m_lastLoadResult;
+}
+
+static bool DecompressData(NavMeshFileCodec codec, void* in_data, size_t in_data_size,
+	void* out_data, size_t out_data_size)
+{
+	switch (codec)
+	{
+	case NavMeshFileCodec::None:
+		if (in_data_size != out_data_size)
+			return false;
+		memcpy(out_data, in_data, out_data_size);
+		return true;
+
+	case NavMeshFileCodec::Zlib:
+		return DecompressMemory(in_data, in_data_size, out_data, out_data_size);
+
+	default:
+		return false;
+	}
+}
+
+// size of a tile index entry in files of the given version
+static size_t TileEntrySize(int version)
+{
+	return version >= 9 ? sizeof(MeshFileTileEntry) : sizeof(MeshFileTileEntryV8);
+}
+
+// an entry of the tile index of a file. Older entries are the start of the
+// current one, the rest is left empty.
+static MeshFileTileEntry ReadTileEntry(const uint8_t* tileIndex, uint32_t i, int version)
+{
+	MeshFileTileEntry entry = { 0 };
+	memcpy(&entry, tileIndex + i * TileEntrySize(version), TileEntrySize(version));
+	return entry;
+}
+
+// whether a stored tile is what was written. Tiles from files without
+// checksums are taken as they are.
+static bool VerifyTileData(const MeshFileTileEntry& entry, const uint8_t* stored)
+{
+	return !+(entry.flags & MeshFileTileFlags::CHECKSUM)
+		|| Crc32(stored, entry.storedSize) == entry.checksum;
+}
+
+// the checksum in the summary of a version 9 file
+static uint32_t MeshFileChecksum(const uint8_t* base, const MeshFileContents& contents,
+	const MeshFileSummary& summary)
+{
+	MQ2NAV_PROFILE_ZONE("NavMesh::MeshFileChecksum");
+
+	uint32_t crc = Crc32(base + summary.summaryOffset, summary.summarySize);
+	crc = Crc32(base + contents.metadataOffset, contents.metadataSize, crc);
+	return Crc32(base + contents.tileIndexOffset, contents.tileCount * sizeof(MeshFileTileEntry), crc);
+}
+
+// reads a stored tile into out, which holds entry.dataSize bytes
+static bool ReadTileData(NavMeshFileCodec codec, const MeshFileTileEntry& entry,
+	const uint8_t* stored, uint8_t* out)
+{
+	MQ2NAV_PROFILE_ZONE("NavMesh::ReadTileData");
+
+	if (!VerifyTileData(entry, stored))
+		return false;
+
+	bool compressed = +(entry.flags & MeshFileTileFlags::COMPRESSED) != 0;
+
+	if (!+(entry.flags & MeshFileTileFlags::PACKED))
+	{
+		return DecompressData(compressed ? codec : NavMeshFileCodec::None, (void*)stored,
+			entry.storedSize, out, entry.dataSize);
+	}
+
+	const uint8_t* packed = stored;
+	size_t packedSize = entry.storedSize;
+
+	std::vector<uint8_t> buffer;
+	if (compressed)
+	{
+		buffer.resize(entry.packedSize);
+		if (!DecompressData(codec, (void*)stored, entry.storedSize, buffer.data(), buffer.size()))
+			return false;
+
+		packed = buffer.data();
+		packedSize = buffer.size();
+	}
+
+	return UnpackTileData(packed, packedSize, out, entry.dataSize);
+}
+
+// tiles that can't be used straight out of the file
+static bool NeedsDecoding(const MeshFileTileEntry& entry)
+{
+	return +(entry.flags & (MeshFileTileFlags::COMPRESSED | MeshFileTileFlags::PACKED)) != 0;
+}
+
+// bounds on the blocks of the arena that mesh file metadata is parsed into
+static const size_t PROTO_ARENA_MIN_BLOCK = 64 * 1024;
+static const size_t PROTO_ARENA_MAX_BLOCK = 16 * 1024 * 1024;
+
+// the decompressed contents of a section of a mesh file. dataSize is the
+// decompressed size of the section, or 0 if the file doesn't record it.
+static bool ReadMeshFileSection(const uint8_t* data, size_t size, bool compressed,
+	NavMeshFileCodec codec, size_t dataSize, std::vector<uint8_t>& buffer)
+{
+	if (!compressed)
+	{
+		buffer.assign(data, data + size);
+		return true;
+	}
+
+	if (dataSize)
+	{
+		buffer.resize(dataSize);
+		return DecompressData(codec, (void*)data, size, buffer.data(), buffer.size());
+	}
+
+	return DecompressMemory((void*)data, size, buffer);
+}
+
+// parse a NavMeshFile proto out of a section of a mesh file. dataSize is the
+// decompressed size of the section, or 0 if the file doesn't record it.
+static bool ParseMeshFileProto(const uint8_t* data, size_t size, bool compressed,
+	NavMeshFileCodec codec, size_t dataSize, nav::NavMeshFile& proto)
+{
+	MQ2NAV_PROFILE_ZONE("NavMesh::ParseMeshFileProto");
+
+	if (!compressed)
+		return proto.ParseFromArray(data, (int)size);
+
+	std::vector<uint8_t> buffer;
+	return ReadMeshFileSection(data, size, compressed, codec, dataSize, buffer)
+		&& proto.ParseFromArray(buffer.data(), (int)buffer.size());
+}
+
+bool NavMesh::ReadMeshFileSummary(const std::string& filename, nav::NavMeshFile& summary,
+	uint32_t* tileCount, uint16_t* version)
+{
+	MappedFile mappedFile;
+	if (!mappedFile.Open(filename.c_str()))
+		return false;
+
+	const uint8_t* data_ptr = mappedFile.GetData();
+	size_t data_size = mappedFile.GetSize();
+
+	if (data_size <= sizeof(MeshFileHeader))
+		return false;
+
+	const MeshFileHeader* fileHeader = (const MeshFileHeader*)data_ptr;
+	if (fileHeader->magic != NAVMESH_FILE_MAGIC
+		|| fileHeader->version < NAVMESH_FILE_MIN_VERSION
+		|| fileHeader->version > NAVMESH_FILE_VERSION)
+	{
+		return false;
+	}
+
+	if (version)
+		*version = fileHeader->version;
+
+	bool compressed = +(fileHeader->flags & NavMeshFileFlags::COMPRESSED) != 0;
+
+	if (fileHeader->version < 5)
+	{
+		if (!ParseMeshFileProto(data_ptr + sizeof(MeshFileHeader), data_size - sizeof(MeshFileHeader),
+			compressed, NavMeshFileCodec::Zlib, 0, summary))
+		{
+			return false;
+		}
+
+		if (tileCount)
+			*tileCount = (uint32_t)summary.tile_set().tiles_size();
+		return true;
+	}
+
+	if (data_size < sizeof(MeshFileHeader) + sizeof(MeshFileContents) + sizeof(MeshFileSummary))
+		return false;
+
+	const MeshFileContents* contents = (const MeshFileContents*)(data_ptr + sizeof(MeshFileHeader));
+	if (tileCount)
+		*tileCount = contents->tileCount;
+
+	uint32_t offset = contents->metadataOffset;
+	uint32_t size = contents->metadataSize;
+	uint32_t dataSize = contents->metadataDataSize;
+
+	if (fileHeader->version >= 6)
+	{
+		const MeshFileSummary* fileSummary = (const MeshFileSummary*)(contents + 1);
+		offset = fileSummary->summaryOffset;
+		size = fileSummary->summarySize;
+		dataSize = fileSummary->summaryDataSize;
+	}
+
+	if ((uint64_t)offset + size > data_size)
+		return false;
+
+	return ParseMeshFileProto(data_ptr + offset, size, compressed, contents->codec, dataSize, summary);
+}
+
+void NavMesh::AdoptNavMesh(NavMesh& other)
+{
+	auto lock = BeginTileChange();
+
+	m_dataFile = other.m_dataFile;
+	m_lastLoadResult = other.m_lastLoadResult;
+	other.m_lastLoadResult = LoadResult::None;
+
+	m_navMesh = std::move(other.m_navMesh);
+	m_navMeshQuery.reset();
+	other.m_navMeshQuery.reset();
+	m_loadStats = other.m_loadStats;
+	other.m_loadStats = NavMeshStats{};
+	m_agentNavMeshes = std::move(other.m_agentNavMeshes);
+	m_loadedAgentProfile = std::move(other.m_loadedAgentProfile);
+	m_agentHeight = other.m_agentHeight;
+	m_mappedFile = std::move(other.m_mappedFile);
+	m_patchedFiles = std::move(other.m_patchedFiles);
+	m_tileIndex = std::move(other.m_tileIndex);
+	m_fileCodec = other.m_fileCodec;
+	m_sharedTiles = std::move(other.m_sharedTiles);
+	m_sharedTileOffsets = std::move(other.m_sharedTileOffsets);
+	m_streamingTileX = m_streamingTileY = INT_MIN;
+
+	m_tileCache = std::move(other.m_tileCache);
+	if (m_tileCache)
+		m_tileCache->SetOwner(this);
+
+	AdoptSavedData(other);
+	other.ResetSavedData();
+
+	OnNavMeshChanged();
+}
+
+int NavMesh::PatchNavMesh(NavMesh& other)
+{
+	// tiles can only be swapped between meshes with the same tile layout. Tiles
+	// rebuilt around obstacles don't match anything in the file. Build hashes are
+	// only kept for the main mesh.
+	if (!m_navMesh || !other.m_navMesh || !m_mappedFile || !other.m_mappedFile
+		|| m_tileCache || other.m_tileCache
+		|| !m_agentNavMeshes.empty() || !other.m_agentNavMeshes.empty()
+		|| !m_loadedAgentProfile.empty() || !other.m_loadedAgentProfile.empty()
+		|| memcmp(m_navMesh->getParams(), other.m_navMesh->getParams(), sizeof(dtNavMeshParams)) != 0)
+	{
+		return -1;
+	}
+
+	auto lock = BeginTileChange();
+
+	// tiles without a hash can't be compared, so they are always replaced
+	std::unordered_map<uint64_t, uint64_t> storedHashes;
+	int tilesChanged = 0;
+
+	for (const MeshFileTileEntry& entry : other.m_tileIndex)
+	{
+		uint64_t hash = other.GetTileBuildHash(entry.x, entry.y, entry.layer);
+		storedHashes[TileBuildHashKey(entry.x, entry.y, entry.layer)] = hash;
+
+		if (hash == 0 || hash != GetTileBuildHash(entry.x, entry.y, entry.layer))
+			++tilesChanged;
+	}
+
+	// remove tiles that are gone or were built from different inputs
+	dtNavMesh* navMesh = m_navMesh.get();
+
+	for (int i = 0; i < navMesh->getMaxTiles(); ++i)
+	{
+		const dtMeshTile* tile = const_cast<const dtNavMesh*>(navMesh)->getTile(i);
+		if (!tile || !tile->header)
+			continue;
+
+		const dtMeshHeader* header = tile->header;
+		uint64_t hash = GetTileBuildHash(header->x, header->y, header->layer);
+
+		auto iter = storedHashes.find(TileBuildHashKey(header->x, header->y, header->layer));
+		if (iter == storedHashes.end())
+			++tilesChanged;
+		else if (hash != 0 && iter->second == hash)
+			continue;
+
+		navMesh->removeTile(navMesh->getTileRef(tile), 0, 0);
+	}
+
+	// tiles that were kept may still point into the old file
+	m_patchedFiles.push_back(std::move(m_mappedFile));
+	if (m_sharedTiles)
+		m_patchedFiles.push_back(std::move(m_sharedTiles));
+
+	m_mappedFile = std::move(other.m_mappedFile);
+	m_tileIndex = std::move(other.m_tileIndex);
+	m_fileCodec = other.m_fileCodec;
+	m_sharedTiles = std::move(other.m_sharedTiles);
+	m_sharedTileOffsets = std::move(other.m_sharedTileOffsets);
+	m_dataFile = other.m_dataFile;
+	m_lastLoadResult = other.m_lastLoadResult;
+	m_loadStats = other.m_loadStats;
+
+	AdoptSavedData(other);
+	other.ResetSavedData();
+
+	// with streaming, missing tiles come back on the next position update
+	if (m_streamingRadius > 0.0f)
+	{
+		m_streamingTileX = m_streamingTileY = INT_MIN;
+	}
+	else
+	{
+		LoadAllStoredTiles();
+	}
+
+	OnNavMeshTilesChanged();
+
+	return tilesChanged;
+}
+
+void NavMesh::AdoptSavedData(NavMesh& other)
+{
+	m_boundsMin = other.m_boundsMin;
+	m_boundsMax = other.m_boundsMax;
+	m_config = other.m_config;
+	m_buildSourceHash = other.m_buildSourceHash;
+	m_buildTime = other.m_buildTime;
+	m_savedNodeBudget = other.m_savedNodeBudget;
+
+	m_tileGraph = std::move(other.m_tileGraph);
+	m_landmarks = std::move(other.m_landmarks);
+	m_tileBuildHashes = std::move(other.m_tileBuildHashes);
+	m_prunedTiles = std::move(other.m_prunedTiles);
+	m_pruneSeeds = std::move(other.m_pruneSeeds);
+
+	m_volumes = std::move(other.m_volumes);
+	m_volumesById = std::move(other.m_volumesById);
+	m_nextVolumeId = other.m_nextVolumeId;
+	RebuildConvexVolumeBuckets();
+
+	// the area list points into the area array, so rebuild it against ours
+	m_polyAreas = other.m_polyAreas;
+	m_queryFilters.clear();
+	m_polyAreaList.clear();
+	for (const PolyAreaType* area : other.m_polyAreaList)
+	{
+		m_polyAreaList.push_back(&m_polyAreas[area->id]);
+	}
+}
+
+NavMesh::LoadResult NavMesh::LoadMesh(const char* filename)
+{
+	MQ2NAV_PROFILE_ZONE("NavMesh::LoadMesh");
+
+	// cache the filename of the file we tried to load
+	m_dataFile = filename;
+	m_loadStats = NavMeshStats{};
+
+	auto startTime = stats_clock::now();
+
+	boost::system::error_code ec;
+	if (!fs::exists(filename, ec))
+		return LoadResult::MissingFile;
+
+	// map the file instead of reading it. Tile data is handed to detour straight
+	// out of the mapping, so the mapping is kept alive for the lifetime of the navmesh.
+	auto mappedFile = std::make_shared<MappedFile>();
+	if (!mappedFile->Open(filename))
+	{
+		m_ctx->Log(LogLevel::ERROR, "loadMesh: failed to open mesh file");
+		return LoadResult::Corrupt;
+	}
+
+	uint8_t* data_ptr = mappedFile->GetData();
+	size_t data_size = mappedFile->GetSize();
+
+	if (data_size <= sizeof(MeshFileHeader))
+	{
+		m_ctx->Log(LogLevel::ERROR, "loadMesh: mesh file is not a valid mesh file");
+		return LoadResult::Corrupt;
+	}
+
+	// read header
+	const MeshFileHeader* fileHeader = (const MeshFileHeader*)data_ptr;
+
+	if (fileHeader->magic != NAVMESH_FILE_MAGIC)
+	{
+		m_ctx->Log(LogLevel::ERROR, "loadMesh: mesh file is not a valid mesh file");
+		return LoadResult::Corrupt;
+	}
+
+	if (fileHeader->version < NAVMESH_FILE_MIN_VERSION
+		|| fileHeader->version > NAVMESH_FILE_VERSION)
+	{
+		m_ctx->Log(LogLevel::ERROR, "loadMesh: mesh file has an incompatible version number");
+		return LoadResult::VersionMismatch;
+	}
+
+	if (+(fileHeader->flags & NavMeshFileFlags::PATCH))
+	{
+		m_ctx->Log(LogLevel::ERROR, "loadMesh: mesh file is a patch, it has to be applied to a mesh file");
+		return LoadResult::Corrupt;
+	}
+
+	bool compressed = +(fileHeader->flags & NavMeshFileFlags::COMPRESSED) != 0;
+	const MeshFileContents* contents = nullptr;
+	const MeshFileSummary* summary = nullptr;
+
+	if (fileHeader->version >= 5)
+	{
+		if (data_size < sizeof(MeshFileHeader) + sizeof(MeshFileContents))
+		{
+			m_ctx->Log(LogLevel::ERROR, "loadMesh: mesh file is truncated");
+			return LoadResult::Corrupt;
+		}
+
+		contents = (const MeshFileContents*)(data_ptr + sizeof(MeshFileHeader));
+
+		if ((uint64_t)contents->metadataOffset + contents->metadataSize > data_size
+			|| (uint64_t)contents->tileIndexOffset + (uint64_t)contents->tileCount * TileEntrySize(fileHeader->version) > data_size)
+		{
+			m_ctx->Log(LogLevel::ERROR, "loadMesh: mesh file is truncated");
+			return LoadResult::Corrupt;
+		}
+
+		if (contents->codec != NavMeshFileCodec::None && contents->codec != NavMeshFileCodec::Zlib)
+		{
+			m_ctx->Log(LogLevel::ERROR, "loadMesh: mesh file uses an unsupported compression codec (%d)",
+				static_cast<int>(contents->codec));
+			return LoadResult::VersionMismatch;
+		}
+
+		if (fileHeader->version >= 6)
+		{
+			summary = (const MeshFileSummary*)(contents + 1);
+
+			if (data_size < sizeof(MeshFileHeader) + sizeof(MeshFileContents) + sizeof(MeshFileSummary)
+				|| (uint64_t)summary->summaryOffset + summary->summarySize > data_size)
+			{
+				m_ctx->Log(LogLevel::ERROR, "loadMesh: mesh file is truncated");
+				return LoadResult::Corrupt;
+			}
+
+			// caught here before any of it is inflated or parsed
+			if (fileHeader->version >= 9 && summary->checksum != MeshFileChecksum(data_ptr, *contents, *summary))
+			{
+				m_ctx->Log(LogLevel::ERROR, "loadMesh: mesh file is corrupt (checksum mismatch)");
+				return LoadResult::Corrupt;
+			}
+		}
+	}
+
+	m_loadStats.readMs = MillisecondsSince(startTime);
+	startTime = stats_clock::now();
+
+	// the metadata is mostly small messages (landmarks, tile graph portals,
+	// volumes), they come out of a few large blocks instead of the heap and go
+	// away all at once.
+	google::protobuf::ArenaOptions arenaOptions;
+	arenaOptions.start_block_size = std::max<size_t>(PROTO_ARENA_MIN_BLOCK,
+		contents ? (size_t)contents->metadataDataSize : 0);
+	arenaOptions.max_block_size = std::max(arenaOptions.start_block_size, PROTO_ARENA_MAX_BLOCK);
+	google::protobuf::Arena arena(arenaOptions);
+
+	nav::NavMeshFile& file_proto = *google::protobuf::Arena::CreateMessage<nav::NavMeshFile>(&arena);
+	bool parsed;
+
+	// newer files record the decompressed size so we can inflate in one shot.
+	if (contents)
+	{
+		parsed = ParseMeshFileProto(data_ptr + contents->metadataOffset, contents->metadataSize,
+			compressed, contents->codec, contents->metadataDataSize, file_proto);
+	}
+	else
+	{
+		parsed = ParseMeshFileProto(data_ptr + sizeof(MeshFileHeader), data_size - sizeof(MeshFileHeader),
+			compressed, NavMeshFileCodec::Zlib, 0, file_proto);
+	}
+
+	if (parsed && summary)
+	{
+		// the summary and the metadata have no fields in common
+		nav::NavMeshFile& summary_proto = *google::protobuf::Arena::CreateMessage<nav::NavMeshFile>(&arena);
+		parsed = ParseMeshFileProto(data_ptr + summary->summaryOffset, summary->summarySize,
+			compressed, contents->codec, summary->summaryDataSize, summary_proto);
+
+		file_proto.MergeFrom(summary_proto);
+	}
+
+	if (!parsed)
+	{
+		m_ctx->Log(LogLevel::ERROR, "loadMesh: failed to read mesh file");
+		return LoadResult::Corrupt;
+	}
+
+	if (file_proto.zone_short_name() != m_zoneName)
+	{
+		m_ctx->Log(LogLevel::ERROR, "loadMesh: zone name mismatch! mesh is for '%s'",
+			file_proto.zone_short_name().c_str());
+		return LoadResult::ZoneMismatch;
+	}
+
+	m_loadStats.parseMs = MillisecondsSince(startTime);
+
+	ResetSavedData(PersistedDataFields::All);
+
+	if (contents)
+	{
+		LoadFromProto(file_proto, PersistedDataFields::All & ~PersistedDataFields::MeshTiles);
+		LoadMappedTiles(file_proto.tile_set(), *contents, fileHeader->version, mappedFile);
+		FromProto(file_proto.tile_set().build_hashes(), m_tileBuildHashes);
+	}
+	else
+	{
+		// legacy files carry the tiles inside the proto, the navmesh keeps the
+		// parsed tile data and the mapping can be released.
+		LoadFromProto(file_proto, PersistedDataFields::All);
+	}
+
+	return LoadResult::Success;
+}
+
+// the agent tile set that fits an agent of the given height, or -1 for the main
+// mesh. See SetAgentHeight.
+static int SelectAgentTileSet(const nav::NavMeshTileSet& tileset, float mainHeight, float agentHeight)
+{
+	int best = -1;
+	float bestHeight = mainHeight;
+
+	for (int i = 0; i < tileset.agent_tile_sets_size(); ++i)
+	{
+		float height = tileset.agent_tile_sets(i).profile().agent_height();
+
+		// shortest that is tall enough, otherwise the tallest
+		bool tallEnough = height >= agentHeight;
+		bool bestTallEnough = bestHeight >= agentHeight;
+
+		if (tallEnough ? (!bestTallEnough || height < bestHeight) : (!bestTallEnough && height > bestHeight))
+		{
+			best = i;
+			bestHeight = height;
+		}
+	}
+
+	return best;
+}
+
+// adds a tile from the file to one of the agent navmeshes
+static bool AddAgentTile(dtNavMesh* navMesh, const MeshFileTileEntry& entry, uint8_t* base,
+	NavMeshFileCodec codec)
+{
+	uint8_t* stored = base + entry.dataOffset;
+
+	// no DT_TILE_FREE_DATA: the data lives in the mapping
+	if (!NeedsDecoding(entry))
+	{
+		return VerifyTileData(entry, stored)
+			&& dtStatusSucceed(navMesh->addTile(stored, (int)entry.dataSize, 0, 0, 0));
+	}
+
+	uint8_t* data = (uint8_t*)dtAlloc((int)entry.dataSize, DT_ALLOC_PERM);
+	if (!data)
+		return false;
+
+	if (!ReadTileData(codec, entry, stored, data)
+		|| dtStatusFailed(navMesh->addTile(data, (int)entry.dataSize, DT_TILE_FREE_DATA, 0, 0)))
+	{
+		dtFree(data);
+		return false;
+	}
+
+	return true;
+}
+
+void NavMesh::LoadMappedTiles(const nav::NavMeshTileSet& tileset, const MeshFileContents& contents,
+	int version, const std::shared_ptr<MappedFile>& mappedFile)
+{
+	auto lock = BeginTileChange();
+
+	if (tileset.compatibility_version() != NAVMESH_TILE_COMPAT_VERSION)
+	{
+		m_ctx->Log(LogLevel::ERROR, "loadMesh: navmesh has incompatible structure, will continue loading without tiles.");
+		return;
+	}
+
+	uint8_t* base = mappedFile->GetData();
+	size_t size = mappedFile->GetSize();
+
+	const uint8_t* entries = base + contents.tileIndexOffset;
+
+	// the main mesh's tiles come before those of any agent profile
+	uint32_t mainTileCount = contents.tileCount;
+	for (const nav::AgentTileSet& agentTiles : tileset.agent_tile_sets())
+	{
+		if ((uint64_t)agentTiles.first_tile() + agentTiles.tile_count() > contents.tileCount)
+		{
+			m_ctx->Log(LogLevel::ERROR, "loadMesh: agent profile '%s' is outside of the tile index, will continue loading without tiles.",
+				agentTiles.profile().name().c_str());
+			return;
+		}
+
+		mainTileCount = std::min(mainTileCount, agentTiles.first_tile());
+	}
+
+	auto readTileIndex = [&](uint32_t first, uint32_t count, std::vector<MeshFileTileEntry>& tileIndex)
+	{
+		tileIndex.clear();
+		tileIndex.reserve(count);
+
+		for (uint32_t i = first; i < first + count; ++i)
+		{
+			MeshFileTileEntry entry = ReadTileEntry(entries, i, version);
+
+			if (entry.tileRef == 0 || entry.dataSize == 0)
+				continue;
+
+			if ((uint64_t)entry.dataOffset + entry.storedSize > size
+				|| entry.dataOffset % NAVMESH_FILE_TILE_ALIGNMENT != 0)
+			{
+				m_ctx->Log(LogLevel::WARNING, "Tile %d, %d (%d) is outside of the mesh file",
+					entry.x, entry.y, entry.layer);
+				continue;
+			}
+
+			tileIndex.push_back(entry);
+		}
+	};
+
+	dtNavMeshParams params;
+	FromProto(params, tileset.mesh_params());
+
+	if (m_keepBuildCapacity && tileset.has_build_params())
+		FromProto(params, tileset.build_params());
+
+	// load the mesh of another profile in place of the main one
+	int agentTileSet = -1;
+	if (m_agentHeight > 0.0f && !m_loadAgentMeshes)
+		agentTileSet = SelectAgentTileSet(tileset, m_config.agentHeight, m_agentHeight);
+
+	if (agentTileSet >= 0)
+	{
+		const nav::AgentTileSet& agentTiles = tileset.agent_tile_sets(agentTileSet);
+
+		FromProto(params, agentTiles.mesh_params());
+		readTileIndex(agentTiles.first_tile(), agentTiles.tile_count(), m_tileIndex);
+		m_loadedAgentProfile = agentTiles.profile().name();
+	}
+	else
+	{
+		readTileIndex(0, mainTileCount, m_tileIndex);
+		m_loadedAgentProfile.clear();
+	}
+
+	std::shared_ptr<SharedMemory> sharedTiles;
+	if (m_shareTileData)
+		sharedTiles = OpenSharedTiles(tileset, base, contents.codec);
+
+	// the deleter holds on to the mapping and the shared tiles, tiles in them are
+	// not owned by the navmesh.
+	std::shared_ptr<dtNavMesh> navMesh(dtAllocNavMesh(),
+		[mappedFile, sharedTiles](dtNavMesh* ptr) { dtFreeNavMesh(ptr); });
+
+	dtStatus status = navMesh->init(&params);
+	if (status != DT_SUCCESS)
+	{
+		m_ctx->Log(LogLevel::ERROR, "loadMesh: failed to initialize navmesh, will continue loading without tiles.");
+		m_tileIndex.clear();
+		m_loadedAgentProfile.clear();
+		return;
+	}
+
+	m_navMesh = std::move(navMesh);
+	m_mappedFile = mappedFile;
+	m_fileCodec = contents.codec;
+	m_sharedTiles = std::move(sharedTiles);
+	if (!m_sharedTiles)
+		m_sharedTileOffsets.clear();
+	m_streamingTileX = m_streamingTileY = INT_MIN;
+
+	// with streaming enabled, tiles are brought in by UpdateStreamingPosition
+	if (m_streamingRadius <= 0.0f)
+	{
+		for (const MeshFileTileEntry& entry : m_tileIndex)
+			AddStoredTile(entry);
+	}
+
+	m_agentNavMeshes.clear();
+	if (!m_loadAgentMeshes)
+		return;
+
+	for (const nav::AgentTileSet& agentTiles : tileset.agent_tile_sets())
+	{
+		AgentNavMesh agentMesh;
+		FromProto(agentTiles.profile(), agentMesh.profile);
+
+		dtNavMeshParams agentParams;
+		FromProto(agentParams, agentTiles.mesh_params());
+
+		// agent meshes are built with the same layout as the main one
+		if (m_keepBuildCapacity && tileset.has_build_params())
+			FromProto(agentParams, tileset.build_params());
+
+		agentMesh.navMesh = std::shared_ptr<dtNavMesh>(dtAllocNavMesh(),
+			[mappedFile](dtNavMesh* ptr) { dtFreeNavMesh(ptr); });
+
+		if (dtStatusFailed(agentMesh.navMesh->init(&agentParams)))
+		{
+			m_ctx->Log(LogLevel::WARNING, "loadMesh: failed to initialize navmesh for agent profile '%s'",
+				agentMesh.profile.name.c_str());
+			continue;
+		}
+
+		std::vector<MeshFileTileEntry> agentTileIndex;
+		readTileIndex(agentTiles.first_tile(), agentTiles.tile_count(), agentTileIndex);
+
+		for (const MeshFileTileEntry& entry : agentTileIndex)
+		{
+			if (!AddAgentTile(agentMesh.navMesh.get(), entry, base, contents.codec))
+			{
+				m_ctx->Log(LogLevel::WARNING, "Failed to read tile: %d, %d (%d) of agent profile '%s'",
+					entry.x, entry.y, entry.layer, agentMesh.profile.name.c_str());
+			}
+		}
+
+		m_agentNavMeshes.push_back(std::move(agentMesh));
+	}
+}
+
+std::shared_ptr<SharedMemory> NavMesh::OpenSharedTiles(const nav::NavMeshTileSet& tileset,
+	const uint8_t* fileData, NavMeshFileCodec codec)
+{
+	m_sharedTileOffsets.clear();
+
+	// every client lays the tiles out the same way, so the name only has to tell
+	// apart different builds of the zone: fnv-1a over the tile index and hashes.
+	uint64_t hash = 14695981039346656037ull;
+	auto combine = [&hash](const void* data, size_t size)
+	{
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+	};
+
+	size_t size = 0;
+	for (const MeshFileTileEntry& entry : m_tileIndex)
+	{
+		combine(&entry, sizeof(entry));
+
+		if (!NeedsDecoding(entry))
+			continue;
+
+		m_sharedTileOffsets[entry.dataOffset] = static_cast<uint32_t>(size);
+		size += (entry.dataSize + NAVMESH_FILE_TILE_ALIGNMENT - 1) & ~(NAVMESH_FILE_TILE_ALIGNMENT - 1);
+	}
+
+	// plain tiles are already shared through the file mapping
+	if (size == 0 || size > UINT32_MAX)
+		return nullptr;
+
+	for (const auto& tileHash : tileset.build_hashes())
+	{
+		uint64_t value = tileHash.hash();
+		combine(&value, sizeof(value));
+	}
+
+	char hashText[17];
+	snprintf(hashText, sizeof(hashText), "%016llx", (unsigned long long)hash);
+	std::string name = "Local\\MQ2Nav_Tiles_" + m_zoneName + "_" + hashText;
+
+	auto sharedTiles = std::make_shared<SharedMemory>();
+	if (!sharedTiles->Open(name, size))
+	{
+		m_ctx->Log(LogLevel::WARNING, "Failed to open shared tile data, tiles will not be shared");
+		return nullptr;
+	}
+
+	if (sharedTiles->IsCreator())
+	{
+		bool success = true;
+
+		for (const MeshFileTileEntry& entry : m_tileIndex)
+		{
+			if (!NeedsDecoding(entry))
+				continue;
+
+			uint8_t* data = sharedTiles->GetData() + m_sharedTileOffsets[entry.dataOffset];
+
+			auto startTime = stats_clock::now();
+			bool read = ReadTileData(codec, entry, fileData + entry.dataOffset, data);
+			m_loadStats.inflateMs += MillisecondsSince(startTime);
 
-					if (ref == 0 || tiledata.length() == 0)
-						continue;
+			if (!read)
+			{
+				m_ctx->Log(LogLevel::WARNING, "Failed to decompress tile: %d, %d (%d)",
+					entry.x, entry.y, entry.layer);
+				success = false;
+				break;
+			}
+		}
 
-					// allocate buffer for the data
-					uint8_t* data = (uint8_t*)dtAlloc((int)tiledata.length(), DT_ALLOC_PERM);
-					memcpy(data, &tiledata[0], tiledata.length());
+		if (!sharedTiles->Publish(success))
+			return nullptr;
+	}
+	else if (!sharedTiles->IsReady())
+	{
+		// another client is still filling it in, or failed to. Decompress our own.
+		return nullptr;
+	}
 
-					dtMeshHeader* tileheader = (dtMeshHeader*)data;
+	return sharedTiles;
+}
 
-					dtStatus status = navMesh->addTile(data, (int)tiledata.length(), DT_TILE_FREE_DATA, ref, 0);
-					if (status != DT_SUCCESS)
-					{
-						m_ctx->Log(LogLevel::WARNING, "Failed to read tile: %d, %d (%d) = %d",
-							tileheader->x, tileheader->y, tileheader->layer, status);
-					}
-				}
+bool NavMesh::AddStoredTile(const MeshFileTileEntry& entry)
+{
+	if (!m_navMesh || !m_mappedFile)
+		return false;
 
-				m_navMesh = std::move(navMesh);
+	uint8_t* stored = m_mappedFile->GetData() + entry.dataOffset;
+	dtStatus status;
+
+	auto sharedIter = m_sharedTiles ? m_sharedTileOffsets.find(entry.dataOffset) : m_sharedTileOffsets.end();
+	if (sharedIter != m_sharedTileOffsets.end())
+	{
+		// no DT_TILE_FREE_DATA: the data lives in the shared memory. Pages that
+		// detour writes links into become private.
+		status = AddTileData(m_sharedTiles->GetData() + sharedIter->second,
+			(int)entry.dataSize, 0, (dtTileRef)entry.tileRef);
+	}
+	else if (NeedsDecoding(entry))
+	{
+		uint8_t* data = (uint8_t*)dtAlloc((int)entry.dataSize, DT_ALLOC_PERM);
+		if (!data)
+			return false;
+
+		auto startTime = stats_clock::now();
+		bool read = ReadTileData(m_fileCodec, entry, stored, data);
+		m_loadStats.inflateMs += MillisecondsSince(startTime);
+
+		if (!read)
+		{
+			m_ctx->Log(LogLevel::WARNING, "Failed to decompress tile: %d, %d (%d)",
+				entry.x, entry.y, entry.layer);
+			dtFree(data);
+			return false;
+		}
+
+		int dataSize = (int)entry.dataSize;
+		if (m_simplifyDetailMeshes)
+		{
+			uint8_t* simplified;
+			int simplifiedSize;
+			if (SimplifyTileDetail(data, dataSize, simplified, simplifiedSize))
+			{
+				dtFree(data);
+				data = simplified;
+				dataSize = simplifiedSize;
+			}
+		}
+
+		status = AddTileData(data, dataSize, DT_TILE_FREE_DATA, (dtTileRef)entry.tileRef);
+		if (dtStatusFailed(status))
+			dtFree(data);
+	}
+	else
+	{
+		if (!VerifyTileData(entry, stored))
+		{
+			m_ctx->Log(LogLevel::WARNING, "Tile %d, %d (%d) is corrupt",
+				entry.x, entry.y, entry.layer);
+			return false;
+		}
+
+		// no DT_TILE_FREE_DATA: the data lives in the mapping
+		status = AddTileData(stored, (int)entry.dataSize, 0, (dtTileRef)entry.tileRef);
+	}
+
+	if (status != DT_SUCCESS)
+	{
+		m_ctx->Log(LogLevel::WARNING, "Failed to read tile: %d, %d (%d) = %d",
+			entry.x, entry.y, entry.layer, status);
+		return false;
+	}
+
+	return true;
+}
+
+dtStatus NavMesh::AddTileData(uint8_t* data, int dataSize, int flags, dtTileRef tileRef)
+{
+	MQ2NAV_PROFILE_ZONE("NavMesh::AddTileData");
+
+	auto startTime = stats_clock::now();
+	dtStatus status = m_navMesh->addTile(data, dataSize, flags, tileRef, 0);
+
+	// after a patch, the slot that the tile was saved in can be taken by
+	// another tile. Its polygon refs change either way, so use any free slot.
+	if (dtStatusFailed(status) && dtStatusDetail(status, DT_OUT_OF_MEMORY) && tileRef != 0)
+		status = m_navMesh->addTile(data, dataSize, flags, 0, 0);
+
+	m_loadStats.addTileMs += MillisecondsSince(startTime);
+	return status;
+}
+
+void NavMesh::LoadAllStoredTiles()
+{
+	if (!m_navMesh)
+		return;
+
+	for (const MeshFileTileEntry& entry : m_tileIndex)
+	{
+		// tiles rebuilt around obstacles replace the stored ones
+		if (m_tileCache && m_tileCache->IsTileRebuilt(entry.x, entry.y))
+			continue;
+
+		if (!m_navMesh->getTileAt(entry.x, entry.y, entry.layer))
+			AddStoredTile(entry);
+	}
+}
+
+//----------------------------------------------------------------------------
+
+void NavMesh::SetTileStreamingRadius(float radius)
+{
+	if (radius < 0.0f)
+		radius = 0.0f;
+
+	if (m_streamingRadius == radius)
+		return;
+
+	m_streamingRadius = radius;
+	m_streamingTileX = m_streamingTileY = INT_MIN;
+
+	// turning streaming off brings everything back in
+	if (m_streamingRadius == 0.0f && !m_tileIndex.empty())
+	{
+		auto lock = BeginTileChange();
+		LoadAllStoredTiles();
+		OnNavMeshTilesChanged();
+	}
+}
+
+void NavMesh::UpdateStreamingPosition(const glm::vec3& pos)
+{
+	if (m_streamingRadius <= 0.0f || !m_navMesh || m_tileIndex.empty())
+		return;
+
+	int tx, ty;
+	m_navMesh->calcTileLoc(glm::value_ptr(pos), &tx, &ty);
+
+	// only update the working set when we cross into a different tile
+	if (tx == m_streamingTileX && ty == m_streamingTileY)
+		return;
+
+	m_streamingTileX = tx;
+	m_streamingTileY = ty;
+
+	auto lock = BeginTileChange();
+
+	const dtNavMeshParams* params = m_navMesh->getParams();
+
+	// tiles are kept until they fall out of a slightly larger radius so that we
+	// don't thrash when moving back and forth along a tile edge.
+	int loadX = (int)ceilf(m_streamingRadius / params->tileWidth);
+	int loadY = (int)ceilf(m_streamingRadius / params->tileHeight);
+	int evictX = loadX + 1;
+	int evictY = loadY + 1;
+
+	bool changed = false;
+
+	for (const MeshFileTileEntry& entry : m_tileIndex)
+	{
+		// tiles rebuilt around obstacles can't be read back, keep them resident
+		if (m_tileCache && m_tileCache->IsTileRebuilt(entry.x, entry.y))
+			continue;
+
+		int dx = abs(entry.x - tx);
+		int dy = abs(entry.y - ty);
+
+		const dtMeshTile* tile = m_navMesh->getTileAt(entry.x, entry.y, entry.layer);
+
+		if (tile && (dx > evictX || dy > evictY))
+		{
+			m_navMesh->removeTile(m_navMesh->getTileRef(tile), 0, 0);
+			changed = true;
+		}
+		else if (!tile && dx <= loadX && dy <= loadY)
+		{
+			changed |= AddStoredTile(entry);
+		}
+	}
+
+	if (changed)
+	{
+		OnNavMeshTilesChanged();
+	}
+}
+
+int NavMesh::GetResidentTileCount() const
+{
+	if (!m_navMesh)
+		return 0;
+
+	const dtNavMesh* navMesh = m_navMesh.get();
+	int count = 0;
+
+	for (int i = 0; i < navMesh->getMaxTiles(); ++i)
+	{
+		const dtMeshTile* tile = navMesh->getTile(i);
+		if (tile && tile->header)
+			++count;
+	}
+
+	return count;
+}
+
+size_t NavMesh::GetResidentTileDataSize() const
+{
+	if (!m_navMesh)
+		return 0;
+
+	const dtNavMesh* navMesh = m_navMesh.get();
+	size_t size = 0;
+
+	for (int i = 0; i < navMesh->getMaxTiles(); ++i)
+	{
+		const dtMeshTile* tile = navMesh->getTile(i);
+		if (tile && tile->header)
+			size += tile->dataSize;
+	}
+
+	return size;
+}
+
+static size_t GetQueryNodeBytes(const dtNavMeshQuery* query)
+{
+	const dtNodePool* nodePool = query->getNodePool();
+	if (!nodePool)
+		return 0;
+
+	// the open list is sized to the node pool
+	return nodePool->getMemUsed() + sizeof(dtNode*) * (nodePool->getMaxNodes() + 1);
+}
+
+NavMeshStats NavMesh::GetStats() const
+{
+	NavMeshStats stats = m_loadStats;
+
+	if (!m_navMesh)
+		return stats;
+
+	const dtNavMesh* navMesh = m_navMesh.get();
+
+	// same layout that detour reads the tile data with
+	auto align = [](size_t size) { return (size + 3) & ~(size_t)3; };
+
+	for (int i = 0; i < navMesh->getMaxTiles(); ++i)
+	{
+		const dtMeshTile* tile = navMesh->getTile(i);
+		if (!tile || !tile->header)
+			continue;
+
+		const dtMeshHeader* header = tile->header;
+
+		stats.tiles++;
+		stats.polys += header->polyCount;
+		stats.verts += header->vertCount;
+		stats.links += header->maxLinkCount;
+		stats.detailVerts += header->detailVertCount;
+		stats.detailTris += header->detailTriCount;
+		stats.offMeshLinks += header->offMeshConCount;
+
+		stats.headerBytes += align(sizeof(dtMeshHeader));
+		stats.polyBytes += align(sizeof(float) * 3 * header->vertCount)
+			+ align(sizeof(dtPoly) * header->polyCount);
+		stats.linkBytes += align(sizeof(dtLink) * header->maxLinkCount);
+		stats.detailBytes += align(sizeof(dtPolyDetail) * header->detailMeshCount)
+			+ align(sizeof(float) * 3 * header->detailVertCount)
+			+ align(sizeof(unsigned char) * 4 * header->detailTriCount);
+		stats.bvTreeBytes += align(sizeof(dtBVNode) * header->bvNodeCount);
+		stats.offMeshBytes += align(sizeof(dtOffMeshConnection) * header->offMeshConCount);
+		stats.tileBytes += tile->dataSize;
+	}
+
+	if (m_navMeshQuery)
+	{
+		stats.queries++;
+		stats.queryNodeBytes += GetQueryNodeBytes(m_navMeshQuery.get());
+	}
+
+	if (m_queryPool && m_queryPool->navMesh.lock() == m_navMesh)
+	{
+		for (const dtNavMeshQuery* query : m_queryPool->queries)
+		{
+			stats.queries++;
+			stats.queryNodeBytes += GetQueryNodeBytes(query);
+		}
+	}
+
+	return stats;
+}
+
+bool NavMesh::SaveNavMeshFile()
+{
+	if (m_dataFile.empty())
+	{
+		return false;
+	}
+
+	return SaveMesh(m_dataFile.c_str());
+}
+
+static void WritePadding(std::ostream& out, size_t alignment)
+{
+	static const char zeros[NAVMESH_FILE_TILE_ALIGNMENT] = { 0 };
+
+	size_t pos = static_cast<size_t>(out.tellp());
+	size_t padding = (alignment - (pos % alignment)) % alignment;
+	if (padding)
+		out.write(zeros, padding);
+}
+
+// an empty navmesh with room for just the tiles in navMesh, for its params and
+// tile refs. Returns null if the params can't be reduced, then the navmesh is
+// saved with the params it has.
+static std::shared_ptr<dtNavMesh> CreateFittedNavMesh(const dtNavMesh* navMesh)
+{
+	dtNavMeshParams params = *navMesh->getParams();
+
+	int tileCount = 0;
+	int maxPolys = 1;
+
+	for (int i = 0; i < navMesh->getMaxTiles(); ++i)
+	{
+		const dtMeshTile* tile = navMesh->getTile(i);
+		if (!tile || !tile->header || !tile->dataSize) continue;
+
+		tileCount++;
+		maxPolys = std::max(maxPolys, tile->header->polyCount);
+	}
+
+	if (tileCount == 0 || tileCount >= params.maxTiles)
+		return nullptr;
+
+	// init works out the split of the poly ref bits from these
+	params.maxTiles = tileCount;
+	params.maxPolys = (int)dtNextPow2((unsigned int)maxPolys);
+
+	std::shared_ptr<dtNavMesh> fitted(dtAllocNavMesh(), [](dtNavMesh* ptr) { dtFreeNavMesh(ptr); });
+	if (dtStatusFailed(fitted->init(&params)))
+		return nullptr;
+
+	return fitted;
+}
+
+// everything that goes into a mesh file, taken out of the navmesh so that the
+// file can be written without it
+struct MeshFileSnapshot
+{
+	std::string summary;
+	std::string metadata;
+	std::vector<MeshFileTileEntry> entries;
+
+	// the data of each tile, pointing into the navmesh or into the copies
+	std::vector<const uint8_t*> tileData;
+	std::vector<std::vector<uint8_t>> tileCopies;
+
+	bool compress = true;
+	bool packTiles = false;
+	float cellSize = 0.0f;
+	float cellHeight = 0.0f;
+
+	// the file is a patch, see SaveMeshPatch
+	bool patch = false;
+
+	// the tiles are already stored the way the entries say, as they were read
+	// from another file
+	bool storedTiles = false;
+};
+
+bool NavMesh::SnapshotMesh(MeshFileSnapshot& snapshot, bool copyTiles, std::shared_lock<TileMutex>& tilesLock)
+{
+	if (!m_navMesh)
+	{
+		return false;
+	}
+
+	// the main mesh and the other profiles weren't loaded, saving would lose them
+	if (!m_loadedAgentProfile.empty())
+	{
+		m_ctx->Log(LogLevel::ERROR, "saveMesh: can't save a mesh loaded for agent profile '%s'",
+			m_loadedAgentProfile.c_str());
+		return false;
+	}
+
+	// todo: Configuration
+	snapshot.compress = true;
+	snapshot.packTiles = m_config.packTiles;
+	snapshot.cellSize = m_config.cellSize;
+	snapshot.cellHeight = m_config.cellHeight;
+
+	// Build the summary, read by tools that only want the settings. It's
+	// serialized once the poly count is known.
+	nav::NavMeshFile summary_proto;
+	summary_proto.set_zone_short_name(m_zoneName);
+
+	SaveToProto(summary_proto, PersistedDataFields::Summary);
+
+	// Build the NavMeshFile proto with the rest. Tiles are stored separately.
+	nav::NavMeshFile file_proto;
+
+	SaveToProto(file_proto, PersistedDataFields::All
+		& ~(PersistedDataFields::MeshTiles | PersistedDataFields::Summary));
+
+	// tiles that were streamed out still need to be written
+	if (m_streamingRadius > 0.0f)
+		LoadAllStoredTiles();
+
+	nav::NavMeshTileSet* tileset = file_proto.mutable_tile_set();
+	tileset->set_compatibility_version(NAVMESH_TILE_COMPAT_VERSION);
+	ToProto(*tileset->mutable_build_hashes(), m_tileBuildHashes);
+
+	// the tiles stay where they are until they're copied, or written if they
+	// aren't copied
+	tilesLock = LockTiles();
+
+	// Build the tile index. Each tile is compressed separately, when it's written.
+	// Tiles are written in tile order and fill the slots in that order when they
+	// are loaded, so the file doesn't depend on the order they were built in.
+	uint32_t polyCount = 0;
+
+	auto addTiles = [&](const dtNavMesh* navMesh, const dtNavMesh* fittedNavMesh)
+	{
+		unsigned int tileIndex = 0;
+
+		for (const dtMeshTile* tile : GetTilesInOrder(*navMesh))
+		{
+			if (navMesh == m_navMesh.get())
+				polyCount += tile->header->polyCount;
+
+			MeshFileTileEntry entry = { 0 };
+
+			// tiles fill the slots of the fitted navmesh, or of the navmesh itself
+			// when it keeps room for tiles that aren't there yet
+			entry.tileRef = (fittedNavMesh ? fittedNavMesh : navMesh)->encodePolyId(1, tileIndex++, 0);
+			entry.x = tile->header->x;
+			entry.y = tile->header->y;
+			entry.layer = tile->header->layer;
+			entry.dataSize = tile->dataSize;
+
+			snapshot.entries.push_back(entry);
+
+			if (copyTiles)
+			{
+				snapshot.tileCopies.emplace_back(tile->data, tile->data + tile->dataSize);
+				snapshot.tileData.push_back(snapshot.tileCopies.back().data());
 			}
 			else
 			{
-				m_ctx->Log(LogLevel::ERROR, "loadMesh: failed to initialize navmesh, will continue loading without tiles.");
+				snapshot.tileData.push_back(tile->data);
 			}
 		}
+	};
+
+	// Save params that only make room for the tiles that are there, so that a
+	// mesh that is mostly empty doesn't allocate for all of it when loaded. Tiles
+	// rebuilt from the tile cache can go where there were none, so that keeps
+	// what it was built with.
+	std::shared_ptr<dtNavMesh> fittedNavMesh;
+	if (!m_tileCache)
+		fittedNavMesh = CreateFittedNavMesh(m_navMesh.get());
+
+	if (fittedNavMesh)
+	{
+		ToProto(*tileset->mutable_mesh_params(), fittedNavMesh->getParams());
+		ToProto(*tileset->mutable_build_params(), m_navMesh->getParams());
+	}
+	else
+	{
+		ToProto(*tileset->mutable_mesh_params(), m_navMesh->getParams());
+	}
+
+	addTiles(m_navMesh.get(), fittedNavMesh.get());
+
+	// then the meshes of the other agent profiles. The tile cache only covers
+	// the main mesh.
+	for (const AgentNavMesh& agentMesh : m_agentNavMeshes)
+	{
+		if (!agentMesh.navMesh)
+			continue;
+
+		std::shared_ptr<dtNavMesh> fittedAgentMesh = CreateFittedNavMesh(agentMesh.navMesh.get());
+
+		nav::AgentTileSet* agentTiles = tileset->add_agent_tile_sets();
+		ToProto(*agentTiles->mutable_profile(), agentMesh.profile);
+		ToProto(*agentTiles->mutable_mesh_params(),
+			fittedAgentMesh ? fittedAgentMesh->getParams() : agentMesh.navMesh->getParams());
+		agentTiles->set_first_tile(static_cast<uint32_t>(snapshot.entries.size()));
+
+		addTiles(agentMesh.navMesh.get(), fittedAgentMesh.get());
+
+		agentTiles->set_tile_count(static_cast<uint32_t>(snapshot.entries.size()) - agentTiles->first_tile());
+	}
+
+	// todo: save offmesh connections
+
+	summary_proto.mutable_build_info()->set_poly_count(polyCount);
+
+	m_savedNodeBudget = ComputeQueryNodeBudget(m_navMesh.get());
+	summary_proto.mutable_build_info()->set_query_node_budget(m_savedNodeBudget);
+	summary_proto.SerializeToString(&snapshot.summary);
+
+	file_proto.SerializeToString(&snapshot.metadata);
+	return true;
+}
+
+// how many tiles each save worker may have compressed ahead of the file
+static const size_t TILE_WRITE_WINDOW_PER_THREAD = 4;
+
+// pack and compress a tile the way it's stored in the file
+static void StoreTile(const MeshFileSnapshot& snapshot, MeshFileTileEntry& entry, const uint8_t* tileData,
+	std::vector<uint8_t>& data)
+{
+	if (snapshot.storedTiles)
+	{
+		data.assign(tileData, tileData + entry.storedSize);
+	}
+	else
+	{
+		// the packed tile takes the place of the tile data when there is one
+		std::vector<uint8_t> packed;
+		const uint8_t* source = tileData;
+		size_t sourceSize = entry.dataSize;
+
+		if (snapshot.packTiles
+			&& PackTileData(tileData, entry.dataSize, snapshot.cellSize, snapshot.cellHeight, packed))
+		{
+			entry.flags |= MeshFileTileFlags::PACKED;
+			entry.packedSize = static_cast<uint32_t>(packed.size());
+			source = packed.data();
+			sourceSize = packed.size();
+		}
+
+		if (snapshot.compress && CompressMemory((void*)source, sourceSize, data)
+			&& data.size() < sourceSize)
+		{
+			entry.flags |= MeshFileTileFlags::COMPRESSED;
+		}
 		else
 		{
-			m_ctx->Log(LogLevel::ERROR, "loadMesh: navmesh has incompatible structure, will continue loading without tiles.");
-		}
+			data.assign(source, source + sourceSize);
+		}
+	}
+
+	entry.storedSize = static_cast<uint32_t>(data.size());
+	entry.checksum = Crc32(data.data(), data.size());
+	entry.flags |= MeshFileTileFlags::CHECKSUM;
+}
+
+static bool WriteMeshFile(MeshFileSnapshot& snapshot, const std::string& filename, Context* ctx)
+{
+	// write to a temporary file and then move it into place. The existing file may
+	// be mapped by a running client, and clients that reload the mesh when it
+	// changes never see half of a file.
+	std::string tempFilename = filename + ".tmp";
+
+	std::ofstream outfile(tempFilename.c_str(), std::ios::binary | std::ios::trunc);
+	if (!outfile.is_open())
+		return false;
+
+	const bool compress = snapshot.compress;
+	const std::string& summary = snapshot.summary;
+	const std::string& metadata = snapshot.metadata;
+	std::vector<MeshFileTileEntry>& entries = snapshot.entries;
+
+	// the metadata is compressed alongside the tiles
+	std::vector<uint8_t> compressedMetadata;
+	std::future<void> metadataTask;
+	if (compress)
+	{
+		metadataTask = std::async(std::launch::async, [&]()
+		{
+			CompressMemory((void*)metadata.data(), metadata.length(), compressedMetadata);
+		});
 	}
 
-	if (+(fields & PersistedDataFields::BuildSettings))
+	std::vector<uint8_t> compressedSummary;
+	if (compress)
 	{
-		// load build settings
-		FromProto(proto.build_settings(), m_config);
-
-		m_boundsMin = FromProto(proto.build_settings().bounds_min());
-		m_boundsMax = FromProto(proto.build_settings().bounds_max());
+		CompressMemory((void*)summary.data(), summary.length(), compressedSummary);
 	}
 
-	if (+(fields & PersistedDataFields::AreaTypes))
+	// tiles are compressed on a thread per core, taking the next tile as each one
+	// finishes, and written out in order as soon as they're ready. The workers
+	// stay a few tiles ahead of the file, only those are held in memory.
+	const size_t threadCount = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u),
+		std::max<size_t>(entries.size(), 1));
+	const size_t window = threadCount * TILE_WRITE_WINDOW_PER_THREAD;
+
+	struct TileSlot
 	{
-		// load areas
-		for (const auto& proto_area : proto.areas())
+		std::vector<uint8_t> data;
+		bool ready = false;
+	};
+	std::vector<TileSlot> slots(window);
+	std::mutex slotsMutex;
+	std::condition_variable slotReady, slotFree;
+	size_t tilesWritten = 0;
+	std::atomic<size_t> nextTile{ 0 };
+
+	auto storeTiles = [&]()
+	{
+		for (size_t i = nextTile++; i < entries.size(); i = nextTile++)
 		{
-			PolyAreaType area;
-			FromProto(proto_area, area);
+			{
+				std::unique_lock<std::mutex> lock(slotsMutex);
+				slotFree.wait(lock, [&]() { return i < tilesWritten + window; });
+			}
 
-			UpdateArea(area);
+			std::vector<uint8_t> data;
+			StoreTile(snapshot, entries[i], snapshot.tileData[i], data);
+
+			{
+				std::unique_lock<std::mutex> lock(slotsMutex);
+				slots[i % window].data = std::move(data);
+				slots[i % window].ready = true;
+			}
+			slotReady.notify_all();
 		}
+	};
+
+	std::vector<std::future<void>> workers;
+	for (size_t i = 0; i < threadCount; ++i)
+		workers.push_back(std::async(std::launch::async, storeTiles));
+
+	if (metadataTask.valid())
+		metadataTask.get();
+
+	MeshFileSummary fileSummary;
+	fileSummary.summaryOffset = sizeof(MeshFileHeader) + sizeof(MeshFileContents) + sizeof(MeshFileSummary);
+	fileSummary.summarySize = static_cast<uint32_t>(compress ? compressedSummary.size() : summary.length());
+	fileSummary.summaryDataSize = static_cast<uint32_t>(summary.length());
+	fileSummary.checksum = 0;
+
+	MeshFileContents contents;
+	contents.metadataOffset = fileSummary.summaryOffset + fileSummary.summarySize;
+	contents.metadataSize = static_cast<uint32_t>(compress ? compressedMetadata.size() : metadata.length());
+	contents.metadataDataSize = static_cast<uint32_t>(metadata.length());
+	contents.codec = compress ? NavMeshFileCodec::Zlib : NavMeshFileCodec::None;
+	contents.tileIndexOffset = contents.metadataOffset + contents.metadataSize;
+	contents.tileIndexOffset = (contents.tileIndexOffset + 7) & ~7;
+	contents.tileCount = static_cast<uint32_t>(entries.size());
+
+	// Store header.
+	MeshFileHeader header;
+	header.magic = NAVMESH_FILE_MAGIC;
+	header.version = NAVMESH_FILE_VERSION;
+	header.flags = NavMeshFileFlags{};
+
+	if (compress) header.flags |= NavMeshFileFlags::COMPRESSED;
+	if (snapshot.patch) header.flags |= NavMeshFileFlags::PATCH;
+
+	outfile.write((const char*)&header, sizeof(MeshFileHeader));
+	outfile.write((const char*)&contents, sizeof(MeshFileContents));
+	outfile.write((const char*)&fileSummary, sizeof(MeshFileSummary));
+
+	if (compress)
+		outfile.write((const char*)&compressedSummary[0], compressedSummary.size());
+	else
+		outfile.write(summary.data(), summary.length());
+
+	if (compress)
+		outfile.write((const char*)&compressedMetadata[0], compressedMetadata.size());
+	else
+		outfile.write(metadata.data(), metadata.length());
+
+	// the tile index goes in once the tiles are written and their sizes are known,
+	// the workers are still filling in the entries.
+	WritePadding(outfile, 8);
+	if (!entries.empty())
+	{
+		std::vector<MeshFileTileEntry> placeholder(entries.size(), MeshFileTileEntry{});
+		outfile.write((const char*)&placeholder[0], placeholder.size() * sizeof(MeshFileTileEntry));
 	}
 
-	if (+(fields & PersistedDataFields::ConvexVolumes))
+	for (size_t i = 0; i < entries.size(); ++i)
 	{
-		// load convex volumes
-		for (const auto& proto_volume : proto.convex_volumes())
+		std::vector<uint8_t> data;
 		{
-			std::unique_ptr<ConvexVolume> vol = FromProto(proto_volume);
-			m_volumesById.emplace(vol->id, vol.get());
-			m_volumes.push_back(std::move(vol));
-		}
+			std::unique_lock<std::mutex> lock(slotsMutex);
+			slotReady.wait(lock, [&]() { return slots[i % window].ready; });
 
-		// find the next volume id
-		for (const auto& volume : m_volumes)
-		{
-			m_nextVolumeId = std::max(m_nextVolumeId, volume->id + 1);
+			data = std::move(slots[i % window].data);
+			slots[i % window].ready = false;
+			tilesWritten++;
 		}
-	}
-}
+		slotFree.notify_all();
 
-void NavMesh::SaveToProto(nav::NavMeshFile& proto, PersistedDataFields fields)
-{
-	if (+(fields & PersistedDataFields::BuildSettings))
-	{
-		// save build settings
-		ToProto(*proto.mutable_build_settings(), m_config);
-		ToProto(*proto.mutable_build_settings()->mutable_bounds_min(), m_boundsMin);
-		ToProto(*proto.mutable_build_settings()->mutable_bounds_max(), m_boundsMax);
+		WritePadding(outfile, NAVMESH_FILE_TILE_ALIGNMENT);
+		entries[i].dataOffset = static_cast<uint32_t>(outfile.tellp());
+		outfile.write((const char*)data.data(), data.size());
 	}
 
-	if (+(fields & PersistedDataFields::MeshTiles))
+	for (std::future<void>& worker : workers)
+		worker.get();
+
+	if (!entries.empty())
 	{
-		// save the navmesh data
-		nav::NavMeshTileSet* tileset = proto.mutable_tile_set();
-		tileset->set_compatibility_version(NAVMESH_TILE_COMPAT_VERSION);
-		ToProto(*tileset->mutable_mesh_params(), m_navMesh->getParams());
-		ToProto(*tileset->mutable_tiles(), m_navMesh.get());
+		outfile.seekp(contents.tileIndexOffset);
+		outfile.write((const char*)&entries[0], entries.size() * sizeof(MeshFileTileEntry));
 	}
 
-	if (+(fields & PersistedDataFields::ConvexVolumes))
+	// and the checksum over all of it, now that the tile index is done
+	if (compress)
+		fileSummary.checksum = Crc32(compressedSummary.data(), compressedSummary.size());
+	else
+		fileSummary.checksum = Crc32(summary.data(), summary.length());
+	if (compress)
+		fileSummary.checksum = Crc32(compressedMetadata.data(), compressedMetadata.size(), fileSummary.checksum);
+	else
+		fileSummary.checksum = Crc32(metadata.data(), metadata.length(), fileSummary.checksum);
+	fileSummary.checksum = Crc32(entries.data(), entries.size() * sizeof(MeshFileTileEntry), fileSummary.checksum);
+
+	outfile.seekp(sizeof(MeshFileHeader) + sizeof(MeshFileContents));
+	outfile.write((const char*)&fileSummary, sizeof(MeshFileSummary));
+
+	bool success = outfile.good();
+	outfile.close();
+
+	boost::system::error_code ec;
+	if (success)
 	{
-		// save convex volumes
-		for (const auto& volume : m_volumes)
+		fs::rename(tempFilename, filename, ec);
+		if (ec)
 		{
-			nav::ConvexVolume* proto_vol = proto.add_convex_volumes();
-			ToProto(*proto_vol, *volume);
+			ctx->Log(LogLevel::ERROR, "saveMesh: failed to replace mesh file: %s", ec.message().c_str());
+			success = false;
 		}
 	}
 
-	if (+(fields & PersistedDataFields::AreaTypes))
+	if (!success)
 	{
-		// save area definitions
-		for (const PolyAreaType* area : m_polyAreaList)
-		{
-			// only serialize user defined areas
-			if (area->id == (uint8_t)PolyArea::Unwalkable)
-				continue;
+		fs::remove(tempFilename, ec);
+	}
 
-			if (!IsUserDefinedPolyArea(area->id))
-			{
-				if (area->id < DefaultPolyAreas.size()
-					&& *area == DefaultPolyAreas[area->id])
-				{
-					continue;
-				}
-			}
+	return success;
+}
 
-			nav::PolyAreaType* proto_area = proto.add_areas();
-			ToProto(*proto_area, *area);
-		}
-	}
+bool NavMesh::SaveMesh(const char* filename)
+{
+	// the tiles are read in place, the lock keeps them there until they're written
+	MeshFileSnapshot snapshot;
+	std::shared_lock<TileMutex> tilesLock;
+	if (!SnapshotMesh(snapshot, false, tilesLock))
+		return false;
+
+	return WriteMeshFile(snapshot, filename, m_ctx);
 }
 
-NavMesh::LoadResult NavMesh::LoadNavMeshFile()
+std::future<bool> NavMesh::SaveNavMeshFileAsync()
 {
-	if (m_dataFile.empty())
+	auto snapshot = std::make_shared<MeshFileSnapshot>();
+	std::shared_lock<TileMutex> tilesLock;
+	if (m_dataFile.empty() || !SnapshotMesh(*snapshot, true, tilesLock))
 	{
-		return LoadResult::MissingFile;
+		std::promise<bool> failed;
+		failed.set_value(false);
+		return failed.get_future();
 	}
 
-	m_lastLoadResult = LoadMesh(m_dataFile.c_str());
-	OnNavMeshChanged();
+	tilesLock.unlock();
 
-	return m_lastLoadResult;
+	return std::async(std::launch::async, [snapshot, filename = m_dataFile, ctx = m_ctx]()
+	{
+		return WriteMeshFile(*snapshot, filename, ctx);
+	});
 }
 
-NavMesh::LoadResult NavMesh::LoadMesh(const char* filename)
+// a mesh file that a patch is made from or applied to, with its summary and
+// metadata read
+struct MeshFileView
 {
-	// cache the filename of the file we tried to load
-	m_dataFile = filename;
+	MappedFile file;
+	const MeshFileHeader* header = nullptr;
+	const MeshFileContents* contents = nullptr;
+	const MeshFileSummary* summary = nullptr;
 
-	FILE* file = 0;
-	errno_t err = fopen_s(&file, filename, "rb");
-	if (err == ENOENT)
-		return LoadResult::MissingFile;
-	else if (!file)
-		return LoadResult::Corrupt;
-
-	scope_guard g = [file]() { fclose(file); };
-	
-	// read the whole file
-	size_t filesize = 0;
-	fseek(file, 0, SEEK_END);
-	filesize = ftell(file);
-	rewind(file);
+	std::vector<uint8_t> summaryData;
+	std::vector<uint8_t> metadataData;
+	nav::NavMeshFile proto;
 
-	if (filesize <= sizeof(MeshFileHeader))
+	MeshFileTileEntry Entry(uint32_t i) const
 	{
-		m_ctx->Log(LogLevel::ERROR, "loadMesh: mesh file is not a valid mesh file");
-		return LoadResult::Corrupt;
+		return ReadTileEntry(file.GetData() + contents->tileIndexOffset, i, header->version);
 	}
+};
+
+// only files with a summary can be patched, older ones need to be saved again
+static bool OpenMeshFileView(const std::string& filename, MeshFileView& view)
+{
+	if (!view.file.Open(filename.c_str()))
+		return false;
+
+	const uint8_t* data = view.file.GetData();
+	size_t size = view.file.GetSize();
+
+	if (size < sizeof(MeshFileHeader) + sizeof(MeshFileContents) + sizeof(MeshFileSummary))
+		return false;
+
+	view.header = (const MeshFileHeader*)data;
+	view.contents = (const MeshFileContents*)(view.header + 1);
+	view.summary = (const MeshFileSummary*)(view.contents + 1);
 
-	std::unique_ptr<char[]> buffer(new char[filesize]);
-	size_t result = fread(buffer.get(), filesize, 1, file);
-	if (result != 1)
+	const MeshFileContents& contents = *view.contents;
+	const MeshFileSummary& summary = *view.summary;
+
+	if (view.header->magic != NAVMESH_FILE_MAGIC
+		|| view.header->version < 6
+		|| view.header->version > NAVMESH_FILE_VERSION
+		|| (contents.codec != NavMeshFileCodec::None && contents.codec != NavMeshFileCodec::Zlib)
+		|| (uint64_t)summary.summaryOffset + summary.summarySize > size
+		|| (uint64_t)contents.metadataOffset + contents.metadataSize > size
+		|| (uint64_t)contents.tileIndexOffset + (uint64_t)contents.tileCount * TileEntrySize(view.header->version) > size)
 	{
-		m_ctx->Log(LogLevel::ERROR, "loadMesh: failed to read contents of mesh file");
-		return LoadResult::Corrupt;
+		return false;
 	}
 
-	char* data_ptr = buffer.get();
-	size_t data_size = filesize;
+	if (view.header->version >= 9 && summary.checksum != MeshFileChecksum(data, contents, summary))
+		return false;
 
-	// read header
-	MeshFileHeader* fileHeader = (MeshFileHeader*)data_ptr;
-	data_ptr += sizeof(MeshFileHeader); data_size -= sizeof(MeshFileHeader);
+	bool compressed = +(view.header->flags & NavMeshFileFlags::COMPRESSED) != 0;
 
-	if (fileHeader->magic != NAVMESH_FILE_MAGIC)
+	if (!ReadMeshFileSection(data + summary.summaryOffset, summary.summarySize, compressed,
+			contents.codec, summary.summaryDataSize, view.summaryData)
+		|| !ReadMeshFileSection(data + contents.metadataOffset, contents.metadataSize, compressed,
+			contents.codec, contents.metadataDataSize, view.metadataData))
 	{
-		m_ctx->Log(LogLevel::ERROR, "loadMesh: mesh file is not a valid mesh file");
-		return LoadResult::Corrupt;
+		return false;
 	}
 
-	if (fileHeader->version != NAVMESH_FILE_VERSION)
+	nav::NavMeshFile summaryProto;
+	if (!summaryProto.ParseFromArray(view.summaryData.data(), (int)view.summaryData.size())
+		|| !view.proto.ParseFromArray(view.metadataData.data(), (int)view.metadataData.size()))
 	{
-		m_ctx->Log(LogLevel::ERROR, "loadMesh: mesh file has an incompatible version number");
-		return LoadResult::VersionMismatch;
+		return false;
 	}
 
-	bool compressed = +(fileHeader->flags & NavMeshFileFlags::COMPRESSED) != 0;
-	nav::NavMeshFile file_proto;
+	view.proto.MergeFrom(summaryProto);
 
-	if (compressed)
+	for (uint32_t i = 0; i < contents.tileCount; ++i)
 	{
-		std::vector<uint8_t> data;
-		if (!DecompressMemory(data_ptr, data_size, data))
-		{
-			m_ctx->Log(LogLevel::ERROR, "loadMesh: failed to decompress mesh file");
-			return LoadResult::Corrupt;
-		}
+		MeshFileTileEntry entry = view.Entry(i);
+		if ((uint64_t)entry.dataOffset + entry.storedSize > size)
+			return false;
+	}
 
-		buffer.reset();
+	return true;
+}
 
-		if (!file_proto.ParseFromArray(&data[0], (int)data.size()))
-		{
-			m_ctx->Log(LogLevel::ERROR, "loadMesh: failed to parse mesh file");
-			return LoadResult::Corrupt;
-		}
-	}
-	else
+bool NavMesh::SaveMeshPatch(const std::string& filename, const std::string& baseFile)
+{
+	MeshFileView base;
+	if (!OpenMeshFileView(baseFile, base) || +(base.header->flags & NavMeshFileFlags::PATCH))
 	{
-		if (!file_proto.ParseFromArray(data_ptr, (int)data_size))
-		{
-			m_ctx->Log(LogLevel::ERROR, "loadMesh: failed to parse mesh file");
-			return LoadResult::Corrupt;
-		}
+		m_ctx->Log(LogLevel::ERROR, "saveMeshPatch: failed to read mesh file '%s'", baseFile.c_str());
+		return false;
 	}
 
-	if (file_proto.zone_short_name() != m_zoneName)
+	// build hashes are only kept for the main mesh
+	if (base.proto.tile_set().agent_tile_sets_size() > 0 || !m_agentNavMeshes.empty())
 	{
-		m_ctx->Log(LogLevel::ERROR, "loadMesh: zone name mismatch! mesh is for '%s'",
-			file_proto.zone_short_name());
-		return LoadResult::ZoneMismatch;
+		m_ctx->Log(LogLevel::ERROR, "saveMeshPatch: meshes with agent profiles can't be patched");
+		return false;
 	}
 
-	ResetSavedData(PersistedDataFields::All);
+	std::unordered_map<uint64_t, uint64_t> baseHashes;
+	FromProto(base.proto.tile_set().build_hashes(), baseHashes);
 
-	LoadFromProto(file_proto, PersistedDataFields::All);
+	MeshFileSnapshot snapshot;
+	std::shared_lock<TileMutex> tilesLock;
+	if (!SnapshotMesh(snapshot, false, tilesLock))
+		return false;
 
-	return LoadResult::Success;
-}
+	// tiles without a hash can't be compared, so they are always in the patch
+	size_t tileCount = snapshot.entries.size();
+	size_t kept = 0;
 
-bool NavMesh::SaveNavMeshFile()
-{
-	if (m_dataFile.empty())
+	for (size_t i = 0; i < snapshot.entries.size(); ++i)
 	{
-		return false;
+		const MeshFileTileEntry& entry = snapshot.entries[i];
+		uint64_t key = TileBuildHashKey(entry.x, entry.y, entry.layer);
+		uint64_t hash = GetTileBuildHash(entry.x, entry.y, entry.layer);
+
+		auto iter = baseHashes.find(key);
+		if (hash != 0 && iter != baseHashes.end() && iter->second == hash)
+			continue;
+
+		snapshot.entries[kept] = entry;
+		snapshot.tileData[kept] = snapshot.tileData[i];
+		kept++;
 	}
 
-	return SaveMesh(m_dataFile.c_str());
+	snapshot.entries.resize(kept);
+	snapshot.tileData.resize(kept);
+	snapshot.patch = true;
+
+	m_ctx->Log(LogLevel::INFO, "Saving patch with %d of %d tiles", (int)kept, (int)tileCount);
+	return WriteMeshFile(snapshot, filename, m_ctx);
 }
 
-bool NavMesh::SaveMesh(const char* filename)
+bool NavMesh::ApplyMeshPatch(const std::string& meshFile, const std::string& patchFile, Context* ctx)
 {
-	if (!m_navMesh)
+	MeshFileView patch;
+	if (!OpenMeshFileView(patchFile, patch) || !+(patch.header->flags & NavMeshFileFlags::PATCH))
 	{
+		ctx->Log(LogLevel::ERROR, "applyMeshPatch: '%s' is not a valid mesh patch", patchFile.c_str());
 		return false;
 	}
 
-	std::ofstream outfile(filename, std::ios::binary | std::ios::trunc);
-	if (!outfile.is_open())
+	MeshFileView base;
+	if (!OpenMeshFileView(meshFile, base) || +(base.header->flags & NavMeshFileFlags::PATCH))
+	{
+		ctx->Log(LogLevel::ERROR, "applyMeshPatch: failed to read mesh file '%s'", meshFile.c_str());
 		return false;
+	}
 
-	// todo: Configuration
-	bool compress = true;
-
-	// Build the NavMeshFile proto
+	if (base.proto.zone_short_name() != patch.proto.zone_short_name()
+		|| base.proto.tile_set().agent_tile_sets_size() > 0)
+	{
+		ctx->Log(LogLevel::ERROR, "applyMeshPatch: '%s' is not for this mesh", patchFile.c_str());
+		return false;
+	}
 
-	nav::NavMeshFile file_proto;
-	file_proto.set_zone_short_name(m_zoneName);
+	// the tiles of the patched mesh are those in the patch, and the ones of the
+	// base that have the hash that the patch expects
+	MeshFileSnapshot snapshot;
+	snapshot.summary.assign(patch.summaryData.begin(), patch.summaryData.end());
+	snapshot.metadata.assign(patch.metadataData.begin(), patch.metadataData.end());
+	snapshot.storedTiles = true;
 
-	SaveToProto(file_proto, PersistedDataFields::All);
+	std::unordered_set<uint64_t> patchedTiles;
+	for (uint32_t i = 0; i < patch.contents->tileCount; ++i)
+	{
+		MeshFileTileEntry entry = patch.Entry(i);
+		const uint8_t* stored = patch.file.GetData() + entry.dataOffset;
 
-	// todo: save offmesh connections
+		if (!VerifyTileData(entry, stored))
+		{
+			ctx->Log(LogLevel::ERROR, "applyMeshPatch: '%s' is corrupt", patchFile.c_str());
+			return false;
+		}
 
-	// Store header.
-	MeshFileHeader header;
-	header.magic = NAVMESH_FILE_MAGIC;
-	header.version = NAVMESH_FILE_VERSION;
-	header.flags = NavMeshFileFlags{};
+		patchedTiles.insert(TileBuildHashKey(entry.x, entry.y, entry.layer));
+		snapshot.entries.push_back(entry);
+		snapshot.tileData.push_back(stored);
+	}
 
-	if (compress) header.flags |= NavMeshFileFlags::COMPRESSED;
+	std::unordered_map<uint64_t, uint64_t> baseHashes, hashes;
+	FromProto(base.proto.tile_set().build_hashes(), baseHashes);
+	FromProto(patch.proto.tile_set().build_hashes(), hashes);
 
-	outfile.write((const char*)&header, sizeof(MeshFileHeader));
+	size_t tilesExpected = 0;
+	for (const auto& tileHash : hashes)
+	{
+		if (!patchedTiles.count(tileHash.first))
+			tilesExpected++;
+	}
 
-	if (compress)
+	size_t tilesKept = 0;
+	for (uint32_t i = 0; i < base.contents->tileCount; ++i)
 	{
-		std::string buffer;
-		file_proto.SerializeToString(&buffer);
+		MeshFileTileEntry entry = base.Entry(i);
+		if (entry.tileRef == 0 || entry.dataSize == 0)
+			continue;
 
-		std::vector<uint8_t> data;
-		CompressMemory(&buffer[0], buffer.length(), data);
+		uint64_t key = TileBuildHashKey(entry.x, entry.y, entry.layer);
+		if (patchedTiles.count(key) || !hashes.count(key))
+			continue;
+
+		const uint8_t* stored = base.file.GetData() + entry.dataOffset;
+		if (!VerifyTileData(entry, stored))
+		{
+			ctx->Log(LogLevel::ERROR, "applyMeshPatch: mesh file '%s' is corrupt", meshFile.c_str());
+			return false;
+		}
 
-		outfile.write((const char*)&data[0], data.size());
+		auto iter = baseHashes.find(key);
+		if (iter == baseHashes.end() || iter->second != hashes[key])
+			continue;
+
+		snapshot.entries.push_back(entry);
+		snapshot.tileData.push_back(stored);
+		tilesKept++;
 	}
-	else
+
+	if (tilesKept != tilesExpected)
 	{
-		file_proto.SerializeToOstream(&outfile);
+		ctx->Log(LogLevel::ERROR, "applyMeshPatch: '%s' was made against a different version of the mesh",
+			patchFile.c_str());
+		return false;
 	}
 
-	outfile.close();
-	return true;
+	// the tiles fill the slots of the patched mesh's params in order, the way
+	// they are saved
+	dtNavMeshParams params;
+	FromProto(params, patch.proto.tile_set().mesh_params());
+
+	std::shared_ptr<dtNavMesh> navMesh(dtAllocNavMesh(), [](dtNavMesh* ptr) { dtFreeNavMesh(ptr); });
+	if (dtStatusFailed(navMesh->init(&params)) || (int)snapshot.entries.size() > params.maxTiles)
+	{
+		ctx->Log(LogLevel::ERROR, "applyMeshPatch: the tiles don't fit the patched mesh");
+		return false;
+	}
+
+	for (size_t i = 0; i < snapshot.entries.size(); ++i)
+		snapshot.entries[i].tileRef = navMesh->encodePolyId(1, (unsigned int)i, 0);
+
+	ctx->Log(LogLevel::INFO, "Applying patch to %s: %d tiles replaced or added, %d kept",
+		meshFile.c_str(), (int)patchedTiles.size(), (int)tilesKept);
+
+	// the views have to stay open until the file is written
+	return WriteMeshFile(snapshot, meshFile, ctx);
+}
+
+void NavMesh::ApplyPendingPatch()
+{
+	fs::path patchPath = fs::path(m_dataFile).replace_extension(NAVMESH_PATCH_EXTENSION);
+
+	boost::system::error_code ec;
+	if (!fs::exists(patchPath, ec))
+		return;
+
+	// take the patch out of the way first, other clients that share the
+	// directory can be loading the same mesh.
+	fs::path takenPath = patchPath;
+	takenPath += "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+
+	fs::rename(patchPath, takenPath, ec);
+	if (ec)
+		return;
+
+	// a patch that doesn't apply never will, it's dropped either way
+	ApplyMeshPatch(m_dataFile, takenPath.string(), m_ctx);
+	fs::remove(takenPath, ec);
 }
 
 //----------------------------------------------------------------------------
 
+static inline uint64_t VolumeBucketKey(int x, int z)
+{
+	return ((uint64_t)(uint32_t)x << 32) | (uint32_t)z;
+}
+
+static void UpdateConvexVolumeBounds(ConvexVolume& volume)
+{
+	GetPointBounds(volume.verts.data(), volume.verts.size(), volume.bmin, volume.bmax);
+}
+
 ConvexVolume* NavMesh::AddConvexVolume(const std::vector<glm::vec3>& verts,
 	const std::string& name,
 	float minh, float maxh, uint8_t areaType)
@@ -674,6 +3427,9 @@ ConvexVolume* NavMesh::AddConvexVolume(const std::vector<glm::vec3>& verts,
 	m_volumes.push_back(std::move(volume));
 	m_volumesById.emplace(vol->id, vol);
 
+	UpdateConvexVolumeBounds(*vol);
+	AddConvexVolumeToBuckets(vol);
+
 	return vol;
 }
 
@@ -683,9 +3439,34 @@ void NavMesh::DeleteConvexVolumeById(uint32_t id)
 		[id](const auto& ptr) { return ptr->id == id; });
 	if (iter != m_volumes.end())
 	{
-		m_volumesById.erase((*iter)->id);
-		m_volumes.erase(iter);
+		RemoveConvexVolumeFromBuckets(iter->get());
+		m_volumesById.erase((*iter)->id);
+		m_volumes.erase(iter);
+	}
+}
+
+void NavMesh::UpdateConvexVolume(ConvexVolume* volume)
+{
+	// the buckets are found with the old bounds
+	RemoveConvexVolumeFromBuckets(volume);
+	UpdateConvexVolumeBounds(*volume);
+	AddConvexVolumeToBuckets(volume);
+}
+
+void NavMesh::SetConvexVolumes(const std::vector<ConvexVolume>& volumes)
+{
+	m_volumes.clear();
+	m_volumesById.clear();
+
+	for (const ConvexVolume& volume : volumes)
+	{
+		auto vol = std::make_unique<ConvexVolume>(volume);
+		m_volumesById.emplace(vol->id, vol.get());
+		m_nextVolumeId = std::max(m_nextVolumeId, vol->id + 1);
+		m_volumes.push_back(std::move(vol));
 	}
+
+	RebuildConvexVolumeBuckets();
 }
 
 ConvexVolume* NavMesh::GetConvexVolumeById(uint32_t id)
@@ -704,16 +3485,9 @@ std::vector<dtTileRef> NavMesh::GetTilesIntersectingConvexVolume(uint32_t id)
 
 	if (m_navMesh && volume && volume->verts.size() > 1)
 	{
-		glm::vec3 bmin = volume->verts[0], bmax = volume->verts[0];
-		for (const auto& vert : volume->verts)
-		{
-			bmin = glm::min(bmin, vert);
-			bmax = glm::max(bmax, vert);
-		}
-
 		int minx, miny, maxx, maxy;
-		m_navMesh->calcTileLoc(glm::value_ptr(bmin), &minx, &miny);
-		m_navMesh->calcTileLoc(glm::value_ptr(bmax), &maxx, &maxy);
+		m_navMesh->calcTileLoc(glm::value_ptr(volume->bmin), &minx, &miny);
+		m_navMesh->calcTileLoc(glm::value_ptr(volume->bmax), &maxx, &maxy);
 
 		static const int MAX_NEIS = 32;
 		const dtMeshTile* neis[MAX_NEIS];
@@ -732,17 +3506,121 @@ std::vector<dtTileRef> NavMesh::GetTilesIntersectingConvexVolume(uint32_t id)
 		}
 
 		std::sort(tiles.begin(), tiles.end());
-		std::unique(tiles.begin(), tiles.end());
+		tiles.erase(std::unique(tiles.begin(), tiles.end()), tiles.end());
 	}
 
 	return tiles;
 }
 
+void NavMesh::AddConvexVolumeToBuckets(ConvexVolume* volume)
+{
+	if (volume->verts.empty())
+		return;
+
+	int minx = (int)floorf(volume->bmin.x / m_volumeBucketSize);
+	int minz = (int)floorf(volume->bmin.z / m_volumeBucketSize);
+	int maxx = (int)floorf(volume->bmax.x / m_volumeBucketSize);
+	int maxz = (int)floorf(volume->bmax.z / m_volumeBucketSize);
+
+	for (int z = minz; z <= maxz; ++z)
+	{
+		for (int x = minx; x <= maxx; ++x)
+			m_volumeBuckets[VolumeBucketKey(x, z)].push_back(volume);
+	}
+}
+
+void NavMesh::RemoveConvexVolumeFromBuckets(ConvexVolume* volume)
+{
+	if (volume->verts.empty())
+		return;
+
+	int minx = (int)floorf(volume->bmin.x / m_volumeBucketSize);
+	int minz = (int)floorf(volume->bmin.z / m_volumeBucketSize);
+	int maxx = (int)floorf(volume->bmax.x / m_volumeBucketSize);
+	int maxz = (int)floorf(volume->bmax.z / m_volumeBucketSize);
+
+	for (int z = minz; z <= maxz; ++z)
+	{
+		for (int x = minx; x <= maxx; ++x)
+		{
+			auto iter = m_volumeBuckets.find(VolumeBucketKey(x, z));
+			if (iter == m_volumeBuckets.end())
+				continue;
+
+			std::vector<ConvexVolume*>& bucket = iter->second;
+			bucket.erase(std::remove(bucket.begin(), bucket.end(), volume), bucket.end());
+			if (bucket.empty())
+				m_volumeBuckets.erase(iter);
+		}
+	}
+}
+
+void NavMesh::RebuildConvexVolumeBuckets()
+{
+	m_volumeBuckets.clear();
+
+	for (const auto& volume : m_volumes)
+	{
+		UpdateConvexVolumeBounds(*volume);
+		AddConvexVolumeToBuckets(volume.get());
+	}
+}
+
+void NavMesh::SetConvexVolumeBucketSize(float size)
+{
+	if (size <= 0.f || size == m_volumeBucketSize)
+		return;
+
+	m_volumeBucketSize = size;
+	RebuildConvexVolumeBuckets();
+}
+
+void NavMesh::GetConvexVolumesInBounds(const float* bmin, const float* bmax,
+	std::vector<const ConvexVolume*>& volumes) const
+{
+	volumes.clear();
+	if (m_volumeBuckets.empty())
+		return;
+
+	int minx = (int)floorf(bmin[0] / m_volumeBucketSize);
+	int minz = (int)floorf(bmin[2] / m_volumeBucketSize);
+	int maxx = (int)floorf(bmax[0] / m_volumeBucketSize);
+	int maxz = (int)floorf(bmax[2] / m_volumeBucketSize);
+
+	for (int z = minz; z <= maxz; ++z)
+	{
+		for (int x = minx; x <= maxx; ++x)
+		{
+			auto iter = m_volumeBuckets.find(VolumeBucketKey(x, z));
+			if (iter == m_volumeBuckets.end())
+				continue;
+
+			for (const ConvexVolume* vol : iter->second)
+			{
+				if (vol->bmin.x > bmax[0] || vol->bmax.x < bmin[0]
+					|| vol->bmin.z > bmax[2] || vol->bmax.z < bmin[2])
+				{
+					continue;
+				}
+
+				volumes.push_back(vol);
+			}
+		}
+	}
+
+	// later volumes win where they overlap, so keep them in order. Ids are
+	// handed out in increasing order, which is the order of m_volumes.
+	std::sort(volumes.begin(), volumes.end(),
+		[](const ConvexVolume* a, const ConvexVolume* b) { return a->id < b->id; });
+	volumes.erase(std::unique(volumes.begin(), volumes.end()), volumes.end());
+}
+
 //----------------------------------------------------------------------------
 
 void NavMesh::InitializeAreas()
 {
 	m_polyAreaList.clear();
+	m_queryFilters.clear();
 
 	// TODO: Add way to save default custom areas
 
@@ -765,6 +3643,8 @@ void NavMesh::UpdateArea(const PolyAreaType& areaType)
 	// don't read in invalid ids
 	if (areaType.id < m_polyAreas.size())
 	{
+		m_queryFilters.clear();
+
 		// simpler to just remove and append new poly area 
 		auto iter = std::find_if(m_polyAreaList.begin(), m_polyAreaList.end(),
 			[&areaType](const PolyAreaType* area)
@@ -799,6 +3679,7 @@ void NavMesh::RemoveUserDefinedArea(uint8_t areaId)
 		return;
 
 	m_polyAreas[areaId].valid = false;
+	m_queryFilters.clear();
 
 	auto iter = std::find_if(m_polyAreaList.begin(), m_polyAreaList.end(),
 		[areaId](const PolyAreaType* area)
@@ -827,6 +3708,408 @@ uint8_t NavMesh::GetFirstUnusedUserDefinedArea() const
 	return 0;
 }
 
+const PolyAreaType* NavMesh::FindPolyArea(const std::string& name) const
+{
+	if (!name.empty() && std::all_of(name.begin(), name.end(), ::isdigit))
+	{
+		int areaId = atoi(name.c_str());
+		return areaId < (int)m_polyAreas.size() ? &m_polyAreas[areaId] : nullptr;
+	}
+
+	auto iter = std::find_if(m_polyAreaList.begin(), m_polyAreaList.end(),
+		[&name](const PolyAreaType* area)
+	{
+		return area->name.size() == name.size()
+			&& std::equal(name.begin(), name.end(), area->name.begin(),
+				[](char a, char b) { return ::tolower(a) == ::tolower(b); });
+	});
+
+	return iter != m_polyAreaList.end() ? *iter : nullptr;
+}
+
+void NavMesh::SetAreaEnabled(uint8_t areaId, bool enabled)
+{
+	if (areaId >= DT_MAX_AREAS || IsAreaEnabled(areaId) == enabled)
+		return;
+
+	if (enabled)
+		m_disabledAreas &= ~AvoidAreaBit(areaId);
+	else
+		m_disabledAreas |= AvoidAreaBit(areaId);
+
+	{
+		auto lock = BeginTileChange();
+
+		UpdateAreaIndex();
+
+		if (m_navMesh)
+		{
+			for (dtPolyRef ref : m_areaPolys[areaId])
+			{
+				unsigned short flags = 0;
+				m_navMesh->getPolyFlags(ref, &flags);
+
+				if (enabled)
+					flags &= ~+PolyFlags::Disabled;
+				else
+					flags |= +PolyFlags::Disabled;
+
+				m_navMesh->setPolyFlags(ref, flags);
+			}
+		}
+	}
+
+	// paths and caches through the area are no good anymore
+	OnNavMeshTilesChanged();
+}
+
+void NavMesh::ResetAreaIndex()
+{
+	for (std::vector<dtPolyRef>& polys : m_areaPolys)
+		polys.clear();
+
+	m_areaIndexTiles.clear();
+	m_areaIndexMesh = nullptr;
+}
+
+void NavMesh::UpdateAreaIndex()
+{
+	auto lock = LockTilesForWrite();
+
+	if (m_areaIndexMesh != m_navMesh.get())
+	{
+		ResetAreaIndex();
+		m_areaIndexMesh = m_navMesh.get();
+	}
+
+	if (!m_navMesh)
+		return;
+
+	dtNavMesh* navMesh = m_navMesh.get();
+
+	// drop the polygons of tiles that were removed. Replaced tiles get a new
+	// salt, so their old refs no longer resolve.
+	bool removed = false;
+	for (auto iter = m_areaIndexTiles.begin(); iter != m_areaIndexTiles.end(); )
+	{
+		if (navMesh->getTileByRef(*iter) == nullptr)
+		{
+			iter = m_areaIndexTiles.erase(iter);
+			removed = true;
+		}
+		else
+		{
+			++iter;
+		}
+	}
+
+	if (removed)
+	{
+		for (std::vector<dtPolyRef>& polys : m_areaPolys)
+		{
+			polys.erase(std::remove_if(polys.begin(), polys.end(),
+				[navMesh](dtPolyRef ref) { return !navMesh->isValidPolyRef(ref); }), polys.end());
+		}
+	}
+
+	const dtNavMesh* constMesh = navMesh;
+	for (int i = 0; i < navMesh->getMaxTiles(); ++i)
+	{
+		const dtMeshTile* tile = constMesh->getTile(i);
+		if (!tile || !tile->header)
+			continue;
+
+		dtTileRef tileRef = navMesh->getTileRef(tile);
+		if (!m_areaIndexTiles.insert(tileRef).second)
+			continue;
+
+		dtPolyRef base = navMesh->getPolyRefBase(tile);
+		for (int j = 0; j < tile->header->polyCount; ++j)
+		{
+			const dtPoly& poly = tile->polys[j];
+			if (poly.flags & +PolyFlags::Disabled)
+				continue;
+
+			uint8_t area = poly.getArea();
+			m_areaPolys[area].push_back(base | (dtPolyRef)j);
+
+			if (m_disabledAreas & AvoidAreaBit(area))
+				navMesh->setPolyFlags(base | (dtPolyRef)j, poly.flags | +PolyFlags::Disabled);
+		}
+	}
+}
+
+bool NavMesh::IsAreaIndexed(dtPolyRef ref) const
+{
+	uint8_t area = 0;
+	if (!m_navMesh || dtStatusFailed(m_navMesh->getPolyArea(ref, &area)))
+		return false;
+
+	const std::vector<dtPolyRef>& polys = m_areaPolys[area];
+	return std::find(polys.begin(), polys.end(), ref) != polys.end();
+}
+
+void NavMesh::RetagPoly(dtPolyRef ref, uint8_t area, uint16_t flags)
+{
+	uint8_t oldArea = 0;
+	if (dtStatusFailed(m_navMesh->getPolyArea(ref, &oldArea)))
+		return;
+
+	// polygons in the index are disabled by their area, the rest keep their own
+	// disabled flag
+	std::vector<dtPolyRef>& oldPolys = m_areaPolys[oldArea];
+	auto iter = std::find(oldPolys.begin(), oldPolys.end(), ref);
+	if (iter != oldPolys.end())
+	{
+		oldPolys.erase(iter);
+		m_areaPolys[area].push_back(ref);
+
+		if (m_disabledAreas & AvoidAreaBit(area))
+			flags |= +PolyFlags::Disabled;
+		else
+			flags &= ~+PolyFlags::Disabled;
+	}
+
+	m_navMesh->setPolyArea(ref, area);
+	m_navMesh->setPolyFlags(ref, flags);
+}
+
+void NavMesh::PaintRuntimeVolume(RuntimeVolume& runtimeVolume)
+{
+	auto lock = LockTilesForWrite();
+	if (!m_navMesh)
+		return;
+
+	auto query = AcquireNavMeshQuery();
+	if (!query)
+		return;
+
+	const ConvexVolume& volume = runtimeVolume.volume;
+	std::vector<PaintedPoly>& painted = runtimeVolume.polys;
+
+	// the polygons of replaced tiles are gone, and so is their paint
+	painted.erase(std::remove_if(painted.begin(), painted.end(),
+		[this](const PaintedPoly& poly) { return !m_navMesh->isValidPolyRef(poly.ref); }), painted.end());
+
+	glm::vec3 center = (volume.bmin + volume.bmax) * 0.5f;
+	glm::vec3 halfExtents = (volume.bmax - volume.bmin) * 0.5f;
+
+	// every polygon, whether the usual filter would take it or not
+	dtQueryFilter filter;
+	filter.setIncludeFlags(0xffff);
+	filter.setExcludeFlags(0);
+
+	static const int MAX_PAINT_POLYS = 512;
+	dtPolyRef polys[MAX_PAINT_POLYS];
+	int polyCount = 0;
+	query->queryPolygons(glm::value_ptr(center), glm::value_ptr(halfExtents), &filter,
+		polys, &polyCount, MAX_PAINT_POLYS);
+
+	const uint16_t areaFlags = GetPolyArea(volume.areaType).flags;
+
+	// the centroids of the polygons within the height of the volume, which are
+	// then tested against its outline all together
+	dtPolyRef candidates[MAX_PAINT_POLYS];
+	const dtPoly* candidatePolys[MAX_PAINT_POLYS];
+	float centroidX[MAX_PAINT_POLYS], centroidZ[MAX_PAINT_POLYS];
+	uint8_t inside[MAX_PAINT_POLYS];
+	int candidateCount = 0;
+
+	for (int i = 0; i < polyCount; ++i)
+	{
+		dtPolyRef ref = polys[i];
+		if (std::any_of(painted.begin(), painted.end(),
+			[ref](const PaintedPoly& poly) { return poly.ref == ref; }))
+		{
+			continue;
+		}
+
+		const dtMeshTile* tile = nullptr;
+		const dtPoly* poly = nullptr;
+		if (dtStatusFailed(m_navMesh->getTileAndPolyByRef(ref, &tile, &poly))
+			|| poly->getType() != DT_POLYTYPE_GROUND)
+		{
+			continue;
+		}
+
+		float centroid[3] = { 0, 0, 0 };
+		for (int j = 0; j < poly->vertCount; ++j)
+			dtVadd(centroid, centroid, &tile->verts[poly->verts[j] * 3]);
+		dtVscale(centroid, centroid, 1.0f / poly->vertCount);
+
+		if (centroid[1] < volume.hmin || centroid[1] > volume.hmax)
+			continue;
+
+		candidates[candidateCount] = ref;
+		candidatePolys[candidateCount] = poly;
+		centroidX[candidateCount] = centroid[0];
+		centroidZ[candidateCount] = centroid[2];
+		++candidateCount;
+	}
+
+	GetPointsInPolygon(centroidX, centroidZ, candidateCount, volume.verts.data(),
+		volume.verts.size(), inside);
+
+	for (int i = 0; i < candidateCount; ++i)
+	{
+		if (!inside[i])
+			continue;
+
+		dtPolyRef ref = candidates[i];
+		const dtPoly* poly = candidatePolys[i];
+
+		uint16_t flags = poly->flags;
+		if (IsAreaIndexed(ref))
+			flags &= ~+PolyFlags::Disabled;
+
+		painted.push_back(PaintedPoly{ ref, poly->getArea(), flags });
+
+		// keep the data's own disabled flag
+		RetagPoly(ref, volume.areaType, areaFlags | (flags & +PolyFlags::Disabled));
+	}
+}
+
+void NavMesh::RestoreRuntimeVolume(size_t index)
+{
+	RuntimeVolume& runtimeVolume = m_runtimeVolumes[index];
+
+	for (const PaintedPoly& poly : runtimeVolume.polys)
+	{
+		if (!m_navMesh || !m_navMesh->isValidPolyRef(poly.ref))
+			continue;
+
+		// a later volume painted over this one, it restores what we had instead
+		bool repainted = false;
+		for (size_t later = index + 1; later < m_runtimeVolumes.size() && !repainted; ++later)
+		{
+			for (PaintedPoly& laterPoly : m_runtimeVolumes[later].polys)
+			{
+				if (laterPoly.ref == poly.ref)
+				{
+					laterPoly.area = poly.area;
+					laterPoly.flags = poly.flags;
+					repainted = true;
+					break;
+				}
+			}
+		}
+
+		if (!repainted)
+			RetagPoly(poly.ref, poly.area, poly.flags);
+	}
+}
+
+uint32_t NavMesh::AddRuntimeVolume(const std::vector<glm::vec3>& verts, float hmin, float hmax,
+	uint8_t areaType)
+{
+	ConvexVolume volume;
+	volume.verts = verts;
+	volume.hmin = hmin;
+	volume.hmax = hmax;
+	volume.areaType = areaType;
+
+	return AddRuntimeVolumes({ volume })[0];
+}
+
+std::vector<uint32_t> NavMesh::AddRuntimeVolumes(std::vector<ConvexVolume> volumes)
+{
+	std::vector<uint32_t> ids(volumes.size(), 0);
+	bool painted = false;
+
+	{
+		auto lock = BeginTileChange();
+
+		UpdateAreaIndex();
+
+		for (size_t i = 0; i < volumes.size(); ++i)
+		{
+			ConvexVolume& volume = volumes[i];
+			if (volume.verts.size() < 3 || volume.areaType >= DT_MAX_AREAS)
+				continue;
+
+			volume.id = m_nextRuntimeVolumeId++;
+			GetPointBounds(volume.verts.data(), volume.verts.size(), volume.bmin, volume.bmax);
+			volume.bmin.y = volume.hmin;
+			volume.bmax.y = volume.hmax;
+
+			RuntimeVolume runtimeVolume;
+			runtimeVolume.volume = std::move(volume);
+			PaintRuntimeVolume(runtimeVolume);
+
+			if (runtimeVolume.polys.empty())
+				continue;
+
+			ids[i] = runtimeVolume.volume.id;
+			m_runtimeVolumes.push_back(std::move(runtimeVolume));
+			painted = true;
+		}
+	}
+
+	if (painted)
+		OnNavMeshTilesChanged();
+
+	return ids;
+}
+
+bool NavMesh::RemoveRuntimeVolume(uint32_t id)
+{
+	return RemoveRuntimeVolumes({ id }) > 0;
+}
+
+int NavMesh::RemoveRuntimeVolumes(const std::vector<uint32_t>& ids)
+{
+	int removed = 0;
+
+	{
+		auto lock = BeginTileChange();
+
+		UpdateAreaIndex();
+
+		for (uint32_t id : ids)
+		{
+			auto iter = std::find_if(m_runtimeVolumes.begin(), m_runtimeVolumes.end(),
+				[id](const RuntimeVolume& runtimeVolume) { return runtimeVolume.volume.id == id; });
+			if (iter == m_runtimeVolumes.end())
+				continue;
+
+			RestoreRuntimeVolume(iter - m_runtimeVolumes.begin());
+			m_runtimeVolumes.erase(iter);
+			++removed;
+		}
+	}
+
+	if (removed)
+		OnNavMeshTilesChanged();
+
+	return removed;
+}
+
+void NavMesh::ClearRuntimeVolumes()
+{
+	if (m_runtimeVolumes.empty())
+		return;
+
+	{
+		auto lock = BeginTileChange();
+
+		UpdateAreaIndex();
+		for (size_t i = m_runtimeVolumes.size(); i-- > 0; )
+			RestoreRuntimeVolume(i);
+		m_runtimeVolumes.clear();
+	}
+
+	OnNavMeshTilesChanged();
+}
+
+std::vector<uint32_t> NavMesh::GetRuntimeVolumeIds() const
+{
+	std::vector<uint32_t> ids;
+	for (const RuntimeVolume& runtimeVolume : m_runtimeVolumes)
+		ids.push_back(runtimeVolume.volume.id);
+
+	return ids;
+}
+
 void NavMesh::FillFilterAreaCosts(dtQueryFilter& filter)
 {
 	for (const PolyAreaType* areaType : m_polyAreaList)
@@ -835,6 +4118,36 @@ void NavMesh::FillFilterAreaCosts(dtQueryFilter& filter)
 	}
 }
 
+std::shared_ptr<const NavMeshQueryFilter> NavMesh::GetQueryFilter(uint64_t avoidAreas, float extraClearance)
+{
+	// meshes built before the flags were baked have none, and pass everything
+	const uint16_t narrowFlags = GetClearanceExcludeFlags(extraClearance);
+
+	auto iter = m_queryFilters.find({ avoidAreas, narrowFlags });
+	if (iter != m_queryFilters.end())
+		return iter->second;
+
+	auto queryFilter = std::make_shared<NavMeshQueryFilter>();
+	queryFilter->avoidAreas = avoidAreas;
+	queryFilter->narrowFlags = narrowFlags;
+
+	dtQueryFilter& filter = queryFilter->filter;
+	filter.setIncludeFlags(+PolyFlags::All);
+	filter.setExcludeFlags(+PolyFlags::Disabled | narrowFlags);
+	FillFilterAreaCosts(filter);
+
+	for (int i = 0; i < DT_MAX_AREAS; ++i)
+	{
+		if (avoidAreas & AvoidAreaBit(static_cast<uint8_t>(i)))
+			filter.setAreaCost(i, filter.getAreaCost(i) * QUERYFILTER_AVOID_COST_FACTOR);
+	}
+
+	queryFilter->hash = HashQueryFilter(filter);
+
+	m_queryFilters.emplace(std::make_pair(avoidAreas, narrowFlags), queryFilter);
+	return queryFilter;
+}
+
 bool NavMesh::ExportJson(const std::string& filename, PersistedDataFields fields)
 {
 	if (m_zoneName.empty())
@@ -843,28 +4156,12 @@ bool NavMesh::ExportJson(const std::string& filename, PersistedDataFields fields
 	nav::NavMeshFile proto;
 	SaveToProto(proto, fields);
 
-	google::protobuf::util::JsonPrintOptions options;
-	options.add_whitespace = true;
-	//options.always_print_primitive_fields = true;
-
-	std::string jsonString;
-	google::protobuf::util::Status status =
-		google::protobuf::util::MessageToJsonString(proto, &jsonString, options);
-	if (status.ok())
-	{
-		fs::path rootPath(filename);
-		boost::system::error_code returnedError;
-		fs::create_directories(rootPath.parent_path(), returnedError);
-
-		std::ofstream ofile(filename.c_str(), std::ios::trunc);
-		if (ofile.is_open())
-		{
-			ofile << jsonString;
-			return true;
-		}
-	}
+	fs::path rootPath(filename);
+	boost::system::error_code returnedError;
+	fs::create_directories(rootPath.parent_path(), returnedError);
 
-	return false;
+	// streamed out as it is written, the tiles can make this very large
+	return ProtoToJsonFile(&proto, filename, true);
 }
 
 bool NavMesh::ImportJson(const std::string& filename, PersistedDataFields fields)
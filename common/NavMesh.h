@@ -6,39 +6,122 @@
 
 #include "common/Context.h"
 #include "common/Enum.h"
+#include "common/LandmarkTable.h"
 #include "common/NavMeshData.h"
 #include "common/NavModule.h"
+#include "common/PolySampler.h"
+#include "common/QueryHeatmap.h"
 #include "common/Signal.h"
+#include "common/TileGraph.h"
+#include "common/TileMutex.h"
 
 #include <DetourNavMesh.h>
+#include <DetourNavMeshQuery.h>
 
 #include <array>
+#include <atomic>
+#include <climits>
+#include <future>
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 class dtNavMesh;
 class dtNavMeshQuery;
 class dtQueryFilter;
 class Context;
 
+class MappedFile;
+struct MeshFileSnapshot;
+class NavMeshTileCache;
+class SharedMemory;
+struct dtTileCacheParams;
+
 namespace nav {
 	class NavMeshFile;
+	class NavMeshTileSet;
 }
 
+// cost multiplier for areas that a query filter avoids
+const float QUERYFILTER_AVOID_COST_FACTOR = 100.0f;
+
+// Query filter built from the area costs of a navmesh. Filters are shared by
+// everything that searches with the same areas avoided, and are rebuilt when
+// the area costs change.
+struct NavMeshQueryFilter
+{
+	dtQueryFilter filter;
+	uint32_t hash = 0;
+
+	// bit n is set if area n is avoided
+	uint64_t avoidAreas = 0;
+
+	// the Narrow flags that are excluded, see GetClearanceExcludeFlags
+	uint16_t narrowFlags = 0;
+};
+
+// avoided areas for GetQueryFilter
+inline uint64_t AvoidAreaBit(uint8_t areaId) { return (uint64_t)1 << areaId; }
+
 enum struct PersistedDataFields : uint32_t
 {
 	BuildSettings          = 0x0001,
 	MeshTiles              = 0x0002,
 	ConvexVolumes          = 0x0004,
 	AreaTypes              = 0x0008,
+	TileGraph              = 0x0010,
+	TileCache              = 0x0020,
+	PruneSet               = 0x0040,
+	Landmarks              = 0x0080,
 
 	None                   = 0x0000,
 	All                    = 0xffff,
+
+	// BuildSettings, ConvexVolumes and AreaTypes, stored in the file summary
+	Summary                = 0x000d,
 };
 
 constexpr bool has_bitwise_operations(PersistedDataFields) { return true; }
 
+// what a loaded navmesh holds and how much memory it takes
+struct NavMeshStats
+{
+	int tiles = 0;
+	int polys = 0;
+	int verts = 0;
+	int links = 0;
+	int detailVerts = 0;
+	int detailTris = 0;
+	int offMeshLinks = 0;
+
+	// bytes of tile data, by the part of the tile it is used for
+	size_t headerBytes = 0;
+	size_t polyBytes = 0;          // polys and their vertices
+	size_t linkBytes = 0;
+	size_t detailBytes = 0;        // detail meshes, vertices and triangles
+	size_t bvTreeBytes = 0;
+	size_t offMeshBytes = 0;
+	size_t tileBytes = 0;          // all of the above
+
+	// node pools of the queries that the navmesh holds on to. Queries that are
+	// in use aren't counted.
+	int queries = 0;
+	size_t queryNodeBytes = 0;
+
+	// milliseconds spent loading the mesh file. Inflating and adding tiles keep
+	// adding up as tiles are streamed in.
+	double readMs = 0;             // opening the file and reading the headers
+	double parseMs = 0;            // the metadata, including inflating it
+	double inflateMs = 0;          // tiles
+	double addTileMs = 0;
+};
+
 //============================================================================
 
 class NavMesh : public NavModule
@@ -77,15 +160,58 @@ public:
 	// get the nav mesh query object
 	std::shared_ptr<dtNavMeshQuery> GetNavMeshQuery();
 
+	// get a query from the pool, initialized against the current navmesh with at
+	// least maxNodes nodes. The query goes back to the pool when released, unless
+	// the navmesh has changed in the meantime. 0 is for queries that don't search
+	// for paths, which get NAVMESH_QUERY_MAX_NODES, or the node budget of the mesh
+	// if that is less.
+	std::shared_ptr<dtNavMeshQuery> AcquireNavMeshQuery(int maxNodes = 0);
+
+	// Nodes a path search across this mesh is expected to need, which is what path
+	// searches size their queries with. Saved with the mesh, from the diameter of
+	// the polygon graph of its largest connected part, and NAVMESH_PATH_MAX_NODES
+	// for meshes saved without one. A search that ran out of nodes and found its
+	// path with more raises it for the zone, until the plugin is unloaded.
+	int GetQueryNodeBudget() const;
+
+	// a search with maxNodes ran out of them. Returns the number of nodes to try
+	// it again with, 0 if it can't grow any further. Safe from any thread.
+	int RecordOutOfNodes(int maxNodes);
+
+	// the outcome of a search that was tried again with maxNodes
+	void RecordNodeRetry(int maxNodes, bool found);
+
+	struct QueryNodeStats
+	{
+		std::atomic<uint32_t> outOfNodes{ 0 };
+		std::atomic<uint32_t> retries{ 0 };
+		std::atomic<uint32_t> retriesFound{ 0 };     // retries that found the path
+	};
+	const QueryNodeStats& GetQueryNodeStats() const { return m_queryNodeStats; }
+
 	// build area costs for filter
 	void FillFilterAreaCosts(dtQueryFilter& filter);
 
+	// the filter for walkable polygons using the area costs of this navmesh, with
+	// the areas in avoidAreas made much more expensive. See AvoidAreaBit. With
+	// extraClearance, polys without that much room past the agent radius of the
+	// mesh are left out, for agents wider than the mesh was built for.
+	std::shared_ptr<const NavMeshQueryFilter> GetQueryFilter(uint64_t avoidAreas = 0,
+		float extraClearance = 0.0f);
+
 	// returns the name of the file that the navmesh was loaded from
 	std::string GetDataFileName() const { return m_dataFile; }
 
 	bool ExportJson(const std::string& filename, PersistedDataFields fields);
 	bool ImportJson(const std::string& filename, PersistedDataFields fields);
 
+	// read the summary fields of a mesh file without loading the rest of it. Files
+	// older than version 6 have no summary and are read in full. If tileCount is
+	// given it receives the number of tiles in the file, and version the file
+	// version.
+	static bool ReadMeshFileSummary(const std::string& filename, nav::NavMeshFile& summary,
+		uint32_t* tileCount = nullptr, uint16_t* version = nullptr);
+
 	//----------------------------------------------------------------------------
 	// navmesh data
 
@@ -102,9 +228,33 @@ public:
 
 	LoadResult LoadNavMeshFile();
 
+	// take all of the loaded data from another navmesh, replacing what we have.
+	// This is used to swap in a mesh that was loaded on another thread, or one
+	// that was kept around from an earlier visit to the zone. other is left empty.
+	void AdoptNavMesh(NavMesh& other);
+
+	// like AdoptNavMesh, but for a newer version of the same mesh file. Only tiles
+	// whose build hash changed are swapped into the existing navmesh, so polygon
+	// refs in the other tiles stay valid. Returns the number of tiles that were
+	// replaced, or -1 if the meshes aren't compatible and it needs a full adopt.
+	int PatchNavMesh(NavMesh& other);
+
 	// save the currently loaded mesh to a file
 	bool SaveNavMeshFile();
 
+	// same, but the file is compressed and written on other threads. The tiles
+	// are copied first, so the mesh can change again as soon as this returns.
+	std::future<bool> SaveNavMeshFileAsync();
+
+	// write a patch that turns baseFile, an earlier save of this mesh, into this
+	// mesh. It only has the tiles whose build hash changed and the metadata.
+	bool SaveMeshPatch(const std::string& filename, const std::string& baseFile);
+
+	// apply a patch from SaveMeshPatch to the mesh file it was made against. A
+	// patch with the same name as the data file and NAVMESH_PATCH_EXTENSION is
+	// applied when the mesh is loaded, reloads then only swap the patched tiles.
+	static bool ApplyMeshPatch(const std::string& meshFile, const std::string& patchFile, Context* ctx);
+
 	void SetNavMeshBounds(const glm::vec3& min, const glm::vec3& max);
 	void GetNavMeshBounds(glm::vec3& min, glm::vec3& max);
 
@@ -114,6 +264,13 @@ public:
 	NavMeshConfig& GetNavMeshConfig() { return m_config; }
 	const NavMeshConfig& GetNavMeshConfig() const { return m_config; }
 
+	// record that tiles were just built from the zone files with the given
+	// fingerprint. Saved with the build settings, so that stale meshes can be
+	// found without loading them.
+	void SetBuildSource(uint64_t sourceHash);
+	uint64_t GetBuildSourceHash() const { return m_buildSourceHash; }
+	int64_t GetBuildTime() const { return m_buildTime; }
+
 	//------------------------------------------------------------------------
 	// area types
 
@@ -132,6 +289,18 @@ public:
 	// returns 0 if there are no available areas
 	uint8_t GetFirstUnusedUserDefinedArea() const;
 
+	// area by id or by name, ignoring case. Returns null if there is none.
+	const PolyAreaType* FindPolyArea(const std::string& name) const;
+
+	// switch an area off at runtime, or back on. Its polygons get the Disabled
+	// flag so that no filter goes through them. Only the polygons of that area are
+	// touched, from an index that is built the first time an area is switched, and
+	// tiles that come in later are switched to match. Switched areas are reset when
+	// the zone changes.
+	void SetAreaEnabled(uint8_t areaId, bool enabled);
+	bool IsAreaEnabled(uint8_t areaId) const { return (m_disabledAreas & AvoidAreaBit(areaId)) == 0; }
+	uint64_t GetDisabledAreas() const { return m_disabledAreas; }
+
 	//----------------------------------------------------------------------------
 	// convex values / marked areas
 
@@ -149,23 +318,302 @@ public:
 	ConvexVolume* GetConvexVolumeById(uint32_t id);
 	void DeleteConvexVolumeById(uint32_t id);
 
+	// call after changing the verts of a volume, so that its bounds are updated
+	void UpdateConvexVolume(ConvexVolume* volume);
+
+	// replace every volume, keeping their ids. For putting back volumes that were
+	// copied out of GetConvexVolumes.
+	void SetConvexVolumes(const std::vector<ConvexVolume>& volumes);
+
 	std::vector<dtTileRef> GetTilesIntersectingConvexVolume(uint32_t volumeId);
 
+	// volumes whose bounds overlap bmin/bmax on the xz plane, in the order that
+	// they are in GetConvexVolumes. Safe to call from the build threads as long
+	// as no volumes are added or changed.
+	void GetConvexVolumesInBounds(const float* bmin, const float* bmax,
+		std::vector<const ConvexVolume*>& volumes) const;
+
+	// size of the buckets used by GetConvexVolumesInBounds. Set to the tile size
+	// before building tiles.
+	void SetConvexVolumeBucketSize(float size);
+
+	// volumes painted onto the loaded tiles without rebuilding them, for hazards
+	// that come and go. The polygons whose centers are inside the volume take its
+	// area and area flags until the volume is removed. They aren't saved, and are
+	// cleared when the zone changes. Returns the id of the volume, 0 if it painted
+	// nothing.
+	uint32_t AddRuntimeVolume(const std::vector<glm::vec3>& verts, float hmin, float hmax,
+		uint8_t areaType);
+	bool RemoveRuntimeVolume(uint32_t id);
+	void ClearRuntimeVolumes();
+
+	// same as above for many volumes at once, with one tile change for all of them.
+	// The bounds and ids of the volumes are filled in.
+	std::vector<uint32_t> AddRuntimeVolumes(std::vector<ConvexVolume> volumes);
+	int RemoveRuntimeVolumes(const std::vector<uint32_t>& ids);
+
+	std::vector<uint32_t> GetRuntimeVolumeIds() const;
+
+	//----------------------------------------------------------------------------
+	// tile build hashes
+
+	// hash of the inputs that each tile was built from. The mesh generator uses
+	// this to skip rebuilding tiles whose inputs haven't changed. Returns 0 if
+	// unknown. Setting a hash of 0 removes it.
+	uint64_t GetTileBuildHash(int x, int y, int layer) const;
+	void SetTileBuildHash(int x, int y, int layer, uint64_t hash);
+
+	//----------------------------------------------------------------------------
+	// pruned polys
+
+	// polys of a tile that were found to be unreachable, by poly index. Along with
+	// the build hash of the tile at the time, so that a rebuilt tile can have the
+	// same polys pruned as long as it was built from the same inputs.
+	struct PrunedTile
+	{
+		uint64_t buildHash = 0;
+		std::vector<uint16_t> polys;
+	};
+
+	// returns null if the tile has no pruned polys, or if it was pruned when it had
+	// a different build hash.
+	const PrunedTile* GetPrunedTile(int x, int y, int layer, uint64_t buildHash) const;
+
+	// setting an empty list of polys removes the tile
+	void SetPrunedTile(int x, int y, int layer, PrunedTile tile);
+	void ClearPrunedTiles() { m_prunedTiles.clear(); }
+	bool HasPrunedTiles() const { return !m_prunedTiles.empty(); }
+
+	// points that the build floods out from when removing unreachable polys, in
+	// navmesh coordinates.
+	const std::vector<glm::vec3>& GetPruneSeeds() const { return m_pruneSeeds; }
+	void AddPruneSeed(const glm::vec3& pos) { m_pruneSeeds.push_back(pos); }
+	void RemovePruneSeed(size_t index);
+	void ClearPruneSeeds() { m_pruneSeeds.clear(); }
+
+	//----------------------------------------------------------------------------
+	// tile graph
+
+	// coarse graph of the connections between tiles, used for routing long paths.
+	// Built by the mesh generator and saved with the mesh.
+	const TileGraph& GetTileGraph() const { return m_tileGraph; }
+
+	// rebuild the tile graph from the tiles that are currently loaded.
+	void BuildTileGraph();
+
+	//----------------------------------------------------------------------------
+	// landmarks
+
+	// landmark distances that give path searches a tighter heuristic. Built by
+	// the mesh generator and saved with the mesh.
+	const LandmarkTable& GetLandmarks() const { return m_landmarks; }
+
+	// rebuild the landmark distances from the tiles that are currently loaded.
+	void BuildLandmarks(int landmarkCount = 8);
+
+	//----------------------------------------------------------------------------
+	// tile cache
+
+	// heightfield layers used to rebuild tiles around temporary obstacles. Only
+	// present if the mesh was built with the tile cache enabled.
+	NavMeshTileCache* GetTileCache() const { return m_tileCache.get(); }
+
+	// replaces any existing tile cache. Returns null if it failed to initialize.
+	NavMeshTileCache* CreateTileCache(const dtTileCacheParams& params);
+	void ResetTileCache();
+
+	// rebuild tiles affected by obstacles that were added or removed since the last
+	// call. Returns true if the navmesh changed.
+	bool UpdateTileCache();
+
+	//----------------------------------------------------------------------------
+	// path cache
+
+	// Recently found paths, keyed by start and end polygon and the filter that was
+	// used. The cache is cleared whenever the navmesh changes. Call
+	// InvalidatePathCache after modifying tiles directly.
+	bool FindCachedPath(dtPolyRef startRef, dtPolyRef endRef, uint32_t filterHash,
+		std::vector<dtPolyRef>& path);
+	void AddCachedPath(dtPolyRef startRef, dtPolyRef endRef, uint32_t filterHash,
+		const dtPolyRef* path, int pathSize);
+	void InvalidatePathCache();
+
+	static uint32_t HashQueryFilter(const dtQueryFilter& filter);
+
+	struct PathCacheStats
+	{
+		uint32_t hits = 0;
+		uint32_t misses = 0;
+		uint32_t entries = 0;
+	};
+	const PathCacheStats& GetPathCacheStats() const { return m_pathCacheStats; }
+
+	// where path searches spend their time, for anything that searches this
+	// navmesh to record into. Cleared when the navmesh is replaced.
+	QueryHeatmap& GetQueryHeatmap() { return m_queryHeatmap; }
+
+	//----------------------------------------------------------------------------
+	// reachability
+
+	// Label of the connected component that a polygon is in. Links are followed in
+	// both directions, including off-mesh links, and disabled polygons are left
+	// out. Polygons with different labels can't reach each other, the same label
+	// means that a search may find a path. Returns 0 for invalid or disabled
+	// polygons. Labels are rebuilt after the tiles change.
+	uint32_t GetPolyComponent(dtPolyRef ref);
+
+	// false if there is no way from startRef to endRef
+	bool MaybeReachable(dtPolyRef startRef, dtPolyRef endRef);
+
+	// a random point within radius of center on the xz plane, on an enabled
+	// polygon of one of the areas in areaMask (see AvoidAreaBit) that startRef can
+	// reach. Drawn from area weighted tables of the tiles, see PolySampler.
+	bool FindRandomPoint(dtPolyRef startRef, const glm::vec3& center, float radius,
+		uint64_t areaMask, glm::vec3& point);
+
+	//----------------------------------------------------------------------------
+	// tile streaming
+
+	// When the streaming radius is non-zero, only tiles within that distance of the
+	// streaming position are kept in the navmesh. Tiles are read from the mesh file
+	// on demand. Set to zero to keep every tile loaded.
+	void SetTileStreamingRadius(float radius);
+	float GetTileStreamingRadius() const { return m_streamingRadius; }
+
+	// update the position that tiles are streamed around. Position is in navmesh
+	// coordinates.
+	void UpdateStreamingPosition(const glm::vec3& pos);
+
+	// number of tiles currently added to the navmesh vs the number in the file.
+	int GetResidentTileCount() const;
+	int GetStoredTileCount() const { return static_cast<int>(m_tileIndex.size()); }
+
+	// bytes of tile data currently added to the navmesh
+	size_t GetResidentTileDataSize() const;
+
+	// counts walk every loaded tile, so don't call this every frame
+	NavMeshStats GetStats() const;
+
+	// just the load times of the stats, without going over the tiles
+	const NavMeshStats& GetLoadStats() const { return m_loadStats; }
+
+	// When enabled, compressed tiles are decompressed once into memory that is
+	// shared with other clients in the same zone, instead of once per client.
+	// Takes effect the next time the mesh is loaded.
+	void SetShareTileData(bool share) { m_shareTileData = share; }
+	bool GetShareTileData() const { return m_shareTileData; }
+
+	// true if the tiles of the current mesh come from shared memory
+	bool IsTileDataShared() const { return m_sharedTiles != nullptr; }
+
+	// When enabled, tiles that are decompressed into this client's own memory have
+	// their detail meshes replaced with the poly vertices, and heights along paths
+	// come from the polys alone. Saves memory at the cost of height accuracy on
+	// uneven ground. Tiles shared with other clients are left whole.
+	// Takes effect for tiles loaded after it is set.
+	void SetSimplifyDetailMeshes(bool simplify) { m_simplifyDetailMeshes = simplify; }
+	bool GetSimplifyDetailMeshes() const { return m_simplifyDetailMeshes; }
+
+	// Saved meshes only have room for the tiles they were saved with. When
+	// enabled, a loaded mesh gets the capacity it was built with instead, so that
+	// tiles can be built where there were none. Used by the mesh generator.
+	void SetKeepBuildCapacity(bool keep) { m_keepBuildCapacity = keep; }
+	bool GetKeepBuildCapacity() const { return m_keepBuildCapacity; }
+
+	//----------------------------------------------------------------------------
+	// agent profiles
+
+	// Meshes built for the agent profiles in the build settings, besides the main
+	// one. They are saved with the main mesh, and only loaded when
+	// SetLoadAgentMeshes is enabled.
+	struct AgentNavMesh
+	{
+		AgentProfile profile;
+		std::shared_ptr<dtNavMesh> navMesh;
+	};
+	const std::vector<AgentNavMesh>& GetAgentNavMeshes() const { return m_agentNavMeshes; }
+	void SetAgentNavMeshes(std::vector<AgentNavMesh> meshes) { m_agentNavMeshes = std::move(meshes); }
+
+	// load the meshes of the other agent profiles into GetAgentNavMeshes along
+	// with the main one. Used by the mesh generator, which saves them again.
+	void SetLoadAgentMeshes(bool load) { m_loadAgentMeshes = load; }
+	bool GetLoadAgentMeshes() const { return m_loadAgentMeshes; }
+
+	// When non-zero, the mesh that fits an agent of this height is loaded in
+	// place of the main one: the shortest profile that is at least as tall, or
+	// the tallest if none are. Takes effect the next time the mesh is loaded.
+	void SetAgentHeight(float height) { m_agentHeight = height; }
+	float GetAgentHeight() const { return m_agentHeight; }
+
+	// name of the profile whose mesh was loaded, empty for the main mesh
+	const std::string& GetLoadedAgentProfile() const { return m_loadedAgentProfile; }
+
+	//------------------------------------------------------------------------
+	// threads
+
+	// Threads that read the tiles away from the owner of the mesh hold this lock
+	// while they do, any number of them at once. They keep a reference to the
+	// mesh they started with, and compare the generation with the one they
+	// started from to tell if the tiles changed in between.
+	std::shared_lock<TileMutex> LockTiles() const
+	{
+		return std::shared_lock<TileMutex>(m_tileMutex);
+	}
+	uint32_t GetTileGeneration() const { return m_tileGeneration; }
+
+	// Changes to the tiles wait for the readers to finish. Adding or removing
+	// tiles bumps the generation, changes that leave every polygon where it was
+	// (flags and areas) only lock.
+	std::unique_lock<TileMutex> BeginTileChange()
+	{
+		auto lock = LockTilesForWrite();
+		++m_tileGeneration;
+		return lock;
+	}
+	std::unique_lock<TileMutex> LockTilesForWrite() const
+	{
+		return std::unique_lock<TileMutex>(m_tileMutex);
+	}
+
 	//------------------------------------------------------------------------
 	// events
 
 	Signal<> OnNavMeshChanged;
+
+	// some tiles were added, removed or replaced, but the navmesh itself and any
+	// queries on it are still good.
+	Signal<> OnNavMeshTilesChanged;
 	
 private:
 	LoadResult LoadMesh(const char* filename);
 	bool SaveMesh(const char* filename);
 
+	// everything that is saved, with the tiles copied or locked in place
+	bool SnapshotMesh(MeshFileSnapshot& snapshot, bool copyTiles, std::shared_lock<TileMutex>& tilesLock);
+
+	void ApplyPendingPatch();
+
+	void LoadMappedTiles(const nav::NavMeshTileSet& tileset, const MeshFileContents& contents,
+		int version, const std::shared_ptr<MappedFile>& mappedFile);
+	bool AddStoredTile(const MeshFileTileEntry& entry);
+
+	// open the shared copy of the decompressed tiles in the tile index, filling
+	// it in if we're the first. Returns null if the tiles can't be shared.
+	std::shared_ptr<SharedMemory> OpenSharedTiles(const nav::NavMeshTileSet& tileset,
+		const uint8_t* fileData, NavMeshFileCodec codec);
+	dtStatus AddTileData(uint8_t* data, int dataSize, int flags, dtTileRef tileRef);
+	void LoadAllStoredTiles();
+
 	void UpdateDataFile();
 	void InitializeAreas();
 
 	void ResetSavedData(PersistedDataFields fields = PersistedDataFields::All);
 
-	void LoadFromProto(const nav::NavMeshFile& proto, PersistedDataFields fields);
+	// take everything but the tiles from another navmesh
+	void AdoptSavedData(NavMesh& other);
+
+	// the tile data is moved out of proto
+	void LoadFromProto(nav::NavMeshFile& proto, PersistedDataFields fields);
 	void SaveToProto(nav::NavMeshFile& proto, PersistedDataFields fields);
 
 private:
@@ -175,15 +623,167 @@ private:
 	std::string m_dataFile;
 	LoadResult m_lastLoadResult = LoadResult::None;
 
+	mutable TileMutex m_tileMutex;
+	std::atomic<uint32_t> m_tileGeneration{ 0 };
+
 	std::shared_ptr<dtNavMesh> m_navMesh;
 	std::shared_ptr<dtNavMeshQuery> m_navMeshQuery;
+
+	// pool of idle queries for one navmesh. Replaced whenever the navmesh changes.
+	struct QueryPool
+	{
+		std::weak_ptr<dtNavMesh> navMesh;
+		std::vector<dtNavMeshQuery*> queries;
+
+		~QueryPool();
+	};
+	std::shared_ptr<QueryPool> m_queryPool;
+
+	// filters by avoided areas, cleared whenever the areas change
+	std::map<std::pair<uint64_t, uint16_t>, std::shared_ptr<const NavMeshQueryFilter>> m_queryFilters;
 	glm::vec3 m_boundsMin, m_boundsMax;
 	NavMeshConfig m_config;
+	uint64_t m_buildSourceHash = 0;
+	int64_t m_buildTime = 0;
+
+	// node budget saved with the mesh, 0 if it has none, and what searches in this
+	// zone have grown it to. Budgets grown in other zones are kept by zone name.
+	int m_savedNodeBudget = 0;
+	std::atomic<int> m_grownNodeBudget{ 0 };
+	std::unordered_map<std::string, int> m_grownNodeBudgets;
+	QueryNodeStats m_queryNodeStats;
+
+	// file backing the current navmesh, and the tiles it contains
+	std::shared_ptr<MappedFile> m_mappedFile;
+
+	// files and shared tiles that tiles were patched in from. Tiles may still
+	// point into them.
+	std::vector<std::shared_ptr<void>> m_patchedFiles;
+	std::vector<MeshFileTileEntry> m_tileIndex;
+	NavMeshFileCodec m_fileCodec = NavMeshFileCodec::None;
+
+	// decompressed tiles shared with other clients, and where each tile is in it,
+	// by data offset in the file.
+	std::shared_ptr<SharedMemory> m_sharedTiles;
+	std::unordered_map<uint32_t, uint32_t> m_sharedTileOffsets;
+	bool m_shareTileData = false;
+	bool m_simplifyDetailMeshes = false;
+	bool m_keepBuildCapacity = false;
+
+	std::vector<AgentNavMesh> m_agentNavMeshes;
+	bool m_loadAgentMeshes = false;
+	float m_agentHeight = 0.0f;
+	std::string m_loadedAgentProfile;
+
+	// only the load times are filled in, the rest is counted by GetStats
+	NavMeshStats m_loadStats;
+	float m_streamingRadius = 0.0f;
+	int m_streamingTileX = INT_MIN, m_streamingTileY = INT_MIN;
+
+	// path cache, most recently used at the front
+	struct PathCacheKey
+	{
+		dtPolyRef startRef;
+		dtPolyRef endRef;
+		uint32_t filterHash;
+
+		bool operator==(const PathCacheKey& other) const
+		{
+			return startRef == other.startRef && endRef == other.endRef
+				&& filterHash == other.filterHash;
+		}
+	};
+	struct PathCacheKeyHash
+	{
+		size_t operator()(const PathCacheKey& key) const
+		{
+			return std::hash<uint64_t>()((uint64_t)key.startRef * 31 + key.endRef) ^ key.filterHash;
+		}
+	};
+	using PathCacheEntry = std::pair<PathCacheKey, std::vector<dtPolyRef>>;
+	std::list<PathCacheEntry> m_pathCache;
+	std::unordered_map<PathCacheKey, std::list<PathCacheEntry>::iterator, PathCacheKeyHash> m_pathCacheIndex;
+	PathCacheStats m_pathCacheStats;
+
+	void BuildPolyComponents();
+
+	// component labels by tile index and poly index within the tile
+	std::vector<std::vector<uint32_t>> m_polyComponents;
+	uint32_t m_componentGeneration = 0;
+	bool m_componentsValid = false;
+
+	PolySampler m_polySampler;
+	const dtNavMesh* m_samplerMesh = nullptr;
+	uint32_t m_samplerGeneration = 0;
+
+	Signal<>::ScopedConnection m_pathCacheConn;
+	Signal<>::ScopedConnection m_pathCacheTilesConn;
+
+	QueryHeatmap m_queryHeatmap;
+	Signal<>::ScopedConnection m_queryHeatmapConn;
+
+	// index tiles that aren't in the area index yet, and drop the ones that are
+	// gone. New tiles get the switched off areas disabled.
+	void UpdateAreaIndex();
+	void ResetAreaIndex();
+
+	// areas switched off by SetAreaEnabled, see AvoidAreaBit
+	uint64_t m_disabledAreas = 0;
+
+	// polygons of each area that the tile data doesn't already disable
+	std::array<std::vector<dtPolyRef>, DT_MAX_AREAS> m_areaPolys;
+	std::unordered_set<dtTileRef> m_areaIndexTiles;
+	const dtNavMesh* m_areaIndexMesh = nullptr;
+
+	Signal<>::ScopedConnection m_areaIndexConn;
+	Signal<>::ScopedConnection m_areaIndexTilesConn;
+
+	TileGraph m_tileGraph;
+	LandmarkTable m_landmarks;
+	std::unordered_map<uint64_t, uint64_t> m_tileBuildHashes;
+	std::unordered_map<uint64_t, PrunedTile> m_prunedTiles;
+	std::vector<glm::vec3> m_pruneSeeds;
+	std::unique_ptr<NavMeshTileCache> m_tileCache;
 
 	std::vector<std::unique_ptr<ConvexVolume>> m_volumes;
 	std::unordered_map<uint32_t, ConvexVolume*> m_volumesById;
 	uint32_t m_nextVolumeId = 1;
 
+	// volumes by the buckets that their bounds overlap
+	void AddConvexVolumeToBuckets(ConvexVolume* volume);
+	void RemoveConvexVolumeFromBuckets(ConvexVolume* volume);
+	void RebuildConvexVolumeBuckets();
+	float m_volumeBucketSize = 256.0f;
+	std::unordered_map<uint64_t, std::vector<ConvexVolume*>> m_volumeBuckets;
+
+	// runtime volumes, and the area and flags that each polygon they painted had
+	// before. Flags don't include the Disabled flag of switched off areas.
+	struct PaintedPoly
+	{
+		dtPolyRef ref;
+		uint8_t area;
+		uint16_t flags;
+	};
+	struct RuntimeVolume
+	{
+		ConvexVolume volume;
+		std::vector<PaintedPoly> polys;
+	};
+
+	// paint the polygons of the volume that it hasn't painted yet
+	void PaintRuntimeVolume(RuntimeVolume& runtimeVolume);
+	void RestoreRuntimeVolume(size_t index);
+
+	// change the area and flags of a polygon, keeping the area index and the
+	// switched off areas in step
+	void RetagPoly(dtPolyRef ref, uint8_t area, uint16_t flags);
+	bool IsAreaIndexed(dtPolyRef ref) const;
+
+	std::vector<RuntimeVolume> m_runtimeVolumes;
+	uint32_t m_nextRuntimeVolumeId = 1;
+	Signal<>::ScopedConnection m_runtimeVolumeConn;
+	Signal<>::ScopedConnection m_runtimeVolumeTilesConn;
+
 	std::vector<const PolyAreaType*> m_polyAreaList;
 	std::array<PolyAreaType, (int)PolyArea::Last + 1> m_polyAreas;
 };
@@ -4,6 +4,10 @@
 
 #include "NavMeshData.h"
 
+#include <DetourNavMesh.h>
+
+#include <algorithm>
+
 constexpr unsigned long RGBA(uint8_t iR, uint8_t iG, uint8_t iB, uint8_t iA)
 {
 	return (iA << 24) | (iB << 16) | (iG << 8) | iR;
@@ -50,6 +54,16 @@ const std::vector<PolyAreaType> DefaultPolyAreas =
 		10.0f,                   // cost
 		true,                    // valid
 	},
+
+	// door
+	PolyAreaType{
+		4,                       // id
+		"Door",                  // name
+		RGBA(160, 96, 32, 255),  // color
+		+PolyFlags::Walk,        // flags
+		1.0f,                    // cost
+		true,                    // valid
+	},
 };
 
 bool IsUserDefinedPolyArea(uint8_t areaId)
@@ -66,3 +80,24 @@ bool operator==(const PolyAreaType& a, const PolyAreaType& b)
 
 	return make_tuple(a) == make_tuple(b);
 }
+
+std::vector<const dtMeshTile*> GetTilesInOrder(const dtNavMesh& navMesh)
+{
+	std::vector<const dtMeshTile*> tiles;
+
+	for (int i = 0; i < navMesh.getMaxTiles(); ++i)
+	{
+		const dtMeshTile* tile = navMesh.getTile(i);
+		if (tile && tile->header && tile->dataSize)
+			tiles.push_back(tile);
+	}
+
+	std::sort(tiles.begin(), tiles.end(), [](const dtMeshTile* a, const dtMeshTile* b)
+	{
+		if (a->header->y != b->header->y) return a->header->y < b->header->y;
+		if (a->header->x != b->header->x) return a->header->x < b->header->x;
+		return a->header->layer < b->header->layer;
+	});
+
+	return tiles;
+}
@@ -11,25 +11,58 @@
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <string>
 #include <vector>
 
 enum struct PolyFlags : uint16_t
 {
 	Walk          = 0x01, // ability to walk (ground, grass, road, etc)
-	Swim          = 0x02, // ability to swim (water) (unused)
+	Swim          = 0x02, // ability to swim (water)
 	Jump          = 0x04, // ability to jump. (unused)
 	Disabled      = 0x08, // disabled polygon
 
+	// set when building on polys that don't have room for an agent that much
+	// wider than the one the mesh is for, see NAVMESH_CLEARANCE_LEVELS
+	Narrow1       = 0x10,
+	Narrow2       = 0x20,
+	Narrow3       = 0x40,
+	Narrow4       = 0x80,
+	NarrowMask    = 0xf0,
+
 	All           = 0xffff,
 };
 constexpr bool has_bitwise_operations(PolyFlags) { return true; }
 
+// clearance past the agent radius of the mesh, in world units, that each of the
+// Narrow flags stands for. A poly has the flag if there's no point in it that
+// far from a wall.
+const float NAVMESH_CLEARANCE_LEVELS[] = { 1.0f, 2.0f, 4.0f, 8.0f };
+const int NAVMESH_CLEARANCE_LEVEL_COUNT = 4;
+
+// the flags to exclude for an agent that needs this much more room than the mesh
+// was built for. It's rounded up to the next level, past the last one only the
+// last one is excluded.
+inline uint16_t GetClearanceExcludeFlags(float extraClearance)
+{
+	if (extraClearance <= 0.0f)
+		return 0;
+
+	for (int i = 0; i < NAVMESH_CLEARANCE_LEVEL_COUNT; ++i)
+	{
+		if (extraClearance <= NAVMESH_CLEARANCE_LEVELS[i])
+			return static_cast<uint16_t>(+PolyFlags::Narrow1 << i);
+	}
+
+	return +PolyFlags::Narrow4;
+}
+
 enum struct PolyArea : uint8_t
 {
 	Unwalkable = 0,        // RC_NULL_AREA
 	Ground     = 1,        // RC_WALKABLE_AREA
 	Jump       = 2,
 	Water      = 3,
+	Door       = 4,        // painted under doors at runtime, see DoorAreas
 
 	UserDefinedFirst = 10,
 	UserDefinedLast  = 60,
@@ -61,6 +94,16 @@ enum struct PartitionType : uint32_t
 	LAYERS = 2,
 };
 
+// another agent size that a mesh is built for, alongside the one in the build
+// settings
+struct AgentProfile
+{
+	std::string name;
+	float agentHeight = 6.0f;
+	float agentRadius = 2.0f;
+	float agentMaxClimb = 4.0f;
+};
+
 struct NavMeshConfig
 {
 	uint8_t configVersion = 1;
@@ -80,6 +123,28 @@ struct NavMeshConfig
 	float detailSampleDist = 6.0f;
 	float detailSampleMaxError = 1.0f;
 	PartitionType partitionType = PartitionType::WATERSHED;
+	bool useTileCache = false;
+	bool pruneUnreachable = false;
+
+	// generate drop and jump links off of ledges
+	bool autoOffMeshLinks = false;
+	float maxDropHeight = 20.0f;
+	float maxJumpDistance = 12.0f;
+
+	// store tiles in the smaller packed encoding
+	bool packTiles = false;
+
+	// other agent sizes, each built into a mesh of its own from the same
+	// rasterized geometry and stored in the same file
+	std::vector<AgentProfile> agentProfiles;
+
+	// build a tile for each layer of the heightfield, so that floors stacked
+	// over each other are separate tiles at the same x, y
+	bool layeredTiles = false;
+
+	// merge flat polys of the same area across region borders after the poly
+	// mesh is built, and take out the verts along straight edges
+	bool mergePolys = false;
 };
 
 //----------------------------------------------------------------------------
@@ -88,12 +153,20 @@ struct NavMeshConfig
 // extension used for navmesh files
 const char* const NAVMESH_FILE_EXTENSION = ".navmesh";
 
+// extension used for patches to navmesh files, see NavMesh::SaveMeshPatch
+const char* const NAVMESH_PATCH_EXTENSION = ".navpatch";
+
 // header constants
 const int NAVMESH_FILE_MAGIC = 'MSET';
-const int NAVMESH_FILE_VERSION = 4;
+const int NAVMESH_FILE_VERSION = 9;
+
+// oldest file version that can still be loaded. Version 4 files store the
+// entire NavMeshFile proto (including tiles) as a single blob.
+const int NAVMESH_FILE_MIN_VERSION = 4;
 
 enum struct NavMeshFileFlags : uint16_t {
-	COMPRESSED = 0x0001
+	COMPRESSED = 0x0001,
+	PATCH      = 0x0002,
 };
 constexpr bool has_bitwise_operations(NavMeshFileFlags) { return true; }
 
@@ -104,12 +177,126 @@ struct MeshFileHeader
 	NavMeshFileFlags flags;
 };
 
+// Version 9 layout:
+//
+//   MeshFileHeader
+//   MeshFileContents
+//   MeshFileSummary
+//   NavMeshFile proto with the summary fields (compressed if COMPRESSED is set)
+//   NavMeshFile proto with everything else except tile data
+//   MeshFileTileEntry[tileCount]
+//   tile data, each tile aligned to NAVMESH_FILE_TILE_ALIGNMENT
+//
+// Each tile is compressed on its own, so a single tile can be read without
+// touching the rest of the file. Uncompressed tiles are stored exactly as
+// detour expects them so that they can be added to the navmesh straight out
+// of a mapped view of the file.
+//
+// Tiles with the PACKED flag are stored in the encoding from
+// NavMeshTilePacking.h (and then compressed if COMPRESSED is also set), and
+// have to be unpacked before they can be used. Version 6 files never have
+// packed tiles.
+//
+// The tile index starts with the tiles of the main mesh. The tiles of the
+// meshes built for other agent profiles follow, where the agent tile sets in
+// the tile set say. Version 7 files only have the main mesh.
+//
+// The summary holds the zone name, build settings, convex volumes and area
+// types, so tools can read those without going through the tile graph or tile
+// cache. Version 5 files are the same without the summary, and everything is
+// in the metadata.
+//
+// The summary's checksum is a crc32 over the stored summary, metadata and tile
+// index, checked before any of it is parsed, and each tile entry has a crc32
+// of the tile as it's stored, checked when the tile is read. Version 8 files
+// have no checksums and the shorter MeshFileTileEntryV8.
+//
+// A patch has the same layout and the PATCH flag. Its metadata is that of the
+// patched mesh, whose build hashes list every tile it has, and the tile index
+// only holds the tiles that aren't in the mesh it was made against with the
+// same build hash. Tiles of that mesh that aren't in the build hashes are gone.
+
+// compression used for the metadata and tiles in a file
+enum struct NavMeshFileCodec : uint32_t {
+	None       = 0,
+	Zlib       = 1,
+};
+
+struct MeshFileContents
+{
+	uint32_t metadataOffset;
+	uint32_t metadataSize;            // size of the metadata in the file
+	uint32_t metadataDataSize;        // size of the metadata once decompressed
+	NavMeshFileCodec codec;
+	uint32_t tileIndexOffset;
+	uint32_t tileCount;
+};
+
+// follows MeshFileContents in version 6 files, same codec as the metadata
+struct MeshFileSummary
+{
+	uint32_t summaryOffset;
+	uint32_t summarySize;             // size of the summary in the file
+	uint32_t summaryDataSize;         // size of the summary once decompressed
+	uint32_t checksum;                // crc32 of the summary, metadata and tile index, version 9
+};
+
+enum struct MeshFileTileFlags : uint32_t {
+	COMPRESSED = 0x0001,
+	PACKED     = 0x0002,
+	CHECKSUM   = 0x0004,              // checksum holds the crc32 of the stored data
+};
+constexpr bool has_bitwise_operations(MeshFileTileFlags) { return true; }
+
+struct MeshFileTileEntry
+{
+	uint64_t tileRef;
+	int32_t x, y, layer;
+	MeshFileTileFlags flags;
+	uint32_t dataOffset;              // offset from start of file
+	uint32_t storedSize;              // size of the data in the file
+	uint32_t dataSize;                // size of the tile once decompressed
+	uint32_t packedSize;              // size of the packed tile, if PACKED
+	uint32_t checksum;                // crc32 of the stored data, if CHECKSUM
+	uint32_t reserved;
+};
+
+// the tile entry of version 5 through 8 files, which is the start of the
+// current one
+struct MeshFileTileEntryV8
+{
+	uint64_t tileRef;
+	int32_t x, y, layer;
+	MeshFileTileFlags flags;
+	uint32_t dataOffset;
+	uint32_t storedSize;
+	uint32_t dataSize;
+	uint32_t packedSize;
+};
+
+// detour reads the tile header and poly data in place, so tile data in
+// the file must be at least as aligned as dtAlloc would return.
+const int NAVMESH_FILE_TILE_ALIGNMENT = 16;
+
 // compatibility version of the navmesh data
 const int NAVMESH_TILE_COMPAT_VERSION = 1;
 
+// compatibility version of the tile cache layers
+const int NAVMESH_TILECACHE_COMPAT_VERSION = 1;
+
 // Maximum number of nodes in navigation query
 const int NAVMESH_QUERY_MAX_NODES = 4096;
 
+// Maximum number of nodes when searching for a path. Paths across large zones
+// need more than the general queries. Used for meshes that were saved without a
+// node budget of their own, see NavMesh::GetQueryNodeBudget.
+const int NAVMESH_PATH_MAX_NODES = 2048 * 4;
+
+// bounds of the node budget of a mesh. The upper one is the most that detour's
+// node pool can index.
+const int NAVMESH_MIN_NODE_BUDGET = 1024;
+const int NAVMESH_MAX_NODE_BUDGET = 65535;
+
 //----------------------------------------------------------------------------
 
 // Convex Volumes
@@ -122,5 +309,19 @@ struct ConvexVolume
 	uint8_t areaType;
 
 	std::string name;
+
+	// bounds of verts, kept up to date by the navmesh
+	glm::vec3 bmin = { 0, 0, 0 };
+	glm::vec3 bmax = { 0, 0, 0 };
 };
 
+
+//----------------------------------------------------------------------------
+
+class dtNavMesh;
+struct dtMeshTile;
+
+// the tiles of the navmesh, ordered by y, x and layer. The slot a tile lands in
+// depends on the order the tiles were added, so anything that numbers the tiles
+// or writes them out goes by this order to come out the same on every build.
+std::vector<const dtMeshTile*> GetTilesInOrder(const dtNavMesh& navMesh);
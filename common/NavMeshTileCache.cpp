@@ -0,0 +1,311 @@
+//
+// NavMeshTileCache.cpp
+//
+
+#include "NavMeshTileCache.h"
+#include "common/NavMesh.h"
+
+#include <DetourAlloc.h>
+#include <DetourCommon.h>
+#include <DetourNavMeshBuilder.h>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+
+// scratch memory used while rebuilding a single tile
+static const size_t TILECACHE_SCRATCH_SIZE = 32 * 1024 * 1024;
+
+static inline uint64_t TileKey(int tx, int ty)
+{
+	return ((uint64_t)(uint32_t)tx << 32) | (uint32_t)ty;
+}
+
+//----------------------------------------------------------------------------
+
+namespace {
+
+// layers are small and rebuilt while the game is running, so favor speed
+struct ZlibCompressor : public dtTileCacheCompressor
+{
+	virtual int maxCompressedSize(const int bufferSize) override
+	{
+		return (int)compressBound((uLong)bufferSize);
+	}
+
+	virtual dtStatus compress(const unsigned char* buffer, const int bufferSize,
+		unsigned char* compressed, const int maxCompressedSize, int* compressedSize) override
+	{
+		uLongf size = (uLongf)maxCompressedSize;
+		if (compress2(compressed, &size, buffer, (uLong)bufferSize, Z_BEST_SPEED) != Z_OK)
+			return DT_FAILURE;
+
+		*compressedSize = (int)size;
+		return DT_SUCCESS;
+	}
+
+	virtual dtStatus decompress(const unsigned char* compressed, const int compressedSize,
+		unsigned char* buffer, const int maxBufferSize, int* bufferSize) override
+	{
+		uLongf size = (uLongf)maxBufferSize;
+		if (uncompress(buffer, &size, compressed, (uLong)compressedSize) != Z_OK)
+			return DT_FAILURE;
+
+		*bufferSize = (int)size;
+		return DT_SUCCESS;
+	}
+};
+
+// one tile is built at a time, so everything comes out of a single buffer that
+// is reset between tiles.
+struct LinearAllocator : public dtTileCacheAlloc
+{
+	std::unique_ptr<uint8_t[]> buffer;
+	size_t capacity;
+	size_t top = 0;
+
+	explicit LinearAllocator(size_t capacity)
+		: buffer(new uint8_t[capacity])
+		, capacity(capacity)
+	{
+	}
+
+	virtual void reset() override
+	{
+		top = 0;
+	}
+
+	virtual void* alloc(const size_t size) override
+	{
+		// keep allocations aligned
+		size_t aligned = (size + 15) & ~(size_t)15;
+		if (top + aligned > capacity)
+			return nullptr;
+
+		void* mem = &buffer[top];
+		top += aligned;
+		return mem;
+	}
+
+	virtual void free(void*) override
+	{
+	}
+};
+
+// poly flags follow the area definitions of the mesh, same as tiles from the builder
+struct MeshProcess : public dtTileCacheMeshProcess
+{
+	const NavMesh* navMesh;
+
+	explicit MeshProcess(const NavMesh* navMesh) : navMesh(navMesh) {}
+
+	virtual void process(dtNavMeshCreateParams* params,
+		unsigned char* polyAreas, unsigned short* polyFlags) override
+	{
+		for (int i = 0; i < params->polyCount; ++i)
+			polyFlags[i] = navMesh->GetPolyArea(polyAreas[i]).flags;
+	}
+};
+
+} // namespace
+
+//============================================================================
+
+NavMeshTileCache::NavMeshTileCache(const NavMesh* navMesh)
+	: m_navMesh(navMesh)
+	, m_tileCache(dtAllocTileCache(), &dtFreeTileCache)
+	, m_alloc(new LinearAllocator(TILECACHE_SCRATCH_SIZE))
+	, m_meshProcess(new MeshProcess(navMesh))
+{
+}
+
+NavMeshTileCache::~NavMeshTileCache()
+{
+}
+
+dtTileCacheCompressor* NavMeshTileCache::GetCompressor()
+{
+	// stateless, so it can be shared by the build threads
+	static ZlibCompressor s_compressor;
+	return &s_compressor;
+}
+
+void NavMeshTileCache::SetOwner(const NavMesh* navMesh)
+{
+	m_navMesh = navMesh;
+	static_cast<MeshProcess*>(m_meshProcess.get())->navMesh = navMesh;
+}
+
+bool NavMeshTileCache::Init(const dtTileCacheParams& params)
+{
+	m_obstacles.clear();
+	m_rebuiltTiles.clear();
+	m_pendingBounds.clear();
+	m_upToDate = true;
+
+	m_tileCache.reset(dtAllocTileCache());
+	if (!m_tileCache)
+		return false;
+
+	dtStatus status = m_tileCache->init(&params, m_alloc.get(), GetCompressor(), m_meshProcess.get());
+	return dtStatusSucceed(status);
+}
+
+const dtTileCacheParams* NavMeshTileCache::GetParams() const
+{
+	return m_tileCache->getParams();
+}
+
+void NavMeshTileCache::SetTileLayers(int tx, int ty, std::vector<std::vector<uint8_t>> layers)
+{
+	dtCompressedTileRef refs[64];
+	int count = m_tileCache->getTilesAt(tx, ty, refs, 64);
+
+	for (int i = 0; i < count; ++i)
+	{
+		uint8_t* data = nullptr;
+		int dataSize = 0;
+
+		// owned by the tile cache, so it has to be freed here
+		if (dtStatusSucceed(m_tileCache->removeTile(refs[i], &data, &dataSize)) && data)
+			dtFree(data);
+	}
+
+	for (const std::vector<uint8_t>& layer : layers)
+		AddLayer(layer.data(), (int)layer.size());
+}
+
+bool NavMeshTileCache::AddLayer(const uint8_t* data, int dataSize)
+{
+	if (dataSize < (int)sizeof(dtTileCacheLayerHeader))
+		return false;
+
+	uint8_t* copy = (uint8_t*)dtAlloc(dataSize, DT_ALLOC_PERM);
+	if (!copy)
+		return false;
+
+	memcpy(copy, data, dataSize);
+
+	dtStatus status = m_tileCache->addTile(copy, dataSize, DT_COMPRESSEDTILE_FREE_DATA, nullptr);
+	if (dtStatusFailed(status))
+	{
+		dtFree(copy);
+		return false;
+	}
+
+	return true;
+}
+
+int NavMeshTileCache::GetLayerCount() const
+{
+	int count = 0;
+	ForEachLayer([&count](int, int, int, const uint8_t*, int) { ++count; });
+
+	return count;
+}
+
+//----------------------------------------------------------------------------
+
+dtObstacleRef NavMeshTileCache::ObstacleAdded(dtStatus status, dtObstacleRef ref)
+{
+	if (dtStatusFailed(status))
+		return 0;
+
+	float bmin[3], bmax[3];
+	m_tileCache->getObstacleBounds(m_tileCache->getObstacleByRef(ref), bmin, bmax);
+
+	m_pendingBounds.emplace_back(glm::make_vec3(bmin), glm::make_vec3(bmax));
+	m_obstacles.push_back(ref);
+	m_upToDate = false;
+
+	return ref;
+}
+
+dtObstacleRef NavMeshTileCache::AddCylinderObstacle(const glm::vec3& pos, float radius, float height)
+{
+	dtObstacleRef ref = 0;
+	dtStatus status = m_tileCache->addObstacle(glm::value_ptr(pos), radius, height, &ref);
+
+	return ObstacleAdded(status, ref);
+}
+
+dtObstacleRef NavMeshTileCache::AddBoxObstacle(const glm::vec3& bmin, const glm::vec3& bmax)
+{
+	dtObstacleRef ref = 0;
+	dtStatus status = m_tileCache->addBoxObstacle(glm::value_ptr(bmin), glm::value_ptr(bmax), &ref);
+
+	return ObstacleAdded(status, ref);
+}
+
+bool NavMeshTileCache::RemoveObstacle(dtObstacleRef ref)
+{
+	auto iter = std::find(m_obstacles.begin(), m_obstacles.end(), ref);
+	if (iter == m_obstacles.end())
+		return false;
+
+	if (dtStatusFailed(m_tileCache->removeObstacle(ref)))
+		return false;
+
+	m_obstacles.erase(iter);
+	m_upToDate = false;
+	return true;
+}
+
+void NavMeshTileCache::RemoveAllObstacles()
+{
+	std::vector<dtObstacleRef> obstacles = m_obstacles;
+
+	for (dtObstacleRef ref : obstacles)
+		RemoveObstacle(ref);
+}
+
+bool NavMeshTileCache::IsTileRebuilt(int tx, int ty) const
+{
+	return m_rebuiltTiles.count(TileKey(tx, ty)) != 0;
+}
+
+void NavMeshTileCache::PrepareTiles(dtNavMesh* navMesh, const float* bmin, const float* bmax)
+{
+	dtCompressedTileRef refs[64];
+	int count = 0;
+	m_tileCache->queryTiles(bmin, bmax, refs, &count, 64);
+
+	for (int i = 0; i < count; ++i)
+	{
+		const dtCompressedTile* tile = m_tileCache->getTileByRef(refs[i]);
+		if (!tile || !tile->header)
+			continue;
+
+		int tx = tile->header->tx;
+		int ty = tile->header->ty;
+		if (!m_rebuiltTiles.insert(TileKey(tx, ty)).second)
+			continue;
+
+		// the stored tile covers every layer, replace all of it
+		const dtMeshTile* meshTiles[32];
+		int meshTileCount = navMesh->getTilesAt(tx, ty, meshTiles, 32);
+		for (int j = 0; j < meshTileCount; ++j)
+			navMesh->removeTile(navMesh->getTileRef(meshTiles[j]), nullptr, nullptr);
+
+		m_tileCache->buildNavMeshTilesAt(tx, ty, navMesh);
+	}
+}
+
+bool NavMeshTileCache::Update(dtNavMesh* navMesh)
+{
+	if (!navMesh || m_upToDate)
+		return false;
+
+	for (const auto& bounds : m_pendingBounds)
+		PrepareTiles(navMesh, glm::value_ptr(bounds.first), glm::value_ptr(bounds.second));
+	m_pendingBounds.clear();
+
+	bool upToDate = false;
+	dtStatus status = m_tileCache->update(0, navMesh, &upToDate);
+
+	// a failed update would keep failing, don't retry it every pulse
+	m_upToDate = upToDate || dtStatusFailed(status);
+	return true;
+}
@@ -0,0 +1,113 @@
+//
+// NavMeshTileCache.h
+//
+
+#pragma once
+
+#include <DetourNavMesh.h>
+#include <DetourTileCache.h>
+#include <DetourTileCacheBuilder.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+class NavMesh;
+
+// number of layers that a tile is expected to have on average. Used to size the
+// tile cache, and the navmesh when it is built with a tile cache.
+const int TILECACHE_EXPECTED_LAYERS_PER_TILE = 4;
+
+// maximum number of temporary obstacles at any one time
+const int TILECACHE_MAX_OBSTACLES = 256;
+
+// Compressed heightfield layers for the tiles of a navmesh, used to rebuild the
+// tiles underneath temporary obstacles. The tiles in the mesh file are kept as
+// they are until an obstacle touches them. At that point every layer of the
+// tile is rebuilt from the cache, and the tile stays that way until the mesh is
+// reloaded.
+class NavMeshTileCache
+{
+public:
+	// the navmesh provides the poly flags of each area
+	explicit NavMeshTileCache(const NavMesh* navMesh);
+	~NavMeshTileCache();
+
+	NavMeshTileCache(const NavMeshTileCache&) = delete;
+	NavMeshTileCache& operator=(const NavMeshTileCache&) = delete;
+
+	// change the navmesh that poly flags are taken from
+	void SetOwner(const NavMesh* navMesh);
+
+	bool Init(const dtTileCacheParams& params);
+	const dtTileCacheParams* GetParams() const;
+
+	//------------------------------------------------------------------------
+	// layers
+
+	// replace the layers of a tile. Each entry is a compressed layer built with
+	// dtBuildTileCacheLayer using the compressor returned by GetCompressor.
+	void SetTileLayers(int tx, int ty, std::vector<std::vector<uint8_t>> layers);
+
+	// add a single compressed layer, as read from a file.
+	bool AddLayer(const uint8_t* data, int dataSize);
+
+	// calls fn(tx, ty, layer, data, size) for every compressed layer
+	template <typename Fn>
+	void ForEachLayer(Fn&& fn) const
+	{
+		for (int i = 0; i < m_tileCache->getTileCount(); ++i)
+		{
+			const dtCompressedTile* tile = m_tileCache->getTile(i);
+			if (tile->header && tile->compressed)
+				fn(tile->header->tx, tile->header->ty, tile->header->tlayer, tile->data, tile->dataSize);
+		}
+	}
+
+	int GetLayerCount() const;
+
+	static dtTileCacheCompressor* GetCompressor();
+
+	//------------------------------------------------------------------------
+	// obstacles
+
+	// positions are in navmesh coordinates. Returns 0 on failure.
+	dtObstacleRef AddCylinderObstacle(const glm::vec3& pos, float radius, float height);
+	dtObstacleRef AddBoxObstacle(const glm::vec3& bmin, const glm::vec3& bmax);
+	bool RemoveObstacle(dtObstacleRef ref);
+	void RemoveAllObstacles();
+
+	const std::vector<dtObstacleRef>& GetObstacles() const { return m_obstacles; }
+
+	// rebuild the tiles affected by obstacles that were added or removed. A
+	// few tiles are done per call. Returns true if the navmesh changed.
+	bool Update(dtNavMesh* navMesh);
+
+	bool IsUpToDate() const { return m_upToDate; }
+
+	// true for tiles that have been rebuilt from the cache, and no longer
+	// match what is stored in the mesh file.
+	bool IsTileRebuilt(int tx, int ty) const;
+
+private:
+	dtObstacleRef ObstacleAdded(dtStatus status, dtObstacleRef ref);
+
+	// replace the stored tiles under an obstacle by ones built from the cache,
+	// so that every layer of the tile can be rebuilt around the obstacle.
+	void PrepareTiles(dtNavMesh* navMesh, const float* bmin, const float* bmax);
+
+	const NavMesh* m_navMesh;
+
+	std::unique_ptr<dtTileCache, void(*)(dtTileCache*)> m_tileCache;
+	std::unique_ptr<dtTileCacheAlloc> m_alloc;
+	std::unique_ptr<dtTileCacheMeshProcess> m_meshProcess;
+
+	std::vector<dtObstacleRef> m_obstacles;
+	std::unordered_set<uint64_t> m_rebuiltTiles;
+
+	// bounds of the obstacles added since the last update, min and max
+	std::vector<std::pair<glm::vec3, glm::vec3>> m_pendingBounds;
+	bool m_upToDate = true;
+};
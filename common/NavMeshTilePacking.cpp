@@ -0,0 +1,426 @@
+//
+// NavMeshTilePacking.cpp
+//
+
+#include "NavMeshTilePacking.h"
+
+#include <DetourAlloc.h>
+#include <DetourCommon.h>
+#include <DetourNavMesh.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static const uint32_t PACKED_TILE_MAGIC = 'PTIL';
+static const uint32_t PACKED_TILE_VERSION = 1;
+
+// detail tri edge flag recast sets for edges on the poly's boundary
+static const uint8_t DETAIL_EDGE_BOUNDARY = 1;
+
+struct PackedTileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	float cs;
+	float ch;
+
+	// height range of the detail vertices
+	float detailMinY;
+	float detailRangeY;
+};
+
+// where each part of a tile starts, laid out the way dtNavMesh::addTile reads it
+struct TileLayout
+{
+	explicit TileLayout(const dtMeshHeader& header)
+	{
+		verts = dtAlign4(sizeof(dtMeshHeader));
+		polys = verts + dtAlign4(sizeof(float) * 3 * header.vertCount);
+		links = polys + dtAlign4(sizeof(dtPoly) * header.polyCount);
+		detailMeshes = links + dtAlign4(sizeof(dtLink) * header.maxLinkCount);
+		detailVerts = detailMeshes + dtAlign4(sizeof(dtPolyDetail) * header.detailMeshCount);
+		detailTris = detailVerts + dtAlign4(sizeof(float) * 3 * header.detailVertCount);
+		bvTree = detailTris + dtAlign4(sizeof(unsigned char) * 4 * header.detailTriCount);
+		offMeshCons = bvTree + dtAlign4(sizeof(dtBVNode) * header.bvNodeCount);
+		size = offMeshCons + dtAlign4(sizeof(dtOffMeshConnection) * header.offMeshConCount);
+	}
+
+	int verts, polys, links, detailMeshes, detailVerts, detailTris, bvTree, offMeshCons, size;
+};
+
+static bool IsValidHeader(const dtMeshHeader& header)
+{
+	return header.magic == DT_NAVMESH_MAGIC
+		&& header.version == DT_NAVMESH_VERSION
+		&& header.vertCount >= header.offMeshConCount * 2
+		&& header.polyCount >= 0 && header.maxLinkCount >= 0
+		&& header.detailMeshCount >= 0 && header.detailMeshCount <= header.polyCount
+		&& header.detailVertCount >= 0 && header.detailTriCount >= 0
+		&& header.bvNodeCount >= 0 && header.offMeshConCount >= 0;
+}
+
+static uint16_t Quantize(float value, float min, float range)
+{
+	if (range <= 0.0f)
+		return 0;
+
+	float t = std::min(std::max((value - min) / range, 0.0f), 1.0f);
+	return static_cast<uint16_t>(t * 65535.0f + 0.5f);
+}
+
+static float Dequantize(uint16_t value, float min, float range)
+{
+	return min + value * (range / 65535.0f);
+}
+
+//----------------------------------------------------------------------------
+
+class PackWriter
+{
+public:
+	explicit PackWriter(std::vector<uint8_t>& out) : m_out(out) {}
+
+	void Write(const void* data, size_t size)
+	{
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		m_out.insert(m_out.end(), bytes, bytes + size);
+	}
+
+	template <typename T>
+	void Write(const T& value) { Write(&value, sizeof(T)); }
+
+private:
+	std::vector<uint8_t>& m_out;
+};
+
+class PackReader
+{
+public:
+	PackReader(const uint8_t* data, size_t size) : m_data(data), m_size(size) {}
+
+	bool Read(void* out, size_t size)
+	{
+		if (m_pos + size > m_size)
+		{
+			m_failed = true;
+			return false;
+		}
+
+		memcpy(out, m_data + m_pos, size);
+		m_pos += size;
+		return true;
+	}
+
+	template <typename T>
+	T Read()
+	{
+		T value = T();
+		Read(&value, sizeof(T));
+		return value;
+	}
+
+	bool IsDone() const { return !m_failed && m_pos == m_size; }
+	bool HasFailed() const { return m_failed; }
+
+private:
+	const uint8_t* m_data;
+	size_t m_size;
+	size_t m_pos = 0;
+	bool m_failed = false;
+};
+
+//============================================================================
+
+bool PackTileData(const uint8_t* data, int dataSize, float cs, float ch,
+	std::vector<uint8_t>& packed)
+{
+	packed.clear();
+
+	if (!data || dataSize < (int)sizeof(dtMeshHeader) || cs <= 0.0f || ch <= 0.0f)
+		return false;
+
+	const dtMeshHeader& header = *reinterpret_cast<const dtMeshHeader*>(data);
+	if (!IsValidHeader(header))
+		return false;
+
+	TileLayout layout(header);
+	if (layout.size != dataSize)
+		return false;
+
+	const float* verts = reinterpret_cast<const float*>(data + layout.verts);
+	const dtPoly* polys = reinterpret_cast<const dtPoly*>(data + layout.polys);
+	const dtPolyDetail* detailMeshes = reinterpret_cast<const dtPolyDetail*>(data + layout.detailMeshes);
+	const float* detailVerts = reinterpret_cast<const float*>(data + layout.detailVerts);
+	const uint8_t* detailTris = data + layout.detailTris;
+
+	// off-mesh connection ends come after the poly vertices, and aren't on the grid
+	const int gridVertCount = header.vertCount - header.offMeshConCount * 2;
+
+	std::vector<uint16_t> cells(gridVertCount * 3);
+	for (int i = 0; i < gridVertCount * 3; ++i)
+	{
+		const int axis = i % 3;
+		const float size = axis == 1 ? ch : cs;
+
+		long cell = lroundf((verts[i] - header.bmin[axis]) / size);
+		if (cell < 0 || cell > 0xffff)
+			return false;
+
+		// has to come back bit for bit the way dtCreateNavMeshData made it
+		cells[i] = static_cast<uint16_t>(cell);
+		float rebuilt = header.bmin[axis] + cells[i] * size;
+		if (memcmp(&rebuilt, &verts[i], sizeof(float)) != 0)
+			return false;
+	}
+
+	// detail meshes are stored one after another, only the counts are needed
+	unsigned int vertBase = 0, triBase = 0;
+	for (int i = 0; i < header.detailMeshCount; ++i)
+	{
+		if (detailMeshes[i].vertBase != vertBase || detailMeshes[i].triBase != triBase)
+			return false;
+
+		vertBase += detailMeshes[i].vertCount;
+		triBase += detailMeshes[i].triCount;
+	}
+
+	if (vertBase != (unsigned int)header.detailVertCount || triBase != (unsigned int)header.detailTriCount)
+		return false;
+
+	float detailMinY = 0.0f, detailMaxY = 0.0f;
+	for (int i = 0; i < header.detailVertCount; ++i)
+	{
+		float y = detailVerts[i * 3 + 1];
+		detailMinY = i == 0 ? y : std::min(detailMinY, y);
+		detailMaxY = i == 0 ? y : std::max(detailMaxY, y);
+	}
+
+	PackWriter writer(packed);
+
+	PackedTileHeader packedHeader;
+	packedHeader.magic = PACKED_TILE_MAGIC;
+	packedHeader.version = PACKED_TILE_VERSION;
+	packedHeader.cs = cs;
+	packedHeader.ch = ch;
+	packedHeader.detailMinY = detailMinY;
+	packedHeader.detailRangeY = detailMaxY - detailMinY;
+	writer.Write(packedHeader);
+	writer.Write(header);
+
+	writer.Write(cells.data(), cells.size() * sizeof(uint16_t));
+	writer.Write(&verts[gridVertCount * 3], header.offMeshConCount * 6 * sizeof(float));
+
+	// firstLink is filled in when the tile is added
+	for (int i = 0; i < header.polyCount; ++i)
+	{
+		const dtPoly& poly = polys[i];
+		writer.Write(poly.verts);
+		writer.Write(poly.neis);
+		writer.Write(poly.flags);
+		writer.Write(poly.vertCount);
+		writer.Write(poly.areaAndtype);
+	}
+
+	for (int i = 0; i < header.detailMeshCount; ++i)
+	{
+		writer.Write(detailMeshes[i].vertCount);
+		writer.Write(detailMeshes[i].triCount);
+	}
+
+	for (int i = 0; i < header.detailVertCount; ++i)
+	{
+		const float* v = &detailVerts[i * 3];
+		writer.Write(Quantize(v[0], header.bmin[0], header.bmax[0] - header.bmin[0]));
+		writer.Write(Quantize(v[1], detailMinY, packedHeader.detailRangeY));
+		writer.Write(Quantize(v[2], header.bmin[2], header.bmax[2] - header.bmin[2]));
+	}
+
+	// neighbouring indices are close together, the differences compress better
+	for (int i = 0; i < header.detailTriCount; ++i)
+	{
+		const uint8_t* t = &detailTris[i * 4];
+		uint8_t tri[4] = { t[0], (uint8_t)(t[1] - t[0]), (uint8_t)(t[2] - t[1]), t[3] };
+		writer.Write(tri);
+	}
+
+	writer.Write(data + layout.bvTree, header.bvNodeCount * sizeof(dtBVNode));
+	writer.Write(data + layout.offMeshCons, header.offMeshConCount * sizeof(dtOffMeshConnection));
+
+	return true;
+}
+
+bool UnpackTileData(const uint8_t* packed, size_t packedSize, uint8_t* out, size_t dataSize)
+{
+	PackReader reader(packed, packedSize);
+
+	PackedTileHeader packedHeader = reader.Read<PackedTileHeader>();
+	if (reader.HasFailed() || packedHeader.magic != PACKED_TILE_MAGIC
+		|| packedHeader.version != PACKED_TILE_VERSION)
+	{
+		return false;
+	}
+
+	dtMeshHeader header = reader.Read<dtMeshHeader>();
+	if (reader.HasFailed() || !IsValidHeader(header))
+		return false;
+
+	TileLayout layout(header);
+	if ((size_t)layout.size != dataSize)
+		return false;
+
+	memset(out, 0, dataSize);
+	memcpy(out, &header, sizeof(header));
+
+	float* verts = reinterpret_cast<float*>(out + layout.verts);
+	dtPoly* polys = reinterpret_cast<dtPoly*>(out + layout.polys);
+	dtPolyDetail* detailMeshes = reinterpret_cast<dtPolyDetail*>(out + layout.detailMeshes);
+	float* detailVerts = reinterpret_cast<float*>(out + layout.detailVerts);
+	uint8_t* detailTris = out + layout.detailTris;
+
+	const int gridVertCount = header.vertCount - header.offMeshConCount * 2;
+	for (int i = 0; i < gridVertCount * 3; ++i)
+	{
+		const int axis = i % 3;
+		const float size = axis == 1 ? packedHeader.ch : packedHeader.cs;
+
+		uint16_t cell = reader.Read<uint16_t>();
+		verts[i] = header.bmin[axis] + cell * size;
+	}
+
+	reader.Read(&verts[gridVertCount * 3], header.offMeshConCount * 6 * sizeof(float));
+
+	for (int i = 0; i < header.polyCount; ++i)
+	{
+		dtPoly& poly = polys[i];
+		poly.firstLink = DT_NULL_LINK;
+		reader.Read(poly.verts, sizeof(poly.verts));
+		reader.Read(poly.neis, sizeof(poly.neis));
+		poly.flags = reader.Read<unsigned short>();
+		poly.vertCount = reader.Read<unsigned char>();
+		poly.areaAndtype = reader.Read<unsigned char>();
+	}
+
+	unsigned int vertBase = 0, triBase = 0;
+	for (int i = 0; i < header.detailMeshCount; ++i)
+	{
+		dtPolyDetail& detail = detailMeshes[i];
+		detail.vertBase = vertBase;
+		detail.triBase = triBase;
+		detail.vertCount = reader.Read<unsigned char>();
+		detail.triCount = reader.Read<unsigned char>();
+
+		vertBase += detail.vertCount;
+		triBase += detail.triCount;
+	}
+
+	if (vertBase != (unsigned int)header.detailVertCount || triBase != (unsigned int)header.detailTriCount)
+		return false;
+
+	for (int i = 0; i < header.detailVertCount; ++i)
+	{
+		float* v = &detailVerts[i * 3];
+		v[0] = Dequantize(reader.Read<uint16_t>(), header.bmin[0], header.bmax[0] - header.bmin[0]);
+		v[1] = Dequantize(reader.Read<uint16_t>(), packedHeader.detailMinY, packedHeader.detailRangeY);
+		v[2] = Dequantize(reader.Read<uint16_t>(), header.bmin[2], header.bmax[2] - header.bmin[2]);
+	}
+
+	for (int i = 0; i < header.detailTriCount; ++i)
+	{
+		uint8_t tri[4];
+		reader.Read(tri, sizeof(tri));
+
+		uint8_t* t = &detailTris[i * 4];
+		t[0] = tri[0];
+		t[1] = (uint8_t)(t[0] + tri[1]);
+		t[2] = (uint8_t)(t[1] + tri[2]);
+		t[3] = tri[3];
+	}
+
+	reader.Read(out + layout.bvTree, header.bvNodeCount * sizeof(dtBVNode));
+	reader.Read(out + layout.offMeshCons, header.offMeshConCount * sizeof(dtOffMeshConnection));
+
+	return reader.IsDone();
+}
+
+//----------------------------------------------------------------------------
+
+bool SimplifyTileDetail(const uint8_t* data, int dataSize, uint8_t*& out, int& outSize)
+{
+	out = nullptr;
+	outSize = 0;
+
+	if (!data || dataSize < (int)sizeof(dtMeshHeader))
+		return false;
+
+	dtMeshHeader header;
+	memcpy(&header, data, sizeof(header));
+	if (!IsValidHeader(header))
+		return false;
+
+	TileLayout layout(header);
+	if (layout.size != dataSize)
+		return false;
+
+	const dtPoly* polys = reinterpret_cast<const dtPoly*>(data + layout.polys);
+
+	// a fan over the poly's own vertices for each detail mesh
+	int triCount = 0;
+	for (int i = 0; i < header.detailMeshCount; ++i)
+	{
+		if (polys[i].vertCount < 3)
+			return false;
+		triCount += polys[i].vertCount - 2;
+	}
+
+	dtMeshHeader simplified = header;
+	simplified.detailVertCount = 0;
+	simplified.detailTriCount = triCount;
+
+	TileLayout newLayout(simplified);
+	if (newLayout.size >= dataSize)
+		return false;
+
+	uint8_t* buffer = static_cast<uint8_t*>(dtAlloc(newLayout.size, DT_ALLOC_PERM));
+	if (!buffer)
+		return false;
+	memset(buffer, 0, newLayout.size);
+
+	// everything up to the detail meshes, and after the detail tris, stays the same
+	memcpy(buffer, &simplified, sizeof(simplified));
+	memcpy(buffer + layout.verts, data + layout.verts, layout.detailMeshes - layout.verts);
+	memcpy(buffer + newLayout.bvTree, data + layout.bvTree, layout.size - layout.bvTree);
+
+	dtPolyDetail* detailMeshes = reinterpret_cast<dtPolyDetail*>(buffer + newLayout.detailMeshes);
+	uint8_t* detailTris = buffer + newLayout.detailTris;
+
+	unsigned int triBase = 0;
+	for (int i = 0; i < header.detailMeshCount; ++i)
+	{
+		const int nv = polys[i].vertCount;
+
+		dtPolyDetail& pd = detailMeshes[i];
+		pd.vertBase = 0;
+		pd.vertCount = 0;
+		pd.triBase = triBase;
+		pd.triCount = static_cast<unsigned char>(nv - 2);
+
+		for (int j = 1; j < nv - 1; ++j)
+		{
+			uint8_t* t = &detailTris[triBase++ * 4];
+			t[0] = 0;
+			t[1] = static_cast<uint8_t>(j);
+			t[2] = static_cast<uint8_t>(j + 1);
+
+			// mark the edges that lie on the poly's boundary
+			t[3] = 0;
+			if (j == 1) t[3] |= DETAIL_EDGE_BOUNDARY << 0;
+			t[3] |= DETAIL_EDGE_BOUNDARY << 2;
+			if (j == nv - 2) t[3] |= DETAIL_EDGE_BOUNDARY << 4;
+		}
+	}
+
+	out = buffer;
+	outSize = newLayout.size;
+	return true;
+}
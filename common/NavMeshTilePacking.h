@@ -0,0 +1,38 @@
+//
+// NavMeshTilePacking.h
+//
+
+// Smaller encoding of detour tile data for storing in mesh files.
+//
+//  - poly vertices are stored as the 16 bit cell coordinates they were built
+//    from, and come back exactly as detour computed them.
+//  - detail vertices are stored as 16 bits relative to the bounds of the tile.
+//    They only give the height of the surface, which comes back within
+//    1/65535th of the tile's height range.
+//  - detail triangles store the difference between their indices.
+//  - links and the other parts that detour fills in when the tile is added
+//    are left out.
+//
+// Unpacking gives a tile in the standard detour layout of the same size, so
+// it can be added to a navmesh the same way as before.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// cs and ch are the cell size and height the tile was built with. Returns false
+// if the tile can't be packed, e.g. it was built with other cell sizes, in which
+// case it should be stored as is.
+bool PackTileData(const uint8_t* data, int dataSize, float cs, float ch,
+	std::vector<uint8_t>& packed);
+
+// out must hold dataSize bytes, the size of the tile before it was packed.
+bool UnpackTileData(const uint8_t* packed, size_t packedSize, uint8_t* out, size_t dataSize);
+
+// Makes a copy of a tile with the detail meshes replaced by a fan of triangles
+// over each poly's own vertices, so heights on the tile come from the poly
+// vertices alone. out is allocated with dtAlloc. Returns false if the tile
+// can't be simplified or wouldn't get any smaller.
+bool SimplifyTileDetail(const uint8_t* data, int dataSize, uint8_t*& out, int& outSize);
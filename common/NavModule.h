@@ -18,4 +18,18 @@ public:
 
 	virtual void SetZoneId(int zoneId) {}
 	virtual void SetGameState(int gameState) {}
+
+	// how OnPulse is scheduled. Critical modules run on every pulse before
+	// movement, the rest after it as long as the pulse has time left for their
+	// budget. Background modules only run every few pulses.
+	enum class PulsePriority
+	{
+		Critical,
+		Normal,
+		Background,
+	};
+	virtual PulsePriority GetPulsePriority() const { return PulsePriority::Normal; }
+
+	// time the module expects its OnPulse to take, in milliseconds
+	virtual float GetPulseBudget() const { return 0.5f; }
 };
@@ -0,0 +1,139 @@
+//
+// NavTrace.cpp
+//
+
+#include "NavTrace.h"
+
+#include <algorithm>
+#include <cstring>
+
+// how often the writer wakes up to drain the ring
+static const int NAVTRACE_WRITE_INTERVAL_MS = 100;
+
+NavTraceWriter::NavTraceWriter()
+	: m_ring(new NavTraceRecord[RING_SIZE])
+{
+}
+
+NavTraceWriter::~NavTraceWriter()
+{
+	Stop();
+}
+
+bool NavTraceWriter::Start(const std::string& filename, const std::string& zoneShortName)
+{
+	Stop();
+
+	m_file.open(filename, std::ios::binary | std::ios::trunc);
+	if (!m_file.is_open())
+		return false;
+
+	NavTraceHeader header;
+	strncpy(header.zoneShortName, zoneShortName.c_str(), sizeof(header.zoneShortName) - 1);
+	header.startTime = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+	m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	m_filename = filename;
+	m_startTime = std::chrono::steady_clock::now();
+	m_head = 0;
+	m_tail = 0;
+	m_written = 0;
+	m_dropped = 0;
+	m_stopping = false;
+	m_active = true;
+
+	m_thread = std::thread([this]() { WriterThread(); });
+	return true;
+}
+
+void NavTraceWriter::Stop()
+{
+	if (!m_active)
+		return;
+
+	m_stopping = true;
+	if (m_thread.joinable())
+		m_thread.join();
+
+	m_file.close();
+	m_active = false;
+}
+
+void NavTraceWriter::Add(NavTraceRecord record)
+{
+	if (!m_active)
+		return;
+
+	uint32_t head = m_head.load(std::memory_order_relaxed);
+	if (head - m_tail.load(std::memory_order_acquire) >= RING_SIZE)
+	{
+		++m_dropped;
+		return;
+	}
+
+	record.time = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - m_startTime).count());
+
+	m_ring[head & (RING_SIZE - 1)] = record;
+	m_head.store(head + 1, std::memory_order_release);
+}
+
+void NavTraceWriter::WriterThread()
+{
+	while (!m_stopping)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(NAVTRACE_WRITE_INTERVAL_MS));
+		Drain();
+	}
+
+	// whatever was added before Stop
+	Drain();
+	m_file.flush();
+}
+
+void NavTraceWriter::Drain()
+{
+	uint32_t tail = m_tail.load(std::memory_order_relaxed);
+	uint32_t head = m_head.load(std::memory_order_acquire);
+
+	// the ring wraps at most once between the two, so it's written in up to two runs
+	while (tail != head)
+	{
+		uint32_t index = tail & (RING_SIZE - 1);
+		uint32_t count = std::min(head - tail, RING_SIZE - index);
+
+		m_file.write(reinterpret_cast<const char*>(&m_ring[index]), count * sizeof(NavTraceRecord));
+		tail += count;
+		m_written += count;
+
+		m_tail.store(tail, std::memory_order_release);
+	}
+}
+
+//----------------------------------------------------------------------------
+
+bool ReadNavTrace(const std::string& filename, NavTraceHeader& header,
+	std::vector<NavTraceRecord>& records)
+{
+	std::ifstream infile(filename, std::ios::binary | std::ios::ate);
+	if (!infile.is_open())
+		return false;
+
+	size_t fileSize = static_cast<size_t>(infile.tellg());
+	infile.seekg(0);
+
+	if (fileSize < sizeof(NavTraceHeader))
+		return false;
+
+	infile.read(reinterpret_cast<char*>(&header), sizeof(header));
+	if (header.magic != NAVTRACE_MAGIC || header.version != NAVTRACE_VERSION)
+		return false;
+
+	// a trace that was cut short ends with part of a record, which is left out
+	size_t count = (fileSize - sizeof(NavTraceHeader)) / sizeof(NavTraceRecord);
+	records.resize(count);
+	infile.read(reinterpret_cast<char*>(records.data()), count * sizeof(NavTraceRecord));
+
+	return !infile.fail();
+}
@@ -0,0 +1,138 @@
+//
+// NavTrace.h
+//
+
+// A compact binary trace of a navigation session, for going over regressions that
+// only show up in game. The file is a NavTraceHeader followed by fixed size
+// NavTraceRecords. Positions are in recast coordinates, the ones the queries were
+// made with, so the replans can be replayed against another mesh or build, see
+// PathBenchmark.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+constexpr uint32_t NAVTRACE_MAGIC = 'NTRC';
+constexpr uint32_t NAVTRACE_VERSION = 1;
+
+constexpr const char* NAVTRACE_EXTENSION = ".navtrace";
+
+enum class NavTraceEvent : uint8_t
+{
+	// the player moved along the path
+	Pulse,
+
+	// the path was searched for again
+	Replan,
+
+	// no progress was made towards the next waypoint
+	Stuck,
+};
+
+enum NavTraceFlags : uint8_t
+{
+	NAVTRACE_FOUND       = 0x1,
+	NAVTRACE_PARTIAL     = 0x2,
+
+	// the search was handed to the worker, the time is only for starting it
+	NAVTRACE_INCREMENTAL = 0x4,
+};
+
+#pragma pack(push, 1)
+
+struct NavTraceHeader
+{
+	uint32_t magic = NAVTRACE_MAGIC;
+	uint32_t version = NAVTRACE_VERSION;
+	char zoneShortName[32] = {};
+
+	// milliseconds since the epoch when the trace was started
+	uint64_t startTime = 0;
+};
+
+struct NavTraceRecord
+{
+	// milliseconds since the trace was started
+	uint32_t time = 0;
+	NavTraceEvent event = NavTraceEvent::Pulse;
+	uint8_t flags = 0;
+	uint16_t includeFlags = 0;
+	uint16_t excludeFlags = 0;
+
+	// replans: the corners of the path. stuck: how many stalls in a row, and the
+	// recovery that was tried.
+	uint16_t pathSize = 0;
+	uint16_t recovery = 0;
+	uint16_t reserved = 0;
+
+	float pos[3] = { 0, 0, 0 };
+	float dest[3] = { 0, 0, 0 };
+
+	// how long the replan took
+	float queryMs = 0;
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(NavTraceHeader) == 48, "NavTraceHeader size");
+static_assert(sizeof(NavTraceRecord) == 44, "NavTraceRecord size");
+
+// Writes records to a trace file from a background thread. Add is called from
+// the game thread only, and doesn't wait: records go into a ring that the writer
+// drains, and are dropped if it falls behind.
+class NavTraceWriter
+{
+public:
+	NavTraceWriter();
+	~NavTraceWriter();
+
+	NavTraceWriter(const NavTraceWriter&) = delete;
+	NavTraceWriter& operator=(const NavTraceWriter&) = delete;
+
+	bool Start(const std::string& filename, const std::string& zoneShortName);
+
+	// writes out what is left in the ring and closes the file
+	void Stop();
+
+	bool IsActive() const { return m_active; }
+	const std::string& GetFilename() const { return m_filename; }
+
+	// the time of the record is filled in here
+	void Add(NavTraceRecord record);
+
+	uint32_t GetRecordCount() const { return m_written; }
+	uint32_t GetDroppedCount() const { return m_dropped; }
+
+private:
+	void WriterThread();
+	void Drain();
+
+	static const uint32_t RING_SIZE = 4096; // power of two
+
+	std::unique_ptr<NavTraceRecord[]> m_ring;
+
+	// m_head is only advanced by Add, m_tail only by the writer
+	std::atomic<uint32_t> m_head{ 0 };
+	std::atomic<uint32_t> m_tail{ 0 };
+
+	std::atomic<uint32_t> m_written{ 0 };
+	std::atomic<uint32_t> m_dropped{ 0 };
+
+	std::atomic<bool> m_active{ false };
+	std::atomic<bool> m_stopping{ false };
+	std::thread m_thread;
+	std::ofstream m_file;
+	std::string m_filename;
+	std::chrono::steady_clock::time_point m_startTime;
+};
+
+// reads a whole trace. Returns false if it isn't a trace this version can read.
+bool ReadNavTrace(const std::string& filename, NavTraceHeader& header,
+	std::vector<NavTraceRecord>& records);
@@ -0,0 +1,873 @@
+//
+// PolyPathSearch.cpp
+//
+
+#include "PolyPathSearch.h"
+#include "FlowField.h"
+#include "LandmarkTable.h"
+
+#include <DetourCommon.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <unordered_set>
+
+// same as detour, keeps the heuristic a little below the real cost
+static const float H_SCALE = 0.999f;
+
+// slots in the node table before it first grows
+static const uint32_t MIN_TABLE_SIZE = 256;
+
+// in the automatic mode, paths at least this far are searched from both ends
+static const float BIDIRECTIONAL_MIN_DISTANCE = 1000.0f;
+
+static inline uint32_t HashNodeKey(uint64_t key)
+{
+	key *= 0x9e3779b97f4a7c15ull;
+	return static_cast<uint32_t>(key >> 32);
+}
+
+//============================================================================
+
+// same as dtQueryFilter::passFilter and getCost, which are only defined inside
+// detour unless it is built with virtual filters.
+static inline bool PassFilter(const dtQueryFilter* filter, const dtPoly* poly)
+{
+	return (poly->flags & filter->getIncludeFlags()) != 0
+		&& (poly->flags & filter->getExcludeFlags()) == 0;
+}
+
+static inline float GetCost(const dtQueryFilter* filter, const float* pa, const float* pb, const dtPoly* poly)
+{
+	return dtVdist(pa, pb) * filter->getAreaCost(poly->getArea());
+}
+
+// the points where the path crosses from one polygon to the next, like the
+// private dtNavMeshQuery::getPortalPoints.
+static bool GetPortalPoints(const dtPoly* fromPoly, const dtMeshTile* fromTile, dtPolyRef to,
+	const dtPoly* toPoly, const dtMeshTile* toTile, dtPolyRef from, float* left, float* right)
+{
+	const dtLink* link = nullptr;
+	for (unsigned int i = fromPoly->firstLink; i != DT_NULL_LINK; i = fromTile->links[i].next)
+	{
+		if (fromTile->links[i].ref == to)
+		{
+			link = &fromTile->links[i];
+			break;
+		}
+	}
+
+	if (!link)
+		return false;
+
+	// off-mesh connections cross at their end points
+	if (fromPoly->getType() == DT_POLYTYPE_OFFMESH_CONNECTION)
+	{
+		const float* v = &fromTile->verts[fromPoly->verts[link->edge] * 3];
+		dtVcopy(left, v);
+		dtVcopy(right, v);
+		return true;
+	}
+
+	if (toPoly->getType() == DT_POLYTYPE_OFFMESH_CONNECTION)
+	{
+		for (unsigned int i = toPoly->firstLink; i != DT_NULL_LINK; i = toTile->links[i].next)
+		{
+			if (toTile->links[i].ref == from)
+			{
+				const float* v = &toTile->verts[toPoly->verts[toTile->links[i].edge] * 3];
+				dtVcopy(left, v);
+				dtVcopy(right, v);
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	const float* v0 = &fromTile->verts[fromPoly->verts[link->edge] * 3];
+	const float* v1 = &fromTile->verts[fromPoly->verts[(link->edge + 1) % (int)fromPoly->vertCount] * 3];
+	dtVcopy(left, v0);
+	dtVcopy(right, v1);
+
+	// at tile borders only part of the edge is shared
+	if (link->side != 0xff && (link->bmin != 0 || link->bmax != 255))
+	{
+		const float s = 1.0f / 255.0f;
+		dtVlerp(left, v0, v1, link->bmin * s);
+		dtVlerp(right, v0, v1, link->bmax * s);
+	}
+
+	return true;
+}
+
+//----------------------------------------------------------------------------
+
+void PolyPathSearch::Frontier::Reset()
+{
+	m_count = 0;
+	m_open.clear();
+
+	// a new stamp empties every slot. Only when it wraps do they need clearing.
+	if (++m_stamp == 0)
+	{
+		for (Slot& slot : m_table)
+			slot.stamp = 0;
+		m_stamp = 1;
+	}
+}
+
+uint32_t PolyPathSearch::Frontier::FindSlot(uint64_t key) const
+{
+	uint32_t mask = static_cast<uint32_t>(m_table.size() - 1);
+	uint32_t index = HashNodeKey(key) & mask;
+
+	while (m_table[index].stamp == m_stamp && m_table[index].key != key)
+		index = (index + 1) & mask;
+
+	return index;
+}
+
+void PolyPathSearch::Frontier::GrowTable()
+{
+	std::vector<Slot> table(std::max<size_t>(MIN_TABLE_SIZE, m_table.size() * 2), Slot{ 0, 0, 0 });
+	uint32_t mask = static_cast<uint32_t>(table.size() - 1);
+
+	for (const Slot& slot : m_table)
+	{
+		if (slot.stamp != m_stamp)
+			continue;
+
+		uint32_t index = HashNodeKey(slot.key) & mask;
+		while (table[index].stamp == m_stamp)
+			index = (index + 1) & mask;
+
+		table[index] = slot;
+	}
+
+	m_table.swap(table);
+}
+
+uint32_t PolyPathSearch::Frontier::Find(dtPolyRef ref, uint8_t crossSide) const
+{
+	if (m_table.empty())
+		return NO_NODE;
+
+	const Slot& slot = m_table[FindSlot(NodeKey(ref, crossSide))];
+	return slot.stamp == m_stamp ? slot.node : NO_NODE;
+}
+
+uint32_t PolyPathSearch::Frontier::Add(dtPolyRef ref, uint8_t crossSide)
+{
+	if ((m_count + 1) * 2 > m_table.size())
+		GrowTable();
+
+	const uint64_t key = NodeKey(ref, crossSide);
+	Slot& slot = m_table[FindSlot(key)];
+	if (slot.stamp == m_stamp)
+		return slot.node;
+
+	uint32_t node = m_count++;
+	if (node == m_nodes.size())
+		m_nodes.emplace_back();
+
+	slot = Slot{ key, m_stamp, node };
+
+	Node& entry = m_nodes[node];
+	dtVset(entry.pos, 0, 0, 0);
+	entry.cost = 0;
+	entry.total = 0;
+	entry.ref = ref;
+	entry.parent = NO_NODE;
+	entry.heapIndex = NO_NODE;
+	entry.closed = false;
+
+	return node;
+}
+
+void PolyPathSearch::Frontier::Push(uint32_t node)
+{
+	m_nodes[node].heapIndex = static_cast<uint32_t>(m_open.size());
+	m_open.push_back(node);
+	SiftUp(m_nodes[node].heapIndex);
+}
+
+uint32_t PolyPathSearch::Frontier::Pop()
+{
+	uint32_t node = m_open.front();
+	m_nodes[node].heapIndex = NO_NODE;
+
+	uint32_t last = m_open.back();
+	m_open.pop_back();
+
+	if (!m_open.empty())
+	{
+		m_open[0] = last;
+		m_nodes[last].heapIndex = 0;
+		SiftDown(0);
+	}
+
+	return node;
+}
+
+void PolyPathSearch::Frontier::SiftUp(uint32_t index)
+{
+	uint32_t node = m_open[index];
+	float total = m_nodes[node].total;
+
+	while (index > 0)
+	{
+		uint32_t parent = (index - 1) / 4;
+		if (m_nodes[m_open[parent]].total <= total)
+			break;
+
+		m_open[index] = m_open[parent];
+		m_nodes[m_open[index]].heapIndex = index;
+		index = parent;
+	}
+
+	m_open[index] = node;
+	m_nodes[node].heapIndex = index;
+}
+
+void PolyPathSearch::Frontier::SiftDown(uint32_t index)
+{
+	uint32_t node = m_open[index];
+	float total = m_nodes[node].total;
+	uint32_t count = static_cast<uint32_t>(m_open.size());
+
+	while (true)
+	{
+		uint32_t first = index * 4 + 1;
+		if (first >= count)
+			break;
+
+		// smallest of up to four children
+		uint32_t best = first;
+		uint32_t last = std::min(first + 4, count);
+		for (uint32_t child = first + 1; child < last; ++child)
+		{
+			if (m_nodes[m_open[child]].total < m_nodes[m_open[best]].total)
+				best = child;
+		}
+
+		if (m_nodes[m_open[best]].total >= total)
+			break;
+
+		m_open[index] = m_open[best];
+		m_nodes[m_open[index]].heapIndex = index;
+		index = best;
+	}
+
+	m_open[index] = node;
+	m_nodes[node].heapIndex = index;
+}
+
+//----------------------------------------------------------------------------
+
+PolyPathSearch::PolyPathSearch(int maxNodes)
+	: m_maxNodes(maxNodes)
+{
+}
+
+float PolyPathSearch::GetHeuristic(const dtMeshTile* tile, const dtPoly* poly, const float* pos,
+	const float* target, const uint16_t* targetDistances) const
+{
+	float heuristic = dtVdist(pos, target);
+
+	if (targetDistances)
+	{
+		const uint16_t* distances = m_landmarks->GetDistances(tile, (int)(poly - tile->polys));
+		if (distances)
+			heuristic = std::max(heuristic, m_landmarks->GetLowerBound(distances, targetDistances) * m_landmarkScale);
+	}
+
+	return heuristic * H_SCALE;
+}
+
+dtStatus PolyPathSearch::Init(const dtNavMesh* navMesh, const LandmarkTable* landmarks,
+	dtPolyRef startRef, dtPolyRef endRef, const float* startPos, const float* endPos,
+	const dtQueryFilter* filter, Mode mode)
+{
+	m_forward.Reset();
+	m_backward.Reset();
+	m_outOfNodes = false;
+	m_lastBestNode = NO_NODE;
+	m_startDistances = nullptr;
+	m_endDistances = nullptr;
+	m_meetingCost = FLT_MAX;
+	m_meetingForward = NO_NODE;
+	m_meetingBackward = NO_NODE;
+	m_bidirectional = false;
+
+	m_navMesh = navMesh;
+	m_landmarks = landmarks;
+	m_filter = filter;
+	m_startRef = startRef;
+	m_endRef = endRef;
+
+	if (!navMesh || !filter || !startPos || !endPos || m_maxNodes < 2
+		|| !navMesh->isValidPolyRef(startRef) || !navMesh->isValidPolyRef(endRef))
+	{
+		m_status = DT_FAILURE | DT_INVALID_PARAM;
+		return m_status;
+	}
+
+	dtVcopy(m_startPos, startPos);
+	dtVcopy(m_endPos, endPos);
+
+	if (m_landmarks && !m_landmarks->IsEmpty())
+	{
+		const dtMeshTile* tile = nullptr;
+		const dtPoly* poly = nullptr;
+
+		navMesh->getTileAndPolyByRefUnsafe(startRef, &tile, &poly);
+		m_startDistances = m_landmarks->GetDistances(tile, (int)(poly - tile->polys));
+
+		navMesh->getTileAndPolyByRefUnsafe(endRef, &tile, &poly);
+		m_endDistances = m_landmarks->GetDistances(tile, (int)(poly - tile->polys));
+
+		float minCost = 1.0f;
+		for (int i = 0; i < DT_MAX_AREAS; ++i)
+			minCost = std::min(minCost, filter->getAreaCost(i));
+		m_landmarkScale = std::max(minCost, 0.0f);
+	}
+
+	const float distance = dtVdist(startPos, endPos);
+
+	m_bidirectional = startRef != endRef && (mode == Mode::Bidirectional
+		|| (mode == Mode::Auto && distance >= BIDIRECTIONAL_MIN_DISTANCE));
+	m_endBound = distance * H_SCALE;
+
+	uint32_t startNode = m_forward.Add(startRef, 0);
+	dtVcopy(m_forward[startNode].pos, startPos);
+	m_forward[startNode].total = m_bidirectional ? m_endBound * 0.5f : m_endBound;
+	m_forward.Push(startNode);
+
+	m_lastBestNode = startNode;
+	m_lastBestNodeCost = m_endBound;
+
+	if (startRef == endRef)
+	{
+		m_status = DT_SUCCESS;
+		return m_status;
+	}
+
+	if (m_bidirectional)
+	{
+		uint32_t endNode = m_backward.Add(endRef, 0);
+		dtVcopy(m_backward[endNode].pos, endPos);
+		m_backward[endNode].total = m_endBound * 0.5f;
+		m_backward.Push(endNode);
+	}
+
+	m_status = DT_IN_PROGRESS;
+	return m_status;
+}
+
+//----------------------------------------------------------------------------
+
+bool PolyPathSearch::ExpandForward()
+{
+	uint32_t bestIndex = m_forward.Pop();
+	m_forward[bestIndex].closed = true;
+
+	const dtPolyRef bestRef = m_forward[bestIndex].ref;
+	if (bestRef == m_endRef)
+	{
+		// when searching both ways, reaching the end is just another meeting
+		if (!m_bidirectional)
+		{
+			m_lastBestNode = bestIndex;
+			m_status = DT_SUCCESS;
+		}
+
+		return true;
+	}
+
+	// the tiles may have changed between slices
+	const dtMeshTile* bestTile = nullptr;
+	const dtPoly* bestPoly = nullptr;
+	if (dtStatusFailed(m_navMesh->getTileAndPolyByRef(bestRef, &bestTile, &bestPoly)))
+		return false;
+
+	dtPolyRef parentRef = 0;
+	if (m_forward[bestIndex].parent != NO_NODE)
+		parentRef = m_forward[m_forward[bestIndex].parent].ref;
+	if (parentRef && !m_navMesh->isValidPolyRef(parentRef))
+		return false;
+
+	for (unsigned int i = bestPoly->firstLink; i != DT_NULL_LINK; i = bestTile->links[i].next)
+	{
+		dtPolyRef neighborRef = bestTile->links[i].ref;
+		if (!neighborRef || neighborRef == parentRef)
+			continue;
+
+		const dtMeshTile* neighborTile = nullptr;
+		const dtPoly* neighborPoly = nullptr;
+		m_navMesh->getTileAndPolyByRefUnsafe(neighborRef, &neighborTile, &neighborPoly);
+
+		if (!PassFilter(m_filter, neighborPoly))
+			continue;
+
+		// tile borders are crossed with a node for each side
+		uint8_t crossSide = 0;
+		if (bestTile->links[i].side != 0xff)
+			crossSide = bestTile->links[i].side >> 1;
+
+		uint32_t neighborIndex = m_forward.Find(neighborRef, crossSide);
+		if (neighborIndex == NO_NODE)
+		{
+			if (GetNodeCount() >= m_maxNodes)
+			{
+				m_outOfNodes = true;
+				continue;
+			}
+
+			neighborIndex = m_forward.Add(neighborRef, crossSide);
+
+			float left[3], right[3];
+			if (GetPortalPoints(bestPoly, bestTile, neighborRef, neighborPoly, neighborTile, bestRef, left, right))
+				dtVlerp(m_forward[neighborIndex].pos, left, right, 0.5f);
+		}
+
+		const Node& best = m_forward[bestIndex];
+		Node& neighbor = m_forward[neighborIndex];
+
+		float cost = best.cost + GetCost(m_filter, best.pos, neighbor.pos, bestPoly);
+		float heuristic = 0;
+
+		if (neighborRef == m_endRef)
+		{
+			cost += GetCost(m_filter, neighbor.pos, m_endPos, neighborPoly);
+		}
+		else
+		{
+			heuristic = GetHeuristic(neighborTile, neighborPoly, neighbor.pos, m_endPos, m_endDistances);
+		}
+
+		float total = cost + heuristic;
+
+		// both searches go by half the difference of the bounds to either end, so
+		// that they order the nodes the same way and can stop when they meet.
+		if (m_bidirectional)
+		{
+			float startBound = (neighborRef == m_endRef) ? m_endBound
+				: GetHeuristic(neighborTile, neighborPoly, neighbor.pos, m_startPos, m_startDistances);
+			total = cost + (heuristic - startBound) * 0.5f;
+		}
+
+		if ((m_forward.IsOpen(neighborIndex) || neighbor.closed) && total >= neighbor.total)
+			continue;
+
+		neighbor.parent = bestIndex;
+		neighbor.cost = cost;
+		neighbor.total = total;
+		neighbor.closed = false;
+
+		if (m_forward.IsOpen(neighborIndex))
+			m_forward.Decrease(neighborIndex);
+		else
+			m_forward.Push(neighborIndex);
+
+		if (heuristic < m_lastBestNodeCost)
+		{
+			m_lastBestNodeCost = heuristic;
+			m_lastBestNode = neighborIndex;
+		}
+
+		if (m_bidirectional)
+			CheckMeeting(true, neighborIndex);
+	}
+
+	return true;
+}
+
+bool PolyPathSearch::ExpandBackward()
+{
+	uint32_t bestIndex = m_backward.Pop();
+	m_backward[bestIndex].closed = true;
+
+	const dtPolyRef bestRef = m_backward[bestIndex].ref;
+	if (bestRef == m_startRef)
+		return true;
+
+	const dtMeshTile* bestTile = nullptr;
+	const dtPoly* bestPoly = nullptr;
+	if (dtStatusFailed(m_navMesh->getTileAndPolyByRef(bestRef, &bestTile, &bestPoly)))
+		return false;
+
+	// the next polygon toward the end
+	dtPolyRef nextRef = 0;
+	if (m_backward[bestIndex].parent != NO_NODE)
+		nextRef = m_backward[m_backward[bestIndex].parent].ref;
+	if (nextRef && !m_navMesh->isValidPolyRef(nextRef))
+		return false;
+
+	for (unsigned int i = bestPoly->firstLink; i != DT_NULL_LINK; i = bestTile->links[i].next)
+	{
+		dtPolyRef prevRef = bestTile->links[i].ref;
+		if (!prevRef || prevRef == nextRef)
+			continue;
+
+		const dtMeshTile* prevTile = nullptr;
+		const dtPoly* prevPoly = nullptr;
+		m_navMesh->getTileAndPolyByRefUnsafe(prevRef, &prevTile, &prevPoly);
+
+		if (!PassFilter(m_filter, prevPoly))
+			continue;
+
+		// only step back over links that the forward search could take
+		float left[3], right[3];
+		if (!GetPortalPoints(prevPoly, prevTile, bestRef, bestPoly, bestTile, prevRef, left, right))
+			continue;
+
+		uint8_t crossSide = 0;
+		if (bestTile->links[i].side != 0xff)
+			crossSide = bestTile->links[i].side >> 1;
+
+		uint32_t prevIndex = m_backward.Find(prevRef, crossSide);
+		if (prevIndex == NO_NODE)
+		{
+			if (GetNodeCount() >= m_maxNodes)
+			{
+				m_outOfNodes = true;
+				continue;
+			}
+
+			prevIndex = m_backward.Add(prevRef, crossSide);
+			dtVlerp(m_backward[prevIndex].pos, left, right, 0.5f);
+		}
+
+		const Node& best = m_backward[bestIndex];
+		Node& prev = m_backward[prevIndex];
+
+		float cost = best.cost + GetCost(m_filter, prev.pos, best.pos, bestPoly);
+		float startBound = 0;
+		float endBound = m_endBound;
+
+		if (prevRef == m_startRef)
+		{
+			cost += GetCost(m_filter, m_startPos, prev.pos, prevPoly);
+		}
+		else
+		{
+			startBound = GetHeuristic(prevTile, prevPoly, prev.pos, m_startPos, m_startDistances);
+			endBound = GetHeuristic(prevTile, prevPoly, prev.pos, m_endPos, m_endDistances);
+		}
+
+		const float total = cost + (startBound - endBound) * 0.5f;
+
+		if ((m_backward.IsOpen(prevIndex) || prev.closed) && total >= prev.total)
+			continue;
+
+		prev.parent = bestIndex;
+		prev.cost = cost;
+		prev.total = total;
+		prev.closed = false;
+
+		if (m_backward.IsOpen(prevIndex))
+			m_backward.Decrease(prevIndex);
+		else
+			m_backward.Push(prevIndex);
+
+		CheckMeeting(false, prevIndex);
+	}
+
+	return true;
+}
+
+void PolyPathSearch::CheckMeeting(bool fromForward, uint32_t node)
+{
+	const Frontier& other = fromForward ? m_backward : m_forward;
+	const dtPolyRef ref = fromForward ? m_forward[node].ref : m_backward[node].ref;
+
+	// the other search may have reached the polygon from any side
+	for (uint8_t crossSide = 0; crossSide < 4; ++crossSide)
+	{
+		uint32_t otherNode = other.Find(ref, crossSide);
+		if (otherNode == NO_NODE)
+			continue;
+
+		uint32_t forwardNode = fromForward ? node : otherNode;
+		uint32_t backwardNode = fromForward ? otherNode : node;
+		const Node& forward = m_forward[forwardNode];
+		const Node& backward = m_backward[backwardNode];
+
+		float cost;
+
+		if (ref == m_endRef)
+		{
+			// the forward cost runs all the way to the end position already
+			if (backward.parent != NO_NODE)
+				continue;
+			cost = forward.cost;
+		}
+		else if (ref == m_startRef)
+		{
+			if (forward.parent != NO_NODE)
+				continue;
+			cost = backward.cost;
+		}
+		else
+		{
+			// across the polygon, from where one search entered to where the other left
+			const dtMeshTile* tile = nullptr;
+			const dtPoly* poly = nullptr;
+			m_navMesh->getTileAndPolyByRefUnsafe(ref, &tile, &poly);
+
+			cost = forward.cost + backward.cost + GetCost(m_filter, forward.pos, backward.pos, poly);
+		}
+
+		if (cost < m_meetingCost)
+		{
+			m_meetingCost = cost;
+			m_meetingForward = forwardNode;
+			m_meetingBackward = backwardNode;
+		}
+	}
+}
+
+bool PolyPathSearch::IsMeetingFinal() const
+{
+	if (m_meetingForward == NO_NODE)
+		return false;
+
+	if (m_forward.IsOpenEmpty())
+		return true;
+
+	// no path through the open nodes can be any cheaper
+	if (m_backward.IsOpenEmpty())
+		return m_forward.GetTopTotal() + m_endBound * 0.5f >= m_meetingCost;
+
+	return m_forward.GetTopTotal() + m_backward.GetTopTotal() >= m_meetingCost;
+}
+
+dtStatus PolyPathSearch::Update(int maxIter, int* doneIters)
+{
+	if (!dtStatusInProgress(m_status))
+		return m_status;
+
+	int iter = 0;
+
+	while (iter < maxIter)
+	{
+		if (m_bidirectional && IsMeetingFinal())
+		{
+			m_status = DT_SUCCESS;
+			break;
+		}
+
+		// nothing left to search, the result is partial
+		if (m_forward.IsOpenEmpty())
+		{
+			m_status = DT_SUCCESS;
+			break;
+		}
+
+		// the backward search may run out first, the forward one carries on alone
+		bool backward = m_bidirectional && !m_backward.IsOpenEmpty()
+			&& m_backward.GetTopTotal() < m_forward.GetTopTotal();
+
+		++iter;
+
+		if (!(backward ? ExpandBackward() : ExpandForward()))
+		{
+			m_status = DT_FAILURE;
+			break;
+		}
+
+		if (!dtStatusInProgress(m_status))
+			break;
+	}
+
+	if (doneIters)
+		*doneIters = iter;
+
+	return m_status;
+}
+
+dtStatus PolyPathSearch::Finalize(dtPolyRef* path, int* pathCount, int maxPath)
+{
+	*pathCount = 0;
+
+	if (dtStatusFailed(m_status) || m_lastBestNode == NO_NODE || !path || maxPath <= 0)
+	{
+		m_status = DT_FAILURE;
+		return DT_FAILURE;
+	}
+
+	dtStatus status = DT_SUCCESS;
+
+	if (m_startRef == m_endRef)
+	{
+		path[0] = m_startRef;
+		*pathCount = 1;
+	}
+	else
+	{
+		bool met = m_meetingForward != NO_NODE;
+		uint32_t forwardEnd = met ? m_meetingForward : m_lastBestNode;
+		uint32_t backwardStart = met ? m_backward[m_meetingBackward].parent : NO_NODE;
+
+		int forwardLength = 0;
+		for (uint32_t node = forwardEnd; node != NO_NODE; node = m_forward[node].parent)
+			++forwardLength;
+
+		int backwardLength = 0;
+		for (uint32_t node = backwardStart; node != NO_NODE; node = m_backward[node].parent)
+			++backwardLength;
+
+		// like detour, a path that doesn't fit is cut short at the end
+		uint32_t node = forwardEnd;
+		for (int i = forwardLength; i > maxPath; --i)
+			node = m_forward[node].parent;
+
+		int count = std::min(forwardLength, maxPath);
+		for (int i = count - 1; i >= 0; --i)
+		{
+			path[i] = m_forward[node].ref;
+			node = m_forward[node].parent;
+		}
+
+		for (node = backwardStart; node != NO_NODE && count < maxPath; node = m_backward[node].parent)
+			path[count++] = m_backward[node].ref;
+
+		*pathCount = count;
+
+		if (forwardLength + backwardLength > maxPath)
+			status |= DT_BUFFER_TOO_SMALL;
+		if (!met && m_forward[m_lastBestNode].ref != m_endRef)
+			status |= DT_PARTIAL_RESULT;
+		if (m_outOfNodes)
+			status |= DT_OUT_OF_NODES;
+	}
+
+	// the nodes are kept for the next search
+	m_status = DT_FAILURE;
+
+	return status;
+}
+
+void PolyPathSearch::GetClosedPolys(std::vector<dtPolyRef>& polys) const
+{
+	polys.clear();
+
+	for (const Frontier* frontier : { &m_forward, &m_backward })
+	{
+		for (uint32_t i = 0; i < frontier->GetCount(); ++i)
+		{
+			if ((*frontier)[i].closed)
+				polys.push_back((*frontier)[i].ref);
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+
+dtStatus PolyPathSearch::BuildFlowField(const dtNavMesh* navMesh, dtPolyRef endRef, const float* endPos,
+	const dtQueryFilter* filter, float maxCost, FlowField& field)
+{
+	field.Clear();
+
+	m_forward.Reset();
+	m_backward.Reset();
+	m_outOfNodes = false;
+	m_lastBestNode = NO_NODE;
+	m_bidirectional = false;
+	m_status = DT_FAILURE;
+
+	if (!navMesh || !filter || !endPos || !navMesh->isValidPolyRef(endRef))
+		return DT_FAILURE | DT_INVALID_PARAM;
+
+	m_navMesh = navMesh;
+	m_landmarks = nullptr;
+	m_filter = filter;
+
+	uint32_t endNode = m_backward.Add(endRef, 0);
+	dtVcopy(m_backward[endNode].pos, endPos);
+	m_backward.Push(endNode);
+
+	std::vector<FlowField::Cell> cells;
+	std::unordered_set<dtPolyRef> reached;
+
+	while (!m_backward.IsOpenEmpty())
+	{
+		uint32_t bestIndex = m_backward.Pop();
+		m_backward[bestIndex].closed = true;
+
+		const dtPolyRef bestRef = m_backward[bestIndex].ref;
+
+		// a polygon has a node for each side it is entered from, the first one out
+		// of the open list is the cheapest
+		if (!reached.insert(bestRef).second)
+			continue;
+
+		const uint32_t parent = m_backward[bestIndex].parent;
+		cells.push_back(FlowField::Cell{ bestRef, parent != NO_NODE ? m_backward[parent].ref : 0,
+			m_backward[bestIndex].cost });
+
+		const dtMeshTile* bestTile = nullptr;
+		const dtPoly* bestPoly = nullptr;
+		m_navMesh->getTileAndPolyByRefUnsafe(bestRef, &bestTile, &bestPoly);
+
+		for (unsigned int i = bestPoly->firstLink; i != DT_NULL_LINK; i = bestTile->links[i].next)
+		{
+			dtPolyRef prevRef = bestTile->links[i].ref;
+			if (!prevRef || reached.count(prevRef))
+				continue;
+
+			const dtMeshTile* prevTile = nullptr;
+			const dtPoly* prevPoly = nullptr;
+			m_navMesh->getTileAndPolyByRefUnsafe(prevRef, &prevTile, &prevPoly);
+
+			if (!PassFilter(m_filter, prevPoly))
+				continue;
+
+			// only step back over links that can be walked toward the end
+			float left[3], right[3];
+			if (!GetPortalPoints(prevPoly, prevTile, bestRef, bestPoly, bestTile, prevRef, left, right))
+				continue;
+
+			uint8_t crossSide = 0;
+			if (bestTile->links[i].side != 0xff)
+				crossSide = bestTile->links[i].side >> 1;
+
+			uint32_t prevIndex = m_backward.Find(prevRef, crossSide);
+			if (prevIndex == NO_NODE)
+			{
+				if (GetNodeCount() >= m_maxNodes)
+				{
+					m_outOfNodes = true;
+					continue;
+				}
+
+				prevIndex = m_backward.Add(prevRef, crossSide);
+				dtVlerp(m_backward[prevIndex].pos, left, right, 0.5f);
+			}
+
+			const Node& best = m_backward[bestIndex];
+			Node& prev = m_backward[prevIndex];
+
+			const float cost = best.cost + GetCost(m_filter, prev.pos, best.pos, bestPoly);
+			if (cost > maxCost)
+				continue;
+			if ((m_backward.IsOpen(prevIndex) || prev.closed) && cost >= prev.total)
+				continue;
+
+			prev.parent = bestIndex;
+			prev.cost = cost;
+			prev.total = cost;
+			prev.closed = false;
+
+			if (m_backward.IsOpen(prevIndex))
+				m_backward.Decrease(prevIndex);
+			else
+				m_backward.Push(prevIndex);
+		}
+	}
+
+	field.SetCells(endRef, endPos, std::move(cells));
+
+	return m_outOfNodes ? (DT_SUCCESS | DT_OUT_OF_NODES) : DT_SUCCESS;
+}
@@ -0,0 +1,184 @@
+//
+// PolyPathSearch.h
+//
+
+#pragma once
+
+#include <DetourNavMesh.h>
+#include <DetourNavMeshQuery.h>
+
+#include <cstdint>
+#include <vector>
+
+class FlowField;
+class LandmarkTable;
+
+// A* over the polygons of a navmesh, the same search as dtNavMeshQuery::findPath
+// but guided by the landmark table when there is one. Nodes are placed on the
+// edge midpoints and costed by the filter, just like detour does, so the paths
+// match the ones found by the navmesh query.
+//
+// Long paths can also be searched from both ends at once, meeting in the middle.
+// The backward search only follows links that the forward one could take, so
+// the paths stay walkable, but it can't see one-way off-mesh connections from
+// the far side. The forward search still does, so no path is missed.
+//
+// Can be run in slices like the sliced find path of the query: Init, Update until
+// it is no longer in progress, then Finalize.
+//
+// The backward expansion also builds flow fields: a search out from one end
+// with no start, keeping the next polygon toward the end for every polygon it
+// reaches.
+//
+// Nodes are looked up in an open addressing table and kept in a 4-ary heap,
+// instead of detour's chained node pool and binary heap. Both grow as needed, up
+// to maxNodes, and are kept between searches: table slots are stamped with the
+// search that filled them, so starting a search doesn't have to clear them.
+class PolyPathSearch
+{
+public:
+	enum class Mode
+	{
+		// bidirectional for paths that go far, forward otherwise
+		Auto,
+		Forward,
+		Bidirectional,
+	};
+
+	explicit PolyPathSearch(int maxNodes);
+
+	// the most nodes a search may open, from the next Init on
+	void SetMaxNodes(int maxNodes) { m_maxNodes = maxNodes; }
+	int GetMaxNodes() const { return m_maxNodes; }
+
+	dtStatus Init(const dtNavMesh* navMesh, const LandmarkTable* landmarks,
+		dtPolyRef startRef, dtPolyRef endRef, const float* startPos, const float* endPos,
+		const dtQueryFilter* filter, Mode mode = Mode::Auto);
+
+	dtStatus Update(int maxIter, int* doneIters = nullptr);
+
+	dtStatus Finalize(dtPolyRef* path, int* pathCount, int maxPath);
+
+	// search out from the end until the paths cost more than maxCost or the nodes
+	// run out. Stops any sliced search in progress.
+	dtStatus BuildFlowField(const dtNavMesh* navMesh, dtPolyRef endRef, const float* endPos,
+		const dtQueryFilter* filter, float maxCost, FlowField& field);
+
+	// nodes used by the last search
+	int GetNodeCount() const { return static_cast<int>(m_forward.GetCount() + m_backward.GetCount()); }
+
+	// the polys of the nodes that the last search expanded, from both ends
+	void GetClosedPolys(std::vector<dtPolyRef>& polys) const;
+
+	bool IsBidirectional() const { return m_bidirectional; }
+
+private:
+	static const uint32_t NO_NODE = UINT32_MAX;
+
+	struct Node
+	{
+		float pos[3];
+		float cost;
+		float total;
+		dtPolyRef ref;
+		uint32_t parent;               // toward the end that the search started from
+		uint32_t heapIndex;            // NO_NODE when not in the open list
+		bool closed;
+	};
+
+	// the nodes reached from one end of the path
+	class Frontier
+	{
+	public:
+		void Reset();
+
+		uint32_t Find(dtPolyRef ref, uint8_t crossSide) const;
+		uint32_t Add(dtPolyRef ref, uint8_t crossSide);
+
+		Node& operator[](uint32_t node) { return m_nodes[node]; }
+		const Node& operator[](uint32_t node) const { return m_nodes[node]; }
+		uint32_t GetCount() const { return m_count; }
+
+		bool IsOpen(uint32_t node) const { return m_nodes[node].heapIndex != NO_NODE; }
+		bool IsOpenEmpty() const { return m_open.empty(); }
+		float GetTopTotal() const { return m_nodes[m_open.front()].total; }
+
+		void Push(uint32_t node);
+		uint32_t Pop();
+
+		// after lowering the total of an open node
+		void Decrease(uint32_t node) { SiftUp(m_nodes[node].heapIndex); }
+
+	private:
+		struct Slot
+		{
+			uint64_t key;
+			uint32_t stamp;            // slots of earlier searches are empty
+			uint32_t node;
+		};
+
+		static uint64_t NodeKey(dtPolyRef ref, uint8_t crossSide) { return ((uint64_t)ref << 8) | crossSide; }
+		uint32_t FindSlot(uint64_t key) const;
+		void GrowTable();
+
+		void SiftUp(uint32_t index);
+		void SiftDown(uint32_t index);
+
+		std::vector<Node> m_nodes;
+		uint32_t m_count = 0;
+
+		// power of two size, kept at most half full
+		std::vector<Slot> m_table;
+		uint32_t m_stamp = 0;
+
+		// node indices, ordered by total
+		std::vector<uint32_t> m_open;
+	};
+
+	bool ExpandForward();
+	bool ExpandBackward();
+
+	// a path through the polygon of this node joining the two searches, if it is
+	// the cheapest so far
+	void CheckMeeting(bool fromForward, uint32_t node);
+	bool IsMeetingFinal() const;
+
+	float GetHeuristic(const dtMeshTile* tile, const dtPoly* poly, const float* pos,
+		const float* target, const uint16_t* targetDistances) const;
+
+	int m_maxNodes;
+
+	const dtNavMesh* m_navMesh = nullptr;
+	const LandmarkTable* m_landmarks = nullptr;
+	const dtQueryFilter* m_filter = nullptr;
+
+	dtPolyRef m_startRef = 0;
+	dtPolyRef m_endRef = 0;
+	float m_startPos[3];
+	float m_endPos[3];
+
+	// landmark distances of the end polygons, null if they aren't in the table
+	const uint16_t* m_startDistances = nullptr;
+	const uint16_t* m_endDistances = nullptr;
+
+	// landmark bounds are scaled by the lowest area cost, so they stay below the
+	// cost of the path
+	float m_landmarkScale = 1.0f;
+
+	dtStatus m_status = DT_FAILURE;
+	uint32_t m_lastBestNode = NO_NODE;
+	float m_lastBestNodeCost = 0.0f;
+	bool m_outOfNodes = false;
+
+	Frontier m_forward;
+	Frontier m_backward;
+	bool m_bidirectional = false;
+
+	// lower bound on the cost between the start and end positions
+	float m_endBound = 0.0f;
+
+	// cheapest path found so far between the searches
+	float m_meetingCost = 0.0f;
+	uint32_t m_meetingForward = NO_NODE;
+	uint32_t m_meetingBackward = NO_NODE;
+};
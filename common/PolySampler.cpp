@@ -0,0 +1,204 @@
+//
+// PolySampler.cpp
+//
+
+#include "PolySampler.h"
+#include "NavMeshData.h"
+
+#include <DetourCommon.h>
+
+#include <algorithm>
+#include <cmath>
+
+// tiles in the circle, and layers of each tile
+static const int MAX_SAMPLE_TILES = 256;
+static const int MAX_TILE_LAYERS = 32;
+
+void PolySampler::Clear()
+{
+	m_tiles.clear();
+}
+
+PolySampler::TileTable PolySampler::BuildTile(const dtMeshTile& tile)
+{
+	TileTable table;
+	std::vector<float> areas;
+
+	for (int i = 0; i < tile.header->polyCount; ++i)
+	{
+		const dtPoly& poly = tile.polys[i];
+		if (poly.getType() != DT_POLYTYPE_GROUND || (poly.flags & +PolyFlags::Disabled))
+			continue;
+
+		// fan of triangles on the xz plane
+		float polyArea = 0.0f;
+		const float* va = &tile.verts[poly.verts[0] * 3];
+		for (int j = 2; j < poly.vertCount; ++j)
+		{
+			const float* vb = &tile.verts[poly.verts[j - 1] * 3];
+			const float* vc = &tile.verts[poly.verts[j] * 3];
+			polyArea += fabsf(dtTriArea2D(va, vb, vc)) * 0.5f;
+		}
+		if (polyArea <= 0.0f)
+			continue;
+
+		auto iter = std::find_if(table.areas.begin(), table.areas.end(),
+			[&poly](const AreaTable& area) { return area.area == poly.getArea(); });
+		if (iter == table.areas.end())
+		{
+			table.areas.emplace_back();
+			iter = table.areas.end() - 1;
+			iter->area = poly.getArea();
+		}
+
+		iter->polys.push_back(static_cast<uint16_t>(i));
+		iter->prob.push_back(polyArea);
+		iter->totalArea += polyArea;
+	}
+
+	// Vose's alias method: every slot holds its own polygon with prob, and
+	// another one with the rest.
+	for (AreaTable& area : table.areas)
+	{
+		const size_t count = area.polys.size();
+		area.alias.assign(count, 0);
+
+		std::vector<uint16_t> small, large;
+		for (size_t i = 0; i < count; ++i)
+		{
+			area.prob[i] = area.prob[i] * count / area.totalArea;
+			(area.prob[i] < 1.0f ? small : large).push_back(static_cast<uint16_t>(i));
+		}
+
+		while (!small.empty() && !large.empty())
+		{
+			uint16_t less = small.back(); small.pop_back();
+			uint16_t more = large.back(); large.pop_back();
+
+			area.alias[less] = more;
+			area.prob[more] += area.prob[less] - 1.0f;
+			(area.prob[more] < 1.0f ? small : large).push_back(more);
+		}
+
+		// whatever is left over is 1 give or take rounding
+		for (uint16_t i : small)
+			area.prob[i] = 1.0f;
+		for (uint16_t i : large)
+			area.prob[i] = 1.0f;
+	}
+
+	return table;
+}
+
+void PolySampler::Update(const dtNavMesh& navMesh)
+{
+	for (auto iter = m_tiles.begin(); iter != m_tiles.end(); )
+	{
+		if (navMesh.getTileByRef(iter->first) == nullptr)
+			iter = m_tiles.erase(iter);
+		else
+			++iter;
+	}
+
+	for (int i = 0; i < navMesh.getMaxTiles(); ++i)
+	{
+		const dtMeshTile* tile = navMesh.getTile(i);
+		if (!tile || !tile->header)
+			continue;
+
+		dtTileRef tileRef = navMesh.getTileRef(tile);
+		if (m_tiles.find(tileRef) == m_tiles.end())
+			m_tiles.emplace(tileRef, BuildTile(*tile));
+	}
+}
+
+bool PolySampler::Sample(const dtNavMesh& navMesh, const float* center, float radius, uint64_t areaMask,
+	const std::function<bool(dtPolyRef)>& accept, dtPolyRef& ref, float* point, int maxAttempts)
+{
+	struct Candidate
+	{
+		const dtMeshTile* tile;
+		const AreaTable* area;
+	};
+	std::vector<Candidate> candidates;
+	float totalArea = 0.0f;
+
+	// the areas of the tiles under the circle
+	float bmin[3] = { center[0] - radius, center[1], center[2] - radius };
+	float bmax[3] = { center[0] + radius, center[1], center[2] + radius };
+	int minx, miny, maxx, maxy;
+	navMesh.calcTileLoc(bmin, &minx, &miny);
+	navMesh.calcTileLoc(bmax, &maxx, &maxy);
+
+	for (int y = miny; y <= maxy; ++y)
+	{
+		for (int x = minx; x <= maxx; ++x)
+		{
+			const dtMeshTile* tiles[MAX_TILE_LAYERS];
+			int tileCount = navMesh.getTilesAt(x, y, tiles, MAX_TILE_LAYERS);
+
+			for (int i = 0; i < tileCount && candidates.size() < MAX_SAMPLE_TILES; ++i)
+			{
+				auto iter = m_tiles.find(navMesh.getTileRef(tiles[i]));
+				if (iter == m_tiles.end())
+					continue;
+
+				for (const AreaTable& area : iter->second.areas)
+				{
+					if (areaMask & ((uint64_t)1 << area.area))
+					{
+						candidates.push_back(Candidate{ tiles[i], &area });
+						totalArea += area.totalArea;
+					}
+				}
+			}
+		}
+	}
+
+	if (candidates.empty())
+		return false;
+
+	float verts[DT_VERTS_PER_POLYGON * 3];
+	float triAreas[DT_VERTS_PER_POLYGON];
+
+	for (int attempt = 0; attempt < maxAttempts; ++attempt)
+	{
+		// tile and area by their share of the area, there are only a few of them
+		float pick = Random() * totalArea;
+		const Candidate* candidate = &candidates.back();
+		for (const Candidate& c : candidates)
+		{
+			if (pick < c.area->totalArea)
+			{
+				candidate = &c;
+				break;
+			}
+			pick -= c.area->totalArea;
+		}
+
+		const AreaTable& area = *candidate->area;
+		size_t slot = std::min(static_cast<size_t>(Random() * area.polys.size()), area.polys.size() - 1);
+		uint16_t polyIndex = area.polys[Random() < area.prob[slot] ? slot : area.alias[slot]];
+
+		const dtMeshTile* tile = candidate->tile;
+		const dtPoly& poly = tile->polys[polyIndex];
+		for (int j = 0; j < poly.vertCount; ++j)
+			dtVcopy(&verts[j * 3], &tile->verts[poly.verts[j] * 3]);
+
+		float pt[3];
+		dtRandomPointInConvexPoly(verts, poly.vertCount, triAreas, Random(), Random(), pt);
+
+		if (dtVdist2DSqr(center, pt) > radius * radius)
+			continue;
+
+		dtPolyRef polyRef = navMesh.getPolyRefBase(tile) | (dtPolyRef)polyIndex;
+		if (accept && !accept(polyRef))
+			continue;
+
+		ref = polyRef;
+		dtVcopy(point, pt);
+		return true;
+	}
+
+	return false;
+}
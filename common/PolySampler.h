@@ -0,0 +1,63 @@
+//
+// PolySampler.h
+//
+
+#pragma once
+
+#include <DetourNavMesh.h>
+
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+// Area weighted tables of the polygons of every tile, one per area type, for
+// picking random points on the navmesh. Picking a polygon from a table is a
+// lookup in an alias table, so a sample costs the same no matter how many
+// polygons there are, where dtNavMeshQuery::findRandomPoint walks every tile and
+// findRandomPointAroundCircle floods out from the start. Tables are kept by tile
+// ref and only built for tiles that don't have one yet.
+class PolySampler
+{
+public:
+	PolySampler() = default;
+
+	void Clear();
+
+	// build the tables of new tiles and drop the ones of tiles that are gone
+	void Update(const dtNavMesh& navMesh);
+
+	// a random point on a polygon of one of the areas in areaMask (bit n for area
+	// n), within radius of center on the xz plane. Samples that are outside of the
+	// circle or that accept turns down are drawn again, up to maxAttempts times.
+	// The point is on the plane of the polygon, not on its detail mesh.
+	bool Sample(const dtNavMesh& navMesh, const float* center, float radius, uint64_t areaMask,
+		const std::function<bool(dtPolyRef)>& accept, dtPolyRef& ref, float* point,
+		int maxAttempts = 32);
+
+private:
+	struct AreaTable
+	{
+		uint8_t area = 0;
+		float totalArea = 0.0f;
+
+		// alias table over the polygons, by poly index in the tile
+		std::vector<uint16_t> polys;
+		std::vector<float> prob;
+		std::vector<uint16_t> alias;
+	};
+
+	struct TileTable
+	{
+		std::vector<AreaTable> areas;
+	};
+
+	static TileTable BuildTile(const dtMeshTile& tile);
+	float Random() { return m_distribution(m_random); }
+
+	std::unordered_map<dtTileRef, TileTable> m_tiles;
+
+	std::minstd_rand m_random;
+	std::uniform_real_distribution<float> m_distribution{ 0.0f, 1.0f };
+};
@@ -0,0 +1,41 @@
+//
+// Profiler.cpp
+//
+
+#include "Profiler.h"
+
+#if defined(MQ2NAV_PROFILE)
+
+#include <windows.h>
+#include <winmeta.h>
+#include <TraceLoggingProvider.h>
+
+// {bc5126ac-ff37-42f5-98bd-56fb87277da2}
+TRACELOGGING_DEFINE_PROVIDER(g_profilerProvider, "MQ2Nav",
+	(0xbc5126ac, 0xff37, 0x42f5, 0x98, 0xbd, 0x56, 0xfb, 0x87, 0x27, 0x7d, 0xa2));
+
+void ProfilerRegister()
+{
+	TraceLoggingRegister(g_profilerProvider);
+}
+
+void ProfilerUnregister()
+{
+	TraceLoggingUnregister(g_profilerProvider);
+}
+
+void ProfilerBegin(const char* name)
+{
+	TraceLoggingWrite(g_profilerProvider, "Zone",
+		TraceLoggingOpcode(WINEVENT_OPCODE_START),
+		TraceLoggingString(name, "Zone"));
+}
+
+void ProfilerEnd(const char* name)
+{
+	TraceLoggingWrite(g_profilerProvider, "Zone",
+		TraceLoggingOpcode(WINEVENT_OPCODE_STOP),
+		TraceLoggingString(name, "Zone"));
+}
+
+#endif
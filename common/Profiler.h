@@ -0,0 +1,70 @@
+//
+// Profiler.h
+//
+
+// Profiler zones for looking at single pulses, frames and builds with an ETW tool
+// such as Windows Performance Analyzer. They're only compiled in when building
+// with /p:MQ2NavProfile=true, which defines MQ2NAV_PROFILE, and are nothing at all
+// otherwise.
+//
+// Zones are written as start and stop events of the "MQ2Nav" TraceLogging
+// provider, {bc5126ac-ff37-42f5-98bd-56fb87277da2}, with the name of the zone in
+// the Zone field. Nothing is written unless a trace session has the provider on:
+//
+//   tracelog -start mq2nav -f mq2nav.etl -guid #bc5126ac-ff37-42f5-98bd-56fb87277da2
+
+#pragma once
+
+#if defined(MQ2NAV_PROFILE)
+
+// the provider is registered for the lifetime of the plugin or the program
+void ProfilerRegister();
+void ProfilerUnregister();
+
+// names have to outlive the trace session, string literals are fine
+void ProfilerBegin(const char* name);
+void ProfilerEnd(const char* name);
+
+class ProfilerZone
+{
+public:
+	explicit ProfilerZone(const char* name)
+		: m_name(name)
+	{
+		ProfilerBegin(m_name);
+	}
+
+	~ProfilerZone()
+	{
+		ProfilerEnd(m_name);
+	}
+
+	ProfilerZone(const ProfilerZone&) = delete;
+	ProfilerZone& operator=(const ProfilerZone&) = delete;
+
+private:
+	const char* m_name;
+};
+
+#define MQ2NAV_PROFILE_CONCAT_(a, b) a##b
+#define MQ2NAV_PROFILE_CONCAT(a, b) MQ2NAV_PROFILE_CONCAT_(a, b)
+
+// times the enclosing scope
+#define MQ2NAV_PROFILE_ZONE(name) ProfilerZone MQ2NAV_PROFILE_CONCAT(profilerZone_, __LINE__)(name)
+
+// for zones that don't follow a scope, the two have to pair up on the same thread
+#define MQ2NAV_PROFILE_BEGIN(name) ProfilerBegin(name)
+#define MQ2NAV_PROFILE_END(name) ProfilerEnd(name)
+
+#define MQ2NAV_PROFILE_REGISTER() ProfilerRegister()
+#define MQ2NAV_PROFILE_UNREGISTER() ProfilerUnregister()
+
+#else
+
+#define MQ2NAV_PROFILE_ZONE(name) ((void)0)
+#define MQ2NAV_PROFILE_BEGIN(name) ((void)0)
+#define MQ2NAV_PROFILE_END(name) ((void)0)
+#define MQ2NAV_PROFILE_REGISTER() ((void)0)
+#define MQ2NAV_PROFILE_UNREGISTER() ((void)0)
+
+#endif
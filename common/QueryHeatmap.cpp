@@ -0,0 +1,160 @@
+//
+// QueryHeatmap.cpp
+//
+
+#include "QueryHeatmap.h"
+#include "common/PolyPathSearch.h"
+
+#include <DebugDraw.h>
+#include <DetourDebugDraw.h>
+#include <DetourNavMeshQuery.h>
+#include <DetourNode.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+void QueryHeatmap::Record(const dtNavMeshQuery& query)
+{
+	if (!m_enabled)
+		return;
+
+	const dtNodePool* nodePool = query.getNodePool();
+	if (!nodePool)
+		return;
+
+	std::vector<dtPolyRef> polys;
+	for (int i = 1; i <= nodePool->getNodeCount(); ++i)
+	{
+		const dtNode* node = nodePool->getNodeAtIdx(i);
+		if (node->flags & DT_NODE_CLOSED)
+			polys.push_back(node->id);
+	}
+
+	Record(polys);
+}
+
+void QueryHeatmap::Record(const PolyPathSearch& search)
+{
+	if (!m_enabled)
+		return;
+
+	std::vector<dtPolyRef> polys;
+	search.GetClosedPolys(polys);
+
+	Record(polys);
+}
+
+void QueryHeatmap::Record(const std::vector<dtPolyRef>& polys)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	for (dtPolyRef ref : polys)
+	{
+		uint32_t& count = m_counts[ref];
+		m_maxCount = std::max(m_maxCount, ++count);
+	}
+
+	m_queries++;
+	m_version++;
+}
+
+void QueryHeatmap::Clear()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	m_counts.clear();
+	m_maxCount = 0;
+	m_queries = 0;
+	m_version++;
+}
+
+int QueryHeatmap::GetQueryCount() const
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	return m_queries;
+}
+
+size_t QueryHeatmap::GetPolyCount() const
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	return m_counts.size();
+}
+
+void QueryHeatmap::Draw(duDebugDraw* dd, const dtNavMesh& navMesh) const
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	if (m_maxCount == 0)
+		return;
+
+	const unsigned int cold = duRGBA(0, 64, 255, 96);
+	const unsigned int hot = duRGBA(255, 0, 0, 192);
+
+	for (const auto& entry : m_counts)
+	{
+		const dtMeshTile* tile = nullptr;
+		const dtPoly* poly = nullptr;
+		if (dtStatusFailed(navMesh.getTileAndPolyByRef(entry.first, &tile, &poly))
+			|| poly->getType() == DT_POLYTYPE_OFFMESH_CONNECTION)
+		{
+			continue;
+		}
+
+		// a handful of expansions shouldn't look the same as none, so it's
+		// scaled by the root
+		float heat = sqrtf((float)entry.second / (float)m_maxCount);
+		duDebugDrawNavMeshPoly(dd, navMesh, entry.first, duLerpCol(cold, hot, (int)(heat * 255.0f)));
+	}
+}
+
+bool QueryHeatmap::Export(const std::string& filename, const dtNavMesh& navMesh) const
+{
+	std::vector<std::pair<dtPolyRef, uint32_t>> counts;
+	int queries;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		counts.assign(m_counts.begin(), m_counts.end());
+		queries = m_queries;
+	}
+
+	std::sort(counts.begin(), counts.end(),
+		[](const auto& a, const auto& b) { return a.second > b.second; });
+
+	FILE* file = fopen(filename.c_str(), "w");
+	if (!file)
+		return false;
+
+	fprintf(file, "# %d queries\n", queries);
+	fprintf(file, "tile_x,tile_y,layer,poly,loc_y,loc_x,loc_z,expansions\n");
+
+	for (const auto& entry : counts)
+	{
+		const dtMeshTile* tile = nullptr;
+		const dtPoly* poly = nullptr;
+		if (dtStatusFailed(navMesh.getTileAndPolyByRef(entry.first, &tile, &poly)))
+			continue;
+
+		float center[3] = { 0, 0, 0 };
+		for (int i = 0; i < poly->vertCount; ++i)
+		{
+			const float* v = &tile->verts[poly->verts[i] * 3];
+			center[0] += v[0];
+			center[1] += v[1];
+			center[2] += v[2];
+		}
+		for (float& c : center)
+			c /= std::max<int>(poly->vertCount, 1);
+
+		// the way /loc shows it in game
+		fprintf(file, "%d,%d,%d,%u,%.2f,%.2f,%.2f,%u\n",
+			tile->header->x, tile->header->y, tile->header->layer,
+			(unsigned int)(poly - tile->polys), center[2], center[0], center[1], entry.second);
+	}
+
+	bool success = ferror(file) == 0;
+	fclose(file);
+
+	return success;
+}
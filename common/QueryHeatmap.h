@@ -0,0 +1,63 @@
+//
+// QueryHeatmap.h
+//
+
+#pragma once
+
+#include <DetourNavMesh.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class dtNavMeshQuery;
+class PolyPathSearch;
+struct duDebugDraw;
+
+// Counts how often path searches expand each poly of a navmesh, to find the
+// places where they spend their time. After a search, the nodes that its node
+// pool closed are added up. Searches can record from any thread.
+class QueryHeatmap
+{
+public:
+	QueryHeatmap() = default;
+	QueryHeatmap(const QueryHeatmap&) = delete;
+	QueryHeatmap& operator=(const QueryHeatmap&) = delete;
+
+	// nothing is recorded until it's enabled
+	void SetEnabled(bool enabled) { m_enabled = enabled; }
+	bool IsEnabled() const { return m_enabled; }
+
+	// adds up the nodes closed by the last search of query or search
+	void Record(const dtNavMeshQuery& query);
+	void Record(const PolyPathSearch& search);
+	void Clear();
+
+	int GetQueryCount() const;
+	size_t GetPolyCount() const;
+
+	// changes whenever something is recorded or cleared
+	uint32_t GetVersion() const { return m_version; }
+
+	// fills the polys that were expanded, from blue to red by how often. Refs
+	// that are no longer in navMesh are skipped.
+	void Draw(duDebugDraw* dd, const dtNavMesh& navMesh) const;
+
+	// a csv with a line for each poly: its tile, poly index, center and count,
+	// the most expanded first
+	bool Export(const std::string& filename, const dtNavMesh& navMesh) const;
+
+private:
+	void Record(const std::vector<dtPolyRef>& polys);
+
+	std::atomic<bool> m_enabled{ false };
+	std::atomic<uint32_t> m_version{ 0 };
+
+	mutable std::mutex m_mutex;
+	std::unordered_map<dtPolyRef, uint32_t> m_counts;
+	uint32_t m_maxCount = 0;
+	int m_queries = 0;
+};
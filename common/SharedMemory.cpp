@@ -0,0 +1,130 @@
+//
+// SharedMemory.cpp
+//
+
+#include "SharedMemory.h"
+
+#include <Windows.h>
+
+// the state gets a page to itself, so writes to the data never make a private
+// copy of it.
+static const size_t SHARED_MEMORY_HEADER_SIZE = 4096;
+
+enum SharedMemoryState : LONG
+{
+	SharedMemoryState_Filling = 0,
+	SharedMemoryState_Ready = 1,
+	SharedMemoryState_Failed = 2,
+};
+
+//============================================================================
+
+SharedMemory::SharedMemory()
+{
+}
+
+SharedMemory::~SharedMemory()
+{
+	Close();
+}
+
+bool SharedMemory::Open(const std::string& name, size_t size)
+{
+	Close();
+
+	// backed by the page file, the memory lives until the last process closes it.
+	uint64_t total = (uint64_t)size + SHARED_MEMORY_HEADER_SIZE;
+	HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+		(DWORD)(total >> 32), (DWORD)total, name.c_str());
+	if (!mapping)
+		return false;
+
+	m_creator = GetLastError() != ERROR_ALREADY_EXISTS;
+	m_mapping = mapping;
+	m_size = size;
+
+	// an existing mapping smaller than what we asked for fails to map here
+	if (!MapView(!m_creator))
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void SharedMemory::Close()
+{
+	if (m_view)
+	{
+		// nobody else is going to fill it in
+		if (m_creator)
+			InterlockedExchange((volatile LONG*)m_view, SharedMemoryState_Failed);
+
+		UnmapViewOfFile(m_view);
+		m_view = nullptr;
+	}
+
+	if (m_mapping)
+	{
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+	}
+
+	m_size = 0;
+	m_creator = false;
+}
+
+bool SharedMemory::MapView(bool copyOnWrite)
+{
+	void* view = MapViewOfFile(m_mapping, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_WRITE,
+		0, 0, m_size + SHARED_MEMORY_HEADER_SIZE);
+	if (!view)
+		return false;
+
+	m_view = static_cast<uint8_t*>(view);
+	return true;
+}
+
+bool SharedMemory::Publish(bool success)
+{
+	if (!m_creator || !m_view)
+		return false;
+
+	if (!success)
+	{
+		Close();
+		return false;
+	}
+
+	// written through the writable view, which is then swapped for a
+	// copy-on-write one like everyone else has.
+	InterlockedExchange((volatile LONG*)m_view, SharedMemoryState_Ready);
+	UnmapViewOfFile(m_view);
+	m_view = nullptr;
+	m_creator = false;
+
+	if (!MapView(true))
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+bool SharedMemory::IsReady() const
+{
+	if (!m_view || m_creator)
+		return false;
+
+	// a plain read, anything that writes would give us a private copy of the page
+	return *(volatile const LONG*)m_view == SharedMemoryState_Ready;
+}
+
+uint8_t* SharedMemory::GetData() const
+{
+	return m_view ? m_view + SHARED_MEMORY_HEADER_SIZE : nullptr;
+}
+
+//============================================================================
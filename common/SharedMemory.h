@@ -0,0 +1,51 @@
+//
+// SharedMemory.h
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Memory shared by name between processes on the same machine. The first process
+// to open a name creates it and fills it in, everyone else maps what it wrote.
+// Once published, the view is copy-on-write like MappedFile: callers may modify
+// it in place, and only the pages they write to become private.
+class SharedMemory
+{
+public:
+	SharedMemory();
+	~SharedMemory();
+
+	SharedMemory(const SharedMemory&) = delete;
+	SharedMemory& operator=(const SharedMemory&) = delete;
+
+	// open the named memory, creating it if nobody has yet. Returns false if it
+	// could not be created or mapped.
+	bool Open(const std::string& name, size_t size);
+	void Close();
+
+	bool IsOpen() const { return m_view != nullptr; }
+
+	// true if this process created the memory. It has to be filled in and then
+	// published before anyone else will use it.
+	bool IsCreator() const { return m_creator; }
+
+	// called by the creator once the memory is filled in. Pass false if that
+	// failed, so that other processes don't use it either.
+	bool Publish(bool success = true);
+
+	// true once the creator has published the contents
+	bool IsReady() const;
+
+	uint8_t* GetData() const;
+	size_t GetSize() const { return m_size; }
+
+private:
+	bool MapView(bool copyOnWrite);
+
+	void* m_mapping = nullptr;
+	uint8_t* m_view = nullptr;
+	size_t m_size = 0;
+	bool m_creator = false;
+};
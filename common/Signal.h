@@ -2,12 +2,25 @@
 // Signal.h
 //
 // Implements a c++11 style signal
+//
+// The connected slots are kept in a flat list that is replaced, not changed,
+// when connecting or disconnecting. Emitting takes a reference to the current
+// list and calls through it in place, so it doesn't allocate and only waits on
+// other threads for the moment it takes to swap the list. Slots disconnected
+// while a signal is being emitted are not called after that, even by the emit
+// that is already running.
+//
+// Signals can be emitted from any thread. Callbacks run on the thread that
+// emits, so it's up to them to be safe there.
 
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <functional>
-#include <list>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 
 template <typename... T>
@@ -17,40 +30,119 @@ template <typename... T>
 class ScopedSignalConnection;
 
 template <typename... T>
-class SignalConnectionItem
+class SignalSlots
 {
 public:
 	typedef std::function<void(T...)> Callback;
 
-	SignalConnectionItem(const Callback& cb, bool connected = true)
-		: m_callback(cb)
-		, m_connected(connected)
+	struct Slot
 	{
+		Slot(uint64_t id_, const Callback& cb)
+			: id(id_)
+			, callback(cb)
+			, connected(true)
+		{
+		}
+
+		uint64_t id;
+		Callback callback;
+		std::atomic<bool> connected;
+	};
+
+	typedef std::vector<std::shared_ptr<Slot>> SlotList;
+
+	std::shared_ptr<const SlotList> GetSlots() const
+	{
+		return std::atomic_load(&m_slots);
 	}
 
-	~SignalConnectionItem()
+	uint64_t Add(const Callback& callback)
 	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		uint64_t id = ++m_nextId;
+
+		auto slots = std::make_shared<SlotList>();
+		if (auto current = std::atomic_load(&m_slots))
+		{
+			slots->reserve(current->size() + 1);
+			*slots = *current;
+		}
+		slots->push_back(std::make_shared<Slot>(id, callback));
+
+		std::atomic_store(&m_slots, std::shared_ptr<const SlotList>(std::move(slots)));
+		return id;
 	}
 
-	void operator()(T... args)
+	bool Remove(uint64_t id)
 	{
-		if (m_connected && m_callback)
-			m_callback(args...);
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		auto current = std::atomic_load(&m_slots);
+		if (!current)
+			return false;
+
+		auto slots = std::make_shared<SlotList>();
+		slots->reserve(current->size());
+
+		bool found = false;
+		for (auto& slot : *current)
+		{
+			if (slot->id == id)
+			{
+				slot->connected = false;
+				found = true;
+			}
+			else
+			{
+				slots->push_back(slot);
+			}
+		}
+
+		if (found)
+		{
+			std::atomic_store(&m_slots, slots->empty()
+				? std::shared_ptr<const SlotList>() : std::shared_ptr<const SlotList>(std::move(slots)));
+		}
+
+		return found;
 	}
 
-	bool IsConnected() const
+	bool RemoveAll()
 	{
-		return m_connected;
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		auto current = std::atomic_load(&m_slots);
+		if (!current)
+			return false;
+
+		for (auto& slot : *current)
+			slot->connected = false;
+
+		std::atomic_store(&m_slots, std::shared_ptr<const SlotList>());
+		return true;
 	}
 
-	void Disconnect()
+	bool Contains(uint64_t id) const
 	{
-		m_connected = false;
+		if (auto current = std::atomic_load(&m_slots))
+		{
+			for (auto& slot : *current)
+			{
+				if (slot->id == id)
+					return slot->connected;
+			}
+		}
+
+		return false;
 	}
 
 private:
-	Callback m_callback;
-	bool m_connected;
+	// only held while changing the list, never while calling slots
+	std::mutex m_mutex;
+
+	std::shared_ptr<const SlotList> m_slots;
+	uint64_t m_nextId = 0;
 };
 
 template <typename... T>
@@ -62,104 +154,73 @@ public:
 	typedef ScopedSignalConnection<T...> ScopedConnection;
 
 private:
-	typedef SignalConnectionItem<T...> ConnectionItem;
-	typedef std::list<std::shared_ptr<ConnectionItem>> ConnectionList;
+	typedef SignalSlots<T...> Slots;
 
-	ConnectionList m_list;
-	uint32_t m_recurseCount = 0;
+	// connections keep a weak reference, so they can outlive the signal
+	std::shared_ptr<Slots> m_slots = std::make_shared<Slots>();
 
-	void ClearDisconnected()
-	{
-		m_list.erase(std::remove_if(m_list.begin(), m_list.end(),
-			[](std::shared_ptr<ConnectionItem>& item)
-		{
-			return !item->IsConnected();
-		}), m_list.end());
-	}
-	
 public:
 	Signal() {}
 
+	Signal(const Signal&) = delete;
+	Signal& operator=(const Signal&) = delete;
+
 	~Signal()
 	{
-		for (auto& item : m_list)
-			item->Disconnect();
+		m_slots->RemoveAll();
 	}
 
 	void operator()(T... args)
 	{
-		std::list<std::shared_ptr<ConnectionItem>> list;
-		for (auto& item : m_list)
-		{
-			if (item->IsConnected())
-				list.push_back(item);
-		}
+		auto slots = m_slots->GetSlots();
+		if (!slots)
+			return;
 
-		++m_recurseCount;
-
-		for (auto& item : list)
+		for (auto& slot : *slots)
 		{
-			(*item)(args...);
+			if (slot->connected.load(std::memory_order_acquire) && slot->callback)
+				slot->callback(args...);
 		}
-
-		if (--m_recurseCount == 0)
-			ClearDisconnected();
 	}
 
 	Connection Connect(const Callback& callback)
 	{
-		auto item = std::make_shared<ConnectionItem>(callback, true);
-		m_list.push_back(item);
+		uint64_t id = m_slots->Add(callback);
 
-		return Connection(*this, item);
+		return Connection(m_slots, id);
 	}
 
 	bool Disconnect(const Connection& connection)
 	{
-		bool found = false;
-		for (auto& item : m_list)
-		{
-			if (connection.HasItem(*item) && item->IsConnected())
-			{
-				found = true;
-				item->Disconnect();
-			}
-		}
+		if (connection.m_slots.lock() != m_slots)
+			return false;
 
-		if (found)
-		{
-			ClearDisconnected();
-		}
-
-		return found;
+		return m_slots->Remove(connection.m_id);
 	}
 
 	bool DisconnectAll()
 	{
-		for (auto& item : m_list)
-			item->Disconnect();
-
-		ClearDisconnected();
+		return m_slots->RemoveAll();
 	}
-
-	friend class Connection;
 };
 
 template <typename... T>
 class SignalConnection
 {
 private:
-	typedef SignalConnectionItem<T...> Item;
+	typedef SignalSlots<T...> Slots;
 
-	Signal<T...>* m_signal = nullptr;
-	std::shared_ptr<Item> m_item;
+	std::weak_ptr<Slots> m_slots;
+	uint64_t m_id = 0;
+
+	friend class Signal<T...>;
 
 public:
 	SignalConnection() {}
 
-	SignalConnection(Signal<T...>& signal, const std::shared_ptr<Item>& item)
-		: m_signal(&signal)
-		, m_item(item)
+	SignalConnection(const std::shared_ptr<Slots>& slots, uint64_t id)
+		: m_slots(slots)
+		, m_id(id)
 	{}
 
 	~SignalConnection()
@@ -167,24 +228,20 @@ public:
 
 	void operator=(const SignalConnection& other)
 	{
-		m_signal = other.m_signal;
-		m_item = other.m_item;
-	}
-
-	bool HasItem(const Item& item) const
-	{
-		return m_item.get() == &item;
+		m_slots = other.m_slots;
+		m_id = other.m_id;
 	}
 
 	bool IsConnected() const
 	{
-		return m_item->IsConnected();
+		auto slots = m_slots.lock();
+		return slots && slots->Contains(m_id);
 	}
 
 	bool Disconnect()
 	{
-		if (m_signal && m_item && m_item->IsConnected())
-			return m_signal->Disconnect(*this);
+		if (auto slots = m_slots.lock())
+			return slots->Remove(m_id);
 
 		return false;
 	}
@@ -196,22 +253,18 @@ class ScopedSignalConnection : public SignalConnection<T...>
 public:
 	ScopedSignalConnection() {}
 
-	ScopedSignalConnection(Signal<T...>* signal, void* callback)
-		: SignalConnection<T...>(signal, callback)
-	{}
-
 	ScopedSignalConnection(const SignalConnection<T...>& other)
 		: SignalConnection<T...>(other)
 	{}
 
 	~ScopedSignalConnection()
 	{
-		Disconnect();
+		this->Disconnect();
 	}
 
 	ScopedSignalConnection& operator=(const SignalConnection<T...>& connection)
 	{
-		Disconnect();
+		this->Disconnect();
 		SignalConnection<T...>::operator=(connection);
 		return *this;
 	}
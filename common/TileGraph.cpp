@@ -0,0 +1,338 @@
+//
+// TileGraph.cpp
+//
+
+#include "TileGraph.h"
+#include "NavMeshData.h"
+
+#include <DetourCommon.h>
+#include <DetourNavMeshQuery.h>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <functional>
+#include <map>
+#include <queue>
+
+// number of portals covered by each refinement search
+static const size_t SEGMENT_PORTALS = 4;
+
+// maximum number of polygons in a single refinement search
+static const int MAX_SEGMENT_POLYS = 1024;
+
+// search extents used to find the polygon under a portal
+static const float PORTAL_EXTENTS[3] = { 4, 8, 4 };
+
+//============================================================================
+
+void TileGraph::Clear()
+{
+	m_tiles.clear();
+	m_portals.clear();
+	m_tilesByKey.clear();
+}
+
+uint32_t TileGraph::AddTile(int x, int y, int layer)
+{
+	uint64_t key = TileKey(x, y, layer);
+
+	auto iter = m_tilesByKey.find(key);
+	if (iter != m_tilesByKey.end())
+		return iter->second;
+
+	uint32_t index = static_cast<uint32_t>(m_tiles.size());
+
+	Tile tile;
+	tile.x = x;
+	tile.y = y;
+	tile.layer = layer;
+	m_tiles.push_back(std::move(tile));
+	m_tilesByKey.emplace(key, index);
+
+	return index;
+}
+
+void TileGraph::AddPortal(uint32_t tileA, uint32_t tileB, const glm::vec3& pos)
+{
+	if (tileA >= m_tiles.size() || tileB >= m_tiles.size() || tileA == tileB)
+		return;
+
+	uint32_t index = static_cast<uint32_t>(m_portals.size());
+
+	Portal portal;
+	portal.tileA = tileA;
+	portal.tileB = tileB;
+	portal.pos = pos;
+	m_portals.push_back(portal);
+
+	m_tiles[tileA].portals.push_back(index);
+	m_tiles[tileB].portals.push_back(index);
+}
+
+int TileGraph::FindTile(int x, int y, int layer) const
+{
+	auto iter = m_tilesByKey.find(TileKey(x, y, layer));
+	if (iter == m_tilesByKey.end())
+		return -1;
+
+	return static_cast<int>(iter->second);
+}
+
+void TileGraph::Build(const dtNavMesh& navMesh)
+{
+	Clear();
+
+	// map navmesh tile indices to graph tiles, numbered in tile order so that the
+	// graph doesn't depend on the slots the tiles were added to
+	std::vector<int> graphTiles(navMesh.getMaxTiles(), -1);
+	std::vector<const dtMeshTile*> tiles = GetTilesInOrder(navMesh);
+
+	for (const dtMeshTile* tile : tiles)
+	{
+		graphTiles[navMesh.decodePolyIdTile(navMesh.getTileRef(tile))]
+			= AddTile(tile->header->x, tile->header->y, tile->header->layer);
+	}
+
+	// collect the midpoints of every edge that links two tiles together
+	std::map<std::pair<uint32_t, uint32_t>, std::vector<glm::vec3>> edges;
+
+	for (const dtMeshTile* tile : tiles)
+	{
+		const int i = (int)navMesh.decodePolyIdTile(navMesh.getTileRef(tile));
+
+		for (int j = 0; j < tile->header->polyCount; ++j)
+		{
+			const dtPoly* poly = &tile->polys[j];
+			if (poly->getType() == DT_POLYTYPE_OFFMESH_CONNECTION)
+				continue;
+
+			for (unsigned int k = poly->firstLink; k != DT_NULL_LINK; k = tile->links[k].next)
+			{
+				const dtLink& link = tile->links[k];
+
+				unsigned int salt, neighborIndex, neighborPoly;
+				navMesh.decodePolyId(link.ref, salt, neighborIndex, neighborPoly);
+
+				if ((int)neighborIndex == i || neighborIndex >= graphTiles.size()
+					|| graphTiles[neighborIndex] == -1)
+				{
+					continue;
+				}
+
+				// only the part of the edge between bmin and bmax is shared
+				const float* va = &tile->verts[poly->verts[link.edge] * 3];
+				const float* vb = &tile->verts[poly->verts[(link.edge + 1) % poly->vertCount] * 3];
+				float t = (link.side != 0xff) ? (link.bmin + link.bmax) / (2.0f * 255.0f) : 0.5f;
+
+				glm::vec3 mid = glm::mix(glm::make_vec3(va), glm::make_vec3(vb), t);
+
+				uint32_t tileA = graphTiles[i];
+				uint32_t tileB = graphTiles[neighborIndex];
+				if (tileA > tileB)
+					std::swap(tileA, tileB);
+
+				edges[std::make_pair(tileA, tileB)].push_back(mid);
+			}
+		}
+	}
+
+	// place each portal on the edge closest to the middle of the shared edges.
+	for (const auto& entry : edges)
+	{
+		const std::vector<glm::vec3>& points = entry.second;
+
+		glm::vec3 center(0.0f);
+		for (const glm::vec3& point : points)
+			center += point;
+		center /= static_cast<float>(points.size());
+
+		const glm::vec3* best = &points[0];
+		float bestDist = FLT_MAX;
+
+		for (const glm::vec3& point : points)
+		{
+			float dist = glm::distance(point, center);
+			if (dist < bestDist)
+			{
+				bestDist = dist;
+				best = &point;
+			}
+		}
+
+		AddPortal(entry.first.first, entry.first.second, *best);
+	}
+}
+
+//----------------------------------------------------------------------------
+
+bool TileGraph::FindRoute(int startTile, const glm::vec3& startPos, int endTile,
+	const glm::vec3& endPos, std::vector<glm::vec3>& route) const
+{
+	route.clear();
+
+	if (startTile < 0 || startTile >= (int)m_tiles.size()
+		|| endTile < 0 || endTile >= (int)m_tiles.size())
+	{
+		return false;
+	}
+
+	if (startTile == endTile)
+		return true;
+
+	// a* over portals. The start and end positions act as extra nodes that are
+	// connected to the portals of their tiles.
+	std::vector<float> costs(m_portals.size(), FLT_MAX);
+	std::vector<int> parents(m_portals.size(), -1);
+	std::vector<bool> closed(m_portals.size(), false);
+
+	using OpenEntry = std::pair<float, uint32_t>;
+	std::priority_queue<OpenEntry, std::vector<OpenEntry>, std::greater<OpenEntry>> open;
+
+	for (uint32_t portal : m_tiles[startTile].portals)
+	{
+		const glm::vec3& pos = m_portals[portal].pos;
+
+		costs[portal] = glm::distance(startPos, pos);
+		open.emplace(costs[portal] + glm::distance(pos, endPos), portal);
+	}
+
+	int goal = -1;
+
+	while (!open.empty())
+	{
+		uint32_t current = open.top().second;
+		open.pop();
+
+		if (closed[current])
+			continue;
+		closed[current] = true;
+
+		const Portal& portal = m_portals[current];
+		if ((int)portal.tileA == endTile || (int)portal.tileB == endTile)
+		{
+			goal = current;
+			break;
+		}
+
+		for (uint32_t tile : { portal.tileA, portal.tileB })
+		{
+			for (uint32_t neighbor : m_tiles[tile].portals)
+			{
+				if (closed[neighbor])
+					continue;
+
+				const glm::vec3& pos = m_portals[neighbor].pos;
+				float cost = costs[current] + glm::distance(portal.pos, pos);
+
+				if (cost < costs[neighbor])
+				{
+					costs[neighbor] = cost;
+					parents[neighbor] = current;
+					open.emplace(cost + glm::distance(pos, endPos), neighbor);
+				}
+			}
+		}
+	}
+
+	if (goal == -1)
+		return false;
+
+	for (int portal = goal; portal != -1; portal = parents[portal])
+		route.push_back(m_portals[portal].pos);
+
+	std::reverse(route.begin(), route.end());
+	return true;
+}
+
+dtStatus TileGraph::FindPath(dtNavMeshQuery* query, const dtQueryFilter& filter,
+	dtPolyRef startRef, const float* startPos, dtPolyRef endRef, const float* endPos,
+	dtPolyRef* path, int* pathCount, int maxPath) const
+{
+	*pathCount = 0;
+
+	const dtNavMesh* navMesh = query->getAttachedNavMesh();
+	const dtMeshTile* startTile = nullptr;
+	const dtMeshTile* endTile = nullptr;
+	const dtPoly* poly = nullptr;
+
+	if (dtStatusFailed(navMesh->getTileAndPolyByRef(startRef, &startTile, &poly))
+		|| dtStatusFailed(navMesh->getTileAndPolyByRef(endRef, &endTile, &poly)))
+	{
+		return DT_FAILURE | DT_INVALID_PARAM;
+	}
+
+	int start = FindTile(startTile->header->x, startTile->header->y, startTile->header->layer);
+	int end = FindTile(endTile->header->x, endTile->header->y, endTile->header->layer);
+
+	std::vector<glm::vec3> route;
+	if (!FindRoute(start, glm::make_vec3(startPos), end, glm::make_vec3(endPos), route))
+		return DT_FAILURE;
+
+	// pick every few portals along the route as intermediate targets
+	std::vector<std::pair<dtPolyRef, glm::vec3>> targets;
+
+	for (size_t i = SEGMENT_PORTALS - 1; i < route.size(); i += SEGMENT_PORTALS)
+	{
+		dtPolyRef ref = 0;
+		glm::vec3 pos;
+
+		query->findNearestPoly(glm::value_ptr(route[i]), PORTAL_EXTENTS, &filter,
+			&ref, glm::value_ptr(pos));
+		if (ref)
+			targets.emplace_back(ref, pos);
+	}
+
+	targets.emplace_back(endRef, glm::make_vec3(endPos));
+
+	std::vector<dtPolyRef> polys;
+	dtPolyRef currentRef = startRef;
+	glm::vec3 currentPos = glm::make_vec3(startPos);
+
+	dtPolyRef segment[MAX_SEGMENT_POLYS];
+
+	for (const auto& target : targets)
+	{
+		int segmentCount = 0;
+		dtStatus status = query->findPath(currentRef, target.first, glm::value_ptr(currentPos),
+			glm::value_ptr(target.second), &filter, segment, &segmentCount, MAX_SEGMENT_POLYS);
+
+		if (dtStatusFailed(status) || segmentCount == 0 || segment[segmentCount - 1] != target.first)
+			return DT_FAILURE | (status & DT_OUT_OF_NODES);
+
+		// each segment starts on the polygon that the previous one ended on
+		polys.insert(polys.end(), polys.empty() ? segment : segment + 1, segment + segmentCount);
+
+		currentRef = target.first;
+		currentPos = target.second;
+	}
+
+	// segments can overlap where a portal sits off the best line, cut out any loops.
+	std::vector<dtPolyRef> result;
+	std::unordered_map<dtPolyRef, size_t> visited;
+
+	for (dtPolyRef ref : polys)
+	{
+		auto iter = visited.find(ref);
+		if (iter != visited.end())
+		{
+			size_t keep = iter->second + 1;
+			for (size_t i = keep; i < result.size(); ++i)
+				visited.erase(result[i]);
+			result.resize(keep);
+		}
+		else
+		{
+			visited.emplace(ref, result.size());
+			result.push_back(ref);
+		}
+	}
+
+	if ((int)result.size() > maxPath)
+		return DT_FAILURE | DT_BUFFER_TOO_SMALL;
+
+	std::copy(result.begin(), result.end(), path);
+	*pathCount = static_cast<int>(result.size());
+
+	return DT_SUCCESS;
+}
@@ -0,0 +1,81 @@
+//
+// TileGraph.h
+//
+
+#pragma once
+
+#include <DetourNavMesh.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+class dtNavMeshQuery;
+class dtQueryFilter;
+
+// Abstract graph over the tiles of a navmesh, used for coarse routing of long
+// paths. Every pair of tiles that share at least one polygon link is joined by a
+// portal, placed on one of the edges that connect them. A route through the
+// graph is then refined with detour one short segment at a time, which keeps
+// each search well below the node limit of the query.
+class TileGraph
+{
+public:
+	struct Tile
+	{
+		int x = 0;
+		int y = 0;
+		int layer = 0;
+
+		// portals leading out of this tile
+		std::vector<uint32_t> portals;
+	};
+
+	struct Portal
+	{
+		uint32_t tileA = 0;
+		uint32_t tileB = 0;
+		glm::vec3 pos;
+	};
+
+	TileGraph() = default;
+
+	// build the graph from the tiles that are currently in the navmesh.
+	void Build(const dtNavMesh& navMesh);
+	void Clear();
+
+	bool IsEmpty() const { return m_portals.empty(); }
+
+	const std::vector<Tile>& GetTiles() const { return m_tiles; }
+	const std::vector<Portal>& GetPortals() const { return m_portals; }
+
+	// used when loading the graph from a file.
+	uint32_t AddTile(int x, int y, int layer);
+	void AddPortal(uint32_t tileA, uint32_t tileB, const glm::vec3& pos);
+
+	// returns the index of the tile at the given location, or -1.
+	int FindTile(int x, int y, int layer) const;
+
+	// find a sequence of portal positions leading from the start tile to the end
+	// tile. Positions are in navmesh coordinates.
+	bool FindRoute(int startTile, const glm::vec3& startPos, int endTile,
+		const glm::vec3& endPos, std::vector<glm::vec3>& route) const;
+
+	// find a polygon path by routing through the graph first, and then
+	// searching between portals along the route. Fails if any part of the path
+	// cannot be completed, in which case the caller should do a regular search.
+	dtStatus FindPath(dtNavMeshQuery* query, const dtQueryFilter& filter,
+		dtPolyRef startRef, const float* startPos, dtPolyRef endRef, const float* endPos,
+		dtPolyRef* path, int* pathCount, int maxPath) const;
+
+private:
+	static uint64_t TileKey(int x, int y, int layer)
+	{
+		return ((uint64_t)(uint32_t)x << 32) | ((uint64_t)(uint16_t)y << 16) | (uint16_t)layer;
+	}
+
+	std::vector<Tile> m_tiles;
+	std::vector<Portal> m_portals;
+	std::unordered_map<uint64_t, uint32_t> m_tilesByKey;
+};
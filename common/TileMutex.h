@@ -0,0 +1,71 @@
+//
+// TileMutex.h
+//
+
+#pragma once
+
+#include <atomic>
+#include <shared_mutex>
+#include <thread>
+
+// Guards the tiles of a navmesh. Any number of threads can read the tiles at
+// once, and a change waits for them to finish and keeps new readers out until
+// it is done. The thread that is changing the tiles can lock them again, for
+// reading or writing, so that the helpers that are used from both sides don't
+// need to know which one they were called from. A thread that is only reading
+// can't start a change without letting go of its read lock first.
+class TileMutex
+{
+public:
+	TileMutex() = default;
+	TileMutex(const TileMutex&) = delete;
+	TileMutex& operator=(const TileMutex&) = delete;
+
+	void lock()
+	{
+		if (IsWriter())
+		{
+			++m_writeDepth;
+			return;
+		}
+
+		m_mutex.lock();
+		m_writer = std::this_thread::get_id();
+		m_writeDepth = 1;
+	}
+
+	void unlock()
+	{
+		if (--m_writeDepth > 0)
+			return;
+
+		m_writer = std::thread::id();
+		m_mutex.unlock();
+	}
+
+	// the writer already has the tiles to itself
+	void lock_shared()
+	{
+		if (IsWriter())
+			++m_writeDepth;
+		else
+			m_mutex.lock_shared();
+	}
+
+	void unlock_shared()
+	{
+		if (IsWriter())
+			--m_writeDepth;
+		else
+			m_mutex.unlock_shared();
+	}
+
+private:
+	bool IsWriter() const { return m_writer == std::this_thread::get_id(); }
+
+	std::shared_timed_mutex m_mutex;
+
+	// only changed by the writer, while it holds the lock
+	std::atomic<std::thread::id> m_writer{ std::thread::id() };
+	int m_writeDepth = 0;
+};
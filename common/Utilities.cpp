@@ -13,6 +13,7 @@
 
 #include <zlib.h>
 
+#include <algorithm>
 #include <stdio.h>
 
 
@@ -87,54 +88,32 @@ void ImGuiEx::ConfigureFonts()
 
 //----------------------------------------------------------------------------
 
-bool CompressMemory(void* in_data, size_t in_data_size, std::vector<uint8_t>& out_data)
+bool CompressMemory(void* in_data, size_t in_data_size, std::vector<uint8_t>& out_data,
+	int level /* = -1 */)
 {
-	std::vector<uint8_t> buffer;
-
-	const size_t BUFSIZE = 128 * 1024;
-	uint8_t temp_buffer[BUFSIZE];
-
 	z_stream strm;
-	strm.zalloc = 0;
-	strm.zfree = 0;
-	strm.next_in = reinterpret_cast<uint8_t *>(in_data);
-	strm.avail_in = (uInt)in_data_size;
-	strm.next_out = temp_buffer;
-	strm.avail_out = BUFSIZE;
+	memset(&strm, 0, sizeof(strm));
 
-	deflateInit(&strm, Z_DEFAULT_COMPRESSION);
+	if (deflateInit(&strm, level) != Z_OK)
+		return false;
 
-	while (strm.avail_in != 0)
-	{
-		int res = deflate(&strm, Z_NO_FLUSH);
-		if (res != Z_OK)
-			return false;
+	// deflateBound gives us the worst case size, so the whole thing can be
+	// compressed in one go without growing the buffer.
+	std::vector<uint8_t> buffer(deflateBound(&strm, (uLong)in_data_size));
 
-		if (strm.avail_out == 0)
-		{
-			buffer.insert(buffer.end(), temp_buffer, temp_buffer + BUFSIZE);
-			strm.next_out = temp_buffer;
-			strm.avail_out = BUFSIZE;
-		}
-	}
+	strm.next_in = reinterpret_cast<uint8_t *>(in_data);
+	strm.avail_in = (uInt)in_data_size;
+	strm.next_out = buffer.data();
+	strm.avail_out = (uInt)buffer.size();
 
-	int deflate_res = Z_OK;
-	while (deflate_res == Z_OK)
-	{
-		if (strm.avail_out == 0)
-		{
-			buffer.insert(buffer.end(), temp_buffer, temp_buffer + BUFSIZE);
-			strm.next_out = temp_buffer;
-			strm.avail_out = BUFSIZE;
-		}
-		deflate_res = deflate(&strm, Z_FINISH);
-	}
+	int deflate_res = deflate(&strm, Z_FINISH);
+	size_t total_out = strm.total_out;
+	deflateEnd(&strm);
 
 	if (deflate_res != Z_STREAM_END)
 		return false;
 
-	buffer.insert(buffer.end(), temp_buffer, temp_buffer + BUFSIZE - strm.avail_out);
-	deflateEnd(&strm);
+	buffer.resize(total_out);
 
 	out_data.swap(buffer);
 	return true;
@@ -151,28 +130,52 @@ bool DecompressMemory(void* in_data, size_t in_data_size, std::vector<uint8_t>&
 	zs.next_in = (Bytef*)in_data;
 	zs.avail_in = (uInt)in_data_size;
 
+	// size is unknown, so start with a guess and inflate straight into the
+	// output, doubling it when we run out of room.
+	std::vector<uint8_t> buffer(std::max<size_t>(in_data_size * 4, 64 * 1024));
 	int ret;
-	const size_t BUFSIZE = 128 * 1024;
-	uint8_t temp_buffer[BUFSIZE];
-	std::vector<uint8_t> buffer;
 
-	// get the decompressed bytes blockwise using repeated calls to inflate
 	do {
-		zs.next_out = reinterpret_cast<Bytef*>(temp_buffer);
-		zs.avail_out = BUFSIZE;
-
-		ret = inflate(&zs, 0);
+		if (zs.total_out == buffer.size())
+			buffer.resize(buffer.size() * 2);
 
-		if (buffer.size() < zs.total_out) {
-			buffer.insert(buffer.end(), temp_buffer, temp_buffer + zs.total_out - buffer.size());
-		}
+		zs.next_out = buffer.data() + zs.total_out;
+		zs.avail_out = (uInt)(buffer.size() - zs.total_out);
 
+		ret = inflate(&zs, Z_NO_FLUSH);
 	} while (ret == Z_OK);
 
+	size_t total_out = zs.total_out;
 	inflateEnd(&zs);
 
 	if (ret != Z_STREAM_END) return false;
 
+	buffer.resize(total_out);
+
 	out_data.swap(buffer);
 	return true;
 }
+
+bool DecompressMemory(void* in_data, size_t in_data_size, void* out_data, size_t out_data_size)
+{
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+
+	if (inflateInit(&zs) != Z_OK)
+		return false;
+
+	zs.next_in = (Bytef*)in_data;
+	zs.avail_in = (uInt)in_data_size;
+	zs.next_out = (Bytef*)out_data;
+	zs.avail_out = (uInt)out_data_size;
+
+	int ret = inflate(&zs, Z_FINISH);
+	inflateEnd(&zs);
+
+	return ret == Z_STREAM_END && zs.total_out == out_data_size;
+}
+
+uint32_t Crc32(const void* data, size_t size, uint32_t crc /* = 0 */)
+{
+	return (uint32_t)crc32(crc, static_cast<const Bytef*>(data), (uInt)size);
+}
@@ -82,9 +82,17 @@ inline float distSqr(const glm::vec3& v1, const glm::vec3& v2)
 
 //----------------------------------------------------------------------------
 
-bool CompressMemory(void* in_data, size_t in_data_size, std::vector<uint8_t>& out_data);
+// level is a zlib compression level, -1 for the default
+bool CompressMemory(void* in_data, size_t in_data_size, std::vector<uint8_t>& out_data,
+	int level = -1);
 bool DecompressMemory(void* in_data, size_t in_data_size, std::vector<uint8_t>& out_data);
 
+// decompress into a buffer of known size. Fails unless exactly out_data_size bytes are produced.
+bool DecompressMemory(void* in_data, size_t in_data_size, void* out_data, size_t out_data_size);
+
+// zlib's crc32, continuing from crc for data that comes in pieces
+uint32_t Crc32(const void* data, size_t size, uint32_t crc = 0);
+
 
 //----------------------------------------------------------------------------
 
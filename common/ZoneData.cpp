@@ -5,6 +5,7 @@
 #include "ZoneData.h"
 
 #include <zone-utilities/common/eqg_model_loader.h>
+#include <zone-utilities/common/pfs_crc.h>
 #include <zone-utilities/common/safe_alloc.h>
 
 #include <boost/algorithm/string.hpp>
@@ -15,6 +16,7 @@
 #include <algorithm>
 #include <fstream>
 #include <iterator>
+#include <memory>
 #include <filesystem>
 
 using namespace std::tr2;
@@ -34,6 +36,65 @@ public:
 
 //----------------------------------------------------------------------------
 
+// The .mod files of a set of archives, decoded the first time they are asked for.
+// Opening an archive only reads its directory and compressed data, which is much
+// cheaper than decoding every model in an asset pack up front.
+class EQGModelArchives
+{
+public:
+	// add the models in an archive. Models in later archives replace models with
+	// the same name in earlier ones. Returns false if there are none.
+	bool Open(const std::string& filename)
+	{
+		auto archive = std::make_unique<EQEmu::PFS::Archive>();
+		if (!archive->OpenReadOnly(filename))
+			return false;
+
+		std::vector<std::string> models;
+		if (!archive->GetFilenames("mod", models) || models.empty())
+			return false;
+
+		for (auto& modelName : models)
+		{
+			m_index[modelName] = archive.get();
+			m_models.erase(modelName);
+		}
+
+		m_archives.push_back(std::move(archive));
+		return true;
+	}
+
+	// fileName is the lower case name of the .mod file
+	ModelPtr GetModel(const std::string& fileName)
+	{
+		auto iter = m_models.find(fileName);
+		if (iter != m_models.end())
+			return iter->second;
+
+		ModelPtr model;
+
+		auto indexIter = m_index.find(fileName);
+		if (indexIter != m_index.end())
+		{
+			EQEmu::EQGModelLoader model_loader;
+			model_loader.Load(*indexIter->second, fileName, model);
+			if (model)
+				model->SetName(fileName);
+		}
+
+		// failures are remembered too, so they aren't decoded again
+		m_models[fileName] = model;
+		return model;
+	}
+
+private:
+	std::vector<std::unique_ptr<EQEmu::PFS::Archive>> m_archives;
+	std::map<std::string, EQEmu::PFS::Archive*> m_index;
+	std::map<std::string, ModelPtr> m_models;
+};
+
+//----------------------------------------------------------------------------
+
 class EQGDataLoader : public ZoneDataLoader
 {
 public:
@@ -53,7 +114,7 @@ public:
 
 	virtual bool Load() override
 	{
-		bool loadedSomething = m_archive.Open(GetZoneFile(m_zd));
+		bool loadedSomething = m_archive.OpenReadOnly(GetZoneFile(m_zd));
 
 		std::string base_filename = (boost::format("%s\\%s")
 			% m_zd->GetEQPath()
@@ -76,29 +137,9 @@ public:
 				for (auto& name : filenames)
 				{
 					std::string asset_file = (boost::format("%s\\%s") % m_zd->GetEQPath() % name).str();
-					EQEmu::PFS::Archive archive;
-
-					if (!archive.Open(asset_file))
-						continue;
-
-					std::vector<std::string> models;
 
-					if (archive.GetFilenames("mod", models))
-					{
-						for (auto& modelName : models)
-						{
-							EQEmu::EQGModelLoader model_loader;
-							ModelPtr model;
-
-							model_loader.Load(archive, modelName, model);
-							if (model)
-							{
-								model->SetName(modelName);
-								m_modelsByFile[modelName] = model;
-								loadedSomething = true;
-							}
-						}
-					}
+					if (m_assetModels.Open(asset_file))
+						loadedSomething = true;
 				}
 			}
 		}
@@ -109,10 +150,9 @@ public:
 	ModelPtr GetModel(const std::string& modelName)
 	{
 		std::string name = boost::to_lower_copy(modelName) + ".mod";
-		auto fileIter = m_modelsByFile.find(name);
-		if (fileIter != m_modelsByFile.end())
+		if (ModelPtr model = m_assetModels.GetModel(name))
 		{
-			return fileIter->second;
+			return model;
 		}
 
 		auto iter = m_models.find(modelName);
@@ -163,7 +203,7 @@ private:
 	EQEmu::PFS::Archive m_archive;
 
 	std::map<std::string, ModelPtr> m_models;
-	std::map<std::string, ModelPtr> m_modelsByFile;
+	EQGModelArchives m_assetModels;
 };
 
 //----------------------------------------------------------------------------
@@ -249,29 +289,9 @@ public:
 				for (auto& name : filenames)
 				{
 					std::string asset_file = (boost::format("%s\\%s") % m_zd->GetEQPath() % name).str();
-					EQEmu::PFS::Archive archive;
 
-					if (!archive.Open(asset_file))
-						continue;
-
-					std::vector<std::string> models;
-
-					if (archive.GetFilenames("mod", models))
-					{
-						for (auto& modelName : models)
-						{
-							EQEmu::EQGModelLoader model_loader;
-							ModelPtr model;
-
-							model_loader.Load(archive, modelName, model);
-							if (model)
-							{
-								model->SetName(modelName);
-								m_eqgModels[modelName] = model;
-								loadedSomething = true;
-							}
-						}
-					}
+					if (m_eqgModels.Open(asset_file))
+						loadedSomething = true;
 				}
 			}
 		}
@@ -294,11 +314,7 @@ public:
 	{
 		std::string eqgName = boost::to_lower_copy(modelName) + ".mod";
 
-		auto iter = m_eqgModels.find(eqgName);
-		if (iter != m_eqgModels.end())
-			return iter->second;
-
-		return nullptr;
+		return m_eqgModels.GetModel(eqgName);
 	}
 
 	virtual std::shared_ptr<ModelInfo> GetModelInfo(const std::string& modelName) override
@@ -350,25 +366,116 @@ private:
 	ZoneData* m_zd;
 
 	std::map<std::string, OldModelPtr> m_s3dModels;
-	std::map<std::string, ModelPtr> m_eqgModels;
+	EQGModelArchives m_eqgModels;
+};
+
+//----------------------------------------------------------------------------
+
+// Door model cache
+//
+// Every model name that was looked up, with its bounds and collision triangles, or
+// a marker if the zone doesn't have it. The cache is thrown out whenever any of the
+// zone's archives change.
+
+static const uint32_t MODEL_CACHE_MAGIC = 'MDCQ';
+static const uint32_t MODEL_CACHE_VERSION = 1;
+
+struct ModelCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t sourceCRC;
+	uint32_t modelCount;
 };
 
+template <typename T>
+static void WriteValue(std::ostream& out, const T& value)
+{
+	out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+static bool ReadValue(std::istream& in, T& value)
+{
+	return !!in.read(reinterpret_cast<char*>(&value), sizeof(T));
+}
+
+template <typename Model>
+static void WriteModel(std::ostream& out, Model& model)
+{
+	auto& verts = model.GetVertices();
+	auto& polys = model.GetPolygons();
+
+	WriteValue(out, static_cast<uint32_t>(verts.size()));
+	WriteValue(out, static_cast<uint32_t>(polys.size()));
+
+	for (auto& vert : verts)
+		WriteValue(out, vert.pos);
+
+	for (auto& poly : polys)
+	{
+		WriteValue(out, poly.flags);
+		WriteValue(out, poly.verts);
+	}
+}
+
+// cached models come back as eqg geometry, whatever they were loaded from. Only
+// the positions and polygon flags are kept.
+static ModelPtr ReadModel(std::istream& in)
+{
+	uint32_t vertCount = 0, polyCount = 0;
+	if (!ReadValue(in, vertCount) || !ReadValue(in, polyCount))
+		return nullptr;
+
+	ModelPtr model = std::make_shared<EQEmu::EQG::Geometry>();
+	model->GetVertices().resize(vertCount);
+	model->GetPolygons().resize(polyCount);
+
+	for (auto& vert : model->GetVertices())
+	{
+		if (!ReadValue(in, vert.pos))
+			return nullptr;
+	}
+
+	for (auto& poly : model->GetPolygons())
+	{
+		if (!ReadValue(in, poly.flags) || !ReadValue(in, poly.verts))
+			return nullptr;
+
+		for (uint32_t index : poly.verts)
+		{
+			if (index >= vertCount)
+				return nullptr;
+		}
+	}
+
+	return model;
+}
+
 //----------------------------------------------------------------------------
 
-ZoneData::ZoneData(const std::string& eqPath, const std::string& zoneName)
+ZoneData::ZoneData(const std::string& eqPath, const std::string& zoneName,
+	const std::string& cachePath)
 	: m_eqPath(eqPath)
 	, m_zoneName(zoneName)
 {
-	LoadZone();
+	if (!cachePath.empty())
+		m_cacheFile = cachePath + "\\" + m_zoneName + "_doors.cache";
+
+	if (!LoadCache())
+		LoadZone();
 }
 
 ZoneData::~ZoneData()
 {
+	if (m_cacheDirty)
+		SaveCache();
 }
 
 void ZoneData::LoadZone()
 {
 	m_loader.reset();
+	m_zoneLoaded = true;
 
 	if (EQGDataLoader::IsValid(this))
 		m_loader = std::make_unique<EQGDataLoader>(this);
@@ -387,10 +494,173 @@ std::shared_ptr<ModelInfo> ZoneData::GetModelInfo(const std::string& modelName)
 	if (iter != m_modelInfo.end())
 		return iter->second;
 
-	return m_loader ? m_loader->GetModelInfo(modelName) : nullptr;
+	// the cache didn't have it, so we need the archives after all
+	if (!m_zoneLoaded)
+		LoadZone();
+
+	std::shared_ptr<ModelInfo> modelInfo = m_loader ? m_loader->GetModelInfo(modelName) : nullptr;
+	if (m_loader)
+	{
+		m_modelInfo[modelName] = modelInfo;
+		m_cacheDirty = true;
+	}
+
+	return modelInfo;
 }
 
 bool ZoneData::IsLoaded()
 {
-	return m_loader != nullptr;
+	return m_loader != nullptr || m_cacheLoaded;
+}
+
+uint32_t ZoneData::ComputeSourceCRC() const
+{
+	EQEmu::PFS::CRC& crc = EQEmu::PFS::CRC::Instance();
+	int32_t value = 0;
+
+	auto AddFile = [&](const std::string& filename)
+	{
+		std::error_code ec;
+		uint64_t size = sys::file_size(filename, ec);
+		if (ec)
+			return;
+
+		int64_t writeTime = sys::last_write_time(filename, ec).time_since_epoch().count();
+		std::string name = boost::to_lower_copy(filename);
+
+		value = crc.Update(value, (int8_t*)name.data(), (int32_t)name.size());
+		value = crc.Update(value, (int8_t*)&size, sizeof(size));
+		value = crc.Update(value, (int8_t*)&writeTime, sizeof(writeTime));
+	};
+
+	std::string base_filename = (boost::format("%s\\%s") % m_eqPath % m_zoneName).str();
+
+	AddFile(base_filename + ".eqg");
+	AddFile(base_filename + ".s3d");
+	AddFile(base_filename + "_obj.s3d");
+	AddFile(base_filename + "_obj2.s3d");
+
+	// the asset packs that models are also loaded from
+	std::string assets_file = base_filename + "_assets.txt";
+	AddFile(assets_file);
+
+	std::ifstream assets(assets_file.c_str());
+	if (assets.is_open())
+	{
+		std::vector<std::string> filenames;
+		std::copy(std::istream_iterator<std::string>(assets),
+			std::istream_iterator<std::string>(),
+			std::back_inserter(filenames));
+
+		if (m_zoneName == "poknowledge")
+			filenames.push_back("poknowledge_obj3.eqg");
+
+		for (auto& name : filenames)
+			AddFile((boost::format("%s\\%s") % m_eqPath % name).str());
+	}
+
+	return static_cast<uint32_t>(value);
+}
+
+bool ZoneData::LoadCache()
+{
+	if (m_cacheFile.empty())
+		return false;
+
+	std::ifstream in(m_cacheFile.c_str(), std::ios::binary);
+	if (!in.is_open())
+		return false;
+
+	ModelCacheHeader header;
+	if (!ReadValue(in, header)
+		|| header.magic != MODEL_CACHE_MAGIC
+		|| header.version != MODEL_CACHE_VERSION
+		|| header.sourceCRC != ComputeSourceCRC())
+	{
+		return false;
+	}
+
+	std::map<std::string, std::shared_ptr<ModelInfo>> models;
+
+	for (uint32_t i = 0; i < header.modelCount; ++i)
+	{
+		uint32_t nameLength = 0;
+		uint8_t found = 0;
+		if (!ReadValue(in, nameLength) || nameLength > 1024)
+			return false;
+
+		std::string name(nameLength, '\0');
+		if (!in.read(&name[0], nameLength) || !ReadValue(in, found))
+			return false;
+
+		if (!found)
+		{
+			models[name] = nullptr;
+			continue;
+		}
+
+		std::shared_ptr<ModelInfo> modelInfo = std::make_shared<ModelInfo>();
+		if (!ReadValue(in, modelInfo->min) || !ReadValue(in, modelInfo->max))
+			return false;
+
+		modelInfo->newModel = ReadModel(in);
+		if (!modelInfo->newModel)
+			return false;
+
+		models[name] = modelInfo;
+	}
+
+	m_modelInfo = std::move(models);
+	m_cacheLoaded = true;
+	return true;
+}
+
+void ZoneData::SaveCache()
+{
+	if (m_cacheFile.empty())
+		return;
+
+	// written to a temporary file first, another process may be reading the cache
+	std::string tempFile = m_cacheFile + ".tmp";
+
+	{
+		std::ofstream out(tempFile.c_str(), std::ios::binary | std::ios::trunc);
+		if (!out.is_open())
+			return;
+
+		ModelCacheHeader header;
+		header.magic = MODEL_CACHE_MAGIC;
+		header.version = MODEL_CACHE_VERSION;
+		header.sourceCRC = ComputeSourceCRC();
+		header.modelCount = static_cast<uint32_t>(m_modelInfo.size());
+		WriteValue(out, header);
+
+		for (const auto& entry : m_modelInfo)
+		{
+			WriteValue(out, static_cast<uint32_t>(entry.first.size()));
+			out.write(entry.first.data(), entry.first.size());
+
+			const std::shared_ptr<ModelInfo>& modelInfo = entry.second;
+			WriteValue(out, static_cast<uint8_t>(modelInfo ? 1 : 0));
+			if (!modelInfo)
+				continue;
+
+			WriteValue(out, modelInfo->min);
+			WriteValue(out, modelInfo->max);
+
+			if (modelInfo->oldModel)
+				WriteModel(out, *modelInfo->oldModel);
+			else
+				WriteModel(out, *modelInfo->newModel);
+		}
+
+		if (!out.good())
+			return;
+	}
+
+	std::error_code ec;
+	sys::remove(m_cacheFile, ec);
+	sys::rename(tempFile, m_cacheFile, ec);
+	if (!ec)
+		m_cacheDirty = false;
 }
@@ -24,7 +24,11 @@ struct ModelInfo
 class ZoneData
 {
 public:
-	ZoneData(const std::string& eqPath, const std::string& zoneName);
+	// if cachePath is given, the models that are looked up are kept in a cache file in
+	// that directory. Models found in the cache are read from it, and the zone archives
+	// are only opened for models the cache doesn't know about.
+	ZoneData(const std::string& eqPath, const std::string& zoneName,
+		const std::string& cachePath = std::string());
 	~ZoneData();
 
 	bool IsLoaded();
@@ -36,9 +40,18 @@ public:
 
 private:
 	void LoadZone();
+
+	bool LoadCache();
+	void SaveCache();
+	uint32_t ComputeSourceCRC() const;
 	
 	std::string m_zoneName;
 	std::string m_eqPath;
+	std::string m_cacheFile;
+
+	bool m_zoneLoaded = false;
+	bool m_cacheLoaded = false;
+	bool m_cacheDirty = false;
 
 	// For EQG files
 	std::unique_ptr<ZoneDataLoader> m_loader;
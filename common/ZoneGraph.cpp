@@ -0,0 +1,282 @@
+//
+// ZoneGraph.cpp
+//
+
+#include "ZoneGraph.h"
+#include "common/proto/NavMeshFile.pb.h"
+
+#include <google/protobuf/util/json_util.h>
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <functional>
+#include <queue>
+#include <sstream>
+
+// zone short names are matched without regard to case
+static std::string ZoneKey(std::string name)
+{
+	std::transform(name.begin(), name.end(), name.begin(),
+		[](char c) { return static_cast<char>(::tolower(static_cast<unsigned char>(c))); });
+	return name;
+}
+
+static void ToProto(nav::vector3& out_proto, const glm::vec3& v3)
+{
+	out_proto.set_x(v3.x);
+	out_proto.set_y(v3.y);
+	out_proto.set_z(v3.z);
+}
+
+static glm::vec3 FromProto(const nav::vector3& in_proto)
+{
+	return glm::vec3{ in_proto.x(), in_proto.y(), in_proto.z() };
+}
+
+static void ToProto(nav::ZoneLine& out_proto, const ZoneGraph::ZoneLine& zoneLine)
+{
+	out_proto.set_zone(zoneLine.zone);
+	ToProto(*out_proto.mutable_position(), zoneLine.pos);
+	out_proto.set_target_zone(zoneLine.targetZone);
+	ToProto(*out_proto.mutable_target_position(), zoneLine.targetPos);
+}
+
+static ZoneGraph::ZoneLine FromProto(const nav::ZoneLine& proto)
+{
+	ZoneGraph::ZoneLine zoneLine;
+	zoneLine.zone = ZoneKey(proto.zone());
+	zoneLine.pos = FromProto(proto.position());
+	zoneLine.targetZone = ZoneKey(proto.target_zone());
+	zoneLine.targetPos = FromProto(proto.target_position());
+	return zoneLine;
+}
+
+//============================================================================
+
+void ZoneGraph::Clear()
+{
+	m_zoneLines.clear();
+	m_zones.clear();
+	m_zonesByName.clear();
+}
+
+void ZoneGraph::SetZoneLines(std::vector<ZoneLine> zoneLines)
+{
+	Clear();
+	m_zoneLines = std::move(zoneLines);
+
+	auto getZone = [this](const std::string& name) -> Zone&
+	{
+		auto iter = m_zonesByName.find(name);
+		if (iter != m_zonesByName.end())
+			return m_zones[iter->second];
+
+		m_zonesByName.emplace(name, static_cast<uint32_t>(m_zones.size()));
+		m_zones.emplace_back();
+		m_zones.back().name = name;
+		return m_zones.back();
+	};
+
+	for (uint32_t i = 0; i < m_zoneLines.size(); ++i)
+	{
+		ZoneLine& zoneLine = m_zoneLines[i];
+		zoneLine.zone = ZoneKey(zoneLine.zone);
+		zoneLine.targetZone = ZoneKey(zoneLine.targetZone);
+
+		getZone(zoneLine.zone).exits.push_back(i);
+		getZone(zoneLine.targetZone).entrances.push_back(i);
+	}
+
+	for (Zone& zone : m_zones)
+	{
+		zone.distances.assign(zone.entrances.size() * zone.exits.size(), -1.0f);
+	}
+}
+
+void ZoneGraph::SetDistances(uint32_t zone, std::vector<float> distances)
+{
+	Zone& z = m_zones[zone];
+	if (distances.size() == z.entrances.size() * z.exits.size())
+		z.distances = std::move(distances);
+}
+
+int ZoneGraph::FindZone(const std::string& zoneShortName) const
+{
+	auto iter = m_zonesByName.find(ZoneKey(zoneShortName));
+	if (iter == m_zonesByName.end())
+		return -1;
+
+	return static_cast<int>(iter->second);
+}
+
+bool ZoneGraph::LoadZoneLines(const std::string& filename, std::vector<ZoneLine>& zoneLines)
+{
+	std::string contents;
+	{
+		std::ifstream infile(filename.c_str());
+		if (!infile.is_open())
+			return false;
+
+		std::stringstream buffer;
+		buffer << infile.rdbuf();
+		contents = buffer.str();
+	}
+
+	google::protobuf::util::JsonParseOptions options;
+	options.ignore_unknown_fields = true;
+
+	nav::ZoneLineList proto;
+	google::protobuf::util::Status status =
+		google::protobuf::util::JsonStringToMessage(contents, &proto, options);
+	if (!status.ok())
+		return false;
+
+	zoneLines.clear();
+	for (const auto& proto_line : proto.zone_lines())
+	{
+		zoneLines.push_back(FromProto(proto_line));
+	}
+
+	return true;
+}
+
+bool ZoneGraph::Load(const std::string& filename)
+{
+	std::ifstream infile(filename.c_str(), std::ios::in | std::ios::binary);
+	if (!infile.is_open())
+		return false;
+
+	nav::ZoneGraph proto;
+	if (!proto.ParseFromIstream(&infile))
+		return false;
+
+	std::vector<ZoneLine> zoneLines;
+	for (const auto& proto_line : proto.zone_lines())
+	{
+		zoneLines.push_back(FromProto(proto_line));
+	}
+
+	SetZoneLines(std::move(zoneLines));
+
+	for (const auto& proto_zone : proto.zones())
+	{
+		int zone = FindZone(proto_zone.zone());
+		if (zone == -1)
+			continue;
+
+		// only keep distances that were measured between the same zone lines
+		const Zone& z = m_zones[zone];
+		if (!std::equal(z.entrances.begin(), z.entrances.end(),
+				proto_zone.entrances().begin(), proto_zone.entrances().end())
+			|| !std::equal(z.exits.begin(), z.exits.end(),
+				proto_zone.exits().begin(), proto_zone.exits().end()))
+		{
+			continue;
+		}
+
+		SetDistances(zone, std::vector<float>(proto_zone.distances().begin(), proto_zone.distances().end()));
+	}
+
+	return true;
+}
+
+bool ZoneGraph::Save(const std::string& filename) const
+{
+	nav::ZoneGraph proto;
+
+	for (const ZoneLine& zoneLine : m_zoneLines)
+	{
+		ToProto(*proto.add_zone_lines(), zoneLine);
+	}
+
+	for (const Zone& zone : m_zones)
+	{
+		nav::ZoneGraphZone* proto_zone = proto.add_zones();
+		proto_zone->set_zone(zone.name);
+
+		for (uint32_t entrance : zone.entrances)
+			proto_zone->add_entrances(entrance);
+		for (uint32_t exit : zone.exits)
+			proto_zone->add_exits(exit);
+		for (float distance : zone.distances)
+			proto_zone->add_distances(distance);
+	}
+
+	std::ofstream outfile(filename.c_str(), std::ios::out | std::ios::binary);
+	if (!outfile.is_open())
+		return false;
+
+	return proto.SerializeToOstream(&outfile);
+}
+
+bool ZoneGraph::FindRoute(const std::string& startZone, const std::vector<float>& startDistances,
+	const std::string& targetZone, std::vector<uint32_t>& route, float zoneCost) const
+{
+	route.clear();
+
+	int start = FindZone(startZone);
+	int target = FindZone(targetZone);
+	if (start == -1 || target == -1)
+		return false;
+	if (start == target)
+		return true;
+
+	// dijkstra over the zone lines, by the distance walked to get through them
+	typedef std::pair<float, uint32_t> QueueEntry;
+	std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry>> open;
+
+	std::vector<float> costs(m_zoneLines.size(), -1.0f);
+	std::vector<uint32_t> parents(m_zoneLines.size(), UINT32_MAX);
+
+	const Zone& first = m_zones[start];
+	for (size_t i = 0; i < first.exits.size() && i < startDistances.size(); ++i)
+	{
+		if (startDistances[i] < 0.0f)
+			continue;
+
+		uint32_t zoneLine = first.exits[i];
+		costs[zoneLine] = startDistances[i] + zoneCost;
+		open.emplace(costs[zoneLine], zoneLine);
+	}
+
+	while (!open.empty())
+	{
+		QueueEntry best = open.top();
+		open.pop();
+
+		uint32_t zoneLine = best.second;
+		if (best.first > costs[zoneLine])
+			continue;
+
+		int zone = FindZone(m_zoneLines[zoneLine].targetZone);
+		if (zone == target)
+		{
+			for (uint32_t i = zoneLine; i != UINT32_MAX; i = parents[i])
+				route.push_back(i);
+			std::reverse(route.begin(), route.end());
+			return true;
+		}
+
+		const Zone& z = m_zones[zone];
+		size_t entrance = std::find(z.entrances.begin(), z.entrances.end(), zoneLine) - z.entrances.begin();
+
+		for (size_t i = 0; i < z.exits.size(); ++i)
+		{
+			float distance = z.distances[entrance * z.exits.size() + i];
+			if (distance < 0.0f)
+				continue;
+
+			uint32_t next = z.exits[i];
+			float cost = best.first + distance + zoneCost;
+			if (costs[next] >= 0.0f && cost >= costs[next])
+				continue;
+
+			costs[next] = cost;
+			parents[next] = zoneLine;
+			open.emplace(cost, next);
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,85 @@
+//
+// ZoneGraph.h
+//
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// files in the navmesh directory
+const char* const ZONE_LINES_FILENAME = "ZoneLines.json";
+const char* const ZONE_GRAPH_FILENAME = "ZoneGraph.dat";
+
+// Connectivity between zones, for routes that cross zone lines. Each zone keeps
+// the walking distance from every zone line that lands in it to every zone line
+// that leaves it, measured over its navmesh when the graph is built. Picking the
+// chain of zones to go through is then a small search over the zone lines,
+// without having to search the meshes of the zones along the way.
+//
+// The graph is built by the mesh generator into a single file next to the
+// meshes, from a hand editable list of zone lines.
+class ZoneGraph
+{
+public:
+	// positions are in game coordinates (spawn x, y, z)
+	struct ZoneLine
+	{
+		std::string zone;
+		glm::vec3 pos;
+
+		// where it lands in the other zone
+		std::string targetZone;
+		glm::vec3 targetPos;
+	};
+
+	struct Zone
+	{
+		std::string name;
+
+		// indices of the zone lines that land in this zone, and that leave it
+		std::vector<uint32_t> entrances;
+		std::vector<uint32_t> exits;
+
+		// a row of exits per entrance, negative if there is no path between them
+		std::vector<float> distances;
+	};
+
+	ZoneGraph() = default;
+
+	// replaces the graph with one over these zone lines. The distances through
+	// each zone are unknown until they are set.
+	void SetZoneLines(std::vector<ZoneLine> zoneLines);
+	void SetDistances(uint32_t zone, std::vector<float> distances);
+	void Clear();
+
+	bool IsEmpty() const { return m_zoneLines.empty(); }
+
+	const std::vector<ZoneLine>& GetZoneLines() const { return m_zoneLines; }
+	const std::vector<Zone>& GetZones() const { return m_zones; }
+
+	// returns the index of the zone with this short name, or -1.
+	int FindZone(const std::string& zoneShortName) const;
+
+	// the zone lines are read from a json ZoneLineList, the graph itself is stored
+	// as a binary ZoneGraph.
+	static bool LoadZoneLines(const std::string& filename, std::vector<ZoneLine>& zoneLines);
+	bool Load(const std::string& filename);
+	bool Save(const std::string& filename) const;
+
+	// find the shortest chain of zone lines from the start zone to the target
+	// zone. startDistances holds the distance to each exit of the start zone, in
+	// the order of its exits, negative for the ones that can't be reached.
+	// zoneCost is added for every zone line, for the time spent zoning.
+	bool FindRoute(const std::string& startZone, const std::vector<float>& startDistances,
+		const std::string& targetZone, std::vector<uint32_t>& route, float zoneCost = 0.0f) const;
+
+private:
+	std::vector<ZoneLine> m_zoneLines;
+	std::vector<Zone> m_zones;
+	std::unordered_map<std::string, uint32_t> m_zonesByName;
+};
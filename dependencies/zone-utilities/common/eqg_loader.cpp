@@ -14,7 +14,7 @@ bool EQEmu::EQGLoader::Load(std::string file, std::vector<std::shared_ptr<EQG::G
 	std::vector<std::shared_ptr<EQG::Region>> &regions, std::vector<std::shared_ptr<Light>> &lights) {
 	// find zon file
 	EQEmu::PFS::Archive archive;
-	if(!archive.Open(file + ".eqg")) {
+	if(!archive.OpenReadOnly(file + ".eqg")) {
 		eqLogMessage(LogTrace, "Failed to open %s.eqg as a standard eqg file because the file does not exist.", file.c_str());
 		return false;
 	}
@@ -108,14 +108,21 @@ bool EQEmu::EQGLoader::ParseZon(EQEmu::PFS::Archive &archive, std::vector<char>
 		model_names.push_back(mod);
 	}
 
-	//Need to load all the models
+	//Need to load all the models, they are inflated together
 	eqLogMessage(LogTrace, "Loading zone models.");
+	std::vector<std::vector<char>> model_buffers;
+	archive.Get(model_names, model_buffers);
+
 	EQGModelLoader model_loader;
 	for (size_t i = 0; i < model_names.size(); ++i) {
 		std::string mod = model_names[i];
 		std::shared_ptr<EQG::Geometry> m(new EQG::Geometry());
 		m->SetName(mod);
-		if(model_loader.Load(archive, mod, m)) {
+		if (model_buffers[i].empty()) {
+			eqLogMessage(LogError, "Unable to load %s, file was not found.", mod.c_str());
+		}
+
+		if(!model_buffers[i].empty() && model_loader.Load(model_buffers[i], mod, m)) {
 			models.push_back(m);
 		} 
 		else {
@@ -12,13 +12,18 @@ EQEmu::EQGModelLoader::~EQGModelLoader() {
 }
 
 bool EQEmu::EQGModelLoader::Load(EQEmu::PFS::Archive &archive, std::string model, std::shared_ptr<EQG::Geometry>& model_out) {
-	eqLogMessage(LogTrace, "Loading model %s.", model.c_str());
 	std::vector<char> buffer;
 	if(!archive.Get(model, buffer)) {
 		eqLogMessage(LogError, "Unable to load %s, file was not found.", model.c_str());
 		return false;
 	}
 
+	return Load(buffer, model, model_out);
+}
+
+bool EQEmu::EQGModelLoader::Load(std::vector<char> &buffer, std::string model, std::shared_ptr<EQG::Geometry>& model_out) {
+	eqLogMessage(LogTrace, "Loading model %s.", model.c_str());
+
 	uint32_t idx = 0;
 	SafeStructAllocParse(mod_header, header);
 	uint32_t bone_count = 0;
@@ -15,6 +15,8 @@ public:
 	EQGModelLoader();
 	~EQGModelLoader();
 	bool Load(EQEmu::PFS::Archive &archive, std::string model, std::shared_ptr<EQG::Geometry>& model_out);
+	//loads a model that was already read from its archive
+	bool Load(std::vector<char> &buffer, std::string model, std::shared_ptr<EQG::Geometry>& model_out);
 };
 
 }
@@ -16,7 +16,7 @@ EQEmu::EQG4Loader::~EQG4Loader() {
 bool EQEmu::EQG4Loader::Load(std::string file, std::shared_ptr<EQG::Terrain> &terrain)
 {
 	EQEmu::PFS::Archive archive;
-	if (!archive.Open(file + ".eqg")) {
+	if (!archive.OpenReadOnly(file + ".eqg")) {
 		eqLogMessage(LogTrace, "Failed to open %s.eqg as an eqgv4 file because the file does not exist.", file.c_str());
 		return false;
 	}
@@ -3,9 +3,26 @@
 #include "compression.h"
 #include <algorithm>
 #include <cctype>
+#include <atomic>
 #include <cstring>
+#include <thread>
 #include <tuple>
 
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #define MAX_BLOCK_SIZE 8192 // the client will crash if you make this bigger, so don't.
 
 #define ReadFromBuffer(type, var, buffer, idx) if(idx + sizeof(type) > buffer.size()) { return false; } type var = *(type*)&buffer[idx];
@@ -14,6 +31,197 @@
 #define WriteToBuffer(type, val, buffer, idx) if(idx + sizeof(type) > buffer.size()) { buffer.resize(idx + sizeof(type)); } *(type*)&buffer[idx] = val;  
 #define WriteToBufferLength(var, len, buffer, idx) if(idx + len > buffer.size()) { buffer.resize(idx + len); } memcpy(&buffer[idx], var, len);
 
+namespace EQEmu
+{
+
+namespace PFS
+{
+
+//read only view of archive data, usable with the buffer macros
+struct BufferView
+{
+	const char *data;
+	size_t length;
+
+	size_t size() const { return length; }
+	const char &operator[](size_t idx) const { return data[idx]; }
+};
+
+//keeps an archive mapped for as long as a read only archive uses it
+class MappedArchiveFile
+{
+public:
+	MappedArchiveFile() { }
+	~MappedArchiveFile() { Close(); }
+
+	bool Open(const std::string &filename);
+	void Close();
+
+	const char *data() const { return view; }
+	size_t size() const { return length; }
+private:
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+	const char *view = nullptr;
+	size_t length = 0;
+};
+
+}
+
+}
+
+bool EQEmu::PFS::MappedArchiveFile::Open(const std::string &filename) {
+	Close();
+
+#ifdef _WIN32
+	file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+		Close();
+		return false;
+	}
+
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping) {
+		Close();
+		return false;
+	}
+
+	view = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!view) {
+		Close();
+		return false;
+	}
+
+	length = (size_t)file_size.QuadPart;
+#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+
+	void *data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED) {
+		return false;
+	}
+
+	view = (const char*)data;
+	length = (size_t)st.st_size;
+#endif
+
+	return true;
+}
+
+void EQEmu::PFS::MappedArchiveFile::Close() {
+#ifdef _WIN32
+	if (view) {
+		UnmapViewOfFile(view);
+	}
+	if (mapping) {
+		CloseHandle(mapping);
+	}
+	if (file != INVALID_HANDLE_VALUE) {
+		CloseHandle(file);
+	}
+
+	file = INVALID_HANDLE_VALUE;
+	mapping = nullptr;
+#else
+	if (view) {
+		munmap((void*)view, length);
+	}
+#endif
+
+	view = nullptr;
+	length = 0;
+}
+
+//files at least this large have their blocks inflated on several threads
+#define PARALLEL_INFLATE_SIZE (1024 * 1024)
+
+struct InflateBlock
+{
+	uint32_t position;
+	uint32_t deflate_length;
+	uint32_t inflate_offset;
+	uint32_t inflate_length;
+};
+
+//inflates a file's blocks straight out of the archive data. The block headers give
+//where each block goes in the output, so the blocks of a large file can be
+//inflated side by side.
+static bool InflateBlocks(uint32_t offset, uint32_t size, const EQEmu::PFS::BufferView &in_buffer, std::vector<char> &out_buffer,
+	bool parallel = true) {
+	out_buffer.resize(size);
+
+	std::vector<InflateBlock> blocks;
+	uint32_t position = offset;
+	uint32_t inflate = 0;
+
+	while (inflate < size) {
+		ReadFromBuffer(uint32_t, deflate_length, in_buffer, position);
+		ReadFromBuffer(uint32_t, inflate_length, in_buffer, position + 4);
+		if (inflate_length == 0 || (size_t)position + 8 + deflate_length > in_buffer.size() || inflate + inflate_length > size) {
+			return false;
+		}
+
+		InflateBlock block = { position + 8, deflate_length, inflate, inflate_length };
+		blocks.push_back(block);
+
+		inflate += inflate_length;
+		position += deflate_length + 8;
+	}
+
+	auto inflate_range = [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; ++i) {
+			const InflateBlock &block = blocks[i];
+			EQEmu::InflateData(&in_buffer[block.position], block.deflate_length,
+				&out_buffer[block.inflate_offset], block.inflate_length);
+		}
+	};
+
+	size_t thread_count = parallel && size >= PARALLEL_INFLATE_SIZE
+		? std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), blocks.size()) : 1;
+
+	if (thread_count <= 1) {
+		inflate_range(0, blocks.size());
+		return true;
+	}
+
+	//each thread takes a run of blocks, this one takes the last
+	std::vector<std::thread> threads;
+	size_t per_thread = (blocks.size() + thread_count - 1) / thread_count;
+	size_t first = 0;
+	for (size_t i = 0; i + 1 < thread_count && first < blocks.size(); ++i) {
+		size_t last = std::min(first + per_thread, blocks.size());
+		threads.emplace_back(inflate_range, first, last);
+		first = last;
+	}
+
+	inflate_range(first, blocks.size());
+
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	return true;
+}
+
 bool EQEmu::PFS::Archive::Open() {
 	Close();
 	return true;
@@ -38,16 +246,39 @@ bool EQEmu::PFS::Archive::Open(std::string filename) {
 
 		buffer.resize(sz);
 		size_t res = fread(&buffer[0], 1, sz, f);
+		fclose(f);
+
 		if (res != sz) {
 			return false;
 		}
-
-		fclose(f);
 	}
 	else {
 		return false;
 	}
 
+	return ReadDirectory(&buffer[0], buffer.size(), false);
+}
+
+bool EQEmu::PFS::Archive::OpenReadOnly(std::string filename) {
+	Close();
+
+	auto file = std::make_shared<MappedArchiveFile>();
+	if (!file->Open(filename)) {
+		return false;
+	}
+
+	mapped = file;
+	if (!ReadDirectory(file->data(), file->size(), true)) {
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+bool EQEmu::PFS::Archive::ReadDirectory(const char *data, size_t data_size, bool read_only) {
+	BufferView buffer = { data, data_size };
+
 	char magic[4];
 	ReadFromBuffer(uint32_t, dir_offset, buffer, 0);
 	ReadFromBufferLength(magic, 4, buffer, 4);
@@ -58,7 +289,7 @@ bool EQEmu::PFS::Archive::Open(std::string filename) {
 
 	ReadFromBuffer(uint32_t, dir_count, buffer, dir_offset);
 	std::vector<std::tuple<int32_t, uint32_t, uint32_t>> directory_entries;
-	std::vector<std::tuple<int32_t, std::string>> filename_entries;
+	std::unordered_map<int32_t, std::string> filename_entries;
 	for(uint32_t i = 0; i < dir_count; ++i) {
 		ReadFromBuffer(int32_t, crc, buffer, dir_offset + 4 + (i * 12));
 		ReadFromBuffer(uint32_t, offset, buffer, dir_offset + 8 + (i * 12));
@@ -66,7 +297,7 @@ bool EQEmu::PFS::Archive::Open(std::string filename) {
 
 		if (crc == 0x61580ac9) {
 			std::vector<char> filename_buffer;
-			if(!InflateByFileOffset(offset, size, buffer, filename_buffer)) {
+			if(!InflateBlocks(offset, size, buffer, filename_buffer)) {
 				return false;
 			}
 
@@ -84,35 +315,29 @@ bool EQEmu::PFS::Archive::Open(std::string filename) {
 
 				std::transform(filename.begin(), filename.end(), filename.begin(), ::tolower);
 				int32_t crc = EQEmu::PFS::CRC::Instance().Get(filename);
-				filename_entries.push_back(std::make_tuple(crc, filename));
+
+				//the first file with a crc wins, like the directory search this replaces
+				filename_entries.emplace(crc, std::move(filename));
 			}
 		} else {
 			directory_entries.push_back(std::make_tuple(crc, offset, size));
 		}
 	}
-	
-	auto iter = directory_entries.begin();
-	while(iter != directory_entries.end()) {
-		int32_t crc = std::get<0>((*iter));
-
-		auto f_iter = filename_entries.begin();
-		while(f_iter != filename_entries.end()) {
-			int32_t f_crc = std::get<0>((*f_iter));
-
-			if(crc == f_crc) {
-				uint32_t offset = std::get<1>((*iter));
-				uint32_t size = std::get<2>((*iter));
-				std::string filename = std::get<1>((*f_iter));
-				if (!StoreBlocksByFileOffset(offset, size, buffer, filename)) {
-					return false;
-				}
-
-				break;
-			}
 
-			++f_iter;
+	for(auto &entry : directory_entries) {
+		auto f_iter = filename_entries.find(std::get<0>(entry));
+		if(f_iter == filename_entries.end()) {
+			continue;
+		}
+
+		uint32_t offset = std::get<1>(entry);
+		uint32_t size = std::get<2>(entry);
+		if (read_only) {
+			MappedEntry mapped_entry = { offset, size };
+			mapped_files[f_iter->second] = mapped_entry;
+		} else if (!StoreBlocksByFileOffset(offset, size, data, data_size, f_iter->second)) {
+			return false;
 		}
-		++iter;
 	}
 
 	uint32_t footer_offset = dir_offset + 4 + (12 * dir_count);
@@ -130,6 +355,10 @@ bool EQEmu::PFS::Archive::Open(std::string filename) {
 }
 
 bool EQEmu::PFS::Archive::Save(std::string filename) {
+	if (mapped) {
+		return false;
+	}
+
 	std::vector<char> buffer;
 
 	//Write Header
@@ -236,17 +465,70 @@ void EQEmu::PFS::Archive::Close() {
 	footer_date = 0;
 	files.clear();
 	files_uncompressed_size.clear();
+	mapped.reset();
+	mapped_files.clear();
 }
 
 bool EQEmu::PFS::Archive::Get(std::string filename, std::vector<char> &buf) {
+	return GetFile(filename, buf, true);
+}
+
+bool EQEmu::PFS::Archive::Get(const std::vector<std::string> &filenames, std::vector<std::vector<char>> &bufs) {
+	bufs.clear();
+	bufs.resize(filenames.size());
+
+	//each thread inflates whole files, so the blocks of a file aren't split up as well
+	size_t thread_count = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), filenames.size());
+	std::atomic<size_t> next_file(0);
+	std::atomic<bool> found_all(true);
+
+	auto get_files = [&]() {
+		size_t i;
+		while ((i = next_file++) < filenames.size()) {
+			if (!GetFile(filenames[i], bufs[i], thread_count <= 1)) {
+				bufs[i].clear();
+				found_all = false;
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < thread_count; ++i) {
+		threads.emplace_back(get_files);
+	}
+
+	get_files();
+
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	return found_all;
+}
+
+bool EQEmu::PFS::Archive::GetFile(std::string filename, std::vector<char> &buf, bool parallel) const {
 	std::transform(filename.begin(), filename.end(), filename.begin(), ::tolower);
 
+	if (mapped) {
+		auto iter = mapped_files.find(filename);
+		if (iter == mapped_files.end()) {
+			return false;
+		}
+
+		buf.clear();
+
+		BufferView buffer = { mapped->data(), mapped->size() };
+		return InflateBlocks(iter->second.offset, iter->second.size, buffer, buf, parallel);
+	}
+
 	auto iter = files.find(filename);
-	if(iter != files.end()) {
+	auto size_iter = files_uncompressed_size.find(filename);
+	if(iter != files.end() && size_iter != files_uncompressed_size.end()) {
 		buf.clear();
 
-		uint32_t uc_size = files_uncompressed_size[filename];
-		if(!InflateByFileOffset(0, uc_size, iter->second, buf)) {
+		uint32_t uc_size = size_iter->second;
+		BufferView buffer = { iter->second.data(), iter->second.size() };
+		if(!InflateBlocks(0, uc_size, buffer, buf, parallel)) {
 			return false;
 		}
 		
@@ -257,6 +539,10 @@ bool EQEmu::PFS::Archive::Get(std::string filename, std::vector<char> &buf) {
 }
 
 bool EQEmu::PFS::Archive::Set(std::string filename, const std::vector<char> &buf) {
+	if (mapped) {
+		return false;
+	}
+
 	std::transform(filename.begin(), filename.end(), filename.begin(), ::tolower);
 
 	std::vector<char> vec;
@@ -272,6 +558,10 @@ bool EQEmu::PFS::Archive::Set(std::string filename, const std::vector<char> &buf
 }
 
 bool EQEmu::PFS::Archive::Delete(std::string filename) {
+	if (mapped) {
+		return false;
+	}
+
 	std::transform(filename.begin(), filename.end(), filename.begin(), ::tolower);
 
 	files.erase(filename);
@@ -281,6 +571,10 @@ bool EQEmu::PFS::Archive::Delete(std::string filename) {
 }
 
 bool EQEmu::PFS::Archive::Rename(std::string filename, std::string filename_new) {
+	if (mapped) {
+		return false;
+	}
+
 	std::transform(filename.begin(), filename.end(), filename.begin(), ::tolower);
 	std::transform(filename_new.begin(), filename_new.end(), filename_new.begin(), ::tolower);
 
@@ -305,6 +599,10 @@ bool EQEmu::PFS::Archive::Rename(std::string filename, std::string filename_new)
 bool EQEmu::PFS::Archive::Exists(std::string filename) {
 	std::transform(filename.begin(), filename.end(), filename.begin(), ::tolower);
 
+	if (mapped) {
+		return mapped_files.count(filename) != 0;
+	}
+
 	return files.count(filename) != 0;
 }
 
@@ -315,21 +613,26 @@ bool EQEmu::PFS::Archive::GetFilenames(std::string ext, std::vector<std::string>
 	size_t elen = ext.length();
 	bool all_files = !ext.compare("*");
 
-	auto iter = files.begin();
-	while (iter != files.end()) {
-		if (all_files) {
-			out_files.push_back(iter->first);
-			++iter;
-			continue;
-		}
+	auto matches = [&](const std::string &name) {
+		size_t flen = name.length();
+		return all_files || (flen > elen && !strcmp(name.c_str() + (flen - elen), ext.c_str()));
+	};
 
-		size_t flen = iter->first.length();
-		if (flen <= elen) {
-			++iter;
-			continue;
+	if (mapped) {
+		for (auto &entry : mapped_files) {
+			if (matches(entry.first)) {
+				out_files.push_back(entry.first);
+			}
 		}
 
-		if (!strcmp(iter->first.c_str() + (flen - elen), ext.c_str())) {
+		//same order as the files of a writable archive
+		std::sort(out_files.begin(), out_files.end());
+		return out_files.size() > 0;
+	}
+
+	auto iter = files.begin();
+	while (iter != files.end()) {
+		if (matches(iter->first)) {
 			out_files.push_back(iter->first);
 		}
 		++iter;
@@ -337,7 +640,8 @@ bool EQEmu::PFS::Archive::GetFilenames(std::string ext, std::vector<std::string>
 	return out_files.size() > 0;
 }
 
-bool EQEmu::PFS::Archive::StoreBlocksByFileOffset(uint32_t offset, uint32_t size, const std::vector<char> &in_buffer, std::string filename) {
+bool EQEmu::PFS::Archive::StoreBlocksByFileOffset(uint32_t offset, uint32_t size, const char *data, size_t data_size, std::string filename) {
+	BufferView in_buffer = { data, data_size };
 
 	uint32_t position = offset;
 	uint32_t block_size = 0;
@@ -350,6 +654,9 @@ bool EQEmu::PFS::Archive::StoreBlocksByFileOffset(uint32_t offset, uint32_t size
 	}
 
 	block_size = position - offset;
+	if (position > in_buffer.size()) {
+		return false;
+	}
 
 	std::vector<char> tbuffer;
 	tbuffer.resize(block_size);
@@ -361,28 +668,6 @@ bool EQEmu::PFS::Archive::StoreBlocksByFileOffset(uint32_t offset, uint32_t size
 	return true;
 }
 
-bool EQEmu::PFS::Archive::InflateByFileOffset(uint32_t offset, uint32_t size, const std::vector<char> &in_buffer, std::vector<char> &out_buffer) {
-	out_buffer.resize(size);
-	memset(&out_buffer[0], 0, size);
-
-	uint32_t position = offset;
-	uint32_t inflate = 0;
-
-	while (inflate < size) {
-		std::vector<char> temp_buffer;
-		ReadFromBuffer(uint32_t, deflate_length, in_buffer, position);
-		ReadFromBuffer(uint32_t, inflate_length, in_buffer, position + 4);
-		temp_buffer.resize(deflate_length + 1);
-		ReadFromBufferLength(&temp_buffer[0], deflate_length, in_buffer, position + 8);
-
-		EQEmu::InflateData(&temp_buffer[0], deflate_length, &out_buffer[inflate], inflate_length);
-		inflate += inflate_length;
-		position += deflate_length + 8;
-	}
-
-	return true;
-}
-
 bool EQEmu::PFS::Archive::WriteDeflatedFileBlock(const std::vector<char> &file, std::vector<char> &out_buffer) {
 	uint32_t pos = 0;
 	uint32_t remain = (uint32_t)file.size();
@@ -5,6 +5,8 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <memory>
 
 namespace EQEmu
 {
@@ -12,6 +14,8 @@ namespace EQEmu
 namespace PFS
 {
 
+class MappedArchiveFile;
+
 class Archive
 {
 public:
@@ -21,20 +25,36 @@ public:
 	bool Open();
 	bool Open(uint32_t date);
 	bool Open(std::string filename);
+	//maps the archive instead of reading it in, files are inflated from the mapping when
+	//asked for. The archive can't be changed or saved.
+	bool OpenReadOnly(std::string filename);
 	bool Save(std::string filename);
 	void Close();
 	bool Get(std::string filename, std::vector<char> &buf);
+	//inflates several files at once. Files that aren't found are left empty and
+	//false is returned.
+	bool Get(const std::vector<std::string> &filenames, std::vector<std::vector<char>> &bufs);
 	bool Set(std::string filename, const std::vector<char> &buf);
 	bool Delete(std::string filename);
 	bool Rename(std::string filename, std::string filename_new);
 	bool Exists(std::string filename);
 	bool GetFilenames(std::string ext, std::vector<std::string> &out_files);
 private:
-	bool StoreBlocksByFileOffset(uint32_t offset, uint32_t size, const std::vector<char> &in_buffer, std::string filename);
-	bool InflateByFileOffset(uint32_t offset, uint32_t size, const std::vector<char> &in_buffer, std::vector<char> &out_buffer);
+	struct MappedEntry
+	{
+		uint32_t offset;
+		uint32_t size;
+	};
+
+	bool GetFile(std::string filename, std::vector<char> &buf, bool parallel) const;
+	bool ReadDirectory(const char *data, size_t data_size, bool read_only);
+	bool StoreBlocksByFileOffset(uint32_t offset, uint32_t size, const char *in_buffer, size_t in_size, std::string filename);
 	bool WriteDeflatedFileBlock(const std::vector<char> &file, std::vector<char> &out_buffer);
 	std::map<std::string, std::vector<char>> files;
 	std::map<std::string, uint32_t> files_uncompressed_size;
+	//read only archives only index the files and keep the archive mapped
+	std::shared_ptr<MappedArchiveFile> mapped;
+	std::unordered_map<std::string, MappedEntry> mapped_files;
 	bool footer;
 	uint32_t footer_date;
 };
@@ -17,14 +17,35 @@ EQEmu::S3DLoader::S3DLoader() {
 EQEmu::S3DLoader::~S3DLoader() {
 }
 
+static bool IsGeometryFragment(uint32_t id) {
+	switch (id) {
+		case 0x10: //skeleton
+		case 0x11: //skeleton reference
+		case 0x12: //bone orientation
+		case 0x13: //bone orientation reference
+		case 0x14: //model
+		case 0x15: //placement
+		case 0x2D: //mesh reference
+		case 0x36: //mesh
+			return true;
+		default:
+			return false;
+	}
+}
+
 bool EQEmu::S3DLoader::ParseWLDFile(std::string file_name, std::string wld_name, std::vector<S3D::WLDFragment> &out) {
+	return ParseWLDFile(file_name, wld_name, out, false);
+}
+
+bool EQEmu::S3DLoader::ParseWLDFile(std::string file_name, std::string wld_name, std::vector<S3D::WLDFragment> &out,
+	bool geometry_only, const FragmentCallback &callback) {
 	out.clear();
 	std::vector<char> buffer;
 	char *current_hash;
 	bool old = false;
 
 	EQEmu::PFS::Archive archive;
-	if (!archive.Open(file_name)) {
+	if (!archive.OpenReadOnly(file_name)) {
 		eqLogMessage(LogDebug, "Unable to open file %s.", file_name.c_str());
 		return false;
 	}
@@ -56,8 +77,13 @@ bool EQEmu::S3DLoader::ParseWLDFile(std::string file_name, std::string wld_name,
 	for (uint32_t i = 0; i < header->fragments; ++i) {
 		SafeStructAllocParse(wld_fragment_header, frag_header);
 
+		uint32_t frag_id = frag_header->id;
+		if (geometry_only && !IsGeometryFragment(frag_id)) {
+			frag_id = 0;
+		}
+
 		eqLogMessage(LogTrace, "Dispatching WLD fragment of type %x", frag_header->id);
-		switch (frag_header->id) {
+		switch (frag_id) {
 			case 0x03: {
 				S3D::WLDFragment03 f(out, &buffer[idx], frag_header->size, frag_header->name_ref, current_hash, old);
 				f.type = frag_header->id;
@@ -200,6 +226,10 @@ bool EQEmu::S3DLoader::ParseWLDFile(std::string file_name, std::string wld_name,
 				break;
 		}
 
+		if (callback && frag_id != 0 && callback(i, out.back())) {
+			out.back().data = EQEmu::Any();
+		}
+
 		idx += frag_header->size - 4;
 	}
 
@@ -4,6 +4,7 @@
 #include <vector>
 #include <stdint.h>
 #include <string>
+#include <functional>
 #include "wld_fragment.h"
 
 void decode_string_hash(char *str, size_t len);
@@ -14,9 +15,18 @@ namespace EQEmu
 class S3DLoader
 {
 public:
+	//called with each fragment as soon as it's decoded. Returning true consumes the
+	//fragment, only its type and name are kept in the list.
+	typedef std::function<bool(uint32_t index, S3D::WLDFragment &frag)> FragmentCallback;
+
 	S3DLoader();
 	~S3DLoader();
 	bool ParseWLDFile(std::string file_name, std::string wld_name, std::vector<S3D::WLDFragment> &out);
+	//with geometry_only set, only meshes, placements, skeletons and the references between
+	//them are decoded. Texture, material, light and bsp fragments are left as placeholders,
+	//so fragments still line up with the indices that refer to them.
+	bool ParseWLDFile(std::string file_name, std::string wld_name, std::vector<S3D::WLDFragment> &out,
+		bool geometry_only, const FragmentCallback &callback = FragmentCallback());
 };
 
 }
@@ -10,9 +10,13 @@
 #include "water_map_v2.h"
 
 WaterMap* WaterMap::LoadWaterMapfile(std::string zone_name) {
+	return LoadWaterMapfile("maps", zone_name);
+}
+
+WaterMap* WaterMap::LoadWaterMapfile(const std::string &folder, std::string zone_name) {
 	std::transform(zone_name.begin(), zone_name.end(), zone_name.begin(), ::tolower);
 		
-	std::string file_path = "maps" + std::string("/") + zone_name + std::string(".wtr");
+	std::string file_path = folder + std::string("/") + zone_name + std::string(".wtr");
 	FILE *f = fopen(file_path.c_str(), "rb");
 	if(f) {
 		char magic[10];
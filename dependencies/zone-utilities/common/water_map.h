@@ -24,6 +24,7 @@ public:
 	~WaterMap() { }
 	
 	static WaterMap* LoadWaterMapfile(std::string zone_name);
+	static WaterMap* LoadWaterMapfile(const std::string &folder, std::string zone_name);
 	virtual WaterRegionType ReturnRegionType(float y, float x, float z) const { return RegionTypeNormal; }
 	virtual bool InWater(float y, float x, float z) const { return false; }
 	virtual bool InVWater(float y, float x, float z) const { return false; }
@@ -8,8 +8,10 @@
 
 #include "ImGuiSDL.h"
 #include "InputGeom.h"
+#include "MeshDirectoryScan.h"
 #include "NavMeshTool.h"
 #include "ZonePicker.h"
+#include "common/Profiler.h"
 #include "common/Utilities.h"
 
 #include "resource.h"
@@ -30,6 +32,8 @@
 
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
+#include <algorithm>
+#include <iterator>
 #include <sstream>
 
 #pragma warning(push)
@@ -41,6 +45,12 @@ namespace fs = boost::filesystem;
 
 static const int32_t MAX_LOG_MESSAGES = 1000;
 
+// build contexts are told apart by id, a new one can get the address of an old one
+static std::atomic<uint32_t> s_nextBuildContextId{ 1 };
+
+// timers are started and stopped on the same thread
+static thread_local std::chrono::steady_clock::time_point t_timerStart[RC_MAX_TIMERS];
+
 static bool IsKeyboardBlocked() {
 	return ImGui::GetIO().WantCaptureKeyboard || ImGui::GetIO().WantTextInput;
 }
@@ -61,6 +71,18 @@ Application::Application(const std::string& defaultZone)
 	m_meshTool->setContext(m_rcContext.get());
 	m_meshTool->setOutputPath(m_eqConfig.GetOutputPath().c_str());
 
+	// asked for from the tools, the load starts from the main loop
+	m_meshTool->setGeometryRequest([this]() { PushEvent([this]() { LoadMeshGeometry(); }); });
+
+	// meshes are loaded to be edited, which can add tiles, and saved again with
+	// all of their agent profiles
+	m_navMesh->SetKeepBuildCapacity(true);
+	m_navMesh->SetLoadAgentMeshes(true);
+
+	// ready by the time the zone picker is opened
+	m_meshScan = std::make_unique<MeshDirectoryScan>(m_eqConfig.GetEverquestPath(), m_eqConfig.GetOutputPath());
+	m_meshScan->Start();
+
 	// Construct the path to the ini file
 	CHAR fullPath[MAX_PATH] = { 0 };
 	GetModuleFileNameA(NULL, fullPath, MAX_PATH);
@@ -75,6 +97,7 @@ Application::Application(const std::string& defaultZone)
 
 Application::~Application()
 {
+	FinishSaveMesh(true);
 	DestroyWindow();
 }
 
@@ -201,6 +224,7 @@ int Application::RunMainLoop()
 		m_raye = glm::unProject(glm::vec3{ m_m.x, m_m.y, 1.0f }, m_model, m_proj, m_view);
 
 		DispatchCallbacks();
+		FinishSaveMesh(false);
 
 		// Handle input events.
 		HandleEvents();
@@ -213,6 +237,10 @@ int Application::RunMainLoop()
 
 			UpdateCamera();
 
+			// safe point for the tiles of a background build to go into the navmesh
+			m_meshTool->setCameraPos(m_cam);
+			m_meshTool->publishBuiltTiles(true);
+
 			glEnable(GL_FOG);
 			m_meshTool->handleRender();
 			glDisable(GL_FOG);
@@ -225,21 +253,30 @@ int Application::RunMainLoop()
 
 		// Do additional work here after rendering
 
-		// Load a zone if a zone load was requested
-		if (!m_nextZoneToLoad.empty())
+		// Load a zone if a zone load was requested. Wait for the one in progress
+		// to finish first.
+		if (!m_nextZoneToLoad.empty() && !m_loadingZone)
 		{
-			PushEvent([zone = m_nextZoneToLoad, loadMesh = m_loadMeshOnZone, this]()
+			PushEvent([zone = m_nextZoneToLoad, loadMesh = m_loadMeshOnZone, meshOnly = m_meshOnlyOnZone, this]()
 			{
-				LoadGeometry(zone, loadMesh);
+				if (meshOnly)
+					OpenMeshOnly(zone);
+				else
+					LoadGeometry(zone, loadMesh);
 			});
 
 			m_loadMeshOnZone = false;
+			m_meshOnlyOnZone = false;
 			m_nextZoneToLoad.clear();
 		}
 	}
 
 	Halt();
 
+	if (m_loadThread.joinable())
+		m_loadThread.join();
+
+	m_loadedGeom.reset();
 	m_geom.reset();
 	return 0;
 }
@@ -299,6 +336,15 @@ void Application::HandleEvents()
 				case SDLK_COMMA:
 					m_showSettingsDialog = true;
 					break;
+
+				case SDLK_z:
+					if (m_meshTool->canUndo())
+						m_meshTool->undo();
+					break;
+				case SDLK_y:
+					if (m_meshTool->canRedo())
+						m_meshTool->redo();
+					break;
 				default:
 					//printf("key: %d", event.key.keysym.sym);
 					break;
@@ -350,11 +396,13 @@ void Application::HandleEvents()
 			else if (event.button.button == SDL_BUTTON_LEFT)
 			{
 				// Hit test mesh.
-				if (m_geom)
+				if (m_geom || m_meshOnly)
 				{
-					// Hit test mesh.
+					// Hit test mesh, or the navmesh when there's no geometry
 					float t;
-					if (m_geom->raycastMesh(glm::value_ptr(m_rays), glm::value_ptr(m_raye), t))
+					bool hit = m_geom ? m_geom->raycastMesh(glm::value_ptr(m_rays), glm::value_ptr(m_raye), t)
+						: m_meshTool->raycastNavMesh(m_rays, m_raye, t);
+					if (hit)
 					{
 						if (SDL_GetModState() & KMOD_CTRL)
 						{
@@ -466,6 +514,9 @@ void Application::UpdateCamera()
 
 	m_cam.z += dp.x * m_model[2][0];
 	m_cam.z += dp.y * m_model[2][2];
+
+	// this frame is still drawn with the matrices from before the camera moved
+	m_meshTool->setViewFrustum(m_proj * m_model);
 }
 
 void Application::RenderInterface()
@@ -489,6 +540,19 @@ void Application::RenderInterface()
 			ImColor(255, 255, 255, 128), m_activityMessage.c_str(), m_progress);
 	}
 
+	if (m_loadingZone)
+	{
+		ImGui::RenderTextCentered(ImVec2(m_width / 2, m_height / 2 - 20),
+			ImColor(255, 255, 255, 200), "Loading %s...", m_loadingZoneName.c_str());
+
+		std::string progress = m_rcContext->getLastProgressText();
+		if (!progress.empty())
+		{
+			ImGui::RenderTextCentered(ImVec2(m_width / 2, m_height / 2),
+				ImColor(255, 255, 255, 128), "%s", progress.c_str());
+		}
+	}
+
 	m_showFailedToOpenDialog = false;
 
 	if (ImGui::BeginMainMenuBar())
@@ -496,7 +560,7 @@ void Application::RenderInterface()
 		if (ImGui::BeginMenu("File"))
 		{
 			if (ImGui::MenuItem("Open Zone", "Ctrl+O", nullptr,
-				!m_meshTool->isBuildingTiles()))
+				!m_meshTool->isBuildingTiles() && !m_loadingZone))
 			{
 				m_showZonePickerDialog = true;
 			}
@@ -527,6 +591,12 @@ void Application::RenderInterface()
 			{
 				SaveMesh();
 			}
+			if (ImGui::MenuItem("Save Patch", "", nullptr,
+				!m_meshTool->isBuildingTiles() && m_navMesh->IsNavMeshLoaded()
+				&& fs::exists(m_navMesh->GetDataFileName())))
+			{
+				SaveMeshPatch();
+			}
 			if (ImGui::MenuItem("Reset Mesh", "", nullptr,
 				!m_meshTool->isBuildingTiles() && m_navMesh->IsNavMeshLoaded()))
 			{
@@ -553,6 +623,18 @@ void Application::RenderInterface()
 
 		if (ImGui::BeginMenu("Edit"))
 		{
+			const TileUndoStack& undoStack = m_meshTool->getUndoStack();
+
+			std::string undoLabel = "Undo " + undoStack.GetUndoLabel();
+			if (ImGui::MenuItem(undoLabel.c_str(), "Ctrl+Z", nullptr, m_meshTool->canUndo()))
+				m_meshTool->undo();
+
+			std::string redoLabel = "Redo " + undoStack.GetRedoLabel();
+			if (ImGui::MenuItem(redoLabel.c_str(), "Ctrl+Y", nullptr, m_meshTool->canRedo()))
+				m_meshTool->redo();
+
+			ImGui::Separator();
+
 			if (ImGui::MenuItem("Area Types"))
 				m_showMapAreas = !m_showMapAreas;
 
@@ -667,8 +749,47 @@ void Application::RenderInterface()
 
 			ImGui::Text("Verts: %.1fk Tris: %.1fk", loader->getVertCount() / 1000.0f, loader->getTriCount() / 1000.0f);
 
+			const MeshInstances& instances = loader->getInstances();
+			if (!instances.IsEmpty())
+			{
+				ImGui::Text("Placed models: %d of %d models, %.1fk tris", instances.GetInstanceCount(),
+					instances.GetModelCount(), instances.GetInstancedTriCount() / 1000.0f);
+			}
+
+			if (m_navMesh->IsNavMeshLoaded())
+			{
+				if (ImGui::Button(ICON_FA_FLOPPY_O " Save"))
+					SaveMesh();
+
+				ImGui::SameLine();
+				if (ImGui::Button("Unload Geometry") && !m_meshTool->isBuildingTiles()
+					&& m_meshTool->getPendingRebuilds() == 0)
+				{
+					UnloadMeshGeometry();
+				}
+
+				if (ImGui::IsItemHovered())
+				{
+					ImGui::BeginTooltip();
+					ImGui::Text("Frees the memory of the zone geometry and keeps\n"
+						"the navmesh open. It's loaded again the next time\n"
+						"tiles are built.");
+					ImGui::EndTooltip();
+				}
+			}
+		}
+		else if (m_meshOnly)
+		{
+			ImGui::TextColored(ImColor(255, 255, 0), "Mesh only, zone geometry not loaded");
+
+			if (m_loadingZone)
+				ImGui::Text("Loading geometry...");
+			else if (ImGui::Button("Load Geometry"))
+				LoadMeshGeometry();
+
 			if (m_navMesh->IsNavMeshLoaded())
 			{
+				ImGui::SameLine();
 				if (ImGui::Button(ICON_FA_FLOPPY_O " Save"))
 					SaveMesh();
 			}
@@ -691,15 +812,13 @@ void Application::RenderInterface()
 
 		ImGui::GetStyle().WindowRounding = oldWindowRounding;
 
-		if (m_geom)
+		if (m_geom || m_meshOnly)
 		{
 			if (m_meshTool->isBuildingTiles())
 			{
-				int tw, th, tm;
-				m_meshTool->getTileStatistics(tw, th, tm);
-				int tt = tw*th;
+				int tt = m_meshTool->getTilesToBuild();
 
-				float percent = (float)m_meshTool->getTilesBuilt() / (float)tt;
+				float percent = tt > 0 ? (float)m_meshTool->getTilesBuilt() / (float)tt : 0.0f;
 
 				char szProgress[256];
 				sprintf_s(szProgress, "%d of %d (%.2f%%)", m_meshTool->getTilesBuilt(), tt, percent * 100);
@@ -800,7 +919,59 @@ void Application::SaveMesh()
 	if (m_meshTool->isBuildingTiles() || !m_navMesh->IsNavMeshLoaded())
 		return;
 
-	m_navMesh->SaveNavMeshFile();
+	// one save at a time, so they land in the order they were made
+	FinishSaveMesh(true);
+
+	// tiles that are still waiting for their detail are saved with it
+	m_meshTool->waitForRebuilds();
+
+	// the mesh is saved either way, tiles with issues are listed to be rebuilt
+	m_meshTool->validateNavMesh();
+
+	m_saveResult = m_navMesh->SaveNavMeshFileAsync();
+}
+
+void Application::SaveMeshPatch()
+{
+	if (m_meshTool->isBuildingTiles() || !m_navMesh->IsNavMeshLoaded())
+		return;
+
+	// the patch is made against the file as it is on disk
+	FinishSaveMesh(true);
+	m_meshTool->waitForRebuilds();
+
+	// kept away from the mesh files, a patch next to one is applied to it when
+	// the mesh is loaded
+	fs::path meshFile = m_navMesh->GetDataFileName();
+	fs::path patchFile = meshFile.parent_path() / "patches";
+
+	boost::system::error_code ec;
+	fs::create_directories(patchFile, ec);
+	patchFile /= m_navMesh->GetZoneName() + NAVMESH_PATCH_EXTENSION;
+
+	if (m_navMesh->SaveMeshPatch(patchFile.string(), meshFile.string()))
+		m_rcContext->log(RC_LOG_PROGRESS, "Saved navmesh patch to %s", patchFile.string().c_str());
+	else
+		m_rcContext->log(RC_LOG_ERROR, "Failed to save navmesh patch");
+}
+
+void Application::FinishSaveMesh(bool wait)
+{
+	if (!m_saveResult.valid())
+		return;
+
+	if (!wait && m_saveResult.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		return;
+
+	if (m_saveResult.get())
+	{
+		m_rcContext->log(RC_LOG_PROGRESS, "Saved navmesh");
+
+		// the picker shows the new stats of the mesh
+		m_meshScan->Start();
+	}
+	else
+		m_rcContext->log(RC_LOG_ERROR, "Failed to save navmesh");
 }
 
 void Application::ShowSettingsDialog()
@@ -839,12 +1010,19 @@ void Application::ShowZonePickerDialog()
 	if (m_showZonePickerDialog) {
 		bool focus = false;
 		if (!m_zonePicker) {
-			m_zonePicker = std::make_unique<ZonePicker>(m_eqConfig);
+			if (!m_meshScan->IsScanOf(m_eqConfig.GetEverquestPath(), m_eqConfig.GetOutputPath()))
+			{
+				m_meshScan = std::make_unique<MeshDirectoryScan>(m_eqConfig.GetEverquestPath(), m_eqConfig.GetOutputPath());
+				m_meshScan->Start();
+			}
+
+			m_zonePicker = std::make_unique<ZonePicker>(m_eqConfig, *m_meshScan);
 			focus = true;
 			ImGui::SetNextWindowFocus();
 		}
 		if (m_zonePicker->Show(focus, &m_nextZoneToLoad)) {
 			m_loadMeshOnZone = m_zonePicker->ShouldLoadNavMesh();
+			m_meshOnlyOnZone = m_zonePicker->ShouldOpenMeshOnly();
 			m_showZonePickerDialog = false;
 		}
 	}
@@ -994,6 +1172,7 @@ void Application::DrawAreaTypesEditor()
 	RenderAreaType(m_navMesh.get(), m_navMesh->GetPolyArea((uint8_t)PolyArea::Ground));
 	RenderAreaType(m_navMesh.get(), m_navMesh->GetPolyArea((uint8_t)PolyArea::Jump));
 	RenderAreaType(m_navMesh.get(), m_navMesh->GetPolyArea((uint8_t)PolyArea::Water));
+	RenderAreaType(m_navMesh.get(), m_navMesh->GetPolyArea((uint8_t)PolyArea::Door));
 
 	ImGui::Separator();
 
@@ -1024,10 +1203,10 @@ void Application::DrawAreaTypesEditor()
 void Application::ResetCamera()
 {
 	// Camera Reset
-	if (m_geom)
+	if (m_geom || m_meshOnly)
 	{
-		const glm::vec3& bmin = m_geom->getMeshBoundsMin();
-		const glm::vec3& bmax = m_geom->getMeshBoundsMax();
+		const glm::vec3& bmin = m_geom ? m_geom->getMeshBoundsMin() : m_navMesh->GetNavMeshBoundsMin();
+		const glm::vec3& bmax = m_geom ? m_geom->getMeshBoundsMax() : m_navMesh->GetNavMeshBoundsMax();
 
 		// Reset camera and fog to match the mesh bounds.
 		m_camr = sqrtf(rcSqr(bmax[0] - bmin[0]) +
@@ -1061,12 +1240,63 @@ void Application::Halt()
 
 void Application::LoadGeometry(const std::string& zoneShortName, bool loadMesh)
 {
+	if (m_loadThread.joinable())
+		m_loadThread.join();
+
+	m_loadingZone = true;
+	m_loadingZoneName = m_eqConfig.GetLongNameForShortName(zoneShortName);
+
+	// the loader only touches its own InputGeom, so the current zone can keep
+	// rendering while it works.
+	m_loadThread = std::thread([this, zoneShortName, loadMesh]()
+	{
+		m_rcContext->log(RC_LOG_PROGRESS, "Loading geometry for '%s'", zoneShortName.c_str());
+
+		m_loadedGeom = std::make_unique<InputGeom>(zoneShortName,
+			m_eqConfig.GetEverquestPath(), m_eqConfig.GetOutputPath());
+		bool loaded = m_loadedGeom->loadGeometry(m_rcContext.get());
+
+		PushEvent([this, zoneShortName, loaded, loadMesh]()
+		{
+			FinishLoadGeometry(zoneShortName, loaded, loadMesh);
+		});
+	});
+}
+
+void Application::FinishLoadGeometry(const std::string& zoneShortName, bool loaded, bool loadMesh)
+{
+	// the thread is done with m_loadedGeom once it has queued this
+	if (m_loadThread.joinable())
+		m_loadThread.join();
+
+	std::unique_ptr<InputGeom> ptr = std::move(m_loadedGeom);
+	m_loadingZone = false;
+
 	std::unique_lock<std::mutex> lock(m_renderMutex);
 
+	// the geometry of the mesh that is open, the mesh and the edits to it stay
+	if (m_meshOnly && zoneShortName == m_zoneShortname)
+	{
+		if (!loaded)
+		{
+			m_showFailedToLoadZone = true;
+			m_failedZoneMsg = "Failed to load the geometry of " + m_zoneLongname;
+
+			// tiles waiting for it won't be built
+			m_meshTool->attachGeometry(nullptr);
+			return;
+		}
+
+		m_geom = std::move(ptr);
+		m_meshOnly = false;
+		m_meshTool->attachGeometry(m_geom.get());
+		return;
+	}
+
 	Halt();
+	m_meshOnly = false;
 
-	auto ptr = std::make_unique<InputGeom>(zoneShortName, m_eqConfig.GetEverquestPath(), m_eqConfig.GetOutputPath());
-	if (!ptr->loadGeometry(m_rcContext.get()))
+	if (!loaded)
 	{
 		m_showFailedToLoadZone = true;
 
@@ -1084,6 +1314,70 @@ void Application::LoadGeometry(const std::string& zoneShortName, bool loadMesh)
 
 	m_geom = std::move(ptr);
 
+	SetZone(zoneShortName);
+	m_meshTool->handleGeometryChanged(m_geom.get());
+
+	if (loadMesh)
+	{
+		m_navMesh->LoadNavMeshFile();
+	}
+}
+
+void Application::OpenMeshOnly(const std::string& zoneShortName)
+{
+	// a zone that is still loading would replace the mesh when it's done
+	if (m_loadingZone)
+		return;
+
+	std::unique_lock<std::mutex> lock(m_renderMutex);
+
+	Halt();
+
+	m_geom.reset();
+	m_meshTool->handleGeometryChanged(nullptr);
+
+	SetZone(zoneShortName);
+
+	if (m_navMesh->LoadNavMeshFile() != NavMesh::LoadResult::Success)
+	{
+		m_showFailedToLoadZone = true;
+		m_failedZoneMsg = "Failed to open the navmesh of " + m_zoneLongname;
+		m_zoneLoaded = false;
+		return;
+	}
+
+	m_meshOnly = true;
+	m_rcContext->log(RC_LOG_PROGRESS, "Opened the navmesh of '%s' without its geometry", zoneShortName.c_str());
+}
+
+void Application::LoadMeshGeometry()
+{
+	if (!m_meshOnly || m_loadingZone)
+		return;
+
+	LoadGeometry(m_zoneShortname, false);
+}
+
+void Application::UnloadMeshGeometry()
+{
+	// tiles being built are reading it
+	if (!m_geom || m_loadingZone || !m_navMesh->IsNavMeshLoaded()
+		|| m_meshTool->isBuildingTiles() || m_meshTool->getPendingRebuilds() > 0)
+	{
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(m_renderMutex);
+
+	m_meshTool->attachGeometry(nullptr);
+	m_geom.reset();
+	m_meshOnly = true;
+
+	m_rcContext->log(RC_LOG_PROGRESS, "Unloaded the geometry of '%s', the navmesh stays open", m_zoneShortname.c_str());
+}
+
+void Application::SetZone(const std::string& zoneShortName)
+{
 	m_zoneShortname = zoneShortName;
 	m_zoneLongname = m_eqConfig.GetLongNameForShortName(m_zoneShortname);
 
@@ -1098,15 +1392,9 @@ void Application::LoadGeometry(const std::string& zoneShortName, bool loadMesh)
 	std::string windowTitle = ss2.str();
 	SDL_SetWindowTitle(m_window, windowTitle.c_str());
 
-	m_meshTool->handleGeometryChanged(m_geom.get());
 	m_navMesh->SetZoneName(m_zoneShortname);
 	m_resetCamera = true;
 	m_zoneLoaded = true;
-
-	if (loadMesh)
-	{
-		m_navMesh->LoadNavMeshFile();
-	}
 }
 
 void Application::PushEvent(const std::function<void()>& cb)
@@ -1134,6 +1422,7 @@ void Application::DispatchCallbacks()
 
 BuildContext::BuildContext(Context* context)
 	: m_context(context)
+	, m_id(s_nextBuildContextId++)
 {
 	resetTimers();
 }
@@ -1144,11 +1433,78 @@ BuildContext::~BuildContext()
 
 //----------------------------------------------------------------------------
 
+BuildContext::ThreadLog& BuildContext::getThreadLog()
+{
+	static thread_local uint32_t t_contextId = 0;
+	static thread_local ThreadLog* t_threadLog = nullptr;
+
+	if (t_contextId != m_id)
+	{
+		std::unique_lock<std::mutex> lock(m_threadLogsMtx);
+
+		std::unique_ptr<ThreadLog>& threadLog = m_threadLogs[std::this_thread::get_id()];
+		if (!threadLog)
+			threadLog = std::make_unique<ThreadLog>();
+
+		t_contextId = m_id;
+		t_threadLog = threadLog.get();
+	}
+
+	return *t_threadLog;
+}
+
+void BuildContext::mergeLogs() const
+{
+	std::unique_lock<std::mutex> lock(m_mtx);
+
+	std::vector<ThreadLog::Entry> entries;
+	{
+		std::unique_lock<std::mutex> threadLogsLock(m_threadLogsMtx);
+
+		for (const auto& p : m_threadLogs)
+		{
+			std::unique_lock<std::mutex> threadLock(p.second->mtx);
+
+			std::move(p.second->entries.begin(), p.second->entries.end(), std::back_inserter(entries));
+			p.second->entries.clear();
+		}
+	}
+
+	std::sort(entries.begin(), entries.end(),
+		[](const ThreadLog::Entry& a, const ThreadLog::Entry& b) { return a.sequence < b.sequence; });
+
+	for (ThreadLog::Entry& entry : entries)
+	{
+		if (entry.category == RC_LOG_PROGRESS)
+			m_lastProgress = entry.text;
+
+		// if the message buffer is full, the newest message takes the place of the oldest
+		if (m_logs.size() < MAX_LOG_MESSAGES)
+		{
+			m_logs.push_back(std::move(entry.text));
+		}
+		else
+		{
+			m_logs[m_logStart] = std::move(entry.text);
+			m_logStart = (m_logStart + 1) % m_logs.size();
+		}
+	}
+}
+
 void BuildContext::doResetLog()
 {
 	std::unique_lock<std::mutex> lock(m_mtx);
 
 	m_logs.clear();
+	m_logStart = 0;
+	m_lastProgress.clear();
+
+	std::unique_lock<std::mutex> threadLogsLock(m_threadLogsMtx);
+	for (const auto& p : m_threadLogs)
+	{
+		std::unique_lock<std::mutex> threadLock(p.second->mtx);
+		p.second->entries.clear();
+	}
 }
 
 void BuildContext::doLog(const rcLogCategory category,
@@ -1157,13 +1513,17 @@ void BuildContext::doLog(const rcLogCategory category,
 	if (!length)
 		return;
 
-	std::unique_lock<std::mutex> lock(m_mtx);
+	{
+		ThreadLog& threadLog = getThreadLog();
+		std::unique_lock<std::mutex> lock(threadLog.mtx);
 
-	// if the message buffer is full, drop an old message
-	if (m_logs.size() > MAX_LOG_MESSAGES)
-		m_logs.pop_front();
+		// nobody is reading the log, keep the newest
+		if (threadLog.entries.size() >= MAX_LOG_MESSAGES)
+			threadLog.entries.pop_front();
 
-	m_logs.emplace_back(std::string(message, static_cast<std::size_t>(length)));
+		threadLog.entries.push_back({ m_logSequence++, category,
+			std::string(message, static_cast<std::size_t>(length)) });
+	}
 
 	LogLevel level = LogLevel::DEBUG;
 	switch (category)
@@ -1196,13 +1556,15 @@ void BuildContext::dumpLog(const char* format, ...)
 	va_end(ap);
 	printf("\n");
 
+	mergeLogs();
+
 	std::unique_lock<std::mutex> lock(m_mtx);
 
 	// Print messages
 	const int TAB_STOPS[4] = { 28, 36, 44, 52 };
-	for (auto& message : m_logs)
+	for (size_t i = 0; i < m_logs.size(); ++i)
 	{
-		const char* msg = message.c_str();
+		const char* msg = m_logs[(m_logStart + i) % m_logs.size()].c_str();
 		int n = 0;
 		while (*msg)
 		{
@@ -1239,13 +1601,24 @@ const char* BuildContext::getLogText(int32_t index) const
 	std::unique_lock<std::mutex> lock(m_mtx);
 
 	if (index >= 0 && index < (int32_t)m_logs.size())
-		return m_logs[index].c_str();
+		return m_logs[(m_logStart + index) % m_logs.size()].c_str();
 
 	return nullptr;
 }
 
+std::string BuildContext::getLastProgressText() const
+{
+	mergeLogs();
+
+	std::unique_lock<std::mutex> lock(m_mtx);
+
+	return m_lastProgress;
+}
+
 int BuildContext::getLogCount() const
 {
+	mergeLogs();
+
 	std::unique_lock<std::mutex> lock(m_mtx);
 
 	return (int)m_logs.size();
@@ -1256,26 +1629,62 @@ int BuildContext::getLogCount() const
 void BuildContext::doResetTimers()
 {
 	for (int i = 0; i < RC_MAX_TIMERS; ++i)
-		m_accTime[i] = std::chrono::nanoseconds();
+		m_accTime[i] = 0;
 }
 
+#if defined(MQ2NAV_PROFILE)
+// the recast stages as profiler zones, in rcTimerLabel order
+static const char* s_timerZoneNames[RC_MAX_TIMERS] = {
+	"recast: total",
+	"recast: temp",
+	"recast: rasterize triangles",
+	"recast: build compact heightfield",
+	"recast: build contours",
+	"recast: build contours trace",
+	"recast: build contours simplify",
+	"recast: filter border",
+	"recast: filter walkable",
+	"recast: median area",
+	"recast: filter low obstacles",
+	"recast: build polymesh",
+	"recast: merge polymesh",
+	"recast: erode area",
+	"recast: mark box area",
+	"recast: mark cylinder area",
+	"recast: mark convex poly area",
+	"recast: build distance field",
+	"recast: build distance field dist",
+	"recast: build distance field blur",
+	"recast: build regions",
+	"recast: build regions watershed",
+	"recast: build regions expand",
+	"recast: build regions flood",
+	"recast: build regions filter",
+	"recast: build layers",
+	"recast: build polymesh detail",
+	"recast: merge polymesh detail",
+};
+#endif
+
 void BuildContext::doStartTimer(const rcTimerLabel label)
 {
-	m_startTime[label] = std::chrono::steady_clock::now();
+	MQ2NAV_PROFILE_BEGIN(s_timerZoneNames[label]);
+	t_timerStart[label] = std::chrono::steady_clock::now();
 }
 
 void BuildContext::doStopTimer(const rcTimerLabel label)
 {
+	MQ2NAV_PROFILE_END(s_timerZoneNames[label]);
 	auto endTime = std::chrono::steady_clock::now();
-	auto deltaTime = endTime - m_startTime[label];
+	auto deltaTime = std::chrono::duration_cast<std::chrono::nanoseconds>(endTime - t_timerStart[label]);
 
-	m_accTime[label] += deltaTime;
+	// the time of every worker adds up
+	m_accTime[label].fetch_add(deltaTime.count(), std::memory_order_relaxed);
 }
 
 int BuildContext::doGetAccumulatedTime(const rcTimerLabel label) const
 {
-	return std::chrono::duration_cast<std::chrono::microseconds>(
-		m_accTime[label]).count();
+	return static_cast<int>(m_accTime[label].load(std::memory_order_relaxed) / 1000);
 }
 
 void ApplicationContext::Log(LogLevel level, const char* szFormat, ...)
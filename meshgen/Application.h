@@ -15,7 +15,9 @@
 #include <SDL.h>
 #include <glm/glm.hpp>
 
+#include <atomic>
 #include <cstdio>
+#include <future>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -24,12 +26,15 @@
 #include <mutex>
 #include <thread>
 #include <chrono>
+#include <unordered_map>
+#include <vector>
 
 class BuildContext;
 class InputGeom;
 class NavMeshTool;
 struct SDL_Surface;
 class ApplicationContext;
+class MeshDirectoryScan;
 class ZonePicker;
 class ImportExportSettingsDialog;
 
@@ -60,8 +65,20 @@ private:
 
 	void DispatchCallbacks();
 
-	// Load a zone's geometry given its shortname.
+	// Load a zone's geometry given its shortname. The geometry is loaded on a
+	// worker thread, the current zone stays up until it is done.
 	void LoadGeometry(const std::string& zoneShortName, bool loadMesh);
+	void FinishLoadGeometry(const std::string& zoneShortName, bool loaded, bool loadMesh);
+
+	// Open a zone's navmesh without its geometry. The geometry of the zone is
+	// loaded later, when the mesh tool needs it to build tiles.
+	void OpenMeshOnly(const std::string& zoneShortName);
+	void LoadMeshGeometry();
+
+	// Let go of the zone geometry of a zone with a navmesh, keeping the mesh open
+	// as if it was opened without it. It's loaded again when it's needed.
+	void UnloadMeshGeometry();
+	void SetZone(const std::string& zoneShortName);
 	void Halt();
 
 	// Reset the camera to the starting point
@@ -74,6 +91,13 @@ private:
 	void OpenMesh();
 	void SaveMesh();
 
+	// writes a patch from the saved mesh file to the mesh as it is now
+	void SaveMeshPatch();
+
+	// reports on the save in the background once it's done. With wait, waits
+	// for it first.
+	void FinishSaveMesh(bool wait);
+
 	// input event handling
 	void HandleEvents();
 
@@ -168,6 +192,10 @@ private:
 	// zone to load on next pass
 	std::string m_nextZoneToLoad;
 	bool m_loadMeshOnZone = false;
+	bool m_meshOnlyOnZone = false;
+
+	// the zone's navmesh is open without its geometry
+	bool m_meshOnly = false;
 
 	// The main window surface
 	SDL_Window* m_window = nullptr;
@@ -181,7 +209,19 @@ private:
 	// current navmesh build worker thread
 	std::thread m_buildThread;
 
+	// the mesh file that is being written in the background
+	std::future<bool> m_saveResult;
+
+	// zone geometry loading thread, and the geometry it loaded
+	std::thread m_loadThread;
+	std::atomic<bool> m_loadingZone = false;
+	std::string m_loadingZoneName;
+	std::unique_ptr<InputGeom> m_loadedGeom;
+
 	std::unique_ptr<ZonePicker> m_zonePicker;
+
+	// stats of the meshes in the output folder, shown by the zone picker
+	std::unique_ptr<MeshDirectoryScan> m_meshScan;
 	std::unique_ptr<ImportExportSettingsDialog> m_importExportSettings;
 
 
@@ -216,6 +256,14 @@ public:
 	// Returns the log message text
 	const char* getLogText(int32_t index) const;
 
+	// Returns the most recent progress message
+	std::string getLastProgressText() const;
+
+	// Moves the messages logged by the workers into the log. The log count and
+	// the texts returned by getLogText stay the same until the next merge. The
+	// getters above merge too.
+	void mergeLogs() const;
+
 protected:
 	virtual void doResetLog() override;
 	virtual void doLog(const rcLogCategory category, const char* msg, const int len) override;
@@ -225,11 +273,36 @@ protected:
 	virtual int doGetAccumulatedTime(const rcTimerLabel label) const override;
 
 private:
+	// messages from one thread that haven't been merged yet. Only that thread
+	// and the merge take the lock, so the workers don't wait on each other.
+	struct ThreadLog
+	{
+		struct Entry
+		{
+			uint32_t sequence;
+			rcLogCategory category;
+			std::string text;
+		};
+
+		std::mutex mtx;
+		std::deque<Entry> entries;
+	};
+	ThreadLog& getThreadLog();
+
 	Context* m_context;
-	std::chrono::steady_clock::time_point m_startTime[RC_MAX_TIMERS];
-	std::chrono::nanoseconds m_accTime[RC_MAX_TIMERS];
+	const uint32_t m_id;
+
+	// start times are kept per thread, see doStartTimer
+	std::atomic<int64_t> m_accTime[RC_MAX_TIMERS];
+
+	mutable std::mutex m_threadLogsMtx;
+	std::unordered_map<std::thread::id, std::unique_ptr<ThreadLog>> m_threadLogs;
+	std::atomic<uint32_t> m_logSequence{ 0 };
 
-	std::deque<std::string> m_logs;
+	// merged messages, a ring of at most MAX_LOG_MESSAGES starting at m_logStart
+	mutable std::vector<std::string> m_logs;
+	mutable size_t m_logStart = 0;
+	mutable std::string m_lastProgress;
 	mutable std::mutex m_mtx;
 };
 
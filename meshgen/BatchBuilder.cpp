@@ -0,0 +1,432 @@
+//
+// BatchBuilder.cpp
+//
+
+#include "BatchBuilder.h"
+
+#include "Application.h"
+#include "EQConfig.h"
+#include "InputGeom.h"
+#include "MapGeometryLoader.h"
+#include "NavMeshTool.h"
+#include "common/NavMesh.h"
+
+#include <boost/filesystem.hpp>
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+#include <Psapi.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#pragma comment (lib, "psapi.lib")
+
+namespace fs = boost::filesystem;
+
+// rough memory use of a build relative to the size of the input geometry. This
+// covers the chunky mesh, the finished navmesh and the tiles in flight.
+static const size_t GEOMETRY_MEMORY_FACTOR = 12;
+
+// scratch memory for each tile being built at the same time
+static const size_t TILE_MEMORY_ESTIMATE = 32 * 1024 * 1024;
+
+// zones built by the benchmark when none are given: a small and a huge zone of
+// each of the s3d, eqg and eqg v4 formats. Don't change these casually, the
+// results are only comparable as long as the set stays the same.
+static const char* s_benchmarkZones[] = {
+	"qeynos2",
+	"poknowledge",
+	"guildlobby",
+	"dragonscale",
+	"shardslanding",
+	"eastwastestwo",
+};
+
+//----------------------------------------------------------------------------
+
+static size_t GetPrivateBytes()
+{
+	PROCESS_MEMORY_COUNTERS_EX counters = { 0 };
+	if (!GetProcessMemoryInfo(GetCurrentProcess(),
+		reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&counters), sizeof(counters)))
+	{
+		return 0;
+	}
+
+	return counters.PrivateUsage;
+}
+
+// the process' own peak counters can't be reset, so sample the memory in use
+// while a zone builds to get the peak of that zone alone.
+class MemorySampler
+{
+public:
+	MemorySampler()
+		: m_baseline(GetPrivateBytes())
+		, m_peak(m_baseline)
+	{
+		m_thread = std::thread([this]()
+		{
+			while (!m_stop)
+			{
+				Sample();
+				std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			}
+		});
+	}
+
+	~MemorySampler()
+	{
+		m_stop = true;
+		m_thread.join();
+	}
+
+	void Sample()
+	{
+		size_t current = GetPrivateBytes();
+		size_t peak = m_peak;
+		while (current > peak && !m_peak.compare_exchange_weak(peak, current)) {}
+	}
+
+	size_t GetPeak() const { return m_peak > m_baseline ? m_peak - m_baseline : 0; }
+
+private:
+	size_t m_baseline;
+	std::atomic<size_t> m_peak;
+	std::atomic<bool> m_stop{ false };
+	std::thread m_thread;
+};
+
+//============================================================================
+
+BatchBuilder::BatchBuilder(EQConfig& eqConfig, Context* context)
+	: m_eqConfig(eqConfig)
+	, m_context(context)
+{
+}
+
+BatchBuilder::~BatchBuilder()
+{
+}
+
+int BatchBuilder::Run()
+{
+	m_pendingZones.clear();
+	m_failedZones.clear();
+	m_benchmarks.clear();
+
+	bool benchmark = !m_benchmarkFile.empty();
+
+	if (m_zones.empty() && benchmark)
+	{
+		m_pendingZones.assign(std::begin(s_benchmarkZones), std::end(s_benchmarkZones));
+	}
+	else if (m_zones.empty())
+	{
+		for (const auto& entry : m_eqConfig.GetAllMaps())
+			m_pendingZones.push_back(entry.first);
+	}
+	else
+	{
+		m_pendingZones.assign(m_zones.begin(), m_zones.end());
+	}
+
+	int hardwareThreads = std::max<int>(1, std::thread::hardware_concurrency());
+	int jobs = m_jobCount > 0 ? m_jobCount : std::max(1, hardwareThreads / 4);
+	jobs = std::min<int>(jobs, static_cast<int>(m_pendingZones.size()));
+
+	// split the machine between the zones that are building at the same time
+	int tileThreads = std::max(1, hardwareThreads / std::max(1, jobs));
+
+	// zones building side by side would skew each other's numbers
+	if (benchmark)
+	{
+		tileThreads = m_jobCount > 0 ? m_jobCount : hardwareThreads;
+		jobs = 1;
+	}
+
+	m_context->Log(LogLevel::INFO, "Batch build: %d zones, %d at a time with %d threads each",
+		(int)m_pendingZones.size(), jobs, tileThreads);
+
+	auto startTime = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> workers;
+	for (int i = 0; i < jobs; ++i)
+		workers.emplace_back([this, tileThreads]() { WorkerMain(tileThreads); });
+
+	for (std::thread& worker : workers)
+		worker.join();
+
+	auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
+		std::chrono::steady_clock::now() - startTime);
+
+	m_context->Log(LogLevel::INFO, "Batch build finished in %d seconds, %d zones failed",
+		(int)elapsed.count(), (int)m_failedZones.size());
+
+	for (const std::string& zone : m_failedZones)
+		m_context->Log(LogLevel::ERROR, "  failed: %s", zone.c_str());
+
+	if (benchmark && !WriteBenchmark())
+	{
+		m_context->Log(LogLevel::ERROR, "Failed to write benchmark results to %s", m_benchmarkFile.c_str());
+		return static_cast<int>(m_failedZones.size()) + 1;
+	}
+
+	return static_cast<int>(m_failedZones.size());
+}
+
+void BatchBuilder::WorkerMain(int tileThreads)
+{
+	while (true)
+	{
+		std::string zoneShortName;
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			if (m_pendingZones.empty())
+				return;
+
+			zoneShortName = std::move(m_pendingZones.front());
+			m_pendingZones.pop_front();
+		}
+
+		if (!BuildZone(zoneShortName, tileThreads))
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_failedZones.push_back(zoneShortName);
+		}
+	}
+}
+
+bool BatchBuilder::BuildZone(const std::string& zoneShortName, int tileThreads)
+{
+	bool benchmark = !m_benchmarkFile.empty();
+
+	ZoneBenchmark result;
+	result.zoneShortName = zoneShortName;
+	result.threadCount = tileThreads;
+
+	std::unique_ptr<MemorySampler> memorySampler;
+	if (benchmark)
+		memorySampler = std::make_unique<MemorySampler>();
+
+	// failed zones are still listed in the results
+	auto RecordResult = [&]()
+	{
+		if (!benchmark)
+			return;
+
+		memorySampler->Sample();
+		result.peakMemory = memorySampler->GetPeak();
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_benchmarks.push_back(result);
+	};
+
+	auto rcContext = std::make_unique<BuildContext>(m_context);
+
+	// the benchmark measures the real load, not the geometry cache
+	auto geom = std::make_unique<InputGeom>(zoneShortName,
+		m_eqConfig.GetEverquestPath(), m_eqConfig.GetOutputPath());
+	if (!geom->loadGeometry(rcContext.get(), !benchmark))
+	{
+		m_context->Log(LogLevel::ERROR, "%s: failed to load zone geometry", zoneShortName.c_str());
+		RecordResult();
+		return false;
+	}
+
+	result.loadTimeMs = geom->getLoadTimeMS();
+	result.chunkyMeshTimeMs = geom->getChunkyMeshTimeMS();
+
+	const MapGeometryLoader* loader = geom->getMeshLoader();
+	size_t geometrySize = (size_t)loader->getVertCount() * 3 * sizeof(float)
+		+ (size_t)loader->getTriCount() * 3 * sizeof(int);
+
+	const MeshInstances& instances = loader->getInstances();
+	for (int i = 0; i < instances.GetModelCount(); ++i)
+	{
+		const MeshInstances::Model& model = instances.GetModel(i);
+		geometrySize += model.verts.size() * sizeof(float) + model.tris.size() * sizeof(int);
+	}
+	size_t memoryEstimate = geometrySize * GEOMETRY_MEMORY_FACTOR
+		+ tileThreads * TILE_MEMORY_ESTIMATE;
+
+	result.vertCount = loader->getVertCount();
+	result.triCount = loader->getTriCount();
+	result.instanceCount = instances.GetInstanceCount();
+
+	ReserveMemory(memoryEstimate);
+
+	std::string meshFolder = m_eqConfig.GetOutputPath() + "\\MQ2Nav";
+	if (benchmark)
+	{
+		meshFolder += "\\benchmark";
+
+		boost::system::error_code ec;
+		fs::create_directories(meshFolder, ec);
+	}
+
+	auto navMesh = std::make_shared<NavMesh>(m_context, meshFolder, zoneShortName);
+	navMesh->SetKeepBuildCapacity(true);
+	navMesh->SetLoadAgentMeshes(true);
+	auto meshTool = std::make_unique<NavMeshTool>(navMesh);
+	meshTool->setContext(rcContext.get());
+	meshTool->setOutputPath(m_eqConfig.GetOutputPath().c_str());
+	meshTool->setBuildThreadCount(tileThreads);
+	meshTool->setBuildPriority(NavMeshTool::BuildPriority::Turbo);
+
+	// the tiles stay inside what was reserved for them, a zone that is over the
+	// budget on its own builds fewer of them at a time
+	if (m_memoryBudget)
+	{
+		const size_t geometryMemory = memoryEstimate - tileThreads * TILE_MEMORY_ESTIMATE;
+		const size_t tileMemory = std::min(tileThreads * TILE_MEMORY_ESTIMATE,
+			m_memoryBudget > geometryMemory ? m_memoryBudget - geometryMemory : 0);
+		meshTool->setTileMemoryBudget(std::max(tileMemory, TILE_MEMORY_ESTIMATE));
+	}
+	meshTool->handleGeometryChanged(geom.get());
+
+	// pick up the build settings, volumes and areas saved with the existing mesh.
+	// Benchmarks always use the defaults.
+	NavMesh::LoadResult loadResult = benchmark ? NavMesh::LoadResult::MissingFile
+		: navMesh->LoadNavMeshFile();
+	if (loadResult != NavMesh::LoadResult::Success
+		&& loadResult != NavMesh::LoadResult::MissingFile)
+	{
+		m_context->Log(LogLevel::WARNING, "%s: existing navmesh could not be loaded (%d), using default settings",
+			zoneShortName.c_str(), (int)loadResult);
+	}
+
+	auto startTime = std::chrono::steady_clock::now();
+
+	bool success = meshTool->handleBuild(false, benchmark ? std::vector<NavMeshTool::BuildRegion>() : m_regions);
+
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - startTime);
+
+	// logged for rebuilding in meshgen, the mesh is still saved
+	if (success)
+		meshTool->validateNavMesh();
+
+	success = success && navMesh->SaveNavMeshFile();
+
+	if (benchmark)
+	{
+		result.success = success;
+		result.buildTimeMs = static_cast<float>(elapsed.count());
+		result.tilesBuilt = meshTool->getTilesBuilt();
+
+		TileBuildTimings::clock::duration busyTime = {};
+		for (const TileBuildTimings& tile : meshTool->getBuildProfiler().GetTiles())
+			busyTime += tile.GetTotalTime();
+
+		float threadTimeMs = result.buildTimeMs * tileThreads;
+		if (threadTimeMs > 0)
+			result.threadUtilization = std::chrono::duration<float, std::milli>(busyTime).count() / threadTimeMs;
+
+		boost::system::error_code ec;
+		uintmax_t fileSize = fs::file_size(navMesh->GetDataFileName(), ec);
+		result.outputSize = ec ? 0 : static_cast<size_t>(fileSize);
+	}
+
+	if (success)
+	{
+		m_context->Log(LogLevel::INFO, "%s: built %d tiles in %.2f seconds", zoneShortName.c_str(),
+			meshTool->getTilesBuilt(), elapsed.count() / 1000.0f);
+	}
+	else
+	{
+		m_context->Log(LogLevel::ERROR, "%s: build failed", zoneShortName.c_str());
+	}
+
+	meshTool.reset();
+	navMesh.reset();
+	geom.reset();
+
+	ReleaseMemory(memoryEstimate);
+	RecordResult();
+	return success;
+}
+
+bool BatchBuilder::WriteBenchmark() const
+{
+	rapidjson::StringBuffer buffer;
+	rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+	writer.SetIndent(' ', 2);
+
+	// in the order the zones were given, so two runs line up when diffed
+	std::vector<ZoneBenchmark> benchmarks = m_benchmarks;
+	std::vector<std::string> order = m_zones.empty()
+		? std::vector<std::string>(std::begin(s_benchmarkZones), std::end(s_benchmarkZones)) : m_zones;
+	std::stable_sort(benchmarks.begin(), benchmarks.end(),
+		[&order](const ZoneBenchmark& a, const ZoneBenchmark& b)
+	{
+		return std::find(order.begin(), order.end(), a.zoneShortName)
+			< std::find(order.begin(), order.end(), b.zoneShortName);
+	});
+
+	writer.StartObject();
+	writer.Key("hardware_threads");
+	writer.Int(std::thread::hardware_concurrency());
+	writer.Key("zones");
+	writer.StartArray();
+
+	for (const ZoneBenchmark& zone : benchmarks)
+	{
+		writer.StartObject();
+		writer.Key("zone"); writer.String(zone.zoneShortName.c_str());
+		writer.Key("success"); writer.Bool(zone.success);
+		writer.Key("verts"); writer.Int(zone.vertCount);
+		writer.Key("tris"); writer.Int(zone.triCount);
+		writer.Key("instances"); writer.Int(zone.instanceCount);
+		writer.Key("load_ms"); writer.Double(zone.loadTimeMs);
+		writer.Key("chunky_mesh_ms"); writer.Double(zone.chunkyMeshTimeMs);
+		writer.Key("build_ms"); writer.Double(zone.buildTimeMs);
+		writer.Key("threads"); writer.Int(zone.threadCount);
+		writer.Key("thread_utilization"); writer.Double(zone.threadUtilization);
+		writer.Key("tiles_built"); writer.Int(zone.tilesBuilt);
+		writer.Key("peak_memory"); writer.Uint64(zone.peakMemory);
+		writer.Key("output_size"); writer.Uint64(zone.outputSize);
+		writer.EndObject();
+	}
+
+	writer.EndArray();
+	writer.EndObject();
+
+	std::ofstream outfile(m_benchmarkFile, std::ios::trunc);
+	if (!outfile.is_open())
+		return false;
+
+	outfile.write(buffer.GetString(), buffer.GetSize());
+	outfile << "\n";
+
+	return outfile.good();
+}
+
+void BatchBuilder::ReserveMemory(size_t bytes)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	// a zone that is larger than the budget on its own still gets to build, but
+	// only once nothing else is running.
+	m_memoryAvailable.wait(lock, [this, bytes]()
+	{
+		return m_memoryBudget == 0 || m_memoryUsed == 0
+			|| m_memoryUsed + bytes <= m_memoryBudget;
+	});
+
+	m_memoryUsed += bytes;
+}
+
+void BatchBuilder::ReleaseMemory(size_t bytes)
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_memoryUsed -= bytes;
+	}
+
+	m_memoryAvailable.notify_all();
+}
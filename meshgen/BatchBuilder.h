@@ -0,0 +1,93 @@
+//
+// BatchBuilder.h
+//
+
+// Builds navmeshes for a list of zones without bringing up the user interface.
+
+#pragma once
+
+#include "NavMeshTool.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class Context;
+class EQConfig;
+
+class BatchBuilder
+{
+public:
+	BatchBuilder(EQConfig& eqConfig, Context* context);
+	~BatchBuilder();
+
+	// zones to build, by short name. If empty, every zone in Zones.ini is built.
+	void SetZones(const std::vector<std::string>& zones) { m_zones = zones; }
+
+	// number of zones to build at the same time. 0 = one per four hardware threads.
+	void SetJobCount(int jobs) { m_jobCount = jobs; }
+
+	// approximate limit on the memory used by builds that are in progress, in
+	// megabytes. A zone that would go over the limit waits for others to finish.
+	// 0 = no limit.
+	void SetMemoryBudget(size_t megabytes) { m_memoryBudget = megabytes * 1024 * 1024; }
+
+	// Benchmark mode: build the zones one at a time from the zone files, with the
+	// default settings, and write what each build cost to this json file. The job
+	// count becomes the number of tile threads. Meshes are written to a separate
+	// benchmark folder, the real ones are left alone. With no zones given, a fixed
+	// set covering each geometry format is built.
+	void SetBenchmarkFile(const std::string& filename) { m_benchmarkFile = filename; }
+
+	// only build the tiles in these regions, merged into the zone's existing mesh.
+	// Empty builds every tile.
+	void SetRegions(const std::vector<NavMeshTool::BuildRegion>& regions) { m_regions = regions; }
+
+	// build every zone. Returns the number of zones that failed.
+	int Run();
+
+private:
+	struct ZoneBenchmark
+	{
+		std::string zoneShortName;
+		bool success = false;
+		int vertCount = 0;
+		int triCount = 0;
+		int instanceCount = 0;         // placed models, their triangles aren't in triCount
+		float loadTimeMs = 0.f;
+		float chunkyMeshTimeMs = 0.f;
+		float buildTimeMs = 0.f;
+		float threadUtilization = 0.f; // busy time of the tile threads over their wall time
+		int threadCount = 0;
+		int tilesBuilt = 0;
+		size_t peakMemory = 0;         // private bytes above what was in use before loading
+		size_t outputSize = 0;
+	};
+
+	bool WriteBenchmark() const;
+
+	void WorkerMain(int tileThreads);
+	bool BuildZone(const std::string& zoneShortName, int tileThreads);
+
+	void ReserveMemory(size_t bytes);
+	void ReleaseMemory(size_t bytes);
+
+	EQConfig& m_eqConfig;
+	Context* m_context;
+
+	std::vector<std::string> m_zones;
+	int m_jobCount = 0;
+	size_t m_memoryBudget = 0;
+	std::string m_benchmarkFile;
+	std::vector<ZoneBenchmark> m_benchmarks;
+	std::vector<NavMeshTool::BuildRegion> m_regions;
+
+	std::mutex m_mutex;
+	std::condition_variable m_memoryAvailable;
+	std::deque<std::string> m_pendingZones;
+	std::vector<std::string> m_failedZones;
+	size_t m_memoryUsed = 0;
+};
@@ -0,0 +1,212 @@
+//
+// BuildProfiler.cpp
+//
+
+#include "BuildProfiler.h"
+
+#include <cstdio>
+#include <memory>
+
+static const char* s_stageNames[] = {
+	"Rasterize",
+	"Filter",
+	"Compact",
+	"Erode",
+	"Layers",
+	"Regions",
+	"Contours",
+	"PolyMesh",
+	"Clearance",
+	"MergePolys",
+	"Detail",
+	"OffMeshLinks",
+	"CreateNavMeshData",
+	"AddTile",
+};
+static_assert(sizeof(s_stageNames) / sizeof(s_stageNames[0]) == (int)BuildStage::Count,
+	"stage names don't match BuildStage");
+
+const char* GetBuildStageName(BuildStage stage)
+{
+	if (stage >= BuildStage::Rasterize && stage < BuildStage::Count)
+		return s_stageNames[(int)stage];
+
+	return "Total";
+}
+
+static double ToMilliseconds(TileBuildTimings::clock::duration duration)
+{
+	return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+static long long ToMicroseconds(TileBuildTimings::clock::duration duration)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+}
+
+//----------------------------------------------------------------------------
+
+TileBuildTimings::clock::duration TileBuildTimings::GetTotalTime() const
+{
+	clock::duration total = {};
+	for (int i = 0; i < (int)BuildStage::Count; ++i)
+		total += stageTime[i];
+
+	return total;
+}
+
+BuildStageTimer::BuildStageTimer(TileBuildTimings* timings)
+	: m_timings(timings)
+{
+	if (m_timings)
+		m_timings->threadId = std::this_thread::get_id();
+}
+
+BuildStageTimer::~BuildStageTimer()
+{
+	Stop();
+}
+
+void BuildStageTimer::Start(BuildStage stage)
+{
+	Stop();
+
+	if (!m_timings)
+		return;
+
+	m_stage = stage;
+	m_start = TileBuildTimings::clock::now();
+}
+
+void BuildStageTimer::Stop()
+{
+	if (!m_timings || m_stage == BuildStage::Count)
+		return;
+
+	int index = (int)m_stage;
+	if (!m_timings->stageRan[index])
+	{
+		m_timings->stageStart[index] = m_start;
+		m_timings->stageRan[index] = true;
+	}
+
+	m_timings->stageTime[index] += TileBuildTimings::clock::now() - m_start;
+	m_stage = BuildStage::Count;
+}
+
+//----------------------------------------------------------------------------
+
+BuildProfiler::BuildProfiler()
+	: m_startTime(TileBuildTimings::clock::now())
+{
+}
+
+void BuildProfiler::Reset()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	m_tiles.clear();
+	m_startTime = TileBuildTimings::clock::now();
+}
+
+void BuildProfiler::AddTile(const TileBuildTimings& timings)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	m_tiles[std::make_pair(timings.x, timings.y)] = timings;
+}
+
+std::vector<TileBuildTimings> BuildProfiler::GetTiles() const
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	std::vector<TileBuildTimings> tiles;
+	tiles.reserve(m_tiles.size());
+
+	for (const auto& entry : m_tiles)
+		tiles.push_back(entry.second);
+
+	return tiles;
+}
+
+bool BuildProfiler::GetTile(int x, int y, TileBuildTimings& timings) const
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	auto iter = m_tiles.find(std::make_pair(x, y));
+	if (iter == m_tiles.end())
+		return false;
+
+	timings = iter->second;
+	return true;
+}
+
+bool BuildProfiler::IsEmpty() const
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	return m_tiles.empty();
+}
+
+bool BuildProfiler::ExportCSV(const std::string& filename) const
+{
+	std::unique_ptr<FILE, decltype(&fclose)> file(fopen(filename.c_str(), "w"), &fclose);
+	if (!file)
+		return false;
+
+	fprintf(file.get(), "x,y");
+	for (int i = 0; i < (int)BuildStage::Count; ++i)
+		fprintf(file.get(), ",%s", s_stageNames[i]);
+	fprintf(file.get(), ",Total\n");
+
+	for (const TileBuildTimings& tile : GetTiles())
+	{
+		fprintf(file.get(), "%d,%d", tile.x, tile.y);
+		for (int i = 0; i < (int)BuildStage::Count; ++i)
+			fprintf(file.get(), ",%.3f", ToMilliseconds(tile.stageTime[i]));
+		fprintf(file.get(), ",%.3f\n", ToMilliseconds(tile.GetTotalTime()));
+	}
+
+	return !ferror(file.get());
+}
+
+bool BuildProfiler::ExportChromeTrace(const std::string& filename) const
+{
+	std::unique_ptr<FILE, decltype(&fclose)> file(fopen(filename.c_str(), "w"), &fclose);
+	if (!file)
+		return false;
+
+	TileBuildTimings::clock::time_point startTime;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		startTime = m_startTime;
+	}
+
+	// the trace viewer wants small thread ids
+	std::map<std::thread::id, int> threadIds;
+
+	fprintf(file.get(), "{\"traceEvents\":[\n");
+	bool first = true;
+
+	for (const TileBuildTimings& tile : GetTiles())
+	{
+		auto iter = threadIds.emplace(tile.threadId, (int)threadIds.size() + 1).first;
+
+		for (int i = 0; i < (int)BuildStage::Count; ++i)
+		{
+			if (!tile.stageRan[i])
+				continue;
+
+			long long ts = ToMicroseconds(tile.stageStart[i] - startTime);
+			fprintf(file.get(), "%s{\"name\":\"%s\",\"cat\":\"tile\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,"
+				"\"pid\":1,\"tid\":%d,\"args\":{\"x\":%d,\"y\":%d}}",
+				first ? "" : ",\n", s_stageNames[i], ts < 0 ? 0 : ts, ToMicroseconds(tile.stageTime[i]),
+				iter->second, tile.x, tile.y);
+			first = false;
+		}
+	}
+
+	fprintf(file.get(), "\n]}\n");
+
+	return !ferror(file.get());
+}
@@ -0,0 +1,109 @@
+//
+// BuildProfiler.h
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// stages of building a single navmesh tile
+enum struct BuildStage
+{
+	Rasterize,
+	Filter,
+	Compact,
+	Erode,
+	Layers,
+	Regions,
+	Contours,
+	PolyMesh,
+	Clearance,
+	MergePolys,
+	Detail,
+	OffMeshLinks,
+	CreateNavMeshData,
+	AddTile,
+
+	Count
+};
+
+const char* GetBuildStageName(BuildStage stage);
+
+// time spent in each stage of building one tile
+struct TileBuildTimings
+{
+	using clock = std::chrono::steady_clock;
+
+	int x = 0;
+	int y = 0;
+	float bmin[3] = { 0 };
+	float bmax[3] = { 0 };
+
+	std::thread::id threadId;
+	clock::time_point stageStart[(int)BuildStage::Count];
+	clock::duration stageTime[(int)BuildStage::Count] = {};
+	bool stageRan[(int)BuildStage::Count] = { false };
+
+	clock::duration GetTime(BuildStage stage) const { return stageTime[(int)stage]; }
+	clock::duration GetTotalTime() const;
+};
+
+// times the stages of a tile as they follow each other. Starting a stage ends the
+// one before it, and the last stage ends when the timer goes out of scope. Does
+// nothing if timings is null.
+class BuildStageTimer
+{
+public:
+	explicit BuildStageTimer(TileBuildTimings* timings);
+	~BuildStageTimer();
+
+	BuildStageTimer(const BuildStageTimer&) = delete;
+	BuildStageTimer& operator=(const BuildStageTimer&) = delete;
+
+	void Start(BuildStage stage);
+	void Stop();
+
+private:
+	TileBuildTimings* m_timings;
+	BuildStage m_stage = BuildStage::Count;
+	TileBuildTimings::clock::time_point m_start;
+};
+
+// Collects the timings of the tiles built by the mesh tool. Building a single
+// tile replaces whatever was recorded for that tile before, building all tiles
+// starts over.
+class BuildProfiler
+{
+public:
+	BuildProfiler();
+
+	// forget all tiles and start timing a new build
+	void Reset();
+
+	// safe to call from the build threads
+	void AddTile(const TileBuildTimings& timings);
+
+	std::vector<TileBuildTimings> GetTiles() const;
+
+	// false if the tile hasn't been built since the last reset
+	bool GetTile(int x, int y, TileBuildTimings& timings) const;
+	bool IsEmpty() const;
+
+	// one row per tile, one column per stage, times in milliseconds
+	bool ExportCSV(const std::string& filename) const;
+
+	// chrome://tracing / perfetto json, one event per stage of each tile
+	bool ExportChromeTrace(const std::string& filename) const;
+
+private:
+	mutable std::mutex m_mutex;
+	TileBuildTimings::clock::time_point m_startTime;
+	std::map<std::pair<int, int>, TileBuildTimings> m_tiles;
+};
@@ -18,37 +18,29 @@
 
 #include "ChunkyTriMesh.h"
 
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <future>
+#include <thread>
+#include <vector>
+
 struct BoundsItem
 {
 	float bmin[2];
 	float bmax[2];
+	float center[2];
 	int i;
 };
 
-static int compareItemX(const void* va, const void* vb)
-{
-	const BoundsItem* a = (const BoundsItem*)va;
-	const BoundsItem* b = (const BoundsItem*)vb;
-	if (a->bmin[0] < b->bmin[0])
-		return -1;
-	if (a->bmin[0] > b->bmin[0])
-		return 1;
-	return 0;
-}
+// number of buckets along each axis that split candidates are taken from
+static const int SAH_BUCKETS = 16;
 
-static int compareItemY(const void* va, const void* vb)
-{
-	const BoundsItem* a = (const BoundsItem*)va;
-	const BoundsItem* b = (const BoundsItem*)vb;
-	if (a->bmin[1] < b->bmin[1])
-		return -1;
-	if (a->bmin[1] > b->bmin[1])
-		return 1;
-	return 0;
-}
+// meshes and subtrees with fewer triangles than this are built on the calling
+// thread, starting a task costs more than they take
+static const int PARALLEL_MIN_TRIS = 64 * 1024;
 
-static void calcExtends(const BoundsItem* items, const int /*nitems*/,
-						const int imin, const int imax,
+static void calcExtends(const BoundsItem* items, const int imin, const int imax,
 						float* bmin, float* bmax)
 {
 	bmin[0] = items[imin].bmin[0];
@@ -68,37 +60,117 @@ static void calcExtends(const BoundsItem* items, const int /*nitems*/,
 	}
 }
 
-inline int longestAxis(float x, float y)
+struct Bucket
+{
+	float bmin[2] = { FLT_MAX, FLT_MAX };
+	float bmax[2] = { -FLT_MAX, -FLT_MAX };
+	int count = 0;
+
+	void add(const float* ibmin, const float* ibmax)
+	{
+		bmin[0] = std::min(bmin[0], ibmin[0]); bmin[1] = std::min(bmin[1], ibmin[1]);
+		bmax[0] = std::max(bmax[0], ibmax[0]); bmax[1] = std::max(bmax[1], ibmax[1]);
+	}
+
+	void add(const Bucket& other)
+	{
+		if (!other.count) return;
+		add(other.bmin, other.bmax);
+		count += other.count;
+	}
+
+	// the tree is 2d, so the perimeter plays the part of the surface area
+	float cost() const
+	{
+		if (!count) return 0;
+		return ((bmax[0] - bmin[0]) + (bmax[1] - bmin[1])) * count;
+	}
+};
+
+// Pick a split with the surface area heuristic. Returns the number of items that go
+// to the left side after partitioning along axis, or 0 if there is no useful split.
+static int findSplit(const BoundsItem* items, int imin, int imax, int minCount, int& axis)
 {
-	return y > x ? 1 : 0;
+	const int inum = imax - imin;
+	float bestCost = FLT_MAX;
+	int bestCount = 0;
+
+	for (int a = 0; a < 2; ++a)
+	{
+		float cmin = FLT_MAX, cmax = -FLT_MAX;
+		for (int i = imin; i < imax; ++i)
+		{
+			cmin = std::min(cmin, items[i].center[a]);
+			cmax = std::max(cmax, items[i].center[a]);
+		}
+		if (cmax - cmin <= 0)
+			continue;
+
+		Bucket buckets[SAH_BUCKETS];
+		const float scale = SAH_BUCKETS / (cmax - cmin);
+		for (int i = imin; i < imax; ++i)
+		{
+			int b = std::min(SAH_BUCKETS - 1, (int)((items[i].center[a] - cmin) * scale));
+			buckets[b].add(items[i].bmin, items[i].bmax);
+			buckets[b].count++;
+		}
+
+		// sweep from the right to get the cost of everything past each split
+		float rightCost[SAH_BUCKETS];
+		Bucket right;
+		for (int b = SAH_BUCKETS - 1; b > 0; --b)
+		{
+			right.add(buckets[b]);
+			rightCost[b] = right.cost();
+		}
+
+		Bucket left;
+		for (int b = 0; b < SAH_BUCKETS - 1; ++b)
+		{
+			left.add(buckets[b]);
+
+			const int leftCount = left.count;
+			if (leftCount < minCount || inum - leftCount < minCount)
+				continue;
+
+			float cost = left.cost() + rightCost[b + 1];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestCount = leftCount;
+				axis = a;
+			}
+		}
+	}
+
+	return bestCount;
 }
 
-static void subdivide(BoundsItem* items, int nitems, int imin, int imax, int trisPerChunk,
-					  int& curNode, rcChunkyTriMeshNode* nodes, const int maxNodes,
-					  int& curTri, int* outTris, const int* inTris)
+// Leaves take their triangles in the order of the items, so a subtree's triangles
+// go to the same range of outTris as its items. Down to parallelDepth levels, the
+// right side is built on a task of its own, into nodes that are appended after
+// the left side's. Node links are relative, so they stay valid.
+static void subdivide(BoundsItem* items, int imin, int imax, int trisPerChunk, int parallelDepth,
+					  std::vector<rcChunkyTriMeshNode>& nodes,
+					  int* outTris, const int* inTris)
 {
 	int inum = imax - imin;
-	int icur = curNode;
-
-	if (curNode > maxNodes)
-		return;
+	int icur = (int)nodes.size();
 
-	rcChunkyTriMeshNode& node = nodes[curNode++];
+	nodes.emplace_back();
+	rcChunkyTriMeshNode& node = nodes.back();
+	calcExtends(items, imin, imax, node.bmin, node.bmax);
 
 	if (inum <= trisPerChunk)
 	{
 		// Leaf
-		calcExtends(items, nitems, imin, imax, node.bmin, node.bmax);
-
-		// Copy triangles.
-		node.i = curTri;
+		node.i = imin;
 		node.n = inum;
 
 		for (int i = imin; i < imax; ++i)
 		{
 			const int* src = &inTris[items[i].i*3];
-			int* dst = &outTris[curTri*3];
-			curTri++;
+			int* dst = &outTris[i*3];
 			dst[0] = src[0];
 			dst[1] = src[1];
 			dst[2] = src[2];
@@ -106,49 +178,52 @@ static void subdivide(BoundsItem* items, int nitems, int imin, int imax, int tri
 	}
 	else
 	{
-		// Split
-		calcExtends(items, nitems, imin, imax, node.bmin, node.bmax);
+		// Split. Each side keeps at least a quarter of a chunk so that the
+		// heuristic doesn't peel off lots of tiny leaves.
+		int axis = 0;
+		int nleft = findSplit(items, imin, imax, std::max(1, trisPerChunk / 4), axis);
+		if (nleft == 0)
+		{
+			// everything is piled up in one spot, fall back to a median split
+			axis = (node.bmax[1] - node.bmin[1]) > (node.bmax[0] - node.bmin[0]) ? 1 : 0;
+			nleft = inum / 2;
+		}
 
-		int	axis = longestAxis(node.bmax[0] - node.bmin[0],
-							   node.bmax[1] - node.bmin[1]);
+		int isplit = imin + nleft;
+		std::nth_element(items + imin, items + isplit, items + imax,
+			[axis](const BoundsItem& a, const BoundsItem& b) { return a.center[axis] < b.center[axis]; });
 
-		if (axis == 0)
+		if (parallelDepth > 0 && inum >= PARALLEL_MIN_TRIS)
 		{
-			// Sort along x-axis
-			qsort(items+imin, inum, sizeof(BoundsItem), compareItemX);
+			std::vector<rcChunkyTriMeshNode> rightNodes;
+			auto right = std::async(std::launch::async, [&]()
+			{
+				rightNodes.reserve((imax - isplit) / trisPerChunk * 4);
+				subdivide(items, isplit, imax, trisPerChunk, parallelDepth - 1, rightNodes, outTris, inTris);
+			});
+
+			subdivide(items, imin, isplit, trisPerChunk, parallelDepth - 1, nodes, outTris, inTris);
+
+			right.get();
+			nodes.insert(nodes.end(), rightNodes.begin(), rightNodes.end());
 		}
-		else if (axis == 1)
+		else
 		{
-			// Sort along y-axis
-			qsort(items+imin, inum, sizeof(BoundsItem), compareItemY);
+			// Left
+			subdivide(items, imin, isplit, trisPerChunk, 0, nodes, outTris, inTris);
+			// Right
+			subdivide(items, isplit, imax, trisPerChunk, 0, nodes, outTris, inTris);
 		}
 
-		int isplit = imin+inum/2;
-
-		// Left
-		subdivide(items, nitems, imin, isplit, trisPerChunk, curNode, nodes, maxNodes, curTri, outTris, inTris);
-		// Right
-		subdivide(items, nitems, isplit, imax, trisPerChunk, curNode, nodes, maxNodes, curTri, outTris, inTris);
-
-		int iescape = curNode - icur;
+		int iescape = (int)nodes.size() - icur;
 		// Negative index means escape.
-		node.i = -iescape;
+		nodes[icur].i = -iescape;
 	}
 }
 
-bool rcCreateChunkyTriMesh(const float* verts, const int* tris, int ntris,
-	int trisPerChunk, rcChunkyTriMesh* cm)
+static void calcItemBounds(const float* verts, const int* tris, BoundsItem* items, int begin, int end)
 {
-	int nchunks = (ntris + trisPerChunk-1) / trisPerChunk;
-
-	cm->nodes = new rcChunkyTriMeshNode[nchunks*4];
-	cm->tris = new int[ntris*3];
-	cm->ntris = ntris;
-
-	// Build tree
-	BoundsItem* items = new BoundsItem[ntris];
-
-	for (int i = 0; i < ntris; i++)
+	for (int i = begin; i < end; i++)
 	{
 		const int* t = &tris[i*3];
 		BoundsItem& it = items[i];
@@ -165,15 +240,59 @@ bool rcCreateChunkyTriMesh(const float* verts, const int* tris, int ntris,
 			if (v[0] > it.bmax[0]) it.bmax[0] = v[0];
 			if (v[2] > it.bmax[1]) it.bmax[1] = v[2];
 		}
+		it.center[0] = (it.bmin[0] + it.bmax[0]) * 0.5f;
+		it.center[1] = (it.bmin[1] + it.bmax[1]) * 0.5f;
 	}
+}
+
+bool rcCreateChunkyTriMesh(const float* verts, const int* tris, int ntris,
+	int trisPerChunk, rcChunkyTriMesh* cm)
+{
+	int nchunks = (ntris + trisPerChunk-1) / trisPerChunk;
 
-	int curTri = 0;
-	int curNode = 0;
-	subdivide(items, ntris, 0, ntris, trisPerChunk, curNode, cm->nodes, nchunks*4, curTri, cm->tris, tris);
+	cm->tris = new int[ntris*3];
+	cm->ntris = ntris;
 
-	delete [] items;
+	const int threadCount = std::max(1, (int)std::thread::hardware_concurrency());
 
-	cm->nnodes = curNode;
+	// Build tree
+	std::vector<BoundsItem> items(ntris);
+
+	if (ntris >= PARALLEL_MIN_TRIS && threadCount > 1)
+	{
+		std::vector<std::future<void>> tasks;
+		const int perTask = (ntris + threadCount - 1) / threadCount;
+		for (int begin = 0; begin < ntris; begin += perTask)
+		{
+			tasks.push_back(std::async(std::launch::async, calcItemBounds, verts, tris, items.data(),
+				begin, std::min(ntris, begin + perTask)));
+		}
+
+		for (auto& task : tasks)
+			task.get();
+	}
+	else
+	{
+		calcItemBounds(verts, tris, items.data(), 0, ntris);
+	}
+
+	// one level more than it takes to give every thread a subtree, the splits
+	// aren't even
+	int parallelDepth = 1;
+	while ((1 << (parallelDepth - 1)) < threadCount)
+		++parallelDepth;
+	if (threadCount == 1)
+		parallelDepth = 0;
+
+	std::vector<rcChunkyTriMeshNode> nodes;
+	nodes.reserve(nchunks * 4);
+
+	if (ntris > 0)
+		subdivide(items.data(), 0, ntris, trisPerChunk, parallelDepth, nodes, cm->tris, tris);
+
+	cm->nnodes = (int)nodes.size();
+	cm->nodes = new rcChunkyTriMeshNode[std::max(1, cm->nnodes)];
+	std::copy(nodes.begin(), nodes.end(), cm->nodes);
 
 	// Calc max tris per node.
 	cm->maxTrisPerChunk = 0;
@@ -235,51 +354,69 @@ int rcGetChunksOverlappingRect(const rcChunkyTriMesh* cm,
 
 
 
-static bool checkOverlapSegment(const float p[2], const float q[2],
-								const float bmin[2], const float bmax[2])
+// Segment vs. box slab test, with the per segment work done up front so that
+// testing each node is just a few multiplies and compares.
+struct SegmentOverlap
 {
-	static const float EPSILON = 1e-6f;
-
-	float tmin = 0;
-	float tmax = 1;
-	float d[2];
-	d[0] = q[0] - p[0];
-	d[1] = q[1] - p[1];
-
-	for (int i = 0; i < 2; i++)
+	SegmentOverlap(const float p_[2], const float q_[2])
 	{
-		if (fabsf(d[i]) < EPSILON)
+		static const float EPSILON = 1e-6f;
+
+		for (int i = 0; i < 2; i++)
 		{
+			p[i] = p_[i];
+			const float d = q_[i] - p_[i];
+
 			// Ray is parallel to slab. No hit if origin not within slab
-			if (p[i] < bmin[i] || p[i] > bmax[i])
-				return false;
+			parallel[i] = fabsf(d) < EPSILON;
+			ood[i] = parallel[i] ? 0.0f : 1.0f / d;
 		}
-		else
+	}
+
+	bool test(const float bmin[2], const float bmax[2]) const
+	{
+		float tmin = 0;
+		float tmax = 1;
+
+		for (int i = 0; i < 2; i++)
 		{
-			// Compute intersection t value of ray with near and far plane of slab
-			float ood = 1.0f / d[i];
-			float t1 = (bmin[i] - p[i]) * ood;
-			float t2 = (bmax[i] - p[i]) * ood;
-			if (t1 > t2) { float tmp = t1; t1 = t2; t2 = tmp; }
-			if (t1 > tmin) tmin = t1;
-			if (t2 < tmax) tmax = t2;
-			if (tmin > tmax) return false;
+			if (parallel[i])
+			{
+				if (p[i] < bmin[i] || p[i] > bmax[i])
+					return false;
+			}
+			else
+			{
+				// Compute intersection t value of ray with near and far plane of slab
+				float t1 = (bmin[i] - p[i]) * ood[i];
+				float t2 = (bmax[i] - p[i]) * ood[i];
+				if (t1 > t2) { float tmp = t1; t1 = t2; t2 = tmp; }
+				if (t1 > tmin) tmin = t1;
+				if (t2 < tmax) tmax = t2;
+				if (tmin > tmax) return false;
+			}
 		}
+		return true;
 	}
-	return true;
-}
+
+	float p[2];
+	float ood[2];
+	bool parallel[2];
+};
 
 int rcGetChunksOverlappingSegment(const rcChunkyTriMesh* cm,
 								  float p[2], float q[2],
 								  int* ids, const int maxIds)
 {
+	const SegmentOverlap segment(p, q);
+
 	// Traverse tree
 	int i = 0;
 	int n = 0;
 	while (i < cm->nnodes)
 	{
 		const rcChunkyTriMeshNode* node = &cm->nodes[i];
-		const bool overlap = checkOverlapSegment(p, q, node->bmin, node->bmax);
+		const bool overlap = segment.test(node->bmin, node->bmax);
 		const bool isLeafNode = node->i >= 0;
 
 		if (isLeafNode && overlap)
@@ -302,3 +439,51 @@ int rcGetChunksOverlappingSegment(const rcChunkyTriMesh* cm,
 
 	return n;
 }
+
+void rcGetChunksOverlappingRect(const rcChunkyTriMesh* cm, const float bmin[2], const float bmax[2],
+	std::vector<int>& ids)
+{
+	ids.clear();
+
+	// Traverse tree
+	int i = 0;
+	while (i < cm->nnodes)
+	{
+		const rcChunkyTriMeshNode* node = &cm->nodes[i];
+		const bool overlap = checkOverlapRect(bmin, bmax, node->bmin, node->bmax);
+		const bool isLeafNode = node->i >= 0;
+
+		if (isLeafNode && overlap)
+			ids.push_back(i);
+
+		if (overlap || isLeafNode)
+			i++;
+		else
+			i += -node->i;
+	}
+}
+
+void rcGetChunksOverlappingSegment(const rcChunkyTriMesh* cm, const float p[2], const float q[2],
+	std::vector<int>& ids)
+{
+	ids.clear();
+
+	const SegmentOverlap segment(p, q);
+
+	// Traverse tree
+	int i = 0;
+	while (i < cm->nnodes)
+	{
+		const rcChunkyTriMeshNode* node = &cm->nodes[i];
+		const bool overlap = segment.test(node->bmin, node->bmax);
+		const bool isLeafNode = node->i >= 0;
+
+		if (isLeafNode && overlap)
+			ids.push_back(i);
+
+		if (overlap || isLeafNode)
+			i++;
+		else
+			i += -node->i;
+	}
+}
@@ -18,6 +18,8 @@
 
 #pragma once
 
+#include <vector>
+
 struct rcChunkyTriMeshNode
 {
 	float bmin[2], bmax[2];
@@ -26,14 +28,17 @@ struct rcChunkyTriMeshNode
 
 struct rcChunkyTriMesh
 {
-	inline rcChunkyTriMesh() : nodes(0), tris(0) {};
-	inline ~rcChunkyTriMesh() { delete [] nodes; delete [] tris; }
+	inline rcChunkyTriMesh() : nodes(0), tris(0), ownsData(true) {};
+	inline ~rcChunkyTriMesh() { if (ownsData) { delete [] nodes; delete [] tris; } }
 
 	rcChunkyTriMeshNode* nodes;
 	int nnodes;
 	int* tris;
 	int ntris;
 	int maxTrisPerChunk;
+
+	// false if nodes and tris point into a mapped geometry cache
+	bool ownsData;
 };
 
 // Creates partitioned triangle mesh (AABB tree),
@@ -47,3 +52,10 @@ int rcGetChunksOverlappingRect(const rcChunkyTriMesh* cm, float bmin[2], float b
 // Returns the chunk indices which overlap the input segment.
 int rcGetChunksOverlappingSegment(const rcChunkyTriMesh* cm, float p[2], float q[2], int* ids, const int maxIds);
 
+// Same as above, but returns every overlapping chunk, growing ids as needed. ids
+// is cleared first.
+void rcGetChunksOverlappingRect(const rcChunkyTriMesh* cm, const float bmin[2], const float bmax[2],
+	std::vector<int>& ids);
+void rcGetChunksOverlappingSegment(const rcChunkyTriMesh* cm, const float p[2], const float q[2],
+	std::vector<int>& ids);
+
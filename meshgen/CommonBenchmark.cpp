@@ -0,0 +1,348 @@
+//
+// CommonBenchmark.cpp
+//
+
+#include "CommonBenchmark.h"
+
+#include "EQConfig.h"
+#include "common/Context.h"
+#include "common/FindPattern.h"
+#include "common/JsonProto.h"
+#include "common/NavMesh.h"
+#include "common/Signal.h"
+#include "common/Utilities.h"
+#include "common/proto/NavMeshFile.pb.h"
+
+#include <DetourNavMesh.h>
+#include <boost/filesystem.hpp>
+#include <google/protobuf/util/json_util.h>
+#include <rapidjson/document.h>
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <numeric>
+#include <random>
+#include <sstream>
+
+namespace fs = boost::filesystem;
+
+// emits timed for each number of connections
+static const int SIGNAL_EMITS = 100000;
+static const int SIGNAL_CONNECTIONS[] = { 1, 16, 256 };
+
+// the buffer searched for patterns, each pattern is only found at the very end
+static const uint32_t PATTERN_BUFFER_SIZE = 1024 * 1024;
+static const int PATTERN_COUNT = 8;
+static const int PATTERN_LENGTH = 16;
+
+using clock_type = std::chrono::high_resolution_clock;
+
+static double ElapsedMs(clock_type::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(clock_type::now() - start).count();
+}
+
+static double Median(std::vector<double> values)
+{
+	if (values.empty())
+		return 0;
+
+	std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+	return values[values.size() / 2];
+}
+
+//============================================================================
+
+CommonBenchmark::CommonBenchmark(EQConfig& eqConfig, Context* context)
+	: m_eqConfig(eqConfig)
+	, m_context(context)
+{
+}
+
+void CommonBenchmark::Measure(const std::string& name, uint64_t bytes, int operations,
+	const std::function<void()>& fn)
+{
+	// warms the caches and lets anything lazy happen outside of the samples
+	fn();
+
+	Case result;
+	result.name = name;
+	result.bytes = bytes;
+	result.operations = operations;
+
+	for (int i = 0; i < m_repeatCount; ++i)
+	{
+		auto start = clock_type::now();
+		fn();
+		result.samples.push_back(ElapsedMs(start));
+	}
+
+	m_cases.push_back(std::move(result));
+}
+
+bool CommonBenchmark::Run(const std::string& zoneShortName)
+{
+	m_cases.clear();
+
+	// the mesh is copied out, so the round-trips never write over the real one
+	boost::system::error_code ec;
+	fs::path workPath = fs::temp_directory_path(ec) / "MQ2NavBenchmark";
+	fs::create_directories(workPath, ec);
+
+	fs::path sourceFile = fs::path(m_eqConfig.GetOutputPath()) / "MQ2Nav"
+		/ (zoneShortName + NAVMESH_FILE_EXTENSION);
+	fs::path workFile = workPath / (zoneShortName + NAVMESH_FILE_EXTENSION);
+	fs::copy_file(sourceFile, workFile, fs::copy_option::overwrite_if_exists, ec);
+	if (ec)
+	{
+		m_context->Log(LogLevel::ERROR, "%s: failed to copy %s", zoneShortName.c_str(), sourceFile.string().c_str());
+		return false;
+	}
+
+	NavMesh navMesh(m_context, workPath.string(), zoneShortName);
+	NavMesh::LoadResult loadResult = navMesh.LoadNavMeshFile();
+	if (loadResult != NavMesh::LoadResult::Success)
+	{
+		m_context->Log(LogLevel::ERROR, "%s: failed to load navmesh (%d)", zoneShortName.c_str(), (int)loadResult);
+		return false;
+	}
+
+	//------------------------------------------------------------------------
+	// tile blobs
+
+	std::vector<std::vector<uint8_t>> tiles;
+	uint64_t tileBytes = 0;
+	{
+		std::shared_ptr<dtNavMesh> mesh = navMesh.GetNavMesh();
+		auto tilesLock = navMesh.LockTiles();
+
+		for (int i = 0; i < mesh->getMaxTiles(); ++i)
+		{
+			const dtMeshTile* tile = static_cast<const dtNavMesh&>(*mesh).getTile(i);
+			if (!tile || !tile->header || !tile->dataSize)
+				continue;
+
+			tiles.emplace_back(tile->data, tile->data + tile->dataSize);
+			tileBytes += tile->dataSize;
+		}
+	}
+
+	std::vector<std::vector<uint8_t>> compressed(tiles.size());
+	Measure("compress_tiles", tileBytes, (int)tiles.size(), [&]()
+	{
+		for (size_t i = 0; i < tiles.size(); ++i)
+			CompressMemory(tiles[i].data(), tiles[i].size(), compressed[i]);
+	});
+
+	std::vector<uint8_t> decompressed;
+	Measure("decompress_tiles", tileBytes, (int)tiles.size(), [&]()
+	{
+		for (size_t i = 0; i < tiles.size(); ++i)
+		{
+			decompressed.resize(tiles[i].size());
+			DecompressMemory(compressed[i].data(), compressed[i].size(), decompressed.data(), decompressed.size());
+		}
+	});
+
+	//------------------------------------------------------------------------
+	// json of the whole mesh
+
+	// the mesh as a message, by way of the export the tools use
+	nav::NavMeshFile proto;
+	{
+		std::string exportFile = (workPath / (zoneShortName + ".json")).string();
+		if (!navMesh.ExportJson(exportFile, PersistedDataFields::All))
+		{
+			m_context->Log(LogLevel::ERROR, "%s: failed to export the mesh as json", zoneShortName.c_str());
+			return false;
+		}
+
+		std::ifstream infile(exportFile);
+		std::stringstream contents;
+		contents << infile.rdbuf();
+
+		google::protobuf::util::JsonParseOptions options;
+		options.ignore_unknown_fields = true;
+		if (!google::protobuf::util::JsonStringToMessage(contents.str(), &proto, options).ok())
+		{
+			m_context->Log(LogLevel::ERROR, "%s: failed to read the exported json", zoneShortName.c_str());
+			return false;
+		}
+
+		fs::remove(exportFile, ec);
+	}
+
+	std::string json;
+	ProtoToJsonString(&proto, json);
+
+	Measure("proto_to_json", json.size(), 1, [&]()
+	{
+		std::string str;
+		ProtoToJsonString(&proto, str);
+	});
+
+	// parsing the text is rapidjson's, only the conversion of the document is timed
+	rapidjson::Document document;
+	document.Parse(json.c_str(), json.size());
+	if (document.HasParseError())
+	{
+		m_context->Log(LogLevel::ERROR, "%s: failed to parse the mesh json", zoneShortName.c_str());
+		return false;
+	}
+
+	Measure("json_to_proto", json.size(), 1, [&]()
+	{
+		nav::NavMeshFile message;
+		JsonToProto(&document, &message);
+	});
+
+	//------------------------------------------------------------------------
+	// signals
+
+	for (int connections : SIGNAL_CONNECTIONS)
+	{
+		Signal<int> signal;
+		volatile int sum = 0;
+		for (int i = 0; i < connections; ++i)
+			signal.Connect([&sum](int value) { sum += value; });
+
+		Measure("signal_emit_" + std::to_string(connections), 0, SIGNAL_EMITS, [&]()
+		{
+			for (int i = 0; i < SIGNAL_EMITS; ++i)
+				signal(i);
+		});
+	}
+
+	//------------------------------------------------------------------------
+	// pattern searches
+
+	std::vector<uint8_t> buffer(PATTERN_BUFFER_SIZE);
+	{
+		// fixed seed, so every run searches the same bytes
+		std::mt19937 rng(PATTERN_BUFFER_SIZE);
+		for (uint8_t& b : buffer)
+			b = static_cast<uint8_t>(rng());
+	}
+
+	// like the client's patterns, with a few wildcards, and put at the end so the
+	// searches go over all of it
+	std::vector<std::vector<uint8_t>> patterns(PATTERN_COUNT);
+	std::string mask(PATTERN_LENGTH, 'x');
+	mask[4] = mask[5] = mask[6] = mask[7] = '?';
+
+	std::vector<PatternSearch> searches(PATTERN_COUNT);
+	for (int i = 0; i < PATTERN_COUNT; ++i)
+	{
+		uint8_t* at = &buffer[PATTERN_BUFFER_SIZE - (i + 1) * PATTERN_LENGTH];
+		patterns[i].assign(at, at + PATTERN_LENGTH);
+		searches[i] = { patterns[i].data(), mask.c_str(), 0 };
+	}
+
+	const uintptr_t base = reinterpret_cast<uintptr_t>(buffer.data());
+
+	Measure("find_pattern", PATTERN_BUFFER_SIZE, 1, [&]()
+	{
+		FindPattern(base, PATTERN_BUFFER_SIZE, patterns[0].data(), mask.c_str());
+	});
+
+	Measure("find_patterns_" + std::to_string(PATTERN_COUNT), PATTERN_BUFFER_SIZE, PATTERN_COUNT, [&]()
+	{
+		FindPatterns(base, PATTERN_BUFFER_SIZE, searches.data(), searches.size());
+	});
+
+	//------------------------------------------------------------------------
+	// mesh files
+
+	uint64_t fileSize = fs::file_size(workFile, ec);
+
+	Measure("mesh_save", fileSize, 1, [&]()
+	{
+		navMesh.SaveNavMeshFile();
+	});
+
+	Measure("mesh_load", fileSize, 1, [&]()
+	{
+		NavMesh loaded(m_context, workPath.string(), zoneShortName);
+		loaded.LoadNavMeshFile();
+	});
+
+	fs::remove_all(workPath, ec);
+
+	Report();
+
+	if (!m_outputFile.empty() && !WriteResults(zoneShortName))
+	{
+		m_context->Log(LogLevel::ERROR, "Failed to write results to %s", m_outputFile.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+void CommonBenchmark::Report() const
+{
+	m_context->Log(LogLevel::INFO, "case                  |   min ms  median ms    mean ms |     MB/s");
+
+	for (const Case& c : m_cases)
+	{
+		double minMs = *std::min_element(c.samples.begin(), c.samples.end());
+		double medianMs = Median(c.samples);
+		double meanMs = std::accumulate(c.samples.begin(), c.samples.end(), 0.0) / c.samples.size();
+
+		if (c.bytes && medianMs > 0)
+		{
+			m_context->Log(LogLevel::INFO, "%-21s | %8.3f  %9.3f  %9.3f | %8.1f", c.name.c_str(),
+				minMs, medianMs, meanMs, c.bytes / (1024.0 * 1024.0) / (medianMs / 1000.0));
+		}
+		else
+		{
+			m_context->Log(LogLevel::INFO, "%-21s | %8.3f  %9.3f  %9.3f |", c.name.c_str(),
+				minMs, medianMs, meanMs);
+		}
+	}
+}
+
+bool CommonBenchmark::WriteResults(const std::string& zoneShortName) const
+{
+	rapidjson::StringBuffer buffer;
+	rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+	writer.SetIndent(' ', 2);
+
+	writer.StartObject();
+	writer.Key("zone"); writer.String(zoneShortName.c_str());
+	writer.Key("repeats"); writer.Int(m_repeatCount);
+	writer.Key("cases");
+	writer.StartArray();
+
+	for (const Case& c : m_cases)
+	{
+		writer.StartObject();
+		writer.Key("name"); writer.String(c.name.c_str());
+		writer.Key("bytes"); writer.Uint64(c.bytes);
+		writer.Key("operations"); writer.Int(c.operations);
+		writer.Key("min_ms"); writer.Double(*std::min_element(c.samples.begin(), c.samples.end()));
+		writer.Key("median_ms"); writer.Double(Median(c.samples));
+		writer.Key("mean_ms"); writer.Double(std::accumulate(c.samples.begin(), c.samples.end(), 0.0) / c.samples.size());
+		writer.Key("samples_ms");
+		writer.StartArray();
+		for (double sample : c.samples)
+			writer.Double(sample);
+		writer.EndArray();
+		writer.EndObject();
+	}
+
+	writer.EndArray();
+	writer.EndObject();
+
+	std::ofstream outfile(m_outputFile, std::ios::trunc);
+	if (!outfile.is_open())
+		return false;
+
+	outfile.write(buffer.GetString(), buffer.GetSize());
+	outfile << "\n";
+
+	return outfile.good();
+}
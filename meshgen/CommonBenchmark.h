@@ -0,0 +1,57 @@
+//
+// CommonBenchmark.h
+//
+
+// Times the shared code in common/ that the plugin and meshgen both lean on,
+// each piece by itself, on the data of a zone's saved navmesh: tile compression,
+// the json conversion of the whole mesh, signals, pattern searches and mesh file
+// round-trips. Results are written as json, so changes to any of them can be
+// compared between builds.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+class Context;
+class EQConfig;
+
+class CommonBenchmark
+{
+public:
+	CommonBenchmark(EQConfig& eqConfig, Context* context);
+
+	// time every case this many times
+	void SetRepeatCount(int repeats) { m_repeatCount = repeats; }
+
+	// if set, also write the results as json
+	void SetOutputFile(const std::string& filename) { m_outputFile = filename; }
+
+	// returns false if the navmesh couldn't be loaded
+	bool Run(const std::string& zoneShortName);
+
+private:
+	struct Case
+	{
+		std::string name;
+		uint64_t bytes = 0;            // processed by each run, 0 if it doesn't apply
+		int operations = 0;            // done by each run
+		std::vector<double> samples;   // ms per run
+	};
+
+	// run fn m_repeatCount times after a run that isn't counted
+	void Measure(const std::string& name, uint64_t bytes, int operations, const std::function<void()>& fn);
+
+	void Report() const;
+	bool WriteResults(const std::string& zoneShortName) const;
+
+	EQConfig& m_eqConfig;
+	Context* m_context;
+
+	int m_repeatCount = 10;
+	std::string m_outputFile;
+
+	std::vector<Case> m_cases;
+};
@@ -212,6 +212,8 @@ void ConvexVolumeTool::handleMenu()
 			&& m_state->m_currentVolumeId != 0
 			&& ImGuiEx::ColoredButton("Delete", ImVec2(-1, 0), 0.0))
 		{
+			m_meshTool->beginUndoStep("Delete Volume", true);
+
 			auto modifiedTiles = navMesh->GetTilesIntersectingConvexVolume(m_state->m_currentVolumeId);
 			navMesh->DeleteConvexVolumeById(m_state->m_currentVolumeId);
 
@@ -309,15 +311,25 @@ void ConvexVolumeTool::handleMenu()
 
 		if (m_state->m_modified && ImGui::Button("Save Changes"))
 		{
+			m_meshTool->beginUndoStep("Edit Volume", true);
+
 			if (ConvexVolume* vol = navMesh->GetConvexVolumeById(m_state->m_currentVolumeId))
 			{
+				// tiles the volume is leaving need a rebuild too
+				auto modifiedTiles = navMesh->GetTilesIntersectingConvexVolume(vol->id);
+
 				vol->areaType = m_state->m_editVolume.areaType;
 				vol->hmin = m_state->m_editVolume.hmin;
 				vol->hmax = m_state->m_editVolume.hmax;
 				vol->name = m_state->m_editVolume.name;
 				vol->verts = m_state->m_editVolume.verts;
+				navMesh->UpdateConvexVolume(vol);
+
+				auto newTiles = navMesh->GetTilesIntersectingConvexVolume(vol->id);
+				modifiedTiles.insert(modifiedTiles.end(), newTiles.begin(), newTiles.end());
+				std::sort(modifiedTiles.begin(), modifiedTiles.end());
+				modifiedTiles.erase(std::unique(modifiedTiles.begin(), modifiedTiles.end()), modifiedTiles.end());
 
-				auto modifiedTiles = navMesh->GetTilesIntersectingConvexVolume(vol->id);
 				if (!modifiedTiles.empty())
 				{
 					m_meshTool->RebuildTiles(modifiedTiles);
@@ -493,6 +505,8 @@ std::vector<dtTileRef> ConvexVolumeToolState::handleVolumeClick(const glm::vec3&
 		// If end point close enough, delete it.
 		if (nearestIndex != -1)
 		{ 
+			m_meshTool->beginUndoStep("Delete Volume", true);
+
 			const ConvexVolume* volume = navMesh->GetConvexVolume(nearestIndex);
 			modifiedTiles = navMesh->GetTilesIntersectingConvexVolume(volume->id);
 			m_meshTool->GetNavMesh()->DeleteConvexVolumeById(volume->id);
@@ -531,6 +545,8 @@ std::vector<dtTileRef> ConvexVolumeToolState::CreateShape()
 
 	if (m_hull.size() > 2)
 	{
+		m_meshTool->beginUndoStep("Add Volume", true);
+
 		std::vector<glm::vec3> verts(m_hull.size());
 
 		// Create shape.
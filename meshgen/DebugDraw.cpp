@@ -3,10 +3,27 @@
 //
 
 #include "DebugDraw.h"
+#include "InputGeom.h"
+#include "MapGeometryLoader.h"
+
+#include <DetourDebugDraw.h>
+#include <DetourNavMeshQuery.h>
+#include <DetourNode.h>
+#include <RecastDebugDraw.h>
 
 #include <SDL.h>
 #include <SDL_OpenGL.h>
 
+#include <cfloat>
+#include <cmath>
+#include <unordered_map>
+
+// input geometry goes into display lists of about this many triangles
+static const int GEOM_DRAW_CHUNK_TRIS = 8192;
+
+// placed models are grouped into squares of this size before they are batched
+static const float GEOM_DRAW_INSTANCE_CELL = 512.0f;
+
 //----------------------------------------------------------------------------
 
 class GLCheckerTexture
@@ -130,3 +147,376 @@ void DebugDrawGL::end()
 	glLineWidth(1.0f);
 	glPointSize(1.0f);
 }
+
+//----------------------------------------------------------------------------
+
+NavMeshTileDrawCache::~NavMeshTileDrawCache()
+{
+	clear();
+}
+
+void NavMeshTileDrawCache::releaseEntry(TileEntry& entry)
+{
+	if (entry.list)
+		glDeleteLists(entry.list, 1);
+
+	entry = TileEntry{};
+}
+
+void NavMeshTileDrawCache::clear()
+{
+	for (TileEntry& entry : m_tiles)
+		releaseEntry(entry);
+
+	m_tiles.clear();
+}
+
+void NavMeshTileDrawCache::draw(DebugDrawGL* dd, const dtNavMesh& mesh, const dtNavMeshQuery& query,
+	unsigned char flags, uint32_t colorKey)
+{
+	const unsigned char tileFlags = flags & ~DU_DRAWNAVMESH_CLOSEDLIST;
+
+	if ((int)m_tiles.size() != mesh.getMaxTiles())
+	{
+		clear();
+		m_tiles.resize(mesh.getMaxTiles());
+	}
+
+	for (int i = 0; i < mesh.getMaxTiles(); ++i)
+	{
+		const dtMeshTile* tile = mesh.getTile(i);
+		TileEntry& entry = m_tiles[i];
+
+		if (!tile->header)
+		{
+			releaseEntry(entry);
+			continue;
+		}
+
+		// the salt in the tile ref changes every time a tile is replaced
+		dtTileRef ref = mesh.getTileRef(tile);
+
+		if (!entry.list || entry.mesh != &mesh || entry.ref != ref || entry.data != tile->data
+			|| entry.flags != tileFlags || entry.colorKey != colorKey)
+		{
+			if (!entry.list)
+				entry.list = glGenLists(1);
+
+			if (!entry.list)
+			{
+				// out of display lists, just draw it directly
+				drawMeshTile(dd, mesh, nullptr, tile, tileFlags);
+				continue;
+			}
+
+			glNewList(entry.list, GL_COMPILE);
+			drawMeshTile(dd, mesh, nullptr, tile, tileFlags);
+			glEndList();
+
+			entry.mesh = &mesh;
+			entry.ref = ref;
+			entry.data = tile->data;
+			entry.flags = tileFlags;
+			entry.colorKey = colorKey;
+		}
+
+		glCallList(entry.list);
+	}
+
+	if (flags & DU_DRAWNAVMESH_CLOSEDLIST)
+	{
+		const dtNodePool* pool = query.getNodePool();
+		if (pool)
+		{
+			for (int i = 0; i < pool->getHashSize(); ++i)
+			{
+				for (dtNodeIndex j = pool->getFirst(i); j != DT_NULL_IDX; j = pool->getNext(j))
+				{
+					const dtNode* node = pool->getNodeAtIdx(j + 1);
+					if (node && (node->flags & DT_NODE_CLOSED))
+						duDebugDrawNavMeshPoly(dd, mesh, node->id, duRGBA(255, 196, 0, 64));
+				}
+			}
+		}
+
+		// leave the depth mask the way drawMeshTile does
+		dd->depthMask(false);
+	}
+}
+
+//----------------------------------------------------------------------------
+
+// the planes of the view frustum, pointing inwards, out of a projection times
+// modelview matrix
+static void GetFrustumPlanes(const glm::mat4& m, glm::vec4 planes[6])
+{
+	const glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+	const glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+	const glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+	const glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+	planes[0] = row3 + row0;
+	planes[1] = row3 - row0;
+	planes[2] = row3 + row1;
+	planes[3] = row3 - row1;
+	planes[4] = row3 + row2;
+	planes[5] = row3 - row2;
+}
+
+// false only if the box is entirely outside one of the planes
+static bool BoxInFrustum(const glm::vec4 planes[6], const glm::vec3& bmin, const glm::vec3& bmax)
+{
+	for (int i = 0; i < 6; ++i)
+	{
+		const glm::vec4& p = planes[i];
+
+		// the corner furthest along the plane's normal
+		const glm::vec3 corner(p.x >= 0 ? bmax.x : bmin.x, p.y >= 0 ? bmax.y : bmin.y,
+			p.z >= 0 ? bmax.z : bmin.z);
+		if (p.x * corner.x + p.y * corner.y + p.z * corner.z + p.w < 0)
+			return false;
+	}
+
+	return true;
+}
+
+static void CalcTriNormal(const float* v0, const float* v1, const float* v2, float* n)
+{
+	float e0[3], e1[3];
+	for (int j = 0; j < 3; ++j)
+	{
+		e0[j] = v1[j] - v0[j];
+		e1[j] = v2[j] - v0[j];
+	}
+
+	n[0] = e0[1]*e1[2] - e0[2]*e1[1];
+	n[1] = e0[2]*e1[0] - e0[0]*e1[2];
+	n[2] = e0[0]*e1[1] - e0[1]*e1[0];
+	float d = sqrtf(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+	if (d > 0)
+	{
+		d = 1.0f/d;
+		n[0] *= d;
+		n[1] *= d;
+		n[2] *= d;
+	}
+}
+
+InputGeomDrawCache::~InputGeomDrawCache()
+{
+	clear();
+}
+
+void InputGeomDrawCache::clear()
+{
+	for (Chunk& chunk : m_chunks)
+	{
+		if (chunk.list)
+			glDeleteLists(chunk.list, 1);
+	}
+
+	m_chunks.clear();
+	m_geom = nullptr;
+	m_geomData = nullptr;
+	m_chunksDrawn = 0;
+}
+
+void InputGeomDrawCache::build(const InputGeom& geom)
+{
+	clear();
+
+	const MapGeometryLoader* loader = geom.getMeshLoader();
+	const rcChunkyTriMesh* chunkyMesh = geom.getChunkyMesh();
+	if (!loader)
+		return;
+
+	// the chunky mesh keeps the triangles of each subtree together, so a run of
+	// leaves in node order stays in one part of the zone
+	if (chunkyMesh)
+	{
+		const float* verts = loader->getVerts();
+		Chunk chunk;
+
+		auto addTris = [&](int first, int count)
+		{
+			if (chunk.triCount == 0)
+			{
+				chunk.firstTri = first;
+				chunk.bmin = glm::vec3(FLT_MAX);
+				chunk.bmax = glm::vec3(-FLT_MAX);
+			}
+
+			for (int i = first * 3; i < (first + count) * 3; ++i)
+			{
+				const glm::vec3 v(verts[chunkyMesh->tris[i] * 3 + 0], verts[chunkyMesh->tris[i] * 3 + 1],
+					verts[chunkyMesh->tris[i] * 3 + 2]);
+				chunk.bmin = glm::min(chunk.bmin, v);
+				chunk.bmax = glm::max(chunk.bmax, v);
+			}
+
+			chunk.triCount += count;
+		};
+
+		for (int i = 0; i < chunkyMesh->nnodes; ++i)
+		{
+			const rcChunkyTriMeshNode& node = chunkyMesh->nodes[i];
+			if (node.i < 0 || node.n == 0)
+				continue;
+
+			// leaves aren't always next to each other in the triangle list
+			if (chunk.triCount > 0 && chunk.firstTri + chunk.triCount != node.i)
+			{
+				m_chunks.push_back(std::move(chunk));
+				chunk = Chunk{};
+			}
+
+			addTris(node.i, node.n);
+
+			if (chunk.triCount >= GEOM_DRAW_CHUNK_TRIS)
+			{
+				m_chunks.push_back(std::move(chunk));
+				chunk = Chunk{};
+			}
+		}
+
+		if (chunk.triCount > 0)
+			m_chunks.push_back(std::move(chunk));
+	}
+
+	// placed models by the square that their center is in
+	const MeshInstances& instances = geom.getMeshInstances();
+	std::unordered_map<uint64_t, std::vector<int>> cells;
+	for (int i = 0; i < instances.GetInstanceCount(); ++i)
+	{
+		const MeshInstances::Instance& instance = instances.GetInstance(i);
+		const glm::vec3 center = (instance.bmin + instance.bmax) * 0.5f;
+		const int cx = (int)floorf(center.x / GEOM_DRAW_INSTANCE_CELL);
+		const int cz = (int)floorf(center.z / GEOM_DRAW_INSTANCE_CELL);
+
+		cells[((uint64_t)(uint32_t)cx << 32) | (uint32_t)cz].push_back(i);
+	}
+
+	for (const auto& cell : cells)
+	{
+		Chunk chunk;
+		for (int index : cell.second)
+		{
+			const MeshInstances::Instance& instance = instances.GetInstance(index);
+			const int triCount = (int)instances.GetModel(instance.model).tris.size() / 3;
+
+			if (chunk.instances.empty())
+			{
+				chunk.bmin = instance.bmin;
+				chunk.bmax = instance.bmax;
+			}
+
+			chunk.instances.push_back(index);
+			chunk.bmin = glm::min(chunk.bmin, instance.bmin);
+			chunk.bmax = glm::max(chunk.bmax, instance.bmax);
+			chunk.triCount += triCount;
+
+			if (chunk.triCount >= GEOM_DRAW_CHUNK_TRIS)
+			{
+				m_chunks.push_back(std::move(chunk));
+				chunk = Chunk{};
+			}
+		}
+
+		if (!chunk.instances.empty())
+			m_chunks.push_back(std::move(chunk));
+	}
+
+	m_geom = &geom;
+	m_geomData = loader->getVerts();
+}
+
+void InputGeomDrawCache::drawChunk(DebugDrawGL* dd, const InputGeom& geom, const Chunk& chunk) const
+{
+	std::vector<float> verts, normals;
+	std::vector<int> tris;
+
+	if (chunk.instances.empty())
+	{
+		const MapGeometryLoader* loader = geom.getMeshLoader();
+		const rcChunkyTriMesh* chunkyMesh = geom.getChunkyMesh();
+		const float* meshVerts = loader->getVerts();
+		const int* chunkTris = &chunkyMesh->tris[chunk.firstTri * 3];
+
+		// the chunky mesh has the triangles in its own order, so the loader's
+		// normals don't line up with them
+		normals.resize(chunk.triCount * 3);
+		for (int i = 0; i < chunk.triCount; ++i)
+		{
+			CalcTriNormal(&meshVerts[chunkTris[i * 3 + 0] * 3], &meshVerts[chunkTris[i * 3 + 1] * 3],
+				&meshVerts[chunkTris[i * 3 + 2] * 3], &normals[i * 3]);
+		}
+
+		duDebugDrawTriMeshSlope(dd, meshVerts, loader->getVertCount(), chunkTris, normals.data(),
+			chunk.triCount, m_walkableSlopeAngle, m_texScale);
+	}
+	else
+	{
+		const MeshInstances& instances = geom.getMeshInstances();
+		for (int index : chunk.instances)
+			instances.AppendInstanceMesh(index, verts, tris, &normals);
+
+		duDebugDrawTriMeshSlope(dd, verts.data(), (int)verts.size() / 3, tris.data(), normals.data(),
+			(int)tris.size() / 3, m_walkableSlopeAngle, m_texScale);
+	}
+}
+
+void InputGeomDrawCache::draw(DebugDrawGL* dd, const InputGeom& geom, const glm::mat4& viewProj,
+	float walkableSlopeAngle, float texScale)
+{
+	if (m_geom != &geom || !geom.getMeshLoader() || m_geomData != geom.getMeshLoader()->getVerts())
+		build(geom);
+
+	// the colors and texture coordinates are baked into the lists
+	if (walkableSlopeAngle != m_walkableSlopeAngle || texScale != m_texScale)
+	{
+		for (Chunk& chunk : m_chunks)
+		{
+			if (chunk.list)
+				glDeleteLists(chunk.list, 1);
+			chunk.list = 0;
+		}
+
+		m_walkableSlopeAngle = walkableSlopeAngle;
+		m_texScale = texScale;
+	}
+
+	glm::vec4 planes[6];
+	GetFrustumPlanes(viewProj, planes);
+
+	// the checker texture is made the first time it's bound, which can't happen
+	// while a list is being compiled
+	dd->texture(true);
+	dd->texture(false);
+
+	m_chunksDrawn = 0;
+	for (Chunk& chunk : m_chunks)
+	{
+		if (!BoxInFrustum(planes, chunk.bmin, chunk.bmax))
+			continue;
+
+		++m_chunksDrawn;
+
+		if (!chunk.list)
+		{
+			chunk.list = glGenLists(1);
+
+			if (!chunk.list)
+			{
+				// out of display lists, just draw it directly
+				drawChunk(dd, geom, chunk);
+				continue;
+			}
+
+			glNewList(chunk.list, GL_COMPILE);
+			drawChunk(dd, geom, chunk);
+			glEndList();
+		}
+
+		glCallList(chunk.list);
+	}
+}
@@ -5,9 +5,18 @@
 #pragma once
 
 #include <DebugDraw.h>
+#include <DetourNavMesh.h>
 #include <Recast.h>
 #include <RecastDump.h>
 
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+class dtNavMeshQuery;
+class InputGeom;
+
 // OpenGL debug draw implementation.
 class DebugDrawGL : public duDebugDraw
 {
@@ -21,3 +30,79 @@ public:
 	virtual void vertex(const float x, const float y, const float z, unsigned int color, const float u, const float v) override;
 	virtual void end() override;
 };
+
+// Keeps the debug drawing of each navmesh tile in a display list, so that the
+// mesh isn't sent to the driver vertex by vertex every frame. A tile is only
+// drawn again once it has been replaced in the navmesh, or when the flags or
+// colors it was drawn with have changed. The closed list of the query changes
+// with every search, so it is drawn on top of the cached tiles instead.
+class NavMeshTileDrawCache
+{
+public:
+	~NavMeshTileDrawCache();
+
+	// same output as duDebugDrawNavMeshWithClosedList. colorKey stands in for
+	// anything else the colors of the tiles depend on, like the area colors.
+	void draw(DebugDrawGL* dd, const dtNavMesh& mesh, const dtNavMeshQuery& query,
+		unsigned char flags, uint32_t colorKey);
+
+	void clear();
+
+private:
+	struct TileEntry
+	{
+		const dtNavMesh* mesh = nullptr;
+		dtTileRef ref = 0;
+		const unsigned char* data = nullptr;
+		unsigned char flags = 0;
+		uint32_t colorKey = 0;
+		unsigned int list = 0;
+	};
+
+	void releaseEntry(TileEntry& entry);
+
+	std::vector<TileEntry> m_tiles;
+};
+
+// Keeps the input geometry in display lists of a few thousand triangles each,
+// made once per zone from runs of the chunky mesh's leaves and from the placed
+// models, grouped by where they are. Each frame only the lists whose bounds are
+// in the view frustum are called. The lists are made again when the slope or
+// the texture scale they were colored with changes.
+class InputGeomDrawCache
+{
+public:
+	~InputGeomDrawCache();
+
+	// same output as duDebugDrawTriMeshSlope over the zone and its placed models.
+	// viewProj is the projection times the modelview matrix, for culling.
+	void draw(DebugDrawGL* dd, const InputGeom& geom, const glm::mat4& viewProj,
+		float walkableSlopeAngle, float texScale);
+
+	void clear();
+
+	int getChunkCount() const { return (int)m_chunks.size(); }
+	int getChunksDrawn() const { return m_chunksDrawn; }
+
+private:
+	struct Chunk
+	{
+		glm::vec3 bmin, bmax;
+		unsigned int list = 0;
+
+		// a run of triangles of the chunky mesh, or placed models
+		int firstTri = 0;
+		int triCount = 0;
+		std::vector<int> instances;
+	};
+
+	void build(const InputGeom& geom);
+	void drawChunk(DebugDrawGL* dd, const InputGeom& geom, const Chunk& chunk) const;
+
+	const InputGeom* m_geom = nullptr;
+	const void* m_geomData = nullptr;
+	float m_walkableSlopeAngle = 0.0f;
+	float m_texScale = 0.0f;
+	std::vector<Chunk> m_chunks;
+	int m_chunksDrawn = 0;
+};
@@ -0,0 +1,522 @@
+//
+// DistributedBuilder.cpp
+//
+
+#include "DistributedBuilder.h"
+
+#include "Application.h"
+#include "EQConfig.h"
+#include "InputGeom.h"
+#include "NavMeshTool.h"
+#include "common/NavMesh.h"
+#include "common/proto/NavMeshFile.pb.h"
+
+#include <DetourAlloc.h>
+#include <DetourNavMesh.h>
+#include <Recast.h>
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <thread>
+
+namespace fs = boost::filesystem;
+
+// how often the coordinator looks for finished jobs
+static const std::chrono::seconds POLL_INTERVAL{ 2 };
+
+//----------------------------------------------------------------------------
+
+// write a small file under another name first and move it into place, so that
+// it's never read half written from another machine.
+static bool WriteFileAtomic(const std::string& filename, const std::string& contents)
+{
+	std::string tempFilename = filename + ".tmp";
+
+	{
+		std::ofstream outfile(tempFilename, std::ios::trunc);
+		if (!outfile.is_open())
+			return false;
+
+		outfile << contents;
+		if (!outfile.good())
+			return false;
+	}
+
+	boost::system::error_code ec;
+	fs::rename(tempFilename, filename, ec);
+	return !ec;
+}
+
+// replace the tiles of the target in the columns [firstColumn, lastColumn) with
+// the tiles that the source has there.
+static bool CopyTileColumns(dtNavMesh& target, const dtNavMesh& source,
+	int firstColumn, int lastColumn, NavMesh* targetHashes, const NavMesh* sourceHashes)
+{
+	for (int i = 0; i < target.getMaxTiles(); ++i)
+	{
+		const dtMeshTile* tile = const_cast<const dtNavMesh&>(target).getTile(i);
+		if (!tile || !tile->header)
+			continue;
+
+		const dtMeshHeader* header = tile->header;
+		if (header->x < firstColumn || header->x >= lastColumn)
+			continue;
+
+		if (targetHashes)
+			targetHashes->SetTileBuildHash(header->x, header->y, header->layer, 0);
+
+		target.removeTile(target.getTileRef(tile), nullptr, nullptr);
+	}
+
+	for (int i = 0; i < source.getMaxTiles(); ++i)
+	{
+		const dtMeshTile* tile = source.getTile(i);
+		if (!tile || !tile->header || !tile->dataSize)
+			continue;
+
+		const dtMeshHeader* header = tile->header;
+		if (header->x < firstColumn || header->x >= lastColumn)
+			continue;
+
+		// the source may only have the tile mapped from its file
+		unsigned char* data = static_cast<unsigned char*>(dtAlloc(tile->dataSize, DT_ALLOC_PERM));
+		if (!data)
+			return false;
+		memcpy(data, tile->data, tile->dataSize);
+
+		if (dtStatusFailed(target.addTile(data, tile->dataSize, DT_TILE_FREE_DATA, 0, nullptr)))
+		{
+			dtFree(data);
+			return false;
+		}
+
+		if (targetHashes && sourceHashes)
+		{
+			targetHashes->SetTileBuildHash(header->x, header->y, header->layer,
+				sourceHashes->GetTileBuildHash(header->x, header->y, header->layer));
+		}
+	}
+
+	return true;
+}
+
+//============================================================================
+
+DistributedBuilder::DistributedBuilder(EQConfig& eqConfig, Context* context,
+	const std::string& sharedFolder)
+	: m_eqConfig(eqConfig)
+	, m_context(context)
+	, m_sharedFolder(sharedFolder)
+{
+}
+
+std::string DistributedBuilder::GetJobName(const std::string& zoneShortName, int part) const
+{
+	return zoneShortName + "." + std::to_string(part);
+}
+
+std::string DistributedBuilder::GetFolder(const char* name) const
+{
+	return (fs::path(m_sharedFolder) / name).string();
+}
+
+//----------------------------------------------------------------------------
+
+int DistributedBuilder::RunCoordinator()
+{
+	std::vector<ZoneJob> zoneJobs;
+
+	if (m_zones.empty())
+	{
+		for (const auto& entry : m_eqConfig.GetAllMaps())
+			m_zones.push_back(entry.first);
+	}
+
+	for (const std::string& zone : m_zones)
+	{
+		ZoneJob zoneJob;
+		zoneJob.zoneShortName = zone;
+		zoneJobs.push_back(std::move(zoneJob));
+	}
+
+	// start from an empty share, anything left in it is from an earlier run
+	for (const char* name : { "input", "jobs", "claimed", "results" })
+	{
+		boost::system::error_code ec;
+		fs::remove_all(GetFolder(name), ec);
+		fs::create_directories(GetFolder(name), ec);
+
+		if (ec)
+		{
+			m_context->Log(LogLevel::ERROR, "Distributed build: could not create %s: %s",
+				GetFolder(name).c_str(), ec.message().c_str());
+			return static_cast<int>(zoneJobs.size());
+		}
+	}
+
+	if (!WriteJobs(zoneJobs))
+		return static_cast<int>(zoneJobs.size());
+
+	int jobCount = 0;
+	for (const ZoneJob& zoneJob : zoneJobs)
+		jobCount += zoneJob.parts;
+
+	m_context->Log(LogLevel::INFO, "Distributed build: %d zones in %d jobs, waiting for workers on %s",
+		(int)zoneJobs.size(), jobCount, m_sharedFolder.c_str());
+
+	auto startTime = std::chrono::steady_clock::now();
+	std::vector<std::string> failedZones;
+	size_t zonesLeft = zoneJobs.size();
+
+	// zones are put together as soon as all of their parts are in
+	while (zonesLeft > 0)
+	{
+		for (ZoneJob& zoneJob : zoneJobs)
+		{
+			if (zoneJob.assembled)
+				continue;
+
+			bool finished = true;
+			for (int part = 0; part < zoneJob.parts; ++part)
+			{
+				if (zoneJob.done[part])
+					continue;
+
+				std::string doneFile = (fs::path(GetFolder("results"))
+					/ (GetJobName(zoneJob.zoneShortName, part) + ".done")).string();
+
+				std::ifstream infile(doneFile);
+				int status = 0;
+				if (!(infile >> status >> zoneJob.columns[part].first >> zoneJob.columns[part].second))
+				{
+					finished = false;
+					continue;
+				}
+
+				zoneJob.done[part] = true;
+				if (!status)
+					zoneJob.failed = true;
+			}
+
+			if (!finished)
+				continue;
+
+			if (zoneJob.failed || !AssembleZone(zoneJob))
+			{
+				m_context->Log(LogLevel::ERROR, "%s: distributed build failed", zoneJob.zoneShortName.c_str());
+				failedZones.push_back(zoneJob.zoneShortName);
+			}
+			else
+			{
+				m_context->Log(LogLevel::INFO, "%s: assembled from %d parts", zoneJob.zoneShortName.c_str(),
+					zoneJob.parts);
+			}
+
+			zoneJob.assembled = true;
+			--zonesLeft;
+		}
+
+		if (zonesLeft > 0)
+			std::this_thread::sleep_for(POLL_INTERVAL);
+	}
+
+	auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
+		std::chrono::steady_clock::now() - startTime);
+
+	m_context->Log(LogLevel::INFO, "Distributed build finished in %d seconds, %d zones failed",
+		(int)elapsed.count(), (int)failedZones.size());
+
+	for (const std::string& zone : failedZones)
+		m_context->Log(LogLevel::ERROR, "  failed: %s", zone.c_str());
+
+	return static_cast<int>(failedZones.size());
+}
+
+bool DistributedBuilder::WriteJobs(std::vector<ZoneJob>& zoneJobs)
+{
+	std::string meshFolder = m_eqConfig.GetOutputPath() + "\\MQ2Nav";
+
+	for (ZoneJob& zoneJob : zoneJobs)
+	{
+		const std::string& zone = zoneJob.zoneShortName;
+		zoneJob.parts = std::max(1, m_partCount);
+
+		// workers use the settings, volumes and areas of the existing mesh
+		fs::path meshFile = fs::path(meshFolder) / (zone + NAVMESH_FILE_EXTENSION);
+		if (fs::exists(meshFile))
+		{
+			boost::system::error_code ec;
+			fs::copy_file(meshFile, fs::path(GetFolder("input")) / meshFile.filename(),
+				fs::copy_option::overwrite_if_exists, ec);
+			if (ec)
+			{
+				m_context->Log(LogLevel::ERROR, "%s: could not copy the existing navmesh to the share: %s",
+					zone.c_str(), ec.message().c_str());
+				return false;
+			}
+
+			// the tile cache and pruning both need every tile of the zone
+			nav::NavMeshFile summary;
+			if (NavMesh::ReadMeshFileSummary(meshFile.string(), summary))
+			{
+				const nav::BuildSettings& settings = summary.build_settings();
+				if (settings.use_tile_cache() || settings.prune_unreachable())
+					zoneJob.parts = 1;
+			}
+		}
+
+		zoneJob.done.assign(zoneJob.parts, false);
+		zoneJob.columns.assign(zoneJob.parts, std::make_pair(0, 0));
+
+		for (int part = 0; part < zoneJob.parts; ++part)
+		{
+			std::string jobFile = (fs::path(GetFolder("jobs")) / (GetJobName(zone, part) + ".job")).string();
+
+			if (!WriteFileAtomic(jobFile, zone + " " + std::to_string(part) + " "
+				+ std::to_string(zoneJob.parts) + "\n"))
+			{
+				m_context->Log(LogLevel::ERROR, "Distributed build: could not write %s", jobFile.c_str());
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+bool DistributedBuilder::AssembleZone(const ZoneJob& zoneJob)
+{
+	const std::string& zone = zoneJob.zoneShortName;
+
+	auto LoadPart = [&](int part)
+	{
+		std::string partFolder = (fs::path(GetFolder("results")) / GetJobName(zone, part)).string();
+
+		auto navMesh = std::make_unique<NavMesh>(m_context, partFolder, zone);
+		navMesh->SetKeepBuildCapacity(true);
+		navMesh->SetLoadAgentMeshes(true);
+
+		if (navMesh->LoadNavMeshFile() != NavMesh::LoadResult::Success)
+		{
+			m_context->Log(LogLevel::ERROR, "%s: could not load the navmesh of part %d", zone.c_str(), part);
+			navMesh.reset();
+		}
+
+		return navMesh;
+	};
+
+	// the first part that built anything is the base, the others bring their
+	// columns into it. Parts can be empty when there are more parts than columns.
+	int basePart = 0;
+	while (basePart < zoneJob.parts && zoneJob.columns[basePart].first >= zoneJob.columns[basePart].second)
+		++basePart;
+
+	if (basePart == zoneJob.parts)
+	{
+		m_context->Log(LogLevel::ERROR, "%s: no tiles were built", zone.c_str());
+		return false;
+	}
+
+	std::unique_ptr<NavMesh> navMesh = LoadPart(basePart);
+	if (!navMesh)
+		return false;
+
+	for (int part = basePart + 1; part < zoneJob.parts; ++part)
+	{
+		const std::pair<int, int>& columns = zoneJob.columns[part];
+		if (columns.first >= columns.second)
+			continue;
+
+		std::unique_ptr<NavMesh> partMesh = LoadPart(part);
+		if (!partMesh)
+			return false;
+
+		// every part is built from the same settings, so the layouts should match
+		const auto& agentMeshes = navMesh->GetAgentNavMeshes();
+		const auto& partAgentMeshes = partMesh->GetAgentNavMeshes();
+		if (memcmp(navMesh->GetNavMesh()->getParams(), partMesh->GetNavMesh()->getParams(), sizeof(dtNavMeshParams)) != 0
+			|| agentMeshes.size() != partAgentMeshes.size())
+		{
+			m_context->Log(LogLevel::ERROR, "%s: part %d was built with different settings", zone.c_str(), part);
+			return false;
+		}
+
+		bool success = CopyTileColumns(*navMesh->GetNavMesh(), *partMesh->GetNavMesh(),
+			columns.first, columns.second, navMesh.get(), partMesh.get());
+
+		for (size_t i = 0; success && i < agentMeshes.size(); ++i)
+		{
+			success = CopyTileColumns(*agentMeshes[i].navMesh, *partAgentMeshes[i].navMesh,
+				columns.first, columns.second, nullptr, nullptr);
+		}
+
+		if (!success)
+		{
+			m_context->Log(LogLevel::ERROR, "%s: could not add the tiles of part %d", zone.c_str(), part);
+			return false;
+		}
+	}
+
+	navMesh->BuildTileGraph();
+	navMesh->BuildLandmarks();
+	navMesh->SetNavMeshDirectory(m_eqConfig.GetOutputPath() + "\\MQ2Nav");
+
+	return navMesh->SaveNavMeshFile();
+}
+
+//----------------------------------------------------------------------------
+
+int DistributedBuilder::RunWorker()
+{
+	int jobsBuilt = 0;
+	int jobsFailed = 0;
+
+	std::string zone;
+	int part = 0, parts = 1;
+
+	while (ClaimJob(zone, part, parts))
+	{
+		m_context->Log(LogLevel::INFO, "%s: building part %d of %d", zone.c_str(), part + 1, parts);
+
+		int firstColumn = 0, lastColumn = 0;
+		bool success = BuildPart(zone, part, parts, firstColumn, lastColumn);
+
+		std::string jobName = GetJobName(zone, part);
+		std::string doneFile = (fs::path(GetFolder("results")) / (jobName + ".done")).string();
+
+		if (!WriteFileAtomic(doneFile, std::to_string(success ? 1 : 0) + " "
+			+ std::to_string(firstColumn) + " " + std::to_string(lastColumn) + "\n"))
+		{
+			m_context->Log(LogLevel::ERROR, "%s: could not write %s", zone.c_str(), doneFile.c_str());
+			success = false;
+		}
+
+		boost::system::error_code ec;
+		fs::remove(fs::path(GetFolder("claimed")) / (jobName + ".job"), ec);
+
+		++jobsBuilt;
+		if (!success)
+			++jobsFailed;
+	}
+
+	m_context->Log(LogLevel::INFO, "Distributed build: worker finished %d jobs, %d failed",
+		jobsBuilt, jobsFailed);
+
+	return jobsFailed;
+}
+
+bool DistributedBuilder::ClaimJob(std::string& zoneShortName, int& part, int& parts)
+{
+	boost::system::error_code ec;
+	for (fs::directory_iterator iter(GetFolder("jobs"), ec), end; !ec && iter != end; iter.increment(ec))
+	{
+		const fs::path& jobFile = iter->path();
+		if (jobFile.extension() != ".job")
+			continue;
+
+		// only one worker can move the job, the others find it gone
+		fs::path claimedFile = fs::path(GetFolder("claimed")) / jobFile.filename();
+
+		boost::system::error_code renameError;
+		fs::rename(jobFile, claimedFile, renameError);
+		if (renameError)
+			continue;
+
+		std::ifstream infile(claimedFile.string());
+		if (infile >> zoneShortName >> part >> parts)
+			return true;
+
+		m_context->Log(LogLevel::ERROR, "Distributed build: could not read %s", claimedFile.string().c_str());
+	}
+
+	return false;
+}
+
+bool DistributedBuilder::BuildPart(const std::string& zoneShortName, int part, int parts,
+	int& firstColumn, int& lastColumn)
+{
+	auto rcContext = std::make_unique<BuildContext>(m_context);
+
+	auto geom = std::make_unique<InputGeom>(zoneShortName,
+		m_eqConfig.GetEverquestPath(), m_eqConfig.GetOutputPath());
+	if (!geom->loadGeometry(rcContext.get(), true))
+	{
+		m_context->Log(LogLevel::ERROR, "%s: failed to load zone geometry", zoneShortName.c_str());
+		return false;
+	}
+
+	auto navMesh = std::make_shared<NavMesh>(m_context, GetFolder("input"), zoneShortName);
+	navMesh->SetKeepBuildCapacity(true);
+	navMesh->SetLoadAgentMeshes(true);
+	auto meshTool = std::make_unique<NavMeshTool>(navMesh);
+	meshTool->setContext(rcContext.get());
+	meshTool->setOutputPath(m_eqConfig.GetOutputPath().c_str());
+	meshTool->setBuildThreadCount(m_threadCount);
+	meshTool->setBuildPriority(NavMeshTool::BuildPriority::Turbo);
+	meshTool->handleGeometryChanged(geom.get());
+
+	NavMesh::LoadResult loadResult = navMesh->LoadNavMeshFile();
+	if (loadResult != NavMesh::LoadResult::Success
+		&& loadResult != NavMesh::LoadResult::MissingFile)
+	{
+		m_context->Log(LogLevel::WARNING, "%s: existing navmesh could not be loaded (%d), using default settings",
+			zoneShortName.c_str(), (int)loadResult);
+	}
+
+	// the part is a strip of tile columns. The region runs through the middle of
+	// the outer columns so it doesn't touch the tiles of the next strip.
+	const NavMeshConfig& config = navMesh->GetNavMeshConfig();
+	const glm::vec3& bmin = navMesh->GetNavMeshBoundsMin();
+	const glm::vec3& bmax = navMesh->GetNavMeshBoundsMax();
+	int gw = 0, gh = 0;
+	rcCalcGridSize(&bmin[0], &bmax[0], config.cellSize, &gw, &gh);
+	const int ts = (int)config.tileSize;
+	const int tw = (gw + ts - 1) / ts;
+	const float tcs = config.tileSize * config.cellSize;
+
+	firstColumn = part * tw / parts;
+	lastColumn = (part + 1) * tw / parts;
+	if (firstColumn >= lastColumn)
+		return true;
+
+	std::vector<NavMeshTool::BuildRegion> regions;
+	if (parts > 1)
+	{
+		regions.push_back({
+			glm::vec3(bmin.x + (firstColumn + 0.5f) * tcs, bmin.y, bmin.z),
+			glm::vec3(bmin.x + (lastColumn - 0.5f) * tcs, bmax.y, bmax.z) });
+	}
+
+	auto startTime = std::chrono::steady_clock::now();
+
+	bool success = meshTool->handleBuild(false, std::move(regions));
+
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - startTime);
+
+	// the part goes to its own folder on the share, the input is left for the others
+	std::string partFolder = (fs::path(GetFolder("results")) / GetJobName(zoneShortName, part)).string();
+
+	boost::system::error_code ec;
+	fs::create_directories(partFolder, ec);
+
+	navMesh->SetNavMeshDirectory(partFolder);
+	success = success && navMesh->SaveNavMeshFile();
+
+	if (success)
+	{
+		m_context->Log(LogLevel::INFO, "%s: built %d tiles of part %d in %.2f seconds", zoneShortName.c_str(),
+			meshTool->getTilesBuilt(), part + 1, elapsed.count() / 1000.0f);
+	}
+	else
+	{
+		m_context->Log(LogLevel::ERROR, "%s: build of part %d failed", zoneShortName.c_str(), part + 1);
+	}
+
+	return success;
+}
@@ -0,0 +1,86 @@
+//
+// DistributedBuilder.h
+//
+
+// Spreads a batch build over several machines through a shared folder. The
+// coordinator writes a job for each zone, or for each part of a zone, and
+// workers on the other machines take jobs until there are none left. Each worker
+// loads the zone from its own EverQuest folder and geometry cache, and writes
+// the tiles it built back to the share. The coordinator puts the parts of each
+// zone together into one mesh in its own output folder.
+//
+// The shared folder is laid out as:
+//
+//   input\<zone>.navmesh           the existing mesh, for its settings, volumes and areas
+//   jobs\<zone>.<part>.job         jobs waiting for a worker
+//   claimed\<zone>.<part>.job      jobs a worker is building
+//   results\<zone>.<part>\         the mesh built for the job
+//   results\<zone>.<part>.done     written once the job is finished
+//
+// Workers take a job by moving it from jobs to claimed, so only one of them gets
+// it. A job left in claimed by a worker that died can be moved back to jobs by
+// hand. The coordinator clears the folder when it starts, so start it before the
+// workers.
+//
+// Parts are strips of tile columns, built with the region support of NavMeshTool.
+// Zones built with the tile cache or with unreachable polys pruned are always
+// built in one part, since both need the whole mesh.
+
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+class Context;
+class EQConfig;
+
+class DistributedBuilder
+{
+public:
+	DistributedBuilder(EQConfig& eqConfig, Context* context, const std::string& sharedFolder);
+
+	// coordinator: zones to build, by short name. If empty, every zone in Zones.ini.
+	void SetZones(const std::vector<std::string>& zones) { m_zones = zones; }
+
+	// coordinator: number of parts to split each zone into.
+	void SetPartCount(int parts) { m_partCount = parts; }
+
+	// worker: number of threads building tiles, 0 for one per hardware thread.
+	void SetThreadCount(int threads) { m_threadCount = threads; }
+
+	// write the jobs and wait for the workers to finish them. Returns the number of
+	// zones that failed.
+	int RunCoordinator();
+
+	// build jobs until there are none left. Returns the number of jobs that failed.
+	int RunWorker();
+
+private:
+	struct ZoneJob
+	{
+		std::string zoneShortName;
+		int parts = 1;
+		std::vector<bool> done;
+		std::vector<std::pair<int, int>> columns; // tile columns [first, last) of each part
+		bool failed = false;
+		bool assembled = false;
+	};
+
+	bool WriteJobs(std::vector<ZoneJob>& zoneJobs);
+	bool ClaimJob(std::string& zoneShortName, int& part, int& parts);
+	bool BuildPart(const std::string& zoneShortName, int part, int parts,
+		int& firstColumn, int& lastColumn);
+	bool AssembleZone(const ZoneJob& zoneJob);
+
+	std::string GetJobName(const std::string& zoneShortName, int part) const;
+	std::string GetFolder(const char* name) const;
+
+	EQConfig& m_eqConfig;
+	Context* m_context;
+	std::string m_sharedFolder;
+
+	std::vector<std::string> m_zones;
+	int m_partCount = 1;
+	int m_threadCount = 0;
+};
@@ -0,0 +1,401 @@
+//
+// GeometryCache.cpp
+//
+
+#include "GeometryCache.h"
+#include "ChunkyTriMesh.h"
+#include "MapGeometryLoader.h"
+#include "common/MappedFile.h"
+
+#include <boost/algorithm/string.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+namespace fs = boost::filesystem;
+
+// bump this whenever the loader or the chunky mesh build changes what they produce
+static const uint32_t GEOMETRY_CACHE_MAGIC = 'GCQM';
+static const uint32_t GEOMETRY_CACHE_VERSION = 5;
+
+static const size_t GEOMETRY_CACHE_ALIGNMENT = 16;
+
+struct GeometryCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t sourceHash;
+
+	int32_t vertCount;
+	int32_t triCount;
+	int32_t nodeCount;
+	int32_t chunkTriCount;
+	int32_t maxTrisPerChunk;
+	int32_t dynamicObjects;
+	uint32_t hasDynamicObjects;
+	uint32_t reserved;
+
+	uint64_t vertsOffset;
+	uint64_t trisOffset;
+	uint64_t nodesOffset;
+	uint64_t chunkTrisOffset;
+
+	// placed models, with the vertices and triangles of every model in one array each
+	int32_t modelCount;
+	int32_t instanceCount;
+	int32_t modelVertCount;
+	int32_t modelTriCount;
+
+	uint64_t modelsOffset;
+	uint64_t modelVertsOffset;
+	uint64_t modelTrisOffset;
+	uint64_t instancesOffset;
+
+	// the terrain grid. Its triangles are the first terrainVertCount vertices
+	int32_t terrainVertCount;
+	int32_t terrainTileCount;
+	int32_t terrainHeightCount;
+	int32_t terrainFlagCount;
+
+	uint64_t terrainTilesOffset;
+	uint64_t terrainHeightsOffset;
+	uint64_t terrainFlagsOffset;
+};
+
+struct GeometryCacheModel
+{
+	int32_t firstVert;
+	int32_t vertCount;
+	int32_t firstTri;
+	int32_t triCount;
+};
+
+struct GeometryCacheInstance
+{
+	int32_t model;
+	float transform[16];
+};
+
+static void WritePadding(std::ostream& out)
+{
+	static const char zeros[GEOMETRY_CACHE_ALIGNMENT] = { 0 };
+
+	size_t pos = static_cast<size_t>(out.tellp());
+	size_t padding = (GEOMETRY_CACHE_ALIGNMENT - (pos % GEOMETRY_CACHE_ALIGNMENT)) % GEOMETRY_CACHE_ALIGNMENT;
+	if (padding)
+		out.write(zeros, padding);
+}
+
+static uint64_t WriteArray(std::ostream& out, const void* data, size_t size)
+{
+	WritePadding(out);
+
+	uint64_t offset = static_cast<uint64_t>(out.tellp());
+	if (size)
+		out.write(static_cast<const char*>(data), size);
+
+	return offset;
+}
+
+//============================================================================
+
+GeometryCache::GeometryCache(const std::string& zoneShortName, const std::string& eqPath,
+	const std::string& meshPath)
+	: m_zoneShortName(zoneShortName)
+	, m_eqPath(eqPath)
+	, m_meshPath(meshPath)
+{
+	m_filename = m_meshPath + "\\MQ2Nav\\" + m_zoneShortName + ".geocache";
+}
+
+std::vector<std::string> GeometryCache::ListSourceFiles(const std::string& eqPath)
+{
+	std::vector<std::string> files;
+
+	boost::system::error_code ec;
+	for (fs::directory_iterator iter(eqPath, ec), end; !ec && iter != end; iter.increment(ec))
+		files.push_back(boost::to_lower_copy(iter->path().filename().string()));
+
+	std::sort(files.begin(), files.end());
+	return files;
+}
+
+uint64_t GeometryCache::ComputeSourceHash(const std::vector<std::string>* eqFiles) const
+{
+	uint64_t hash = 14695981039346656037ull;
+	auto Add = [&hash](const void* data, size_t size)
+	{
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+	};
+
+	auto AddFile = [&](const fs::path& path)
+	{
+		boost::system::error_code ec;
+		uint64_t size = fs::file_size(path, ec);
+		if (ec)
+			return;
+
+		int64_t writeTime = static_cast<int64_t>(fs::last_write_time(path, ec));
+		std::string name = boost::to_lower_copy(path.filename().string());
+
+		Add(name.data(), name.size());
+		Add(&size, sizeof(size));
+		Add(&writeTime, sizeof(writeTime));
+	};
+
+	// every archive belonging to the zone: <zone>.s3d, <zone>_obj.s3d, <zone>.eqg,
+	// <zone>_assets.txt, ... Directory order isn't stable, so the names are sorted.
+	std::vector<std::string> listed;
+	if (!eqFiles)
+	{
+		listed = ListSourceFiles(m_eqPath);
+		eqFiles = &listed;
+	}
+
+	std::string prefix = boost::to_lower_copy(m_zoneShortName);
+
+	// the zone's files are together in the sorted names
+	for (auto iter = std::lower_bound(eqFiles->begin(), eqFiles->end(), prefix);
+		iter != eqFiles->end() && boost::starts_with(*iter, prefix); ++iter)
+	{
+		const std::string& name = *iter;
+		if (name.size() > prefix.size() && (name[prefix.size()] == '.' || name[prefix.size()] == '_'))
+			AddFile(fs::path(m_eqPath) / name);
+	}
+
+	AddFile(m_meshPath + "\\MQ2Nav\\" + m_zoneShortName + "_doors.json");
+
+	return hash;
+}
+
+bool GeometryCache::Load(MapGeometryLoader& loader, rcChunkyTriMesh& chunkyMesh)
+{
+	auto mappedFile = std::make_shared<MappedFile>();
+	if (!mappedFile->Open(m_filename))
+		return false;
+
+	const uint8_t* data = mappedFile->GetData();
+	size_t size = mappedFile->GetSize();
+
+	if (size < sizeof(GeometryCacheHeader))
+		return false;
+
+	const GeometryCacheHeader& header = *reinterpret_cast<const GeometryCacheHeader*>(data);
+	if (header.magic != GEOMETRY_CACHE_MAGIC || header.version != GEOMETRY_CACHE_VERSION)
+		return false;
+
+	if (header.sourceHash != ComputeSourceHash())
+		return false;
+
+	auto InBounds = [size](uint64_t offset, uint64_t length)
+	{
+		return offset <= size && length <= size - offset;
+	};
+
+	if (!InBounds(header.vertsOffset, (uint64_t)header.vertCount * 3 * sizeof(float))
+		|| !InBounds(header.trisOffset, (uint64_t)header.triCount * 3 * sizeof(int))
+		|| !InBounds(header.nodesOffset, (uint64_t)header.nodeCount * sizeof(rcChunkyTriMeshNode))
+		|| !InBounds(header.chunkTrisOffset, (uint64_t)header.chunkTriCount * 3 * sizeof(int))
+		|| !InBounds(header.modelsOffset, (uint64_t)header.modelCount * sizeof(GeometryCacheModel))
+		|| !InBounds(header.modelVertsOffset, (uint64_t)header.modelVertCount * 3 * sizeof(float))
+		|| !InBounds(header.modelTrisOffset, (uint64_t)header.modelTriCount * 3 * sizeof(int))
+		|| !InBounds(header.instancesOffset, (uint64_t)header.instanceCount * sizeof(GeometryCacheInstance))
+		|| !InBounds(header.terrainTilesOffset, (uint64_t)header.terrainTileCount * sizeof(TerrainHeightfield::Tile))
+		|| !InBounds(header.terrainHeightsOffset, (uint64_t)header.terrainHeightCount * sizeof(float))
+		|| !InBounds(header.terrainFlagsOffset, (uint64_t)header.terrainFlagCount)
+		|| header.terrainVertCount < 0 || header.terrainVertCount > header.vertCount)
+	{
+		return false;
+	}
+
+	uint8_t* base = mappedFile->GetData();
+
+	// the models are small next to the zone, so they are copied out rather than used
+	// in place.
+	const GeometryCacheModel* models = reinterpret_cast<const GeometryCacheModel*>(base + header.modelsOffset);
+	const float* modelVerts = reinterpret_cast<const float*>(base + header.modelVertsOffset);
+	const int* modelTris = reinterpret_cast<const int*>(base + header.modelTrisOffset);
+	const GeometryCacheInstance* instances = reinterpret_cast<const GeometryCacheInstance*>(base + header.instancesOffset);
+
+	MeshInstances& meshInstances = loader.m_instances;
+	meshInstances.Clear();
+
+	for (int i = 0; i < header.modelCount; ++i)
+	{
+		const GeometryCacheModel& model = models[i];
+		if (model.firstVert < 0 || model.vertCount < 0 || model.firstVert > header.modelVertCount - model.vertCount
+			|| model.firstTri < 0 || model.triCount < 0 || model.firstTri > header.modelTriCount - model.triCount)
+		{
+			return false;
+		}
+
+		const int* tris = &modelTris[model.firstTri * 3];
+		for (int j = 0; j < model.triCount * 3; ++j)
+		{
+			if (tris[j] < 0 || tris[j] >= model.vertCount)
+				return false;
+		}
+
+		meshInstances.AddModel(
+			std::vector<float>(&modelVerts[model.firstVert * 3], &modelVerts[(model.firstVert + model.vertCount) * 3]),
+			std::vector<int>(tris, tris + model.triCount * 3));
+	}
+
+	if (meshInstances.GetModelCount() != header.modelCount)
+		return false;
+
+	for (int i = 0; i < header.instanceCount; ++i)
+	{
+		if (instances[i].model < 0 || instances[i].model >= header.modelCount)
+			return false;
+
+		meshInstances.AddInstance(instances[i].model, glm::make_mat4(instances[i].transform));
+	}
+
+	meshInstances.Build();
+
+	const TerrainHeightfield::Tile* terrainTiles = reinterpret_cast<const TerrainHeightfield::Tile*>(base + header.terrainTilesOffset);
+	const float* terrainHeights = reinterpret_cast<const float*>(base + header.terrainHeightsOffset);
+	const uint8_t* terrainFlags = base + header.terrainFlagsOffset;
+
+	TerrainHeightfield& terrain = loader.m_terrain;
+	terrain.Clear();
+
+	for (int i = 0; i < header.terrainTileCount; ++i)
+	{
+		const TerrainHeightfield::Tile& tile = terrainTiles[i];
+		if (tile.quads <= 0 || tile.quads > 0xffff
+			|| tile.firstHeight < 0 || tile.firstHeight > header.terrainHeightCount - (tile.quads + 1) * (tile.quads + 1)
+			|| (tile.firstFlag >= 0 && tile.firstFlag > header.terrainFlagCount - tile.quads * tile.quads))
+		{
+			return false;
+		}
+
+		terrain.AddTile(tile.x, tile.z, tile.quads, tile.quadSize, &terrainHeights[tile.firstHeight],
+			tile.firstFlag >= 0 ? &terrainFlags[tile.firstFlag] : nullptr);
+	}
+
+	terrain.Build();
+	loader.m_terrainVertCount = header.terrainVertCount;
+
+	loader.m_verts = reinterpret_cast<float*>(base + header.vertsOffset);
+	loader.m_tris = reinterpret_cast<int*>(base + header.trisOffset);
+	loader.m_vertCount = loader.vcap = header.vertCount;
+	loader.m_triCount = loader.tcap = header.triCount;
+	loader.m_dynamicObjects = header.dynamicObjects;
+	loader.m_hasDynamicObjects = header.hasDynamicObjects != 0;
+	loader.m_mappedFile = mappedFile;
+
+	chunkyMesh.nodes = reinterpret_cast<rcChunkyTriMeshNode*>(base + header.nodesOffset);
+	chunkyMesh.nnodes = header.nodeCount;
+	chunkyMesh.tris = reinterpret_cast<int*>(base + header.chunkTrisOffset);
+	chunkyMesh.ntris = header.chunkTriCount;
+	chunkyMesh.maxTrisPerChunk = header.maxTrisPerChunk;
+	chunkyMesh.ownsData = false;
+
+	return true;
+}
+
+bool GeometryCache::Save(const MapGeometryLoader& loader, const rcChunkyTriMesh& chunkyMesh)
+{
+	// written to a temporary file first, the existing cache may still be mapped
+	std::string tempFilename = m_filename + ".tmp";
+
+	std::ofstream outfile(tempFilename.c_str(), std::ios::binary | std::ios::trunc);
+	if (!outfile.is_open())
+		return false;
+
+	GeometryCacheHeader header = { 0 };
+	header.magic = GEOMETRY_CACHE_MAGIC;
+	header.version = GEOMETRY_CACHE_VERSION;
+	header.sourceHash = ComputeSourceHash();
+	header.vertCount = loader.getVertCount();
+	header.triCount = loader.getTriCount();
+	header.nodeCount = chunkyMesh.nnodes;
+	header.chunkTriCount = chunkyMesh.ntris;
+	header.maxTrisPerChunk = chunkyMesh.maxTrisPerChunk;
+	header.dynamicObjects = loader.GetDynamicObjectsCount();
+	header.hasDynamicObjects = loader.HasDynamicObjects() ? 1 : 0;
+
+	// the header is rewritten once the offsets are known
+	outfile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	header.vertsOffset = WriteArray(outfile, loader.getVerts(), header.vertCount * 3 * sizeof(float));
+	header.trisOffset = WriteArray(outfile, loader.getTris(), header.triCount * 3 * sizeof(int));
+	header.nodesOffset = WriteArray(outfile, chunkyMesh.nodes, header.nodeCount * sizeof(rcChunkyTriMeshNode));
+	header.chunkTrisOffset = WriteArray(outfile, chunkyMesh.tris, header.chunkTriCount * 3 * sizeof(int));
+
+	const MeshInstances& meshInstances = loader.getInstances();
+	std::vector<GeometryCacheModel> models;
+	std::vector<float> modelVerts;
+	std::vector<int> modelTris;
+
+	for (int i = 0; i < meshInstances.GetModelCount(); ++i)
+	{
+		const MeshInstances::Model& model = meshInstances.GetModel(i);
+
+		GeometryCacheModel entry;
+		entry.firstVert = (int32_t)modelVerts.size() / 3;
+		entry.vertCount = (int32_t)model.verts.size() / 3;
+		entry.firstTri = (int32_t)modelTris.size() / 3;
+		entry.triCount = (int32_t)model.tris.size() / 3;
+		models.push_back(entry);
+
+		modelVerts.insert(modelVerts.end(), model.verts.begin(), model.verts.end());
+		modelTris.insert(modelTris.end(), model.tris.begin(), model.tris.end());
+	}
+
+	std::vector<GeometryCacheInstance> instances(meshInstances.GetInstanceCount());
+	for (int i = 0; i < meshInstances.GetInstanceCount(); ++i)
+	{
+		const MeshInstances::Instance& instance = meshInstances.GetInstance(i);
+		instances[i].model = instance.model;
+		memcpy(instances[i].transform, glm::value_ptr(instance.transform), sizeof(instances[i].transform));
+	}
+
+	header.modelCount = (int32_t)models.size();
+	header.instanceCount = (int32_t)instances.size();
+	header.modelVertCount = (int32_t)modelVerts.size() / 3;
+	header.modelTriCount = (int32_t)modelTris.size() / 3;
+	header.modelsOffset = WriteArray(outfile, models.data(), models.size() * sizeof(GeometryCacheModel));
+	header.modelVertsOffset = WriteArray(outfile, modelVerts.data(), modelVerts.size() * sizeof(float));
+	header.modelTrisOffset = WriteArray(outfile, modelTris.data(), modelTris.size() * sizeof(int));
+	header.instancesOffset = WriteArray(outfile, instances.data(), instances.size() * sizeof(GeometryCacheInstance));
+
+	const TerrainHeightfield& terrain = loader.getTerrain();
+	header.terrainVertCount = loader.getTerrainVertCount();
+	header.terrainTileCount = (int32_t)terrain.GetTiles().size();
+	header.terrainHeightCount = (int32_t)terrain.GetHeights().size();
+	header.terrainFlagCount = (int32_t)terrain.GetFlags().size();
+	header.terrainTilesOffset = WriteArray(outfile, terrain.GetTiles().data(), terrain.GetTiles().size() * sizeof(TerrainHeightfield::Tile));
+	header.terrainHeightsOffset = WriteArray(outfile, terrain.GetHeights().data(), terrain.GetHeights().size() * sizeof(float));
+	header.terrainFlagsOffset = WriteArray(outfile, terrain.GetFlags().data(), terrain.GetFlags().size());
+
+	outfile.seekp(0);
+	outfile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	bool success = outfile.good();
+	outfile.close();
+
+	boost::system::error_code ec;
+	if (success)
+	{
+		fs::rename(tempFilename, m_filename, ec);
+		success = !ec;
+	}
+
+	if (!success)
+		fs::remove(tempFilename, ec);
+
+	return success;
+}
@@ -0,0 +1,48 @@
+//
+// GeometryCache.h
+//
+
+// Keeps the processed geometry of a zone on disk, so that opening the zone again
+// doesn't have to go through the zone archives. The cache holds the final vertex
+// and triangle arrays along with the chunky mesh, laid out so that the file can be
+// mapped and used in place, the placed models with their transforms, and the
+// terrain height grid.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class MapGeometryLoader;
+struct rcChunkyTriMesh;
+
+class GeometryCache
+{
+public:
+	GeometryCache(const std::string& zoneShortName, const std::string& eqPath,
+		const std::string& meshPath);
+
+	// map the cached geometry into the loader and chunky mesh. Fails if there is no
+	// cache, or if any of the zone's files have changed since it was written.
+	bool Load(MapGeometryLoader& loader, rcChunkyTriMesh& chunkyMesh);
+
+	bool Save(const MapGeometryLoader& loader, const rcChunkyTriMesh& chunkyMesh);
+
+	const std::string& GetFilename() const { return m_filename; }
+
+	// fingerprint of the files the geometry is loaded from. When fingerprinting
+	// many zones, pass the names in the everquest folder from ListSourceFiles so
+	// that the folder is only listed once.
+	uint64_t ComputeSourceHash(const std::vector<std::string>* eqFiles = nullptr) const;
+
+	// the lowercase names of every file in the everquest folder, sorted
+	static std::vector<std::string> ListSourceFiles(const std::string& eqPath);
+
+private:
+
+	std::string m_zoneShortName;
+	std::string m_eqPath;
+	std::string m_meshPath;
+	std::string m_filename;
+};
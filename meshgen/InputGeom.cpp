@@ -3,51 +3,18 @@
 //
 
 #include "InputGeom.h"
+#include "GeometryCache.h"
+#include "MeshRaycaster.h"
 
 #include <DebugDraw.h>
 #include <DetourNavMesh.h>
 #include <Recast.h>
 #include <RecastDebugDraw.h>
 
-static bool intersectSegmentTriangle(const float* sp, const float* sq,
-	const float* a, const float* b, const float* c,
-	float &t)
-{
-	float v, w;
-	float ab[3], ac[3], qp[3], ap[3], norm[3], e[3];
-	rcVsub(ab, b, a);
-	rcVsub(ac, c, a);
-	rcVsub(qp, sp, sq);
-
-	// Compute triangle normal. Can be precalculated or cached if
-	// intersecting multiple segments against the same triangle
-	rcVcross(norm, ab, ac);
-
-	// Compute denominator d. If d <= 0, segment is parallel to or points
-	// away from triangle, so exit early
-	float d = rcVdot(qp, norm);
-	if (d <= 0.0f) return false;
-
-	// Compute intersection t value of pq with plane of triangle. A ray
-	// intersects iff 0 <= t. Segment intersects iff 0 <= t <= 1. Delay
-	// dividing by d until intersection has been found to pierce triangle
-	rcVsub(ap, sp, a);
-	t = rcVdot(ap, norm);
-	if (t < 0.0f) return false;
-	if (t > d) return false; // For segment; exclude this code line for a ray test
-
-	// Compute barycentric coordinate components and test if within bounds
-	rcVcross(e, qp, ap);
-	v = rcVdot(ac, e);
-	if (v < 0.0f || v > d) return false;
-	w = -rcVdot(ab, e);
-	if (w < 0.0f || v + w > d) return false;
-
-	// Segment/ray intersects triangle. Perform delayed division
-	t /= d;
-
-	return true;
-}
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iterator>
 
 //----------------------------------------------------------------------------
 
@@ -62,14 +29,50 @@ InputGeom::~InputGeom()
 {
 }
 
-bool InputGeom::loadGeometry(rcContext* ctx)
+bool InputGeom::loadGeometry(rcContext* ctx, bool useCache)
 {
 	m_chunkyMesh.reset();
-	m_offMeshConCount = 0;
+	m_offMeshCons.clear();
+	m_offMeshBuckets.clear();
 	m_volumes.clear();
+	m_loadTimeMs = 0.f;
+	m_chunkyMeshTimeMs = 0.f;
+
+	auto ElapsedMs = [](std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	};
 
 	m_loader.reset(new MapGeometryLoader(m_zoneShortName, m_eqPath, m_meshPath));
-	if (!m_loader->load())
+	m_chunkyMesh.reset(new rcChunkyTriMesh);
+
+	// the water map isn't part of the geometry cache, it is small enough to read each time
+	loadWaterMap(ctx);
+
+	// Reuse the processed geometry from last time if the zone files haven't changed.
+	GeometryCache cache(m_zoneShortName, m_eqPath, m_meshPath);
+	m_sourceHash = cache.ComputeSourceHash();
+
+	auto startTime = std::chrono::steady_clock::now();
+
+	if (useCache && cache.Load(*m_loader, *m_chunkyMesh))
+	{
+		m_loadTimeMs = ElapsedMs(startTime);
+
+		ctx->log(RC_LOG_PROGRESS, "Loaded geometry for '%s' from %s",
+			m_zoneShortName.c_str(), cache.GetFilename().c_str());
+
+		calcMeshBounds();
+		return true;
+	}
+
+	ctx->log(RC_LOG_PROGRESS, "Loading zone files for '%s'", m_zoneShortName.c_str());
+
+	startTime = std::chrono::steady_clock::now();
+	bool loaded = m_loader->load();
+	m_loadTimeMs = ElapsedMs(startTime);
+
+	if (!loaded)
 	{
 		ctx->log(RC_LOG_ERROR, "buildTiledNavigation: Could not load '%s'",
 			m_zoneShortName.c_str());
@@ -79,137 +82,263 @@ bool InputGeom::loadGeometry(rcContext* ctx)
 	if (m_loader->getVerts() == nullptr)
 		return false;
 
-	rcCalcBounds(m_loader->getVerts(), m_loader->getVertCount(),
-		&m_meshBMin[0], &m_meshBMax[0]);
+	calcMeshBounds();
 
 	// Construct the partitioned triangle mesh
-	m_chunkyMesh.reset(new rcChunkyTriMesh);
-	if (!rcCreateChunkyTriMesh(
+	ctx->log(RC_LOG_PROGRESS, "Partitioning %d triangles", m_loader->getTriCount());
+
+	startTime = std::chrono::steady_clock::now();
+	bool chunkyBuilt = rcCreateChunkyTriMesh(
 		m_loader->getVerts(),        // verts
 		m_loader->getTris(),         // tris
 		m_loader->getTriCount(),     // ntris
 		256,                         // trisPerChunk
-		m_chunkyMesh.get()))         // [out] chunkyMesh
+		m_chunkyMesh.get());         // [out] chunkyMesh
+	m_chunkyMeshTimeMs = ElapsedMs(startTime);
+
+	if (!chunkyBuilt)
 	{
 		ctx->log(RC_LOG_ERROR, "buildTiledNavigation: Failed to build chunky mesh.");
 		return false;
 	}
 
+	if (useCache && !cache.Save(*m_loader, *m_chunkyMesh))
+	{
+		ctx->log(RC_LOG_WARNING, "Failed to write geometry cache %s",
+			cache.GetFilename().c_str());
+	}
+
 	return true;
 }
 
-#pragma region Utilities
-static bool isectSegAABB(const float* sp, const float* sq,
-	const float* amin, const float* amax, float& tmin, float& tmax)
+void InputGeom::loadWaterMap(rcContext* ctx)
 {
-	static const float EPS = 1e-6f;
+	m_waterMap.reset();
+	m_waterMapHash = 0;
 
-	float d[3];
-	d[0] = sq[0] - sp[0];
-	d[1] = sq[1] - sp[1];
-	d[2] = sq[2] - sp[2];
-	tmin = 0.0;
-	tmax = 1.0f;
+	std::string folder = m_meshPath + "\\MQ2Nav";
+	m_waterMap.reset(WaterMap::LoadWaterMapfile(folder, m_zoneShortName));
+	if (!m_waterMap)
+		return;
 
-	for (int i = 0; i < 3; i++)
+	std::string zoneName = m_zoneShortName;
+	std::transform(zoneName.begin(), zoneName.end(), zoneName.begin(), ::tolower);
+
+	std::ifstream file(folder + "/" + zoneName + ".wtr", std::ios::binary);
+	std::vector<char> contents{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+
+	uint64_t hash = 14695981039346656037ull;
+	for (char c : contents)
 	{
-		if (fabsf(d[i]) < EPS)
-		{
-			if (sp[i] < amin[i] || sp[i] > amax[i])
-				return false;
-		}
-		else
-		{
-			const float ood = 1.0f / d[i];
-			float t1 = (amin[i] - sp[i]) * ood;
-			float t2 = (amax[i] - sp[i]) * ood;
-			if (t1 > t2) { float tmp = t1; t1 = t2; t2 = tmp; }
-			if (t1 > tmin) tmin = t1;
-			if (t2 < tmax) tmax = t2;
-			if (tmin > tmax) return false;
-		}
+		hash ^= static_cast<uint8_t>(c);
+		hash *= 1099511628211ull;
 	}
+	m_waterMapHash = hash;
 
-	return true;
+	ctx->log(RC_LOG_PROGRESS, "Loaded water map for '%s'", m_zoneShortName.c_str());
 }
 
-bool InputGeom::raycastMesh(float* src, float* dst, float& tmin)
+void InputGeom::calcMeshBounds()
 {
-	float dir[3];
-	rcVsub(dir, dst, src);
+	rcCalcBounds(m_loader->getVerts(), m_loader->getVertCount(),
+		&m_meshBMin[0], &m_meshBMax[0]);
 
-	// Prune hit ray.
-	float btmin, btmax;
-	if (!isectSegAABB(src, dst, &m_meshBMin[0], &m_meshBMax[0], btmin, btmax))
-		return false;
-	float p[2], q[2];
-	p[0] = src[0] + (dst[0]-src[0])*btmin;
-	p[1] = src[2] + (dst[2]-src[2])*btmin;
-	q[0] = src[0] + (dst[0]-src[0])*btmax;
-	q[1] = src[2] + (dst[2]-src[2])*btmax;
-
-	int cid[512];
-	const int ncid = rcGetChunksOverlappingSegment(m_chunkyMesh.get(), p, q, cid, 512);
-	if (!ncid)
-		return false;
+	const MeshInstances& instances = m_loader->getInstances();
+	if (!instances.IsEmpty())
+	{
+		m_meshBMin = glm::min(m_meshBMin, instances.GetBoundsMin());
+		m_meshBMax = glm::max(m_meshBMax, instances.GetBoundsMax());
+	}
+}
 
-	tmin = 1.0f;
-	bool hit = false;
-	const float* verts = m_loader->getVerts();
+#pragma region Utilities
+MeshRaycaster InputGeom::getRaycaster() const
+{
+	return MeshRaycaster(m_loader->getVerts(), m_chunkyMesh.get(), m_meshBMin, m_meshBMax,
+		&m_loader->getInstances());
+}
 
-	for (int i = 0; i < ncid; ++i)
-	{
-		const rcChunkyTriMeshNode& node = m_chunkyMesh->nodes[cid[i]];
-		const int* tris = &m_chunkyMesh->tris[node.i*3];
-		const int ntris = node.n;
+bool InputGeom::raycastMesh(float* src, float* dst, float& tmin)
+{
+	if (!m_loader || !m_chunkyMesh)
+		return false;
 
-		for (int j = 0; j < ntris*3; j += 3)
-		{
-			float t = 1;
-			if (intersectSegmentTriangle(
-				src, dst,
-				&verts[tris[j]*3],
-				&verts[tris[j+1]*3],
-				&verts[tris[j+2]*3], t))
-			{
-				if (t < tmin)
-					tmin = t;
-				hit = true;
-			}
-		}
-	}
+	return getRaycaster().Raycast(src, dst, tmin);
+}
 
-	return hit;
+void InputGeom::raycastMesh(MeshRay* rays, int count, TaskScheduler* scheduler)
+{
+	if (!m_loader || !m_chunkyMesh)
+		return;
+
+	getRaycaster().Raycast(rays, count, scheduler);
 }
 #pragma endregion
 
 #pragma region Off-Mesh connections
+void OffMeshConnections::clear()
+{
+	verts.clear();
+	rads.clear();
+	dirs.clear();
+	areas.clear();
+	flags.clear();
+	ids.clear();
+}
+
+void OffMeshConnections::push_back(const OffMeshConnections& other, int i)
+{
+	verts.insert(verts.end(), &other.verts[i * 6], &other.verts[i * 6] + 6);
+	rads.push_back(other.rads[i]);
+	dirs.push_back(other.dirs[i]);
+	areas.push_back(other.areas[i]);
+	flags.push_back(other.flags[i]);
+	ids.push_back(other.ids[i]);
+}
+
+static inline uint64_t BucketKey(int x, int z)
+{
+	return ((uint64_t)(uint32_t)x << 32) | (uint32_t)z;
+}
+
 void InputGeom::addOffMeshConnection(const float* spos, const float* epos, const float rad,
 	unsigned char bidir, unsigned char area, unsigned short flags)
 {
-	if (m_offMeshConCount >= MAX_OFFMESH_CONNECTIONS) return;
-	float* v = &m_offMeshConVerts[m_offMeshConCount*3*2];
-	m_offMeshConRads[m_offMeshConCount] = rad;
-	m_offMeshConDirs[m_offMeshConCount] = bidir;
-	m_offMeshConAreas[m_offMeshConCount] = area;
-	m_offMeshConFlags[m_offMeshConCount] = flags;
-	m_offMeshConId[m_offMeshConCount] = 1000 + m_offMeshConCount;
-	rcVcopy(&v[0], spos);
-	rcVcopy(&v[3], epos);
-	m_offMeshConCount++;
+	m_offMeshCons.verts.insert(m_offMeshCons.verts.end(), spos, spos + 3);
+	m_offMeshCons.verts.insert(m_offMeshCons.verts.end(), epos, epos + 3);
+	m_offMeshCons.rads.push_back(rad);
+	m_offMeshCons.dirs.push_back(bidir);
+	m_offMeshCons.areas.push_back(area);
+	m_offMeshCons.flags.push_back(flags);
+	m_offMeshCons.ids.push_back(m_nextOffMeshConId++);
+
+	addOffMeshConnectionToBuckets(m_offMeshCons.count() - 1);
 }
 
 void InputGeom::deleteOffMeshConnection(int i)
 {
-	m_offMeshConCount--;
-	float* src = &m_offMeshConVerts[m_offMeshConCount*3*2];
-	float* dst = &m_offMeshConVerts[i*3*2];
+	int last = m_offMeshCons.count() - 1;
+	if (i < 0 || i > last)
+		return;
+
+	// the last connection moves into the free slot
+	removeOffMeshConnectionFromBuckets(i);
+	if (i != last)
+		removeOffMeshConnectionFromBuckets(last);
+
+	float* src = &m_offMeshCons.verts[last * 6];
+	float* dst = &m_offMeshCons.verts[i * 6];
 	rcVcopy(&dst[0], &src[0]);
 	rcVcopy(&dst[3], &src[3]);
-	m_offMeshConRads[i] = m_offMeshConRads[m_offMeshConCount];
-	m_offMeshConDirs[i] = m_offMeshConDirs[m_offMeshConCount];
-	m_offMeshConAreas[i] = m_offMeshConAreas[m_offMeshConCount];
-	m_offMeshConFlags[i] = m_offMeshConFlags[m_offMeshConCount];
+	m_offMeshCons.rads[i] = m_offMeshCons.rads[last];
+	m_offMeshCons.dirs[i] = m_offMeshCons.dirs[last];
+	m_offMeshCons.areas[i] = m_offMeshCons.areas[last];
+	m_offMeshCons.flags[i] = m_offMeshCons.flags[last];
+	m_offMeshCons.ids[i] = m_offMeshCons.ids[last];
+
+	m_offMeshCons.verts.resize(last * 6);
+	m_offMeshCons.rads.pop_back();
+	m_offMeshCons.dirs.pop_back();
+	m_offMeshCons.areas.pop_back();
+	m_offMeshCons.flags.pop_back();
+	m_offMeshCons.ids.pop_back();
+
+	if (i != last)
+		addOffMeshConnectionToBuckets(i);
+}
+
+void InputGeom::addOffMeshConnectionToBuckets(int i)
+{
+	const float* v = &m_offMeshCons.verts[i * 6];
+
+	for (int k = 0; k < 2; ++k)
+	{
+		int x = (int)floorf((v[k * 3 + 0] - m_meshBMin.x) / m_offMeshBucketSize);
+		int z = (int)floorf((v[k * 3 + 2] - m_meshBMin.z) / m_offMeshBucketSize);
+
+		std::vector<int>& bucket = m_offMeshBuckets[BucketKey(x, z)];
+		if (std::find(bucket.begin(), bucket.end(), i) == bucket.end())
+			bucket.push_back(i);
+	}
+}
+
+void InputGeom::removeOffMeshConnectionFromBuckets(int i)
+{
+	const float* v = &m_offMeshCons.verts[i * 6];
+
+	for (int k = 0; k < 2; ++k)
+	{
+		int x = (int)floorf((v[k * 3 + 0] - m_meshBMin.x) / m_offMeshBucketSize);
+		int z = (int)floorf((v[k * 3 + 2] - m_meshBMin.z) / m_offMeshBucketSize);
+
+		auto iter = m_offMeshBuckets.find(BucketKey(x, z));
+		if (iter == m_offMeshBuckets.end())
+			continue;
+
+		std::vector<int>& bucket = iter->second;
+		bucket.erase(std::remove(bucket.begin(), bucket.end(), i), bucket.end());
+		if (bucket.empty())
+			m_offMeshBuckets.erase(iter);
+	}
+}
+
+void InputGeom::setOffMeshConnectionBucketSize(float size)
+{
+	if (size <= 0.f || size == m_offMeshBucketSize)
+		return;
+
+	m_offMeshBucketSize = size;
+	m_offMeshBuckets.clear();
+
+	for (int i = 0; i < m_offMeshCons.count(); ++i)
+		addOffMeshConnectionToBuckets(i);
+}
+
+void InputGeom::getOffMeshConnectionsInBounds(const float* bmin, const float* bmax,
+	OffMeshConnections& out) const
+{
+	out.clear();
+	if (m_offMeshBuckets.empty())
+		return;
+
+	int minx = (int)floorf((bmin[0] - m_meshBMin.x) / m_offMeshBucketSize);
+	int minz = (int)floorf((bmin[2] - m_meshBMin.z) / m_offMeshBucketSize);
+	int maxx = (int)floorf((bmax[0] - m_meshBMin.x) / m_offMeshBucketSize);
+	int maxz = (int)floorf((bmax[2] - m_meshBMin.z) / m_offMeshBucketSize);
+
+	std::vector<int> found;
+
+	for (int z = minz; z <= maxz; ++z)
+	{
+		for (int x = minx; x <= maxx; ++x)
+		{
+			auto iter = m_offMeshBuckets.find(BucketKey(x, z));
+			if (iter == m_offMeshBuckets.end())
+				continue;
+
+			for (int i : iter->second)
+			{
+				const float* v = &m_offMeshCons.verts[i * 6];
+
+				for (int k = 0; k < 2; ++k)
+				{
+					const float* p = &v[k * 3];
+					if (p[0] >= bmin[0] && p[0] <= bmax[0] && p[2] >= bmin[2] && p[2] <= bmax[2])
+					{
+						found.push_back(i);
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	// both ends can be in the query, and the order should not depend on the buckets
+	std::sort(found.begin(), found.end());
+	found.erase(std::unique(found.begin(), found.end()), found.end());
+
+	for (int i : found)
+		out.push_back(m_offMeshCons, i);
 }
 
 void InputGeom::drawOffMeshConnections(duDebugDraw* dd, bool hilight)
@@ -219,9 +348,9 @@ void InputGeom::drawOffMeshConnections(duDebugDraw* dd, bool hilight)
 	dd->depthMask(false);
 
 	dd->begin(DU_DRAW_LINES, 2.0f);
-	for (int i = 0; i < m_offMeshConCount; ++i)
+	for (int i = 0; i < m_offMeshCons.count(); ++i)
 	{
-		float* v = &m_offMeshConVerts[i*3*2];
+		const float* v = &m_offMeshCons.verts[i*3*2];
 
 		dd->vertex(v[0],v[1],v[2], baseColor);
 		dd->vertex(v[0],v[1]+0.2f,v[2], baseColor);
@@ -229,13 +358,13 @@ void InputGeom::drawOffMeshConnections(duDebugDraw* dd, bool hilight)
 		dd->vertex(v[3],v[4],v[5], baseColor);
 		dd->vertex(v[3],v[4]+0.2f,v[5], baseColor);
 
-		duAppendCircle(dd, v[0],v[1]+0.1f,v[2], m_offMeshConRads[i], baseColor);
-		duAppendCircle(dd, v[3],v[4]+0.1f,v[5], m_offMeshConRads[i], baseColor);
+		duAppendCircle(dd, v[0],v[1]+0.1f,v[2], m_offMeshCons.rads[i], baseColor);
+		duAppendCircle(dd, v[3],v[4]+0.1f,v[5], m_offMeshCons.rads[i], baseColor);
 
 		if (hilight)
 		{
 			duAppendArc(dd, v[0],v[1],v[2], v[3],v[4],v[5], 0.25f,
-				(m_offMeshConDirs[i] & 1) ? 0.6f : 0.0f, 0.6f, conColor);
+				(m_offMeshCons.dirs[i] & 1) ? 0.6f : 0.0f, 0.6f, conColor);
 		}
 	}
 	dd->end();
@@ -6,18 +6,46 @@
 
 #include "ChunkyTriMesh.h"
 #include "MapGeometryLoader.h"
+#include "MeshRaycaster.h"
 
 #include "common/NavMeshData.h"
 
+#include <zone-utilities/common/water_map.h>
+
+#include <unordered_map>
+#include <vector>
+
 static const int MAX_CONVEXVOL_PTS = 12;
 
+// off-mesh connections stored the way dtNavMeshCreateParams takes them
+struct OffMeshConnections
+{
+	std::vector<float> verts;           // start and end, 6 floats per connection
+	std::vector<float> rads;
+	std::vector<unsigned char> dirs;
+	std::vector<unsigned char> areas;
+	std::vector<unsigned short> flags;
+	std::vector<unsigned int> ids;
+
+	int count() const { return (int)rads.size(); }
+
+	void clear();
+	void push_back(const OffMeshConnections& other, int i);
+};
+
 class InputGeom
 {
 public:
 	InputGeom(const std::string& zoneShortName, const std::string& eqPath, const std::string& meshPath);
 	~InputGeom();
 
-	bool loadGeometry(class rcContext* ctx);
+	// useCache = false always loads from the zone files, and doesn't update the cache.
+	bool loadGeometry(class rcContext* ctx, bool useCache = true);
+
+	// how long the last loadGeometry spent loading the geometry and building the
+	// chunky mesh. The chunky mesh time is 0 when the geometry came from the cache.
+	float getLoadTimeMS() const { return m_loadTimeMs; }
+	float getChunkyMeshTimeMS() const { return m_chunkyMeshTimeMs; }
 
 	// Method to return static mesh data.
 	inline const glm::vec3& getMeshBoundsMin() const { return m_meshBMin; }
@@ -25,23 +53,47 @@ public:
 
 	inline const MapGeometryLoader* getMeshLoader() const { return m_loader.get(); }
 	inline const rcChunkyTriMesh* getChunkyMesh() const { return m_chunkyMesh.get(); }
+	inline const MeshInstances& getMeshInstances() const { return m_loader->getInstances(); }
+
+	// water regions of the zone, from <zone>.wtr in the MQ2Nav folder. Null if the
+	// zone doesn't have a water map. The hash fingerprints the file.
+	inline const WaterMap* getWaterMap() const { return m_waterMap.get(); }
+	inline uint64_t getWaterMapHash() const { return m_waterMapHash; }
+
+	// fingerprint of the zone files the geometry was loaded from, see GeometryCache
+	inline uint64_t getSourceHash() const { return m_sourceHash; }
 
 	// Off-Mesh connections.
-	int getOffMeshConnectionCount() const { return m_offMeshConCount; }
-	const float* getOffMeshConnectionVerts() const { return m_offMeshConVerts; }
-	const float* getOffMeshConnectionRads() const { return m_offMeshConRads; }
-	const unsigned char* getOffMeshConnectionDirs() const { return m_offMeshConDirs; }
-	const unsigned char* getOffMeshConnectionAreas() const { return m_offMeshConAreas; }
-	const unsigned short* getOffMeshConnectionFlags() const { return m_offMeshConFlags; }
-	const unsigned int* getOffMeshConnectionId() const { return m_offMeshConId; }
+	int getOffMeshConnectionCount() const { return m_offMeshCons.count(); }
+	const float* getOffMeshConnectionVerts() const { return m_offMeshCons.verts.data(); }
+	const float* getOffMeshConnectionRads() const { return m_offMeshCons.rads.data(); }
+	const unsigned char* getOffMeshConnectionDirs() const { return m_offMeshCons.dirs.data(); }
+	const unsigned char* getOffMeshConnectionAreas() const { return m_offMeshCons.areas.data(); }
+	const unsigned short* getOffMeshConnectionFlags() const { return m_offMeshCons.flags.data(); }
+	const unsigned int* getOffMeshConnectionId() const { return m_offMeshCons.ids.data(); }
 	void addOffMeshConnection(const float* spos, const float* epos, const float rad,
 		unsigned char bidir, unsigned char area, unsigned short flags);
 	void deleteOffMeshConnection(int i);
+
+	// size of the buckets used to find the connections near a tile. Set this to the
+	// tile size before building, so that a tile only looks at a bucket or two.
+	void setOffMeshConnectionBucketSize(float size);
+
+	// copies the connections with an end inside of bmin/bmax (xz only) to out.
+	// Safe to call from multiple threads as long as connections aren't changed.
+	void getOffMeshConnectionsInBounds(const float* bmin, const float* bmax, OffMeshConnections& out) const;
+
 	void drawOffMeshConnections(struct duDebugDraw* dd, bool hilight = false);
 
 	// Utilities
+	// raycaster over the zone mesh and the placed models. Geometry must be loaded.
+	MeshRaycaster getRaycaster() const;
+
 	bool raycastMesh(float* src, float* dst, float& tmin);
 
+	// casts every ray, split between the workers of the scheduler if one is given
+	void raycastMesh(MeshRay* rays, int count, TaskScheduler* scheduler = nullptr);
+
 private:
 	std::string m_eqPath;
 	std::string m_zoneShortName;
@@ -50,18 +102,27 @@ private:
 	std::unique_ptr<rcChunkyTriMesh> m_chunkyMesh;
 	std::unique_ptr<MapGeometryLoader> m_loader;
 
-	// bounds
+	void loadWaterMap(class rcContext* ctx);
+	std::unique_ptr<WaterMap> m_waterMap;
+	uint64_t m_waterMapHash = 0;
+	uint64_t m_sourceHash = 0;
+
+	// bounds of the zone mesh and the placed models together
+	void calcMeshBounds();
 	glm::vec3 m_meshBMin, m_meshBMax;
 
+	float m_loadTimeMs = 0.f;
+	float m_chunkyMeshTimeMs = 0.f;
+
 	// Off-Mesh connections.
-	static const int MAX_OFFMESH_CONNECTIONS = 256;
-	float m_offMeshConVerts[MAX_OFFMESH_CONNECTIONS * 3 * 2];
-	float m_offMeshConRads[MAX_OFFMESH_CONNECTIONS];
-	unsigned char m_offMeshConDirs[MAX_OFFMESH_CONNECTIONS];
-	unsigned char m_offMeshConAreas[MAX_OFFMESH_CONNECTIONS];
-	unsigned short m_offMeshConFlags[MAX_OFFMESH_CONNECTIONS];
-	unsigned int m_offMeshConId[MAX_OFFMESH_CONNECTIONS];
-	int m_offMeshConCount = 0;
+	OffMeshConnections m_offMeshCons;
+	unsigned int m_nextOffMeshConId = 1000;
+
+	// connection indices by the buckets that their ends are in
+	void addOffMeshConnectionToBuckets(int i);
+	void removeOffMeshConnectionFromBuckets(int i);
+	float m_offMeshBucketSize = 256.0f;
+	std::unordered_map<uint64_t, std::vector<int>> m_offMeshBuckets;
 
 	// Convex Volumes.
 	std::vector<std::unique_ptr<ConvexVolume>> m_volumes;
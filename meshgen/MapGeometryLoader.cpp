@@ -4,6 +4,7 @@
 
 #include "MapGeometryLoader.h"
 
+#include "common/MappedFile.h"
 #include "common/ZoneData.h"
 
 #include <glm/gtc/matrix_transform.hpp>
@@ -11,9 +12,12 @@
 #include <zone-utilities/log/log_macros.h>
 #include <zone-utilities/common/compression.h>
 
+#include <algorithm>
 #include <sstream>
 #include <boost/filesystem.hpp>
 
+// vertices closer together than this are merged into one
+static const float VERTEX_WELD_DISTANCE = 0.001f;
 
 static inline void RotateVertex(glm::vec3& v, float rx, float ry, float rz)
 {
@@ -61,9 +65,19 @@ static inline void TranslateVertex(glm::vec3& v, const glm::vec3& t)
 	TranslateVertex(v, t.x, t.y, t.z);
 }
 
+// matrix equivalent of RotateVertex: rotates around x, then y, then z
+static glm::mat4 RotationMatrix(float rx, float ry, float rz)
+{
+	glm::mat4 m = glm::rotate(glm::mat4(1.0f), rz, glm::vec3(0, 0, 1));
+	m = glm::rotate(m, ry, glm::vec3(0, 1, 0));
+	return glm::rotate(m, rx, glm::vec3(1, 0, 0));
+}
+
 MapGeometryLoader::MapGeometryLoader(const std::string& zoneShortName,
 	const std::string& everquest_path, const std::string& mesh_path)
-	: m_zoneName(zoneShortName)
+	: collide_vert_to_index(VERTEX_WELD_DISTANCE)
+	, non_collide_vert_to_index(VERTEX_WELD_DISTANCE)
+	, m_zoneName(zoneShortName)
 	, m_eqPath(everquest_path)
 	, m_meshPath(mesh_path)
 {
@@ -71,9 +85,11 @@ MapGeometryLoader::MapGeometryLoader(const std::string& zoneShortName,
 
 MapGeometryLoader::~MapGeometryLoader()
 {
-	delete [] m_verts;
-	delete [] m_normals;
-	delete [] m_tris;
+	if (!m_mappedFile)
+	{
+		delete [] m_verts;
+		delete [] m_tris;
+	}
 }
 
 void MapGeometryLoader::addVertex(float x, float y, float z)
@@ -94,6 +110,50 @@ void MapGeometryLoader::addVertex(float x, float y, float z)
 	m_vertCount++;
 }
 
+void MapGeometryLoader::reserveGeometry(int vertCount, int triCount)
+{
+	// still doubling, so that reserving a little at a time doesn't copy every time
+	if (vertCount > vcap)
+	{
+		vcap = std::max(vertCount, vcap * 2);
+		float* nv = new float[vcap * 3];
+		if (m_vertCount)
+			memcpy(nv, m_verts, m_vertCount*3*sizeof(float));
+		delete [] m_verts;
+		m_verts = nv;
+	}
+	if (triCount > tcap)
+	{
+		tcap = std::max(triCount, tcap * 2);
+		int* nt = new int[tcap * 3];
+		if (m_triCount)
+			memcpy(nt, m_tris, m_triCount*3*sizeof(int));
+		delete [] m_tris;
+		m_tris = nt;
+	}
+}
+
+void MapGeometryLoader::shrinkGeometry()
+{
+	// the arrays grew by doubling, the space past the end is given back
+	if (vcap > m_vertCount)
+	{
+		vcap = m_vertCount;
+		float* nv = new float[vcap * 3];
+		memcpy(nv, m_verts, m_vertCount*3*sizeof(float));
+		delete [] m_verts;
+		m_verts = nv;
+	}
+	if (tcap > m_triCount)
+	{
+		tcap = m_triCount;
+		int* nt = new int[tcap * 3];
+		memcpy(nt, m_tris, m_triCount*3*sizeof(int));
+		delete [] m_tris;
+		m_tris = nt;
+	}
+}
+
 void MapGeometryLoader::addTriangle(int a, int b, int c)
 {
 	if (m_triCount + 1 > tcap)
@@ -132,6 +192,8 @@ bool MapGeometryLoader::load()
 		return false;
 	}
 
+	m_terrain.Clear();
+
 	// load terrain geometry
 	if (terrain)
 	{
@@ -141,6 +203,12 @@ bool MapGeometryLoader::load()
 		uint32_t vert_count = ((quads_per_tile + 1) * (quads_per_tile + 1));
 		uint32_t quad_count = (quads_per_tile * quads_per_tile);
 
+		// room for every quad, so the arrays don't grow one tile at a time
+		int terrainQuads = 0;
+		for (const auto& tile : tiles)
+			terrainQuads += tile->IsFlat() ? 1 : (int)quad_count;
+		reserveGeometry(m_vertCount + terrainQuads * 4, m_triCount + terrainQuads * 2);
+
 		for (uint32_t i = 0; i < tiles.size(); ++i)
 		{
 			auto& tile = tiles[i];
@@ -166,6 +234,9 @@ bool MapGeometryLoader::load()
 				addTriangle(counter + 2, counter + 0, counter + 3);
 
 				counter += 4;
+
+				const float heights[4] = { z * m_scale, z * m_scale, z * m_scale, z * m_scale };
+				m_terrain.AddTile(x * m_scale, y * m_scale, 1, dt * m_scale, heights, nullptr);
 			}
 			else
 			{
@@ -200,179 +271,157 @@ bool MapGeometryLoader::load()
 
 					counter += 4;
 				}
+
+				std::vector<float> heights(floats.begin(), floats.begin() + vert_count);
+				for (float& height : heights)
+					height *= m_scale;
+
+				m_terrain.AddTile(x * m_scale, y * m_scale, quads_per_tile, units_per_vertex * m_scale,
+					heights.data(), tile->GetFlags().data());
 			}
 		}
 	}
 
-	for (uint32_t index = 0; index < collide_indices.size(); index += 3, counter += 3)
-	{
-		uint32_t vert_index1 = collide_indices[index];
-		const glm::vec3& vert1 = collide_verts[vert_index1];
-		addVertex(vert1.x, vert1.z, vert1.y);
+	m_terrain.Build();
+	m_terrainVertCount = m_vertCount;
 
-		uint32_t vert_index2 = collide_indices[index + 2];
-		const glm::vec3& vert2 = collide_verts[vert_index2];
-		addVertex(vert2.x, vert2.z, vert2.y);
+	// the collide mesh is already welded, so it can be added with its shared vertices
+	reserveGeometry(m_vertCount + (int)collide_verts.size(), m_triCount + (int)collide_indices.size() / 3);
 
-		uint32_t vert_index3 = collide_indices[index + 1];
-		const glm::vec3& vert3 = collide_verts[vert_index3];
-		addVertex(vert3.x, vert3.z, vert3.y);
+	for (const glm::vec3& vert : collide_verts)
+		addVertex(vert.x, vert.z, vert.y);
 
-		addTriangle(counter, counter + 2, counter + 1);
+	for (uint32_t index = 0; index < collide_indices.size(); index += 3)
+	{
+		addTriangle(counter + collide_indices[index],
+			counter + collide_indices[index + 1],
+			counter + collide_indices[index + 2]);
 	}
+	counter += (uint32_t)collide_verts.size();
 
 	auto isVisible = [](int flags)
 	{
 		return !(flags == 0x01 || flags == 0x10 || flags == 0x11);
 	};
 
-	// Load models
-	for (auto iter : map_models)
-	{
-		std::string name = iter.first;
-		std::shared_ptr<EQEmu::S3D::Geometry> model = iter.second;
-
-		std::shared_ptr<ModelEntry> entry = std::make_shared<ModelEntry>();
-
-		for (const auto& vert : model->GetVertices())
-		{
-			entry->verts.push_back(vert.pos);
-		}
-
-		for (const auto& poly : model->GetPolygons())
-		{
-			bool visible = isVisible(poly.flags);
-
-			entry->polys.emplace_back(
-				ModelEntry::Poly{ glm::ivec3{poly.verts[0], poly.verts[1], poly.verts[2]},
-					visible, poly.flags });
-		}
-
-		m_models.emplace(std::make_pair(std::move(name), std::move(entry)));
-	}
-
-	for (auto iter : map_eqg_models)
+	// Placed models are kept once each, with the transform of every placement. The
+	// model's vertices are stored in recast axes, so the transforms go straight from
+	// those to the final vertices: swap to eq axes, place, then swap back and scale.
+	const glm::mat4 toRecast(
+		glm::vec4(0, 0, 1, 0),
+		glm::vec4(1, 0, 0, 0),
+		glm::vec4(0, 1, 0, 0),
+		glm::vec4(0, 0, 0, 1));
+	const glm::mat4 fromRecast = glm::transpose(toRecast);
+	const glm::mat4 scale = glm::scale(glm::mat4(1.0f), glm::vec3(m_scale));
+
+	m_instances.Clear();
+	std::map<std::string, int> modelIndices;
+
+	auto AddModel = [&](const std::string& name, auto model)
 	{
-		bool first = true;
-		std::string name = iter.first;
-		std::shared_ptr<EQEmu::EQG::Geometry> model = iter.second;
-		std::shared_ptr<ModelEntry> entry = std::make_shared<ModelEntry>();
+		std::vector<float> verts;
+		std::vector<int> tris;
 
+		verts.reserve(model->GetVertices().size() * 3);
 		for (const auto& vert : model->GetVertices())
 		{
-			entry->verts.push_back(vert.pos);
+			verts.push_back(vert.pos.y);
+			verts.push_back(vert.pos.z);
+			verts.push_back(vert.pos.x);
 		}
 
 		for (const auto& poly : model->GetPolygons())
 		{
 			// 0x10 = invisible
 			// 0x01 = no collision
-			bool visible = isVisible(poly.flags);
+			if (!isVisible(poly.flags))
+				continue;
 
-			entry->polys.emplace_back(
-				ModelEntry::Poly{ glm::ivec3{ poly.verts[0], poly.verts[1], poly.verts[2] },
-					visible, poly.flags });
+			tris.push_back(poly.verts[0]);
+			tris.push_back(poly.verts[1]);
+			tris.push_back(poly.verts[2]);
 		}
 
-		m_models.emplace(std::make_pair(std::move(name), std::move(entry)));
+		modelIndices[name] = m_instances.AddModel(std::move(verts), std::move(tris));
+	};
 
-	}
+	for (auto iter : map_models)
+		AddModel(iter.first, iter.second);
 
-	auto AddTriangle = [&](const glm::vec3& v1, const glm::vec3& v2, const glm::vec3& v3)
-	{
-		addVertex(v1.y, v1.z, v1.x);
-		addVertex(v2.y, v2.z, v2.x);
-		addVertex(v3.y, v3.z, v3.x);
+	for (auto iter : map_eqg_models)
+		AddModel(iter.first, iter.second);
 
-		addTriangle(counter, counter + 1, counter + 2);
-		counter += 3;
+	auto AddInstance = [&](int model, const glm::mat4& transform)
+	{
+		m_instances.AddInstance(model, scale * toRecast * transform * fromRecast);
 	};
 
 	for (const auto& obj : map_placeables)
 	{
 		const std::string& name = obj->GetFileName();
 
-		auto modelIter = m_models.find(name);
-		if (modelIter == m_models.end())
+		auto modelIter = modelIndices.find(name);
+		if (modelIter == modelIndices.end() || modelIter->second < 0)
 			continue;
 
 		// some objects have a really low z, just ignore them.
 		if (obj->GetZ() < -30000 || obj->GetX() > 15000 || obj->GetY() > 15000 || obj->GetZ() > 15000)
 			continue;
 
-		const auto& model = modelIter->second;
-		for (const auto& poly : model->polys)
-		{
-			if (!poly.vis)
-				continue;
+		glm::vec3 rot = GetRotation(obj);
 
-			glm::vec3 v[3];
-			for (int i = 0; i < 3; i++)
-			{
-				v[i] = model->verts[poly.indices[i]];
-
-				RotateVertex(v[i], GetRotation(obj));
-				ScaleVertex(v[i], GetScale(obj));
-				TranslateVertex(v[i], GetTranslation(obj));
-			}
+		glm::mat4 transform = glm::translate(glm::mat4(1.0f), GetTranslation(obj));
+		transform = glm::scale(transform, GetScale(obj));
+		transform *= RotationMatrix(rot.x, rot.y, rot.z);
 
-			AddTriangle(v[0], v[1], v[2]);
-		}
+		AddInstance(modelIter->second, transform);
 	}
 
 	for (const auto& group : map_group_placeables)
 	{
+		float groupRotX = static_cast<float>(group->GetRotationX() * M_PI / 180);
+		float groupRotY = static_cast<float>(group->GetRotationY() * M_PI / 180);
+		float groupRotZ = static_cast<float>(group->GetRotationZ() * M_PI / 180);
+
+		// the parts of the transform that are the same for every object in the group
+		const glm::mat4 groupRotationX = RotationMatrix(groupRotX, 0, 0);
+		const glm::mat4 groupRotationXY = RotationMatrix(groupRotX, groupRotY, 0);
+
+		glm::mat4 groupTransform = glm::translate(glm::mat4(1.0f),
+			glm::vec3(group->GetTileX(), group->GetTileY(), group->GetTileZ()) + GetTranslation(group));
+		groupTransform = glm::scale(groupTransform, GetScale(group));
+		groupTransform *= RotationMatrix(0, 0, groupRotZ);
+
 		for (const auto& obj : group->GetPlaceables())
 		{
 			const std::string& name = obj->GetFileName();
 
-			auto modelIter = m_models.find(name);
-			if (modelIter == m_models.end())
+			auto modelIter = modelIndices.find(name);
+			if (modelIter == modelIndices.end() || modelIter->second < 0)
 				continue;
 
-			const auto& model = modelIter->second;
-			for (const auto& poly : model->polys)
-			{
-				if (!poly.vis)
-					continue;
-
-				glm::vec3 v_[3];
-				for (int i = 0; i < 3; i++)
-				{
-					glm::vec3& v = v_[i];
-					v = model->verts[poly.indices[i]];
-
-					ScaleVertex(v, GetScale(obj));
-					TranslateVertex(v, GetTranslation(obj));
-
-					RotateVertex(v, group->GetRotationX() * M_PI / 180, 0, 0);
-					RotateVertex(v, 0, group->GetRotationY() * M_PI / 180, 0);
-
-					glm::vec3 correction = GetTranslation(obj);
-
-					RotateVertex(correction, group->GetRotationX() * M_PI / 180, 0, 0);
-
-					TranslateVertex(v, -correction.x, -correction.y, -correction.z);
-
-					RotateVertex(v, obj->GetRotateX() * M_PI / 180, 0, 0);
-					RotateVertex(v, 0, -obj->GetRotateY() * M_PI / 180, 0);
-					RotateVertex(v, 0, 0, obj->GetRotateZ() * M_PI / 180);
+			// the object is rotated in place, around its position after the group's x/y rotation
+			glm::vec3 correction = glm::vec3(groupRotationX * glm::vec4(GetTranslation(obj), 1.0f));
 
-					TranslateVertex(v, correction.x, correction.y, correction.z);
+			glm::mat4 transform = glm::translate(groupTransform, correction);
+			transform *= RotationMatrix(
+				static_cast<float>(obj->GetRotateX() * M_PI / 180),
+				static_cast<float>(-obj->GetRotateY() * M_PI / 180),
+				static_cast<float>(obj->GetRotateZ() * M_PI / 180));
+			transform = glm::translate(transform, -correction);
+			transform *= groupRotationXY;
+			transform = glm::translate(transform, GetTranslation(obj));
+			transform = glm::scale(transform, GetScale(obj));
 
-					RotateVertex(v, 0, 0, group->GetRotationZ() * M_PI / 180);
-
-					ScaleVertex(v, GetScale(group));
-
-					TranslateVertex(v, group->GetTileX(), group->GetTileY(), group->GetTileZ());
-					TranslateVertex(v, GetTranslation(group));
-				}
-
-				AddTriangle(v_[0], v_[1], v_[2]);
-			}
+			AddInstance(modelIter->second, transform);
 		}
 	}
 
+	m_instances.Build();
+
+	counter = m_vertCount;
+
 	//const auto& non_collide_indices = map.GetNonCollideIndices();
 
 	//for (uint32_t index = 0; index < non_collide_indices.size(); index += 3, counter += 3)
@@ -392,36 +441,46 @@ bool MapGeometryLoader::load()
 	//	addTriangle(counter, counter + 2, counter + 1, tcap);
 	//}
 
+	ReleaseCompileData();
+
 	LoadDoors();
+	shrinkGeometry();
 
-	//message = "Calculating Surface Normals...";
-	m_normals = new float[m_triCount*3];
-	for (int i = 0; i < m_triCount*3; i += 3)
+	return true;
+}
+
+const float* MapGeometryLoader::getNormals() const
+{
+	std::call_once(m_normalsOnce, [this]()
 	{
-		const float* v0 = &m_verts[m_tris[i]*3];
-		const float* v1 = &m_verts[m_tris[i+1]*3];
-		const float* v2 = &m_verts[m_tris[i+2]*3];
-		float e0[3], e1[3];
-		for (int j = 0; j < 3; ++j)
+		m_normals.reset(new float[m_triCount * 3]);
+		for (int i = 0; i < m_triCount*3; i += 3)
 		{
-			e0[j] = v1[j] - v0[j];
-			e1[j] = v2[j] - v0[j];
-		}
-		float* n = &m_normals[i];
-		n[0] = e0[1]*e1[2] - e0[2]*e1[1];
-		n[1] = e0[2]*e1[0] - e0[0]*e1[2];
-		n[2] = e0[0]*e1[1] - e0[1]*e1[0];
-		float d = sqrtf(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
-		if (d > 0)
-		{
-			d = 1.0f/d;
-			n[0] *= d;
-			n[1] *= d;
-			n[2] *= d;
+			const float* v0 = &m_verts[m_tris[i]*3];
+			const float* v1 = &m_verts[m_tris[i+1]*3];
+			const float* v2 = &m_verts[m_tris[i+2]*3];
+			float e0[3], e1[3];
+			for (int j = 0; j < 3; ++j)
+			{
+				e0[j] = v1[j] - v0[j];
+				e1[j] = v2[j] - v0[j];
+			}
+			float* n = &m_normals[i];
+			n[0] = e0[1]*e1[2] - e0[2]*e1[1];
+			n[1] = e0[2]*e1[0] - e0[0]*e1[2];
+			n[2] = e0[0]*e1[1] - e0[1]*e1[0];
+			float d = sqrtf(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+			if (d > 0)
+			{
+				d = 1.0f/d;
+				n[0] *= d;
+				n[1] *= d;
+				n[2] *= d;
+			}
 		}
-	}
+	});
 
-	return true;
+	return m_normals.get();
 }
 
 struct DoorParams
@@ -504,7 +563,7 @@ void MapGeometryLoader::LoadDoors()
 	// Load the models for that door data
 	//
 
-	ZoneData zoneData(m_eqPath, m_zoneName);
+	ZoneData zoneData(m_eqPath, m_zoneName, m_meshPath + "\\MQ2Nav");
 
 	if (!zoneData.IsLoaded())
 		return;
@@ -528,8 +587,11 @@ void MapGeometryLoader::LoadDoors()
 	// generic lambda for both old and new model types
 	auto addModel = [&](const glm::mat4x4& matrix, float scale, auto modelPtr)
 	{
-		auto verts = modelPtr->GetVertices();
-		auto polys = modelPtr->GetPolygons();
+		const auto& verts = modelPtr->GetVertices();
+		const auto& polys = modelPtr->GetPolygons();
+
+		// at most three vertices for each polygon, none of them are shared
+		reserveGeometry(m_vertCount + (int)polys.size() * 3, m_triCount + (int)polys.size());
 
 		for (auto iter = polys.begin(); iter != polys.end(); ++iter)
 		{
@@ -602,17 +664,32 @@ bool MapGeometryLoader::Build()
 	std::vector<EQEmu::S3D::WLDFragment> zone_frags;
 	std::vector<EQEmu::S3D::WLDFragment> zone_object_frags;
 	std::vector<EQEmu::S3D::WLDFragment> object_frags;
-	if (!s3d.ParseWLDFile(filePath + ".s3d", m_zoneName + ".wld", zone_frags))
+
+	ClearGeometry();
+
+	// zone meshes are added as they are parsed, and dropped from the list once added.
+	auto addZoneMesh = [this](uint32_t, EQEmu::S3D::WLDFragment& fragment)
+	{
+		if (fragment.type != 0x36)
+			return false;
+
+		auto& frag = reinterpret_cast<EQEmu::S3D::WLDFragment36&>(fragment);
+		if (auto model = frag.GetData())
+			AddS3DZoneMesh(*model);
+		return true;
+	};
+
+	if (!s3d.ParseWLDFile(filePath + ".s3d", m_zoneName + ".wld", zone_frags, true, addZoneMesh))
 	{
 		return false;
 	}
 
-	if (!s3d.ParseWLDFile(filePath + ".s3d", "objects.wld", zone_object_frags))
+	if (!s3d.ParseWLDFile(filePath + ".s3d", "objects.wld", zone_object_frags, true))
 	{
 		return false;
 	}
 
-	if (!s3d.ParseWLDFile(filePath + "_obj.s3d", m_zoneName + "_obj.wld", object_frags))
+	if (!s3d.ParseWLDFile(filePath + "_obj.s3d", m_zoneName + "_obj.wld", object_frags, true))
 	{
 		return false;
 	}
@@ -698,18 +775,7 @@ bool MapGeometryLoader::CompileS3D(
 	std::vector<EQEmu::S3D::WLDFragment>& zone_object_frags,
 	std::vector<EQEmu::S3D::WLDFragment>& object_frags)
 {
-	collide_verts.clear();
-	collide_indices.clear();
-	non_collide_verts.clear();
-	non_collide_indices.clear();
-	current_collide_index = 0;
-	current_non_collide_index = 0;
-	collide_vert_to_index.clear();
-	non_collide_vert_to_index.clear();
-	map_models.clear();
-	map_eqg_models.clear();
-	map_placeables.clear();
-
+	// zone meshes were already added while parsing, see load().
 	//eqLogMessage(LogTrace, "Processing s3d zone geometry fragments.");
 	for (uint32_t i = 0; i < zone_frags.size(); ++i)
 	{
@@ -722,39 +788,6 @@ bool MapGeometryLoader::CompileS3D(
 				region->GetName().c_str(), region->GetExtendedInfo().c_str());
 
 		}
-		if (zone_frags[i].type == 0x36)
-		{
-			EQEmu::S3D::WLDFragment36& frag = reinterpret_cast<EQEmu::S3D::WLDFragment36&>(zone_frags[i]);
-			auto model = frag.GetData();
-
-			auto& mod_polys = model->GetPolygons();
-			auto& mod_verts = model->GetVertices();
-
-			for (uint32_t j = 0; j < mod_polys.size(); ++j)
-			{
-				auto& current_poly = mod_polys[j];
-				auto v1 = mod_verts[current_poly.verts[0]];
-				auto v2 = mod_verts[current_poly.verts[1]];
-				auto v3 = mod_verts[current_poly.verts[2]];
-
-				float t = v1.pos.x;
-				v1.pos.x = v1.pos.y;
-				v1.pos.y = t;
-
-				t = v2.pos.x;
-				v2.pos.x = v2.pos.y;
-				v2.pos.y = t;
-
-				t = v3.pos.x;
-				v3.pos.x = v3.pos.y;
-				v3.pos.y = t;
-
-				if (current_poly.flags == 0x10)
-					AddFace(v1.pos, v2.pos, v3.pos, false);
-				else
-					AddFace(v1.pos, v2.pos, v3.pos, true);
-			}
-		}
 	}
 
 	eqLogMessage(LogTrace, "Processing zone placeable fragments.");
@@ -895,17 +928,7 @@ bool MapGeometryLoader::CompileEQG(
 	std::vector<std::shared_ptr<EQEmu::EQG::Region>>& regions,
 	std::vector<std::shared_ptr<EQEmu::Light>>& lights)
 {
-	collide_verts.clear();
-	collide_indices.clear();
-	non_collide_verts.clear();
-	non_collide_indices.clear();
-	current_collide_index = 0;
-	current_non_collide_index = 0;
-	collide_vert_to_index.clear();
-	non_collide_vert_to_index.clear();
-	map_models.clear();
-	map_eqg_models.clear();
-	map_placeables.clear();
+	ClearGeometry();
 
 	for (uint32_t i = 0; i < placeables.size(); ++i)
 	{
@@ -971,6 +994,8 @@ bool MapGeometryLoader::CompileEQG(
 		auto& mod_polys = model->GetPolygons();
 		auto& mod_verts = model->GetVertices();
 
+		ReserveFaces(mod_verts.size());
+
 		for (uint32_t j = 0; j < mod_polys.size(); ++j)
 		{
 			auto& current_poly = mod_polys[j];
@@ -1003,17 +1028,7 @@ bool MapGeometryLoader::CompileEQG(
 
 bool MapGeometryLoader::CompileEQGv4()
 {
-	collide_verts.clear();
-	collide_indices.clear();
-	non_collide_verts.clear();
-	non_collide_indices.clear();
-	current_collide_index = 0;
-	current_non_collide_index = 0;
-	collide_vert_to_index.clear();
-	non_collide_vert_to_index.clear();
-	map_models.clear();
-	map_eqg_models.clear();
-	map_placeables.clear();
+	ClearGeometry();
 
 	if (!terrain)
 		return false;
@@ -1142,54 +1157,109 @@ bool MapGeometryLoader::CompileEQGv4()
 	return true;
 }
 
-void MapGeometryLoader::AddFace(glm::vec3& v1, glm::vec3& v2, glm::vec3& v3, bool collidable)
+void MapGeometryLoader::ClearGeometry()
+{
+	collide_verts.clear();
+	collide_indices.clear();
+	non_collide_verts.clear();
+	non_collide_indices.clear();
+	current_collide_index = 0;
+	current_non_collide_index = 0;
+	collide_vert_to_index.clear();
+	non_collide_vert_to_index.clear();
+	map_models.clear();
+	map_eqg_models.clear();
+	map_placeables.clear();
+}
+
+void MapGeometryLoader::ReleaseCompileData()
+{
+	// clear() keeps the memory, these are swapped out to free it
+	std::vector<glm::vec3>().swap(collide_verts);
+	std::vector<uint32_t>().swap(collide_indices);
+	std::vector<glm::vec3>().swap(non_collide_verts);
+	std::vector<uint32_t>().swap(non_collide_indices);
+	current_collide_index = 0;
+	current_non_collide_index = 0;
+
+	collide_vert_to_index = VertexWeldMap(VERTEX_WELD_DISTANCE);
+	non_collide_vert_to_index = VertexWeldMap(VERTEX_WELD_DISTANCE);
+
+	terrain.reset();
+	map_models.clear();
+	map_eqg_models.clear();
+	map_placeables.clear();
+	map_group_placeables.clear();
+}
+
+void MapGeometryLoader::AddS3DZoneMesh(EQEmu::S3D::Geometry& model)
 {
-	if (!collidable)
+	auto& mod_polys = model.GetPolygons();
+	auto& mod_verts = model.GetVertices();
+
+	ReserveFaces(mod_verts.size());
+
+	for (uint32_t j = 0; j < mod_polys.size(); ++j)
 	{
-		auto InsertVertex = [this](const glm::vec3& vec)
-		{
-			auto iter = non_collide_vert_to_index.find(vec);
-			if (iter == non_collide_vert_to_index.end())
-			{
-				non_collide_vert_to_index[vec] = current_non_collide_index;
-				non_collide_verts.push_back(vec);
-				non_collide_indices.push_back(current_non_collide_index);
+		auto& current_poly = mod_polys[j];
+		auto v1 = mod_verts[current_poly.verts[0]];
+		auto v2 = mod_verts[current_poly.verts[1]];
+		auto v3 = mod_verts[current_poly.verts[2]];
 
-				++current_non_collide_index;
-			}
-			else
-			{
-				uint32_t t_idx = iter->second;
-				non_collide_indices.push_back(t_idx);
-			}
-		};
+		float t = v1.pos.x;
+		v1.pos.x = v1.pos.y;
+		v1.pos.y = t;
 
-		InsertVertex(v1);
-		InsertVertex(v2);
-		InsertVertex(v3);
+		t = v2.pos.x;
+		v2.pos.x = v2.pos.y;
+		v2.pos.y = t;
+
+		t = v3.pos.x;
+		v3.pos.x = v3.pos.y;
+		v3.pos.y = t;
+
+		if (current_poly.flags == 0x10)
+			AddFace(v1.pos, v2.pos, v3.pos, false);
+		else
+			AddFace(v1.pos, v2.pos, v3.pos, true);
 	}
-	else
+}
+
+void MapGeometryLoader::ReserveFaces(size_t vertCount)
+{
+	collide_verts.reserve(collide_verts.size() + vertCount);
+	collide_indices.reserve(collide_indices.size() + vertCount * 3);
+	collide_vert_to_index.reserve(collide_vert_to_index.size() + vertCount);
+}
+
+void MapGeometryLoader::AddFace(glm::vec3& v1, glm::vec3& v2, glm::vec3& v3, bool collidable)
+{
+	std::vector<glm::vec3>& verts = collidable ? collide_verts : non_collide_verts;
+	std::vector<uint32_t>& indices = collidable ? collide_indices : non_collide_indices;
+	VertexWeldMap& vertToIndex = collidable ? collide_vert_to_index : non_collide_vert_to_index;
+	uint32_t& currentIndex = collidable ? current_collide_index : current_non_collide_index;
+
+	auto InsertVertex = [&](const glm::vec3& vec)
 	{
-		auto InsertVertex = [this](const glm::vec3& vec)
+		uint32_t index = vertToIndex.insert(vec, currentIndex);
+		if (index == currentIndex)
 		{
-			auto iter = collide_vert_to_index.find(vec);
-			if (iter == collide_vert_to_index.end())
-			{
-				collide_vert_to_index[vec] = current_collide_index;
-				collide_verts.push_back(vec);
-				collide_indices.push_back(current_collide_index);
+			verts.push_back(vec);
+			++currentIndex;
+		}
 
-				++current_collide_index;
-			}
-			else
-			{
-				uint32_t t_idx = iter->second;
-				collide_indices.push_back(t_idx);
-			}
-		};
+		return index;
+	};
 
-		InsertVertex(v1);
-		InsertVertex(v2);
-		InsertVertex(v3);
-	}
+	uint32_t i1 = InsertVertex(v1);
+	uint32_t i2 = InsertVertex(v2);
+	uint32_t i3 = InsertVertex(v3);
+
+	// welding can collapse slivers down to a line
+	if (i1 == i2 || i2 == i3 || i1 == i3)
+		return;
+
+	indices.push_back(i1);
+	indices.push_back(i2);
+	indices.push_back(i3);
 }
@@ -14,28 +14,24 @@
 #pragma warning(pop)
 
 #include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <map>
 #include <tuple>
-#include <unordered_map>
+
+#include "MeshInstances.h"
+#include "TerrainHeightfield.h"
+#include "VertexWeldMap.h"
 
 #include <glm/glm.hpp>
 
-struct KeyFuncs
-{
-	size_t operator()(const glm::vec3& k)const
-	{
-		return std::hash<float>()(k.x) ^ std::hash<float>()(k.y) ^ std::hash<float>()(k.z);
-	}
-
-	bool operator()(const glm::vec3& a, const glm::vec3& b)const
-	{
-		return a == b;
-	}
-};
+class MappedFile;
 
 class MapGeometryLoader
 {
+	friend class GeometryCache;
+
 public:
 	MapGeometryLoader(const std::string& zoneShortName, const std::string& everquest_path,
 		const std::string& mesh_path);
@@ -46,11 +42,21 @@ public:
 	inline const std::string& getFileName() const { return m_zoneName; }
 
 	inline const float* getVerts() const { return m_verts; }
-	inline const float* getNormals() const { return m_normals; }
+	// the normal of each triangle. Only a few tools need them, so they aren't
+	// kept until the first time they're asked for.
+	const float* getNormals() const;
 	inline const int* getTris() const { return m_tris; }
 	inline int getVertCount() const { return m_vertCount; }
 	inline int getTriCount() const { return m_triCount; }
 
+	// placed models, which aren't part of the arrays above
+	inline const MeshInstances& getInstances() const { return m_instances; }
+
+	// the terrain of eqg v4 zones as a height grid. Its triangles are the first
+	// getTerrainVertCount() vertices of the arrays above.
+	inline const TerrainHeightfield& getTerrain() const { return m_terrain; }
+	inline int getTerrainVertCount() const { return m_terrainVertCount; }
+
 	inline int GetDynamicObjectsCount() const { return m_dynamicObjects; }
 	inline bool HasDynamicObjects() const { return m_hasDynamicObjects; }
 
@@ -71,7 +77,14 @@ private:
 		std::vector<std::shared_ptr<EQEmu::Light>>& lights);
 	bool CompileEQGv4();
 
+	void ClearGeometry();
+
+	// the models and placements read from the zone files, and the weld maps, once
+	// they have been copied into the arrays
+	void ReleaseCompileData();
+	void AddS3DZoneMesh(EQEmu::S3D::Geometry& model);
 	void AddFace(glm::vec3& v1, glm::vec3& v2, glm::vec3& v3, bool collidable);
+	void ReserveFaces(size_t vertCount);
 
 	std::vector<glm::vec3> collide_verts;
 	std::vector<uint32_t> collide_indices;
@@ -82,8 +95,8 @@ private:
 	uint32_t current_collide_index = 0;
 	uint32_t current_non_collide_index = 0;
 
-	std::unordered_map<glm::vec3, uint32_t, KeyFuncs, KeyFuncs> collide_vert_to_index;
-	std::unordered_map<glm::vec3, uint32_t, KeyFuncs, KeyFuncs> non_collide_vert_to_index;
+	VertexWeldMap collide_vert_to_index;
+	VertexWeldMap non_collide_vert_to_index;
 
 	std::shared_ptr<EQEmu::EQG::Terrain> terrain;
 	std::map<std::string, std::shared_ptr<EQEmu::S3D::Geometry>> map_models;
@@ -94,19 +107,9 @@ private:
 	int m_dynamicObjects = 0;
 	bool m_hasDynamicObjects = false;
 
-	struct ModelEntry
-	{
-	public:
-		struct Poly
-		{
-			glm::ivec3 indices;
-			uint8_t vis;
-			uint32_t flags;
-		};
-		std::vector<glm::vec3> verts;
-		std::vector<Poly> polys;
-	};
-	std::map<std::string, std::shared_ptr<ModelEntry>> m_models;
+	MeshInstances m_instances;
+	TerrainHeightfield m_terrain;
+	int m_terrainVertCount = 0;
 
 
 
@@ -114,12 +117,15 @@ private:
 	
 	void addVertex(float x, float y, float z);
 	void addTriangle(int a, int b, int c);
+	void reserveGeometry(int vertCount, int triCount);
+	void shrinkGeometry();
 
 	int vcap = 0, tcap = 0;
 	float m_scale = 1.0;
 	float* m_verts = 0;
 	int* m_tris = 0;
-	float* m_normals = 0;
+	mutable std::unique_ptr<float[]> m_normals;
+	mutable std::once_flag m_normalsOnce;
 	int m_vertCount = 0;
 	int m_triCount = 0;
 
@@ -128,4 +134,7 @@ private:
 	std::string m_meshPath;
 
 	bool m_doorsLoaded = false;
+
+	// set when the geometry arrays were mapped from the geometry cache
+	std::shared_ptr<MappedFile> m_mappedFile;
 };
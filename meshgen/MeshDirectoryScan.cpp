@@ -0,0 +1,131 @@
+//
+// MeshDirectoryScan.cpp
+//
+
+#include "MeshDirectoryScan.h"
+#include "GeometryCache.h"
+#include "common/NavMesh.h"
+#include "common/NavMeshData.h"
+#include "common/proto/NavMeshFile.pb.h"
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+#include <vector>
+
+namespace fs = boost::filesystem;
+
+MeshDirectoryScan::MeshDirectoryScan(const std::string& eqPath, const std::string& meshPath)
+	: m_eqPath(eqPath)
+	, m_meshPath(meshPath)
+	, m_results(std::make_shared<Results>())
+{
+}
+
+MeshDirectoryScan::~MeshDirectoryScan()
+{
+	m_stop = true;
+
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+void MeshDirectoryScan::Start()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	if (m_scanning)
+	{
+		m_rescan = true;
+		return;
+	}
+
+	// the last scan is done with the thread
+	if (m_thread.joinable())
+		m_thread.join();
+
+	m_scanning = true;
+	m_thread = std::thread([this]() { Run(); });
+}
+
+std::shared_ptr<const MeshDirectoryScan::Results> MeshDirectoryScan::GetResults() const
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	return m_results;
+}
+
+void MeshDirectoryScan::Run()
+{
+	for (;;)
+	{
+		std::shared_ptr<Results> results = Scan();
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (!m_stop)
+			m_results = std::move(results);
+
+		if (!m_rescan || m_stop)
+		{
+			m_scanning = false;
+			return;
+		}
+
+		m_rescan = false;
+	}
+}
+
+std::shared_ptr<MeshDirectoryScan::Results> MeshDirectoryScan::Scan()
+{
+	auto results = std::make_shared<Results>();
+	const NavMeshConfig defaults;
+
+	// listed once, rather than once per zone to fingerprint its files
+	std::vector<std::string> eqFiles = GeometryCache::ListSourceFiles(m_eqPath);
+
+	boost::system::error_code ec;
+	for (fs::directory_iterator iter(m_meshPath + "\\MQ2Nav", ec), end; !ec && iter != end; iter.increment(ec))
+	{
+		if (m_stop)
+			break;
+
+		const fs::path& path = iter->path();
+		if (path.extension() != NAVMESH_FILE_EXTENSION)
+			continue;
+
+		nav::NavMeshFile summary;
+		MeshFileStats stats;
+		if (!NavMesh::ReadMeshFileSummary(path.string(), summary, &stats.tileCount, &stats.fileVersion))
+			continue;
+
+		boost::system::error_code fileEc;
+		stats.fileSize = fs::file_size(path, fileEc);
+
+		stats.volumeCount = summary.convex_volumes_size();
+		stats.areaCount = summary.areas_size();
+		stats.tileSize = summary.build_settings().tile_size();
+		stats.cellSize = summary.build_settings().cell_size();
+		stats.polyCount = summary.build_info().poly_count();
+		stats.sourceHash = summary.build_info().source_hash();
+
+		stats.buildTime = summary.build_info().build_time();
+		if (!stats.buildTime)
+			stats.buildTime = static_cast<int64_t>(fs::last_write_time(path, fileEc));
+
+		std::string zoneName = summary.zone_short_name();
+		if (zoneName.empty())
+			zoneName = path.stem().string();
+
+		if (stats.sourceHash)
+		{
+			GeometryCache cache(zoneName, m_eqPath, m_meshPath);
+			stats.stale = cache.ComputeSourceHash(&eqFiles) != stats.sourceHash;
+		}
+
+		stats.oldSettings = stats.fileVersion < NAVMESH_FILE_VERSION
+			|| summary.build_settings().config_version() < defaults.configVersion;
+
+		results->emplace(boost::algorithm::to_lower_copy(path.stem().string()), stats);
+	}
+
+	return results;
+}
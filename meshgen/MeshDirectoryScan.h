@@ -0,0 +1,84 @@
+//
+// MeshDirectoryScan.h
+//
+
+// Reads the summary of every navmesh in the output folder on a thread of its
+// own, so that the zone picker can show which meshes are stale, large or built
+// with old settings without opening each one. Only the headers and the summary
+// of a file are read, never its tiles.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+struct MeshFileStats
+{
+	uint64_t fileSize = 0;
+	uint16_t fileVersion = 0;
+	uint32_t tileCount = 0;
+	uint32_t polyCount = 0;           // 0 for files saved before it was recorded
+	int volumeCount = 0;
+	int areaCount = 0;
+	float tileSize = 0.0f;
+	float cellSize = 0.0f;
+
+	// when the tiles were last built, or the file written if it doesn't say.
+	// In seconds since the epoch.
+	int64_t buildTime = 0;
+	uint64_t sourceHash = 0;
+
+	// the zone files changed since the tiles were built
+	bool stale = false;
+
+	// an older file version or build config than this build writes
+	bool oldSettings = false;
+};
+
+class MeshDirectoryScan
+{
+public:
+	// meshPath is the output path, the meshes are in its MQ2Nav folder
+	MeshDirectoryScan(const std::string& eqPath, const std::string& meshPath);
+	~MeshDirectoryScan();
+
+	MeshDirectoryScan(const MeshDirectoryScan&) = delete;
+	MeshDirectoryScan& operator=(const MeshDirectoryScan&) = delete;
+
+	// scan the folder in the background. Asking while a scan is running scans
+	// again once it's done.
+	void Start();
+
+	bool IsScanning() const { return m_scanning; }
+
+	// false once the folders have been changed in the settings
+	bool IsScanOf(const std::string& eqPath, const std::string& meshPath) const
+	{
+		return eqPath == m_eqPath && meshPath == m_meshPath;
+	}
+
+	typedef std::map<std::string, MeshFileStats> Results;
+
+	// the results of the last scan that finished, by lowercase zone short name
+	std::shared_ptr<const Results> GetResults() const;
+
+private:
+	void Run();
+	std::shared_ptr<Results> Scan();
+
+	std::string m_eqPath;
+	std::string m_meshPath;
+
+	mutable std::mutex m_mutex;
+	std::shared_ptr<const Results> m_results;
+	bool m_rescan = false;
+
+	std::thread m_thread;
+	std::atomic<bool> m_scanning{ false };
+	std::atomic<bool> m_stop{ false };
+};
@@ -0,0 +1,200 @@
+//
+// MeshInstances.cpp
+//
+
+#include "MeshInstances.h"
+
+#include <algorithm>
+#include <cfloat>
+
+// models are small, so their chunks are too
+static const int MODEL_TRIS_PER_CHUNK = 64;
+
+void MeshInstances::Clear()
+{
+	m_models.clear();
+	m_instances.clear();
+	m_buckets.clear();
+	m_instancedVertCount = 0;
+	m_instancedTriCount = 0;
+}
+
+int MeshInstances::AddModel(std::vector<float> verts, std::vector<int> tris)
+{
+	if (tris.empty())
+		return -1;
+
+	Model model;
+	model.verts = std::move(verts);
+	model.tris = std::move(tris);
+	model.bmin = glm::vec3(FLT_MAX);
+	model.bmax = glm::vec3(-FLT_MAX);
+
+	for (int index : model.tris)
+	{
+		glm::vec3 v(model.verts[index * 3], model.verts[index * 3 + 1], model.verts[index * 3 + 2]);
+		model.bmin = glm::min(model.bmin, v);
+		model.bmax = glm::max(model.bmax, v);
+	}
+
+	m_models.push_back(std::move(model));
+	return static_cast<int>(m_models.size()) - 1;
+}
+
+void MeshInstances::AddInstance(int model, const glm::mat4& transform)
+{
+	if (model < 0 || model >= (int)m_models.size())
+		return;
+
+	const Model& source = m_models[model];
+
+	Instance instance;
+	instance.model = model;
+	instance.transform = transform;
+	instance.inverse = glm::inverse(transform);
+	instance.mirrored = glm::determinant(glm::mat3(transform)) < 0;
+	instance.bmin = glm::vec3(FLT_MAX);
+	instance.bmax = glm::vec3(-FLT_MAX);
+
+	for (int i = 0; i < 8; ++i)
+	{
+		glm::vec3 corner(
+			(i & 1) ? source.bmax.x : source.bmin.x,
+			(i & 2) ? source.bmax.y : source.bmin.y,
+			(i & 4) ? source.bmax.z : source.bmin.z);
+		glm::vec3 v = glm::vec3(transform * glm::vec4(corner, 1.0f));
+
+		instance.bmin = glm::min(instance.bmin, v);
+		instance.bmax = glm::max(instance.bmax, v);
+	}
+
+	m_instances.push_back(instance);
+	m_instancedVertCount += (int)source.verts.size() / 3;
+	m_instancedTriCount += (int)source.tris.size() / 3;
+}
+
+void MeshInstances::Build()
+{
+	m_buckets.clear();
+	m_bmin = glm::vec3(FLT_MAX);
+	m_bmax = glm::vec3(-FLT_MAX);
+
+	std::vector<bool> mirrored(m_models.size(), false);
+
+	for (int i = 0; i < (int)m_instances.size(); ++i)
+	{
+		const Instance& instance = m_instances[i];
+		if (instance.mirrored)
+			mirrored[instance.model] = true;
+
+		m_bmin = glm::min(m_bmin, instance.bmin);
+		m_bmax = glm::max(m_bmax, instance.bmax);
+
+		for (int z = GetBucket(instance.bmin.z); z <= GetBucket(instance.bmax.z); ++z)
+		{
+			for (int x = GetBucket(instance.bmin.x); x <= GetBucket(instance.bmax.x); ++x)
+				m_buckets[BucketKey(x, z)].push_back(i);
+		}
+	}
+
+	for (int i = 0; i < (int)m_models.size(); ++i)
+	{
+		Model& model = m_models[i];
+		const int ntris = (int)model.tris.size() / 3;
+
+		uint64_t hash = 14695981039346656037ull;
+		auto Add = [&hash](const void* data, size_t size)
+		{
+			const uint8_t* bytes = static_cast<const uint8_t*>(data);
+			for (size_t b = 0; b < size; ++b)
+			{
+				hash ^= bytes[b];
+				hash *= 1099511628211ull;
+			}
+		};
+		Add(model.verts.data(), model.verts.size() * sizeof(float));
+		Add(model.tris.data(), model.tris.size() * sizeof(int));
+		model.hash = hash;
+
+		model.chunkyMesh.reset(new rcChunkyTriMesh);
+		rcCreateChunkyTriMesh(model.verts.data(), model.tris.data(), ntris,
+			MODEL_TRIS_PER_CHUNK, model.chunkyMesh.get());
+
+		if (mirrored[i])
+		{
+			std::vector<int> flipped = model.tris;
+			for (int j = 0; j < ntris; ++j)
+				std::swap(flipped[j * 3 + 1], flipped[j * 3 + 2]);
+
+			model.mirroredChunkyMesh.reset(new rcChunkyTriMesh);
+			rcCreateChunkyTriMesh(model.verts.data(), flipped.data(), ntris,
+				MODEL_TRIS_PER_CHUNK, model.mirroredChunkyMesh.get());
+		}
+		else
+		{
+			model.mirroredChunkyMesh.reset();
+		}
+	}
+}
+
+void MeshInstances::GetInstancesOverlappingRect(const float* bmin, const float* bmax,
+	std::vector<int>& out) const
+{
+	out.clear();
+	ForEachInstanceOverlappingRect(bmin, bmax, [&out](int index) { out.push_back(index); });
+
+	// the order should not depend on the buckets
+	std::sort(out.begin(), out.end());
+}
+
+void MeshInstances::AppendInstanceMesh(int index, std::vector<float>& verts, std::vector<int>& tris,
+	std::vector<float>* normals) const
+{
+	const Instance& instance = m_instances[index];
+	const Model& model = m_models[instance.model];
+
+	const int firstVert = (int)verts.size() / 3;
+	const int firstTri = (int)tris.size() / 3;
+	const int nverts = (int)model.verts.size() / 3;
+	const int ntris = (int)model.tris.size() / 3;
+
+	verts.resize(verts.size() + nverts * 3);
+	float* dst = &verts[firstVert * 3];
+
+	for (int i = 0; i < nverts; ++i)
+	{
+		const float* src = &model.verts[i * 3];
+		glm::vec4 v = instance.transform * glm::vec4(src[0], src[1], src[2], 1.0f);
+
+		*dst++ = v.x;
+		*dst++ = v.y;
+		*dst++ = v.z;
+	}
+
+	tris.reserve(tris.size() + ntris * 3);
+	for (int vert : model.tris)
+		tris.push_back(firstVert + vert);
+
+	if (normals)
+	{
+		normals->resize(normals->size() + ntris * 3);
+		float* n = &(*normals)[(normals->size() / 3 - ntris) * 3];
+
+		for (int i = 0; i < ntris; ++i, n += 3)
+		{
+			const int* tri = &tris[(firstTri + i) * 3];
+			glm::vec3 v0(verts[tri[0] * 3], verts[tri[0] * 3 + 1], verts[tri[0] * 3 + 2]);
+			glm::vec3 v1(verts[tri[1] * 3], verts[tri[1] * 3 + 1], verts[tri[1] * 3 + 2]);
+			glm::vec3 v2(verts[tri[2] * 3], verts[tri[2] * 3 + 1], verts[tri[2] * 3 + 2]);
+
+			glm::vec3 norm = glm::cross(v1 - v0, v2 - v0);
+			float d = glm::length(norm);
+			if (d > 0)
+				norm /= d;
+
+			n[0] = norm.x;
+			n[1] = norm.y;
+			n[2] = norm.z;
+		}
+	}
+}
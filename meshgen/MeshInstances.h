@@ -0,0 +1,154 @@
+//
+// MeshInstances.h
+//
+
+// Models that are placed around a zone are kept once, in model space, along with
+// the transform of each placement. Their triangles are transformed when a tile,
+// a ray or the renderer needs them, instead of being stored again for every
+// placement. Vertices are in recast axes (y is up), both in model space and once
+// transformed.
+
+#pragma once
+
+#include "ChunkyTriMesh.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+class MeshInstances
+{
+public:
+	struct Model
+	{
+		std::vector<float> verts;
+		std::vector<int> tris;
+
+		// bounds of the vertices used by the triangles
+		glm::vec3 bmin, bmax;
+
+		// fingerprint of the vertices and triangles
+		uint64_t hash = 0;
+
+		// for raycasts in model space. Mirrored placements turn the triangles
+		// inside out, so they use a copy with the winding flipped.
+		std::unique_ptr<rcChunkyTriMesh> chunkyMesh;
+		std::unique_ptr<rcChunkyTriMesh> mirroredChunkyMesh;
+	};
+
+	struct Instance
+	{
+		int model;
+		glm::mat4 transform;
+		glm::mat4 inverse;
+
+		// bounds of the transformed model
+		glm::vec3 bmin, bmax;
+
+		bool mirrored;
+	};
+
+	void Clear();
+
+	// Returns the index of the model, or -1 if it has no triangles.
+	int AddModel(std::vector<float> verts, std::vector<int> tris);
+	void AddInstance(int model, const glm::mat4& transform);
+
+	// sets up the chunky meshes and the buckets. Call once all of the models and
+	// instances are added, and before any of the queries below.
+	void Build();
+
+	int GetModelCount() const { return static_cast<int>(m_models.size()); }
+	const Model& GetModel(int index) const { return m_models[index]; }
+
+	int GetInstanceCount() const { return static_cast<int>(m_instances.size()); }
+	const Instance& GetInstance(int index) const { return m_instances[index]; }
+	bool IsEmpty() const { return m_instances.empty(); }
+
+	// vertices and triangles of every instance together, as if they had been copied
+	int GetInstancedVertCount() const { return m_instancedVertCount; }
+	int GetInstancedTriCount() const { return m_instancedTriCount; }
+
+	// bounds of every instance. Only valid if there are any.
+	const glm::vec3& GetBoundsMin() const { return m_bmin; }
+	const glm::vec3& GetBoundsMax() const { return m_bmax; }
+
+	// calls fn once with the index of each instance whose bounds overlap bmin/bmax
+	// on x/z.
+	template <typename Fn>
+	void ForEachInstanceOverlappingRect(const float* bmin, const float* bmax, Fn&& fn) const;
+
+	// same as above, but collects the indices in order
+	void GetInstancesOverlappingRect(const float* bmin, const float* bmax, std::vector<int>& out) const;
+
+	// appends the transformed vertices of an instance to verts and its triangles to
+	// tris, numbered from the vertices already in verts. If normals is given, the
+	// normal of each triangle is appended to it.
+	void AppendInstanceMesh(int instance, std::vector<float>& verts, std::vector<int>& tris,
+		std::vector<float>* normals = nullptr) const;
+
+private:
+	int GetBucket(float v) const { return (int)floorf(v / m_bucketSize); }
+	static uint64_t BucketKey(int x, int z)
+	{
+		return ((uint64_t)(uint32_t)x << 32) | (uint32_t)z;
+	}
+
+	std::vector<Model> m_models;
+	std::vector<Instance> m_instances;
+
+	glm::vec3 m_bmin, m_bmax;
+	int m_instancedVertCount = 0;
+	int m_instancedTriCount = 0;
+
+	// instance indices by the buckets that their bounds overlap
+	float m_bucketSize = 256.0f;
+	std::unordered_map<uint64_t, std::vector<int>> m_buckets;
+};
+
+template <typename Fn>
+void MeshInstances::ForEachInstanceOverlappingRect(const float* bmin, const float* bmax, Fn&& fn) const
+{
+	if (m_buckets.empty())
+		return;
+
+	const int minx = GetBucket(bmin[0]);
+	const int minz = GetBucket(bmin[2]);
+	const int maxx = GetBucket(bmax[0]);
+	const int maxz = GetBucket(bmax[2]);
+
+	for (int z = minz; z <= maxz; ++z)
+	{
+		for (int x = minx; x <= maxx; ++x)
+		{
+			auto iter = m_buckets.find(BucketKey(x, z));
+			if (iter == m_buckets.end())
+				continue;
+
+			for (int index : iter->second)
+			{
+				const Instance& instance = m_instances[index];
+				if (instance.bmin.x > bmax[0] || instance.bmax.x < bmin[0]
+					|| instance.bmin.z > bmax[2] || instance.bmax.z < bmin[2])
+				{
+					continue;
+				}
+
+				// an instance can be in more than one of the buckets, only the first
+				// bucket that both it and the rect are in reports it.
+				if (x != std::max(GetBucket(instance.bmin.x), minx)
+					|| z != std::max(GetBucket(instance.bmin.z), minz))
+				{
+					continue;
+				}
+
+				fn(index);
+			}
+		}
+	}
+}
@@ -0,0 +1,345 @@
+//
+// MeshRaycaster.cpp
+//
+
+#include "MeshRaycaster.h"
+#include "ChunkyTriMesh.h"
+#include "MeshInstances.h"
+#include "TaskScheduler.h"
+
+#include <Recast.h>
+
+#include <algorithm>
+
+#if defined(_M_X64) || defined(_M_IX86_FP) || defined(__SSE2__)
+#define MESH_RAYCASTER_SSE 1
+#include <emmintrin.h>
+#endif
+
+// rays per task when a batch is split between workers
+static const int RAYCAST_BATCH_SIZE = 64;
+
+//============================================================================
+
+static bool intersectSegmentTriangle(const float* sp, const float* sq,
+	const float* a, const float* b, const float* c,
+	float &t)
+{
+	float v, w;
+	float ab[3], ac[3], qp[3], ap[3], norm[3], e[3];
+	rcVsub(ab, b, a);
+	rcVsub(ac, c, a);
+	rcVsub(qp, sp, sq);
+
+	// Compute triangle normal. Can be precalculated or cached if
+	// intersecting multiple segments against the same triangle
+	rcVcross(norm, ab, ac);
+
+	// Compute denominator d. If d <= 0, segment is parallel to or points
+	// away from triangle, so exit early
+	float d = rcVdot(qp, norm);
+	if (d <= 0.0f) return false;
+
+	// Compute intersection t value of pq with plane of triangle. A ray
+	// intersects iff 0 <= t. Segment intersects iff 0 <= t <= 1. Delay
+	// dividing by d until intersection has been found to pierce triangle
+	rcVsub(ap, sp, a);
+	t = rcVdot(ap, norm);
+	if (t < 0.0f) return false;
+	if (t > d) return false; // For segment; exclude this code line for a ray test
+
+	// Compute barycentric coordinate components and test if within bounds
+	rcVcross(e, qp, ap);
+	v = rcVdot(ac, e);
+	if (v < 0.0f || v > d) return false;
+	w = -rcVdot(ab, e);
+	if (w < 0.0f || v + w > d) return false;
+
+	// Segment/ray intersects triangle. Perform delayed division
+	t /= d;
+
+	return true;
+}
+
+static bool isectSegAABB(const float* sp, const float* sq,
+	const float* amin, const float* amax, float& tmin, float& tmax)
+{
+	static const float EPS = 1e-6f;
+
+	float d[3];
+	d[0] = sq[0] - sp[0];
+	d[1] = sq[1] - sp[1];
+	d[2] = sq[2] - sp[2];
+	tmin = 0.0;
+	tmax = 1.0f;
+
+	for (int i = 0; i < 3; i++)
+	{
+		if (fabsf(d[i]) < EPS)
+		{
+			if (sp[i] < amin[i] || sp[i] > amax[i])
+				return false;
+		}
+		else
+		{
+			const float ood = 1.0f / d[i];
+			float t1 = (amin[i] - sp[i]) * ood;
+			float t2 = (amax[i] - sp[i]) * ood;
+			if (t1 > t2) { float tmp = t1; t1 = t2; t2 = tmp; }
+			if (t1 > tmin) tmin = t1;
+			if (t2 < tmax) tmax = t2;
+			if (tmin > tmax) return false;
+		}
+	}
+
+	return true;
+}
+
+#if defined(MESH_RAYCASTER_SSE)
+
+// load one coordinate of the same vertex of four triangles
+static inline __m128 LoadCoord(const float* verts, const int* tris, int corner, int axis)
+{
+	return _mm_setr_ps(
+		verts[tris[0 + corner] * 3 + axis],
+		verts[tris[3 + corner] * 3 + axis],
+		verts[tris[6 + corner] * 3 + axis],
+		verts[tris[9 + corner] * 3 + axis]);
+}
+
+// intersectSegmentTriangle for four triangles. Returns a mask of the triangles
+// that were hit, with the t of each in t.
+static inline int IntersectSegmentTriangles(const float* sp, const float* sq,
+	const float* verts, const int* tris, __m128& t)
+{
+	const __m128 zero = _mm_setzero_ps();
+
+	__m128 ax = LoadCoord(verts, tris, 0, 0), ay = LoadCoord(verts, tris, 0, 1), az = LoadCoord(verts, tris, 0, 2);
+	__m128 abx = _mm_sub_ps(LoadCoord(verts, tris, 1, 0), ax);
+	__m128 aby = _mm_sub_ps(LoadCoord(verts, tris, 1, 1), ay);
+	__m128 abz = _mm_sub_ps(LoadCoord(verts, tris, 1, 2), az);
+	__m128 acx = _mm_sub_ps(LoadCoord(verts, tris, 2, 0), ax);
+	__m128 acy = _mm_sub_ps(LoadCoord(verts, tris, 2, 1), ay);
+	__m128 acz = _mm_sub_ps(LoadCoord(verts, tris, 2, 2), az);
+
+	__m128 qpx = _mm_set1_ps(sp[0] - sq[0]);
+	__m128 qpy = _mm_set1_ps(sp[1] - sq[1]);
+	__m128 qpz = _mm_set1_ps(sp[2] - sq[2]);
+
+	// triangle normal, and the denominator
+	__m128 nx = _mm_sub_ps(_mm_mul_ps(aby, acz), _mm_mul_ps(abz, acy));
+	__m128 ny = _mm_sub_ps(_mm_mul_ps(abz, acx), _mm_mul_ps(abx, acz));
+	__m128 nz = _mm_sub_ps(_mm_mul_ps(abx, acy), _mm_mul_ps(aby, acx));
+
+	__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(qpx, nx), _mm_mul_ps(qpy, ny)), _mm_mul_ps(qpz, nz));
+	__m128 valid = _mm_cmpgt_ps(d, zero);
+	if (!_mm_movemask_ps(valid))
+		return 0;
+
+	__m128 apx = _mm_sub_ps(_mm_set1_ps(sp[0]), ax);
+	__m128 apy = _mm_sub_ps(_mm_set1_ps(sp[1]), ay);
+	__m128 apz = _mm_sub_ps(_mm_set1_ps(sp[2]), az);
+
+	t = _mm_add_ps(_mm_add_ps(_mm_mul_ps(apx, nx), _mm_mul_ps(apy, ny)), _mm_mul_ps(apz, nz));
+	valid = _mm_and_ps(valid, _mm_cmpge_ps(t, zero));
+	valid = _mm_and_ps(valid, _mm_cmple_ps(t, d));
+
+	// barycentric coordinates
+	__m128 ex = _mm_sub_ps(_mm_mul_ps(qpy, apz), _mm_mul_ps(qpz, apy));
+	__m128 ey = _mm_sub_ps(_mm_mul_ps(qpz, apx), _mm_mul_ps(qpx, apz));
+	__m128 ez = _mm_sub_ps(_mm_mul_ps(qpx, apy), _mm_mul_ps(qpy, apx));
+
+	__m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(acx, ex), _mm_mul_ps(acy, ey)), _mm_mul_ps(acz, ez));
+	__m128 w = _mm_sub_ps(zero, _mm_add_ps(_mm_add_ps(_mm_mul_ps(abx, ex), _mm_mul_ps(aby, ey)), _mm_mul_ps(abz, ez)));
+
+	valid = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+	valid = _mm_and_ps(valid, _mm_cmple_ps(v, d));
+	valid = _mm_and_ps(valid, _mm_cmpge_ps(w, zero));
+	valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(v, w), d));
+
+	int mask = _mm_movemask_ps(valid);
+	if (mask)
+		t = _mm_div_ps(t, d);
+
+	return mask;
+}
+
+#endif
+
+//----------------------------------------------------------------------------
+
+MeshRaycaster::MeshRaycaster(const float* verts, const rcChunkyTriMesh* chunkyMesh,
+	const glm::vec3& bmin, const glm::vec3& bmax, const MeshInstances* instances)
+	: m_verts(verts)
+	, m_chunkyMesh(chunkyMesh)
+	, m_bmin(bmin)
+	, m_bmax(bmax)
+	, m_instances(instances)
+{
+}
+
+bool MeshRaycaster::Raycast(const float* src, const float* dst, float& tmin) const
+{
+	std::vector<int> chunks;
+	return Raycast(src, dst, tmin, chunks);
+}
+
+void MeshRaycaster::Raycast(MeshRay& ray) const
+{
+	ray.t = 1.0f;
+	ray.hit = Raycast(&ray.start[0], &ray.end[0], ray.t);
+}
+
+void MeshRaycaster::Raycast(MeshRay* rays, int count, TaskScheduler* scheduler) const
+{
+	auto runBatch = [this, rays](int first, int last)
+	{
+		// the chunk list is reused for every ray of the batch
+		std::vector<int> chunks;
+
+		for (int i = first; i < last; ++i)
+		{
+			MeshRay& ray = rays[i];
+			ray.t = 1.0f;
+			ray.hit = Raycast(&ray.start[0], &ray.end[0], ray.t, chunks);
+		}
+	};
+
+	if (!scheduler || count <= RAYCAST_BATCH_SIZE)
+	{
+		runBatch(0, count);
+		return;
+	}
+
+	std::vector<TaskScheduler::Task> tasks;
+	tasks.reserve((count + RAYCAST_BATCH_SIZE - 1) / RAYCAST_BATCH_SIZE);
+
+	for (int first = 0; first < count; first += RAYCAST_BATCH_SIZE)
+	{
+		int last = std::min(first + RAYCAST_BATCH_SIZE, count);
+		tasks.push_back([runBatch, first, last]() { runBatch(first, last); });
+	}
+
+	scheduler->Run(std::move(tasks));
+	scheduler->Wait();
+}
+
+bool MeshRaycaster::Raycast(const float* src, const float* dst, float& tmin,
+	std::vector<int>& chunks) const
+{
+	float t = 1.0f;
+	bool hit = RaycastTriangles(src, dst, t, chunks);
+
+	if (m_instances && RaycastInstances(src, dst, t, chunks))
+		hit = true;
+
+	tmin = t;
+	return hit;
+}
+
+// lowers tmin to the nearest hit that is closer than it
+bool MeshRaycaster::RaycastTriangles(const float* src, const float* dst, float& tmin,
+	std::vector<int>& chunks) const
+{
+	if (!m_verts || !m_chunkyMesh)
+		return false;
+
+	// Prune hit ray.
+	float btmin, btmax;
+	if (!isectSegAABB(src, dst, &m_bmin[0], &m_bmax[0], btmin, btmax))
+		return false;
+	float p[2], q[2];
+	p[0] = src[0] + (dst[0]-src[0])*btmin;
+	p[1] = src[2] + (dst[2]-src[2])*btmin;
+	q[0] = src[0] + (dst[0]-src[0])*btmax;
+	q[1] = src[2] + (dst[2]-src[2])*btmax;
+
+	rcGetChunksOverlappingSegment(m_chunkyMesh, p, q, chunks);
+	if (chunks.empty())
+		return false;
+
+	bool hit = false;
+
+	for (int chunk : chunks)
+	{
+		const rcChunkyTriMeshNode& node = m_chunkyMesh->nodes[chunk];
+		const int* tris = &m_chunkyMesh->tris[node.i*3];
+		const int ntris = node.n;
+		int i = 0;
+
+#if defined(MESH_RAYCASTER_SSE)
+		for (; i + 4 <= ntris; i += 4)
+		{
+			__m128 t;
+			int mask = IntersectSegmentTriangles(src, dst, m_verts, &tris[i*3], t);
+			if (!mask)
+				continue;
+
+			alignas(16) float ts[4];
+			_mm_store_ps(ts, t);
+
+			for (int j = 0; j < 4; ++j)
+			{
+				if ((mask & (1 << j)) && ts[j] < tmin)
+					tmin = ts[j];
+			}
+			hit = true;
+		}
+#endif
+
+		for (; i < ntris; ++i)
+		{
+			const int* tri = &tris[i*3];
+
+			float t = 1;
+			if (intersectSegmentTriangle(src, dst,
+				&m_verts[tri[0]*3], &m_verts[tri[1]*3], &m_verts[tri[2]*3], t))
+			{
+				if (t < tmin)
+					tmin = t;
+				hit = true;
+			}
+		}
+	}
+
+	return hit;
+}
+
+bool MeshRaycaster::RaycastInstances(const float* src, const float* dst, float& tmin,
+	std::vector<int>& chunks) const
+{
+	float bmin[3], bmax[3];
+	rcVcopy(bmin, src);
+	rcVcopy(bmax, src);
+	rcVmin(bmin, dst);
+	rcVmax(bmax, dst);
+
+	bool hit = false;
+
+	m_instances->ForEachInstanceOverlappingRect(bmin, bmax, [&](int index)
+	{
+		const MeshInstances::Instance& instance = m_instances->GetInstance(index);
+
+		// nothing in the instance can be closer than a hit that was already found
+		float btmin, btmax;
+		if (!isectSegAABB(src, dst, &instance.bmin[0], &instance.bmax[0], btmin, btmax)
+			|| btmin >= tmin)
+		{
+			return;
+		}
+
+		// a point keeps its position along the segment when both are transformed
+		glm::vec3 lsrc = glm::vec3(instance.inverse * glm::vec4(src[0], src[1], src[2], 1.0f));
+		glm::vec3 ldst = glm::vec3(instance.inverse * glm::vec4(dst[0], dst[1], dst[2], 1.0f));
+
+		const MeshInstances::Model& model = m_instances->GetModel(instance.model);
+		MeshRaycaster raycaster(model.verts.data(),
+			instance.mirrored ? model.mirroredChunkyMesh.get() : model.chunkyMesh.get(),
+			model.bmin, model.bmax);
+
+		if (raycaster.RaycastTriangles(&lsrc[0], &ldst[0], tmin, chunks))
+			hit = true;
+	});
+
+	return hit;
+}
@@ -0,0 +1,53 @@
+//
+// MeshRaycaster.h
+//
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+struct rcChunkyTriMesh;
+class MeshInstances;
+class TaskScheduler;
+
+// a segment to test against the geometry, and the result of the test
+struct MeshRay
+{
+	glm::vec3 start;
+	glm::vec3 end;
+
+	// nearest hit along the segment, from 0 at start to 1 at end
+	float t = 1.0f;
+	bool hit = false;
+};
+
+// Segment tests against the triangles of a chunky mesh. Each segment is tested
+// against four triangles at a time with SSE, and gives the same result as
+// testing the triangles one by one. Placed models are tested in their own model
+// space, with the segment transformed into it.
+class MeshRaycaster
+{
+public:
+	// bmin and bmax are the bounds of all of the vertices
+	MeshRaycaster(const float* verts, const rcChunkyTriMesh* chunkyMesh,
+		const glm::vec3& bmin, const glm::vec3& bmax, const MeshInstances* instances = nullptr);
+
+	bool Raycast(const float* src, const float* dst, float& tmin) const;
+	void Raycast(MeshRay& ray) const;
+
+	// test a batch of segments. With a scheduler the batch is split between its
+	// workers, and this waits for them to finish.
+	void Raycast(MeshRay* rays, int count, TaskScheduler* scheduler = nullptr) const;
+
+private:
+	bool Raycast(const float* src, const float* dst, float& tmin, std::vector<int>& chunks) const;
+	bool RaycastTriangles(const float* src, const float* dst, float& tmin, std::vector<int>& chunks) const;
+	bool RaycastInstances(const float* src, const float* dst, float& tmin, std::vector<int>& chunks) const;
+
+	const float* m_verts;
+	const rcChunkyTriMesh* m_chunkyMesh;
+	glm::vec3 m_bmin, m_bmax;
+	const MeshInstances* m_instances;
+};
@@ -0,0 +1,172 @@
+//
+// NavMeshFlood.cpp
+//
+
+#include "NavMeshFlood.h"
+#include "TaskScheduler.h"
+
+#include <algorithm>
+
+// frontiers smaller than this are expanded on the calling thread, splitting
+// them up costs more than it saves.
+static const size_t FLOOD_MIN_PARALLEL_FRONTIER = 512;
+
+//----------------------------------------------------------------------------
+
+void PolyBitset::init(const dtNavMesh* nav)
+{
+	m_nav = nav;
+	m_tileOffsets.assign(nav->getMaxTiles(), 0);
+	m_tilePolys.assign(nav->getMaxTiles(), 0);
+
+	uint32_t total = 0;
+	for (int i = 0; i < nav->getMaxTiles(); ++i)
+	{
+		const dtMeshTile* tile = nav->getTile(i);
+		m_tileOffsets[i] = total;
+
+		if (tile->header)
+		{
+			m_tilePolys[i] = tile->header->polyCount;
+			total += tile->header->polyCount;
+		}
+	}
+
+	m_polyCount = (int)total;
+	m_words = (total + 63) / 64;
+	m_bits.reset(new std::atomic<uint64_t>[m_words]);
+	clear();
+}
+
+void PolyBitset::clear()
+{
+	for (size_t i = 0; i < m_words; ++i)
+		m_bits[i].store(0, std::memory_order_relaxed);
+
+	m_count = 0;
+}
+
+bool PolyBitset::getIndex(dtPolyRef ref, uint32_t& index) const
+{
+	if (!m_nav || !ref)
+		return false;
+
+	unsigned int salt, it, ip;
+	m_nav->decodePolyId(ref, salt, it, ip);
+	if (it >= m_tilePolys.size() || ip >= m_tilePolys[it])
+		return false;
+
+	index = m_tileOffsets[it] + ip;
+	return true;
+}
+
+bool PolyBitset::test(dtPolyRef ref) const
+{
+	uint32_t index;
+	if (!getIndex(ref, index))
+		return false;
+
+	uint64_t mask = (uint64_t)1 << (index & 63);
+	return (m_bits[index >> 6].load(std::memory_order_relaxed) & mask) != 0;
+}
+
+bool PolyBitset::set(dtPolyRef ref)
+{
+	uint32_t index;
+	if (!getIndex(ref, index))
+		return false;
+
+	uint64_t mask = (uint64_t)1 << (index & 63);
+	if (m_bits[index >> 6].fetch_or(mask, std::memory_order_relaxed) & mask)
+		return false;
+
+	++m_count;
+	return true;
+}
+
+//----------------------------------------------------------------------------
+
+NavMeshFlood::NavMeshFlood(const dtNavMesh* nav)
+	: m_nav(nav)
+{
+	m_visited.init(nav);
+}
+
+void NavMeshFlood::expand(const dtPolyRef* refs, size_t count, std::vector<dtPolyRef>& next)
+{
+	for (size_t n = 0; n < count; ++n)
+	{
+		// The refs came out of the links, skip checking internal data.
+		const dtMeshTile* tile = nullptr;
+		const dtPoly* poly = nullptr;
+		m_nav->getTileAndPolyByRefUnsafe(refs[n], &tile, &poly);
+
+		// Visit linked polygons.
+		for (auto i = poly->firstLink; i != DT_NULL_LINK; i = tile->links[i].next)
+		{
+			const dtPolyRef neiRef = tile->links[i].ref;
+
+			// only the thread that sets the bit gets to expand it
+			if (neiRef && m_visited.set(neiRef))
+				next.push_back(neiRef);
+		}
+	}
+}
+
+bool NavMeshFlood::flood(const std::vector<dtPolyRef>& starts, TaskScheduler& scheduler,
+	const std::atomic<bool>* cancel)
+{
+	std::vector<dtPolyRef> frontier;
+	for (dtPolyRef ref : starts)
+	{
+		if (m_nav->isValidPolyRef(ref) && m_visited.set(ref))
+			frontier.push_back(ref);
+	}
+
+	const size_t workers = (size_t)std::max(1, scheduler.GetThreadCount());
+	std::vector<std::vector<dtPolyRef>> next(workers);
+
+	while (!frontier.empty())
+	{
+		if (cancel && *cancel)
+			return false;
+
+		if (frontier.size() < FLOOD_MIN_PARALLEL_FRONTIER || workers == 1)
+		{
+			next[0].clear();
+			expand(frontier.data(), frontier.size(), next[0]);
+			frontier.swap(next[0]);
+			continue;
+		}
+
+		// one contiguous run of the frontier per worker
+		const size_t chunk = (frontier.size() + workers - 1) / workers;
+		std::vector<TaskScheduler::Task> tasks;
+		tasks.reserve(workers);
+
+		for (size_t w = 0; w < workers; ++w)
+		{
+			size_t first = w * chunk;
+			if (first >= frontier.size())
+				break;
+
+			size_t count = std::min(chunk, frontier.size() - first);
+			next[w].clear();
+
+			tasks.push_back([this, &frontier, &next, w, first, count]()
+			{
+				expand(&frontier[first], count, next[w]);
+			});
+		}
+
+		const size_t used = tasks.size();
+		scheduler.Run(std::move(tasks));
+		scheduler.Wait();
+
+		frontier.clear();
+		for (size_t w = 0; w < used; ++w)
+			frontier.insert(frontier.end(), next[w].begin(), next[w].end());
+	}
+
+	return true;
+}
@@ -0,0 +1,87 @@
+//
+// NavMeshFlood.h
+//
+
+#pragma once
+
+#include <DetourNavMesh.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class TaskScheduler;
+
+// One bit for every poly of a navmesh. Setting bits is safe from multiple
+// threads.
+class PolyBitset
+{
+public:
+	PolyBitset() = default;
+
+	// sized for the tiles that are in the navmesh right now
+	void init(const dtNavMesh* nav);
+	void clear();
+
+	bool test(dtPolyRef ref) const;
+
+	// returns true if the bit wasn't set before
+	bool set(dtPolyRef ref);
+
+	int getCount() const { return m_count; }
+	int getPolyCount() const { return m_polyCount; }
+
+private:
+	bool getIndex(dtPolyRef ref, uint32_t& index) const;
+
+	const dtNavMesh* m_nav = nullptr;
+	std::vector<uint32_t> m_tileOffsets;   // first bit of each tile
+	std::vector<uint32_t> m_tilePolys;     // poly count of each tile
+	std::unique_ptr<std::atomic<uint64_t>[]> m_bits;
+	size_t m_words = 0;
+	int m_polyCount = 0;
+	std::atomic<int> m_count = 0;
+};
+
+// Flood fill across the links of a navmesh. Each step of the fill expands the
+// whole frontier, split between the workers of the scheduler.
+class NavMeshFlood
+{
+public:
+	explicit NavMeshFlood(const dtNavMesh* nav);
+
+	// polys reached from starts are added to the visited set. Can be called again
+	// with new starts to grow the set. Returns false if cancelled.
+	bool flood(const std::vector<dtPolyRef>& starts, TaskScheduler& scheduler,
+		const std::atomic<bool>* cancel = nullptr);
+
+	const dtNavMesh* getNavMesh() const { return m_nav; }
+
+	PolyBitset& getVisited() { return m_visited; }
+	const PolyBitset& getVisited() const { return m_visited; }
+
+	// calls fn(tile, polyIndex) for every poly that hasn't been visited
+	template <typename Fn>
+	void forEachUnvisited(Fn&& fn) const
+	{
+		for (int i = 0; i < m_nav->getMaxTiles(); ++i)
+		{
+			const dtMeshTile* tile = m_nav->getTile(i);
+			if (!tile->header) continue;
+
+			const dtPolyRef base = m_nav->getPolyRefBase(tile);
+			for (int j = 0; j < tile->header->polyCount; ++j)
+			{
+				if (!m_visited.test(base | (dtPolyRef)j))
+					fn(tile, j);
+			}
+		}
+	}
+
+private:
+	void expand(const dtPolyRef* refs, size_t count, std::vector<dtPolyRef>& next);
+
+	const dtNavMesh* m_nav;
+	PolyBitset m_visited;
+};
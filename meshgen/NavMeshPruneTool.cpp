@@ -5,217 +5,312 @@
 #include "NavMeshPruneTool.h"
 
 #include "InputGeom.h"
+#include "NavMeshFlood.h"
 #include "NavMeshTool.h"
+#include "TaskScheduler.h"
 #include "common/NavMeshData.h"
+#include "common/Utilities.h"
 
 #include <DetourNavMesh.h>
 #include <DetourCommon.h>
-#include <DetourAssert.h>
 #include <DetourDebugDraw.h>
 
 #include <imgui.h>
 #include <imgui_custom/imgui_user.h>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
 #include <vector>
 
-//-----------------------------------------------------------------------------
+//----------------------------------------------------------------------------
 
-class NavmeshFlags
+NavMeshPruneTool::NavMeshPruneTool()
 {
-	struct TileFlags
-	{
-		inline void purge() { dtFree(flags); }
-		unsigned char* flags;
-		int nflags;
-		dtPolyRef base;
-	};
-
-	const dtNavMesh* m_nav;
-	TileFlags* m_tiles;
-	int m_ntiles;
-
-public:
-	NavmeshFlags() :
-		m_nav(0), m_tiles(0), m_ntiles(0)
-	{
-	}
+}
 
-	~NavmeshFlags()
-	{
-		for (int i = 0; i < m_ntiles; ++i)
-			m_tiles[i].purge();
-		dtFree(m_tiles);
-	}
+NavMeshPruneTool::~NavMeshPruneTool()
+{
+	cancelJob();
+}
+
+void NavMeshPruneTool::init(NavMeshTool* meshtool)
+{
+	m_meshTool = meshtool;
+}
+
+void NavMeshPruneTool::reset()
+{
+	cancelJob();
+
+	m_hitPosSet = false;
+	m_flood.reset();
+	m_prunedTiles.clear();
+}
+
+void NavMeshPruneTool::startJob(std::vector<dtPolyRef> starts, bool prune)
+{
+	if (m_jobRunning)
+		return;
+	if (m_jobThread.joinable())
+		m_jobThread.join();
+
+	m_jobNavMesh = m_meshTool->GetNavMesh()->GetNavMesh();
+	m_jobPrunes = prune;
+	m_jobRunning = true;
+	m_prunedTiles.clear();
 
-	bool init(const dtNavMesh* nav)
+	// the polys are disabled in place, so the tiles that lose some are saved first
+	if (prune && starts.empty())
 	{
-		m_ntiles = nav->getMaxTiles();
-		if (!m_ntiles)
-			return true;
-		m_tiles = (TileFlags*)dtAlloc(sizeof(TileFlags)*m_ntiles, DT_ALLOC_TEMP);
-		if (!m_tiles)
-		{
-			return false;
-		}
-		memset(m_tiles, 0, sizeof(TileFlags)*m_ntiles);
+		m_meshTool->beginUndoStep("Prune Polys");
 
-		// Alloc flags for each tile.
+		const dtNavMesh* nav = m_jobNavMesh.get();
 		for (int i = 0; i < nav->getMaxTiles(); ++i)
 		{
 			const dtMeshTile* tile = nav->getTile(i);
 			if (!tile->header) continue;
-			TileFlags* tf = &m_tiles[i];
-			tf->nflags = tile->header->polyCount;
-			tf->base = nav->getPolyRefBase(tile);
-			if (tf->nflags)
+
+			const dtPolyRef base = nav->getPolyRefBase(tile);
+			for (int j = 0; j < tile->header->polyCount; ++j)
 			{
-				tf->flags = (unsigned char*)dtAlloc(tf->nflags, DT_ALLOC_TEMP);
-				if (!tf->flags)
-					return false;
-				memset(tf->flags, 0, tf->nflags);
+				if (!m_flood->getVisited().test(base | (unsigned int)j))
+				{
+					m_meshTool->saveUndoTile(tile->header->x, tile->header->y);
+					break;
+				}
 			}
 		}
-
-		m_nav = nav;
-
-		return false;
-	}
-
-	inline void clearAllFlags()
-	{
-		for (int i = 0; i < m_ntiles; ++i)
-		{
-			TileFlags* tf = &m_tiles[i];
-			if (tf->nflags)
-				memset(tf->flags, 0, tf->nflags);
-		}
 	}
 
-	inline unsigned char getFlags(dtPolyRef ref)
-	{
-		dtAssert(m_nav);
-		dtAssert(m_ntiles);
-		// Assume the ref is valid, no bounds checks.
-		unsigned int salt, it, ip;
-		m_nav->decodePolyId(ref, salt, it, ip);
-		return m_tiles[it].flags[ip];
-	}
+	// the job works on the live tiles. It holds the tile lock while it does, and
+	// gives up if the tiles were changed since it was started.
+	std::shared_ptr<NavMesh> navMesh = m_meshTool->GetNavMesh();
+	uint32_t generation = navMesh->GetTileGeneration();
 
-	inline void setFlags(dtPolyRef ref, unsigned char flags)
+	m_jobThread = std::thread([this, navMesh, generation, starts = std::move(starts), prune]()
 	{
-		dtAssert(m_nav);
-		dtAssert(m_ntiles);
-		// Assume the ref is valid, no bounds checks.
-		unsigned int salt, it, ip;
-		m_nav->decodePolyId(ref, salt, it, ip);
-		m_tiles[it].flags[ip] = flags;
-	}
-};
+		TaskScheduler scheduler(0, TaskScheduler::Priority::BelowNormal);
+		bool changed = false;
 
-static void floodNavmesh(dtNavMesh* nav, NavmeshFlags* flags, dtPolyRef start, uint8_t flag)
-{
-	// If already visited, skip.
-	if (flags->getFlags(start))
-		return;
-
-	std::vector<dtPolyRef> openList;
-	openList.push_back(start);
-
-	while (!openList.empty())
-	{
-		const dtPolyRef ref = openList.back();
-		openList.pop_back();
+		if (!starts.empty())
+		{
+			auto lock = navMesh->LockTiles();
+			changed = navMesh->GetTileGeneration() != generation;
 
-		// Get current poly and tile.
-		// The API input has been checked already, skip checking internal data.
-		const dtMeshTile* tile = nullptr;
-		const dtPoly* poly = nullptr;
-		nav->getTileAndPolyByRefUnsafe(ref, &tile, &poly);
+			if (!changed)
+				m_flood->flood(starts, scheduler, &m_cancelJob);
+		}
 
-		// Visit linked polygons.
-		for (auto i = poly->firstLink; i != DT_NULL_LINK; i = tile->links[i].next)
+		if (prune && !changed && !m_cancelJob)
 		{
-			const dtPolyRef neiRef = tile->links[i].ref;
+			auto lock = navMesh->LockTilesForWrite();
+			if (navMesh->GetTileGeneration() == generation)
+				pruneUnvisited(scheduler);
+		}
 
-			// Skip invalid and already visited.
-			if (!neiRef || flags->getFlags(neiRef))
-				continue;
+		m_jobRunning = false;
+	});
+}
 
-			// Mark as visited
-			flags->setFlags(neiRef, flag);
+void NavMeshPruneTool::cancelJob()
+{
+	m_cancelJob = true;
+	if (m_jobThread.joinable())
+		m_jobThread.join();
 
-			// Visit neighbors
-			openList.push_back(neiRef);
-		}
-	}
+	m_cancelJob = false;
+	m_jobRunning = false;
+	m_jobNavMesh.reset();
 }
 
-static void disableUnvisitedPolys(dtNavMesh* nav, NavmeshFlags* flags)
+void NavMeshPruneTool::pruneUnvisited(TaskScheduler& scheduler)
 {
+	dtNavMesh* nav = m_jobNavMesh.get();
+
+	// every tile only touches its own polys, so they can all go at once
+	std::vector<std::vector<uint16_t>> tilePolys(nav->getMaxTiles());
+	std::vector<TaskScheduler::Task> tasks;
+
 	for (int i = 0; i < nav->getMaxTiles(); ++i)
 	{
 		const dtMeshTile* tile = const_cast<const dtNavMesh*>(nav)->getTile(i);
-
 		if (!tile->header) continue;
-		const dtPolyRef base = nav->getPolyRefBase(tile);
-		for (int j = 0; j < tile->header->polyCount; ++j)
+
+		tasks.push_back([this, nav, tile, &tilePolys, i]()
 		{
-			const dtPolyRef ref = base | (unsigned int)j;
-			if (!flags->getFlags(ref))
+			const dtPolyRef base = nav->getPolyRefBase(tile);
+			for (int j = 0; j < tile->header->polyCount; ++j)
 			{
-				uint16_t f = 0;
-				nav->getPolyFlags(ref, &f);
-				nav->setPolyFlags(ref, f | +PolyFlags::Disabled);
+				const dtPolyRef ref = base | (unsigned int)j;
+				if (!m_flood->getVisited().test(ref))
+				{
+					uint16_t f = 0;
+					nav->getPolyFlags(ref, &f);
+					nav->setPolyFlags(ref, f | +PolyFlags::Disabled);
+
+					tilePolys[i].push_back((uint16_t)j);
+				}
 			}
-		}
+		});
 	}
-}
 
-//----------------------------------------------------------------------------
+	scheduler.Run(std::move(tasks));
+	scheduler.Wait();
 
-NavMeshPruneTool::NavMeshPruneTool()
-{
-}
+	for (int i = 0; i < nav->getMaxTiles(); ++i)
+	{
+		if (tilePolys[i].empty())
+			continue;
 
-NavMeshPruneTool::~NavMeshPruneTool()
-{
+		const dtMeshTile* tile = const_cast<const dtNavMesh*>(nav)->getTile(i);
+		m_prunedTiles.push_back(PrunedTile{ tile->header->x, tile->header->y, tile->header->layer,
+			std::move(tilePolys[i]) });
+	}
 }
 
-void NavMeshPruneTool::init(NavMeshTool* meshtool)
+void NavMeshPruneTool::finishJob()
 {
-	m_meshTool = meshtool;
+	m_jobThread.join();
+	m_jobNavMesh.reset();
+
+	if (!m_jobPrunes)
+		return;
+
+	// remember what was pruned, so that rebuilding these tiles prunes them again
+	auto navMesh = m_meshTool->GetNavMesh();
+
+	for (PrunedTile& tile : m_prunedTiles)
+	{
+		uint64_t hash = navMesh->GetTileBuildHash(tile.x, tile.y, tile.layer);
+
+		NavMesh::PrunedTile pruned;
+		pruned.buildHash = hash;
+		pruned.polys = std::move(tile.polys);
+
+		if (const NavMesh::PrunedTile* existing = navMesh->GetPrunedTile(tile.x, tile.y, tile.layer, hash))
+			pruned.polys.insert(pruned.polys.end(), existing->polys.begin(), existing->polys.end());
+
+		std::sort(pruned.polys.begin(), pruned.polys.end());
+		pruned.polys.erase(std::unique(pruned.polys.begin(), pruned.polys.end()), pruned.polys.end());
+
+		navMesh->SetPrunedTile(tile.x, tile.y, tile.layer, std::move(pruned));
+	}
+
+	m_prunedTiles.clear();
+	m_flood.reset();
+
+	navMesh->OnNavMeshTilesChanged();
 }
 
-void NavMeshPruneTool::reset()
+void NavMeshPruneTool::handleUpdate(float /*dt*/)
 {
-	m_hitPosSet = false;
-	m_flags.reset();
+	if (!m_jobRunning && m_jobThread.joinable())
+		finishJob();
 }
 
 void NavMeshPruneTool::handleMenu()
 {
 	auto nav = m_meshTool->GetNavMesh()->GetNavMesh();
 	if (!nav) return;
-	if (!m_flags) return;
+
+	if (m_jobRunning)
+	{
+		int visited = m_flood->getVisited().getCount();
+		int total = std::max(1, m_flood->getVisited().getPolyCount());
+
+		char szProgress[256];
+		sprintf_s(szProgress, m_jobPrunes ? "Pruning..." : "%d of %d polys", visited, total);
+
+		ImGui::ProgressBar(m_jobPrunes ? 1.0f : (float)visited / total, ImVec2(-1, 0), szProgress);
+
+		if (ImGui::Button("Cancel"))
+			cancelJob();
+		return;
+	}
+
+	// the selection is only good for the tiles it was made on
+	if (m_flood && (m_flood->getNavMesh() != nav.get()
+		|| m_meshTool->GetNavMesh()->GetTileGeneration() != m_floodGeneration))
+	{
+		m_flood.reset();
+	}
+
+	if (m_meshTool->GetNavMesh()->HasPrunedTiles())
+	{
+		if (ImGui::Button("Forget Pruned Polys"))
+			m_meshTool->GetNavMesh()->ClearPrunedTiles();
+		ImGui::SameLine();
+		ImGuiEx::HelpMarker("Pruned polys are pruned again when their tiles are rebuilt. This stops that, "
+			"polys that are already pruned stay that way until their tile is rebuilt.");
+	}
+
+	drawSeeds();
+
+	if (!m_flood) return;
 
 	if (ImGui::Button("Clear Selection"))
 	{
-		m_flags->clearAllFlags();
+		m_flood->getVisited().clear();
 	}
 
+	// indices of polys that were removed don't line up with what's in the tile, so
+	// pruning by hand is left to meshes that only disable polys.
+	if (m_meshTool->GetNavMesh()->GetNavMeshConfig().pruneUnreachable)
+		return;
+
 	if (ImGui::Button("Prune Unselected"))
 	{
-		disableUnvisitedPolys(nav.get(), m_flags.get());
-		m_flags.reset();
+		startJob({}, true);
 	}
 }
 
-void NavMeshPruneTool::handleClick(const glm::vec3& /*s*/, const glm::vec3& p, bool /*shift*/)
+void NavMeshPruneTool::drawSeeds()
+{
+	auto navMesh = m_meshTool->GetNavMesh();
+	const std::vector<glm::vec3>& seeds = navMesh->GetPruneSeeds();
+
+	ImGui::Text("Prune Seeds");
+	ImGui::SameLine();
+	ImGuiEx::HelpMarker("Shift+click to place a seed. When Prune Unreachable is enabled in the build "
+		"settings, polys that can't be reached from any seed are removed from the mesh.");
+
+	if (seeds.empty())
+	{
+		ImGui::TextColored(ImColor(127, 127, 127), "No seeds placed");
+		return;
+	}
+
+	int removeIndex = -1;
+	for (size_t i = 0; i < seeds.size(); ++i)
+	{
+		const glm::vec3& seed = seeds[i];
+
+		ImGui::PushID((int)i);
+		ImGui::Text("%d: %.2f, %.2f, %.2f", (int)i + 1, seed.z, seed.x, seed.y);
+		ImGui::SameLine();
+		if (ImGui::SmallButton("Remove"))
+			removeIndex = (int)i;
+		ImGui::PopID();
+	}
+
+	if (removeIndex != -1)
+		navMesh->RemovePruneSeed(removeIndex);
+
+	if (ImGui::Button("Clear Seeds"))
+		navMesh->ClearPruneSeeds();
+}
+
+void NavMeshPruneTool::handleClick(const glm::vec3& /*s*/, const glm::vec3& p, bool shift)
 {
 	if (!m_meshTool) return;
-	InputGeom* geom = m_meshTool->getInputGeom();
-	if (!geom) return;
+
+	if (shift)
+	{
+		m_meshTool->GetNavMesh()->AddPruneSeed(p);
+		return;
+	}
+
+	if (m_jobRunning) return;
 	auto nav = m_meshTool->GetNavMesh()->GetNavMesh();
 	if (!nav) return;
 	auto query = m_meshTool->GetNavMesh()->GetNavMeshQuery();
@@ -224,10 +319,11 @@ void NavMeshPruneTool::handleClick(const glm::vec3& /*s*/, const glm::vec3& p, b
 	m_hitPos = p;
 	m_hitPosSet = true;
 
-	if (!m_flags)
+	uint32_t generation = m_meshTool->GetNavMesh()->GetTileGeneration();
+	if (!m_flood || m_flood->getNavMesh() != nav.get() || generation != m_floodGeneration)
 	{
-		m_flags = std::make_unique<NavmeshFlags>();
-		m_flags->init(nav.get());
+		m_flood = std::make_unique<NavMeshFlood>(nav.get());
+		m_floodGeneration = generation;
 	}
 
 	const float ext[3] = { 2,4,2 };
@@ -235,7 +331,8 @@ void NavMeshPruneTool::handleClick(const glm::vec3& /*s*/, const glm::vec3& p, b
 	dtPolyRef ref = 0;
 	query->findNearestPoly(glm::value_ptr(p), ext, &filter, &ref, 0);
 
-	floodNavmesh(nav.get(), m_flags.get(), ref, 1);
+	if (ref)
+		startJob({ ref }, false);
 }
 
 void NavMeshPruneTool::handleRender()
@@ -256,8 +353,21 @@ void NavMeshPruneTool::handleRender()
 		dd.end();
 	}
 
+	// seeds
+	{
+		const float s = m_meshTool->GetNavMesh()->GetNavMeshConfig().agentRadius;
+		const float h = m_meshTool->GetNavMesh()->GetNavMeshConfig().agentHeight;
+		const unsigned int col = duRGBA(64, 255, 64, 220);
+
+		for (const glm::vec3& seed : m_meshTool->GetNavMesh()->GetPruneSeeds())
+		{
+			duDebugDrawCylinderWire(&dd, seed[0] - s, seed[1] + 0.02f, seed[2] - s,
+				seed[0] + s, seed[1] + h, seed[2] + s, col, 2.0f);
+		}
+	}
+
 	const dtNavMesh* nav = m_meshTool->GetNavMesh()->GetNavMesh().get();
-	if (m_flags && nav)
+	if (m_flood && nav && m_flood->getNavMesh() == nav)
 	{
 		for (int i = 0; i < nav->getMaxTiles(); ++i)
 		{
@@ -267,7 +377,7 @@ void NavMeshPruneTool::handleRender()
 			for (int j = 0; j < tile->header->polyCount; ++j)
 			{
 				const dtPolyRef ref = base | (unsigned int)j;
-				if (m_flags->getFlags(ref))
+				if (m_flood->getVisited().test(ref))
 				{
 					duDebugDrawNavMeshPoly(&dd, *nav, ref, duRGBA(255, 255, 255, 128));
 				}
@@ -281,5 +391,5 @@ void NavMeshPruneTool::handleRenderOverlay(const glm::mat4& /*proj*/,
 {
 	// Tool help
 	ImGui::RenderTextRight(-330, -(view[3] - 40), ImVec4(255, 255, 255, 192),
-		"LMB: Click fill area.");
+		"LMB: Click fill area. Shift+LMB: Place prune seed.");
 }
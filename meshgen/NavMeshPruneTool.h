@@ -7,9 +7,14 @@
 #include "NavMeshTool.h"
 
 #include <glm/glm.hpp>
+
+#include <atomic>
 #include <memory>
+#include <thread>
+#include <vector>
 
-class NavmeshFlags;
+class NavMeshFlood;
+class TaskScheduler;
 
 // Prune navmesh to accessible locations from a point.
 class NavMeshPruneTool : public Tool
@@ -25,14 +30,37 @@ public:
 	virtual void handleClick(const glm::vec3& s, const glm::vec3& p, bool shift) override;
 	virtual void handleToggle() override {}
 	virtual void handleStep() override {}
-	virtual void handleUpdate(float dt) override {}
+	virtual void handleUpdate(float dt) override;
 	virtual void handleRender() override;
 	virtual void handleRenderOverlay(const glm::mat4& proj,
 		const glm::mat4& model, const glm::ivec4& view) override;
 
 private:
+	// flooding and pruning run on a worker thread, one job at a time
+	void startJob(std::vector<dtPolyRef> starts, bool prune);
+	void finishJob();
+	void cancelJob();
+	void pruneUnvisited(TaskScheduler& scheduler);
+
+	void drawSeeds();
+
 	NavMeshTool* m_meshTool = nullptr;
-	std::unique_ptr<NavmeshFlags> m_flags;
+	std::unique_ptr<NavMeshFlood> m_flood;
+	uint32_t m_floodGeneration = 0;     // tile generation the flood was made on
 	glm::vec3 m_hitPos;
 	bool m_hitPosSet = false;
+
+	std::shared_ptr<dtNavMesh> m_jobNavMesh;
+	std::thread m_jobThread;
+	std::atomic<bool> m_jobRunning = false;
+	std::atomic<bool> m_cancelJob = false;
+	bool m_jobPrunes = false;
+
+	// pruned polys found by the job, stored in the navmesh when it finishes
+	struct PrunedTile
+	{
+		int x, y, layer;
+		std::vector<uint16_t> polys;
+	};
+	std::vector<PrunedTile> m_prunedTiles;
 };
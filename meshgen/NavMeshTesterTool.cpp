@@ -399,6 +399,27 @@ void NavMeshTesterTool::handleMenu()
 	ImGui::PopID();
 	ImGui::Unindent();
 
+	// paths for an agent wider than the mesh was built for, by NAVMESH_CLEARANCE_LEVELS
+	int clearance = 0;
+	for (int i = 0; i < NAVMESH_CLEARANCE_LEVEL_COUNT; ++i)
+	{
+		if (excludeFlags & (+PolyFlags::Narrow1 << i))
+		{
+			clearance = i + 1;
+			break;
+		}
+	}
+
+	if (ImGui::Combo("Extra Clearance", &clearance, "None\0+1\0+2\0+4\0+8\0"))
+	{
+		excludeFlags &= ~+PolyFlags::NarrowMask;
+		if (clearance > 0)
+			excludeFlags |= +PolyFlags::Narrow1 << (clearance - 1);
+		changed = true;
+	}
+	if (ImGui::IsItemHovered())
+		ImGui::SetTooltip("Stay out of polys without this much more room than the agent radius");
+
 	ImGui::Separator();
 
 	if (changed)
@@ -407,6 +428,42 @@ void NavMeshTesterTool::handleMenu()
 		m_filter.setExcludeFlags(excludeFlags);
 		recalc();
 	}
+
+	auto navMesh = m_meshTool->GetNavMesh();
+	QueryHeatmap& heatmap = navMesh->GetQueryHeatmap();
+
+	bool recordHeatmap = heatmap.IsEnabled();
+	if (ImGui::Checkbox("Record Search Heatmap", &recordHeatmap))
+		heatmap.SetEnabled(recordHeatmap);
+	ImGui::Checkbox("Show Search Heatmap", &m_showHeatmap);
+
+	ImGui::Text("%d searches, %d polys", heatmap.GetQueryCount(), (int)heatmap.GetPolyCount());
+
+	if (ImGui::Button("Clear Heatmap"))
+	{
+		heatmap.Clear();
+		m_heatmapStatus.clear();
+	}
+
+	ImGui::SameLine();
+
+	if (ImGui::Button("Export Heatmap") && m_navMesh)
+	{
+		std::string filename = navMesh->GetNavMeshDirectory() + "\\" + navMesh->GetZoneName() + "_heatmap.csv";
+
+		if (heatmap.Export(filename, *m_navMesh))
+			m_heatmapStatus = "Saved " + filename;
+		else
+			m_heatmapStatus = "Failed to save " + filename;
+	}
+
+	if (!m_heatmapStatus.empty())
+		ImGui::TextWrapped("%s", m_heatmapStatus.c_str());
+}
+
+void NavMeshTesterTool::recordHeatmap()
+{
+	m_meshTool->GetNavMesh()->GetQueryHeatmap().Record(*m_navQuery);
 }
 
 void NavMeshTesterTool::handleClick(const glm::vec3& s, const glm::vec3& p, bool shift)
@@ -445,6 +502,7 @@ void NavMeshTesterTool::handleToggle()
 	{
 		m_navQuery->findPath(m_startRef, m_endRef, glm::value_ptr(m_spos), glm::value_ptr(m_epos),
 			&m_filter, m_polys, &m_npolys, MAX_POLYS);
+		recordHeatmap();
 		m_nsmoothPath = 0;
 
 		m_pathIterPolyCount = m_npolys;
@@ -595,6 +653,7 @@ void NavMeshTesterTool::handleUpdate(float /*dt*/)
 		if (dtStatusSucceed(m_pathFindStatus))
 		{
 			m_navQuery->finalizeSlicedFindPath(m_polys, &m_npolys, MAX_POLYS);
+			recordHeatmap();
 			m_nstraightPath = 0;
 
 			if (m_npolys)
@@ -667,6 +726,7 @@ void NavMeshTesterTool::recalc()
 
 			m_navQuery->findPath(m_startRef, m_endRef, glm::value_ptr(m_spos), glm::value_ptr(m_epos),
 				&m_filter, m_polys, &m_npolys, MAX_POLYS);
+			recordHeatmap();
 
 			m_nsmoothPath = 0;
 
@@ -812,6 +872,7 @@ void NavMeshTesterTool::recalc()
 #endif
 			m_navQuery->findPath(m_startRef, m_endRef, glm::value_ptr(m_spos),
 				glm::value_ptr(m_epos), &m_filter, m_polys, &m_npolys, MAX_POLYS);
+			recordHeatmap();
 			m_nstraightPath = 0;
 			if (m_npolys)
 			{
@@ -1022,6 +1083,11 @@ void NavMeshTesterTool::handleRender()
 		return;
 	}
 
+	if (m_showHeatmap)
+	{
+		m_meshTool->GetNavMesh()->GetQueryHeatmap().Draw(&dd, *m_navMesh);
+	}
+
 	if (m_toolMode == ToolMode::PATHFIND_FOLLOW)
 	{
 		duDebugDrawNavMeshPoly(&dd, *m_navMesh, m_startRef, startCol);
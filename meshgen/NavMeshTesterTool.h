@@ -10,6 +10,7 @@
 #include <DetourNavMeshQuery.h>
 
 #include <glm/glm.hpp>
+#include <string>
 #include <vector>
 
 class NavMeshTesterTool : public Tool
@@ -32,6 +33,7 @@ public:
 
 private:
 	void recalc();
+	void recordHeatmap();
 	void drawAgent(const glm::vec3& pos, float r, float h, float c, uint32_t col);
 
 private:
@@ -100,4 +102,7 @@ private:
 	glm::vec3 m_targetPos;
 
 	std::vector<glm::vec3> m_steerPoints;
+
+	bool m_showHeatmap = false;
+	std::string m_heatmapStatus;
 };
@@ -3,6 +3,7 @@
 //
 
 #include "NavMeshTileTool.h"
+#include "common/NavMesh.h"
 
 #include <DebugDraw.h>
 
@@ -13,6 +14,56 @@
 
 #include <imgui/fonts/IconsMaterialDesign.h>
 
+#include <algorithm>
+
+// the most tiles counted for the totals in a frame, the rest wait for the next one
+static const int TOTALS_TILES_PER_FRAME = 256;
+
+// the layers of a tile, the same as the navmesh keeps for removing them
+static const int MAX_TILE_LAYERS = 32;
+
+// depth of the bv tree of a tile. Nodes are stored depth first, internal nodes have
+// the negated size of their subtree as their index.
+static int GetBVTreeDepth(const dtMeshTile* tile)
+{
+	if (!tile->bvTree)
+		return 0;
+
+	const int nodeCount = tile->header->bvNodeCount;
+	int subtreeEnds[64];
+	int depth = 0, maxDepth = 0;
+
+	for (int i = 0; i < nodeCount; ++i)
+	{
+		while (depth > 0 && subtreeEnds[depth - 1] <= i)
+			--depth;
+
+		maxDepth = std::max(maxDepth, depth + 1);
+
+		const dtBVNode& node = tile->bvTree[i];
+		if (node.i < 0 && depth < 64)
+			subtreeEnds[depth++] = i - node.i;
+	}
+
+	return maxDepth;
+}
+
+void NavMeshTileTool::TileStats::Add(const TileStats& other, int sign)
+{
+	tiles += sign * other.tiles;
+	layers += sign * other.layers;
+	polys += sign * other.polys;
+	verts += sign * other.verts;
+	detailMeshes += sign * other.detailMeshes;
+	detailVerts += sign * other.detailVerts;
+	detailTris += sign * other.detailTris;
+	offMeshCons += sign * other.offMeshCons;
+	bvNodes += sign * other.bvNodes;
+	bytes += sign * static_cast<ptrdiff_t>(other.bytes);
+}
+
+//----------------------------------------------------------------------------
+
 void NavMeshTileTool::init(NavMeshTool* meshTool)
 {
 	m_meshTool = meshTool;
@@ -22,6 +73,154 @@ void NavMeshTileTool::init(NavMeshTool* meshTool)
 void NavMeshTileTool::reset()
 {
 	m_hitPosSet = false;
+
+	m_statsMesh = nullptr;
+	m_tileStats.clear();
+	m_totals = TileStats();
+	m_totalsCurrent = false;
+}
+
+void NavMeshTileTool::checkNavMesh()
+{
+	std::shared_ptr<dtNavMesh> navMesh = m_meshTool->GetNavMesh()->GetNavMesh();
+
+	// refs of a new mesh can be the same as the old one's
+	if (navMesh.get() != m_statsMesh)
+	{
+		m_statsMesh = navMesh.get();
+		m_tileStats.clear();
+		m_totals = TileStats();
+		m_totalsCurrent = false;
+	}
+}
+
+const NavMeshTileTool::TileStats& NavMeshTileTool::getTileStats(int tx, int ty)
+{
+	checkNavMesh();
+
+	std::shared_ptr<NavMesh> navMesh = m_meshTool->GetNavMesh();
+	const uint32_t tileGeneration = navMesh->GetTileGeneration();
+
+	CachedTileStats& cached = m_tileStats[TileKey(tx, ty)];
+	if (cached.tileGeneration == tileGeneration && !cached.refs.empty())
+		return cached.stats;
+
+	cached.tileGeneration = tileGeneration;
+
+	std::shared_ptr<dtNavMesh> mesh = navMesh->GetNavMesh();
+	if (!mesh)
+		return cached.stats;
+
+	auto tilesLock = navMesh->LockTiles();
+
+	const dtMeshTile* tiles[MAX_TILE_LAYERS];
+	const int tileCount = static_cast<const dtNavMesh&>(*mesh).getTilesAt(tx, ty, tiles, MAX_TILE_LAYERS);
+
+	std::vector<dtTileRef> refs(tileCount);
+	for (int i = 0; i < tileCount; ++i)
+		refs[i] = mesh->getTileRef(tiles[i]);
+
+	// rebuilt tiles get new refs, anything else is still what was counted
+	if (refs == cached.refs)
+		return cached.stats;
+
+	TileStats stats;
+	for (int i = 0; i < tileCount; ++i)
+	{
+		const dtMeshTile* tile = tiles[i];
+		const dtMeshHeader* header = tile->header;
+
+		++stats.layers;
+		stats.polys += header->polyCount;
+		stats.verts += header->vertCount;
+		stats.detailMeshes += header->detailMeshCount;
+		stats.detailVerts += header->detailVertCount;
+		stats.detailTris += header->detailTriCount;
+		stats.offMeshCons += header->offMeshConCount;
+		stats.bvNodes += header->bvNodeCount;
+		stats.bvDepth = std::max(stats.bvDepth, GetBVTreeDepth(tile));
+		stats.bytes += tile->dataSize;
+	}
+	stats.tiles = stats.layers > 0 ? 1 : 0;
+
+	// the totals are always the sum of what is cached
+	m_totals.Add(cached.stats, -1);
+	m_totals.Add(stats, 1);
+
+	cached.refs = std::move(refs);
+	cached.stats = stats;
+	return cached.stats;
+}
+
+void NavMeshTileTool::updateTotals()
+{
+	checkNavMesh();
+
+	std::shared_ptr<NavMesh> navMesh = m_meshTool->GetNavMesh();
+	const uint32_t tileGeneration = navMesh->GetTileGeneration();
+	if (m_totalsCurrent && m_totalsGeneration == tileGeneration)
+		return;
+
+	std::shared_ptr<dtNavMesh> mesh = navMesh->GetNavMesh();
+	if (!mesh)
+		return;
+
+	// where there are tiles now, without counting anything
+	std::vector<TileKey> present;
+	{
+		auto tilesLock = navMesh->LockTiles();
+		const dtNavMesh& constMesh = *mesh;
+
+		for (int i = 0; i < constMesh.getMaxTiles(); ++i)
+		{
+			const dtMeshTile* tile = constMesh.getTile(i);
+			if (tile && tile->header)
+				present.emplace_back(tile->header->x, tile->header->y);
+		}
+	}
+
+	std::sort(present.begin(), present.end());
+	present.erase(std::unique(present.begin(), present.end()), present.end());
+
+	// tiles that were removed
+	for (auto iter = m_tileStats.begin(); iter != m_tileStats.end();)
+	{
+		if (!std::binary_search(present.begin(), present.end(), iter->first))
+		{
+			m_totals.Add(iter->second.stats, -1);
+			iter = m_tileStats.erase(iter);
+		}
+		else
+		{
+			++iter;
+		}
+	}
+
+	// only tiles that were rebuilt are counted again, and only so many a frame
+	int counted = 0;
+	for (const TileKey& key : present)
+	{
+		auto iter = m_tileStats.find(key);
+		if (iter != m_tileStats.end() && iter->second.tileGeneration == tileGeneration)
+			continue;
+
+		if (counted++ == TOTALS_TILES_PER_FRAME)
+		{
+			m_totalsCurrent = false;
+			return;
+		}
+
+		getTileStats(key.first, key.second);
+	}
+
+	m_totalsGeneration = tileGeneration;
+	m_totalsCurrent = true;
+}
+
+void NavMeshTileTool::handleUpdate(float /*dt*/)
+{
+	if (m_showTotals && m_meshTool)
+		updateTotals();
 }
 
 void NavMeshTileTool::handleMenu()
@@ -40,9 +239,75 @@ void NavMeshTileTool::handleMenu()
 			m_meshTool->RemoveAllTiles();
 	}
 
+	// rebuild the tiles around the last clicked point, keeping the rest of the mesh
+	if (m_hitPosSet)
+	{
+		ImGui::SliderFloat("Region Radius", &m_regionRadius, 10.0f, 1000.0f, "%.0f");
+
+		if (ImGui::Button(ICON_MD_BUILD " Build Region"))
+		{
+			if (m_meshTool)
+				m_meshTool->handleBuild(true, NavMeshTool::GetRegionsAlongPath({ m_hitPos }, m_regionRadius));
+		}
+	}
+
 	float totalBuildTime = m_meshTool->getTotalBuildTimeMS();
 	if (totalBuildTime > 0)
 		ImGui::Text("Build Time: %.1fms", totalBuildTime);
+
+	int polysBeforeMerge = m_meshTool->getPolysBeforeMerge();
+	if (polysBeforeMerge > 0)
+	{
+		int polysAfterMerge = m_meshTool->getPolysAfterMerge();
+		ImGui::Text("Merged Polys: %d -> %d (%.0f%% fewer)", polysBeforeMerge, polysAfterMerge,
+			100.0f * (polysBeforeMerge - polysAfterMerge) / polysBeforeMerge);
+	}
+
+	// the tile that was clicked last, counted when it is selected or rebuilt
+	if (m_hitPosSet)
+	{
+		int tx = 0, ty = 0;
+		m_meshTool->GetTilePos(m_hitPos, tx, ty);
+
+		const TileStats& stats = getTileStats(tx, ty);
+
+		ImGui::Separator();
+		ImGui::Text("Tile (%d,%d)", tx, ty);
+
+		if (stats.layers == 0)
+		{
+			ImGui::TextDisabled("No tile");
+		}
+		else
+		{
+			ImGui::Text("Layers: %d  Bytes: %.1fKB", stats.layers, stats.bytes / 1024.0f);
+			ImGui::Text("Polys: %d  Verts: %d  Off-mesh: %d", stats.polys, stats.verts, stats.offMeshCons);
+			ImGui::Text("Detail: %d meshes, %d verts, %d tris", stats.detailMeshes, stats.detailVerts, stats.detailTris);
+			ImGui::Text("BV Tree: %d nodes, depth %d", stats.bvNodes, stats.bvDepth);
+
+			TileBuildTimings timings;
+			if (m_meshTool->getBuildProfiler().GetTile(tx, ty, timings))
+			{
+				ImGui::Text("Build Time: %.2fms", std::chrono::duration<float, std::milli>(
+					timings.GetTotalTime()).count());
+			}
+		}
+	}
+
+	ImGui::Separator();
+	ImGui::Checkbox("Mesh Totals", &m_showTotals);
+
+	if (m_showTotals)
+	{
+		ImGui::Text("Tiles: %d  Layers: %d  Bytes: %.1fMB%s", m_totals.tiles, m_totals.layers,
+			m_totals.bytes / (1024.0f * 1024.0f), m_totalsCurrent ? "" : " (counting)");
+		ImGui::Text("Polys: %d  Verts: %d  Off-mesh: %d", m_totals.polys, m_totals.verts, m_totals.offMeshCons);
+		ImGui::Text("Detail: %d meshes, %d verts, %d tris", m_totals.detailMeshes, m_totals.detailVerts,
+			m_totals.detailTris);
+		ImGui::Text("BV Nodes: %d", m_totals.bvNodes);
+	}
+
+	m_meshTool->handleBuildProfile();
 }
 
 void NavMeshTileTool::handleClick(const glm::vec3& s, const glm::vec3& p, bool shift)
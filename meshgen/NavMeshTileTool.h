@@ -6,6 +6,12 @@
 
 #include "NavMeshTool.h"
 
+#include <DetourNavMesh.h>
+
+#include <map>
+#include <utility>
+#include <vector>
+
 class NavMeshTileTool : public Tool
 {
 public:
@@ -19,13 +25,60 @@ public:
 	virtual void handleClick(const glm::vec3& s, const glm::vec3& p, bool shift) override;
 	virtual void handleToggle() override {}
 	virtual void handleStep() override {}
-	virtual void handleUpdate(float /*dt*/) override {}
+	virtual void handleUpdate(float dt) override;
 	virtual void handleRender() override;
 	virtual void handleRenderOverlay(const glm::mat4& proj,
 		const glm::mat4& model, const glm::ivec4& view) override;
 
 private:
+	// counts of every layer of a tile, or of every tile
+	struct TileStats
+	{
+		int tiles = 0;
+		int layers = 0;
+		int polys = 0;
+		int verts = 0;
+		int detailMeshes = 0;
+		int detailVerts = 0;
+		int detailTris = 0;
+		int offMeshCons = 0;
+		int bvNodes = 0;
+		int bvDepth = 0;       // deepest of the layers, left out of the totals
+		size_t bytes = 0;
+
+		void Add(const TileStats& other, int sign);
+	};
+
+	struct CachedTileStats
+	{
+		uint32_t tileGeneration = 0;     // of the navmesh when the refs were looked at
+		std::vector<dtTileRef> refs;     // of the layers the stats were counted from
+		TileStats stats;
+	};
+
+	using TileKey = std::pair<int, int>;
+
+	// stats of the tile at tx, ty, only counted again when its layers have been
+	// replaced since the last time
+	const TileStats& getTileStats(int tx, int ty);
+
+	// bring the totals up to date with the tiles that changed, at most a few
+	// hundred tiles a frame
+	void updateTotals();
+
+	// forget everything if the navmesh was replaced
+	void checkNavMesh();
+
 	NavMeshTool* m_meshTool = nullptr;
 	glm::vec3 m_hitPos;
 	bool m_hitPosSet = false;
+	float m_regionRadius = 200.0f;
+
+	const dtNavMesh* m_statsMesh = nullptr;
+	std::map<TileKey, CachedTileStats> m_tileStats;
+
+	bool m_showTotals = false;
+	TileStats m_totals;
+	uint32_t m_totalsGeneration = 0;
+	bool m_totalsCurrent = false;
 };
@@ -4,11 +4,20 @@
 #include "Application.h"
 #include "ConvexVolumeTool.h"
 #include "InputGeom.h"
+#include "NavMeshFlood.h"
 #include "NavMeshPruneTool.h"
+#include "NavMeshValidator.h"
 #include "NavMeshTesterTool.h"
 #include "NavMeshTileTool.h"
 #include "OffMeshConnectionTool.h"
+#include "PolyMeshMerge.h"
+#include "RecastArena.h"
+#include "TaskScheduler.h"
+#include "TileBVTree.h"
+#include "TriangleRasterizer.h"
 #include "common/NavMeshData.h"
+#include "common/NavMeshTileCache.h"
+#include "common/Profiler.h"
 #include "common/Utilities.h"
 #include "common/proto/NavMeshFile.pb.h"
 
@@ -18,6 +27,8 @@
 #include <DetourDebugDraw.h>
 #include <DetourNavMesh.h>
 #include <DetourNavMeshBuilder.h>
+#include <DetourNavMeshQuery.h>
+#include <DetourTileCacheBuilder.h>
 #include <imgui/fonts/IconsMaterialDesign.h>
 
 #include <SDL.h>
@@ -26,10 +37,571 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-#include <ppl.h>
-#include <agents.h>
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <climits>
+#include <future>
 #include <mutex>
 #include <fstream>
+#include <thread>
+
+//----------------------------------------------------------------------------
+
+// a tile rebuild that has the workers to itself splits its rasterization and
+// detail mesh into batches of at least this many triangles and polygons
+static const int PARALLEL_RASTERIZE_MIN_TRIS = 8192;
+static const int PARALLEL_DETAIL_MIN_POLYS = 128;
+
+// the most batches a tile's triangles are split into. The split only depends on
+// the triangle count, so a tile comes out the same on any number of threads.
+static const int PARALLEL_RASTERIZE_MAX_BATCHES = 8;
+
+// scratch memory of a tile per cell of its heightfield, until a tile has been
+// built to measure it
+static const size_t TILE_MEMORY_PER_CELL = 1024;
+
+// tiles with issues listed in the log by validation, the rest are only counted
+static const size_t VALIDATE_MAX_LOGGED_TILES = 20;
+
+// the longest the main loop holds the render mutex adding the tiles of a
+// background build in one frame. At least one tile goes in every frame.
+static const double PUBLISH_FRAME_BUDGET_MS = 4.0;
+
+// the build settings with the agent size of a profile
+static NavMeshConfig GetProfileConfig(const NavMeshConfig& config, const AgentProfile& profile)
+{
+	NavMeshConfig profileConfig = config;
+	profileConfig.agentHeight = profile.agentHeight;
+	profileConfig.agentRadius = profile.agentRadius;
+	profileConfig.agentMaxClimb = profile.agentMaxClimb;
+	profileConfig.agentProfiles.clear();
+
+	return profileConfig;
+}
+
+// tiles are built with the border of the widest agent, so that every profile
+// can be built from the same heightfield.
+static float GetLargestAgentRadius(const NavMeshConfig& config)
+{
+	float radius = config.agentRadius;
+	for (const AgentProfile& profile : config.agentProfiles)
+		radius = std::max(radius, profile.agentRadius);
+
+	return radius;
+}
+
+// the recast settings of a build, everything but the bounds of the tile
+static rcConfig GetRecastConfig(const NavMeshConfig& config, bool coarseDetail)
+{
+	rcConfig cfg;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.cs = config.cellSize;
+	cfg.ch = config.cellHeight;
+	cfg.walkableSlopeAngle = config.agentMaxSlope;
+	cfg.walkableHeight = (int)ceilf(config.agentHeight / cfg.ch);
+	cfg.walkableClimb = (int)floorf(config.agentMaxClimb / cfg.ch);
+	cfg.walkableRadius = (int)ceilf(config.agentRadius / cfg.cs);
+	cfg.maxEdgeLen = (int)(config.edgeMaxLen / config.cellSize);
+	cfg.maxSimplificationError = config.edgeMaxError;
+	cfg.minRegionArea = (int)rcSqr(config.regionMinSize);		// Note: area = size*size
+	cfg.mergeRegionArea = (int)rcSqr(config.regionMergeSize);	// Note: area = size*size
+	cfg.maxVertsPerPoly = (int)config.vertsPerPoly;
+	cfg.tileSize = (int)config.tileSize;
+	cfg.borderSize = (int)ceilf(GetLargestAgentRadius(config) / cfg.cs) + 3; // Reserve enough padding.
+	cfg.width = cfg.tileSize + cfg.borderSize * 2;
+	cfg.height = cfg.tileSize + cfg.borderSize * 2;
+	cfg.detailSampleDist = config.detailSampleDist < 0.9f ? 0 : config.cellSize * config.detailSampleDist;
+	cfg.detailSampleMaxError = config.cellHeight * config.detailSampleMaxError;
+
+	// without samples the detail mesh is just the polys, triangulated
+	if (coarseDetail)
+		cfg.detailSampleDist = 0;
+
+	return cfg;
+}
+
+static bool AgentMeshesMatch(const std::vector<NavMesh::AgentNavMesh>& meshes,
+	const std::vector<AgentProfile>& profiles)
+{
+	if (meshes.size() != profiles.size())
+		return false;
+
+	for (size_t i = 0; i < profiles.size(); ++i)
+	{
+		const AgentProfile& profile = meshes[i].profile;
+		if (!meshes[i].navMesh
+			|| profile.name != profiles[i].name
+			|| profile.agentHeight != profiles[i].agentHeight
+			|| profile.agentRadius != profiles[i].agentRadius
+			|| profile.agentMaxClimb != profiles[i].agentMaxClimb)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static inline uint64_t TileRebuildKey(int x, int y)
+{
+	return ((uint64_t)(uint32_t)x << 32) | (uint32_t)y;
+}
+
+// remove every layer of the tile at tx, ty. If navMesh is given, the build
+// hashes of the layers are cleared too.
+static void RemoveTilesAt(dtNavMesh& mesh, int tx, int ty, NavMesh* navMesh)
+{
+	const dtMeshTile* tiles[32];
+	const int tileCount = mesh.getTilesAt(tx, ty, tiles, 32);
+
+	for (int i = 0; i < tileCount; ++i)
+	{
+		if (navMesh)
+			navMesh->SetTileBuildHash(tx, ty, tiles[i]->header->layer, 0);
+
+		mesh.removeTile(mesh.getTileRef(tiles[i]), 0, 0);
+	}
+}
+
+// the areas of every span in the heightfield, in the order they're walked
+static void SaveSpanAreas(const rcHeightfield& solid, std::vector<uint8_t>& areas)
+{
+	areas.clear();
+
+	for (int i = 0; i < solid.width * solid.height; ++i)
+	{
+		for (const rcSpan* span = solid.spans[i]; span; span = span->next)
+			areas.push_back(static_cast<uint8_t>(span->area));
+	}
+}
+
+static void RestoreSpanAreas(rcHeightfield& solid, const std::vector<uint8_t>& areas)
+{
+	size_t index = 0;
+
+	for (int i = 0; i < solid.width * solid.height; ++i)
+	{
+		for (rcSpan* span = solid.spans[i]; span; span = span->next)
+			span->area = areas[index++];
+	}
+}
+
+// Rasterize the triangles on up to threadCount threads, each into a heightfield
+// of its own, and add their spans to solid. Spans merge the same way they do
+// when they're rasterized into one heightfield, but which of two overlapping
+// spans keeps its area depends on the order they're added. Large tiles are
+// always split into the same batches and merged in batch order, and batches
+// that don't have a thread are rasterized on this one.
+//
+// The batches run off the scheduler, a rebuild already holds one of its workers.
+// They have no arena, so what they allocate comes from the heap and can be freed
+// from this thread.
+static bool RasterizeTriangles(rcContext* ctx, const float* verts, int nverts, const int* tris,
+	const unsigned char* areas, int ntris, rcHeightfield& solid, int flagMergeThr, int threadCount)
+{
+	const int batchCount = std::min(PARALLEL_RASTERIZE_MAX_BATCHES, ntris / PARALLEL_RASTERIZE_MIN_TRIS);
+	if (batchCount <= 1)
+		return rcRasterizeTriangles(ctx, verts, nverts, tris, areas, ntris, solid, flagMergeThr);
+
+	std::vector<deleting_unique_ptr<rcHeightfield>> batches;
+	std::vector<std::future<bool>> results;
+
+	for (int i = 0; i < batchCount; ++i)
+	{
+		const int first = ntris * i / batchCount;
+		const int last = ntris * (i + 1) / batchCount;
+
+		batches.emplace_back(rcAllocHeightfield(), [](rcHeightfield* hf) { rcFreeHeightField(hf); });
+		rcHeightfield* hf = batches.back().get();
+
+		const auto policy = i < threadCount ? std::launch::async : std::launch::deferred;
+		results.push_back(std::async(policy, [=, &solid]()
+		{
+			return rcCreateHeightfield(ctx, *hf, solid.width, solid.height, solid.bmin, solid.bmax,
+				solid.cs, solid.ch)
+				&& rcRasterizeTriangles(ctx, verts, nverts, tris + first * 3, areas + first, last - first,
+					*hf, flagMergeThr);
+		}));
+	}
+
+	bool success = true;
+	for (std::future<bool>& result : results)
+	{
+		if (!result.get())
+			success = false;
+	}
+
+	if (!success)
+		return false;
+
+	for (const deleting_unique_ptr<rcHeightfield>& hf : batches)
+	{
+		for (int y = 0; y < hf->height; ++y)
+		{
+			for (int x = 0; x < hf->width; ++x)
+			{
+				for (const rcSpan* s = hf->spans[x + y * hf->width]; s; s = s->next)
+				{
+					if (!rcAddSpan(ctx, solid, x, y, (unsigned short)s->smin, (unsigned short)s->smax,
+						(unsigned char)s->area, flagMergeThr))
+					{
+						return false;
+					}
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+// Build the detail mesh on up to threadCount threads, each for a range of the
+// polygons, and merge them in polygon order. The detail of a polygon only
+// depends on its own vertices and the heightfield under it.
+static bool BuildPolyMeshDetail(rcContext* ctx, const rcPolyMesh& pmesh, const rcCompactHeightfield& chf,
+	float sampleDist, float sampleMaxError, rcPolyMeshDetail& dmesh, int threadCount)
+{
+	const int batchCount = std::min(threadCount, pmesh.npolys / PARALLEL_DETAIL_MIN_POLYS);
+	if (batchCount <= 1)
+		return rcBuildPolyMeshDetail(ctx, pmesh, chf, sampleDist, sampleMaxError, dmesh);
+
+	// the ranges share the arrays of the whole mesh
+	std::vector<rcPolyMesh> ranges(batchCount, pmesh);
+	std::vector<deleting_unique_ptr<rcPolyMeshDetail>> batches;
+	std::vector<std::future<bool>> results;
+
+	for (int i = 0; i < batchCount; ++i)
+	{
+		const int first = pmesh.npolys * i / batchCount;
+		const int last = pmesh.npolys * (i + 1) / batchCount;
+
+		rcPolyMesh& range = ranges[i];
+		range.polys = pmesh.polys + first * pmesh.nvp * 2;
+		range.regs = pmesh.regs + first;
+		range.flags = pmesh.flags + first;
+		range.areas = pmesh.areas + first;
+		range.npolys = range.maxpolys = last - first;
+
+		batches.emplace_back(rcAllocPolyMeshDetail(), [](rcPolyMeshDetail* pm) { rcFreePolyMeshDetail(pm); });
+		rcPolyMeshDetail* batch = batches.back().get();
+
+		results.push_back(std::async(std::launch::async, [=, &range, &chf]()
+		{
+			return rcBuildPolyMeshDetail(ctx, range, chf, sampleDist, sampleMaxError, *batch);
+		}));
+	}
+
+	bool success = true;
+	for (std::future<bool>& result : results)
+	{
+		if (!result.get())
+			success = false;
+	}
+
+	if (!success)
+		return false;
+
+	std::vector<rcPolyMeshDetail*> meshes;
+	for (const deleting_unique_ptr<rcPolyMeshDetail>& batch : batches)
+		meshes.push_back(batch.get());
+
+	return rcMergePolyMeshDetails(ctx, meshes.data(), (int)meshes.size(), dmesh);
+}
+
+// Partition the heightfield so that we can use simple algorithm later to triangulate the walkable areas.
+// There are 3 martitioning methods, each with some pros and cons:
+// 1) Watershed partitioning
+//   - the classic Recast partitioning
+//   - creates the nicest tessellation
+//   - usually slowest
+//   - partitions the heightfield into nice regions without holes or overlaps
+//   - the are some corner cases where this method creates produces holes and overlaps
+//      - holes may appear when a small obstacles is close to large open area (triangulation can handle this)
+//      - overlaps may occur if you have narrow spiral corridors (i.e stairs), this make triangulation to fail
+//   * generally the best choice if you precompute the nacmesh, use this if you have large open areas
+// 2) Monotone partioning
+//   - fastest
+//   - partitions the heightfield into regions without holes and overlaps (guaranteed)
+//   - creates long thin polygons, which sometimes causes paths with detours
+//   * use this if you want fast navmesh generation
+// 3) Layer partitoining
+//   - quite fast
+//   - partitions the heighfield into non-overlapping regions
+//   - relies on the triangulation code to cope with holes (thus slower than monotone partitioning)
+//   - produces better triangles than monotone partitioning
+//   - does not have the corner cases of watershed partitioning
+//   - can be slow and create a bit ugly tessellation (still better than monotone)
+//     if you have large open areas with small obstacles (not a problem if you use tiles)
+//   * good choice to use for tiled navmesh with medium and small sized tiles
+template <PartitionType Type>
+static bool BuildRegions(rcContext* ctx, rcCompactHeightfield& chf, const rcConfig& cfg);
+
+template <>
+bool BuildRegions<PartitionType::WATERSHED>(rcContext* ctx, rcCompactHeightfield& chf, const rcConfig& cfg)
+{
+	// Prepare for region partitioning, by calculating distance field along the walkable surface.
+	if (!rcBuildDistanceField(ctx, chf))
+	{
+		ctx->log(RC_LOG_ERROR, "buildNavigation: Could not build distance field.");
+		return false;
+	}
+
+	// Partition the walkable surface into simple regions without holes.
+	if (!rcBuildRegions(ctx, chf, cfg.borderSize, cfg.minRegionArea, cfg.mergeRegionArea))
+	{
+		ctx->log(RC_LOG_ERROR, "buildNavigation: Could not build watershed regions.");
+		return false;
+	}
+
+	return true;
+}
+
+template <>
+bool BuildRegions<PartitionType::MONOTONE>(rcContext* ctx, rcCompactHeightfield& chf, const rcConfig& cfg)
+{
+	// Partition the walkable surface into simple regions without holes.
+	// Monotone partitioning does not need distancefield.
+	if (!rcBuildRegionsMonotone(ctx, chf, cfg.borderSize, cfg.minRegionArea, cfg.mergeRegionArea))
+	{
+		ctx->log(RC_LOG_ERROR, "buildNavigation: Could not build monotone regions.");
+		return false;
+	}
+
+	return true;
+}
+
+template <>
+bool BuildRegions<PartitionType::LAYERS>(rcContext* ctx, rcCompactHeightfield& chf, const rcConfig& cfg)
+{
+	// Partition the walkable surface into simple regions without holes.
+	if (!rcBuildLayerRegions(ctx, chf, cfg.borderSize, cfg.minRegionArea))
+	{
+		ctx->log(RC_LOG_ERROR, "buildNavigation: Could not build layer regions.");
+		return false;
+	}
+
+	return true;
+}
+
+using BuildRegionsFn = bool (*)(rcContext*, rcCompactHeightfield&, const rcConfig&);
+
+// by PartitionType
+static const BuildRegionsFn BUILD_REGIONS[] =
+{
+	&BuildRegions<PartitionType::WATERSHED>,
+	&BuildRegions<PartitionType::MONOTONE>,
+	&BuildRegions<PartitionType::LAYERS>,
+};
+
+static BuildRegionsFn GetBuildRegions(PartitionType type)
+{
+	const size_t index = static_cast<size_t>(type);
+	return index < sizeof(BUILD_REGIONS) / sizeof(BUILD_REGIONS[0]) ? BUILD_REGIONS[index]
+		: BUILD_REGIONS[static_cast<size_t>(PartitionType::LAYERS)];
+}
+
+// distance from each span to the nearest one that can't be walked on, in half
+// cells like rcBuildDistanceField. Unlike that one, changes of area and the edges
+// of the heightfield aren't walls, so that painted areas and tile borders don't
+// make polys look narrow. The heightfield has been eroded by the agent radius, so
+// this is the room past it.
+static void BuildWallDistances(const rcCompactHeightfield& chf, std::vector<uint16_t>& dist)
+{
+	const int w = chf.width;
+	const int h = chf.height;
+	dist.assign(chf.spanCount, 0xffff);
+
+	for (int y = 0; y < h; ++y)
+	{
+		for (int x = 0; x < w; ++x)
+		{
+			const rcCompactCell& c = chf.cells[x + y * w];
+			for (int i = (int)c.index, ni = (int)(c.index + c.count); i < ni; ++i)
+			{
+				if (chf.areas[i] == RC_NULL_AREA)
+				{
+					dist[i] = 0;
+					continue;
+				}
+
+				const rcCompactSpan& s = chf.spans[i];
+				for (int dir = 0; dir < 4; ++dir)
+				{
+					const int ax = x + rcGetDirOffsetX(dir);
+					const int ay = y + rcGetDirOffsetY(dir);
+					if (ax < 0 || ay < 0 || ax >= w || ay >= h)
+						continue;
+
+					if (rcGetCon(s, dir) == RC_NOT_CONNECTED
+						|| chf.areas[(int)chf.cells[ax + ay * w].index + rcGetCon(s, dir)] == RC_NULL_AREA)
+					{
+						dist[i] = 0;
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	// straight steps cost 2 and diagonal ones 3
+	auto relax = [&](int i, int x, int y, int dir, int diagDir)
+	{
+		const rcCompactSpan& s = chf.spans[i];
+		if (rcGetCon(s, dir) == RC_NOT_CONNECTED)
+			return;
+
+		const int ax = x + rcGetDirOffsetX(dir);
+		const int ay = y + rcGetDirOffsetY(dir);
+		const int ai = (int)chf.cells[ax + ay * w].index + rcGetCon(s, dir);
+		if (dist[ai] + 2 < dist[i])
+			dist[i] = static_cast<uint16_t>(dist[ai] + 2);
+
+		const rcCompactSpan& as = chf.spans[ai];
+		if (rcGetCon(as, diagDir) == RC_NOT_CONNECTED)
+			return;
+
+		const int bx = ax + rcGetDirOffsetX(diagDir);
+		const int by = ay + rcGetDirOffsetY(diagDir);
+		const int bi = (int)chf.cells[bx + by * w].index + rcGetCon(as, diagDir);
+		if (dist[bi] + 3 < dist[i])
+			dist[i] = static_cast<uint16_t>(dist[bi] + 3);
+	};
+
+	for (int y = 0; y < h; ++y)
+	{
+		for (int x = 0; x < w; ++x)
+		{
+			const rcCompactCell& c = chf.cells[x + y * w];
+			for (int i = (int)c.index, ni = (int)(c.index + c.count); i < ni; ++i)
+			{
+				relax(i, x, y, 0, 3);
+				relax(i, x, y, 3, 2);
+			}
+		}
+	}
+
+	for (int y = h - 1; y >= 0; --y)
+	{
+		for (int x = w - 1; x >= 0; --x)
+		{
+			const rcCompactCell& c = chf.cells[x + y * w];
+			for (int i = (int)c.index, ni = (int)(c.index + c.count); i < ni; ++i)
+			{
+				relax(i, x, y, 2, 1);
+				relax(i, x, y, 1, 0);
+			}
+		}
+	}
+}
+
+static bool PointInPoly(const int* xs, const int* zs, int count, float px, float pz)
+{
+	bool inside = false;
+	for (int i = 0, j = count - 1; i < count; j = i++)
+	{
+		if (((zs[i] > pz) != (zs[j] > pz))
+			&& (px < (xs[j] - xs[i]) * (pz - zs[i]) / (float)(zs[j] - zs[i]) + xs[i]))
+		{
+			inside = !inside;
+		}
+	}
+	return inside;
+}
+
+// the Narrow flags of each poly, from the widest point inside of it. A poly gets
+// a flag if none of its spans is that far from a wall. Polys that can't be
+// reached from their widest point aren't told apart, wide agents may still have
+// to squeeze through their sides.
+static void GetNarrowPolyFlags(const rcCompactHeightfield& chf, const rcPolyMesh& pmesh,
+	std::vector<uint16_t>& flags)
+{
+	flags.assign(pmesh.npolys, 0);
+	if (pmesh.nvp > DT_VERTS_PER_POLYGON)
+		return;
+
+	std::vector<uint16_t> dist;
+	BuildWallDistances(chf, dist);
+
+	// poly verts are in cells from the inside of the border
+	const int border = chf.borderSize;
+	const int w = chf.width;
+
+	auto widestInCell = [&](int x, int z, uint16_t reg, int& widest)
+	{
+		const int cx = x + border;
+		const int cz = z + border;
+		if (cx < 0 || cz < 0 || cx >= w || cz >= chf.height)
+			return false;
+
+		bool found = false;
+		const rcCompactCell& c = chf.cells[cx + cz * w];
+		for (int i = (int)c.index, ni = (int)(c.index + c.count); i < ni; ++i)
+		{
+			if (chf.spans[i].reg == reg)
+			{
+				widest = std::max<int>(widest, dist[i]);
+				found = true;
+			}
+		}
+		return found;
+	};
+
+	for (int i = 0; i < pmesh.npolys; ++i)
+	{
+		const unsigned short* poly = &pmesh.polys[i * 2 * pmesh.nvp];
+
+		int xs[DT_VERTS_PER_POLYGON], zs[DT_VERTS_PER_POLYGON];
+		int count = 0;
+		int minx = INT_MAX, minz = INT_MAX, maxx = INT_MIN, maxz = INT_MIN;
+
+		for (int j = 0; j < pmesh.nvp && poly[j] != RC_MESH_NULL_IDX; ++j)
+		{
+			const unsigned short* v = &pmesh.verts[poly[j] * 3];
+			xs[count] = v[0];
+			zs[count] = v[2];
+			minx = std::min<int>(minx, v[0]);
+			maxx = std::max<int>(maxx, v[0]);
+			minz = std::min<int>(minz, v[2]);
+			maxz = std::max<int>(maxz, v[2]);
+			++count;
+		}
+
+		if (count < 3)
+			continue;
+
+		int widest = 0;
+		bool found = false;
+
+		for (int z = minz; z < maxz; ++z)
+		{
+			for (int x = minx; x < maxx; ++x)
+			{
+				if (PointInPoly(xs, zs, count, x + 0.5f, z + 0.5f))
+					found |= widestInCell(x, z, pmesh.regs[i], widest);
+			}
+		}
+
+		// slivers that no cell center is inside of
+		if (!found)
+		{
+			for (int j = 0; j < count; ++j)
+				found |= widestInCell(xs[j], zs[j], pmesh.regs[i], widest);
+		}
+
+		// nowhere near a wall
+		if (!found || widest == 0xffff)
+			continue;
+
+		const float clearance = widest * 0.5f * chf.cs;
+		for (int level = 0; level < NAVMESH_CLEARANCE_LEVEL_COUNT; ++level)
+		{
+			if (clearance < NAVMESH_CLEARANCE_LEVELS[level])
+				flags[i] |= static_cast<uint16_t>(+PolyFlags::Narrow1 << level);
+		}
+	}
+}
 
 //----------------------------------------------------------------------------
 
@@ -49,6 +621,9 @@ NavMeshTool::NavMeshTool(const std::shared_ptr<NavMesh>& navMesh)
 
 NavMeshTool::~NavMeshTool()
 {
+	// rebuilds still running use the rest of us
+	m_scheduler.reset();
+
 	delete[] m_outputPath;
 }
 
@@ -143,6 +718,19 @@ void NavMeshTool::handleDebug()
 		valid[DrawMode::NAVMESH_PORTALS] = isValid;
 		valid[DrawMode::NAVMESH_INVIS] = isValid;
 		valid[DrawMode::MESH] = true;
+
+		// the intermediates are only around for the tiles in the debug cache
+		bool isCached = !m_debugCache.IsEmpty();
+
+		valid[DrawMode::VOXELS] = isCached;
+		valid[DrawMode::VOXELS_WALKABLE] = isCached;
+		valid[DrawMode::COMPACT] = isCached;
+		valid[DrawMode::COMPACT_DISTANCE] = isCached;
+		valid[DrawMode::COMPACT_REGIONS] = isCached;
+		valid[DrawMode::REGION_CONNECTIONS] = isCached;
+		valid[DrawMode::RAW_CONTOURS] = isCached;
+		valid[DrawMode::BOTH_CONTOURS] = isCached;
+		valid[DrawMode::CONTOURS] = isCached;
 	}
 
 	int unavail = 0;
@@ -169,6 +757,24 @@ void NavMeshTool::handleDebug()
 			m_drawMode = DrawMode::NAVMESH_NODES;
 		if (valid[DrawMode::NAVMESH_PORTALS] && ImGui::RadioButton("Navmesh Portals", m_drawMode == DrawMode::NAVMESH_PORTALS))
 			m_drawMode = DrawMode::NAVMESH_PORTALS;
+		if (valid[DrawMode::VOXELS] && ImGui::RadioButton("Voxels", m_drawMode == DrawMode::VOXELS))
+			m_drawMode = DrawMode::VOXELS;
+		if (valid[DrawMode::VOXELS_WALKABLE] && ImGui::RadioButton("Walkable Voxels", m_drawMode == DrawMode::VOXELS_WALKABLE))
+			m_drawMode = DrawMode::VOXELS_WALKABLE;
+		if (valid[DrawMode::COMPACT] && ImGui::RadioButton("Compact", m_drawMode == DrawMode::COMPACT))
+			m_drawMode = DrawMode::COMPACT;
+		if (valid[DrawMode::COMPACT_DISTANCE] && ImGui::RadioButton("Compact Distance", m_drawMode == DrawMode::COMPACT_DISTANCE))
+			m_drawMode = DrawMode::COMPACT_DISTANCE;
+		if (valid[DrawMode::COMPACT_REGIONS] && ImGui::RadioButton("Compact Regions", m_drawMode == DrawMode::COMPACT_REGIONS))
+			m_drawMode = DrawMode::COMPACT_REGIONS;
+		if (valid[DrawMode::REGION_CONNECTIONS] && ImGui::RadioButton("Region Connections", m_drawMode == DrawMode::REGION_CONNECTIONS))
+			m_drawMode = DrawMode::REGION_CONNECTIONS;
+		if (valid[DrawMode::RAW_CONTOURS] && ImGui::RadioButton("Raw Contours", m_drawMode == DrawMode::RAW_CONTOURS))
+			m_drawMode = DrawMode::RAW_CONTOURS;
+		if (valid[DrawMode::BOTH_CONTOURS] && ImGui::RadioButton("Both Contours", m_drawMode == DrawMode::BOTH_CONTOURS))
+			m_drawMode = DrawMode::BOTH_CONTOURS;
+		if (valid[DrawMode::CONTOURS] && ImGui::RadioButton("Contours", m_drawMode == DrawMode::CONTOURS))
+			m_drawMode = DrawMode::CONTOURS;
 	}
 }
 
@@ -276,6 +882,46 @@ void NavMeshTool::handleTools()
 			ImGui::SliderFloat("Max Climb", &m_config.agentMaxClimb, 0.1f, 15.0f, "%.1f");
 			ImGui::SliderFloat("Max Slope", &m_config.agentMaxSlope, 0.0f, 90.0f, "%.1f");
 		}
+		if (ImGui::TreeNodeEx("Agent Profiles", ImGuiTreeNodeFlags_NoTreePushOnOpen)) {
+			ImGui::TextWrapped("Meshes for other agent sizes, built from the same geometry and saved "
+				"in the same file. The plugin loads the one that fits the character.");
+
+			int removed = -1;
+			for (size_t i = 0; i < m_config.agentProfiles.size(); ++i)
+			{
+				AgentProfile& profile = m_config.agentProfiles[i];
+				ImGui::PushID((int)i);
+
+				char name[64];
+				strncpy(name, profile.name.c_str(), sizeof(name) - 1);
+				name[sizeof(name) - 1] = 0;
+				if (ImGui::InputText("Name", name, sizeof(name)))
+					profile.name = name;
+
+				ImGui::SliderFloat("Height", &profile.agentHeight, 0.1f, 15.0f, "%.1f");
+				ImGui::SliderFloat("Radius", &profile.agentRadius, 0.1f, 15.0f, "%.1f");
+				ImGui::SliderFloat("Max Climb", &profile.agentMaxClimb, 0.1f, 15.0f, "%.1f");
+
+				if (ImGui::Button("Remove Profile"))
+					removed = (int)i;
+
+				ImGui::Separator();
+				ImGui::PopID();
+			}
+
+			if (removed >= 0)
+				m_config.agentProfiles.erase(m_config.agentProfiles.begin() + removed);
+
+			if (ImGui::Button("Add Profile"))
+			{
+				AgentProfile profile;
+				profile.name = "Profile " + std::to_string(m_config.agentProfiles.size() + 1);
+				profile.agentHeight = m_config.agentHeight;
+				profile.agentRadius = m_config.agentRadius;
+				profile.agentMaxClimb = m_config.agentMaxClimb;
+				m_config.agentProfiles.push_back(profile);
+			}
+		}
 
 		if (m_geom && ImGui::TreeNodeEx("Bounding Box", ImGuiTreeNodeFlags_DefaultOpen | ImGuiTreeNodeFlags_NoTreePushOnOpen)) {
 			glm::vec3 min, max;
@@ -353,6 +999,19 @@ void NavMeshTool::handleTools()
 			const char *partition_types[] = { "Watershed", "Monotone", "Layers" };
 			ImGui::Combo("Partition Type", (int*)&m_config.partitionType, partition_types, 3);
 
+			// Layers
+			ImGui::Text("Layers");
+			ImGui::SameLine();
+			static const char* LayersHelp =
+				"Layered Tiles:\n"
+				"  - Builds a tile for each layer of the heightfield, so that floors stacked\n"
+				"    over each other are smaller tiles of their own.\n"
+				"  - Layers are partitioned the way the tile cache does it, and don't get\n"
+				"    detail meshes or pruning. Tile size must be 255 or less.\n";
+			ImGuiEx::HelpMarker(LayersHelp, 600.0f, ImGuiEx::ConsoleFont);
+
+			ImGui::Checkbox("Layered Tiles", &m_config.layeredTiles);
+
 			// Polygonization
 			ImGui::Text("Polygonization");
 			ImGui::SameLine();
@@ -364,12 +1023,18 @@ void NavMeshTool::handleTools()
 				"    original raw contour.\n\n"
 				"Verts Per Poly:\n"
 				"  - The maximum number of vertices allowed for polygons generatd during the\n"
-				"    contour to polygon conversion process.\n";
+				"    contour to polygon conversion process.\n\n"
+				"Merge Polys:\n"
+				"  - Merges polys of the same area that are about flat across region borders,\n"
+				"    up to 6 verts, and takes out verts along straight walls and tile borders.\n"
+				"  - Smaller tiles, and fewer polys for path searches to expand. Polys may be\n"
+				"    off of a plane by up to the Max Sample Error.\n";
 			ImGuiEx::HelpMarker(PolygonizationHelp, 600.0f, ImGuiEx::ConsoleFont);
 
 			ImGui::SliderFloat("Max Edge Length", &m_config.edgeMaxLen, 0.0f, 50.0f, "%.0f");
 			ImGui::SliderFloat("Max Edge Error", &m_config.edgeMaxError, 0.1f, 3.0f, "%.1f");
 			ImGui::SliderFloat("Verts Per Poly", &m_config.vertsPerPoly, 3.0f, 12.0f, "%.0f");
+			ImGui::Checkbox("Merge Polys", &m_config.mergePolys);
 
 			// Detail Mesh
 			ImGui::Text("Detail Mesh");
@@ -385,33 +1050,146 @@ void NavMeshTool::handleTools()
 
 			ImGui::SliderFloat("Sample Distance", &m_config.detailSampleDist, 0.0f, 0.9f, "%.2f");
 			ImGui::SliderFloat("Max Sample Error", &m_config.detailSampleMaxError, 0.0f, 100.0f, "%.1f");
-		}
-	}
-}
 
-void NavMeshTool::handleRender()
-{
-	if (!m_geom || !m_geom->getMeshLoader())
-		return;
+			// Obstacles
+			ImGui::Text("Obstacles");
+			ImGui::SameLine();
+			static const char* ObstaclesHelp =
+				"Tile Cache:\n"
+				"  - Stores the heightfield layers of each tile in the mesh file, so that\n"
+				"    temporary obstacles can be added at runtime with /nav obstacle.\n"
+				"  - Makes the mesh file larger. Tile size must be small enough for the tile\n"
+				"    and its border to fit in 255 cells.\n";
+			ImGuiEx::HelpMarker(ObstaclesHelp, 600.0f, ImGuiEx::ConsoleFont);
+
+			ImGui::Checkbox("Tile Cache", &m_config.useTileCache);
+
+			// Pruning
+			ImGui::Text("Pruning");
+			ImGui::SameLine();
+			static const char* PruningHelp =
+				"Prune Unreachable:\n"
+				"  - After building all tiles, polys that can't be reached from any of the\n"
+				"    seeds placed with the Prune NavMesh Tool are removed from the mesh.\n"
+				"  - Tiles built one at a time keep what was pruned from them, as long as\n"
+				"    they haven't changed. Build all tiles again after moving the seeds.\n";
+			ImGuiEx::HelpMarker(PruningHelp, 600.0f, ImGuiEx::ConsoleFont);
+
+			ImGui::Checkbox("Prune Unreachable", &m_config.pruneUnreachable);
+
+			// Storage
+			ImGui::Text("Storage");
+			ImGui::SameLine();
+			static const char* StorageHelp =
+				"Pack Tiles:\n"
+				"  - Saves tiles with 16 bit vertices and delta coded detail triangles,\n"
+				"    which makes the mesh file smaller.\n"
+				"  - Detail heights are rounded a little. Packed tiles are unpacked when\n"
+				"    they are loaded, so they can't be used straight out of the file.\n";
+			ImGuiEx::HelpMarker(StorageHelp, 600.0f, ImGuiEx::ConsoleFont);
+
+			ImGui::Checkbox("Pack Tiles", &m_config.packTiles);
+
+			// Off-Mesh Links
+			ImGui::Text("Off-Mesh Links");
+			ImGui::SameLine();
+			static const char* OffMeshLinksHelp =
+				"Generate Links:\n"
+				"  - Adds one way Jump links along the edges of the navmesh, down off of\n"
+				"    ledges and across gaps to ground at about the same height.\n\n"
+				"Max Drop Height:\n"
+				"  - The furthest down a link is allowed to go.\n\n"
+				"Max Jump Distance:\n"
+				"  - The widest gap that a link can cross.\n";
+			ImGuiEx::HelpMarker(OffMeshLinksHelp, 600.0f, ImGuiEx::ConsoleFont);
+
+			ImGui::Checkbox("Generate Links", &m_config.autoOffMeshLinks);
+			if (m_config.autoOffMeshLinks)
+			{
+				ImGui::SliderFloat("Max Drop Height", &m_config.maxDropHeight, 0.0f, 100.0f, "%.1f");
+				ImGui::SliderFloat("Max Jump Distance", &m_config.maxJumpDistance, 0.0f, 50.0f, "%.1f");
+			}
 
-	duDebugDraw& dd = getDebugDraw();
+			// Build
+			ImGui::Text("Build");
+			ImGui::SameLine();
+			static const char* BuildHelp =
+				"Build Priority:\n"
+				"  - Background builds at below normal priority and leaves a core for the\n"
+				"    editor when the threads are on Auto, so the view stays smooth while\n"
+				"    looking at the tiles built so far.\n"
+				"  - Normal builds on every core at normal priority.\n"
+				"  - Turbo builds on every core above normal priority and adds tiles as\n"
+				"    fast as they are built, even if the view stutters.\n";
+			ImGuiEx::HelpMarker(BuildHelp, 600.0f, ImGuiEx::ConsoleFont);
+
+			ImGui::SliderInt("Build Threads", &m_buildThreadCount, 0, (int)std::thread::hardware_concurrency(),
+				m_buildThreadCount == 0 ? "Auto" : "%.0f");
+
+			const char* priorities[] = { "Background", "Normal", "Turbo" };
+			ImGui::Combo("Build Priority", (int*)&m_buildPriority, priorities, 3);
+
+			int memoryBudget = (int)(m_tileMemoryBudget / (1024 * 1024));
+			if (ImGui::SliderInt("Tile Memory (MB)", &memoryBudget, 0, 8192,
+				memoryBudget == 0 ? "No Limit" : "%.0f"))
+			{
+				m_tileMemoryBudget = (size_t)memoryBudget * 1024 * 1024;
+			}
 
-	const float texScale = 1.0f / (m_config.cellSize * 10.0f);
+			int debugTiles = m_debugCache.GetMaxTiles();
+			if (ImGui::SliderInt("Debug Tiles", &debugTiles, 0, 64, debugTiles == 0 ? "Off" : "%.0f"))
+				m_debugCache.SetMaxTiles(debugTiles);
+			if (ImGui::IsItemHovered())
+			{
+				ImGui::SetTooltip("Keep the voxels, compact heightfield and contours of this many of\n"
+					"the tiles built last, for the debug draw modes");
+			}
 
-	// Draw mesh
-	if (m_drawMode != DrawMode::NAVMESH_TRANS)
-	{
-		// Draw mesh
-		duDebugDrawTriMeshSlope(&dd,
-			m_geom->getMeshLoader()->getVerts(),
-			m_geom->getMeshLoader()->getVertCount(),
-			m_geom->getMeshLoader()->getTris(),
-			m_geom->getMeshLoader()->getNormals(),
-			m_geom->getMeshLoader()->getTriCount(),
-			m_config.agentMaxSlope,
-			texScale);
-		m_geom->drawOffMeshConnections(&dd);
-	}
+			ImGui::Checkbox("Detail Later", &m_deferDetail);
+			if (ImGui::IsItemHovered())
+			{
+				ImGui::SetTooltip("Build All Tiles skips the detail samples, and the tiles are\n"
+					"rebuilt with them in the background once the build is done");
+			}
+
+			if (ImGui::Button("Validate Mesh"))
+				validateNavMesh();
+
+			if (!m_invalidTiles.empty())
+			{
+				ImGui::SameLine();
+
+				char label[64];
+				sprintf_s(label, "Rebuild %d Invalid Tiles", (int)m_invalidTiles.size());
+				if (ImGui::Button(label))
+				{
+					beginUndoStep("Rebuild Invalid Tiles");
+					RebuildTiles(m_invalidTiles);
+					m_invalidTiles.clear();
+				}
+			}
+		}
+	}
+}
+
+void NavMeshTool::handleRender()
+{
+	// a mesh opened without its geometry is drawn by itself
+	if (m_geom ? !m_geom->getMeshLoader() : !m_navMesh->IsNavMeshLoaded())
+		return;
+
+	duDebugDraw& dd = getDebugDraw();
+
+	const float texScale = 1.0f / (m_config.cellSize * 10.0f);
+
+	// Draw mesh
+	if (m_geom && m_drawMode != DrawMode::NAVMESH_TRANS)
+	{
+		// Draw mesh, and the placed models, from display lists of the parts in view
+		m_geomDrawCache.draw(&m_dd, *m_geom, m_viewProj, m_config.agentMaxSlope, texScale);
+
+		m_geom->drawOffMeshConnections(&dd);
+	}
 
 	dd.depthMask(false);
 
@@ -429,6 +1207,9 @@ void NavMeshTool::handleRender()
 	const float s = m_config.tileSize * m_config.cellSize;
 	duDebugDrawGridXZ(&dd, bmin[0], bmin[1], bmin[2], tw, th, s, duRGBA(0, 0, 0, 64), 1.0f);
 
+	if (m_drawBuildTimes)
+		drawBuildTimes(&dd);
+
 	if (m_navMesh->IsNavMeshLoaded() &&
 		(m_drawMode == DrawMode::NAVMESH ||
 		 m_drawMode == DrawMode::NAVMESH_TRANS ||
@@ -443,7 +1224,14 @@ void NavMeshTool::handleRender()
 		if (navMesh && navQuery)
 		{
 			if (m_drawMode != DrawMode::NAVMESH_INVIS)
-				duDebugDrawNavMeshWithClosedList(&dd, *navMesh, *navQuery, m_navMeshDrawFlags);
+			{
+				// tiles are colored by area, so their cached drawing depends on the area colors
+				uint32_t areaColorsKey = 2166136261u;
+				for (const PolyAreaType* area : m_navMesh->GetPolyAreas())
+					areaColorsKey = (areaColorsKey ^ area->color ^ (area->id << 24)) * 16777619u;
+
+				m_tileDrawCache.draw(&m_dd, *navMesh, *navQuery, m_navMeshDrawFlags, areaColorsKey);
+			}
 			if (m_drawMode == DrawMode::NAVMESH_BVTREE)
 				duDebugDrawNavMeshBVTree(&dd, *navMesh);
 			if (m_drawMode == DrawMode::NAVMESH_PORTALS)
@@ -455,6 +1243,43 @@ void NavMeshTool::handleRender()
 		}
 	}
 
+	switch (m_drawMode)
+	{
+	case DrawMode::VOXELS:
+		m_debugCache.DrawHeightfields([&dd](const rcHeightfield& hf) { duDebugDrawHeightfieldSolid(&dd, hf); });
+		break;
+	case DrawMode::VOXELS_WALKABLE:
+		m_debugCache.DrawHeightfields([&dd](const rcHeightfield& hf) { duDebugDrawHeightfieldWalkable(&dd, hf); });
+		break;
+	case DrawMode::COMPACT:
+		m_debugCache.DrawCompactHeightfields([&dd](const rcCompactHeightfield& chf) { duDebugDrawCompactHeightfieldSolid(&dd, chf); });
+		break;
+	case DrawMode::COMPACT_DISTANCE:
+		m_debugCache.DrawCompactHeightfields([&dd](const rcCompactHeightfield& chf) { duDebugDrawCompactHeightfieldDistance(&dd, chf); });
+		break;
+	case DrawMode::COMPACT_REGIONS:
+		m_debugCache.DrawCompactHeightfields([&dd](const rcCompactHeightfield& chf) { duDebugDrawCompactHeightfieldRegions(&dd, chf); });
+		break;
+	case DrawMode::REGION_CONNECTIONS:
+		m_debugCache.DrawContours([&dd](const rcContourSet& cset) { duDebugDrawRegionConnections(&dd, cset); });
+		break;
+	case DrawMode::RAW_CONTOURS:
+		m_debugCache.DrawContours([&dd](const rcContourSet& cset) { duDebugDrawRawContours(&dd, cset); });
+		break;
+	case DrawMode::BOTH_CONTOURS:
+		m_debugCache.DrawContours([&dd](const rcContourSet& cset)
+		{
+			duDebugDrawRawContours(&dd, cset, 0.5f);
+			duDebugDrawContours(&dd, cset);
+		});
+		break;
+	case DrawMode::CONTOURS:
+		m_debugCache.DrawContours([&dd](const rcContourSet& cset) { duDebugDrawContours(&dd, cset); });
+		break;
+	default:
+		break;
+	}
+
 	drawConvexVolumes(&dd);
 
 	if (m_tool)
@@ -462,6 +1287,106 @@ void NavMeshTool::handleRender()
 	renderToolStates();
 }
 
+void NavMeshTool::drawBuildTimes(duDebugDraw* dd)
+{
+	std::vector<TileBuildTimings> tiles = m_buildProfiler.GetTiles();
+	if (tiles.empty())
+		return;
+
+	auto GetTime = [this](const TileBuildTimings& tile)
+	{
+		return m_buildTimeStage == BuildStage::Count ? tile.GetTotalTime() : tile.GetTime(m_buildTimeStage);
+	};
+
+	TileBuildTimings::clock::duration maxTime = {};
+	for (const TileBuildTimings& tile : tiles)
+		maxTime = std::max(maxTime, GetTime(tile));
+
+	if (maxTime.count() <= 0)
+		return;
+
+	// flat on the bottom of the mesh bounds, green for the fastest tiles through red for the slowest
+	const float y = m_navMesh->GetNavMeshBoundsMin().y;
+
+	dd->begin(DU_DRAW_QUADS);
+
+	for (const TileBuildTimings& tile : tiles)
+	{
+		float t = (float)GetTime(tile).count() / (float)maxTime.count();
+		unsigned int col = duLerpCol(duRGBA(0, 192, 0, 96), duRGBA(255, 0, 0, 96), (int)(t * 255));
+
+		dd->vertex(tile.bmin[0], y, tile.bmin[2], col);
+		dd->vertex(tile.bmax[0], y, tile.bmin[2], col);
+		dd->vertex(tile.bmax[0], y, tile.bmax[2], col);
+		dd->vertex(tile.bmin[0], y, tile.bmax[2], col);
+	}
+
+	dd->end();
+}
+
+void NavMeshTool::handleBuildProfile()
+{
+	if (m_buildProfiler.IsEmpty())
+		return;
+
+	if (!ImGui::CollapsingHeader("Build Profile"))
+		return;
+
+	ImGui::Checkbox("Build Time Heat Map", &m_drawBuildTimes);
+
+	auto StageGetter = [](void*, int index, const char** text)
+	{
+		*text = GetBuildStageName(static_cast<BuildStage>(index));
+		return true;
+	};
+
+	int stage = static_cast<int>(m_buildTimeStage);
+	if (ImGui::Combo("Stage", &stage, StageGetter, nullptr, (int)BuildStage::Count + 1))
+		m_buildTimeStage = static_cast<BuildStage>(stage);
+
+	// time summed over all tiles, so with more than one build thread this exceeds the wall time
+	std::vector<TileBuildTimings> tiles = m_buildProfiler.GetTiles();
+	TileBuildTimings::clock::duration stageTotals[(int)BuildStage::Count] = {};
+	TileBuildTimings::clock::duration total = {};
+
+	for (const TileBuildTimings& tile : tiles)
+	{
+		for (int i = 0; i < (int)BuildStage::Count; ++i)
+			stageTotals[i] += tile.stageTime[i];
+		total += tile.GetTotalTime();
+	}
+
+	ImGui::Text("%d tiles", (int)tiles.size());
+	for (int i = 0; i < (int)BuildStage::Count; ++i)
+	{
+		ImGui::Text("%s: %.1fms", GetBuildStageName(static_cast<BuildStage>(i)),
+			std::chrono::duration<float, std::milli>(stageTotals[i]).count());
+	}
+	ImGui::Text("Total: %.1fms", std::chrono::duration<float, std::milli>(total).count());
+
+	std::string basePath = std::string(m_outputPath) + "\\MQ2Nav\\" + m_navMesh->GetZoneName();
+
+	if (ImGui::Button("Export CSV"))
+	{
+		std::string filename = basePath + "_buildtimes.csv";
+		if (m_buildProfiler.ExportCSV(filename))
+			m_ctx->log(RC_LOG_PROGRESS, "Wrote build times to %s", filename.c_str());
+		else
+			m_ctx->log(RC_LOG_ERROR, "Failed to write build times to %s", filename.c_str());
+	}
+
+	ImGui::SameLine();
+
+	if (ImGui::Button("Export Trace"))
+	{
+		std::string filename = basePath + "_buildtrace.json";
+		if (m_buildProfiler.ExportChromeTrace(filename))
+			m_ctx->log(RC_LOG_PROGRESS, "Wrote build trace to %s", filename.c_str());
+		else
+			m_ctx->log(RC_LOG_ERROR, "Failed to write build trace to %s", filename.c_str());
+	}
+}
+
 void NavMeshTool::drawConvexVolumes(duDebugDraw* dd)
 {
 	dd->depthMask(false);
@@ -548,6 +1473,10 @@ void NavMeshTool::handleRenderOverlay(const glm::mat4& proj,
 void NavMeshTool::handleGeometryChanged(class InputGeom* geom)
 {
 	m_geom = geom;
+	m_geomDrawCache.clear();
+	m_undo.Clear();
+	m_geometryRequested = false;
+	m_geometryRebuilds.clear();
 
 	if (m_tool)
 	{
@@ -558,36 +1487,267 @@ void NavMeshTool::handleGeometryChanged(class InputGeom* geom)
 	NavMeshUpdated();
 }
 
-bool NavMeshTool::handleBuild()
+void NavMeshTool::attachGeometry(InputGeom* geom)
+{
+	m_geom = geom;
+	m_geomDrawCache.clear();
+	m_geometryRequested = false;
+
+	if (!m_geom)
+	{
+		// the geometry didn't load, drop the tiles that were waiting on it
+		m_geometryRebuilds.clear();
+		return;
+	}
+
+	UpdateTileSizes();
+
+	std::vector<dtTileRef> tiles;
+	std::swap(tiles, m_geometryRebuilds);
+	RebuildTiles(tiles);
+}
+
+void NavMeshTool::requestGeometry()
+{
+	if (m_geom || m_geometryRequested || !m_requestGeometry)
+		return;
+
+	m_ctx->log(RC_LOG_PROGRESS, "Loading the zone geometry to build tiles");
+	m_geometryRequested = true;
+	m_requestGeometry();
+}
+
+bool NavMeshTool::raycastNavMesh(const glm::vec3& start, const glm::vec3& end, float& t) const
+{
+	auto navMesh = m_navMesh->GetNavMesh();
+	if (!navMesh)
+		return false;
+
+	auto tilesLock = m_navMesh->LockTiles();
+	const dtNavMesh* mesh = navMesh.get();
+	const glm::vec3 dir = end - start;
+
+	t = 1.0f;
+	bool hit = false;
+
+	// both sides of the triangle, the winding of detail triangles isn't fixed
+	auto testTriangle = [&](const float* a, const float* b, const float* c)
+	{
+		const glm::vec3 va = glm::make_vec3(a);
+		const glm::vec3 ab = glm::make_vec3(b) - va;
+		const glm::vec3 ac = glm::make_vec3(c) - va;
+
+		const glm::vec3 p = glm::cross(dir, ac);
+		const float det = glm::dot(ab, p);
+		if (std::abs(det) < 1e-8f)
+			return;
+
+		const float inv = 1.0f / det;
+		const glm::vec3 s = start - va;
+		const float u = glm::dot(s, p) * inv;
+		if (u < 0.0f || u > 1.0f)
+			return;
+
+		const glm::vec3 q = glm::cross(s, ab);
+		const float v = glm::dot(dir, q) * inv;
+		if (v < 0.0f || u + v > 1.0f)
+			return;
+
+		const float tt = glm::dot(ac, q) * inv;
+		if (tt >= 0.0f && tt < t)
+		{
+			t = tt;
+			hit = true;
+		}
+	};
+
+	for (int i = 0; i < mesh->getMaxTiles(); ++i)
+	{
+		const dtMeshTile* tile = mesh->getTile(i);
+		if (!tile || !tile->header)
+			continue;
+
+		// the segment's bounds against the tile's, with a little room for the detail
+		const glm::vec3 lo = glm::min(start, end), hi = glm::max(start, end);
+		if (lo.x > tile->header->bmax[0] || hi.x < tile->header->bmin[0]
+			|| lo.z > tile->header->bmax[2] || hi.z < tile->header->bmin[2]
+			|| lo.y > tile->header->bmax[1] + 1.0f || hi.y < tile->header->bmin[1] - 1.0f)
+		{
+			continue;
+		}
+
+		for (int j = 0; j < tile->header->polyCount; ++j)
+		{
+			const dtPoly& poly = tile->polys[j];
+			if (poly.getType() == DT_POLYTYPE_OFFMESH_CONNECTION)
+				continue;
+
+			if (j >= tile->header->detailMeshCount)
+			{
+				// no detail, the poly is a fan
+				for (int k = 2; k < poly.vertCount; ++k)
+				{
+					testTriangle(&tile->verts[poly.verts[0] * 3], &tile->verts[poly.verts[k - 1] * 3],
+						&tile->verts[poly.verts[k] * 3]);
+				}
+				continue;
+			}
+
+			const dtPolyDetail& pd = tile->detailMeshes[j];
+			auto vertex = [&](unsigned char index)
+			{
+				return index < poly.vertCount ? &tile->verts[poly.verts[index] * 3]
+					: &tile->detailVerts[(pd.vertBase + index - poly.vertCount) * 3];
+			};
+
+			for (int k = 0; k < pd.triCount; ++k)
+			{
+				const unsigned char* tri = &tile->detailTris[(pd.triBase + k) * 4];
+				testTriangle(vertex(tri[0]), vertex(tri[1]), vertex(tri[2]));
+			}
+		}
+	}
+
+	return hit;
+}
+
+bool NavMeshTool::handleBuild(bool async, std::vector<BuildRegion> regions)
 {
 	if (!m_geom || !m_geom->getMeshLoader())
 	{
+		if (!m_geom && m_requestGeometry)
+		{
+			// build again once it's loaded, what to build may change with it
+			requestGeometry();
+			return false;
+		}
+
 		m_ctx->log(RC_LOG_ERROR, "buildTiledNavigation: No vertices and triangles.");
 		return false;
 	}
 
-	std::shared_ptr<dtNavMesh> navMesh(dtAllocNavMesh(),
-		[](dtNavMesh* ptr) { dtFreeNavMesh(ptr); });
+	UpdateTileSizes();
 
-	m_navMesh->SetNavMesh(navMesh, false);
+	// a region build is an edit, a full build changes too much to keep the steps for
+	if (!regions.empty())
+		beginUndoStep("Build Region");
+	else
+		m_undo.Clear();
 
 	dtNavMeshParams params;
 	rcVcopy(params.orig, glm::value_ptr(m_geom->getMeshBoundsMin()));
 	params.tileWidth = m_config.tileSize * m_config.cellSize;
 	params.tileHeight = m_config.tileSize * m_config.cellSize;
 	params.maxTiles = m_tilesWidth * m_tilesHeight;
-	params.maxPolys = m_maxPolysPerTile * params.maxTiles;
+	params.maxPolys = m_maxPolysPerTile; // per tile
 
-	dtStatus status;
+	// layers are limited to 255 cells on a side, including the border
+	const int borderSize = (int)ceilf(GetLargestAgentRadius(m_config) / m_config.cellSize) + 3;
+	bool useTileCache = m_config.useTileCache;
+	if (useTileCache && (int)m_config.tileSize + borderSize * 2 > 255)
+	{
+		m_ctx->log(RC_LOG_WARNING, "buildTiledNavigation: Tile size is too large for the tile cache, building without it.");
+		useTileCache = false;
+	}
 
-	status = navMesh->init(&params);
-	if (dtStatusFailed(status))
+	// layered tiles have a tile per layer, like tiles rebuilt from the cache
+	if (m_config.layeredTiles)
 	{
-		m_ctx->log(RC_LOG_ERROR, "buildTiledNavigation: Could not init navmesh.");
-		return false;
+		if ((int)m_config.tileSize > 255)
+			m_ctx->log(RC_LOG_WARNING, "buildTiledNavigation: Tile size is too large for layered tiles, building without them.");
+		else
+			params.maxTiles = m_tilesWidth * m_tilesHeight * TILECACHE_EXPECTED_LAYERS_PER_TILE;
+	}
+
+	// the meshes of the other agent profiles are built along with the main one.
+	// When the profiles change, every tile is built again to fill the new ones.
+	bool resetTiles = !AgentMeshesMatch(m_navMesh->GetAgentNavMeshes(), m_config.agentProfiles);
+
+	if (useTileCache)
+	{
+		// tiles rebuilt from the cache can have a tile per layer
+		params.maxTiles = m_tilesWidth * m_tilesHeight * TILECACHE_EXPECTED_LAYERS_PER_TILE;
+
+		dtTileCacheParams tcparams;
+		memset(&tcparams, 0, sizeof(tcparams));
+		rcVcopy(tcparams.orig, glm::value_ptr(m_geom->getMeshBoundsMin()));
+		tcparams.cs = m_config.cellSize;
+		tcparams.ch = m_config.cellHeight;
+		tcparams.width = (int)m_config.tileSize;
+		tcparams.height = (int)m_config.tileSize;
+		tcparams.walkableHeight = m_config.agentHeight;
+		tcparams.walkableRadius = m_config.agentRadius;
+		tcparams.walkableClimb = m_config.agentMaxClimb;
+		tcparams.maxSimplificationError = m_config.edgeMaxError;
+		tcparams.maxTiles = m_tilesWidth * m_tilesHeight * TILECACHE_EXPECTED_LAYERS_PER_TILE;
+		tcparams.maxObstacles = TILECACHE_MAX_OBSTACLES;
+
+		// a new cache has no layers, so every tile has to be built again to fill it
+		NavMeshTileCache* tileCache = m_navMesh->GetTileCache();
+		if (!tileCache || memcmp(tileCache->GetParams(), &tcparams, sizeof(tcparams)) != 0)
+		{
+			if (!m_navMesh->CreateTileCache(tcparams))
+			{
+				m_ctx->log(RC_LOG_ERROR, "buildTiledNavigation: Could not init tile cache.");
+				return false;
+			}
+
+			resetTiles = true;
+		}
+	}
+	else
+	{
+		m_navMesh->ResetTileCache();
+	}
+
+	// if the tile layout hasn't changed, build into the existing mesh so that tiles
+	// whose inputs are unchanged can be kept.
+	std::shared_ptr<dtNavMesh> navMesh = m_navMesh->GetNavMesh();
+	if (!navMesh || resetTiles || memcmp(navMesh->getParams(), &params, sizeof(params)) != 0)
+	{
+		navMesh = std::shared_ptr<dtNavMesh>(dtAllocNavMesh(),
+			[](dtNavMesh* ptr) { dtFreeNavMesh(ptr); });
+
+		m_navMesh->SetNavMesh(navMesh, false);
+
+		dtStatus status;
+
+		status = navMesh->init(&params);
+		if (dtStatusFailed(status))
+		{
+			m_ctx->log(RC_LOG_ERROR, "buildTiledNavigation: Could not init navmesh.");
+			return false;
+		}
+
+		// the agent meshes share the layout of the main one
+		std::vector<NavMesh::AgentNavMesh> agentMeshes;
+		for (const AgentProfile& profile : m_config.agentProfiles)
+		{
+			NavMesh::AgentNavMesh agentMesh;
+			agentMesh.profile = profile;
+			agentMesh.navMesh = std::shared_ptr<dtNavMesh>(dtAllocNavMesh(),
+				[](dtNavMesh* ptr) { dtFreeNavMesh(ptr); });
+
+			if (dtStatusFailed(agentMesh.navMesh->init(&params)))
+			{
+				m_ctx->log(RC_LOG_ERROR, "buildTiledNavigation: Could not init navmesh for agent profile '%s'.",
+					profile.name.c_str());
+				return false;
+			}
+
+			agentMeshes.push_back(std::move(agentMesh));
+		}
+
+		m_navMesh->SetAgentNavMeshes(std::move(agentMeshes));
+
+		if (!regions.empty())
+		{
+			m_ctx->log(RC_LOG_WARNING, "buildTiledNavigation: The navmesh was created again, "
+				"only the tiles in the build regions will be built.");
+		}
 	}
 
-	BuildAllTiles(navMesh);
+	BuildAllTiles(navMesh, async, std::move(regions));
 
 	if (m_tool)
 	{
@@ -623,9 +1783,28 @@ void NavMeshTool::RemoveTile(const glm::vec3& pos)
 	const float ts = m_config.tileSize * m_config.cellSize;
 	const int tx = (int)((pos[0] - bmin[0]) / ts);
 	const int ty = (int)((pos[2] - bmin[2]) / ts);
+	m_geom->setOffMeshConnectionBucketSize(ts);
+	m_navMesh->SetConvexVolumeBucketSize(ts);
+
+	beginUndoStep("Remove Tile");
+
+	{
+		auto lock = m_navMesh->BeginTileChange();
 
-	dtTileRef tileRef = navMesh->getTileRefAt(tx, ty, 0);
-	navMesh->removeTile(tileRef, 0, 0);
+		m_undo.TouchTile(*m_navMesh, tx, ty);
+		RemoveTilesAt(*navMesh, tx, ty, m_navMesh.get());
+		m_navMesh->SetTileBuildHash(tx, ty, 0, 0);
+		m_debugCache.Remove(tx, ty);
+
+		for (const NavMesh::AgentNavMesh& agentMesh : m_navMesh->GetAgentNavMeshes())
+		{
+			if (agentMesh.navMesh)
+				RemoveTilesAt(*agentMesh.navMesh, tx, ty, nullptr);
+		}
+	}
+
+	m_navMesh->BuildTileGraph();
+	m_navMesh->BuildLandmarks();
 }
 
 void NavMeshTool::RemoveAllTiles()
@@ -633,6 +1812,11 @@ void NavMeshTool::RemoveAllTiles()
 	std::shared_ptr<dtNavMesh> navMesh = m_navMesh->GetNavMesh();
 	if (!navMesh) return;
 
+	beginUndoStep("Remove All Tiles");
+
+	auto lock = m_navMesh->BeginTileChange();
+	m_debugCache.Clear();
+
 	for (int i = 0; i < navMesh->getMaxTiles(); ++i)
 	{
 		const dtMeshTile* tile = nullptr;
@@ -640,183 +1824,729 @@ void NavMeshTool::RemoveAllTiles()
 		if ((tile = const_cast<const dtNavMesh*>(navMesh.get())->getTile(i))
 			&& tile->header != nullptr)
 		{
+			m_undo.TouchTile(*m_navMesh, tile->header->x, tile->header->y);
+			m_navMesh->SetTileBuildHash(tile->header->x, tile->header->y, tile->header->layer, 0);
 			navMesh->removeTile(navMesh->getTileRef(tile), 0, 0);
 		}
 	}
+
+	for (const NavMesh::AgentNavMesh& agentMesh : m_navMesh->GetAgentNavMeshes())
+	{
+		dtNavMesh* agentNavMesh = agentMesh.navMesh.get();
+		if (!agentNavMesh)
+			continue;
+
+		for (int i = 0; i < agentNavMesh->getMaxTiles(); ++i)
+		{
+			const dtMeshTile* tile = const_cast<const dtNavMesh*>(agentNavMesh)->getTile(i);
+			if (tile && tile->header != nullptr)
+				agentNavMesh->removeTile(agentNavMesh->getTileRef(tile), 0, 0);
+		}
+	}
+
+	lock.unlock();
+
+	m_navMesh->BuildTileGraph();
+	m_navMesh->BuildLandmarks();
 }
 
 void NavMeshTool::CancelBuildAllTiles(bool wait)
 {
 	if (m_buildingTiles)
+	{
+		// the build thread might be waiting on the publisher
+		std::unique_lock<std::mutex> lock(m_builtTilesMutex);
 		m_cancelTiles = true;
+		m_builtTilesCv.notify_all();
+	}
+
+	{
+		// and workers might be waiting for memory
+		std::unique_lock<std::mutex> lock(m_tileMemoryMutex);
+		m_tileMemoryAvailable.notify_all();
+	}
 
 	if (wait && m_buildThread.joinable())
+	{
 		m_buildThread.join();
-}
 
-void NavMeshTool::setOutputPath(const char* output_path)
-{
-	strcpy(m_outputPath, output_path);
-	char buffer[512];
-	sprintf(buffer, "%s\\MQ2Nav", output_path);
-	CreateDirectory(buffer, NULL);
+		// the tiles that were finished before the build stopped are kept
+		publishBuiltTiles();
+	}
 }
 
-void NavMeshTool::resetCommonSettings()
+void NavMeshTool::queueBuiltTile(BuiltTile&& tile)
 {
-	m_config = NavMeshConfig{};
-	m_navMeshDrawFlags = DU_DRAWNAVMESH_OFFMESHCONS | DU_DRAWNAVMESH_CLOSEDLIST;
-}
+	// rebuilds only come from the editor, which publishes every frame
+	const bool publishNow = !m_publishInBackground && tile.generation == 0;
 
-//----------------------------------------------------------------------------
+	{
+		std::unique_lock<std::mutex> lock(m_builtTilesMutex);
+		m_builtTiles.push_back(std::move(tile));
+		++m_tilesUnpublished;
+	}
 
-void NavMeshTool::BuildTile(const glm::vec3& pos)
+	if (publishNow)
+		publishBuiltTiles();
+}
+
+bool NavMeshTool::waitForBuiltTiles()
 {
-	if (!m_geom) return;
+	std::unique_lock<std::mutex> lock(m_builtTilesMutex);
+	m_builtTilesCv.wait(lock, [this]() { return m_tilesUnpublished == 0 || m_cancelTiles; });
 
-	const glm::vec3& bmin = m_navMesh->GetNavMeshBoundsMin();
-	const glm::vec3& bmax = m_navMesh->GetNavMeshBoundsMax();
+	return !m_cancelTiles;
+}
 
-	const float ts = m_config.tileSize * m_config.cellSize;
-	const int tx = (int)((pos[0] - bmin[0]) / ts);
-	const int ty = (int)((pos[2] - bmin[2]) / ts);
+void NavMeshTool::publishBuiltTiles(bool limited)
+{
+	// builds that aren't in the background publish from every worker
+	std::unique_lock<std::mutex> publishLock(m_publishMutex);
 
-	glm::vec3 tileBmin, tileBmax;
-	tileBmin[0] = bmin[0] + tx*ts;
-	tileBmin[1] = bmin[1];
-	tileBmin[2] = bmin[2] + ty*ts;
+	std::vector<BuiltTile> tiles;
+	{
+		std::unique_lock<std::mutex> lock(m_builtTilesMutex);
+		std::swap(tiles, m_builtTiles);
+	}
 
-	tileBmax[0] = bmin[0] + (tx + 1)*ts;
-	tileBmax[1] = bmax[1];
-	tileBmax[2] = bmin[2] + (ty + 1)*ts;
+	limited = limited && m_buildPriority != BuildPriority::Turbo;
+	const auto publishStart = std::chrono::steady_clock::now();
+	size_t published = 0;
 
-	m_ctx->resetLog();
+	// anything reading the tiles from another thread waits until the batch is in
+	std::unique_lock<TileMutex> tilesLock;
+	if (!tiles.empty())
+		tilesLock = m_navMesh->BeginTileChange();
 
-	std::shared_ptr<dtNavMesh> navMesh = m_navMesh->GetNavMesh();
-	if (!navMesh)
+	for (; published < tiles.size(); ++published)
 	{
-		navMesh = std::shared_ptr<dtNavMesh>(dtAllocNavMesh(),
-			[](dtNavMesh* ptr) { dtFreeNavMesh(ptr); });
-
-		m_navMesh->SetNavMesh(navMesh, false);
+		// the rest wait for the next frame
+		if (limited && published > 0 && std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - publishStart).count() >= PUBLISH_FRAME_BUDGET_MS)
+		{
+			break;
+		}
 
-		dtNavMeshParams params;
-		rcVcopy(params.orig, glm::value_ptr(bmin));
-		params.tileWidth = m_config.tileSize * m_config.cellSize;
-		params.tileHeight = m_config.tileSize * m_config.cellSize;
-		params.maxTiles = m_tilesWidth * m_tilesHeight;
-		params.maxPolys = m_maxPolysPerTile * params.maxTiles;
+		BuiltTile& tile = tiles[published];
 
-		dtStatus status;
+		if (tile.generation != 0)
+		{
+			std::unique_lock<std::mutex> lock(m_rebuildMutex);
 
-		status = navMesh->init(&params);
-		if (dtStatusFailed(status))
+			// the tile was edited again while this was building, wait for the newer one
+			auto iter = m_tileRebuilds.find(TileRebuildKey(tile.x, tile.y));
+			if (iter == m_tileRebuilds.end() || iter->second.generation != tile.generation)
+			{
+				freeTileLayers(tile.data, tile.otherLayers);
+				for (AgentTile& agentTile : tile.agentTiles)
+					freeTileLayers(agentTile.data, agentTile.otherLayers);
+				continue;
+			}
+
+			m_tileRebuilds.erase(iter);
+			m_tileGraphPending = true;
+		}
+
+		BuildStageTimer timer(&tile.timings);
+		timer.Start(BuildStage::AddTile);
+
+		// saved for undo along with the agent meshes, if an edit is being recorded
+		if (tile.navMesh == m_navMesh->GetNavMesh())
+			m_undo.TouchTile(*m_navMesh, tile.x, tile.y);
+
+		// Remove any previous data (navmesh owns and deletes the data).
+		RemoveTilesAt(*tile.navMesh, tile.x, tile.y, tile.pruned ? nullptr : m_navMesh.get());
+
+		if (!tile.pruned)
 		{
-			m_ctx->log(RC_LOG_ERROR, "buildTiledNavigation: Could not init navmesh.");
-			return;
+			m_navMesh->SetTileBuildHash(tile.x, tile.y, 0, tile.hash);
+			storeTileLayers(tile.x, tile.y, tile.layers);
+
+			// every layer of the tile is built from the same inputs
+			for (const TileLayerData& layer : tile.otherLayers)
+			{
+				const dtMeshHeader* header = reinterpret_cast<const dtMeshHeader*>(layer.data);
+				m_navMesh->SetTileBuildHash(tile.x, tile.y, header->layer, tile.hash);
+			}
+		}
+
+		// Let the navmesh own the data.
+		addTileLayers(*tile.navMesh, tile.data, tile.dataSize, tile.otherLayers);
+
+		// the same tile in the meshes of the other agent profiles
+		for (AgentTile& agentTile : tile.agentTiles)
+		{
+			RemoveTilesAt(*agentTile.navMesh, tile.x, tile.y, nullptr);
+			addTileLayers(*agentTile.navMesh, agentTile.data, agentTile.dataSize, agentTile.otherLayers);
 		}
+
+		timer.Stop();
+
+		if (!tile.pruned)
+			m_buildProfiler.AddTile(tile.timings);
 	}
 
-	int dataSize = 0;
-	unsigned char* data = buildTileMesh(tx, ty, glm::value_ptr(tileBmin),
-		glm::value_ptr(tileBmax), dataSize);
+	// saved in the file summary, so that meshes built from old zone files stand out
+	if (!tiles.empty() && m_geom)
+		m_navMesh->SetBuildSource(m_geom->getSourceHash());
+
+	if (tilesLock)
+		tilesLock.unlock();
+
+	if (!tiles.empty())
+	{
+		m_navMesh->OnNavMeshTilesChanged();
+
+		std::unique_lock<std::mutex> lock(m_builtTilesMutex);
+		m_tilesUnpublished -= (int)published;
+
+		// ahead of whatever was queued since, so tiles go in in the order they were built
+		m_builtTiles.insert(m_builtTiles.begin(), std::make_move_iterator(tiles.begin() + published),
+			std::make_move_iterator(tiles.end()));
+		m_builtTilesCv.notify_all();
+	}
 
-	// Remove any previous data (navmesh owns and deletes the data).
-	dtTileRef tileRef = navMesh->getTileRefAt(tx, ty, 0);
-	navMesh->removeTile(tileRef, 0, 0);
+	// a cancelled build and rebuilds leave the tile graph to us
+	if (m_tileGraphPending && !m_buildingTiles && getPendingRebuilds() == 0 && published == tiles.size())
+	{
+		m_tileGraphPending = false;
+		m_navMesh->BuildTileGraph();
+		m_navMesh->BuildLandmarks();
+	}
+}
 
-	// Add tile, or leave the location empty.
+void NavMeshTool::addTileLayers(dtNavMesh& navMesh, uint8_t* data, int dataSize,
+	std::vector<TileLayerData>& otherLayers)
+{
 	if (data)
 	{
-		// Let the navmesh own the data.
-		dtStatus status = navMesh->addTile(data, dataSize, DT_TILE_FREE_DATA, 0, 0);
+		dtStatus status = navMesh.addTile(data, dataSize, DT_TILE_FREE_DATA, 0, 0);
 		if (dtStatusFailed(status))
+		{
 			dtFree(data);
+		}
+	}
+
+	for (TileLayerData& layer : otherLayers)
+	{
+		dtStatus status = navMesh.addTile(layer.data, layer.dataSize, DT_TILE_FREE_DATA, 0, 0);
+		if (dtStatusFailed(status))
+		{
+			dtFree(layer.data);
+		}
+	}
+
+	otherLayers.clear();
+}
+
+void NavMeshTool::freeTileLayers(uint8_t* data, std::vector<TileLayerData>& otherLayers)
+{
+	dtFree(data);
+
+	for (TileLayerData& layer : otherLayers)
+		dtFree(layer.data);
+
+	otherLayers.clear();
+}
+
+void NavMeshTool::setOutputPath(const char* output_path)
+{
+	strcpy(m_outputPath, output_path);
+	char buffer[512];
+	sprintf(buffer, "%s\\MQ2Nav", output_path);
+	CreateDirectory(buffer, NULL);
+}
+
+void NavMeshTool::resetCommonSettings()
+{
+	m_config = NavMeshConfig{};
+	m_navMeshDrawFlags = DU_DRAWNAVMESH_OFFMESHCONS | DU_DRAWNAVMESH_CLOSEDLIST;
+}
+
+//----------------------------------------------------------------------------
+
+void NavMeshTool::BuildTile(const glm::vec3& pos)
+{
+	if (!m_geom)
+	{
+		requestGeometry();
+		return;
 	}
 
-	m_ctx->dumpLog("Build Tile (%d,%d):", tx, ty);
+	const glm::vec3& bmin = m_navMesh->GetNavMeshBoundsMin();
+	const glm::vec3& bmax = m_navMesh->GetNavMeshBoundsMax();
+
+	const float ts = m_config.tileSize * m_config.cellSize;
+	const int tx = (int)((pos[0] - bmin[0]) / ts);
+	const int ty = (int)((pos[2] - bmin[2]) / ts);
+
+	glm::vec3 tileBmin, tileBmax;
+	tileBmin[0] = bmin[0] + tx*ts;
+	tileBmin[1] = bmin[1];
+	tileBmin[2] = bmin[2] + ty*ts;
+
+	tileBmax[0] = bmin[0] + (tx + 1)*ts;
+	tileBmax[1] = bmax[1];
+	tileBmax[2] = bmin[2] + (ty + 1)*ts;
+
+	m_ctx->resetLog();
+
+	std::shared_ptr<dtNavMesh> navMesh = m_navMesh->GetNavMesh();
+	if (!navMesh)
+	{
+		navMesh = std::shared_ptr<dtNavMesh>(dtAllocNavMesh(),
+			[](dtNavMesh* ptr) { dtFreeNavMesh(ptr); });
+
+		m_navMesh->SetNavMesh(navMesh, false);
+
+		dtNavMeshParams params;
+		rcVcopy(params.orig, glm::value_ptr(bmin));
+		params.tileWidth = m_config.tileSize * m_config.cellSize;
+		params.tileHeight = m_config.tileSize * m_config.cellSize;
+		params.maxTiles = m_tilesWidth * m_tilesHeight;
+		if (m_config.layeredTiles)
+			params.maxTiles *= TILECACHE_EXPECTED_LAYERS_PER_TILE;
+		params.maxPolys = m_maxPolysPerTile; // per tile
+
+		dtStatus status;
+
+		status = navMesh->init(&params);
+		if (dtStatusFailed(status))
+		{
+			m_ctx->log(RC_LOG_ERROR, "buildTiledNavigation: Could not init navmesh.");
+			return;
+		}
+	}
+
+	beginUndoStep("Build Tile");
+
+	// the tile is swapped in by publishBuiltTiles once it's built
+	requestTileRebuild(tx, ty, glm::value_ptr(tileBmin), glm::value_ptr(tileBmax));
 }
 
 void NavMeshTool::RebuildTile(dtTileRef tileRef)
 {
-	if (!m_geom) return;
+	if (!m_geom)
+	{
+		// edits of a mesh opened without its geometry are built once it's in
+		if (m_requestGeometry)
+		{
+			m_geometryRebuilds.push_back(tileRef);
+			requestGeometry();
+		}
+		return;
+	}
+
 	const auto& navMesh = m_navMesh->GetNavMesh();
 	if (!navMesh) return;
 
 	const dtMeshTile* tile = navMesh->getTileByRef(tileRef);
 	if (!tile || !tile->header) return;
-	
-	auto bmin = tile->header->bmin;
-	auto bmax = tile->header->bmax;
 
-	int dataSize = 0;
-	unsigned char* data = buildTileMesh(tile->header->x, tile->header->y, bmin, bmax, dataSize);
+	requestTileRebuild(tile->header->x, tile->header->y, tile->header->bmin, tile->header->bmax);
+}
 
-	navMesh->removeTile(tileRef, 0, 0);
+void NavMeshTool::RebuildTiles(const std::vector<dtTileRef>& tiles)
+{
+	for (dtTileRef tileRef : tiles)
+		RebuildTile(tileRef);
+}
 
-	if (data)
+void NavMeshTool::setCameraPos(const glm::vec3& pos)
+{
+	std::unique_lock<std::mutex> lock(m_rebuildMutex);
+	m_cameraPos = pos;
+}
+
+int NavMeshTool::getPendingRebuilds() const
+{
+	std::unique_lock<std::mutex> lock(m_rebuildMutex);
+	return (int)m_tileRebuilds.size();
+}
+
+void NavMeshTool::waitForRebuilds()
+{
+	// rebuilds are only published from here, waiting on the workers isn't enough
+	while (getPendingRebuilds() > 0)
 	{
-		dtStatus status = navMesh->addTile(data, dataSize, DT_TILE_FREE_DATA, 0, 0);
-		if (dtStatusFailed(status))
-			dtFree(data);
+		publishBuiltTiles();
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+}
+
+int NavMeshTool::validateNavMesh()
+{
+	m_invalidTiles.clear();
+
+	auto navMesh = m_navMesh->GetNavMesh();
+	if (!navMesh)
+		return 0;
+
+	std::vector<NavMeshTileIssues> tiles;
+	{
+		auto tilesLock = m_navMesh->LockTiles();
+		TaskScheduler scheduler(m_buildThreadCount, TaskScheduler::Priority::BelowNormal);
+
+		tiles = ValidateNavMesh(*navMesh, scheduler);
 	}
 
+	if (tiles.empty())
+		return 0;
+
+	m_ctx->log(RC_LOG_WARNING, "Validate: %d tiles have issues, rebuilding them may fix them", (int)tiles.size());
+
+	for (const NavMeshTileIssues& tile : tiles)
+		m_invalidTiles.push_back(tile.ref);
+
+	for (size_t t = 0; t < tiles.size(); ++t)
+	{
+		const NavMeshTileIssues& tile = tiles[t];
+		if (t == VALIDATE_MAX_LOGGED_TILES)
+		{
+			m_ctx->log(RC_LOG_WARNING, "  and %d more", (int)(tiles.size() - t));
+			break;
+		}
+
+		std::string issues;
+		for (int i = 0; i < (int)NavMeshIssue::Count; ++i)
+		{
+			if (tile.counts[i] == 0)
+				continue;
+
+			if (!issues.empty())
+				issues += ", ";
+			issues += std::to_string(tile.counts[i]) + " " + GetNavMeshIssueName((NavMeshIssue)i);
+		}
+
+		m_ctx->log(RC_LOG_WARNING, "  tile %d,%d layer %d: %s", tile.x, tile.y, tile.layer, issues.c_str());
+	}
+
+	return (int)tiles.size();
 }
 
-void NavMeshTool::RebuildTiles(const std::vector<dtTileRef>& tiles)
+void NavMeshTool::beginUndoStep(const std::string& label, bool volumes)
 {
-	for (dtTileRef tileRef : tiles)
-		RebuildTile(tileRef);
+	// the tiles of the last edit have to be in before it is closed
+	waitForRebuilds();
+	m_undo.BeginStep(*m_navMesh, label, volumes);
 }
 
-struct TileData
+void NavMeshTool::saveUndoTile(int tx, int ty)
 {
-	unsigned char* data = 0;
-	int length = 0;
-	int x = 0;
-	int y = 0;
-};
+	m_undo.TouchTile(*m_navMesh, tx, ty);
+}
 
-typedef std::shared_ptr<TileData> TileDataPtr;
+bool NavMeshTool::canUndo() const
+{
+	return !m_buildingTiles && m_undo.CanUndo();
+}
 
-class NavmeshUpdaterAgent : public concurrency::agent
+bool NavMeshTool::canRedo() const
 {
-public:
-	explicit NavmeshUpdaterAgent(concurrency::ISource<TileDataPtr>& dataSource,
-		const std::shared_ptr<dtNavMesh>& navMesh)
-		: m_source(dataSource)
-		, m_navMesh(navMesh)
+	return !m_buildingTiles && m_undo.CanRedo();
+}
+
+void NavMeshTool::undo()
+{
+	applyUndoStep(true);
+}
+
+void NavMeshTool::redo()
+{
+	applyUndoStep(false);
+}
+
+void NavMeshTool::applyUndoStep(bool undo)
+{
+	if (m_buildingTiles)
+		return;
+
+	// tools can hold on to polys and volumes that are about to go away
+	if (m_tool)
+		m_tool->reset();
+
+	waitForRebuilds();
+
+	std::vector<std::pair<int, int>> tiles;
+	if (!(undo ? m_undo.Undo(*m_navMesh, tiles) : m_undo.Redo(*m_navMesh, tiles)))
+		return;
+
+	for (const auto& tile : tiles)
+		m_debugCache.Remove(tile.first, tile.second);
+
+	m_navMesh->OnNavMeshTilesChanged();
+	m_navMesh->BuildTileGraph();
+	m_navMesh->BuildLandmarks();
+}
+
+TaskScheduler& NavMeshTool::getScheduler()
+{
+	std::unique_lock<std::mutex> lock(m_schedulerMutex);
+
+	if (m_scheduler && (m_schedulerThreadCount != m_buildThreadCount || m_schedulerPriority != m_buildPriority)
+		&& !m_buildingTiles && getPendingRebuilds() == 0)
+	{
+		m_scheduler.reset();
+	}
+
+	if (!m_scheduler)
+	{
+		int threadCount = m_buildThreadCount;
+		TaskScheduler::Priority priority = TaskScheduler::Priority::Normal;
+
+		switch (m_buildPriority)
+		{
+		case BuildPriority::Background:
+			// one core is left for the main loop
+			if (threadCount == 0)
+				threadCount = std::max<int>(1, std::thread::hardware_concurrency() - 1);
+			priority = TaskScheduler::Priority::BelowNormal;
+			break;
+		case BuildPriority::Turbo:
+			priority = TaskScheduler::Priority::AboveNormal;
+			break;
+		default:
+			break;
+		}
+
+		m_scheduler = std::make_unique<TaskScheduler>(threadCount, priority);
+		m_schedulerThreadCount = m_buildThreadCount;
+		m_schedulerPriority = m_buildPriority;
+	}
+
+	return *m_scheduler;
+}
+
+size_t NavMeshTool::reserveTileMemory()
+{
+	const size_t bytes = m_tileMemoryEstimate;
+	if (m_tileMemoryBudget == 0)
+		return 0;
+
+	std::unique_lock<std::mutex> lock(m_tileMemoryMutex);
+
+	// a tile that is larger than the budget on its own still gets built, but
+	// only once nothing else is building.
+	auto available = [this, bytes]()
+	{
+		return m_cancelTiles || m_tileMemoryUsed == 0
+			|| m_tileMemoryUsed + bytes <= m_tileMemoryBudget;
+	};
+
+	if (!available())
+	{
+		// the arena of a waiting worker is memory that the others could use
+		lock.unlock();
+		RecastArena::Trim();
+		lock.lock();
+
+		m_tileMemoryAvailable.wait(lock, available);
+	}
+
+	m_tileMemoryUsed += bytes;
+	return bytes;
+}
+
+void NavMeshTool::releaseTileMemory(size_t bytes)
+{
+	// the tiles after this one are expected to need as much as the largest so far
+	const size_t used = RecastArena::GetLastScopeSize();
+	size_t estimate = m_tileMemoryEstimate;
+	while (used > estimate && !m_tileMemoryEstimate.compare_exchange_weak(estimate, used)) {}
+
+	if (!bytes)
+		return;
+
 	{
+		std::unique_lock<std::mutex> lock(m_tileMemoryMutex);
+		m_tileMemoryUsed -= bytes;
 	}
 
-protected:
-	virtual void run() override
+	m_tileMemoryAvailable.notify_all();
+}
+
+std::vector<NavMeshTool::AgentTile> NavMeshTool::getAgentTiles() const
+{
+	std::vector<AgentTile> agentTiles;
+
+	const std::vector<NavMesh::AgentNavMesh>& agentMeshes = m_navMesh->GetAgentNavMeshes();
+	if (AgentMeshesMatch(agentMeshes, m_config.agentProfiles))
 	{
-		TileDataPtr data = receive(m_source);
-		while (data != nullptr)
+		agentTiles.resize(agentMeshes.size());
+		for (size_t i = 0; i < agentMeshes.size(); ++i)
+			agentTiles[i].navMesh = agentMeshes[i].navMesh;
+	}
+
+	return agentTiles;
+}
+
+void NavMeshTool::requestTileRebuild(int tx, int ty, const float* bmin, const float* bmax)
+{
+	std::shared_ptr<dtNavMesh> navMesh = m_navMesh->GetNavMesh();
+	if (!navMesh) return;
+
+	// the volumes buildTileMesh would find, including the border
+	const int walkableRadius = (int)ceilf(GetLargestAgentRadius(m_config) / m_config.cellSize);
+	const float border = (walkableRadius + 3) * m_config.cellSize;
+
+	float vbmin[3], vbmax[3];
+	rcVcopy(vbmin, bmin);
+	rcVcopy(vbmax, bmax);
+	vbmin[0] -= border;
+	vbmin[2] -= border;
+	vbmax[0] += border;
+	vbmax[2] += border;
+
+	std::vector<const ConvexVolume*> volumes;
+	m_navMesh->GetConvexVolumesInBounds(vbmin, vbmax, volumes);
+
+	uint64_t hash = computeTileHash(bmin, bmax);
+	bool schedule;
+
+	{
+		std::unique_lock<std::mutex> lock(m_rebuildMutex);
+
+		TileRebuild& rebuild = m_tileRebuilds[TileRebuildKey(tx, ty)];
+		rebuild.navMesh = navMesh;
+		rebuild.x = tx;
+		rebuild.y = ty;
+		rebuild.bmin = glm::make_vec3(bmin);
+		rebuild.bmax = glm::make_vec3(bmax);
+		rebuild.hash = hash;
+		rebuild.generation = ++m_rebuildGeneration;
+
+		rebuild.volumes.clear();
+		for (const ConvexVolume* vol : volumes)
+			rebuild.volumes.push_back(*vol);
+
+		rebuild.agentTiles = getAgentTiles();
+
+		// already waiting for a worker, it'll pick up the new request
+		schedule = !rebuild.queued;
+		rebuild.queued = true;
+	}
+
+	if (schedule)
+	{
+		getScheduler().Run([this]() { runTileRebuild(); });
+	}
+}
+
+void NavMeshTool::runTileRebuild()
+{
+	TileRebuild rebuild;
+
+	{
+		std::unique_lock<std::mutex> lock(m_rebuildMutex);
+
+		auto best = m_tileRebuilds.end();
+		float bestDistSq = FLT_MAX;
+
+		for (auto iter = m_tileRebuilds.begin(); iter != m_tileRebuilds.end(); ++iter)
 		{
-			// Remove any previous data (navmesh owns and deletes the data).
-			m_navMesh->removeTile(m_navMesh->getTileRefAt(data->x, data->y, 0), 0, 0);
+			if (!iter->second.queued)
+				continue;
 
-			// Let the navmesh own the data.
-			dtStatus status = m_navMesh->addTile(data->data, data->length, DT_TILE_FREE_DATA, 0, 0);
-			if (dtStatusFailed(status))
+			glm::vec3 center = (iter->second.bmin + iter->second.bmax) * 0.5f;
+			float dx = center.x - m_cameraPos.x;
+			float dz = center.z - m_cameraPos.z;
+			float distSq = dx * dx + dz * dz;
+
+			if (distSq < bestDistSq)
 			{
-				dtFree(data->data);
+				best = iter;
+				bestDistSq = distSq;
 			}
-
-			data = receive(m_source);
 		}
 
-		done();
+		if (best == m_tileRebuilds.end())
+			return;
+
+		best->second.queued = false;
+		rebuild = best->second;
 	}
 
-private:
-	concurrency::ISource<TileDataPtr>& m_source;
-	std::shared_ptr<dtNavMesh> m_navMesh;
-};
+	BuiltTile built;
+	built.navMesh = rebuild.navMesh;
+	built.x = rebuild.x;
+	built.y = rebuild.y;
+	built.hash = rebuild.hash;
+	built.generation = rebuild.generation;
+	built.agentTiles = std::move(rebuild.agentTiles);
+
+	// an edit of a single tile spreads the tile's own stages over the workers it
+	// isn't using
+	const int threadCount = (!m_buildingTiles && getPendingRebuilds() <= 1)
+		? getScheduler().GetThreadCount() : 1;
+
+	built.data = buildTileMesh(rebuild.x, rebuild.y, glm::value_ptr(rebuild.bmin),
+		glm::value_ptr(rebuild.bmax), built.dataSize, &built.timings, &built.layers,
+		&rebuild.volumes, nullptr, &built.agentTiles, &built.otherLayers, threadCount);
+
+	queueBuiltTile(std::move(built));
+}
+
+std::vector<NavMeshTool::BuildRegion> NavMeshTool::GetRegionsAlongPath(
+	const std::vector<glm::vec3>& points, float radius)
+{
+	std::vector<BuildRegion> regions;
+	if (points.empty())
+		return regions;
+
+	// a box around each segment, so a long diagonal path doesn't pull in every
+	// tile of the square it spans.
+	const glm::vec3 extents(radius, 0.0f, radius);
+	if (points.size() == 1)
+	{
+		regions.push_back({ points[0] - extents, points[0] + extents });
+		return regions;
+	}
+
+	regions.reserve(points.size() - 1);
+	for (size_t i = 1; i < points.size(); ++i)
+	{
+		regions.push_back({ glm::min(points[i - 1], points[i]) - extents,
+			glm::max(points[i - 1], points[i]) + extents });
+	}
+
+	return regions;
+}
 
-void NavMeshTool::BuildAllTiles(const std::shared_ptr<dtNavMesh>& navMesh, bool async)
+// regions only cover the tiles under them, heights are ignored.
+static bool TileOverlapsRegions(const glm::vec3& tileBmin, const glm::vec3& tileBmax,
+	const std::vector<NavMeshTool::BuildRegion>& regions)
+{
+	for (const NavMeshTool::BuildRegion& region : regions)
+	{
+		if (tileBmin.x <= region.bmax.x && tileBmax.x >= region.bmin.x
+			&& tileBmin.z <= region.bmax.z && tileBmax.z >= region.bmin.z)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// interleave the bits of x and y so that tiles that are close together on the
+// map are also close together in the build order.
+static uint32_t MortonCode(uint32_t x, uint32_t y)
+{
+	auto spread = [](uint32_t v)
+	{
+		v &= 0x0000ffff;
+		v = (v | (v << 8)) & 0x00ff00ff;
+		v = (v | (v << 4)) & 0x0f0f0f0f;
+		v = (v | (v << 2)) & 0x33333333;
+		v = (v | (v << 1)) & 0x55555555;
+		return v;
+	};
+
+	return spread(x) | (spread(y) << 1);
+}
+
+void NavMeshTool::BuildAllTiles(const std::shared_ptr<dtNavMesh>& navMesh, bool async,
+	std::vector<BuildRegion> regions)
 {
 	if (!m_geom) return;
 	if (m_buildingTiles) return;
@@ -828,9 +2558,12 @@ void NavMeshTool::BuildAllTiles(const std::shared_ptr<dtNavMesh>& navMesh, bool
 		if (m_buildThread.joinable())
 			m_buildThread.join();
 
-		m_buildThread = std::thread([this, navMesh]()
+		// tiles are handed to the main loop instead of being added by the workers
+		m_publishInBackground = true;
+
+		m_buildThread = std::thread([this, navMesh, regions = std::move(regions)]() mutable
 		{
-			BuildAllTiles(navMesh, false);
+			BuildAllTiles(navMesh, false, std::move(regions));
 		});
 		return;
 	}
@@ -838,179 +2571,769 @@ void NavMeshTool::BuildAllTiles(const std::shared_ptr<dtNavMesh>& navMesh, bool
 	m_buildingTiles = true;
 	m_cancelTiles = false;
 
-	const glm::vec3& bmin = m_navMesh->GetNavMeshBoundsMin();
-	const glm::vec3& bmax = m_navMesh->GetNavMeshBoundsMax();
-	int gw = 0, gh = 0;
-	rcCalcGridSize(&bmin[0], &bmax[0], m_config.cellSize, &gw, &gh);
-	const int ts = (int)m_config.tileSize;
-	const int tw = (gw + ts - 1) / ts;
-	const int th = (gh + ts - 1) / ts;
-	const float tcs = m_config.tileSize * m_config.cellSize;
+	const glm::vec3& bmin = m_navMesh->GetNavMeshBoundsMin();
+	const glm::vec3& bmax = m_navMesh->GetNavMeshBoundsMax();
+	int gw = 0, gh = 0;
+	rcCalcGridSize(&bmin[0], &bmax[0], m_config.cellSize, &gw, &gh);
+	const int ts = (int)m_config.tileSize;
+	const int tw = (gw + ts - 1) / ts;
+	const int th = (gh + ts - 1) / ts;
+	const float tcs = m_config.tileSize * m_config.cellSize;
+
+	m_tilesBuilt = 0;
+	m_buildProfiler.Reset();
+	m_geom->setOffMeshConnectionBucketSize(tcs);
+
+	const size_t tileCells = rcSqr(ts + 2 * ((int)ceilf(GetLargestAgentRadius(m_config) / m_config.cellSize) + 3));
+	m_tileMemoryEstimate = tileCells * TILE_MEMORY_PER_CELL;
+	m_navMesh->SetConvexVolumeBucketSize(tcs);
+
+	// Start the build process.
+	m_ctx->startTimer(RC_TIMER_TEMP);
+
+	// build tiles in z-order so that each worker stays on a compact part of the
+	// map, and of the chunky mesh.
+	// with build regions, the tiles outside of them are left as they are.
+	std::vector<std::pair<int, int>> tileOrder;
+	tileOrder.reserve(tw * th);
+	for (int x = 0; x < tw; x++)
+	{
+		for (int y = 0; y < th; y++)
+		{
+			if (!regions.empty())
+			{
+				glm::vec3 tileBmin(bmin[0] + x*tcs, bmin[1], bmin[2] + y*tcs);
+				glm::vec3 tileBmax(bmin[0] + (x + 1)*tcs, bmax[1], bmin[2] + (y + 1)*tcs);
+				if (!TileOverlapsRegions(tileBmin, tileBmax, regions))
+					continue;
+			}
+
+			tileOrder.emplace_back(x, y);
+		}
+	}
+
+	m_tilesToBuild = (int)tileOrder.size();
+
+	std::sort(tileOrder.begin(), tileOrder.end(),
+		[](const std::pair<int, int>& a, const std::pair<int, int>& b)
+	{
+		return MortonCode(a.first, a.second) < MortonCode(b.first, b.second);
+	});
+
+	std::vector<TaskScheduler::Task> tasks;
+	tasks.reserve(tileOrder.size());
+	m_tilesSkipped = 0;
+	m_polysBeforeMerge = 0;
+	m_polysAfterMerge = 0;
+
+	const std::vector<AgentTile> agentTiles = getAgentTiles();
+
+	// tiles built without detail, rebuilt with it once the build is done
+	const bool coarseDetail = m_deferDetail;
+	std::vector<std::pair<int, int>> coarseTiles;
+
+	for (const auto& tile : tileOrder)
+	{
+		int x = tile.first;
+		int y = tile.second;
+
+		glm::vec3 tileBmin, tileBmax;
+		tileBmin[0] = bmin[0] + x*tcs;
+		tileBmin[1] = bmin[1];
+		tileBmin[2] = bmin[2] + y*tcs;
+
+		tileBmax[0] = bmin[0] + (x + 1)*tcs;
+		tileBmax[1] = bmax[1];
+		tileBmax[2] = bmin[2] + (y + 1)*tcs;
+
+		// nothing that goes into this tile has changed since it was last built. Tiles
+		// with polys removed by pruning are built whole again, the seeds might have moved.
+		uint64_t hash = computeTileHash(glm::value_ptr(tileBmin), glm::value_ptr(tileBmax));
+		if (hash == m_navMesh->GetTileBuildHash(x, y, 0)
+			&& !(m_config.pruneUnreachable && m_navMesh->GetPrunedTile(x, y, 0, hash)))
+		{
+			++m_tilesBuilt;
+			++m_tilesSkipped;
+			continue;
+		}
+
+		if (coarseDetail)
+			coarseTiles.push_back(tile);
+
+		tasks.push_back([this, x, y, tileBmin, tileBmax, hash, coarseDetail, &navMesh, &agentTiles]()
+		{
+			MQ2NAV_PROFILE_ZONE("BuildAllTiles: tile");
+
+			// waits while the other workers are using up the memory budget
+			const size_t memory = reserveTileMemory();
+			if (m_cancelTiles)
+			{
+				releaseTileMemory(memory);
+				return;
+			}
+
+			++m_tilesBuilt;
+
+			BuiltTile built;
+			built.navMesh = navMesh;
+			built.x = x;
+			built.y = y;
+			// a coarse tile isn't what the settings build, so it has no hash and
+			// the next build does it again if the detail never makes it in
+			built.hash = coarseDetail ? 0 : hash;
+			built.agentTiles = agentTiles;
+			built.data = buildTileMesh(x, y, glm::value_ptr(tileBmin),
+				glm::value_ptr(tileBmax), built.dataSize, &built.timings, &built.layers,
+				nullptr, nullptr, &built.agentTiles, &built.otherLayers, 1, coarseDetail);
+
+			releaseTileMemory(memory);
+
+			queueBuiltTile(std::move(built));
+		});
+	}
+
+	// pruning starts over from the whole mesh. A region build only has part of
+	// it to flood, so the pruned tiles are left as they are.
+	const bool prune = m_config.pruneUnreachable && regions.empty();
+	if (prune)
+		m_navMesh->ClearPrunedTiles();
+
+	bool published;
+	{
+		TaskScheduler& scheduler = getScheduler();
+		scheduler.Run(std::move(tasks));
+		scheduler.Wait();
+
+		// reachability can only be worked out once every tile is linked up
+		published = waitForBuiltTiles();
+		if (prune && published)
+		{
+			pruneUnreachablePolys(navMesh, scheduler);
+			published = waitForBuiltTiles();
+		}
+	}
+
+	// portals between tiles for routing long paths, and the landmark distances
+	// that guide searches. A cancelled build might still have tiles waiting, the
+	// publisher does it once they're in.
+	if (published)
+	{
+		m_navMesh->BuildTileGraph();
+		m_navMesh->BuildLandmarks();
+
+		if (!coarseTiles.empty())
+		{
+			m_ctx->log(RC_LOG_PROGRESS, "Build All Tiles: Building detail for %d tiles", (int)coarseTiles.size());
+
+			for (const auto& tile : coarseTiles)
+			{
+				glm::vec3 tileBmin(bmin[0] + tile.first*tcs, bmin[1], bmin[2] + tile.second*tcs);
+				glm::vec3 tileBmax(bmin[0] + (tile.first + 1)*tcs, bmax[1], bmin[2] + (tile.second + 1)*tcs);
+				requestTileRebuild(tile.first, tile.second, glm::value_ptr(tileBmin), glm::value_ptr(tileBmax));
+			}
+		}
+	}
+	else
+	{
+		m_tileGraphPending = true;
+	}
+
+	// Start the build process.
+	m_ctx->stopTimer(RC_TIMER_TEMP);
+
+	m_totalBuildTimeMs = m_ctx->getAccumulatedTime(RC_TIMER_TEMP) / 1000.0f;
+
+	if (m_tilesSkipped > 0)
+	{
+		m_ctx->log(RC_LOG_PROGRESS, "Build All Tiles: %d of %d tiles unchanged", m_tilesSkipped.load(),
+			(int)tileOrder.size());
+	}
+
+	if (m_polysBeforeMerge > 0)
+	{
+		m_ctx->log(RC_LOG_PROGRESS, "Build All Tiles: Merged %d polys into %d", m_polysBeforeMerge.load(),
+			m_polysAfterMerge.load());
+	}
+
+	m_publishInBackground = false;
+	m_buildingTiles = false;
+}
+
+void NavMeshTool::pruneUnreachablePolys(const std::shared_ptr<dtNavMesh>& navMesh,
+	TaskScheduler& scheduler)
+{
+	// layered tiles are built without a recast poly mesh to take the polys out of
+	if (m_config.layeredTiles)
+	{
+		m_ctx->log(RC_LOG_WARNING, "Prune Unreachable: Layered tiles can't be pruned, nothing was pruned.");
+		return;
+	}
+
+	const std::vector<glm::vec3>& seeds = m_navMesh->GetPruneSeeds();
+	if (seeds.empty())
+	{
+		m_ctx->log(RC_LOG_WARNING, "Prune Unreachable: No seeds have been placed, nothing was pruned.");
+		return;
+	}
+
+	std::vector<dtPolyRef> starts;
+	{
+		deleting_unique_ptr<dtNavMeshQuery> query(dtAllocNavMeshQuery(),
+			[](dtNavMeshQuery* q) { dtFreeNavMeshQuery(q); });
+		if (!query || dtStatusFailed(query->init(navMesh.get(), 256)))
+		{
+			m_ctx->log(RC_LOG_ERROR, "Prune Unreachable: Could not init navmesh query.");
+			return;
+		}
+
+		const float ext[3] = { 2, 4, 2 };
+		dtQueryFilter filter;
+
+		for (const glm::vec3& seed : seeds)
+		{
+			dtPolyRef ref = 0;
+			query->findNearestPoly(glm::value_ptr(seed), ext, &filter, &ref, nullptr);
+			if (ref)
+				starts.push_back(ref);
+		}
+	}
+
+	if (starts.empty())
+	{
+		m_ctx->log(RC_LOG_WARNING, "Prune Unreachable: None of the seeds are on the mesh, nothing was pruned.");
+		return;
+	}
+
+	NavMeshFlood flood(navMesh.get());
+	if (!flood.flood(starts, scheduler, &m_cancelTiles))
+		return;
+
+	// the unvisited polys of each tile. Off-mesh connections are left for detour
+	// to drop along with the polys they connect.
+	std::vector<std::pair<const dtMeshTile*, std::vector<uint16_t>>> prunedTiles;
+	flood.forEachUnvisited([&](const dtMeshTile* tile, int poly)
+	{
+		if (poly >= tile->header->offMeshBase)
+			return;
+
+		if (prunedTiles.empty() || prunedTiles.back().first != tile)
+			prunedTiles.emplace_back(tile, std::vector<uint16_t>());
+		prunedTiles.back().second.push_back((uint16_t)poly);
+	});
+
+	if (prunedTiles.empty())
+		return;
+
+	const glm::vec3& bmin = m_navMesh->GetNavMeshBoundsMin();
+	const glm::vec3& bmax = m_navMesh->GetNavMeshBoundsMax();
+	const float tcs = m_config.tileSize * m_config.cellSize;
+
+	std::vector<TaskScheduler::Task> tasks;
+	tasks.reserve(prunedTiles.size());
+	int prunedPolys = 0;
+
+	for (auto& entry : prunedTiles)
+	{
+		const int x = entry.first->header->x;
+		const int y = entry.first->header->y;
+		prunedPolys += (int)entry.second.size();
+
+		glm::vec3 tileBmin(bmin[0] + x*tcs, bmin[1], bmin[2] + y*tcs);
+		glm::vec3 tileBmax(bmin[0] + (x + 1)*tcs, bmax[1], bmin[2] + (y + 1)*tcs);
+
+		// the tile is built again from the same inputs, with these polys left out.
+		// Tiles that are still waiting for their detail don't have a hash yet.
+		NavMesh::PrunedTile pruned;
+		pruned.buildHash = m_navMesh->GetTileBuildHash(x, y, 0);
+		if (!pruned.buildHash)
+			pruned.buildHash = computeTileHash(glm::value_ptr(tileBmin), glm::value_ptr(tileBmax));
+		pruned.polys = std::move(entry.second);
+		m_navMesh->SetPrunedTile(x, y, 0, std::move(pruned));
+
+		tasks.push_back([this, x, y, tileBmin, tileBmax, &navMesh]()
+		{
+			MQ2NAV_PROFILE_ZONE("BuildAllTiles: pruned tile");
+
+			const size_t memory = reserveTileMemory();
+			if (m_cancelTiles)
+			{
+				releaseTileMemory(memory);
+				return;
+			}
+
+			BuiltTile built;
+			built.navMesh = navMesh;
+			built.x = x;
+			built.y = y;
+			built.pruned = true;
+			built.data = buildTileMesh(x, y, glm::value_ptr(tileBmin),
+				glm::value_ptr(tileBmax), built.dataSize);
+
+			releaseTileMemory(memory);
+
+			queueBuiltTile(std::move(built));
+		});
+	}
+
+	const int tileCount = (int)tasks.size();
+	scheduler.Run(std::move(tasks));
+	scheduler.Wait();
+
+	m_ctx->log(RC_LOG_PROGRESS, "Prune Unreachable: Removed %d of %d polys from %d tiles", prunedPolys,
+		flood.getVisited().getPolyCount(), tileCount);
+}
+
+// Spans whose top is under water become water area, so paths through them can be
+// costed or avoided. Water maps use eq axes ordered y, x, z, and recast has y up.
+static void MarkWaterSpans(const WaterMap& waterMap, rcHeightfield& hf)
+{
+	for (int y = 0; y < hf.height; ++y)
+	{
+		for (int x = 0; x < hf.width; ++x)
+		{
+			const float px = hf.bmin[0] + (x + 0.5f) * hf.cs;
+			const float pz = hf.bmin[2] + (y + 0.5f) * hf.cs;
+
+			for (rcSpan* s = hf.spans[x + y * hf.width]; s; s = s->next)
+			{
+				if (s->area == RC_NULL_AREA)
+					continue;
+
+				// just above the surface of the span, where the feet would be
+				const float py = hf.bmin[1] + (s->smax + 1) * hf.ch;
+
+				WaterRegionType type = waterMap.ReturnRegionType(pz, px, py);
+				if (type == RegionTypeWater || type == RegionTypeVWater)
+					s->area = static_cast<uint8_t>(PolyArea::Water);
+			}
+		}
+	}
+}
+
+deleting_unique_ptr<rcHeightfield> NavMeshTool::rasterizeGeometry(const rcConfig& cfg,
+	TileBuildTimings* timings, int threadCount) const
+{
+	BuildStageTimer timer(timings);
+	timer.Start(BuildStage::Rasterize);
+
+	// Allocate voxel heightfield where we rasterize our input data to.
+	deleting_unique_ptr<rcHeightfield> solid(rcAllocHeightfield(),
+		[](rcHeightfield* hf) { rcFreeHeightField(hf); });
+
+	if (!rcCreateHeightfield(m_ctx, *solid, cfg.width, cfg.height, cfg.bmin, cfg.bmax, cfg.cs, cfg.ch))
+	{
+		m_ctx->log(RC_LOG_ERROR, "buildNavigation: Could not create solid heightfield.");
+		return 0;
+	}
+
+	const float* verts = m_geom->getMeshLoader()->getVerts();
+	const int nverts = m_geom->getMeshLoader()->getVertCount();
+	const rcChunkyTriMesh* chunkyMesh = m_geom->getChunkyMesh();
+
+	float tbmin[2], tbmax[2];
+	tbmin[0] = cfg.bmin[0];
+	tbmin[1] = cfg.bmin[2];
+	tbmax[0] = cfg.bmax[0];
+	tbmax[1] = cfg.bmax[2];
+	std::vector<int> cid;
+	rcGetChunksOverlappingRect(chunkyMesh, tbmin, tbmax, cid);
+
+	const MeshInstances& instances = m_geom->getMeshInstances();
+	std::vector<int> instanceIds;
+	instances.GetInstancesOverlappingRect(cfg.bmin, cfg.bmax, instanceIds);
+
+	const TerrainHeightfield& terrain = m_geom->getMeshLoader()->getTerrain();
+	const int terrainVerts = m_geom->getMeshLoader()->getTerrainVertCount();
+
+	if (cid.empty() && instanceIds.empty())
+		return 0;
+
+	// the terrain grid goes straight into the heightfield, its triangles are skipped
+	// below.
+	if (!terrain.Rasterize(m_ctx, *solid, cfg.walkableSlopeAngle, cfg.walkableClimb))
+	{
+		m_ctx->log(RC_LOG_ERROR, "buildNavigation: Could not rasterize terrain.");
+		return 0;
+	}
+
+	// Classify and rasterize the triangles of all chunks in one batch. Chunks that
+	// overlap the tile edge contribute only the triangles that reach into the tile.
+	TriangleRasterizer rasterizer;
+
+	if (!cid.empty())
+	{
+		rasterizer.Gather(chunkyMesh, cid, verts, cfg.bmin, cfg.bmax, terrainVerts);
+		rasterizer.MarkWalkable(verts, cfg.walkableSlopeAngle);
+
+		if (!RasterizeTriangles(m_ctx, verts, nverts, rasterizer.GetTris(), rasterizer.GetAreas(),
+			rasterizer.GetTriCount(), *solid, cfg.walkableClimb, threadCount))
+		{
+			m_ctx->log(RC_LOG_ERROR, "buildNavigation: Could not rasterize triangles.");
+			return 0;
+		}
+	}
+
+	// placed models that reach into the tile are transformed into place here, and
+	// go in as a second batch.
+	if (!instanceIds.empty())
+	{
+		std::vector<float> instanceVerts;
+		std::vector<int> instanceTris;
+
+		for (int index : instanceIds)
+			instances.AppendInstanceMesh(index, instanceVerts, instanceTris);
+
+		const int ninstanceVerts = (int)instanceVerts.size() / 3;
+		rasterizer.Gather(instanceTris.data(), (int)instanceTris.size() / 3, instanceVerts.data(),
+			cfg.bmin, cfg.bmax);
+		rasterizer.MarkWalkable(instanceVerts.data(), cfg.walkableSlopeAngle);
+
+		if (!RasterizeTriangles(m_ctx, instanceVerts.data(), ninstanceVerts, rasterizer.GetTris(),
+			rasterizer.GetAreas(), rasterizer.GetTriCount(), *solid, cfg.walkableClimb, threadCount))
+		{
+			m_ctx->log(RC_LOG_ERROR, "buildNavigation: Could not rasterize triangles.");
+			return 0;
+		}
+	}
+
+	if (const WaterMap* waterMap = m_geom->getWaterMap())
+		MarkWaterSpans(*waterMap, *solid);
+
+	return solid;
+}
+
+deleting_unique_ptr<rcCompactHeightfield> NavMeshTool::compactHeightfield(const rcConfig& cfg,
+	rcHeightfield& solid, TileBuildTimings* timings) const
+{
+	BuildStageTimer timer(timings);
+
+	// Once all geometry is rasterized, we do initial pass of filtering to
+	// remove unwanted overhangs caused by the conservative rasterization
+	// as well as filter spans where the character cannot possibly stand.
+	timer.Start(BuildStage::Filter);
+	rcFilterLowHangingWalkableObstacles(m_ctx, cfg.walkableClimb, solid);
+	rcFilterLedgeSpans(m_ctx, cfg.walkableHeight, cfg.walkableClimb, solid);
+	rcFilterWalkableLowHeightSpans(m_ctx, cfg.walkableHeight, solid);
+
+	// Compact the heightfield so that it is faster to handle from now on.
+	// This will result more cache coherent data as well as the neighbours
+	// between walkable cells will be calculated.
+	timer.Start(BuildStage::Compact);
+	deleting_unique_ptr<rcCompactHeightfield> chf(rcAllocCompactHeightfield(),
+		[](rcCompactHeightfield* hf) { rcFreeCompactHeightfield(hf); });
+
+	if (!rcBuildCompactHeightfield(m_ctx, cfg.walkableHeight, cfg.walkableClimb, solid, *chf))
+	{
+		m_ctx->log(RC_LOG_ERROR, "buildNavigation: Could not build compact data.");
+		return 0;
+	}
+
+	return std::move(chf);
+}
+
+// fnv-1a, used to fingerprint the inputs of a tile
+class TileHasher
+{
+public:
+	void Add(const void* data, size_t size)
+	{
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		for (size_t i = 0; i < size; ++i)
+		{
+			m_hash ^= bytes[i];
+			m_hash *= 1099511628211ull;
+		}
+	}
+
+	template <typename T>
+	void Add(const T& value) { Add(&value, sizeof(T)); }
+
+	uint64_t GetHash() const { return m_hash ? m_hash : 1; }
+
+private:
+	uint64_t m_hash = 14695981039346656037ull;
+};
 
-	m_tilesBuilt = 0;
+OffMeshLinkSettings NavMeshTool::getOffMeshLinkSettings(const NavMeshConfig& config) const
+{
+	OffMeshLinkSettings settings;
+	settings.agentRadius = config.agentRadius;
+	settings.agentHeight = config.agentHeight;
+	settings.agentMaxClimb = config.agentMaxClimb;
+	settings.maxDropHeight = config.maxDropHeight;
+	settings.maxJumpDistance = config.maxJumpDistance;
+	settings.area = static_cast<uint8_t>(PolyArea::Jump);
+	settings.flags = m_navMesh->GetPolyArea(settings.area).flags;
+
+	return settings;
+}
 
-	//concurrency::CurrentScheduler::Create(concurrency::SchedulerPolicy(1, concurrency::MaxConcurrency, 3));
+uint64_t NavMeshTool::computeTileHash(const float* bmin, const float* bmax) const
+{
+	if (!m_geom || !m_geom->getMeshLoader() || !m_geom->getChunkyMesh())
+		return 0;
 
-	concurrency::unbounded_buffer<TileDataPtr> agentTiles;
-	NavmeshUpdaterAgent updater_agent(agentTiles, navMesh);
+	TileHasher hasher;
+
+	// build settings
+	hasher.Add(m_config.tileSize);
+	hasher.Add(m_config.cellSize);
+	hasher.Add(m_config.cellHeight);
+	hasher.Add(m_config.agentHeight);
+	hasher.Add(m_config.agentRadius);
+	hasher.Add(m_config.agentMaxClimb);
+	hasher.Add(m_config.agentMaxSlope);
+	hasher.Add(m_config.regionMinSize);
+	hasher.Add(m_config.regionMergeSize);
+	hasher.Add(m_config.edgeMaxLen);
+	hasher.Add(m_config.edgeMaxError);
+	hasher.Add(m_config.vertsPerPoly);
+	hasher.Add(m_config.detailSampleDist);
+	hasher.Add(m_config.detailSampleMaxError);
+	hasher.Add(m_config.partitionType);
+	if (m_config.layeredTiles)
+		hasher.Add(m_config.layeredTiles);
+	if (m_config.mergePolys)
+		hasher.Add(m_config.mergePolys);
+	hasher.Add(m_config.pruneUnreachable);
+	hasher.Add(m_config.autoOffMeshLinks);
+	if (m_config.autoOffMeshLinks)
+	{
+		hasher.Add(m_config.maxDropHeight);
+		hasher.Add(m_config.maxJumpDistance);
+	}
+	hasher.Add(m_navMesh->GetTileCache() != nullptr);
+	hasher.Add(NAVMESH_CLEARANCE_LEVELS);
 
-	updater_agent.start();
+	for (const AgentProfile& profile : m_config.agentProfiles)
+	{
+		hasher.Add(profile.agentHeight);
+		hasher.Add(profile.agentRadius);
+		hasher.Add(profile.agentMaxClimb);
+	}
 
-	// Start the build process.
-	m_ctx->startTimer(RC_TIMER_TEMP);
+	// the same area that buildTileMesh reads geometry from, including the border
+	const int walkableRadius = (int)ceilf(GetLargestAgentRadius(m_config) / m_config.cellSize);
+	float border = (walkableRadius + 3) * m_config.cellSize;
 
-	concurrency::task_group tasks;
-	for (int x = 0; x < tw; x++)
+	// generated links look further out
+	if (m_config.autoOffMeshLinks)
 	{
-		for (int y = 0; y < th; y++)
+		border = std::max(border, OffMeshLinkBuilder::getReach(getOffMeshLinkSettings(m_config)));
+
+		for (const AgentProfile& profile : m_config.agentProfiles)
 		{
-			tasks.run([this, x, y, &bmin, &bmax, tcs, &agentTiles]()
-			{
-				if (m_cancelTiles)
-					return;
+			border = std::max(border, OffMeshLinkBuilder::getReach(
+				getOffMeshLinkSettings(GetProfileConfig(m_config, profile))));
+		}
+	}
 
-				++m_tilesBuilt;
+	float tbmin[3], tbmax[3];
+	rcVcopy(tbmin, bmin);
+	rcVcopy(tbmax, bmax);
+	tbmin[0] -= border;
+	tbmin[2] -= border;
+	tbmax[0] += border;
+	tbmax[2] += border;
 
-				glm::vec3 tileBmin, tileBmax;
-				tileBmin[0] = bmin[0] + x*tcs;
-				tileBmin[1] = bmin[1];
-				tileBmin[2] = bmin[2] + y*tcs;
+	hasher.Add(tbmin, sizeof(tbmin));
+	hasher.Add(tbmax, sizeof(tbmax));
 
-				tileBmax[0] = bmin[0] + (x + 1)*tcs;
-				tileBmax[1] = bmax[1];
-				tileBmax[2] = bmin[2] + (y + 1)*tcs;
+	// triangles
+	const float* verts = m_geom->getMeshLoader()->getVerts();
+	const rcChunkyTriMesh* chunkyMesh = m_geom->getChunkyMesh();
 
-				int dataSize = 0;
-				uint8_t* data = buildTileMesh(x, y, glm::value_ptr(tileBmin),
-					glm::value_ptr(tileBmax), dataSize);
+	float rectMin[2] = { tbmin[0], tbmin[2] };
+	float rectMax[2] = { tbmax[0], tbmax[2] };
+	std::vector<int> cid;
+	rcGetChunksOverlappingRect(chunkyMesh, rectMin, rectMax, cid);
 
-				if (data)
-				{
-					TileDataPtr tileData = std::make_shared<TileData>();
-					tileData->data = data;
-					tileData->length = dataSize;
-					tileData->x = x;
-					tileData->y = y;
+	for (int chunk : cid)
+	{
+		const rcChunkyTriMeshNode& node = chunkyMesh->nodes[chunk];
+		const int* ctris = &chunkyMesh->tris[node.i * 3];
 
-					asend(agentTiles, tileData);
-				}
-			});
-		}
+		for (int j = 0; j < node.n * 3; ++j)
+			hasher.Add(&verts[ctris[j] * 3], sizeof(float) * 3);
 	}
 
-	tasks.wait();
-
-	// send terminator
-	asend(agentTiles, TileDataPtr());
+	// placed models, by what they are and where they are placed
+	const MeshInstances& instances = m_geom->getMeshInstances();
+	instances.ForEachInstanceOverlappingRect(tbmin, tbmax, [&](int index)
+	{
+		const MeshInstances::Instance& instance = instances.GetInstance(index);
+		hasher.Add(instances.GetModel(instance.model).hash);
+		hasher.Add(instance.transform);
+	});
 
-	concurrency::agent::wait(&updater_agent);
+	hasher.Add(m_geom->getWaterMapHash());
 
+	// convex volumes that overlap the tile
+	std::vector<const ConvexVolume*> volumes;
+	m_navMesh->GetConvexVolumesInBounds(tbmin, tbmax, volumes);
+	for (const ConvexVolume* vol : volumes)
+	{
+		hasher.Add(vol->areaType);
+		hasher.Add(vol->hmin);
+		hasher.Add(vol->hmax);
+		hasher.Add(vol->verts.data(), vol->verts.size() * sizeof(glm::vec3));
+	}
 
-	// Start the build process.
-	m_ctx->stopTimer(RC_TIMER_TEMP);
+	// off-mesh connections with an end in the tile
+	OffMeshConnections offMeshCons;
+	m_geom->getOffMeshConnectionsInBounds(tbmin, tbmax, offMeshCons);
+	for (int i = 0; i < offMeshCons.count(); ++i)
+	{
+		hasher.Add(&offMeshCons.verts[i * 6], sizeof(float) * 6);
+		hasher.Add(offMeshCons.rads[i]);
+		hasher.Add(offMeshCons.dirs[i]);
+		hasher.Add(offMeshCons.areas[i]);
+		hasher.Add(offMeshCons.flags[i]);
+	}
 
-	m_totalBuildTimeMs = m_ctx->getAccumulatedTime(RC_TIMER_TEMP) / 1000.0f;
+	// area flags end up on the polygons
+	for (const PolyAreaType* area : m_navMesh->GetPolyAreas())
+	{
+		hasher.Add(area->id);
+		hasher.Add(area->flags);
+	}
 
-	m_buildingTiles = false;
+	return hasher.GetHash();
 }
 
-deleting_unique_ptr<rcCompactHeightfield> NavMeshTool::rasterizeGeometry(rcConfig& cfg) const
+// take polys out of a poly mesh and its detail mesh, along with the verts that
+// only they used. The polys that are left keep their order.
+static void RemovePolys(rcPolyMesh& pmesh, rcPolyMeshDetail& dmesh, const std::vector<uint16_t>& polys)
 {
-	// Allocate voxel heightfield where we rasterize our input data to.
-	deleting_unique_ptr<rcHeightfield> solid(rcAllocHeightfield(),
-		[](rcHeightfield* hf) { rcFreeHeightField(hf); });
+	const int nvp = pmesh.nvp;
 
-	if (!rcCreateHeightfield(m_ctx, *solid, cfg.width, cfg.height, cfg.bmin, cfg.bmax, cfg.cs, cfg.ch))
+	std::vector<bool> removed(pmesh.npolys, false);
+	for (uint16_t poly : polys)
 	{
-		m_ctx->log(RC_LOG_ERROR, "buildNavigation: Could not create solid heightfield.");
-		return 0;
+		if (poly < pmesh.npolys)
+			removed[poly] = true;
 	}
 
-	const float* verts = m_geom->getMeshLoader()->getVerts();
-	const int nverts = m_geom->getMeshLoader()->getVertCount();
-	const int ntris = m_geom->getMeshLoader()->getTriCount();
-	const rcChunkyTriMesh* chunkyMesh = m_geom->getChunkyMesh();
-
-	// Allocate array that can hold triangle flags.
-	// If you have multiple meshes you need to process, allocate
-	// and array which can hold the max number of triangles you need to process.
+	std::vector<unsigned short> polyRemap(pmesh.npolys, RC_MESH_NULL_IDX);
+	int npolys = 0;
+	for (int i = 0; i < pmesh.npolys; ++i)
+	{
+		if (!removed[i])
+			polyRemap[i] = (unsigned short)npolys++;
+	}
 
-	std::unique_ptr<unsigned char[]> triareas(new unsigned char[chunkyMesh->maxTrisPerChunk]);
+	if (npolys == pmesh.npolys)
+		return;
 
-	float tbmin[2], tbmax[2];
-	tbmin[0] = cfg.bmin[0];
-	tbmin[1] = cfg.bmin[2];
-	tbmax[0] = cfg.bmax[0];
-	tbmax[1] = cfg.bmax[2];
-	int cid[512];// TODO: Make grow when returning too many items.
-	const int ncid = rcGetChunksOverlappingRect(chunkyMesh, tbmin, tbmax, cid, 512);
-	if (!ncid)
-		return 0;
+	// detail triangles are packed again behind the polys that are left
+	std::vector<unsigned char> tris;
+	tris.reserve(dmesh.ntris * 4);
 
-	for (int i = 0; i < ncid; ++i)
+	for (int i = 0; i < pmesh.npolys; ++i)
 	{
-		const rcChunkyTriMeshNode& node = chunkyMesh->nodes[cid[i]];
-		const int* ctris = &chunkyMesh->tris[node.i * 3];
-		const int nctris = node.n;
+		const int n = polyRemap[i];
+		if (n == RC_MESH_NULL_IDX)
+			continue;
+
+		unsigned short* p = &pmesh.polys[n * nvp * 2];
+		if (n != i)
+		{
+			memcpy(p, &pmesh.polys[i * nvp * 2], sizeof(unsigned short) * nvp * 2);
+			pmesh.regs[n] = pmesh.regs[i];
+			pmesh.flags[n] = pmesh.flags[i];
+			pmesh.areas[n] = pmesh.areas[i];
+		}
+
+		// edges to removed polys become walls, portals to other tiles are kept
+		for (int j = 0; j < nvp; ++j)
+		{
+			unsigned short& nei = p[nvp + j];
+			if (nei != RC_MESH_NULL_IDX && !(nei & 0x8000))
+				nei = polyRemap[nei];
+		}
+
+		const unsigned int vertBase = dmesh.meshes[i * 4 + 0];
+		const unsigned int vertCount = dmesh.meshes[i * 4 + 1];
+		const unsigned int triBase = dmesh.meshes[i * 4 + 2];
+		const unsigned int triCount = dmesh.meshes[i * 4 + 3];
 
-		memset(triareas.get(), 0, nctris * sizeof(unsigned char));
-		rcMarkWalkableTriangles(m_ctx, cfg.walkableSlopeAngle,
-			verts, nverts, ctris, nctris, triareas.get());
+		dmesh.meshes[n * 4 + 0] = vertBase;
+		dmesh.meshes[n * 4 + 1] = vertCount;
+		dmesh.meshes[n * 4 + 2] = (unsigned int)(tris.size() / 4);
+		dmesh.meshes[n * 4 + 3] = triCount;
 
-		rcRasterizeTriangles(m_ctx, verts, nverts, ctris, triareas.get(), nctris, *solid, cfg.walkableClimb);
+		tris.insert(tris.end(), dmesh.tris + triBase * 4, dmesh.tris + (triBase + triCount) * 4);
 	}
 
-	// Once all geometry is rasterized, we do initial pass of filtering to
-	// remove unwanted overhangs caused by the conservative rasterization
-	// as well as filter spans where the character cannot possibly stand.
-	rcFilterLowHangingWalkableObstacles(m_ctx, cfg.walkableClimb, *solid);
-	rcFilterLedgeSpans(m_ctx, cfg.walkableHeight, cfg.walkableClimb, *solid);
-	rcFilterWalkableLowHeightSpans(m_ctx, cfg.walkableHeight, *solid);
+	memcpy(dmesh.tris, tris.data(), tris.size());
+	dmesh.ntris = (int)(tris.size() / 4);
+	dmesh.nmeshes = npolys;
+	pmesh.npolys = npolys;
 
-	// Compact the heightfield so that it is faster to handle from now on.
-	// This will result more cache coherent data as well as the neighbours
-	// between walkable cells will be calculated.
-	deleting_unique_ptr<rcCompactHeightfield> chf(rcAllocCompactHeightfield(),
-		[](rcCompactHeightfield* hf) { rcFreeCompactHeightfield(hf); });
+	// unused detail verts are skipped by detour, poly verts have to be packed here
+	std::vector<unsigned short> vertRemap(pmesh.nverts, RC_MESH_NULL_IDX);
+	for (int i = 0; i < npolys * nvp * 2; i += nvp * 2)
+	{
+		for (int j = 0; j < nvp && pmesh.polys[i + j] != RC_MESH_NULL_IDX; ++j)
+			vertRemap[pmesh.polys[i + j]] = 0;
+	}
 
-	if (!rcBuildCompactHeightfield(m_ctx, cfg.walkableHeight, cfg.walkableClimb, *solid, *chf))
+	int nverts = 0;
+	for (int i = 0; i < pmesh.nverts; ++i)
 	{
-		m_ctx->log(RC_LOG_ERROR, "buildNavigation: Could not build compact data.");
-		return 0;
+		if (vertRemap[i] == RC_MESH_NULL_IDX)
+			continue;
+
+		if (nverts != i)
+			memcpy(&pmesh.verts[nverts * 3], &pmesh.verts[i * 3], sizeof(unsigned short) * 3);
+		vertRemap[i] = (unsigned short)nverts++;
 	}
 
-	return std::move(chf);
+	for (int i = 0; i < npolys * nvp * 2; i += nvp * 2)
+	{
+		for (int j = 0; j < nvp && pmesh.polys[i + j] != RC_MESH_NULL_IDX; ++j)
+			pmesh.polys[i + j] = vertRemap[pmesh.polys[i + j]];
+	}
+
+	pmesh.nverts = nverts;
+}
+
+unsigned char* NavMeshTool::buildSampleTile(const NavMeshConfig& config, int tx, int ty,
+	int& dataSize, TileBuildTimings* timings) const
+{
+	const glm::vec3& bmin = m_navMesh->GetNavMeshBoundsMin();
+	const glm::vec3& bmax = m_navMesh->GetNavMeshBoundsMax();
+	const float tcs = config.tileSize * config.cellSize;
+
+	glm::vec3 tileBmin(bmin[0] + tx*tcs, bmin[1], bmin[2] + ty*tcs);
+	glm::vec3 tileBmax(bmin[0] + (tx + 1)*tcs, bmax[1], bmin[2] + (ty + 1)*tcs);
+
+	return buildTileMesh(tx, ty, glm::value_ptr(tileBmin), glm::value_ptr(tileBmax),
+		dataSize, timings, nullptr, nullptr, &config);
 }
 
-unsigned char* NavMeshTool::buildTileMesh(const int tx, const int ty, const float* bmin, const float* bmax, int& dataSize) const
+unsigned char* NavMeshTool::buildTileMesh(const int tx, const int ty, const float* bmin, const float* bmax,
+	int& dataSize, TileBuildTimings* timings, std::vector<std::vector<uint8_t>>* layers,
+	const std::vector<ConvexVolume>* volumeList, const NavMeshConfig* settings,
+	std::vector<AgentTile>* agentTiles, std::vector<TileLayerData>* otherLayers, int threadCount,
+	bool coarseDetail) const
 {
+	MQ2NAV_PROFILE_ZONE("NavMeshTool::buildTileMesh");
+
 	if (!m_geom || !m_geom->getMeshLoader() || !m_geom->getChunkyMesh())
 	{
 		m_ctx->log(RC_LOG_ERROR, "buildNavigation: Input mesh is not specified.");
 		return 0;
 	}
 
-	// Init build configuration from GUI
-	rcConfig cfg;
+	const NavMeshConfig& config = settings ? *settings : m_config;
 
-	memset(&cfg, 0, sizeof(cfg));
-	cfg.cs = m_config.cellSize;
-	cfg.ch = m_config.cellHeight;
-	cfg.walkableSlopeAngle = m_config.agentMaxSlope;
-	cfg.walkableHeight = (int)ceilf(m_config.agentHeight / cfg.ch);
-	cfg.walkableClimb = (int)floorf(m_config.agentMaxClimb / cfg.ch);
-	cfg.walkableRadius = (int)ceilf(m_config.agentRadius / cfg.cs);
-	cfg.maxEdgeLen = (int)(m_config.edgeMaxLen / m_config.cellSize);
-	cfg.maxSimplificationError = m_config.edgeMaxError;
-	cfg.minRegionArea = (int)rcSqr(m_config.regionMinSize);		// Note: area = size*size
-	cfg.mergeRegionArea = (int)rcSqr(m_config.regionMergeSize);	// Note: area = size*size
-	cfg.maxVertsPerPoly = (int)m_config.vertsPerPoly;
-	cfg.tileSize = (int)m_config.tileSize;
-	cfg.borderSize = cfg.walkableRadius + 3; // Reserve enough padding.
-	cfg.width = cfg.tileSize + cfg.borderSize * 2;
-	cfg.height = cfg.tileSize + cfg.borderSize * 2;
-	cfg.detailSampleDist = m_config.detailSampleDist < 0.9f ? 0 : m_config.cellSize * m_config.detailSampleDist;
-	cfg.detailSampleMaxError = m_config.cellHeight * m_config.detailSampleMaxError;
+	// intermediate recast data comes out of this thread's arena, and is all
+	// thrown away once the tile is done.
+	RecastArena::Scope arenaScope;
+
+	// Init build configuration from GUI
+	rcConfig cfg = GetRecastConfig(config, coarseDetail);
 
 	// Expand the heighfield bounding box by border size to find the extents of geometry we need to build this tile.
 	//
@@ -1052,11 +3375,77 @@ unsigned char* NavMeshTool::buildTileMesh(const int tx, const int ty, const floa
 	m_ctx->log(RC_LOG_PROGRESS, " - %.1fK verts, %.1fK tris", nverts / 1000.0f, ntris / 1000.0f);
 #endif
 
-	deleting_unique_ptr<rcCompactHeightfield> chf = rasterizeGeometry(cfg);
+	if (timings)
+	{
+		timings->x = tx;
+		timings->y = ty;
+		rcVcopy(timings->bmin, bmin);
+		rcVcopy(timings->bmax, bmax);
+	}
+
+	deleting_unique_ptr<rcHeightfield> solid = rasterizeGeometry(cfg, timings, threadCount);
+	if (!solid)
+		return 0;
+
+	// the convex volumes are marked on the compact heightfield of each agent
+	std::vector<const ConvexVolume*> volumes;
+	if (volumeList)
+	{
+		for (const ConvexVolume& vol : *volumeList)
+			volumes.push_back(&vol);
+	}
+	else
+	{
+		m_navMesh->GetConvexVolumesInBounds(cfg.bmin, cfg.bmax, volumes);
+	}
+
+	// the other agent profiles start from the same rasterized spans. Filtering
+	// only changes the areas of the spans, so those are put back in between.
+	std::vector<uint8_t> spanAreas;
+	if (agentTiles && !agentTiles->empty())
+		SaveSpanAreas(*solid, spanAreas);
+
+	unsigned char* navData = buildTileData(tx, ty, bmin, bmax, cfg, config, *solid, volumes,
+		!settings, dataSize, timings, layers, otherLayers, threadCount);
+
+	if (agentTiles)
+	{
+		for (size_t i = 0; i < agentTiles->size() && i < config.agentProfiles.size(); ++i)
+		{
+			const NavMeshConfig profileConfig = GetProfileConfig(config, config.agentProfiles[i]);
+
+			rcConfig profileCfg = cfg;
+			profileCfg.walkableHeight = (int)ceilf(profileConfig.agentHeight / cfg.ch);
+			profileCfg.walkableClimb = (int)floorf(profileConfig.agentMaxClimb / cfg.ch);
+			profileCfg.walkableRadius = (int)ceilf(profileConfig.agentRadius / cfg.cs);
+
+			RestoreSpanAreas(*solid, spanAreas);
+
+			AgentTile& tile = (*agentTiles)[i];
+			tile.data = buildTileData(tx, ty, bmin, bmax, profileCfg, profileConfig, *solid, volumes,
+				false, tile.dataSize, timings, nullptr, &tile.otherLayers, threadCount);
+		}
+	}
+
+	m_ctx->stopTimer(RC_TIMER_TOTAL);
+
+	return navData;
+}
+
+unsigned char* NavMeshTool::buildTileData(const int tx, const int ty, const float* bmin, const float* bmax,
+	const rcConfig& cfg, const NavMeshConfig& config, rcHeightfield& solid,
+	const std::vector<const ConvexVolume*>& volumes, bool primary, int& dataSize,
+	TileBuildTimings* timings, std::vector<std::vector<uint8_t>>* layers,
+	std::vector<TileLayerData>* otherLayers, int threadCount) const
+{
+	deleting_unique_ptr<rcCompactHeightfield> chf = compactHeightfield(cfg, solid, timings);
 	if (!chf)
 		return 0;
 
+	BuildStageTimer timer(timings);
+
 	// Erode the walkable area by agent radius.
+	timer.Start(BuildStage::Erode);
 	if (!rcErodeWalkableArea(m_ctx, cfg.walkableRadius, *chf))
 	{
 		m_ctx->log(RC_LOG_ERROR, "buildNavigation: Could not erode.");
@@ -1064,76 +3453,40 @@ unsigned char* NavMeshTool::buildTileMesh(const int tx, const int ty, const floa
 	}
 
 	// (Optional) Mark areas.
-	const auto& volumes = m_navMesh->GetConvexVolumes();
-	for (const auto& vol : volumes)
+	for (const ConvexVolume* vol : volumes)
 	{
 		rcMarkConvexPolyArea(m_ctx, glm::value_ptr(vol->verts[0]), static_cast<int>(vol->verts.size()),
 			vol->hmin, vol->hmax, static_cast<uint8_t>(vol->areaType), *chf);
 	}
 
-	// Partition the heightfield so that we can use simple algorithm later to triangulate the walkable areas.
-	// There are 3 martitioning methods, each with some pros and cons:
-	// 1) Watershed partitioning
-	//   - the classic Recast partitioning
-	//   - creates the nicest tessellation
-	//   - usually slowest
-	//   - partitions the heightfield into nice regions without holes or overlaps
-	//   - the are some corner cases where this method creates produces holes and overlaps
-	//      - holes may appear when a small obstacles is close to large open area (triangulation can handle this)
-	//      - overlaps may occur if you have narrow spiral corridors (i.e stairs), this make triangulation to fail
-	//   * generally the best choice if you precompute the nacmesh, use this if you have large open areas
-	// 2) Monotone partioning
-	//   - fastest
-	//   - partitions the heightfield into regions without holes and overlaps (guaranteed)
-	//   - creates long thin polygons, which sometimes causes paths with detours
-	//   * use this if you want fast navmesh generation
-	// 3) Layer partitoining
-	//   - quite fast
-	//   - partitions the heighfield into non-overlapping regions
-	//   - relies on the triangulation code to cope with holes (thus slower than monotone partitioning)
-	//   - produces better triangles than monotone partitioning
-	//   - does not have the corner cases of watershed partitioning
-	//   - can be slow and create a bit ugly tessellation (still better than monotone)
-	//     if you have large open areas with small obstacles (not a problem if you use tiles)
-	//   * good choice to use for tiled navmesh with medium and small sized tiles
-
-	if (m_config.partitionType == PartitionType::WATERSHED)
-	{
-		// Prepare for region partitioning, by calculating distance field along the walkable surface.
-		if (!rcBuildDistanceField(m_ctx, *chf))
-		{
-			m_ctx->log(RC_LOG_ERROR, "buildNavigation: Could not build distance field.");
-			return false;
-		}
-
-		// Partition the walkable surface into simple regions without holes.
-		if (!rcBuildRegions(m_ctx, *chf, cfg.borderSize, cfg.minRegionArea, cfg.mergeRegionArea))
-		{
-			m_ctx->log(RC_LOG_ERROR, "buildNavigation: Could not build watershed regions.");
-			return false;
-		}
-	}
-	else if (m_config.partitionType == PartitionType::MONOTONE)
+	// layers for the tile cache and layered tiles are built from the same
+	// heightfield, after areas are marked but before it is partitioned.
+	const bool cacheLayers = layers && m_navMesh->GetTileCache() && primary;
+	const bool layeredTiles = config.layeredTiles && cfg.tileSize <= 255;
+	if (cacheLayers || layeredTiles)
 	{
-		// Partition the walkable surface into simple regions without holes.
-		// Monotone partitioning does not need distancefield.
-		if (!rcBuildRegionsMonotone(m_ctx, *chf, cfg.borderSize, cfg.minRegionArea, cfg.mergeRegionArea))
-		{
-			m_ctx->log(RC_LOG_ERROR, "buildNavigation: Could not build monotone regions.");
-			return false;
-		}
-	}
-	else // PartitionType::LAYERS
-	{
-		// Partition the walkable surface into simple regions without holes.
-		if (!rcBuildLayerRegions(m_ctx, *chf, cfg.borderSize, cfg.minRegionArea))
+		timer.Start(BuildStage::Layers);
+		deleting_unique_ptr<rcHeightfieldLayerSet> lset = buildHeightfieldLayers(cfg, *chf);
+		if (!lset)
+			return 0;
+
+		if (cacheLayers && !buildTileLayers(tx, ty, *lset, *layers))
+			return 0;
+
+		if (layeredTiles)
 		{
-			m_ctx->log(RC_LOG_ERROR, "buildNavigation: Could not build layer regions.");
-			return false;
+			timer.Stop();
+			return buildLayerTiles(tx, ty, cfg, config, *lset, dataSize, timings, otherLayers);
 		}
 	}
 
+	// Partition the heightfield so that we can use simple algorithm later to triangulate the walkable areas.
+	timer.Start(BuildStage::Regions);
+	if (!GetBuildRegions(config.partitionType)(m_ctx, *chf, cfg))
+		return 0;
+
 	// Create contours.
+	timer.Start(BuildStage::Contours);
 	deleting_unique_ptr<rcContourSet> cset(rcAllocContourSet(), [](rcContourSet* cs) { rcFreeContourSet(cs); });
 	if (!rcBuildContours(m_ctx, *chf, cfg.maxSimplificationError, cfg.maxEdgeLen, *cset))
 	{
@@ -1141,12 +3494,17 @@ unsigned char* NavMeshTool::buildTileMesh(const int tx, const int ty, const floa
 		return 0;
 	}
 
+	// a copy of the intermediates for the debug draw modes
+	if (primary && m_debugCache.IsEnabled())
+		m_debugCache.Store(tx, ty, solid, *chf, *cset);
+
 	if (cset->nconts == 0)
 	{
 		return 0;
 	}
 
 	// Build polygon navmesh from the contours.
+	timer.Start(BuildStage::PolyMesh);
 	deleting_unique_ptr<rcPolyMesh> pmesh(rcAllocPolyMesh(), [](rcPolyMesh* pm) { rcFreePolyMesh(pm); });
 	if (!rcBuildPolyMesh(m_ctx, *cset, cfg.maxVertsPerPoly, *pmesh))
 	{
@@ -1154,11 +3512,32 @@ unsigned char* NavMeshTool::buildTileMesh(const int tx, const int ty, const floa
 		return 0;
 	}
 
+	// how much room each poly has past the agent radius, for wider agents. Done
+	// before merging, polys are only merged with ones that have as much room.
+	timer.Start(BuildStage::Clearance);
+	std::vector<uint16_t> narrowFlags;
+	GetNarrowPolyFlags(*chf, *pmesh, narrowFlags);
+
+	if (config.mergePolys)
+	{
+		timer.Start(BuildStage::MergePolys);
+
+		PolyMergeStats mergeStats;
+		MergePolyMesh(*pmesh, narrowFlags, std::max(cfg.detailSampleMaxError, cfg.ch), &mergeStats);
+
+		if (primary)
+		{
+			m_polysBeforeMerge += mergeStats.polysBefore;
+			m_polysAfterMerge += mergeStats.polysAfter;
+		}
+	}
+
 	// Build detail mesh.
+	timer.Start(BuildStage::Detail);
 	deleting_unique_ptr<rcPolyMeshDetail> dmesh(rcAllocPolyMeshDetail(), [](rcPolyMeshDetail* pm) { rcFreePolyMeshDetail(pm); });
-	if (!rcBuildPolyMeshDetail(m_ctx, *pmesh, *chf,
+	if (!BuildPolyMeshDetail(m_ctx, *pmesh, *chf,
 		cfg.detailSampleDist, cfg.detailSampleMaxError,
-		*dmesh))
+		*dmesh, threadCount))
 	{
 		m_ctx->log(RC_LOG_ERROR, "buildNavigation: Could build polymesh detail.");
 		return 0;
@@ -1167,6 +3546,7 @@ unsigned char* NavMeshTool::buildTileMesh(const int tx, const int ty, const floa
 	chf.reset();
 	cset.reset();
 
+	timer.Start(BuildStage::CreateNavMeshData);
 	unsigned char* navData = 0;
 	int navDataSize = 0;
 	if (cfg.maxVertsPerPoly <= DT_VERTS_PER_POLYGON)
@@ -1184,9 +3564,35 @@ unsigned char* NavMeshTool::buildTileMesh(const int tx, const int ty, const floa
 			if (pmesh->areas[i] >= RC_WALKABLE_AREA)
 				pmesh->areas[i] = static_cast<uint8_t>(PolyArea::Ground);
 
-			pmesh->flags[i] = m_navMesh->GetPolyArea(pmesh->areas[i]).flags;
+			pmesh->flags[i] = static_cast<unsigned short>(m_navMesh->GetPolyArea(pmesh->areas[i]).flags | narrowFlags[i]);
+		}
+
+		// polys pruned from this tile before stay pruned, if the tile hasn't changed.
+		// Poly indices match because the tile is built the same way. When the build
+		// does the pruning the polys are taken out, otherwise they're only disabled.
+		if (m_navMesh->HasPrunedTiles() && primary)
+		{
+			if (const NavMesh::PrunedTile* pruned = m_navMesh->GetPrunedTile(tx, ty, 0, computeTileHash(bmin, bmax)))
+			{
+				if (config.pruneUnreachable)
+				{
+					RemovePolys(*pmesh, *dmesh, pruned->polys);
+				}
+				else
+				{
+					for (uint16_t poly : pruned->polys)
+					{
+						if (poly < pmesh->npolys)
+							pmesh->flags[poly] |= +PolyFlags::Disabled;
+					}
+				}
+			}
 		}
 
+		// everything in the tile was pruned
+		if (pmesh->npolys == 0)
+			return 0;
+
 		dtNavMeshCreateParams params;
 		memset(&params, 0, sizeof(params));
 		params.verts = pmesh->verts;
@@ -1201,16 +3607,31 @@ unsigned char* NavMeshTool::buildTileMesh(const int tx, const int ty, const floa
 		params.detailVertsCount = dmesh->nverts;
 		params.detailTris = dmesh->tris;
 		params.detailTriCount = dmesh->ntris;
-		params.offMeshConVerts = m_geom->getOffMeshConnectionVerts();
-		params.offMeshConRad = m_geom->getOffMeshConnectionRads();
-		params.offMeshConDir = m_geom->getOffMeshConnectionDirs();
-		params.offMeshConAreas = m_geom->getOffMeshConnectionAreas();
-		params.offMeshConFlags = m_geom->getOffMeshConnectionFlags();
-		params.offMeshConUserID = m_geom->getOffMeshConnectionId();
-		params.offMeshConCount = m_geom->getOffMeshConnectionCount();
-		params.walkableHeight = m_config.agentHeight;
-		params.walkableRadius = m_config.agentRadius;
-		params.walkableClimb = m_config.agentMaxClimb;
+		// only the connections near the tile, detour would check every one otherwise
+		OffMeshConnections offMeshCons;
+		m_geom->getOffMeshConnectionsInBounds(pmesh->bmin, pmesh->bmax, offMeshCons);
+
+		if (config.autoOffMeshLinks)
+		{
+			timer.Start(BuildStage::OffMeshLinks);
+
+			MeshRaycaster raycaster = m_geom->getRaycaster();
+			OffMeshLinkBuilder linkBuilder(raycaster, getOffMeshLinkSettings(config));
+			linkBuilder.build(*pmesh, offMeshCons);
+
+			timer.Start(BuildStage::CreateNavMeshData);
+		}
+
+		params.offMeshConVerts = offMeshCons.verts.data();
+		params.offMeshConRad = offMeshCons.rads.data();
+		params.offMeshConDir = offMeshCons.dirs.data();
+		params.offMeshConAreas = offMeshCons.areas.data();
+		params.offMeshConFlags = offMeshCons.flags.data();
+		params.offMeshConUserID = offMeshCons.ids.data();
+		params.offMeshConCount = offMeshCons.count();
+		params.walkableHeight = config.agentHeight;
+		params.walkableRadius = config.agentRadius;
+		params.walkableClimb = config.agentMaxClimb;
 		params.tileX = tx;
 		params.tileY = ty;
 		params.tileLayer = 0;
@@ -1220,19 +3641,258 @@ unsigned char* NavMeshTool::buildTileMesh(const int tx, const int ty, const floa
 		params.ch = cfg.ch;
 		params.buildBvTree = true;
 
-		if (!dtCreateNavMeshData(&params, &navData, &navDataSize))
+		if (!TileBVTree::CreateNavMeshData(params, &navData, &navDataSize))
 		{
 			m_ctx->log(RC_LOG_ERROR, "Could not build Detour navmesh.");
 			return 0;
 		}
 	}
 
-	m_ctx->stopTimer(RC_TIMER_TOTAL);
-
 	dataSize = navDataSize;
 	return navData;
 }
 
+deleting_unique_ptr<rcHeightfieldLayerSet> NavMeshTool::buildHeightfieldLayers(const rcConfig& cfg,
+	rcCompactHeightfield& chf) const
+{
+	deleting_unique_ptr<rcHeightfieldLayerSet> lset(rcAllocHeightfieldLayerSet(),
+		[](rcHeightfieldLayerSet* ls) { rcFreeHeightfieldLayerSet(ls); });
+	if (!lset)
+	{
+		m_ctx->log(RC_LOG_ERROR, "buildNavigation: Out of memory 'lset'.");
+		return nullptr;
+	}
+
+	if (!rcBuildHeightfieldLayers(m_ctx, chf, cfg.borderSize, cfg.walkableHeight, *lset))
+	{
+		m_ctx->log(RC_LOG_ERROR, "buildNavigation: Could not build heightfield layers.");
+		return nullptr;
+	}
+
+	return lset;
+}
+
+bool NavMeshTool::buildTileLayers(const int tx, const int ty, const rcHeightfieldLayerSet& lset,
+	std::vector<std::vector<uint8_t>>& layers) const
+{
+	layers.clear();
+	layers.reserve(lset.nlayers);
+
+	for (int i = 0; i < lset.nlayers; ++i)
+	{
+		const rcHeightfieldLayer* layer = &lset.layers[i];
+
+		dtTileCacheLayerHeader header;
+		header.magic = DT_TILECACHE_MAGIC;
+		header.version = DT_TILECACHE_VERSION;
+		header.tx = tx;
+		header.ty = ty;
+		header.tlayer = i;
+		rcVcopy(header.bmin, layer->bmin);
+		rcVcopy(header.bmax, layer->bmax);
+		header.width = (unsigned char)layer->width;
+		header.height = (unsigned char)layer->height;
+		header.minx = (unsigned char)layer->minx;
+		header.maxx = (unsigned char)layer->maxx;
+		header.miny = (unsigned char)layer->miny;
+		header.maxy = (unsigned char)layer->maxy;
+		header.hmin = (unsigned short)layer->hmin;
+		header.hmax = (unsigned short)layer->hmax;
+
+		uint8_t* data = nullptr;
+		int dataSize = 0;
+		dtStatus status = dtBuildTileCacheLayer(NavMeshTileCache::GetCompressor(), &header,
+			layer->heights, layer->areas, layer->cons, &data, &dataSize);
+		if (dtStatusFailed(status))
+		{
+			m_ctx->log(RC_LOG_ERROR, "buildNavigation: Could not compress layer %d.", i);
+			return false;
+		}
+
+		layers.emplace_back(data, data + dataSize);
+		dtFree(data);
+	}
+
+	return true;
+}
+
+unsigned char* NavMeshTool::buildLayerTiles(const int tx, const int ty, const rcConfig& cfg,
+	const NavMeshConfig& config, const rcHeightfieldLayerSet& lset, int& dataSize,
+	TileBuildTimings* timings, std::vector<TileLayerData>* otherLayers) const
+{
+	BuildStageTimer timer(timings);
+	dtTileCacheAlloc alloc;
+
+	unsigned char* firstData = nullptr;
+	int firstDataSize = 0;
+
+	for (int i = 0; i < lset.nlayers; ++i)
+	{
+		const rcHeightfieldLayer& hlayer = lset.layers[i];
+
+		dtTileCacheLayerHeader header;
+		memset(&header, 0, sizeof(header));
+		header.magic = DT_TILECACHE_MAGIC;
+		header.version = DT_TILECACHE_VERSION;
+		header.tx = tx;
+		header.ty = ty;
+		header.tlayer = i;
+		rcVcopy(header.bmin, hlayer.bmin);
+		rcVcopy(header.bmax, hlayer.bmax);
+		header.width = (unsigned char)hlayer.width;
+		header.height = (unsigned char)hlayer.height;
+		header.minx = (unsigned char)hlayer.minx;
+		header.maxx = (unsigned char)hlayer.maxx;
+		header.miny = (unsigned char)hlayer.miny;
+		header.maxy = (unsigned char)hlayer.maxy;
+		header.hmin = (unsigned short)hlayer.hmin;
+		header.hmax = (unsigned short)hlayer.hmax;
+
+		// the layer is used where it is, it only needs somewhere to put the regions
+		std::vector<uint8_t> regs(hlayer.width * hlayer.height);
+
+		dtTileCacheLayer layer;
+		layer.header = &header;
+		layer.regCount = 0;
+		layer.heights = hlayer.heights;
+		layer.areas = hlayer.areas;
+		layer.cons = hlayer.cons;
+		layer.regs = regs.data();
+
+		timer.Start(BuildStage::Regions);
+		if (dtStatusFailed(dtBuildTileCacheRegions(&alloc, layer, cfg.walkableClimb)))
+		{
+			m_ctx->log(RC_LOG_ERROR, "buildNavigation: Could not build regions of layer %d.", i);
+			continue;
+		}
+
+		timer.Start(BuildStage::Contours);
+		deleting_unique_ptr<dtTileCacheContourSet> lcset(dtAllocTileCacheContourSet(&alloc),
+			[&alloc](dtTileCacheContourSet* cs) { dtFreeTileCacheContourSet(&alloc, cs); });
+		if (!lcset || dtStatusFailed(dtBuildTileCacheContours(&alloc, layer, cfg.walkableClimb,
+			cfg.maxSimplificationError, *lcset)))
+		{
+			m_ctx->log(RC_LOG_ERROR, "buildNavigation: Could not create contours of layer %d.", i);
+			continue;
+		}
+
+		timer.Start(BuildStage::PolyMesh);
+		deleting_unique_ptr<dtTileCachePolyMesh> lmesh(dtAllocTileCachePolyMesh(&alloc),
+			[&alloc](dtTileCachePolyMesh* pm) { dtFreeTileCachePolyMesh(&alloc, pm); });
+		if (!lmesh || dtStatusFailed(dtBuildTileCachePolyMesh(&alloc, *lcset, *lmesh)))
+		{
+			m_ctx->log(RC_LOG_ERROR, "buildNavigation: Could not triangulate contours of layer %d.", i);
+			continue;
+		}
+
+		if (lmesh->npolys == 0)
+			continue;
+
+		timer.Start(BuildStage::CreateNavMeshData);
+
+		// Update poly flags from areas.
+		for (int j = 0; j < lmesh->npolys; ++j)
+		{
+			if (lmesh->areas[j] >= RC_WALKABLE_AREA)
+				lmesh->areas[j] = static_cast<uint8_t>(PolyArea::Ground);
+
+			lmesh->flags[j] = m_navMesh->GetPolyArea(lmesh->areas[j]).flags;
+		}
+
+		// the poly mesh has the same layout as a recast one, for the link builder
+		rcPolyMesh pmesh;
+		memset(&pmesh, 0, sizeof(pmesh));
+		pmesh.verts = lmesh->verts;
+		pmesh.polys = lmesh->polys;
+		pmesh.flags = lmesh->flags;
+		pmesh.areas = lmesh->areas;
+		pmesh.nverts = lmesh->nverts;
+		pmesh.npolys = lmesh->npolys;
+		pmesh.maxpolys = lmesh->npolys;
+		pmesh.nvp = lmesh->nvp;
+		rcVcopy(pmesh.bmin, header.bmin);
+		rcVcopy(pmesh.bmax, header.bmax);
+		pmesh.cs = cfg.cs;
+		pmesh.ch = cfg.ch;
+
+		OffMeshConnections offMeshCons;
+		m_geom->getOffMeshConnectionsInBounds(pmesh.bmin, pmesh.bmax, offMeshCons);
+
+		if (config.autoOffMeshLinks)
+		{
+			timer.Start(BuildStage::OffMeshLinks);
+
+			MeshRaycaster raycaster = m_geom->getRaycaster();
+			OffMeshLinkBuilder linkBuilder(raycaster, getOffMeshLinkSettings(config));
+			linkBuilder.build(pmesh, offMeshCons);
+
+			timer.Start(BuildStage::CreateNavMeshData);
+		}
+
+		dtNavMeshCreateParams params;
+		memset(&params, 0, sizeof(params));
+		params.verts = lmesh->verts;
+		params.vertCount = lmesh->nverts;
+		params.polys = lmesh->polys;
+		params.polyAreas = lmesh->areas;
+		params.polyFlags = lmesh->flags;
+		params.polyCount = lmesh->npolys;
+		params.nvp = lmesh->nvp;
+		params.offMeshConVerts = offMeshCons.verts.data();
+		params.offMeshConRad = offMeshCons.rads.data();
+		params.offMeshConDir = offMeshCons.dirs.data();
+		params.offMeshConAreas = offMeshCons.areas.data();
+		params.offMeshConFlags = offMeshCons.flags.data();
+		params.offMeshConUserID = offMeshCons.ids.data();
+		params.offMeshConCount = offMeshCons.count();
+		params.walkableHeight = config.agentHeight;
+		params.walkableRadius = config.agentRadius;
+		params.walkableClimb = config.agentMaxClimb;
+		params.tileX = tx;
+		params.tileY = ty;
+		params.tileLayer = i;
+		rcVcopy(params.bmin, header.bmin);
+		rcVcopy(params.bmax, header.bmax);
+		params.cs = cfg.cs;
+		params.ch = cfg.ch;
+		params.buildBvTree = true;
+
+		unsigned char* navData = nullptr;
+		int navDataSize = 0;
+		if (!TileBVTree::CreateNavMeshData(params, &navData, &navDataSize))
+		{
+			m_ctx->log(RC_LOG_ERROR, "Could not build Detour navmesh for layer %d.", i);
+			continue;
+		}
+
+		if (!firstData)
+		{
+			firstData = navData;
+			firstDataSize = navDataSize;
+		}
+		else if (otherLayers)
+		{
+			TileLayerData layerData;
+			layerData.data = navData;
+			layerData.dataSize = navDataSize;
+			otherLayers->push_back(layerData);
+		}
+		else
+		{
+			dtFree(navData);
+		}
+	}
+
+	dataSize = firstDataSize;
+	return firstData;
+}
+
+void NavMeshTool::storeTileLayers(const int tx, const int ty, std::vector<std::vector<uint8_t>>& layers)
+{
+	if (NavMeshTileCache* tileCache = m_navMesh->GetTileCache())
+		tileCache->SetTileLayers(tx, ty, std::move(layers));
+}
+
 unsigned int NavMeshTool::GetColorForPoly(const dtPoly* poly)
 {
 	if (poly)
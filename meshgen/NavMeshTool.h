@@ -4,8 +4,13 @@
 
 #pragma once
 
+#include "BuildProfiler.h"
 #include "ChunkyTriMesh.h"
 #include "DebugDraw.h"
+#include "OffMeshLinkBuilder.h"
+#include "TaskScheduler.h"
+#include "TileDebugCache.h"
+#include "TileUndoStack.h"
 
 #include "common/Enum.h"
 #include "common/NavMesh.h"
@@ -21,10 +26,14 @@
 #include <glm/glm.hpp>
 
 #include <atomic>
+#include <condition_variable>
 #include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 class BuildContext;
 class InputGeom;
@@ -104,7 +113,34 @@ public:
 	void handleRenderOverlay(const glm::mat4& proj, const glm::mat4& model, const glm::ivec4& view);
 	void handleGeometryChanged(InputGeom* geom);
 
-	bool handleBuild();
+	// A mesh can be opened without its zone geometry, to look at it and test it.
+	// Tiles that need to be rebuilt then wait for the geometry, which is asked
+	// for with the request, and are rebuilt once it is attached. Attaching the
+	// geometry of the open mesh keeps the tool states and the undo steps.
+	void setGeometryRequest(std::function<void()> request) { m_requestGeometry = std::move(request); }
+	void attachGeometry(InputGeom* geom);
+	void requestGeometry();
+
+	// hit test against the navmesh itself, for when there is no geometry to hit
+	bool raycastNavMesh(const glm::vec3& start, const glm::vec3& end, float& t) const;
+
+	// an area to build the tiles of. Only x and z are used, tiles cover the whole
+	// height of the mesh.
+	struct BuildRegion
+	{
+		glm::vec3 bmin;
+		glm::vec3 bmax;
+	};
+
+	// regions that cover a path through the points, out to radius on each side.
+	// A single point gives the square around it.
+	static std::vector<BuildRegion> GetRegionsAlongPath(const std::vector<glm::vec3>& points,
+		float radius);
+
+	// build every tile. If async, the build runs on a separate thread. If regions
+	// are given, only the tiles that overlap them are built and the rest of the
+	// mesh is kept as it is.
+	bool handleBuild(bool async = true, std::vector<BuildRegion> regions = {});
 	void handleClick(const glm::vec3& s, const glm::vec3& p, bool shift);
 
 	void GetTilePos(const glm::vec3& pos, int& tx, int& ty);
@@ -113,20 +149,102 @@ public:
 	void RemoveTile(const glm::vec3& pos);
 	void RemoveAllTiles();
 
-	void BuildAllTiles(const std::shared_ptr<dtNavMesh>& navMesh, bool async = true);
+	void BuildAllTiles(const std::shared_ptr<dtNavMesh>& navMesh, bool async = true,
+		std::vector<BuildRegion> regions = {});
 	void CancelBuildAllTiles(bool wait = true);
 
+	// add the tiles finished by a background build to the navmesh. Called once a
+	// frame from the main loop, where nothing else is using the navmesh, so the
+	// tiles built so far can be drawn and tested while the rest are building.
+	// If limited, stops after about PUBLISH_FRAME_BUDGET_MS and leaves the rest
+	// for the next frame, unless the build is in turbo.
+	void publishBuiltTiles(bool limited = false);
+
+	// queue tiles to be rebuilt on the build workers. Tiles closest to the camera
+	// are built first. If a tile is queued again while it is being built, the
+	// older build is thrown away.
 	void RebuildTiles(const std::vector<dtTileRef>& tiles);
 	void RebuildTile(dtTileRef tileRef);
 
+	// queued rebuilds are ordered by distance from here
+	void setCameraPos(const glm::vec3& pos);
+
+	// projection times modelview, the input geometry outside of it isn't drawn
+	void setViewFrustum(const glm::mat4& viewProj) { m_viewProj = viewProj; }
+	int getPendingRebuilds() const;
+
+	// publish rebuilds until none are left, for when the mesh is about to be
+	// saved. Called from the main loop.
+	void waitForRebuilds();
+
 	bool isBuildingTiles() const { return m_buildingTiles; }
 
 	void getTileStatistics(int& width, int& height, int& maxTiles) const;
 	int getTilesBuilt() const { return m_tilesBuilt; }
+	int getTilesToBuild() const { return m_tilesToBuild; }
+	int getTilesSkipped() const { return m_tilesSkipped; }
+
+	// polys of the tiles built by the last build before and after they were
+	// merged, 0 if merging is off
+	int getPolysBeforeMerge() const { return m_polysBeforeMerge; }
+	int getPolysAfterMerge() const { return m_polysAfterMerge; }
+
+	// build one tile with other settings than the current ones, for comparing
+	// settings. The tile isn't added to the navmesh. Safe to call from multiple
+	// threads while nothing is building.
+	unsigned char* buildSampleTile(const NavMeshConfig& config, int tx, int ty, int& dataSize,
+		TileBuildTimings* timings = nullptr) const;
+
+	// number of threads used to build tiles, 0 for one per hardware thread.
+	void setBuildThreadCount(int threads) { m_buildThreadCount = threads; }
+
+	enum struct BuildPriority
+	{
+		Background,   // below normal workers and a core left for the editor
+		Normal,
+		Turbo,        // every core, and tiles are published as fast as they come. For headless builds.
+	};
+	void setBuildPriority(BuildPriority priority) { m_buildPriority = priority; }
+	BuildPriority getBuildPriority() const { return m_buildPriority; }
 	float getTotalBuildTimeMS() const { return m_totalBuildTimeMs; }
 
+	// approximate limit on the scratch memory of the tiles that are being built
+	// at the same time, in bytes. A worker whose tile would go over waits for the
+	// others to finish. 0 = no limit.
+	void setTileMemoryBudget(size_t bytes) { m_tileMemoryBudget = bytes; }
+
+	// build all tiles without detail samples first, so the mesh can be used right
+	// away, and rebuild them with detail once the build is done.
+	void setDeferDetail(bool defer) { m_deferDetail = defer; }
+
+	// check every tile for links, detail meshes and bv trees that would break
+	// paths, and log the ones with issues. They're kept for Rebuild Invalid Tiles.
+	// Returns the number of tiles with issues.
+	int validateNavMesh();
+
+	// undo and redo of edits to the tiles. An edit starts with beginUndoStep, and
+	// the tiles that change until the next one are saved before they change. Tools
+	// that change tiles in place save them with saveUndoTile first. Full builds
+	// and loading a mesh clear the steps.
+	void beginUndoStep(const std::string& label, bool volumes = false);
+	void saveUndoTile(int tx, int ty);
+
+	bool canUndo() const;
+	bool canRedo() const;
+	void undo();
+	void redo();
+	const TileUndoStack& getUndoStack() const { return m_undo; }
+
+	// keep the recast intermediates of this many of the tiles built last, for
+	// the voxel, compact heightfield and contour draw modes. 0 keeps none.
+	void setDebugCacheTiles(int tiles) { m_debugCache.SetMaxTiles(tiles); }
+
 	void setOutputPath(const char* output_path);
 
+	// heat map and export of the per tile build timings
+	void handleBuildProfile();
+	const BuildProfiler& getBuildProfiler() const { return m_buildProfiler; }
+
 	void UpdateTileSizes();
 
 	uint8_t getNavMeshDrawFlags() const { return m_navMeshDrawFlags; }
@@ -145,7 +263,13 @@ public:
 	duDebugDraw& getDebugDraw() { return m_dd; }
 
 private:
-	deleting_unique_ptr<rcCompactHeightfield> rasterizeGeometry(rcConfig& cfg) const;
+	// threadCount is how many threads the triangles can be rasterized on
+	deleting_unique_ptr<rcHeightfield> rasterizeGeometry(const rcConfig& cfg,
+		TileBuildTimings* timings = nullptr, int threadCount = 1) const;
+
+	// filters the rasterized spans for the agent size in cfg, and compacts them
+	deleting_unique_ptr<rcCompactHeightfield> compactHeightfield(const rcConfig& cfg,
+		rcHeightfield& solid, TileBuildTimings* timings = nullptr) const;
 
 	void resetCommonSettings();
 
@@ -159,11 +283,150 @@ private:
 
 	void handleUpdate(float dt);
 
-	unsigned char* buildTileMesh(const int tx, const int ty, const float* bmin, const float* bmax, int& dataSize) const;
+	// hold back the scratch memory of a tile from the budget, waiting for it if
+	// the tiles in flight are using it up. Returns what was reserved.
+	size_t reserveTileMemory();
+	void releaseTileMemory(size_t bytes);
+
+	// detour data of one layer of a tile
+	struct TileLayerData
+	{
+		uint8_t* data = nullptr;
+		int dataSize = 0;
+	};
+
+	// add a tile and the rest of its layers to a navmesh, which takes the data.
+	// Anything that can't be added is freed.
+	static void addTileLayers(dtNavMesh& navMesh, uint8_t* data, int dataSize,
+		std::vector<TileLayerData>& otherLayers);
+	static void freeTileLayers(uint8_t* data, std::vector<TileLayerData>& otherLayers);
+
+	// a tile built for one of the other agent profiles, for that profile's mesh
+	struct AgentTile
+	{
+		std::shared_ptr<dtNavMesh> navMesh;
+		uint8_t* data = nullptr;
+		int dataSize = 0;
+		std::vector<TileLayerData> otherLayers;
+	};
+
+	// an entry for each agent mesh, if they were made for the current profiles.
+	// Otherwise the profiles have changed and the agent meshes wait for a full build.
+	std::vector<AgentTile> getAgentTiles() const;
+
+	// if layers is given and the tile cache is enabled, the compressed heightfield
+	// layers of the tile are returned in it.
+	// if volumeList is given, those are marked instead of the navmesh's convex volumes.
+	// if settings is given, they are used in place of the build settings, and the
+	// tile doesn't get layers or pruning.
+	// if agentTiles is given, it has an entry for each agent profile in the build
+	// settings, and the tile is built for each of them from the same heightfield.
+	// with layered tiles, the first layer is returned and the rest of the layers
+	// go in otherLayers, or are thrown away if it isn't given.
+	// threadCount is how many threads the stages of the tile can be split over.
+	// with coarseDetail, the detail mesh only triangulates the polys.
+	unsigned char* buildTileMesh(const int tx, const int ty, const float* bmin, const float* bmax,
+		int& dataSize, TileBuildTimings* timings = nullptr,
+		std::vector<std::vector<uint8_t>>* layers = nullptr,
+		const std::vector<ConvexVolume>* volumeList = nullptr,
+		const NavMeshConfig* settings = nullptr,
+		std::vector<AgentTile>* agentTiles = nullptr,
+		std::vector<TileLayerData>* otherLayers = nullptr,
+		int threadCount = 1, bool coarseDetail = false) const;
+
+	// the part of the build that depends on the agent size, from the rasterized
+	// heightfield on. primary is false for the other agent profiles, which don't
+	// get layers or pruning.
+	unsigned char* buildTileData(const int tx, const int ty, const float* bmin, const float* bmax,
+		const rcConfig& cfg, const NavMeshConfig& config, rcHeightfield& solid,
+		const std::vector<const ConvexVolume*>& volumes, bool primary, int& dataSize,
+		TileBuildTimings* timings, std::vector<std::vector<uint8_t>>* layers,
+		std::vector<TileLayerData>* otherLayers, int threadCount = 1) const;
+
+	deleting_unique_ptr<rcHeightfieldLayerSet> buildHeightfieldLayers(const rcConfig& cfg,
+		rcCompactHeightfield& chf) const;
+
+	// compress the layers for the tile cache
+	bool buildTileLayers(const int tx, const int ty, const rcHeightfieldLayerSet& lset,
+		std::vector<std::vector<uint8_t>>& layers) const;
+
+	// build a tile for each heightfield layer, the same way the tile cache does.
+	// These tiles don't have detail meshes.
+	unsigned char* buildLayerTiles(const int tx, const int ty, const rcConfig& cfg,
+		const NavMeshConfig& config, const rcHeightfieldLayerSet& lset, int& dataSize,
+		TileBuildTimings* timings, std::vector<TileLayerData>* otherLayers) const;
+
+	// store the layers of a tile in the navmesh's tile cache, if it has one
+	void storeTileLayers(const int tx, const int ty, std::vector<std::vector<uint8_t>>& layers);
+
+	// hash of everything that goes into building the tile with the given bounds.
+	uint64_t computeTileHash(const float* bmin, const float* bmax) const;
+
+	// settings for the generated jump and drop links, from the build settings
+	OffMeshLinkSettings getOffMeshLinkSettings(const NavMeshConfig& config) const;
+
+	// flood the finished mesh from the prune seeds, and build the tiles with
+	// unreachable polys again without them.
+	void pruneUnreachablePolys(const std::shared_ptr<dtNavMesh>& navMesh,
+		TaskScheduler& scheduler);
+
+	// a tile built by a worker, waiting to be added to the navmesh
+	struct BuiltTile
+	{
+		std::shared_ptr<dtNavMesh> navMesh;
+		int x = 0, y = 0;
+		uint8_t* data = nullptr;
+		int dataSize = 0;
+
+		// pruned tiles keep the hash and layers of the full tile
+		bool pruned = false;
+		uint32_t generation = 0;          // non-zero for rebuilds after an edit
+		uint64_t hash = 0;
+		std::vector<std::vector<uint8_t>> layers;
+		std::vector<TileLayerData> otherLayers;
+		std::vector<AgentTile> agentTiles;
+		TileBuildTimings timings;
+	};
+
+	// hand a built tile to the publisher. Unless the build is running in the
+	// background, it is published right away.
+	void queueBuiltTile(BuiltTile&& tile);
+
+	// wait for the main loop to publish every queued tile. Returns false if the
+	// build was cancelled first.
+	bool waitForBuiltTiles();
+
+	// workers shared by full builds and rebuilds. Changes to the thread settings
+	// take effect once it is idle.
+	TaskScheduler& getScheduler();
+
+	// a tile waiting to be rebuilt after an edit
+	struct TileRebuild
+	{
+		std::shared_ptr<dtNavMesh> navMesh;
+		int x = 0, y = 0;
+		glm::vec3 bmin, bmax;
+		uint64_t hash = 0;
+		uint32_t generation = 0;
+		bool queued = false;              // false once a worker has picked it up
+
+		// copied when queued, so edits can't change them under the worker
+		std::vector<ConvexVolume> volumes;
+		std::vector<AgentTile> agentTiles;
+	};
+
+	void requestTileRebuild(int tx, int ty, const float* bmin, const float* bmax);
+
+	// build the queued rebuild closest to the camera
+	void runTileRebuild();
 
 	void NavMeshUpdated();
 
+	// put the tiles of an undo step back, undo or redo
+	void applyUndoStep(bool undo);
+
 	void drawConvexVolumes(duDebugDraw* dd);
+	void drawBuildTimes(duDebugDraw* dd);
 
 private:
 	InputGeom* m_geom = nullptr;
@@ -187,9 +450,48 @@ private:
 	int m_tilesHeight = 0;
 	int m_tilesCount = 0;
 	std::atomic<int> m_tilesBuilt = 0;
+	std::atomic<int> m_tilesToBuild = 0;
+	std::atomic<int> m_tilesSkipped = 0;
+	mutable std::atomic<int> m_polysBeforeMerge = 0;
+	mutable std::atomic<int> m_polysAfterMerge = 0;
 	std::atomic<bool> m_buildingTiles = false;
 	std::atomic<bool> m_cancelTiles = false;
 	std::thread m_buildThread;
+	int m_buildThreadCount = 0; // 0 = one per hardware thread
+
+	// see setTileMemoryBudget. The estimate is the most a tile has needed so far.
+	std::atomic<size_t> m_tileMemoryBudget = 0;
+	std::atomic<size_t> m_tileMemoryEstimate = 0;
+	std::mutex m_tileMemoryMutex;
+	std::condition_variable m_tileMemoryAvailable;
+	size_t m_tileMemoryUsed = 0;
+
+	bool m_deferDetail = false;
+
+	// tiles waiting to be published, and how many haven't been added yet
+	std::mutex m_builtTilesMutex;
+	std::condition_variable m_builtTilesCv;
+	std::vector<BuiltTile> m_builtTiles;
+	int m_tilesUnpublished = 0;
+	std::mutex m_publishMutex;
+	std::atomic<bool> m_publishInBackground = false;
+	std::atomic<bool> m_tileGraphPending = false;
+
+	// rebuilds that haven't been published yet, by tile
+	mutable std::mutex m_rebuildMutex;
+	std::unordered_map<uint64_t, TileRebuild> m_tileRebuilds;
+	uint32_t m_rebuildGeneration = 0;
+	glm::vec3 m_cameraPos = { 0, 0, 0 };
+
+	std::mutex m_schedulerMutex;
+	int m_schedulerThreadCount = 0;
+	BuildPriority m_schedulerPriority = BuildPriority::Normal;
+	std::unique_ptr<TaskScheduler> m_scheduler;
+	BuildPriority m_buildPriority = BuildPriority::Background;
+
+	BuildProfiler m_buildProfiler;
+	bool m_drawBuildTimes = false;
+	BuildStage m_buildTimeStage = BuildStage::Count; // Count = total of all stages
 
 	uint8_t m_navMeshDrawFlags = 0;
 	NavMeshConfig m_config;
@@ -218,4 +520,14 @@ private:
 	DrawMode::Enum m_drawMode = DrawMode::NAVMESH;
 
 	NavMeshDebugDraw m_dd{ this };
+	NavMeshTileDrawCache m_tileDrawCache;
+	InputGeomDrawCache m_geomDrawCache;
+	glm::mat4 m_viewProj{ 1.0f };
+	mutable TileDebugCache m_debugCache;
+	TileUndoStack m_undo;
+	std::vector<dtTileRef> m_invalidTiles;   // from the last validateNavMesh
+
+	std::function<void()> m_requestGeometry;
+	bool m_geometryRequested = false;
+	std::vector<dtTileRef> m_geometryRebuilds; // waiting for the geometry to be attached
 };
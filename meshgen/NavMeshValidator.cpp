@@ -0,0 +1,410 @@
+//
+// NavMeshValidator.cpp
+//
+
+#include "NavMeshValidator.h"
+#include "TaskScheduler.h"
+
+#include <DetourCommon.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+
+// the most layers a tile can have
+static const int VALIDATE_MAX_TILE_LAYERS = 32;
+
+// polys with less area than this can't be walked on
+static const float VALIDATE_MIN_POLY_AREA = 1e-4f;
+
+const char* GetNavMeshIssueName(NavMeshIssue issue)
+{
+	switch (issue)
+	{
+	case NavMeshIssue::TooManyPolys: return "too many polys";
+	case NavMeshIssue::DegeneratePoly: return "degenerate polys";
+	case NavMeshIssue::BadLink: return "bad links";
+	case NavMeshIssue::OneWayLink: return "one way links";
+	case NavMeshIssue::UnlinkedPortal: return "unlinked portals";
+	case NavMeshIssue::BadDetailMesh: return "bad detail meshes";
+	case NavMeshIssue::BadBVTree: return "bad bv tree";
+	case NavMeshIssue::OffMeshStart: return "unlinked off-mesh starts";
+	case NavMeshIssue::OffMeshEnd: return "unlinked off-mesh ends";
+	default: return "unknown";
+	}
+}
+
+namespace {
+
+class TileValidator
+{
+public:
+	TileValidator(const dtNavMesh& navMesh, const dtMeshTile& tile, NavMeshTileIssues& issues)
+		: m_navMesh(navMesh)
+		, m_tile(tile)
+		, m_header(*tile.header)
+		, m_issues(issues)
+	{
+	}
+
+	void Validate()
+	{
+		if (m_header.polyCount > m_navMesh.getParams()->maxPolys)
+			Add(NavMeshIssue::TooManyPolys);
+
+		for (int i = 0; i < m_header.polyCount; ++i)
+		{
+			const dtPoly& poly = m_tile.polys[i];
+			if (poly.getType() == DT_POLYTYPE_OFFMESH_CONNECTION)
+				continue;
+
+			if (!CheckPoly(poly))
+			{
+				// the rest of the checks need the verts
+				Add(NavMeshIssue::DegeneratePoly);
+				continue;
+			}
+
+			CheckLinks(i, poly);
+			CheckPortals(poly);
+			CheckDetailMesh(i, poly);
+		}
+
+		CheckBVTree();
+		CheckOffMeshConnections();
+	}
+
+private:
+	void Add(NavMeshIssue issue) { ++m_issues.counts[(int)issue]; }
+
+	bool CheckPoly(const dtPoly& poly) const
+	{
+		if (poly.vertCount < 3 || poly.vertCount > DT_VERTS_PER_POLYGON)
+			return false;
+
+		for (int j = 0; j < poly.vertCount; ++j)
+		{
+			if (poly.verts[j] >= m_header.vertCount)
+				return false;
+		}
+
+		float area = 0;
+		const float* va = &m_tile.verts[poly.verts[0] * 3];
+		for (int j = 2; j < poly.vertCount; ++j)
+		{
+			const float* vb = &m_tile.verts[poly.verts[j - 1] * 3];
+			const float* vc = &m_tile.verts[poly.verts[j] * 3];
+			area += dtTriArea2D(va, vb, vc);
+		}
+
+		return std::abs(area) >= VALIDATE_MIN_POLY_AREA;
+	}
+
+	// returns false if the link list doesn't end inside of the tile's links
+	template <typename T>
+	bool ForEachLink(const dtMeshTile& tile, const dtPoly& poly, T&& func) const
+	{
+		int steps = 0;
+		for (unsigned int k = poly.firstLink; k != DT_NULL_LINK; k = tile.links[k].next)
+		{
+			if (k >= (unsigned int)tile.header->maxLinkCount || ++steps > tile.header->maxLinkCount)
+				return false;
+
+			func(tile.links[k]);
+		}
+
+		return true;
+	}
+
+	void CheckLinks(int index, const dtPoly& poly)
+	{
+		const dtPolyRef ref = m_navMesh.getPolyRefBase(&m_tile) | (dtPolyRef)index;
+
+		bool valid = ForEachLink(m_tile, poly, [&](const dtLink& link)
+		{
+			const dtMeshTile* otherTile = nullptr;
+			const dtPoly* otherPoly = nullptr;
+			if (dtStatusFailed(m_navMesh.getTileAndPolyByRef(link.ref, &otherTile, &otherPoly)))
+			{
+				Add(NavMeshIssue::BadLink);
+				return;
+			}
+
+			// links to off-mesh connections only go back from the end if it's bidirectional
+			if (otherPoly->getType() == DT_POLYTYPE_OFFMESH_CONNECTION)
+				return;
+
+			bool found = false;
+			bool otherValid = ForEachLink(*otherTile, *otherPoly, [&](const dtLink& back)
+			{
+				found = found || back.ref == ref;
+			});
+
+			if (otherValid && !found)
+				Add(NavMeshIssue::OneWayLink);
+		});
+
+		if (!valid)
+			Add(NavMeshIssue::BadLink);
+	}
+
+	// a portal edge is one on the tile border that was left for a neighbour to link
+	// to. Detour links two tiles where their portal edges overlap, so a portal that
+	// faces a matching portal in a neighbour and has no link means one of the two
+	// tiles is out of date.
+	void CheckPortals(const dtPoly& poly)
+	{
+		for (int j = 0; j < poly.vertCount; ++j)
+		{
+			if (!(poly.neis[j] & DT_EXT_LINK))
+				continue;
+
+			const int side = poly.neis[j] & 0xff;
+			if (side != 0 && side != 2 && side != 4 && side != 6)
+				continue;
+
+			bool linked = false;
+			ForEachLink(m_tile, poly, [&](const dtLink& link)
+			{
+				linked = linked || link.edge == j;
+			});
+
+			if (linked)
+				continue;
+
+			const float* va = &m_tile.verts[poly.verts[j] * 3];
+			const float* vb = &m_tile.verts[poly.verts[(j + 1) % poly.vertCount] * 3];
+
+			if (HasMatchingPortal(side, va, vb))
+				Add(NavMeshIssue::UnlinkedPortal);
+		}
+	}
+
+	bool HasMatchingPortal(int side, const float* va, const float* vb) const
+	{
+		const int nx = m_header.x + (side == 0 ? 1 : side == 4 ? -1 : 0);
+		const int ny = m_header.y + (side == 2 ? 1 : side == 6 ? -1 : 0);
+		const int opposite = (side + 4) & 0x7;
+
+		// the portal runs along z on the x sides and along x on the z sides
+		const int axis = (side == 0 || side == 4) ? 2 : 0;
+		const float amin = std::min(va[axis], vb[axis]);
+		const float amax = std::max(va[axis], vb[axis]);
+		const float ymin = std::min(va[1], vb[1]) - m_header.walkableClimb;
+		const float ymax = std::max(va[1], vb[1]) + m_header.walkableClimb;
+
+		const dtMeshTile* neighbours[VALIDATE_MAX_TILE_LAYERS];
+		const int count = m_navMesh.getTilesAt(nx, ny, neighbours, VALIDATE_MAX_TILE_LAYERS);
+
+		for (int t = 0; t < count; ++t)
+		{
+			const dtMeshTile& other = *neighbours[t];
+			for (int i = 0; i < other.header->polyCount; ++i)
+			{
+				const dtPoly& otherPoly = other.polys[i];
+				if (otherPoly.getType() == DT_POLYTYPE_OFFMESH_CONNECTION)
+					continue;
+
+				for (int j = 0; j < otherPoly.vertCount; ++j)
+				{
+					if (otherPoly.neis[j] != (DT_EXT_LINK | opposite))
+						continue;
+
+					const float* oa = &other.verts[otherPoly.verts[j] * 3];
+					const float* ob = &other.verts[otherPoly.verts[(j + 1) % otherPoly.vertCount] * 3];
+
+					const float overlap = std::min(amax, std::max(oa[axis], ob[axis]))
+						- std::max(amin, std::min(oa[axis], ob[axis]));
+					if (overlap <= 0.01f)
+						continue;
+
+					if (std::max(oa[1], ob[1]) < ymin || std::min(oa[1], ob[1]) > ymax)
+						continue;
+
+					return true;
+				}
+			}
+		}
+
+		return false;
+	}
+
+	void CheckDetailMesh(int index, const dtPoly& poly)
+	{
+		// tiles built from tile cache layers don't have detail meshes
+		if (m_header.detailMeshCount == 0)
+			return;
+
+		if (index >= m_header.detailMeshCount)
+		{
+			Add(NavMeshIssue::BadDetailMesh);
+			return;
+		}
+
+		const dtPolyDetail& pd = m_tile.detailMeshes[index];
+		if (pd.triCount == 0
+			|| (int)(pd.vertBase + pd.vertCount) > m_header.detailVertCount
+			|| (int)(pd.triBase + pd.triCount) > m_header.detailTriCount)
+		{
+			Add(NavMeshIssue::BadDetailMesh);
+			return;
+		}
+
+		const int vertCount = poly.vertCount + pd.vertCount;
+		for (int k = 0; k < pd.triCount; ++k)
+		{
+			const unsigned char* t = &m_tile.detailTris[(pd.triBase + k) * 4];
+			if (t[0] >= vertCount || t[1] >= vertCount || t[2] >= vertCount)
+			{
+				Add(NavMeshIssue::BadDetailMesh);
+				return;
+			}
+		}
+	}
+
+	void CheckBVTree()
+	{
+		if (m_header.bvNodeCount == 0 || !m_tile.bvTree)
+			return;
+
+		// y is quantized from the detail mesh, which can be outside of the tile bounds
+		const float qfac = m_header.bvQuantFactor;
+		const int maxX = (int)((m_header.bmax[0] - m_header.bmin[0]) * qfac) + 1;
+		const int maxZ = (int)((m_header.bmax[2] - m_header.bmin[2]) * qfac) + 1;
+
+		int leaves = 0;
+		for (int n = 0; n < m_header.bvNodeCount; ++n)
+		{
+			const dtBVNode& node = m_tile.bvTree[n];
+
+			if (node.bmin[0] > node.bmax[0] || node.bmin[1] > node.bmax[1] || node.bmin[2] > node.bmax[2]
+				|| node.bmax[0] > maxX || node.bmax[2] > maxZ)
+			{
+				Add(NavMeshIssue::BadBVTree);
+				return;
+			}
+
+			if (node.i >= 0)
+			{
+				if (node.i >= m_header.offMeshBase)
+				{
+					Add(NavMeshIssue::BadBVTree);
+					return;
+				}
+
+				++leaves;
+			}
+			else if (n - node.i > m_header.bvNodeCount)
+			{
+				Add(NavMeshIssue::BadBVTree);
+				return;
+			}
+		}
+
+		// queries that go through the tree can't find polys that aren't in it
+		if (leaves != m_header.offMeshBase)
+			Add(NavMeshIssue::BadBVTree);
+	}
+
+	void CheckOffMeshConnections()
+	{
+		for (int i = 0; i < m_header.offMeshConCount; ++i)
+		{
+			const dtOffMeshConnection& con = m_tile.offMeshCons[i];
+			if (con.poly >= m_header.polyCount)
+			{
+				Add(NavMeshIssue::BadLink);
+				continue;
+			}
+
+			// detour links an off-mesh connection to the mesh with edge 0 at the
+			// start and edge 1 at the end.
+			bool start = false, end = false;
+			bool valid = ForEachLink(m_tile, m_tile.polys[con.poly], [&](const dtLink& link)
+			{
+				start = start || link.edge == 0;
+				end = end || link.edge == 1;
+			});
+
+			if (!valid)
+			{
+				Add(NavMeshIssue::BadLink);
+				continue;
+			}
+
+			if (!start)
+				Add(NavMeshIssue::OffMeshStart);
+			if (!end)
+				Add(NavMeshIssue::OffMeshEnd);
+		}
+	}
+
+	const dtNavMesh& m_navMesh;
+	const dtMeshTile& m_tile;
+	const dtMeshHeader& m_header;
+	NavMeshTileIssues& m_issues;
+};
+
+} // namespace
+
+std::vector<NavMeshTileIssues> ValidateNavMesh(const dtNavMesh& navMesh, TaskScheduler& scheduler)
+{
+	std::vector<const dtMeshTile*> tiles;
+	for (int i = 0; i < navMesh.getMaxTiles(); ++i)
+	{
+		const dtMeshTile* tile = navMesh.getTile(i);
+		if (tile && tile->header && tile->dataSize > 0)
+			tiles.push_back(tile);
+	}
+
+	std::vector<NavMeshTileIssues> results;
+	if (tiles.empty())
+		return results;
+
+	std::mutex resultsMutex;
+	std::atomic<size_t> nextTile{ 0 };
+
+	const int threadCount = std::min<int>(scheduler.GetThreadCount(), (int)tiles.size());
+	std::vector<TaskScheduler::Task> tasks;
+	tasks.reserve(threadCount);
+
+	for (int t = 0; t < threadCount; ++t)
+	{
+		tasks.emplace_back([&]()
+		{
+			std::vector<NavMeshTileIssues> found;
+
+			for (size_t i = nextTile++; i < tiles.size(); i = nextTile++)
+			{
+				const dtMeshTile* tile = tiles[i];
+
+				NavMeshTileIssues issues;
+				issues.ref = navMesh.getTileRef(tile);
+				issues.x = tile->header->x;
+				issues.y = tile->header->y;
+				issues.layer = tile->header->layer;
+
+				TileValidator(navMesh, *tile, issues).Validate();
+
+				if (std::any_of(std::begin(issues.counts), std::end(issues.counts), [](int count) { return count > 0; }))
+					found.push_back(issues);
+			}
+
+			std::unique_lock<std::mutex> lock(resultsMutex);
+			results.insert(results.end(), found.begin(), found.end());
+		});
+	}
+
+	scheduler.Run(std::move(tasks));
+	scheduler.Wait();
+
+	std::sort(results.begin(), results.end(), [](const NavMeshTileIssues& a, const NavMeshTileIssues& b)
+	{
+		if (a.y != b.y) return a.y < b.y;
+		if (a.x != b.x) return a.x < b.x;
+		return a.layer < b.layer;
+	});
+
+	return results;
+}
@@ -0,0 +1,45 @@
+//
+// NavMeshValidator.h
+//
+
+// Checks the tiles of a navmesh for data that detour accepts, but that shows up
+// as failed or partial paths at runtime: links that only go one way across a
+// tile border, portal edges that didn't connect, degenerate polys, detail meshes
+// and bv trees that point outside of the tile, and off-mesh connections that
+// didn't land. Every tile is checked on its own, so they're checked in parallel.
+
+#pragma once
+
+#include <DetourNavMesh.h>
+
+#include <vector>
+
+class TaskScheduler;
+
+enum class NavMeshIssue
+{
+	TooManyPolys,         // more polys than the navmesh's maxPolys
+	DegeneratePoly,       // fewer than 3 verts, no area, or verts outside the tile
+	BadLink,              // a link to a poly that isn't there
+	OneWayLink,           // a link between two polys that only one of them has
+	UnlinkedPortal,       // a portal edge facing a tile that it has no link into
+	BadDetailMesh,
+	BadBVTree,
+	OffMeshStart,         // an off-mesh connection whose start isn't linked to the mesh
+	OffMeshEnd,
+
+	Count
+};
+
+const char* GetNavMeshIssueName(NavMeshIssue issue);
+
+struct NavMeshTileIssues
+{
+	dtTileRef ref = 0;
+	int x = 0, y = 0, layer = 0;
+	int counts[(int)NavMeshIssue::Count] = {};
+};
+
+// check every tile of the navmesh on the scheduler, which is waited for. The
+// tiles can't change while this runs. Returns the tiles that have issues.
+std::vector<NavMeshTileIssues> ValidateNavMesh(const dtNavMesh& navMesh, TaskScheduler& scheduler);
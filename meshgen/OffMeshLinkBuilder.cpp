@@ -0,0 +1,213 @@
+//
+// OffMeshLinkBuilder.cpp
+//
+
+#include "OffMeshLinkBuilder.h"
+#include "InputGeom.h"
+
+#include "common/NavMeshData.h"
+
+#include <Recast.h>
+
+#include <algorithm>
+
+// rays per sample looking for a drop: the way off of the ledge, and down.
+static const int DROP_RAYS_PER_SAMPLE = 2;
+
+// rays per step looking for a place to jump to: the way across, and down.
+static const int JUMP_RAYS_PER_STEP = 2;
+
+//----------------------------------------------------------------------------
+
+OffMeshLinkBuilder::OffMeshLinkBuilder(const MeshRaycaster& raycaster, const OffMeshLinkSettings& settings)
+	: m_raycaster(raycaster)
+	, m_settings(settings)
+{
+}
+
+// the edge of the navmesh is about a radius away from the ledge, check the
+// ground a radius past the ledge.
+static float getProbeDistance(const OffMeshLinkSettings& settings)
+{
+	return settings.agentRadius * 3;
+}
+
+float OffMeshLinkBuilder::getReach(const OffMeshLinkSettings& settings)
+{
+	return std::max(getProbeDistance(settings), settings.maxJumpDistance + settings.agentRadius);
+}
+
+void OffMeshLinkBuilder::collectSamples(const rcPolyMesh& pmesh)
+{
+	const int nvp = pmesh.nvp;
+	const float spacing = std::max(m_settings.agentRadius * 2, pmesh.cs);
+
+	auto getVertex = [&](unsigned short index)
+	{
+		const unsigned short* v = &pmesh.verts[index * 3];
+		return glm::vec3(pmesh.bmin[0] + v[0] * pmesh.cs,
+			pmesh.bmin[1] + v[1] * pmesh.ch,
+			pmesh.bmin[2] + v[2] * pmesh.cs);
+	};
+
+	for (int i = 0; i < pmesh.npolys; ++i)
+	{
+		if (pmesh.areas[i] == RC_NULL_AREA || (pmesh.flags[i] & +PolyFlags::Disabled))
+			continue;
+
+		const unsigned short* p = &pmesh.polys[i * nvp * 2];
+
+		int nv = 0;
+		glm::vec3 center(0.0f);
+		while (nv < nvp && p[nv] != RC_MESH_NULL_IDX)
+			center += getVertex(p[nv++]);
+		if (nv < 3)
+			continue;
+		center /= (float)nv;
+
+		for (int j = 0; j < nv; ++j)
+		{
+			// edges shared with another poly, and portals to the next tile, have
+			// something on the other side.
+			if (p[nvp + j] != RC_MESH_NULL_IDX)
+				continue;
+
+			glm::vec3 a = getVertex(p[j]);
+			glm::vec3 b = getVertex(p[(j + 1) % nv]);
+			glm::vec3 edge = b - a;
+
+			float length = sqrtf(edge.x * edge.x + edge.z * edge.z);
+			if (length < pmesh.cs)
+				continue;
+
+			glm::vec3 normal(edge.z / length, 0.0f, -edge.x / length);
+			glm::vec3 mid = (a + b) * 0.5f;
+			if (normal.x * (mid.x - center.x) + normal.z * (mid.z - center.z) < 0)
+				normal = -normal;
+
+			int count = std::max(1, (int)(length / spacing));
+			for (int k = 0; k < count; ++k)
+			{
+				float t = (k + 0.5f) / count;
+				m_samples.push_back(EdgeSample{ a + edge * t, normal });
+			}
+		}
+	}
+}
+
+void OffMeshLinkBuilder::addLink(const glm::vec3& start, const glm::vec3& end, OffMeshConnections& out)
+{
+	out.verts.insert(out.verts.end(), { start.x, start.y, start.z, end.x, end.y, end.z });
+	out.rads.push_back(m_settings.agentRadius);
+	out.dirs.push_back(0);
+	out.areas.push_back(m_settings.area);
+	out.flags.push_back(m_settings.flags);
+	out.ids.push_back(0);
+}
+
+int OffMeshLinkBuilder::build(const rcPolyMesh& pmesh, OffMeshConnections& out)
+{
+	m_samples.clear();
+	collectSamples(pmesh);
+
+	if (m_samples.empty())
+		return 0;
+
+	const glm::vec3 up(0.0f, 1.0f, 0.0f);
+	const float probe = getProbeDistance(m_settings);
+
+	// rays start above the edge so that small steps don't block them, and go
+	// across at waist height so that low walls do.
+	const float lift = m_settings.agentMaxClimb;
+	const float waist = std::max(m_settings.agentHeight * 0.5f, lift);
+
+	// off of the ledge, then down to the lowest point that can be dropped to
+	m_rays.resize(m_samples.size() * DROP_RAYS_PER_SAMPLE);
+	for (size_t i = 0; i < m_samples.size(); ++i)
+	{
+		const EdgeSample& sample = m_samples[i];
+		glm::vec3 ground = sample.pos + sample.normal * probe;
+
+		MeshRay* rays = &m_rays[i * DROP_RAYS_PER_SAMPLE];
+		rays[0] = MeshRay{ sample.pos + up * waist, ground + up * waist };
+		rays[1] = MeshRay{ ground + up * lift, ground - up * m_settings.maxDropHeight };
+	}
+
+	m_raycaster.Raycast(m_rays.data(), (int)m_rays.size());
+
+	int added = 0;
+	std::vector<size_t> gaps;
+
+	for (size_t i = 0; i < m_samples.size(); ++i)
+	{
+		const EdgeSample& sample = m_samples[i];
+		const MeshRay* rays = &m_rays[i * DROP_RAYS_PER_SAMPLE];
+
+		// wall in the way
+		if (rays[0].hit)
+			continue;
+
+		if (rays[1].hit)
+		{
+			glm::vec3 landing = glm::mix(rays[1].start, rays[1].end, rays[1].t);
+
+			// ground carries on, the navmesh either covers it or it's too tight to stand on
+			if (sample.pos.y - landing.y <= m_settings.agentMaxClimb)
+				continue;
+
+			addLink(sample.pos, landing, out);
+			++added;
+		}
+
+		gaps.push_back(i);
+	}
+
+	if (gaps.empty() || m_settings.maxJumpDistance <= probe)
+		return added;
+
+	// across the gap, one step at a time, looking for ground at the same height
+	const float step = std::max(m_settings.agentRadius, pmesh.cs);
+	const int steps = std::max(1, (int)ceilf((m_settings.maxJumpDistance - probe) / step));
+
+	m_rays.resize(gaps.size() * steps * JUMP_RAYS_PER_STEP);
+	for (size_t i = 0; i < gaps.size(); ++i)
+	{
+		const EdgeSample& sample = m_samples[gaps[i]];
+
+		for (int s = 0; s < steps; ++s)
+		{
+			// land a radius in, so the end is on the navmesh on the far side
+			float distance = std::min(probe + step * (s + 1), m_settings.maxJumpDistance);
+			glm::vec3 ground = sample.pos + sample.normal * (distance + m_settings.agentRadius);
+
+			MeshRay* rays = &m_rays[(i * steps + s) * JUMP_RAYS_PER_STEP];
+			rays[0] = MeshRay{ sample.pos + up * waist, ground + up * waist };
+			rays[1] = MeshRay{ ground + up * lift, ground - up * m_settings.agentMaxClimb };
+		}
+	}
+
+	m_raycaster.Raycast(m_rays.data(), (int)m_rays.size());
+
+	for (size_t i = 0; i < gaps.size(); ++i)
+	{
+		const EdgeSample& sample = m_samples[gaps[i]];
+
+		for (int s = 0; s < steps; ++s)
+		{
+			const MeshRay* rays = &m_rays[(i * steps + s) * JUMP_RAYS_PER_STEP];
+
+			// anything further out is behind the wall too
+			if (rays[0].hit)
+				break;
+
+			if (rays[1].hit)
+			{
+				addLink(sample.pos, glm::mix(rays[1].start, rays[1].end, rays[1].t), out);
+				++added;
+				break;
+			}
+		}
+	}
+
+	return added;
+}
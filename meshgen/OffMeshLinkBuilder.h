@@ -0,0 +1,66 @@
+//
+// OffMeshLinkBuilder.h
+//
+
+#pragma once
+
+#include "MeshRaycaster.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+struct OffMeshConnections;
+struct rcPolyMesh;
+
+struct OffMeshLinkSettings
+{
+	float agentRadius = 2.0f;
+	float agentHeight = 6.0f;
+	float agentMaxClimb = 4.0f;
+
+	// furthest an agent is allowed to drop down off of a ledge
+	float maxDropHeight = 20.0f;
+
+	// widest gap that can be jumped across, to ground at about the same height
+	float maxJumpDistance = 12.0f;
+
+	// area and flags given to the links
+	uint8_t area = 0;
+	uint16_t flags = 0;
+};
+
+// Finds places along the boundary edges of a tile's poly mesh where an agent
+// could drop down to the ground below, or jump across a gap, and adds one way
+// off-mesh connections for them. Every sample is tested with a handful of
+// segments against the zone geometry, all of them cast in a single batch.
+class OffMeshLinkBuilder
+{
+public:
+	OffMeshLinkBuilder(const MeshRaycaster& raycaster, const OffMeshLinkSettings& settings);
+
+	// how far outside of a tile the links reach, geometry that far out affects
+	// the links of the tile.
+	static float getReach(const OffMeshLinkSettings& settings);
+
+	// pmesh needs its areas and flags set, disabled and unwalkable polys are
+	// skipped. Returns the number of links added to out.
+	int build(const rcPolyMesh& pmesh, OffMeshConnections& out);
+
+private:
+	struct EdgeSample
+	{
+		glm::vec3 pos;             // on the edge
+		glm::vec3 normal;          // pointing away from the poly, xz only
+	};
+
+	void collectSamples(const rcPolyMesh& pmesh);
+	void addLink(const glm::vec3& start, const glm::vec3& end, OffMeshConnections& out);
+
+	const MeshRaycaster& m_raycaster;
+	OffMeshLinkSettings m_settings;
+
+	std::vector<EdgeSample> m_samples;
+	std::vector<MeshRay> m_rays;
+};
@@ -0,0 +1,305 @@
+//
+// PathBenchmark.cpp
+//
+
+#include "PathBenchmark.h"
+
+#include "EQConfig.h"
+#include "common/Context.h"
+#include "common/NavMesh.h"
+#include "common/NavTrace.h"
+
+#include <DetourNavMeshQuery.h>
+#include <DetourNode.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+
+// same limits the plugin uses for its queries
+static const int MAX_NODES = 2048 * 4;
+static const int MAX_POLYS = 4028 * 4;
+static const float POLY_PICK_EXTENTS[3] = { 2, 4, 2 };
+
+using clock_type = std::chrono::high_resolution_clock;
+
+static double ElapsedMs(clock_type::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(clock_type::now() - start).count();
+}
+
+template <typename T>
+static T Percentile(std::vector<T>& values, double p)
+{
+	if (values.empty())
+		return T();
+
+	size_t index = std::min(static_cast<size_t>(p * values.size()), values.size() - 1);
+	std::nth_element(values.begin(), values.begin() + index, values.end());
+
+	return values[index];
+}
+
+//============================================================================
+
+PathBenchmark::PathBenchmark(EQConfig& eqConfig, Context* context)
+	: m_eqConfig(eqConfig)
+	, m_context(context)
+{
+}
+
+bool PathBenchmark::LoadCorpus(const std::string& filename)
+{
+	const size_t extLength = strlen(NAVTRACE_EXTENSION);
+	if (filename.size() > extLength
+		&& _stricmp(filename.c_str() + filename.size() - extLength, NAVTRACE_EXTENSION) == 0)
+	{
+		return LoadTrace(filename);
+	}
+
+	std::ifstream infile(filename);
+	if (!infile.is_open())
+	{
+		m_context->Log(LogLevel::ERROR, "Failed to open path corpus: %s", filename.c_str());
+		return false;
+	}
+
+	m_queries.clear();
+
+	std::string line;
+	while (std::getline(infile, line))
+	{
+		std::istringstream ss(line);
+		std::string tag;
+		Query query;
+		uint32_t includeFlags = 0xffff, excludeFlags = 0;
+
+		if (!(ss >> tag >> query.start[0] >> query.start[1] >> query.start[2]
+			>> query.end[0] >> query.end[1] >> query.end[2]))
+		{
+			continue;
+		}
+
+		// the flags are optional
+		if (ss >> std::hex >> includeFlags)
+			ss >> excludeFlags;
+
+		query.includeFlags = static_cast<uint16_t>(includeFlags);
+		query.excludeFlags = static_cast<uint16_t>(excludeFlags);
+		m_queries.push_back(query);
+	}
+
+	m_context->Log(LogLevel::INFO, "Loaded %d queries from %s", (int)m_queries.size(), filename.c_str());
+	return !m_queries.empty();
+}
+
+bool PathBenchmark::LoadTrace(const std::string& filename)
+{
+	NavTraceHeader header;
+	std::vector<NavTraceRecord> records;
+	if (!ReadNavTrace(filename, header, records))
+	{
+		m_context->Log(LogLevel::ERROR, "Failed to read trace: %s", filename.c_str());
+		return false;
+	}
+
+	m_queries.clear();
+	m_recordedMs.clear();
+	m_traceZone.assign(header.zoneShortName, strnlen(header.zoneShortName, sizeof(header.zoneShortName)));
+
+	int pulses = 0, stalls = 0;
+	for (const NavTraceRecord& record : records)
+	{
+		if (record.event == NavTraceEvent::Pulse)
+			++pulses;
+		else if (record.event == NavTraceEvent::Stuck)
+			++stalls;
+
+		if (record.event != NavTraceEvent::Replan)
+			continue;
+
+		Query query;
+		std::copy(std::begin(record.pos), std::end(record.pos), query.start);
+		std::copy(std::begin(record.dest), std::end(record.dest), query.end);
+		query.includeFlags = record.includeFlags;
+		query.excludeFlags = record.excludeFlags;
+		m_queries.push_back(query);
+
+		// searches that went to the worker only timed handing them over
+		if (!(record.flags & NAVTRACE_INCREMENTAL))
+			m_recordedMs.push_back(record.queryMs);
+	}
+
+	m_context->Log(LogLevel::INFO, "Loaded %d replans from %s (%s): %d pulses, %d stalls",
+		(int)m_queries.size(), filename.c_str(), m_traceZone.c_str(), pulses, stalls);
+	return !m_queries.empty();
+}
+
+bool PathBenchmark::Run(const std::string& zoneShortName)
+{
+	if (!m_traceZone.empty() && _stricmp(m_traceZone.c_str(), zoneShortName.c_str()) != 0)
+	{
+		m_context->Log(LogLevel::WARNING, "Trace was recorded in %s, replaying it in %s",
+			m_traceZone.c_str(), zoneShortName.c_str());
+	}
+
+	NavMesh navMesh(m_context, m_eqConfig.GetOutputPath() + "\\MQ2Nav", zoneShortName);
+
+	auto loadStart = clock_type::now();
+	NavMesh::LoadResult loadResult = navMesh.LoadNavMeshFile();
+	if (loadResult != NavMesh::LoadResult::Success)
+	{
+		m_context->Log(LogLevel::ERROR, "%s: failed to load navmesh (%d)", zoneShortName.c_str(), (int)loadResult);
+		return false;
+	}
+
+	m_context->Log(LogLevel::INFO, "%s: navmesh loaded in %.2fms", zoneShortName.c_str(), ElapsedMs(loadStart));
+
+	std::shared_ptr<dtNavMeshQuery> query = navMesh.AcquireNavMeshQuery(MAX_NODES);
+	if (!query)
+	{
+		m_context->Log(LogLevel::ERROR, "%s: failed to create navmesh query", zoneShortName.c_str());
+		return false;
+	}
+
+	dtQueryFilter filter;
+	navMesh.FillFilterAreaCosts(filter);
+
+	std::unique_ptr<dtPolyRef[]> polys(new dtPolyRef[MAX_POLYS]);
+	std::unique_ptr<float[]> straightPath(new float[MAX_POLYS * 3]);
+
+	std::vector<Result> results;
+	results.reserve(m_queries.size() * m_repeatCount);
+
+	for (int repeat = 0; repeat < m_repeatCount; ++repeat)
+	{
+		for (const Query& q : m_queries)
+		{
+			Result result;
+			filter.setIncludeFlags(q.includeFlags);
+			filter.setExcludeFlags(q.excludeFlags);
+
+			dtPolyRef startRef = 0, endRef = 0;
+			float spos[3], epos[3];
+
+			auto start = clock_type::now();
+			query->findNearestPoly(q.start, POLY_PICK_EXTENTS, &filter, &startRef, spos);
+			query->findNearestPoly(q.end, POLY_PICK_EXTENTS, &filter, &endRef, epos);
+			result.nearestPolyMs = ElapsedMs(start);
+
+			if (startRef && endRef)
+			{
+				result.hasPolys = true;
+
+				start = clock_type::now();
+				dtStatus status = query->findPath(startRef, endRef, spos, epos, &filter,
+					polys.get(), &result.polys, MAX_POLYS);
+				result.findPathMs = ElapsedMs(start);
+
+				result.nodes = query->getNodePool()->getNodeCount();
+				result.found = dtStatusSucceed(status) && result.polys > 0;
+				result.partial = dtStatusDetail(status, DT_PARTIAL_RESULT);
+
+				if (result.found)
+				{
+					start = clock_type::now();
+					query->findStraightPath(spos, epos, polys.get(), result.polys, straightPath.get(),
+						0, 0, &result.straightPoints, MAX_POLYS, DT_STRAIGHTPATH_AREA_CROSSINGS);
+					result.straightPathMs = ElapsedMs(start);
+				}
+			}
+
+			results.push_back(result);
+		}
+	}
+
+	Report(results);
+
+	if (!m_outputFile.empty() && !WriteResults(results))
+		m_context->Log(LogLevel::ERROR, "Failed to write results to %s", m_outputFile.c_str());
+
+	return true;
+}
+
+void PathBenchmark::Report(const std::vector<Result>& results)
+{
+	std::vector<double> nearestPoly, findPath, straightPath;
+	std::vector<int> nodes;
+	int found = 0, partial = 0, missing = 0;
+
+	for (const Result& result : results)
+	{
+		nearestPoly.push_back(result.nearestPolyMs);
+
+		if (result.hasPolys)
+		{
+			findPath.push_back(result.findPathMs);
+			nodes.push_back(result.nodes);
+		}
+		else
+		{
+			++missing;
+		}
+
+		if (result.found)
+		{
+			straightPath.push_back(result.straightPathMs);
+			++found;
+		}
+		if (result.partial)
+			++partial;
+	}
+
+	auto LogTimes = [this](const char* name, std::vector<double>& values)
+	{
+		if (values.empty())
+			return;
+
+		double total = 0;
+		for (double value : values)
+			total += value;
+
+		m_context->Log(LogLevel::INFO, "  %-16s avg %8.3f  p50 %8.3f  p90 %8.3f  p99 %8.3f  max %8.3f ms",
+			name, total / values.size(), Percentile(values, 0.5), Percentile(values, 0.9),
+			Percentile(values, 0.99), *std::max_element(values.begin(), values.end()));
+	};
+
+	m_context->Log(LogLevel::INFO, "%d queries: %d found, %d partial (%.1f%%), %d without start or end poly",
+		(int)results.size(), found, partial, found ? 100.0f * partial / found : 0.0f, missing);
+
+	LogTimes("findNearestPoly", nearestPoly);
+	LogTimes("findPath", findPath);
+	LogTimes("findStraightPath", straightPath);
+
+	// the in game times include everything the plugin does for a replan
+	std::vector<double> recorded = m_recordedMs;
+	LogTimes("recorded replan", recorded);
+
+	if (!nodes.empty())
+	{
+		m_context->Log(LogLevel::INFO, "  %-16s p50 %d  p99 %d  max %d", "nodes",
+			Percentile(nodes, 0.5), Percentile(nodes, 0.99), *std::max_element(nodes.begin(), nodes.end()));
+	}
+}
+
+bool PathBenchmark::WriteResults(const std::vector<Result>& results)
+{
+	std::ofstream outfile(m_outputFile, std::ios::trunc);
+	if (!outfile.is_open())
+		return false;
+
+	outfile << "query,nearest_poly_ms,find_path_ms,straight_path_ms,nodes,polys,straight_points,found,partial\n";
+
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const Result& r = results[i];
+		outfile << (i % m_queries.size()) << ',' << r.nearestPolyMs << ',' << r.findPathMs << ','
+			<< r.straightPathMs << ',' << r.nodes << ',' << r.polys << ',' << r.straightPoints << ','
+			<< r.found << ',' << r.partial << '\n';
+	}
+
+	return outfile.good();
+}
@@ -0,0 +1,82 @@
+//
+// PathBenchmark.h
+//
+
+// Replays a list of recorded path queries against a zone's navmesh and reports how
+// long each part of the query took. Only the saved navmesh is needed, so results
+// can be compared between meshes, settings and builds.
+//
+// The corpus uses the format printed by the tester tool with DUMP_REQS, one query
+// per line, in recast coordinates:
+//
+//   ps  sx sy sz  ex ey ez  0xINCLUDE 0xEXCLUDE
+//
+// The leading tag is ignored, so "pi" and "rc" lines replay as straight paths too.
+//
+// A .navtrace file recorded in game with /nav trace can be used as the corpus as
+// well. Its replans are replayed, and the times they took in game are reported
+// next to the replayed ones.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Context;
+class EQConfig;
+
+class PathBenchmark
+{
+public:
+	PathBenchmark(EQConfig& eqConfig, Context* context);
+
+	bool LoadCorpus(const std::string& filename);
+
+	// run every query this many times
+	void SetRepeatCount(int repeats) { m_repeatCount = repeats; }
+
+	// if set, also write one row per query
+	void SetOutputFile(const std::string& filename) { m_outputFile = filename; }
+
+	// returns false if the navmesh couldn't be loaded
+	bool Run(const std::string& zoneShortName);
+
+private:
+	bool LoadTrace(const std::string& filename);
+
+	struct Query
+	{
+		float start[3];
+		float end[3];
+		uint16_t includeFlags;
+		uint16_t excludeFlags;
+	};
+
+	struct Result
+	{
+		double nearestPolyMs = 0;
+		double findPathMs = 0;
+		double straightPathMs = 0;
+		int nodes = 0;
+		int polys = 0;
+		int straightPoints = 0;
+		bool hasPolys = false; // found polys for both ends
+		bool found = false;
+		bool partial = false;
+	};
+
+	void Report(const std::vector<Result>& results);
+	bool WriteResults(const std::vector<Result>& results);
+
+	EQConfig& m_eqConfig;
+	Context* m_context;
+
+	std::vector<Query> m_queries;
+	int m_repeatCount = 1;
+
+	// replan times from a trace, and the zone it was recorded in
+	std::vector<double> m_recordedMs;
+	std::string m_traceZone;
+	std::string m_outputFile;
+};
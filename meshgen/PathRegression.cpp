@@ -0,0 +1,427 @@
+//
+// PathRegression.cpp
+//
+
+#include "PathRegression.h"
+
+#include "EQConfig.h"
+#include "TaskScheduler.h"
+#include "common/Context.h"
+#include "common/NavMesh.h"
+#include "common/NavTrace.h"
+#include "common/Utilities.h"
+
+#include <DetourCommon.h>
+#include <DetourNavMesh.h>
+#include <DetourNavMeshQuery.h>
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+
+namespace fs = boost::filesystem;
+
+// same limits the plugin uses for its queries
+static const int MAX_NODES = 2048 * 4;
+static const int MAX_POLYS = 4028 * 4;
+static const float POLY_PICK_EXTENTS[3] = { 2, 4, 2 };
+
+// regions listed in the report, the ones with the most broken paths first
+static const int MAX_REPORTED_REGIONS = 20;
+
+using clock_type = std::chrono::high_resolution_clock;
+
+static const char* GetStatusName(int status)
+{
+	static const char* names[] = { "no_poly", "not_found", "partial", "found" };
+	return names[status];
+}
+
+//============================================================================
+
+PathRegression::PathRegression(EQConfig& eqConfig, Context* context)
+	: m_eqConfig(eqConfig)
+	, m_context(context)
+{
+}
+
+bool PathRegression::LoadCorpus(const std::string& filename)
+{
+	const size_t extLength = strlen(NAVTRACE_EXTENSION);
+	if (filename.size() > extLength
+		&& _stricmp(filename.c_str() + filename.size() - extLength, NAVTRACE_EXTENSION) == 0)
+	{
+		return LoadTrace(filename);
+	}
+
+	std::ifstream infile(filename);
+	if (!infile.is_open())
+	{
+		m_context->Log(LogLevel::ERROR, "Failed to open path corpus: %s", filename.c_str());
+		return false;
+	}
+
+	m_queries.clear();
+
+	std::string line;
+	while (std::getline(infile, line))
+	{
+		std::istringstream ss(line);
+		std::string tag;
+		Query query;
+		uint32_t includeFlags = 0xffff, excludeFlags = 0;
+
+		if (!(ss >> tag >> query.start.x >> query.start.y >> query.start.z
+			>> query.end.x >> query.end.y >> query.end.z))
+		{
+			continue;
+		}
+
+		// the flags are optional
+		if (ss >> std::hex >> includeFlags)
+			ss >> excludeFlags;
+
+		query.includeFlags = static_cast<uint16_t>(includeFlags);
+		query.excludeFlags = static_cast<uint16_t>(excludeFlags);
+		m_queries.push_back(query);
+	}
+
+	m_context->Log(LogLevel::INFO, "Loaded %d queries from %s", (int)m_queries.size(), filename.c_str());
+	return !m_queries.empty();
+}
+
+bool PathRegression::LoadTrace(const std::string& filename)
+{
+	NavTraceHeader header;
+	std::vector<NavTraceRecord> records;
+	if (!ReadNavTrace(filename, header, records))
+	{
+		m_context->Log(LogLevel::ERROR, "Failed to read trace: %s", filename.c_str());
+		return false;
+	}
+
+	m_queries.clear();
+
+	for (const NavTraceRecord& record : records)
+	{
+		if (record.event != NavTraceEvent::Replan)
+			continue;
+
+		Query query;
+		query.start = glm::vec3(record.pos[0], record.pos[1], record.pos[2]);
+		query.end = glm::vec3(record.dest[0], record.dest[1], record.dest[2]);
+		query.includeFlags = record.includeFlags;
+		query.excludeFlags = record.excludeFlags;
+		m_queries.push_back(query);
+	}
+
+	m_context->Log(LogLevel::INFO, "Loaded %d replans from %s", (int)m_queries.size(), filename.c_str());
+	return !m_queries.empty();
+}
+
+bool PathRegression::LoadMesh(NavMesh& navMesh, const char* name)
+{
+	auto loadStart = clock_type::now();
+
+	NavMesh::LoadResult loadResult = navMesh.LoadNavMeshFile();
+	if (loadResult != NavMesh::LoadResult::Success)
+	{
+		m_context->Log(LogLevel::ERROR, "%s navmesh %s failed to load (%d)", name,
+			navMesh.GetDataFileName().c_str(), (int)loadResult);
+		return false;
+	}
+
+	m_context->Log(LogLevel::INFO, "%s navmesh %s loaded in %.2fms", name, navMesh.GetDataFileName().c_str(),
+		std::chrono::duration<double, std::milli>(clock_type::now() - loadStart).count());
+	return true;
+}
+
+bool PathRegression::Run(const std::string& zoneShortName)
+{
+	// the reference has to be named for the zone, a file is taken from its folder
+	fs::path referenceFolder = m_referencePath;
+	if (fs::is_regular_file(referenceFolder))
+	{
+		if (_stricmp(referenceFolder.stem().string().c_str(), zoneShortName.c_str()) != 0)
+		{
+			m_context->Log(LogLevel::ERROR, "Reference navmesh %s isn't named for %s", m_referencePath.c_str(),
+				zoneShortName.c_str());
+			return false;
+		}
+
+		referenceFolder = referenceFolder.parent_path();
+	}
+
+	NavMesh reference(m_context, referenceFolder.string(), zoneShortName);
+	NavMesh current(m_context, m_eqConfig.GetOutputPath() + "\\MQ2Nav", zoneShortName);
+
+	if (!LoadMesh(reference, "Reference") || !LoadMesh(current, "Current"))
+		return false;
+
+	boost::system::error_code ec;
+	if (fs::equivalent(reference.GetDataFileName(), current.GetDataFileName(), ec))
+		m_context->Log(LogLevel::WARNING, "The reference is the current navmesh, nothing will change");
+
+	auto start = clock_type::now();
+
+	std::vector<Result> results(m_queries.size());
+	RunQueries(reference, current, results);
+
+	double elapsedMs = std::chrono::duration<double, std::milli>(clock_type::now() - start).count();
+	int regressions = Report(results, elapsedMs);
+
+	if (!m_outputFile.empty() && !WriteResults(results))
+		m_context->Log(LogLevel::ERROR, "Failed to write results to %s", m_outputFile.c_str());
+
+	return regressions == 0;
+}
+
+void PathRegression::RunQueries(NavMesh& reference, NavMesh& current, std::vector<Result>& results)
+{
+	TaskScheduler scheduler(m_threadCount);
+	const int threadCount = std::min<int>(scheduler.GetThreadCount(), (int)m_queries.size());
+
+	dtQueryFilter referenceFilter, currentFilter;
+	reference.FillFilterAreaCosts(referenceFilter);
+	current.FillFilterAreaCosts(currentFilter);
+
+	// each worker takes the next query until there are none left
+	std::atomic<size_t> nextQuery{ 0 };
+	std::vector<TaskScheduler::Task> tasks;
+
+	for (int i = 0; i < threadCount; ++i)
+	{
+		tasks.push_back([&]()
+		{
+			auto makeQuery = [](const std::shared_ptr<dtNavMesh>& nav)
+			{
+				deleting_unique_ptr<dtNavMeshQuery> query(dtAllocNavMeshQuery(),
+					[](dtNavMeshQuery* q) { dtFreeNavMeshQuery(q); });
+				if (query && dtStatusFailed(query->init(nav.get(), MAX_NODES)))
+					query.reset();
+				return query;
+			};
+
+			deleting_unique_ptr<dtNavMeshQuery> referenceQuery = makeQuery(reference.GetNavMesh());
+			deleting_unique_ptr<dtNavMeshQuery> currentQuery = makeQuery(current.GetNavMesh());
+			if (!referenceQuery || !currentQuery)
+				return;
+
+			dtQueryFilter filters[2] = { referenceFilter, currentFilter };
+			dtNavMeshQuery* queries[2] = { referenceQuery.get(), currentQuery.get() };
+
+			std::vector<dtPolyRef> polys(MAX_POLYS);
+			std::vector<float> straightPath(MAX_POLYS * 3);
+
+			for (size_t index = nextQuery++; index < m_queries.size(); index = nextQuery++)
+			{
+				const Query& q = m_queries[index];
+				PathResult* pathResults[2] = { &results[index].reference, &results[index].current };
+
+				for (int mesh = 0; mesh < 2; ++mesh)
+				{
+					dtNavMeshQuery* query = queries[mesh];
+					dtQueryFilter& filter = filters[mesh];
+					PathResult& result = *pathResults[mesh];
+
+					filter.setIncludeFlags(q.includeFlags);
+					filter.setExcludeFlags(q.excludeFlags);
+
+					dtPolyRef startRef = 0, endRef = 0;
+					float spos[3], epos[3];
+					query->findNearestPoly(&q.start[0], POLY_PICK_EXTENTS, &filter, &startRef, spos);
+					query->findNearestPoly(&q.end[0], POLY_PICK_EXTENTS, &filter, &endRef, epos);
+					if (!startRef || !endRef)
+						continue;
+
+					int polyCount = 0;
+					dtStatus status = query->findPath(startRef, endRef, spos, epos, &filter,
+						polys.data(), &polyCount, MAX_POLYS);
+					if (dtStatusFailed(status) || polyCount == 0)
+					{
+						result.status = PathStatus::NotFound;
+						continue;
+					}
+
+					result.status = dtStatusDetail(status, DT_PARTIAL_RESULT) || polys[polyCount - 1] != endRef
+						? PathStatus::Partial : PathStatus::Found;
+
+					int pointCount = 0;
+					query->findStraightPath(spos, epos, polys.data(), polyCount, straightPath.data(),
+						nullptr, nullptr, &pointCount, MAX_POLYS);
+
+					for (int p = 1; p < pointCount; ++p)
+						result.length += dtVdist(&straightPath[(p - 1) * 3], &straightPath[p * 3]);
+				}
+			}
+		});
+	}
+
+	scheduler.Run(std::move(tasks));
+	scheduler.Wait();
+}
+
+PathRegression::Change PathRegression::GetChange(const Result& result) const
+{
+	const bool referenceFound = result.reference.status == PathStatus::Found;
+	const bool currentFound = result.current.status == PathStatus::Found;
+
+	if (referenceFound && !currentFound)
+		return Change::Broken;
+	if (!referenceFound && currentFound)
+		return Change::Fixed;
+	if (!referenceFound)
+		return Change::None;
+
+	const float tolerance = m_lengthTolerance / 100.0f;
+	if (result.current.length > result.reference.length * (1.0f + tolerance))
+		return Change::Longer;
+	if (result.current.length < result.reference.length * (1.0f - tolerance))
+		return Change::Shorter;
+
+	return Change::None;
+}
+
+int PathRegression::Report(const std::vector<Result>& results, double elapsedMs) const
+{
+	struct RegionStats
+	{
+		int queries = 0;
+		int referenceFound = 0;
+		int currentFound = 0;
+		int broken = 0;
+		int fixed = 0;
+		int longer = 0;
+	};
+
+	int changes[5] = {};
+	int referenceFound = 0, currentFound = 0;
+	double referenceLength = 0, currentLength = 0;
+	std::map<std::pair<int, int>, RegionStats> regions;
+
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const Result& result = results[i];
+		const Query& q = m_queries[i];
+		Change change = GetChange(result);
+		++changes[(int)change];
+
+		// by where the path starts
+		RegionStats& region = regions[{ (int)floorf(q.start.x / m_regionSize), (int)floorf(q.start.z / m_regionSize) }];
+		++region.queries;
+
+		if (result.reference.status == PathStatus::Found)
+		{
+			++referenceFound;
+			++region.referenceFound;
+		}
+		if (result.current.status == PathStatus::Found)
+		{
+			++currentFound;
+			++region.currentFound;
+		}
+
+		if (change == Change::Broken)
+			++region.broken;
+		else if (change == Change::Fixed)
+			++region.fixed;
+		else if (change == Change::Longer)
+			++region.longer;
+
+		// the length of the paths found on both
+		if (result.reference.status == PathStatus::Found && result.current.status == PathStatus::Found)
+		{
+			referenceLength += result.reference.length;
+			currentLength += result.current.length;
+		}
+	}
+
+	const int regressions = changes[(int)Change::Broken] + changes[(int)Change::Longer];
+
+	m_context->Log(LogLevel::INFO, "%d queries in %.0fms: %d found on the reference, %d on the current mesh",
+		(int)results.size(), elapsedMs, referenceFound, currentFound);
+	m_context->Log(LogLevel::INFO, "  broken %d  fixed %d  longer than %.1f%% %d  shorter %d",
+		changes[(int)Change::Broken], changes[(int)Change::Fixed], m_lengthTolerance,
+		changes[(int)Change::Longer], changes[(int)Change::Shorter]);
+
+	if (referenceLength > 0)
+	{
+		m_context->Log(LogLevel::INFO, "  paths found on both are %+.2f%% in total length",
+			100.0 * (currentLength - referenceLength) / referenceLength);
+	}
+
+	// the regions that changed, worst first
+	std::vector<std::pair<std::pair<int, int>, RegionStats>> changed;
+	for (const auto& entry : regions)
+	{
+		const RegionStats& region = entry.second;
+		if (region.broken || region.fixed || region.longer)
+			changed.push_back(entry);
+	}
+
+	std::sort(changed.begin(), changed.end(), [](const auto& a, const auto& b)
+	{
+		if (a.second.broken != b.second.broken)
+			return a.second.broken > b.second.broken;
+		return a.second.longer > b.second.longer;
+	});
+
+	if (!changed.empty())
+	{
+		// regions are in the -region order of the batch builder, so they can be rebuilt
+		m_context->Log(LogLevel::INFO, "%d regions changed:", (int)changed.size());
+
+		for (int i = 0; i < std::min((int)changed.size(), MAX_REPORTED_REGIONS); ++i)
+		{
+			const std::pair<int, int>& cell = changed[i].first;
+			const RegionStats& region = changed[i].second;
+
+			m_context->Log(LogLevel::INFO, "  %.0f,%.0f,%.0f,%.0f: %d queries, reachable %d -> %d, broken %d, fixed %d, longer %d",
+				cell.second * m_regionSize, cell.first * m_regionSize,
+				(cell.second + 1) * m_regionSize, (cell.first + 1) * m_regionSize,
+				region.queries, region.referenceFound, region.currentFound,
+				region.broken, region.fixed, region.longer);
+		}
+	}
+
+	if (regressions > 0)
+		m_context->Log(LogLevel::ERROR, "%d paths regressed", regressions);
+
+	return regressions;
+}
+
+bool PathRegression::WriteResults(const std::vector<Result>& results) const
+{
+	static const char* changeNames[] = { "none", "broken", "fixed", "longer", "shorter" };
+
+	std::ofstream outfile(m_outputFile, std::ios::trunc);
+	if (!outfile.is_open())
+		return false;
+
+	outfile << "query,change,reference_status,reference_length,current_status,current_length,"
+		"sx,sy,sz,ex,ey,ez\n";
+
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const Result& r = results[i];
+		Change change = GetChange(r);
+		if (change == Change::None)
+			continue;
+
+		const Query& q = m_queries[i];
+		outfile << i << ',' << changeNames[(int)change] << ','
+			<< GetStatusName((int)r.reference.status) << ',' << r.reference.length << ','
+			<< GetStatusName((int)r.current.status) << ',' << r.current.length << ','
+			<< q.start.x << ',' << q.start.y << ',' << q.start.z << ','
+			<< q.end.x << ',' << q.end.y << ',' << q.end.z << '\n';
+	}
+
+	return outfile.good();
+}
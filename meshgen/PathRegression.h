@@ -0,0 +1,109 @@
+//
+// PathRegression.h
+//
+
+// Runs a path corpus against a reference navmesh of a zone and the current one,
+// to check that a rebuild with new settings didn't break paths or make them
+// longer. Queries are spread over every core, each thread with a query object
+// for both meshes.
+//
+// The corpus is the same as PathBenchmark's: the tester tool's DUMP_REQS lines
+// or a .navtrace recorded in game. Changes are reported for the whole corpus and
+// by region, a square of the map that the queries start in.
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Context;
+class EQConfig;
+class NavMesh;
+
+class PathRegression
+{
+public:
+	PathRegression(EQConfig& eqConfig, Context* context);
+
+	bool LoadCorpus(const std::string& filename);
+
+	// the folder holding the reference <zone>.navmesh, or the file itself
+	void SetReferencePath(const std::string& path) { m_referencePath = path; }
+
+	// paths that got longer than this, in percent, are counted as regressions
+	void SetLengthTolerance(float percent) { m_lengthTolerance = percent; }
+
+	// size of the regions that changes are grouped by, in world units
+	void SetRegionSize(float size) { m_regionSize = size; }
+
+	// number of threads running queries, 0 for one per hardware thread
+	void SetThreadCount(int threads) { m_threadCount = threads; }
+
+	// if set, also write one row per query that changed
+	void SetOutputFile(const std::string& filename) { m_outputFile = filename; }
+
+	// returns false if either mesh couldn't be loaded, or if any path broke or
+	// got too much longer.
+	bool Run(const std::string& zoneShortName);
+
+private:
+	bool LoadTrace(const std::string& filename);
+
+	struct Query
+	{
+		glm::vec3 start;
+		glm::vec3 end;
+		uint16_t includeFlags = 0xffff;
+		uint16_t excludeFlags = 0;
+	};
+
+	enum class PathStatus : uint8_t
+	{
+		NoPoly,           // no poly near the start or the end
+		NotFound,
+		Partial,
+		Found,
+	};
+
+	struct PathResult
+	{
+		PathStatus status = PathStatus::NoPoly;
+		float length = 0;
+	};
+
+	struct Result
+	{
+		PathResult reference;
+		PathResult current;
+	};
+
+	enum class Change : uint8_t
+	{
+		None,
+		Broken,           // complete on the reference mesh only
+		Fixed,            // complete on the current mesh only
+		Longer,
+		Shorter,
+	};
+
+	bool LoadMesh(NavMesh& navMesh, const char* name);
+	void RunQueries(NavMesh& reference, NavMesh& current, std::vector<Result>& results);
+	Change GetChange(const Result& result) const;
+
+	// returns the number of regressions
+	int Report(const std::vector<Result>& results, double elapsedMs) const;
+	bool WriteResults(const std::vector<Result>& results) const;
+
+	EQConfig& m_eqConfig;
+	Context* m_context;
+
+	std::vector<Query> m_queries;
+	std::string m_referencePath;
+	std::string m_outputFile;
+	float m_lengthTolerance = 5.0f;
+	float m_regionSize = 500.0f;
+	int m_threadCount = 0;
+};
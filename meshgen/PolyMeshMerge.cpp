@@ -0,0 +1,406 @@
+//
+// PolyMeshMerge.cpp
+//
+
+#include "PolyMeshMerge.h"
+
+#include <Recast.h>
+#include <RecastAlloc.h>
+#include <DetourNavMesh.h>
+
+#include <cmath>
+#include <cstring>
+
+// two polys merged together, before their straight verts are taken out
+static const int MERGE_MAX_RING_VERTS = DT_VERTS_PER_POLYGON * 2;
+
+namespace {
+
+struct MergePoly
+{
+	unsigned short verts[MERGE_MAX_RING_VERTS];
+	unsigned short neis[MERGE_MAX_RING_VERTS];   // neis[i] is across the edge from verts[i] to verts[i + 1]
+	int count = 0;
+	unsigned short reg = 0;
+	unsigned short flags = 0;
+	uint8_t area = 0;
+	uint16_t key = 0;
+	bool removed = false;
+};
+
+} // namespace
+
+// an edge between two polys of the tile, rather than a wall or a portal to
+// another tile
+static bool IsInnerEdge(unsigned short nei)
+{
+	return nei != RC_MESH_NULL_IDX && !(nei & 0x8000);
+}
+
+// less than zero where the polys turn the way they wind, zero if the verts are
+// on a line
+static int Cross2D(const unsigned short* a, const unsigned short* b, const unsigned short* c)
+{
+	return ((int)b[0] - a[0]) * ((int)c[2] - a[2]) - ((int)c[0] - a[0]) * ((int)b[2] - a[2]);
+}
+
+// true if v is on the segment from p to n and at about its height. maxClimb is
+// in cells.
+static bool IsStraightVert(const unsigned short* p, const unsigned short* v, const unsigned short* n, float maxClimb)
+{
+	if (Cross2D(p, v, n) != 0)
+		return false;
+
+	const int dx = (int)n[0] - p[0];
+	const int dz = (int)n[2] - p[2];
+	const int len = dx * dx + dz * dz;
+	const int along = ((int)v[0] - p[0]) * dx + ((int)v[2] - p[2]) * dz;
+	if (along <= 0 || along >= len)
+		return false;
+
+	const float y = p[1] + ((float)n[1] - p[1]) * along / (float)len;
+	return fabsf(v[1] - y) <= maxClimb;
+}
+
+// take out the verts in the middle of straight walls and tile borders. Verts
+// between edges shared with other polys are kept, the other polys still use
+// them. Returns the number of verts taken out.
+static int SimplifyPoly(MergePoly& poly, const unsigned short* verts, float maxClimb)
+{
+	int removed = 0;
+
+	for (int i = 0; i < poly.count && poly.count > 3;)
+	{
+		const int prev = (i + poly.count - 1) % poly.count;
+		const int next = (i + 1) % poly.count;
+
+		if (poly.neis[prev] == poly.neis[i] && !IsInnerEdge(poly.neis[i])
+			&& IsStraightVert(&verts[poly.verts[prev] * 3], &verts[poly.verts[i] * 3],
+				&verts[poly.verts[next] * 3], maxClimb))
+		{
+			// the edge before it takes the place of both
+			memmove(&poly.verts[i], &poly.verts[i + 1], sizeof(unsigned short) * (poly.count - i - 1));
+			memmove(&poly.neis[i], &poly.neis[i + 1], sizeof(unsigned short) * (poly.count - i - 1));
+			--poly.count;
+			++removed;
+		}
+		else
+		{
+			++i;
+		}
+	}
+
+	return removed;
+}
+
+// true if the poly is no further than maxHeightError in world units from the
+// plane through it
+static bool IsFlat(const MergePoly& poly, const rcPolyMesh& pmesh, float maxHeightError)
+{
+	float pts[MERGE_MAX_RING_VERTS][3];
+	float center[3] = { 0, 0, 0 };
+
+	for (int i = 0; i < poly.count; ++i)
+	{
+		const unsigned short* v = &pmesh.verts[poly.verts[i] * 3];
+		pts[i][0] = v[0] * pmesh.cs;
+		pts[i][1] = v[1] * pmesh.ch;
+		pts[i][2] = v[2] * pmesh.cs;
+
+		for (int k = 0; k < 3; ++k)
+			center[k] += pts[i][k] / poly.count;
+	}
+
+	// newell's method, works for polys with verts that aren't quite in a plane
+	float normal[3] = { 0, 0, 0 };
+	for (int i = 0, j = poly.count - 1; i < poly.count; j = i++)
+	{
+		normal[0] += (pts[j][1] - pts[i][1]) * (pts[j][2] + pts[i][2]);
+		normal[1] += (pts[j][2] - pts[i][2]) * (pts[j][0] + pts[i][0]);
+		normal[2] += (pts[j][0] - pts[i][0]) * (pts[j][1] + pts[i][1]);
+	}
+
+	const float len = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+	if (fabsf(normal[1]) <= len * 1e-3f)
+		return false;
+
+	for (int i = 0; i < poly.count; ++i)
+	{
+		const float dist = normal[0] * (pts[i][0] - center[0])
+			+ normal[1] * (pts[i][1] - center[1])
+			+ normal[2] * (pts[i][2] - center[2]);
+
+		// height above or below the plane
+		if (fabsf(dist / normal[1]) > maxHeightError)
+			return false;
+	}
+
+	return true;
+}
+
+static bool IsConvex(const MergePoly& poly, const unsigned short* verts)
+{
+	for (int i = 0; i < poly.count; ++i)
+	{
+		const int prev = (i + poly.count - 1) % poly.count;
+		const int next = (i + 1) % poly.count;
+
+		if (Cross2D(&verts[poly.verts[prev] * 3], &verts[poly.verts[i] * 3], &verts[poly.verts[next] * 3]) > 0)
+			return false;
+	}
+
+	return true;
+}
+
+// merge poly a with the poly across its edge ea into out. Returns how good of a
+// merge it is, the squared length of the edge, or -1 if they can't be merged.
+static int GetMergeValue(const rcPolyMesh& pmesh, const std::vector<MergePoly>& polys, int a, int ea,
+	float maxHeightError, MergePoly& out)
+{
+	const MergePoly& pa = polys[a];
+	const int b = pa.neis[ea];
+	const MergePoly& pb = polys[b];
+
+	if (pa.area != pb.area || pa.key != pb.key)
+		return -1;
+
+	const unsigned short va0 = pa.verts[ea];
+	const unsigned short va1 = pa.verts[(ea + 1) % pa.count];
+
+	// polys that touch along more than one edge would leave a hole
+	int eb = -1;
+	for (int j = 0; j < pb.count; ++j)
+	{
+		if (pb.neis[j] != a)
+			continue;
+		if (eb != -1)
+			return -1;
+		eb = j;
+	}
+
+	if (eb == -1 || pb.verts[eb] != va1 || pb.verts[(eb + 1) % pb.count] != va0)
+		return -1;
+
+	for (int j = 0; j < pa.count; ++j)
+	{
+		if (j != ea && pa.neis[j] == b)
+			return -1;
+	}
+
+	// a from the end of the shared edge around to its start, then b the same way
+	out.count = 0;
+	for (int i = 0; i < pa.count - 1; ++i)
+	{
+		const int j = (ea + 1 + i) % pa.count;
+		out.verts[out.count] = pa.verts[j];
+		out.neis[out.count++] = pa.neis[j];
+	}
+	for (int i = 0; i < pb.count - 1; ++i)
+	{
+		const int j = (eb + 1 + i) % pb.count;
+		out.verts[out.count] = pb.verts[j];
+		out.neis[out.count++] = pb.neis[j];
+	}
+
+	// polys that also touch at a vert would make a figure eight
+	for (int i = 0; i < out.count; ++i)
+	{
+		for (int j = i + 1; j < out.count; ++j)
+		{
+			if (out.verts[i] == out.verts[j])
+				return -1;
+		}
+	}
+
+	if (!IsFlat(out, pmesh, maxHeightError))
+		return -1;
+
+	SimplifyPoly(out, pmesh.verts, maxHeightError / pmesh.ch);
+	if (out.count > DT_VERTS_PER_POLYGON || !IsConvex(out, pmesh.verts))
+		return -1;
+
+	out.reg = pa.reg == pb.reg ? pa.reg : RC_MULTIPLE_REGS;
+	out.flags = pa.flags;
+	out.area = pa.area;
+	out.key = pa.key;
+	out.removed = false;
+
+	const unsigned short* v0 = &pmesh.verts[va0 * 3];
+	const unsigned short* v1 = &pmesh.verts[va1 * 3];
+	const int dx = (int)v1[0] - v0[0];
+	const int dz = (int)v1[2] - v0[2];
+	return dx * dx + dz * dz;
+}
+
+void MergePolyMesh(rcPolyMesh& pmesh, std::vector<uint16_t>& keys, float maxHeightError,
+	PolyMergeStats* stats)
+{
+	const int nvp = pmesh.nvp;
+
+	if (stats)
+	{
+		stats->polysBefore = stats->polysAfter = pmesh.npolys;
+		stats->vertsBefore = stats->vertsAfter = pmesh.nverts;
+	}
+
+	if (nvp > DT_VERTS_PER_POLYGON || pmesh.npolys == 0 || (int)keys.size() != pmesh.npolys)
+		return;
+
+	const float maxClimb = maxHeightError / pmesh.ch;
+
+	std::vector<MergePoly> polys(pmesh.npolys);
+	for (int i = 0; i < pmesh.npolys; ++i)
+	{
+		const unsigned short* p = &pmesh.polys[i * nvp * 2];
+		MergePoly& poly = polys[i];
+
+		for (int j = 0; j < nvp && p[j] != RC_MESH_NULL_IDX; ++j)
+		{
+			poly.verts[poly.count] = p[j];
+			poly.neis[poly.count++] = p[nvp + j];
+		}
+
+		poly.reg = pmesh.regs[i];
+		poly.flags = pmesh.flags[i];
+		poly.area = pmesh.areas[i];
+		poly.key = keys[i];
+
+		// straight walls first, so the polys have verts to spare for merging
+		SimplifyPoly(poly, pmesh.verts, maxClimb);
+	}
+
+	// merge each poly with the neighbor it shares the longest edge with, until
+	// nothing else can be merged
+	for (bool merged = true; merged;)
+	{
+		merged = false;
+
+		for (int a = 0; a < (int)polys.size(); ++a)
+		{
+			if (polys[a].removed)
+				continue;
+
+			MergePoly best, candidate;
+			int bestValue = -1;
+			int bestPoly = -1;
+
+			for (int j = 0; j < polys[a].count; ++j)
+			{
+				const unsigned short b = polys[a].neis[j];
+				if (!IsInnerEdge(b) || b == a || polys[b].removed)
+					continue;
+
+				const int value = GetMergeValue(pmesh, polys, a, j, maxHeightError, candidate);
+				if (value > bestValue)
+				{
+					bestValue = value;
+					bestPoly = b;
+					best = candidate;
+				}
+			}
+
+			if (bestPoly == -1)
+				continue;
+
+			// the polys next to b are next to a now
+			const MergePoly& pb = polys[bestPoly];
+			for (int j = 0; j < pb.count; ++j)
+			{
+				const unsigned short c = pb.neis[j];
+				if (!IsInnerEdge(c) || c == a)
+					continue;
+
+				MergePoly& pc = polys[c];
+				for (int k = 0; k < pc.count; ++k)
+				{
+					if (pc.neis[k] == bestPoly)
+						pc.neis[k] = static_cast<unsigned short>(a);
+				}
+			}
+
+			polys[a] = best;
+			polys[bestPoly].removed = true;
+			merged = true;
+		}
+	}
+
+	// merged polys can use all the verts that detour stores
+	if (nvp != DT_VERTS_PER_POLYGON)
+	{
+		unsigned short* wider = static_cast<unsigned short*>(
+			rcAlloc(sizeof(unsigned short) * pmesh.maxpolys * DT_VERTS_PER_POLYGON * 2, RC_ALLOC_PERM));
+		if (!wider)
+			return;
+
+		rcFree(pmesh.polys);
+		pmesh.polys = wider;
+		pmesh.nvp = DT_VERTS_PER_POLYGON;
+	}
+
+	std::vector<unsigned short> polyRemap(polys.size(), RC_MESH_NULL_IDX);
+	int npolys = 0;
+	for (int i = 0; i < (int)polys.size(); ++i)
+	{
+		if (!polys[i].removed)
+			polyRemap[i] = static_cast<unsigned short>(npolys++);
+	}
+
+	const int outNvp = pmesh.nvp;
+	memset(pmesh.polys, 0xff, sizeof(unsigned short) * pmesh.maxpolys * outNvp * 2);
+
+	for (int i = 0; i < (int)polys.size(); ++i)
+	{
+		const MergePoly& poly = polys[i];
+		const int n = polyRemap[i];
+		if (n == RC_MESH_NULL_IDX)
+			continue;
+
+		unsigned short* p = &pmesh.polys[n * outNvp * 2];
+		for (int j = 0; j < poly.count; ++j)
+		{
+			p[j] = poly.verts[j];
+			p[outNvp + j] = IsInnerEdge(poly.neis[j]) ? polyRemap[poly.neis[j]] : poly.neis[j];
+		}
+
+		pmesh.regs[n] = poly.reg;
+		pmesh.flags[n] = poly.flags;
+		pmesh.areas[n] = poly.area;
+		keys[n] = poly.key;
+	}
+
+	pmesh.npolys = npolys;
+	keys.resize(npolys);
+
+	// pack the verts that are still used
+	std::vector<unsigned short> vertRemap(pmesh.nverts, RC_MESH_NULL_IDX);
+	for (int i = 0; i < npolys * outNvp * 2; i += outNvp * 2)
+	{
+		for (int j = 0; j < outNvp && pmesh.polys[i + j] != RC_MESH_NULL_IDX; ++j)
+			vertRemap[pmesh.polys[i + j]] = 0;
+	}
+
+	int nverts = 0;
+	for (int i = 0; i < pmesh.nverts; ++i)
+	{
+		if (vertRemap[i] == RC_MESH_NULL_IDX)
+			continue;
+
+		if (nverts != i)
+			memcpy(&pmesh.verts[nverts * 3], &pmesh.verts[i * 3], sizeof(unsigned short) * 3);
+		vertRemap[i] = static_cast<unsigned short>(nverts++);
+	}
+
+	for (int i = 0; i < npolys * outNvp * 2; i += outNvp * 2)
+	{
+		for (int j = 0; j < outNvp && pmesh.polys[i + j] != RC_MESH_NULL_IDX; ++j)
+			pmesh.polys[i + j] = vertRemap[pmesh.polys[i + j]];
+	}
+
+	pmesh.nverts = nverts;
+
+	if (stats)
+	{
+		stats->polysAfter = npolys;
+		stats->vertsAfter = nverts;
+	}
+}
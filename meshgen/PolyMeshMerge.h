@@ -0,0 +1,33 @@
+//
+// PolyMeshMerge.h
+//
+
+// Merges the polys of a tile's poly mesh after it has been built. Recast only
+// merges polys that came out of the same region, so open ground is left as many
+// small polys along region borders, and every path search has to cross them.
+// Polys of the same area that lie in about the same plane are merged across
+// regions here, up to the verts that detour can store, and verts on straight
+// wall and tile border edges are taken out.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+struct rcPolyMesh;
+
+struct PolyMergeStats
+{
+	int polysBefore = 0;
+	int polysAfter = 0;
+	int vertsBefore = 0;
+	int vertsAfter = 0;
+};
+
+// merge the polys of pmesh, before its detail mesh is built. Only polys with the
+// same area and the same key are merged, keys has one per poly and is packed
+// along with the polys. Merged polys may not be further than maxHeightError in
+// world units from a plane through them. pmesh is left as it was if it has more
+// verts per poly than detour can store.
+void MergePolyMesh(rcPolyMesh& pmesh, std::vector<uint16_t>& keys, float maxHeightError,
+	PolyMergeStats* stats = nullptr);
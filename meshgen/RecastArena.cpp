@@ -0,0 +1,189 @@
+//
+// RecastArena.cpp
+//
+
+#include "RecastArena.h"
+
+#include <DetourAlloc.h>
+#include <RecastAlloc.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+
+// size of the first block in each arena. Arenas grow to fit the largest tile.
+static const size_t DEFAULT_BLOCK_SIZE = 16 * 1024 * 1024;
+
+static const size_t ALLOCATION_ALIGNMENT = 16;
+
+static thread_local std::unique_ptr<RecastArena> s_threadArena;
+
+//============================================================================
+
+RecastArena::RecastArena()
+{
+}
+
+RecastArena::~RecastArena()
+{
+	for (Block& block : m_blocks)
+		::free(block.data);
+}
+
+void RecastArena::Install()
+{
+	rcAllocSetCustom(
+		[](size_t size, rcAllocHint hint) { return AllocRecast(size, hint); },
+		[](void* ptr) { Free(ptr); });
+
+	dtAllocSetCustom(
+		[](size_t size, dtAllocHint hint) { return AllocDetour(size, hint); },
+		[](void* ptr) { Free(ptr); });
+}
+
+size_t RecastArena::GetLastScopeSize()
+{
+	return s_threadArena ? s_threadArena->m_lastScopeSize : 0;
+}
+
+void RecastArena::Trim()
+{
+	RecastArena* arena = s_threadArena.get();
+	if (!arena || arena->m_depth > 0)
+		return;
+
+	for (Block& block : arena->m_blocks)
+		::free(block.data);
+	arena->m_blocks.clear();
+}
+
+RecastArena* RecastArena::GetActive()
+{
+	RecastArena* arena = s_threadArena.get();
+	if (arena && arena->m_depth > 0)
+		return arena;
+
+	return nullptr;
+}
+
+void* RecastArena::AllocRecast(size_t size, int /*hint*/)
+{
+	// everything recast allocates during a tile build is freed before the build ends
+	if (RecastArena* arena = GetActive())
+		return arena->Allocate(size);
+
+	return ::malloc(size);
+}
+
+void* RecastArena::AllocDetour(size_t size, int hint)
+{
+	// permanent allocations are tile data that gets handed to the navmesh
+	if (hint == DT_ALLOC_TEMP)
+	{
+		if (RecastArena* arena = GetActive())
+			return arena->Allocate(size);
+	}
+
+	return ::malloc(size);
+}
+
+void RecastArena::Free(void* ptr)
+{
+	if (!ptr)
+		return;
+
+	// arena memory is released when the scope ends. Only the thread that owns
+	// an arena ever allocates from it, so there is no need to look at others.
+	RecastArena* arena = s_threadArena.get();
+	if (arena && arena->Owns(ptr))
+		return;
+
+	::free(ptr);
+}
+
+//----------------------------------------------------------------------------
+
+void* RecastArena::Allocate(size_t size)
+{
+	size = (size + ALLOCATION_ALIGNMENT - 1) & ~(ALLOCATION_ALIGNMENT - 1);
+
+	if (m_blocks.empty() || m_blocks.back().used + size > m_blocks.back().size)
+	{
+		Block block;
+		block.size = std::max(size, m_blocks.empty() ? DEFAULT_BLOCK_SIZE : m_blocks.back().size * 2);
+		block.data = static_cast<uint8_t*>(::malloc(block.size));
+		if (!block.data)
+			return nullptr;
+
+		m_blocks.push_back(block);
+	}
+
+	Block& block = m_blocks.back();
+	void* ptr = block.data + block.used;
+	block.used += size;
+
+	return ptr;
+}
+
+bool RecastArena::Owns(const void* ptr) const
+{
+	const uint8_t* p = static_cast<const uint8_t*>(ptr);
+
+	for (const Block& block : m_blocks)
+	{
+		if (p >= block.data && p < block.data + block.size)
+			return true;
+	}
+
+	return false;
+}
+
+void RecastArena::Reset()
+{
+	if (m_blocks.size() > 1)
+	{
+		// replace the blocks with a single one that fits everything at once
+		size_t total = 0;
+		for (Block& block : m_blocks)
+		{
+			total += block.size;
+			::free(block.data);
+		}
+
+		m_blocks.clear();
+
+		Block block;
+		block.size = total;
+		block.data = static_cast<uint8_t*>(::malloc(total));
+		if (block.data)
+			m_blocks.push_back(block);
+	}
+	else if (!m_blocks.empty())
+	{
+		m_blocks.back().used = 0;
+	}
+}
+
+//----------------------------------------------------------------------------
+
+RecastArena::Scope::Scope()
+{
+	if (!s_threadArena)
+		s_threadArena = std::make_unique<RecastArena>();
+
+	++s_threadArena->m_depth;
+}
+
+RecastArena::Scope::~Scope()
+{
+	if (--s_threadArena->m_depth == 0)
+	{
+		// nothing is freed during a scope, so this is also its peak
+		size_t used = 0;
+		for (const Block& block : s_threadArena->m_blocks)
+			used += block.used;
+		s_threadArena->m_lastScopeSize = used;
+
+		s_threadArena->Reset();
+	}
+}
@@ -0,0 +1,70 @@
+//
+// RecastArena.h
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Per-thread scratch memory for building tiles. While a Scope is active on a
+// thread, recast allocations and detour temporary allocations made by that
+// thread are carved out of the thread's arena instead of the heap, and are
+// all released at once when the scope ends. This keeps tile builds running on
+// many threads from fighting over the heap lock.
+//
+// Anything that has to outlive the scope (such as the finished tile data, which
+// detour allocates as permanent) still comes from the heap.
+class RecastArena
+{
+public:
+	RecastArena();
+	~RecastArena();
+
+	RecastArena(const RecastArena&) = delete;
+	RecastArena& operator=(const RecastArena&) = delete;
+
+	// install the arena aware allocators for recast and detour. Must be called
+	// before anything is allocated through them.
+	static void Install();
+
+	// bytes handed out by this thread's arena in its last scope
+	static size_t GetLastScopeSize();
+
+	// give the memory of this thread's arena back to the heap. Does nothing while
+	// a scope is active.
+	static void Trim();
+
+	class Scope
+	{
+	public:
+		Scope();
+		~Scope();
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+	};
+
+private:
+	struct Block
+	{
+		uint8_t* data = nullptr;
+		size_t size = 0;
+		size_t used = 0;
+	};
+
+	void* Allocate(size_t size);
+	bool Owns(const void* ptr) const;
+	void Reset();
+
+	static void* AllocRecast(size_t size, int hint);
+	static void* AllocDetour(size_t size, int hint);
+	static void Free(void* ptr);
+
+	static RecastArena* GetActive();
+
+	std::vector<Block> m_blocks;
+	int m_depth = 0;
+	size_t m_lastScopeSize = 0;
+};
@@ -0,0 +1,559 @@
+//
+// SettingsTuner.cpp
+//
+
+#include "SettingsTuner.h"
+
+#include "Application.h"
+#include "EQConfig.h"
+#include "InputGeom.h"
+#include "MapGeometryLoader.h"
+#include "NavMeshTool.h"
+#include "TaskScheduler.h"
+#include "common/Context.h"
+#include "common/NavMesh.h"
+#include "common/Utilities.h"
+
+#include <DetourNavMesh.h>
+#include <DetourNavMeshQuery.h>
+#include <Recast.h>
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <set>
+#include <sstream>
+
+// same limits the plugin uses for its queries
+static const int MAX_NODES = 2048 * 4;
+static const int MAX_POLYS = 4028 * 4;
+static const float POLY_PICK_EXTENTS[3] = { 2, 4, 2 };
+
+// candidates this close to the best coverage count as just as good, and the
+// smallest of them is recommended.
+static const float QUALITY_TOLERANCE = 0.02f;
+
+//----------------------------------------------------------------------------
+
+// tiles touched by the straight line from start to end
+static void AddTilesAlongLine(const glm::vec3& start, const glm::vec3& end, const glm::vec3& orig,
+	float tcs, std::set<std::pair<int, int>>& tiles)
+{
+	const float length = glm::length(glm::vec2(end.x - start.x, end.z - start.z));
+	const int steps = std::max(1, (int)ceilf(length / (tcs * 0.5f)));
+
+	for (int i = 0; i <= steps; ++i)
+	{
+		glm::vec3 pos = glm::mix(start, end, (float)i / steps);
+		tiles.emplace((int)floorf((pos.x - orig.x) / tcs), (int)floorf((pos.z - orig.z) / tcs));
+	}
+}
+
+//============================================================================
+
+SettingsTuner::SettingsTuner(EQConfig& eqConfig, Context* context)
+	: m_eqConfig(eqConfig)
+	, m_context(context)
+{
+}
+
+bool SettingsTuner::LoadCorpus(const std::string& filename)
+{
+	std::ifstream infile(filename);
+	if (!infile.is_open())
+	{
+		m_context->Log(LogLevel::ERROR, "Failed to open path corpus: %s", filename.c_str());
+		return false;
+	}
+
+	m_queries.clear();
+
+	std::string line;
+	while (std::getline(infile, line))
+	{
+		std::istringstream ss(line);
+		std::string tag;
+		Query query;
+
+		if (ss >> tag >> query.start.x >> query.start.y >> query.start.z
+			>> query.end.x >> query.end.y >> query.end.z)
+		{
+			m_queries.push_back(query);
+		}
+	}
+
+	m_context->Log(LogLevel::INFO, "Loaded %d queries from %s", (int)m_queries.size(), filename.c_str());
+	return !m_queries.empty();
+}
+
+bool SettingsTuner::Run(const std::string& zoneShortName)
+{
+	auto rcContext = std::make_unique<BuildContext>(m_context);
+
+	auto geom = std::make_unique<InputGeom>(zoneShortName,
+		m_eqConfig.GetEverquestPath(), m_eqConfig.GetOutputPath());
+	if (!geom->loadGeometry(rcContext.get()))
+	{
+		m_context->Log(LogLevel::ERROR, "%s: failed to load zone geometry", zoneShortName.c_str());
+		return false;
+	}
+
+	auto navMesh = std::make_shared<NavMesh>(m_context, m_eqConfig.GetOutputPath() + "\\MQ2Nav", zoneShortName);
+	auto meshTool = std::make_unique<NavMeshTool>(navMesh);
+	meshTool->setContext(rcContext.get());
+	meshTool->setOutputPath(m_eqConfig.GetOutputPath().c_str());
+	meshTool->setBuildPriority(NavMeshTool::BuildPriority::Turbo);
+	meshTool->handleGeometryChanged(geom.get());
+
+	// candidates start from the saved settings, volumes and areas of the zone
+	NavMesh::LoadResult loadResult = navMesh->LoadNavMeshFile();
+	if (loadResult != NavMesh::LoadResult::Success
+		&& loadResult != NavMesh::LoadResult::MissingFile)
+	{
+		m_context->Log(LogLevel::WARNING, "%s: existing navmesh could not be loaded (%d), using default settings",
+			zoneShortName.c_str(), (int)loadResult);
+	}
+
+	const NavMeshConfig base = navMesh->GetNavMeshConfig();
+
+	m_candidates.clear();
+	for (float tileSize : m_tileSizes)
+	{
+		for (float cellSize : m_cellSizes)
+		{
+			for (float cellHeight : m_cellHeights)
+			{
+				Candidate candidate;
+				candidate.config = base;
+				candidate.config.tileSize = tileSize;
+				candidate.config.cellSize = cellSize;
+				candidate.config.cellHeight = cellHeight;
+				m_candidates.push_back(candidate);
+			}
+		}
+	}
+
+	CollectSamples(*geom, base);
+	if (m_samplePoints.empty())
+	{
+		m_context->Log(LogLevel::ERROR, "%s: nothing to sample", zoneShortName.c_str());
+		return false;
+	}
+
+	m_context->Log(LogLevel::INFO, "%s: trying %d settings at %d sample points and %d paths",
+		zoneShortName.c_str(), (int)m_candidates.size(), (int)m_samplePoints.size(), (int)m_queries.size());
+
+	BuildCandidates(*meshTool, *geom);
+	FindParetoSet();
+
+	// the best of the ones that aren't worse than another in every way
+	int recommended = -1;
+	const bool usePaths = !m_queries.empty();
+	auto quality = [usePaths](const Candidate& c) { return usePaths ? c.pathsFound : c.coverage; };
+
+	float bestQuality = 0;
+	for (const Candidate& candidate : m_candidates)
+	{
+		if (candidate.pareto)
+			bestQuality = std::max(bestQuality, quality(candidate));
+	}
+
+	for (int i = 0; i < (int)m_candidates.size(); ++i)
+	{
+		const Candidate& candidate = m_candidates[i];
+		if (!candidate.pareto || quality(candidate) < bestQuality - QUALITY_TOLERANCE)
+			continue;
+
+		if (recommended == -1
+			|| candidate.zoneDataSize < m_candidates[recommended].zoneDataSize
+			|| (candidate.zoneDataSize == m_candidates[recommended].zoneDataSize
+				&& candidate.zoneBuildMs < m_candidates[recommended].zoneBuildMs))
+		{
+			recommended = i;
+		}
+	}
+
+	Report(recommended);
+
+	if (!m_outputFile.empty() && !WriteResults(zoneShortName, recommended))
+	{
+		m_context->Log(LogLevel::ERROR, "Failed to write results to %s", m_outputFile.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+void SettingsTuner::CollectSamples(const InputGeom& geom, const NavMeshConfig& base)
+{
+	m_samplePoints.clear();
+
+	if (!m_queries.empty())
+	{
+		// spread the queries that are used over the whole corpus
+		if (m_sampleCount > 0 && (int)m_queries.size() > m_sampleCount)
+		{
+			std::vector<Query> queries;
+			queries.reserve(m_sampleCount);
+			for (int i = 0; i < m_sampleCount; ++i)
+				queries.push_back(m_queries[i * m_queries.size() / m_sampleCount]);
+			m_queries.swap(queries);
+		}
+
+		for (const Query& query : m_queries)
+		{
+			m_samplePoints.push_back(query.start);
+			m_samplePoints.push_back(query.end);
+		}
+		return;
+	}
+
+	// the middle of evenly spaced triangles that can be walked on
+	const MapGeometryLoader* loader = geom.getMeshLoader();
+	const float* verts = loader->getVerts();
+	const float* normals = loader->getNormals();
+	const int* tris = loader->getTris();
+	const int ntris = loader->getTriCount();
+	const float walkableThr = cosf(base.agentMaxSlope / 180.0f * RC_PI);
+	const int count = std::max(1, m_sampleCount);
+
+	for (int i = 0; i < count; ++i)
+	{
+		for (int tri = i * ntris / count; tri < (i + 1) * ntris / count; ++tri)
+		{
+			if (normals[tri * 3 + 1] <= walkableThr)
+				continue;
+
+			glm::vec3 center(0.0f);
+			for (int j = 0; j < 3; ++j)
+			{
+				const float* v = &verts[tris[tri * 3 + j] * 3];
+				center += glm::vec3(v[0], v[1], v[2]);
+			}
+			m_samplePoints.push_back(center / 3.0f);
+			break;
+		}
+	}
+}
+
+void SettingsTuner::BuildCandidates(NavMeshTool& meshTool, const InputGeom& geom)
+{
+	struct SampleTile
+	{
+		int candidate;
+		int x, y;
+		unsigned char* data = nullptr;
+		int dataSize = 0;
+		size_t compressedSize = 0;
+		double buildMs = 0;
+	};
+
+	const std::shared_ptr<NavMesh> navMesh = meshTool.GetNavMesh();
+	const glm::vec3& bmin = navMesh->GetNavMeshBoundsMin();
+	const glm::vec3& bmax = navMesh->GetNavMeshBoundsMax();
+
+	// every tile of every candidate goes into one batch, so the workers stay busy
+	// across candidates.
+	std::vector<SampleTile> sampleTiles;
+
+	for (int c = 0; c < (int)m_candidates.size(); ++c)
+	{
+		Candidate& candidate = m_candidates[c];
+		const NavMeshConfig& config = candidate.config;
+		const float tcs = config.tileSize * config.cellSize;
+
+		int gw = 0, gh = 0;
+		rcCalcGridSize(&bmin[0], &bmax[0], config.cellSize, &gw, &gh);
+		const int ts = (int)config.tileSize;
+		const int tw = (gw + ts - 1) / ts;
+		const int th = (gh + ts - 1) / ts;
+
+		std::set<std::pair<int, int>> tiles;
+		for (const glm::vec3& point : m_samplePoints)
+			AddTilesAlongLine(point, point, bmin, tcs, tiles);
+
+		// paths that stray far from the straight line leave the sampled tiles, for
+		// every candidate alike.
+		for (const Query& query : m_queries)
+			AddTilesAlongLine(query.start, query.end, bmin, tcs, tiles);
+
+		for (const auto& tile : tiles)
+		{
+			if (tile.first < 0 || tile.second < 0 || tile.first >= tw || tile.second >= th)
+				continue;
+
+			SampleTile sample;
+			sample.candidate = c;
+			sample.x = tile.first;
+			sample.y = tile.second;
+			sampleTiles.push_back(sample);
+		}
+
+		// tiles of the zone that have any geometry in them, for scaling up the samples
+		std::vector<int> chunks, instances;
+		for (int y = 0; y < th; ++y)
+		{
+			for (int x = 0; x < tw; ++x)
+			{
+				float rectMin[2] = { bmin[0] + x * tcs, bmin[2] + y * tcs };
+				float rectMax[2] = { bmin[0] + (x + 1) * tcs, bmin[2] + (y + 1) * tcs };
+
+				chunks.clear();
+				instances.clear();
+				rcGetChunksOverlappingRect(geom.getChunkyMesh(), rectMin, rectMax, chunks);
+				if (chunks.empty())
+				{
+					// or just placed models
+					float tileMin[3] = { rectMin[0], 0, rectMin[1] };
+					float tileMax[3] = { rectMax[0], 0, rectMax[1] };
+					geom.getMeshInstances().GetInstancesOverlappingRect(tileMin, tileMax, instances);
+				}
+				if (!chunks.empty() || !instances.empty())
+					++candidate.zoneTiles;
+			}
+		}
+	}
+
+	TaskScheduler scheduler(m_threadCount);
+
+	std::vector<TaskScheduler::Task> tasks;
+	tasks.reserve(sampleTiles.size());
+
+	for (SampleTile& sample : sampleTiles)
+	{
+		tasks.push_back([this, &meshTool, &sample]()
+		{
+			TileBuildTimings timings;
+			sample.data = meshTool.buildSampleTile(m_candidates[sample.candidate].config,
+				sample.x, sample.y, sample.dataSize, &timings);
+			sample.buildMs = std::chrono::duration<double, std::milli>(timings.GetTotalTime()).count();
+
+			std::vector<uint8_t> compressed;
+			if (sample.data && CompressMemory(sample.data, sample.dataSize, compressed))
+				sample.compressedSize = compressed.size();
+			else
+				sample.compressedSize = sample.dataSize;
+		});
+	}
+
+	scheduler.Run(std::move(tasks));
+	scheduler.Wait();
+
+	// put the tiles of each candidate together and see how much of the zone they cover
+	for (int c = 0; c < (int)m_candidates.size(); ++c)
+	{
+		Candidate& candidate = m_candidates[c];
+		const NavMeshConfig& config = candidate.config;
+
+		int tileCount = 0;
+		for (const SampleTile& sample : sampleTiles)
+		{
+			if (sample.candidate == c)
+				++tileCount;
+		}
+
+		dtNavMeshParams params;
+		memset(&params, 0, sizeof(params));
+		rcVcopy(params.orig, &bmin[0]);
+		params.tileWidth = config.tileSize * config.cellSize;
+		params.tileHeight = config.tileSize * config.cellSize;
+		params.maxTiles = std::max(1, tileCount);
+#ifdef DT_POLYREF64
+		params.maxPolys = 1 << DT_POLY_BITS;
+#else
+		int tileBits = rcMin((int)ilog2(nextPow2(params.maxTiles)), 14);
+		params.maxPolys = 1 << (22 - tileBits);
+#endif
+
+		deleting_unique_ptr<dtNavMesh> nav(dtAllocNavMesh(), [](dtNavMesh* m) { dtFreeNavMesh(m); });
+		if (!nav || dtStatusFailed(nav->init(&params)))
+		{
+			m_context->Log(LogLevel::ERROR, "Could not init navmesh for tile size %.0f cell size %.2f",
+				config.tileSize, config.cellSize);
+			continue;
+		}
+
+		for (SampleTile& sample : sampleTiles)
+		{
+			if (sample.candidate != c)
+				continue;
+
+			++candidate.tilesSampled;
+			candidate.buildMs += sample.buildMs;
+
+			if (!sample.data)
+			{
+				++candidate.tilesEmpty;
+				continue;
+			}
+
+			candidate.polyCount += reinterpret_cast<const dtMeshHeader*>(sample.data)->polyCount;
+			candidate.dataSize += sample.compressedSize;
+
+			// the navmesh frees the data from here on
+			if (dtStatusFailed(nav->addTile(sample.data, sample.dataSize, DT_TILE_FREE_DATA, 0, nullptr)))
+				dtFree(sample.data);
+			sample.data = nullptr;
+		}
+
+		if (candidate.tilesSampled > 0)
+		{
+			double scale = (double)candidate.zoneTiles / candidate.tilesSampled;
+			candidate.zoneBuildMs = candidate.buildMs * scale;
+			candidate.zonePolys = candidate.polyCount * scale;
+			candidate.zoneDataSize = candidate.dataSize * scale;
+		}
+
+		deleting_unique_ptr<dtNavMeshQuery> query(dtAllocNavMeshQuery(), [](dtNavMeshQuery* q) { dtFreeNavMeshQuery(q); });
+		if (!query || dtStatusFailed(query->init(nav.get(), MAX_NODES)))
+			continue;
+
+		dtQueryFilter filter;
+		filter.setExcludeFlags(+PolyFlags::Disabled);
+
+		int onMesh = 0;
+		for (const glm::vec3& point : m_samplePoints)
+		{
+			dtPolyRef ref = 0;
+			float nearest[3];
+			query->findNearestPoly(&point[0], POLY_PICK_EXTENTS, &filter, &ref, nearest);
+			if (ref)
+				++onMesh;
+		}
+		candidate.coverage = (float)onMesh / m_samplePoints.size();
+
+		if (m_queries.empty())
+			continue;
+
+		std::vector<dtPolyRef> path(MAX_POLYS);
+		int found = 0;
+
+		for (const Query& q : m_queries)
+		{
+			dtPolyRef startRef = 0, endRef = 0;
+			float startPos[3], endPos[3];
+			query->findNearestPoly(&q.start[0], POLY_PICK_EXTENTS, &filter, &startRef, startPos);
+			query->findNearestPoly(&q.end[0], POLY_PICK_EXTENTS, &filter, &endRef, endPos);
+			if (!startRef || !endRef)
+				continue;
+
+			int pathCount = 0;
+			dtStatus status = query->findPath(startRef, endRef, startPos, endPos, &filter,
+				path.data(), &pathCount, MAX_POLYS);
+			if (dtStatusSucceed(status) && !(status & DT_PARTIAL_RESULT)
+				&& pathCount > 0 && path[pathCount - 1] == endRef)
+			{
+				++found;
+			}
+		}
+		candidate.pathsFound = (float)found / m_queries.size();
+	}
+
+	for (SampleTile& sample : sampleTiles)
+		dtFree(sample.data);
+}
+
+void SettingsTuner::FindParetoSet()
+{
+	const bool usePaths = !m_queries.empty();
+
+	for (Candidate& a : m_candidates)
+	{
+		float qualityA = usePaths ? a.pathsFound : a.coverage;
+		a.pareto = a.tilesSampled > 0;
+
+		for (const Candidate& b : m_candidates)
+		{
+			if (&a == &b || b.tilesSampled == 0)
+				continue;
+
+			float qualityB = usePaths ? b.pathsFound : b.coverage;
+			bool noWorse = b.zoneBuildMs <= a.zoneBuildMs && b.zoneDataSize <= a.zoneDataSize
+				&& qualityB >= qualityA;
+			bool better = b.zoneBuildMs < a.zoneBuildMs || b.zoneDataSize < a.zoneDataSize
+				|| qualityB > qualityA;
+
+			if (noWorse && better)
+			{
+				a.pareto = false;
+				break;
+			}
+		}
+	}
+}
+
+void SettingsTuner::Report(int recommended) const
+{
+	m_context->Log(LogLevel::INFO, "  tile   cell  height | tiles  build s   polys    size KB | coverage  paths");
+
+	for (int i = 0; i < (int)m_candidates.size(); ++i)
+	{
+		const Candidate& c = m_candidates[i];
+		m_context->Log(LogLevel::INFO, "%c %4.0f  %5.2f  %5.2f  | %5d  %7.1f  %7.0f  %9.1f | %6.1f%%  %5.1f%%%s",
+			c.pareto ? '*' : ' ', c.config.tileSize, c.config.cellSize, c.config.cellHeight,
+			c.zoneTiles, c.zoneBuildMs / 1000.0, c.zonePolys, c.zoneDataSize / 1024.0,
+			c.coverage * 100.0f, c.pathsFound * 100.0f, i == recommended ? "  <- recommended" : "");
+	}
+
+	m_context->Log(LogLevel::INFO, "Zone totals are estimated from the sampled tiles, build time is summed over all threads.");
+	m_context->Log(LogLevel::INFO, "* = not beaten on build time, size and %s by any other settings",
+		m_queries.empty() ? "coverage" : "paths found");
+
+	if (recommended != -1)
+	{
+		const NavMeshConfig& config = m_candidates[recommended].config;
+		m_context->Log(LogLevel::INFO, "Recommended: tile size %.0f, cell size %.2f, cell height %.2f",
+			config.tileSize, config.cellSize, config.cellHeight);
+	}
+}
+
+bool SettingsTuner::WriteResults(const std::string& zoneShortName, int recommended) const
+{
+	rapidjson::StringBuffer buffer;
+	rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+	writer.SetIndent(' ', 2);
+
+	writer.StartObject();
+	writer.Key("zone"); writer.String(zoneShortName.c_str());
+	writer.Key("sample_points"); writer.Int((int)m_samplePoints.size());
+	writer.Key("paths"); writer.Int((int)m_queries.size());
+	writer.Key("recommended"); writer.Int(recommended);
+	writer.Key("candidates");
+	writer.StartArray();
+
+	for (const Candidate& c : m_candidates)
+	{
+		writer.StartObject();
+		writer.Key("tile_size"); writer.Double(c.config.tileSize);
+		writer.Key("cell_size"); writer.Double(c.config.cellSize);
+		writer.Key("cell_height"); writer.Double(c.config.cellHeight);
+		writer.Key("tiles_sampled"); writer.Int(c.tilesSampled);
+		writer.Key("tiles_empty"); writer.Int(c.tilesEmpty);
+		writer.Key("build_ms"); writer.Double(c.buildMs);
+		writer.Key("polys"); writer.Int(c.polyCount);
+		writer.Key("data_size"); writer.Uint64(c.dataSize);
+		writer.Key("zone_tiles"); writer.Int(c.zoneTiles);
+		writer.Key("zone_build_ms"); writer.Double(c.zoneBuildMs);
+		writer.Key("zone_polys"); writer.Double(c.zonePolys);
+		writer.Key("zone_data_size"); writer.Double(c.zoneDataSize);
+		writer.Key("coverage"); writer.Double(c.coverage);
+		writer.Key("paths_found"); writer.Double(c.pathsFound);
+		writer.Key("pareto"); writer.Bool(c.pareto);
+		writer.EndObject();
+	}
+
+	writer.EndArray();
+	writer.EndObject();
+
+	std::ofstream outfile(m_outputFile, std::ios::trunc);
+	if (!outfile.is_open())
+		return false;
+
+	outfile.write(buffer.GetString(), buffer.GetSize());
+	outfile << "\n";
+
+	return outfile.good();
+}
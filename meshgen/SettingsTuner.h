@@ -0,0 +1,105 @@
+//
+// SettingsTuner.h
+//
+
+// Builds a sample of a zone's tiles under a grid of candidate build settings and
+// compares what each would cost and how well it covers the zone, to pick the
+// tile size, cell size and cell height without building the whole zone each way.
+//
+// Samples are taken around the ends of the queries in a path corpus (the format
+// PathBenchmark replays), and along the straight line between them, so that the
+// paths can be tried on each candidate. Without a corpus, points spread over the
+// zone's triangles are used and only coverage is reported.
+
+#pragma once
+
+#include "common/NavMeshData.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Context;
+class EQConfig;
+class InputGeom;
+class NavMeshTool;
+
+class SettingsTuner
+{
+public:
+	SettingsTuner(EQConfig& eqConfig, Context* context);
+
+	bool LoadCorpus(const std::string& filename);
+
+	// values to try, every combination is built. Empty lists keep the defaults.
+	void SetTileSizes(const std::vector<float>& values) { if (!values.empty()) m_tileSizes = values; }
+	void SetCellSizes(const std::vector<float>& values) { if (!values.empty()) m_cellSizes = values; }
+	void SetCellHeights(const std::vector<float>& values) { if (!values.empty()) m_cellHeights = values; }
+
+	// number of points sampled when there is no corpus, or the most corpus
+	// queries used when there is one.
+	void SetSampleCount(int count) { m_sampleCount = count; }
+
+	// number of threads building tiles, 0 for one per hardware thread
+	void SetThreadCount(int threads) { m_threadCount = threads; }
+
+	// if set, also write the results as json
+	void SetOutputFile(const std::string& filename) { m_outputFile = filename; }
+
+	// returns false if the zone couldn't be loaded
+	bool Run(const std::string& zoneShortName);
+
+private:
+	struct Query
+	{
+		glm::vec3 start;
+		glm::vec3 end;
+	};
+
+	struct Candidate
+	{
+		NavMeshConfig config;
+
+		// sampled tiles
+		int tilesSampled = 0;
+		int tilesEmpty = 0;
+		double buildMs = 0;         // summed over the tiles, not wall time
+		int polyCount = 0;
+		size_t dataSize = 0;        // compressed, as stored in the mesh file
+
+		// estimates for the whole zone, scaled up from the samples
+		int zoneTiles = 0;
+		double zoneBuildMs = 0;
+		double zonePolys = 0;
+		double zoneDataSize = 0;
+
+		// fraction of sample points on the mesh, and of corpus paths found
+		float coverage = 0;
+		float pathsFound = 0;
+
+		bool pareto = false;
+	};
+
+	void CollectSamples(const InputGeom& geom, const NavMeshConfig& base);
+	void BuildCandidates(NavMeshTool& meshTool, const InputGeom& geom);
+	void FindParetoSet();
+
+	void Report(int recommended) const;
+	bool WriteResults(const std::string& zoneShortName, int recommended) const;
+
+	EQConfig& m_eqConfig;
+	Context* m_context;
+
+	std::vector<float> m_tileSizes = { 64, 128, 256 };
+	std::vector<float> m_cellSizes = { 0.4f, 0.6f, 0.8f, 1.0f, 1.2f };
+	std::vector<float> m_cellHeights = { 0.2f, 0.3f, 0.4f };
+	int m_sampleCount = 32;
+	int m_threadCount = 0;
+	std::string m_outputFile;
+
+	std::vector<Query> m_queries;
+	std::vector<glm::vec3> m_samplePoints;
+	std::vector<Candidate> m_candidates;
+};
@@ -0,0 +1,168 @@
+//
+// TaskScheduler.cpp
+//
+
+#include "TaskScheduler.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#endif
+
+#include <algorithm>
+
+//============================================================================
+
+static void SetWorkerPriority(std::thread& thread, TaskScheduler::Priority priority)
+{
+#if defined(_WIN32)
+	int nativePriority = THREAD_PRIORITY_NORMAL;
+
+	switch (priority)
+	{
+	case TaskScheduler::Priority::Low:
+		nativePriority = THREAD_PRIORITY_LOWEST;
+		break;
+	case TaskScheduler::Priority::BelowNormal:
+		nativePriority = THREAD_PRIORITY_BELOW_NORMAL;
+		break;
+	case TaskScheduler::Priority::AboveNormal:
+		nativePriority = THREAD_PRIORITY_ABOVE_NORMAL;
+		break;
+	default:
+		break;
+	}
+
+	::SetThreadPriority(thread.native_handle(), nativePriority);
+#endif
+}
+
+TaskScheduler::TaskScheduler(int threadCount, Priority priority)
+{
+	if (threadCount <= 0)
+		threadCount = std::max<int>(1, std::thread::hardware_concurrency());
+
+	for (int i = 0; i < threadCount; ++i)
+		m_queues.push_back(std::make_unique<WorkQueue>());
+
+	for (int i = 0; i < threadCount; ++i)
+	{
+		m_threads.emplace_back([this, i]() { WorkerMain(i); });
+
+		if (priority != Priority::Normal)
+			SetWorkerPriority(m_threads.back(), priority);
+	}
+}
+
+TaskScheduler::~TaskScheduler()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_shutdown = true;
+	}
+	m_workAvailable.notify_all();
+
+	for (std::thread& thread : m_threads)
+		thread.join();
+}
+
+void TaskScheduler::Push(int index, Task&& task)
+{
+	// counted before a worker can see it, or it could be done and uncounted
+	// before it was ever counted
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		++m_queued;
+		++m_pending;
+	}
+
+	std::unique_lock<std::mutex> lock(m_queues[index]->mutex);
+	m_queues[index]->tasks.push_back(std::move(task));
+}
+
+void TaskScheduler::Run(Task task)
+{
+	int index = m_nextQueue++ % static_cast<int>(m_queues.size());
+
+	Push(index, std::move(task));
+	m_workAvailable.notify_one();
+}
+
+void TaskScheduler::Run(std::vector<Task>&& tasks)
+{
+	if (tasks.empty())
+		return;
+
+	size_t threadCount = m_queues.size();
+	size_t perThread = (tasks.size() + threadCount - 1) / threadCount;
+
+	for (size_t i = 0; i < tasks.size(); ++i)
+		Push(static_cast<int>(i / perThread), std::move(tasks[i]));
+
+	tasks.clear();
+	m_workAvailable.notify_all();
+}
+
+void TaskScheduler::Wait()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_workDone.wait(lock, [this]() { return m_pending == 0; });
+}
+
+bool TaskScheduler::PopTask(int index, Task& task)
+{
+	// the queues are all there before the first worker starts, the threads
+	// aren't
+	int count = static_cast<int>(m_queues.size());
+
+	// our own queue is worked from the front, in submission order. Others are
+	// stolen from at the back, furthest away from what their owner is working on.
+	for (int i = 0; i < count; ++i)
+	{
+		WorkQueue& queue = *m_queues[(index + i) % count];
+
+		std::unique_lock<std::mutex> queueLock(queue.mutex);
+		if (queue.tasks.empty())
+			continue;
+
+		if (i == 0)
+		{
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+		}
+		else
+		{
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+		}
+		queueLock.unlock();
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		--m_queued;
+		return true;
+	}
+
+	return false;
+}
+
+void TaskScheduler::WorkerMain(int index)
+{
+	while (true)
+	{
+		Task task;
+		if (PopTask(index, task))
+		{
+			task();
+
+			std::unique_lock<std::mutex> lock(m_mutex);
+			if (--m_pending == 0)
+				m_workDone.notify_all();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_workAvailable.wait(lock, [this]() { return m_shutdown || m_queued > 0; });
+
+		if (m_shutdown && m_queued == 0)
+			return;
+	}
+}
@@ -0,0 +1,74 @@
+//
+// TaskScheduler.h
+//
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A small work-stealing thread pool. Each worker owns a queue of tasks that it
+// runs in the order they were given. Workers that run out of work steal from
+// the opposite end of another worker's queue, so a batch of tasks that was
+// submitted in spatial order keeps each worker on a compact region for as long
+// as possible.
+class TaskScheduler
+{
+public:
+	using Task = std::function<void()>;
+
+	enum struct Priority
+	{
+		Low,
+		BelowNormal,
+		Normal,
+		AboveNormal,
+	};
+
+	// threadCount of zero uses one thread per hardware thread.
+	explicit TaskScheduler(int threadCount = 0, Priority priority = Priority::Normal);
+	~TaskScheduler();
+
+	TaskScheduler(const TaskScheduler&) = delete;
+	TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+	int GetThreadCount() const { return static_cast<int>(m_queues.size()); }
+
+	// queue a single task on the next worker.
+	void Run(Task task);
+
+	// queue a batch of tasks. The batch is split into contiguous runs, one per
+	// worker, so neighbouring tasks tend to run on the same thread.
+	void Run(std::vector<Task>&& tasks);
+
+	// block until every queued task has finished.
+	void Wait();
+
+private:
+	struct WorkQueue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	void WorkerMain(int index);
+	bool PopTask(int index, Task& task);
+	void Push(int index, Task&& task);
+
+	std::vector<std::unique_ptr<WorkQueue>> m_queues;
+	std::vector<std::thread> m_threads;
+	std::atomic<int> m_nextQueue = 0;
+
+	std::mutex m_mutex;
+	std::condition_variable m_workAvailable;
+	std::condition_variable m_workDone;
+	int m_queued = 0;       // tasks sitting in a queue
+	int m_pending = 0;      // tasks queued or running
+	bool m_shutdown = false;
+};
@@ -0,0 +1,275 @@
+//
+// TerrainHeightfield.cpp
+//
+
+#include "TerrainHeightfield.h"
+
+#include <Recast.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// same as the slope test of rcMarkWalkableTriangles
+static bool IsWalkable(const float* v0, const float* v1, const float* v2, float walkableThr)
+{
+	float e0[3], e1[3], norm[3];
+	rcVsub(e0, v1, v0);
+	rcVsub(e1, v2, v0);
+	rcVcross(norm, e0, e1);
+	rcVnormalize(norm);
+
+	return norm[1] > walkableThr;
+}
+
+//----------------------------------------------------------------------------
+
+void TerrainHeightfield::Clear()
+{
+	m_tiles.clear();
+	m_heights.clear();
+	m_flags.clear();
+	m_buckets.clear();
+	m_bucketSize = 0.f;
+}
+
+void TerrainHeightfield::AddTile(float x, float z, int quads, float quadSize,
+	const float* heights, const uint8_t* skipped)
+{
+	if (quads <= 0 || quadSize <= 0.f)
+		return;
+
+	Tile tile;
+	tile.x = x;
+	tile.z = z;
+	tile.quads = quads;
+	tile.quadSize = quadSize;
+	tile.firstHeight = (int)m_heights.size();
+	tile.firstFlag = -1;
+
+	m_heights.insert(m_heights.end(), heights, heights + (quads + 1) * (quads + 1));
+
+	if (skipped && std::any_of(skipped, skipped + quads * quads, [](uint8_t f) { return f != 0; }))
+	{
+		tile.firstFlag = (int)m_flags.size();
+		m_flags.insert(m_flags.end(), skipped, skipped + quads * quads);
+	}
+
+	m_tiles.push_back(tile);
+}
+
+int TerrainHeightfield::GetBucket(float v) const
+{
+	return (int)floorf(v / m_bucketSize);
+}
+
+void TerrainHeightfield::Build()
+{
+	m_buckets.clear();
+	m_bucketSize = 0.f;
+
+	for (const Tile& tile : m_tiles)
+		m_bucketSize = std::max(m_bucketSize, tile.quads * tile.quadSize);
+
+	for (int i = 0; i < (int)m_tiles.size(); ++i)
+	{
+		const Tile& tile = m_tiles[i];
+		const float size = tile.quads * tile.quadSize;
+
+		for (int z = GetBucket(tile.z); z <= GetBucket(tile.z + size); ++z)
+		{
+			for (int x = GetBucket(tile.x); x <= GetBucket(tile.x + size); ++x)
+				m_buckets[BucketKey(x, z)].push_back(i);
+		}
+	}
+}
+
+bool TerrainHeightfield::Rasterize(rcContext* ctx, rcHeightfield& hf, float walkableSlopeAngle,
+	int flagMergeThr) const
+{
+	if (m_buckets.empty())
+		return true;
+
+	const float walkableThr = cosf(walkableSlopeAngle / 180.0f * RC_PI);
+	const float* bmin = hf.bmin;
+	const float* bmax = hf.bmax;
+
+	// the tiles under the heightfield, in the order they were added
+	std::vector<int> tiles;
+	for (int z = GetBucket(bmin[2]); z <= GetBucket(bmax[2]); ++z)
+	{
+		for (int x = GetBucket(bmin[0]); x <= GetBucket(bmax[0]); ++x)
+		{
+			auto iter = m_buckets.find(BucketKey(x, z));
+			if (iter != m_buckets.end())
+				tiles.insert(tiles.end(), iter->second.begin(), iter->second.end());
+		}
+	}
+
+	std::sort(tiles.begin(), tiles.end());
+	tiles.erase(std::unique(tiles.begin(), tiles.end()), tiles.end());
+
+	for (int index : tiles)
+	{
+		const Tile& tile = m_tiles[index];
+		const float* heights = &m_heights[tile.firstHeight];
+		const uint8_t* flags = tile.firstFlag >= 0 ? &m_flags[tile.firstFlag] : nullptr;
+		const int stride = tile.quads + 1;
+
+		// quads of the tile that reach into the heightfield
+		const int r0 = std::max(0, (int)floorf((bmin[0] - tile.x) / tile.quadSize));
+		const int r1 = std::min(tile.quads - 1, (int)floorf((bmax[0] - tile.x) / tile.quadSize));
+		const int c0 = std::max(0, (int)floorf((bmin[2] - tile.z) / tile.quadSize));
+		const int c1 = std::min(tile.quads - 1, (int)floorf((bmax[2] - tile.z) / tile.quadSize));
+
+		for (int r = r0; r <= r1; ++r)
+		{
+			for (int c = c0; c <= c1; ++c)
+			{
+				if (flags && (flags[r * tile.quads + c] & 0x01))
+					continue;
+
+				const float h[4] = {
+					heights[r * stride + c],
+					heights[(r + 1) * stride + c],
+					heights[(r + 1) * stride + c + 1],
+					heights[r * stride + c + 1],
+				};
+
+				if (!RasterizeQuad(ctx, hf, tile.x + r * tile.quadSize, tile.z + c * tile.quadSize,
+					tile.quadSize, h, walkableThr, flagMergeThr))
+				{
+					return false;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+// The quad is split into two triangles along the diagonal from its corner, the
+// same way the loader triangulates it: A below the diagonal (t <= s) and B above
+// it, with s along x and t along z from 0 to 1 across the quad. Both are planes,
+// so the height range of a cell within one of them is found at the corners of
+// the cell inside of it and where the diagonal crosses the cell.
+bool TerrainHeightfield::RasterizeQuad(rcContext* ctx, rcHeightfield& hf, float x, float z,
+	float size, const float* h, float walkableThr, int flagMergeThr) const
+{
+	const float cs = hf.cs;
+	const float ics = 1.0f / hf.cs;
+	const float ich = 1.0f / hf.ch;
+	const float by = hf.bmax[1] - hf.bmin[1];
+
+	// the corners as the loader adds them: v0 (x, z), v1 (x + size, z),
+	// v2 (x + size, z + size), v3 (x, z + size)
+	const float v0[3] = { x, h[0], z };
+	const float v1[3] = { x + size, h[1], z };
+	const float v2[3] = { x + size, h[2], z + size };
+	const float v3[3] = { x, h[3], z + size };
+
+	const float qmin = std::min({ h[0], h[1], h[2], h[3] });
+	const float qmax = std::max({ h[0], h[1], h[2], h[3] });
+	if (qmax < hf.bmin[1] || qmin > hf.bmax[1])
+		return true;
+
+	// triangles (v0, v2, v1) and (v2, v0, v3)
+	const unsigned char areaA = IsWalkable(v0, v2, v1, walkableThr) ? RC_WALKABLE_AREA : RC_NULL_AREA;
+	const unsigned char areaB = IsWalkable(v2, v0, v3, walkableThr) ? RC_WALKABLE_AREA : RC_NULL_AREA;
+
+	auto heightA = [h](float s, float t) { return h[0] + s * (h[1] - h[0]) + t * (h[2] - h[1]); };
+	auto heightB = [h](float s, float t) { return h[0] + t * (h[3] - h[0]) + s * (h[2] - h[3]); };
+
+	const int x0 = std::max(0, (int)((x - hf.bmin[0]) * ics));
+	const int x1 = std::min(hf.width - 1, (int)((x + size - hf.bmin[0]) * ics));
+	const int y0 = std::max(0, (int)((z - hf.bmin[2]) * ics));
+	const int y1 = std::min(hf.height - 1, (int)((z + size - hf.bmin[2]) * ics));
+
+	auto addSpan = [&](int cx, int cy, float smin, float smax, unsigned char area)
+	{
+		smin -= hf.bmin[1];
+		smax -= hf.bmin[1];
+		if (smax < 0.0f || smin > by)
+			return true;
+		if (smin < 0.0f) smin = 0;
+		if (smax > by) smax = by;
+
+		unsigned short ismin = (unsigned short)rcClamp((int)floorf(smin * ich), 0, RC_SPAN_MAX_HEIGHT);
+		unsigned short ismax = (unsigned short)rcClamp((int)ceilf(smax * ich), (int)ismin + 1, RC_SPAN_MAX_HEIGHT);
+
+		return rcAddSpan(ctx, hf, cx, cy, ismin, ismax, area, flagMergeThr);
+	};
+
+	for (int cy = y0; cy <= y1; ++cy)
+	{
+		const float t0 = std::max(0.0f, (hf.bmin[2] + cy * cs - z) / size);
+		const float t1 = std::min(1.0f, (hf.bmin[2] + (cy + 1) * cs - z) / size);
+		if (t1 <= t0)
+			continue;
+
+		for (int cx = x0; cx <= x1; ++cx)
+		{
+			const float s0 = std::max(0.0f, (hf.bmin[0] + cx * cs - x) / size);
+			const float s1 = std::min(1.0f, (hf.bmin[0] + (cx + 1) * cs - x) / size);
+			if (s1 <= s0)
+				continue;
+
+			// the corners of the cell within the quad, and where the diagonal enters
+			// and leaves it
+			const float corners[4][2] = { { s0, t0 }, { s1, t0 }, { s0, t1 }, { s1, t1 } };
+			const float dmin = std::max(s0, t0);
+			const float dmax = std::min(s1, t1);
+			const bool crossed = dmin <= dmax;
+
+			// A, unless the cell is all above the diagonal
+			if (t0 < s1)
+			{
+				float smin = FLT_MAX, smax = -FLT_MAX;
+				for (const auto& p : corners)
+				{
+					if (p[1] <= p[0])
+					{
+						float v = heightA(p[0], p[1]);
+						smin = std::min(smin, v);
+						smax = std::max(smax, v);
+					}
+				}
+				if (crossed)
+				{
+					float va = heightA(dmin, dmin), vb = heightA(dmax, dmax);
+					smin = std::min({ smin, va, vb });
+					smax = std::max({ smax, va, vb });
+				}
+
+				if (!addSpan(cx, cy, smin, smax, areaA))
+					return false;
+			}
+
+			// B, unless the cell is all below the diagonal
+			if (t1 > s0)
+			{
+				float smin = FLT_MAX, smax = -FLT_MAX;
+				for (const auto& p : corners)
+				{
+					if (p[1] >= p[0])
+					{
+						float v = heightB(p[0], p[1]);
+						smin = std::min(smin, v);
+						smax = std::max(smax, v);
+					}
+				}
+				if (crossed)
+				{
+					float va = heightB(dmin, dmin), vb = heightB(dmax, dmax);
+					smin = std::min({ smin, va, vb });
+					smax = std::max({ smax, va, vb });
+				}
+
+				if (!addSpan(cx, cy, smin, smax, areaB))
+					return false;
+			}
+		}
+	}
+
+	return true;
+}
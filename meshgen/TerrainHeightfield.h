@@ -0,0 +1,75 @@
+//
+// TerrainHeightfield.h
+//
+
+// The terrain of EQG v4 zones is a regular grid of heights. It is kept here as
+// that grid, so tiles can write its spans straight into their heightfield: each
+// quad of the terrain covers a block of cells, and the height range of a cell
+// comes from the two planes of the quad without clipping any triangles.
+//
+// The terrain triangles are still part of the mesh for raycasts and drawing, they
+// are just left out when the triangles of a tile are rasterized.
+
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+class rcContext;
+struct rcHeightfield;
+
+class TerrainHeightfield
+{
+public:
+	struct Tile
+	{
+		// corner of the tile, in recast axes
+		float x, z;
+
+		int quads;          // quads along each side
+		float quadSize;
+		int firstHeight;    // (quads + 1)^2 heights, a row along z for each step along x
+		int firstFlag;      // quads^2 flags, or -1 if none of them are skipped
+	};
+
+	void Clear();
+
+	// heights holds (quads + 1)^2 values, and skipped quads^2 flags. Skipped quads
+	// have no terrain. skipped can be null.
+	void AddTile(float x, float z, int quads, float quadSize, const float* heights, const uint8_t* skipped);
+
+	// sets up the lookup of tiles by position. Call after adding the tiles.
+	void Build();
+
+	bool IsEmpty() const { return m_tiles.empty(); }
+
+	const std::vector<Tile>& GetTiles() const { return m_tiles; }
+	const std::vector<float>& GetHeights() const { return m_heights; }
+	const std::vector<uint8_t>& GetFlags() const { return m_flags; }
+
+	// Adds the spans of the terrain under the heightfield. Spans are walkable where
+	// the terrain is flatter than walkableSlopeAngle. Gives the same spans as
+	// rasterizing the terrain triangles with recast, up to rounding.
+	bool Rasterize(rcContext* ctx, rcHeightfield& hf, float walkableSlopeAngle, int flagMergeThr) const;
+
+private:
+	// h holds the heights at (x, z), (x + size, z), (x + size, z + size), (x, z + size)
+	bool RasterizeQuad(rcContext* ctx, rcHeightfield& hf, float x, float z, float size,
+		const float* h, float walkableThr, int flagMergeThr) const;
+
+	int GetBucket(float v) const;
+	static uint64_t BucketKey(int x, int z)
+	{
+		return ((uint64_t)(uint32_t)x << 32) | (uint32_t)z;
+	}
+
+	std::vector<Tile> m_tiles;
+	std::vector<float> m_heights;
+	std::vector<uint8_t> m_flags;
+
+	// tile indices by the buckets that they overlap. Buckets are as large as the
+	// largest tile, so each tile is in a few at most.
+	float m_bucketSize = 0.f;
+	std::unordered_map<uint64_t, std::vector<int>> m_buckets;
+};
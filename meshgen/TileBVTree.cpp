@@ -0,0 +1,337 @@
+//
+// TileBVTree.cpp
+//
+
+#include "TileBVTree.h"
+
+#include <DetourAlloc.h>
+#include <DetourCommon.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+
+// centroids are sorted into this many bins along each axis to find a split
+static const int BV_TREE_BINS = 16;
+
+static const unsigned short MESH_NULL_IDX = 0xffff;
+
+namespace {
+
+struct BVItem
+{
+	unsigned short bmin[3];
+	unsigned short bmax[3];
+	int i;
+
+	// twice the center, to stay in integers
+	int Centroid(int axis) const { return bmin[axis] + bmax[axis]; }
+};
+
+struct BVBounds
+{
+	int bmin[3] = { INT_MAX, INT_MAX, INT_MAX };
+	int bmax[3] = { INT_MIN, INT_MIN, INT_MIN };
+
+	void Add(const BVItem& item)
+	{
+		for (int j = 0; j < 3; ++j)
+		{
+			bmin[j] = std::min(bmin[j], (int)item.bmin[j]);
+			bmax[j] = std::max(bmax[j], (int)item.bmax[j]);
+		}
+	}
+
+	void Add(const BVBounds& other)
+	{
+		for (int j = 0; j < 3; ++j)
+		{
+			bmin[j] = std::min(bmin[j], other.bmin[j]);
+			bmax[j] = std::max(bmax[j], other.bmax[j]);
+		}
+	}
+
+	// half the surface area, which is all the heuristic needs
+	float Area() const
+	{
+		if (bmin[0] > bmax[0])
+			return 0.0f;
+
+		const float dx = (float)(bmax[0] - bmin[0]);
+		const float dy = (float)(bmax[1] - bmin[1]);
+		const float dz = (float)(bmax[2] - bmin[2]);
+		return dx * dy + dy * dz + dz * dx;
+	}
+};
+
+// a range of items and the node that its subtree starts at
+struct BVTask
+{
+	int begin;
+	int end;
+	int node;
+};
+
+} // namespace
+
+// the bounds of each poly as dtCreateNavMeshData works them out
+static void CalcItemBounds(const dtNavMeshCreateParams& params, std::vector<BVItem>& items)
+{
+	const float quantFactor = 1 / params.cs;
+
+	items.resize(params.polyCount);
+	for (int i = 0; i < params.polyCount; ++i)
+	{
+		BVItem& it = items[i];
+		it.i = i;
+
+		// Use detail meshes if available.
+		if (params.detailMeshes)
+		{
+			const int vb = (int)params.detailMeshes[i * 4 + 0];
+			const int ndv = (int)params.detailMeshes[i * 4 + 1];
+			const float* dv = &params.detailVerts[vb * 3];
+
+			float bmin[3], bmax[3];
+			dtVcopy(bmin, dv);
+			dtVcopy(bmax, dv);
+
+			for (int j = 1; j < ndv; ++j)
+			{
+				dtVmin(bmin, &dv[j * 3]);
+				dtVmax(bmax, &dv[j * 3]);
+			}
+
+			// BV-tree uses cs for all dimensions
+			for (int j = 0; j < 3; ++j)
+			{
+				it.bmin[j] = (unsigned short)dtClamp((int)((bmin[j] - params.bmin[j]) * quantFactor), 0, 0xffff);
+				it.bmax[j] = (unsigned short)dtClamp((int)((bmax[j] - params.bmin[j]) * quantFactor), 0, 0xffff);
+			}
+		}
+		else
+		{
+			const unsigned short* p = &params.polys[i * params.nvp * 2];
+			for (int j = 0; j < 3; ++j)
+				it.bmin[j] = it.bmax[j] = params.verts[p[0] * 3 + j];
+
+			for (int k = 1; k < params.nvp && p[k] != MESH_NULL_IDX; ++k)
+			{
+				for (int j = 0; j < 3; ++j)
+				{
+					const unsigned short v = params.verts[p[k] * 3 + j];
+					it.bmin[j] = std::min(it.bmin[j], v);
+					it.bmax[j] = std::max(it.bmax[j], v);
+				}
+			}
+
+			// Remap y
+			it.bmin[1] = (unsigned short)dtMathFloorf((float)it.bmin[1] * params.ch / params.cs);
+			it.bmax[1] = (unsigned short)dtMathCeilf((float)it.bmax[1] * params.ch / params.cs);
+		}
+	}
+}
+
+// where to split [begin, end), somewhere in between. Picks the cheapest split
+// between the bins of the axes, and falls back to the median along the longest
+// axis when the centroids can't be told apart.
+static int SplitItems(BVItem* items, int begin, int end, const BVBounds& bounds)
+{
+	BVBounds centroids;
+	for (int i = begin; i < end; ++i)
+	{
+		for (int j = 0; j < 3; ++j)
+		{
+			centroids.bmin[j] = std::min(centroids.bmin[j], items[i].Centroid(j));
+			centroids.bmax[j] = std::max(centroids.bmax[j], items[i].Centroid(j));
+		}
+	}
+
+	int bestAxis = -1;
+	int bestBin = 0;
+	float bestCost = FLT_MAX;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const int extent = centroids.bmax[axis] - centroids.bmin[axis];
+		if (extent <= 0)
+			continue;
+
+		BVBounds binBounds[BV_TREE_BINS];
+		int binCounts[BV_TREE_BINS] = {};
+
+		for (int i = begin; i < end; ++i)
+		{
+			int bin = (int)((int64_t)(items[i].Centroid(axis) - centroids.bmin[axis]) * BV_TREE_BINS / (extent + 1));
+			binBounds[bin].Add(items[i]);
+			binCounts[bin]++;
+		}
+
+		// the areas of everything right of each split, swept from the right
+		float rightAreas[BV_TREE_BINS];
+		int rightCounts[BV_TREE_BINS];
+		BVBounds right;
+		int rightCount = 0;
+		for (int bin = BV_TREE_BINS - 1; bin > 0; --bin)
+		{
+			right.Add(binBounds[bin]);
+			rightCount += binCounts[bin];
+			rightAreas[bin] = right.Area();
+			rightCounts[bin] = rightCount;
+		}
+
+		BVBounds left;
+		int leftCount = 0;
+		for (int bin = 0; bin < BV_TREE_BINS - 1; ++bin)
+		{
+			left.Add(binBounds[bin]);
+			leftCount += binCounts[bin];
+			if (leftCount == 0 || rightCounts[bin + 1] == 0)
+				continue;
+
+			float cost = left.Area() * leftCount + rightAreas[bin + 1] * rightCounts[bin + 1];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = bin;
+			}
+		}
+	}
+
+	if (bestAxis >= 0)
+	{
+		const int extent = centroids.bmax[bestAxis] - centroids.bmin[bestAxis];
+		BVItem* split = std::partition(items + begin, items + end, [&](const BVItem& item)
+		{
+			int bin = (int)((int64_t)(item.Centroid(bestAxis) - centroids.bmin[bestAxis]) * BV_TREE_BINS / (extent + 1));
+			return bin <= bestBin;
+		});
+
+		return (int)(split - items);
+	}
+
+	// all of the centroids are in the same place, any split is as good as another
+	int axis = 0;
+	for (int j = 1; j < 3; ++j)
+	{
+		if (bounds.bmax[j] - bounds.bmin[j] > bounds.bmax[axis] - bounds.bmin[axis])
+			axis = j;
+	}
+
+	const int mid = begin + (end - begin) / 2;
+	std::nth_element(items + begin, items + mid, items + end,
+		[axis](const BVItem& a, const BVItem& b) { return a.bmin[axis] < b.bmin[axis]; });
+
+	return mid;
+}
+
+void TileBVTree::Build(const dtNavMeshCreateParams& params, std::vector<dtBVNode>& nodes)
+{
+	nodes.clear();
+	if (params.polyCount <= 0)
+		return;
+
+	std::vector<BVItem> items;
+	CalcItemBounds(params, items);
+
+	// a subtree over n polys always has 2n - 1 nodes, so where each node goes is
+	// known before its children are built and the tree doesn't need recursion.
+	nodes.resize(2 * params.polyCount - 1);
+
+	std::vector<BVTask> tasks;
+	tasks.push_back({ 0, params.polyCount, 0 });
+
+	while (!tasks.empty())
+	{
+		BVTask task = tasks.back();
+		tasks.pop_back();
+
+		dtBVNode& node = nodes[task.node];
+
+		if (task.end - task.begin == 1)
+		{
+			const BVItem& item = items[task.begin];
+			for (int j = 0; j < 3; ++j)
+			{
+				node.bmin[j] = item.bmin[j];
+				node.bmax[j] = item.bmax[j];
+			}
+			node.i = item.i;
+			continue;
+		}
+
+		BVBounds bounds;
+		for (int i = task.begin; i < task.end; ++i)
+			bounds.Add(items[i]);
+
+		for (int j = 0; j < 3; ++j)
+		{
+			node.bmin[j] = (unsigned short)bounds.bmin[j];
+			node.bmax[j] = (unsigned short)bounds.bmax[j];
+		}
+
+		// Negative index means escape.
+		node.i = -(2 * (task.end - task.begin) - 1);
+
+		const int split = SplitItems(items.data(), task.begin, task.end, bounds);
+		const int leftNode = task.node + 1;
+		const int rightNode = leftNode + 2 * (split - task.begin) - 1;
+
+		tasks.push_back({ split, task.end, rightNode });
+		tasks.push_back({ task.begin, split, leftNode });
+	}
+}
+
+bool TileBVTree::CreateNavMeshData(const dtNavMeshCreateParams& params,
+	unsigned char** outData, int* outDataSize)
+{
+	dtNavMeshCreateParams createParams = params;
+	if (!params.buildBvTree)
+		return dtCreateNavMeshData(&createParams, outData, outDataSize);
+
+	// detour leaves out the tree, and it's put in where detour would have had it
+	createParams.buildBvTree = false;
+
+	unsigned char* data = nullptr;
+	int dataSize = 0;
+	if (!dtCreateNavMeshData(&createParams, &data, &dataSize))
+		return false;
+
+	std::vector<dtBVNode> nodes;
+	Build(params, nodes);
+
+	const dtMeshHeader* header = reinterpret_cast<const dtMeshHeader*>(data);
+	const int bvTreeOffset = dtAlign4(sizeof(dtMeshHeader))
+		+ dtAlign4(sizeof(float) * 3 * header->vertCount)
+		+ dtAlign4(sizeof(dtPoly) * header->polyCount)
+		+ dtAlign4(sizeof(dtLink) * header->maxLinkCount)
+		+ dtAlign4(sizeof(dtPolyDetail) * header->detailMeshCount)
+		+ dtAlign4(sizeof(float) * 3 * header->detailVertCount)
+		+ dtAlign4(sizeof(unsigned char) * 4 * header->detailTriCount);
+	const int bvTreeSize = dtAlign4(sizeof(dtBVNode) * (int)nodes.size());
+
+	const int newDataSize = dataSize + bvTreeSize;
+	unsigned char* newData = static_cast<unsigned char*>(dtAlloc(newDataSize, DT_ALLOC_PERM));
+	if (!newData)
+	{
+		dtFree(data);
+		return false;
+	}
+
+	memset(newData, 0, newDataSize);
+	memcpy(newData, data, bvTreeOffset);
+	memcpy(newData + bvTreeOffset, nodes.data(), sizeof(dtBVNode) * nodes.size());
+	memcpy(newData + bvTreeOffset + bvTreeSize, data + bvTreeOffset, dataSize - bvTreeOffset);
+	dtFree(data);
+
+	dtMeshHeader* newHeader = reinterpret_cast<dtMeshHeader*>(newData);
+	newHeader->bvNodeCount = (int)nodes.size();
+	newHeader->bvQuantFactor = 1.0f / params.cs;
+
+	*outData = newData;
+	*outDataSize = newDataSize;
+	return true;
+}
@@ -0,0 +1,26 @@
+//
+// TileBVTree.h
+//
+
+#pragma once
+
+#include <DetourNavMesh.h>
+#include <DetourNavMeshBuilder.h>
+
+#include <vector>
+
+// Builds the bounding volume tree of a tile with a binned surface area heuristic,
+// in place of the median split of dtCreateNavMeshData, which sorts every range
+// it splits. The nodes are the same quantized dtBVNodes in the same depth first
+// order with escape indices, so detour reads them like its own, but the tree
+// only has as many nodes as it needs and its boxes overlap less.
+class TileBVTree
+{
+public:
+	// the tree for the polys in params, quantized the way detour does it
+	static void Build(const dtNavMeshCreateParams& params, std::vector<dtBVNode>& nodes);
+
+	// dtCreateNavMeshData, with the tree from Build if params asks for one
+	static bool CreateNavMeshData(const dtNavMeshCreateParams& params,
+		unsigned char** outData, int* outDataSize);
+};
@@ -0,0 +1,435 @@
+//
+// TileDebugCache.cpp
+//
+
+#include "TileDebugCache.h"
+
+#include <RecastAlloc.h>
+
+#include <algorithm>
+#include <cstring>
+
+// the intermediates are thrown away again when the tile is rebuilt, so they're
+// compressed for speed rather than size
+static const int DEBUG_CACHE_COMPRESSION_LEVEL = 1;
+
+static inline uint64_t TileKey(int x, int y)
+{
+	return (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) | static_cast<uint32_t>(y);
+}
+
+namespace {
+
+class BlobWriter
+{
+public:
+	explicit BlobWriter(std::vector<uint8_t>& out) : m_out(out) {}
+
+	template <typename T>
+	void Write(const T& value) { Write(&value, sizeof(T)); }
+
+	void Write(const void* data, size_t size)
+	{
+		if (!size)
+			return;
+
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		m_out.insert(m_out.end(), bytes, bytes + size);
+	}
+
+private:
+	std::vector<uint8_t>& m_out;
+};
+
+class BlobReader
+{
+public:
+	BlobReader(const std::vector<uint8_t>& in) : m_in(in) {}
+
+	template <typename T>
+	bool Read(T& value) { return Read(&value, sizeof(T)); }
+
+	bool Read(void* data, size_t size)
+	{
+		if (m_pos + size > m_in.size())
+			return false;
+
+		if (size)
+			memcpy(data, m_in.data() + m_pos, size);
+		m_pos += size;
+		return true;
+	}
+
+private:
+	const std::vector<uint8_t>& m_in;
+	size_t m_pos = 0;
+};
+
+// recast data is freed with rcFree, so it's allocated the same way
+template <typename T>
+T* AllocArray(size_t count)
+{
+	return static_cast<T*>(rcAlloc(sizeof(T) * count, RC_ALLOC_PERM));
+}
+
+} // namespace
+
+//----------------------------------------------------------------------------
+
+// the spans of each column, bottom up
+static void WriteHeightfield(const rcHeightfield& hf, std::vector<uint8_t>& out)
+{
+	BlobWriter writer(out);
+	writer.Write(hf.width);
+	writer.Write(hf.height);
+	writer.Write(hf.bmin, sizeof(hf.bmin));
+	writer.Write(hf.bmax, sizeof(hf.bmax));
+	writer.Write(hf.cs);
+	writer.Write(hf.ch);
+
+	for (int i = 0; i < hf.width * hf.height; ++i)
+	{
+		uint16_t count = 0;
+		for (const rcSpan* s = hf.spans[i]; s; s = s->next)
+			++count;
+		writer.Write(count);
+
+		for (const rcSpan* s = hf.spans[i]; s; s = s->next)
+		{
+			writer.Write(static_cast<uint16_t>(s->smin));
+			writer.Write(static_cast<uint16_t>(s->smax));
+			writer.Write(static_cast<uint8_t>(s->area));
+		}
+	}
+}
+
+static deleting_unique_ptr<rcHeightfield> ReadHeightfield(const std::vector<uint8_t>& in)
+{
+	deleting_unique_ptr<rcHeightfield> hf(rcAllocHeightfield(), [](rcHeightfield* hf) { rcFreeHeightField(hf); });
+	if (!hf)
+		return nullptr;
+
+	BlobReader reader(in);
+	int width = 0, height = 0;
+	float bmin[3], bmax[3], cs = 0, ch = 0;
+	if (!reader.Read(width) || !reader.Read(height) || !reader.Read(bmin, sizeof(bmin))
+		|| !reader.Read(bmax, sizeof(bmax)) || !reader.Read(cs) || !reader.Read(ch))
+	{
+		return nullptr;
+	}
+
+	rcContext ctx(false);
+	if (!rcCreateHeightfield(&ctx, *hf, width, height, bmin, bmax, cs, ch))
+		return nullptr;
+
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			uint16_t count = 0;
+			if (!reader.Read(count))
+				return nullptr;
+
+			for (uint16_t i = 0; i < count; ++i)
+			{
+				uint16_t smin, smax;
+				uint8_t area;
+				if (!reader.Read(smin) || !reader.Read(smax) || !reader.Read(area))
+					return nullptr;
+
+				// the spans of a column never touch, so none of them are merged
+				if (!rcAddSpan(&ctx, *hf, x, y, smin, smax, area, 0))
+					return nullptr;
+			}
+		}
+	}
+
+	return hf;
+}
+
+static void WriteCompactHeightfield(const rcCompactHeightfield& chf, std::vector<uint8_t>& out)
+{
+	BlobWriter writer(out);
+	writer.Write(chf);
+	writer.Write(chf.cells, sizeof(rcCompactCell) * chf.width * chf.height);
+	writer.Write(chf.spans, sizeof(rcCompactSpan) * chf.spanCount);
+	writer.Write(chf.areas, sizeof(unsigned char) * chf.spanCount);
+
+	// only watershed partitioning has a distance field
+	const uint8_t hasDist = chf.dist != nullptr;
+	writer.Write(hasDist);
+	if (hasDist)
+		writer.Write(chf.dist, sizeof(unsigned short) * chf.spanCount);
+}
+
+static deleting_unique_ptr<rcCompactHeightfield> ReadCompactHeightfield(const std::vector<uint8_t>& in)
+{
+	deleting_unique_ptr<rcCompactHeightfield> chf(rcAllocCompactHeightfield(),
+		[](rcCompactHeightfield* chf) { rcFreeCompactHeightfield(chf); });
+	if (!chf)
+		return nullptr;
+
+	BlobReader reader(in);
+	if (!reader.Read(*chf))
+	{
+		memset(chf.get(), 0, sizeof(rcCompactHeightfield));
+		return nullptr;
+	}
+
+	// the pointers that were read are from the tile that was stored
+	const size_t cellCount = (size_t)chf->width * chf->height;
+	chf->cells = AllocArray<rcCompactCell>(cellCount);
+	chf->spans = AllocArray<rcCompactSpan>(chf->spanCount);
+	chf->areas = AllocArray<unsigned char>(chf->spanCount);
+	chf->dist = nullptr;
+
+	uint8_t hasDist = 0;
+	if (!chf->cells || !chf->spans || !chf->areas
+		|| !reader.Read(chf->cells, sizeof(rcCompactCell) * cellCount)
+		|| !reader.Read(chf->spans, sizeof(rcCompactSpan) * chf->spanCount)
+		|| !reader.Read(chf->areas, sizeof(unsigned char) * chf->spanCount)
+		|| !reader.Read(hasDist))
+	{
+		return nullptr;
+	}
+
+	if (hasDist)
+	{
+		chf->dist = AllocArray<unsigned short>(chf->spanCount);
+		if (!chf->dist || !reader.Read(chf->dist, sizeof(unsigned short) * chf->spanCount))
+			return nullptr;
+	}
+
+	return chf;
+}
+
+static void WriteContours(const rcContourSet& cset, std::vector<uint8_t>& out)
+{
+	BlobWriter writer(out);
+	writer.Write(cset);
+
+	for (int i = 0; i < cset.nconts; ++i)
+	{
+		const rcContour& cont = cset.conts[i];
+		writer.Write(cont.nverts);
+		writer.Write(cont.nrverts);
+		writer.Write(cont.reg);
+		writer.Write(cont.area);
+		writer.Write(cont.verts, sizeof(int) * 4 * cont.nverts);
+		writer.Write(cont.rverts, sizeof(int) * 4 * cont.nrverts);
+	}
+}
+
+static deleting_unique_ptr<rcContourSet> ReadContours(const std::vector<uint8_t>& in)
+{
+	deleting_unique_ptr<rcContourSet> cset(rcAllocContourSet(), [](rcContourSet* cs) { rcFreeContourSet(cs); });
+	if (!cset)
+		return nullptr;
+
+	BlobReader reader(in);
+	if (!reader.Read(*cset))
+	{
+		memset(cset.get(), 0, sizeof(rcContourSet));
+		return nullptr;
+	}
+
+	// the contours are filled in one at a time, so a short read frees what's there
+	const int nconts = cset->nconts;
+	cset->nconts = 0;
+	cset->conts = AllocArray<rcContour>(nconts);
+	if (!cset->conts)
+		return nullptr;
+
+	for (int i = 0; i < nconts; ++i)
+	{
+		rcContour& cont = cset->conts[i];
+		memset(&cont, 0, sizeof(rcContour));
+		++cset->nconts;
+
+		int nverts = 0, nrverts = 0;
+		if (!reader.Read(nverts) || !reader.Read(nrverts) || !reader.Read(cont.reg) || !reader.Read(cont.area))
+			return nullptr;
+
+		cont.verts = AllocArray<int>(4 * nverts);
+		cont.rverts = AllocArray<int>(4 * nrverts);
+		if ((nverts && !cont.verts) || (nrverts && !cont.rverts)
+			|| !reader.Read(cont.verts, sizeof(int) * 4 * nverts)
+			|| !reader.Read(cont.rverts, sizeof(int) * 4 * nrverts))
+		{
+			return nullptr;
+		}
+
+		cont.nverts = nverts;
+		cont.nrverts = nrverts;
+	}
+
+	return cset;
+}
+
+//----------------------------------------------------------------------------
+
+void TileDebugCache::SetMaxTiles(int maxTiles)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_maxTiles = std::max(maxTiles, 0);
+
+	while ((int)m_entries.size() > m_maxTiles)
+	{
+		m_entriesByTile.erase(m_entries.back().key);
+		m_entries.pop_back();
+	}
+}
+
+bool TileDebugCache::IsEmpty() const
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	return m_entries.empty();
+}
+
+void TileDebugCache::Store(int tx, int ty, const rcHeightfield& solid, const rcCompactHeightfield& chf,
+	const rcContourSet& cset)
+{
+	if (!IsEnabled())
+		return;
+
+	// compressed before taking the lock, the workers store tiles at the same time
+	Entry entry;
+	entry.key = TileKey(tx, ty);
+
+	std::vector<uint8_t> buffer;
+	for (int i = 0; i < (int)Data::Count; ++i)
+	{
+		buffer.clear();
+		switch ((Data)i)
+		{
+		case Data::Heightfield: WriteHeightfield(solid, buffer); break;
+		case Data::CompactHeightfield: WriteCompactHeightfield(chf, buffer); break;
+		case Data::Contours: WriteContours(cset, buffer); break;
+		default: break;
+		}
+
+		entry.size[i] = buffer.size();
+		if (!CompressMemory(buffer.data(), buffer.size(), entry.compressed[i], DEBUG_CACHE_COMPRESSION_LEVEL))
+			return;
+	}
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (m_maxTiles == 0)
+		return;
+
+	auto iter = m_entriesByTile.find(entry.key);
+	if (iter != m_entriesByTile.end())
+	{
+		m_entries.erase(iter->second);
+		m_entriesByTile.erase(iter);
+	}
+
+	m_entries.push_front(std::move(entry));
+	m_entriesByTile[m_entries.front().key] = m_entries.begin();
+
+	while ((int)m_entries.size() > m_maxTiles)
+	{
+		m_entriesByTile.erase(m_entries.back().key);
+		m_entries.pop_back();
+	}
+}
+
+void TileDebugCache::Remove(int tx, int ty)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	auto iter = m_entriesByTile.find(TileKey(tx, ty));
+	if (iter != m_entriesByTile.end())
+	{
+		m_entries.erase(iter->second);
+		m_entriesByTile.erase(iter);
+	}
+}
+
+void TileDebugCache::Clear()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_entries.clear();
+	m_entriesByTile.clear();
+}
+
+bool TileDebugCache::Decompress(const Entry& entry, Data data, std::vector<uint8_t>& buffer) const
+{
+	const std::vector<uint8_t>& compressed = entry.compressed[(int)data];
+	buffer.resize(entry.size[(int)data]);
+
+	return DecompressMemory((void*)compressed.data(), compressed.size(), buffer.data(), buffer.size());
+}
+
+void TileDebugCache::Expand(Entry& entry, Data data)
+{
+	Collapse(entry, data);
+
+	std::vector<uint8_t> buffer;
+	switch (data)
+	{
+	case Data::Heightfield:
+		if (!entry.solid && Decompress(entry, data, buffer))
+			entry.solid = ReadHeightfield(buffer);
+		break;
+
+	case Data::CompactHeightfield:
+		if (!entry.chf && Decompress(entry, data, buffer))
+			entry.chf = ReadCompactHeightfield(buffer);
+		break;
+
+	case Data::Contours:
+		if (!entry.cset && Decompress(entry, data, buffer))
+			entry.cset = ReadContours(buffer);
+		break;
+
+	default:
+		break;
+	}
+}
+
+void TileDebugCache::Collapse(Entry& entry, Data keep)
+{
+	if (keep != Data::Heightfield)
+		entry.solid.reset();
+	if (keep != Data::CompactHeightfield)
+		entry.chf.reset();
+	if (keep != Data::Contours)
+		entry.cset.reset();
+}
+
+void TileDebugCache::DrawHeightfields(const std::function<void(const rcHeightfield&)>& draw)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	for (Entry& entry : m_entries)
+	{
+		Expand(entry, Data::Heightfield);
+		if (entry.solid)
+			draw(*entry.solid);
+	}
+}
+
+void TileDebugCache::DrawCompactHeightfields(const std::function<void(const rcCompactHeightfield&)>& draw)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	for (Entry& entry : m_entries)
+	{
+		Expand(entry, Data::CompactHeightfield);
+		if (entry.chf)
+			draw(*entry.chf);
+	}
+}
+
+void TileDebugCache::DrawContours(const std::function<void(const rcContourSet&)>& draw)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	for (Entry& entry : m_entries)
+	{
+		Expand(entry, Data::Contours);
+		if (entry.cset)
+			draw(*entry.cset);
+	}
+}
@@ -0,0 +1,74 @@
+//
+// TileDebugCache.h
+//
+
+#pragma once
+
+#include "common/Utilities.h"
+
+#include <Recast.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Keeps the recast intermediates of the last few tiles that were built, so the
+// voxel, compact heightfield and contour draw modes have something to show
+// without building the tiles again. Each tile's heightfield, compact heightfield
+// and contours are kept compressed, and only the ones that are being drawn are
+// expanded. Tiles are stored from the build workers and drawn from the main loop.
+class TileDebugCache
+{
+public:
+	TileDebugCache() = default;
+	TileDebugCache(const TileDebugCache&) = delete;
+	TileDebugCache& operator=(const TileDebugCache&) = delete;
+
+	// the number of tiles that are kept, the ones stored longest ago are dropped
+	// first. 0 keeps none, which is the default.
+	void SetMaxTiles(int maxTiles);
+	int GetMaxTiles() const { return m_maxTiles; }
+
+	bool IsEnabled() const { return m_maxTiles > 0; }
+	bool IsEmpty() const;
+
+	// solid is the filtered heightfield, chf has its regions.
+	void Store(int tx, int ty, const rcHeightfield& solid, const rcCompactHeightfield& chf,
+		const rcContourSet& cset);
+	void Remove(int tx, int ty);
+	void Clear();
+
+	// calls draw with each of the cached tiles. The other kinds of data of the
+	// tiles are put away again.
+	void DrawHeightfields(const std::function<void(const rcHeightfield&)>& draw);
+	void DrawCompactHeightfields(const std::function<void(const rcCompactHeightfield&)>& draw);
+	void DrawContours(const std::function<void(const rcContourSet&)>& draw);
+
+private:
+	enum class Data { Heightfield, CompactHeightfield, Contours, Count };
+
+	struct Entry
+	{
+		uint64_t key = 0;
+		std::vector<uint8_t> compressed[(int)Data::Count];
+		size_t size[(int)Data::Count] = {};
+
+		// only the kind that is being drawn is expanded
+		deleting_unique_ptr<rcHeightfield> solid;
+		deleting_unique_ptr<rcCompactHeightfield> chf;
+		deleting_unique_ptr<rcContourSet> cset;
+	};
+
+	void Expand(Entry& entry, Data data);
+	void Collapse(Entry& entry, Data keep);
+	bool Decompress(const Entry& entry, Data data, std::vector<uint8_t>& buffer) const;
+
+	mutable std::mutex m_mutex;
+	std::list<Entry> m_entries; // most recently stored first
+	std::unordered_map<uint64_t, std::list<Entry>::iterator> m_entriesByTile;
+	std::atomic<int> m_maxTiles{ 0 };
+};
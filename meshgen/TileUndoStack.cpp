@@ -0,0 +1,371 @@
+//
+// TileUndoStack.cpp
+//
+
+#include "TileUndoStack.h"
+
+#include <DetourAlloc.h>
+#include <DetourNavMesh.h>
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_set>
+
+// the most layers a tile can have in any of the meshes
+static const int UNDO_MAX_TILE_LAYERS = 32;
+
+static inline uint64_t TileKey(int x, int y)
+{
+	return (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) | static_cast<uint32_t>(y);
+}
+
+static inline std::pair<int, int> TileFromKey(uint64_t key)
+{
+	return { static_cast<int>(key >> 32), static_cast<int>(key & 0xffffffff) };
+}
+
+void TileUndoStack::BeginStep(NavMesh& navMesh, const std::string& label, bool volumes)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	CheckMesh(navMesh);
+	FinishStep(navMesh);
+
+	m_steps.erase(m_steps.begin() + m_applied, m_steps.end());
+
+	Step step;
+	step.label = label;
+	step.hasVolumes = volumes;
+	if (volumes)
+		step.volumesBefore = CopyVolumes(navMesh);
+
+	m_steps.push_back(std::move(step));
+	m_applied = m_steps.size();
+	m_recording = true;
+
+	while (m_steps.size() > m_maxSteps)
+	{
+		m_steps.pop_front();
+		--m_applied;
+	}
+}
+
+void TileUndoStack::TouchTile(NavMesh& navMesh, int x, int y)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	CheckMesh(navMesh);
+
+	uint64_t key = TileKey(x, y);
+	if (!m_recording)
+	{
+		// the copies of the tile no longer match it
+		m_current.erase(key);
+		return;
+	}
+
+	Step& step = m_steps[m_applied - 1];
+	if (step.before.count(key))
+		return;
+
+	auto iter = m_current.find(key);
+	ColumnPtr column = iter != m_current.end() ? iter->second.lock() : nullptr;
+	if (!column)
+	{
+		column = SaveTiles(navMesh, x, y);
+		m_current[key] = column;
+	}
+
+	step.before.emplace(key, std::move(column));
+}
+
+void TileUndoStack::EndStep(NavMesh& navMesh)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	CheckMesh(navMesh);
+	FinishStep(navMesh);
+}
+
+void TileUndoStack::FinishStep(NavMesh& navMesh)
+{
+	if (!m_recording)
+		return;
+
+	m_recording = false;
+	Step& step = m_steps[m_applied - 1];
+
+	// nothing was changed
+	if (step.before.empty() && !step.hasVolumes)
+	{
+		m_steps.erase(m_steps.begin() + (m_applied - 1));
+		--m_applied;
+		return;
+	}
+
+	for (const auto& entry : step.before)
+	{
+		std::pair<int, int> tile = TileFromKey(entry.first);
+		ColumnPtr column = SaveTiles(navMesh, tile.first, tile.second);
+
+		m_current[entry.first] = column;
+		step.after.emplace(entry.first, std::move(column));
+	}
+
+	if (step.hasVolumes)
+		step.volumesAfter = CopyVolumes(navMesh);
+}
+
+bool TileUndoStack::Undo(NavMesh& navMesh, std::vector<std::pair<int, int>>& tiles)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	CheckMesh(navMesh);
+	FinishStep(navMesh);
+
+	if (m_applied == 0)
+		return false;
+
+	return ApplyStep(navMesh, m_steps[--m_applied], true, tiles);
+}
+
+bool TileUndoStack::Redo(NavMesh& navMesh, std::vector<std::pair<int, int>>& tiles)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	CheckMesh(navMesh);
+	FinishStep(navMesh);
+
+	if (m_applied == m_steps.size())
+		return false;
+
+	return ApplyStep(navMesh, m_steps[m_applied++], false, tiles);
+}
+
+bool TileUndoStack::ApplyStep(NavMesh& navMesh, Step& step, bool undo,
+	std::vector<std::pair<int, int>>& tiles)
+{
+	const auto& columns = undo ? step.before : step.after;
+
+	{
+		auto tilesLock = navMesh.BeginTileChange();
+
+		for (const auto& entry : columns)
+		{
+			std::pair<int, int> tile = TileFromKey(entry.first);
+			RestoreTiles(navMesh, tile.first, tile.second, *entry.second);
+
+			m_current[entry.first] = entry.second;
+			tiles.push_back(tile);
+		}
+	}
+
+	// the saved tiles were built with these, so nothing needs to be rebuilt
+	if (step.hasVolumes)
+		navMesh.SetConvexVolumes(undo ? step.volumesBefore : step.volumesAfter);
+
+	return true;
+}
+
+void TileUndoStack::Clear()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	m_steps.clear();
+	m_applied = 0;
+	m_recording = false;
+	m_current.clear();
+}
+
+bool TileUndoStack::CanUndo() const
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	return m_applied > 0;
+}
+
+bool TileUndoStack::CanRedo() const
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	return m_applied < m_steps.size();
+}
+
+std::string TileUndoStack::GetUndoLabel() const
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	return m_applied > 0 ? m_steps[m_applied - 1].label : std::string();
+}
+
+std::string TileUndoStack::GetRedoLabel() const
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	return m_applied < m_steps.size() ? m_steps[m_applied].label : std::string();
+}
+
+void TileUndoStack::SetMaxSteps(size_t maxSteps)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_maxSteps = std::max<size_t>(maxSteps, 1);
+
+	while (m_steps.size() > m_maxSteps)
+	{
+		if (m_applied == 0)
+		{
+			// keep the steps that can be redone over the ones that are furthest back
+			m_steps.pop_back();
+			continue;
+		}
+
+		m_steps.pop_front();
+		--m_applied;
+	}
+}
+
+size_t TileUndoStack::GetMemoryUsed() const
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	std::unordered_set<const TileColumn*> counted;
+	size_t size = 0;
+
+	auto addColumns = [&](const std::unordered_map<uint64_t, ColumnPtr>& columns)
+	{
+		for (const auto& entry : columns)
+		{
+			if (counted.insert(entry.second.get()).second)
+				size += entry.second->size;
+		}
+	};
+
+	for (const Step& step : m_steps)
+	{
+		addColumns(step.before);
+		addColumns(step.after);
+	}
+
+	return size;
+}
+
+void TileUndoStack::CheckMesh(NavMesh& navMesh)
+{
+	const dtNavMesh* mesh = navMesh.GetNavMesh().get();
+	if (mesh == m_mesh)
+		return;
+
+	m_steps.clear();
+	m_applied = 0;
+	m_recording = false;
+	m_current.clear();
+	m_mesh = mesh;
+}
+
+TileUndoStack::ColumnPtr TileUndoStack::SaveTiles(NavMesh& navMesh, int x, int y) const
+{
+	auto column = std::make_shared<TileColumn>();
+	std::vector<dtNavMesh*> meshes = GetMeshes(navMesh);
+	column->meshes.resize(meshes.size());
+
+	for (size_t i = 0; i < meshes.size(); ++i)
+	{
+		if (!meshes[i])
+			continue;
+
+		const dtMeshTile* tiles[UNDO_MAX_TILE_LAYERS];
+		const int tileCount = const_cast<const dtNavMesh*>(meshes[i])->getTilesAt(x, y, tiles, UNDO_MAX_TILE_LAYERS);
+
+		for (int j = 0; j < tileCount; ++j)
+		{
+			TileColumn::Layer layer;
+			layer.layer = tiles[j]->header->layer;
+			layer.data.assign(tiles[j]->data, tiles[j]->data + tiles[j]->dataSize);
+
+			// hashes and pruned polys are only kept for the main mesh
+			if (i == 0)
+			{
+				layer.buildHash = navMesh.GetTileBuildHash(x, y, layer.layer);
+				if (const NavMesh::PrunedTile* pruned = navMesh.GetPrunedTile(x, y, layer.layer, layer.buildHash))
+					layer.pruned = *pruned;
+			}
+
+			column->size += layer.data.size();
+			column->meshes[i].push_back(std::move(layer));
+		}
+	}
+
+	return column;
+}
+
+void TileUndoStack::RestoreTiles(NavMesh& navMesh, int x, int y, const TileColumn& column) const
+{
+	std::vector<dtNavMesh*> meshes = GetMeshes(navMesh);
+
+	for (size_t i = 0; i < meshes.size(); ++i)
+	{
+		dtNavMesh* mesh = meshes[i];
+		if (!mesh)
+			continue;
+
+		const dtMeshTile* tiles[UNDO_MAX_TILE_LAYERS];
+		const int tileCount = mesh->getTilesAt(x, y, tiles, UNDO_MAX_TILE_LAYERS);
+
+		for (int j = 0; j < tileCount; ++j)
+		{
+			if (i == 0)
+			{
+				navMesh.SetTileBuildHash(x, y, tiles[j]->header->layer, 0);
+				navMesh.SetPrunedTile(x, y, tiles[j]->header->layer, {});
+			}
+
+			mesh->removeTile(mesh->getTileRef(tiles[j]), 0, 0);
+		}
+
+		// agent meshes that were made after the tile was saved stay empty here
+		if (i >= column.meshes.size())
+			continue;
+
+		for (const TileColumn::Layer& layer : column.meshes[i])
+		{
+			const int dataSize = static_cast<int>(layer.data.size());
+			uint8_t* data = static_cast<uint8_t*>(dtAlloc(dataSize, DT_ALLOC_PERM));
+			if (!data)
+				continue;
+
+			memcpy(data, layer.data.data(), dataSize);
+
+			// the navmesh owns the data now
+			if (dtStatusFailed(mesh->addTile(data, dataSize, DT_TILE_FREE_DATA, 0, nullptr)))
+			{
+				dtFree(data);
+				continue;
+			}
+
+			if (i == 0)
+			{
+				navMesh.SetTileBuildHash(x, y, layer.layer, layer.buildHash);
+				if (!layer.pruned.polys.empty())
+					navMesh.SetPrunedTile(x, y, layer.layer, layer.pruned);
+			}
+		}
+	}
+}
+
+std::vector<dtNavMesh*> TileUndoStack::GetMeshes(NavMesh& navMesh)
+{
+	std::vector<dtNavMesh*> meshes;
+	meshes.push_back(navMesh.GetNavMesh().get());
+
+	for (const NavMesh::AgentNavMesh& agentMesh : navMesh.GetAgentNavMeshes())
+		meshes.push_back(agentMesh.navMesh.get());
+
+	return meshes;
+}
+
+std::vector<ConvexVolume> TileUndoStack::CopyVolumes(const NavMesh& navMesh)
+{
+	std::vector<ConvexVolume> volumes;
+	volumes.reserve(navMesh.GetConvexVolumeCount());
+
+	for (const auto& volume : navMesh.GetConvexVolumes())
+		volumes.push_back(*volume);
+
+	return volumes;
+}
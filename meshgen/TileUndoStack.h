@@ -0,0 +1,119 @@
+//
+// TileUndoStack.h
+//
+
+#pragma once
+
+#include "common/NavMesh.h"
+#include "common/NavMeshData.h"
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class dtNavMesh;
+
+// Undo and redo for edits to the tiles of the mesh. An edit saves each tile it
+// touches the first time the tile changes, so undoing or redoing it only costs
+// as much as the tiles it changed. Saved tiles are shared: the copy of what one
+// edit left a tile as is the same copy that the next edit of that tile starts
+// from, and a copy goes away with the last step that uses it.
+//
+// A tile is saved with every layer at its x, y, in the main mesh and in the
+// agent meshes, along with the build hashes and pruned polys of the layers. The
+// tile cache layers aren't saved, rebuilding the tile brings them back in line.
+class TileUndoStack
+{
+public:
+	TileUndoStack() = default;
+	TileUndoStack(const TileUndoStack&) = delete;
+	TileUndoStack& operator=(const TileUndoStack&) = delete;
+
+	// start recording an edit, ending the one before it. Steps that could be
+	// redone are dropped. If volumes is set, the convex volumes are saved too.
+	void BeginStep(NavMesh& navMesh, const std::string& label, bool volumes);
+
+	// save the tile at x, y if this is the first change to it in the step. Called
+	// before the tile changes, and outside of a step it isn't recorded.
+	void TouchTile(NavMesh& navMesh, int x, int y);
+
+	// save what the step left its tiles as. Done before undoing, and before the
+	// next step begins.
+	void EndStep(NavMesh& navMesh);
+
+	// put the tiles of the last step back the way they were, or redo the last
+	// step that was undone. The x, y of each tile that was put back is added to
+	// tiles. Returns false if there was nothing to do.
+	bool Undo(NavMesh& navMesh, std::vector<std::pair<int, int>>& tiles);
+	bool Redo(NavMesh& navMesh, std::vector<std::pair<int, int>>& tiles);
+
+	void Clear();
+
+	bool CanUndo() const;
+	bool CanRedo() const;
+	std::string GetUndoLabel() const;
+	std::string GetRedoLabel() const;
+
+	// the steps kept, the oldest ones are dropped first
+	void SetMaxSteps(size_t maxSteps);
+
+	// bytes of tile data held by the steps, counting shared tiles once
+	size_t GetMemoryUsed() const;
+
+private:
+	struct TileColumn
+	{
+		struct Layer
+		{
+			int layer = 0;
+			uint64_t buildHash = 0;
+			NavMesh::PrunedTile pruned;
+			std::vector<uint8_t> data;
+		};
+
+		// the layers in the main mesh, then in each agent mesh
+		std::vector<std::vector<Layer>> meshes;
+		size_t size = 0;
+	};
+	using ColumnPtr = std::shared_ptr<const TileColumn>;
+
+	struct Step
+	{
+		std::string label;
+
+		// the tiles before and after the edit, by tile key
+		std::unordered_map<uint64_t, ColumnPtr> before;
+		std::unordered_map<uint64_t, ColumnPtr> after;
+
+		bool hasVolumes = false;
+		std::vector<ConvexVolume> volumesBefore;
+		std::vector<ConvexVolume> volumesAfter;
+	};
+
+	// the steps are for one mesh, if it was replaced they're dropped
+	void CheckMesh(NavMesh& navMesh);
+	void FinishStep(NavMesh& navMesh);
+	bool ApplyStep(NavMesh& navMesh, Step& step, bool undo, std::vector<std::pair<int, int>>& tiles);
+
+	ColumnPtr SaveTiles(NavMesh& navMesh, int x, int y) const;
+	void RestoreTiles(NavMesh& navMesh, int x, int y, const TileColumn& column) const;
+
+	static std::vector<dtNavMesh*> GetMeshes(NavMesh& navMesh);
+	static std::vector<ConvexVolume> CopyVolumes(const NavMesh& navMesh);
+
+	mutable std::mutex m_mutex;
+	std::deque<Step> m_steps;
+	size_t m_applied = 0;          // steps before this are done, the rest can be redone
+	bool m_recording = false;      // the last step that is done is still being recorded
+	size_t m_maxSteps = 50;
+
+	// the last saved copy of each tile, for as long as a step holds on to it.
+	// Only valid while every change to the tile goes through TouchTile.
+	std::unordered_map<uint64_t, std::weak_ptr<const TileColumn>> m_current;
+	const dtNavMesh* m_mesh = nullptr;
+};
@@ -0,0 +1,199 @@
+//
+// TriangleRasterizer.cpp
+//
+
+#include "TriangleRasterizer.h"
+#include "ChunkyTriMesh.h"
+
+#include <Recast.h>
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86_FP) || defined(__SSE2__)
+#define TRIANGLE_RASTERIZER_SSE 1
+#include <emmintrin.h>
+#endif
+
+//============================================================================
+
+#if defined(TRIANGLE_RASTERIZER_SSE)
+
+// load one coordinate of the same vertex of four triangles
+static inline __m128 LoadCoord(const float* verts, const int* tris, int corner, int axis)
+{
+	return _mm_setr_ps(
+		verts[tris[0 + corner] * 3 + axis],
+		verts[tris[3 + corner] * 3 + axis],
+		verts[tris[6 + corner] * 3 + axis],
+		verts[tris[9 + corner] * 3 + axis]);
+}
+
+static inline __m128 Min3(__m128 a, __m128 b, __m128 c)
+{
+	return _mm_min_ps(a, _mm_min_ps(b, c));
+}
+
+static inline __m128 Max3(__m128 a, __m128 b, __m128 c)
+{
+	return _mm_max_ps(a, _mm_max_ps(b, c));
+}
+
+#endif
+
+static bool TriangleOverlapsBounds(const float* verts, const int* tri,
+	const float* bmin, const float* bmax)
+{
+	const float* v0 = &verts[tri[0] * 3];
+	const float* v1 = &verts[tri[1] * 3];
+	const float* v2 = &verts[tri[2] * 3];
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (std::min({ v0[axis], v1[axis], v2[axis] }) > bmax[axis])
+			return false;
+		if (std::max({ v0[axis], v1[axis], v2[axis] }) < bmin[axis])
+			return false;
+	}
+
+	return true;
+}
+
+static bool TriangleIsWalkable(const float* verts, const int* tri, float walkableThr)
+{
+	const float* v0 = &verts[tri[0] * 3];
+	const float* v1 = &verts[tri[1] * 3];
+	const float* v2 = &verts[tri[2] * 3];
+
+	float e0[3], e1[3], norm[3];
+	rcVsub(e0, v1, v0);
+	rcVsub(e1, v2, v0);
+	rcVcross(norm, e0, e1);
+	rcVnormalize(norm);
+
+	return norm[1] > walkableThr;
+}
+
+//----------------------------------------------------------------------------
+
+void TriangleRasterizer::Gather(const rcChunkyTriMesh* chunkyMesh, const std::vector<int>& chunks,
+	const float* verts, const float* bmin, const float* bmax, int firstVert)
+{
+	m_tris.clear();
+
+	size_t totalTris = 0;
+	for (int chunk : chunks)
+		totalTris += chunkyMesh->nodes[chunk].n;
+	m_tris.reserve(totalTris * 3);
+
+	for (int chunk : chunks)
+	{
+		const rcChunkyTriMeshNode& node = chunkyMesh->nodes[chunk];
+		AddOverlapping(&chunkyMesh->tris[node.i * 3], node.n, verts, bmin, bmax, firstVert);
+	}
+
+	m_areas.assign(m_tris.size() / 3, RC_NULL_AREA);
+}
+
+void TriangleRasterizer::Gather(const int* tris, int ntris, const float* verts,
+	const float* bmin, const float* bmax)
+{
+	m_tris.clear();
+	m_tris.reserve(ntris * 3);
+
+	AddOverlapping(tris, ntris, verts, bmin, bmax, 0);
+
+	m_areas.assign(m_tris.size() / 3, RC_NULL_AREA);
+}
+
+void TriangleRasterizer::AddOverlapping(const int* ctris, int nctris, const float* verts,
+	const float* bmin, const float* bmax, int firstVert)
+{
+	int i = 0;
+
+#if defined(TRIANGLE_RASTERIZER_SSE)
+	const __m128 minX = _mm_set1_ps(bmin[0]), maxX = _mm_set1_ps(bmax[0]);
+	const __m128 minY = _mm_set1_ps(bmin[1]), maxY = _mm_set1_ps(bmax[1]);
+	const __m128 minZ = _mm_set1_ps(bmin[2]), maxZ = _mm_set1_ps(bmax[2]);
+
+	for (; i + 4 <= nctris; i += 4)
+	{
+		const int* tris = &ctris[i * 3];
+		__m128 outside = _mm_setzero_ps();
+
+		__m128 x0 = LoadCoord(verts, tris, 0, 0), x1 = LoadCoord(verts, tris, 1, 0), x2 = LoadCoord(verts, tris, 2, 0);
+		outside = _mm_or_ps(outside, _mm_cmpgt_ps(Min3(x0, x1, x2), maxX));
+		outside = _mm_or_ps(outside, _mm_cmplt_ps(Max3(x0, x1, x2), minX));
+
+		__m128 y0 = LoadCoord(verts, tris, 0, 1), y1 = LoadCoord(verts, tris, 1, 1), y2 = LoadCoord(verts, tris, 2, 1);
+		outside = _mm_or_ps(outside, _mm_cmpgt_ps(Min3(y0, y1, y2), maxY));
+		outside = _mm_or_ps(outside, _mm_cmplt_ps(Max3(y0, y1, y2), minY));
+
+		__m128 z0 = LoadCoord(verts, tris, 0, 2), z1 = LoadCoord(verts, tris, 1, 2), z2 = LoadCoord(verts, tris, 2, 2);
+		outside = _mm_or_ps(outside, _mm_cmpgt_ps(Min3(z0, z1, z2), maxZ));
+		outside = _mm_or_ps(outside, _mm_cmplt_ps(Max3(z0, z1, z2), minZ));
+
+		int mask = _mm_movemask_ps(outside);
+		if (mask == 0xf)
+			continue;
+
+		for (int j = 0; j < 4; ++j)
+		{
+			if (!(mask & (1 << j)) && tris[j * 3] >= firstVert)
+				m_tris.insert(m_tris.end(), &tris[j * 3], &tris[j * 3 + 3]);
+		}
+	}
+#endif
+
+	for (; i < nctris; ++i)
+	{
+		const int* tri = &ctris[i * 3];
+		if (tri[0] >= firstVert && TriangleOverlapsBounds(verts, tri, bmin, bmax))
+			m_tris.insert(m_tris.end(), tri, tri + 3);
+	}
+}
+
+void TriangleRasterizer::MarkWalkable(const float* verts, float walkableSlopeAngle)
+{
+	const float walkableThr = cosf(walkableSlopeAngle / 180.0f * RC_PI);
+	const int ntris = GetTriCount();
+	int i = 0;
+
+#if defined(TRIANGLE_RASTERIZER_SSE)
+	const __m128 thr = _mm_set1_ps(walkableThr);
+
+	for (; i + 4 <= ntris; i += 4)
+	{
+		const int* tris = &m_tris[i * 3];
+
+		__m128 x0 = LoadCoord(verts, tris, 0, 0), y0 = LoadCoord(verts, tris, 0, 1), z0 = LoadCoord(verts, tris, 0, 2);
+		__m128 e0x = _mm_sub_ps(LoadCoord(verts, tris, 1, 0), x0);
+		__m128 e0y = _mm_sub_ps(LoadCoord(verts, tris, 1, 1), y0);
+		__m128 e0z = _mm_sub_ps(LoadCoord(verts, tris, 1, 2), z0);
+		__m128 e1x = _mm_sub_ps(LoadCoord(verts, tris, 2, 0), x0);
+		__m128 e1y = _mm_sub_ps(LoadCoord(verts, tris, 2, 1), y0);
+		__m128 e1z = _mm_sub_ps(LoadCoord(verts, tris, 2, 2), z0);
+
+		// cross(e0, e1), then compare the normalized y component against the threshold.
+		// Degenerate triangles divide by zero and fail the comparison, same as recast.
+		__m128 nx = _mm_sub_ps(_mm_mul_ps(e0y, e1z), _mm_mul_ps(e0z, e1y));
+		__m128 ny = _mm_sub_ps(_mm_mul_ps(e0z, e1x), _mm_mul_ps(e0x, e1z));
+		__m128 nz = _mm_sub_ps(_mm_mul_ps(e0x, e1y), _mm_mul_ps(e0y, e1x));
+
+		__m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz)));
+		int mask = _mm_movemask_ps(_mm_cmpgt_ps(_mm_div_ps(ny, len), thr));
+
+		for (int j = 0; j < 4; ++j)
+		{
+			if (mask & (1 << j))
+				m_areas[i + j] = RC_WALKABLE_AREA;
+		}
+	}
+#endif
+
+	for (; i < ntris; ++i)
+	{
+		if (TriangleIsWalkable(verts, &m_tris[i * 3], walkableThr))
+			m_areas[i] = RC_WALKABLE_AREA;
+	}
+}
@@ -0,0 +1,41 @@
+//
+// TriangleRasterizer.h
+//
+
+#pragma once
+
+#include <vector>
+
+struct rcChunkyTriMesh;
+
+// Collects the triangles of a tile from the chunky mesh and prepares them for rasterization.
+// The per-triangle work (slope classification and culling against the tile bounds) is done
+// four triangles at a time with SSE, so that the whole tile can be handed to recast in one
+// rcRasterizeTriangles call instead of once per chunk.
+class TriangleRasterizer
+{
+public:
+	// gather the triangles of the given chunks that overlap the box [bmin, bmax]. Triangles
+	// that lie entirely outside of it would be rejected by the rasterizer anyway. Triangles
+	// that start at a vertex below firstVert are left out.
+	void Gather(const rcChunkyTriMesh* chunkyMesh, const std::vector<int>& chunks,
+		const float* verts, const float* bmin, const float* bmax, int firstVert = 0);
+
+	// same as above, for a plain list of triangles
+	void Gather(const int* tris, int ntris, const float* verts, const float* bmin, const float* bmax);
+
+	// mark the gathered triangles walkable if their slope is below the given angle. This
+	// gives the same result as rcMarkWalkableTriangles.
+	void MarkWalkable(const float* verts, float walkableSlopeAngle);
+
+	const int* GetTris() const { return m_tris.data(); }
+	const unsigned char* GetAreas() const { return m_areas.data(); }
+	int GetTriCount() const { return static_cast<int>(m_areas.size()); }
+
+private:
+	void AddOverlapping(const int* tris, int ntris, const float* verts, const float* bmin, const float* bmax,
+		int firstVert);
+
+	std::vector<int> m_tris;
+	std::vector<unsigned char> m_areas;
+};
@@ -0,0 +1,113 @@
+//
+// VertexWeldMap.cpp
+//
+
+#include "VertexWeldMap.h"
+
+#include <cmath>
+#include <cstring>
+
+static const size_t MIN_CAPACITY = 64;
+
+static inline size_t HashKey(const uint32_t key[3])
+{
+	uint64_t h = key[0] * 0x9e3779b97f4a7c15ull;
+	h ^= key[1] * 0xc2b2ae3d27d4eb4full;
+	h ^= key[2] * 0x165667b19e3779f9ull;
+	h ^= h >> 29;
+	h *= 0xbf58476d1ce4e5b9ull;
+	h ^= h >> 32;
+
+	return static_cast<size_t>(h);
+}
+
+//----------------------------------------------------------------------------
+
+VertexWeldMap::VertexWeldMap(float weldDistance)
+	: m_invCellSize(weldDistance > 0.0f ? 1.0f / weldDistance : 0.0f)
+{
+}
+
+void VertexWeldMap::clear()
+{
+	m_slots.clear();
+	m_count = 0;
+	m_mask = 0;
+}
+
+void VertexWeldMap::reserve(size_t count)
+{
+	// keep the table at most half full
+	size_t capacity = MIN_CAPACITY;
+	while (capacity < count * 2)
+		capacity *= 2;
+
+	if (capacity > m_slots.size())
+		grow(capacity);
+}
+
+void VertexWeldMap::makeKey(const glm::vec3& pos, uint32_t key[3]) const
+{
+	for (int i = 0; i < 3; ++i)
+	{
+		if (m_invCellSize > 0.0f)
+		{
+			key[i] = static_cast<uint32_t>(static_cast<int32_t>(std::floor(pos[i] * m_invCellSize)));
+		}
+		else
+		{
+			// adding zero turns -0 into +0, so both end up with the same bits
+			float value = pos[i] + 0.0f;
+			memcpy(&key[i], &value, sizeof(float));
+		}
+	}
+}
+
+void VertexWeldMap::grow(size_t capacity)
+{
+	std::vector<Slot> oldSlots;
+	oldSlots.swap(m_slots);
+
+	m_slots.resize(capacity);
+	for (Slot& slot : m_slots)
+		slot.index = EMPTY;
+	m_mask = capacity - 1;
+
+	for (const Slot& slot : oldSlots)
+	{
+		if (slot.index == EMPTY)
+			continue;
+
+		size_t pos = HashKey(slot.key) & m_mask;
+		while (m_slots[pos].index != EMPTY)
+			pos = (pos + 1) & m_mask;
+
+		m_slots[pos] = slot;
+	}
+}
+
+uint32_t VertexWeldMap::insert(const glm::vec3& pos, uint32_t index)
+{
+	if ((m_count + 1) * 2 > m_slots.size())
+		grow(m_slots.empty() ? MIN_CAPACITY : m_slots.size() * 2);
+
+	uint32_t key[3];
+	makeKey(pos, key);
+
+	size_t slot = HashKey(key) & m_mask;
+	while (m_slots[slot].index != EMPTY)
+	{
+		const Slot& existing = m_slots[slot];
+		if (existing.key[0] == key[0] && existing.key[1] == key[1] && existing.key[2] == key[2])
+			return existing.index;
+
+		slot = (slot + 1) & m_mask;
+	}
+
+	Slot& newSlot = m_slots[slot];
+	memcpy(newSlot.key, key, sizeof(key));
+	newSlot.index = index;
+	++m_count;
+
+	return index;
+}
@@ -0,0 +1,50 @@
+//
+// VertexWeldMap.h
+//
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Maps vertex positions to vertex indices, for merging the duplicate vertices
+// shared by neighbouring triangles. Positions are snapped to a grid with the
+// given weld distance as its cell size, so vertices that fall into the same
+// cell are merged together. A weld distance of 0 only merges vertices that are
+// exactly equal.
+//
+// This is an open addressing table with linear probing, so inserts don't
+// allocate once it has been reserved.
+class VertexWeldMap
+{
+public:
+	explicit VertexWeldMap(float weldDistance = 0.0f);
+
+	void clear();
+	void reserve(size_t count);
+
+	size_t size() const { return m_count; }
+
+	// look up the vertex at this position. If there isn't one yet, it is added
+	// with the given index. Returns the index of the vertex either way.
+	uint32_t insert(const glm::vec3& pos, uint32_t index);
+
+private:
+	struct Slot
+	{
+		uint32_t key[3];
+		uint32_t index;
+	};
+
+	static const uint32_t EMPTY = 0xffffffff;
+
+	void makeKey(const glm::vec3& pos, uint32_t key[3]) const;
+	void grow(size_t capacity);
+
+	std::vector<Slot> m_slots;
+	size_t m_count = 0;
+	size_t m_mask = 0;
+	float m_invCellSize = 0.0f;
+};
@@ -0,0 +1,163 @@
+//
+// ZoneGraphBuilder.cpp
+//
+
+#include "ZoneGraphBuilder.h"
+
+#include "EQConfig.h"
+#include "TaskScheduler.h"
+#include "common/Context.h"
+#include "common/NavMesh.h"
+#include "common/ZoneGraph.h"
+
+#include <DetourCommon.h>
+#include <DetourNavMeshQuery.h>
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+// same limits the plugin uses for its queries, nodes come from the mesh's budget
+static const int MAX_POLYS = 4028 * 4;
+
+// zone lines are usually placed a little off the mesh, inside the zone line
+static const float ZONE_LINE_EXTENTS[3] = { 10, 20, 10 };
+
+// walking distance between two points of the mesh, or -1 if there is no path
+static float MeasurePath(dtNavMeshQuery* query, const dtQueryFilter& filter,
+	const glm::vec3& start, const glm::vec3& end, dtPolyRef* polys, float* straightPath)
+{
+	const float startPos[3] = { start.x, start.z, start.y };
+	const float endPos[3] = { end.x, end.z, end.y };
+
+	dtPolyRef startRef = 0, endRef = 0;
+	float spos[3], epos[3];
+	query->findNearestPoly(startPos, ZONE_LINE_EXTENTS, &filter, &startRef, spos);
+	query->findNearestPoly(endPos, ZONE_LINE_EXTENTS, &filter, &endRef, epos);
+	if (!startRef || !endRef)
+		return -1.0f;
+
+	int numPolys = 0;
+	dtStatus status = query->findPath(startRef, endRef, spos, epos, &filter, polys, &numPolys, MAX_POLYS);
+	if (dtStatusFailed(status) || numPolys == 0 || polys[numPolys - 1] != endRef)
+		return -1.0f;
+
+	int numPoints = 0;
+	status = query->findStraightPath(spos, epos, polys, numPolys, straightPath, nullptr, nullptr,
+		&numPoints, MAX_POLYS);
+	if (dtStatusFailed(status))
+		return -1.0f;
+
+	float distance = 0.0f;
+	for (int i = 1; i < numPoints; ++i)
+		distance += dtVdist(&straightPath[(i - 1) * 3], &straightPath[i * 3]);
+
+	return distance;
+}
+
+//============================================================================
+
+ZoneGraphBuilder::ZoneGraphBuilder(EQConfig& eqConfig, Context* context)
+	: m_eqConfig(eqConfig)
+	, m_context(context)
+{
+}
+
+bool ZoneGraphBuilder::Run()
+{
+	std::string meshPath = m_eqConfig.GetOutputPath() + "\\MQ2Nav";
+	std::string zoneLinesFile = meshPath + "\\" + ZONE_LINES_FILENAME;
+
+	std::vector<ZoneGraph::ZoneLine> zoneLines;
+	if (!ZoneGraph::LoadZoneLines(zoneLinesFile, zoneLines))
+	{
+		m_context->Log(LogLevel::ERROR, "Failed to read zone lines from %s", zoneLinesFile.c_str());
+		return false;
+	}
+
+	auto startTime = std::chrono::steady_clock::now();
+
+	ZoneGraph graph;
+	graph.SetZoneLines(std::move(zoneLines));
+
+	const std::vector<ZoneGraph::ZoneLine>& lines = graph.GetZoneLines();
+	const std::vector<ZoneGraph::Zone>& zones = graph.GetZones();
+
+	std::vector<std::vector<float>> distances(zones.size());
+
+	TaskScheduler scheduler(m_threadCount);
+
+	std::vector<TaskScheduler::Task> tasks;
+	tasks.reserve(zones.size());
+
+	for (size_t z = 0; z < zones.size(); ++z)
+	{
+		const ZoneGraph::Zone& zone = zones[z];
+
+		// nothing to measure if the zone is only ever passed into or out of
+		if (zone.entrances.empty() || zone.exits.empty())
+			continue;
+
+		tasks.push_back([this, &meshPath, &lines, &zone, &result = distances[z]]()
+		{
+			NavMesh navMesh(m_context, meshPath, zone.name);
+			if (navMesh.LoadNavMeshFile() != NavMesh::LoadResult::Success)
+			{
+				m_context->Log(LogLevel::WARNING, "%s: no navmesh, zone lines through it are skipped",
+					zone.name.c_str());
+				return;
+			}
+
+			std::shared_ptr<dtNavMeshQuery> query = navMesh.AcquireNavMeshQuery(navMesh.GetQueryNodeBudget());
+			if (!query)
+				return;
+
+			dtQueryFilter filter;
+			navMesh.FillFilterAreaCosts(filter);
+
+			std::unique_ptr<dtPolyRef[]> polys(new dtPolyRef[MAX_POLYS]);
+			std::unique_ptr<float[]> straightPath(new float[MAX_POLYS * 3]);
+
+			result.reserve(zone.entrances.size() * zone.exits.size());
+			int connected = 0;
+
+			for (uint32_t entrance : zone.entrances)
+			{
+				for (uint32_t exit : zone.exits)
+				{
+					float distance = MeasurePath(query.get(), filter, lines[entrance].targetPos,
+						lines[exit].pos, polys.get(), straightPath.get());
+					if (distance >= 0.0f)
+						++connected;
+
+					result.push_back(distance);
+				}
+			}
+
+			m_context->Log(LogLevel::INFO, "%s: %d of %d zone line pairs connected", zone.name.c_str(),
+				connected, (int)result.size());
+		});
+	}
+
+	scheduler.Run(std::move(tasks));
+	scheduler.Wait();
+
+	for (size_t z = 0; z < zones.size(); ++z)
+	{
+		if (!distances[z].empty())
+			graph.SetDistances(static_cast<uint32_t>(z), std::move(distances[z]));
+	}
+
+	std::string graphFile = meshPath + "\\" + ZONE_GRAPH_FILENAME;
+	if (!graph.Save(graphFile))
+	{
+		m_context->Log(LogLevel::ERROR, "Failed to write zone graph to %s", graphFile.c_str());
+		return false;
+	}
+
+	m_context->Log(LogLevel::INFO, "Zone graph of %d zones and %d zone lines built in %.2fms",
+		(int)zones.size(), (int)lines.size(),
+		std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count());
+
+	return true;
+}
@@ -0,0 +1,38 @@
+//
+// ZoneGraphBuilder.h
+//
+
+// Builds the zone graph from the zone lines in ZoneLines.json and the zone
+// meshes that have already been built. Each zone is measured on its own, so the
+// zones are spread over a pool of threads.
+//
+// ZoneLines.json holds a ZoneLineList in json, in the MQ2Nav folder:
+//
+//   { "zoneLines": [ { "zone": "qeynos2", "position": { "x": ..., "y": ..., "z": ... },
+//     "targetZone": "qeytoqrg", "targetPosition": { ... } }, ... ] }
+
+#pragma once
+
+#include <string>
+
+class Context;
+class EQConfig;
+
+class ZoneGraphBuilder
+{
+public:
+	ZoneGraphBuilder(EQConfig& eqConfig, Context* context);
+
+	// number of zones measured at the same time. 0 = one per hardware thread.
+	void SetThreadCount(int threads) { m_threadCount = threads; }
+
+	// returns false if the zone lines couldn't be read or the graph couldn't be
+	// written. Zones without a mesh are left without distances.
+	bool Run();
+
+private:
+	EQConfig& m_eqConfig;
+	Context* m_context;
+
+	int m_threadCount = 0;
+};
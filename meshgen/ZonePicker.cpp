@@ -10,6 +10,9 @@
 
 #include <SDL_opengl.h>
 
+#include <algorithm>
+#include <ctime>
+
 #pragma warning (push)
 #pragma warning (disable : 4312 4244)
 
@@ -56,11 +59,13 @@ std::pair<int, glm::ivec2> FindExpansionImage(int expansion, bool active)
 	return{ imageFile, pos };
 }
 
-ZonePicker::ZonePicker(const EQConfig& eqConfig)
-	: m_mapList(eqConfig.GetMapList())
+ZonePicker::ZonePicker(const EQConfig& eqConfig, const MeshDirectoryScan& meshScan)
+	: m_meshScan(meshScan)
+	, m_mapList(eqConfig.GetMapList())
 	, m_allMaps(eqConfig.GetAllMaps())
 	, m_eqDirectory(eqConfig.GetEverquestPath())
 {
+
 #if 0
 	for (const auto& expansionFile : ExpansionLogoFiles)
 	{
@@ -91,6 +96,124 @@ ZonePicker::~ZonePicker()
 	}
 }
 
+const MeshFileStats* ZonePicker::GetMeshStats(const std::string& shortName) const
+{
+	if (!m_meshStats)
+		return nullptr;
+
+	auto iter = m_meshStats->find(boost::algorithm::to_lower_copy(shortName));
+	return iter != m_meshStats->end() ? &iter->second : nullptr;
+}
+
+void ZonePicker::ShowMeshStats(const std::string& shortName)
+{
+	const MeshFileStats* stats = GetMeshStats(shortName);
+	if (!stats)
+		return;
+
+	ImGui::TextColored(ImColor(128, 128, 128), "%u tiles, %.1f MB", stats->tileCount,
+		stats->fileSize / (1024.0f * 1024.0f));
+	bool hovered = ImGui::IsItemHovered();
+
+	if (stats->stale)
+	{
+		ImGui::SameLine();
+		ImGui::TextColored(ImColor(255, 128, 0), "stale");
+		hovered |= ImGui::IsItemHovered();
+	}
+
+	if (stats->oldSettings)
+	{
+		ImGui::SameLine();
+		ImGui::TextColored(ImColor(255, 255, 0), "old");
+		hovered |= ImGui::IsItemHovered();
+	}
+
+	if (hovered)
+	{
+		char buildTime[64] = "unknown";
+		time_t time = static_cast<time_t>(stats->buildTime);
+		if (const tm* time_info = localtime(&time))
+			strftime(buildTime, sizeof(buildTime), "%m/%d/%y %H:%M", time_info);
+
+		ImGui::BeginTooltip();
+		ImGui::Text("Built: %s", buildTime);
+		if (stats->polyCount)
+			ImGui::Text("Polys: %u", stats->polyCount);
+		ImGui::Text("File version: %d", stats->fileVersion);
+		ImGui::Text("Tile size: %.0f", stats->tileSize);
+		ImGui::Text("Cell size: %.2f", stats->cellSize);
+		ImGui::Text("Convex volumes: %d", stats->volumeCount);
+		ImGui::Text("Area types: %d", stats->areaCount);
+		if (stats->sourceHash)
+			ImGui::Text("Zone files: %016llx", (unsigned long long)stats->sourceHash);
+		if (stats->stale)
+			ImGui::TextColored(ImColor(255, 128, 0), "The zone files changed since this was built");
+		if (stats->oldSettings)
+			ImGui::TextColored(ImColor(255, 255, 0), "Saved by an older version, rebuild to update it");
+		ImGui::EndTooltip();
+	}
+}
+
+bool ZonePicker::ShowZoneRow(const std::string& longName, const std::string& shortName)
+{
+	bool selected = false;
+	if (ImGui::Selectable(longName.c_str(), &selected, ImGuiSelectableFlags_SpanAllColumns/* | ImGuiSelectableFlags_MenuItem*/))
+		selected = true;
+	ImGui::NextColumn();
+	ImGui::SetColumnOffset(-1, 300);
+	ImGui::Text(shortName.c_str());
+	ImGui::NextColumn();
+	ImGui::SetColumnOffset(-1, 420);
+	ShowMeshStats(shortName);
+	ImGui::NextColumn();
+
+	return selected;
+}
+
+void ZonePicker::GetFilteredZones(const std::string& text,
+	std::vector<std::pair<std::string, std::string>>& zones) const
+{
+	for (const auto& mapIter : m_allMaps)
+	{
+		const std::string& shortName = mapIter.first;
+		const std::string& longName = mapIter.second;
+
+		if (!text.empty() && !boost::ifind_first(shortName, text) && !boost::ifind_first(longName, text))
+			continue;
+
+		const MeshFileStats* stats = GetMeshStats(shortName);
+		if ((m_onlyMeshes || m_onlyStale || m_onlyOldSettings) && !stats)
+			continue;
+		if ((m_onlyStale && !stats->stale) || (m_onlyOldSettings && !stats->oldSettings))
+			continue;
+
+		zones.emplace_back(shortName, longName);
+	}
+
+	if (m_sortBy == (int)SortBy::Name)
+		return;
+
+	// largest and newest first, zones without a mesh last
+	auto sortKey = [this](const std::string& shortName) -> int64_t
+	{
+		const MeshFileStats* stats = GetMeshStats(shortName);
+		if (!stats)
+			return -1;
+
+		switch ((SortBy)m_sortBy)
+		{
+		case SortBy::FileSize: return static_cast<int64_t>(stats->fileSize);
+		case SortBy::PolyCount: return stats->polyCount;
+		case SortBy::BuildTime: return stats->buildTime;
+		default: return 0;
+		}
+	};
+
+	std::stable_sort(zones.begin(), zones.end(),
+		[&](const auto& a, const auto& b) { return sortKey(a.first) > sortKey(b.first); });
+}
+
 #if 0
 static bool ExpansionButton(const IMAGEDATA& tgaData, const glm::ivec2& pos)
 {
@@ -114,7 +237,7 @@ bool ZonePicker::Show(bool focus, std::string* selected_zone /* = nullptr */)
 {
 	bool result = false;
 
-	ImGui::SetNextWindowSize(ImVec2(500, 575), ImGuiSetCond_Once);
+	ImGui::SetNextWindowSize(ImVec2(620, 600), ImGuiSetCond_Once);
 	ImGui::SetNextWindowPosCenter(ImGuiSetCond_Once);
 	bool show = true;
 
@@ -132,6 +255,29 @@ bool ZonePicker::Show(bool focus, std::string* selected_zone /* = nullptr */)
 
 		std::string text(m_filterText);
 
+		// the scan keeps going in the background, pick up what it has finished
+		m_meshStats = m_meshScan.GetResults();
+
+		ImGui::PushItemWidth(110);
+		ImGui::Combo("Sort", &m_sortBy, "Name\0File Size\0Polys\0Build Date\0");
+		ImGui::PopItemWidth();
+		ImGui::SameLine();
+		ImGui::Checkbox("Has Mesh", &m_onlyMeshes);
+		ImGui::SameLine();
+		ImGui::Checkbox("Stale", &m_onlyStale);
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Meshes built before the zone files last changed");
+		ImGui::SameLine();
+		ImGui::Checkbox("Old Settings", &m_onlyOldSettings);
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Meshes saved by an older version of the mesh generator");
+
+		if (m_meshScan.IsScanning())
+		{
+			ImGui::SameLine();
+			ImGui::TextColored(ImColor(128, 128, 128), "Scanning meshes...");
+		}
+
 #if 0
 		ImGui::PushItemWidth(130);
 		static int selectedIndex = 0;
@@ -161,9 +307,9 @@ bool ZonePicker::Show(bool focus, std::string* selected_zone /* = nullptr */)
 #endif
 
 		ImGui::BeginChild("##ZoneList", ImVec2(ImGui::GetWindowContentRegionWidth(),
-			ImGui::GetWindowHeight() - 115), false);
+			ImGui::GetWindowHeight() - 140), false);
 
-		if (text.empty())
+		if (text.empty() && !HasMeshFilters())
 		{
 			ImGui::PushID("ZonesByExpansion");
 
@@ -175,22 +321,14 @@ bool ZonePicker::Show(bool focus, std::string* selected_zone /* = nullptr */)
 
 				if (ImGui::TreeNode(expansionName.c_str()))
 				{
-					ImGui::Columns(2);
+					ImGui::Columns(3);
 
 					for (const auto& zonePair : mapIter.second)
 					{
 						const std::string& longName = zonePair.first;
 						const std::string& shortName = zonePair.second;
 
-						bool selected = false;
-						if (ImGui::Selectable(longName.c_str(), &selected, ImGuiSelectableFlags_SpanAllColumns/* | ImGuiSelectableFlags_MenuItem*/))
-							selected = true;
-						ImGui::NextColumn();
-						ImGui::SetColumnOffset(-1, 300);
-						ImGui::Text(shortName.c_str());
-						ImGui::NextColumn();
-
-						if (selected) {
+						if (ShowZoneRow(longName, shortName)) {
 							*selected_zone = zonePair.second;
 							result = true;
 							break;
@@ -206,43 +344,30 @@ bool ZonePicker::Show(bool focus, std::string* selected_zone /* = nullptr */)
 		}
 		else
 		{
-			bool count = 0;
-			std::string lastZone;
+			std::vector<std::pair<std::string, std::string>> zones;
+			GetFilteredZones(text, zones);
 
 			ImGui::PushID("ZonesByFilter");
 
-			ImGui::Columns(2);
+			ImGui::Columns(3);
 
-			for (const auto& mapIter : m_allMaps)
+			for (const auto& zone : zones)
 			{
-				const std::string& shortName = mapIter.first;
-				const std::string& longName = mapIter.second;
+				const std::string& shortName = zone.first;
+				const std::string& longName = zone.second;
 
-				if (boost::ifind_first(shortName, text) || boost::ifind_first(longName, text))
-				{
-					std::string displayName = longName + " (" + shortName + ")";
-					lastZone = shortName;
-					bool selected = false;
-					if (ImGui::Selectable(longName.c_str(), &selected, ImGuiSelectableFlags_SpanAllColumns/* | ImGuiSelectableFlags_MenuItem*/))
-						selected = true;
-					ImGui::NextColumn();
-					ImGui::SetColumnOffset(-1, 300);
-					ImGui::Text(shortName.c_str());
-					ImGui::NextColumn();
-					if (selected) {
-						*selected_zone = shortName;
-						result = true;
-						break;
-					}
+				if (ShowZoneRow(longName, shortName)) {
+					*selected_zone = shortName;
+					result = true;
+					break;
 				}
-				count++;
 			}
 
 			ImGui::Columns(1);
 
 
-			if (count == 1 && selectSingle) {
-				*selected_zone = lastZone;
+			if (zones.size() == 1 && selectSingle) {
+				*selected_zone = zones[0].first;
 				result = true;
 			}
 
@@ -261,6 +386,17 @@ bool ZonePicker::Show(bool focus, std::string* selected_zone /* = nullptr */)
 		ImGui::SameLine();
 		ImGui::Checkbox("Load Navmesh if available", &m_loadNavMesh);
 
+		if (m_loadNavMesh)
+		{
+			ImGui::SameLine();
+			ImGui::Checkbox("Mesh Only", &m_meshOnly);
+			if (ImGui::IsItemHovered())
+			{
+				ImGui::SetTooltip("Open the navmesh without the zone geometry, to test it or edit\n"
+					"areas and volumes. The geometry is loaded once tiles need building.");
+			}
+		}
+
 	}
 	ImGui::End();
 
@@ -5,10 +5,12 @@
 #pragma once
 
 #include "EQConfig.h"
+#include "MeshDirectoryScan.h"
 
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 struct IMAGEDATA
 {
@@ -20,14 +22,47 @@ struct IMAGEDATA
 class ZonePicker
 {
 public:
-	ZonePicker(const EQConfig& eqConfig);
+	ZonePicker(const EQConfig& eqConfig, const MeshDirectoryScan& meshScan);
 	~ZonePicker();
 
 	bool Show(bool focus, std::string* selected_zone = nullptr);
 
 	bool ShouldLoadNavMesh() const { return m_loadNavMesh; }
 
+	// open only the navmesh, the geometry is loaded when tiles need building
+	bool ShouldOpenMeshOnly() const { return m_loadNavMesh && m_meshOnly; }
+
 private:
+	const MeshFileStats* GetMeshStats(const std::string& shortName) const;
+	void ShowMeshStats(const std::string& shortName);
+
+	// returns true if the zone was selected
+	bool ShowZoneRow(const std::string& longName, const std::string& shortName);
+
+	// zones matching the filter and the mesh filters, in the order they're shown
+	void GetFilteredZones(const std::string& text, std::vector<std::pair<std::string, std::string>>& zones) const;
+
+	enum class SortBy
+	{
+		Name,
+		FileSize,
+		PolyCount,
+		BuildTime,
+	};
+
+	bool HasMeshFilters() const
+	{
+		return m_sortBy != (int)SortBy::Name || m_onlyMeshes || m_onlyStale || m_onlyOldSettings;
+	}
+
+	const MeshDirectoryScan& m_meshScan;
+	std::shared_ptr<const MeshDirectoryScan::Results> m_meshStats;
+
+	int m_sortBy = (int)SortBy::Name;
+	bool m_onlyMeshes = false;
+	bool m_onlyStale = false;
+	bool m_onlyOldSettings = false;
+
 	typedef std::map<std::string, std::string> ZoneCollection;
 	ZoneCollection m_allMaps;
 	EQConfig::MapList m_mapList;
@@ -36,6 +71,7 @@ private:
 	char m_filterText[64] = { 0 };
 
 	bool m_loadNavMesh = true;
+	bool m_meshOnly = false;
 
 	std::vector<IMAGEDATA> m_tgaData;
 };
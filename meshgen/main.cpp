@@ -3,6 +3,15 @@
 //
 
 #include "Application.h"
+#include "BatchBuilder.h"
+#include "CommonBenchmark.h"
+#include "DistributedBuilder.h"
+#include "PathBenchmark.h"
+#include "PathRegression.h"
+#include "RecastArena.h"
+#include "SettingsTuner.h"
+#include "ZoneGraphBuilder.h"
+#include "common/Profiler.h"
 
 #include <Recast.h>
 #include <RecastDebugDraw.h>
@@ -12,8 +21,11 @@
 #include <zone-utilities/log/log_stdout.h>
 #include <zone-utilities/log/log_file.h>
 
+#include <algorithm>
 #include <memory>
 #include <sstream>
+#include <string>
+#include <vector>
 
 // logger to log to the build context
 class LogContext : public EQEmu::Log::LogBase
@@ -130,14 +142,30 @@ VOID DebugSpewAlways(PCHAR szFormat, ...)
 	LocalFree(szOutput);
 }
 
+static std::vector<float> ParseFloatList(const char* arg)
+{
+	std::vector<float> values;
+	std::istringstream ss(arg);
+	std::string value;
+	while (std::getline(ss, value, ','))
+		values.push_back(static_cast<float>(atof(value.c_str())));
+	return values;
+}
+
 int main(int argc, char* argv[])
 {
+	// registered until the process exits
+	MQ2NAV_PROFILE_REGISTER();
+
 	// Construct the path to the ini file
 	CHAR logfilePath[MAX_PATH] = { 0 };
 	GetModuleFileNameA(NULL, logfilePath, MAX_PATH);
 	PathRemoveFileSpecA(logfilePath);
 	PathAppendA(logfilePath, "MeshGenerator.log");
 
+	// tile builds allocate recast data from per-thread arenas
+	RecastArena::Install();
+
 	eqLogInit(-1);
 	eqLogRegister(std::make_shared<EQEmu::Log::LogFile>(logfilePath));
 	eqLogRegister(std::make_shared<EQEmu::Log::LogStdOut>());
@@ -146,6 +174,210 @@ int main(int argc, char* argv[])
 	eqLogRegister(std::make_shared<DebugLog>());
 #endif
 
+	// headless build: MeshGenerator --batch [-j jobs] [-m megabytes] [-benchmark results.json]
+	//   [-region minY,minX,maxY,maxX] [-around y,x,radius] [-path radius,y1,x1,y2,x2,...] [zone ...]
+	//
+	// The region options can be repeated, and only build the tiles they cover into the
+	// existing mesh. Coordinates are in /loc order.
+	if (argc > 1 && strcmp(argv[1], "--batch") == 0)
+	{
+		EQConfig eqConfig;
+		ApplicationContext context;
+		BatchBuilder builder(eqConfig, &context);
+
+		std::vector<std::string> zones;
+		std::vector<NavMeshTool::BuildRegion> regions;
+		for (int i = 2; i < argc; ++i)
+		{
+			if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+				builder.SetJobCount(atoi(argv[++i]));
+			else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+				builder.SetMemoryBudget(static_cast<size_t>(atoi(argv[++i])));
+			else if (strcmp(argv[i], "-benchmark") == 0 && i + 1 < argc)
+				builder.SetBenchmarkFile(argv[++i]);
+			else if (strcmp(argv[i], "-region") == 0 && i + 1 < argc)
+			{
+				std::vector<float> values = ParseFloatList(argv[++i]);
+				if (values.size() == 4)
+				{
+					regions.push_back({ glm::vec3(std::min(values[1], values[3]), 0, std::min(values[0], values[2])),
+						glm::vec3(std::max(values[1], values[3]), 0, std::max(values[0], values[2])) });
+				}
+			}
+			else if (strcmp(argv[i], "-around") == 0 && i + 1 < argc)
+			{
+				std::vector<float> values = ParseFloatList(argv[++i]);
+				if (values.size() == 3)
+				{
+					auto around = NavMeshTool::GetRegionsAlongPath({ glm::vec3(values[1], 0, values[0]) }, values[2]);
+					regions.insert(regions.end(), around.begin(), around.end());
+				}
+			}
+			else if (strcmp(argv[i], "-path") == 0 && i + 1 < argc)
+			{
+				std::vector<float> values = ParseFloatList(argv[++i]);
+				std::vector<glm::vec3> points;
+				for (size_t v = 2; v < values.size(); v += 2)
+					points.emplace_back(values[v], 0, values[v - 1]);
+
+				if (!values.empty())
+				{
+					auto path = NavMeshTool::GetRegionsAlongPath(points, values[0]);
+					regions.insert(regions.end(), path.begin(), path.end());
+				}
+			}
+			else
+				zones.push_back(argv[i]);
+		}
+		builder.SetZones(zones);
+		builder.SetRegions(regions);
+
+		return builder.Run();
+	}
+
+	// distributed build, through a folder shared by every machine:
+	//   MeshGenerator --coordinator <share> [-parts n] [zone ...]
+	//   MeshGenerator --worker <share> [-j threads]
+	if (argc > 2 && (strcmp(argv[1], "--coordinator") == 0 || strcmp(argv[1], "--worker") == 0))
+	{
+		EQConfig eqConfig;
+		ApplicationContext context;
+		DistributedBuilder builder(eqConfig, &context, argv[2]);
+
+		std::vector<std::string> zones;
+		for (int i = 3; i < argc; ++i)
+		{
+			if (strcmp(argv[i], "-parts") == 0 && i + 1 < argc)
+				builder.SetPartCount(std::max(1, atoi(argv[++i])));
+			else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+				builder.SetThreadCount(atoi(argv[++i]));
+			else
+				zones.push_back(argv[i]);
+		}
+		builder.SetZones(zones);
+
+		if (strcmp(argv[1], "--coordinator") == 0)
+			return builder.RunCoordinator();
+
+		return builder.RunWorker();
+	}
+
+	// path benchmark: MeshGenerator --pathbench <zone> <corpus or .navtrace> [-r repeats] [-o results.csv]
+	if (argc > 3 && strcmp(argv[1], "--pathbench") == 0)
+	{
+		EQConfig eqConfig;
+		ApplicationContext context;
+		PathBenchmark benchmark(eqConfig, &context);
+
+		for (int i = 4; i < argc; ++i)
+		{
+			if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+				benchmark.SetRepeatCount(std::max(1, atoi(argv[++i])));
+			else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+				benchmark.SetOutputFile(argv[++i]);
+		}
+
+		if (!benchmark.LoadCorpus(argv[3]))
+			return 1;
+
+		return benchmark.Run(argv[2]) ? 0 : 1;
+	}
+
+	// micro benchmarks: MeshGenerator --microbench <zone> [-r repeats] [-o results.json]
+	if (argc > 2 && strcmp(argv[1], "--microbench") == 0)
+	{
+		EQConfig eqConfig;
+		ApplicationContext context;
+		CommonBenchmark benchmark(eqConfig, &context);
+
+		for (int i = 3; i < argc; ++i)
+		{
+			if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+				benchmark.SetRepeatCount(std::max(1, atoi(argv[++i])));
+			else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+				benchmark.SetOutputFile(argv[++i]);
+		}
+
+		return benchmark.Run(argv[2]) ? 0 : 1;
+	}
+
+	// path regression: MeshGenerator --pathdiff <zone> <reference folder or .navmesh> <corpus or .navtrace>
+	//   [-t percent] [-g region size] [-j threads] [-o changes.csv]
+	// exits with 1 if any path broke or got more than -t percent longer
+	if (argc > 4 && strcmp(argv[1], "--pathdiff") == 0)
+	{
+		EQConfig eqConfig;
+		ApplicationContext context;
+		PathRegression regression(eqConfig, &context);
+		regression.SetReferencePath(argv[3]);
+
+		for (int i = 5; i < argc; ++i)
+		{
+			if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+				regression.SetLengthTolerance(std::max(0.0f, static_cast<float>(atof(argv[++i]))));
+			else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc)
+				regression.SetRegionSize(std::max(1.0f, static_cast<float>(atof(argv[++i]))));
+			else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+				regression.SetThreadCount(atoi(argv[++i]));
+			else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+				regression.SetOutputFile(argv[++i]);
+		}
+
+		if (!regression.LoadCorpus(argv[4]))
+			return 1;
+
+		return regression.Run(argv[2]) ? 0 : 1;
+	}
+
+	// zone graph: MeshGenerator --zonegraph [-j threads]
+	// reads ZoneLines.json and measures the zone lines over the meshes that are built
+	if (argc > 1 && strcmp(argv[1], "--zonegraph") == 0)
+	{
+		EQConfig eqConfig;
+		ApplicationContext context;
+		ZoneGraphBuilder builder(eqConfig, &context);
+
+		for (int i = 2; i < argc; ++i)
+		{
+			if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+				builder.SetThreadCount(atoi(argv[++i]));
+		}
+
+		return builder.Run() ? 0 : 1;
+	}
+
+	// settings tuner: MeshGenerator --tune <zone> [-c corpus] [-n samples] [-j threads]
+	//   [-ts 64,128,256] [-cs 0.4,0.6,0.8,1.0,1.2] [-ch 0.2,0.3,0.4] [-o results.json]
+	if (argc > 2 && strcmp(argv[1], "--tune") == 0)
+	{
+		EQConfig eqConfig;
+		ApplicationContext context;
+		SettingsTuner tuner(eqConfig, &context);
+
+		for (int i = 3; i < argc; ++i)
+		{
+			if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			{
+				if (!tuner.LoadCorpus(argv[++i]))
+					return 1;
+			}
+			else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+				tuner.SetSampleCount(std::max(1, atoi(argv[++i])));
+			else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+				tuner.SetThreadCount(atoi(argv[++i]));
+			else if (strcmp(argv[i], "-ts") == 0 && i + 1 < argc)
+				tuner.SetTileSizes(ParseFloatList(argv[++i]));
+			else if (strcmp(argv[i], "-cs") == 0 && i + 1 < argc)
+				tuner.SetCellSizes(ParseFloatList(argv[++i]));
+			else if (strcmp(argv[i], "-ch") == 0 && i + 1 < argc)
+				tuner.SetCellHeights(ParseFloatList(argv[++i]));
+			else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+				tuner.SetOutputFile(argv[++i]);
+		}
+
+		return tuner.Run(argv[2]) ? 0 : 1;
+	}
+
 	std::string startingZone;
 	if (argc > 1)
 		startingZone = argv[1];
@@ -0,0 +1,179 @@
+//
+// CurrentPathView.cpp
+//
+
+#include "CurrentPathView.h"
+#include "MQ2Navigation.h"
+#include "NavigationPath.h"
+
+#include <algorithm>
+
+// bump when the layout of the mapping changes, readers look for the new name
+static const int CURRENT_PATH_VIEW_VERSION = 1;
+
+// points past this are left out of the mapping, same as the longest path searched
+static const int CURRENT_PATH_MAX_POINTS = 4028 * 4;
+
+struct CurrentPathView::Header
+{
+	// odd while the path is being written. Readers copy it out and read the
+	// sequence again, and try again if it changed.
+	volatile LONG sequence;
+
+	DWORD spawnId;
+	int32_t active;                    // 1 while navigating
+	int32_t count;
+	int32_t cursor;                    // index of the point we're headed to
+
+	// goes up when the points change, and not when only the cursor moves
+	uint32_t generation;
+
+	float destination[3];
+	float points[CURRENT_PATH_MAX_POINTS][3];
+};
+
+//----------------------------------------------------------------------------
+
+CurrentPathView::CurrentPathView()
+{
+}
+
+CurrentPathView::~CurrentPathView()
+{
+	Detach();
+}
+
+void CurrentPathView::Initialize()
+{
+	Attach();
+}
+
+void CurrentPathView::Shutdown()
+{
+	Detach();
+
+	m_points.clear();
+	m_lastPath.reset();
+}
+
+void CurrentPathView::Attach()
+{
+	char szName[MAX_PATH];
+	sprintf_s(szName, "Local\\MQ2Nav_CurrentPath%d_%lu", CURRENT_PATH_VIEW_VERSION, GetCurrentProcessId());
+
+	// new mappings come zeroed, which is not navigating
+	const DWORD size = sizeof(Header);
+	m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, size, szName);
+	if (!m_mapping)
+		return;
+
+	m_view = MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (!m_view)
+	{
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+	}
+}
+
+void CurrentPathView::Detach()
+{
+	if (m_view)
+	{
+		// a reader holding on to the mapping shouldn't see a path we stopped following
+		Header* header = static_cast<Header*>(m_view);
+		InterlockedIncrement(&header->sequence);
+		header->active = 0;
+		header->count = 0;
+		InterlockedIncrement(&header->sequence);
+
+		UnmapViewOfFile(m_view);
+		m_view = nullptr;
+	}
+
+	if (m_mapping)
+	{
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+	}
+}
+
+void CurrentPathView::OnPulse()
+{
+	std::shared_ptr<NavigationPath> path = g_mq2Nav->GetCurrentPath();
+
+	if (!path)
+	{
+		if (!m_points.empty())
+		{
+			m_points.clear();
+			m_cursor = 0;
+			m_lastPath.reset();
+			++m_generation;
+			Write();
+		}
+		return;
+	}
+
+	bool changed = m_lastPath.lock() != path || path->GetPathGeneration() != m_lastGeneration
+		|| path->GetPathSize() != m_lastSize;
+	int cursor = path->GetPathIndex();
+
+	if (!changed && cursor == m_cursor)
+		return;
+
+	if (changed)
+	{
+		m_lastPath = path;
+		m_lastGeneration = path->GetPathGeneration();
+		m_lastSize = path->GetPathSize();
+
+		// the path is in navmesh coordinates
+		m_points.resize(std::max(m_lastSize, 0));
+		for (int i = 0; i < m_lastSize; ++i)
+		{
+			const float* pos = path->GetRawPosition(i);
+			m_points[i] = glm::vec3(pos[0], pos[2], pos[1]);
+		}
+
+		m_destination = path->GetDestination();
+		++m_generation;
+	}
+
+	m_cursor = cursor;
+	Write();
+}
+
+void CurrentPathView::Write()
+{
+	if (!m_view)
+		return;
+
+	Header* header = static_cast<Header*>(m_view);
+	int count = std::min(static_cast<int>(m_points.size()), CURRENT_PATH_MAX_POINTS);
+
+	InterlockedIncrement(&header->sequence);
+
+	PSPAWNINFO me = GetCharInfo() ? GetCharInfo()->pSpawn : nullptr;
+	header->spawnId = me ? me->SpawnID : 0;
+	header->active = !m_points.empty();
+	header->cursor = m_cursor;
+
+	// the points are left alone when only the cursor moved
+	if (header->generation != m_generation)
+	{
+		header->count = count;
+		header->generation = m_generation;
+		header->destination[0] = m_destination.x;
+		header->destination[1] = m_destination.y;
+		header->destination[2] = m_destination.z;
+
+		for (int i = 0; i < count; ++i)
+		{
+			header->points[i][0] = m_points[i].x;
+			header->points[i][1] = m_points[i].y;
+			header->points[i][2] = m_points[i].z;
+		}
+	}
+
+	InterlockedIncrement(&header->sequence);
+}
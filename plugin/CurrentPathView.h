@@ -0,0 +1,63 @@
+//
+// CurrentPathView.h
+//
+
+#pragma once
+
+#include "MQ2Plugin.h"
+
+#include "common/NavModule.h"
+
+#include <glm/vec3.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class NavigationPath;
+
+// The path that this client is following, copied into a named file mapping for
+// overlays and scripts outside of the game, so that they read the whole path at
+// once instead of asking for it a point at a time. The mapping is named
+// Local\MQ2Nav_CurrentPath<version>_<process id>, see the Header in the .cpp
+// for its layout. Points are in eq coordinates. The copy kept here backs the
+// CurrentPath TLO.
+class CurrentPathView : public NavModule
+{
+public:
+	CurrentPathView();
+	virtual ~CurrentPathView();
+
+	virtual void Initialize() override;
+	virtual void Shutdown() override;
+
+	// after movement, so the cursor is the one we're walking to
+	virtual void OnPulse() override;
+
+	// the points of the path, empty when not navigating, and the index of the
+	// one we're headed to
+	const std::vector<glm::vec3>& GetPoints() const { return m_points; }
+	int GetCursor() const { return m_cursor; }
+
+private:
+	struct Header;
+
+	void Attach();
+	void Detach();
+
+	void Write();
+
+	std::vector<glm::vec3> m_points;
+	glm::vec3 m_destination;
+	int m_cursor = 0;
+	uint32_t m_generation = 0;
+
+	// what the copy was last taken from
+	std::weak_ptr<NavigationPath> m_lastPath;
+	uint32_t m_lastGeneration = 0;
+	int m_lastSize = 0;
+
+	HANDLE m_mapping = nullptr;
+	void* m_view = nullptr;
+};
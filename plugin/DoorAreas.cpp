@@ -0,0 +1,140 @@
+//
+// DoorAreas.cpp
+//
+
+#include "DoorAreas.h"
+#include "MQ2Navigation.h"
+#include "ModelLoader.h"
+#include "ObjectIndex.h"
+
+#include "common/NavMesh.h"
+#include "common/NavMeshData.h"
+
+#include <DetourCommon.h>
+
+// size of doors whose model isn't loaded yet
+static const float DOOR_DEFAULT_RADIUS = 12.0f;
+
+// the volume reaches this far past the door, and this far below and above it
+static const float DOOR_MARGIN = 2.0f;
+static const float DOOR_HEIGHT_BELOW = 5.0f;
+static const float DOOR_HEIGHT_ABOVE = 20.0f;
+
+DoorAreas::DoorAreas(NavMesh* navMesh)
+	: m_navMesh(navMesh)
+{
+}
+
+void DoorAreas::SetZoneId(int zoneId)
+{
+	// the navmesh drops the volumes with the zone
+	m_doors.clear();
+	m_volumeIds.clear();
+	m_paintedDoorCount = 0;
+	m_paintedModelCount = 0;
+	m_painted = false;
+}
+
+void DoorAreas::OnPulse()
+{
+	if (!m_navMesh->IsNavMeshLoaded())
+		return;
+
+	size_t doorCount = g_mq2Nav->Get<ObjectIndex>()->GetDoorCount();
+	size_t modelCount = g_mq2Nav->Get<ModelLoader>()->GetDoorModelCount();
+
+	if (m_painted && doorCount == m_paintedDoorCount && modelCount == m_paintedModelCount)
+		return;
+
+	PaintDoors();
+
+	m_paintedDoorCount = doorCount;
+	m_paintedModelCount = modelCount;
+	m_painted = true;
+}
+
+void DoorAreas::PaintDoors()
+{
+	if (!m_volumeIds.empty())
+		m_navMesh->RemoveRuntimeVolumes(m_volumeIds);
+
+	m_doors.clear();
+	m_volumeIds.clear();
+
+	ModelLoader* modelLoader = g_mq2Nav->Get<ModelLoader>();
+	const ObjectIndex::DoorSnapshot& snapshot = g_mq2Nav->Get<ObjectIndex>()->GetDoors();
+
+	std::vector<ConvexVolume> volumes;
+	for (PDOOR door : snapshot.doors)
+	{
+		if (!door || IsSwitchStationary(door))
+			continue;
+
+		// doors swing around where they're placed, so the volume is a circle
+		// around it as wide as the door
+		float radius = DOOR_DEFAULT_RADIUS;
+		if (const ModelInfo* model = modelLoader->GetDoorModel(door->ID))
+		{
+			glm::vec3 size = model->max - model->min;
+			radius = std::max(size.x, size.y) * GetDoorScale(door);
+		}
+		radius += DOOR_MARGIN;
+
+		// painted where the door is when closed
+		glm::vec3 pos(door->DefaultX, door->DefaultY, door->DefaultZ);
+
+		ConvexVolume volume;
+		for (int i = 0; i < 8; ++i)
+		{
+			float angle = DT_PI * 2 * i / 8;
+			volume.verts.emplace_back(pos.x + cosf(angle) * radius, pos.z, pos.y + sinf(angle) * radius);
+		}
+		volume.hmin = pos.z - DOOR_HEIGHT_BELOW;
+		volume.hmax = pos.z + DOOR_HEIGHT_ABOVE;
+		volume.areaType = static_cast<uint8_t>(PolyArea::Door);
+
+		volumes.push_back(std::move(volume));
+		m_doors.push_back(Door{ door->ID, pos, radius });
+	}
+
+	std::vector<uint32_t> ids = m_navMesh->AddRuntimeVolumes(std::move(volumes));
+
+	// doors that are off the mesh painted nothing
+	size_t count = 0;
+	for (size_t i = 0; i < ids.size(); ++i)
+	{
+		if (ids[i] == 0)
+			continue;
+
+		m_volumeIds.push_back(ids[i]);
+		m_doors[count++] = m_doors[i];
+	}
+	m_doors.resize(count);
+}
+
+PDOOR DoorAreas::FindClosedDoor(const glm::vec3& pos) const
+{
+	ObjectIndex* objectIndex = g_mq2Nav->Get<ObjectIndex>();
+
+	PDOOR closest = nullptr;
+	float closestDistSq = FLT_MAX;
+
+	for (const Door& door : m_doors)
+	{
+		float dx = door.pos.x - pos.x;
+		float dy = door.pos.y - pos.y;
+		float distSq = dx * dx + dy * dy;
+		if (distSq > door.radius * door.radius || distSq >= closestDistSq)
+			continue;
+
+		// 0 is closed, the rest are open or on their way
+		PDOOR pDoor = objectIndex->FindDoorById(door.id);
+		if (!pDoor || pDoor->State != 0)
+			continue;
+
+		closest = pDoor;
+		closestDistSq = distSq;
+	}
+
+	return closest;
+}
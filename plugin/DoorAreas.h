@@ -0,0 +1,56 @@
+//
+// DoorAreas.h
+//
+
+#pragma once
+
+#include "MQ2Plugin.h"
+
+#include "common/NavModule.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+class NavMesh;
+
+// Marks the ground around the doors of the zone with the door area, by painting
+// a runtime volume around each door onto the navmesh. A path that goes through
+// a door then says so ahead of time, and the door can be opened on the way
+// instead of being walked into. The volumes are repainted once the door models
+// are loaded, which gives the size of each door.
+class DoorAreas : public NavModule
+{
+public:
+	explicit DoorAreas(NavMesh* navMesh);
+
+	virtual void OnPulse() override;
+	virtual void SetZoneId(int zoneId) override;
+
+	virtual PulsePriority GetPulsePriority() const override { return PulsePriority::Background; }
+
+	// the closest closed door whose volume has pos in it, in eq coordinates
+	PDOOR FindClosedDoor(const glm::vec3& pos) const;
+
+	size_t GetDoorCount() const { return m_doors.size(); }
+
+private:
+	void PaintDoors();
+
+	NavMesh* m_navMesh;
+
+	struct Door
+	{
+		int id;
+		glm::vec3 pos;                 // eq coordinates
+		float radius;
+	};
+	std::vector<Door> m_doors;
+	std::vector<uint32_t> m_volumeIds;
+
+	// what the doors were painted from, they're painted again when it changes
+	size_t m_paintedDoorCount = 0;
+	size_t m_paintedModelCount = 0;
+	bool m_painted = false;
+};
@@ -11,6 +11,8 @@
 
 #include <imgui/imgui_custom/ImGuiUtils.h>
 #include <imgui/fonts/font_roboto_regular_ttf.h>
+
+#include <algorithm>
 //#include <imgui/fonts/font_fontawesome_ttf.h>
 
 // Data
@@ -20,8 +22,8 @@ static INT64                    g_TicksPerSecond = 0;
 static LPDIRECT3DDEVICE9        g_pd3dDevice = NULL;
 static LPDIRECT3DVERTEXBUFFER9  g_pVB = NULL;
 static LPDIRECT3DINDEXBUFFER9   g_pIB = NULL;
-static int                      VERTEX_BUFFER_SIZE = 20000;     // TODO: Make buffers smaller and grow dynamically as needed.
-static int                      INDEX_BUFFER_SIZE = 40000;      // TODO: Make buffers smaller and grow dynamically as needed.
+static int                      g_VertexBufferSize = 5000;      // grown when a frame needs more, and kept that big
+static int                      g_IndexBufferSize = 10000;
 
 struct CUSTOMVERTEX
 {
@@ -32,6 +34,40 @@ struct CUSTOMVERTEX
 #define D3DFVF_CUSTOMVERTEX (D3DFVF_XYZ|D3DFVF_DIFFUSE|D3DFVF_TEX1)
 
 
+// make sure the buffers hold at least this many vertices and indices, growing
+// them by at least half again so that a frame that keeps getting bigger doesn't
+// recreate them every time
+static bool ImGui_ImplDX9_ReserveBuffers(int vtxCount, int idxCount)
+{
+	if (g_pVB && g_VertexBufferSize < vtxCount)
+	{
+		g_pVB->Release();
+		g_pVB = NULL;
+		g_VertexBufferSize = std::max(vtxCount, g_VertexBufferSize + g_VertexBufferSize / 2);
+	}
+
+	if (!g_pVB && g_pd3dDevice->CreateVertexBuffer(g_VertexBufferSize * sizeof(CUSTOMVERTEX),
+		D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY, D3DFVF_CUSTOMVERTEX, D3DPOOL_DEFAULT, &g_pVB, NULL) < 0)
+	{
+		return false;
+	}
+
+	if (g_pIB && g_IndexBufferSize < idxCount)
+	{
+		g_pIB->Release();
+		g_pIB = NULL;
+		g_IndexBufferSize = std::max(idxCount, g_IndexBufferSize + g_IndexBufferSize / 2);
+	}
+
+	if (!g_pIB && g_pd3dDevice->CreateIndexBuffer(g_IndexBufferSize * sizeof(ImDrawIdx),
+		D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY, D3DFMT_INDEX16, D3DPOOL_DEFAULT, &g_pIB, NULL) < 0)
+	{
+		return false;
+	}
+
+	return true;
+}
+
 static void ConfigureFonts()
 {
 	ImGuiIO& io = ImGui::GetIO();
@@ -61,13 +97,19 @@ static void ConfigureFonts()
 // - in your Render function, try translating your projection matrix by (0.5f,0.5f) or (0.375f,0.375f)
 static void ImGui_ImplDX9_RenderDrawLists(ImDrawData* draw_data)
 {
+	if (!ImGui_ImplDX9_ReserveBuffers(draw_data->TotalVtxCount, draw_data->TotalIdxCount))
+		return;
+
 	// Copy and convert all vertices into a single contiguous buffer
 	CUSTOMVERTEX* vtx_dst;
 	ImDrawIdx* idx_dst;
 	if (g_pVB->Lock(0, (UINT)(draw_data->TotalVtxCount * sizeof(CUSTOMVERTEX)), (void**)&vtx_dst, D3DLOCK_DISCARD) < 0)
 		return;
 	if (g_pIB->Lock(0, (UINT)(draw_data->TotalIdxCount * sizeof(ImDrawIdx)), (void**)&idx_dst, D3DLOCK_DISCARD) < 0)
+	{
+		g_pVB->Unlock();
 		return;
+	}
 	for (int n = 0; n < draw_data->CmdListsCount; n++)
 	{
 		const ImDrawList* cmd_list = draw_data->CmdLists[n];
@@ -122,9 +164,14 @@ static void ImGui_ImplDX9_RenderDrawLists(ImDrawData* draw_data)
 	D3DXMatrixOrthoOffCenterLH(&mat, 0.5f, viewport.Width + 0.5f, viewport.Height + 0.5f, 0.5f, -1.0f, +1.0f);
 	g_pd3dDevice->SetTransform(D3DTS_PROJECTION, &mat);
 
-	// Render command lists
+	// Render command lists. Commands that follow each other with the same texture and
+	// clip rect are drawn together, and the state is only set when it changes.
 	int vtx_offset = 0;
 	int idx_offset = 0;
+	ImTextureID last_texture = NULL;
+	RECT last_rect = { 0, 0, 0, 0 };
+	bool state_set = false;
+
 	for (int n = 0; n < draw_data->CmdListsCount; n++)
 	{
 		const ImDrawList* cmd_list = draw_data->CmdLists[n];
@@ -134,15 +181,39 @@ static void ImGui_ImplDX9_RenderDrawLists(ImDrawData* draw_data)
 			if (pcmd->UserCallback)
 			{
 				pcmd->UserCallback(cmd_list, pcmd);
+				idx_offset += pcmd->ElemCount;
+
+				// the callback may have changed anything
+				state_set = false;
+				continue;
 			}
-			else
+
+			UINT elem_count = pcmd->ElemCount;
+			while (cmd_i + 1 < cmd_list->CmdBuffer.size())
 			{
-				const RECT r = { (LONG)pcmd->ClipRect.x, (LONG)pcmd->ClipRect.y, (LONG)pcmd->ClipRect.z, (LONG)pcmd->ClipRect.w };
+				const ImDrawCmd* next = &cmd_list->CmdBuffer[cmd_i + 1];
+				if (next->UserCallback || next->TextureId != pcmd->TextureId
+					|| memcmp(&next->ClipRect, &pcmd->ClipRect, sizeof(ImVec4)) != 0)
+				{
+					break;
+				}
+
+				elem_count += next->ElemCount;
+				++cmd_i;
+			}
+
+			const RECT r = { (LONG)pcmd->ClipRect.x, (LONG)pcmd->ClipRect.y, (LONG)pcmd->ClipRect.z, (LONG)pcmd->ClipRect.w };
+			if (!state_set || pcmd->TextureId != last_texture)
 				g_pd3dDevice->SetTexture(0, (LPDIRECT3DTEXTURE9)pcmd->TextureId);
+			if (!state_set || memcmp(&r, &last_rect, sizeof(RECT)) != 0)
 				g_pd3dDevice->SetScissorRect(&r);
-				g_pd3dDevice->DrawIndexedPrimitive(D3DPT_TRIANGLELIST, vtx_offset, 0, (UINT)cmd_list->VtxBuffer.size(), idx_offset, pcmd->ElemCount / 3);
-			}
-			idx_offset += pcmd->ElemCount;
+			last_texture = pcmd->TextureId;
+			last_rect = r;
+			state_set = true;
+
+			if (elem_count > 0)
+				g_pd3dDevice->DrawIndexedPrimitive(D3DPT_TRIANGLELIST, vtx_offset, 0, (UINT)cmd_list->VtxBuffer.size(), idx_offset, elem_count / 3);
+			idx_offset += elem_count;
 		}
 		vtx_offset += cmd_list->VtxBuffer.size();
 	}
@@ -275,11 +346,8 @@ bool ImGui_ImplDX9_CreateDeviceObjects()
 	if (!g_pd3dDevice)
 		return false;
 
-	if (g_pd3dDevice->CreateVertexBuffer(VERTEX_BUFFER_SIZE * sizeof(CUSTOMVERTEX),
-		D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY, D3DFVF_CUSTOMVERTEX, D3DPOOL_DEFAULT, &g_pVB, NULL) < 0)
-		return false;
-
-	if (g_pd3dDevice->CreateIndexBuffer(INDEX_BUFFER_SIZE * sizeof(ImDrawIdx), D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY, D3DFMT_INDEX16, D3DPOOL_DEFAULT, &g_pIB, NULL) < 0)
+	// at the size they had grown to before the device was lost
+	if (!ImGui_ImplDX9_ReserveBuffers(0, 0))
 		return false;
 
 	ImGui_ImplDX9_CreateFontsTexture();
@@ -6,6 +6,7 @@
 #include "ImGuiDX9.h"
 #include "MQ2Navigation.h"
 #include "MQ2Nav_Hooks.h"
+#include "PerfStats.h"
 
 #include <imgui.h>
 #include <imgui/imgui_custom/imgui_user.h>
@@ -64,6 +65,8 @@ void ImGuiRenderer::Render(RenderPhase phase)
 	if (!m_visible)
 		return;
 
+	mq2nav::ScopedPerfTimer timer(mq2nav::PerfTimer::ImGuiRender);
+
 	if (m_imguiReady)
 	{
 		// don't draw ui if we're not in game, but also
@@ -80,8 +83,29 @@ void ImGuiRenderer::Render(RenderPhase phase)
 	}
 }
 
+void ImGuiRenderer::RecordDeviceState()
+{
+	// the parts of ImGui_ImplDX9_RenderDrawLists that ResetDeviceState doesn't cover
+	m_pDevice->SetTextureStageState(0, D3DTSS_COLORARG1, D3DTA_DIFFUSE);
+	m_pDevice->SetTextureStageState(0, D3DTSS_ALPHAARG1, D3DTA_TEXTURE);
+	m_pDevice->SetTextureStageState(0, D3DTSS_ALPHAARG2, D3DTA_DIFFUSE);
+}
+
 void ImGuiRenderer::BeginNewFrame()
 {
+	if (!IsActive())
+	{
+		// nothing will be drawn, so nothing should be captured either
+		ImGuiIO& io = ImGui::GetIO();
+		io.WantCaptureKeyboard = false;
+		io.WantCaptureMouse = false;
+		io.WantTextInput = false;
+
+		m_imguiReady = false;
+		m_imguiRender = false;
+		return;
+	}
+
 	m_imguiReady = ImGui_ImplDX9_NewFrame();
 	m_imguiRender = true;
 }
@@ -8,6 +8,7 @@
 #include "common/Signal.h"
 
 #include <chrono>
+#include <functional>
 #include <memory>
 #include <vector>
 
@@ -34,11 +35,22 @@ public:
 	virtual void InvalidateDeviceObjects() override;
 	virtual bool CreateDeviceObjects() override;
 	virtual void Render(RenderPhase phase) override;
+	virtual bool IsRenderActive(RenderPhase phase) const override { return phase == Render_UI && IsActive(); }
+	virtual void RecordDeviceState() override;
 
 	void BeginNewFrame();
 
 	void SetVisible(bool visible);
 
+	// a suspended renderer isn't active, for clients in the background
+	void SetSuspended(bool suspended) { m_suspended = suspended; }
+
+	// Tells whether any windows are open. While there are none (or the renderer
+	// isn't visible) imgui doesn't run at all: no new frames are started and
+	// nothing is rendered.
+	void SetHasWindows(std::function<bool()> hasWindows) { m_hasWindows = std::move(hasWindows); }
+	bool IsActive() const { return m_visible && !m_suspended && (!m_hasWindows || m_hasWindows()); }
+
 	// add a signal to do ui stuff
 	Signal<> OnUpdateUI;
 
@@ -50,6 +62,8 @@ private:
 	bool m_imguiRender = false;
 
 	bool m_visible = true;
+	bool m_suspended = false;
+	std::function<bool()> m_hasWindows;
 
 	// we're holding onto the device, we need to maintain a refcount
 	IDirect3DDevice9* m_pDevice = nullptr;
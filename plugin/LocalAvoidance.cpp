@@ -0,0 +1,324 @@
+//
+// LocalAvoidance.cpp
+//
+
+#include "LocalAvoidance.h"
+
+#include "common/NavMesh.h"
+#include "common/NavMeshData.h"
+
+#include <DetourCommon.h>
+
+#include <algorithm>
+
+// bump when the layout of the mapping changes, clients of different versions get
+// different mappings.
+static const int LOCAL_AVOIDANCE_VERSION = 1;
+
+// characters in one zone that can avoid each other
+static const int AVOIDANCE_MAX_AGENTS = 64;
+
+// agents that haven't updated in this long have gone away
+static const DWORD AVOIDANCE_AGENT_TIMEOUT_MS = 2000;
+
+// only agents this close are avoided
+static const float AVOIDANCE_RANGE = 30.0f;
+
+// characters stand still or walk slowly between updates now and then, a little
+// speed is always assumed so that there is something to steer
+static const float AVOIDANCE_MIN_SPEED = 10.0f;
+
+// how far ahead the steered direction is looked at
+static const float AVOIDANCE_LOOKAHEAD = 10.0f;
+
+struct LocalAvoidance::Agent
+{
+	// odd while the agent is being written
+	volatile LONG sequence;
+
+	DWORD processId;                   // 0 if the slot is free
+	DWORD spawnId;
+	DWORD tick;
+	float pos[3];
+	float vel[3];
+	float radius;
+};
+
+//----------------------------------------------------------------------------
+
+LocalAvoidance::LocalAvoidance(NavMesh* navMesh)
+	: m_navMesh(navMesh)
+{
+	m_query.init(AVOIDANCE_MAX_AGENTS, 0);
+
+	// dtCrowd's defaults, at the crowd sample's medium quality
+	m_params.velBias = 0.4f;
+	m_params.weightDesVel = 2.0f;
+	m_params.weightCurVel = 0.75f;
+	m_params.weightSide = 0.75f;
+	m_params.weightToi = 2.5f;
+	m_params.horizTime = 2.5f;
+	m_params.gridSize = 33;
+	m_params.adaptiveDivs = 7;
+	m_params.adaptiveRings = 2;
+	m_params.adaptiveDepth = 2;
+}
+
+LocalAvoidance::~LocalAvoidance()
+{
+	Detach();
+}
+
+void LocalAvoidance::Initialize()
+{
+	// agents are shared by zone
+	m_navMeshConn = m_navMesh->OnNavMeshChanged.Connect([this]() { Attach(); });
+}
+
+void LocalAvoidance::Shutdown()
+{
+	m_navMeshConn.Disconnect();
+
+	Detach();
+}
+
+void LocalAvoidance::SetEnabled(bool enabled)
+{
+	m_enabled = enabled;
+
+	if (m_enabled)
+		Attach();
+	else
+		Detach();
+}
+
+void LocalAvoidance::Attach()
+{
+	std::string name;
+	if (m_enabled && m_navMesh->IsNavMeshLoaded())
+	{
+		char szName[MAX_PATH];
+		sprintf_s(szName, "Local\\MQ2Nav_Agents%d_%s", LOCAL_AVOIDANCE_VERSION,
+			m_navMesh->GetZoneName().c_str());
+		name = szName;
+	}
+
+	if (m_view && name == m_mappingName)
+		return;
+
+	Detach();
+
+	if (name.empty())
+		return;
+
+	// new mappings come zeroed, which is every slot free
+	const DWORD size = sizeof(Agent) * AVOIDANCE_MAX_AGENTS;
+	m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, size, name.c_str());
+	if (!m_mapping)
+		return;
+
+	m_view = MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (!m_view)
+	{
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+		return;
+	}
+
+	m_mappingName = name;
+	m_hasPos = false;
+}
+
+void LocalAvoidance::Detach()
+{
+	RemoveAgent();
+
+	if (m_view)
+	{
+		UnmapViewOfFile(m_view);
+		m_view = nullptr;
+	}
+
+	if (m_mapping)
+	{
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+	}
+
+	m_mappingName.clear();
+}
+
+LocalAvoidance::Agent* LocalAvoidance::GetAgents() const
+{
+	return static_cast<Agent*>(m_view);
+}
+
+void LocalAvoidance::UpdateAgent(DWORD spawnId, const float* pos)
+{
+	if (!m_view)
+		return;
+
+	auto now = std::chrono::steady_clock::now();
+	float dt = std::chrono::duration<float>(now - m_lastUpdate).count();
+
+	// a jump in position, from zoning or a teleport, isn't movement
+	if (m_hasPos && spawnId == m_spawnId && dt > 0.0f && dtVdist2D(pos, m_pos) < AVOIDANCE_RANGE)
+	{
+		dtVsub(m_vel, pos, m_pos);
+		dtVscale(m_vel, m_vel, 1.0f / dt);
+		m_vel[1] = 0;
+	}
+	else
+	{
+		dtVset(m_vel, 0, 0, 0);
+	}
+
+	dtVcopy(m_pos, pos);
+	m_spawnId = spawnId;
+	m_lastUpdate = now;
+	m_hasPos = true;
+
+	WriteAgent(spawnId, m_pos, m_vel);
+}
+
+void LocalAvoidance::WriteAgent(DWORD spawnId, const float* pos, const float* vel)
+{
+	Agent* agents = GetAgents();
+	const DWORD processId = GetCurrentProcessId();
+	const DWORD tick = GetTickCount();
+
+	// claim a slot that is free or has timed out
+	if (m_slot < 0 || agents[m_slot].processId != processId)
+	{
+		m_slot = -1;
+
+		for (int i = 0; i < AVOIDANCE_MAX_AGENTS && m_slot < 0; ++i)
+		{
+			Agent& agent = agents[i];
+			if (agent.processId != 0 && tick - agent.tick <= AVOIDANCE_AGENT_TIMEOUT_MS)
+				continue;
+
+			LONG sequence = agent.sequence;
+			if ((sequence & 1) || InterlockedCompareExchange(&agent.sequence, sequence + 1, sequence) != sequence)
+				continue;
+
+			agent.processId = processId;
+			agent.tick = tick;
+			InterlockedExchange(&agent.sequence, sequence + 2);
+			m_slot = i;
+		}
+
+		if (m_slot < 0)
+			return;
+	}
+
+	// nobody else writes to our slot once it is ours
+	Agent& agent = agents[m_slot];
+	LONG sequence = agent.sequence;
+	InterlockedExchange(&agent.sequence, sequence + 1);
+
+	agent.spawnId = spawnId;
+	agent.tick = tick;
+	dtVcopy(agent.pos, pos);
+	dtVcopy(agent.vel, vel);
+	agent.radius = m_navMesh->GetNavMeshConfig().agentRadius;
+
+	InterlockedExchange(&agent.sequence, sequence + 2);
+}
+
+void LocalAvoidance::RemoveAgent()
+{
+	if (!m_view || m_slot < 0)
+		return;
+
+	Agent& agent = GetAgents()[m_slot];
+	if (agent.processId == GetCurrentProcessId())
+	{
+		LONG sequence = agent.sequence;
+		InterlockedExchange(&agent.sequence, sequence + 1);
+		agent.processId = 0;
+		agent.spawnId = 0;
+		InterlockedExchange(&agent.sequence, sequence + 2);
+	}
+
+	m_slot = -1;
+	m_hasPos = false;
+}
+
+bool LocalAvoidance::Steer(const float* target, float* steerPos)
+{
+	m_stats.neighbours = 0;
+
+	if (!m_view || !m_hasPos)
+		return false;
+
+	Agent* agents = GetAgents();
+	const DWORD processId = GetCurrentProcessId();
+	const DWORD tick = GetTickCount();
+	const float radius = m_navMesh->GetNavMeshConfig().agentRadius;
+
+	m_query.reset();
+
+	for (int i = 0; i < AVOIDANCE_MAX_AGENTS; ++i)
+	{
+		Agent& agent = agents[i];
+
+		LONG sequence = agent.sequence;
+		MemoryBarrier();
+
+		if ((sequence & 1)
+			|| agent.processId == 0
+			|| agent.processId == processId
+			|| tick - agent.tick > AVOIDANCE_AGENT_TIMEOUT_MS)
+		{
+			continue;
+		}
+
+		float pos[3], vel[3];
+		dtVcopy(pos, agent.pos);
+		dtVcopy(vel, agent.vel);
+		float agentRadius = agent.radius;
+
+		MemoryBarrier();
+		if (agent.sequence != sequence)
+			continue;
+
+		// on another floor, or too far away to matter
+		if (fabsf(pos[1] - m_pos[1]) > m_navMesh->GetNavMeshConfig().agentHeight
+			|| dtVdist2DSqr(pos, m_pos) > dtSqr(AVOIDANCE_RANGE))
+		{
+			continue;
+		}
+
+		// where they're headed isn't shared, assume they keep going
+		m_query.addCircle(pos, agentRadius, vel, vel);
+		++m_stats.neighbours;
+	}
+
+	if (m_stats.neighbours == 0)
+		return false;
+
+	const float speed = std::max(dtVlen(m_vel), AVOIDANCE_MIN_SPEED);
+
+	float dvel[3];
+	dtVsub(dvel, target, m_pos);
+	dvel[1] = 0;
+	if (dtVlenSqr(dvel) < 0.0001f)
+		return false;
+	dtVnormalize(dvel);
+	dtVscale(dvel, dvel, speed);
+
+	float nvel[3];
+	m_query.sampleVelocityAdaptive(m_pos, radius, speed, m_vel, dvel, nvel, &m_params);
+	if (dtVlenSqr(nvel) < 0.0001f)
+		return false;
+
+	// look along the new direction, no further than the target itself
+	float distance = std::min(AVOIDANCE_LOOKAHEAD, dtVdist2D(target, m_pos));
+	dtVnormalize(nvel);
+	dtVmad(steerPos, m_pos, nvel, distance);
+	steerPos[1] = target[1];
+
+	++m_stats.steered;
+	return true;
+}
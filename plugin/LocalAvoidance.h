@@ -0,0 +1,82 @@
+//
+// LocalAvoidance.h
+//
+
+#pragma once
+
+#include "MQ2Plugin.h"
+
+#include "common/NavModule.h"
+#include "common/Signal.h"
+
+#include <DetourObstacleAvoidance.h>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+class NavMesh;
+
+// Steering around the other characters on this machine that are in the same
+// zone. Every client writes its position and velocity into a table shared
+// through a named file mapping, and nudges the direction it walks in with
+// detour's obstacle avoidance, the velocity sampling that dtCrowd does for its
+// agents. Characters moving together spread out instead of walking over the
+// same corners, which keeps them from getting stuck on each other.
+class LocalAvoidance : public NavModule
+{
+public:
+	explicit LocalAvoidance(NavMesh* navMesh);
+	virtual ~LocalAvoidance();
+
+	virtual void Initialize() override;
+	virtual void Shutdown() override;
+
+	void SetEnabled(bool enabled);
+	bool IsEnabled() const { return m_enabled; }
+
+	// publish where this character is, once per pulse. Positions are in navmesh
+	// coordinates, the velocity is taken from the movement since the last update.
+	void UpdateAgent(DWORD spawnId, const float* pos);
+
+	// a point to head for instead of target that stays clear of the other
+	// characters. Returns false if there is no one close enough to avoid.
+	bool Steer(const float* target, float* steerPos);
+
+	struct Stats
+	{
+		uint32_t neighbours = 0;        // in range at the last steer
+		uint32_t steered = 0;
+	};
+	const Stats& GetStats() const { return m_stats; }
+
+private:
+	struct Agent;
+
+	Agent* GetAgents() const;
+	void WriteAgent(DWORD spawnId, const float* pos, const float* vel);
+	void RemoveAgent();
+
+	void Attach();
+	void Detach();
+
+	NavMesh* m_navMesh;
+	bool m_enabled = false;
+
+	dtObstacleAvoidanceQuery m_query;
+	dtObstacleAvoidanceParams m_params;
+
+	DWORD m_spawnId = 0;
+	float m_pos[3] = { 0, 0, 0 };
+	float m_vel[3] = { 0, 0, 0 };
+	std::chrono::steady_clock::time_point m_lastUpdate;
+	bool m_hasPos = false;
+
+	HANDLE m_mapping = nullptr;
+	void* m_view = nullptr;
+	std::string m_mappingName;
+	int m_slot = -1;
+	Stats m_stats;
+
+	Signal<>::ScopedConnection m_navMeshConn;
+};
@@ -0,0 +1,239 @@
+//
+// MQ2NavAPI.cpp
+//
+
+#include "MQ2NavAPI.h"
+#include "MQ2Navigation.h"
+#include "MQ2Nav_Settings.h"
+
+#include "common/NavMesh.h"
+
+#include <cfloat>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+static_assert(MQ2NAV_RESULT_ARRIVED == (int)NavigationEvent::Arrived
+	&& MQ2NAV_RESULT_STOPPED == (int)NavigationEvent::Stopped
+	&& MQ2NAV_RESULT_FAILED == (int)NavigationEvent::Failed
+	&& MQ2NAV_EVENT_STUCK == (int)NavigationEvent::Stuck
+	&& MQ2NAV_EVENT_DESTINATION_CHANGED == (int)NavigationEvent::DestinationChanged,
+	"MQ2NavEvent doesn't match NavigationEvent");
+
+// how many finished navigations GetNavigationResult remembers
+static const size_t MAX_FINISHED_RESULTS = 64;
+
+static std::unordered_map<uint32_t, Signal<uint32_t, NavigationEvent>::Connection> s_callbacks;
+static uint32_t s_nextCallbackHandle = 1;
+
+// navigation id and result, most recent last
+static std::deque<std::pair<uint32_t, NavigationEvent>> s_finishedResults;
+static Signal<uint32_t, NavigationEvent>::ScopedConnection s_resultsConn;
+
+static void RecordResult(uint32_t navigationId, NavigationEvent event)
+{
+	if (!IsFinishedEvent(event))
+		return;
+
+	s_finishedResults.emplace_back(navigationId, event);
+	if (s_finishedResults.size() > MAX_FINISHED_RESULTS)
+		s_finishedResults.pop_front();
+}
+
+static bool CanUseAPI()
+{
+	if (g_mq2Nav && !s_resultsConn.IsConnected())
+		s_resultsConn = g_mq2Nav->OnNavigationEvent.Connect(RecordResult);
+
+	return g_mq2Nav && g_mq2Nav->IsInitialized() && GetCharInfo() && GetCharInfo()->pSpawn;
+}
+
+// the destination as ParseDestination would have made it from a command
+static std::shared_ptr<DestinationInfo> MakeDestination(const MQ2NavOptions* options)
+{
+	auto dest = std::make_shared<DestinationInfo>();
+
+	if (mq2nav::GetSettings().avoid_water)
+		dest->avoidAreas |= AvoidAreaBit(static_cast<uint8_t>(PolyArea::Water));
+
+	if (options && options->structSize >= offsetof(MQ2NavOptions, avoidAreas) + sizeof(options->avoidAreas))
+		dest->avoidAreas |= options->avoidAreas;
+
+	dest->clearance = mq2nav::GetSettings().extra_clearance;
+	if (options && options->structSize >= offsetof(MQ2NavOptions, clearance) + sizeof(options->clearance)
+		&& options->clearance > 0.0f)
+	{
+		dest->clearance = options->clearance;
+	}
+
+	return dest;
+}
+
+static std::shared_ptr<DestinationInfo> MakeLocationDestination(const float* eqPos, const MQ2NavOptions* options)
+{
+	auto dest = MakeDestination(options);
+	dest->command = "api locxyz";
+	dest->type = DestinationType::Location;
+	dest->eqDestinationPos = { eqPos[0], eqPos[1], eqPos[2] };
+	dest->valid = true;
+
+	return dest;
+}
+
+//----------------------------------------------------------------------------
+
+PLUGIN_API uint32_t MQ2Nav_GetAPIVersion()
+{
+	return MQ2NAV_API_VERSION;
+}
+
+PLUGIN_API uint32_t MQ2Nav_NavigateToPosition(const float* eqPos, const MQ2NavOptions* options)
+{
+	if (!eqPos || !CanUseAPI())
+		return 0;
+
+	g_mq2Nav->StopZoneRoute();
+	g_mq2Nav->BeginNavigation(MakeLocationDestination(eqPos, options));
+
+	return g_mq2Nav->GetNavigationId();
+}
+
+PLUGIN_API uint32_t MQ2Nav_NavigateToSpawn(uint32_t spawnId, const MQ2NavOptions* options)
+{
+	if (!CanUseAPI())
+		return 0;
+
+	PSPAWNINFO target = (PSPAWNINFO)GetSpawnByID(spawnId);
+	if (!target)
+		return 0;
+
+	auto dest = MakeDestination(options);
+	dest->command = "api id";
+	dest->type = DestinationType::Spawn;
+	dest->eqDestinationPos = { target->X, target->Y, target->Z };
+	dest->pSpawn = target;
+	dest->spawnId = target->SpawnID;
+	dest->valid = true;
+
+	g_mq2Nav->StopZoneRoute();
+	g_mq2Nav->BeginNavigation(dest);
+
+	return g_mq2Nav->GetNavigationId();
+}
+
+PLUGIN_API void MQ2Nav_Stop()
+{
+	if (!CanUseAPI())
+		return;
+
+	g_mq2Nav->StopZoneRoute();
+	g_mq2Nav->Stop();
+}
+
+PLUGIN_API uint32_t MQ2Nav_GetNavigationId()
+{
+	return g_mq2Nav ? g_mq2Nav->GetNavigationId() : 0;
+}
+
+PLUGIN_API float MQ2Nav_GetPathLength(const float* eqPos, const MQ2NavOptions* options)
+{
+	if (!eqPos || !CanUseAPI() || !g_mq2Nav->IsMeshLoaded())
+		return -1.f;
+
+	return g_mq2Nav->GetNavigationPathLength(MakeLocationDestination(eqPos, options));
+}
+
+PLUGIN_API int MQ2Nav_IsReachable(const float* eqPos, const MQ2NavOptions* options)
+{
+	return MQ2Nav_GetPathLength(eqPos, options) >= 0.f ? 1 : 0;
+}
+
+PLUGIN_API uint32_t MQ2Nav_GetFloorHeights(const float* eqPositions, uint32_t count,
+	float* heights, uint8_t* onMesh, const MQ2NavOptions* options)
+{
+	if (onMesh)
+		memset(onMesh, 0, count);
+
+	if (!eqPositions || !heights || count == 0 || !CanUseAPI() || !g_mq2Nav->IsMeshLoaded())
+		return 0;
+
+	std::vector<glm::vec3> positions(count);
+	for (uint32_t i = 0; i < count; ++i)
+		positions[i] = glm::vec3(eqPositions[i * 3], eqPositions[i * 3 + 1], eqPositions[i * 3 + 2]);
+
+	auto dest = MakeDestination(options);
+	std::vector<float> results = g_mq2Nav->GetFloorHeights(positions, dest->avoidAreas, dest->clearance);
+
+	uint32_t found = 0;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		if (results[i] == FLT_MAX)
+			continue;
+
+		heights[i] = results[i];
+		if (onMesh)
+			onMesh[i] = 1;
+		++found;
+	}
+
+	return found;
+}
+
+PLUGIN_API int MQ2Nav_GetNavigationResult(uint32_t navigationId)
+{
+	if (navigationId == 0)
+		return -1;
+
+	for (auto iter = s_finishedResults.rbegin(); iter != s_finishedResults.rend(); ++iter)
+	{
+		if (iter->first == navigationId)
+			return static_cast<int>(iter->second);
+	}
+
+	return -1;
+}
+
+static uint32_t AddCallback(MQ2NavEventCallback callback, void* userData, bool finishedOnly)
+{
+	if (!callback || !g_mq2Nav)
+		return 0;
+
+	uint32_t handle = s_nextCallbackHandle++;
+	s_callbacks[handle] = g_mq2Nav->OnNavigationEvent.Connect(
+		[callback, userData, finishedOnly](uint32_t navigationId, NavigationEvent event)
+	{
+		if (!finishedOnly || IsFinishedEvent(event))
+			callback(navigationId, static_cast<int>(event), userData);
+	});
+
+	return handle;
+}
+
+PLUGIN_API uint32_t MQ2Nav_RegisterFinishedCallback(MQ2NavFinishedCallback callback, void* userData)
+{
+	return AddCallback(callback, userData, true);
+}
+
+PLUGIN_API uint32_t MQ2Nav_RegisterEventCallback(MQ2NavEventCallback callback, void* userData)
+{
+	return AddCallback(callback, userData, false);
+}
+
+PLUGIN_API void MQ2Nav_UnregisterCallback(uint32_t handle)
+{
+	auto iter = s_callbacks.find(handle);
+	if (iter == s_callbacks.end())
+		return;
+
+	if (g_mq2Nav)
+		g_mq2Nav->OnNavigationEvent.Disconnect(iter->second);
+	s_callbacks.erase(iter);
+}
+
+PLUGIN_API void MQ2Nav_UnregisterFinishedCallback(uint32_t handle)
+{
+	MQ2Nav_UnregisterCallback(handle);
+}
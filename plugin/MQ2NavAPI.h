@@ -0,0 +1,118 @@
+//
+// MQ2NavAPI.h
+//
+
+// A C interface for other plugins to drive navigation with, instead of formatting
+// /nav commands and reading TLO strings. The functions are exported from MQ2Nav.dll
+// and are looked up with GetProcAddress, so a plugin doesn't need to link against
+// MQ2Nav and keeps working when it isn't loaded:
+//
+//   HMODULE module = GetModuleHandleA("MQ2Nav.dll");
+//   auto getVersion = (MQ2Nav_GetAPIVersionFn)GetProcAddress(module, "MQ2Nav_GetAPIVersion");
+//   if (getVersion && getVersion() >= MQ2NAV_API_VERSION) ...
+//
+// Everything has to be called from the game thread, pulses and commands are fine.
+// Positions are in eq coordinates: x, y and z as they are on a spawn.
+//
+// This header is C, and only needs <stdint.h>.
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// goes up whenever something is added. Nothing is changed or removed without
+// renaming it.
+#define MQ2NAV_API_VERSION 4
+
+enum MQ2NavResult
+{
+	MQ2NAV_RESULT_ARRIVED = 0,
+	MQ2NAV_RESULT_STOPPED = 1,    // stopped, replaced by another destination, or left the zone
+	MQ2NAV_RESULT_FAILED = 2,     // the path was lost and no new one was found
+};
+
+// what event callbacks get, the results and the things that happen along the way.
+// Version 2.
+enum MQ2NavEvent
+{
+	MQ2NAV_EVENT_STUCK = 3,                  // no progress was made, a recovery was tried
+	MQ2NAV_EVENT_DESTINATION_CHANGED = 4,    // a new navigation replaced the one in progress
+};
+
+// options for a navigation or query. Zero initialize it and set structSize, the
+// fields after the size that a caller doesn't know of yet get their defaults.
+typedef struct MQ2NavOptions
+{
+	uint32_t structSize;
+
+	// area ids to stay out of if the path can, as bits (1 << id). The avoid_water
+	// setting is applied as well.
+	uint64_t avoidAreas;
+
+	// room to keep from walls past the agent radius of the mesh, for a wider
+	// agent. 0 uses the extra_clearance setting. Version 3.
+	float clearance;
+} MQ2NavOptions;
+
+// called on the game thread once a navigation is over. It shouldn't start
+// navigating again from inside the callback, save the id and do it next pulse.
+typedef void (*MQ2NavFinishedCallback)(uint32_t navigationId, int result, void* userData);
+
+// called on the game thread with an MQ2NavResult or MQ2NavEvent. Same rules as
+// the finished callback.
+typedef void (*MQ2NavEventCallback)(uint32_t navigationId, int event, void* userData);
+
+// MQ2NAV_API_VERSION of the plugin that is loaded
+typedef uint32_t (*MQ2Nav_GetAPIVersionFn)(void);
+
+// navigate to a position or follow a spawn, options can be null. Returns the id
+// of the navigation, or 0 if there's no mesh or no path to it.
+typedef uint32_t (*MQ2Nav_NavigateToPositionFn)(const float* eqPos, const MQ2NavOptions* options);
+typedef uint32_t (*MQ2Nav_NavigateToSpawnFn)(uint32_t spawnId, const MQ2NavOptions* options);
+
+// stop the navigation in progress, if there is one
+typedef void (*MQ2Nav_StopFn)(void);
+
+// the id of the navigation in progress, 0 if there is none
+typedef uint32_t (*MQ2Nav_GetNavigationIdFn)(void);
+
+// the length of the path from the player to eqPos, -1 if it can't be reached.
+// Searches right away, on the game thread.
+typedef float (*MQ2Nav_GetPathLengthFn)(const float* eqPos, const MQ2NavOptions* options);
+
+// 1 if a path from the player to eqPos exists, 0 otherwise
+typedef int (*MQ2Nav_IsReachableFn)(const float* eqPos, const MQ2NavOptions* options);
+
+// returns a handle for unregistering, callbacks are dropped when the plugin unloads
+typedef uint32_t (*MQ2Nav_RegisterFinishedCallbackFn)(MQ2NavFinishedCallback callback, void* userData);
+typedef void (*MQ2Nav_UnregisterFinishedCallbackFn)(uint32_t handle);
+
+// version 2:
+
+// the MQ2NavResult of a navigation that has finished, -1 while it's still going
+// or if it's too old to remember. Cheap enough to poll every pulse, for waiting on a
+// navigation without a callback.
+typedef int (*MQ2Nav_GetNavigationResultFn)(uint32_t navigationId);
+
+// every event of every navigation, handles are the same kind as the finished
+// callback's and can be unregistered with either function.
+typedef uint32_t (*MQ2Nav_RegisterEventCallbackFn)(MQ2NavEventCallback callback, void* userData);
+typedef void (*MQ2Nav_UnregisterCallbackFn)(uint32_t handle);
+
+// version 4:
+
+// the height of the navmesh under count positions, eqPositions holding x, y, z
+// for each. The floor closest to each z is picked. heights gets the height of
+// each, and onMesh, if given, 1 for the ones over the mesh and 0 for the others,
+// whose heights are left as they were. Clustered positions share the tile
+// lookups. Returns how many were over the mesh.
+typedef uint32_t (*MQ2Nav_GetFloorHeightsFn)(const float* eqPositions, uint32_t count,
+	float* heights, uint8_t* onMesh, const MQ2NavOptions* options);
+
+#ifdef __cplusplus
+}
+#endif
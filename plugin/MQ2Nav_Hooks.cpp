@@ -21,7 +21,9 @@
 #include <dinput.h>
 
 #include <atomic>
+#include <string>
 #include <thread>
+#include <vector>
 #include <boost/algorithm/string.hpp>
 #include <winternl.h>
 #include <tchar.h>
@@ -89,27 +91,133 @@ const unsigned char* WndProc_Pattern = (const unsigned char*)"\x6a\xff\x68\x00\x
 
 //----------------------------------------------------------------------------
 
+// Offsets found by scanning are saved to the ini, relative to their module, along
+// with the build of both modules. As long as the build is the same, they're
+// checked against their pattern and used without scanning again.
+static const char* OffsetsSection = "Offsets";
+static const DWORD OffsetSearchLength = 0x100000;
+
+struct OffsetSignature
+{
+	const char* name;
+	DWORD* value;
+	DWORD moduleBase;
+	DWORD searchStart;
+	const unsigned char* pattern;
+	const char* mask;
+};
+
+static std::string GetModuleBuild(DWORD moduleBase)
+{
+	if (moduleBase == 0)
+		return "0";
+
+	const IMAGE_DOS_HEADER* dosHeader = reinterpret_cast<const IMAGE_DOS_HEADER*>(moduleBase);
+	const IMAGE_NT_HEADERS* ntHeaders = reinterpret_cast<const IMAGE_NT_HEADERS*>(moduleBase + dosHeader->e_lfanew);
+
+	char build[32];
+	sprintf_s(build, "%08X%08X", ntHeaders->FileHeader.TimeDateStamp, ntHeaders->OptionalHeader.SizeOfImage);
+	return build;
+}
+
+static void LoadCachedOffsets(OffsetSignature* signatures, size_t count, const std::string& build)
+{
+	char szTemp[MAX_STRING] = { 0 };
+	GetPrivateProfileString(OffsetsSection, "Build", "", szTemp, MAX_STRING, INIFileName);
+	if (build != szTemp)
+		return;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		OffsetSignature& sig = signatures[i];
+
+		GetPrivateProfileString(OffsetsSection, sig.name, "", szTemp, MAX_STRING, INIFileName);
+		if (!szTemp[0])
+			continue;
+
+		DWORD address = sig.moduleBase + strtoul(szTemp, nullptr, 16);
+		if (MatchesPattern(address, sig.pattern, sig.mask))
+		{
+			*sig.value = address;
+		}
+	}
+}
+
+static void SaveCachedOffsets(const OffsetSignature* signatures, size_t count, const std::string& build)
+{
+	char szTemp[MAX_STRING] = { 0 };
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		const OffsetSignature& sig = signatures[i];
+
+		sprintf_s(szTemp, "%08X", *sig.value - sig.moduleBase);
+		WritePrivateProfileString(OffsetsSection, sig.name, szTemp, INIFileName);
+	}
+
+	WritePrivateProfileString(OffsetsSection, "Build", build.c_str(), INIFileName);
+}
+
 bool GetOffsets()
 {
-	if ((ZoneRender_InjectionOffset = FindPattern(FixEQGraphicsOffset(0x10000000), 0x100000,
-		ZoneRender_InjectionPattern, ZoneRender_InjectionMask)) == 0)
-		return false;
+	OffsetSignature signatures[] = {
+		{ "ZoneRender_InjectionOffset", &ZoneRender_InjectionOffset, EQGraphicsBaseAddress,
+			FixEQGraphicsOffset(0x10000000), ZoneRender_InjectionPattern, ZoneRender_InjectionMask },
+		{ "ProcessMouseEvent", &__ProcessMouseEvent, baseAddress,
+			FixOffset(0x500000), ProcessMouseEvent_Pattern, ProcessMouseEvent_Mask },
+		{ "ProcessKeyboardEvent", &__ProcessKeyboardEvent, baseAddress,
+			FixOffset(0x600000), ProcessKeyboardEvent_Pattern, ProcessKeyboardEvent_Mask },
+		{ "FlushDxKeyboard", &__FlushDxKeyboard, baseAddress,
+			FixOffset(0x600000), FlushDxKeyboard_Pattern, FlushDxKeyboard_Mask },
+		{ "WndProc", &__WndProc, baseAddress,
+			FixOffset(0x5A0000), WndProc_Pattern, WndProc_Mask },
+	};
+	const size_t count = _countof(signatures);
+
+	for (OffsetSignature& sig : signatures)
+		*sig.value = 0;
+
+	std::string build = GetModuleBuild(baseAddress) + "-" + GetModuleBuild(EQGraphicsBaseAddress);
+	LoadCachedOffsets(signatures, count, build);
+
+	// scan for the rest, everything starting at the same place in one pass
+	bool scanned = false;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (*signatures[i].value != 0)
+			continue;
+
+		DWORD searchStart = signatures[i].searchStart;
+		std::vector<PatternSearch> searches;
+		std::vector<OffsetSignature*> found;
+
+		for (size_t j = i; j < count; ++j)
+		{
+			if (*signatures[j].value == 0 && signatures[j].searchStart == searchStart)
+			{
+				searches.push_back({ signatures[j].pattern, signatures[j].mask, 0 });
+				found.push_back(&signatures[j]);
+			}
+		}
+
+		FindPatterns(searchStart, OffsetSearchLength, searches.data(), searches.size());
 
-	if ((__ProcessMouseEvent = FindPattern(FixOffset(0x500000), 0x100000,
-		ProcessMouseEvent_Pattern, ProcessMouseEvent_Mask)) == 0)
-		return false;
+		for (size_t j = 0; j < searches.size(); ++j)
+		{
+			if (searches[j].result == 0)
+				return false;
 
-	if ((__ProcessKeyboardEvent = FindPattern(FixOffset(0x600000), 0x100000,
-		ProcessKeyboardEvent_Pattern, ProcessKeyboardEvent_Mask)) == 0)
-		return false;
+			*found[j]->value = static_cast<DWORD>(searches[j].result);
+		}
 
-	if ((__FlushDxKeyboard = FindPattern(FixOffset(0x600000), 0x100000,
-		FlushDxKeyboard_Pattern, FlushDxKeyboard_Mask)) == 0)
-		return false;
+		scanned = true;
+	}
 
-	if ((__WndProc = FindPattern(FixOffset(0x5A0000), 0x100000,
-		WndProc_Pattern, WndProc_Mask)) == 0)
-		return false;
+	if (scanned)
+	{
+		SaveCachedOffsets(signatures, count, build);
+	}
 
 	return true;
 }
@@ -191,20 +299,11 @@ public:
 			}
 		}
 
-		// Perform the render within a stateblock so we don't upset the
-		// rest of the rendering pipeline
-		if (g_deviceAcquired)
+		// the render handler saves and restores the states it changes, so we
+		// don't upset the rest of the rendering pipeline
+		if (g_deviceAcquired && g_renderHandler)
 		{
-			IDirect3DStateBlock9* stateBlock = nullptr;
-			g_pDevice->CreateStateBlock(D3DSBT_ALL, &stateBlock);
-
-			if (g_renderHandler)
-			{
-				g_renderHandler->PerformRender(Renderable::Render_UI);
-			}
-
-			stateBlock->Apply();
-			stateBlock->Release();
+			g_renderHandler->PerformRender(Renderable::Render_UI);
 		}
 
 		return EndScene_Trampoline();
@@ -215,20 +314,9 @@ public:
 	void ZoneRender_Injection_Trampoline();
 	void ZoneRender_Injection_Detour()
 	{
-		// Perform the render within a stateblock so we don't upset the
-		// rest of the rendering pipeline
-		if (g_deviceAcquired)
+		if (g_deviceAcquired && g_renderHandler)
 		{
-			IDirect3DStateBlock9* stateBlock = nullptr;
-			g_pDevice->CreateStateBlock(D3DSBT_ALL, &stateBlock);
-
-			if (g_renderHandler)
-			{
-				g_renderHandler->PerformRender(Renderable::Render_Geometry);
-			}
-
-			stateBlock->Apply();
-			stateBlock->Release();
+			g_renderHandler->PerformRender(Renderable::Render_Geometry);
 		}
 
 		ZoneRender_Injection_Trampoline();
@@ -29,6 +29,39 @@ static inline void SaveBoolSetting(const std::string& name, bool value)
 	WritePrivateProfileString("Settings", name.c_str(), value ? "on" : "off", INIFileName);
 }
 
+static inline float LoadFloatSetting(const std::string& name, float default)
+{
+	char szTemp[MAX_STRING] = { 0 };
+	char szDefault[64] = { 0 };
+	sprintf_s(szDefault, "%.2f", default);
+
+	GetPrivateProfileString("Settings", name.c_str(), szDefault,
+		szTemp, MAX_STRING, INIFileName);
+	return static_cast<float>(atof(szTemp));
+}
+
+static inline void SaveFloatSetting(const std::string& name, float value)
+{
+	char szTemp[64] = { 0 };
+	sprintf_s(szTemp, "%.2f", value);
+
+	WritePrivateProfileString("Settings", name.c_str(), szTemp, INIFileName);
+}
+
+static inline std::string LoadStringSetting(const std::string& name, const std::string& default)
+{
+	char szTemp[MAX_STRING] = { 0 };
+
+	GetPrivateProfileString("Settings", name.c_str(), default.c_str(),
+		szTemp, MAX_STRING, INIFileName);
+	return szTemp;
+}
+
+static inline void SaveStringSetting(const std::string& name, const std::string& value)
+{
+	WritePrivateProfileString("Settings", name.c_str(), value.c_str(), INIFileName);
+}
+
 void LoadSettings(bool showMessage/* = true*/)
 {
 	if (showMessage)
@@ -43,8 +76,35 @@ void LoadSettings(bool showMessage/* = true*/)
 	settings.autoreload = LoadBoolSetting("AutoReload", defaults.autoreload);
 	settings.show_ui = LoadBoolSetting("ShowUI", defaults.show_ui);
 	settings.show_navmesh_overlay = LoadBoolSetting("ShowNavMesh", defaults.show_navmesh_overlay);
+	settings.navmesh_overlay_radius = LoadFloatSetting("NavMeshOverlayRadius", defaults.navmesh_overlay_radius);
+	settings.navmesh_overlay_lod = LoadBoolSetting("NavMeshOverlayLOD", defaults.navmesh_overlay_lod);
 	settings.show_nav_path = LoadBoolSetting("ShowNavPath", defaults.show_nav_path);
 	settings.attempt_unstuck = LoadBoolSetting("AttemptUnstuck", defaults.attempt_unstuck);
+	settings.tile_streaming = LoadBoolSetting("TileStreaming", defaults.tile_streaming);
+	settings.tile_streaming_radius = LoadFloatSetting("TileStreamingRadius", defaults.tile_streaming_radius);
+
+	settings.sliced_pathfinding = LoadBoolSetting("SlicedPathfinding", defaults.sliced_pathfinding);
+	settings.fast_path_search = LoadBoolSetting("FastPathSearch", defaults.fast_path_search);
+	settings.use_pathing_corridor = LoadBoolSetting("UsePathingCorridor", defaults.use_pathing_corridor);
+	settings.share_path_cache = LoadBoolSetting("SharePathCache", defaults.share_path_cache);
+	settings.local_avoidance = LoadBoolSetting("LocalAvoidance", defaults.local_avoidance);
+	settings.background_throttle = LoadBoolSetting("BackgroundThrottle", defaults.background_throttle);
+	settings.share_tile_data = LoadBoolSetting("ShareTileData", defaults.share_tile_data);
+	settings.simplify_detail_meshes = LoadBoolSetting("SimplifyDetailMeshes", defaults.simplify_detail_meshes);
+	settings.mesh_cache_size = LoadFloatSetting("MeshCacheSize", defaults.mesh_cache_size);
+	settings.preload_zones = LoadBoolSetting("PreloadZones", defaults.preload_zones);
+	settings.select_agent_profile = LoadBoolSetting("SelectAgentProfile", defaults.select_agent_profile);
+	settings.zone_in_budget = LoadFloatSetting("ZoneInBudget", defaults.zone_in_budget);
+	settings.zone_in_timings = LoadBoolSetting("ZoneInTimings", defaults.zone_in_timings);
+	settings.remote_mesh_directory = LoadStringSetting("RemoteMeshDirectory", defaults.remote_mesh_directory);
+	while (!settings.remote_mesh_directory.empty()
+		&& (settings.remote_mesh_directory.back() == '\\' || settings.remote_mesh_directory.back() == '/'))
+		settings.remote_mesh_directory.pop_back();
+	settings.avoid_water = LoadBoolSetting("AvoidWater", defaults.avoid_water);
+	settings.extra_clearance = LoadFloatSetting("ExtraClearance", defaults.extra_clearance);
+	settings.event_messages = LoadBoolSetting("EventMessages", defaults.event_messages);
+	settings.smooth_paths = LoadBoolSetting("SmoothPaths", defaults.smooth_paths);
+	settings.path_smoothing_budget = LoadFloatSetting("PathSmoothingBudget", defaults.path_smoothing_budget);
 
 	// debug settings
 	settings.debug_render_pathing = LoadBoolSetting("DebugRenderPathing", defaults.debug_render_pathing);
@@ -65,7 +125,30 @@ void SaveSettings(bool showMessage/* = true*/)
 	SaveBoolSetting("AutoReload", g_settings.autoreload);
 	SaveBoolSetting("ShowUI", g_settings.show_ui);
 	SaveBoolSetting("ShowNavMesh", g_settings.show_navmesh_overlay);
+	SaveFloatSetting("NavMeshOverlayRadius", g_settings.navmesh_overlay_radius);
+	SaveBoolSetting("NavMeshOverlayLOD", g_settings.navmesh_overlay_lod);
 	SaveBoolSetting("ShowNavPath", g_settings.show_nav_path);
+	SaveBoolSetting("TileStreaming", g_settings.tile_streaming);
+	SaveFloatSetting("TileStreamingRadius", g_settings.tile_streaming_radius);
+	SaveBoolSetting("SlicedPathfinding", g_settings.sliced_pathfinding);
+	SaveBoolSetting("FastPathSearch", g_settings.fast_path_search);
+	SaveBoolSetting("UsePathingCorridor", g_settings.use_pathing_corridor);
+	SaveBoolSetting("SharePathCache", g_settings.share_path_cache);
+	SaveBoolSetting("LocalAvoidance", g_settings.local_avoidance);
+	SaveBoolSetting("BackgroundThrottle", g_settings.background_throttle);
+	SaveBoolSetting("ShareTileData", g_settings.share_tile_data);
+	SaveBoolSetting("SimplifyDetailMeshes", g_settings.simplify_detail_meshes);
+	SaveFloatSetting("MeshCacheSize", g_settings.mesh_cache_size);
+	SaveBoolSetting("PreloadZones", g_settings.preload_zones);
+	SaveBoolSetting("SelectAgentProfile", g_settings.select_agent_profile);
+	SaveFloatSetting("ZoneInBudget", g_settings.zone_in_budget);
+	SaveBoolSetting("ZoneInTimings", g_settings.zone_in_timings);
+	SaveStringSetting("RemoteMeshDirectory", g_settings.remote_mesh_directory);
+	SaveBoolSetting("AvoidWater", g_settings.avoid_water);
+	SaveFloatSetting("ExtraClearance", g_settings.extra_clearance);
+	SaveBoolSetting("EventMessages", g_settings.event_messages);
+	SaveBoolSetting("SmoothPaths", g_settings.smooth_paths);
+	SaveFloatSetting("PathSmoothingBudget", g_settings.path_smoothing_budget);
 
 	// debug settings
 	SaveBoolSetting("DebugRenderPathing", g_settings.debug_render_pathing);
@@ -73,4 +156,22 @@ void SaveSettings(bool showMessage/* = true*/)
 
 //----------------------------------------------------------------------------
 
+std::vector<std::string> GetPreloadZones(const std::string& zoneShortName)
+{
+	char szTemp[MAX_STRING] = { 0 };
+	GetPrivateProfileString("PreloadZones", zoneShortName.c_str(), "",
+		szTemp, MAX_STRING, INIFileName);
+
+	std::vector<std::string> zones;
+	char* context = nullptr;
+	for (char* token = strtok_s(szTemp, ", ", &context); token; token = strtok_s(nullptr, ", ", &context))
+	{
+		zones.emplace_back(token);
+	}
+
+	return zones;
+}
+
+//----------------------------------------------------------------------------
+
 } // namespace mq2nav
@@ -6,6 +6,9 @@
 
 #include "MQ2Navigation.h"
 
+#include <string>
+#include <vector>
+
 namespace mq2nav {
 
 struct SettingsData
@@ -25,20 +28,95 @@ struct SettingsData
 	// show the navmesh overlay
 	bool show_navmesh_overlay = false;
 
+	// only draw navmesh overlay tiles within this distance of the player, 0 draws everything
+	float navmesh_overlay_radius = 0.0f;
+
+	// draw distant navmesh overlay tiles with less detail
+	bool navmesh_overlay_lod = true;
+
 	// show the current navigation path
 	bool show_nav_path = true;
 
 	// attempt to get unstuck
 	bool attempt_unstuck = false;
 
+	// only keep navmesh tiles near the player loaded
+	bool tile_streaming = false;
+
+	// distance around the player to keep tiles loaded when streaming
+	float tile_streaming_radius = 800.0f;
+
 	// render pathing 3d debugging
 	bool debug_render_pathing = false;
 
-	// use corridor method (buggy, not finished...)
-	bool debug_use_pathing_corridor = false;
+	// search for periodic path updates on the pathfinding worker thread
+	bool sliced_pathfinding = true;
+
+	// search with the plugin's own node table and open list instead of detour's
+	bool fast_path_search = true;
+
+	// follow paths using a path corridor, replanning only when it becomes invalid
+	bool use_pathing_corridor = false;
+
+	// share found paths with other clients on this machine using the same mesh
+	bool share_path_cache = false;
+
+	// steer around other clients on this machine in the same zone
+	bool local_avoidance = false;
+
+	// skip rendering and replan less often while the window isn't in the foreground
+	bool background_throttle = false;
+
+	// make paths go around water when they can
+	bool avoid_water = false;
+
+	// room to keep from walls past the agent radius the mesh was built for, for
+	// mounts and big races. Only meshes built with clearance flags have it.
+	float extra_clearance = 0.0f;
+
+	// write a line to chat for arrival, failure, stalls and the like, for macro #events
+	bool event_messages = false;
+
+	// remove path corners that can be walked past in a straight line
+	bool smooth_paths = false;
+
+	// time that smoothing may take per path, in microseconds
+	float path_smoothing_budget = 200.0f;
+
+	// decompress mesh tiles once into memory shared with other clients on this machine
+	bool share_tile_data = false;
+
+	// drop the detail meshes of tiles that aren't shared, to save memory
+	bool simplify_detail_meshes = false;
+
+	// megabytes of meshes from zones that were left to keep in memory, 0 to disable
+	float mesh_cache_size = 0.0f;
+
+	// load the meshes of zones listed in the PreloadZones section in the background
+	bool preload_zones = false;
+
+	// load the mesh built for the agent profile that fits the character's height
+	bool select_agent_profile = true;
+
+	// milliseconds of zone-in work that may be done on the main thread in one
+	// pulse, the rest waits for the next one. 0 to not hold it back.
+	float zone_in_budget = 8.0f;
+
+	// write how long each part of entering a zone took to chat
+	bool zone_in_timings = false;
+
+	// directory the meshes are published to, like a file share. Changed meshes
+	// are copied from it into the local mesh directory in the background. Empty
+	// to only use the local meshes.
+	std::string remote_mesh_directory;
 };
 SettingsData& GetSettings();
 
+// zones listed to preload for a zone in the ini, e.g.
+//   [PreloadZones]
+//   poknowledge=potranquility,guildlobby
+std::vector<std::string> GetPreloadZones(const std::string& zoneShortName);
+
 // Load settings from the .ini file
 void LoadSettings(bool showMessage = false);
 
@@ -5,23 +5,39 @@
 #include "MQ2Navigation.h"
 #include "NavigationPath.h"
 #include "NavigationType.h"
+#include "PerfStats.h"
 #include "RenderHandler.h"
 #include "ImGuiRenderer.h"
+#include "CurrentPathView.h"
+#include "DoorAreas.h"
 #include "KeybindHandler.h"
+#include "LocalAvoidance.h"
 #include "MQ2Nav_Hooks.h"
+#include "MeshSync.h"
 #include "NavMeshLoader.h"
 #include "ModelLoader.h"
 #include "NavMeshRenderer.h"
+#include "ObjectIndex.h"
+#include "SharedFlowField.h"
+#include "SharedLeaderPath.h"
+#include "SharedPathCache.h"
+#include "PathfindingWorker.h"
 #include "MQ2Nav_Util.h"
 #include "MQ2Nav_Settings.h"
 #include "UiController.h"
+#include "WaypointDistances.h"
 #include "Waypoints.h"
+#include "ZoneInTimeline.h"
 
 #include "common/NavMesh.h"
+#include "common/NavMeshTileCache.h"
+#include "common/Profiler.h"
 
 #include "DetourCommon.h"
 
+#include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
+#include <algorithm>
 #include <set>
 
 #pragma comment (lib, "d3d9.lib")
@@ -32,6 +48,16 @@
 std::unique_ptr<RenderHandler> g_renderHandler;
 std::unique_ptr<ImGuiRenderer> g_imguiRenderer;
 
+// added to the route for every zone line it goes through, for the time spent zoning
+static const float ZONE_ROUTE_ZONE_COST = 200.0f;
+
+// how long to wait at a zone line for the zone to change
+static const int ZONE_ROUTE_ZONING_TIMEOUT_MS = 10000;
+
+// slower than this, in units per second, counts as standing still for the
+// arrival estimate
+static const float ETA_MIN_SPEED = 1.0f;
+
 //============================================================================
 
 static void NavigateCommand(PSPAWNINFO pChar, PCHAR szLine)
@@ -122,17 +148,67 @@ void MQ2NavigationPlugin::Plugin_OnPulse()
 		return;
 	}
 
-	for (const auto& m : m_modules)
+	mq2nav::ScopedPerfTimer timer(mq2nav::PerfTimer::Pulse);
+	MQ2NAV_PROFILE_ZONE("Plugin_OnPulse");
+	PulseScheduler::clock::time_point pulseStart = PulseScheduler::clock::now();
+
+	UpdateBackgroundMode();
+
+	Get<ZoneInTimeline>()->BeginPulse();
+
+	// housekeeping waits until after movement, unless it can't
+	m_pulseScheduler.RunCritical();
+
+	mq2nav::CheckPendingWaypoints();
+
+	// run any navigation commands that were issued while the mesh was loading
+	if (!m_queuedCommands.empty() && !Get<NavMeshLoader>()->IsLoading())
 	{
-		m.second->OnPulse();
+		std::vector<std::string> commands;
+		commands.swap(m_queuedCommands);
+
+		for (std::string& command : commands)
+		{
+			Command_Navigate(GetCharInfo() ? GetCharInfo()->pSpawn : nullptr, &command[0]);
+		}
 	}
 
 	if (m_initialized && mq2nav::ValidIngame(TRUE))
 	{
+		// standing characters are in the way too, so everyone is published
+		PSPAWNINFO me = GetCharInfo()->pSpawn;
+		float pos[3] = { me->X, me->FloorHeight, me->Y };
+		Get<LocalAvoidance>()->UpdateAgent(me->SpawnID, pos);
+
+		UpdateZoneRoute();
+		UpdateStopRoute();
+		UpdateNavQueue();
 		AttemptMovement();
 		StuckCheck();
 		//AttemptClick();
+
+		if (m_trace.IsActive() && m_isActive)
+			m_trace.Add(MakeTraceRecord(NavTraceEvent::Pulse));
 	}
+
+	m_pulseScheduler.RunDeferred(pulseStart, PULSE_BUDGET_MS);
+}
+
+void MQ2NavigationPlugin::UpdateBackgroundMode()
+{
+	HWND eqHWnd = *(HWND*)EQADDR_HWND;
+	bool inBackground = mq2nav::GetSettings().background_throttle && GetForegroundWindow() != eqHWnd;
+
+	if (inBackground == m_inBackground)
+		return;
+
+	m_inBackground = inBackground;
+
+	if (g_renderHandler)
+		g_renderHandler->SetSuspended(m_inBackground);
+	if (g_imguiRenderer)
+		g_imguiRenderer->SetSuspended(m_inBackground);
+	Get<NavMeshRenderer>()->SetSuspended(m_inBackground);
 }
 
 void MQ2NavigationPlugin::Plugin_OnBeginZone()
@@ -142,10 +218,19 @@ void MQ2NavigationPlugin::Plugin_OnBeginZone()
 
 	UpdateCurrentZone();
 
+	// a trace only covers one zone
+	if (m_trace.IsActive())
+	{
+		m_trace.Stop();
+		WriteChatf(PLUGIN_MSG "Trace stopped: %s", m_trace.GetFilename().c_str());
+	}
+
 	// stop active path if one exists
+	NotifyNavigationEvent(NavigationEvent::Stopped);
 	m_isActive = false;
 	m_isPaused = false;
 	m_activePath.reset();
+	m_queuedCommands.clear();
 
 	for (const auto& m : m_modules)
 	{
@@ -190,6 +275,10 @@ void MQ2NavigationPlugin::Plugin_SetGameState(DWORD GameState)
 
 void MQ2NavigationPlugin::Plugin_OnAddGroundItem(PGROUNDITEM pGroundItem)
 {
+	if (!m_initialized)
+		return;
+
+	Get<ObjectIndex>()->AddGroundItem(pGroundItem);
 }
 
 void MQ2NavigationPlugin::Plugin_OnRemoveGroundItem(PGROUNDITEM pGroundItem)
@@ -199,6 +288,11 @@ void MQ2NavigationPlugin::Plugin_OnRemoveGroundItem(PGROUNDITEM pGroundItem)
 	{
 		m_pEndingItem = nullptr;
 	}
+
+	if (m_initialized)
+	{
+		Get<ObjectIndex>()->RemoveGroundItem(pGroundItem);
+	}
 }
 
 void MQ2NavigationPlugin::Plugin_Initialize()
@@ -219,12 +313,26 @@ void MQ2NavigationPlugin::Plugin_Initialize()
 	InitializeRenderer();
 
 	AddModule<KeybindHandler>();
+	AddModule<ZoneInTimeline>();
+
+	m_forwardCmd = FindMappableCommand("FORWARD");
+	m_jumpCmd = FindMappableCommand("JUMP");
 
 	NavMesh* mesh = AddModule<NavMesh>(m_context.get(),
 		GetDataDirectory());
 	AddModule<NavMeshLoader>(m_context.get(), mesh);
+	AddModule<MeshSync>(m_context.get(), mesh);
+	AddModule<SharedPathCache>(mesh);
+	AddModule<SharedFlowField>(mesh);
+	AddModule<SharedLeaderPath>(mesh);
+	AddModule<LocalAvoidance>(mesh);
+	AddModule<PathfindingWorker>(mesh);
+	AddModule<WaypointDistances>(mesh);
+	AddModule<CurrentPathView>();
 
 	AddModule<ModelLoader>();
+	AddModule<ObjectIndex>();
+	AddModule<DoorAreas>(mesh);
 	AddModule<NavMeshRenderer>();
 	AddModule<UiController>();
 
@@ -238,9 +346,31 @@ void MQ2NavigationPlugin::Plugin_Initialize()
 	m_keypressConn = keybindHandler->OnMovementKeyPressed.Connect(
 		[this]() { OnMovementKeyPressed(); });
 
+	m_stopRouteConn = OnNavigationEvent.Connect(
+		[this](uint32_t navigationId, NavigationEvent event) { OnStopRouteEvent(navigationId, event); });
+	m_navQueueConn = OnNavigationEvent.Connect(
+		[this](uint32_t navigationId, NavigationEvent event) { OnNavQueueEvent(navigationId, event); });
+
 	// initialize mesh loader's settings
 	auto meshLoader = Get<NavMeshLoader>();
 	meshLoader->SetAutoReload(mq2nav::GetSettings().autoreload);
+	meshLoader->SetMeshCacheSize(static_cast<size_t>(mq2nav::GetSettings().mesh_cache_size * 1024 * 1024));
+	meshLoader->SetPreloadZones(mq2nav::GetSettings().preload_zones);
+	meshLoader->SetSelectAgentProfile(mq2nav::GetSettings().select_agent_profile);
+
+	if (mq2nav::GetSettings().tile_streaming)
+	{
+		mesh->SetTileStreamingRadius(mq2nav::GetSettings().tile_streaming_radius);
+	}
+
+	Get<SharedPathCache>()->SetEnabled(mq2nav::GetSettings().share_path_cache);
+	Get<SharedFlowField>()->SetEnabled(mq2nav::GetSettings().share_path_cache);
+	Get<SharedLeaderPath>()->SetEnabled(mq2nav::GetSettings().share_path_cache);
+	Get<LocalAvoidance>()->SetEnabled(mq2nav::GetSettings().local_avoidance);
+	mesh->SetShareTileData(mq2nav::GetSettings().share_tile_data);
+	mesh->SetSimplifyDetailMeshes(mq2nav::GetSettings().simplify_detail_meshes);
+
+	MQ2NAV_PROFILE_REGISTER();
 
 	m_initialized = true;
 
@@ -263,6 +393,7 @@ void MQ2NavigationPlugin::Plugin_Shutdown()
 	ShutdownMQ2NavMacroData();
 
 	Stop();
+	m_trace.Stop();
 
 	// shut down all of the modules
 	for (const auto& m : m_modules)
@@ -271,10 +402,15 @@ void MQ2NavigationPlugin::Plugin_Shutdown()
 	}
 
 	// delete all of the modules
+	m_pulseScheduler.Clear();
 	m_modules.clear();
 
+	mq2nav::FlushWaypoints();
+
 	ShutdownRenderer();
 	ShutdownHooks();
+
+	MQ2NAV_PROFILE_UNREGISTER();
 	
 	m_initialized = false;
 }
@@ -310,6 +446,29 @@ void MQ2NavigationPlugin::ShutdownRenderer()
 
 //----------------------------------------------------------------------------
 
+// destinations separated by '|'. Returns false if any of them isn't valid, the
+// reason is written to chat.
+static bool ParseDestinationList(const std::string& line,
+	std::vector<std::shared_ptr<DestinationInfo>>& destinations)
+{
+	std::vector<std::string> parts;
+	boost::split(parts, line, boost::is_any_of("|"));
+
+	for (std::string& part : parts)
+	{
+		boost::trim(part);
+		if (part.empty())
+			continue;
+
+		auto dest = ParseDestination(part.c_str(), NotifyType::Errors);
+		if (!dest->valid)
+			return false;
+		destinations.push_back(dest);
+	}
+
+	return true;
+}
+
 void MQ2NavigationPlugin::Command_Navigate(PSPAWNINFO pChar, PCHAR szLine)
 {
 	CHAR buffer[MAX_STRING] = { 0 };
@@ -336,7 +495,7 @@ void MQ2NavigationPlugin::Command_Navigate(PSPAWNINFO pChar, PCHAR szLine)
 		if (m_isPaused)
 		{
 			WriteChatf(PLUGIN_MSG "Pausing Navigation");
-			MQ2Globals::ExecuteCmd(FindMappableCommand("FORWARD"), 0, 0);
+			MQ2Globals::ExecuteCmd(m_forwardCmd, 0, 0);
 		}
 		else
 			WriteChatf(PLUGIN_MSG "Resuming Navigation");
@@ -347,8 +506,13 @@ void MQ2NavigationPlugin::Command_Navigate(PSPAWNINFO pChar, PCHAR szLine)
 	// parse /nav stop
 	if (!_stricmp(buffer, "stop"))
 	{
-		if (m_isActive)
+		if (m_isActive || !m_zoneRoute.empty() || !m_stopRoute.empty() || !m_navQueue.empty())
+		{
+			StopZoneRoute();
+			StopStopRoute();
+			StopNavQueue();
 			Stop();
+		}
 		else
 			WriteChatf(PLUGIN_MSG "\arNo navigation path currently active");
 
@@ -358,6 +522,7 @@ void MQ2NavigationPlugin::Command_Navigate(PSPAWNINFO pChar, PCHAR szLine)
 	// parse /nav reload
 	if (!_stricmp(buffer, "reload"))
 	{
+		m_zoneGraphLoaded = false;
 		Get<NavMeshLoader>()->LoadNavMesh();
 		return;
 	}
@@ -401,6 +566,234 @@ void MQ2NavigationPlugin::Command_Navigate(PSPAWNINFO pChar, PCHAR szLine)
 		return;
 	}
 
+	// parse /nav perf
+	if (!_stricmp(buffer, "perf"))
+	{
+		GetArg(buffer, szLine, 2);
+		if (!_stricmp(buffer, "reset"))
+		{
+			mq2nav::ResetPerfCounters();
+			WriteChatf(PLUGIN_MSG "Timings reset");
+		}
+		else
+		{
+			mq2nav::DumpPerfStats();
+		}
+		return;
+	}
+
+	// parse /nav trace
+	if (!_stricmp(buffer, "trace"))
+	{
+		GetArg(buffer, szLine, 2);
+		if (!_stricmp(buffer, "stop"))
+		{
+			if (!m_trace.IsActive())
+			{
+				WriteChatf(PLUGIN_MSG "\arNo trace is being recorded");
+				return;
+			}
+
+			m_trace.Stop();
+			WriteChatf(PLUGIN_MSG "Trace saved: %s (%d records, %d dropped)", m_trace.GetFilename().c_str(),
+				m_trace.GetRecordCount(), m_trace.GetDroppedCount());
+		}
+		else if (!_stricmp(buffer, "start") || buffer[0] == 0)
+		{
+			NavMesh* navMesh = Get<NavMesh>();
+			if (navMesh->GetZoneName().empty())
+			{
+				WriteChatf(PLUGIN_MSG "\arNo zone to trace");
+				return;
+			}
+
+			SYSTEMTIME now;
+			GetLocalTime(&now);
+
+			char filename[MAX_PATH];
+			sprintf_s(filename, "%s\\%s-%04d%02d%02d-%02d%02d%02d%s", navMesh->GetNavMeshDirectory().c_str(),
+				navMesh->GetZoneName().c_str(), now.wYear, now.wMonth, now.wDay, now.wHour, now.wMinute,
+				now.wSecond, NAVTRACE_EXTENSION);
+
+			if (m_trace.Start(filename, navMesh->GetZoneName()))
+				WriteChatf(PLUGIN_MSG "Recording trace: %s", filename);
+			else
+				WriteChatf(PLUGIN_MSG "\arFailed to create trace file: %s", filename);
+		}
+		else
+		{
+			WriteChatf(PLUGIN_MSG "Usage: /nav trace [start | stop]");
+		}
+		return;
+	}
+
+	// parse /nav obstacle
+	if (!_stricmp(buffer, "obstacle"))
+	{
+		NavMeshTileCache* tileCache = Get<NavMesh>()->GetTileCache();
+		if (!tileCache)
+		{
+			WriteChatf(PLUGIN_MSG "\arThe current navmesh was not built with obstacle support");
+			return;
+		}
+
+		GetArg(buffer, szLine, 2);
+		if (!_stricmp(buffer, "add"))
+		{
+			CHAR radius[MAX_STRING] = { 0 }, height[MAX_STRING] = { 0 };
+			GetArg(radius, szLine, 3);
+			GetArg(height, szLine, 4);
+
+			PSPAWNINFO me = GetCharInfo() ? GetCharInfo()->pSpawn : nullptr;
+			if (!me || !radius[0])
+			{
+				WriteChatf(PLUGIN_MSG "Usage: /nav obstacle add <radius> [height]");
+				return;
+			}
+
+			float r = (float)atof(radius);
+			float h = height[0] ? (float)atof(height) : 10.0f;
+
+			// cylinders are placed by their base
+			glm::vec3 pos = { me->X, me->FloorHeight, me->Y };
+
+			if (dtObstacleRef ref = tileCache->AddCylinderObstacle(pos, r, h))
+				WriteChatf(PLUGIN_MSG "Added obstacle \ag%u\ax at %.2f %.2f %.2f", ref, me->Y, me->X, me->Z);
+			else
+				WriteChatf(PLUGIN_MSG "\arFailed to add obstacle");
+		}
+		else if (!_stricmp(buffer, "remove"))
+		{
+			GetArg(buffer, szLine, 3);
+			dtObstacleRef ref = (dtObstacleRef)strtoul(buffer, nullptr, 10);
+
+			if (tileCache->RemoveObstacle(ref))
+				WriteChatf(PLUGIN_MSG "Removed obstacle \ag%u\ax", ref);
+			else
+				WriteChatf(PLUGIN_MSG "\arNo obstacle with id %u", ref);
+		}
+		else if (!_stricmp(buffer, "clear"))
+		{
+			tileCache->RemoveAllObstacles();
+			WriteChatf(PLUGIN_MSG "Removed all obstacles");
+		}
+		else
+		{
+			WriteChatf(PLUGIN_MSG "%d obstacles:", (int)tileCache->GetObstacles().size());
+			for (dtObstacleRef ref : tileCache->GetObstacles())
+				WriteChatf(PLUGIN_MSG "  \ag%u\ax", ref);
+		}
+		return;
+	}
+
+	// parse /nav hazard
+	if (!_stricmp(buffer, "hazard"))
+	{
+		auto navMesh = Get<NavMesh>();
+
+		GetArg(buffer, szLine, 2);
+		if (!_stricmp(buffer, "add"))
+		{
+			CHAR radius[MAX_STRING] = { 0 }, areaName[MAX_STRING] = { 0 };
+			GetArg(radius, szLine, 3);
+			GetArg(areaName, szLine, 4);
+
+			PSPAWNINFO me = GetCharInfo() ? GetCharInfo()->pSpawn : nullptr;
+			if (!me || !radius[0])
+			{
+				WriteChatf(PLUGIN_MSG "Usage: /nav hazard add <radius> [area]");
+				return;
+			}
+
+			// not walkable unless another area is given
+			const PolyAreaType* area = areaName[0] ? navMesh->FindPolyArea(areaName)
+				: &navMesh->GetPolyArea((uint8_t)PolyArea::Unwalkable);
+			if (!area)
+			{
+				WriteChatf(PLUGIN_MSG "\arNo area named %s", areaName);
+				return;
+			}
+
+			float r = (float)atof(radius);
+			glm::vec3 pos = { me->X, me->FloorHeight, me->Y };
+
+			// an octagon around us, from a bit below our feet to above our head
+			std::vector<glm::vec3> verts;
+			for (int i = 0; i < 8; ++i)
+			{
+				float angle = DT_PI * 2 * i / 8;
+				verts.push_back(pos + glm::vec3(cosf(angle) * r, 0, sinf(angle) * r));
+			}
+
+			if (uint32_t id = navMesh->AddRuntimeVolume(verts, pos.y - 5.0f, pos.y + me->AvatarHeight + 5.0f, area->id))
+				WriteChatf(PLUGIN_MSG "Added hazard \ag%u\ax (%s) at %.2f %.2f %.2f", id, area->name.c_str(), me->Y, me->X, me->Z);
+			else
+				WriteChatf(PLUGIN_MSG "\arNo navmesh under the hazard");
+		}
+		else if (!_stricmp(buffer, "remove"))
+		{
+			GetArg(buffer, szLine, 3);
+			uint32_t id = strtoul(buffer, nullptr, 10);
+
+			if (navMesh->RemoveRuntimeVolume(id))
+				WriteChatf(PLUGIN_MSG "Removed hazard \ag%u\ax", id);
+			else
+				WriteChatf(PLUGIN_MSG "\arNo hazard with id %u", id);
+		}
+		else if (!_stricmp(buffer, "clear"))
+		{
+			navMesh->ClearRuntimeVolumes();
+			WriteChatf(PLUGIN_MSG "Removed all hazards");
+		}
+		else
+		{
+			std::vector<uint32_t> ids = navMesh->GetRuntimeVolumeIds();
+			WriteChatf(PLUGIN_MSG "%d hazards:", (int)ids.size());
+			for (uint32_t id : ids)
+				WriteChatf(PLUGIN_MSG "  \ag%u\ax", id);
+		}
+		return;
+	}
+
+	// parse /nav raycast <destination>
+	if (!_stricmp(buffer, "raycast"))
+	{
+		auto dest = ParseDestination(GetNextArg(szLine), NotifyType::Errors);
+		if (!dest->valid)
+			return;
+
+		std::vector<glm::vec3> hits;
+		if (RaycastDestinations({ dest }, &hits)[0])
+			WriteChatf(PLUGIN_MSG "\agClear\ax walkable line to %.2f %.2f %.2f", hits[0].y, hits[0].x, hits[0].z);
+		else
+			WriteChatf(PLUGIN_MSG "\arBlocked\ax at %.2f %.2f %.2f", hits[0].y, hits[0].x, hits[0].z);
+		return;
+	}
+
+	// parse /nav area <id | name> [on | off]
+	if (!_stricmp(buffer, "area"))
+	{
+		auto navMesh = Get<NavMesh>();
+
+		GetArg(buffer, szLine, 2);
+		const PolyAreaType* area = navMesh->FindPolyArea(buffer);
+		if (!area)
+		{
+			WriteChatf(PLUGIN_MSG "Usage: /nav area <id | name> [on | off]");
+			return;
+		}
+
+		GetArg(buffer, szLine, 3);
+		if (!_stricmp(buffer, "on"))
+			navMesh->SetAreaEnabled(area->id, true);
+		else if (!_stricmp(buffer, "off"))
+			navMesh->SetAreaEnabled(area->id, false);
+
+		WriteChatf(PLUGIN_MSG "Area \ag%d\ax (%s) is %s", area->id, area->name.c_str(),
+			navMesh->IsAreaEnabled(area->id) ? "\agon\ax" : "\aroff\ax");
+		return;
+	}
+
 	// parse /nav help
 	if (!_stricmp(buffer, "help"))
 	{
@@ -408,26 +801,111 @@ void MQ2NavigationPlugin::Command_Navigate(PSPAWNINFO pChar, PCHAR szLine)
 		WriteChatf(PLUGIN_MSG "\ag/nav [save | load]\ax - save/load settings");
 		WriteChatf(PLUGIN_MSG "\ag/nav reload\ax - reload navmesh");
 		WriteChatf(PLUGIN_MSG "\ag/nav recordwaypoint <waypoint name> <waypoint tag>\ax - create a waypoint");
+		WriteChatf(PLUGIN_MSG "\ag/nav perf [reset]\ax - show (or reset) plugin timings");
+		WriteChatf(PLUGIN_MSG "\ag/nav trace [start | stop]\ax - record a trace of navigation for replaying with meshgen --pathbench");
+		WriteChatf(PLUGIN_MSG "\ag/nav obstacle [add <radius> [height] | remove <id> | clear]\ax - block the mesh at your location");
+		WriteChatf(PLUGIN_MSG "\ag/nav raycast <destination>\ax - check for walkable ground in a straight line to a destination");
+		WriteChatf(PLUGIN_MSG "\ag/nav hazard [add <radius> [area] | remove <id> | clear]\ax - paint an area onto the mesh around you, not walkable by default");
+		WriteChatf(PLUGIN_MSG "\ag/nav area <id | name> [on | off]\ax - switch an area of the mesh off or back on");
 
 		WriteChatf(PLUGIN_MSG "\aoNavigation Options:\ax");
 		WriteChatf(PLUGIN_MSG "\ag/nav target\ax - navigate to target");
 		WriteChatf(PLUGIN_MSG "\ag/nav id #\ax - navigate to target with ID = #");
 		WriteChatf(PLUGIN_MSG "\ag/nav loc[yxz] Y X Z\ax - navigate to coordinates");
 		WriteChatf(PLUGIN_MSG "\ag/nav locxyz X Y Z\ax - navigate to coordinates");
-		WriteChatf(PLUGIN_MSG "\ag/nav item [click]\ax - navigate to item (and click it)");
+		WriteChatf(PLUGIN_MSG "\ag/nav item [nearest | item_name] [click]\ax - navigate to item (and click it)");
 		WriteChatf(PLUGIN_MSG "\ag/nav door [item_name | id #] [click]\ax - navigate to door/object (and click it)");
 		WriteChatf(PLUGIN_MSG "\ag/nav spawn <spawn search>\ax - navigate to spawn via spawn search query");
 		WriteChatf(PLUGIN_MSG "\ag/nav waypoint|wp <waypoint>\ax - navigate to waypoint");
+		WriteChatf(PLUGIN_MSG "\ag/nav zone <zone short name>\ax - navigate to another zone through its zone lines");
+		WriteChatf(PLUGIN_MSG "\ag/nav stops <destination> | <destination> ...\ax - visit every destination, in the order with the shortest way between them");
+		WriteChatf(PLUGIN_MSG "\ag/nav queue [<destination> | <destination> ... | clear]\ax - visit destinations in the order they were queued, without stopping between them");
+		WriteChatf(PLUGIN_MSG "\ag/nav field <destination>\ax - navigate to any of the above, sharing one search with everyone headed there");
+		WriteChatf(PLUGIN_MSG "\ag/nav formation [offset] <spawn>\ax - follow a spawn along the path it is navigating, offset units behind it");
+		WriteChatf(PLUGIN_MSG "\ag/nav clearance <distance> <destination>\ax - navigate keeping that much further from walls than the mesh was built for");
 		WriteChatf(PLUGIN_MSG "\ag/nav stop\ax - stop navigation");
 		WriteChatf(PLUGIN_MSG "\ag/nav pause\ax - pause navigation");
 		return;
 	}
 	
+	// the mesh is still loading, hold on to the command until it's ready
+	if (Get<NavMeshLoader>()->IsLoading())
+	{
+		WriteChatf(PLUGIN_MSG "Navmesh is still loading, command will run when it's ready.");
+		m_queuedCommands.push_back(szLine);
+		return;
+	}
+
+	// parse /nav zone <shortname>
+	if (!_stricmp(buffer, "zone"))
+	{
+		GetArg(buffer, szLine, 2);
+		if (!buffer[0])
+		{
+			WriteChatf(PLUGIN_MSG "Usage: /nav zone <zone short name>");
+			return;
+		}
+
+		BeginZoneRoute(buffer);
+		return;
+	}
+
+	// parse /nav stops <destination> | <destination> ...
+	if (!_stricmp(buffer, "stops"))
+	{
+		std::vector<std::shared_ptr<DestinationInfo>> stops;
+		if (!ParseDestinationList(GetNextArg(szLine), stops))
+			return;
+
+		if (stops.empty())
+		{
+			WriteChatf(PLUGIN_MSG "Usage: /nav stops <destination> | <destination> ...");
+			return;
+		}
+
+		BeginStopRoute(stops);
+		return;
+	}
+
+	// parse /nav queue [<destination> | <destination> ... | clear]
+	if (!_stricmp(buffer, "queue"))
+	{
+		GetArg(buffer, szLine, 2);
+		if (!_stricmp(buffer, "clear"))
+		{
+			WriteChatf(PLUGIN_MSG "Cleared %d queued destinations", (int)m_navQueue.size());
+			if (m_navQueuePrefetch)
+				m_navQueuePrefetch->Cancel();
+
+			m_navQueue.clear();
+			m_navQueuePrefetch.reset();
+			m_navQueuePrefetchDest.reset();
+			return;
+		}
+
+		std::vector<std::shared_ptr<DestinationInfo>> destinations;
+		if (!ParseDestinationList(GetNextArg(szLine), destinations))
+			return;
+
+		if (destinations.empty())
+		{
+			if (m_navQueue.empty())
+				WriteChatf(PLUGIN_MSG "Usage: /nav queue [<destination> | <destination> ... | clear]");
+			else
+				WriteChatf(PLUGIN_MSG "%d destinations queued", (int)m_navQueue.size());
+			return;
+		}
+
+		QueueNavigation(destinations);
+		return;
+	}
+
 	// all thats left is a navigation command. leave if it isn't a valid one.
 	auto destination = ParseDestination(szLine, NotifyType::All);
 	if (!destination->valid)
 		return;
 
+	StopZoneRoute();
 	BeginNavigation(destination);
 }
 
@@ -457,6 +935,12 @@ void MQ2NavigationPlugin::UpdateCurrentZone()
 		else
 			DebugSpewAlways("Switching to zone: %d", m_zoneId);
 
+		m_pathQueries.clear();
+
+		// everything from here on is part of entering the zone
+		PCHAR zoneName = m_zoneId != -1 ? GetShortZone(m_zoneId) : nullptr;
+		Get<ZoneInTimeline>()->Begin(zoneName ? zoneName : "");
+
 		mq2nav::LoadWaypoints(m_zoneId);
 
 		for (const auto& m : m_modules)
@@ -466,11 +950,14 @@ void MQ2NavigationPlugin::UpdateCurrentZone()
 	}
 }
 
-void MQ2NavigationPlugin::BeginNavigation(const std::shared_ptr<DestinationInfo>& destInfo)
+void MQ2NavigationPlugin::BeginNavigation(const std::shared_ptr<DestinationInfo>& destInfo,
+	const std::shared_ptr<PathJob>& prefetched)
 {
 	assert(destInfo);
 
 	// first clear existing state
+	bool replacing = m_navigationId != 0;
+	NotifyNavigationEvent(NavigationEvent::Stopped);
 	m_isActive = false;
 	m_isPaused = false;
 	m_pEndingDoor = nullptr;
@@ -493,6 +980,8 @@ void MQ2NavigationPlugin::BeginNavigation(const std::shared_ptr<DestinationInfo>
 	}
 
 	m_activePath = std::make_shared<NavigationPath>(destInfo);
+	m_activePath->SetPublishPath(true);
+	m_activePath->SetPrefetchedPath(prefetched);
 	if (m_activePath->FindPath())
 	{
 		m_activePath->SetShowNavigationPaths(true);
@@ -501,8 +990,42 @@ void MQ2NavigationPlugin::BeginNavigation(const std::shared_ptr<DestinationInfo>
 
 	if (m_isActive)
 	{
+		m_navigationId = m_nextNavigationId++;
 		EzCommand("/squelch /stick off");
+
+		if (replacing)
+			NotifyNavigationEvent(NavigationEvent::DestinationChanged);
+	}
+}
+
+const char* GetNavigationEventName(NavigationEvent event)
+{
+	switch (event)
+	{
+	case NavigationEvent::Arrived: return "Arrived";
+	case NavigationEvent::Stopped: return "Stopped";
+	case NavigationEvent::Failed: return "Failed";
+	case NavigationEvent::Stuck: return "Stuck";
+	case NavigationEvent::DestinationChanged: return "DestinationChanged";
 	}
+
+	return "Unknown";
+}
+
+void MQ2NavigationPlugin::NotifyNavigationEvent(NavigationEvent event)
+{
+	if (m_navigationId == 0)
+		return;
+
+	uint32_t navigationId = m_navigationId;
+	if (IsFinishedEvent(event))
+		m_navigationId = 0;
+
+	// plain text, so that macros can match it with #event "[MQ2Nav] Event Arrived#*#"
+	if (mq2nav::GetSettings().event_messages)
+		WriteChatf("[MQ2Nav] Event %s %u", GetNavigationEventName(event), navigationId);
+
+	OnNavigationEvent(navigationId, event);
 }
 
 bool MQ2NavigationPlugin::IsMeshLoaded() const
@@ -516,6 +1039,7 @@ void MQ2NavigationPlugin::OnMovementKeyPressed()
 	{
 		if (mq2nav::GetSettings().autobreak)
 		{
+			StopZoneRoute();
 			Stop();
 		}
 		else if (mq2nav::GetSettings().autopause)
@@ -557,22 +1081,10 @@ bool MQ2NavigationPlugin::ClickNearestClosedDoor(float cDistance)
 {
 	if (!ppSwitchMgr || !pSwitchMgr) return false;
 
-	PDOORTABLE pDoorTable = (PDOORTABLE)pSwitchMgr;
-	PDOOR pDoor = NULL;
 	PSPAWNINFO pChar = GetCharInfo()->pSpawn;
+	PDOOR pDoor = Get<ObjectIndex>()->FindNearestDoor(glm::vec3(pChar->X, pChar->Y, pChar->Z),
+		cDistance, nullptr, gZFilter, false);
 
-	for (DWORD index = 0; index < pDoorTable->NumEntries; index++)
-	{
-		if (pDoorTable->pDoor[index]->Z <= pChar->Z + gZFilter &&
-			pDoorTable->pDoor[index]->Z >= pChar->Z - gZFilter)
-		{
-			FLOAT Distance = GetDistance(pDoorTable->pDoor[index]->X, pDoorTable->pDoor[index]->Y);
-			if (Distance < cDistance) {
-				pDoor = pDoorTable->pDoor[index];
-				cDistance = Distance;
-			}
-		}
-	}
 	if (pDoor) {
 		ClickDoor(pDoor);
 		return true;
@@ -580,70 +1092,171 @@ bool MQ2NavigationPlugin::ClickNearestClosedDoor(float cDistance)
 	return false;
 }
 
-void MQ2NavigationPlugin::StuckCheck()
+void MQ2NavigationPlugin::OpenDoorsAhead()
 {
 	if (m_isPaused)
 		return;
 
-	if (!mq2nav::GetSettings().attempt_unstuck)
+	clock::time_point now = clock::now();
+	if (now < m_doorCheckTime + std::chrono::milliseconds(DOOR_CHECK_INTERVAL_MS))
 		return;
+	m_doorCheckTime = now;
 
-	clock::time_point now = clock::now();
+	PSPAWNINFO me = GetCharInfo()->pSpawn;
+	glm::vec3 pos(me->X, me->FloorHeight, me->Y);
 
-	// check every 100 ms
-	if (now > m_stuckTimer + std::chrono::milliseconds(100))
-	{
-		m_stuckTimer = now;
-		if (GetCharInfo())
-		{
-			if (GetCharInfo()->pSpawn->SpeedMultiplier != -10000
-				&& FindSpeed(GetCharInfo()->pSpawn)
-				&& (GetDistance(m_stuckX, m_stuckY) < FindSpeed(GetCharInfo()->pSpawn) / 600)
-				&& !ClickNearestClosedDoor(25)
-				&& !GetCharInfo()->pSpawn->mPlayerPhysicsClient.Levitate
-				&& !GetCharInfo()->pSpawn->UnderWater
-				&& !GetCharInfo()->Stunned
-				&& m_isActive)
-			{
-				int jumpCmd = FindMappableCommand("JUMP");
-				MQ2Globals::ExecuteCmd(jumpCmd, 1, 0);
-				MQ2Globals::ExecuteCmd(jumpCmd, 0, 0);
-			}
+	glm::vec3 doorPos;
+	if (!m_activePath->FindAreaAhead(static_cast<uint8_t>(PolyArea::Door), pos, DOOR_OPEN_DISTANCE, doorPos))
+		return;
 
-			m_stuckX = GetCharInfo()->pSpawn->X;
-			m_stuckY = GetCharInfo()->pSpawn->Y;
-		}
-	}
-}
+	PDOOR door = Get<DoorAreas>()->FindClosedDoor(glm::vec3(doorPos.x, doorPos.z, doorPos.y));
+	if (!door)
+		return;
 
-static glm::vec3 s_lastFace;
+	if (door->ID == m_doorClickId && now < m_doorClickTime + std::chrono::milliseconds(DOOR_RETRY_MS))
+		return;
 
-void MQ2NavigationPlugin::LookAt(const glm::vec3& pos)
+	ClickDoor(door);
+
+	m_doorClickId = door->ID;
+	m_doorClickTime = now;
+}
+
+void MQ2NavigationPlugin::StuckCheck()
 {
 	if (m_isPaused)
 		return;
 
-	PSPAWNINFO pSpawn = GetCharInfo()->pSpawn;
-	
-	gFaceAngle = (atan2(pos.x - pSpawn->X, pos.y - pSpawn->Y)  * 256.0f / PI);
-	if (gFaceAngle >= 512.0f) gFaceAngle -= 512.0f;
-	if (gFaceAngle<0.0f) gFaceAngle += 512.0f;
-	((PSPAWNINFO)pCharSpawn)->Heading = (FLOAT)gFaceAngle;
+	clock::time_point now = clock::now();
+	if (now < m_stuckTimer + std::chrono::milliseconds(STUCK_CHECK_INTERVAL_MS))
+		return;
+	m_stuckTimer = now;
+
+	PCHARINFO pChar = GetCharInfo();
+	PSPAWNINFO me = pChar ? pChar->pSpawn : nullptr;
+
+	// only walking along a path can stall
+	if (!me || !m_isActive || !m_activePath || m_activePath->IsAtEnd()
+		|| me->SpeedMultiplier == -10000
+		|| !FindSpeed(me)
+		|| me->mPlayerPhysicsClient.Levitate
+		|| me->UnderWater
+		|| pChar->Stunned)
+	{
+		m_progressTime = now;
+		m_progressDistance = FLT_MAX;
+		return;
+	}
 
-	// This is a sentinel value telling MQ2 to not adjust the face angle
-	gFaceAngle = 10000.0f;
+	glm::vec3 pos(me->X, me->Y, me->Z);
+	if (m_stallCount > 0 && glm::distance(pos, m_stallPos) > STUCK_RECOVERED_DISTANCE)
+		m_stallCount = 0;
 
-	s_lastFace = pos;
+	// progress is getting closer to the next waypoint, or moving on to another one
+	glm::vec3 waypoint = m_activePath->GetNextPosition();
+	float distance = GetDistance(waypoint.x, waypoint.z);
 
-	if (pSpawn->UnderWater == 5 || pSpawn->FeetWet == 5)
+	if (waypoint != m_progressWaypoint || distance < m_progressDistance - STUCK_PROGRESS_DISTANCE)
 	{
-		FLOAT distance = (FLOAT)GetDistance(pSpawn->X, pSpawn->Y, pos.x, pos.y);
-		pSpawn->CameraAngle = (FLOAT)(atan2(pos.z - pSpawn->FloorHeight, distance) * 256.0f / PI);
+		m_progressWaypoint = waypoint;
+		m_progressDistance = distance;
+		m_progressTime = now;
+		return;
 	}
-	else if (pSpawn->mPlayerPhysicsClient.Levitate == 2)
+
+	if (now - m_progressTime < std::chrono::milliseconds(STUCK_PROGRESS_WINDOW_MS))
+		return;
+
+	m_progressTime = now;
+	m_progressDistance = distance;
+	m_stallPos = pos;
+
+	// fix the path locally if the mesh can tell what's wrong, the obstacle isn't
+	// on the mesh otherwise: a door, or something to jump over.
+	NavigationPath::StallRecovery recovery = m_activePath->RecoverFromStall(m_stallCount++);
+	NotifyNavigationEvent(NavigationEvent::Stuck);
+	NavSpew(MQ2NAV_SPEW_MOVEMENT, "[MQ2Nav] Stalled at %.2f %.2f %.2f, recovery %d",
+		pos.y, pos.x, pos.z, static_cast<int>(recovery));
+
+	if (m_trace.IsActive())
 	{
-		if (pos.z < pSpawn->FloorHeight)
-			pSpawn->CameraAngle = -45.0f;
+		NavTraceRecord record = MakeTraceRecord(NavTraceEvent::Stuck);
+		record.pathSize = static_cast<uint16_t>(m_stallCount);
+		record.recovery = static_cast<uint16_t>(recovery);
+		m_trace.Add(record);
+	}
+
+	if (recovery == NavigationPath::StallRecovery::None || recovery == NavigationPath::StallRecovery::Replan)
+	{
+		if (mq2nav::GetSettings().attempt_unstuck && !ClickNearestClosedDoor(25))
+		{
+			MQ2Globals::ExecuteCmd(m_jumpCmd, 1, 0);
+			MQ2Globals::ExecuteCmd(m_jumpCmd, 0, 0);
+		}
+	}
+}
+
+NavTraceRecord MQ2NavigationPlugin::MakeTraceRecord(NavTraceEvent event) const
+{
+	NavTraceRecord record;
+	record.event = event;
+
+	if (PSPAWNINFO me = GetCharInfo() ? GetCharInfo()->pSpawn : nullptr)
+	{
+		record.pos[0] = me->X;
+		record.pos[1] = me->FloorHeight;
+		record.pos[2] = me->Y;
+	}
+
+	if (m_activePath)
+	{
+		glm::vec3 dest = m_activePath->GetDestination();
+		record.dest[0] = dest.x;
+		record.dest[1] = dest.z;
+		record.dest[2] = dest.y;
+
+		if (const dtQueryFilter* filter = m_activePath->GetFilter())
+		{
+			record.includeFlags = filter->getIncludeFlags();
+			record.excludeFlags = filter->getExcludeFlags();
+		}
+	}
+
+	return record;
+}
+
+static glm::vec3 s_lastFace;
+
+void MQ2NavigationPlugin::LookAt(const glm::vec3& pos)
+{
+	if (m_isPaused)
+		return;
+
+	PSPAWNINFO pSpawn = GetCharInfo()->pSpawn;
+	
+	gFaceAngle = (atan2(pos.x - pSpawn->X, pos.y - pSpawn->Y)  * 256.0f / PI);
+	if (gFaceAngle >= 512.0f) gFaceAngle -= 512.0f;
+	if (gFaceAngle<0.0f) gFaceAngle += 512.0f;
+
+	// small corrections aren't worth turning for, they come out as jitter
+	float headingDelta = fabsf(static_cast<float>(gFaceAngle) - ((PSPAWNINFO)pCharSpawn)->Heading);
+	if (std::min(headingDelta, 512.0f - headingDelta) > STEER_HEADING_THRESHOLD)
+		((PSPAWNINFO)pCharSpawn)->Heading = (FLOAT)gFaceAngle;
+
+	// This is a sentinel value telling MQ2 to not adjust the face angle
+	gFaceAngle = 10000.0f;
+
+	s_lastFace = pos;
+
+	if (pSpawn->UnderWater == 5 || pSpawn->FeetWet == 5)
+	{
+		FLOAT distance = (FLOAT)GetDistance(pSpawn->X, pSpawn->Y, pos.x, pos.y);
+		pSpawn->CameraAngle = (FLOAT)(atan2(pos.z - pSpawn->FloorHeight, distance) * 256.0f / PI);
+	}
+	else if (pSpawn->mPlayerPhysicsClient.Levitate == 2)
+	{
+		if (pos.z < pSpawn->FloorHeight)
+			pSpawn->CameraAngle = -45.0f;
 		else if (pos.z > pSpawn->Z + 5)
 			pSpawn->CameraAngle = 45.0f;
 		else
@@ -658,17 +1271,44 @@ void MQ2NavigationPlugin::LookAt(const glm::vec3& pos)
 
 void MQ2NavigationPlugin::AttemptMovement()
 {
+	mq2nav::ScopedPerfTimer timer(mq2nav::PerfTimer::AttemptMovement);
+
 	if (m_isActive)
 	{
 		clock::time_point now = clock::now();
 
-		if (now - m_pathfindTimer > std::chrono::milliseconds(PATHFINDING_DELAY_MS))
+		// continue any path search that is in progress
+		m_activePath->UpdateIncrementalPath();
+
+		// follow spawns as they move
+		m_activePath->UpdateTargetPosition();
+
+		// the current path is kept until something it depends on changes
+		if (m_activePath->IsUsingCorridor()
+			|| (now - m_pathfindTimer > std::chrono::milliseconds(
+					m_inBackground ? BACKGROUND_PATHFINDING_DELAY_MS : PATHFINDING_DELAY_MS)
+				&& m_activePath->ShouldReplan()))
 		{
 			//WriteChatf(PLUGIN_MSG "Recomputing Path...");
 
 			// update path
+			clock::time_point replanStart = clock::now();
 			m_activePath->UpdatePath();
 			m_isActive = m_activePath->GetPathSize() > 0;
+			if (!m_isActive)
+				NotifyNavigationEvent(NavigationEvent::Failed);
+
+			if (m_trace.IsActive())
+			{
+				NavTraceRecord record = MakeTraceRecord(NavTraceEvent::Replan);
+				record.queryMs = std::chrono::duration<float, std::milli>(clock::now() - replanStart).count();
+				record.pathSize = static_cast<uint16_t>(std::min(m_activePath->GetPathSize(), 0xffff));
+				if (m_activePath->GetPathSize() > 0)
+					record.flags |= NAVTRACE_FOUND;
+				if (m_activePath->IsSearching())
+					record.flags |= NAVTRACE_INCREMENTAL;
+				m_trace.Add(record);
+			}
 
 			m_pathfindTimer = now;
 		}
@@ -680,6 +1320,15 @@ void MQ2NavigationPlugin::AttemptMovement()
 	const glm::vec3& dest = m_activePath->GetDestination();
 	float distanceToTarget = GetDistance(dest.x, dest.y);
 
+	// followers in formation hold their place behind the leader instead of arriving
+	std::shared_ptr<DestinationInfo> destInfo = m_activePath->GetDestinationInfo();
+	if (destInfo->formation && (m_activePath->IsAtEnd() || distanceToTarget <= destInfo->formationOffset))
+	{
+		if (GetCharInfo()->pSpawn->SpeedRun)
+			MQ2Globals::ExecuteCmd(m_forwardCmd, 0, 0);
+		return;
+	}
+
 	if (m_activePath->IsAtEnd())
 	{
 		WriteChatf(PLUGIN_MSG "\agReached destination at: %.2f %.2f %.2f",
@@ -692,14 +1341,19 @@ void MQ2NavigationPlugin::AttemptMovement()
 			AttemptClick();
 		}
 
-		Stop();
+		uint32_t arrivedId = m_navigationId;
+		NotifyNavigationEvent(NavigationEvent::Arrived);
+
+		// the next queued destination takes over without letting go of the keys
+		if (!ContinueNavQueue(arrivedId))
+			Stop();
 	}
 	else if (m_activePath->GetPathSize() > 0)
 	{
 		if (!m_isPaused)
 		{
 			if (!GetCharInfo()->pSpawn->SpeedRun)
-				MQ2Globals::ExecuteCmd(FindMappableCommand("FORWARD"), 1, 0);
+				MQ2Globals::ExecuteCmd(m_forwardCmd, 1, 0);
 		}
 
 		glm::vec3 nextPosition = m_activePath->GetNextPosition();
@@ -712,22 +1366,83 @@ void MQ2NavigationPlugin::AttemptMovement()
 
 			if (!m_activePath->IsAtEnd())
 			{
-				m_activePath->UpdatePath();
 				nextPosition = m_activePath->GetNextPosition();
 			}
 		}
 
+		OpenDoorsAhead();
+
+		glm::vec3 steerPosition = UpdateSteering(nextPosition);
+		if (!m_activePath->IsAtEnd())
+			nextPosition = m_activePath->GetNextPosition();
+
 		if (m_currentWaypoint != nextPosition)
 		{
 			m_currentWaypoint = nextPosition;
-			DebugSpewAlways("[MQ2Nav] Moving Towards: %.2f %.2f %.2f", nextPosition.x, nextPosition.z, nextPosition.y);
+			NavSpew(MQ2NAV_SPEW_MOVEMENT, "[MQ2Nav] Moving Towards: %.2f %.2f %.2f",
+				nextPosition.x, nextPosition.z, nextPosition.y);
 		}
 
-		glm::vec3 eqPoint(nextPosition.x, nextPosition.z, nextPosition.y);
+		glm::vec3 eqPoint(steerPosition.x, steerPosition.z, steerPosition.y);
+
+		// go around other clients in the way of the next waypoint
+		float target[3] = { steerPosition.x, steerPosition.y, steerPosition.z };
+		float steerPos[3];
+		if (Get<LocalAvoidance>()->Steer(target, steerPos))
+			eqPoint = glm::vec3(steerPos[0], steerPos[2], steerPos[1]);
+
 		LookAt(eqPoint);
 	}
 }
 
+glm::vec3 MQ2NavigationPlugin::UpdateSteering(const glm::vec3& nextPosition)
+{
+	PSPAWNINFO me = GetCharInfo()->pSpawn;
+	glm::vec3 pos(me->X, me->FloorHeight, me->Y);
+
+	// speed over the last pulses, smoothed so that a single long frame doesn't
+	// throw the lookahead off
+	clock::time_point now = clock::now();
+	float dt = std::chrono::duration<float>(now - m_steerTime).count();
+	if (dt > 0.0f)
+	{
+		float speed = glm::distance(glm::vec2(pos.x, pos.z), glm::vec2(m_steerPos.x, m_steerPos.z)) / dt;
+		m_steerSpeed = dt < 1.0f ? m_steerSpeed + (speed - m_steerSpeed) * 0.25f : 0.0f;
+	}
+	m_steerPos = pos;
+	m_steerTime = now;
+
+	int index = m_activePath->GetPathIndex();
+	if (index + 1 >= m_activePath->GetPathSize())
+		return nextPosition;
+
+	// off-mesh connections have to be walked onto exactly
+	if (m_activePath->GetCornerFlags(index) & DT_STRAIGHTPATH_OFFMESH_CONNECTION)
+		return nextPosition;
+
+	float lookahead = glm::clamp(m_steerSpeed * STEER_LOOKAHEAD_MS / 1000.0f,
+		(float)STEER_MIN_LOOKAHEAD, (float)STEER_MAX_LOOKAHEAD);
+	float distance = GetDistance(nextPosition.x, nextPosition.z);
+	if (distance >= lookahead)
+		return nextPosition;
+
+	glm::vec3 afterNext = m_activePath->GetPosition(index + 1);
+
+	// the corner has been rounded once we're past the line through it, square to
+	// the way on from it. Waiting to get within the progression distance would
+	// overshoot it.
+	glm::vec2 toPlayer(pos.x - nextPosition.x, pos.z - nextPosition.z);
+	glm::vec2 onward(afterNext.x - nextPosition.x, afterNext.z - nextPosition.z);
+	if (glm::dot(toPlayer, onward) > 0.0f)
+	{
+		m_activePath->Increment();
+		return afterNext;
+	}
+
+	float blend = (1.0f - distance / lookahead) * STEER_MAX_BLEND_PERCENT / 100.0f;
+	return glm::mix(nextPosition, afterNext, blend);
+}
+
 PDOOR ParseDoorTarget(char* buffer, const char* szLine, int& argIndex)
 {
 	PDOOR pDoor = pDoorTarget;
@@ -741,7 +1456,7 @@ PDOOR ParseDoorTarget(char* buffer, const char* szLine, int& argIndex)
 
 	// follows similarly to DoorTarget
 	if (!ppSwitchMgr || !pSwitchMgr) return pDoor;
-	PDOORTABLE pDoorTable = (PDOORTABLE)pSwitchMgr;
+	ObjectIndex* objectIndex = g_mq2Nav->Get<ObjectIndex>();
 
 	// look up door by id
 	if (!_stricmp(buffer, "id"))
@@ -753,46 +1468,39 @@ PDOOR ParseDoorTarget(char* buffer, const char* szLine, int& argIndex)
 		if (!buffer[0])
 			return nullptr;
 
-		int id = atoi(buffer);
-		for (int i = 0; i < pDoorTable->NumEntries; i++)
-		{
-			if (pDoorTable->pDoor[i]->ID == id)
-				return pDoorTable->pDoor[i];
-		}
-
-		return nullptr;
+		return objectIndex->FindDoorById(atoi(buffer));
 	}
 
 	// its not id and its not click. Its probably the name of the door!
 	// find the closest door that matches. If text is 'nearest' then pick
 	// the nearest door.
-	float distance = FLT_MAX;
 	bool searchAny = !_stricmp(buffer, "nearest");
-	int id = -1;
 	argIndex++;
 
 	PSPAWNINFO pSpawn = GetCharInfo()->pSpawn;
+	PDOOR door = objectIndex->FindNearestDoor(glm::vec3(pSpawn->X, pSpawn->Y, pSpawn->Z),
+		FLT_MAX, searchAny ? nullptr : buffer, gZFilter >= 10000.0f ? FLT_MAX : gZFilter);
 
-	for (int i = 0; i < pDoorTable->NumEntries; i++)
-	{
-		PDOOR door = pDoorTable->pDoor[i];
-		// check if name matches and if it falls within the zfilter
-		if ((searchAny || !_strnicmp(door->Name, buffer, len))
-			&& ((gZFilter >= 10000.0f) || ((pDoor->Z <= pSpawn->Z + gZFilter)
-				&& (pDoor->Z >= pSpawn->Z - gZFilter))))
-		{
-			id = door->ID;
-			float d = Get3DDistance(pSpawn->X, pSpawn->Y, pSpawn->Z,
-				door->X, door->Y, door->Z);
-			if (d < distance)
-			{
-				pDoor = door;
-				distance = d;
-			}
-		}
-	}
+	return door ? door : pDoor;
+}
 
-	return pDoor;
+PGROUNDITEM ParseGroundItemTarget(char* buffer, const char* szLine, int& argIndex)
+{
+	PGROUNDITEM pGroundItem = pGroundTarget;
+
+	// short circuit if the argument is "click"
+	GetArg(buffer, szLine, argIndex);
+
+	if (!buffer[0] || !_stricmp(buffer, "click"))
+		return pGroundItem;
+
+	// find the closest item that matches the name, or any item for 'nearest'
+	bool searchAny = !_stricmp(buffer, "nearest");
+	argIndex++;
+
+	PSPAWNINFO pSpawn = GetCharInfo()->pSpawn;
+	return g_mq2Nav->Get<ObjectIndex>()->FindNearestGroundItem(glm::vec3(pSpawn->X, pSpawn->Y, pSpawn->Z),
+		FLT_MAX, searchAny ? nullptr : buffer);
 }
 
 std::shared_ptr<DestinationInfo> ParseDestination(const char* szLine, NotifyType notify)
@@ -803,6 +1511,10 @@ std::shared_ptr<DestinationInfo> ParseDestination(const char* szLine, NotifyType
 	std::shared_ptr<DestinationInfo> result = std::make_shared<DestinationInfo>();
 	result->command = szLine;
 
+	if (mq2nav::GetSettings().avoid_water)
+		result->avoidAreas |= AvoidAreaBit(static_cast<uint8_t>(PolyArea::Water));
+	result->clearance = mq2nav::GetSettings().extra_clearance;
+
 	if (!GetCharInfo() || !GetCharInfo()->pSpawn)
 	{
 		if (notify == NotifyType::Errors || notify == NotifyType::All)
@@ -810,6 +1522,64 @@ std::shared_ptr<DestinationInfo> ParseDestination(const char* szLine, NotifyType
 		return result;
 	}
 
+	// parse /nav field <destination>, followers of one destination share a flow field
+	if (!_stricmp(buffer, "field"))
+	{
+		result = ParseDestination(GetNextArg(const_cast<char*>(szLine)), notify);
+		result->command = szLine;
+		result->flowField = true;
+		return result;
+	}
+
+	// parse /nav formation [offset] <spawn destination>
+	if (!_stricmp(buffer, "formation"))
+	{
+		char* rest = GetNextArg(const_cast<char*>(szLine));
+		float offset = MQ2NavigationPlugin::FORMATION_DEFAULT_OFFSET;
+
+		GetArg(buffer, rest, 1);
+		if (IsNumber(buffer))
+		{
+			offset = static_cast<float>(atof(buffer));
+			rest = GetNextArg(rest);
+		}
+
+		result = ParseDestination(rest, notify);
+		result->command = szLine;
+
+		if (result->valid && !result->spawnId)
+		{
+			if (notify == NotifyType::Errors || notify == NotifyType::All)
+				WriteChatf(PLUGIN_MSG "\arFormations can only follow a spawn");
+			result->valid = false;
+		}
+
+		result->formation = true;
+		result->formationOffset = offset;
+		return result;
+	}
+
+	// parse /nav clearance <distance> <destination>, for a wider agent than the ini says
+	if (!_stricmp(buffer, "clearance"))
+	{
+		char* rest = GetNextArg(const_cast<char*>(szLine));
+
+		GetArg(buffer, rest, 1);
+		if (!IsNumber(buffer))
+		{
+			if (notify == NotifyType::Errors || notify == NotifyType::All)
+				WriteChatf(PLUGIN_MSG "\arUsage: /nav clearance <distance> <destination>");
+			return result;
+		}
+
+		float clearance = static_cast<float>(atof(buffer));
+
+		result = ParseDestination(GetNextArg(rest), notify);
+		result->command = szLine;
+		result->clearance = clearance;
+		return result;
+	}
+
 	// parse /nav target
 	if (!_stricmp(buffer, "target"))
 	{
@@ -818,6 +1588,7 @@ std::shared_ptr<DestinationInfo> ParseDestination(const char* szLine, NotifyType
 			PSPAWNINFO target = (PSPAWNINFO)pTarget;
 
 			result->pSpawn = target;
+			result->spawnId = target->SpawnID;
 			result->eqDestinationPos = { target->X, target->Y, target->Z };
 			result->valid = true;
 
@@ -857,6 +1628,7 @@ std::shared_ptr<DestinationInfo> ParseDestination(const char* szLine, NotifyType
 
 		result->eqDestinationPos = { target->X, target->Y, target->Z };
 		result->pSpawn = target;
+		result->spawnId = target->SpawnID;
 		result->type = DestinationType::Spawn;
 		result->valid = true;
 
@@ -876,6 +1648,7 @@ std::shared_ptr<DestinationInfo> ParseDestination(const char* szLine, NotifyType
 		{
 			result->eqDestinationPos = { pSpawn->X, pSpawn->Y, pSpawn->Z };
 			result->pSpawn = pSpawn;
+			result->spawnId = pSpawn->SpawnID;
 			result->type = DestinationType::Spawn;
 			result->valid = true;
 
@@ -917,20 +1690,22 @@ std::shared_ptr<DestinationInfo> ParseDestination(const char* szLine, NotifyType
 		}
 		else
 		{
-			if (!pGroundTarget)
+			PGROUNDITEM theItem = ParseGroundItemTarget(buffer, szLine, idx);
+
+			if (!theItem)
 			{
 				if (notify == NotifyType::Errors || notify == NotifyType::All)
-					WriteChatf(PLUGIN_MSG "\arNo ground item target!");
+					WriteChatf(PLUGIN_MSG "\arNo ground item found or bad ground item target!");
 				return result;
 			}
 
 			result->type = DestinationType::GroundItem;
-			result->pGroundItem = pGroundTarget;
-			result->eqDestinationPos = { pGroundTarget->X, pGroundTarget->Y, pGroundTarget->Z };
+			result->pGroundItem = theItem;
+			result->eqDestinationPos = { theItem->X, theItem->Y, theItem->Z };
 			result->valid = true;
 
 			if (notify == NotifyType::All)
-				WriteChatf(PLUGIN_MSG "Navigating to ground item: %s", pGroundTarget->Name);
+				WriteChatf(PLUGIN_MSG "Navigating to ground item: %s", theItem->Name);
 		}
 
 		// check for click and once
@@ -1009,6 +1784,7 @@ std::shared_ptr<DestinationInfo> ParseDestination(const char* szLine, NotifyType
 float MQ2NavigationPlugin::GetNavigationPathLength(const std::shared_ptr<DestinationInfo>& info)
 {
 	NavigationPath path(info);
+	path.SetUseCorridor(false);
 
 	if (path.FindPath())
 		return path.GetPathTraversalDistance();
@@ -1016,42 +1792,517 @@ float MQ2NavigationPlugin::GetNavigationPathLength(const std::shared_ptr<Destina
 	return -1;
 }
 
+float MQ2NavigationPlugin::GetRemainingDistance() const
+{
+	PSPAWNINFO me = GetCharInfo() ? GetCharInfo()->pSpawn : nullptr;
+	if (!m_isActive || !m_activePath || !me)
+		return -1.f;
+
+	return m_activePath->GetRemainingDistance(glm::vec3(me->X, me->FloorHeight, me->Y));
+}
+
+std::shared_ptr<NavigationPath> MQ2NavigationPlugin::GetCurrentPath()
+{
+	return m_isActive ? m_activePath : nullptr;
+}
+
+float MQ2NavigationPlugin::GetEstimatedTimeRemaining() const
+{
+	float remaining = GetRemainingDistance();
+	if (remaining < 0.f || m_isPaused || m_steerSpeed < ETA_MIN_SPEED)
+		return -1.f;
+
+	return remaining / m_steerSpeed;
+}
+
 float MQ2NavigationPlugin::GetNavigationPathLength(PCHAR szLine)
 {
-	float result = -1.f;
+	return QueryPathLength(szLine, false);
+}
+
+float MQ2NavigationPlugin::GetNavigationPathLengthAsync(PCHAR szLine)
+{
+	return QueryPathLength(szLine, true);
+}
 
-	auto dest = ParseDestination(szLine);
-	if (dest->valid)
+bool MQ2NavigationPlugin::FindRandomPoint(PCHAR szLine, glm::vec3& eqPoint)
+{
+	PSPAWNINFO me = GetCharInfo() ? GetCharInfo()->pSpawn : nullptr;
+	NavMesh* mesh = Get<NavMesh>();
+	if (!me || !mesh->IsNavMeshLoaded())
+		return false;
+
+	CHAR buffer[MAX_STRING] = { 0 };
+	GetArg(buffer, szLine, 1);
+	float radius = (float)atof(buffer);
+	if (radius <= 0)
+		return false;
+
+	uint64_t areaMask = 0;
+	for (int i = 2; GetArg(buffer, szLine, i), buffer[0]; ++i)
 	{
-		result = GetNavigationPathLength(dest);
+		const PolyAreaType* area = mesh->FindPolyArea(buffer);
+		if (!area)
+			return false;
+
+		areaMask |= AvoidAreaBit(area->id);
 	}
+	if (areaMask == 0)
+		areaMask = ~AvoidAreaBit(static_cast<uint8_t>(PolyArea::Unwalkable));
+
+	auto query = mesh->AcquireNavMeshQuery();
+	if (!query)
+		return false;
+
+	const float extents[3] = { 2, 4, 2 };
+	const float startPos[3] = { me->X, me->FloorHeight, me->Y };
+	dtPolyRef startRef = 0;
+	float nearest[3];
+	query->findNearestPoly(startPos, extents, &mesh->GetQueryFilter()->filter, &startRef, nearest);
+	if (!startRef)
+		return false;
+
+	glm::vec3 point;
+	if (!mesh->FindRandomPoint(startRef, glm::vec3(startPos[0], startPos[1], startPos[2]), radius, areaMask, point))
+		return false;
+
+	eqPoint = glm::vec3(point.x, point.z, point.y);
+	return true;
+}
 
-	return result;
+float MQ2NavigationPlugin::QueryPathLength(PCHAR szLine, bool async)
+{
+	auto dest = ParseDestination(szLine, async ? NotifyType::None : NotifyType::Errors);
+	if (!dest->valid)
+		return -1.f;
+
+	PSPAWNINFO me = GetCharInfo() ? GetCharInfo()->pSpawn : nullptr;
+	NavMesh* mesh = Get<NavMesh>();
+	if (!me || !mesh->IsNavMeshLoaded())
+		return -1.f;
+
+	auto query = mesh->AcquireNavMeshQuery();
+	if (!query)
+		return -1.f;
+
+	// the polygons at both ends are part of the key, finding them is cheap
+	PathRequest request;
+	request.filter = mesh->GetQueryFilter(dest->avoidAreas, dest->clearance);
+	request.searchMode = dest->searchMode;
+
+	const float extents[3] = { 2, 4, 2 };
+	const float startPos[3] = { me->X, me->FloorHeight, me->Y };
+	const float endPos[3] = { dest->eqDestinationPos.x, dest->eqDestinationPos.z, dest->eqDestinationPos.y };
+
+	query->findNearestPoly(startPos, extents, &request.filter->filter, &request.startRef, request.spos);
+	request.endRef = FindDestinationPoly(query.get(), &request.filter->filter, request.filter->hash,
+		endPos, extents, dest->spawnId, request.epos);
+	if (!request.startRef || !request.endRef)
+		return -1.f;
+
+	// different components can't be reached, no need to search
+	if (!mesh->MaybeReachable(request.startRef, request.endRef))
+		return -1.f;
+
+	if (m_pathQueries.size() >= PATH_QUERY_CACHE_SIZE && m_pathQueries.count(szLine) == 0)
+		m_pathQueries.clear();
+
+	PathQuery& entry = m_pathQueries[szLine];
+	ResolvePathQuery(entry);
+
+	auto now = std::chrono::steady_clock::now();
+	if (entry.valid
+		&& entry.startRef == request.startRef
+		&& entry.endRef == request.endRef
+		&& entry.tileGeneration == mesh->GetTileGeneration()
+		&& now - entry.time < std::chrono::milliseconds(PATH_QUERY_TTL_MS))
+	{
+		return entry.length;
+	}
+
+	if (async)
+	{
+		if (!entry.pending)
+			entry.pending = Get<PathfindingWorker>()->Submit(request);
+
+		return entry.valid ? entry.length : -1.f;
+	}
+
+	if (entry.pending)
+	{
+		entry.pending->Cancel();
+		entry.pending.reset();
+	}
+
+	entry.startRef = request.startRef;
+	entry.endRef = request.endRef;
+	entry.tileGeneration = mesh->GetTileGeneration();
+	entry.time = now;
+	entry.length = GetNavigationPathLength(dest);
+	entry.valid = true;
+
+	return entry.length;
 }
 
-bool MQ2NavigationPlugin::CanNavigateToPoint(PCHAR szLine)
+void MQ2NavigationPlugin::ResolvePathQuery(PathQuery& entry)
 {
-	bool result = false;
-	auto dest = ParseDestination(szLine);
-	if (dest->valid)
+	if (!entry.pending || !entry.pending->IsDone())
+		return;
+
+	std::shared_ptr<PathJob> job = std::move(entry.pending);
+
+	// asked for again with the new tiles
+	if (job->IsStale())
+		return;
+
+	const PathRequest& request = job->GetRequest();
+	const std::vector<dtPolyRef>& polys = job->GetPath();
+
+	float length = -1.f;
+
+	auto query = Get<NavMesh>()->AcquireNavMeshQuery();
+	if (query && dtStatusSucceed(job->GetStatus()) && !polys.empty())
 	{
-		NavigationPath path(dest);
+		// the length of the path as it would be followed
+		std::vector<float> straightPath((polys.size() + 2) * 3);
+		int straightPathSize = 0;
 
-		if (path.FindPath())
+		if (dtStatusSucceed(query->findStraightPath(request.spos, request.epos, polys.data(),
+			(int)polys.size(), straightPath.data(), nullptr, nullptr, &straightPathSize,
+			(int)polys.size() + 2)) && straightPathSize > 0)
 		{
-			result = path.GetPathSize() > 0;
+			length = 0.f;
+			for (int i = 0; i < straightPathSize - 1; ++i)
+				length += dtVdist(&straightPath[i * 3], &straightPath[(i + 1) * 3]);
 		}
 	}
 
-	return result;
+	entry.startRef = request.startRef;
+	entry.endRef = request.endRef;
+	entry.tileGeneration = Get<NavMesh>()->GetTileGeneration();
+	entry.time = std::chrono::steady_clock::now();
+	entry.length = length;
+	entry.valid = true;
+}
+
+std::vector<float> MQ2NavigationPlugin::GetNavigationPathLengths(
+	const std::vector<std::shared_ptr<DestinationInfo>>& destinations)
+{
+	std::vector<float> results(destinations.size(), -1.f);
+
+	PSPAWNINFO me = GetCharInfo() ? GetCharInfo()->pSpawn : nullptr;
+	NavMesh* mesh = Get<NavMesh>();
+	if (!me || !mesh->IsNavMeshLoaded())
+		return results;
+
+	auto query = mesh->AcquireNavMeshQuery();
+	if (!query)
+		return results;
+
+	// every destination is measured with the same search, so with the same filter
+	uint64_t avoidAreas = 0;
+	float clearance = 0.0f;
+	for (const auto& dest : destinations)
+	{
+		if (dest && dest->valid)
+		{
+			avoidAreas |= dest->avoidAreas;
+			clearance = std::max(clearance, dest->clearance);
+		}
+	}
+
+	auto queryFilter = mesh->GetQueryFilter(avoidAreas, clearance);
+	const dtQueryFilter& filter = queryFilter->filter;
+
+	const float extents[3] = { 2, 4, 2 };
+	const glm::vec3 startPos{ me->X, me->FloorHeight, me->Y };
+
+	dtPolyRef startRef = 0;
+	float nearest[3];
+	query->findNearestPoly(&startPos[0], extents, &filter, &startRef, nearest);
+	if (!startRef)
+		return results;
+
+	std::vector<glm::vec3> positions;
+	std::vector<size_t> indices;
+
+	for (size_t i = 0; i < destinations.size(); ++i)
+	{
+		const auto& dest = destinations[i];
+		if (!dest || !dest->valid)
+			continue;
+
+		glm::vec3 pos(dest->eqDestinationPos.x, dest->eqDestinationPos.z, dest->eqDestinationPos.y);
+
+		// destinations in other components would keep the search going until it
+		// runs out of nodes
+		dtPolyRef endRef = 0;
+		query->findNearestPoly(&pos[0], extents, &filter, &endRef, nearest);
+		if (!mesh->MaybeReachable(startRef, endRef))
+			continue;
+
+		positions.push_back(pos);
+		indices.push_back(i);
+	}
+
+	std::vector<float> lengths = CalculatePathLengths(query.get(), filter,
+		startPos, positions, extents);
+
+	for (size_t i = 0; i < indices.size(); ++i)
+	{
+		results[indices[i]] = lengths[i];
+	}
+
+	return results;
+}
+
+std::vector<float> MQ2NavigationPlugin::GetNavigationPathLengths(PCHAR szLine)
+{
+	std::vector<std::shared_ptr<DestinationInfo>> destinations;
+
+	std::vector<std::string> parts;
+	boost::split(parts, szLine, boost::is_any_of("|"));
+
+	for (std::string& part : parts)
+	{
+		boost::trim(part);
+		destinations.push_back(ParseDestination(part.c_str(), NotifyType::None));
+	}
+
+	return GetNavigationPathLengths(destinations);
+}
+
+PSPAWNINFO MQ2NavigationPlugin::FindNearestReachableSpawn(PCHAR szSearch, float* length)
+{
+	PSPAWNINFO me = GetCharInfo() ? GetCharInfo()->pSpawn : nullptr;
+	NavMesh* mesh = Get<NavMesh>();
+	if (!me || !mesh->IsNavMeshLoaded())
+		return nullptr;
+
+	auto query = mesh->AcquireNavMeshQuery();
+	if (!query)
+		return nullptr;
+
+	auto queryFilter = mesh->GetQueryFilter();
+	const dtQueryFilter& filter = queryFilter->filter;
+
+	const float extents[3] = { 2, 4, 2 };
+	const float startPos[3] = { me->X, me->FloorHeight, me->Y };
+
+	dtPolyRef startRef = 0;
+	float spos[3];
+	query->findNearestPoly(startPos, extents, &filter, &startRef, spos);
+	if (!startRef)
+		return nullptr;
+
+	SEARCHSPAWN sSpawn;
+	ClearSearchSpawn(&sSpawn);
+	ParseSearchSpawn(szSearch, &sSpawn);
+
+	// the polygons of the spawns come from the destination cache, which keeps
+	// them for as long as the spawn stays put
+	std::vector<PSPAWNINFO> spawns;
+	std::vector<dtPolyRef> endRefs;
+	std::vector<glm::vec3> endPositions;
+
+	for (PSPAWNINFO pSpawn = (PSPAWNINFO)pSpawnList; pSpawn; pSpawn = pSpawn->pNext)
+	{
+		if (pSpawn == me || !SpawnMatchesSearch(&sSpawn, me, pSpawn))
+			continue;
+
+		const float pos[3] = { pSpawn->X, pSpawn->Z, pSpawn->Y };
+		glm::vec3 nearest;
+		dtPolyRef ref = FindDestinationPoly(query.get(), &filter, queryFilter->hash,
+			pos, extents, pSpawn->SpawnID, &nearest[0]);
+
+		// other components would keep the search going until it runs out of nodes
+		if (!mesh->MaybeReachable(startRef, ref))
+			continue;
+
+		spawns.push_back(pSpawn);
+		endRefs.push_back(ref);
+		endPositions.push_back(nearest);
+	}
+
+	int index = FindNearestDestination(query.get(), filter, startRef, spos,
+		endRefs, endPositions, length);
+	return index >= 0 ? spawns[index] : nullptr;
+}
+
+std::vector<bool> MQ2NavigationPlugin::RaycastDestinations(
+	const std::vector<std::shared_ptr<DestinationInfo>>& destinations, std::vector<glm::vec3>* hits)
+{
+	std::vector<bool> results(destinations.size(), false);
+	if (hits)
+		hits->assign(destinations.size(), glm::vec3());
+
+	PSPAWNINFO me = GetCharInfo() ? GetCharInfo()->pSpawn : nullptr;
+	NavMesh* mesh = Get<NavMesh>();
+	if (!me || !mesh->IsNavMeshLoaded())
+		return results;
+
+	auto query = mesh->AcquireNavMeshQuery();
+	if (!query)
+		return results;
+
+	uint64_t avoidAreas = 0;
+	float clearance = 0.0f;
+	for (const auto& dest : destinations)
+	{
+		if (dest && dest->valid)
+		{
+			avoidAreas |= dest->avoidAreas;
+			clearance = std::max(clearance, dest->clearance);
+		}
+	}
+
+	auto queryFilter = mesh->GetQueryFilter(avoidAreas, clearance);
+	const dtQueryFilter& filter = queryFilter->filter;
+
+	const float extents[3] = { 2, 4, 2 };
+	const float startPos[3] = { me->X, me->FloorHeight, me->Y };
+
+	dtPolyRef startRef = 0;
+	float spos[3];
+	query->findNearestPoly(startPos, extents, &filter, &startRef, spos);
+	if (!startRef)
+		return results;
+
+	dtPolyRef polys[RAYCAST_MAX_POLYS];
+	for (size_t i = 0; i < destinations.size(); ++i)
+	{
+		const auto& dest = destinations[i];
+		if (!dest || !dest->valid)
+			continue;
+
+		const glm::vec3& eqPos = dest->eqDestinationPos;
+		const float endPos[3] = { eqPos.x, eqPos.z, eqPos.y };
+
+		dtRaycastHit hit;
+		hit.path = polys;
+		hit.maxPath = RAYCAST_MAX_POLYS;
+
+		dtStatus status = query->raycast(startRef, spos, endPos, &filter, 0, &hit);
+		if (dtStatusFailed(status) || hit.pathCount == 0)
+			continue;
+
+		if (hit.t == FLT_MAX)
+		{
+			// the ray is flat, the ground it ends on has to be near the destination
+			float height = endPos[1];
+			results[i] = dtStatusDetail(status, DT_BUFFER_TOO_SMALL)
+				|| (dtStatusSucceed(query->getPolyHeight(polys[hit.pathCount - 1], endPos, &height))
+					&& fabsf(height - endPos[1]) <= RAYCAST_HEIGHT_TOLERANCE);
+
+			if (hits)
+				(*hits)[i] = eqPos;
+		}
+		else if (hits)
+		{
+			float hitPos[3];
+			dtVlerp(hitPos, spos, endPos, hit.t);
+			(*hits)[i] = glm::vec3(hitPos[0], hitPos[2], hitPos[1]);
+		}
+	}
+
+	return results;
+}
+
+std::vector<bool> MQ2NavigationPlugin::RaycastDestinations(PCHAR szLine, std::vector<glm::vec3>* hits)
+{
+	std::vector<std::shared_ptr<DestinationInfo>> destinations;
+
+	std::vector<std::string> parts;
+	boost::split(parts, szLine, boost::is_any_of("|"));
+
+	for (std::string& part : parts)
+	{
+		boost::trim(part);
+		destinations.push_back(ParseDestination(part.c_str(), NotifyType::None));
+	}
+
+	return RaycastDestinations(destinations, hits);
+}
+
+std::vector<float> MQ2NavigationPlugin::GetFloorHeights(const std::vector<glm::vec3>& eqPositions,
+	uint64_t avoidAreas, float clearance)
+{
+	NavMesh* mesh = Get<NavMesh>();
+	if (!mesh->IsNavMeshLoaded())
+		return std::vector<float>(eqPositions.size(), FLT_MAX);
+
+	auto query = mesh->AcquireNavMeshQuery();
+	if (!query)
+		return std::vector<float>(eqPositions.size(), FLT_MAX);
+
+	auto queryFilter = mesh->GetQueryFilter(avoidAreas, clearance);
+
+	std::vector<glm::vec3> positions;
+	positions.reserve(eqPositions.size());
+	for (const glm::vec3& eqPos : eqPositions)
+		positions.emplace_back(eqPos.x, eqPos.z, eqPos.y);
+
+	return FindFloorHeights(query.get(), queryFilter->filter, positions);
+}
+
+std::vector<float> MQ2NavigationPlugin::GetFloorHeights(PCHAR szLine)
+{
+	std::vector<glm::vec3> eqPositions;
+
+	std::vector<std::string> parts;
+	boost::split(parts, szLine, boost::is_any_of("|"));
+
+	for (std::string& part : parts)
+	{
+		// y x, and z if there is one. Locations that don't parse have no floor.
+		glm::vec3 eqPos(0.0f, 0.0f, FLT_MAX);
+		float* coords[3] = { &eqPos.y, &eqPos.x, &eqPos.z };
+		int count = 0;
+
+		CHAR buffer[MAX_STRING] = { 0 };
+		for (; count < 3; ++count)
+		{
+			GetArg(buffer, &part[0], count + 1);
+			if (!buffer[0])
+				break;
+
+			try { *coords[count] = boost::lexical_cast<float>(buffer); }
+			catch (const boost::bad_lexical_cast&) { count = -1; break; }
+		}
+
+		if (count < 2)
+			eqPos = glm::vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+		eqPositions.push_back(eqPos);
+	}
+
+	std::vector<float> heights = GetFloorHeights(eqPositions);
+	for (size_t i = 0; i < heights.size(); ++i)
+	{
+		if (eqPositions[i].x == FLT_MAX)
+			heights[i] = FLT_MAX;
+	}
+
+	return heights;
+}
+
+bool MQ2NavigationPlugin::CanNavigateToPoint(PCHAR szLine)
+{
+	return QueryPathLength(szLine, false) >= 0.f;
+}
+
+bool MQ2NavigationPlugin::CanNavigateToPointAsync(PCHAR szLine)
+{
+	return QueryPathLength(szLine, true) >= 0.f;
 }
 
 void MQ2NavigationPlugin::Stop()
 {
+	NotifyNavigationEvent(NavigationEvent::Stopped);
+
 	if (m_isActive)
 	{
 		WriteChatf(PLUGIN_MSG "Stopping navigation");
-		MQ2Globals::ExecuteCmd(FindMappableCommand("FORWARD"), 0, 0);
+		MQ2Globals::ExecuteCmd(m_forwardCmd, 0, 0);
 	}
 
 	m_activePath.reset();
@@ -1061,6 +2312,421 @@ void MQ2NavigationPlugin::Stop()
 	m_pEndingDoor = nullptr;
 	m_pEndingItem = nullptr;
 }
+
+static std::shared_ptr<DestinationInfo> ZoneLineDestination(const ZoneGraph::ZoneLine& zoneLine)
+{
+	auto dest = std::make_shared<DestinationInfo>();
+	dest->command = "zone " + zoneLine.targetZone;
+	dest->type = DestinationType::Location;
+	dest->eqDestinationPos = zoneLine.pos;
+	dest->valid = true;
+
+	if (mq2nav::GetSettings().avoid_water)
+		dest->avoidAreas |= AvoidAreaBit(static_cast<uint8_t>(PolyArea::Water));
+	dest->clearance = mq2nav::GetSettings().extra_clearance;
+
+	return dest;
+}
+
+bool MQ2NavigationPlugin::BeginZoneRoute(const std::string& targetZone)
+{
+	StopZoneRoute();
+
+	NavMesh* mesh = Get<NavMesh>();
+	if (!mesh->IsNavMeshLoaded())
+	{
+		WriteChatf(PLUGIN_MSG "\arCannot navigate - No mesh file loaded.");
+		return false;
+	}
+
+	if (!m_zoneGraphLoaded)
+	{
+		m_zoneGraphLoaded = true;
+
+		std::string filename = mesh->GetNavMeshDirectory() + "\\" + ZONE_GRAPH_FILENAME;
+		if (!m_zoneGraph.Load(filename))
+		{
+			m_zoneGraph.Clear();
+			WriteChatf(PLUGIN_MSG "\arCould not load the zone graph from %s", filename.c_str());
+		}
+	}
+
+	std::string zoneName = mesh->GetZoneName();
+	int zone = m_zoneGraph.FindZone(zoneName);
+	if (zone == -1 || m_zoneGraph.FindZone(targetZone) == -1)
+	{
+		WriteChatf(PLUGIN_MSG "\arNo zone lines known between %s and %s", zoneName.c_str(), targetZone.c_str());
+		return false;
+	}
+
+	// how far each way out of this zone is, in one search
+	const std::vector<ZoneGraph::ZoneLine>& zoneLines = m_zoneGraph.GetZoneLines();
+
+	std::vector<std::shared_ptr<DestinationInfo>> exits;
+	for (uint32_t exit : m_zoneGraph.GetZones()[zone].exits)
+		exits.push_back(ZoneLineDestination(zoneLines[exit]));
+
+	std::vector<float> distances = GetNavigationPathLengths(exits);
+
+	std::vector<uint32_t> route;
+	if (!m_zoneGraph.FindRoute(zoneName, distances, targetZone, route, ZONE_ROUTE_ZONE_COST))
+	{
+		WriteChatf(PLUGIN_MSG "\arNo route from %s to %s", zoneName.c_str(), targetZone.c_str());
+		return false;
+	}
+
+	if (route.empty())
+	{
+		WriteChatf(PLUGIN_MSG "Already in %s", zoneName.c_str());
+		return true;
+	}
+
+	for (uint32_t zoneLine : route)
+		m_zoneRoute.push_back(zoneLines[zoneLine]);
+
+	WriteChatf(PLUGIN_MSG "Navigating to %s through %d zone lines", targetZone.c_str(), (int)route.size());
+
+	UpdateZoneRoute();
+	return true;
+}
+
+void MQ2NavigationPlugin::StopZoneRoute()
+{
+	m_zoneRoute.clear();
+	m_zoneRouteLegStarted = false;
+	m_zoneRouteArrival = clock::time_point();
+}
+
+void MQ2NavigationPlugin::UpdateZoneRoute()
+{
+	if (m_zoneRoute.empty() || m_isActive)
+		return;
+
+	// wait for the mesh of the zone we just got into
+	NavMesh* mesh = Get<NavMesh>();
+	if (Get<NavMeshLoader>()->IsLoading())
+		return;
+
+	std::string zoneName = mesh->GetZoneName();
+
+	// went through the zone line, on to the next one
+	if (!_stricmp(zoneName.c_str(), m_zoneRoute.front().targetZone.c_str()))
+	{
+		m_zoneRoute.pop_front();
+		m_zoneRouteLegStarted = false;
+		m_zoneRouteArrival = clock::time_point();
+
+		if (m_zoneRoute.empty())
+		{
+			WriteChatf(PLUGIN_MSG "\agArrived in %s", zoneName.c_str());
+			return;
+		}
+	}
+
+	const ZoneGraph::ZoneLine& zoneLine = m_zoneRoute.front();
+	if (_stricmp(zoneName.c_str(), zoneLine.zone.c_str()) != 0)
+	{
+		WriteChatf(PLUGIN_MSG "\arEnded up in %s instead of %s, stopping the zone route",
+			zoneName.c_str(), zoneLine.zone.c_str());
+		StopZoneRoute();
+		return;
+	}
+
+	if (m_zoneRouteLegStarted)
+	{
+		// give the zone line a moment to take us through
+		clock::time_point now = clock::now();
+		if (m_zoneRouteArrival == clock::time_point())
+			m_zoneRouteArrival = now;
+
+		if (now - m_zoneRouteArrival < std::chrono::milliseconds(ZONE_ROUTE_ZONING_TIMEOUT_MS))
+			return;
+
+		WriteChatf(PLUGIN_MSG "\arDid not zone into %s, stopping the zone route", zoneLine.targetZone.c_str());
+		StopZoneRoute();
+		return;
+	}
+
+	WriteChatf(PLUGIN_MSG "Navigating to the zone line to %s", zoneLine.targetZone.c_str());
+
+	m_zoneRouteLegStarted = true;
+	BeginNavigation(ZoneLineDestination(zoneLine));
+}
+
+bool MQ2NavigationPlugin::BeginStopRoute(const std::vector<std::shared_ptr<DestinationInfo>>& stops)
+{
+	StopStopRoute();
+
+	PSPAWNINFO me = GetCharInfo() ? GetCharInfo()->pSpawn : nullptr;
+	NavMesh* mesh = Get<NavMesh>();
+	if (!me || !mesh->IsNavMeshLoaded())
+	{
+		WriteChatf(PLUGIN_MSG "\arCannot navigate - No mesh file loaded.");
+		return false;
+	}
+
+	// the order is worked out with one filter for all the stops
+	uint64_t avoidAreas = 0;
+	float clearance = 0.0f;
+	for (const auto& stop : stops)
+	{
+		avoidAreas |= stop->avoidAreas;
+		clearance = std::max(clearance, stop->clearance);
+	}
+	auto queryFilter = mesh->GetQueryFilter(avoidAreas, clearance);
+
+	// we're stop 0
+	std::vector<glm::vec3> positions;
+	positions.emplace_back(me->X, me->FloorHeight, me->Y);
+	for (const auto& stop : stops)
+		positions.emplace_back(stop->eqDestinationPos.x, stop->eqDestinationPos.z, stop->eqDestinationPos.y);
+
+	const float extents[3] = { 2, 4, 2 };
+
+	auto startTime = clock::now();
+	std::vector<float> lengths = CalculatePathLengthMatrix(mesh, queryFilter->filter, positions, extents);
+	std::vector<size_t> order = OrderStops(lengths, positions.size());
+	float elapsedMs = std::chrono::duration<float, std::milli>(clock::now() - startTime).count();
+
+	const size_t count = positions.size();
+	float total = 0.f;
+	size_t from = 0;
+
+	for (size_t stop : order)
+	{
+		if (lengths[stop] < 0.f)
+		{
+			WriteChatf(PLUGIN_MSG "\arSkipping %s, there's no path to it", stops[stop - 1]->command.c_str());
+			continue;
+		}
+
+		if (lengths[from * count + stop] >= 0.f)
+			total += lengths[from * count + stop];
+
+		m_stopRoute.push_back(stops[stop - 1]);
+		from = stop;
+	}
+
+	if (m_stopRoute.empty())
+	{
+		WriteChatf(PLUGIN_MSG "\arNone of the stops can be reached");
+		return false;
+	}
+
+	m_stopRouteCount = static_cast<int>(m_stopRoute.size());
+	WriteChatf(PLUGIN_MSG "Visiting %d stops, \ag%.0f\ax units in all (ordered in %.1fms)",
+		m_stopRouteCount, total, elapsedMs);
+
+	StopZoneRoute();
+	StopNavQueue();
+	UpdateStopRoute();
+	return true;
+}
+
+void MQ2NavigationPlugin::StopStopRoute()
+{
+	m_stopRoute.clear();
+	m_stopRouteNavigationId = 0;
+	m_stopRouteCount = 0;
+}
+
+void MQ2NavigationPlugin::UpdateStopRoute()
+{
+	// something else may have been started between two stops, it gets to finish
+	if (m_stopRoute.empty() || m_stopRouteNavigationId != 0 || m_isActive)
+		return;
+
+	std::shared_ptr<DestinationInfo> stop = m_stopRoute.front();
+	m_stopRoute.pop_front();
+
+	int stopNumber = m_stopRouteCount - static_cast<int>(m_stopRoute.size());
+	WriteChatf(PLUGIN_MSG "Navigating to stop %d of %d", stopNumber, m_stopRouteCount);
+
+	BeginNavigation(stop);
+
+	m_stopRouteNavigationId = GetNavigationId();
+	if (m_stopRouteNavigationId == 0)
+		WriteChatf(PLUGIN_MSG "\arNo path to stop %d, moving on", stopNumber);
+}
+
+void MQ2NavigationPlugin::OnStopRouteEvent(uint32_t navigationId, NavigationEvent event)
+{
+	if (m_stopRouteNavigationId == 0 || navigationId != m_stopRouteNavigationId
+		|| !IsFinishedEvent(event))
+	{
+		return;
+	}
+
+	if (event != NavigationEvent::Arrived)
+	{
+		// stopped, or taken over by something else
+		if (event == NavigationEvent::Failed)
+			WriteChatf(PLUGIN_MSG "\arLost the path to the next stop, stopping the route");
+		StopStopRoute();
+		return;
+	}
+
+	// the next one is started on the next pulse, not from inside of AttemptMovement
+	m_stopRouteNavigationId = 0;
+	if (m_stopRoute.empty())
+	{
+		WriteChatf(PLUGIN_MSG "\agVisited all %d stops", m_stopRouteCount);
+		StopStopRoute();
+	}
+}
+
+void MQ2NavigationPlugin::QueueNavigation(const std::vector<std::shared_ptr<DestinationInfo>>& destinations)
+{
+	const bool starting = m_navQueue.empty() && m_navQueueNavigationId == 0;
+
+	m_navQueue.insert(m_navQueue.end(), destinations.begin(), destinations.end());
+
+	if (starting)
+	{
+		WriteChatf(PLUGIN_MSG "Queued %d destinations", (int)m_navQueue.size());
+
+		StopZoneRoute();
+		StopStopRoute();
+		BeginNextQueuedLeg();
+		return;
+	}
+
+	WriteChatf(PLUGIN_MSG "Queued %d more destinations, %d in all", (int)destinations.size(),
+		(int)m_navQueue.size());
+
+	// the one we're on the way to was the last one
+	if (!m_navQueuePrefetch)
+		PrefetchNavQueue();
+}
+
+void MQ2NavigationPlugin::StopNavQueue()
+{
+	if (m_navQueuePrefetch)
+		m_navQueuePrefetch->Cancel();
+
+	m_navQueue.clear();
+	m_navQueueNavigationId = 0;
+	m_navQueuePrefetch.reset();
+	m_navQueuePrefetchDest.reset();
+}
+
+void MQ2NavigationPlugin::UpdateNavQueue()
+{
+	// a leg that couldn't be started, or something else that was started between
+	// two legs and gets to finish
+	if (m_navQueue.empty() || m_navQueueNavigationId != 0 || m_isActive)
+		return;
+
+	BeginNextQueuedLeg();
+}
+
+bool MQ2NavigationPlugin::ContinueNavQueue(uint32_t arrivedId)
+{
+	if (arrivedId == 0 || arrivedId != m_navQueueNavigationId)
+		return false;
+
+	m_navQueueNavigationId = 0;
+	if (m_navQueue.empty())
+	{
+		WriteChatf(PLUGIN_MSG "\agReached the end of the navigation queue");
+		StopNavQueue();
+		return false;
+	}
+
+	BeginNextQueuedLeg();
+	if (m_isActive)
+		return true;
+
+	// the rest are tried on the next pulse, standing still
+	MQ2Globals::ExecuteCmd(m_forwardCmd, 0, 0);
+	return false;
+}
+
+void MQ2NavigationPlugin::BeginNextQueuedLeg()
+{
+	std::shared_ptr<DestinationInfo> dest = m_navQueue.front();
+	m_navQueue.pop_front();
+
+	// only good for the destination it was searched for
+	std::shared_ptr<PathJob> prefetched;
+	if (m_navQueuePrefetchDest == dest)
+		prefetched = std::move(m_navQueuePrefetch);
+	else if (m_navQueuePrefetch)
+		m_navQueuePrefetch->Cancel();
+
+	m_navQueuePrefetch.reset();
+	m_navQueuePrefetchDest.reset();
+
+	BeginNavigation(dest, prefetched);
+
+	m_navQueueNavigationId = GetNavigationId();
+	if (m_navQueueNavigationId == 0)
+	{
+		WriteChatf(PLUGIN_MSG "\arNo path to %s, moving on", dest->command.c_str());
+		return;
+	}
+
+	PrefetchNavQueue();
+}
+
+void MQ2NavigationPlugin::OnNavQueueEvent(uint32_t navigationId, NavigationEvent event)
+{
+	if (m_navQueueNavigationId == 0 || navigationId != m_navQueueNavigationId
+		|| !IsFinishedEvent(event))
+	{
+		return;
+	}
+
+	// arriving is handled by ContinueNavQueue, once the navigation is done with
+	if (event == NavigationEvent::Arrived)
+		return;
+
+	// stopped, or taken over by something else
+	if (event == NavigationEvent::Failed)
+		WriteChatf(PLUGIN_MSG "\arLost the path to the next destination, clearing the queue");
+	StopNavQueue();
+}
+
+void MQ2NavigationPlugin::PrefetchNavQueue()
+{
+	if (m_navQueue.empty() || !m_isActive || !m_activePath || !m_activePath->GetNavMeshQuery())
+		return;
+
+	if (m_navQueuePrefetch)
+		m_navQueuePrefetch->Cancel();
+	m_navQueuePrefetch.reset();
+	m_navQueuePrefetchDest.reset();
+
+	const std::shared_ptr<DestinationInfo>& next = m_navQueue.front();
+	std::shared_ptr<DestinationInfo> current = m_activePath->GetDestinationInfo();
+
+	NavMesh* mesh = Get<NavMesh>();
+	dtNavMeshQuery* query = m_activePath->GetNavMeshQuery();
+	const float extents[3] = { 2, 4, 2 };
+
+	// searched with the filter the next leg will use
+	PathRequest request;
+	request.filter = mesh->GetQueryFilter(next->avoidAreas, next->clearance);
+	request.searchMode = next->searchMode;
+
+	// from where this leg ends, as of now for spawns
+	const glm::vec3& from = current->eqDestinationPos;
+	const float startPos[3] = { from.x, from.z, from.y };
+	request.startRef = FindDestinationPoly(query, &request.filter->filter, request.filter->hash,
+		startPos, extents, 0, request.spos);
+
+	const glm::vec3& to = next->eqDestinationPos;
+	const float endPos[3] = { to.x, to.z, to.y };
+	request.endRef = FindDestinationPoly(query, &request.filter->filter, request.filter->hash,
+		endPos, extents, next->spawnId, request.epos);
+
+	if (!request.startRef || !request.endRef)
+		return;
+
+	m_navQueuePrefetch = Get<PathfindingWorker>()->Submit(request);
+	if (m_navQueuePrefetch)
+		m_navQueuePrefetchDest = next;
+}
 #pragma endregion
 
 //----------------------------------------------------------------------------
@@ -1081,7 +2747,7 @@ void MQ2NavigationPlugin::OnUpdateTab(TabPage tabId)
 
 		if (ImGui::Checkbox("Pause navigation", &m_isPaused)) {
 			if (m_isPaused)
-				MQ2Globals::ExecuteCmd(FindMappableCommand("FORWARD"), 0, 0);
+				MQ2Globals::ExecuteCmd(m_forwardCmd, 0, 0);
 		}
 
 		if (ImGui::CollapsingHeader("Pathing Debug"))
@@ -1091,12 +2757,35 @@ void MQ2NavigationPlugin::OnUpdateTab(TabPage tabId)
 
 			if (ImGui::Checkbox("Render pathing debug draw", &settings.debug_render_pathing))
 				settingsChanged = true;
-			if (ImGui::Checkbox("Use Pathing Corridor (experimental)", &settings.debug_use_pathing_corridor))
+			if (ImGui::Checkbox("Use Pathing Corridor", &settings.use_pathing_corridor))
+				settingsChanged = true;
+			if (ImGui::Checkbox("Fast path search", &settings.fast_path_search))
 				settingsChanged = true;
 
 			if (settingsChanged)
 				mq2nav::SaveSettings();
 
+			const NavMesh::PathCacheStats& cacheStats = Get<NavMesh>()->GetPathCacheStats();
+			uint32_t cacheLookups = cacheStats.hits + cacheStats.misses;
+			ImGui::LabelText("Path Cache", "%d hits, %d misses (%.1f%%), %d entries",
+				cacheStats.hits, cacheStats.misses,
+				cacheLookups ? 100.f * cacheStats.hits / cacheLookups : 0.f, cacheStats.entries);
+
+			const NavMesh::QueryNodeStats& nodeStats = Get<NavMesh>()->GetQueryNodeStats();
+			ImGui::LabelText("Query Nodes", "%d budget, ran out %d times, %d of %d retries found the path",
+				Get<NavMesh>()->GetQueryNodeBudget(), nodeStats.outOfNodes.load(),
+				nodeStats.retriesFound.load(), nodeStats.retries.load());
+
+			SharedPathCache* sharedCache = Get<SharedPathCache>();
+			if (sharedCache->IsAttached())
+			{
+				const SharedPathCache::Stats& sharedStats = sharedCache->GetStats();
+				uint32_t sharedLookups = sharedStats.hits + sharedStats.misses;
+				ImGui::LabelText("Shared Path Cache", "%d hits, %d misses (%.1f%%)",
+					sharedStats.hits, sharedStats.misses,
+					sharedLookups ? 100.f * sharedStats.hits / sharedLookups : 0.f);
+			}
+
 			if (m_activePath)
 			{
 				auto dest = m_activePath->GetDestination();
@@ -1139,7 +2828,7 @@ void MQ2NavigationPlugin::OnUpdateTab(TabPage tabId)
 			ImGui::LabelText("Ending Item", "%s", m_pEndingItem ? m_pEndingItem->Name : "<none>");
 			ImGui::LabelText("Is Active", "%s", m_isActive ? "true" : "false");
 			ImGui::LabelText("Current Waypoint", "(%.2f, %.2f, %.2f)", m_currentWaypoint.x, m_currentWaypoint.y, m_currentWaypoint.z);
-			ImGui::LabelText("Stuck Data", "(%.2f, %.2f) %d", m_stuckX, m_stuckY, m_stuckTimer.time_since_epoch());
+			ImGui::LabelText("Stuck Data", "(%.2f, %.2f) %d", m_stallPos.y, m_stallPos.x, m_stallCount);
 			ImGui::LabelText("Last Click", "%d", m_lastClick.time_since_epoch() / 1000000);
 			ImGui::LabelText("Pathfind Timer", "%d", m_pathfindTimer.time_since_epoch() / 1000000);
 		}
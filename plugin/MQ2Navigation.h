@@ -5,21 +5,46 @@
 #pragma once
 
 #include "MQ2Plugin.h"
+#include "PulseScheduler.h"
 
 #include "common/Context.h"
 #include "common/NavModule.h"
+#include "common/NavTrace.h"
+#include "common/PolyPathSearch.h"
 #include "common/Signal.h"
+#include "common/ZoneGraph.h"
 
 #include <memory>
 #include <chrono>
+#include <deque>
+#include <string>
 #include <typeinfo>
 #include <unordered_map>
+#include <vector>
+
+#include <DetourNavMesh.h>
 
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
 
 #define PLUGIN_MSG "\ag[MQ2Nav]\ax "
 
+// Debug spew from the navigation loop. Anything above MQ2NAV_SPEW_LEVEL is
+// compiled out, release builds keep none of it.
+#define MQ2NAV_SPEW_PATHING 1    // path searches that fail or come back partial
+#define MQ2NAV_SPEW_MOVEMENT 2   // every waypoint that is moved towards
+
+#if !defined(MQ2NAV_SPEW_LEVEL)
+#if defined(_DEBUG)
+#define MQ2NAV_SPEW_LEVEL MQ2NAV_SPEW_MOVEMENT
+#else
+#define MQ2NAV_SPEW_LEVEL 0
+#endif
+#endif
+
+#define NavSpew(level, ...) \
+	do { if (MQ2NAV_SPEW_LEVEL >= (level)) DebugSpewAlways(__VA_ARGS__); } while (0)
+
 
 #if !defined(GAMESTATE_ZONING)
 #define GAMESTATE_ZONING 4
@@ -67,6 +92,21 @@ enum class NotifyType
 	All
 };
 
+// what happened to a navigation, see MQ2NavigationPlugin::OnNavigationEvent. The
+// first three end it.
+enum class NavigationEvent
+{
+	Arrived,
+	Stopped,            // stopped, replaced by another destination, or left the zone
+	Failed,             // the path was lost and no new one was found
+	Stuck,              // no progress toward the next waypoint, see StuckCheck
+	DestinationChanged, // this navigation replaced one that was in progress
+};
+
+inline bool IsFinishedEvent(NavigationEvent event) { return event <= NavigationEvent::Failed; }
+
+const char* GetNavigationEventName(NavigationEvent event);
+
 struct DestinationInfo
 {
 	std::string command;
@@ -75,10 +115,29 @@ struct DestinationInfo
 	DestinationType type = DestinationType::None;
 
 	PSPAWNINFO pSpawn = nullptr;
+	DWORD spawnId = 0; // spawn destinations are followed by id, the spawn can go away
 	PDOOR pDoor = nullptr;
 	PGROUNDITEM pGroundItem = nullptr;
 	ClickType clickType = ClickType::None;
 
+	// areas the path should stay out of if it can, see AvoidAreaBit
+	uint64_t avoidAreas = 0;
+
+	// room the path needs past the agent radius of the mesh, see
+	// GetClearanceExcludeFlags
+	float clearance = 0.0f;
+
+	// how the path to the destination is searched for
+	PolyPathSearch::Mode searchMode = PolyPathSearch::Mode::Auto;
+
+	// follow the flow field of the destination instead of searching, see SharedFlowField
+	bool flowField = false;
+
+	// follow a spawn along the path it is navigating, staying this far behind it,
+	// see SharedLeaderPath
+	bool formation = false;
+	float formationOffset = 0.0f;
+
 	bool valid = false;
 };
 
@@ -87,6 +146,25 @@ std::shared_ptr<DestinationInfo> ParseDestination(const char* szLine,
 
 //----------------------------------------------------------------------------
 
+class PathJob;
+
+// a memoized path length for a macro, see MQ2NavigationPlugin::QueryPathLength
+struct PathQuery
+{
+	dtPolyRef startRef = 0;
+	dtPolyRef endRef = 0;
+	uint32_t tileGeneration = 0;
+	std::chrono::steady_clock::time_point time;
+
+	float length = -1.f;
+	bool valid = false;
+
+	// update running on the pathfinding worker, for the async members
+	std::shared_ptr<PathJob> pending;
+};
+
+//----------------------------------------------------------------------------
+
 class PluginContext : public Context
 {
 public:
@@ -131,6 +209,7 @@ public:
 		auto result = m_modules.emplace(std::move(std::make_pair(
 			typeid(T).hash_code(),
 			std::unique_ptr<NavModule>(new T(std::forward<Args>(args)...)))));
+		m_pulseScheduler.AddModule(result.first->second.get(), typeid(T).name());
 		return static_cast<T*>(result.first->second.get());
 	}
 
@@ -140,6 +219,12 @@ public:
 		return static_cast<T*>(m_modules.at(typeid(T).hash_code()).get());
 	}
 
+	PulseScheduler& GetPulseScheduler() { return m_pulseScheduler; }
+
+	// true while the window isn't in the foreground and background throttling is
+	// on. Nothing is rendered then, and work that is only for display is skipped.
+	bool IsInBackground() const { return m_inBackground; }
+
 	//------------------------------------------------------------------------
 	// constants
 
@@ -151,9 +236,55 @@ public:
 	// stopping distance at the final waypoint
 	static const int ENDPOINT_STOP_DISTANCE = 15;
 
-	// how often to update the path (in milliseconds)
+	// how far formation followers stay behind the leader unless told otherwise
+	static const int FORMATION_DEFAULT_OFFSET = 15;
+
+	// the player is stuck when the distance to the next waypoint hasn't gone down
+	// by this much over the window, and is clear of a stall once it has moved the
+	// recovered distance away from it.
+	static const int STUCK_CHECK_INTERVAL_MS = 100;
+	static const int STUCK_PROGRESS_WINDOW_MS = 500;
+	static const int STUCK_PROGRESS_DISTANCE = 2;
+	static const int STUCK_RECOVERED_DISTANCE = 10;
+
+	// corners are rounded toward the corner after them once they're closer than
+	// the distance covered in the lookahead time, within the min and max. The
+	// heading is only written when it is off by more than the threshold, in
+	// heading units of 512 to a full turn.
+	static const int STEER_LOOKAHEAD_MS = 400;
+	static const int STEER_MIN_LOOKAHEAD = 5;
+	static const int STEER_MAX_LOOKAHEAD = 20;
+	static const int STEER_MAX_BLEND_PERCENT = 50;
+	static const int STEER_HEADING_THRESHOLD = 2;
+
+	// doors on the path are opened once the path reaches the door area within the
+	// open distance, see DoorAreas. Checked every interval, and a door that stays
+	// closed is clicked again after the retry time.
+	static const int DOOR_CHECK_INTERVAL_MS = 250;
+	static const int DOOR_OPEN_DISTANCE = 20;
+	static const int DOOR_RETRY_MS = 2000;
+
+	// time a pulse may take before the modules that can wait are put off to the
+	// next one, in milliseconds. See PulseScheduler.
+	static const int PULSE_BUDGET_MS = 2;
+
+	// least amount of time between path updates (in milliseconds). Paths are only
+	// updated when the path says it needs to be, see NavigationPath::ShouldReplan.
 	static const int PATHFINDING_DELAY_MS = 200;
 
+	// the same for clients in the background, see background_throttle
+	static const int BACKGROUND_PATHFINDING_DELAY_MS = 1000;
+
+	// a raycast reaches a destination if the ground it ends on is within this
+	// height of it, and it crosses no more than this many polygons
+	static const int RAYCAST_HEIGHT_TOLERANCE = 10;
+	static const int RAYCAST_MAX_POLYS = 256;
+
+	// how long a path length for a macro is reused, and how many destinations
+	// they are kept for
+	static const int PATH_QUERY_TTL_MS = 500;
+	static const size_t PATH_QUERY_CACHE_SIZE = 64;
+
 	//----------------------------------------------------------------------------
 
 	bool IsActive() const { return m_isActive; }
@@ -166,10 +297,97 @@ public:
 	// Check how far away a point is (given a coordinate string)
 	float GetNavigationPathLength(PCHAR szLine);
 
-	// Begin navigating to a point
-	void BeginNavigation(const std::shared_ptr<DestinationInfo>& dest);
+	// Same as above, but never searches on the game thread: returns the last known
+	// result for the destination and updates it on the pathfinding worker.
+	// Returns -1 (false) until there is a result.
+	bool CanNavigateToPointAsync(PCHAR szLine);
+	float GetNavigationPathLengthAsync(PCHAR szLine);
+
+	// A random point that can be reached from the player, within a radius of
+	// them: "<radius> [area ...]", by area id or name. Any walkable area if none
+	// are given.
+	bool FindRandomPoint(PCHAR szLine, glm::vec3& eqPoint);
+
+	// Get the path length to each of the destinations, in a single search. Returns
+	// -1 for destinations that can't be reached.
+	std::vector<float> GetNavigationPathLengths(
+		const std::vector<std::shared_ptr<DestinationInfo>>& destinations);
+
+	// Same as above, given a list of destination strings separated by '|'
+	std::vector<float> GetNavigationPathLengths(PCHAR szLine);
+
+	// The spawn matching an MQ2 spawn search that is closest to the player by path
+	// length, in a single search towards all of them. Spawns that are off the
+	// mesh or on a part of it that can't be reached are left out before searching.
+	// The length of the path to it goes in length, if given. Returns nullptr if
+	// none of them can be reached.
+	PSPAWNINFO FindNearestReachableSpawn(PCHAR szSearch, float* length = nullptr);
+
+	// Whether there is walkable ground in a straight line from the player to each
+	// of the destinations, raycasting along the navmesh. The player's polygon is
+	// looked up once for all of the rays. Where each ray stopped goes in hits, in
+	// eq coordinates, if given.
+	std::vector<bool> RaycastDestinations(const std::vector<std::shared_ptr<DestinationInfo>>& destinations,
+		std::vector<glm::vec3>* hits = nullptr);
+
+	// same for a '|' separated list of destinations
+	std::vector<bool> RaycastDestinations(PCHAR szLine, std::vector<glm::vec3>* hits = nullptr);
+
+	// The height of the navmesh under each of the positions, in eq coordinates,
+	// all in one go. The floor closest to the z of a position is picked, or the
+	// highest one if z is FLT_MAX. FLT_MAX where there is no mesh.
+	std::vector<float> GetFloorHeights(const std::vector<glm::vec3>& eqPositions,
+		uint64_t avoidAreas = 0, float clearance = 0.0f);
+
+	// same for a '|' separated list of "y x [z]" locations
+	std::vector<float> GetFloorHeights(PCHAR szLine);
+
+	// Begin navigating to a point. A search for the destination that was handed
+	// to the pathfinding worker ahead of time is used instead of searching, if it
+	// is done, see NavigationPath::SetPrefetchedPath.
+	void BeginNavigation(const std::shared_ptr<DestinationInfo>& dest,
+		const std::shared_ptr<PathJob>& prefetched = nullptr);
+
+	// stop navigating, and release the movement keys
+	void Stop();
 
-	// Get the currently active path
+	// the id of the navigation in progress, 0 if there is none. Each call to
+	// BeginNavigation that finds a path gets a new one.
+	uint32_t GetNavigationId() const { return m_navigationId; }
+
+	// fired on the game thread with the id of a navigation as things happen to
+	// it. With the event_messages setting, each one is also written to chat for
+	// macros to pick up with #event.
+	Signal<uint32_t, NavigationEvent> OnNavigationEvent;
+
+	// the length of the path to dest, -1 if there isn't one
+	float GetNavigationPathLength(const std::shared_ptr<DestinationInfo>& dest);
+
+	// how much of the active path is left, -1 if there's no navigation. The
+	// estimate is at the speed we've been moving at, -1 while standing still.
+	float GetRemainingDistance() const;
+	float GetEstimatedTimeRemaining() const;
+
+	// Go to another zone, through the zone lines of the zone graph. Each zone
+	// along the way is navigated once its mesh is loaded.
+	bool BeginZoneRoute(const std::string& targetZone);
+	void StopZoneRoute();
+
+	// Visit each of the destinations once, in the order with the shortest path
+	// between them. Ends when a stop fails, or when anything else takes over the
+	// navigation.
+	bool BeginStopRoute(const std::vector<std::shared_ptr<DestinationInfo>>& stops);
+	void StopStopRoute();
+
+	// Add destinations to the end of the navigation queue, and start on the first
+	// one if the queue was empty. Destinations are visited in the order they were
+	// queued. The path to the next one is searched for on the pathfinding worker
+	// while we're on the way to the one before it, so each leg follows the last
+	// without stopping. Ends like a stop route.
+	void QueueNavigation(const std::vector<std::shared_ptr<DestinationInfo>>& destinations);
+	void StopNavQueue();
+
+	// Get the currently active path, null when not navigating
 	std::shared_ptr<NavigationPath> GetCurrentPath();
 
 private:
@@ -181,17 +399,55 @@ private:
 
 	//----------------------------------------------------------------------------
 
-	float GetNavigationPathLength(const std::shared_ptr<DestinationInfo>& pos);
+	// tell OnNavigationEvent about the navigation in progress, if there is one.
+	// Finishing it clears the id.
+	void NotifyNavigationEvent(NavigationEvent event);
+
+	// path lengths asked for by macros, memoized by destination string for
+	// PATH_QUERY_TTL_MS, as long as the start and end polygons and the tiles are
+	// the same. -1 if there is no path.
+	float QueryPathLength(PCHAR szLine, bool async);
+	void ResolvePathQuery(PathQuery& query);
 
 	void AttemptClick();
 	bool ClickNearestClosedDoor(float cDistance = 30);
 
+	// open the closed door that the path goes through next, before running into it
+	void OpenDoorsAhead();
+
 	void StuckCheck();
 
+	// a trace record of the active path at the player's position
+	NavTraceRecord MakeTraceRecord(NavTraceEvent event) const;
+
 	void LookAt(const glm::vec3& pos);
 
+	// the point to head for on the way to the next waypoint, see STEER_LOOKAHEAD_MS.
+	// Also moves on to the next waypoint once the corner has been rounded.
+	glm::vec3 UpdateSteering(const glm::vec3& nextPosition);
+
 	void AttemptMovement();
-	void Stop();
+
+	// navigate to the next zone line of the zone route, once we're in its zone
+	void UpdateZoneRoute();
+
+	// navigate to the next stop, once we got to the last one
+	void UpdateStopRoute();
+	void OnStopRouteEvent(uint32_t navigationId, NavigationEvent event);
+
+	// start on the next queued destination, between pulses or as soon as the
+	// navigation with the arrived id got there. Returns true if we're on our way.
+	void UpdateNavQueue();
+	bool ContinueNavQueue(uint32_t arrivedId);
+	void BeginNextQueuedLeg();
+	void OnNavQueueEvent(uint32_t navigationId, NavigationEvent event);
+
+	// search for the path to the next queued destination from the end of the
+	// active navigation
+	void PrefetchNavQueue();
+
+	// switch background throttling on or off as the window loses or gains focus
+	void UpdateBackgroundMode();
 
 	void OnMovementKeyPressed();
 
@@ -204,6 +460,7 @@ private:
 
 	bool m_initialized = false;
 	int m_zoneId = -1;
+	bool m_inBackground = false;
 
 	bool m_retryHooks = false;
 	bool m_initializationFailed = false;
@@ -214,6 +471,8 @@ private:
 
 	// whether the current path is active or not
 	bool m_isActive = false;
+	uint32_t m_navigationId = 0;
+	uint32_t m_nextNavigationId = 1;
 	glm::vec3 m_currentWaypoint;
 
 	// if paused, path will not be followed
@@ -223,16 +482,70 @@ private:
 
 	clock::time_point m_lastClick = clock::now();
 
+	// progress toward the next waypoint, see StuckCheck
 	clock::time_point m_stuckTimer = clock::now();
-	float m_stuckX = 0;
-	float m_stuckY = 0;
+	clock::time_point m_progressTime = clock::now();
+	glm::vec3 m_progressWaypoint;
+	float m_progressDistance = 0.0f;
+
+	// how fast the player has been moving, for steering
+	glm::vec3 m_steerPos;
+	clock::time_point m_steerTime = clock::now();
+	float m_steerSpeed = 0.0f;
+
+	// where the last stall was, and how many recoveries were tried there
+	glm::vec3 m_stallPos;
+	int m_stallCount = 0;
 
 	clock::time_point m_pathfindTimer = clock::now();
 
+	// the door last opened by OpenDoorsAhead
+	clock::time_point m_doorCheckTime = clock::now();
+	clock::time_point m_doorClickTime;
+	int m_doorClickId = -1;
+
+	// key commands, looked up once instead of by name on every pulse
+	int m_forwardCmd = 0;
+	int m_jumpCmd = 0;
+
 	Signal<>::ScopedConnection m_keypressConn;
 	Signal<TabPage>::ScopedConnection m_updateTabConn;
 
+	// navigation commands issued while a navmesh was loading
+	std::vector<std::string> m_queuedCommands;
+
+	std::unordered_map<std::string, PathQuery> m_pathQueries;
+
+	// loaded from the navmesh directory the first time a route is asked for
+	ZoneGraph m_zoneGraph;
+	bool m_zoneGraphLoaded = false;
+
+	// zone lines left to go through, and whether we're on our way to the first
+	std::deque<ZoneGraph::ZoneLine> m_zoneRoute;
+	bool m_zoneRouteLegStarted = false;
+
+	// when we got to the zone line, zero while still on the way
+	clock::time_point m_zoneRouteArrival;
+
+	// stops left to visit, and the navigation to the one we're on the way to
+	std::deque<std::shared_ptr<DestinationInfo>> m_stopRoute;
+	uint32_t m_stopRouteNavigationId = 0;
+	int m_stopRouteCount = 0;
+	Signal<uint32_t, NavigationEvent>::ScopedConnection m_stopRouteConn;
+
+	// destinations left in the queue, the navigation to the one we're on the way
+	// to, and the search for the one after it
+	std::deque<std::shared_ptr<DestinationInfo>> m_navQueue;
+	uint32_t m_navQueueNavigationId = 0;
+	std::shared_ptr<PathJob> m_navQueuePrefetch;
+	std::shared_ptr<DestinationInfo> m_navQueuePrefetchDest;
+	Signal<uint32_t, NavigationEvent>::ScopedConnection m_navQueueConn;
+
 	std::unordered_map<size_t, std::unique_ptr<NavModule>> m_modules;
+	PulseScheduler m_pulseScheduler;
+
+	// session trace started with /nav trace, see NavTrace.h
+	NavTraceWriter m_trace;
 };
 
 
@@ -0,0 +1,180 @@
+//
+// MeshFileWatcher.cpp
+//
+
+#include "MeshFileWatcher.h"
+
+#include <algorithm>
+#include <cctype>
+
+// how long a file has to go without being written to before it counts as changed
+static const std::chrono::milliseconds CHANGE_SETTLE_TIME{ 1000 };
+
+static std::string ToLower(std::string text)
+{
+	std::transform(text.begin(), text.end(), text.begin(),
+		[](char c) { return static_cast<char>(::tolower(static_cast<unsigned char>(c))); });
+	return text;
+}
+
+// the writer keeps the file open for writing until it is done
+static bool IsFileWritable(const std::string& fileName)
+{
+	HANDLE hFile = CreateFile(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ,
+		NULL, OPEN_EXISTING, 0, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return GetLastError() != ERROR_SHARING_VIOLATION;
+
+	CloseHandle(hFile);
+	return true;
+}
+
+//============================================================================
+
+MeshFileWatcher::MeshFileWatcher()
+{
+	m_stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+}
+
+MeshFileWatcher::~MeshFileWatcher()
+{
+	Stop();
+
+	if (m_stopEvent)
+		CloseHandle(m_stopEvent);
+}
+
+void MeshFileWatcher::Watch(const std::string& directory)
+{
+	// a directory that couldn't be opened isn't tried again until it changes
+	if (directory == m_directory)
+		return;
+
+	Stop();
+	m_directory = directory;
+
+	if (m_directory.empty() || !m_stopEvent)
+		return;
+
+	HANDLE hDirectory = CreateFile(m_directory.c_str(), FILE_LIST_DIRECTORY,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+		FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+	if (hDirectory == INVALID_HANDLE_VALUE)
+	{
+		DebugSpewAlways("MeshFileWatcher: failed to open %s: %d", m_directory.c_str(), GetLastError());
+		return;
+	}
+
+	ResetEvent(m_stopEvent);
+	m_thread = std::thread([this, hDirectory]() { WatchThread(hDirectory); });
+}
+
+void MeshFileWatcher::Stop()
+{
+	if (m_thread.joinable())
+	{
+		SetEvent(m_stopEvent);
+		m_thread.join();
+	}
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_changes.clear();
+}
+
+bool MeshFileWatcher::HasChanged(const std::string& fileName)
+{
+	std::string name = ToLower(fileName);
+	clock::time_point now = clock::now();
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	auto iter = m_changes.find(name);
+	if (iter == m_changes.end())
+	{
+		iter = m_changes.find(std::string());
+		if (iter == m_changes.end())
+			return false;
+	}
+
+	if (now - iter->second < CHANGE_SETTLE_TIME)
+		return false;
+
+	if (!IsFileWritable(m_directory + "\\" + fileName))
+	{
+		// still being written, check again later
+		iter->second = now;
+		return false;
+	}
+
+	m_changes.erase(iter);
+	return true;
+}
+
+void MeshFileWatcher::AddChange(const std::string& fileName)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_changes[ToLower(fileName)] = clock::now();
+}
+
+void MeshFileWatcher::WatchThread(HANDLE hDirectory)
+{
+	OVERLAPPED overlapped = { 0 };
+	overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	// DWORD aligned, as ReadDirectoryChangesW requires
+	DWORD buffer[4096];
+
+	while (overlapped.hEvent)
+	{
+		ResetEvent(overlapped.hEvent);
+
+		if (!ReadDirectoryChangesW(hDirectory, buffer, sizeof(buffer), FALSE,
+			FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE,
+			NULL, &overlapped, NULL))
+		{
+			break;
+		}
+
+		HANDLE events[] = { m_stopEvent, overlapped.hEvent };
+		DWORD bytes = 0;
+		if (WaitForMultipleObjects(2, events, FALSE, INFINITE) != WAIT_OBJECT_0 + 1)
+		{
+			CancelIo(hDirectory);
+			GetOverlappedResult(hDirectory, &overlapped, &bytes, TRUE);
+			break;
+		}
+
+		if (!GetOverlappedResult(hDirectory, &overlapped, &bytes, FALSE))
+			break;
+
+		// the buffer overflowed and the changes were lost
+		if (bytes == 0)
+		{
+			AddChange(std::string());
+			continue;
+		}
+
+		const uint8_t* data = reinterpret_cast<const uint8_t*>(buffer);
+		for (;;)
+		{
+			auto info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(data);
+
+			if (info->Action != FILE_ACTION_REMOVED && info->Action != FILE_ACTION_RENAMED_OLD_NAME)
+			{
+				char fileName[MAX_PATH] = { 0 };
+				int length = WideCharToMultiByte(CP_ACP, 0, info->FileName,
+					info->FileNameLength / sizeof(WCHAR), fileName, MAX_PATH - 1, NULL, NULL);
+				if (length > 0)
+					AddChange(std::string(fileName, length));
+			}
+
+			if (info->NextEntryOffset == 0)
+				break;
+			data += info->NextEntryOffset;
+		}
+	}
+
+	if (overlapped.hEvent)
+		CloseHandle(overlapped.hEvent);
+	CloseHandle(hDirectory);
+}
@@ -0,0 +1,52 @@
+//
+// MeshFileWatcher.h
+//
+
+#pragma once
+
+#include "MQ2Plugin.h"
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+// Watches the navmesh directory for files that were written to, on a thread of
+// its own, so that checking whether the current zone's mesh changed doesn't touch
+// the file system. A file only counts as changed once it hasn't been written to
+// for a little while and nothing has it open for writing any more, so a file that
+// is still being saved is never reported.
+class MeshFileWatcher
+{
+public:
+	MeshFileWatcher();
+	~MeshFileWatcher();
+
+	// start watching a directory, replacing the one being watched. An empty
+	// directory stops watching.
+	void Watch(const std::string& directory);
+	const std::string& GetDirectory() const { return m_directory; }
+	bool IsWatching() const { return m_thread.joinable(); }
+
+	// true once if the file in the watched directory changed and is done being
+	// written since the last time this returned true for it.
+	bool HasChanged(const std::string& fileName);
+
+private:
+	void Stop();
+	void WatchThread(HANDLE directory);
+
+	void AddChange(const std::string& fileName);
+
+	typedef std::chrono::steady_clock clock;
+
+	std::string m_directory;
+	std::thread m_thread;
+	HANDLE m_stopEvent = nullptr;
+
+	// lowercase file name to the time of its last change. An empty name means
+	// changes were missed, and every file counts as changed.
+	std::mutex m_mutex;
+	std::unordered_map<std::string, clock::time_point> m_changes;
+};
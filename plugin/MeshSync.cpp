@@ -0,0 +1,235 @@
+//
+// MeshSync.cpp
+//
+
+#include "MeshSync.h"
+#include "MQ2Nav_Settings.h"
+#include "MQ2Navigation.h"
+#include "NavMeshLoader.h"
+
+#include "common/Context.h"
+#include "common/NavMesh.h"
+#include "common/NavMeshData.h"
+
+#include <algorithm>
+#include <fstream>
+
+// what tells two copies of a mesh file apart without reading all of it
+struct MeshFileStamp
+{
+	uint64_t size = 0;
+	FILETIME writeTime = { 0, 0 };
+
+	// crc32 of the summary, metadata and tile index, which holds the checksum
+	// of every tile. 0 for files older than version 9.
+	uint32_t checksum = 0;
+};
+
+static bool ReadMeshFileStamp(const std::string& filename, MeshFileStamp& stamp)
+{
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExA(filename.c_str(), GetFileExInfoStandard, &data))
+		return false;
+
+	stamp.size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+	stamp.writeTime = data.ftLastWriteTime;
+	stamp.checksum = 0;
+
+	// only the start of the file goes over the network
+	char buffer[sizeof(MeshFileHeader) + sizeof(MeshFileContents) + sizeof(MeshFileSummary)];
+	std::ifstream file(filename, std::ios::binary);
+	if (file.read(buffer, sizeof(buffer)))
+	{
+		const MeshFileHeader* header = reinterpret_cast<const MeshFileHeader*>(buffer);
+		const MeshFileSummary* summary = reinterpret_cast<const MeshFileSummary*>(
+			buffer + sizeof(MeshFileHeader) + sizeof(MeshFileContents));
+
+		if (header->magic == NAVMESH_FILE_MAGIC && header->version >= 9)
+			stamp.checksum = summary->checksum;
+	}
+
+	return true;
+}
+
+static bool IsSameMeshFile(const MeshFileStamp& a, const MeshFileStamp& b)
+{
+	if (a.checksum && b.checksum)
+		return a.checksum == b.checksum && a.size == b.size;
+
+	// older files by size and time, which copying keeps
+	return a.size == b.size && CompareFileTime(&a.writeTime, &b.writeTime) == 0;
+}
+
+static DWORD CALLBACK CopyProgress(LARGE_INTEGER, LARGE_INTEGER, LARGE_INTEGER, LARGE_INTEGER,
+	DWORD, DWORD, HANDLE, HANDLE, LPVOID data)
+{
+	const std::atomic<bool>* cancelled = static_cast<const std::atomic<bool>*>(data);
+	return *cancelled ? PROGRESS_CANCEL : PROGRESS_CONTINUE;
+}
+
+//============================================================================
+
+MeshSync::MeshSync(Context* context, NavMesh* navMesh)
+	: m_context(context)
+	, m_navMesh(navMesh)
+{
+}
+
+MeshSync::~MeshSync()
+{
+	Shutdown();
+}
+
+void MeshSync::Shutdown()
+{
+	m_queue.clear();
+
+	// a copy in progress stops at its next chunk
+	if (m_job)
+		m_job->cancelled = true;
+
+	if (m_pending.valid())
+		m_pending.wait();
+
+	m_pending = std::future<SyncResult>();
+	m_job.reset();
+}
+
+void MeshSync::SyncZone(const std::string& zoneShortName)
+{
+	if (std::find(m_queue.begin(), m_queue.end(), zoneShortName) == m_queue.end())
+		m_queue.push_back(zoneShortName);
+}
+
+void MeshSync::OnPulse()
+{
+	// never waits for a copy that's still going
+	if (m_pending.valid() && m_pending.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+		FinishJob(m_pending.get());
+
+	if (m_reloadPending)
+		ReloadCurrentMesh();
+
+	if (mq2nav::GetSettings().remote_mesh_directory.empty())
+	{
+		m_queue.clear();
+		m_zoneShortName.clear();
+		return;
+	}
+
+	// the zone and the zones that are preloaded from it
+	const std::string& zoneShortName = m_navMesh->GetZoneName();
+	if (!zoneShortName.empty() && zoneShortName != m_zoneShortName)
+	{
+		m_zoneShortName = zoneShortName;
+
+		SyncZone(zoneShortName);
+		for (const std::string& zone : mq2nav::GetPreloadZones(zoneShortName))
+			SyncZone(zone);
+	}
+
+	if (!m_job)
+		StartNextJob();
+}
+
+void MeshSync::StartNextJob()
+{
+	if (m_queue.empty())
+		return;
+
+	auto job = std::make_shared<Job>();
+	job->zoneShortName = m_queue.front();
+	job->remoteFile = mq2nav::GetSettings().remote_mesh_directory + "\\" + job->zoneShortName + NAVMESH_FILE_EXTENSION;
+	job->localFile = m_navMesh->GetNavMeshDirectory() + "\\" + job->zoneShortName + NAVMESH_FILE_EXTENSION;
+	m_queue.pop_front();
+
+	m_job = job;
+	m_pending = std::async(std::launch::async, [job]() { return RunJob(*job); });
+}
+
+MeshSync::SyncResult MeshSync::RunJob(Job& job)
+{
+	MeshFileStamp remote;
+	if (!ReadMeshFileStamp(job.remoteFile, remote))
+		return SyncResult::Missing;
+
+	MeshFileStamp local;
+	if (ReadMeshFileStamp(job.localFile, local) && IsSameMeshFile(local, remote))
+		return SyncResult::Unchanged;
+
+	// copied next to it and moved over it, so the loader never sees half a file.
+	// Other clients on this machine might be copying it too.
+	char suffix[32];
+	sprintf_s(suffix, ".sync%lu", GetCurrentProcessId());
+	std::string tempFile = job.localFile + suffix;
+
+	std::string directory = job.localFile.substr(0, job.localFile.find_last_of('\\'));
+	CreateDirectoryA(directory.c_str(), nullptr);
+
+	if (!CopyFileExA(job.remoteFile.c_str(), tempFile.c_str(), CopyProgress, &job.cancelled, nullptr, 0))
+	{
+		DeleteFileA(tempFile.c_str());
+		return job.cancelled ? SyncResult::Cancelled : SyncResult::Failed;
+	}
+
+	// the remote file might have been written to while it was copied
+	MeshFileStamp copied;
+	if (!ReadMeshFileStamp(tempFile, copied) || !ReadMeshFileStamp(job.remoteFile, remote)
+		|| !IsSameMeshFile(copied, remote))
+	{
+		DeleteFileA(tempFile.c_str());
+		return SyncResult::Failed;
+	}
+
+	if (!MoveFileExA(tempFile.c_str(), job.localFile.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		DeleteFileA(tempFile.c_str());
+		return SyncResult::Failed;
+	}
+
+	return SyncResult::Updated;
+}
+
+void MeshSync::FinishJob(SyncResult result)
+{
+	std::shared_ptr<Job> job = std::move(m_job);
+
+	switch (result)
+	{
+	case SyncResult::Updated:
+		m_context->Log(LogLevel::INFO, "Synced mesh for %s from %s", job->zoneShortName.c_str(),
+			job->remoteFile.c_str());
+		break;
+	case SyncResult::Failed:
+		m_context->Log(LogLevel::WARNING, "Failed to sync mesh for %s from %s", job->zoneShortName.c_str(),
+			job->remoteFile.c_str());
+		break;
+	default:
+		break;
+	}
+
+	if (result == SyncResult::Updated && job->zoneShortName == m_navMesh->GetZoneName())
+		m_reloadPending = true;
+}
+
+void MeshSync::ReloadCurrentMesh()
+{
+	// a load that started before the copy is finished first
+	NavMeshLoader* loader = g_mq2Nav->Get<NavMeshLoader>();
+	if (loader->IsLoading())
+		return;
+
+	m_reloadPending = false;
+
+	// the loader reloads a mesh it has loaded by itself when auto reloading, the
+	// rest is up to us. A zone without a mesh until now gets a full load.
+	if (m_navMesh->IsNavMeshLoadedFromDisk())
+	{
+		if (!loader->GetAutoReload())
+			loader->LoadNavMesh(true);
+	}
+	else if (loader->GetAutoLoad())
+	{
+		loader->LoadNavMesh();
+	}
+}
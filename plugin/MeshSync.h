@@ -0,0 +1,84 @@
+//
+// MeshSync.h
+//
+
+#pragma once
+
+#include "MQ2Plugin.h"
+
+#include "common/NavModule.h"
+
+#include <atomic>
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+
+class Context;
+class NavMesh;
+
+// Keeps the meshes in the local mesh directory up to date with a directory they
+// are published to, like a file share, set with RemoteMeshDirectory in the ini.
+// Zones are always loaded from the local copy, so zoning never waits on the
+// network. When a zone is entered, its mesh and the meshes of its preload zones
+// are compared with the remote ones on a thread of their own, by the checksum
+// in the file header, and copied down if they changed. A new copy of the
+// current zone's mesh is swapped in by a patch reload, which only replaces the
+// tiles that changed.
+class MeshSync : public NavModule
+{
+public:
+	MeshSync(Context* context, NavMesh* navMesh);
+	virtual ~MeshSync();
+
+	virtual void Shutdown() override;
+	virtual void OnPulse() override;
+
+	// nothing here is in a hurry
+	virtual PulsePriority GetPulsePriority() const override { return PulsePriority::Background; }
+
+	// compare a zone's mesh with the remote one again, even if it was already
+	// checked since entering the zone
+	void SyncZone(const std::string& zoneShortName);
+
+	bool IsSyncing() const { return m_job != nullptr; }
+
+private:
+	enum struct SyncResult
+	{
+		Unchanged,
+		Updated,
+		Missing,              // the remote directory doesn't have the mesh
+		Failed,
+		Cancelled,
+	};
+
+	struct Job
+	{
+		std::string zoneShortName;
+		std::string remoteFile;
+		std::string localFile;
+		std::atomic<bool> cancelled{ false };
+	};
+
+	static SyncResult RunJob(Job& job);
+
+	void StartNextJob();
+	void FinishJob(SyncResult result);
+	void ReloadCurrentMesh();
+
+	Context* m_context;
+	NavMesh* m_navMesh;
+
+	// zone the queue was last filled for
+	std::string m_zoneShortName;
+	std::deque<std::string> m_queue;
+
+	// one copy at a time, the job is only touched by the worker until the
+	// future is ready
+	std::shared_ptr<Job> m_job;
+	std::future<SyncResult> m_pending;
+
+	// the current zone's mesh was copied down and hasn't been loaded yet
+	bool m_reloadPending = false;
+};
@@ -8,6 +8,8 @@
 #include "Renderable.h"
 #include "RenderHandler.h"
 #include "MQ2Nav_Util.h"
+#include "ObjectIndex.h"
+#include "ZoneInTimeline.h"
 
 #include <imgui.h>
 #include "imgui_custom/imgui_column_headers.h"
@@ -23,8 +25,11 @@
 #include <DebugDraw.h>
 #include <d3d9types.h>
 
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
+#include <tuple>
+#include <unordered_map>
 
 using namespace std::tr2;
 
@@ -48,245 +53,410 @@ INITIALIZE_EQGAME_OFFSET(Teleport_Table);
 bool s_visibleOverride = false;
 bool s_drawBoundingBoxes = false;
 
-class ModelData : public Renderable
+// per door state of the debug boxes. The boxes themselves are drawn by
+// DoorBoxRenderer, for all of the doors at once.
+class ModelData
 {
 public:
-	ModelData(int doorId, const std::shared_ptr<ModelInfo>& modelInfo, IDirect3DDevice9* device)
+	ModelData(int doorId, const std::shared_ptr<ModelInfo>& modelInfo)
 		: m_doorId(doorId)
 		, m_modelInfo(modelInfo)
 	{
-		m_grpBB = std::make_unique<RenderGroup>(device);
-#if RENDER_MODELS
-		m_grpModel = std::make_unique<RenderGroup>(device);
-#endif
-		RegenerateMesh();
+	}
+
+	void SetTargetted(bool targetted) { m_targetted = targetted; }
+	bool IsTargetted() const { return m_targetted; }
+
+	void SetHighlight(bool highlight) { m_highlight = highlight; }
+	bool IsHighlighted() const { return m_highlight; }
+
+	void SetVisible(bool visible) { m_visible = visible; }
+	bool IsVisible() const { return m_visible; }
 
-		g_renderHandler->AddRenderable(this);
+	bool IsBoxVisible() const
+	{
+		return m_visible && (m_targetted || m_highlight || s_drawBoundingBoxes);
 	}
 
-	~ModelData()
+	DWORD GetColor() const
 	{
-		g_renderHandler->RemoveRenderable(this);
+		if (m_targetted)
+			return D3DCOLOR_RGBA(0, 255, 0, 255);
+		if (m_highlight)
+			return D3DCOLOR_RGBA(0, 255, 255, 255);
 
-		InvalidateDeviceObjects();
+		return D3DCOLOR_RGBA(255, 255, 255, 255);
 	}
 
-	bool SetColor(DWORD color)
-	{
-		if (color != m_color)
-		{
-			m_color = color;
-			Rebuild();
-			return true;
-		}
+	int GetDoorId() const { return m_doorId; }
+	const std::shared_ptr<ModelInfo>& GetModelInfo() { return m_modelInfo; }
 
-		return false;
+private:
+	std::shared_ptr<ModelInfo> m_modelInfo;
+
+	bool m_visible = true;
+	int m_doorId = 0;
+	bool m_highlight = false;
+	bool m_targetted = false;
+};
+
+//----------------------------------------------------------------------------
+
+// Draws the bounding boxes of the door models with hardware instancing. The box
+// of each model is in one shared vertex buffer, and the doors are drawn with a
+// second stream holding the transform and color of each door. Doors that use
+// the same model go out in one draw call.
+class DoorBoxRenderer : public Renderable
+{
+public:
+	DoorBoxRenderer(const std::map<int, std::shared_ptr<ModelData>>& models)
+		: m_models(models)
+	{
+		m_shaderFile = std::string(gszINIPath) + "\\MQ2Nav\\DoorInstances.fx";
 	}
 
-	void SetTargetted(bool targetted)
+	~DoorBoxRenderer()
 	{
-		if (m_targetted == targetted)
-			return;
+		InvalidateDeviceObjects();
+	}
 
-		m_targetted = targetted;
+	// the set of models changed, the box buffer is rebuilt on the next render
+	void ModelsChanged() { m_modelsChanged = true; }
 
-		if (!UpdateColor())
-			Rebuild();
+	virtual bool IsRenderActive(RenderPhase phase) const override
+	{
+		return phase == Render_Geometry && m_effect && !m_models.empty();
 	}
-	bool IsTargetted() const { return m_targetted; }
 
-	void SetHighlight(bool highlight)
+	virtual void RecordDeviceState() override
 	{
-		m_highlight = highlight;
-		UpdateColor();
+		g_pDevice->SetStreamSource(1, nullptr, 0, 0);
+		g_pDevice->SetStreamSourceFreq(0, 1);
+		g_pDevice->SetStreamSourceFreq(1, 1);
+		g_pDevice->SetRenderState(D3DRS_ZENABLE, true);
 	}
-	bool IsHighlighted() const { return m_highlight; }
 
-	bool UpdateColor()
+	virtual bool CreateDeviceObjects() override
 	{
-		DWORD color = D3DCOLOR_RGBA(255, 255, 255, 255);
+		// hardware instancing needs shader model 3
+		D3DCAPS9 caps;
+		if (FAILED(g_pDevice->GetDeviceCaps(&caps)) || caps.VertexShaderVersion < D3DVS_VERSION(3, 0))
+		{
+			DebugSpewAlways("DoorBoxRenderer: instancing is not supported, door boxes are disabled");
+			return false;
+		}
 
-		if (m_targetted)
-			color = D3DCOLOR_RGBA(0, 255, 0, 255);
-		else if (m_highlight)
-			color = D3DCOLOR_RGBA(0, 255, 255, 255);
+		ID3DXBuffer* errors = 0;
+		HRESULT hr = D3DXCreateEffectFromFileA(g_pDevice, m_shaderFile.c_str(),
+			NULL, NULL, 0, NULL, &m_effect, &errors);
+		if (FAILED(hr))
+		{
+			if (errors)
+			{
+				DebugSpewAlways("Effect error: %s", errors->GetBufferPointer());
 
-		return SetColor(color);
-	}
+				errors->Release();
+				errors = nullptr;
+			}
 
-	void RegenerateMesh()
-	{	
-		{
-			DebugDrawDX dd(m_grpBB.get());
+			InvalidateDeviceObjects();
+			return false;
+		}
 
-			duDebugDrawBoxWire(&dd,
-				m_modelInfo->min.x, m_modelInfo->min.z, m_modelInfo->min.y,
-				m_modelInfo->max.x, m_modelInfo->max.z, m_modelInfo->max.y,
-				m_color, 1.0);
+		D3DVERTEXELEMENT9 vertexElements[] =
+		{
+			{ 0,  0,  D3DDECLTYPE_FLOAT3,   D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_POSITION, 0 },
+			{ 1,  0,  D3DDECLTYPE_FLOAT4,   D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 0 },
+			{ 1, 16,  D3DDECLTYPE_FLOAT4,   D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 1 },
+			{ 1, 32,  D3DDECLTYPE_FLOAT4,   D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 2 },
+			{ 1, 48,  D3DDECLTYPE_FLOAT4,   D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 3 },
+			{ 1, 64,  D3DDECLTYPE_D3DCOLOR, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_COLOR,    0 },
+			D3DDECL_END()
+		};
+
+		hr = g_pDevice->CreateVertexDeclaration(vertexElements, &m_vDeclaration);
+		if (FAILED(hr))
+		{
+			InvalidateDeviceObjects();
+			return false;
 		}
 
-#if RENDER_MODELS
-		if (!m_targetted)
-			return;
+		// the twelve edges of a box, the same for every model
+		static const uint16_t edges[BOX_INDICES] = {
+			0, 1, 1, 3, 3, 2, 2, 0,
+			4, 5, 5, 7, 7, 6, 6, 4,
+			0, 4, 1, 5, 2, 6, 3, 7,
+		};
 
-		DebugDrawDX dd(m_grpModel.get());
+		hr = g_pDevice->CreateIndexBuffer(sizeof(edges), D3DUSAGE_WRITEONLY, D3DFMT_INDEX16,
+			D3DPOOL_MANAGED, &m_indexBuffer, nullptr);
+		if (FAILED(hr))
+		{
+			InvalidateDeviceObjects();
+			return false;
+		}
 
-		// iterate over all the things!
-		if (m_modelInfo->oldModel)
+		void* indices = nullptr;
+		if (SUCCEEDED(m_indexBuffer->Lock(0, 0, &indices, 0)))
 		{
-			auto verts = m_modelInfo->oldModel->GetVertices();
-			auto polys = m_modelInfo->oldModel->GetPolygons();
-
-#define VERT(PX) { \
-	glm::vec3 p0; const glm::vec3& p = verts[iter->verts[PX]].pos; \
-	p0.x = p.y; \
-	p0.y = p.z; \
-	p0.z = p.x; \
-	dd.vertex(&p0.x, 0xffffffff); \
-}
+			memcpy(indices, edges, sizeof(edges));
+			m_indexBuffer->Unlock();
+		}
 
-			for (auto iter = polys.begin(); iter != polys.end(); ++iter)
+		m_modelsChanged = true;
+		return true;
+	}
+
+	virtual void InvalidateDeviceObjects() override
+	{
+		auto Release = [](auto*& object)
+		{
+			if (object)
 			{
-				//if (iter->flags & 0x11)
-				//	continue;
+				object->Release();
+				object = nullptr;
+			}
+		};
+
+		Release(m_effect);
+		Release(m_vDeclaration);
+		Release(m_indexBuffer);
+		Release(m_boxBuffer);
+		Release(m_instanceBuffer);
 
-				dd.begin(DU_DRAW_TRIS);
+		m_instanceCapacity = 0;
+		m_modelIndices.clear();
+	}
 
-				VERT(0);
-				VERT(1);
-				VERT(2);
+	virtual void Render(RenderPhase phase) override
+	{
+		if (phase != Render_Geometry || !m_effect)
+			return;
 
-				dd.end();
-			}
-		}
+		if (m_modelsChanged)
+			UpdateBoxes();
+		if (!m_boxBuffer)
+			return;
 
-		if (m_modelInfo->newModel)
-		{
-			auto verts = m_modelInfo->newModel->GetVertices();
-			auto polys = m_modelInfo->newModel->GetPolygons();
+		GatherInstances();
+		if (m_instances.empty() || !UploadInstances())
+			return;
 
-			for (auto iter = polys.begin(); iter != polys.end(); ++iter)
-			{
-				//if (iter->flags & 0x11)
-				//	continue;
-				dd.begin(DU_DRAW_TRIS);
+		D3DXMATRIX view, proj;
+		g_pDevice->GetTransform(D3DTS_VIEW, &view);
+		g_pDevice->GetTransform(D3DTS_PROJECTION, &proj);
+
+		D3DXMATRIX viewProj = view * proj;
+		m_effect->SetMatrix("mViewProj", &viewProj);
+
+		g_pDevice->SetVertexDeclaration(m_vDeclaration);
+		g_pDevice->SetStreamSource(0, m_boxBuffer, 0, sizeof(D3DXVECTOR3));
+		g_pDevice->SetIndices(m_indexBuffer);
 
-				VERT(0);
-				VERT(1);
-				VERT(2);
+		UINT passes = 0;
+		m_effect->Begin(&passes, 0);
+		m_effect->BeginPass(0);
 
-				dd.end();
+		// one draw for each run of doors with the same model and depth setting
+		for (size_t first = 0; first < m_instances.size(); )
+		{
+			size_t last = first + 1;
+			while (last < m_instances.size()
+				&& m_instances[last].model == m_instances[first].model
+				&& m_instances[last].noDepth == m_instances[first].noDepth)
+			{
+				++last;
 			}
+
+			g_pDevice->SetRenderState(D3DRS_ZENABLE, !m_instances[first].noDepth && !s_visibleOverride);
+
+			g_pDevice->SetStreamSourceFreq(0, D3DSTREAMSOURCE_INDEXEDDATA | (UINT)(last - first));
+			g_pDevice->SetStreamSource(1, m_instanceBuffer, (UINT)(first * sizeof(InstanceData)), sizeof(InstanceData));
+			g_pDevice->SetStreamSourceFreq(1, D3DSTREAMSOURCE_INSTANCEDATA | 1ul);
+
+			g_pDevice->DrawIndexedPrimitive(D3DPT_LINELIST,
+				m_instances[first].model * BOX_VERTICES,  // BaseVertexIndex
+				0,                                         // MinIndex
+				BOX_VERTICES,                              // NumVertices
+				0,                                         // StartIndex
+				BOX_INDICES / 2);                          // PrimitiveCount
+
+			first = last;
 		}
-#endif
+
+		m_effect->EndPass();
+		m_effect->End();
+
+		g_pDevice->SetStreamSourceFreq(0, 1);
+		g_pDevice->SetStreamSourceFreq(1, 1);
+		g_pDevice->SetStreamSource(1, nullptr, 0, 0);
 	}
 
-	virtual void Render(RenderPhase phase) override
+private:
+	static const int BOX_VERTICES = 8;
+	static const int BOX_INDICES = 24;
+
+	// what the instance stream holds for each door
+	struct InstanceData
 	{
-		// find the door
-		PDOORTABLE pDoorTable = (PDOORTABLE)pSwitchMgr;
-		if (!pDoorTable) return;
-		for (DWORD count = 0; count < pDoorTable->NumEntries; count++)
-		{
-			PDOOR door = pDoorTable->pDoor[count];
-			if (door && door->ID == m_doorId)
-			{
-				if (m_visible && door->pSwitch)
-				{
-					bool zDisabled = m_targetted || m_highlight;
+		D3DXMATRIX world;
+		D3DCOLOR color;
+	};
 
-					// create a matrix to scale the object by the scale amount
-					D3DXMATRIX scale;
-					float scaleFactor = GetDoorScale(door);
-					D3DXMatrixScaling(&scale, scaleFactor, scaleFactor, scaleFactor);
+	struct Instance
+	{
+		int model;
+		bool noDepth;
+		InstanceData data;
+	};
 
-					// multiply the transform matrix by the scale matrix to produce new matrix
-					D3DXMATRIX* mtx = (D3DXMATRIX*)(&door->pSwitch->transformMatrix); 
-					scale = scale * *mtx;
+	// one box for every distinct model, in the order of m_modelIndices
+	void UpdateBoxes()
+	{
+		m_modelsChanged = false;
+		m_modelIndices.clear();
 
-#if 0
-					// if attachment matrix exists, apply it next
-					if (door->pSwitch->bbHasAttachSRT)
-					{
-						D3DXMATRIX* attach = (D3DXMATRIX*)(&door->pSwitch->attachSRT);
+		if (m_boxBuffer)
+		{
+			m_boxBuffer->Release();
+			m_boxBuffer = nullptr;
+		}
 
-						scale = scale * *attach;
-					}
-#endif
+		std::vector<D3DXVECTOR3> corners;
+		for (const auto& p : m_models)
+		{
+			if (!p.second)
+				continue;
 
-#if RENDER_MODELS
-					if (m_targetted)
-					{
-						m_grpModel->SetTransform(&scale);
-						m_grpModel->Render(phase);
-					}
-#endif
+			const ModelInfo* modelInfo = p.second->GetModelInfo().get();
+			if (!m_modelIndices.emplace(modelInfo, (int)m_modelIndices.size()).second)
+				continue;
 
-					if (m_targetted || m_highlight || s_drawBoundingBoxes)
-					{
-						g_pDevice->SetRenderState(D3DRS_ZENABLE, !zDisabled && !s_visibleOverride);
-						m_grpBB->SetTransform(&scale);
-						m_grpBB->Render(phase);
-					}
-				}
+			// same axes as the box that duDebugDrawBoxWire used to draw
+			for (int i = 0; i < BOX_VERTICES; ++i)
+			{
+				corners.emplace_back(
+					(i & 1) ? modelInfo->max.x : modelInfo->min.x,
+					(i & 2) ? modelInfo->max.z : modelInfo->min.z,
+					(i & 4) ? modelInfo->max.y : modelInfo->min.y);
 			}
 		}
+
+		if (corners.empty())
+			return;
+
+		UINT size = (UINT)(corners.size() * sizeof(D3DXVECTOR3));
+		if (FAILED(g_pDevice->CreateVertexBuffer(size, D3DUSAGE_WRITEONLY, 0, D3DPOOL_MANAGED,
+			&m_boxBuffer, nullptr)))
+		{
+			return;
+		}
+
+		void* data = nullptr;
+		if (SUCCEEDED(m_boxBuffer->Lock(0, 0, &data, 0)))
+		{
+			memcpy(data, corners.data(), size);
+			m_boxBuffer->Unlock();
+		}
 	}
 
-	virtual bool CreateDeviceObjects() override
+	// doors move, so their transforms are picked up every frame
+	void GatherInstances()
 	{
-		m_grpBB->CreateDeviceObjects();
-#if RENDER_MODELS
-		m_grpModel->CreateDeviceObjects();
-#endif
+		m_instances.clear();
 
-		return true;
+		ObjectIndex* objectIndex = g_mq2Nav->Get<ObjectIndex>();
+
+		for (const auto& p : m_models)
+		{
+			ModelData* model = p.second.get();
+			if (!model || !model->IsBoxVisible())
+				continue;
+
+			PDOOR door = objectIndex->FindDoorById(model->GetDoorId());
+			if (!door || !door->pSwitch)
+				continue;
+
+			auto iter = m_modelIndices.find(model->GetModelInfo().get());
+			if (iter == m_modelIndices.end())
+				continue;
+
+			Instance instance;
+			instance.model = iter->second;
+			instance.noDepth = model->IsTargetted() || model->IsHighlighted();
+			instance.data.color = model->GetColor();
+
+			// scale the object by the scale amount, then place it with the door's transform
+			float scaleFactor = GetDoorScale(door);
+			D3DXMatrixScaling(&instance.data.world, scaleFactor, scaleFactor, scaleFactor);
+			instance.data.world = instance.data.world * *(D3DXMATRIX*)(&door->pSwitch->transformMatrix);
+
+			m_instances.push_back(instance);
+		}
+
+		std::sort(m_instances.begin(), m_instances.end(),
+			[](const Instance& a, const Instance& b)
+		{
+			return std::tie(a.noDepth, a.model) < std::tie(b.noDepth, b.model);
+		});
 	}
 
-	virtual void InvalidateDeviceObjects() override
+	bool UploadInstances()
 	{
-		m_grpBB->InvalidateDeviceObjects();
-#if RENDER_MODELS
-		m_grpModel->InvalidateDeviceObjects();
-#endif
-	}
+		if (m_instances.size() > m_instanceCapacity)
+		{
+			if (m_instanceBuffer)
+			{
+				m_instanceBuffer->Release();
+				m_instanceBuffer = nullptr;
+			}
 
-	void SetVisible(bool visible) { m_visible = visible; }
-	bool IsVisible() const { return m_visible; }
+			m_instanceCapacity = std::max<size_t>(64, m_instanceCapacity);
+			while (m_instanceCapacity < m_instances.size())
+				m_instanceCapacity *= 2;
 
-	const std::shared_ptr<ModelInfo>& GetModelInfo() { return m_modelInfo; }
+			if (FAILED(g_pDevice->CreateVertexBuffer((UINT)(m_instanceCapacity * sizeof(InstanceData)),
+				D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY, 0, D3DPOOL_DEFAULT, &m_instanceBuffer, nullptr)))
+			{
+				m_instanceCapacity = 0;
+				return false;
+			}
+		}
 
-private:
-	void Rebuild()
-	{
-		m_grpBB->Reset();
-#if RENDER_MODELS
-		m_grpModel->Reset();
-#endif
-		RegenerateMesh();
+		InstanceData* data = nullptr;
+		if (FAILED(m_instanceBuffer->Lock(0, (UINT)(m_instances.size() * sizeof(InstanceData)),
+			(void**)&data, D3DLOCK_DISCARD)))
+		{
+			return false;
+		}
+
+		for (const Instance& instance : m_instances)
+			*data++ = instance.data;
+
+		m_instanceBuffer->Unlock();
+		return true;
 	}
 
-	std::shared_ptr<ModelInfo> m_modelInfo;
-	std::unique_ptr<RenderGroup> m_grpBB;
-#if RENDER_MODELS
-	std::unique_ptr<RenderGroup> m_grpModel;
-#endif
-	DWORD m_color = D3DCOLOR_RGBA(255, 255, 255, 255);
+	const std::map<int, std::shared_ptr<ModelData>>& m_models;
+	std::string m_shaderFile;
 
-	glm::vec3 m_lastAdjust;
+	ID3DXEffect* m_effect = nullptr;
+	IDirect3DVertexDeclaration9* m_vDeclaration = nullptr;
+	IDirect3DIndexBuffer9* m_indexBuffer = nullptr;
+	IDirect3DVertexBuffer9* m_boxBuffer = nullptr;
+	IDirect3DVertexBuffer9* m_instanceBuffer = nullptr;
+	size_t m_instanceCapacity = 0;
 
-	bool m_visible = true;
-	int m_doorId = 0;
-	bool m_highlight = false;
-	bool m_targetted = false;
+	std::unordered_map<const ModelInfo*, int> m_modelIndices;
+	bool m_modelsChanged = true;
+
+	std::vector<Instance> m_instances;
 };
 
 #pragma endregion
 
 //----------------------------------------------------------------------------
 
-#define RENDER_MODELS  0
-
 const char* GetTeleportName(DWORD id)
 {
 #if defined(USE_TP_COORDS)
@@ -333,15 +503,14 @@ public:
 		m_showDoorsUI = true;
 	}
 
-	float GetDistance(PDOOR door);
-
 	int m_doorsSortColumn = 0;
 	bool m_sortReverse = false;
 	bool m_showDoorsUI = false;
 	int m_lastDoorTargetId = -1;
 
-	std::map<DWORD, float> m_distanceCache;
-	glm::vec3 m_lastPos;
+	// distance to each door of the snapshot, and the order they are listed in
+	std::vector<float> m_distances;
+	std::vector<int> m_order;
 };
 
 ModelLoader::ModelLoader()
@@ -355,14 +524,26 @@ ModelLoader::~ModelLoader()
 
 void ModelLoader::Initialize()
 {
+	m_doorBoxes = std::make_unique<DoorBoxRenderer>(m_modelData);
+	g_renderHandler->AddRenderable(m_doorBoxes.get());
 }
 
 void ModelLoader::Shutdown()
 {
+	if (m_pendingDump.valid())
+		m_pendingDump.wait();
+
+	if (m_doorBoxes)
+	{
+		g_renderHandler->RemoveRenderable(m_doorBoxes.get());
+		m_doorBoxes.reset();
+	}
 }
 
 void ModelLoader::OnPulse()
 {
+	CheckPendingModels();
+
 	if (m_zoneId == 0)
 		return;
 	if (gGameState != GAMESTATE_INGAME)
@@ -372,7 +553,12 @@ void ModelLoader::OnPulse()
 	if (m_loadedDoorCount != pDoorTable->NumEntries
 		&& pDoorTable->NumEntries > 0)
 	{
-		UpdateModels();
+		ZoneInTimeline* timeline = g_mq2Nav->Get<ZoneInTimeline>();
+		if (timeline->CanRunStage(ZoneInStage::Doors))
+		{
+			ScopedZoneInStage stage(timeline, ZoneInStage::Doors);
+			UpdateModels();
+		}
 	}
 
 	DWORD doorTargetId = -1;
@@ -417,58 +603,123 @@ void ModelLoader::SetZoneId(int zoneId)
 
 void ModelLoader::UpdateModels()
 {
-	m_modelData.clear();
+	// the door table will be looked at again once the current load is done
+	if (m_pendingModels.valid())
+		return;
 
 	const char* zoneName = GetShortZone(m_zoneId);
 	CHAR szEQPath[MAX_STRING];
 	GetEQPath(szEQPath, MAX_STRING);
 
-	// this uses a lot of cpu, spin it off into its own thread so it
-	// doesn't block themain thread.
-	auto zoneData = std::make_unique<ZoneData>(szEQPath, zoneName);
-
-	if (!zoneData->IsLoaded())
-	{
-		return;
-	}
+	// only the door names are needed to look up the models
+	std::vector<std::pair<int, std::string>> doors;
 
 	PDOORTABLE pDoorTable = (PDOORTABLE)pSwitchMgr;
 	for (DWORD count = 0; count < pDoorTable->NumEntries; count++)
 	{
 		PDOOR door = pDoorTable->pDoor[count];
-		std::shared_ptr<ModelInfo> modelInfo;
+		doors.emplace_back(door->ID, door->Name);
+	}
+
+	m_loadedDoorCount = pDoorTable->NumEntries;
+	m_pendingZoneId = m_zoneId;
+	m_pendingDoorCount = pDoorTable->NumEntries;
 
-		// might end up moving the renderable generating into m_zoneData
-		if (modelInfo = zoneData->GetModelInfo(door->Name))
+	// this uses a lot of cpu, spin it off into its own thread so it
+	// doesn't block the main thread.
+	std::string cachePath = std::string(gszINIPath) + "\\MQ2Nav";
+
+	g_mq2Nav->Get<ZoneInTimeline>()->StartStage(ZoneInStage::DoorModels);
+	m_pendingModelsStart = std::chrono::steady_clock::now();
+
+	m_pendingModels = std::async(std::launch::async,
+		[eqPath = std::string(szEQPath), zoneName = std::string(zoneName), cachePath, doors = std::move(doors)]()
+	{
+		DoorModelList models;
+
+		auto zoneData = std::make_unique<ZoneData>(eqPath, zoneName, cachePath);
+		if (!zoneData->IsLoaded())
+			return models;
+
+		// doors with the same name share the model, so they can be drawn together
+		std::map<std::string, std::shared_ptr<ModelInfo>> modelInfos;
+
+		for (const auto& door : doors)
 		{
-			// Create new model object
-			std::shared_ptr<ModelData> md = std::make_shared<ModelData>(door->ID, modelInfo, g_pDevice);
-			m_modelData[door->ID] = md;
+			auto iter = modelInfos.find(door.second);
+			if (iter == modelInfos.end())
+				iter = modelInfos.emplace(door.second, zoneData->GetModelInfo(door.second)).first;
+
+			if (iter->second)
+				models.emplace_back(door.first, iter->second);
 		}
-	}
 
-	m_loadedDoorCount = pDoorTable->NumEntries;
+		return models;
+	});
 
 	// dump the doors out to a config file
 	DumpDoors();
 }
 
-void ModelLoader::DumpDoors()
+void ModelLoader::CheckPendingModels()
 {
-	std::string filename = std::string(gszINIPath) + "\\MQ2Nav";
+	if (!m_pendingModels.valid())
+		return;
 
-	// make sure directory exists so we can write to it!
-	std::error_code ec;
-	sys::create_directory(filename, ec);
+	if (m_pendingModels.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		return;
 
-	// filename for the door file
-	const char* zoneName = GetShortZone(m_zoneId);
-	filename = filename + "\\" + zoneName + "_doors.json";
+	// the device objects wait for a pulse with room for them
+	ZoneInTimeline* timeline = g_mq2Nav->Get<ZoneInTimeline>();
+	if (!timeline->CanRunStage(ZoneInStage::DoorModels))
+		return;
 
-	std::ofstream file(filename);
-	if (!file.is_open())
+	DoorModelList models = m_pendingModels.get();
+
+	// zone changed while the models were loading
+	if (m_pendingZoneId != m_zoneId)
 		return;
 
+	timeline->AddBackgroundTime(ZoneInStage::DoorModels, std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - m_pendingModelsStart).count());
+
+	ScopedZoneInStage stage(timeline, ZoneInStage::DoorModels);
+
+	m_modelData.clear();
+
+	for (const auto& model : models)
+	{
+		// Create new model object
+		m_modelData[model.first] = std::make_shared<ModelData>(model.first, model.second);
+	}
+
+	m_doorBoxes->ModelsChanged();
+
+	DebugSpewAlways("Model Loader, loaded %d door models for %d doors",
+		(int)models.size(), m_pendingDoorCount);
+}
+
+static uint64_t HashDoorsText(const char* data, size_t size)
+{
+	// fnv-1a over the text
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= (uint8_t)data[i];
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+void ModelLoader::DumpDoors()
+{
+	std::string directory = std::string(gszINIPath) + "\\MQ2Nav";
+
+	// filename for the door file
+	const char* zoneName = GetShortZone(m_zoneId);
+	std::string filename = directory + "\\" + zoneName + "_doors.json";
+
 	rapidjson::StringBuffer sb;
 	rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(sb);
 
@@ -508,7 +759,44 @@ void ModelLoader::DumpDoors()
 
 	writer.EndArray();
 
-	file.write(sb.GetString(), sb.GetSize());
+	uint64_t hash = HashDoorsText(sb.GetString(), sb.GetSize());
+	if (filename == m_dumpedDoorsFile && hash == m_dumpedDoorsHash)
+		return;
+
+	m_dumpedDoorsFile = filename;
+	m_dumpedDoorsHash = hash;
+
+	// one write at a time, so the last one to start is the one that sticks
+	if (m_pendingDump.valid())
+		m_pendingDump.wait();
+
+	m_pendingDump = std::async(std::launch::async,
+		[directory, filename, hash, text = std::string(sb.GetString(), sb.GetSize())]()
+	{
+		// the file from the last time in the zone is usually the same
+		{
+			std::ifstream existing(filename, std::ios::binary | std::ios::ate);
+			if (existing.is_open() && (size_t)existing.tellg() == text.size())
+			{
+				std::string contents(text.size(), '\0');
+				existing.seekg(0);
+				if (existing.read(&contents[0], contents.size())
+					&& HashDoorsText(contents.data(), contents.size()) == hash)
+				{
+					return;
+				}
+			}
+		}
+
+		// make sure directory exists so we can write to it!
+		std::error_code ec;
+		sys::create_directory(directory, ec);
+
+		// binary, so the file reads back the same as the text that was hashed
+		std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+		if (file.is_open())
+			file.write(text.data(), text.size());
+	});
 }
 
 void ModelLoader::Reset()
@@ -519,6 +807,18 @@ void ModelLoader::Reset()
 	m_lastDoorTargetId = -1;
 	m_loadedDoorCount = 0;
 	m_modelData.clear();
+
+	if (m_doorBoxes)
+		m_doorBoxes->ModelsChanged();
+}
+
+const ModelInfo* ModelLoader::GetDoorModel(int doorId) const
+{
+	auto iter = m_modelData.find(doorId);
+	if (iter == m_modelData.end() || !iter->second)
+		return nullptr;
+
+	return iter->second->GetModelInfo().get();
 }
 
 bool IsSwitchStationary(PDOOR door)
@@ -564,16 +864,30 @@ if (!m_showDoorsUI)
 
 	ImGui::Separator();
 
-	std::vector<PDOOR> doors(pDoorTable->NumEntries);
+	ObjectIndex* objectIndex = g_mq2Nav->Get<ObjectIndex>();
+	const ObjectIndex::DoorSnapshot& snapshot = objectIndex->GetDoors();
 
-	for (DWORD count = 0; count < pDoorTable->NumEntries; count++)
+	// distances are worked out once per frame for every door, then sorted by
+	if (PCHARINFO charInfo = GetCharInfo())
+	{
+		glm::vec3 myPos(charInfo->pSpawn->X, charInfo->pSpawn->Y, charInfo->pSpawn->Z);
+		objectIndex->GetDoorDistances(myPos, true, m_distances);
+	}
+	else
 	{
-		doors[count] = pDoorTable->pDoor[count];
+		m_distances.assign(snapshot.size(), 0.0f);
 	}
 
-	std::sort(doors.begin(), doors.end(),
-		[this](PDOOR a, PDOOR b) -> bool
+	m_order.resize(snapshot.size());
+	for (int i = 0; i < (int)m_order.size(); ++i)
+		m_order[i] = i;
+
+	std::sort(m_order.begin(), m_order.end(),
+		[this, &snapshot](int indexA, int indexB) -> bool
 	{
+		PDOOR a = snapshot.doors[indexA];
+		PDOOR b = snapshot.doors[indexB];
+
 		bool less = false;
 		if (m_doorsSortColumn == Sort_ID)
 			less = a->ID < b->ID;
@@ -584,17 +898,17 @@ if (!m_showDoorsUI)
 		else if (m_doorsSortColumn == Sort_State)
 			less = a->State < b->State;
 		else if (m_doorsSortColumn == Sort_Distance)
-			less = GetDistance(a) < GetDistance(b);
+			less = m_distances[indexA] < m_distances[indexB];
 		
 		return less;
 	});
 
 	if (m_sortReverse)
-		std::reverse(doors.begin(), doors.end());
+		std::reverse(m_order.begin(), m_order.end());
 
-	for (auto iter = doors.begin(); iter != doors.end(); ++iter)
+	for (int index : m_order)
 	{
-		PDOOR door = *iter;
+		PDOOR door = snapshot.doors[index];
 
 		ImGui::PushID(door->ID);
 
@@ -615,7 +929,7 @@ if (!m_showDoorsUI)
 		ImGui::NextColumn();
 		ImGui::Text("%d", door->Type); ImGui::NextColumn();
 		ImGui::Text("%d", door->State); ImGui::NextColumn();
-		ImGui::Text("%.2f", GetDistance(door)); ImGui::NextColumn();
+		ImGui::Text("%.2f", m_distances[index]); ImGui::NextColumn();
 
 		if (targetted)
 			ImGui::PopStyleColor();
@@ -647,28 +961,6 @@ if (!m_showDoorsUI)
 	ImGui::End();
 }
 
-float DoorsDebugUI::GetDistance(PDOOR door)
-{
-	PCHARINFO charInfo = GetCharInfo();
-	if (!charInfo)
-		return 0;
-
-	glm::vec3 myPos(charInfo->pSpawn->X, charInfo->pSpawn->Y, charInfo->pSpawn->Z);
-	if (myPos != m_lastPos)
-		m_distanceCache.clear();
-	m_lastPos = myPos;
-
-	auto it = m_distanceCache.find(door->ID);
-	if (it != m_distanceCache.end())
-		return it->second;
-
-	glm::vec3 doorPos(door->DefaultX, door->DefaultY, door->DefaultZ);
-	float distance = glm::distance(myPos, doorPos);
-
-	m_distanceCache[door->ID] = distance;
-	return distance;
-}
-
 
 void ModelLoader::OnUpdateUI()
 {
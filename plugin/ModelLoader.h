@@ -15,11 +15,14 @@
 #include <d3dx9.h>
 #include <d3d9caps.h>
 
+#include <chrono>
+#include <future>
 #include <string>
 #include <vector>
 #include <map>
 
 class ModelData;
+class DoorBoxRenderer;
 class DoorsDebugUI;
 
 class ModelLoader : public NavModule
@@ -32,17 +35,28 @@ public:
 	virtual void Shutdown() override;
 	virtual void OnPulse() override;
 
+	// door models and target highlights are only for display
+	virtual PulsePriority GetPulsePriority() const override { return PulsePriority::Background; }
+	virtual float GetPulseBudget() const override { return 1.0f; }
+
 	void SetZoneId(int zoneId);
 	void Reset();
 
 	void OnUpdateUI();
 
+	// bounds of the model of a door, once the models of the zone are loaded
+	const ModelInfo* GetDoorModel(int doorId) const;
+	size_t GetDoorModelCount() const { return m_modelData.size(); }
+
 private:
 	void RenderDoorObjectUI(PDOOR door, bool target = false);
 
 	void UpdateModels();
+	void CheckPendingModels();
 	void DumpDoors();
 
+	using DoorModelList = std::vector<std::pair<int, std::shared_ptr<ModelInfo>>>;
+
 private:
 	int m_zoneId = 0;
 	std::string m_zoneFile;
@@ -53,6 +67,23 @@ private:
 	std::map<int, std::shared_ptr<ModelData>> m_modelData;
 
 	std::unique_ptr<DoorsDebugUI> m_doorsUI;
+	std::unique_ptr<DoorBoxRenderer> m_doorBoxes;
+
+	// door models are read out of the zone archives on a worker thread. The
+	// result is picked up on the pulse, where the device objects are created.
+	std::future<DoorModelList> m_pendingModels;
+	std::chrono::steady_clock::time_point m_pendingModelsStart;
+	int m_pendingZoneId = 0;
+	int m_pendingDoorCount = 0;
+
+	// the door config file is written on a worker thread, and only when its
+	// contents change.
+	std::future<void> m_pendingDump;
+	std::string m_dumpedDoorsFile;
+	uint64_t m_dumpedDoorsHash = 0;
 };
 
 void DumpDataUI(void* ptr, DWORD length);
+
+float GetDoorScale(PDOOR door);
+bool IsSwitchStationary(PDOOR door);
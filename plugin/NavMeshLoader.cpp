@@ -3,13 +3,20 @@
 //
 
 #include "NavMeshLoader.h"
+#include "MQ2Nav_Settings.h"
 #include "MQ2Nav_Util.h"
 #include "MQ2Navigation.h"
+#include "ZoneInTimeline.h"
 
 #include <DetourNavMesh.h>
 #include <DetourCommon.h>
+
+#include <algorithm>
 #include <ctime>
 
+// how often the mesh file is checked for changes when auto reloading
+static const int FILE_CHECK_INTERVAL_MS = 1000;
+
 //============================================================================
 
 NavMeshLoader::NavMeshLoader(Context* context, NavMesh* mesh)
@@ -42,16 +49,34 @@ void NavMeshLoader::SetZoneId(int zoneId)
 		else
 		{
 			m_context->Log(LogLevel::INFO, "Zone changed to: %s", m_zoneShortName.c_str());
+
+			CacheCurrentMesh();
 			m_navMesh->SetZoneName(m_zoneShortName);
 
 			if (m_autoLoad)
 			{
-				m_navMesh->LoadNavMeshFile();
+				bool cached;
+				{
+					ScopedZoneInStage stage(g_mq2Nav->Get<ZoneInTimeline>(), ZoneInStage::MeshSwap);
+					cached = TakeFromCache(m_zoneShortName);
+				}
+
+				if (cached)
+				{
+					WriteChatf(PLUGIN_MSG "\agLoaded cached mesh for \am%s\ax", m_zoneShortName.c_str());
+				}
+				else
+				{
+					LoadNavMesh();
+				}
+
+				QueuePreloads();
 			}
 		}
 	}
 	else
 	{
+		CacheCurrentMesh();
 		m_navMesh->ResetNavMesh();
 	}
 }
@@ -61,11 +86,127 @@ void NavMeshLoader::SetAutoLoad(bool autoLoad)
 	m_autoLoad = autoLoad;
 }
 
-bool NavMeshLoader::LoadNavMesh()
+bool NavMeshLoader::LoadNavMesh(bool patch)
+{
+	if (m_zoneShortName.empty() || m_navMesh->GetDataFileName().empty())
+	{
+		ReportLoadResult(NavMesh::LoadResult::MissingFile);
+		return false;
+	}
+
+	// a load that is still running for another zone is put aside and
+	// discarded when it completes.
+	if (IsLoading())
+	{
+		if (m_pendingZone == m_zoneShortName)
+		{
+			m_pendingPatch &= patch;
+			return true;
+		}
+
+		m_discardedLoads.push_back({ std::move(m_pendingMesh), std::move(m_pendingLoad) });
+	}
+
+	// load into a separate navmesh so that the current one stays usable until
+	// the new one is ready.
+	m_pendingZone = m_zoneShortName;
+	m_pendingPatch = patch;
+	m_pendingMesh = CreateNavMesh(m_zoneShortName);
+
+	NavMesh* pendingMesh = m_pendingMesh.get();
+	m_pendingLoad = std::async(std::launch::async,
+		[pendingMesh]() { return pendingMesh->LoadNavMeshFile(); });
+
+	// entering the zone isn't done until the new mesh is in
+	if (!patch)
+		g_mq2Nav->Get<ZoneInTimeline>()->StartStage(ZoneInStage::MeshSwap);
+
+	return true;
+}
+
+std::unique_ptr<NavMesh> NavMeshLoader::CreateNavMesh(const std::string& zoneShortName) const
+{
+	auto mesh = std::make_unique<NavMesh>(m_context, m_navMesh->GetNavMeshDirectory(),
+		zoneShortName);
+	mesh->SetTileStreamingRadius(m_navMesh->GetTileStreamingRadius());
+	mesh->SetShareTileData(m_navMesh->GetShareTileData());
+	mesh->SetSimplifyDetailMeshes(m_navMesh->GetSimplifyDetailMeshes());
+	mesh->SetAgentHeight(GetAgentHeight());
+
+	return mesh;
+}
+
+float NavMeshLoader::GetAgentHeight() const
+{
+	if (!m_selectAgentProfile)
+		return 0.0f;
+
+	PCHARINFO charInfo = GetCharInfo();
+	if (!charInfo || !charInfo->pSpawn)
+		return 0.0f;
+
+	return charInfo->pSpawn->AvatarHeight;
+}
+
+void NavMeshLoader::CheckPendingLoad()
+{
+	m_discardedLoads.erase(std::remove_if(m_discardedLoads.begin(), m_discardedLoads.end(),
+		[](const DiscardedLoad& discarded)
+		{
+			return discarded.load.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+		}), m_discardedLoads.end());
+
+	if (!IsLoading())
+		return;
+
+	if (m_pendingLoad.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		return;
+
+	// swapping the mesh in waits for a pulse with room for it
+	ZoneInTimeline* timeline = g_mq2Nav->Get<ZoneInTimeline>();
+	if (!timeline->CanRunStage(ZoneInStage::MeshSwap))
+		return;
+
+	NavMesh::LoadResult result = m_pendingLoad.get();
+	std::unique_ptr<NavMesh> pendingMesh = std::move(m_pendingMesh);
+
+	// zone changed while the mesh was loading
+	if (m_pendingZone != m_navMesh->GetZoneName())
+		return;
+
+	const NavMeshStats& loadStats = pendingMesh->GetLoadStats();
+	timeline->AddBackgroundTime(ZoneInStage::MeshRead, loadStats.readMs);
+	timeline->AddBackgroundTime(ZoneInStage::MeshParse, loadStats.parseMs);
+	timeline->AddBackgroundTime(ZoneInStage::MeshInflate, loadStats.inflateMs);
+	timeline->AddBackgroundTime(ZoneInStage::MeshAddTiles, loadStats.addTileMs);
+
+	ScopedZoneInStage stage(timeline, ZoneInStage::MeshSwap);
+
+	if (result == NavMesh::LoadResult::Success)
+	{
+		UpdateFileTime();
+
+		// keep the current navmesh and swap in the tiles that were rebuilt
+		if (m_pendingPatch)
+		{
+			int tilesChanged = m_navMesh->PatchNavMesh(*pendingMesh);
+			if (tilesChanged >= 0)
+			{
+				WriteChatf(PLUGIN_MSG "\agUpdated %d tiles of mesh for \am%s\ax", tilesChanged,
+					m_zoneShortName.c_str());
+				return;
+			}
+		}
+
+		m_navMesh->AdoptNavMesh(*pendingMesh);
+	}
+
+	ReportLoadResult(result);
+}
+
+void NavMeshLoader::ReportLoadResult(NavMesh::LoadResult result)
 {
-	NavMesh::LoadResult result = m_navMesh->LoadNavMeshFile();
 	std::string meshFile = m_navMesh->GetDataFileName();
-	bool success = false;
 
 	switch (result)
 	{
@@ -75,19 +216,15 @@ bool NavMeshLoader::LoadNavMesh()
 		break;
 
 	case NavMesh::LoadResult::Success:
-		WriteChatf(PLUGIN_MSG "\agSuccessfully loaded mesh for \am%s\ax", m_zoneShortName.c_str());
+		if (!m_navMesh->GetLoadedAgentProfile().empty())
 		{
-			// Get filetime
-			HANDLE hFile = CreateFile(meshFile.c_str(), GENERIC_READ, FILE_SHARE_READ,
-				NULL, OPEN_EXISTING, 0, NULL);
-			if (hFile != INVALID_HANDLE_VALUE)
-			{
-				GetFileTime(hFile, NULL, NULL, &m_fileTime);
-			}
-			CloseHandle(hFile);
+			WriteChatf(PLUGIN_MSG "\agSuccessfully loaded mesh for \am%s\ax (agent profile \am%s\ax)",
+				m_zoneShortName.c_str(), m_navMesh->GetLoadedAgentProfile().c_str());
+		}
+		else
+		{
+			WriteChatf(PLUGIN_MSG "\agSuccessfully loaded mesh for \am%s\ax", m_zoneShortName.c_str());
 		}
-
-		success = true;
 		break;
 
 	case NavMesh::LoadResult::MissingFile:
@@ -108,44 +245,74 @@ bool NavMeshLoader::LoadNavMesh()
 		WriteChatf(PLUGIN_MSG "\arCouldn't load mesh file. It isn't for this zone.");
 		break;
 	}
+}
+
+static bool GetMeshFileTime(const std::string& meshFile, FILETIME& fileTime)
+{
+	HANDLE hFile = CreateFile(meshFile.c_str(), GENERIC_READ, FILE_SHARE_READ,
+		NULL, OPEN_EXISTING, 0, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	bool success = GetFileTime(hFile, NULL, NULL, &fileTime) != 0;
+	CloseHandle(hFile);
 
 	return success;
 }
 
+void NavMeshLoader::UpdateFileTime()
+{
+	GetMeshFileTime(m_navMesh->GetDataFileName(), m_fileTime);
+}
+
 void NavMeshLoader::OnPulse()
 {
-	if (m_autoReload)
-	{
-		clock::time_point now = clock::now();
-		if (now - m_lastUpdate > std::chrono::seconds(1))
-		{
-			m_lastUpdate = now;
+	CheckPendingLoad();
+	UpdatePreload();
 
-			if (m_navMesh->IsNavMeshLoadedFromDisk())
-			{
-				std::string filename = m_navMesh->GetDataFileName();
+	// rebuild tiles around obstacles that were added or removed
+	m_navMesh->UpdateTileCache();
 
-				// Get the current filetime
-				FILETIME currentFileTime;
+	if (m_navMesh->GetTileStreamingRadius() > 0.0f)
+	{
+		PCHARINFO charInfo = GetCharInfo();
+		if (charInfo && charInfo->pSpawn)
+		{
+			PSPAWNINFO me = charInfo->pSpawn;
+			m_navMesh->UpdateStreamingPosition(glm::vec3{ me->X, me->FloorHeight, me->Y });
+		}
+	}
 
-				HANDLE hFile = CreateFile(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
-					NULL, OPEN_EXISTING, 0, NULL);
-				if (hFile != INVALID_HANDLE_VALUE)
-				{
-					GetFileTime(hFile, NULL, NULL, &currentFileTime);
-
-					// Reload file *if* it is 5 seconds old AND newer than existing
-					if (CompareFileTime(&currentFileTime, &m_fileTime))
-					{
-						m_context->Log(LogLevel::DEBUG,
-							"Current file time is newer than old file time, refreshing");
-						LoadNavMesh();
-					}
-				}
+	// a changed mesh file can wait a moment to be noticed
+	auto now = std::chrono::steady_clock::now();
+	if (m_autoReload && now - m_lastFileCheck >= std::chrono::milliseconds(FILE_CHECK_INTERVAL_MS))
+	{
+		m_lastFileCheck = now;
+		m_fileWatcher.Watch(m_navMesh->GetNavMeshDirectory());
 
-				CloseHandle(hFile);
+		// only touches the file once the watcher saw it change
+		if (m_navMesh->IsNavMeshLoadedFromDisk() && !IsLoading()
+			&& m_fileWatcher.HasChanged(m_navMesh->GetZoneName() + NAVMESH_FILE_EXTENSION))
+		{
+			FILETIME currentFileTime;
+			if (GetMeshFileTime(m_navMesh->GetDataFileName(), currentFileTime)
+				&& CompareFileTime(&currentFileTime, &m_fileTime))
+			{
+				m_context->Log(LogLevel::DEBUG,
+					"Current file time is newer than old file time, refreshing");
+				LoadNavMesh(true);
 			}
 		}
+
+		// a patch is applied to the mesh file by the load, see NavMesh::ApplyMeshPatch
+		if (m_navMesh->IsNavMeshLoadedFromDisk() && !IsLoading()
+			&& m_fileWatcher.HasChanged(m_navMesh->GetZoneName() + NAVMESH_PATCH_EXTENSION)
+			&& GetFileAttributesA((m_navMesh->GetNavMeshDirectory() + "\\" + m_navMesh->GetZoneName()
+				+ NAVMESH_PATCH_EXTENSION).c_str()) != INVALID_FILE_ATTRIBUTES)
+		{
+			m_context->Log(LogLevel::DEBUG, "Mesh patch arrived, refreshing");
+			LoadNavMesh(true);
+		}
 	}
 }
 
@@ -156,6 +323,8 @@ void NavMeshLoader::SetGameState(int GameState)
 		// into the same zone (succor), so no use unload the mesh until
 		// after loading completes.
 		if (GameState != GAMESTATE_ZONING && GameState != GAMESTATE_LOGGINGIN) {
+			m_pendingZone.clear();
+			CacheCurrentMesh();
 			m_navMesh->ResetNavMesh();
 		}
 	}
@@ -168,5 +337,183 @@ void NavMeshLoader::SetAutoReload(bool autoReload)
 	if (m_autoReload != autoReload)
 	{
 		m_autoReload = autoReload;
+
+		if (!m_autoReload)
+			m_fileWatcher.Watch(std::string());
+	}
+}
+
+//----------------------------------------------------------------------------
+// mesh cache
+
+void NavMeshLoader::SetMeshCacheSize(size_t bytes)
+{
+	m_meshCacheSize = bytes;
+
+	if (m_meshCacheSize == 0)
+	{
+		m_preloadQueue.clear();
+		m_meshCache.clear();
+	}
+	else
+	{
+		TrimCache();
+	}
+}
+
+void NavMeshLoader::SetPreloadZones(bool preload)
+{
+	m_preloadZones = preload;
+
+	if (!m_preloadZones)
+		m_preloadQueue.clear();
+}
+
+void NavMeshLoader::CacheCurrentMesh()
+{
+	if (m_meshCacheSize == 0 || !m_navMesh->IsNavMeshLoadedFromDisk())
+		return;
+
+	// the navmesh itself has to stay with the plugin, so its contents move into a
+	// new one for the cache.
+	auto mesh = std::make_unique<NavMesh>(m_context, m_navMesh->GetNavMeshDirectory(),
+		m_navMesh->GetZoneName());
+	mesh->AdoptNavMesh(*m_navMesh);
+
+	AddToCache(std::move(mesh), m_fileTime, true);
+}
+
+void NavMeshLoader::AddToCache(std::unique_ptr<NavMesh> mesh, const FILETIME& fileTime, bool used)
+{
+	std::string zoneShortName = mesh->GetZoneName();
+
+	m_meshCache.remove_if([&](const CachedMesh& cached) { return cached.zoneShortName == zoneShortName; });
+
+	CachedMesh cached;
+	cached.zoneShortName = zoneShortName;
+	cached.size = mesh->GetResidentTileDataSize();
+	cached.mesh = std::move(mesh);
+	cached.fileTime = fileTime;
+
+	// a mesh that was preloaded and not used yet is the first to go, so it can't
+	// push out the zones that were actually visited.
+	if (used)
+		m_meshCache.push_front(std::move(cached));
+	else
+		m_meshCache.push_back(std::move(cached));
+
+	TrimCache();
+}
+
+bool NavMeshLoader::TakeFromCache(const std::string& zoneShortName)
+{
+	auto iter = std::find_if(m_meshCache.begin(), m_meshCache.end(),
+		[&](const CachedMesh& cached) { return cached.zoneShortName == zoneShortName; });
+	if (iter == m_meshCache.end())
+		return false;
+
+	CachedMesh cached = std::move(*iter);
+	m_meshCache.erase(iter);
+
+	// the file changed since it was cached, or it was loaded for another agent
+	FILETIME fileTime;
+	if (!GetMeshFileTime(cached.mesh->GetDataFileName(), fileTime)
+		|| CompareFileTime(&fileTime, &cached.fileTime) != 0
+		|| cached.mesh->GetAgentHeight() != GetAgentHeight())
+	{
+		return false;
+	}
+
+	m_navMesh->AdoptNavMesh(*cached.mesh);
+	m_fileTime = cached.fileTime;
+	return true;
+}
+
+bool NavMeshLoader::IsCached(const std::string& zoneShortName) const
+{
+	return std::any_of(m_meshCache.begin(), m_meshCache.end(),
+		[&](const CachedMesh& cached) { return cached.zoneShortName == zoneShortName; });
+}
+
+void NavMeshLoader::TrimCache()
+{
+	size_t total = 0;
+	for (const CachedMesh& cached : m_meshCache)
+		total += cached.size;
+
+	while (!m_meshCache.empty() && total > m_meshCacheSize)
+	{
+		total -= m_meshCache.back().size;
+		m_meshCache.pop_back();
+	}
+}
+
+//----------------------------------------------------------------------------
+// preloading
+
+void NavMeshLoader::QueuePreloads()
+{
+	m_preloadQueue.clear();
+
+	if (!m_preloadZones || m_meshCacheSize == 0)
+		return;
+
+	for (const std::string& zoneShortName : mq2nav::GetPreloadZones(m_zoneShortName))
+		PreloadZone(zoneShortName);
+}
+
+void NavMeshLoader::PreloadZone(const std::string& zoneShortName)
+{
+	if (m_meshCacheSize == 0 || zoneShortName.empty())
+		return;
+
+	if (std::find(m_preloadQueue.begin(), m_preloadQueue.end(), zoneShortName) == m_preloadQueue.end())
+		m_preloadQueue.push_back(zoneShortName);
+}
+
+void NavMeshLoader::UpdatePreload()
+{
+	if (m_preloadLoad.valid())
+	{
+		if (m_preloadLoad.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			return;
+
+		NavMesh::LoadResult result = m_preloadLoad.get();
+		std::unique_ptr<NavMesh> mesh = std::move(m_preloadMesh);
+
+		FILETIME fileTime;
+		if (result == NavMesh::LoadResult::Success
+			&& m_meshCacheSize != 0
+			&& mesh->GetZoneName() != m_navMesh->GetZoneName()
+			&& GetMeshFileTime(mesh->GetDataFileName(), fileTime))
+		{
+			m_context->Log(LogLevel::DEBUG, "Preloaded mesh for %s", mesh->GetZoneName().c_str());
+			AddToCache(std::move(mesh), fileTime, false);
+		}
+	}
+
+	// the current zone's mesh comes first
+	if (IsLoading())
+		return;
+
+	while (!m_preloadQueue.empty())
+	{
+		std::string zoneShortName = std::move(m_preloadQueue.front());
+		m_preloadQueue.pop_front();
+
+		if (zoneShortName == m_zoneShortName || IsCached(zoneShortName))
+			continue;
+
+		m_preloadMesh = CreateNavMesh(zoneShortName);
+		if (m_preloadMesh->GetDataFileName().empty())
+		{
+			m_preloadMesh.reset();
+			continue;
+		}
+
+		NavMesh* preloadMesh = m_preloadMesh.get();
+		m_preloadLoad = std::async(std::launch::async,
+			[preloadMesh]() { return preloadMesh->LoadNavMeshFile(); });
+		break;
 	}
 }
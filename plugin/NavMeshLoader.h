@@ -5,6 +5,7 @@
 #pragma once
 
 #include "MQ2Plugin.h"
+#include "MeshFileWatcher.h"
 
 #include "common/Context.h"
 #include "common/NavMesh.h"
@@ -12,8 +13,12 @@
 #include "common/Signal.h"
 
 #include <chrono>
+#include <deque>
+#include <future>
+#include <list>
 #include <string>
 #include <memory>
+#include <vector>
 
 class dtNavMesh;
 class MQ2NavigationPlugin;
@@ -28,6 +33,9 @@ public:
 
 	// will do actions on specific intervals
 	virtual void OnPulse() override;
+
+	// finishing loads and streaming tiles around the player can't wait
+	virtual PulsePriority GetPulsePriority() const override { return PulsePriority::Critical; }
 	virtual void SetGameState(int GameState) override;
 
 	// update the current zone. This will trigger a reload of the navmesh file if
@@ -45,9 +53,68 @@ public:
 	void SetAutoReload(bool autoReload);
 	bool GetAutoReload() const { return m_autoReload; }
 
-	// try to reload the navmesh for the current zone. Returns true if the
-	// navmesh successfully loads
-	bool LoadNavMesh();
+	// start loading the navmesh for the current zone in the background. The mesh
+	// is swapped in on a later pulse once it has finished loading. If patch is
+	// true, only the tiles that changed are swapped in when possible. Returns
+	// false if a load could not be started.
+	bool LoadNavMesh(bool patch = false);
+
+	// returns true while a navmesh is being loaded in the background
+	bool IsLoading() const { return m_pendingLoad.valid(); }
+
+	// Meshes of zones that were left are kept in memory, up to this many bytes of
+	// tile data, so zoning back doesn't read the file again. 0 disables the cache.
+	void SetMeshCacheSize(size_t bytes);
+	size_t GetMeshCacheSize() const { return m_meshCacheSize; }
+
+	// when enabled, meshes of the zones listed for the current zone in the
+	// PreloadZones section of the ini are loaded into the cache in the background
+	void SetPreloadZones(bool preload);
+	bool GetPreloadZones() const { return m_preloadZones; }
+
+	// queue a zone to be loaded into the cache in the background
+	void PreloadZone(const std::string& zoneShortName);
+
+	// when enabled, meshes built with more than one agent profile are loaded with
+	// the profile that fits the character's height
+	void SetSelectAgentProfile(bool select) { m_selectAgentProfile = select; }
+	bool GetSelectAgentProfile() const { return m_selectAgentProfile; }
+
+private:
+	struct CachedMesh
+	{
+		std::string zoneShortName;
+		std::unique_ptr<NavMesh> mesh;
+		FILETIME fileTime;
+		size_t size;
+	};
+
+	// a load that was replaced by one for another zone. The mesh goes first, so
+	// the future waits for the load before it is freed.
+	struct DiscardedLoad
+	{
+		std::unique_ptr<NavMesh> mesh;
+		std::future<NavMesh::LoadResult> load;
+	};
+
+	std::unique_ptr<NavMesh> CreateNavMesh(const std::string& zoneShortName) const;
+
+	// height of the agent to pick a profile for, 0 to load the main mesh
+	float GetAgentHeight() const;
+
+	void CheckPendingLoad();
+	void ReportLoadResult(NavMesh::LoadResult result);
+	void UpdateFileTime();
+
+	// mesh cache
+	void CacheCurrentMesh();
+	void AddToCache(std::unique_ptr<NavMesh> mesh, const FILETIME& fileTime, bool used);
+	bool TakeFromCache(const std::string& zoneShortName);
+	bool IsCached(const std::string& zoneShortName) const;
+	void TrimCache();
+
+	void QueuePreloads();
+	void UpdatePreload();
 
 private:
 	Context* m_context = nullptr;
@@ -57,11 +124,31 @@ private:
 	int m_zoneId = -1;
 
 	bool m_autoLoad = true;
+	bool m_selectAgentProfile = true;
 
 	// auto reloading
 	bool m_autoReload = true;
 	FILETIME m_fileTime = { 0, 0 };
 
-	typedef std::chrono::high_resolution_clock clock;
-	clock::time_point m_lastUpdate = clock::now();
+	MeshFileWatcher m_fileWatcher;
+	std::chrono::steady_clock::time_point m_lastFileCheck;
+
+	// background load. The pending mesh is only touched by the worker until
+	// the future is ready.
+	std::future<NavMesh::LoadResult> m_pendingLoad;
+	std::unique_ptr<NavMesh> m_pendingMesh;
+	std::string m_pendingZone;
+	bool m_pendingPatch = false;
+
+	// loads can't be stopped, so replaced ones are kept until they finish
+	std::vector<DiscardedLoad> m_discardedLoads;
+
+	// most recently used first
+	std::list<CachedMesh> m_meshCache;
+	size_t m_meshCacheSize = 0;
+
+	bool m_preloadZones = false;
+	std::deque<std::string> m_preloadQueue;
+	std::unique_ptr<NavMesh> m_preloadMesh;
+	std::future<NavMesh::LoadResult> m_preloadLoad;
 };
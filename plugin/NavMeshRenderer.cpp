@@ -9,10 +9,14 @@
 #include "RenderHandler.h"
 #include "DebugDrawDX.h"
 #include "NavMeshLoader.h"
+#include "PerfStats.h"
+#include "ZoneInTimeline.h"
 
 #include "common/NavMesh.h"
+#include "common/Profiler.h"
 
 #include <cassert>
+#include <DetourCommon.h>
 #include <DetourDebugDraw.h>
 #include <RecastDebugDraw.h>
 #include <DetourNavMesh.h>
@@ -20,6 +24,9 @@
 
 #include <imgui.h>
 
+#include <algorithm>
+#include <future>
+
 #define GLM_FORCE_RADIANS
 #include <glm.hpp>
 
@@ -27,33 +34,20 @@ extern IDirect3DDevice9* g_pDevice;
 
 //----------------------------------------------------------------------------
 
-class NavMeshDebugDraw : public DebugDrawDX
-{
-public:
-	NavMeshDebugDraw(NavMeshRenderer* renderer, RenderGroup* grp)
-		: DebugDrawDX(grp)
-		, m_renderer(renderer) {}
-
-	virtual unsigned int polyToCol(const dtPoly* poly) override
-	{
-		if (poly)
-		{
-			return m_renderer->GetColorForPolyArea(poly->getArea());
-		}
+// detail edges closer than this to a polygon edge are drawn as part of it, the
+// same threshold as drawMeshTile's
+static const float OVERLAY_EDGE_THRESHOLD = 0.01f * 0.01f;
 
-		return 0;
-	}
-
-private:
-	NavMeshRenderer* m_renderer = nullptr;
-};
+// camera distances at which tiles of the overlay drop to polygons only, and then
+// to their outer edges only
+static const float OVERLAY_LOD_POLYS_DISTANCE = 400.0f;
+static const float OVERLAY_LOD_OUTLINE_DISTANCE = 1200.0f;
 
 //----------------------------------------------------------------------------
 
 NavMeshRenderer::NavMeshRenderer()
 	: m_pDevice(g_pDevice)
 	, m_state(new ConfigurableRenderState)
-	, m_primGroup(std::make_unique<RenderGroup>(g_pDevice))
 {
 }
 
@@ -68,12 +62,17 @@ void NavMeshRenderer::Initialize()
 
 	m_meshConn = m_navMesh->OnNavMeshChanged.Connect(
 		[this]() { UpdateNavMesh(); });
+	m_meshTilesConn = m_navMesh->OnNavMeshTilesChanged.Connect(
+		[this]() { UpdateNavMesh(); });
 
 	g_renderHandler->AddRenderable(this);
 }
 
 void NavMeshRenderer::Shutdown()
 {
+	// while the other modules are still around
+	StopLoad();
+
 	g_renderHandler->RemoveRenderable(this);
 }
 
@@ -81,28 +80,58 @@ void NavMeshRenderer::Shutdown()
 
 void NavMeshRenderer::InvalidateDeviceObjects()
 {
-	CleanupObjects();
+	// the tiles are static, their managed buffers are restored by d3d itself
+	for (auto& entry : m_tiles)
+	{
+		for (auto& group : entry.second->groups)
+			group->InvalidateDeviceObjects();
+	}
+
+	if (m_heatmapGroup)
+		m_heatmapGroup->InvalidateDeviceObjects();
 }
 
 void NavMeshRenderer::CleanupObjects()
 {
 	StopLoad();
 
-	m_primGroup->Reset();
-	m_primGroup->InvalidateDeviceObjects();
-
-	m_primGroup.reset(new RenderGroup(g_pDevice));
+	m_tiles.clear();
+	m_heatmapGroup.reset();
 }
 
 bool NavMeshRenderer::CreateDeviceObjects()
 {
-	return m_primGroup->CreateDeviceObjects();
+	for (auto& entry : m_tiles)
+	{
+		for (auto& group : entry.second->groups)
+			group->CreateDeviceObjects();
+	}
+
+	if (m_heatmapGroup)
+		m_heatmapGroup->CreateDeviceObjects();
+
+	return true;
+}
+
+bool NavMeshRenderer::IsRenderActive(RenderPhase phase) const
+{
+	// Render also tears down the geometry after the overlay is turned off
+	return phase == Renderable::Render_Geometry && (m_enabled || m_loaded);
+}
+
+void NavMeshRenderer::RecordDeviceState()
+{
+	// covers everything the state editor can change
+	m_state->ApplyState(m_pDevice);
 }
 
 void NavMeshRenderer::Render(Renderable::RenderPhase phase)
 {
 	if (phase == Renderable::Render_Geometry)
 	{
+		mq2nav::ScopedPerfTimer timer(mq2nav::PerfTimer::NavMeshRender);
+		MQ2NAV_PROFILE_ZONE("NavMeshRenderer::Render");
+
 		if (m_enabled != m_loaded)
 		{
 			if (m_enabled)
@@ -118,7 +147,12 @@ void NavMeshRenderer::Render(Renderable::RenderPhase phase)
 			m_loaded = m_enabled;
 		}
 
-		if (!m_loaded || m_loading)
+		if (!m_loaded)
+			return;
+
+		FinishLoad();
+
+		if (m_tiles.empty())
 			return;
 
 		m_pDevice->SetPixelShader(nullptr);
@@ -160,26 +194,410 @@ void NavMeshRenderer::Render(Renderable::RenderPhase phase)
 			}
 		}
 
-		m_primGroup->Render(phase);
+		D3DXVECTOR3 origin(0.0f, 0.0f, 0.0f);
+		float maxDistance = 0.0f;
+
+		PCHARINFO charInfo = GetCharInfo();
+		if (charInfo && charInfo->pSpawn)
+		{
+			origin = D3DXVECTOR3(charInfo->pSpawn->Y, charInfo->pSpawn->X, charInfo->pSpawn->Z);
+			maxDistance = mq2nav::GetSettings().navmesh_overlay_radius;
+		}
+
+		RenderCullState cull;
+		cull.Update(m_pDevice, origin, maxDistance);
+
+		const bool useLOD = mq2nav::GetSettings().navmesh_overlay_lod;
+
+		// keep drawing the previous tiles until the new set is complete
+		for (auto& entry : m_tiles)
+		{
+			TileChunk& chunk = *entry.second;
+			if (!chunk.groups[Detail_Full]->IsVisible(cull))
+				continue;
+
+			TileDetail detail = Detail_Full;
+			if (useLOD)
+			{
+				float distanceSqr = chunk.groups[Detail_Full]->GetCameraDistanceSqr(cull);
+				if (distanceSqr > OVERLAY_LOD_OUTLINE_DISTANCE * OVERLAY_LOD_OUTLINE_DISTANCE)
+					detail = Detail_Outline;
+				else if (distanceSqr > OVERLAY_LOD_POLYS_DISTANCE * OVERLAY_LOD_POLYS_DISTANCE)
+					detail = Detail_Polys;
+			}
+
+			chunk.groups[detail]->Render(phase);
+		}
+
+		if (m_showHeatmap)
+		{
+			UpdateHeatmap();
+
+			if (m_heatmapGroup)
+				m_heatmapGroup->Render(phase);
+		}
 	}
 }
 
+void NavMeshRenderer::UpdateHeatmap()
+{
+	const QueryHeatmap& heatmap = m_navMesh->GetQueryHeatmap();
+	uint32_t version = heatmap.GetVersion();
+
+	if (m_heatmapGroup && version == m_heatmapVersion)
+		return;
+
+	DWORD tick = GetTickCount();
+	if (m_heatmapGroup && tick - m_heatmapTick < 1000)
+		return;
+
+	m_heatmapVersion = version;
+	m_heatmapTick = tick;
+
+	if (!m_heatmapGroup)
+		m_heatmapGroup = std::make_unique<RenderGroup>(g_pDevice);
+	else
+		m_heatmapGroup->Reset();
+
+	auto navMesh = m_navMesh->GetNavMesh();
+	if (!navMesh)
+		return;
+
+	auto tilesLock = m_navMesh->LockTiles();
+
+	DebugDrawDX dd(m_heatmapGroup.get());
+	heatmap.Draw(&dd, *navMesh);
+}
+
 //----------------------------------------------------------------------------
 
+static uint64_t TileKey(const dtMeshHeader* header)
+{
+	return ((uint64_t)(uint32_t)header->x << 32) | ((uint64_t)(uint16_t)header->y << 16)
+		| (uint16_t)header->layer;
+}
+
+static uint64_t HashTileData(const dtMeshTile* tile)
+{
+	// fnv-1a over the tile data
+	uint64_t hash = 14695981039346656037ull;
+	const uint8_t* bytes = tile->data;
+	for (int i = 0; i < tile->dataSize; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+// the geometry of a tile's overlay, in the lists of a RenderGroup
+struct TileGeometry
+{
+	std::vector<RenderList::Vertex> vertices[RenderList::Prim_Count];
+	std::vector<uint32_t> indices[RenderList::Prim_Count];
+
+	void AddLine(const float* a, const float* b, unsigned int color)
+	{
+		auto& lineVerts = vertices[RenderList::Prim_Lines];
+		auto& lineIndices = indices[RenderList::Prim_Lines];
+
+		lineIndices.push_back(static_cast<uint32_t>(lineVerts.size()));
+		lineVerts.push_back(RenderList::MakeVertex(a, color));
+		lineIndices.push_back(static_cast<uint32_t>(lineVerts.size()));
+		lineVerts.push_back(RenderList::MakeVertex(b, color));
+	}
+};
+
+// collects the lines of the duDebugDraw helpers used for off-mesh connections,
+// the arcs and circles. There are few enough of those for the virtual calls.
+class TileLineCollector : public duDebugDraw
+{
+public:
+	explicit TileLineCollector(TileGeometry& geometry) : m_geometry(geometry) {}
+
+	virtual void depthMask(bool) override {}
+	virtual void texture(bool) override {}
+	virtual void begin(duDebugDrawPrimitives, float) override { m_count = 0; }
+	virtual void end() override {}
+
+	virtual void vertex(const float* pos, unsigned int color) override
+	{
+		if (m_count++ & 1)
+			m_geometry.AddLine(m_first, pos, color);
+		else
+			dtVcopy(m_first, pos);
+	}
+
+	virtual void vertex(const float x, const float y, const float z, unsigned int color) override
+	{
+		const float pos[3] = { x, y, z };
+		vertex(pos, color);
+	}
+
+	virtual void vertex(const float* pos, unsigned int color, const float*) override { vertex(pos, color); }
+	virtual void vertex(const float x, const float y, const float z, unsigned int color, const float, const float) override
+	{
+		vertex(x, y, z, color);
+	}
+
+private:
+	TileGeometry& m_geometry;
+	float m_first[3];
+	int m_count = 0;
+};
+
+static float DistancePtLine2D(const float* pt, const float* p, const float* q)
+{
+	float pqx = q[0] - p[0];
+	float pqz = q[2] - p[2];
+	float dx = pt[0] - p[0];
+	float dz = pt[2] - p[2];
+	float d = pqx * pqx + pqz * pqz;
+	float t = pqx * dx + pqz * dz;
+	if (d != 0) t /= d;
+	dx = p[0] + t * pqx - pt[0];
+	dz = p[2] + t * pqz - pt[2];
+	return dx * dx + dz * dz;
+}
+
+static void SetTileGeometry(TileGeometry& geometry, RenderGroup& group)
+{
+	for (int i = 0; i < RenderList::Prim_Count; ++i)
+	{
+		if (!geometry.indices[i].empty())
+		{
+			group.GetRenderList(static_cast<RenderList::PrimitiveType>(i))->SetGeometry(
+				std::move(geometry.vertices[i]), std::move(geometry.indices[i]));
+		}
+	}
+}
+
+// The lower levels of detail of a tile: its polygons as fans without the detail
+// mesh along with its outer edges, and the outer edges on their own.
+static void BuildTileOutlines(const dtMeshTile* tile, const unsigned int* areaColors,
+	RenderGroup& polys, RenderGroup& outline)
+{
+	const dtMeshHeader* header = tile->header;
+	TileGeometry polyGeometry, outlineGeometry;
+
+	auto& triVertices = polyGeometry.vertices[RenderList::Prim_Triangles];
+	auto& triList = polyGeometry.indices[RenderList::Prim_Triangles];
+	triVertices.reserve(header->polyCount * DT_VERTS_PER_POLYGON);
+	triList.reserve(header->polyCount * (DT_VERTS_PER_POLYGON - 2) * 3);
+
+	for (int i = 0; i < header->polyCount; ++i)
+	{
+		const dtPoly* p = &tile->polys[i];
+		if (p->getType() == DT_POLYTYPE_OFFMESH_CONNECTION)
+			continue;
+
+		const unsigned int col = duTransCol(areaColors[p->getArea()], 64);
+
+		const uint32_t base = static_cast<uint32_t>(triVertices.size());
+		for (int k = 0; k < p->vertCount; ++k)
+			triVertices.push_back(RenderList::MakeVertex(&tile->verts[p->verts[k] * 3], col));
+
+		// same winding as the detail triangles
+		for (int k = 2; k < p->vertCount; ++k)
+		{
+			triList.push_back(base);
+			triList.push_back(base + k - 1);
+			triList.push_back(base + k);
+		}
+
+		for (int j = 0; j < p->vertCount; ++j)
+		{
+			if (p->neis[j] != 0)
+				continue;
+
+			outlineGeometry.AddLine(&tile->verts[p->verts[j] * 3],
+				&tile->verts[p->verts[(j + 1) % p->vertCount] * 3], duRGBA(0, 48, 64, 220));
+		}
+	}
+
+	polyGeometry.vertices[RenderList::Prim_Lines] = outlineGeometry.vertices[RenderList::Prim_Lines];
+	polyGeometry.indices[RenderList::Prim_Lines] = outlineGeometry.indices[RenderList::Prim_Lines];
+
+	SetTileGeometry(polyGeometry, polys);
+	SetTileGeometry(outlineGeometry, outline);
+}
+
+// Builds the same overlay as drawMeshTile with DU_DRAWNAVMESH_OFFMESHCONS, straight
+// into vertex and index arrays sized for the tile up front. Polygons share their
+// vertices between their detail triangles, and each detail edge on the boundary
+// is only matched against the edges of its own polygon once.
+static void BuildTileGeometry(const dtMeshTile* tile, const unsigned int* areaColors, RenderGroup& group)
+{
+	const dtMeshHeader* header = tile->header;
+	TileGeometry geometry;
+
+	size_t triVerts = 0, triIndices = 0, boundaryEdges = 0;
+	for (int i = 0; i < header->polyCount; ++i)
+	{
+		const dtPoly* p = &tile->polys[i];
+		if (p->getType() == DT_POLYTYPE_OFFMESH_CONNECTION)
+			continue;
+
+		const dtPolyDetail* pd = &tile->detailMeshes[i];
+		triVerts += p->vertCount + pd->vertCount;
+		triIndices += pd->triCount * 3;
+		boundaryEdges += p->vertCount;
+	}
+
+	geometry.vertices[RenderList::Prim_Triangles].reserve(triVerts);
+	geometry.indices[RenderList::Prim_Triangles].reserve(triIndices);
+	geometry.vertices[RenderList::Prim_Lines].reserve(boundaryEdges * 2);
+	geometry.indices[RenderList::Prim_Lines].reserve(boundaryEdges * 2);
+
+	auto& triVertices = geometry.vertices[RenderList::Prim_Triangles];
+	auto& triList = geometry.indices[RenderList::Prim_Triangles];
+
+	for (int i = 0; i < header->polyCount; ++i)
+	{
+		const dtPoly* p = &tile->polys[i];
+		if (p->getType() == DT_POLYTYPE_OFFMESH_CONNECTION)
+			continue;
+
+		const dtPolyDetail* pd = &tile->detailMeshes[i];
+		const unsigned int col = duTransCol(areaColors[p->getArea()], 64);
+
+		// detail triangles index the polygon's vertices first, then its detail
+		// vertices, which is the order they're added in
+		const uint32_t base = static_cast<uint32_t>(triVertices.size());
+		for (int k = 0; k < p->vertCount; ++k)
+			triVertices.push_back(RenderList::MakeVertex(&tile->verts[p->verts[k] * 3], col));
+		for (int k = 0; k < pd->vertCount; ++k)
+			triVertices.push_back(RenderList::MakeVertex(&tile->detailVerts[(pd->vertBase + k) * 3], col));
+
+		// edges to other tiles are lighter when they're connected
+		uint8_t linkedEdges = 0;
+		for (unsigned int k = p->firstLink; k != DT_NULL_LINK; k = tile->links[k].next)
+			linkedEdges |= 1 << tile->links[k].edge;
+
+		unsigned int edgeColors[DT_VERTS_PER_POLYGON];
+		for (int j = 0; j < p->vertCount; ++j)
+		{
+			if (p->neis[j] == 0)
+				edgeColors[j] = duRGBA(0, 48, 64, 220);
+			else if (p->neis[j] & DT_EXT_LINK)
+				edgeColors[j] = (linkedEdges & (1 << j)) ? duRGBA(255, 255, 255, 48) : duRGBA(0, 0, 0, 48);
+			else
+				edgeColors[j] = duRGBA(0, 48, 64, 32);
+		}
+
+		for (int k = 0; k < pd->triCount; ++k)
+		{
+			const unsigned char* t = &tile->detailTris[(pd->triBase + k) * 4];
+
+			const float* tv[3];
+			for (int m = 0; m < 3; ++m)
+			{
+				triList.push_back(base + t[m]);
+
+				if (t[m] < p->vertCount)
+					tv[m] = &tile->verts[p->verts[t[m]] * 3];
+				else
+					tv[m] = &tile->detailVerts[(pd->vertBase + (t[m] - p->vertCount)) * 3];
+			}
+
+			for (int m = 0, n = 2; m < 3; n = m++)
+			{
+				if (((t[3] >> (n * 2)) & 0x3) == 0)
+					continue; // inner detail edge
+
+				for (int j = 0; j < p->vertCount; ++j)
+				{
+					const float* v0 = &tile->verts[p->verts[j] * 3];
+					const float* v1 = &tile->verts[p->verts[(j + 1) % p->vertCount] * 3];
+
+					if (DistancePtLine2D(tv[n], v0, v1) < OVERLAY_EDGE_THRESHOLD
+						&& DistancePtLine2D(tv[m], v0, v1) < OVERLAY_EDGE_THRESHOLD)
+					{
+						geometry.AddLine(tv[n], tv[m], edgeColors[j]);
+					}
+				}
+			}
+		}
+	}
+
+	// off-mesh connections
+	TileLineCollector lines(geometry);
+	lines.begin(DU_DRAW_LINES, 2.0f);
+
+	for (int i = 0; i < header->polyCount; ++i)
+	{
+		const dtPoly* p = &tile->polys[i];
+		if (p->getType() != DT_POLYTYPE_OFFMESH_CONNECTION)
+			continue;
+
+		const unsigned int col = duDarkenCol(duTransCol(areaColors[p->getArea()], 220));
+		const dtOffMeshConnection* con = &tile->offMeshCons[i - header->offMeshBase];
+		const float* va = &tile->verts[p->verts[0] * 3];
+		const float* vb = &tile->verts[p->verts[1] * 3];
+
+		bool startSet = false;
+		bool endSet = false;
+		for (unsigned int k = p->firstLink; k != DT_NULL_LINK; k = tile->links[k].next)
+		{
+			if (tile->links[k].edge == 0)
+				startSet = true;
+			if (tile->links[k].edge == 1)
+				endSet = true;
+		}
+
+		const unsigned int endColor = duRGBA(0, 48, 64, 196);
+		const float startTop[3] = { con->pos[0], con->pos[1] + 0.2f, con->pos[2] };
+		const float endTop[3] = { con->pos[3], con->pos[4] + 0.2f, con->pos[5] };
+
+		geometry.AddLine(va, &con->pos[0], col);
+		duAppendCircle(&lines, con->pos[0], con->pos[1] + 0.1f, con->pos[2], con->rad,
+			startSet ? col : duRGBA(220, 32, 16, 196));
+
+		geometry.AddLine(vb, &con->pos[3], col);
+		duAppendCircle(&lines, con->pos[3], con->pos[4] + 0.1f, con->pos[5], con->rad,
+			endSet ? col : duRGBA(220, 32, 16, 196));
+
+		geometry.AddLine(&con->pos[0], startTop, endColor);
+		geometry.AddLine(&con->pos[3], endTop, endColor);
+
+		duAppendArc(&lines, con->pos[0], con->pos[1], con->pos[2], con->pos[3], con->pos[4], con->pos[5], 0.25f,
+			(con->flags & 1) ? 0.6f : 0, 0.6f, col);
+	}
+
+	// vertices
+	auto& pointVerts = geometry.vertices[RenderList::Prim_Points];
+	auto& points = geometry.indices[RenderList::Prim_Points];
+	pointVerts.reserve(header->vertCount);
+	points.reserve(header->vertCount);
+
+	for (int i = 0; i < header->vertCount; ++i)
+	{
+		points.push_back(static_cast<uint32_t>(pointVerts.size()));
+		pointVerts.push_back(RenderList::MakeVertex(&tile->verts[i * 3], duRGBA(0, 0, 0, 196)));
+	}
+
+	SetTileGeometry(geometry, group);
+}
+
 void NavMeshRenderer::StopLoad()
 {
 	if (m_loadThread.joinable())
 	{
 		m_stopLoading = true;
 		m_loadThread.join();
+
+		g_mq2Nav->Get<ZoneInTimeline>()->FinishStage(ZoneInStage::Overlay);
 	}
+
+	m_pendingTiles.clear();
+	m_loading = false;
 }
 
 void NavMeshRenderer::StartLoad()
 {
 	m_stopLoading = false;
-	m_loading = true;
-	int tilesToLoad = 0;
+	m_progress = 0.0f;
 
 	if (!m_navMesh->IsNavMeshLoaded())
 		return;
@@ -187,31 +605,116 @@ void NavMeshRenderer::StartLoad()
 	std::shared_ptr<const dtNavMesh> navMesh =
 		std::static_pointer_cast<const dtNavMesh>(m_navMesh->GetNavMesh());
 
-	std::shared_ptr<NavMeshDebugDraw> dd = std::make_shared<NavMeshDebugDraw>(
-		this, m_primGroup.get());
-
-	for (int i = 0; i < navMesh->getMaxTiles(); ++i)
+	// tiles are colored by area, so nothing can be reused if the colors changed
+	uint32_t areaColorsHash = 2166136261u;
+	for (const PolyAreaType* area : m_navMesh->GetPolyAreas())
 	{
-		const dtMeshTile* tile = navMesh->getTile(i);
-		if (!tile->header) continue;
-
-		tilesToLoad++;
+		uint32_t values[2] = { area->id, area->color };
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(values);
+		for (size_t i = 0; i < sizeof(values); ++i)
+		{
+			areaColorsHash ^= bytes[i];
+			areaColorsHash *= 16777619u;
+		}
 	}
 
-	auto loadingThread = [this, dd, tilesToLoad, navMesh]() mutable
+	TileChunkMap previousTiles;
+	if (areaColorsHash == m_areaColorsHash)
+		previousTiles = m_tiles;
+	m_areaColorsHash = areaColorsHash;
+
+	// looked up here, the mesh's areas aren't for other threads
+	std::shared_ptr<std::vector<unsigned int>> areaColors = std::make_shared<std::vector<unsigned int>>(DT_MAX_AREAS);
+	for (int i = 0; i < DT_MAX_AREAS; ++i)
+		(*areaColors)[i] = m_navMesh->GetPolyArea(static_cast<uint8_t>(i)).color;
+
+	m_loading = true;
+	m_loadStart = std::chrono::steady_clock::now();
+	g_mq2Nav->Get<ZoneInTimeline>()->StartStage(ZoneInStage::Overlay);
+
+	// the load thread owns the pending set until it has finished
+	auto loadingThread = [this, navMesh, previousTiles, areaColors]()
 	{
-		int currentTile = 0;
+		MQ2NAV_PROFILE_ZONE("NavMeshRenderer::Load");
 
-		for (int i = 0; i < navMesh->getMaxTiles() && !m_stopLoading; ++i)
+		struct TileEntry
+		{
+			const dtMeshTile* tile;
+			uint64_t key;
+			uint64_t dataHash;
+			std::shared_ptr<TileChunk> chunk;
+		};
+
+		// only tiles whose data changed are drawn again. Edge colors along the
+		// tile border come from the links to its neighbours, those are allowed
+		// to go stale until the tile itself changes.
+		std::vector<TileEntry> entries;
+		std::vector<size_t> toBuild;
+
+		for (int i = 0; i < navMesh->getMaxTiles(); ++i)
 		{
 			const dtMeshTile* tile = navMesh->getTile(i);
 			if (!tile->header) continue;
 
-			drawMeshTile(dd.get(), *navMesh, 0, tile, DU_DRAWNAVMESH_OFFMESHCONS | DU_DRAWNAVMESH_CLOSEDLIST
-				/* | DU_DRAWNAVMESH_COLOR_TILES*/);
+			TileEntry entry{ tile, TileKey(tile->header), HashTileData(tile) };
 
-			++currentTile;
-			m_progress = static_cast<float>(currentTile) / static_cast<float>(tilesToLoad);
+			auto iter = previousTiles.find(entry.key);
+			if (iter != previousTiles.end() && iter->second->dataHash == entry.dataHash)
+				entry.chunk = iter->second;
+			else
+				toBuild.push_back(entries.size());
+
+			entries.push_back(std::move(entry));
+		}
+
+		// the tiles that changed are built on a thread per core, each taking the
+		// next one as it finishes
+		std::atomic<size_t> nextBuild{ 0 };
+		std::atomic<size_t> tilesDone{ entries.size() - toBuild.size() };
+
+		auto buildTiles = [&]()
+		{
+			for (size_t i = nextBuild++; i < toBuild.size() && !m_stopLoading; i = nextBuild++)
+			{
+				TileEntry& entry = entries[toBuild[i]];
+
+				auto chunk = std::make_shared<TileChunk>();
+				chunk->dataHash = entry.dataHash;
+
+				// render coordinates are recast's with the axes rotated, see RenderList::AddVertex
+				const float* bmin = entry.tile->header->bmin;
+				const float* bmax = entry.tile->header->bmax;
+
+				for (auto& group : chunk->groups)
+				{
+					group = std::make_unique<RenderGroup>(g_pDevice);
+					group->SetStatic(true);
+					group->SetBounds(D3DXVECTOR3(bmin[2], bmin[0], bmin[1]),
+						D3DXVECTOR3(bmax[2], bmax[0], bmax[1]));
+				}
+
+				BuildTileGeometry(entry.tile, areaColors->data(), *chunk->groups[Detail_Full]);
+				BuildTileOutlines(entry.tile, areaColors->data(), *chunk->groups[Detail_Polys],
+					*chunk->groups[Detail_Outline]);
+				entry.chunk = std::move(chunk);
+
+				m_progress = static_cast<float>(++tilesDone) / static_cast<float>(entries.size());
+			}
+		};
+
+		const size_t threadCount = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u),
+			std::max<size_t>(toBuild.size(), 1));
+
+		std::vector<std::future<void>> workers;
+		for (size_t i = 0; i < threadCount; ++i)
+			workers.push_back(std::async(std::launch::async, buildTiles));
+		for (auto& worker : workers)
+			worker.get();
+
+		if (!m_stopLoading)
+		{
+			for (TileEntry& entry : entries)
+				m_pendingTiles[entry.key] = std::move(entry.chunk);
 		}
 
 		m_loading = false;
@@ -220,6 +723,25 @@ void NavMeshRenderer::StartLoad()
 	m_loadThread = std::thread(loadingThread);
 }
 
+void NavMeshRenderer::FinishLoad()
+{
+	if (m_loading || !m_loadThread.joinable())
+		return;
+
+	m_loadThread.join();
+
+	ZoneInTimeline* timeline = g_mq2Nav->Get<ZoneInTimeline>();
+	timeline->AddBackgroundTime(ZoneInStage::Overlay, std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - m_loadStart).count());
+
+	ScopedZoneInStage stage(timeline, ZoneInStage::Overlay);
+
+	// tiles that were carried over are shared between the two sets, the rest
+	// of the old set is released here
+	m_tiles.swap(m_pendingTiles);
+	m_pendingTiles.clear();
+}
+
 void NavMeshRenderer::UpdateNavMesh()
 {
 	StopLoad();
@@ -228,21 +750,41 @@ void NavMeshRenderer::UpdateNavMesh()
 	if (!m_enabled)
 		return;
 
-	m_primGroup->Reset();
+	if (m_suspended)
+	{
+		m_updatePending = true;
+		return;
+	}
 
 	// if we don't have a navmesh, don't build the geometry
 	if (!m_navMesh->IsNavMeshLoaded())
 	{
-		InvalidateDeviceObjects();
+		m_tiles.clear();
 		return;
 	}
 
 	StartLoad();
 }
 
+void NavMeshRenderer::SetSuspended(bool suspended)
+{
+	if (m_suspended == suspended)
+		return;
+
+	m_suspended = suspended;
+
+	if (!m_suspended && m_updatePending)
+	{
+		m_updatePending = false;
+		UpdateNavMesh();
+	}
+}
+
 void NavMeshRenderer::OnUpdateUI()
 {
-	if (!m_navMesh->IsNavMeshLoaded())
+	if (g_mq2Nav->Get<NavMeshLoader>()->IsLoading())
+		ImGui::TextColored(ImColor(255, 255, 0), "Loading navmesh...");
+	else if (!m_navMesh->IsNavMeshLoaded())
 		ImGui::TextColored(ImColor(255, 255, 0), "No navmesh loaded");
 	else
 		ImGui::TextColored(ImColor(0, 255, 0), "Navmesh loaded");
@@ -262,7 +804,54 @@ void NavMeshRenderer::OnUpdateUI()
 
 	if (m_enabled && m_loading)
 	{
-		ImGui::ProgressBar(m_progress);
+		ImGui::ProgressBar(m_progress.load());
+	}
+
+	if (m_enabled)
+	{
+		float& radius = mq2nav::GetSettings().navmesh_overlay_radius;
+		if (ImGui::SliderFloat("Draw distance", &radius, 0.0f, 5000.0f, radius > 0.0f ? "%.0f" : "Unlimited"))
+			mq2nav::SaveSettings(false);
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Only draw the parts of the navmesh overlay within this distance of you");
+
+		if (ImGui::Checkbox("Simplify distant tiles", &mq2nav::GetSettings().navmesh_overlay_lod))
+			mq2nav::SaveSettings(false);
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Draw tiles far from the camera without their detail meshes, and only their edges further out");
+
+		if (ImGui::Checkbox("Show search heatmap", &m_showHeatmap) && !m_showHeatmap)
+			m_heatmapGroup.reset();
+	}
+
+	QueryHeatmap& heatmap = m_navMesh->GetQueryHeatmap();
+
+	bool recordHeatmap = heatmap.IsEnabled();
+	if (ImGui::Checkbox("Record search heatmap", &recordHeatmap))
+		heatmap.SetEnabled(recordHeatmap);
+	if (ImGui::IsItemHovered())
+		ImGui::SetTooltip("Count the polys that path searches expand, to see where they spend their time");
+
+	if (recordHeatmap || heatmap.GetQueryCount() > 0)
+	{
+		ImGui::Text("%d searches, %d polys", heatmap.GetQueryCount(), (int)heatmap.GetPolyCount());
+
+		if (ImGui::Button("Clear##Heatmap"))
+			heatmap.Clear();
+
+		ImGui::SameLine();
+
+		if (ImGui::Button("Export##Heatmap"))
+		{
+			auto navMesh = m_navMesh->GetNavMesh();
+			std::string filename = m_navMesh->GetNavMeshDirectory() + "\\" + m_navMesh->GetZoneName() + "_heatmap.csv";
+
+			auto tilesLock = m_navMesh->LockTiles();
+			if (navMesh && heatmap.Export(filename, *navMesh))
+				WriteChatf(PLUGIN_MSG "Saved search heatmap to %s", filename.c_str());
+			else
+				WriteChatf(PLUGIN_MSG "\arFailed to save search heatmap to %s", filename.c_str());
+		}
 	}
 
 #if 0
@@ -286,16 +875,6 @@ void NavMeshRenderer::OnUpdateUI()
 #endif
 }
 
-unsigned int NavMeshRenderer::GetColorForPolyArea(uint8_t areaType)
-{
-	if (m_navMesh)
-	{
-		return m_navMesh->GetPolyArea(areaType).color;
-	}
-
-	return 0;
-}
-
 //----------------------------------------------------------------------------
 //----------------------------------------------------------------------------
 
@@ -12,7 +12,11 @@
 
 #include <d3dx9.h>
 #include <d3d9caps.h>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <map>
+#include <memory>
 #include <thread>
 #include <mutex>
 
@@ -24,8 +28,6 @@ class ConfigurableRenderState;
 
 class NavMeshRenderer : public Renderable, public NavModule
 {
-	friend class NavMeshDebugDraw;
-
 public:
 	NavMeshRenderer();
 	~NavMeshRenderer();
@@ -36,9 +38,15 @@ public:
 	virtual void InvalidateDeviceObjects() override;
 	virtual bool CreateDeviceObjects() override;
 	virtual void Render(RenderPhase phase) override;
+	virtual bool IsRenderActive(RenderPhase phase) const override;
+	virtual void RecordDeviceState() override;
 
 	void UpdateNavMesh();
 
+	// geometry isn't built while suspended, changes to the mesh are picked up
+	// once it is resumed
+	void SetSuspended(bool suspended);
+
 	void OnUpdateUI();
 
 private:
@@ -48,8 +56,11 @@ private:
 	void StopLoad();
 	void StartLoad();
 
-	// for NavMeshDebugDraw
-	unsigned int GetColorForPolyArea(uint8_t areaType);
+	// swap in the tiles built by the load thread once it has finished
+	void FinishLoad();
+
+	// draws the query heatmap again if it has changed since it was last drawn
+	void UpdateHeatmap();
 
 private:
 	IDirect3DDevice9* m_pDevice = nullptr;
@@ -57,18 +68,54 @@ private:
 
 	bool m_enabled = false;
 	bool m_loaded = false;
+	bool m_suspended = false;
+	bool m_updatePending = false;
+
+	// geometry for a single tile of the mesh. Tiles whose data hasn't changed are
+	// carried over when the mesh is updated, instead of being drawn again.
+	// Tiles are drawn in less detail the further they are from the camera: with
+	// their detail meshes up close, only their polygons further out, and only
+	// their outer edges beyond that. See OVERLAY_LOD_*_DISTANCE.
+	enum TileDetail
+	{
+		Detail_Full,
+		Detail_Polys,
+		Detail_Outline,
+
+		Detail_Count
+	};
+
+	struct TileChunk
+	{
+		uint64_t dataHash = 0;
+		std::unique_ptr<RenderGroup> groups[Detail_Count];
+	};
+	using TileChunkMap = std::map<uint64_t, std::shared_ptr<TileChunk>>;
+
+	// the tiles currently being rendered, and the set being built by the load
+	// thread. The pending set replaces the current one once it is complete.
+	TileChunkMap m_tiles;
+	TileChunkMap m_pendingTiles;
+	uint32_t m_areaColorsHash = 0;
+
+	// the query heatmap, redrawn at most once a second while searches are recorded
+	std::unique_ptr<RenderGroup> m_heatmapGroup;
+	bool m_showHeatmap = false;
+	uint32_t m_heatmapVersion = 0;
+	DWORD m_heatmapTick = 0;
 
-	std::unique_ptr<RenderGroup> m_primGroup;
 	Signal<>::ScopedConnection m_meshConn;
+	Signal<>::ScopedConnection m_meshTilesConn;
 
 	std::unique_ptr<ConfigurableRenderState> m_state;
 	bool m_useStateEditor = false;
 
 	// loading progress
-	bool m_loading = false;
-	bool m_stopLoading = false;
-	float m_progress = 0.0f;
+	std::atomic<bool> m_loading{ false };
+	std::atomic<bool> m_stopLoading{ false };
+	std::atomic<float> m_progress{ 0.0f };
 	std::thread m_loadThread;
+	std::chrono::steady_clock::time_point m_loadStart;
 };
 
 //----------------------------------------------------------------------------
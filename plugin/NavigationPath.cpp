@@ -7,22 +7,131 @@
 #include "NavMeshLoader.h"
 #include "RenderHandler.h"
 #include "MQ2Nav_Settings.h"
+#include "PathfindingWorker.h"
+#include "PerfStats.h"
+#include "SharedFlowField.h"
+#include "SharedLeaderPath.h"
+#include "SharedPathCache.h"
 #include "common/NavMesh.h"
 #include "common/NavMeshData.h"
+#include "common/Profiler.h"
 
 #include "DebugDrawDX.h"
 #include "DetourNavMesh.h"
 #include "DetourCommon.h"
+#include "DetourNode.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <future>
+#include <queue>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 
 //----------------------------------------------------------------------------
 // constants
 
 const int MAX_POLYS = 4028 * 4;
 
-const int MAX_NODES = 2048 * 4;
-
 const int MAX_PATH_SIZE = 2048 * 4;
 
+// room for any path that can be found, the corridor needs one more than it holds
+const int CORRIDOR_MAX_POLYS = MAX_POLYS + 1;
+
+// corridor following parameters
+const int CORRIDOR_MAX_CORNERS = 64;
+const int CORRIDOR_CHECK_LOOKAHEAD = 16;
+const float CORRIDOR_OPTIMIZE_DISTANCE = 60.0f;
+const int CORRIDOR_VISIBILITY_INTERVAL_MS = 100;
+const int CORRIDOR_TOPOLOGY_INTERVAL_MS = 500;
+
+// paths between tiles that are at least this far apart are routed through the tile graph
+const int ROUTED_PATH_MIN_TILES = 4;
+
+// spawn destinations have to move this far before the end of the path is moved
+const float PURSUIT_UPDATE_DISTANCE = 2.0f;
+
+// spawns that move further than this from the end of the path get a new path
+const float PURSUIT_MAX_REPAIR_DISTANCE = 50.0f;
+
+// how close the repaired end of the path has to get to the spawn
+const float PURSUIT_TARGET_TOLERANCE = 5.0f;
+
+// path polygons ahead of the player that are checked before looking the player up
+const int PATH_POLY_LOOKAHEAD = 4;
+
+// furthest the player is expected to move between lookups. Further than this and
+// the last known polygon isn't worth starting from.
+const float PLAYER_POLY_MAX_MOVE = 30.0f;
+
+// polygons that a move from the last known polygon may cross
+const int PLAYER_POLY_MAX_VISITED = 16;
+
+// destinations off the mesh are looked for with extents that double for this
+// many steps. Spawns keep their polygon while they
+// move less than the distance, for as many spawns as the cache holds, which is
+// enough for all of the candidates of a nearest spawn search.
+const int DESTINATION_SNAP_STEPS = 5;
+const float DESTINATION_SNAP_MOVE_DISTANCE = 0.5f;
+const size_t DESTINATION_SNAP_CACHE_SIZE = 1024;
+
+// corners closer than this to the line between their neighbours are dropped
+const float SMOOTH_COLLINEAR_DISTANCE = 0.25f;
+const float SMOOTH_COLLINEAR_HEIGHT = 1.0f;
+
+// longest raycast that is tried when shortcutting a corner, in polygons
+const int SMOOTH_MAX_RAYCAST_POLYS = 64;
+
+// polygons a walk along the surface to the next waypoint may cross when checking
+// whether the way there is open
+const int STALL_MAX_VISITED = 32;
+
+// polygons a detour around a blocked polygon may search through
+const int STALL_DETOUR_MAX_POLYS = 64;
+
+// a prefetched path is joined up with a search from the player if they're no
+// further than this from where it starts
+const float PREFETCH_JOIN_DISTANCE = 30.0f;
+
+//----------------------------------------------------------------------------
+
+// look in this client's path cache first, then in the one shared with other clients
+static bool FindCachedPath(dtPolyRef startRef, dtPolyRef endRef, uint32_t filterHash,
+	std::vector<dtPolyRef>& path)
+{
+	NavMesh* mesh = g_mq2Nav->Get<NavMesh>();
+	if (mesh->FindCachedPath(startRef, endRef, filterHash, path))
+		return true;
+
+	if (!g_mq2Nav->Get<SharedPathCache>()->FindPath(startRef, endRef, filterHash, path))
+		return false;
+
+	mesh->AddCachedPath(startRef, endRef, filterHash, path.data(), static_cast<int>(path.size()));
+	return true;
+}
+
+// destinations in flow field mode follow the field instead of searching
+static bool FindFlowFieldPath(const DestinationInfo* dest, dtPolyRef startRef, dtPolyRef endRef,
+	const float* endPos, const NavMeshQueryFilter& filter, std::vector<dtPolyRef>& path)
+{
+	if (!dest || !dest->flowField)
+		return false;
+
+	return g_mq2Nav->Get<SharedFlowField>()->FindPath(startRef, endRef, endPos, filter, path);
+}
+
+static void AddCachedPath(dtPolyRef startRef, dtPolyRef endRef, uint32_t filterHash,
+	const dtPolyRef* path, int pathSize)
+{
+	g_mq2Nav->Get<NavMesh>()->AddCachedPath(startRef, endRef, filterHash, path, pathSize);
+	g_mq2Nav->Get<SharedPathCache>()->AddPath(startRef, endRef, filterHash, path, pathSize);
+}
+
 //----------------------------------------------------------------------------
 
 NavigationPath::NavigationPath(const std::shared_ptr<DestinationInfo>& dest)
@@ -31,287 +140,1754 @@ NavigationPath::NavigationPath(const std::shared_ptr<DestinationInfo>& dest)
 	auto* mesh = g_mq2Nav->Get<NavMesh>();
 	m_navMeshConn = mesh->OnNavMeshChanged.Connect(
 		[this, mesh]() { SetNavMesh(mesh->GetNavMesh()); });
+	m_navMeshTilesConn = mesh->OnNavMeshTilesChanged.Connect(
+		[this]() { OnTilesChanged(); });
 	
 	SetNavMesh(mesh->GetNavMesh(), false);
 
-	m_useCorridor = mq2nav::GetSettings().debug_use_pathing_corridor;
+	// allocated up front so that following the path doesn't allocate
+	m_currentPath.reset(new float[MAX_POLYS * 3]);
+	m_cornerFlags.reset(new uint8_t[MAX_POLYS]);
+	m_searchPolys.reset(new dtPolyRef[MAX_POLYS]);
+	m_straightPathPolys.reset(new dtPolyRef[MAX_POLYS]);
+	m_pathPolys.reserve(MAX_POLYS);
+
+	m_useCorridor = mq2nav::GetSettings().use_pathing_corridor;
 
 	SetDestination(dest);
 }
 
 NavigationPath::~NavigationPath()
 {
+	CancelIncrementalPath();
 	SetShowNavigationPaths(false);
+	SetPublishPath(false);
+}
+
+void NavigationPath::SetPublishPath(bool publish)
+{
+	if (m_publishPath == publish)
+		return;
+
+	m_publishPath = publish;
+
+	PSPAWNINFO me = GetCharInfo() ? GetCharInfo()->pSpawn : nullptr;
+	if (!m_publishPath && me)
+		g_mq2Nav->Get<SharedLeaderPath>()->ClearPath(me->SpawnID);
+}
+
+void NavigationPath::PublishPath(const dtPolyRef* polys, int numPolys)
+{
+	if (!m_publishPath)
+		return;
+
+	PSPAWNINFO me = GetCharInfo() ? GetCharInfo()->pSpawn : nullptr;
+	if (me)
+		g_mq2Nav->Get<SharedLeaderPath>()->PublishPath(me->SpawnID, m_filterHash, polys, numPolys);
+}
+
+//----------------------------------------------------------------------------
+
+void NavigationPath::SetShowNavigationPaths(bool renderPaths)
+{
+	if (m_renderPaths == renderPaths)
+		return;
+
+	m_renderPaths = renderPaths;
+
+	if (m_renderPaths)
+	{
+		m_line = std::make_shared<NavigationLine>(this);
+		m_line->SetVisible(mq2nav::GetSettings().show_nav_path);
+		g_renderHandler->AddRenderable(m_line.get());
+
+		m_debugDrawGrp = std::make_unique<RenderGroup>(g_pDevice);
+		g_renderHandler->AddRenderable(m_debugDrawGrp.get());
+	}
+	else
+	{
+		g_renderHandler->RemoveRenderable(m_debugDrawGrp.get());
+		g_renderHandler->RemoveRenderable(m_line.get());
+
+		m_line.reset();
+		m_debugDrawGrp.reset();
+	}
+}
+
+void NavigationPath::SetDestination(const std::shared_ptr<DestinationInfo>& info)
+{
+	m_destinationInfo = info;
+
+	// followers in formation move along a corridor seeded from the leader's path
+	if (m_destinationInfo && m_destinationInfo->formation)
+		m_useCorridor = true;
+
+	UpdateFilter();
+}
+
+bool NavigationPath::FindPath()
+{
+	if (!m_navMesh)
+		return false;
+
+	if (!m_destinationInfo || !m_destinationInfo->valid)
+		return false;
+
+	// WriteChatf("MQ2Navigation::FindPath - %.1f %.1f %.1f", X, Y, Z);
+	m_currentPathCursor = 0;
+	m_currentPathSize = 0;
+
+	UpdatePath(true);
+
+	return m_currentPathSize > 0;
+}
+
+void NavigationPath::SetNavMesh(const std::shared_ptr<dtNavMesh>& navMesh,
+	bool updatePath)
+{
+	m_navMesh = navMesh;
+
+	m_query.reset();
+	m_corridor.reset();
+	CancelIncrementalPath();
+	m_playerPoly = 0;
+
+	UpdateFilter();
+
+	if (updatePath && m_navMesh)
+	{
+		UpdatePath();
+	}
+}
+
+void NavigationPath::OnTilesChanged()
+{
+	// a search in progress may have visited polygons that no longer exist
+	CancelIncrementalPath();
+
+	// area costs may have come with the new tiles
+	UpdateFilter();
+
+	if (!m_navMesh)
+		return;
+
+	// the corridor only needs replanning if it went through a replaced tile
+	if (m_useCorridor && m_corridor && m_query
+		&& m_corridor->isValid(m_corridor->getPathCount(), m_query.get(), m_filter))
+	{
+		return;
+	}
+
+	UpdatePath(true);
+}
+
+void NavigationPath::UpdateFilter()
+{
+	// shared with every other path that avoids the same areas and needs the same room
+	uint64_t avoidAreas = m_destinationInfo ? m_destinationInfo->avoidAreas : 0;
+	float clearance = m_destinationInfo ? m_destinationInfo->clearance : 0.0f;
+
+	m_queryFilter = g_mq2Nav->Get<NavMesh>()->GetQueryFilter(avoidAreas, clearance);
+	m_filter = &m_queryFilter->filter;
+	m_filterHash = m_queryFilter->hash;
+}
+
+void NavigationPath::UpdatePath(bool force)
+{
+	mq2nav::ScopedPerfTimer timer(mq2nav::PerfTimer::UpdatePath);
+	MQ2NAV_PROFILE_ZONE("NavigationPath::UpdatePath");
+
+	if (m_navMesh == nullptr || m_destinationInfo == nullptr)
+		return;
+
+	// sized from the node budget of the mesh, which may have grown since
+	NavMesh* mesh = g_mq2Nav->Get<NavMesh>();
+	const int maxNodes = mesh->GetQueryNodeBudget();
+	if (m_query == nullptr || m_query->getNodePool()->getMaxNodes() < maxNodes)
+	{
+		m_query = mesh->AcquireNavMeshQuery(maxNodes);
+		if (m_query == nullptr)
+			return;
+	}
+
+	PSPAWNINFO me = GetCharInfo()->pSpawn;
+	if (me == nullptr)
+		return;
+
+	const glm::vec3& destination = m_destinationInfo->eqDestinationPos;
+
+	float startOffset[3] = { me->X, me->FloorHeight, me->Y };
+	float endOffset[3] = { destination.x, destination.z, destination.y };
+	float spos[3];
+	float epos[3];
+
+	glm::vec3 thisPos(startOffset[0], startOffset[1], startOffset[2]);
+
+	if (thisPos == m_lastPos && destination == m_destination && !force)
+		return;
+	m_lastPos = thisPos;
+	m_destination = destination;
+
+	// once there is a path to follow, updates are searched for on the worker. The
+	// current path remains in use until the new one is ready.
+	if ((!force || m_currentPathSize > 0) && !m_useCorridor && mq2nav::GetSettings().sliced_pathfinding)
+	{
+		BeginIncrementalPath(startOffset, endOffset, force);
+		return;
+	}
+
+	// a full update supersedes anything in progress
+	CancelIncrementalPath();
+
+	if (m_useCorridor)
+	{
+		UpdateCorridor(startOffset, endOffset, force);
+		return;
+	}
+
+	m_currentPathCursor = 0;
+	m_currentPathSize = 0;
+
+	dtPolyRef startRef = FindPlayerPoly(startOffset, spos);
+	dtPolyRef endRef;
+
+	if (!startRef)
+	{
+		WriteChatf(PLUGIN_MSG "Could not locate starting point on navmesh: %.2f %.2f %.2f)",
+			startOffset[2], startOffset[0], startOffset[1]);
+		return;
+	}
+
+	endRef = FindDestinationPoly(m_query.get(), m_filter, m_filterHash, endOffset, m_extents,
+		m_destinationInfo->spawnId, epos);
+	if (!endRef)
+	{
+		WriteChatf(PLUGIN_MSG "Could not locate destination on navmesh: %.2f %.2f %.2f",
+			endOffset[2], endOffset[0], endOffset[1]);
+		return;
+	}
+
+	m_destinationRef = endRef;
+
+	if (FindFlowFieldPath(m_destinationInfo.get(), startRef, endRef, epos, *m_queryFilter, m_cachedPath)
+		|| TakePrefetchedPath(startRef, spos, endRef, m_cachedPath)
+		|| FindCachedPath(startRef, endRef, m_filterHash, m_cachedPath))
+	{
+		FinishPath(spos, epos, m_cachedPath.data(), static_cast<int>(m_cachedPath.size()));
+		return;
+	}
+
+	dtPolyRef* polys = m_searchPolys.get();
+	int numPolys = 0;
+
+	dtStatus status = DT_SUCCESS;
+	if (!FindRoutedPath(startRef, spos, endRef, epos, polys, numPolys, false))
+	{
+		mq2nav::ScopedPerfTimer timer(mq2nav::PerfTimer::FindPath);
+		status = m_query->findPath(startRef, endRef, spos, epos, m_filter, polys, &numPolys, MAX_POLYS);
+		g_mq2Nav->Get<NavMesh>()->GetQueryHeatmap().Record(*m_query);
+
+		// the search gave up before reaching the destination, try going through the tile graph instead.
+		if ((status & (DT_OUT_OF_NODES | DT_PARTIAL_RESULT))
+			&& FindRoutedPath(startRef, spos, endRef, epos, polys, numPolys, true))
+		{
+			status = DT_SUCCESS;
+		}
+
+		// and then once more with more nodes. A path that still runs out is partial,
+		// and the next replan starts from the grown budget, so no pulse does more
+		// than two searches.
+		if (status & DT_OUT_OF_NODES)
+		{
+			int grownNodes = mesh->RecordOutOfNodes(m_query->getNodePool()->getMaxNodes());
+			std::shared_ptr<dtNavMeshQuery> query = grownNodes ? mesh->AcquireNavMeshQuery(grownNodes) : nullptr;
+			if (query)
+			{
+				m_query = query;
+				status = m_query->findPath(startRef, endRef, spos, epos, m_filter, polys, &numPolys, MAX_POLYS);
+				mesh->GetQueryHeatmap().Record(*m_query);
+
+				mesh->RecordNodeRetry(grownNodes, dtStatusSucceed(status) && !dtStatusDetail(status, DT_PARTIAL_RESULT));
+			}
+		}
+	}
+	if (dtStatusSucceed(status) && !dtStatusDetail(status, DT_PARTIAL_RESULT))
+		AddCachedPath(startRef, endRef, m_filterHash, polys, numPolys);
+	if (status & DT_OUT_OF_NODES)
+		NavSpew(MQ2NAV_SPEW_PATHING, "findPath from %.2f,%.2f,%.2f to %.2f,%.2f,%.2f failed: out of nodes",
+			startOffset[0], startOffset[1], startOffset[2],
+			endOffset[0], endOffset[1], endOffset[2]);
+	if (status & DT_PARTIAL_RESULT)
+		NavSpew(MQ2NAV_SPEW_PATHING, "findPath from %.2f,%.2f,%.2f to %.2f,%.2f,%.2f returned a partial result.",
+			startOffset[0], startOffset[1], startOffset[2],
+			endOffset[0], endOffset[1], endOffset[2]);
+
+	FinishPath(spos, epos, polys, numPolys);
+}
+
+bool NavigationPath::ResetCorridor(const float* startOffset, const float* endOffset)
+{
+	dtPolyRef startRef, endRef;
+	float spos[3], epos[3];
+
+	startRef = FindPlayerPoly(startOffset, spos);
+	if (!startRef)
+	{
+		WriteChatf(PLUGIN_MSG "Could not locate starting point on navmesh: %.2f %.2f %.2f)",
+			startOffset[2], startOffset[0], startOffset[1]);
+		return false;
+	}
+
+	endRef = FindDestinationPoly(m_query.get(), m_filter, m_filterHash, endOffset, m_extents,
+		m_destinationInfo->spawnId, epos);
+	if (!endRef)
+	{
+		WriteChatf(PLUGIN_MSG "Could not locate destination on navmesh: %.2f %.2f %.2f",
+			endOffset[2], endOffset[0], endOffset[1]);
+		return false;
+	}
+
+	dtPolyRef* polys = m_searchPolys.get();
+	int numPolys = 0;
+
+	// followers take the polygons of the leader's path up to the leader, and only
+	// search when they're off of it
+	if (m_destinationInfo->formation
+		&& g_mq2Nav->Get<SharedLeaderPath>()->FindPath(m_destinationInfo->spawnId, m_filterHash,
+			startRef, endRef, m_cachedPath))
+	{
+		polys = m_cachedPath.data();
+		numPolys = static_cast<int>(m_cachedPath.size());
+	}
+	else if (TakePrefetchedPath(startRef, spos, endRef, m_cachedPath))
+	{
+		polys = m_cachedPath.data();
+		numPolys = static_cast<int>(m_cachedPath.size());
+	}
+	else
+	{
+		dtStatus status = m_query->findPath(startRef, endRef, spos, epos, m_filter,
+			polys, &numPolys, MAX_POLYS);
+		g_mq2Nav->Get<NavMesh>()->GetQueryHeatmap().Record(*m_query);
+		if (dtStatusFailed(status) || numPolys == 0)
+			return false;
+	}
+
+	// paths handed over from elsewhere can be longer than the corridor holds, it
+	// follows as much of them as fits
+	numPolys = std::min(numPolys, CORRIDOR_MAX_POLYS - 1);
+
+	// partial paths end short of the destination, aim for the end of the corridor
+	if (polys[numPolys - 1] != endRef)
+	{
+		m_query->closestPointOnPoly(polys[numPolys - 1], epos, epos, nullptr);
+	}
+
+	if (!m_corridor)
+	{
+		m_corridor.reset(new dtPathCorridor);
+		m_corridor->init(CORRIDOR_MAX_POLYS);
+	}
+
+	m_corridor->reset(startRef, spos);
+	m_corridor->setCorridor(epos, polys, numPolys);
+	PublishPath(polys, numPolys);
+
+	m_corridorTarget = glm::make_vec3(endOffset);
+	m_lastVisibilityOptimize = m_lastTopologyOptimize = clock::now();
+
+	return true;
+}
+
+void NavigationPath::UpdateCorridor(const float* startOffset, const float* endOffset, bool force)
+{
+	bool replan = force || !m_corridor;
+
+	if (!replan)
+	{
+		// cheap per-pulse update: slide the corridor along with the player and
+		// the destination.
+		m_corridor->movePosition(startOffset, m_query.get(), m_filter);
+
+		if (glm::make_vec3(endOffset) != m_corridorTarget)
+		{
+			m_corridor->moveTargetPosition(endOffset, m_query.get(), m_filter);
+			m_corridorTarget = glm::make_vec3(endOffset);
+
+			// the destination left the area around the end of the corridor
+			replan = dtVdist2DSqr(m_corridor->getTarget(), endOffset) > dtSqr(PURSUIT_TARGET_TOLERANCE);
+		}
+
+		// only do a full search when the corridor has been broken, for example by
+		// a tile change or a disabled polygon.
+		replan = replan || !m_corridor->isValid(CORRIDOR_CHECK_LOOKAHEAD, m_query.get(), m_filter);
+	}
+
+	if (replan)
+	{
+		if (!ResetCorridor(startOffset, endOffset))
+		{
+			m_currentPathCursor = 0;
+			m_currentPathSize = 0;
+			return;
+		}
+	}
+	else
+	{
+		clock::time_point now = clock::now();
+
+		if (now - m_lastTopologyOptimize > std::chrono::milliseconds(CORRIDOR_TOPOLOGY_INTERVAL_MS))
+		{
+			m_corridor->optimizePathTopology(m_query.get(), m_filter);
+			m_lastTopologyOptimize = now;
+		}
+	}
+
+	// the path is the current position followed by the upcoming corners, so that
+	// it can be followed the same way as a path from findStraightPath.
+	dtPolyRef cornerPolys[CORRIDOR_MAX_CORNERS];
+	dtVcopy(&m_currentPath[0], m_corridor->getPos());
+	m_cornerFlags[0] = DT_STRAIGHTPATH_START;
+
+	int numCorners = m_corridor->findCorners(&m_currentPath[3], &m_cornerFlags[1],
+		cornerPolys, CORRIDOR_MAX_CORNERS, m_query.get(), m_filter);
+
+	// shortcut towards the next corner when it becomes visible. This raycasts, so
+	// it is only done periodically.
+	clock::time_point now = clock::now();
+	if (numCorners > 0
+		&& now - m_lastVisibilityOptimize > std::chrono::milliseconds(CORRIDOR_VISIBILITY_INTERVAL_MS))
+	{
+		const float* target = &m_currentPath[std::min(numCorners, 2) * 3];
+		m_corridor->optimizePathVisibility(target, CORRIDOR_OPTIMIZE_DISTANCE, m_query.get(), m_filter);
+		m_lastVisibilityOptimize = now;
+
+		numCorners = m_corridor->findCorners(&m_currentPath[3], &m_cornerFlags[1],
+			cornerPolys, CORRIDOR_MAX_CORNERS, m_query.get(), m_filter);
+	}
+
+	m_currentPathSize = numCorners + 1;
+	m_currentPathCursor = 1;
+	UpdatePathDistances();
+
+	if (m_debugDrawGrp)
+		m_debugDrawGrp->Reset();
+
+	if (m_line && mq2nav::GetSettings().show_nav_path)
+	{
+		m_line->Update();
+	}
+}
+
+void NavigationPath::BeginIncrementalPath(const float* startOffset, const float* endOffset, bool force)
+{
+	// let the search that is already running finish first
+	if (m_pendingSearch && !force)
+		return;
+
+	CancelIncrementalPath();
+
+	PathRequest request;
+	request.filter = m_queryFilter;
+	if (m_destinationInfo)
+		request.searchMode = m_destinationInfo->searchMode;
+
+	request.startRef = FindPlayerPoly(startOffset, request.spos);
+	if (!request.startRef)
+		return;
+
+	request.endRef = FindDestinationPoly(m_query.get(), m_filter, m_filterHash, endOffset, m_extents,
+		m_destinationInfo ? m_destinationInfo->spawnId : 0, request.epos);
+	if (!request.endRef)
+		return;
+
+	m_destinationRef = request.endRef;
+
+	// nothing to search for if we've been here before
+	if (FindFlowFieldPath(m_destinationInfo.get(), request.startRef, request.endRef, request.epos,
+			*m_queryFilter, m_cachedPath)
+		|| FindCachedPath(request.startRef, request.endRef, m_filterHash, m_cachedPath))
+	{
+		m_currentPathCursor = 0;
+		m_currentPathSize = 0;
+
+		FinishPath(request.spos, request.epos, m_cachedPath.data(), static_cast<int>(m_cachedPath.size()));
+		return;
+	}
+
+	m_pendingSearch = g_mq2Nav->Get<PathfindingWorker>()->Submit(request);
+}
+
+bool NavigationPath::TakePrefetchedPath(dtPolyRef startRef, const float* spos, dtPolyRef endRef,
+	std::vector<dtPolyRef>& path)
+{
+	std::shared_ptr<PathJob> job = std::move(m_prefetchedPath);
+	if (!job)
+		return false;
+
+	// still searching, it's cheaper to start over than to wait for it
+	if (!job->IsDone())
+	{
+		job->Cancel();
+		return false;
+	}
+
+	const PathRequest& request = job->GetRequest();
+	const std::vector<dtPolyRef>& polys = job->GetPath();
+	dtStatus status = job->GetStatus();
+
+	if (job->IsStale() || dtStatusFailed(status) || (status & DT_PARTIAL_RESULT)
+		|| polys.empty() || request.endRef != endRef || !m_query)
+	{
+		return false;
+	}
+
+	// the player is on the way already
+	auto iter = std::find(polys.begin(), polys.end(), startRef);
+	if (iter != polys.end())
+	{
+		path.assign(iter, polys.end());
+		return true;
+	}
+
+	// stopped a bit short of where it starts
+	if (dtVdistSqr(spos, request.spos) > dtSqr(PREFETCH_JOIN_DISTANCE))
+		return false;
+
+	dtPolyRef* join = m_searchPolys.get();
+	int numJoin = 0;
+	status = m_query->findPath(startRef, polys.front(), spos, request.spos, m_filter,
+		join, &numJoin, MAX_POLYS);
+	if (dtStatusFailed(status) || (status & DT_PARTIAL_RESULT) || numJoin == 0
+		|| numJoin + static_cast<int>(polys.size()) > MAX_POLYS)
+	{
+		return false;
+	}
+
+	// the join ends on the first polygon of the prefetched path
+	path.assign(join, join + numJoin - 1);
+	path.insert(path.end(), polys.begin(), polys.end());
+	return true;
+}
+
+void NavigationPath::CancelIncrementalPath()
+{
+	if (m_pendingSearch)
+	{
+		m_pendingSearch->Cancel();
+		m_pendingSearch.reset();
+	}
+}
+
+bool NavigationPath::UpdateIncrementalPath()
+{
+	if (!m_pendingSearch)
+		return false;
+
+	if (!m_pendingSearch->IsDone())
+		return true;
+
+	std::shared_ptr<PathJob> search = std::move(m_pendingSearch);
+	const PathRequest& request = search->GetRequest();
+
+	// the tiles changed under the search, try again with the new ones
+	if (search->IsStale())
+	{
+		m_replanRequested = true;
+		return false;
+	}
+
+	dtStatus status = search->GetStatus();
+	const std::vector<dtPolyRef>& polys = search->GetPath();
+	if (dtStatusFailed(status) || polys.empty() || !m_query)
+		return false;
+
+	if (status & DT_PARTIAL_RESULT)
+		NavSpew(MQ2NAV_SPEW_PATHING, "findPath to %.2f,%.2f,%.2f on the worker returned a partial result.",
+			request.epos[0], request.epos[1], request.epos[2]);
+	else
+		AddCachedPath(request.startRef, request.endRef,
+			m_filterHash, polys.data(), static_cast<int>(polys.size()));
+
+	m_currentPathCursor = 0;
+	m_currentPathSize = 0;
+
+	FinishPath(request.spos, request.epos, polys.data(), static_cast<int>(polys.size()));
+	return false;
+}
+
+// polygons that spawn destinations were found on
+struct SnappedDestination
+{
+	float pos[3];
+	float nearest[3];
+	dtPolyRef ref;
+	uint32_t filterHash;
+	uint32_t tileGeneration;
+};
+static std::unordered_map<DWORD, SnappedDestination> s_snappedDestinations;
+
+static bool HasTilesInBounds(const dtNavMesh* navMesh, const float* pos, const float* extents)
+{
+	float bmin[3], bmax[3];
+	dtVsub(bmin, pos, extents);
+	dtVadd(bmax, pos, extents);
+
+	int minx, miny, maxx, maxy;
+	navMesh->calcTileLoc(bmin, &minx, &miny);
+	navMesh->calcTileLoc(bmax, &maxx, &maxy);
+
+	for (int y = miny; y <= maxy; ++y)
+	{
+		for (int x = minx; x <= maxx; ++x)
+		{
+			const dtMeshTile* tile = nullptr;
+			if (navMesh->getTilesAt(x, y, &tile, 1) > 0)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+dtPolyRef FindDestinationPoly(dtNavMeshQuery* query, const dtQueryFilter* filter, uint32_t filterHash,
+	const float* pos, const float* extents, DWORD spawnId, float* nearest)
+{
+	uint32_t tileGeneration = g_mq2Nav->Get<NavMesh>()->GetTileGeneration();
+
+	if (spawnId)
+	{
+		auto iter = s_snappedDestinations.find(spawnId);
+		if (iter != s_snappedDestinations.end())
+		{
+			const SnappedDestination& snapped = iter->second;
+			if (snapped.filterHash == filterHash && snapped.tileGeneration == tileGeneration
+				&& dtVdistSqr(snapped.pos, pos) < dtSqr(DESTINATION_SNAP_MOVE_DISTANCE))
+			{
+				dtVcopy(nearest, snapped.nearest);
+				return snapped.ref;
+			}
+		}
+	}
+
+	mq2nav::ScopedPerfTimer timer(mq2nav::PerfTimer::FindNearestPoly);
+
+	const dtNavMesh* navMesh = query->getAttachedNavMesh();
+	float searchExtents[3];
+	dtVcopy(searchExtents, extents);
+
+	dtPolyRef ref = 0;
+	for (int step = 0; step <= DESTINATION_SNAP_STEPS; ++step, dtVscale(searchExtents, searchExtents, 2.0f))
+	{
+		// nothing to find where there are no tiles, go straight to a size that reaches one
+		if (step < DESTINATION_SNAP_STEPS && !HasTilesInBounds(navMesh, pos, searchExtents))
+			continue;
+
+		query->findNearestPoly(pos, searchExtents, filter, &ref, nearest);
+		if (ref)
+			break;
+	}
+
+	if (spawnId && ref)
+	{
+		if (s_snappedDestinations.size() >= DESTINATION_SNAP_CACHE_SIZE
+			&& s_snappedDestinations.count(spawnId) == 0)
+		{
+			s_snappedDestinations.clear();
+		}
+
+		SnappedDestination& snapped = s_snappedDestinations[spawnId];
+		dtVcopy(snapped.pos, pos);
+		dtVcopy(snapped.nearest, nearest);
+		snapped.ref = ref;
+		snapped.filterHash = filterHash;
+		snapped.tileGeneration = tileGeneration;
+	}
+
+	return ref;
+}
+
+bool FindRoutedPath(dtNavMeshQuery* query, const TileGraph& graph, const dtQueryFilter& filter,
+	dtPolyRef startRef, const float* spos, dtPolyRef endRef, const float* epos,
+	dtPolyRef* polys, int& numPolys, int maxPolys, bool force)
+{
+	if (graph.IsEmpty())
+		return false;
+
+	if (!force)
+	{
+		const dtNavMesh* navMesh = query->getAttachedNavMesh();
+		const dtMeshTile* startTile = nullptr;
+		const dtMeshTile* endTile = nullptr;
+		const dtPoly* poly = nullptr;
+
+		navMesh->getTileAndPolyByRefUnsafe(startRef, &startTile, &poly);
+		navMesh->getTileAndPolyByRefUnsafe(endRef, &endTile, &poly);
+
+		int distance = std::max(std::abs(startTile->header->x - endTile->header->x),
+			std::abs(startTile->header->y - endTile->header->y));
+		if (distance < ROUTED_PATH_MIN_TILES)
+			return false;
+	}
+
+	int count = 0;
+	dtStatus status = graph.FindPath(query, filter, startRef, spos, endRef, epos,
+		polys, &count, maxPolys);
+	if (dtStatusFailed(status))
+		return false;
+
+	numPolys = count;
+	return true;
+}
+
+bool NavigationPath::FindRoutedPath(dtPolyRef startRef, const float* spos,
+	dtPolyRef endRef, const float* epos, dtPolyRef* polys, int& numPolys, bool force)
+{
+	const TileGraph& graph = g_mq2Nav->Get<NavMesh>()->GetTileGraph();
+
+	if (!::FindRoutedPath(m_query.get(), graph, *m_filter, startRef, spos, endRef, epos,
+		polys, numPolys, MAX_POLYS, force))
+	{
+		if (!graph.IsEmpty() && force)
+			NavSpew(MQ2NAV_SPEW_PATHING, "routed path to %.2f,%.2f,%.2f failed", epos[0], epos[1], epos[2]);
+		return false;
+	}
+
+	return true;
+}
+
+void NavigationPath::UpdateTargetPosition()
+{
+	if (!m_destinationInfo || !m_destinationInfo->spawnId)
+		return;
+
+	PSPAWNINFO pSpawn = (PSPAWNINFO)GetSpawnByID(m_destinationInfo->spawnId);
+	if (!pSpawn)
+		return;
+
+	glm::vec3 pos(pSpawn->X, pSpawn->Y, pSpawn->Z);
+	if (glm::distance(pos, m_destinationInfo->eqDestinationPos) <= PURSUIT_UPDATE_DISTANCE)
+		return;
+
+	m_destinationInfo->eqDestinationPos = pos;
+
+	// corridor paths move their target on every update
+	if (m_useCorridor)
+		return;
+
+	if (!MovePathTarget(pos))
+		m_replanRequested = true;
+}
+
+bool NavigationPath::MovePathTarget(const glm::vec3& eqPos)
+{
+	if (!m_query || m_pendingSearch)
+		return false;
+	if (m_pathPolys.empty() || m_currentPathSize <= 0)
+		return false;
+
+	PSPAWNINFO me = GetCharInfo()->pSpawn;
+	if (me == nullptr)
+		return false;
+
+	float startOffset[3] = { me->X, me->FloorHeight, me->Y };
+	float endOffset[3] = { eqPos.x, eqPos.z, eqPos.y };
+
+	float oldEnd[3];
+	dtVcopy(oldEnd, GetRawPosition(m_currentPathSize - 1));
+	if (dtVdist2D(oldEnd, endOffset) > PURSUIT_MAX_REPAIR_DISTANCE)
+		return false;
+
+	// the rest of the path goes into a corridor, which moves its end along the
+	// surface of the mesh and fixes up the polygons behind it.
+	if (!m_corridor)
+	{
+		m_corridor.reset(new dtPathCorridor);
+		m_corridor->init(CORRIDOR_MAX_POLYS);
+	}
+
+	const int first = std::min(m_pathPolyCursor, (int)m_pathPolys.size() - 1);
+	const int count = (int)m_pathPolys.size() - first;
+	if (count >= CORRIDOR_MAX_POLYS)
+		return false;
+
+	m_corridor->reset(m_pathPolys[first], startOffset);
+	m_corridor->setCorridor(oldEnd, &m_pathPolys[first], count);
+
+	if (!m_corridor->moveTargetPosition(endOffset, m_query.get(), m_filter))
+		return false;
+
+	// blocked somewhere along the way, the spawn went around something
+	if (dtVdist2DSqr(m_corridor->getTarget(), endOffset) > dtSqr(PURSUIT_TARGET_TOLERANCE))
+		return false;
+
+	float spos[3], epos[3];
+	if (dtStatusFailed(m_query->closestPointOnPoly(m_corridor->getFirstPoly(), startOffset, spos, nullptr)))
+		return false;
+	dtVcopy(epos, m_corridor->getTarget());
+
+	m_destination = eqPos;
+	m_destinationRef = m_corridor->getLastPoly();
+	m_currentPathCursor = 0;
+	m_currentPathSize = 0;
+
+	FinishPath(spos, epos, m_corridor->getPath(), m_corridor->getPathCount());
+	return m_currentPathSize > 0;
+}
+
+bool NavigationPath::ShouldReplan()
+{
+	if (m_replanRequested)
+	{
+		m_replanRequested = false;
+		return true;
+	}
+
+	if (m_useCorridor)
+		return false;
+
+	// keep trying until there is a path to follow
+	if (m_pathPolys.empty() || !m_query)
+		return true;
+
+	// and one that gets all the way there. The caller keeps this to once every
+	// PATHFINDING_DELAY_MS.
+	if (m_destinationRef && m_pathPolys.back() != m_destinationRef)
+		return true;
+
+	PSPAWNINFO me = GetCharInfo()->pSpawn;
+	if (me == nullptr)
+		return false;
+
+	float pos[3] = { me->X, me->FloorHeight, me->Y };
+	return !IsOnPathPolys(pos);
+}
+
+bool NavigationPath::FindAreaAhead(uint8_t areaId, const glm::vec3& pos, float maxDistance,
+	glm::vec3& areaPos) const
+{
+	if (!m_navMesh)
+		return false;
+
+	for (int i = std::max(m_pathPolyCursor, 0); i < (int)m_pathPolys.size(); ++i)
+	{
+		const dtMeshTile* tile = nullptr;
+		const dtPoly* poly = nullptr;
+		if (dtStatusFailed(m_navMesh->getTileAndPolyByRef(m_pathPolys[i], &tile, &poly)))
+			return false;
+
+		float center[3] = { 0, 0, 0 };
+		for (int j = 0; j < poly->vertCount; ++j)
+			dtVadd(center, center, &tile->verts[poly->verts[j] * 3]);
+		dtVscale(center, center, 1.0f / poly->vertCount);
+
+		// the polygon we're on can be big, the ones after it are further along
+		if (i > m_pathPolyCursor && dtVdist2D(center, glm::value_ptr(pos)) > maxDistance)
+			return false;
+
+		if (poly->getArea() == areaId)
+		{
+			areaPos = glm::vec3(center[0], center[1], center[2]);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool NavigationPath::IsOnPathPolys(const float* pos)
+{
+	// usually still on the same polygon, or on one of the next few
+	const int last = std::min((int)m_pathPolys.size(), m_pathPolyCursor + PATH_POLY_LOOKAHEAD);
+	for (int i = m_pathPolyCursor; i < last; ++i)
+	{
+		float closest[3];
+		bool posOverPoly = false;
+
+		if (dtStatusSucceed(m_query->closestPointOnPoly(m_pathPolys[i], pos, closest, &posOverPoly))
+			&& posOverPoly && fabsf(closest[1] - pos[1]) <= m_extents[1])
+		{
+			m_pathPolyCursor = i;
+			return true;
+		}
+	}
+
+	float nearest[3];
+	dtPolyRef ref = FindPlayerPoly(pos, nearest);
+
+	// off the mesh (jumping, falling), a new path wouldn't start anywhere better
+	if (!ref)
+		return true;
+
+	auto iter = std::find(m_pathPolys.begin(), m_pathPolys.end(), ref);
+	if (iter == m_pathPolys.end())
+	{
+		return std::find(m_shortcutPolys.begin(), m_shortcutPolys.end(), ref)
+			!= m_shortcutPolys.end();
+	}
+
+	m_pathPolyCursor = static_cast<int>(iter - m_pathPolys.begin());
+	return true;
+}
+
+dtPolyRef NavigationPath::FindPlayerPoly(const float* pos, float* nearest)
+{
+	// the player is almost always on the polygon from last time, or walked onto
+	// one next to it.
+	if (m_playerPoly && m_query->isValidPolyRef(m_playerPoly, m_filter)
+		&& dtVdist2DSqr(m_playerPolyPos, pos) < dtSqr(PLAYER_POLY_MAX_MOVE))
+	{
+		bool posOverPoly = false;
+		if (dtStatusSucceed(m_query->closestPointOnPoly(m_playerPoly, pos, nearest, &posOverPoly))
+			&& posOverPoly && fabsf(nearest[1] - pos[1]) <= m_extents[1])
+		{
+			dtVcopy(m_playerPolyPos, nearest);
+			return m_playerPoly;
+		}
+
+		// slide across the surface from where the player was last seen. If that
+		// reaches pos, the last polygon visited is the one the player is on.
+		dtPolyRef visited[PLAYER_POLY_MAX_VISITED];
+		int visitedCount = 0;
+		float result[3];
+
+		dtStatus status = m_query->moveAlongSurface(m_playerPoly, m_playerPolyPos, pos, m_filter,
+			result, visited, &visitedCount, PLAYER_POLY_MAX_VISITED);
+		if (dtStatusSucceed(status) && visitedCount > 0
+			&& dtVdist2DSqr(result, pos) < 0.01f)
+		{
+			dtPolyRef ref = visited[visitedCount - 1];
+			if (dtStatusSucceed(m_query->closestPointOnPoly(ref, pos, nearest, &posOverPoly))
+				&& posOverPoly && fabsf(nearest[1] - pos[1]) <= m_extents[1])
+			{
+				m_playerPoly = ref;
+				dtVcopy(m_playerPolyPos, nearest);
+				return ref;
+			}
+		}
+	}
+
+	{
+		mq2nav::ScopedPerfTimer timer(mq2nav::PerfTimer::FindNearestPoly);
+
+		dtPolyRef ref = 0;
+		m_query->findNearestPoly(pos, m_extents, m_filter, &ref, nearest);
+
+		m_playerPoly = ref;
+		if (ref)
+			dtVcopy(m_playerPolyPos, nearest);
+		return ref;
+	}
+}
+
+// a short way from startRef around blockedRef, back onto path at a polygon past
+// the blocked one. Breadth first over the links of at most maxPolys polygons, so
+// it stays local. The result is followed by the rest of path.
+static bool FindDetour(const dtNavMesh* navMesh, const dtNavMeshQuery* query, const dtQueryFilter* filter,
+	dtPolyRef startRef, dtPolyRef blockedRef, const std::vector<dtPolyRef>& path, int blockedIndex,
+	int maxPolys, std::vector<dtPolyRef>& result)
+{
+	std::unordered_map<dtPolyRef, int> rejoin;
+	for (int i = blockedIndex + 1; i < (int)path.size(); ++i)
+		rejoin.emplace(path[i], i);
+
+	std::unordered_map<dtPolyRef, dtPolyRef> parents;
+	std::queue<dtPolyRef> open;
+
+	parents[startRef] = 0;
+	open.push(startRef);
+
+	while (!open.empty() && (int)parents.size() < maxPolys)
+	{
+		dtPolyRef ref = open.front();
+		open.pop();
+
+		const dtMeshTile* tile = nullptr;
+		const dtPoly* poly = nullptr;
+		navMesh->getTileAndPolyByRefUnsafe(ref, &tile, &poly);
+
+		for (unsigned int i = poly->firstLink; i != DT_NULL_LINK; i = tile->links[i].next)
+		{
+			dtPolyRef neighbour = tile->links[i].ref;
+			if (!neighbour || neighbour == blockedRef || parents.count(neighbour)
+				|| !query->isValidPolyRef(neighbour, filter))
+			{
+				continue;
+			}
+
+			parents[neighbour] = ref;
+
+			auto iter = rejoin.find(neighbour);
+			if (iter != rejoin.end())
+			{
+				result.clear();
+				for (dtPolyRef step = neighbour; step; step = parents[step])
+					result.push_back(step);
+				std::reverse(result.begin(), result.end());
+
+				result.insert(result.end(), path.begin() + iter->second + 1, path.end());
+				return true;
+			}
+
+			open.push(neighbour);
+		}
+	}
+
+	return false;
+}
+
+NavigationPath::StallRecovery NavigationPath::RecoverFromStall(int attempt)
+{
+	// corridors replan on their own when they break
+	if (m_useCorridor || !m_query || m_pendingSearch || m_pathPolys.empty() || IsAtEnd())
+	{
+		m_replanRequested = true;
+		return StallRecovery::Replan;
+	}
+
+	PSPAWNINFO me = GetCharInfo()->pSpawn;
+	if (me == nullptr)
+		return StallRecovery::None;
+
+	float pos[3] = { me->X, me->FloorHeight, me->Y };
+	float spos[3], epos[3];
+
+	dtPolyRef startRef = FindPlayerPoly(pos, spos);
+	if (!startRef || !IsOnPathPolys(spos))
+	{
+		m_replanRequested = true;
+		return StallRecovery::Replan;
+	}
+
+	dtVcopy(epos, GetRawPosition(m_currentPathSize - 1));
+	const float* next = GetRawPosition(m_currentPathCursor);
+
+	if (attempt == 0)
+	{
+		// the mesh says the way to the next waypoint is blocked, so it must have
+		// cut a corner. Go back to following the corners of the path polygons.
+		float result[3];
+		dtPolyRef visited[STALL_MAX_VISITED];
+		int visitedCount = 0;
+
+		dtStatus status = m_query->moveAlongSurface(startRef, spos, next, m_filter,
+			result, visited, &visitedCount, STALL_MAX_VISITED);
+		if (dtStatusFailed(status) || dtVdist2DSqr(result, next) <= dtSqr(m_extents[0]))
+			return StallRecovery::None;
+
+		std::vector<dtPolyRef> polys(m_pathPolys.begin() + m_pathPolyCursor, m_pathPolys.end());
+		m_currentPathCursor = 0;
+		m_currentPathSize = 0;
+		FinishPath(spos, epos, polys.data(), static_cast<int>(polys.size()), false);
+		return StallRecovery::Resurface;
+	}
+
+	if (attempt == 1 && m_pathPolyCursor + 1 < (int)m_pathPolys.size())
+	{
+		// something that isn't in the mesh is in the way, go around the polygon
+		// after the one we're stuck on.
+		const int blockedIndex = m_pathPolyCursor + 1;
+		if (FindDetour(m_navMesh.get(), m_query.get(), m_filter, startRef, m_pathPolys[blockedIndex],
+			m_pathPolys, blockedIndex, STALL_DETOUR_MAX_POLYS, m_cachedPath))
+		{
+			m_currentPathCursor = 0;
+			m_currentPathSize = 0;
+			FinishPath(spos, epos, m_cachedPath.data(), static_cast<int>(m_cachedPath.size()));
+			return StallRecovery::Detour;
+		}
+	}
+
+	m_replanRequested = true;
+	return StallRecovery::Replan;
+}
+
+void NavigationPath::FinishPath(const float* spos, const float* epos,
+	const dtPolyRef* polys, int numPolys, bool smooth)
+{
+	if (m_debugDrawGrp)
+		m_debugDrawGrp->Reset();
+
+	m_pathPolys.assign(polys, polys + numPolys);
+	m_pathPolyCursor = 0;
+	m_shortcutPolys.clear();
+	PublishPath(polys, numPolys);
+
+	if (numPolys > 0)
+	{
+		{
+			mq2nav::ScopedPerfTimer timer(mq2nav::PerfTimer::FindStraightPath);
+			m_query->findStraightPath(spos, epos, polys, numPolys, m_currentPath.get(),
+				m_cornerFlags.get(), m_straightPathPolys.get(), &m_currentPathSize, MAX_POLYS,
+				DT_STRAIGHTPATH_AREA_CROSSINGS);
+		}
+
+		if (smooth && mq2nav::GetSettings().smooth_paths)
+		{
+			mq2nav::ScopedPerfTimer timer(mq2nav::PerfTimer::SmoothPath);
+			SmoothPath(mq2nav::GetSettings().path_smoothing_budget);
+		}
+
+		UpdatePathDistances();
+
+		// The 0th index is the starting point. Begin by trying to reach the
+		// 2nd point...
+		if (m_currentPathSize > 1)
+			m_currentPathCursor = 1;
+
+		if (m_debugDrawGrp && mq2nav::GetSettings().debug_render_pathing && !g_mq2Nav->IsInBackground())
+		{
+			DebugDrawDX dd(m_debugDrawGrp.get());
+
+			// draw current position
+			duDebugDrawCross(&dd, spos[0], spos[1], spos[2], 0.5, DXColor(51, 255, 255), 1);
+
+			// Draw the waypoints. Green is next point
+			for (int i = 0; i < m_currentPathSize; ++i)
+			{
+				int color = DXColor(255, 255, 255);
+				if (i < m_currentPathCursor)
+					color = DXColor(0, 102, 204);
+				if (i == m_currentPathCursor)
+					color = DXColor(0, 255, 0);
+				if (i == m_currentPathSize - 1)
+					color = DXColor(255, 0, 0);
+
+				duDebugDrawCross(&dd, m_currentPath[i * 3],
+					m_currentPath[i * 3 + 1],
+					m_currentPath[i * 3 + 2],
+					0.5, color, 1);
+			}
+		}
+	}
+
+	if (m_line && mq2nav::GetSettings().show_nav_path)
+	{
+		m_line->Update();
+	}
+}
+
+void NavigationPath::SmoothPath(float budgetUs)
+{
+	if (m_currentPathSize < 3)
+		return;
+
+	// collinear corners are always dropped, raycasts only while there's time left
+	const clock::time_point deadline = clock::now()
+		+ std::chrono::microseconds(static_cast<int>(budgetUs));
+
+	float* path = m_currentPath.get();
+	uint8_t* flags = m_cornerFlags.get();
+	dtPolyRef* refs = m_straightPathPolys.get();
+
+	// the start is always kept. Points are compacted in place, a kept point never
+	// overwrites one that hasn't been looked at yet.
+	int kept = 1;
+	uint8_t prevFlags = flags[0];
+
+	for (int i = 1; i < m_currentPathSize - 1; ++i)
+	{
+		const float* prev = &path[(kept - 1) * 3];
+		const float* point = &path[i * 3];
+		const float* next = &path[(i + 1) * 3];
+
+		// both ends of an off-mesh connection have to be walked to
+		bool offMesh = (flags[i] & DT_STRAIGHTPATH_OFFMESH_CONNECTION)
+			|| (prevFlags & DT_STRAIGHTPATH_OFFMESH_CONNECTION);
+		prevFlags = flags[i];
+
+		bool remove = false;
+		if (!offMesh)
+		{
+			float t = 0.0f;
+			float distSqr = dtDistancePtSegSqr2D(point, prev, next, t);
+			float height = prev[1] + (next[1] - prev[1]) * t;
+
+			remove = distSqr < dtSqr(SMOOTH_COLLINEAR_DISTANCE)
+				&& fabsf(point[1] - height) < SMOOTH_COLLINEAR_HEIGHT;
+
+			if (!remove && clock::now() < deadline)
+				remove = CanShortcut(refs[kept - 1], prev, next);
+		}
+
+		if (!remove)
+		{
+			dtVcopy(&path[kept * 3], point);
+			flags[kept] = flags[i];
+			refs[kept] = refs[i];
+			++kept;
+		}
+	}
+
+	const int last = m_currentPathSize - 1;
+	dtVcopy(&path[kept * 3], &path[last * 3]);
+	flags[kept] = flags[last];
+	refs[kept] = refs[last];
+
+	m_currentPathSize = kept + 1;
+}
+
+bool NavigationPath::CanShortcut(dtPolyRef startRef, const float* start, const float* end)
+{
+	dtPolyRef rayPolys[SMOOTH_MAX_RAYCAST_POLYS];
+	int rayCount = 0;
+	float t = 0.0f;
+	float hitNormal[3];
+
+	dtStatus status = m_query->raycast(startRef, start, end, m_filter, &t, hitNormal,
+		rayPolys, &rayCount, SMOOTH_MAX_RAYCAST_POLYS);
+	if (dtStatusFailed(status) || dtStatusDetail(status, DT_BUFFER_TOO_SMALL)
+		|| t != FLT_MAX || rayCount == 0)
+	{
+		return false;
+	}
+
+	// raycasts ignore height, make sure it ended up on the same level as end
+	float closest[3];
+	if (dtStatusFailed(m_query->closestPointOnPoly(rayPolys[rayCount - 1], end, closest, nullptr))
+		|| fabsf(closest[1] - end[1]) > m_extents[1])
+	{
+		return false;
+	}
+
+	// walking the shortcut shouldn't look like leaving the path
+	for (int i = 0; i < rayCount; ++i)
+	{
+		if (std::find(m_pathPolys.begin(), m_pathPolys.end(), rayPolys[i]) == m_pathPolys.end()
+			&& std::find(m_shortcutPolys.begin(), m_shortcutPolys.end(), rayPolys[i]) == m_shortcutPolys.end())
+		{
+			m_shortcutPolys.push_back(rayPolys[i]);
+		}
+	}
+
+	return true;
+}
+
+void NavigationPath::UpdatePathDistances()
+{
+	m_pathDistances.resize(std::max(m_currentPathSize, 0));
+	++m_pathGeneration;
+
+	float distance = 0.f;
+	for (int i = 0; i < m_currentPathSize; ++i)
+	{
+		if (i > 0)
+			distance += dtVdist(GetRawPosition(i - 1), GetRawPosition(i));
+		m_pathDistances[i] = distance;
+	}
+}
+
+float NavigationPath::GetPathTraversalDistance() const
+{
+	if (!m_destinationInfo || !m_destinationInfo->valid)
+		return -1.f;
+
+	// the distances are from the last time the path had points, it may have been
+	// cleared since
+	if (m_currentPathSize <= 0 || m_currentPathSize > (int)m_pathDistances.size())
+		return 0.f;
+
+	return m_pathDistances[m_currentPathSize - 1];
+}
+
+float NavigationPath::GetRemainingDistance(const glm::vec3& pos) const
+{
+	if (!m_destinationInfo || !m_destinationInfo->valid
+		|| m_currentPathSize <= 0 || m_currentPathSize > (int)m_pathDistances.size())
+	{
+		return -1.f;
+	}
+
+	if (IsAtEnd())
+		return 0.f;
+
+	const int cursor = m_currentPathCursor;
+	return dtVdist(glm::value_ptr(pos), GetRawPosition(cursor))
+		+ m_pathDistances[m_currentPathSize - 1] - m_pathDistances[cursor];
+}
+
+void NavigationPath::RenderUI()
+{
+	bool showPath = mq2nav::GetSettings().show_nav_path;
+	if (ImGui::Checkbox("Show navigation path", &showPath))
+	{
+		SetShowNavigationPaths(showPath);
+
+		mq2nav::GetSettings().show_nav_path = showPath;
+		mq2nav::SaveSettings(false);
+
+		if (m_line)
+			m_line->SetVisible(showPath);
+	}
+
+#if DEBUG_NAVIGATION_LINES
+	if (m_line)
+		m_line->RenderUI();
+#endif
+}
+
+glm::vec3 NavigationPath::GetDestination() const
+{
+	return m_destinationInfo ? m_destinationInfo->eqDestinationPos : glm::vec3();
+}
+
+//----------------------------------------------------------------------------
+
+// upper bound on the number of polygons visited by a batched search
+const int MAX_BATCH_NODES = 65536;
+
+// same test as dtQueryFilter::passFilter, which is only defined inside detour
+static inline bool PassFilter(const dtQueryFilter& filter, const dtPoly* poly)
+{
+	return (poly->flags & filter.getIncludeFlags()) != 0
+		&& (poly->flags & filter.getExcludeFlags()) == 0;
+}
+
+// what a leg between stops that can't reach each other counts as when ordering
+const float STOP_UNREACHABLE_COST = 1e7f;
+
+// 2-opt gives up after this many passes that improved the route
+const int STOP_ORDER_MAX_PASSES = 50;
+
+// the most layers a tile has, for looking them up
+const int FLOOR_MAX_TILE_LAYERS = 32;
+
+// the polys of a tile whose bounds contain pos, from the bv tree if it has one
+static void FindPolysOverPoint(const dtMeshTile* tile, const float* pos, std::vector<int>& polys)
+{
+	const dtMeshHeader* header = tile->header;
+	polys.clear();
+
+	if (!tile->bvTree)
+	{
+		for (int i = 0; i < header->polyCount; ++i)
+			polys.push_back(i);
+		return;
+	}
+
+	// quantized the same way detour's own tile queries do, with every height
+	const float qfac = header->bvQuantFactor;
+	const float x = dtClamp(pos[0], header->bmin[0], header->bmax[0]) - header->bmin[0];
+	const float z = dtClamp(pos[2], header->bmin[2], header->bmax[2]) - header->bmin[2];
+
+	unsigned short bmin[3], bmax[3];
+	bmin[0] = (unsigned short)(qfac * x) & 0xfffe;
+	bmin[1] = 0;
+	bmin[2] = (unsigned short)(qfac * z) & 0xfffe;
+	bmax[0] = (unsigned short)(qfac * x + 1) | 1;
+	bmax[1] = 0xffff;
+	bmax[2] = (unsigned short)(qfac * z + 1) | 1;
+
+	const dtBVNode* node = tile->bvTree;
+	const dtBVNode* end = tile->bvTree + header->bvNodeCount;
+	while (node < end)
+	{
+		const bool overlap = dtOverlapQuantBounds(bmin, bmax, node->bmin, node->bmax);
+		const bool leaf = node->i >= 0;
+
+		if (leaf && overlap)
+			polys.push_back(node->i);
+
+		if (overlap || leaf)
+			++node;
+		else
+			node += -node->i;
+	}
 }
 
-//----------------------------------------------------------------------------
-
-void NavigationPath::SetShowNavigationPaths(bool renderPaths)
+std::vector<float> FindFloorHeights(dtNavMeshQuery* query, const dtQueryFilter& filter,
+	const std::vector<glm::vec3>& positions)
 {
-	if (m_renderPaths == renderPaths)
-		return;
+	std::vector<float> heights(positions.size(), FLT_MAX);
 
-	m_renderPaths = renderPaths;
+	const dtNavMesh* navMesh = query ? query->getAttachedNavMesh() : nullptr;
+	if (!navMesh || positions.empty())
+		return heights;
 
-	if (m_renderPaths)
+	// positions by tile, so that each tile is only looked up once
+	struct TilePoint
 	{
-		m_line = std::make_shared<NavigationLine>(this);
-		m_line->SetVisible(mq2nav::GetSettings().show_nav_path);
-		g_renderHandler->AddRenderable(m_line.get());
+		int tx, ty;
+		size_t index;
 
-		m_debugDrawGrp = std::make_unique<RenderGroup>(g_pDevice);
-		g_renderHandler->AddRenderable(m_debugDrawGrp.get());
+		bool operator<(const TilePoint& other) const
+		{
+			return std::tie(tx, ty, index) < std::tie(other.tx, other.ty, other.index);
+		}
+	};
+
+	std::vector<TilePoint> points(positions.size());
+	for (size_t i = 0; i < positions.size(); ++i)
+	{
+		navMesh->calcTileLoc(glm::value_ptr(positions[i]), &points[i].tx, &points[i].ty);
+		points[i].index = i;
 	}
-	else
+	std::sort(points.begin(), points.end());
+
+	const dtMeshTile* tiles[FLOOR_MAX_TILE_LAYERS];
+	int tileCount = 0;
+	std::vector<int> polys;
+	float verts[DT_VERTS_PER_POLYGON * 3];
+
+	for (size_t p = 0; p < points.size(); ++p)
 	{
-		g_renderHandler->RemoveRenderable(m_debugDrawGrp.get());
-		g_renderHandler->RemoveRenderable(m_line.get());
+		const TilePoint& point = points[p];
+		if (p == 0 || point.tx != points[p - 1].tx || point.ty != points[p - 1].ty)
+			tileCount = navMesh->getTilesAt(point.tx, point.ty, tiles, FLOOR_MAX_TILE_LAYERS);
 
-		m_line.reset();
-		m_debugDrawGrp.reset();
+		const float* pos = glm::value_ptr(positions[point.index]);
+		float bestDistance = FLT_MAX;
+
+		for (int t = 0; t < tileCount; ++t)
+		{
+			const dtMeshTile* tile = tiles[t];
+			const dtPolyRef base = navMesh->getPolyRefBase(tile);
+
+			FindPolysOverPoint(tile, pos, polys);
+			for (int polyIndex : polys)
+			{
+				const dtPoly* poly = &tile->polys[polyIndex];
+				const dtPolyRef ref = base | (dtPolyRef)polyIndex;
+				if (poly->getType() == DT_POLYTYPE_OFFMESH_CONNECTION || !PassFilter(filter, poly))
+					continue;
+
+				for (int v = 0; v < poly->vertCount; ++v)
+					dtVcopy(&verts[v * 3], &tile->verts[poly->verts[v] * 3]);
+				if (!dtPointInPolygon(pos, verts, poly->vertCount))
+					continue;
+
+				float height;
+				if (dtStatusFailed(query->getPolyHeight(ref, pos, &height)))
+					continue;
+
+				// no height to be close to, the highest floor wins
+				const float distance = pos[1] == FLT_MAX ? -height : fabsf(height - pos[1]);
+				if (distance < bestDistance)
+				{
+					bestDistance = distance;
+					heights[point.index] = height;
+				}
+			}
+		}
 	}
+
+	return heights;
 }
 
-void NavigationPath::SetDestination(const std::shared_ptr<DestinationInfo>& info)
+// dijkstra expansion over the polygon graph, moving between edge midpoints the
+// same way detour's own searches do. Goes until every polygon in targets has been
+// reached, or the first of them if stopAtFirst, which is returned.
+struct PolySearchNode
 {
-	m_destinationInfo = info;
-}
+	float cost;
+	dtPolyRef parent;
+	glm::vec3 pos;
+	bool closed;
+};
 
-bool NavigationPath::FindPath()
+using PolySearchNodes = std::unordered_map<dtPolyRef, PolySearchNode>;
+
+static dtPolyRef SearchPolyGraph(const dtNavMesh* navMesh, const dtQueryFilter& filter,
+	dtPolyRef startRef, const float* spos, std::unordered_set<dtPolyRef>& targets,
+	bool stopAtFirst, PolySearchNodes& nodes)
 {
-	if (!m_navMesh)
-		return false;
+	using QueueEntry = std::pair<float, dtPolyRef>;
+	std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry>> open;
 
-	if (!m_destinationInfo || !m_destinationInfo->valid)
-		return false;
+	nodes[startRef] = PolySearchNode{ 0.f, 0, glm::make_vec3(spos), false };
+	open.emplace(0.f, startRef);
 
-	// WriteChatf("MQ2Navigation::FindPath - %.1f %.1f %.1f", X, Y, Z);
-	m_currentPathCursor = 0;
-	m_currentPathSize = 0;
+	while (!open.empty() && !targets.empty() && (int)nodes.size() < MAX_BATCH_NODES)
+	{
+		QueueEntry top = open.top();
+		open.pop();
 
-	UpdatePath(true);
+		dtPolyRef ref = top.second;
+		PolySearchNode& node = nodes[ref];
+		if (node.closed || top.first > node.cost)
+			continue;
 
-	return m_currentPathSize > 0;
-}
+		node.closed = true;
+		if (targets.erase(ref) && stopAtFirst)
+			return ref;
 
-void NavigationPath::SetNavMesh(const std::shared_ptr<dtNavMesh>& navMesh,
-	bool updatePath)
-{
-	m_navMesh = navMesh;
+		const dtMeshTile* tile = nullptr;
+		const dtPoly* poly = nullptr;
+		navMesh->getTileAndPolyByRefUnsafe(ref, &tile, &poly);
 
-	m_query.reset();
-	m_corridor.reset();
+		for (unsigned int i = poly->firstLink; i != DT_NULL_LINK; i = tile->links[i].next)
+		{
+			const dtLink& link = tile->links[i];
+			dtPolyRef neighbourRef = link.ref;
+			if (!neighbourRef || neighbourRef == node.parent)
+				continue;
 
-	m_filter = dtQueryFilter{};
-	m_filter.setIncludeFlags(+PolyFlags::All);
-	m_filter.setExcludeFlags(+PolyFlags::Disabled);
-	if (auto* mesh = g_mq2Nav->Get<NavMesh>())
-	{
-		mesh->FillFilterAreaCosts(m_filter);
-	}
+			const dtMeshTile* neighbourTile = nullptr;
+			const dtPoly* neighbourPoly = nullptr;
+			navMesh->getTileAndPolyByRefUnsafe(neighbourRef, &neighbourTile, &neighbourPoly);
 
-	if (updatePath && m_navMesh)
-	{
-		UpdatePath();
+			if (!PassFilter(filter, neighbourPoly))
+				continue;
+
+			const float* va = &tile->verts[poly->verts[link.edge] * 3];
+			const float* vb = &tile->verts[poly->verts[(link.edge + 1) % poly->vertCount] * 3];
+			glm::vec3 mid = (glm::make_vec3(va) + glm::make_vec3(vb)) * 0.5f;
+
+			float cost = node.cost + glm::distance(node.pos, mid) * filter.getAreaCost(poly->getArea());
+
+			auto iter = nodes.find(neighbourRef);
+			if (iter != nodes.end() && (iter->second.closed || iter->second.cost <= cost))
+				continue;
+
+			nodes[neighbourRef] = PolySearchNode{ cost, ref, mid, false };
+			open.emplace(cost, neighbourRef);
+		}
 	}
+
+	return 0;
 }
 
-void NavigationPath::UpdatePath(bool force)
+// walk the search tree back to the start from endRef and string pull the
+// corridor to get the actual distance. -1 if the search didn't get there.
+static float GetSearchedPathLength(dtNavMeshQuery* query, PolySearchNodes& nodes,
+	const float* spos, dtPolyRef endRef, const float* epos, std::vector<dtPolyRef>& corridor,
+	float* straightPath)
 {
-	if (m_navMesh == nullptr || m_destinationInfo == nullptr)
-		return;
+	auto iter = nodes.find(endRef);
+	if (!endRef || iter == nodes.end() || !iter->second.closed)
+		return -1.f;
 
-	if (m_query == nullptr)
-	{
-		m_query = deleting_unique_ptr<dtNavMeshQuery>(dtAllocNavMeshQuery(),
-			[](dtNavMeshQuery* ptr) { dtFreeNavMeshQuery(ptr); });
+	corridor.clear();
+	for (dtPolyRef ref = endRef; ref != 0; ref = nodes[ref].parent)
+		corridor.push_back(ref);
+	std::reverse(corridor.begin(), corridor.end());
+
+	int straightPathSize = 0;
+	query->findStraightPath(spos, epos, &corridor[0], (int)corridor.size(),
+		straightPath, 0, 0, &straightPathSize, MAX_PATH_SIZE, 0);
 
-		m_query->init(m_navMesh.get(), MAX_NODES);
+	float length = 0.f;
+	for (int j = 0; j < straightPathSize - 1; ++j)
+	{
+		length += dtVdist(&straightPath[j * 3], &straightPath[(j + 1) * 3]);
 	}
 
-	PSPAWNINFO me = GetCharInfo()->pSpawn;
-	if (me == nullptr)
-		return;
+	return length;
+}
+
+std::vector<float> CalculatePathLengths(dtNavMeshQuery* query, const dtQueryFilter& filter,
+	const glm::vec3& start, const std::vector<glm::vec3>& destinations,
+	const float* extents)
+{
+	std::vector<float> results(destinations.size(), -1.f);
 
-	m_destination = m_destinationInfo->eqDestinationPos;
+	const dtNavMesh* navMesh = query ? query->getAttachedNavMesh() : nullptr;
+	if (!navMesh || destinations.empty())
+		return results;
 
-	float startOffset[3] = { me->X, me->FloorHeight, me->Y };
-	float endOffset[3] = { m_destination.x, m_destination.z, m_destination.y };
+	dtPolyRef startRef = 0;
 	float spos[3];
-	float epos[3];
+	query->findNearestPoly(glm::value_ptr(start), extents, &filter, &startRef, spos);
+	if (!startRef)
+		return results;
 
-	glm::vec3 thisPos(startOffset[0], startOffset[1], startOffset[2]);
+	std::vector<dtPolyRef> endRefs(destinations.size());
+	std::vector<glm::vec3> endPositions(destinations.size());
+	std::unordered_set<dtPolyRef> remaining;
 
-	if (thisPos == m_lastPos && !force)
-		return;
-	m_lastPos = thisPos;
+	for (size_t i = 0; i < destinations.size(); ++i)
+	{
+		query->findNearestPoly(glm::value_ptr(destinations[i]), extents, &filter,
+			&endRefs[i], glm::value_ptr(endPositions[i]));
 
-	m_currentPathCursor = 0;
-	m_currentPathSize = 0;
+		if (endRefs[i])
+			remaining.insert(endRefs[i]);
+	}
 
-	dtPolyRef startRef, endRef;
-	m_query->findNearestPoly(startOffset, m_extents, &m_filter, &startRef, spos);
+	PolySearchNodes nodes;
+	SearchPolyGraph(navMesh, filter, startRef, spos, remaining, false, nodes);
 
-	if (!startRef)
+	std::vector<dtPolyRef> corridor;
+	std::unique_ptr<float[]> straightPath(new float[MAX_PATH_SIZE * 3]);
+
+	for (size_t i = 0; i < destinations.size(); ++i)
 	{
-		WriteChatf(PLUGIN_MSG "Could not locate starting point on navmesh: %.2f %.2f %.2f)",
-			startOffset[2], startOffset[0], startOffset[1]);
-		return;
+		results[i] = GetSearchedPathLength(query, nodes, spos, endRefs[i],
+			glm::value_ptr(endPositions[i]), corridor, straightPath.get());
 	}
 
-	dtPolyRef polys[MAX_POLYS];
-	int numPolys = 0;
+	return results;
+}
 
-	if (!m_corridor)
+int FindNearestDestination(dtNavMeshQuery* query, const dtQueryFilter& filter,
+	dtPolyRef startRef, const float* spos, const std::vector<dtPolyRef>& endRefs,
+	const std::vector<glm::vec3>& endPositions, float* length)
+{
+	const dtNavMesh* navMesh = query ? query->getAttachedNavMesh() : nullptr;
+	if (!navMesh || !startRef)
+		return -1;
+
+	std::unordered_set<dtPolyRef> targets;
+	for (dtPolyRef ref : endRefs)
 	{
-		if (m_useCorridor)
-		{
-			// initialize planning
-			m_corridor.reset(new dtPathCorridor);
-			m_corridor->init(MAX_PATH_SIZE);
+		if (ref)
+			targets.insert(ref);
+	}
 
-			m_corridor->reset(startRef, startOffset);
-		}
+	if (targets.empty())
+		return -1;
 
-		m_query->findNearestPoly(endOffset, m_extents, &m_filter, &endRef, epos);
+	PolySearchNodes nodes;
+	dtPolyRef reached = SearchPolyGraph(navMesh, filter, startRef, spos, targets, true, nodes);
+	if (!reached)
+		return -1;
 
-		if (!endRef)
-		{
-			WriteChatf(PLUGIN_MSG "Could not locate destination on navmesh: %.2f %.2f %.2f",
-				endOffset[2], endOffset[0], endOffset[1]);
-			return;
-		}
+	// several destinations in the polygon that was reached, the closest of them
+	int nearest = -1;
+	float nearestDistSq = FLT_MAX;
+	const glm::vec3& reachedPos = nodes[reached].pos;
 
-		dtStatus status = m_query->findPath(startRef, endRef, spos, epos, &m_filter, polys, &numPolys, MAX_POLYS);
-		if (status & DT_OUT_OF_NODES)
-			DebugSpewAlways("findPath from %.2f,%.2f,%.2f to %.2f,%.2f,%.2f failed: out of nodes",
-				startOffset[0], startOffset[1], startOffset[2],
-				endOffset[0], endOffset[1], endOffset[2]);
-		if (status & DT_PARTIAL_RESULT)
-			DebugSpewAlways("findPath from %.2f,%.2f,%.2f to %.2f,%.2f,%.2f returned a partial result.",
-				startOffset[0], startOffset[1], startOffset[2],
-				endOffset[0], endOffset[1], endOffset[2]);
-
-		if (m_corridor)
+	for (size_t i = 0; i < endRefs.size(); ++i)
+	{
+		if (endRefs[i] != reached)
+			continue;
+
+		glm::vec3 delta = endPositions[i] - reachedPos;
+		float distSq = glm::dot(delta, delta);
+		if (distSq < nearestDistSq)
 		{
-			m_corridor->setCorridor(endOffset, polys, numPolys);
+			nearest = (int)i;
+			nearestDistSq = distSq;
 		}
 	}
-	else
+
+	if (length)
 	{
-		// this is an update
-		m_corridor->movePosition(startOffset, m_query.get(), &m_filter);
+		std::vector<dtPolyRef> corridor;
+		std::unique_ptr<float[]> straightPath(new float[MAX_PATH_SIZE * 3]);
+
+		*length = GetSearchedPathLength(query, nodes, spos, reached,
+			glm::value_ptr(endPositions[nearest]), corridor, straightPath.get());
 	}
 
-	if (m_corridor)
-	{
-		m_corridor->optimizePathTopology(m_query.get(), &m_filter);
+	return nearest;
+}
 
-		if (!m_currentPath)
-		{
-			m_currentPath = std::unique_ptr<float[]>(new float[MAX_POLYS * 3]);
-		}
-		if (!m_cornerFlags)
-		{
-			m_cornerFlags = std::unique_ptr<uint8_t[]>(new uint8_t[MAX_POLYS]);
-		}
+std::vector<float> CalculatePathLengthMatrix(NavMesh* navMesh, const dtQueryFilter& filter,
+	const std::vector<glm::vec3>& positions, const float* extents)
+{
+	MQ2NAV_PROFILE_ZONE("CalculatePathLengthMatrix");
 
-		m_currentPathSize = m_corridor->findCorners(m_currentPath.get(),
-			m_cornerFlags.get(), polys, 10, m_query.get(), &m_filter);
-	}
+	const size_t count = positions.size();
+	std::vector<float> lengths(count * count, -1.f);
+	if (count == 0)
+		return lengths;
 
-	if (m_debugDrawGrp)
-		m_debugDrawGrp->Reset();
+	// the pool isn't for other threads, so every query is taken out up front
+	const size_t threadCount = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), count);
 
-	if (numPolys > 0)
+	std::vector<std::shared_ptr<dtNavMeshQuery>> queries;
+	for (size_t i = 0; i < threadCount; ++i)
 	{
-		if (!m_currentPath)
-		{
-			m_currentPath = std::unique_ptr<float[]>(new float[MAX_POLYS * 3]);
-		}
-
-		m_query->findStraightPath(spos, epos, polys, numPolys, m_currentPath.get(),
-			0, 0, &m_currentPathSize, MAX_POLYS, DT_STRAIGHTPATH_AREA_CROSSINGS);
+		auto query = navMesh->AcquireNavMeshQuery();
+		if (!query)
+			break;
+		queries.push_back(std::move(query));
+	}
 
-		// The 0th index is the starting point. Begin by trying to reach the
-		// 2nd point...
-		if (m_currentPathSize > 1)
-			m_currentPathCursor = 1;
+	std::atomic<size_t> nextRow{ 0 };
+	auto calculateRows = [&](dtNavMeshQuery* query)
+	{
+		auto tilesLock = navMesh->LockTiles();
 
-		if (m_debugDrawGrp && mq2nav::GetSettings().debug_render_pathing)
+		for (size_t row = nextRow++; row < count; row = nextRow++)
 		{
-			DebugDrawDX dd(m_debugDrawGrp.get());
-
-			// draw current position
-			duDebugDrawCross(&dd, me->X, me->FloorHeight, me->Y, 0.5, DXColor(51, 255, 255), 1);
+			std::vector<float> rowLengths = CalculatePathLengths(query, filter,
+				positions[row], positions, extents);
+			std::copy(rowLengths.begin(), rowLengths.end(), lengths.begin() + row * count);
+		}
+	};
 
-			// Draw the waypoints. Green is next point
-			for (int i = 0; i < m_currentPathSize; ++i)
-			{
-				int color = DXColor(255, 255, 255);
-				if (i < m_currentPathCursor)
-					color = DXColor(0, 102, 204);
-				if (i == m_currentPathCursor)
-					color = DXColor(0, 255, 0);
-				if (i == m_currentPathSize - 1)
-					color = DXColor(255, 0, 0);
+	std::vector<std::future<void>> workers;
+	for (const auto& query : queries)
+		workers.push_back(std::async(std::launch::async, calculateRows, query.get()));
 
-				duDebugDrawCross(&dd, m_currentPath[i * 3],
-					m_currentPath[i * 3 + 1],
-					m_currentPath[i * 3 + 2],
-					0.5, color, 1);
-			}
-		}
-	}
+	for (auto& worker : workers)
+		worker.get();
 
-	if (m_line && mq2nav::GetSettings().show_nav_path)
-	{
-		m_line->Update();
-	}
+	return lengths;
 }
 
-float NavigationPath::GetPathTraversalDistance() const
+std::vector<size_t> OrderStops(const std::vector<float>& lengths, size_t count)
 {
-	float result = 0.f;
+	std::vector<size_t> order;
+	if (count < 2)
+		return order;
 
-	if (!m_destinationInfo || !m_destinationInfo->valid)
-		return -1.f;
+	// stops that can't be reached from each other go last, past anything reachable
+	auto cost = [&](size_t from, size_t to)
+	{
+		float length = lengths[from * count + to];
+		return length < 0.f ? STOP_UNREACHABLE_COST : length;
+	};
+
+	auto routeCost = [&](const std::vector<size_t>& route)
+	{
+		float total = cost(0, route[0]);
+		for (size_t i = 1; i < route.size(); ++i)
+			total += cost(route[i - 1], route[i]);
+		return total;
+	};
+
+	// nearest neighbor from the start
+	std::vector<bool> visited(count, false);
+	size_t current = 0;
+	visited[0] = true;
 
-	for (int i = 0; i < m_currentPathSize - 1; ++i)
+	for (size_t i = 1; i < count; ++i)
 	{
-		const float* first = GetRawPosition(i);
-		const float* second = GetRawPosition(i + 1);
+		size_t best = 0;
+		for (size_t stop = 1; stop < count; ++stop)
+		{
+			if (!visited[stop] && (best == 0 || cost(current, stop) < cost(current, best)))
+				best = stop;
+		}
 
-		// accumulate the distance
-		result += dtVdist(first, second);
+		order.push_back(best);
+		visited[best] = true;
+		current = best;
 	}
-	
-	return result;
-}
 
-void NavigationPath::RenderUI()
-{
-	bool showPath = mq2nav::GetSettings().show_nav_path;
-	if (ImGui::Checkbox("Show navigation path", &showPath))
+	// then 2-opt. The lengths aren't symmetric, so each reversal costs the whole
+	// route again, which is cheap for the few stops a route has.
+	float bestCost = routeCost(order);
+	for (int pass = 0; pass < STOP_ORDER_MAX_PASSES; ++pass)
 	{
-		SetShowNavigationPaths(showPath);
+		bool improved = false;
 
-		mq2nav::GetSettings().show_nav_path = showPath;
-		mq2nav::SaveSettings(false);
+		for (size_t i = 0; i + 1 < order.size(); ++i)
+		{
+			for (size_t j = i + 1; j < order.size(); ++j)
+			{
+				std::reverse(order.begin() + i, order.begin() + j + 1);
+
+				float newCost = routeCost(order);
+				if (newCost < bestCost - 0.01f)
+				{
+					bestCost = newCost;
+					improved = true;
+				}
+				else
+				{
+					std::reverse(order.begin() + i, order.begin() + j + 1);
+				}
+			}
+		}
 
-		if (m_line)
-			m_line->SetVisible(showPath);
+		if (!improved)
+			break;
 	}
 
-#if DEBUG_NAVIGATION_LINES
-	if (m_line)
-		m_line->RenderUI();
-#endif
-}
-
-glm::vec3 NavigationPath::GetDestination() const
-{
-	return m_destinationInfo ? m_destinationInfo->eqDestinationPos : glm::vec3();
+	return order;
 }
 
 //----------------------------------------------------------------------------
@@ -374,6 +1950,7 @@ bool NavigationLine::CreateDeviceObjects()
 	}
 
 	m_loaded = true;
+	m_needsUpdate = true;
 	return true;
 }
 
@@ -391,6 +1968,17 @@ void NavigationLine::InvalidateDeviceObjects()
 		m_vertexBuffer = nullptr;
 	}
 
+	if (m_indexBuffer)
+	{
+		m_indexBuffer->Release();
+		m_indexBuffer = nullptr;
+	}
+
+	m_segmentStarts.clear();
+	m_primitiveCount = 0;
+	m_segments.clear();
+	m_ringHead = 0;
+
 	if (m_vDeclaration)
 	{
 		m_vDeclaration->Release();
@@ -408,7 +1996,7 @@ void NavigationLine::Render(RenderPhase phase)
 		return;
 	if (m_needsUpdate)
 		GenerateBuffers();
-	if (!m_vertexBuffer)
+	if (!m_vertexBuffer || !m_indexBuffer || m_primitiveCount == 0)
 		return;
 
 	D3DXMATRIX world;
@@ -432,13 +2020,15 @@ void NavigationLine::Render(RenderPhase phase)
 
 	g_pDevice->SetVertexDeclaration(m_vDeclaration);
 	g_pDevice->SetStreamSource(0, m_vertexBuffer, 0, sizeof(TVertex));
+	g_pDevice->SetIndices(m_indexBuffer);
 
 	UINT passes = 0;
 	m_effect->Begin(&passes, 0);
 
+	// the passes only differ in their depth test and style, so each one is the
+	// same single draw of the whole path
 	for (int iPass = 0; iPass < passes; iPass++)
 	{
-
 		RenderStyle style;
 		if (iPass < m_renderPasses.size())
 			style = m_renderPasses[iPass];
@@ -452,12 +2042,8 @@ void NavigationLine::Render(RenderPhase phase)
 		m_effect->SetFloat("lineWidth", style.width);
 		m_effect->CommitChanges();
 
-		// render
-		for (auto& cmd : m_commands)
-		{
-			g_pDevice->DrawPrimitive(D3DPT_TRIANGLESTRIP,
-				cmd.StartVertex, cmd.PrimitiveCount);
-		}
+		g_pDevice->DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 0, 0, m_ringCapacity,
+			0, m_primitiveCount);
 
 		m_effect->EndPass();
 	}
@@ -472,22 +2058,21 @@ void NavigationLine::GenerateBuffers()
 {
 	int size = m_path->m_currentPathSize;
 
-	if (size == m_lastSize)
+	if (size < 2)
 	{
-		// check if the path actually changed.
-	}
-
-	if (size <= 0)
+		m_segmentStarts.clear();
+		m_primitiveCount = 0;
+		m_segments.clear();
+		m_needsUpdate = false;
 		return;
+	}
 
-	int bufferLength = (size - 1) * 4;
-
-	if (!m_vertexBuffer || size > m_lastSize)
+	if (!m_vertexBuffer)
 	{
-		if (m_vertexBuffer)
-			m_vertexBuffer->Release();
+		// big enough to hold the longest path we can get from the query
+		m_ringCapacity = (MAX_POLYS - 1) * 4;
 
-		HRESULT hr = g_pDevice->CreateVertexBuffer(bufferLength * sizeof(TVertex),
+		HRESULT hr = g_pDevice->CreateVertexBuffer(m_ringCapacity * sizeof(TVertex),
 			D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY, TVertex::FVF, D3DPOOL_DEFAULT,
 			&m_vertexBuffer, nullptr);
 
@@ -496,82 +2081,155 @@ void NavigationLine::GenerateBuffers()
 			m_vertexBuffer = nullptr;
 			return;
 		}
+
+		// six indices for the two triangles of each segment
+		hr = g_pDevice->CreateIndexBuffer((MAX_POLYS - 1) * 6 * sizeof(uint16_t),
+			D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY, D3DFMT_INDEX16, D3DPOOL_DEFAULT,
+			&m_indexBuffer, nullptr);
+
+		if (FAILED(hr))
+		{
+			m_vertexBuffer->Release();
+			m_vertexBuffer = nullptr;
+			m_indexBuffer = nullptr;
+			return;
+		}
+
+		m_ringHead = 0;
+		m_segments.clear();
 	}
 
-	m_lastSize = size;
-	TVertex* vertexDest = nullptr;
+	// get the path as if it were a series of 3d points
+	const D3DXVECTOR3* pt = (const D3DXVECTOR3*)&m_path->m_currentPath[0];
+	auto ToRender = [](const D3DXVECTOR3& p) { return D3DXVECTOR3(p.z, p.x, p.y + 1); };
+
+	int segmentCount = size - 1;
+	m_newSegments.resize(segmentCount);
+
+	for (int i = 0; i < segmentCount; ++i)
+	{
+		SegmentKey& key = m_newSegments[i];
+
+		// previous and following point
+		key.prevIdx = i > 0 ? -1 : 0;
+		key.nextIdx = i < size - 2 ? 2 : 1;
+
+		key.pos = ToRender(pt[i]);
+		key.otherPos = ToRender(pt[i + 1]);
+		key.prevPos = ToRender(pt[i + key.prevIdx]);
+		key.nextPos = ToRender(pt[i + key.nextIdx]);
+	}
+
+	// only the segments that changed get written
+	bool rewriteAll = m_segmentThickness != m_thickness || m_segments.empty();
+	int changedCount = 0;
+
+	for (int i = 0; i < segmentCount; ++i)
+	{
+		if (rewriteAll || i >= (int)m_segments.size() || !(m_segments[i] == m_newSegments[i]))
+			++changedCount;
+	}
 
-	if (m_vertexBuffer->Lock(0, bufferLength * sizeof(TVertex), (void**)&vertexDest, D3DLOCK_DISCARD) < 0)
+	if (changedCount == 0)
+	{
+		// the path got shorter, but what is left of it is already in the buffer
+		m_segmentStarts.resize(segmentCount);
+		m_segments.swap(m_newSegments);
+		GenerateIndices();
+		m_needsUpdate = false;
 		return;
+	}
 
-	// get the path as if it were a series of 3d points
-	D3DXVECTOR3* pt = (D3DXVECTOR3*)&m_path->m_currentPath[0];
+	// append after what is in use, or start over if it doesn't fit
+	DWORD lockFlags = D3DLOCK_NOOVERWRITE;
+	if (rewriteAll || m_ringHead + changedCount * 4 > m_ringCapacity)
+	{
+		lockFlags = D3DLOCK_DISCARD;
+		rewriteAll = true;
+		changedCount = segmentCount;
+		m_ringHead = 0;
+	}
+
+	TVertex* vertexDest = nullptr;
+	if (m_vertexBuffer->Lock(m_ringHead * sizeof(TVertex), changedCount * 4 * sizeof(TVertex),
+		(void**)&vertexDest, lockFlags) < 0)
+	{
+		return;
+	}
 
+	m_segmentStarts.resize(segmentCount);
 	int index = 0;
-	m_commands.resize(size - 1);
-
-	for (int i = 0; i < size - 1; ++i, ++pt)
-	{
-		// this point
-		D3DXVECTOR3 v0;
-		v0.x = pt[0].z;
-		v0.y = pt[0].x;
-		v0.z = pt[0].y + 1;
-
-		// next point
-		D3DXVECTOR3 v1;
-		v1.x = pt[1].z;
-		v1.y = pt[1].x;
-		v1.z = pt[1].y + 1;
-
-
-		// following point
-		D3DXVECTOR3 nextPos;
-		int nextIdx = i < size - 2 ? 2 : 1;
-		nextPos.x = pt[nextIdx].z;
-		nextPos.y = pt[nextIdx].x;
-		nextPos.z = pt[nextIdx].y + 1;
-
-		// previous point
-		D3DXVECTOR3 prevPos;
-		int prevIdx = i > 0 ? -1 : 0;
-		prevPos.x = pt[prevIdx].z;
-		prevPos.y = pt[prevIdx].x;
-		prevPos.z = pt[prevIdx].y + 1;
-
-		vertexDest[index + 0].pos = v0;
-		vertexDest[index + 0].otherPos = v1;
+
+	for (int i = 0; i < segmentCount; ++i)
+	{
+		const SegmentKey& key = m_newSegments[i];
+
+		if (!rewriteAll && i < (int)m_segments.size() && m_segments[i] == key)
+			continue;
+
+		vertexDest[index + 0].pos = key.pos;
+		vertexDest[index + 0].otherPos = key.otherPos;
 		vertexDest[index + 0].thickness = -m_thickness;
-		vertexDest[index + 0].adjPos = prevPos;
-		vertexDest[index + 0].adjHint = prevIdx;
+		vertexDest[index + 0].adjPos = key.prevPos;
+		vertexDest[index + 0].adjHint = key.prevIdx;
 
-		vertexDest[index + 1].pos = v1;
-		vertexDest[index + 1].otherPos = v0;
+		vertexDest[index + 1].pos = key.otherPos;
+		vertexDest[index + 1].otherPos = key.pos;
 		vertexDest[index + 1].thickness = m_thickness;
-		vertexDest[index + 1].adjPos = nextPos;
-		vertexDest[index + 1].adjHint = nextIdx - 1;
+		vertexDest[index + 1].adjPos = key.nextPos;
+		vertexDest[index + 1].adjHint = key.nextIdx - 1;
 
-		vertexDest[index + 2].pos = v0;
-		vertexDest[index + 2].otherPos = v1;
+		vertexDest[index + 2].pos = key.pos;
+		vertexDest[index + 2].otherPos = key.otherPos;
 		vertexDest[index + 2].thickness = m_thickness;
-		vertexDest[index + 2].adjPos = prevPos;
-		vertexDest[index + 2].adjHint = prevIdx;
+		vertexDest[index + 2].adjPos = key.prevPos;
+		vertexDest[index + 2].adjHint = key.prevIdx;
 
-		vertexDest[index + 3].pos = v1;
-		vertexDest[index + 3].otherPos = v0;
+		vertexDest[index + 3].pos = key.otherPos;
+		vertexDest[index + 3].otherPos = key.pos;
 		vertexDest[index + 3].thickness = -m_thickness;
-		vertexDest[index + 3].adjPos = nextPos;
-		vertexDest[index + 3].adjHint = nextIdx - 1;
+		vertexDest[index + 3].adjPos = key.nextPos;
+		vertexDest[index + 3].adjHint = key.nextIdx - 1;
 
-		m_commands[i].StartVertex = index;
-		m_commands[i].PrimitiveCount = 2; // 2 triangles in a strip
+		m_segmentStarts[i] = m_ringHead + index;
 		index += 4;
 	}
 
 	m_vertexBuffer->Unlock();
+
+	m_ringHead += index;
+	m_segments.swap(m_newSegments);
+	m_segmentThickness = m_thickness;
+	GenerateIndices();
 	m_needsUpdate = false;
 }
 
+void NavigationLine::GenerateIndices()
+{
+	m_primitiveCount = 0;
+
+	uint16_t* indexDest = nullptr;
+	if (m_indexBuffer->Lock(0, (UINT)m_segmentStarts.size() * 6 * sizeof(uint16_t),
+		(void**)&indexDest, D3DLOCK_DISCARD) < 0)
+	{
+		return;
+	}
+
+	// the four vertices of a segment were laid out as a strip: 0 1 2, 2 1 3
+	for (UINT start : m_segmentStarts)
+	{
+		*indexDest++ = static_cast<uint16_t>(start + 0);
+		*indexDest++ = static_cast<uint16_t>(start + 1);
+		*indexDest++ = static_cast<uint16_t>(start + 2);
+		*indexDest++ = static_cast<uint16_t>(start + 2);
+		*indexDest++ = static_cast<uint16_t>(start + 1);
+		*indexDest++ = static_cast<uint16_t>(start + 3);
+	}
+
+	m_indexBuffer->Unlock();
+	m_primitiveCount = (UINT)m_segmentStarts.size() * 2;
+}
+
 void NavigationLine::SetThickness(float thickness)
 {
 	if (thickness != m_thickness)
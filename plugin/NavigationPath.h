@@ -21,7 +21,9 @@
 #include <d3dx9.h>
 
 #include <imgui.h>
+#include <chrono>
 #include <memory>
+#include <vector>
 
 #define DEBUG_NAVIGATION_LINES 1
 
@@ -29,7 +31,61 @@
 
 class NavMesh;
 class NavigationLine;
+class PathJob;
+class TileGraph;
 struct DestinationInfo;
+struct NavMeshQueryFilter;
+
+// Calculate the length of the path from one start position to many destinations
+// using a single search from the start polygon. The search stops once every
+// destination polygon has been reached. Positions are in navmesh coordinates.
+// Returns -1 for destinations that can't be reached.
+std::vector<float> CalculatePathLengths(dtNavMeshQuery* query, const dtQueryFilter& filter,
+	const glm::vec3& start, const std::vector<glm::vec3>& destinations,
+	const float* extents);
+
+// Which of the destinations is closest to the start by path length, using a
+// search that stops at the first destination polygon it reaches. endRefs and
+// endPositions are the polygons and points of the destinations, 0 for the ones
+// to skip. The length of the path to it goes in length, if given. Returns -1 if
+// none of them can be reached.
+int FindNearestDestination(dtNavMeshQuery* query, const dtQueryFilter& filter,
+	dtPolyRef startRef, const float* spos, const std::vector<dtPolyRef>& endRefs,
+	const std::vector<glm::vec3>& endPositions, float* length = nullptr);
+
+// The path lengths between every pair of positions, as a row for each start:
+// lengths[from * count + to]. The rows are searched in parallel, one thread per
+// core, with a query from the navmesh's pool each. Called from the game thread,
+// which waits for them.
+std::vector<float> CalculatePathLengthMatrix(NavMesh* navMesh, const dtQueryFilter& filter,
+	const std::vector<glm::vec3>& positions, const float* extents);
+
+// The order to visit stops 1 to count - 1 in, starting from stop 0 and not coming
+// back, given their path lengths from the matrix above. Nearest neighbor followed
+// by 2-opt, so short but not always the shortest.
+std::vector<size_t> OrderStops(const std::vector<float>& lengths, size_t count);
+
+// Route a path through the tile graph of the navmesh. Unless forced, only done for
+// paths that span several tiles. Returns false if no path was found.
+bool FindRoutedPath(dtNavMeshQuery* query, const TileGraph& graph, const dtQueryFilter& filter,
+	dtPolyRef startRef, const float* spos, dtPolyRef endRef, const float* epos,
+	dtPolyRef* polys, int& numPolys, int maxPolys, bool force);
+
+// The polygon nearest to a destination in navmesh coordinates, for destinations
+// that may be a bit off the mesh. The search grows out from extents until it
+// finds one, skipping sizes that don't reach any tile. Spawn destinations keep
+// the polygon they were found on until they move. Returns 0 if there is nothing
+// in reach.
+dtPolyRef FindDestinationPoly(dtNavMeshQuery* query, const dtQueryFilter* filter, uint32_t filterHash,
+	const float* pos, const float* extents, DWORD spawnId, float* nearest);
+
+// The height of the navmesh under each of the positions, in navmesh coordinates.
+// Where there are floors above each other the one closest to the height of the
+// position is picked, FLT_MAX as the height picks the highest. FLT_MAX for
+// positions that aren't over the mesh. The positions are grouped by tile, and
+// the layers of a tile are looked up once for all of the positions over it.
+std::vector<float> FindFloorHeights(dtNavMeshQuery* query, const dtQueryFilter& filter,
+	const std::vector<glm::vec3>& positions);
 
 class NavigationPath
 {
@@ -45,9 +101,45 @@ public:
 	// try to find a path to the current destination. Returns true if a path has been found.
 	bool FindPath();
 
-	// trigger a recalculation of the path towards the destination.
+	// trigger a recalculation of the path towards the destination. Once there is
+	// a path, the search may be done on the pathfinding worker, and the result is
+	// picked up by UpdateIncrementalPath.
 	void UpdatePath(bool force = false);
 
+	// pick up the result of a search on the worker. Returns true while the search
+	// is still in progress. The existing path stays valid until the search completes.
+	bool UpdateIncrementalPath();
+	bool IsSearching() const { return m_pendingSearch != nullptr; }
+
+	// a search for this destination handed to the worker ahead of time, from
+	// where the player was expected to be. Used by the next full search instead
+	// of searching, if it finished and the player is on or near its start.
+	void SetPrefetchedPath(const std::shared_ptr<PathJob>& job) { m_prefetchedPath = job; }
+
+	// move the destination along with a spawn destination. Short moves only repair
+	// the end of the path, a replan is requested when the spawn has left the area
+	// around the end of the path.
+	void UpdateTargetPosition();
+
+	// true if the path should be replanned: the destination moved, the player left
+	// the polygons that the path goes through, or a replan was requested. Navmesh
+	// changes replan on their own. Not needed for corridor paths.
+	bool ShouldReplan();
+	void RequestReplan() { m_replanRequested = true; }
+
+	// the player stopped making progress toward the next waypoint. Each attempt
+	// at the same spot goes further: first back onto the path polygons with an
+	// unsmoothed path if the mesh says the way ahead is blocked, then a short
+	// detour around the polygon ahead, then a full replan.
+	enum class StallRecovery
+	{
+		None,                          // the way ahead is open on the mesh
+		Resurface,
+		Detour,
+		Replan,
+	};
+	StallRecovery RecoverFromStall(int attempt);
+
 	// trigger render of the debug ui
 	void RenderUI();
 
@@ -61,11 +153,18 @@ public:
 	// get the full length of the path as traversed
 	float GetPathTraversalDistance() const;
 
+	// the length of the rest of the path, from pos (in navmesh coordinates) to
+	// the next waypoint and on from there. -1 if there is no path.
+	float GetRemainingDistance(const glm::vec3& pos) const;
+
 	// Get the number of nodes in the path and the index of the current node
 	// along that path.
 	int GetPathSize() const { return m_currentPathSize; }
 	int GetPathIndex() const { return m_currentPathCursor; }
 
+	// goes up every time the points of the path change
+	uint32_t GetPathGeneration() const { return m_pathGeneration; }
+
 	// Check if we are at the end if our path
 	inline bool IsAtEnd() const
 	{
@@ -92,17 +191,81 @@ public:
 		return glm::vec3(rawcoord[0], rawcoord[1], rawcoord[2]);
 	}
 
+	// DT_STRAIGHTPATH flags of a point of the path
+	inline uint8_t GetCornerFlags(int index) const
+	{
+		assert(index < m_currentPathSize);
+		return m_cornerFlags[index];
+	}
+
 	inline void Increment() { ++m_currentPathCursor; }
 
+	// corridor paths are cheap to update and are updated every pulse. Corridors only
+	// track the next few corners, so one-off queries should turn them off.
+	bool IsUsingCorridor() const { return m_useCorridor; }
+	void SetUseCorridor(bool useCorridor) { m_useCorridor = useCorridor; m_corridor.reset(); }
+
 	const float* GetCurrentPath() const { return &m_currentPath[0]; }
 
+	// publish the polygons of the path for followers in formation, see SharedLeaderPath
+	void SetPublishPath(bool publish);
+
 	dtNavMesh* GetNavMesh() const { return m_navMesh.get(); }
 	dtNavMeshQuery* GetNavMeshQuery() const { return m_query.get(); }
+	const dtQueryFilter* GetFilter() const { return m_filter; }
+
+	// center of the first polygon of areaId on the rest of the path, if it comes
+	// within maxDistance of pos. In navmesh coordinates.
+	bool FindAreaAhead(uint8_t areaId, const glm::vec3& pos, float maxDistance, glm::vec3& areaPos) const;
 
 private:
 	void SetNavMesh(const std::shared_ptr<dtNavMesh>& navMesh,
 		bool updatePath = true);
 
+	// tiles were swapped in the current navmesh, the query stays usable
+	void OnTilesChanged();
+	void UpdateFilter();
+
+	// hand the search over to the worker. A forced search replaces one that is
+	// already running.
+	void BeginIncrementalPath(const float* startOffset, const float* endOffset, bool force);
+	void CancelIncrementalPath();
+
+	// the polygons of the prefetched path from startRef on, see SetPrefetchedPath.
+	// The prefetch is used up either way.
+	bool TakePrefetchedPath(dtPolyRef startRef, const float* spos, dtPolyRef endRef,
+		std::vector<dtPolyRef>& path);
+
+	bool ResetCorridor(const float* startOffset, const float* endOffset);
+	void UpdateCorridor(const float* startOffset, const float* endOffset, bool force);
+
+	// route a path through the navmesh's tile graph. Unless forced, only done for
+	// paths that span several tiles. Returns false if no path was found.
+	bool FindRoutedPath(dtPolyRef startRef, const float* spos, dtPolyRef endRef,
+		const float* epos, dtPolyRef* polys, int& numPolys, bool force);
+	void FinishPath(const float* spos, const float* epos, const dtPolyRef* polys, int numPolys,
+		bool smooth = true);
+	void PublishPath(const dtPolyRef* polys, int numPolys);
+
+	// after the straight path changes
+	void UpdatePathDistances();
+
+	// remove corners of the straight path that are in line with their neighbours,
+	// or that can be skipped with a raycast, until the budget runs out.
+	void SmoothPath(float budgetUs);
+	bool CanShortcut(dtPolyRef startRef, const float* start, const float* end);
+
+	// check if pos is still on the polygons of the current path
+	bool IsOnPathPolys(const float* pos);
+
+	// find the polygon under the player, starting from the last one found before
+	// falling back to a full nearest polygon search.
+	dtPolyRef FindPlayerPoly(const float* pos, float* nearest);
+
+	// move the end of the current path to eqPos with a local search from the old
+	// end. Returns false if eqPos couldn't be reached that way.
+	bool MovePathTarget(const glm::vec3& eqPos);
+
 	std::shared_ptr<DestinationInfo> m_destinationInfo;
 
 	std::unique_ptr<RenderGroup> m_debugDrawGrp;
@@ -112,27 +275,65 @@ private:
 
 	int m_currentPathCursor = 0;
 	int m_currentPathSize = 0;
+	uint32_t m_pathGeneration = 0;
+
+	// polygons of the current path, and the one the player was last seen on
+	std::vector<dtPolyRef> m_pathPolys;
+	int m_pathPolyCursor = 0;
+
+	// polygon the destination is on. A path that ends anywhere else is partial.
+	dtPolyRef m_destinationRef = 0;
+
+	// polygon the player was last found on, and where on it
+	dtPolyRef m_playerPoly = 0;
+	float m_playerPolyPos[3] = { 0, 0, 0 };
 
+	// polygons outside of the path polygons that smoothing cut across
+	std::vector<dtPolyRef> m_shortcutPolys;
+	bool m_replanRequested = false;
+	bool m_publishPath = false;
 
 	// the plugin owns the mesh
 	std::shared_ptr<dtNavMesh> m_navMesh;
 
-	// we own the query
-	deleting_unique_ptr<dtNavMeshQuery> m_query;
+	// query is borrowed from the navmesh's query pool
+	std::shared_ptr<dtNavMeshQuery> m_query;
 
 	bool m_useCorridor = false;
 	// used by corridor
 	std::unique_ptr<float[]> m_currentPath;
 	std::unique_ptr<uint8_t[]> m_cornerFlags;
+
+	// distance along the path from its start to each point
+	std::vector<float> m_pathDistances;
+
+	// scratch space for searches, reused between updates
+	std::unique_ptr<dtPolyRef[]> m_searchPolys;
+	std::unique_ptr<dtPolyRef[]> m_straightPathPolys;
+	std::vector<dtPolyRef> m_cachedPath;
 	std::unique_ptr<dtPathCorridor> m_corridor;
+	glm::vec3 m_corridorTarget;
+
+	typedef std::chrono::high_resolution_clock clock;
+	clock::time_point m_lastVisibilityOptimize;
+	clock::time_point m_lastTopologyOptimize;
 
 	bool m_renderPaths;
 	std::shared_ptr<NavigationLine> m_line;
 
-	dtQueryFilter m_filter;
+	// filter owned by the navmesh, kept alive until the areas change and it is
+	// picked up again.
+	std::shared_ptr<const NavMeshQueryFilter> m_queryFilter;
+	const dtQueryFilter* m_filter = nullptr;
+	uint32_t m_filterHash = 0;
 	float m_extents[3] = { 2, 4, 2 }; // note: X, Z, Y
 
+	// search running on the worker
+	std::shared_ptr<PathJob> m_pendingSearch;
+	std::shared_ptr<PathJob> m_prefetchedPath;
+
 	Signal<>::ScopedConnection m_navMeshConn;
+	Signal<>::ScopedConnection m_navMeshTilesConn;
 };
 
 //----------------------------------------------------------------------------
@@ -150,6 +351,11 @@ public:
 	void Update() { m_needsUpdate = true; }
 
 	virtual void Render(RenderPhase phase) override;
+	virtual bool IsRenderActive(RenderPhase phase) const override
+	{
+		return phase == Render_Geometry && m_loaded && m_visible
+			&& (m_needsUpdate || m_primitiveCount > 0);
+	}
 	virtual bool CreateDeviceObjects() override;
 	virtual void InvalidateDeviceObjects() override;
 
@@ -160,6 +366,9 @@ public:
 #endif
 
 private:
+	// one triangle list over the segments wherever they are in the ring
+	void GenerateIndices();
+
 	NavigationPath* m_path;
 
 	std::string m_shaderFile;
@@ -185,15 +394,35 @@ private:
 	};
 
 	IDirect3DVertexBuffer9* m_vertexBuffer = nullptr;
+	IDirect3DIndexBuffer9* m_indexBuffer = nullptr;
 	IDirect3DVertexDeclaration9* m_vDeclaration = nullptr;
 
-	struct RenderCommand
+	// the segments are scattered over the ring, the index buffer strings them
+	// together into one triangle list so each pass is a single draw.
+	std::vector<UINT> m_segmentStarts;
+	UINT m_primitiveCount = 0;
+
+	// the points a line segment was last written from. Segments that come out the
+	// same are left where they are in the vertex buffer.
+	struct SegmentKey
 	{
-		UINT StartVertex;
-		UINT PrimitiveCount;
+		D3DXVECTOR3 pos, otherPos, prevPos, nextPos;
+		int prevIdx, nextIdx;
+
+		bool operator==(const SegmentKey& other) const
+		{
+			return pos == other.pos && otherPos == other.otherPos && prevPos == other.prevPos
+				&& nextPos == other.nextPos && prevIdx == other.prevIdx && nextIdx == other.nextIdx;
+		}
 	};
-	std::vector<RenderCommand> m_commands;
-	int m_lastSize = 0;
+	std::vector<SegmentKey> m_segments;
+	std::vector<SegmentKey> m_newSegments;
+	float m_segmentThickness = 0.0f;
+
+	// the vertex buffer is used as a ring. Changed segments are appended after the
+	// ones still in use, and the buffer is discarded when it wraps around.
+	int m_ringCapacity = 0;
+	int m_ringHead = 0;
 
 	bool m_loaded = false;
 	bool m_needsUpdate = false;
@@ -3,13 +3,95 @@
 //
 
 #include "NavigationType.h"
+#include "CurrentPathView.h"
 #include "MQ2Navigation.h"
+#include "WaypointDistances.h"
+#include "common/NavMesh.h"
+
+#include <boost/algorithm/string.hpp>
+
+#include <cfloat>
 
 //----------------------------------------------------------------------------
 
 std::unique_ptr<MQ2NavigationType> g_mq2NavigationType;
 std::unique_ptr<MQ2NavPathType> g_mq2NavPathType;
 
+// adds an item to the '|' separated list in DataTypeTemp, which is length long.
+// Returns false if it doesn't fit, the items after it are left off too.
+static bool AppendListItem(size_t& length, const char* item)
+{
+	size_t itemLength = strlen(item) + (length > 0 ? 1 : 0);
+	if (length + itemLength >= MAX_STRING)
+		return false;
+
+	sprintf_s(DataTypeTemp + length, MAX_STRING - length, length > 0 ? "|%s" : "%s", item);
+	length += itemLength;
+	return true;
+}
+
+static bool GetMeshStat(const NavMeshStats& stats, const char* name, MQ2TYPEVAR& Dest)
+{
+	static const struct { const char* name; int NavMeshStats::* value; } s_counts[] = {
+		{ "tiles", &NavMeshStats::tiles },
+		{ "polys", &NavMeshStats::polys },
+		{ "verts", &NavMeshStats::verts },
+		{ "links", &NavMeshStats::links },
+		{ "detailverts", &NavMeshStats::detailVerts },
+		{ "detailtris", &NavMeshStats::detailTris },
+		{ "offmeshlinks", &NavMeshStats::offMeshLinks },
+		{ "queries", &NavMeshStats::queries },
+	};
+	static const struct { const char* name; size_t NavMeshStats::* value; } s_sizes[] = {
+		{ "headerbytes", &NavMeshStats::headerBytes },
+		{ "polybytes", &NavMeshStats::polyBytes },
+		{ "linkbytes", &NavMeshStats::linkBytes },
+		{ "detailbytes", &NavMeshStats::detailBytes },
+		{ "bvtreebytes", &NavMeshStats::bvTreeBytes },
+		{ "offmeshbytes", &NavMeshStats::offMeshBytes },
+		{ "tilebytes", &NavMeshStats::tileBytes },
+		{ "querynodebytes", &NavMeshStats::queryNodeBytes },
+	};
+	static const struct { const char* name; double NavMeshStats::* value; } s_times[] = {
+		{ "readms", &NavMeshStats::readMs },
+		{ "parsems", &NavMeshStats::parseMs },
+		{ "inflatems", &NavMeshStats::inflateMs },
+		{ "addtilems", &NavMeshStats::addTileMs },
+	};
+
+	for (const auto& count : s_counts)
+	{
+		if (!_stricmp(name, count.name))
+		{
+			Dest.Type = pIntType;
+			Dest.Int = stats.*count.value;
+			return true;
+		}
+	}
+
+	for (const auto& size : s_sizes)
+	{
+		if (!_stricmp(name, size.name))
+		{
+			Dest.Type = pIntType;
+			Dest.Int = static_cast<int>(stats.*size.value);
+			return true;
+		}
+	}
+
+	for (const auto& time : s_times)
+	{
+		if (!_stricmp(name, time.name))
+		{
+			Dest.Type = pFloatType;
+			Dest.Float = static_cast<float>(stats.*time.value);
+			return true;
+		}
+	}
+
+	return false;
+}
+
 MQ2NavigationType::MQ2NavigationType()
 	: MQ2Type("Navigation")
 	, m_nav(g_mq2Nav.get())
@@ -19,8 +101,24 @@ MQ2NavigationType::MQ2NavigationType()
 	TypeMember(MeshLoaded);
 	TypeMember(PathExists);
 	TypeMember(PathLength);
+	TypeMember(PathLengths);
+	TypeMember(MeshStats);
+	TypeMember(PathExistsAsync);
+	TypeMember(PathLengthAsync);
+	TypeMember(AreaEnabled);
+	TypeMember(RandomPoint);
+	TypeMember(Raycast);
+	TypeMember(Raycasts);
+	TypeMember(Remaining);
+	TypeMember(ETA);
+	TypeMember(WaypointDistance);
+	TypeMember(ClosestWaypoint);
+	TypeMember(WaypointDistancesReady);
+	TypeMember(FloorHeight);
+	TypeMember(FloorHeights);
+	TypeMember(NearestSpawn);
 
-	//TypeMember(CurrentPath);
+	TypeMember(CurrentPath);
 }
 
 MQ2NavigationType::~MQ2NavigationType()
@@ -51,13 +149,213 @@ bool MQ2NavigationType::GetMember(MQ2VARPTR VarPtr, PCHAR Member, PCHAR Index, M
 		Dest.Type = pFloatType;
 		Dest.Float = m_nav->GetNavigationPathLength(Index);
 		return true;
+	case PathExistsAsync:
+		Dest.Type = pBoolType;
+		Dest.DWord = m_nav->CanNavigateToPointAsync(Index);
+		return true;
+	case PathLengthAsync:
+		Dest.Type = pFloatType;
+		Dest.Float = m_nav->GetNavigationPathLengthAsync(Index);
+		return true;
+	case PathLengths: {
+		std::vector<float> lengths = m_nav->GetNavigationPathLengths(Index);
+
+		DataTypeTemp[0] = 0;
+		size_t length = 0;
+		for (float pathLength : lengths)
+		{
+			char temp[32];
+			sprintf_s(temp, "%.2f", pathLength);
+			if (!AppendListItem(length, temp))
+				break;
+		}
+
+		Dest.Type = pStringType;
+		Dest.Ptr = &DataTypeTemp[0];
+		return true;
+	}
+
+	case MeshStats:
+		if (Index && GetMeshStat(m_nav->Get<NavMesh>()->GetStats(), Index, Dest))
+			return true;
+		break;
+
+	case AreaEnabled:
+		if (Index)
+		{
+			auto navMesh = m_nav->Get<NavMesh>();
+			if (const PolyAreaType* area = navMesh->FindPolyArea(Index))
+			{
+				Dest.Type = pBoolType;
+				Dest.DWord = navMesh->IsAreaEnabled(area->id);
+				return true;
+			}
+		}
+		break;
+
+	case RandomPoint: {
+		glm::vec3 point;
+		if (Index && m_nav->FindRandomPoint(Index, point))
+		{
+			sprintf_s(DataTypeTemp, "%.2f %.2f %.2f", point.y, point.x, point.z);
+			Dest.Type = pStringType;
+			Dest.Ptr = &DataTypeTemp[0];
+			return true;
+		}
+		break;
+	}
+
+	case Raycast:
+		Dest.Type = pBoolType;
+		Dest.DWord = Index && m_nav->RaycastDestinations(Index)[0];
+		return true;
+
+	case Raycasts: {
+		std::vector<bool> results;
+		if (Index)
+			results = m_nav->RaycastDestinations(Index);
+
+		DataTypeTemp[0] = 0;
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			if (i > 0)
+				strcat_s(DataTypeTemp, "|");
+			strcat_s(DataTypeTemp, results[i] ? "1" : "0");
+		}
+
+		Dest.Type = pStringType;
+		Dest.Ptr = &DataTypeTemp[0];
+		return true;
+	}
+
+	case Remaining:
+		Dest.Type = pFloatType;
+		Dest.Float = m_nav->GetRemainingDistance();
+		return true;
+
+	case ETA:
+		Dest.Type = pFloatType;
+		Dest.Float = m_nav->GetEstimatedTimeRemaining();
+		return true;
+
+	case WaypointDistance:
+		if (Index)
+		{
+			std::vector<std::string> parts;
+			boost::split(parts, Index, boost::is_any_of("|"));
+
+			if (parts.size() == 2)
+			{
+				Dest.Type = pFloatType;
+				Dest.Float = m_nav->Get<WaypointDistances>()->GetDistance(parts[0], parts[1]);
+				return true;
+			}
+		}
+		break;
+
+	case ClosestWaypoint:
+		if (Index)
+		{
+			std::vector<std::string> parts;
+			boost::split(parts, Index, boost::is_any_of("|"));
+
+			std::vector<std::string> candidates(parts.begin() + 1, parts.end());
+			std::string closest = m_nav->Get<WaypointDistances>()->FindClosest(parts[0], candidates);
+			if (!closest.empty())
+			{
+				strcpy_s(DataTypeTemp, closest.c_str());
+				Dest.Type = pStringType;
+				Dest.Ptr = &DataTypeTemp[0];
+				return true;
+			}
+		}
+		break;
+
+	case WaypointDistancesReady:
+		Dest.Type = pBoolType;
+		Dest.DWord = m_nav->Get<WaypointDistances>()->IsReady();
+		return true;
 
+	case FloorHeight:
+		if (Index)
+		{
+			float height = m_nav->GetFloorHeights(Index)[0];
+			if (height != FLT_MAX)
+			{
+				Dest.Type = pFloatType;
+				Dest.Float = height;
+				return true;
+			}
+		}
+		break;
+
+	case FloorHeights: {
+		std::vector<float> heights;
+		if (Index)
+			heights = m_nav->GetFloorHeights(Index);
 
-	case CurrentPath:
-		//Dest.Type = g_mq2NavPathType.get();
-		//Dest.
+		DataTypeTemp[0] = 0;
+		size_t length = 0;
+		for (float height : heights)
+		{
+			char temp[32];
+			if (height != FLT_MAX)
+				sprintf_s(temp, "%.2f", height);
+			else
+				strcpy_s(temp, "NULL");
+			if (!AppendListItem(length, temp))
+				break;
+		}
+
+		Dest.Type = pStringType;
+		Dest.Ptr = &DataTypeTemp[0];
+		return true;
+	}
+
+	case NearestSpawn:
+		if (Index)
+		{
+			if (PSPAWNINFO pSpawn = m_nav->FindNearestReachableSpawn(Index))
+			{
+				Dest.Type = pSpawnType;
+				Dest.Ptr = pSpawn;
+				return true;
+			}
+		}
+		break;
+
+	case CurrentPath: {
+		const CurrentPathView* view = m_nav->Get<CurrentPathView>();
+		const std::vector<glm::vec3>& points = view->GetPoints();
+
+		if (!Index || !Index[0])
+		{
+			Dest.Type = pIntType;
+			Dest.Int = static_cast<int>(points.size());
+			return true;
+		}
+
+		if (!_stricmp(Index, "cursor"))
+		{
+			Dest.Type = pIntType;
+			Dest.Int = view->GetCursor();
+			return true;
+		}
+
+		if (IsNumber(Index))
+		{
+			int index = atoi(Index);
+			if (index >= 0 && index < static_cast<int>(points.size()))
+			{
+				sprintf_s(DataTypeTemp, "%.2f %.2f %.2f", points[index].y, points[index].x, points[index].z);
+				Dest.Type = pStringType;
+				Dest.Ptr = &DataTypeTemp[0];
+				return true;
+			}
+		}
 		break;
 	}
+	}
 
 	strcpy_s(DataTypeTemp, "NULL");
 	Dest.Type = pStringType;
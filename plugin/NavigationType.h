@@ -30,9 +30,63 @@ public:
 		PathExists = 4,
 		PathLength = 5,
 
-		// These return MQ2NavPathType
+		// the path being followed, from the copy kept for the shared view: the
+		// number of points, CurrentPath[n] for point n as "y x z", or
+		// CurrentPath[cursor] for the index of the point we're headed to
 		CurrentPath = 6,
+
+		// returns MQ2NavPathType
 		PathTo = 7,
+
+		// list of path lengths for a '|' separated list of destinations
+		PathLengths = 8,
+
+		// a value from the stats of the loaded mesh, by name, e.g. MeshStats[polys]
+		MeshStats = 9,
+
+		// same as PathExists/PathLength, but return the last known result and
+		// update it in the background instead of searching right away
+		PathExistsAsync = 10,
+		PathLengthAsync = 11,
+
+		// false if the area, by id or name, was switched off with /nav area
+		AreaEnabled = 12,
+
+		// a random point within a radius that can be reached from here, as
+		// "y x z" for /nav locyxz, e.g. RandomPoint[100] or RandomPoint[100 water]
+		RandomPoint = 13,
+
+		// true if there is walkable ground in a straight line to the destination,
+		// and the same for a '|' separated list of destinations, as "1|0|1"
+		Raycast = 14,
+		Raycasts = 15,
+
+		// distance left on the active path, and the seconds until we get there at
+		// the speed we've been moving. -1 when not navigating, or not moving.
+		Remaining = 16,
+		ETA = 17,
+
+		// path length between two waypoints, WaypointDistance[from|to], from the
+		// matrix searched in the background. -1 if there's no path, or it isn't
+		// ready yet, see WaypointDistancesReady.
+		WaypointDistance = 18,
+
+		// the waypoint closest to a waypoint by path length, ClosestWaypoint[from],
+		// or out of a '|' separated list, ClosestWaypoint[from|a|b]. NULL if none
+		// can be reached.
+		ClosestWaypoint = 19,
+		WaypointDistancesReady = 20,
+
+		// height of the navmesh under a location, FloorHeight[y x] for the highest
+		// floor or FloorHeight[y x z] for the one closest to z. NULL if it isn't on
+		// the mesh. FloorHeights takes a '|' separated list of them and returns
+		// "z|z|..." with NULL for the ones that aren't, in a single lookup.
+		FloorHeight = 21,
+		FloorHeights = 22,
+
+		// the spawn matching a spawn search that is closest by path length, e.g.
+		// NearestSpawn[npc radius 500 orc]. NULL if none of them can be reached.
+		NearestSpawn = 23,
 	};
 
 	MQ2NavigationType();
@@ -0,0 +1,248 @@
+//
+// ObjectIndex.cpp
+//
+
+#include "ObjectIndex.h"
+#include "MQ2Navigation.h"
+#include "ZoneInTimeline.h"
+
+#include "common/Geometry.h"
+
+#include <boost/algorithm/string.hpp>
+
+// doors and items are spread out over a zone, most cells hold a handful
+static const float OBJECTINDEX_CELL_SIZE = 50.0f;
+
+static std::string ToLowerName(const char* name)
+{
+	std::string str = name ? name : "";
+	boost::algorithm::to_lower(str);
+
+	return str;
+}
+
+// items are searched by the name shown when targeting them, not the actor name
+static std::string GetGroundItemName(PGROUNDITEM pGroundItem)
+{
+	CHAR szName[MAX_STRING] = { 0 };
+	GetFriendlyNameForGroundItem(pGroundItem, szName, sizeof(szName));
+
+	return ToLowerName(szName);
+}
+
+//----------------------------------------------------------------------------
+
+ObjectIndex::ObjectIndex()
+	: m_groundItems(OBJECTINDEX_CELL_SIZE)
+{
+}
+
+void ObjectIndex::OnPulse()
+{
+	if (gGameState != GAMESTATE_INGAME)
+		return;
+	if (!ppSwitchMgr || !pSwitchMgr)
+		return;
+
+	// doors arrive a while after entering the zone, same check as the model loader
+	PDOORTABLE pDoorTable = (PDOORTABLE)pSwitchMgr;
+	if (pDoorTable != m_doorTable || pDoorTable->NumEntries != m_indexedDoorCount)
+	{
+		ZoneInTimeline* timeline = g_mq2Nav->Get<ZoneInTimeline>();
+		if (timeline->CanRunStage(ZoneInStage::Doors))
+		{
+			ScopedZoneInStage stage(timeline, ZoneInStage::Doors);
+			RebuildDoors();
+		}
+	}
+}
+
+void ObjectIndex::SetZoneId(int zoneId)
+{
+	Clear();
+
+	if (zoneId == 0 || !pItemList)
+		return;
+
+	// pick up whatever is already on the ground, the add hook keeps it current after that
+	PGROUNDITEM pItem = *(PGROUNDITEM*)pItemList;
+	while (pItem)
+	{
+		AddGroundItem(pItem);
+		pItem = pItem->pNext;
+	}
+}
+
+void ObjectIndex::SetGameState(int gameState)
+{
+	if (gameState != GAMESTATE_INGAME)
+	{
+		Clear();
+	}
+}
+
+void ObjectIndex::Clear()
+{
+	m_doorSnapshot = DoorSnapshot();
+	m_doorNames.clear();
+	m_doorsById.clear();
+	m_doorTable = nullptr;
+	m_indexedDoorCount = 0;
+
+	m_groundItems.Clear();
+	m_groundItemNames.clear();
+}
+
+void ObjectIndex::RebuildDoors()
+{
+	DoorSnapshot& snapshot = m_doorSnapshot;
+	snapshot = DoorSnapshot();
+	m_doorNames.clear();
+	m_doorsById.clear();
+
+	PDOORTABLE pDoorTable = (PDOORTABLE)pSwitchMgr;
+	m_doorTable = pDoorTable;
+	m_indexedDoorCount = pDoorTable->NumEntries;
+
+	snapshot.doors.reserve(pDoorTable->NumEntries);
+	snapshot.ids.reserve(pDoorTable->NumEntries);
+
+	for (DWORD index = 0; index < pDoorTable->NumEntries; index++)
+	{
+		PDOOR pDoor = pDoorTable->pDoor[index];
+		if (!pDoor)
+			continue;
+
+		snapshot.doors.push_back(pDoor);
+		snapshot.ids.push_back(pDoor->ID);
+		snapshot.x.push_back(pDoor->X);
+		snapshot.y.push_back(pDoor->Y);
+		snapshot.z.push_back(pDoor->Z);
+
+		m_doorNames.emplace(ToLowerName(pDoor->Name), pDoor);
+		m_doorsById.emplace(pDoor->ID, pDoor);
+	}
+}
+
+void ObjectIndex::GetDoorDistances(const glm::vec3& pos, bool distance3D, std::vector<float>& distances) const
+{
+	const DoorSnapshot& snapshot = m_doorSnapshot;
+	distances.resize(snapshot.size());
+
+	GetPointDistances(pos, snapshot.x.data(), snapshot.y.data(), snapshot.z.data(),
+		snapshot.size(), distance3D, distances.data());
+}
+
+void ObjectIndex::AddGroundItem(PGROUNDITEM pGroundItem)
+{
+	if (!pGroundItem)
+		return;
+
+	// the hook can report items that were picked up from the list already
+	RemoveGroundItem(pGroundItem);
+
+	m_groundItems.Insert(glm::vec3(pGroundItem->X, pGroundItem->Y, pGroundItem->Z), pGroundItem);
+	m_groundItemNames.emplace(GetGroundItemName(pGroundItem), pGroundItem);
+}
+
+void ObjectIndex::RemoveGroundItem(PGROUNDITEM pGroundItem)
+{
+	if (!pGroundItem)
+		return;
+
+	if (!m_groundItems.Remove(glm::vec3(pGroundItem->X, pGroundItem->Y, pGroundItem->Z), pGroundItem))
+		return;
+
+	auto range = m_groundItemNames.equal_range(GetGroundItemName(pGroundItem));
+	for (auto iter = range.first; iter != range.second; ++iter)
+	{
+		if (iter->second == pGroundItem)
+		{
+			m_groundItemNames.erase(iter);
+			break;
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+
+template <typename T>
+std::pair<typename ObjectIndex::NameIndex<T>::const_iterator, typename ObjectIndex::NameIndex<T>::const_iterator>
+ObjectIndex::FindPrefix(const NameIndex<T>& index, const std::string& prefix)
+{
+	auto first = index.lower_bound(prefix);
+	auto last = first;
+
+	while (last != index.end() && last->first.compare(0, prefix.length(), prefix) == 0)
+		++last;
+
+	return std::make_pair(first, last);
+}
+
+template <typename T>
+T ObjectIndex::FindNearestByName(const NameIndex<T>& index, const std::string& prefix,
+	const glm::vec3& pos, float maxDistance, float zFilter, bool distance3D)
+{
+	auto range = FindPrefix(index, prefix);
+
+	T best = T();
+	float bestDistance = maxDistance;
+
+	for (auto iter = range.first; iter != range.second; ++iter)
+	{
+		T value = iter->second;
+		if (fabs(value->Z - pos.z) > zFilter)
+			continue;
+
+		float distance = distance3D
+			? Get3DDistance(pos.x, pos.y, pos.z, value->X, value->Y, value->Z)
+			: GetDistance(pos.x, pos.y, value->X, value->Y);
+		if (distance < bestDistance)
+		{
+			best = value;
+			bestDistance = distance;
+		}
+	}
+
+	return best;
+}
+
+PDOOR ObjectIndex::FindDoorById(int id) const
+{
+	auto iter = m_doorsById.find(id);
+	if (iter == m_doorsById.end())
+		return nullptr;
+
+	return iter->second;
+}
+
+PDOOR ObjectIndex::FindNearestDoor(const glm::vec3& pos, float maxDistance,
+	const char* prefix, float zFilter, bool distance3D) const
+{
+	// a name narrows it down to a few doors, check those directly
+	if (prefix && prefix[0])
+	{
+		return FindNearestByName(m_doorNames, ToLowerName(prefix), pos,
+			maxDistance, zFilter, distance3D);
+	}
+
+	// otherwise check every door, four at a time
+	const DoorSnapshot& snapshot = m_doorSnapshot;
+	int bestIndex = FindNearestPoint(pos, snapshot.x.data(), snapshot.y.data(), snapshot.z.data(),
+		snapshot.size(), maxDistance, zFilter, distance3D);
+
+	return bestIndex >= 0 ? snapshot.doors[bestIndex] : nullptr;
+}
+
+PGROUNDITEM ObjectIndex::FindNearestGroundItem(const glm::vec3& pos, float maxDistance,
+	const char* prefix, bool distance3D) const
+{
+	if (prefix && prefix[0])
+	{
+		return FindNearestByName(m_groundItemNames, ToLowerName(prefix), pos,
+			maxDistance, FLT_MAX, distance3D);
+	}
+
+	return m_groundItems.FindNearest(pos, maxDistance, distance3D,
+		[](PGROUNDITEM) { return true; });
+}
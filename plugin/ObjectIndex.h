@@ -0,0 +1,227 @@
+//
+// ObjectIndex.h
+//
+
+#pragma once
+
+#include "MQ2Plugin.h"
+
+#include "common/NavModule.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//----------------------------------------------------------------------------
+
+// Uniform grid over the xy plane, in eq coordinates. Lookups visit the cells
+// in rings around the search position, so only the area near the closest
+// match is looked at.
+template <typename T>
+class SpatialGrid
+{
+public:
+	explicit SpatialGrid(float cellSize) : m_cellSize(cellSize) {}
+
+	void Clear()
+	{
+		m_cells.clear();
+		m_count = 0;
+	}
+
+	void Insert(const glm::vec3& pos, T value)
+	{
+		glm::ivec2 cell(CellCoord(pos.x), CellCoord(pos.y));
+		m_cells[CellKey(cell.x, cell.y)].push_back(Entry{ pos, value });
+
+		// bounds only grow, removing doesn't shrink them
+		if (m_count++ == 0)
+			m_minCell = m_maxCell = cell;
+		else
+		{
+			m_minCell = glm::min(m_minCell, cell);
+			m_maxCell = glm::max(m_maxCell, cell);
+		}
+	}
+
+	bool Remove(const glm::vec3& pos, T value)
+	{
+		auto iter = m_cells.find(CellKey(CellCoord(pos.x), CellCoord(pos.y)));
+		if (iter == m_cells.end())
+			return false;
+
+		std::vector<Entry>& entries = iter->second;
+		for (size_t i = 0; i < entries.size(); ++i)
+		{
+			if (entries[i].value == value)
+			{
+				entries[i] = entries.back();
+				entries.pop_back();
+				--m_count;
+
+				if (entries.empty())
+					m_cells.erase(iter);
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	size_t GetCount() const { return m_count; }
+
+	// closest value to pos that is accepted by the filter, within maxDistance. Pass
+	// distance3D to include height in the distance. Returns T() if nothing matches.
+	template <typename Filter>
+	T FindNearest(const glm::vec3& pos, float maxDistance, bool distance3D, Filter&& filter) const
+	{
+		if (m_cells.empty())
+			return T();
+
+		int cx = CellCoord(pos.x);
+		int cy = CellCoord(pos.y);
+
+		// no point in going further out than the furthest cell
+		int maxRing = std::max(std::max(cx - m_minCell.x, m_maxCell.x - cx),
+			std::max(cy - m_minCell.y, m_maxCell.y - cy));
+		if (maxDistance < FLT_MAX)
+			maxRing = std::min(maxRing, (int)ceilf(maxDistance / m_cellSize) + 1);
+
+		T best = T();
+		float bestDistSq = maxDistance < FLT_MAX ? maxDistance * maxDistance : FLT_MAX;
+
+		for (int ring = 0; ring <= maxRing; ++ring)
+		{
+			// everything in this ring is at least this far away on the plane
+			float ringDist = (ring - 1) * m_cellSize;
+			if (ring > 1 && ringDist * ringDist > bestDistSq)
+				break;
+
+			for (int y = cy - ring; y <= cy + ring; ++y)
+			{
+				// only the border of the ring, the inside has been visited
+				int step = (y == cy - ring || y == cy + ring) ? 1 : std::max(ring * 2, 1);
+
+				for (int x = cx - ring; x <= cx + ring; x += step)
+				{
+					auto iter = m_cells.find(CellKey(x, y));
+					if (iter == m_cells.end())
+						continue;
+
+					for (const Entry& entry : iter->second)
+					{
+						glm::vec3 delta = entry.pos - pos;
+						float distSq = delta.x * delta.x + delta.y * delta.y;
+						if (distance3D)
+							distSq += delta.z * delta.z;
+
+						if (distSq < bestDistSq && filter(entry.value))
+						{
+							best = entry.value;
+							bestDistSq = distSq;
+						}
+					}
+				}
+			}
+		}
+
+		return best;
+	}
+
+private:
+	struct Entry
+	{
+		glm::vec3 pos;
+		T value;
+	};
+
+	int CellCoord(float v) const { return (int)floorf(v / m_cellSize); }
+
+	static uint64_t CellKey(int x, int y)
+	{
+		return ((uint64_t)(uint32_t)x << 32) | (uint32_t)y;
+	}
+
+	float m_cellSize;
+	std::unordered_map<uint64_t, std::vector<Entry>> m_cells;
+	size_t m_count = 0;
+	glm::ivec2 m_minCell, m_maxCell;
+};
+
+//----------------------------------------------------------------------------
+
+// Index of the doors and ground items in the current zone, for finding them
+// by name prefix or by distance without walking the whole door table or
+// item list.
+class ObjectIndex : public NavModule
+{
+public:
+	// the doors of the zone copied out into flat arrays when the door table
+	// changes, so distances can be worked out four doors at a time, see
+	// common/Geometry.h.
+	struct DoorSnapshot
+	{
+		std::vector<PDOOR> doors;
+		std::vector<int> ids;
+		std::vector<float> x, y, z;
+
+		size_t size() const { return doors.size(); }
+	};
+
+	ObjectIndex();
+
+	virtual void OnPulse() override;
+	virtual void SetZoneId(int zoneId) override;
+	virtual void SetGameState(int gameState) override;
+
+	void AddGroundItem(PGROUNDITEM pGroundItem);
+	void RemoveGroundItem(PGROUNDITEM pGroundItem);
+
+	PDOOR FindDoorById(int id) const;
+
+	// closest door to pos within maxDistance. An empty prefix matches any door.
+	// Doors more than zFilter above or below pos are skipped.
+	PDOOR FindNearestDoor(const glm::vec3& pos, float maxDistance = FLT_MAX,
+		const char* prefix = nullptr, float zFilter = FLT_MAX, bool distance3D = true) const;
+
+	PGROUNDITEM FindNearestGroundItem(const glm::vec3& pos, float maxDistance = FLT_MAX,
+		const char* prefix = nullptr, bool distance3D = true) const;
+
+	const DoorSnapshot& GetDoors() const { return m_doorSnapshot; }
+
+	// distance from pos to every door of the snapshot, in snapshot order
+	void GetDoorDistances(const glm::vec3& pos, bool distance3D, std::vector<float>& distances) const;
+
+	size_t GetDoorCount() const { return m_doorSnapshot.size(); }
+	size_t GetGroundItemCount() const { return m_groundItems.GetCount(); }
+
+private:
+	void RebuildDoors();
+	void Clear();
+
+	template <typename T>
+	using NameIndex = std::multimap<std::string, T>;
+
+	// entries of the name index that start with prefix
+	template <typename T>
+	static std::pair<typename NameIndex<T>::const_iterator, typename NameIndex<T>::const_iterator>
+		FindPrefix(const NameIndex<T>& index, const std::string& prefix);
+
+	template <typename T>
+	static T FindNearestByName(const NameIndex<T>& index, const std::string& prefix,
+		const glm::vec3& pos, float maxDistance, float zFilter, bool distance3D);
+
+	DoorSnapshot m_doorSnapshot;
+	NameIndex<PDOOR> m_doorNames;
+	std::unordered_map<int, PDOOR> m_doorsById;
+	PDOORTABLE m_doorTable = nullptr;
+	DWORD m_indexedDoorCount = 0;
+
+	SpatialGrid<PGROUNDITEM> m_groundItems;
+	NameIndex<PGROUNDITEM> m_groundItemNames;
+};
@@ -0,0 +1,262 @@
+//
+// PathfindingWorker.cpp
+//
+
+#include "PathfindingWorker.h"
+#include "MQ2Nav_Settings.h"
+#include "NavigationPath.h"
+
+#include "common/NavMesh.h"
+#include "common/NavMeshData.h"
+
+#include <DetourCommon.h>
+#include <DetourNode.h>
+
+// same limits as the searches done by NavigationPath
+static const int MAX_POLYS = 4028 * 4;
+
+// search iterations between letting go of the tiles
+static const int SEARCH_SLICE_ITERATIONS = 256;
+
+//----------------------------------------------------------------------------
+
+PathfindingWorker::PathfindingWorker(NavMesh* navMesh)
+	: m_navMesh(navMesh)
+	, m_query(nullptr, [](dtNavMeshQuery* query) { dtFreeNavMeshQuery(query); })
+	, m_search(NAVMESH_PATH_MAX_NODES)
+{
+}
+
+PathfindingWorker::~PathfindingWorker()
+{
+	Shutdown();
+}
+
+void PathfindingWorker::Initialize()
+{
+	m_stop = false;
+	m_polys.reset(new dtPolyRef[MAX_POLYS]);
+	m_thread = std::thread([this]() { ThreadProc(); });
+}
+
+void PathfindingWorker::Shutdown()
+{
+	if (!m_thread.joinable())
+		return;
+
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_stop = true;
+
+		for (const auto& job : m_queue)
+			job->Cancel();
+	}
+
+	m_cv.notify_all();
+	m_thread.join();
+
+	m_queue.clear();
+	m_query.reset();
+	m_queryNavMesh.reset();
+}
+
+std::shared_ptr<PathJob> PathfindingWorker::Submit(const PathRequest& request)
+{
+	std::shared_ptr<dtNavMesh> navMesh = m_navMesh->GetNavMesh();
+	if (!navMesh || !request.filter || !m_thread.joinable())
+		return nullptr;
+
+	auto job = std::make_shared<PathJob>();
+	job->m_request = request;
+	job->m_navMesh = std::move(navMesh);
+	job->m_tileGeneration = m_navMesh->GetTileGeneration();
+	job->m_maxNodes = m_navMesh->GetQueryNodeBudget();
+	job->m_useSearch = mq2nav::GetSettings().fast_path_search;
+
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_queue.push_back(job);
+	}
+
+	m_cv.notify_one();
+	return job;
+}
+
+void PathfindingWorker::ThreadProc()
+{
+	while (true)
+	{
+		std::shared_ptr<PathJob> job;
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cv.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+
+			if (m_stop)
+				return;
+
+			job = std::move(m_queue.front());
+			m_queue.pop_front();
+		}
+
+		if (!job->m_cancelled)
+			RunJob(*job);
+
+		job->m_done = true;
+	}
+}
+
+void PathfindingWorker::RunJob(PathJob& job)
+{
+	const PathRequest& request = job.m_request;
+	const dtQueryFilter& filter = request.filter->filter;
+
+	auto tilesLock = m_navMesh->LockTiles();
+
+	// the tiles changed since the job was submitted, the polygons may be gone
+	auto tilesChanged = [&]()
+	{
+		if (m_navMesh->GetTileGeneration() == job.m_tileGeneration)
+			return false;
+
+		job.m_stale = true;
+		return true;
+	};
+
+	if (tilesChanged())
+		return;
+
+	// sized from the node budget of the mesh when the job was submitted, and
+	// bigger for a search that is tried again after running out of nodes
+	auto prepareQuery = [&](int maxNodes)
+	{
+		m_search.SetMaxNodes(maxNodes);
+
+		if (m_query && m_queryNavMesh == job.m_navMesh
+			&& m_query->getNodePool()->getMaxNodes() >= maxNodes)
+		{
+			return true;
+		}
+
+		m_query.reset(dtAllocNavMeshQuery());
+		m_queryNavMesh.reset();
+
+		if (!m_query || dtStatusFailed(m_query->init(job.m_navMesh.get(), maxNodes)))
+		{
+			m_query.reset();
+			return false;
+		}
+
+		m_queryNavMesh = job.m_navMesh;
+		return true;
+	};
+
+	int maxNodes = job.m_maxNodes;
+	if (!prepareQuery(maxNodes))
+		return;
+
+	const TileGraph& graph = m_navMesh->GetTileGraph();
+	dtPolyRef* polys = m_polys.get();
+	int numPolys = 0;
+
+	// long paths are routed through the tile graph in one go
+	if (FindRoutedPath(m_query.get(), graph, filter, request.startRef, request.spos,
+		request.endRef, request.epos, polys, numPolys, MAX_POLYS, false))
+	{
+		job.m_status = DT_SUCCESS;
+		job.m_path.assign(polys, polys + numPolys);
+		return;
+	}
+
+	// the landmark distances make for a much tighter heuristic than the straight
+	// line to the end, so fewer polygons are searched. The search has its own
+	// node table and open list, which hold up better than detour's on big zones.
+	const LandmarkTable& landmarks = m_navMesh->GetLandmarks();
+	bool useSearch = job.m_useSearch || !landmarks.IsEmpty();
+
+	// the whole search, a slice at a time. Returns false if the job was cancelled
+	// or went stale, and DT_FAILURE if no path came out of it.
+	auto search = [&](dtStatus& status)
+	{
+		status = useSearch
+			? m_search.Init(job.m_navMesh.get(), &landmarks, request.startRef, request.endRef,
+				request.spos, request.epos, &filter, request.searchMode)
+			: m_query->initSlicedFindPath(request.startRef, request.endRef,
+				request.spos, request.epos, &filter);
+
+		while (dtStatusInProgress(status))
+		{
+			status = useSearch
+				? m_search.Update(SEARCH_SLICE_ITERATIONS)
+				: m_query->updateSlicedFindPath(SEARCH_SLICE_ITERATIONS, nullptr);
+			if (!dtStatusInProgress(status))
+				break;
+
+			// give the game thread a chance to change the tiles
+			tilesLock.unlock();
+			std::this_thread::yield();
+			tilesLock.lock();
+
+			if (job.m_cancelled || tilesChanged())
+				return false;
+		}
+
+		if (dtStatusFailed(status))
+			return true;
+
+		status = useSearch
+			? m_search.Finalize(polys, &numPolys, MAX_POLYS)
+			: m_query->finalizeSlicedFindPath(polys, &numPolys, MAX_POLYS);
+
+		QueryHeatmap& heatmap = m_navMesh->GetQueryHeatmap();
+		if (useSearch)
+			heatmap.Record(m_search);
+		else
+			heatmap.Record(*m_query);
+
+		if (dtStatusFailed(status) || numPolys == 0)
+			status = DT_FAILURE;
+		return true;
+	};
+
+	dtStatus status;
+	if (!search(status))
+		return;
+
+	if (dtStatusFailed(status))
+	{
+		job.m_status = status;
+		return;
+	}
+
+	// the search gave up before reaching the destination, try going through the tile graph instead.
+	if ((status & (DT_OUT_OF_NODES | DT_PARTIAL_RESULT))
+		&& FindRoutedPath(m_query.get(), graph, filter, request.startRef, request.spos,
+			request.endRef, request.epos, polys, numPolys, MAX_POLYS, true))
+	{
+		status = DT_SUCCESS;
+	}
+
+	// and then once more with more nodes. A path that still runs out is partial,
+	// and the next job starts from the grown budget.
+	if (status & DT_OUT_OF_NODES)
+	{
+		maxNodes = m_navMesh->RecordOutOfNodes(maxNodes);
+		if (maxNodes && prepareQuery(maxNodes))
+		{
+			if (!search(status))
+				return;
+
+			m_navMesh->RecordNodeRetry(maxNodes, dtStatusSucceed(status) && !dtStatusDetail(status, DT_PARTIAL_RESULT));
+
+			if (dtStatusFailed(status))
+			{
+				job.m_status = status;
+				return;
+			}
+		}
+	}
+
+	job.m_status = status;
+	job.m_path.assign(polys, polys + numPolys);
+}
@@ -0,0 +1,110 @@
+//
+// PathfindingWorker.h
+//
+
+#pragma once
+
+#include "common/NavModule.h"
+#include "common/PolyPathSearch.h"
+
+#include <DetourNavMesh.h>
+#include <DetourNavMeshQuery.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class NavMesh;
+struct NavMeshQueryFilter;
+
+// A path search between two polygons. The polygons and the positions on them
+// are found on the game thread, before the search is handed to the worker.
+struct PathRequest
+{
+	dtPolyRef startRef = 0;
+	dtPolyRef endRef = 0;
+	float spos[3] = { 0, 0, 0 };
+	float epos[3] = { 0, 0, 0 };
+
+	// kept alive until the search is done
+	std::shared_ptr<const NavMeshQueryFilter> filter;
+
+	// whether to search from both ends, only used by the fast path search
+	PolyPathSearch::Mode searchMode = PolyPathSearch::Mode::Auto;
+};
+
+class PathJob
+{
+public:
+	const PathRequest& GetRequest() const { return m_request; }
+
+	// the rest is only valid once the job is done
+	bool IsDone() const { return m_done; }
+
+	// the tiles changed while the search was running, so the path may go through
+	// polygons that are gone. It should be searched for again.
+	bool IsStale() const { return m_stale; }
+
+	dtStatus GetStatus() const { return m_status; }
+	const std::vector<dtPolyRef>& GetPath() const { return m_path; }
+
+	// the worker skips the job, or stops searching at the next slice
+	void Cancel() { m_cancelled = true; }
+
+private:
+	friend class PathfindingWorker;
+
+	PathRequest m_request;
+	std::shared_ptr<dtNavMesh> m_navMesh;
+	uint32_t m_tileGeneration = 0;
+	int m_maxNodes = 0;
+	bool m_useSearch = true;
+
+	std::vector<dtPolyRef> m_path;
+	dtStatus m_status = DT_FAILURE;
+	bool m_stale = false;
+
+	std::atomic<bool> m_done{ false };
+	std::atomic<bool> m_cancelled{ false };
+};
+
+// Runs path searches on a thread of its own, with its own query. Jobs are done
+// in the order they are submitted, and the results are picked up by polling the
+// job. The tiles are locked while searching, one slice at a time, so tile changes
+// on the game thread only wait for the current slice.
+class PathfindingWorker : public NavModule
+{
+public:
+	explicit PathfindingWorker(NavMesh* navMesh);
+	virtual ~PathfindingWorker();
+
+	virtual void Initialize() override;
+	virtual void Shutdown() override;
+
+	// Returns null if there is no navmesh to search.
+	std::shared_ptr<PathJob> Submit(const PathRequest& request);
+
+private:
+	void ThreadProc();
+	void RunJob(PathJob& job);
+
+	NavMesh* m_navMesh;
+
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::deque<std::shared_ptr<PathJob>> m_queue;
+	bool m_stop = false;
+
+	// only touched by the worker thread
+	std::shared_ptr<dtNavMesh> m_queryNavMesh;
+	std::unique_ptr<dtNavMeshQuery, void(*)(dtNavMeshQuery*)> m_query;
+	std::unique_ptr<dtPolyRef[]> m_polys;
+
+	// used instead of the query when the mesh has landmarks
+	PolyPathSearch m_search;
+};
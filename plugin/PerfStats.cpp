@@ -0,0 +1,135 @@
+//
+// PerfStats.cpp
+//
+
+#include "PerfStats.h"
+#include "MQ2Navigation.h"
+
+#include <imgui.h>
+
+#include <algorithm>
+
+namespace mq2nav {
+
+//----------------------------------------------------------------------------
+
+static const char* s_timerNames[] = {
+	"Pulse",
+	"AttemptMovement",
+	"UpdatePath",
+	"findNearestPoly",
+	"findPath",
+	"findStraightPath",
+	"SmoothPath",
+	"NavMeshRender",
+	"ImGuiRender",
+};
+static_assert(sizeof(s_timerNames) / sizeof(s_timerNames[0]) == (int)PerfTimer::Count,
+	"timer names don't match PerfTimer");
+
+static PerfCounter s_counters[(int)PerfTimer::Count];
+
+const char* GetPerfTimerName(PerfTimer timer)
+{
+	return s_timerNames[(int)timer];
+}
+
+PerfCounter& GetPerfCounter(PerfTimer timer)
+{
+	return s_counters[(int)timer];
+}
+
+void ResetPerfCounters()
+{
+	for (PerfCounter& counter : s_counters)
+		counter.Reset();
+}
+
+//----------------------------------------------------------------------------
+
+void PerfCounter::AddSample(float ms)
+{
+	m_samples[m_next] = ms;
+	m_next = (m_next + 1) % MAX_SAMPLES;
+	m_count = std::min(m_count + 1, MAX_SAMPLES);
+	m_last = ms;
+}
+
+void PerfCounter::Reset()
+{
+	m_count = 0;
+	m_next = 0;
+	m_last = 0.0f;
+}
+
+float PerfCounter::GetMax() const
+{
+	if (m_count == 0)
+		return 0.0f;
+
+	return *std::max_element(m_samples, m_samples + m_count);
+}
+
+float PerfCounter::GetPercentile(float p) const
+{
+	if (m_count == 0)
+		return 0.0f;
+
+	// only ever called for display, so a copy of the window is fine
+	float sorted[MAX_SAMPLES];
+	std::copy(m_samples, m_samples + m_count, sorted);
+
+	int index = std::min(static_cast<int>(p * m_count), m_count - 1);
+	std::nth_element(sorted, sorted + index, sorted + m_count);
+
+	return sorted[index];
+}
+
+//----------------------------------------------------------------------------
+
+void RenderPerfUI()
+{
+	ImGui::TextColored(ImColor(255, 255, 0), "Milliseconds over the last %d samples", PerfCounter::MAX_SAMPLES);
+
+	ImGui::Columns(5, "##perf");
+	ImGui::Separator();
+	ImGui::Text("Timer"); ImGui::NextColumn();
+	ImGui::Text("Last"); ImGui::NextColumn();
+	ImGui::Text("p50"); ImGui::NextColumn();
+	ImGui::Text("p99"); ImGui::NextColumn();
+	ImGui::Text("Max"); ImGui::NextColumn();
+	ImGui::Separator();
+
+	for (int i = 0; i < (int)PerfTimer::Count; ++i)
+	{
+		const PerfCounter& counter = s_counters[i];
+
+		ImGui::Text("%s", s_timerNames[i]); ImGui::NextColumn();
+		ImGui::Text("%.3f", counter.GetLast()); ImGui::NextColumn();
+		ImGui::Text("%.3f", counter.GetPercentile(0.5f)); ImGui::NextColumn();
+		ImGui::Text("%.3f", counter.GetPercentile(0.99f)); ImGui::NextColumn();
+		ImGui::Text("%.3f", counter.GetMax()); ImGui::NextColumn();
+	}
+
+	ImGui::Columns(1);
+	ImGui::Separator();
+
+	if (ImGui::Button("Reset"))
+		ResetPerfCounters();
+}
+
+void DumpPerfStats()
+{
+	WriteChatf(PLUGIN_MSG "Timings in ms (p50 / p99 / max, samples):");
+
+	for (int i = 0; i < (int)PerfTimer::Count; ++i)
+	{
+		const PerfCounter& counter = s_counters[i];
+
+		WriteChatf(PLUGIN_MSG "\ag%s\ax: %.3f / %.3f / %.3f (%d)", s_timerNames[i],
+			counter.GetPercentile(0.5f), counter.GetPercentile(0.99f), counter.GetMax(),
+			counter.GetSampleCount());
+	}
+}
+
+} // namespace mq2nav
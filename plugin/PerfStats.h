@@ -0,0 +1,90 @@
+//
+// PerfStats.h
+//
+
+// Lightweight timers for the parts of the plugin that run every pulse or every
+// frame. Each timer keeps a window of its most recent samples so that the median
+// and the spikes can be reported without keeping everything around.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+namespace mq2nav {
+
+enum class PerfTimer
+{
+	Pulse,
+	AttemptMovement,
+	UpdatePath,
+	FindNearestPoly,
+	FindPath,
+	FindStraightPath,
+	SmoothPath,
+	NavMeshRender,
+	ImGuiRender,
+
+	Count
+};
+
+const char* GetPerfTimerName(PerfTimer timer);
+
+class PerfCounter
+{
+public:
+	static const int MAX_SAMPLES = 512;
+
+	void AddSample(float ms);
+	void Reset();
+
+	int GetSampleCount() const { return m_count; }
+	float GetLast() const { return m_last; }
+	float GetMax() const;
+
+	// percentile of the samples in the window, p in [0, 1]
+	float GetPercentile(float p) const;
+
+private:
+	float m_samples[MAX_SAMPLES];
+	int m_count = 0;
+	int m_next = 0;
+	float m_last = 0.0f;
+};
+
+PerfCounter& GetPerfCounter(PerfTimer timer);
+
+void ResetPerfCounters();
+
+// times the enclosing scope into the given counter
+class ScopedPerfTimer
+{
+public:
+	using clock = std::chrono::high_resolution_clock;
+
+	explicit ScopedPerfTimer(PerfTimer timer)
+		: m_timer(timer)
+		, m_start(clock::now())
+	{
+	}
+
+	~ScopedPerfTimer()
+	{
+		GetPerfCounter(m_timer).AddSample(
+			std::chrono::duration<float, std::milli>(clock::now() - m_start).count());
+	}
+
+	ScopedPerfTimer(const ScopedPerfTimer&) = delete;
+	ScopedPerfTimer& operator=(const ScopedPerfTimer&) = delete;
+
+private:
+	PerfTimer m_timer;
+	clock::time_point m_start;
+};
+
+void RenderPerfUI();
+
+// writes the current numbers to the chat window
+void DumpPerfStats();
+
+} // namespace mq2nav
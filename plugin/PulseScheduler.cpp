@@ -0,0 +1,116 @@
+//
+// PulseScheduler.cpp
+//
+
+#include "PulseScheduler.h"
+
+#include <imgui.h>
+
+#include <algorithm>
+
+void PulseScheduler::AddModule(NavModule* module, const char* name)
+{
+	Entry entry;
+	entry.module = module;
+	entry.name = name;
+	entry.priority = module->GetPulsePriority();
+
+	m_entries.push_back(std::move(entry));
+	m_order.clear();
+}
+
+void PulseScheduler::Clear()
+{
+	m_entries.clear();
+	m_order.clear();
+}
+
+void PulseScheduler::Run(Entry& entry)
+{
+	clock::time_point start = clock::now();
+	entry.module->OnPulse();
+	entry.cost.AddSample(std::chrono::duration<float, std::milli>(clock::now() - start).count());
+
+	entry.waiting = 0;
+}
+
+void PulseScheduler::RunCritical()
+{
+	for (Entry& entry : m_entries)
+	{
+		if (entry.priority == NavModule::PulsePriority::Critical)
+			Run(entry);
+	}
+}
+
+void PulseScheduler::RunDeferred(clock::time_point pulseStart, float budgetMs)
+{
+	if (m_order.empty())
+	{
+		for (Entry& entry : m_entries)
+		{
+			if (entry.priority != NavModule::PulsePriority::Critical)
+				m_order.push_back(&entry);
+		}
+	}
+
+	// whatever has waited longest goes first, then by priority
+	std::stable_sort(m_order.begin(), m_order.end(), [](const Entry* a, const Entry* b)
+	{
+		if (a->waiting != b->waiting)
+			return a->waiting > b->waiting;
+		return a->priority < b->priority;
+	});
+
+	for (Entry* entry : m_order)
+	{
+		++entry->waiting;
+
+		if (entry->priority == NavModule::PulsePriority::Background
+			&& entry->waiting < BACKGROUND_INTERVAL)
+		{
+			continue;
+		}
+
+		int maxWaiting = MAX_DEFERRED_PULSES;
+		if (entry->priority == NavModule::PulsePriority::Background)
+			maxWaiting += BACKGROUND_INTERVAL;
+
+		float elapsed = std::chrono::duration<float, std::milli>(clock::now() - pulseStart).count();
+		if (elapsed + entry->module->GetPulseBudget() > budgetMs && entry->waiting <= maxWaiting)
+		{
+			++entry->deferred;
+			continue;
+		}
+
+		Run(*entry);
+	}
+}
+
+void PulseScheduler::RenderUI()
+{
+	static const char* s_priorityNames[] = { "Critical", "Normal", "Background" };
+
+	ImGui::TextColored(ImColor(255, 255, 0), "Module pulses in milliseconds");
+
+	ImGui::Columns(5, "##pulse");
+	ImGui::Separator();
+	ImGui::Text("Module"); ImGui::NextColumn();
+	ImGui::Text("Priority"); ImGui::NextColumn();
+	ImGui::Text("p50"); ImGui::NextColumn();
+	ImGui::Text("Max"); ImGui::NextColumn();
+	ImGui::Text("Deferred"); ImGui::NextColumn();
+	ImGui::Separator();
+
+	for (const Entry& entry : m_entries)
+	{
+		ImGui::Text("%s", entry.name); ImGui::NextColumn();
+		ImGui::Text("%s", s_priorityNames[static_cast<int>(entry.priority)]); ImGui::NextColumn();
+		ImGui::Text("%.3f", entry.cost.GetPercentile(0.5f)); ImGui::NextColumn();
+		ImGui::Text("%.3f", entry.cost.GetMax()); ImGui::NextColumn();
+		ImGui::Text("%u", entry.deferred); ImGui::NextColumn();
+	}
+
+	ImGui::Columns(1);
+	ImGui::Separator();
+}
@@ -0,0 +1,56 @@
+//
+// PulseScheduler.h
+//
+
+#pragma once
+
+#include "PerfStats.h"
+
+#include "common/NavModule.h"
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Runs the OnPulse of the modules around movement. Critical modules run first on
+// every pulse. The others run after movement, in priority order, while the time
+// taken by the pulse so far leaves room for their budget. A module that was put
+// off goes first on the next pulse, and is run regardless once it has waited
+// MAX_DEFERRED_PULSES, so housekeeping is delayed but never starved.
+class PulseScheduler
+{
+public:
+	using clock = std::chrono::high_resolution_clock;
+
+	static const int MAX_DEFERRED_PULSES = 8;
+	static const int BACKGROUND_INTERVAL = 10;
+
+	void AddModule(NavModule* module, const char* name);
+	void Clear();
+
+	void RunCritical();
+
+	// run the modules that fit in what is left of budgetMs since pulseStart
+	void RunDeferred(clock::time_point pulseStart, float budgetMs);
+
+	void RenderUI();
+
+private:
+	struct Entry
+	{
+		NavModule* module;
+		const char* name;
+		NavModule::PulsePriority priority;
+
+		// pulses since the module last ran
+		int waiting = 0;
+		uint32_t deferred = 0;
+
+		mq2nav::PerfCounter cost;
+	};
+
+	void Run(Entry& entry);
+
+	std::vector<Entry> m_entries;
+	std::vector<Entry*> m_order;
+};
@@ -8,6 +8,7 @@
 
 #include "ImGuiDX9.h"
 
+#include <algorithm>
 #include <cassert>
 #include <DetourDebugDraw.h>
 #include <RecastDebugDraw.h>
@@ -43,6 +44,7 @@ void RenderHandler::CreateDeviceObjects()
 		p->CreateDeviceObjects();
 	}
 	m_deviceAcquired = true;
+	m_savedStateDirty = true;
 }
 
 void RenderHandler::InvalidateDeviceObjects()
@@ -51,6 +53,13 @@ void RenderHandler::InvalidateDeviceObjects()
 		return;
 	m_deviceAcquired = false;
 
+	// the state block holds references to whatever was bound when it was captured
+	if (m_savedState)
+	{
+		m_savedState->Release();
+		m_savedState = nullptr;
+	}
+
 	for (auto& p : m_renderables)
 	{
 		p->InvalidateDeviceObjects();
@@ -62,6 +71,7 @@ void RenderHandler::AddRenderable(Renderable* renderable)
 	assert(std::find(m_renderables.begin(), m_renderables.end(), renderable) == m_renderables.cend());
 
 	m_renderables.push_back(renderable);
+	m_savedStateDirty = true;
 
 	if (m_deviceAcquired)
 	{
@@ -80,20 +90,111 @@ void RenderHandler::RemoveRenderable(Renderable* renderable)
 	}
 
 	m_renderables.erase(iter);
+	m_savedStateDirty = true;
 }
 
 void RenderHandler::PerformRender(Renderable::RenderPhase phase)
 {
+	if (!m_deviceAcquired || m_suspended)
+		return;
+
+	if (std::none_of(m_renderables.begin(), m_renderables.end(),
+		[phase](const Renderable* r) { return r->IsRenderActive(phase); }))
+	{
+		return;
+	}
+
+	if (!m_savedState || m_savedStateDirty)
+		RecordSavedState();
+
+	// fall back to saving everything if the state block couldn't be recorded
+	IDirect3DStateBlock9* savedState = m_savedState;
+	if (savedState)
+		savedState->Capture();
+	else
+		g_pDevice->CreateStateBlock(D3DSBT_ALL, &savedState);
+
 	ResetDeviceState();
 
 	D3DPERF_BeginEvent(D3DCOLOR_XRGB(255, 0, 0), L"RenderHandler::PerformRender");
 
 	for (auto& r : m_renderables)
 	{
-		r->Render(phase);
+		if (r->IsRenderActive(phase))
+			r->Render(phase);
 	}
 
 	D3DPERF_EndEvent();
+
+	if (savedState)
+	{
+		savedState->Apply();
+		if (savedState != m_savedState)
+			savedState->Release();
+	}
+}
+
+// sets the states that every renderable may change, values don't matter while recording
+static void RecordCommonDeviceState()
+{
+	g_pDevice->SetVertexShader(nullptr);
+	g_pDevice->SetPixelShader(nullptr);
+	g_pDevice->SetVertexDeclaration(nullptr);
+	g_pDevice->SetFVF(0);
+	g_pDevice->SetStreamSource(0, nullptr, 0, 0);
+	g_pDevice->SetIndices(nullptr);
+	g_pDevice->SetTexture(0, nullptr);
+
+	D3DXMATRIX matrix;
+	D3DXMatrixIdentity(&matrix);
+	g_pDevice->SetTransform(D3DTS_WORLD, &matrix);
+	g_pDevice->SetTransform(D3DTS_VIEW, &matrix);
+	g_pDevice->SetTransform(D3DTS_PROJECTION, &matrix);
+
+	D3DVIEWPORT9 viewport = { 0, 0, 1, 1, 0.0f, 1.0f };
+	g_pDevice->SetViewport(&viewport);
+
+	RECT scissor = { 0, 0, 1, 1 };
+	g_pDevice->SetScissorRect(&scissor);
+
+	g_pDevice->SetSamplerState(0, D3DSAMP_MINFILTER, D3DTEXF_LINEAR);
+	g_pDevice->SetSamplerState(0, D3DSAMP_MAGFILTER, D3DTEXF_LINEAR);
+}
+
+void RenderHandler::RecordSavedState()
+{
+	m_savedStateDirty = false;
+
+	if (m_savedState)
+	{
+		m_savedState->Release();
+		m_savedState = nullptr;
+	}
+
+	// this only happens when the renderables change, so keep the current state
+	// safe from the recording the expensive way.
+	IDirect3DStateBlock9* currentState = nullptr;
+	g_pDevice->CreateStateBlock(D3DSBT_ALL, &currentState);
+
+	if (SUCCEEDED(g_pDevice->BeginStateBlock()))
+	{
+		ResetDeviceState();
+		RecordCommonDeviceState();
+
+		for (auto& r : m_renderables)
+		{
+			r->RecordDeviceState();
+		}
+
+		if (FAILED(g_pDevice->EndStateBlock(&m_savedState)))
+			m_savedState = nullptr;
+	}
+
+	if (currentState)
+	{
+		currentState->Apply();
+		currentState->Release();
+	}
 }
 
 void ResetDeviceState()
@@ -28,20 +28,33 @@ public:
 	void AddRenderable(Renderable* renderable);
 	void RemoveRenderable(Renderable* renderable);
 
+	// nothing is rendered while suspended, for clients in the background
+	void SetSuspended(bool suspended) { m_suspended = suspended; }
+	bool IsSuspended() const { return m_suspended; }
+
 private:
 
 	// Called by RenderHooks
 	void CreateDeviceObjects();
 	void InvalidateDeviceObjects();
 
+	// saves the device state, renders and restores it again
 	void PerformRender(Renderable::RenderPhase phase);
 
 	void Render3D();
 
+	void RecordSavedState();
+
 private:
 	bool m_deviceAcquired = false; // implies that g_pDevice is valid to use
+	bool m_suspended = false;
 
 	std::list<Renderable*> m_renderables;
+
+	// holds the states the renderables change, captured before rendering and
+	// applied after. Recorded again if the renderables change.
+	IDirect3DStateBlock9* m_savedState = nullptr;
+	bool m_savedStateDirty = true;
 };
 
 // utility function to reset the state of the current direct3d9 device
@@ -39,7 +39,7 @@ RenderList::RenderList(IDirect3DDevice9* pDevice, PrimitiveType type)
 
 RenderList::~RenderList()
 {
-	InvalidateDeviceObjects();
+	ReleaseBuffers();
 }
 
 static inline unsigned int ConvertColor(unsigned int color)
@@ -53,10 +53,12 @@ static inline unsigned int ConvertColor(unsigned int color)
 
 void RenderList::Reset()
 {
-	InvalidateDeviceObjects();
+	ReleaseBuffers();
 
 	m_vertices.clear();
+	m_vertexIndices.clear();
 	m_prims.clear();
+	m_batches.clear();
 }
 
 void RenderList::Begin(float size /* = 1.0f */)
@@ -82,9 +84,9 @@ void RenderList::Begin(float size /* = 1.0f */)
 void RenderList::AddVertex(float x, float y, float z, unsigned int color, float u, float v)
 {
 	if (m_eqCoords)
-		m_vertices.emplace_back(Vertex{ { x, y, z}, ConvertColor(color), {u, v} });
+		m_tempVertices[m_tempIndex] = Vertex{ { x, y, z}, ConvertColor(color), {u, v} };
 	else
-		m_vertices.emplace_back(Vertex{ { z, x, y}, ConvertColor(color), {u, v} });
+		m_tempVertices[m_tempIndex] = Vertex{ { z, x, y}, ConvertColor(color), {u, v} };
 	++m_currentPrim->vertices;
 	++m_tempIndex;
 
@@ -114,48 +116,50 @@ void RenderList::AddVertex(float x, float y, float z, unsigned int color, float
 	}
 }
 
-void RenderList::AddPoint()
+uint32_t RenderList::AddUniqueVertex(const Vertex& vertex)
 {
-	uint32_t index = m_vertices.size() - 1;
-	m_currentPrim->indices.push_back(index);
-	m_currentPrim->count++;
+	// neighbouring primitives are drawn with the same corners, only keep one of each
+	auto result = m_vertexIndices.emplace(vertex, static_cast<uint32_t>(m_vertices.size()));
+	if (result.second)
+		m_vertices.push_back(vertex);
+
+	return result.first->second;
 }
 
-void RenderList::AddLine()
+void RenderList::AddPoint()
 {
-	uint32_t index = m_vertices.size() - 2;
-	m_currentPrim->indices.push_back(index);
-	m_currentPrim->indices.push_back(index + 1);
+	m_currentPrim->indices.push_back(AddUniqueVertex(m_tempVertices[0]));
 	m_currentPrim->count++;
 }
 
-inline float distance(const D3DXVECTOR3& a, const D3DXVECTOR3& b)
+void RenderList::AddLine()
 {
-	float X = a.x - b.x;
-	float Y = a.y - b.y;
-	float Z = a.z - b.z;
-
-	return sqrtf(X*X + Y*Y + Z*Z);
+	m_currentPrim->indices.push_back(AddUniqueVertex(m_tempVertices[0]));
+	m_currentPrim->indices.push_back(AddUniqueVertex(m_tempVertices[1]));
+	m_currentPrim->count++;
 }
 
 void RenderList::AddTriangle()
 {
-	uint32_t index = m_vertices.size() - 3;
-	m_currentPrim->indices.push_back(index);
-	m_currentPrim->indices.push_back(index + 1);
-	m_currentPrim->indices.push_back(index + 2);
+	m_currentPrim->indices.push_back(AddUniqueVertex(m_tempVertices[0]));
+	m_currentPrim->indices.push_back(AddUniqueVertex(m_tempVertices[1]));
+	m_currentPrim->indices.push_back(AddUniqueVertex(m_tempVertices[2]));
 	m_currentPrim->count++;
 }
 
 void RenderList::AddQuad()
 {
-	uint32_t index = m_vertices.size() - 4;
-	m_currentPrim->indices.push_back(index);
-	m_currentPrim->indices.push_back(index + 1);
-	m_currentPrim->indices.push_back(index + 2);
-	m_currentPrim->indices.push_back(index + 1);
-	m_currentPrim->indices.push_back(index + 3);
-	m_currentPrim->indices.push_back(index + 2);
+	uint32_t index0 = AddUniqueVertex(m_tempVertices[0]);
+	uint32_t index1 = AddUniqueVertex(m_tempVertices[1]);
+	uint32_t index2 = AddUniqueVertex(m_tempVertices[2]);
+	uint32_t index3 = AddUniqueVertex(m_tempVertices[3]);
+
+	m_currentPrim->indices.push_back(index0);
+	m_currentPrim->indices.push_back(index1);
+	m_currentPrim->indices.push_back(index2);
+	m_currentPrim->indices.push_back(index1);
+	m_currentPrim->indices.push_back(index3);
+	m_currentPrim->indices.push_back(index2);
 	m_currentPrim->count++;
 }
 
@@ -163,6 +167,29 @@ void RenderList::End()
 {
 }
 
+RenderList::Vertex RenderList::MakeVertex(const float* pos, unsigned int color)
+{
+	return Vertex{ { pos[2], pos[0], pos[1] }, ConvertColor(color), { 0.0f, 0.0f } };
+}
+
+void RenderList::SetGeometry(std::vector<Vertex> vertices, std::vector<uint32_t> indices)
+{
+	Reset();
+
+	if (indices.empty())
+		return;
+
+	// every index now points at its own vertex list, nothing is left to merge into
+	auto p = std::make_unique<PrimitiveList>();
+	p->count = static_cast<int>(indices.size()) / (m_type == Prim_Quads ? 6 : PrimVertexCount(m_type));
+	p->vertices = static_cast<int>(indices.size());
+	p->indices = std::move(indices);
+
+	m_vertices = std::move(vertices);
+	m_prims.push_back(std::move(p));
+	m_currentPrim = nullptr;
+}
+
 void RenderList::Render(Renderable::RenderPhase phase)
 {
 	if (phase != Renderable::Render_Geometry)
@@ -183,122 +210,134 @@ void RenderList::Render(Renderable::RenderPhase phase)
 		m_mtx = nullptr;
 	}
 
-	int start = std::max(0u, m_firstRender);
-	int end = std::min(m_prims.size(), m_lastRender);
-
-	for (auto& p : m_prims)
+	D3DPRIMITIVETYPE primType = D3DPT_TRIANGLELIST;
+	switch (m_type)
 	{
-		PrimitiveList* l = p.get();
-
-		if (l->indices.size() == 0)
-			continue;
-
-		switch (m_type)
-		{
-		case Prim_Points:
-			m_pDevice->DrawIndexedPrimitive(D3DPT_POINTLIST,
-				0,                       // BaseVertexIndex
-				l->indices[0],           // MinIndex
-				l->vertices,             // NumVertices
-				l->startingIndex,        // StartIndex
-				l->count                 // PrimitiveCount
-				);
-			break;
-
-		case Prim_Lines:
-			m_pDevice->DrawIndexedPrimitive(D3DPT_LINELIST,
-				0,                       // BaseVertexIndex
-				l->indices[0],           // MinIndex
-				l->vertices,             // NumVertices
-				l->startingIndex,        // StartIndex
-				l->count                 // PrimitiveCount
-				);
-			break;
+	case Prim_Points: primType = D3DPT_POINTLIST; break;
+	case Prim_Lines: primType = D3DPT_LINELIST; break;
+	case Prim_Triangles:
+	case Prim_Quads: primType = D3DPT_TRIANGLELIST; break;
+	}
 
-		case Prim_Triangles:
-		case Prim_Quads:
-			m_pDevice->DrawIndexedPrimitive(D3DPT_TRIANGLELIST,
-				0,                       // BaseVertexIndex
-				l->indices[0],           // MinIndex
-				l->vertices,             // NumVertices
-				l->startingIndex,        // StartIndex
-				l->count                 // PrimitiveCount
-				);
-			break;
-		}
+	for (const DrawBatch& batch : m_batches)
+	{
+		m_pDevice->DrawIndexedPrimitive(primType,
+			0,                       // BaseVertexIndex
+			batch.minIndex,          // MinIndex
+			batch.numVertices,       // NumVertices
+			batch.startIndex,        // StartIndex
+			batch.primCount          // PrimitiveCount
+			);
 	}
 }
 
 void RenderList::GenerateBuffers()
 {
-	bool rebuildBuffers = false;
-	int vertexSize = 0, indexSize = 0;
+	if (m_pVB && m_pIB)
+		return;
 
-	if (!m_pVB && m_vertices.size() > 0)
-	{
-		vertexSize = m_vertices.size();
-		if (m_pDevice->CreateVertexBuffer(vertexSize * sizeof(Vertex),
-			D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY, VertexType, D3DPOOL_DEFAULT, &m_pVB, nullptr) < 0)
-		{
-			return;
-		}
+	// nothing to upload. Static lists also end up here once their geometry has
+	// been handed to the buffers.
+	if (m_vertices.empty() || m_prims.empty())
+		return;
+
+	ReleaseBuffers();
+
+	int vertexSize = m_vertices.size(), indexSize = 0;
+	for (auto& p : m_prims)
+		indexSize += p->indices.size();
+
+	if (indexSize == 0)
+		return;
 
-		rebuildBuffers = true;
+	// static geometry goes into the managed pool so that d3d keeps it across a
+	// device reset, dynamic geometry is rebuilt after one anyways.
+	DWORD usage = m_static ? D3DUSAGE_WRITEONLY : (D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY);
+	D3DPOOL pool = m_static ? D3DPOOL_MANAGED : D3DPOOL_DEFAULT;
+	DWORD lockFlags = m_static ? 0 : D3DLOCK_DISCARD;
+
+	if (m_pDevice->CreateVertexBuffer(vertexSize * sizeof(Vertex),
+		usage, VertexType, pool, &m_pVB, nullptr) < 0)
+	{
+		return;
 	}
 
-	if (!m_pIB && m_prims.size() > 0)
+	if (m_pDevice->CreateIndexBuffer(indexSize * sizeof(uint32_t),
+		usage, D3DFMT_INDEX32, pool, &m_pIB, nullptr) < 0)
 	{
-		// rebuild the indices and render sets
-		for (auto& p : m_prims)
-			indexSize += p->indices.size();
+		ReleaseBuffers();
+		return;
+	}
 
-		if (m_pDevice->CreateIndexBuffer(indexSize * sizeof(uint32_t),
-			D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY, D3DFMT_INDEX32, D3DPOOL_DEFAULT, &m_pIB, nullptr) < 0)
-		{
-			return;
-		}
+	Vertex* vertexDest;
+	uint32_t* indexDest;
 
-		rebuildBuffers = true;
+	if (m_pVB->Lock(0, vertexSize * sizeof(Vertex), (void**)&vertexDest, lockFlags) < 0)
+	{
+		ReleaseBuffers();
+		return;
 	}
+	if (m_pIB->Lock(0, indexSize * sizeof(uint32_t), (void**)&indexDest, lockFlags) < 0)
+	{
+		m_pVB->Unlock();
+		ReleaseBuffers();
+		return;
+	}
+
+	// fill vertex buffer
+	memcpy(vertexDest, &m_vertices[0], vertexSize * sizeof(Vertex));
+
+	// build the index buffer. Thickness is the only thing that differs between the
+	// lists and it isn't applied when drawing, so every list shares the same state
+	// and all of them go into one batch.
+	m_batches.clear();
+	DrawBatch batch;
+	uint32_t minIndex = 0xffffffff, maxIndex = 0;
 
-	if (rebuildBuffers)
+	int currentIndex = 0;
+	for (auto& p : m_prims)
 	{
-		Vertex* vertexDest;
-		uint32_t* indexDest;
+		PrimitiveList* l = p.get();
 
-		if (m_pVB->Lock(0, vertexSize * sizeof(Vertex), (void**)&vertexDest, D3DLOCK_DISCARD) < 0)
-			return;
-		if (m_pIB->Lock(0, indexSize * sizeof(uint32_t), (void**)&indexDest, D3DLOCK_DISCARD) < 0)
-			return;
+		if (l->indices.size() == 0)
+			continue;
 
-		// fill vertex buffer
-		memcpy(vertexDest, &m_vertices[0], vertexSize * sizeof(Vertex));
+		size_t source_len = l->indices.size() * sizeof(uint32_t);
+		uint32_t* source = &l->indices[0];
+		uint32_t* dest = indexDest + currentIndex;
+		memcpy(dest, source, source_len);
 
-		// build the index buffer
-		int currentIndex = 0;
-		for (auto& p : m_prims)
+		for (uint32_t index : l->indices)
 		{
-			PrimitiveList* l = p.get();
+			minIndex = std::min(minIndex, index);
+			maxIndex = std::max(maxIndex, index);
+		}
 
-			if (l->indices.size() == 0)
-				continue;
+		l->startingIndex = currentIndex;
+		currentIndex += l->indices.size();
+		batch.primCount += l->count;
+	}
 
-			size_t source_len = l->indices.size() * sizeof(uint32_t);
-			uint32_t* source = &l->indices[0];
-			uint32_t* dest = indexDest + currentIndex;
-			memcpy(dest, source, source_len);
+	batch.startIndex = 0;
+	batch.minIndex = minIndex;
+	batch.numVertices = maxIndex - minIndex + 1;
+	m_batches.push_back(batch);
 
-			l->startingIndex = currentIndex;
-			currentIndex += l->indices.size();
-		}
+	m_lastRender = m_prims.size();
+	m_pVB->Unlock();
+	m_pIB->Unlock();
 
-		m_lastRender = m_prims.size();
-		m_pVB->Unlock();
-		m_pIB->Unlock();
+	if (m_static)
+	{
+		// the buffers have their own copy now
+		std::vector<Vertex>().swap(m_vertices);
+		m_vertexIndices = std::unordered_map<Vertex, uint32_t, VertexHash>();
+		for (auto& p : m_prims)
+			std::vector<uint32_t>().swap(p->indices);
 	}
 }
 
-void RenderList::InvalidateDeviceObjects()
+void RenderList::ReleaseBuffers()
 {
 	if (m_pVB)
 	{
@@ -313,6 +352,17 @@ void RenderList::InvalidateDeviceObjects()
 	}
 }
 
+void RenderList::InvalidateDeviceObjects()
+{
+	// managed buffers are restored by d3d after a reset. Static lists don't
+	// keep their geometry around, so they hold on to them.
+	if (m_static)
+		return;
+
+	ReleaseBuffers();
+	m_batches.clear();
+}
+
 bool RenderList::CreateDeviceObjects()
 {
 	if (!m_pDevice)
@@ -338,3 +388,71 @@ void RenderList::Debug_GetRenderRange(int& begin, int& end)
 	begin = m_firstRender;
 	end = m_lastRender;
 }
+
+//----------------------------------------------------------------------------
+
+void RenderCullState::Update(IDirect3DDevice9* device, const D3DXVECTOR3& origin, float maxDistance)
+{
+	D3DXMATRIX view, proj, viewProj;
+	device->GetTransform(D3DTS_VIEW, &view);
+	device->GetTransform(D3DTS_PROJECTION, &proj);
+	viewProj = view * proj;
+
+	const D3DXMATRIX& m = viewProj;
+
+	// clip planes from the combined matrix: left, right, bottom, top, near, far
+	m_planes[0] = D3DXPLANE(m._14 + m._11, m._24 + m._21, m._34 + m._31, m._44 + m._41);
+	m_planes[1] = D3DXPLANE(m._14 - m._11, m._24 - m._21, m._34 - m._31, m._44 - m._41);
+	m_planes[2] = D3DXPLANE(m._14 + m._12, m._24 + m._22, m._34 + m._32, m._44 + m._42);
+	m_planes[3] = D3DXPLANE(m._14 - m._12, m._24 - m._22, m._34 - m._32, m._44 - m._42);
+	m_planes[4] = D3DXPLANE(m._13, m._23, m._33, m._43);
+	m_planes[5] = D3DXPLANE(m._14 - m._13, m._24 - m._23, m._34 - m._33, m._44 - m._43);
+
+	m_origin = origin;
+	m_maxDistanceSqr = maxDistance * maxDistance;
+
+	// the camera is where the inverse of the view puts the origin
+	D3DXMATRIX invView;
+	if (D3DXMatrixInverse(&invView, nullptr, &view))
+		m_camera = D3DXVECTOR3(invView._41, invView._42, invView._43);
+	else
+		m_camera = origin;
+}
+
+float RenderCullState::GetCameraDistanceSqr(const D3DXVECTOR3& bmin, const D3DXVECTOR3& bmax) const
+{
+	float dx = std::max(std::max(bmin.x - m_camera.x, 0.0f), m_camera.x - bmax.x);
+	float dy = std::max(std::max(bmin.y - m_camera.y, 0.0f), m_camera.y - bmax.y);
+	float dz = std::max(std::max(bmin.z - m_camera.z, 0.0f), m_camera.z - bmax.z);
+
+	return dx * dx + dy * dy + dz * dz;
+}
+
+bool RenderCullState::IsVisible(const D3DXVECTOR3& bmin, const D3DXVECTOR3& bmax) const
+{
+	if (m_maxDistanceSqr > 0.0f)
+	{
+		// distance from the origin to the closest point of the box
+		float dx = std::max(std::max(bmin.x - m_origin.x, 0.0f), m_origin.x - bmax.x);
+		float dy = std::max(std::max(bmin.y - m_origin.y, 0.0f), m_origin.y - bmax.y);
+		float dz = std::max(std::max(bmin.z - m_origin.z, 0.0f), m_origin.z - bmax.z);
+
+		if (dx * dx + dy * dy + dz * dz > m_maxDistanceSqr)
+			return false;
+	}
+
+	for (const D3DXPLANE& plane : m_planes)
+	{
+		// the corner furthest along the plane normal. If that one is behind the
+		// plane, the whole box is.
+		D3DXVECTOR3 corner(
+			plane.a >= 0.0f ? bmax.x : bmin.x,
+			plane.b >= 0.0f ? bmax.y : bmin.y,
+			plane.c >= 0.0f ? bmax.z : bmin.z);
+
+		if (D3DXPlaneDotCoord(&plane, &corner) < 0.0f)
+			return false;
+	}
+
+	return true;
+}
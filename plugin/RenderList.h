@@ -14,6 +14,7 @@
 
 #include <map>
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
 //----------------------------------------------------------------------------
@@ -31,6 +32,18 @@ public:
 		Prim_Count
 	};
 
+	struct Vertex
+	{
+		D3DXVECTOR3 pos;
+		D3DCOLOR    col;
+		D3DXVECTOR2 uv;
+
+		bool operator==(const Vertex& other) const
+		{
+			return pos == other.pos && col == other.col && uv == other.uv;
+		}
+	};
+
 	RenderList(IDirect3DDevice9* d3dDevice, PrimitiveType type);
 	~RenderList();
 
@@ -45,14 +58,34 @@ public:
 
 	void End();
 
+	// a vertex as AddVertex would store it, from recast coordinates and a
+	// duDebugDraw color
+	static Vertex MakeVertex(const float* pos, unsigned int color);
+
+	// replace the geometry with vertices and indices that were built elsewhere,
+	// without going through AddVertex one vertex at a time. Quads are given as
+	// two triangles each. Can be called from any thread before the list is first
+	// rendered.
+	void SetGeometry(std::vector<Vertex> vertices, std::vector<uint32_t> indices);
+
 	//----------------------------------------------------------------------------
 
 	// Render the geometry
 	virtual void Render(RenderPhase phase);
+	virtual bool IsRenderActive(RenderPhase phase) const override
+	{
+		// something uploaded, or waiting to be
+		return phase == Render_Geometry && (m_pVB || (!m_vertices.empty() && !m_prims.empty()));
+	}
 
 	void SetTransform(D3DXMATRIX* mtx) { m_mtx = mtx; }
 	void SetEQCoords(bool eqCoords) { m_eqCoords = eqCoords; }
 
+	// Static lists are uploaded once into managed buffers, which survive a device
+	// reset. The cpu copy of the geometry is dropped after the upload, so a static
+	// list has to be Reset before it can be built again.
+	void SetStatic(bool isStatic) { m_static = isStatic; }
+
 	PrimitiveType GetType() const { return m_type; }
 
 	void RenderDebugUI();
@@ -80,14 +113,24 @@ private:
 
 	// Create buffers if necessary
 	void GenerateBuffers();
+	void ReleaseBuffers();
 
-	struct Vertex
+	static const DWORD VertexType = (D3DFVF_XYZ | D3DFVF_DIFFUSE | D3DFVF_TEX1);
+
+	struct VertexHash
 	{
-		D3DXVECTOR3 pos;
-		D3DCOLOR    col;
-		D3DXVECTOR2 uv;
+		size_t operator()(const Vertex& v) const
+		{
+			const uint32_t* words = reinterpret_cast<const uint32_t*>(&v);
+			size_t hash = 2166136261u;
+			for (size_t i = 0; i < sizeof(Vertex) / sizeof(uint32_t); ++i)
+				hash = (hash ^ words[i]) * 16777619u;
+			return hash;
+		}
 	};
-	static const DWORD VertexType = (D3DFVF_XYZ | D3DFVF_DIFFUSE | D3DFVF_TEX1);
+
+	// returns the index of the vertex, adding it if it hasn't been seen before
+	uint32_t AddUniqueVertex(const Vertex& vertex);
 
 	PrimitiveType m_type;
 
@@ -102,16 +145,26 @@ private:
 		uint32_t startingIndex = 0;
 	};
 
+	// a single draw call over a range of the index buffer
+	struct DrawBatch
+	{
+		uint32_t startIndex = 0;
+		uint32_t primCount = 0;
+		uint32_t minIndex = 0;
+		uint32_t numVertices = 0;
+	};
+
 	uint32_t m_firstRender = 0;
 	uint32_t m_lastRender = 0xffffffff;
 
-	// buffer of temporary indices for the current primitive
-	Vertex m_tempIndices[4];
+	// buffer of temporary vertices for the current primitive
+	Vertex m_tempVertices[4];
 	int m_tempIndex = 0;
 	int m_tempMax = 0;
 
 	D3DXMATRIX* m_mtx = nullptr;
 	bool m_eqCoords = false;
+	bool m_static = false;
 
 private:
 	IDirect3DDevice9* m_pDevice = nullptr;
@@ -119,11 +172,36 @@ private:
 	IDirect3DIndexBuffer9* m_pIB = nullptr;
 
 	std::vector<Vertex> m_vertices;
+	std::unordered_map<Vertex, uint32_t, VertexHash> m_vertexIndices;
 
 	// keyed on thickness. We don't support thickness so it doesn't
 	// make any difference at the moment.
 	std::vector<std::unique_ptr<PrimitiveList>> m_prims;
 	PrimitiveList* m_currentPrim;
+
+	std::vector<DrawBatch> m_batches;
+};
+
+
+// View frustum and distance from the viewer, used to skip geometry that can't
+// be seen before any draw calls are made for it.
+class RenderCullState
+{
+public:
+	// build the frustum from the device's current view and projection. A max
+	// distance of 0 disables distance culling.
+	void Update(IDirect3DDevice9* device, const D3DXVECTOR3& origin, float maxDistance);
+
+	bool IsVisible(const D3DXVECTOR3& bmin, const D3DXVECTOR3& bmax) const;
+
+	// squared distance from the camera to the closest point of the box
+	float GetCameraDistanceSqr(const D3DXVECTOR3& bmin, const D3DXVECTOR3& bmax) const;
+
+private:
+	D3DXPLANE m_planes[6];
+	D3DXVECTOR3 m_origin;
+	D3DXVECTOR3 m_camera;
+	float m_maxDistanceSqr = 0.0f;
 };
 
 
@@ -166,6 +244,12 @@ public:
 			m_primLists[i]->SetEQCoords(eqCoords);
 	}
 
+	inline void SetStatic(bool isStatic)
+	{
+		for (int i = 0; i < RenderList::Prim_Count; ++i)
+			m_primLists[i]->SetStatic(isStatic);
+	}
+
 	void SetTransform(D3DXMATRIX* mtx)
 	{
 		for (int i = 0; i < RenderList::Prim_Count; ++i)
@@ -175,6 +259,26 @@ public:
 		}
 	}
 
+	// bounds of the geometry in the group, in render coordinates
+	void SetBounds(const D3DXVECTOR3& bmin, const D3DXVECTOR3& bmax)
+	{
+		m_bmin = bmin;
+		m_bmax = bmax;
+		m_hasBounds = true;
+	}
+
+	// groups without bounds are always considered visible
+	bool IsVisible(const RenderCullState& cull) const
+	{
+		return !m_hasBounds || cull.IsVisible(m_bmin, m_bmax);
+	}
+
+	// and as close as can be
+	float GetCameraDistanceSqr(const RenderCullState& cull) const
+	{
+		return m_hasBounds ? cull.GetCameraDistanceSqr(m_bmin, m_bmax) : 0.0f;
+	}
+
 	virtual void Render(Renderable::RenderPhase phase) override
 	{
 		for (int i = 0; i < RenderList::Prim_Count; ++i)
@@ -184,6 +288,17 @@ public:
 		}
 	}
 
+	virtual bool IsRenderActive(Renderable::RenderPhase phase) const override
+	{
+		for (int i = 0; i < RenderList::Prim_Count; ++i)
+		{
+			if (m_primsEnabled[i] && m_primLists[i]->IsRenderActive(phase))
+				return true;
+		}
+
+		return false;
+	}
+
 	virtual bool CreateDeviceObjects() override
 	{
 		for (int i = 0; i < RenderList::Prim_Count; ++i)
@@ -223,4 +338,7 @@ private:
 	bool m_primsEnabled[RenderList::Prim_Count];
 
 	RenderList* m_currentList = nullptr;
+
+	D3DXVECTOR3 m_bmin, m_bmax;
+	bool m_hasBounds = false;
 };
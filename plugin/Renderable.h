@@ -20,4 +20,14 @@ public:
 	virtual void Render(RenderPhase phase) = 0;
 	virtual bool CreateDeviceObjects() = 0;
 	virtual void InvalidateDeviceObjects() = 0;
+
+	// false if Render won't draw anything in this phase. When nothing renders, the
+	// device state isn't saved and restored at all.
+	virtual bool IsRenderActive(RenderPhase phase) const { return true; }
+
+	// Set every device state that Render changes, to any value. This is called
+	// while the state block that saves and restores EQ's state around rendering
+	// is recorded. The states that ResetDeviceState sets, and the shaders,
+	// streams, transforms, texture 0 and viewport, are always included.
+	virtual void RecordDeviceState() {}
 };
@@ -0,0 +1,245 @@
+//
+// SharedFlowField.cpp
+//
+
+#include "SharedFlowField.h"
+#include "PerfStats.h"
+#include "SharedPathCache.h"
+
+#include "common/NavMesh.h"
+#include "common/NavMeshData.h"
+
+#include <DetourCommon.h>
+
+#include <algorithm>
+
+// bump when the layout of the mapping changes, clients of different versions get
+// different mappings.
+static const int SHARED_FLOW_FIELD_VERSION = 1;
+
+// the field is rebuilt once the destination has moved further than this from
+// where it was built
+static const float FLOW_FIELD_MOVE_DISTANCE = 10.0f;
+
+// how far out from the destination the field reaches, in path cost
+static const float FLOW_FIELD_MAX_COST = 2000.0f;
+
+// the field never has more cells than the search has nodes
+static const int FLOW_FIELD_MAX_CELLS = NAVMESH_PATH_MAX_NODES;
+
+// longest path taken from the field
+static const int FLOW_FIELD_MAX_PATH = 4028 * 4;
+
+struct SharedFlowField::Header
+{
+	// odd while the field is being written
+	volatile LONG sequence;
+
+	uint32_t filterHash;
+	dtPolyRef destRef;
+	float destPos[3];
+	int32_t cellCount;
+
+	// followed by FLOW_FIELD_MAX_CELLS cells
+	FlowField::Cell* GetCells() { return reinterpret_cast<FlowField::Cell*>(this + 1); }
+};
+
+//----------------------------------------------------------------------------
+
+SharedFlowField::SharedFlowField(NavMesh* navMesh)
+	: m_navMesh(navMesh)
+	, m_search(NAVMESH_PATH_MAX_NODES)
+{
+}
+
+SharedFlowField::~SharedFlowField()
+{
+	Detach();
+}
+
+void SharedFlowField::Initialize()
+{
+	auto reset = [this]()
+	{
+		m_field.Clear();
+		Attach();
+	};
+
+	m_navMeshConn = m_navMesh->OnNavMeshChanged.Connect(reset);
+	m_navMeshTilesConn = m_navMesh->OnNavMeshTilesChanged.Connect(reset);
+}
+
+void SharedFlowField::Shutdown()
+{
+	m_navMeshConn.Disconnect();
+	m_navMeshTilesConn.Disconnect();
+
+	Detach();
+	m_field.Clear();
+}
+
+void SharedFlowField::SetEnabled(bool enabled)
+{
+	m_enabled = enabled;
+
+	if (m_enabled)
+		Attach();
+	else
+		Detach();
+}
+
+void SharedFlowField::Attach()
+{
+	std::string meshName = m_enabled ? SharedPathCache::GetSharedMeshName(m_navMesh) : std::string();
+
+	std::string name;
+	if (!meshName.empty())
+	{
+		char szName[MAX_PATH];
+		sprintf_s(szName, "Local\\MQ2Nav_FlowField%d_%s", SHARED_FLOW_FIELD_VERSION, meshName.c_str());
+		name = szName;
+	}
+
+	if (m_header && name == m_mappingName)
+		return;
+
+	Detach();
+
+	if (name.empty())
+		return;
+
+	// new mappings come zeroed, which is no field
+	const DWORD size = sizeof(Header) + sizeof(FlowField::Cell) * FLOW_FIELD_MAX_CELLS;
+	m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, size, name.c_str());
+	if (!m_mapping)
+		return;
+
+	m_header = static_cast<Header*>(MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+	if (!m_header)
+	{
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+		return;
+	}
+
+	m_mappingName = name;
+}
+
+void SharedFlowField::Detach()
+{
+	if (m_header)
+	{
+		UnmapViewOfFile(m_header);
+		m_header = nullptr;
+	}
+
+	if (m_mapping)
+	{
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+	}
+
+	m_mappingName.clear();
+}
+
+bool SharedFlowField::IsCurrent(const FlowField& field, uint32_t filterHash, const float* endPos) const
+{
+	return !field.IsEmpty()
+		&& filterHash == m_filterHash
+		&& dtVdistSqr(field.GetDestinationPos(), endPos) <= dtSqr(FLOW_FIELD_MOVE_DISTANCE);
+}
+
+bool SharedFlowField::ReadShared(uint32_t filterHash, const float* endPos)
+{
+	if (!m_header)
+		return false;
+
+	LONG sequence = m_header->sequence;
+	MemoryBarrier();
+
+	if ((sequence & 1)
+		|| m_header->filterHash != filterHash
+		|| m_header->cellCount <= 0
+		|| m_header->cellCount > FLOW_FIELD_MAX_CELLS
+		|| dtVdistSqr(m_header->destPos, endPos) > dtSqr(FLOW_FIELD_MOVE_DISTANCE))
+	{
+		return false;
+	}
+
+	const FlowField::Cell* cells = m_header->GetCells();
+	std::vector<FlowField::Cell> copy(cells, cells + m_header->cellCount);
+	dtPolyRef destRef = m_header->destRef;
+	float destPos[3];
+	dtVcopy(destPos, m_header->destPos);
+
+	MemoryBarrier();
+	if (m_header->sequence != sequence)
+		return false;
+
+	m_field.SetCells(destRef, destPos, std::move(copy));
+	m_filterHash = filterHash;
+	++m_stats.sharedReads;
+
+	return true;
+}
+
+void SharedFlowField::WriteShared()
+{
+	const std::vector<FlowField::Cell>& cells = m_field.GetCells();
+	if (!m_header || cells.empty() || cells.size() > FLOW_FIELD_MAX_CELLS)
+		return;
+
+	// leave it to whoever is writing it now
+	LONG sequence = m_header->sequence;
+	if ((sequence & 1) || InterlockedCompareExchange(&m_header->sequence, sequence + 1, sequence) != sequence)
+		return;
+
+	m_header->filterHash = m_filterHash;
+	m_header->destRef = m_field.GetDestinationRef();
+	dtVcopy(m_header->destPos, m_field.GetDestinationPos());
+	m_header->cellCount = static_cast<int32_t>(cells.size());
+	memcpy(m_header->GetCells(), cells.data(), sizeof(FlowField::Cell) * cells.size());
+
+	InterlockedExchange(&m_header->sequence, sequence + 2);
+}
+
+bool SharedFlowField::FindPath(dtPolyRef startRef, dtPolyRef endRef, const float* endPos,
+	const NavMeshQueryFilter& filter, std::vector<dtPolyRef>& path)
+{
+	std::shared_ptr<dtNavMesh> navMesh = m_navMesh->GetNavMesh();
+	if (!navMesh)
+		return false;
+
+	if (!IsCurrent(m_field, filter.hash, endPos) && !ReadShared(filter.hash, endPos))
+	{
+		mq2nav::ScopedPerfTimer timer(mq2nav::PerfTimer::FindPath);
+
+		dtStatus status = m_search.BuildFlowField(navMesh.get(), endRef, endPos, &filter.filter,
+			FLOW_FIELD_MAX_COST, m_field);
+		if (dtStatusFailed(status))
+		{
+			m_field.Clear();
+			return false;
+		}
+
+		m_filterHash = filter.hash;
+		++m_stats.builds;
+
+		WriteShared();
+	}
+
+	path.resize(FLOW_FIELD_MAX_PATH);
+	int pathSize = m_field.GetPath(startRef, endRef, path.data(), FLOW_FIELD_MAX_PATH);
+	path.resize(pathSize);
+
+	// a field from another client can go through tiles that aren't streamed in here
+	if (path.empty() || !std::all_of(path.begin(), path.end(),
+		[&navMesh](dtPolyRef ref) { return navMesh->isValidPolyRef(ref); }))
+	{
+		path.clear();
+		return false;
+	}
+
+	++m_stats.paths;
+	return true;
+}
@@ -0,0 +1,81 @@
+//
+// SharedFlowField.h
+//
+
+#pragma once
+
+#include "MQ2Plugin.h"
+
+#include "common/FlowField.h"
+#include "common/NavModule.h"
+#include "common/PolyPathSearch.h"
+#include "common/Signal.h"
+
+#include <DetourNavMesh.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class NavMesh;
+struct NavMeshQueryFilter;
+
+// Flow field for destinations that a group is headed to, see FlowField. The
+// field is built once for the destination, and every character that asks for a
+// path to it follows the field instead of searching. With sharing enabled, the
+// field is also published to the other clients on this machine through a named
+// file mapping, like the shared path cache, so a group moving to one spot only
+// costs one search.
+class SharedFlowField : public NavModule
+{
+public:
+	explicit SharedFlowField(NavMesh* navMesh);
+	virtual ~SharedFlowField();
+
+	virtual void Initialize() override;
+	virtual void Shutdown() override;
+
+	void SetEnabled(bool enabled);
+	bool IsEnabled() const { return m_enabled; }
+
+	// the path from startRef to the destination at endPos. The field is rebuilt
+	// when the destination has moved too far from where it was built. Returns
+	// false if startRef is out of reach of the field.
+	bool FindPath(dtPolyRef startRef, dtPolyRef endRef, const float* endPos,
+		const NavMeshQueryFilter& filter, std::vector<dtPolyRef>& path);
+
+	struct Stats
+	{
+		uint32_t builds = 0;
+		uint32_t sharedReads = 0;
+		uint32_t paths = 0;
+	};
+	const Stats& GetStats() const { return m_stats; }
+
+private:
+	struct Header;
+
+	bool IsCurrent(const FlowField& field, uint32_t filterHash, const float* endPos) const;
+
+	// copy the field from the mapping if it is for this destination
+	bool ReadShared(uint32_t filterHash, const float* endPos);
+	void WriteShared();
+
+	void Attach();
+	void Detach();
+
+	NavMesh* m_navMesh;
+	bool m_enabled = false;
+
+	FlowField m_field;
+	uint32_t m_filterHash = 0;
+	PolyPathSearch m_search;
+
+	HANDLE m_mapping = nullptr;
+	Header* m_header = nullptr;
+	std::string m_mappingName;
+	Stats m_stats;
+
+	Signal<>::ScopedConnection m_navMeshConn;
+	Signal<>::ScopedConnection m_navMeshTilesConn;
+};
@@ -0,0 +1,262 @@
+//
+// SharedLeaderPath.cpp
+//
+
+#include "SharedLeaderPath.h"
+#include "SharedPathCache.h"
+
+#include "common/NavMesh.h"
+
+#include <algorithm>
+
+// bump when the layout of the mapping changes, clients of different versions get
+// different mappings.
+static const int SHARED_LEADER_PATH_VERSION = 1;
+
+// characters that can publish a path at the same time
+static const int LEADER_PATH_SLOTS = 24;
+
+// longest trail kept for a leader, the oldest polygons are dropped first
+static const int LEADER_PATH_MAX_POLYS = 2048;
+
+struct SharedLeaderPath::Slot
+{
+	// odd while the slot is being written
+	volatile LONG sequence;
+
+	DWORD spawnId;                     // 0 if the slot is free
+	uint32_t filterHash;
+	int32_t count;
+	dtPolyRef polys[LEADER_PATH_MAX_POLYS];
+};
+
+//----------------------------------------------------------------------------
+
+SharedLeaderPath::SharedLeaderPath(NavMesh* navMesh)
+	: m_navMesh(navMesh)
+{
+}
+
+SharedLeaderPath::~SharedLeaderPath()
+{
+	Detach();
+}
+
+void SharedLeaderPath::Initialize()
+{
+	// polygon refs of the old mesh mean nothing in the new one
+	auto reset = [this]()
+	{
+		m_trail.clear();
+		Attach();
+	};
+
+	m_navMeshConn = m_navMesh->OnNavMeshChanged.Connect(reset);
+	m_navMeshTilesConn = m_navMesh->OnNavMeshTilesChanged.Connect(reset);
+}
+
+void SharedLeaderPath::Shutdown()
+{
+	m_navMeshConn.Disconnect();
+	m_navMeshTilesConn.Disconnect();
+
+	Detach();
+	m_trail.clear();
+}
+
+void SharedLeaderPath::SetEnabled(bool enabled)
+{
+	m_enabled = enabled;
+
+	if (m_enabled)
+		Attach();
+	else
+		Detach();
+}
+
+void SharedLeaderPath::Attach()
+{
+	std::string meshName = m_enabled ? SharedPathCache::GetSharedMeshName(m_navMesh) : std::string();
+
+	std::string name;
+	if (!meshName.empty())
+	{
+		char szName[MAX_PATH];
+		sprintf_s(szName, "Local\\MQ2Nav_LeaderPath%d_%s", SHARED_LEADER_PATH_VERSION, meshName.c_str());
+		name = szName;
+	}
+
+	if (m_view && name == m_mappingName)
+		return;
+
+	Detach();
+
+	if (name.empty())
+		return;
+
+	// new mappings come zeroed, which is every slot free
+	const DWORD size = sizeof(Slot) * LEADER_PATH_SLOTS;
+	m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, size, name.c_str());
+	if (!m_mapping)
+		return;
+
+	m_view = MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (!m_view)
+	{
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+		return;
+	}
+
+	m_mappingName = name;
+}
+
+void SharedLeaderPath::Detach()
+{
+	if (m_view)
+	{
+		UnmapViewOfFile(m_view);
+		m_view = nullptr;
+	}
+
+	if (m_mapping)
+	{
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+	}
+
+	m_mappingName.clear();
+}
+
+SharedLeaderPath::Slot* SharedLeaderPath::GetSlots() const
+{
+	return static_cast<Slot*>(m_view);
+}
+
+void SharedLeaderPath::PublishPath(DWORD spawnId, uint32_t filterHash, const dtPolyRef* polys, int numPolys)
+{
+	if (!m_view || !spawnId || numPolys <= 0)
+		return;
+
+	// a replan from somewhere along the trail keeps the part behind it
+	auto iter = filterHash == m_trailFilterHash
+		? std::find(m_trail.begin(), m_trail.end(), polys[0]) : m_trail.end();
+	m_trail.erase(iter, m_trail.end());
+	m_trail.insert(m_trail.end(), polys, polys + numPolys);
+	m_trailFilterHash = filterHash;
+
+	if (m_trail.size() > LEADER_PATH_MAX_POLYS)
+		m_trail.erase(m_trail.begin(), m_trail.end() - LEADER_PATH_MAX_POLYS);
+
+	WritePath(spawnId, filterHash, m_trail);
+	++m_stats.published;
+}
+
+void SharedLeaderPath::ClearPath(DWORD spawnId)
+{
+	m_trail.clear();
+
+	if (!m_view || !spawnId)
+		return;
+
+	WritePath(spawnId, 0, m_trail);
+}
+
+void SharedLeaderPath::WritePath(DWORD spawnId, uint32_t filterHash, const std::vector<dtPolyRef>& path)
+{
+	Slot* slots = GetSlots();
+
+	// our own slot, or the first free one if there is nothing to take down
+	Slot* slot = nullptr;
+	for (int i = 0; i < LEADER_PATH_SLOTS && !slot; ++i)
+	{
+		if (slots[i].spawnId == spawnId)
+			slot = &slots[i];
+	}
+	for (int i = 0; i < LEADER_PATH_SLOTS && !slot && !path.empty(); ++i)
+	{
+		if (slots[i].spawnId == 0)
+			slot = &slots[i];
+	}
+	if (!slot)
+		return;
+
+	// leave it to whoever is writing it now
+	LONG sequence = slot->sequence;
+	if ((sequence & 1) || InterlockedCompareExchange(&slot->sequence, sequence + 1, sequence) != sequence)
+		return;
+
+	// someone else took the free slot first
+	if (slot->spawnId != spawnId && slot->spawnId != 0)
+	{
+		InterlockedExchange(&slot->sequence, sequence + 2);
+		return;
+	}
+
+	slot->spawnId = path.empty() ? 0 : spawnId;
+	slot->filterHash = filterHash;
+	slot->count = static_cast<int32_t>(path.size());
+	if (!path.empty())
+		memcpy(slot->polys, path.data(), sizeof(dtPolyRef) * path.size());
+
+	InterlockedExchange(&slot->sequence, sequence + 2);
+}
+
+bool SharedLeaderPath::ReadPath(DWORD spawnId, uint32_t filterHash, std::vector<dtPolyRef>& path)
+{
+	path.clear();
+	if (!m_view || !spawnId)
+		return false;
+
+	Slot* slots = GetSlots();
+	for (int i = 0; i < LEADER_PATH_SLOTS; ++i)
+	{
+		Slot& slot = slots[i];
+
+		LONG sequence = slot.sequence;
+		MemoryBarrier();
+
+		if ((sequence & 1)
+			|| slot.spawnId != spawnId
+			|| slot.filterHash != filterHash
+			|| slot.count <= 0
+			|| slot.count > LEADER_PATH_MAX_POLYS)
+		{
+			continue;
+		}
+
+		path.assign(slot.polys, slot.polys + slot.count);
+
+		MemoryBarrier();
+		if (slot.sequence != sequence)
+		{
+			path.clear();
+			return false;
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+bool SharedLeaderPath::FindPath(DWORD leaderId, uint32_t filterHash, dtPolyRef startRef, dtPolyRef endRef,
+	std::vector<dtPolyRef>& path)
+{
+	path.clear();
+	if (!ReadPath(leaderId, filterHash, m_leaderPath))
+		return false;
+
+	// the leader is ahead of the follower on the trail
+	auto start = std::find(m_leaderPath.begin(), m_leaderPath.end(), startRef);
+	auto end = std::find(start, m_leaderPath.end(), endRef);
+	if (start == m_leaderPath.end() || end == m_leaderPath.end())
+	{
+		++m_stats.offCorridor;
+		return false;
+	}
+
+	path.assign(start, end + 1);
+	++m_stats.seeded;
+	return true;
+}
@@ -0,0 +1,82 @@
+//
+// SharedLeaderPath.h
+//
+
+#pragma once
+
+#include "MQ2Plugin.h"
+
+#include "common/NavModule.h"
+#include "common/Signal.h"
+
+#include <DetourNavMesh.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class NavMesh;
+
+// Polygons of the paths that characters on this machine are following, by spawn
+// id, for followers in formation mode. Each client publishes the path of its own
+// navigation, and a follower seeds its corridor with the polygons of its
+// leader's path between itself and the leader instead of searching. Paths are
+// kept as a trail: when the leader replans from somewhere along its old path,
+// the part it already walked is kept in front of the new one, so followers
+// further back stay on it. Shared through a named file mapping, like the shared
+// path cache.
+class SharedLeaderPath : public NavModule
+{
+public:
+	explicit SharedLeaderPath(NavMesh* navMesh);
+	virtual ~SharedLeaderPath();
+
+	virtual void Initialize() override;
+	virtual void Shutdown() override;
+
+	void SetEnabled(bool enabled);
+	bool IsEnabled() const { return m_enabled; }
+
+	// publish the path of spawnId, or take it down when it stops navigating
+	void PublishPath(DWORD spawnId, uint32_t filterHash, const dtPolyRef* polys, int numPolys);
+	void ClearPath(DWORD spawnId);
+
+	// the polygons of the leader's path from startRef to endRef. Returns false if
+	// either isn't on the leader's path, the follower is off the corridor then.
+	bool FindPath(DWORD leaderId, uint32_t filterHash, dtPolyRef startRef, dtPolyRef endRef,
+		std::vector<dtPolyRef>& path);
+
+	struct Stats
+	{
+		uint32_t published = 0;
+		uint32_t seeded = 0;
+		uint32_t offCorridor = 0;
+	};
+	const Stats& GetStats() const { return m_stats; }
+
+private:
+	struct Slot;
+
+	Slot* GetSlots() const;
+	bool ReadPath(DWORD spawnId, uint32_t filterHash, std::vector<dtPolyRef>& path);
+	void WritePath(DWORD spawnId, uint32_t filterHash, const std::vector<dtPolyRef>& path);
+
+	void Attach();
+	void Detach();
+
+	NavMesh* m_navMesh;
+	bool m_enabled = false;
+
+	// the path this client last published, with the part already walked
+	std::vector<dtPolyRef> m_trail;
+	uint32_t m_trailFilterHash = 0;
+	std::vector<dtPolyRef> m_leaderPath;
+
+	HANDLE m_mapping = nullptr;
+	void* m_view = nullptr;
+	std::string m_mappingName;
+	Stats m_stats;
+
+	Signal<>::ScopedConnection m_navMeshConn;
+	Signal<>::ScopedConnection m_navMeshTilesConn;
+};
@@ -0,0 +1,226 @@
+//
+// SharedPathCache.cpp
+//
+
+#include "SharedPathCache.h"
+
+#include "common/NavMesh.h"
+#include "common/NavMeshTileCache.h"
+
+#include <algorithm>
+
+// bump when the layout of an entry changes, clients of different versions get
+// different mappings.
+static const int SHARED_PATH_CACHE_VERSION = 1;
+
+static const uint32_t SHARED_PATH_CACHE_ENTRIES = 2048;
+
+// longer paths aren't shared
+static const int SHARED_PATH_MAX_POLYS = 256;
+
+struct SharedPathCache::Entry
+{
+	// odd while the entry is being written
+	volatile LONG sequence;
+
+	dtPolyRef startRef;
+	dtPolyRef endRef;
+	uint32_t filterHash;
+	int32_t pathSize;
+	dtPolyRef path[SHARED_PATH_MAX_POLYS];
+};
+
+//----------------------------------------------------------------------------
+
+SharedPathCache::SharedPathCache(NavMesh* navMesh)
+	: m_navMesh(navMesh)
+{
+}
+
+SharedPathCache::~SharedPathCache()
+{
+	Detach();
+}
+
+void SharedPathCache::Initialize()
+{
+	m_navMeshConn = m_navMesh->OnNavMeshChanged.Connect([this]() { Attach(); });
+
+	// patched tiles come from a new file, tiles rebuilt around obstacles only
+	// exist in this client.
+	m_navMeshTilesConn = m_navMesh->OnNavMeshTilesChanged.Connect([this]() { Attach(); });
+}
+
+void SharedPathCache::Shutdown()
+{
+	m_navMeshConn.Disconnect();
+	m_navMeshTilesConn.Disconnect();
+
+	Detach();
+}
+
+void SharedPathCache::SetEnabled(bool enabled)
+{
+	m_enabled = enabled;
+
+	if (m_enabled)
+		Attach();
+	else
+		Detach();
+}
+
+std::string SharedPathCache::GetSharedMeshName(NavMesh* navMesh)
+{
+	if (!navMesh->IsNavMeshLoaded())
+		return std::string();
+
+	if (NavMeshTileCache* tileCache = navMesh->GetTileCache())
+	{
+		if (!tileCache->GetObstacles().empty())
+			return std::string();
+	}
+
+	// the file's time and size stand in for its contents
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExA(navMesh->GetDataFileName().c_str(), GetFileExInfoStandard, &data))
+		return std::string();
+
+	char szName[MAX_PATH];
+	sprintf_s(szName, "%s_%08x%08x_%08x", navMesh->GetZoneName().c_str(),
+		data.ftLastWriteTime.dwHighDateTime, data.ftLastWriteTime.dwLowDateTime, data.nFileSizeLow);
+
+	return szName;
+}
+
+std::string SharedPathCache::GetMappingName() const
+{
+	std::string meshName = GetSharedMeshName(m_navMesh);
+	if (meshName.empty())
+		return std::string();
+
+	char szName[MAX_PATH];
+	sprintf_s(szName, "Local\\MQ2Nav_PathCache%d_%s", SHARED_PATH_CACHE_VERSION, meshName.c_str());
+
+	return szName;
+}
+
+void SharedPathCache::Attach()
+{
+	std::string name = m_enabled ? GetMappingName() : std::string();
+	if (m_entries && name == m_mappingName)
+		return;
+
+	Detach();
+
+	if (name.empty())
+		return;
+
+	// new mappings come zeroed, which is an empty cache
+	const DWORD size = sizeof(Entry) * SHARED_PATH_CACHE_ENTRIES;
+	m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, size, name.c_str());
+	if (!m_mapping)
+		return;
+
+	m_entries = static_cast<Entry*>(MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+	if (!m_entries)
+	{
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+		return;
+	}
+
+	m_mappingName = name;
+}
+
+void SharedPathCache::Detach()
+{
+	if (m_entries)
+	{
+		UnmapViewOfFile(m_entries);
+		m_entries = nullptr;
+	}
+
+	if (m_mapping)
+	{
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+	}
+
+	m_mappingName.clear();
+}
+
+SharedPathCache::Entry& SharedPathCache::GetEntry(dtPolyRef startRef, dtPolyRef endRef,
+	uint32_t filterHash) const
+{
+	uint32_t hash = static_cast<uint32_t>(startRef) * 2654435761u;
+	hash ^= static_cast<uint32_t>(endRef) * 2246822519u;
+	hash ^= filterHash * 3266489917u;
+
+	return m_entries[(hash ^ (hash >> 15)) % SHARED_PATH_CACHE_ENTRIES];
+}
+
+bool SharedPathCache::FindPath(dtPolyRef startRef, dtPolyRef endRef, uint32_t filterHash,
+	std::vector<dtPolyRef>& path)
+{
+	if (!m_entries)
+		return false;
+
+	const Entry& entry = GetEntry(startRef, endRef, filterHash);
+
+	LONG sequence = entry.sequence;
+	MemoryBarrier();
+
+	bool found = !(sequence & 1)
+		&& entry.startRef == startRef
+		&& entry.endRef == endRef
+		&& entry.filterHash == filterHash
+		&& entry.pathSize > 0
+		&& entry.pathSize <= SHARED_PATH_MAX_POLYS;
+
+	if (found)
+	{
+		path.assign(entry.path, entry.path + entry.pathSize);
+
+		MemoryBarrier();
+		found = entry.sequence == sequence;
+	}
+
+	// the path can go through tiles that aren't streamed in here
+	if (found)
+	{
+		const dtNavMesh* navMesh = m_navMesh->GetNavMesh().get();
+		found = std::all_of(path.begin(), path.end(),
+			[navMesh](dtPolyRef ref) { return navMesh->isValidPolyRef(ref); });
+	}
+
+	if (!found)
+	{
+		++m_stats.misses;
+		return false;
+	}
+
+	++m_stats.hits;
+	return true;
+}
+
+void SharedPathCache::AddPath(dtPolyRef startRef, dtPolyRef endRef, uint32_t filterHash,
+	const dtPolyRef* path, int pathSize)
+{
+	if (!m_entries || pathSize <= 0 || pathSize > SHARED_PATH_MAX_POLYS)
+		return;
+
+	Entry& entry = GetEntry(startRef, endRef, filterHash);
+
+	// leave it to whoever is writing it now
+	LONG sequence = entry.sequence;
+	if ((sequence & 1) || InterlockedCompareExchange(&entry.sequence, sequence + 1, sequence) != sequence)
+		return;
+
+	entry.startRef = startRef;
+	entry.endRef = endRef;
+	entry.filterHash = filterHash;
+	entry.pathSize = pathSize;
+	memcpy(entry.path, path, sizeof(dtPolyRef) * pathSize);
+
+	InterlockedExchange(&entry.sequence, sequence + 2);
+}
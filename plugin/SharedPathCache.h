@@ -0,0 +1,75 @@
+//
+// SharedPathCache.h
+//
+
+#pragma once
+
+#include "MQ2Plugin.h"
+
+#include "common/NavModule.h"
+#include "common/Signal.h"
+
+#include <DetourNavMesh.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class NavMesh;
+
+// Paths found by any client on this machine, shared through a named file mapping
+// for each zone and mesh file. Every client that loaded the same mesh file ends up
+// with the same polygon refs, so a path found by one client is good for all of
+// them. Entries are written under a sequence lock, a read that overlaps a write
+// is treated as a miss.
+class SharedPathCache : public NavModule
+{
+public:
+	explicit SharedPathCache(NavMesh* navMesh);
+	virtual ~SharedPathCache();
+
+	virtual void Initialize() override;
+	virtual void Shutdown() override;
+
+	void SetEnabled(bool enabled);
+	bool IsEnabled() const { return m_enabled; }
+	bool IsAttached() const { return m_entries != nullptr; }
+
+	bool FindPath(dtPolyRef startRef, dtPolyRef endRef, uint32_t filterHash,
+		std::vector<dtPolyRef>& path);
+	void AddPath(dtPolyRef startRef, dtPolyRef endRef, uint32_t filterHash,
+		const dtPolyRef* path, int pathSize);
+
+	struct Stats
+	{
+		uint32_t hits = 0;
+		uint32_t misses = 0;
+	};
+	const Stats& GetStats() const { return m_stats; }
+
+	// names the loaded mesh the same way in every client that loaded the same
+	// file, for mappings shared between them. Empty if the loaded mesh doesn't
+	// match its file on disk.
+	static std::string GetSharedMeshName(NavMesh* navMesh);
+
+private:
+	struct Entry;
+
+	// map the cache for the current mesh, or unmap it if the mesh can't be shared
+	void Attach();
+	void Detach();
+
+	std::string GetMappingName() const;
+	Entry& GetEntry(dtPolyRef startRef, dtPolyRef endRef, uint32_t filterHash) const;
+
+	NavMesh* m_navMesh;
+	bool m_enabled = false;
+
+	HANDLE m_mapping = nullptr;
+	Entry* m_entries = nullptr;
+	std::string m_mappingName;
+	Stats m_stats;
+
+	Signal<>::ScopedConnection m_navMeshConn;
+	Signal<>::ScopedConnection m_navMeshTilesConn;
+};
@@ -7,8 +7,16 @@
 #include "MQ2Nav_Settings.h"
 #include "MQ2Navigation.h"
 #include "ModelLoader.h"
+#include "NavMeshLoader.h"
+#include "PerfStats.h"
+#include "LocalAvoidance.h"
+#include "SharedFlowField.h"
+#include "SharedLeaderPath.h"
+#include "SharedPathCache.h"
 #include "ImGuiRenderer.h"
 #include "Waypoints.h"
+#include "ZoneInTimeline.h"
+#include "common/NavMesh.h"
 
 #define IMGUI_INCLUDE_IMGUI_USER_H
 #include <imgui.h>
@@ -22,19 +30,63 @@ namespace
 		"Waypoints",
 		"Settings",
 		"Tools",
+		"Perf",
 		"Theme",
 	};
 }
 
 //----------------------------------------------------------------------------
 
+static void RenderMeshStatsUI()
+{
+	if (!ImGui::CollapsingHeader("Navmesh"))
+		return;
+
+	NavMeshStats stats = g_mq2Nav->Get<NavMesh>()->GetStats();
+
+	auto kb = [](size_t bytes) { return bytes / 1024.0f; };
+
+	ImGui::Text("Tiles: %d  Polys: %d  Verts: %d", stats.tiles, stats.polys, stats.verts);
+	ImGui::Text("Links: %d  Off-mesh links: %d", stats.links, stats.offMeshLinks);
+	ImGui::Text("Detail verts: %d  Detail tris: %d", stats.detailVerts, stats.detailTris);
+
+	ImGui::Separator();
+
+	ImGui::Columns(2);
+	ImGui::Text("Memory"); ImGui::NextColumn();
+	ImGui::Text("KB"); ImGui::NextColumn();
+	ImGui::Separator();
+
+	ImGui::Text("Headers"); ImGui::NextColumn(); ImGui::Text("%.1f", kb(stats.headerBytes)); ImGui::NextColumn();
+	ImGui::Text("Polys"); ImGui::NextColumn(); ImGui::Text("%.1f", kb(stats.polyBytes)); ImGui::NextColumn();
+	ImGui::Text("Links"); ImGui::NextColumn(); ImGui::Text("%.1f", kb(stats.linkBytes)); ImGui::NextColumn();
+	ImGui::Text("Detail meshes"); ImGui::NextColumn(); ImGui::Text("%.1f", kb(stats.detailBytes)); ImGui::NextColumn();
+	ImGui::Text("BV trees"); ImGui::NextColumn(); ImGui::Text("%.1f", kb(stats.bvTreeBytes)); ImGui::NextColumn();
+	ImGui::Text("Off-mesh links"); ImGui::NextColumn(); ImGui::Text("%.1f", kb(stats.offMeshBytes)); ImGui::NextColumn();
+	ImGui::Text("All tiles"); ImGui::NextColumn(); ImGui::Text("%.1f", kb(stats.tileBytes)); ImGui::NextColumn();
+	ImGui::Text("Query nodes (%d)", stats.queries); ImGui::NextColumn(); ImGui::Text("%.1f", kb(stats.queryNodeBytes)); ImGui::NextColumn();
+	ImGui::Columns(1);
+
+	ImGui::Separator();
+
+	ImGui::Text("Load (ms): read %.1f  parse %.1f  inflate %.1f  add tiles %.1f",
+		stats.readMs, stats.parseMs, stats.inflateMs, stats.addTileMs);
+}
+
+//----------------------------------------------------------------------------
+
 void UiController::Initialize()
 {
 	m_uiConn = g_imguiRenderer->OnUpdateUI.Connect([this]() { PerformUpdateUI(); });
+
+	// every window is drawn from the tools window
+	g_imguiRenderer->SetHasWindows([this]() { return IsUiOn(); });
 }
 
 void UiController::Shutdown()
 {
+	if (g_imguiRenderer)
+		g_imguiRenderer->SetHasWindows(nullptr);
 }
 
 bool UiController::IsUiOn() const
@@ -134,6 +186,135 @@ void UiController::PerformUpdateTab(TabPage page)
 		if (ImGui::IsItemHovered())
 			ImGui::SetTooltip("Automatically reload the navmesh when it is modified");
 
+		if (ImGui::Checkbox("Stream nav mesh tiles", &settings.tile_streaming))
+		{
+			changed = true;
+		}
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Only keep the parts of the navmesh that are near you loaded");
+
+		if (settings.tile_streaming)
+		{
+			if (ImGui::SliderFloat("Streaming radius", &settings.tile_streaming_radius, 200.0f, 5000.0f, "%.0f"))
+				changed = true;
+		}
+
+		if (ImGui::Checkbox("Avoid water", &settings.avoid_water))
+		{
+			changed = true;
+		}
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Paths go around water unless there is no other way.\nApplies to destinations given after it is changed");
+
+		if (ImGui::SliderFloat("Extra clearance", &settings.extra_clearance, 0.0f, 8.0f, "%.1f"))
+		{
+			changed = true;
+		}
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Keep this much further from walls than the mesh was built for, for mounts and\nbig races. Needs a mesh built with clearance flags, applies to new destinations");
+
+		if (ImGui::Checkbox("Event messages", &settings.event_messages))
+		{
+			changed = true;
+		}
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Write \"[MQ2Nav] Event <name> <id>\" to chat when navigation arrives, stops, fails,\ngets stuck or changes destination, so macros can use #event instead of polling");
+
+		if (ImGui::Checkbox("Smooth paths", &settings.smooth_paths))
+		{
+			changed = true;
+		}
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Cut path corners that can be walked past in a straight line.\nFewer waypoints means fewer course corrections");
+
+		if (settings.smooth_paths)
+		{
+			if (ImGui::SliderFloat("Smoothing budget (us)", &settings.path_smoothing_budget, 20.0f, 2000.0f, "%.0f"))
+				changed = true;
+		}
+
+		if (ImGui::Checkbox("Share paths between clients", &settings.share_path_cache))
+		{
+			changed = true;
+		}
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Paths found by one client are reused by the other clients on\nthis computer that are in the same zone with the same mesh");
+
+		if (ImGui::Checkbox("Avoid other clients", &settings.local_avoidance))
+		{
+			changed = true;
+		}
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Steer around the other clients on this computer that are in the same\nzone instead of walking into them");
+
+		if (ImGui::Checkbox("Throttle in background", &settings.background_throttle))
+		{
+			changed = true;
+		}
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("While this window isn't in the foreground, draw nothing and look for\nnew paths less often. Saves a lot of cpu with many clients");
+
+		if (ImGui::Checkbox("Share mesh memory between clients", &settings.share_tile_data))
+		{
+			changed = true;
+		}
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Compressed mesh tiles are unpacked once for all of the clients on\nthis computer in the same zone. Takes effect when the mesh is next loaded");
+
+		if (ImGui::Checkbox("Simplify mesh heights", &settings.simplify_detail_meshes))
+		{
+			changed = true;
+		}
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Drop the detailed surface heights of tiles that aren't shared between clients\nto save memory. Paths follow uneven ground less closely. Takes effect when\nthe mesh is next loaded");
+
+		if (ImGui::SliderFloat("Mesh cache (MB)", &settings.mesh_cache_size, 0.0f, 1024.0f, "%.0f"))
+			changed = true;
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Keep the meshes of zones you left in memory, so zoning back doesn't\nload them again. 0 turns the cache off");
+
+		if (settings.mesh_cache_size > 0.0f)
+		{
+			if (ImGui::Checkbox("Preload nearby zones", &settings.preload_zones))
+			{
+				changed = true;
+			}
+			if (ImGui::IsItemHovered())
+				ImGui::SetTooltip("Load the meshes of the zones listed for this zone under [PreloadZones]\nin MQ2Nav.ini in the background, e.g. poknowledge=potranquility,guildlobby");
+		}
+
+		if (ImGui::Checkbox("Select agent profile", &settings.select_agent_profile))
+			changed = true;
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("When the mesh has been built for more than one agent size, load the one\nthat fits your character's height. Takes effect when the mesh is next loaded");
+
+		if (ImGui::SliderFloat("Zone-in budget (ms)", &settings.zone_in_budget, 0.0f, 50.0f, "%.0f"))
+			changed = true;
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Time that entering a zone may take on the game's thread in one frame.\nThe rest waits for the next frame, and what goes over it on its own\nis done in the background after that. 0 to not hold it back");
+
+		if (ImGui::Checkbox("Show zone-in timings", &settings.zone_in_timings))
+			changed = true;
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Write how long each part of entering a zone took to chat");
+
+		if (changed)
+		{
+			g_mq2Nav->Get<NavMesh>()->SetTileStreamingRadius(
+				settings.tile_streaming ? settings.tile_streaming_radius : 0.0f);
+			g_mq2Nav->Get<SharedPathCache>()->SetEnabled(settings.share_path_cache);
+			g_mq2Nav->Get<SharedFlowField>()->SetEnabled(settings.share_path_cache);
+			g_mq2Nav->Get<SharedLeaderPath>()->SetEnabled(settings.share_path_cache);
+			g_mq2Nav->Get<LocalAvoidance>()->SetEnabled(settings.local_avoidance);
+			g_mq2Nav->Get<NavMesh>()->SetShareTileData(settings.share_tile_data);
+			g_mq2Nav->Get<NavMesh>()->SetSimplifyDetailMeshes(settings.simplify_detail_meshes);
+
+			auto meshLoader = g_mq2Nav->Get<NavMeshLoader>();
+			meshLoader->SetMeshCacheSize(static_cast<size_t>(settings.mesh_cache_size * 1024 * 1024));
+			meshLoader->SetPreloadZones(settings.preload_zones);
+			meshLoader->SetSelectAgentProfile(settings.select_agent_profile);
+		}
+
 		if (changed)
 			mq2nav::SaveSettings();
 	}
@@ -149,6 +330,14 @@ void UiController::PerformUpdateTab(TabPage page)
 		mq2nav::RenderWaypointsUI();
 	}
 
+	else if (page == TabPage::Performance)
+	{
+		RenderMeshStatsUI();
+		g_mq2Nav->Get<ZoneInTimeline>()->RenderUI();
+		mq2nav::RenderPerfUI();
+		g_mq2Nav->GetPulseScheduler().RenderUI();
+	}
+
 	else if (page == TabPage::Theme)
 	{
 		ImGui::ShowStyleEditor();
@@ -14,6 +14,7 @@ enum class TabPage {
 	Waypoints,
 	Settings,
 	Tools,
+	Performance,
 	Theme,
 
 	Max
@@ -0,0 +1,358 @@
+//
+// WaypointDistances.cpp
+//
+
+#include "WaypointDistances.h"
+#include "MQ2Navigation.h"
+#include "NavigationPath.h"
+#include "SharedPathCache.h"
+#include "Waypoints.h"
+
+#include "common/NavMesh.h"
+#include "common/NavMeshData.h"
+
+#include <DetourNavMeshQuery.h>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+// header, then count * count path lengths, by row
+static const uint32_t DISTANCE_FILE_MAGIC = 'DWNM';
+static const uint32_t DISTANCE_FILE_VERSION = 1;
+
+struct DistanceFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;
+	uint32_t filterHash;
+	uint64_t meshHash;
+	uint64_t waypointHash;
+};
+
+// same as the other path length searches
+static const float WAYPOINT_EXTENTS[3] = { 2, 4, 2 };
+
+static uint64_t HashBytes(uint64_t hash, const void* data, size_t size)
+{
+	// FNV-1a
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+static const uint64_t HASH_SEED = 14695981039346656037ull;
+
+static uint64_t HashWaypoints(const std::vector<mq2nav::Waypoint>& waypoints)
+{
+	uint64_t hash = HASH_SEED;
+	for (const mq2nav::Waypoint& wp : waypoints)
+	{
+		// the length keeps "ab" + "c" apart from "a" + "bc"
+		uint32_t length = static_cast<uint32_t>(wp.name.size());
+		hash = HashBytes(hash, &length, sizeof(length));
+		hash = HashBytes(hash, wp.name.data(), wp.name.size());
+		hash = HashBytes(hash, &wp.location, sizeof(wp.location));
+	}
+
+	return hash;
+}
+
+//----------------------------------------------------------------------------
+
+WaypointDistances::WaypointDistances(NavMesh* navMesh)
+	: m_navMesh(navMesh)
+{
+}
+
+WaypointDistances::~WaypointDistances()
+{
+	Shutdown();
+}
+
+void WaypointDistances::Initialize()
+{
+	m_navMeshConn = m_navMesh->OnNavMeshChanged.Connect([this]() { ++m_meshChanges; });
+}
+
+void WaypointDistances::Shutdown()
+{
+	m_navMeshConn.Disconnect();
+
+	if (m_job)
+		m_job->cancelled = true;
+
+	if (m_pending.valid())
+		m_pending.wait();
+
+	m_pending = std::future<std::shared_ptr<Matrix>>();
+	m_job.reset();
+	m_matrix.reset();
+}
+
+void WaypointDistances::OnPulse()
+{
+	// never waits for a job that's still running
+	if (m_pending.valid() && m_pending.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+	{
+		// cancelled jobs have nothing to show
+		if (std::shared_ptr<Matrix> matrix = m_pending.get())
+			m_matrix = std::move(matrix);
+
+		m_job.reset();
+	}
+
+	if (!m_navMesh->IsNavMeshLoaded())
+	{
+		if (m_job)
+			m_job->cancelled = true;
+
+		m_matrix.reset();
+		m_currentInputs = Inputs();
+		return;
+	}
+
+	m_currentInputs = GetInputs();
+	if (m_matrix && m_matrix->inputs == m_currentInputs)
+		return;
+
+	// one job at a time, the next one starts once this one has stopped
+	if (m_job)
+	{
+		if (m_job->inputs != m_currentInputs)
+			m_job->cancelled = true;
+		return;
+	}
+
+	StartJob(m_currentInputs);
+}
+
+WaypointDistances::Inputs WaypointDistances::GetInputs()
+{
+	uint32_t revision = mq2nav::GetWaypointRevision();
+	if (revision != m_waypointRevision)
+	{
+		m_waypointRevision = revision;
+		m_waypointHash = HashWaypoints(mq2nav::GetWaypoints());
+	}
+
+	Inputs inputs;
+	inputs.waypointHash = m_waypointHash;
+	inputs.meshChanges = m_meshChanges;
+	inputs.tileGeneration = m_navMesh->GetTileGeneration();
+	inputs.filterHash = m_navMesh->GetQueryFilter()->hash;
+	return inputs;
+}
+
+void WaypointDistances::StartJob(const Inputs& inputs)
+{
+	const std::vector<mq2nav::Waypoint>& waypoints = mq2nav::GetWaypoints();
+
+	auto job = std::make_shared<Job>();
+	job->inputs = inputs;
+	job->navMesh = m_navMesh->GetNavMesh();
+	job->filter = m_navMesh->GetQueryFilter();
+
+	job->names.reserve(waypoints.size());
+	job->positions.reserve(waypoints.size());
+	for (const mq2nav::Waypoint& wp : waypoints)
+	{
+		job->names.push_back(wp.name);
+		job->positions.emplace_back(wp.location.x, wp.location.z, wp.location.y);
+	}
+
+	std::string meshName = SharedPathCache::GetSharedMeshName(m_navMesh);
+	if (!meshName.empty())
+	{
+		job->meshHash = HashBytes(HASH_SEED, meshName.data(), meshName.size());
+		job->cacheFile = g_mq2Nav->GetDataDirectory() + "\\" + m_navMesh->GetZoneName() + "_waypoints.dist";
+	}
+
+	m_job = job;
+	m_pending = std::async(std::launch::async, [this, job]() { return RunJob(*job); });
+}
+
+std::shared_ptr<WaypointDistances::Matrix> WaypointDistances::RunJob(Job& job)
+{
+	const size_t count = job.names.size();
+	std::vector<float> lengths;
+
+	if (!ReadCacheFile(job, lengths))
+	{
+		lengths.assign(count * count, -1.f);
+
+		// the query pool is for the game thread, so each thread has a query of its own
+		const size_t threadCount = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), count);
+
+		std::atomic<size_t> nextRow{ 0 };
+		std::atomic<size_t> rowsDone{ 0 };
+		auto calculateRows = [&]()
+		{
+			std::unique_ptr<dtNavMeshQuery, void(*)(dtNavMeshQuery*)> query(dtAllocNavMeshQuery(),
+				[](dtNavMeshQuery* query) { dtFreeNavMeshQuery(query); });
+			if (!query || dtStatusFailed(query->init(job.navMesh.get(), NAVMESH_QUERY_MAX_NODES)))
+				return;
+
+			for (size_t row = nextRow++; row < count && !job.cancelled; row = nextRow++)
+			{
+				// held a row at a time, so tile changes don't wait for the whole matrix
+				auto tilesLock = m_navMesh->LockTiles();
+
+				std::vector<float> rowLengths = CalculatePathLengths(query.get(), job.filter->filter,
+					job.positions[row], job.positions, WAYPOINT_EXTENTS);
+				std::copy(rowLengths.begin(), rowLengths.end(), lengths.begin() + row * count);
+				++rowsDone;
+			}
+		};
+
+		std::vector<std::future<void>> workers;
+		for (size_t i = 0; i < threadCount; ++i)
+			workers.push_back(std::async(std::launch::async, calculateRows));
+
+		for (auto& worker : workers)
+			worker.get();
+
+		if (job.cancelled)
+			return nullptr;
+
+		// rows left out by queries that couldn't be made aren't saved
+		if (rowsDone == count)
+			WriteCacheFile(job, lengths);
+	}
+
+	if (job.cancelled)
+		return nullptr;
+
+	auto matrix = std::make_shared<Matrix>();
+	matrix->inputs = job.inputs;
+	matrix->names = std::move(job.names);
+	matrix->lengths = std::move(lengths);
+
+	matrix->index.reserve(count);
+	for (size_t i = 0; i < count; ++i)
+		matrix->index.emplace(matrix->names[i], i);
+
+	return matrix;
+}
+
+bool WaypointDistances::ReadCacheFile(const Job& job, std::vector<float>& lengths)
+{
+	if (job.cacheFile.empty())
+		return false;
+
+	std::ifstream file(job.cacheFile, std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	DistanceFileHeader header;
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+		return false;
+
+	// anything else is searched again and written over
+	const size_t count = job.names.size();
+	if (header.magic != DISTANCE_FILE_MAGIC || header.version != DISTANCE_FILE_VERSION
+		|| header.count != count || header.filterHash != job.inputs.filterHash
+		|| header.meshHash != job.meshHash || header.waypointHash != job.inputs.waypointHash)
+	{
+		return false;
+	}
+
+	lengths.resize(count * count);
+	return !!file.read(reinterpret_cast<char*>(lengths.data()), lengths.size() * sizeof(float));
+}
+
+void WaypointDistances::WriteCacheFile(const Job& job, const std::vector<float>& lengths)
+{
+	if (job.cacheFile.empty())
+		return;
+
+	DistanceFileHeader header = { DISTANCE_FILE_MAGIC, DISTANCE_FILE_VERSION,
+		static_cast<uint32_t>(job.names.size()), job.inputs.filterHash, job.meshHash, job.inputs.waypointHash };
+
+	std::error_code ec;
+	std::tr2::sys::create_directory(g_mq2Nav->GetDataDirectory(), ec);
+
+	// written next to it and moved over it, like the waypoint file
+	std::string tempFilename = job.cacheFile + ".tmp";
+	{
+		std::ofstream file(tempFilename, std::ios::binary | std::ios::trunc);
+		if (!file.is_open()
+			|| !file.write(reinterpret_cast<const char*>(&header), sizeof(header))
+			|| !file.write(reinterpret_cast<const char*>(lengths.data()), lengths.size() * sizeof(float)))
+		{
+			return;
+		}
+	}
+
+	MoveFileEx(tempFilename.c_str(), job.cacheFile.c_str(), MOVEFILE_REPLACE_EXISTING);
+}
+
+bool WaypointDistances::IsReady() const
+{
+	return m_matrix
+		&& m_matrix->inputs.waypointHash == m_currentInputs.waypointHash
+		&& m_matrix->inputs.meshChanges == m_currentInputs.meshChanges;
+}
+
+float WaypointDistances::GetDistance(const std::string& from, const std::string& to) const
+{
+	if (!IsReady())
+		return -1.f;
+
+	auto fromIter = m_matrix->index.find(from);
+	auto toIter = m_matrix->index.find(to);
+	if (fromIter == m_matrix->index.end() || toIter == m_matrix->index.end())
+		return -1.f;
+
+	return m_matrix->Get(fromIter->second, toIter->second);
+}
+
+std::string WaypointDistances::FindClosest(const std::string& from,
+	const std::vector<std::string>& candidates) const
+{
+	if (!IsReady())
+		return std::string();
+
+	auto fromIter = m_matrix->index.find(from);
+	if (fromIter == m_matrix->index.end())
+		return std::string();
+
+	const size_t fromIndex = fromIter->second;
+	size_t closest = fromIndex;
+	float closestLength = 0.f;
+
+	auto consider = [&](size_t index)
+	{
+		float length = m_matrix->Get(fromIndex, index);
+		if (index != fromIndex && length >= 0.f && (closest == fromIndex || length < closestLength))
+		{
+			closest = index;
+			closestLength = length;
+		}
+	};
+
+	if (candidates.empty())
+	{
+		for (size_t i = 0; i < m_matrix->names.size(); ++i)
+			consider(i);
+	}
+	else
+	{
+		for (const std::string& name : candidates)
+		{
+			auto iter = m_matrix->index.find(name);
+			if (iter != m_matrix->index.end())
+				consider(iter->second);
+		}
+	}
+
+	return closest == fromIndex ? std::string() : m_matrix->names[closest];
+}
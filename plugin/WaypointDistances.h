@@ -0,0 +1,116 @@
+//
+// WaypointDistances.h
+//
+
+#pragma once
+
+#include "common/NavModule.h"
+#include "common/Signal.h"
+
+#include <DetourNavMesh.h>
+#include <glm/vec3.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class NavMesh;
+struct NavMeshQueryFilter;
+
+// The path length between every pair of waypoints in the zone, so that macros
+// picking the nearest camp or ordering a circuit look it up instead of searching.
+// The matrix is searched in the background once the mesh and the waypoints are
+// loaded, a row per thread, and saved next to the waypoints. It is read back on
+// the next load as long as the mesh file and the waypoints are the same.
+class WaypointDistances : public NavModule
+{
+public:
+	explicit WaypointDistances(NavMesh* navMesh);
+	virtual ~WaypointDistances();
+
+	virtual void Initialize() override;
+	virtual void Shutdown() override;
+	virtual void OnPulse() override;
+
+	virtual PulsePriority GetPulsePriority() const override { return PulsePriority::Background; }
+
+	// the matrix is for the current waypoints and mesh. It is kept while searched
+	// again after the tiles or area costs change.
+	bool IsReady() const;
+
+	// path length between two waypoints, -1 if there's no path or the matrix
+	// isn't ready
+	float GetDistance(const std::string& from, const std::string& to) const;
+
+	// the waypoint that is the shortest path away from from, out of candidates,
+	// or out of every other waypoint if there are none. Empty if none are reachable.
+	std::string FindClosest(const std::string& from, const std::vector<std::string>& candidates) const;
+
+private:
+	// what the matrix was searched with
+	struct Inputs
+	{
+		uint64_t waypointHash = 0;
+		uint32_t meshChanges = 0;
+		uint32_t tileGeneration = 0;
+		uint32_t filterHash = 0;
+
+		bool operator==(const Inputs& other) const
+		{
+			return waypointHash == other.waypointHash && meshChanges == other.meshChanges
+				&& tileGeneration == other.tileGeneration && filterHash == other.filterHash;
+		}
+		bool operator!=(const Inputs& other) const { return !(*this == other); }
+	};
+
+	struct Matrix
+	{
+		Inputs inputs;
+		std::unordered_map<std::string, size_t> index;
+		std::vector<std::string> names;
+		std::vector<float> lengths;
+
+		float Get(size_t from, size_t to) const { return lengths[from * names.size() + to]; }
+	};
+
+	struct Job
+	{
+		Inputs inputs;
+		std::shared_ptr<dtNavMesh> navMesh;
+		std::shared_ptr<const NavMeshQueryFilter> filter;
+		std::vector<std::string> names;
+		std::vector<glm::vec3> positions;
+
+		// empty if the mesh can't be told apart from another on disk
+		std::string cacheFile;
+		uint64_t meshHash = 0;
+
+		std::atomic<bool> cancelled{ false };
+	};
+
+	Inputs GetInputs();
+	void StartJob(const Inputs& inputs);
+
+	// run on a worker thread
+	std::shared_ptr<Matrix> RunJob(Job& job);
+	bool ReadCacheFile(const Job& job, std::vector<float>& lengths);
+	void WriteCacheFile(const Job& job, const std::vector<float>& lengths);
+
+	NavMesh* m_navMesh;
+	Signal<>::ScopedConnection m_navMeshConn;
+	uint32_t m_meshChanges = 0;
+
+	// the waypoint hash is only taken again when the waypoints change
+	uint32_t m_waypointRevision = 0;
+	uint64_t m_waypointHash = 0;
+
+	std::shared_ptr<const Matrix> m_matrix;
+	Inputs m_currentInputs;
+
+	std::shared_ptr<Job> m_job;
+	std::future<std::shared_ptr<Matrix>> m_pending;
+};
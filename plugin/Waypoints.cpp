@@ -3,9 +3,18 @@
 //
 
 #include "Waypoints.h"
+#include "ZoneInTimeline.h"
 
 #include <imgui.h>
 
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
 namespace mq2nav {
 
 //----------------------------------------------------------------------------
@@ -16,8 +25,39 @@ std::string g_zoneName;
 std::string g_shortZone;
 int g_currentZone = 0;
 
+// name -> index into g_waypoints, which is kept sorted by name for the ui
+std::unordered_map<std::string, size_t> g_waypointIndex;
+uint32_t g_waypointRevision = 0;
+
 bool DeleteWaypoint(const std::string& name);
 
+// the waypoint file being written, if any. Writes go out one at a time, in order.
+std::future<bool> g_pendingSave;
+std::string g_pendingSaveFilename;
+
+// the waypoint file being read, when reading it took too long for the main thread
+struct PendingWaypointLoad
+{
+	Waypoints waypoints;
+	bool found = false;
+	const char* problem = nullptr;
+	double readMs = 0;
+};
+std::future<PendingWaypointLoad> g_pendingLoad;
+std::string g_pendingLoadFilename;
+
+// per zone waypoint file: header, then name, location and description of each
+// waypoint. Strings are length prefixed.
+static const uint32_t WAYPOINT_FILE_MAGIC = 'PWNM';
+static const uint32_t WAYPOINT_FILE_VERSION = 1;
+
+struct WaypointFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;
+};
+
 std::string Waypoint::Serialize() const
 {
 	std::ostringstream ostr;
@@ -54,127 +94,405 @@ bool Waypoint::Deserialize(const std::string& name, const std::string& data)
 
 //----------------------------------------------------------------------------
 
-void LoadWaypoints(int zoneId)
+static std::string GetWaypointFilename()
 {
-	g_shortZone = GetShortZone(zoneId);
-	g_zoneName = GetFullZone(zoneId);
-	g_currentZone = zoneId;
+	return g_mq2Nav->GetDataDirectory() + "\\" + g_shortZone + "_waypoints.dat";
+}
 
-	WriteChatf(PLUGIN_MSG "Loading waypoints for zone: %s", g_shortZone.c_str());
-	g_waypoints.clear();
+static void SortWaypoints()
+{
+	std::sort(g_waypoints.begin(), g_waypoints.end(),
+		[](const Waypoint& a, const Waypoint& b)
+	{
+		return strcmp(a.name.c_str(), b.name.c_str()) < 0;
+	});
+
+	g_waypointIndex.clear();
+	g_waypointIndex.reserve(g_waypoints.size());
+
+	for (size_t i = 0; i < g_waypoints.size(); ++i)
+		g_waypointIndex.emplace(g_waypoints[i].name, i);
+
+	++g_waypointRevision;
+}
+
+static void WriteString(std::vector<char>& buffer, const std::string& str)
+{
+	uint16_t length = (uint16_t)std::min<size_t>(str.length(), UINT16_MAX);
+
+	buffer.insert(buffer.end(), (const char*)&length, (const char*)&length + sizeof(length));
+	buffer.insert(buffer.end(), str.begin(), str.begin() + length);
+}
+
+static bool ReadString(const char*& data, const char* end, std::string& str)
+{
+	uint16_t length;
+	if (end - data < (ptrdiff_t)sizeof(length))
+		return false;
+
+	memcpy(&length, data, sizeof(length));
+	data += sizeof(length);
+
+	if (end - data < length)
+		return false;
+
+	str.assign(data, length);
+	data += length;
+	return true;
+}
+
+// the whole file is read in one go and parsed from memory. Returns false if there
+// is no file that can be used, problem says what was wrong with it. Leaves the
+// globals alone, so it can be done on a worker.
+static bool ReadWaypointFile(const std::string& filename, Waypoints& waypoints, const char*& problem)
+{
+	std::ifstream file(filename, std::ios::binary | std::ios::ate);
+	if (!file.is_open())
+		return false;
+
+	std::vector<char> buffer((size_t)file.tellg());
+	file.seekg(0);
+	if (!file.read(buffer.data(), buffer.size()))
+		return false;
+
+	WaypointFileHeader header;
+	if (buffer.size() < sizeof(header))
+		return false;
+
+	memcpy(&header, buffer.data(), sizeof(header));
+	if (header.magic != WAYPOINT_FILE_MAGIC || header.version != WAYPOINT_FILE_VERSION)
+	{
+		problem = "not valid";
+		return false;
+	}
+
+	const char* data = buffer.data() + sizeof(header);
+	const char* end = buffer.data() + buffer.size();
 
+	// the count can't be trusted any more than the rest. Each waypoint takes at
+	// least its location and the lengths of its two strings.
+	const size_t minRecordSize = sizeof(glm::vec3) + 2 * sizeof(uint16_t);
+	if (header.count > (size_t)(end - data) / minRecordSize)
+	{
+		problem = "truncated";
+		return false;
+	}
+
+	waypoints.reserve(header.count);
+
+	for (uint32_t i = 0; i < header.count; ++i)
+	{
+		Waypoint wp;
+		if (!ReadString(data, end, wp.name)
+			|| end - data < (ptrdiff_t)sizeof(wp.location))
+		{
+			problem = "truncated";
+			break;
+		}
+
+		memcpy(&wp.location, data, sizeof(wp.location));
+		data += sizeof(wp.location);
+
+		if (!ReadString(data, end, wp.description))
+		{
+			problem = "truncated";
+			break;
+		}
+
+		waypoints.push_back(std::move(wp));
+	}
+
+	return true;
+}
+
+// waits for the last write to finish and reports it if it failed
+static void WaitForPendingSave()
+{
+	if (!g_pendingSave.valid())
+		return;
+
+	if (!g_pendingSave.get())
+		WriteChatf(PLUGIN_MSG "\arFailed to save waypoints: %s", g_pendingSaveFilename.c_str());
+}
+
+// the file is serialized here and written from a worker thread, to a temporary
+// file that then replaces the old one.
+static void SaveWaypointFile()
+{
+	WaitForPendingSave();
+
+	WaypointFileHeader header = { WAYPOINT_FILE_MAGIC, WAYPOINT_FILE_VERSION, (uint32_t)g_waypoints.size() };
+
+	std::vector<char> buffer;
+	buffer.insert(buffer.end(), (const char*)&header, (const char*)&header + sizeof(header));
+
+	for (const Waypoint& wp : g_waypoints)
+	{
+		WriteString(buffer, wp.name);
+		buffer.insert(buffer.end(), (const char*)&wp.location, (const char*)&wp.location + sizeof(wp.location));
+		WriteString(buffer, wp.description);
+	}
+
+	g_pendingSaveFilename = GetWaypointFilename();
+
+	g_pendingSave = std::async(std::launch::async,
+		[buffer = std::move(buffer), directory = g_mq2Nav->GetDataDirectory(), filename = g_pendingSaveFilename]()
+	{
+		// make sure directory exists so we can write to it!
+		std::error_code ec;
+		std::tr2::sys::create_directory(directory, ec);
+
+		std::string tempFilename = filename + ".tmp";
+		{
+			std::ofstream file(tempFilename, std::ios::binary | std::ios::trunc);
+			if (!file.is_open() || !file.write(buffer.data(), buffer.size()))
+				return false;
+		}
+
+		return MoveFileEx(tempFilename.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+	});
+}
+
+void FlushWaypoints()
+{
+	WaitForPendingSave();
+}
+
+// waypoints from before the waypoint file existed live in the ini. They are
+// copied over the first time a zone is loaded, the ini is left alone.
+static void ImportIniWaypoints()
+{
 	CHAR pchKeys[MAX_STRING * 10] = { 0 };
 	CHAR pchValue[MAX_STRING];
-	Waypoint wp;
 
-	if (GetPrivateProfileString(g_shortZone.c_str(), NULL, "", pchKeys, MAX_STRING * 10, INIFileName))
+	if (!GetPrivateProfileString(g_shortZone.c_str(), NULL, "", pchKeys, MAX_STRING * 10, INIFileName))
+		return;
+
+	PCHAR pKeys = pchKeys;
+	while (pKeys[0] || pKeys[1])
 	{
-		PCHAR pKeys = pchKeys;
-		while (pKeys[0] || pKeys[1])
+		GetPrivateProfileString(g_shortZone.c_str(), pKeys, "", pchValue, MAX_STRING, INIFileName);
+
+		std::string name(pKeys);
+		Waypoint wp;
+
+		if (!name.empty() && g_waypointIndex.count(name) == 0
+			&& (pchValue[0] != 0) && wp.Deserialize(name, pchValue))
 		{
-			GetPrivateProfileString(g_shortZone.c_str(), pKeys, "", pchValue, MAX_STRING, INIFileName);
+			g_waypointIndex.emplace(name, g_waypoints.size());
+			g_waypoints.push_back(std::move(wp));
+		}
+		else
+		{
+			WriteChatf(PLUGIN_MSG "Invalid waypoint entry: %s", pKeys);
+		}
 
-			std::string name(pKeys);
-			bool valid = true;
+		pKeys += strlen(pKeys) + 1;
+	}
 
-			// empty/invalid character, delete it
-			if (name.empty())
-			{
-				valid = false;
-			}
-			else
-			{
-				bool exists = std::find_if(g_waypoints.begin(), g_waypoints.end(),
-					[&name](const Waypoint& wp) { return wp.name == name; }) != g_waypoints.end();
+	if (!g_waypoints.empty())
+	{
+		WriteChatf(PLUGIN_MSG "Imported %d waypoints from %s", g_waypoints.size(), INIFileName);
+		SaveWaypointFile();
+	}
+}
 
-				if (!exists && (pchValue[0] != 0) && wp.Deserialize(name, pchValue))
-				{
-					g_waypoints.push_back(wp);
-				}
-				else
-				{
-					WriteChatf(PLUGIN_MSG "Invalid waypoint entry: %s", pKeys);
-					valid = false;
-				}
-			}
+// the waypoints read from the zone's file replace the last zone's. The ini ones
+// are imported if there was no file.
+static void ApplyWaypoints(Waypoints& waypoints, bool found, const char* problem, const std::string& filename)
+{
+	if (problem)
+		WriteChatf(PLUGIN_MSG "\arWaypoint file is %s: %s", problem, filename.c_str());
 
-			if (!valid)
-			{
-				DeleteWaypoint(name);
-			}
+	g_waypoints = std::move(waypoints);
+	g_waypointIndex.clear();
 
-			pKeys += strlen(pKeys) + 1;
-		}
+	if (!found)
+	{
+		g_waypoints.clear();
+		ImportIniWaypoints();
 	}
 
-	std::sort(g_waypoints.begin(), g_waypoints.end(),
-		[](const Waypoint& a, const Waypoint& b)
+	SortWaypoints();
+}
+
+static void FinishPendingLoad()
+{
+	PendingWaypointLoad load = g_pendingLoad.get();
+
+	ZoneInTimeline* timeline = g_mq2Nav->Get<ZoneInTimeline>();
+	timeline->AddBackgroundTime(ZoneInStage::Waypoints, load.readMs);
+
+	ScopedZoneInStage stage(timeline, ZoneInStage::Waypoints);
+	ApplyWaypoints(load.waypoints, load.found, load.problem, g_pendingLoadFilename);
+}
+
+// anything that looks a waypoint up or changes them can't wait for the pulse
+static void WaitForPendingLoad()
+{
+	if (g_pendingLoad.valid())
+		FinishPendingLoad();
+}
+
+void CheckPendingWaypoints()
+{
+	if (!g_pendingLoad.valid()
+		|| g_pendingLoad.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
 	{
-		return strcmp(a.name.c_str(), b.name.c_str()) < 0;
-	});
+		return;
+	}
+
+	if (g_mq2Nav->Get<ZoneInTimeline>()->CanRunStage(ZoneInStage::Waypoints))
+		FinishPendingLoad();
 }
 
-void SaveWaypoint(const Waypoint& wp)
+void LoadWaypoints(int zoneId)
 {
-	std::string& serialized = wp.Serialize();
+	// the last zone's waypoints go out before its file could be read back
+	WaitForPendingSave();
+
+	// and a read of them that is still going is of no use anymore
+	if (g_pendingLoad.valid())
+		g_pendingLoad.wait();
+	g_pendingLoad = std::future<PendingWaypointLoad>();
+
+	g_shortZone = GetShortZone(zoneId);
+	g_zoneName = GetFullZone(zoneId);
+	g_currentZone = zoneId;
+
+	WriteChatf(PLUGIN_MSG "Loading waypoints for zone: %s", g_shortZone.c_str());
+	g_waypoints.clear();
+	g_waypointIndex.clear();
+
+	ZoneInTimeline* timeline = g_mq2Nav->Get<ZoneInTimeline>();
+	std::string filename = GetWaypointFilename();
 
-	WritePrivateProfileString(g_shortZone.c_str(), wp.name.c_str(),
-		serialized.c_str(), INIFileName);
+	// a file that took too long to read on the main thread is read on a worker
+	if (timeline->ShouldRunInBackground(ZoneInStage::Waypoints))
+	{
+		SortWaypoints();
+
+		timeline->StartStage(ZoneInStage::Waypoints);
+		g_pendingLoadFilename = filename;
+		g_pendingLoad = std::async(std::launch::async, [filename]()
+		{
+			auto start = std::chrono::steady_clock::now();
+
+			PendingWaypointLoad load;
+			load.found = ReadWaypointFile(filename, load.waypoints, load.problem);
+			load.readMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			return load;
+		});
+		return;
+	}
+
+	ScopedZoneInStage stage(timeline, ZoneInStage::Waypoints);
+
+	Waypoints waypoints;
+	const char* problem = nullptr;
+	bool found = ReadWaypointFile(filename, waypoints, problem);
+	ApplyWaypoints(waypoints, found, problem, filename);
+}
+
+const std::vector<Waypoint>& GetWaypoints()
+{
+	return g_waypoints;
+}
+
+uint32_t GetWaypointRevision()
+{
+	return g_waypointRevision;
 }
 
 bool GetWaypoint(const std::string& name, Waypoint& wp)
 {
-	auto iter = std::find_if(g_waypoints.begin(), g_waypoints.end(),
-		[&name](const Waypoint& wp) { return wp.name == name; });
+	WaitForPendingLoad();
+
+	auto iter = g_waypointIndex.find(name);
 
-	bool result = (iter != g_waypoints.end());
+	bool result = (iter != g_waypointIndex.end());
 
-	wp = result ? *iter : Waypoint();
+	wp = result ? g_waypoints[iter->second] : Waypoint();
 	return result;
 }
 
-bool DeleteWaypoint(const std::string& name)
+// these change g_waypoints without sorting or saving it, so a batch can do both
+// once at the end.
+static bool InsertWaypoint(const Waypoint& waypoint)
 {
-	auto iter = std::find_if(g_waypoints.begin(), g_waypoints.end(),
-		[&name](const Waypoint& wp) { return wp.name == name; });
+	auto iter = g_waypointIndex.find(waypoint.name);
 
-	if (iter == g_waypoints.end())
-		return false;
+	if (iter != g_waypointIndex.end())
+	{
+		g_waypoints[iter->second] = waypoint;
+		return true;
+	}
 
-	g_waypoints.erase(iter);
+	g_waypointIndex.emplace(waypoint.name, g_waypoints.size());
+	g_waypoints.push_back(waypoint);
+	return false;
+}
 
-	WritePrivateProfileString(g_shortZone.c_str(), name.c_str(), NULL, INIFileName);
-	return true;
+static int RemoveWaypoints(const std::vector<std::string>& names)
+{
+	std::unordered_set<std::string> removed;
+	for (const std::string& name : names)
+	{
+		if (g_waypointIndex.count(name))
+			removed.insert(name);
+	}
+
+	if (removed.empty())
+		return 0;
+
+	g_waypoints.erase(std::remove_if(g_waypoints.begin(), g_waypoints.end(),
+		[&removed](const Waypoint& wp) { return removed.count(wp.name) != 0; }), g_waypoints.end());
+	return (int)removed.size();
 }
 
-bool AddWaypoint(const Waypoint& waypoint)
+int DeleteWaypoints(const std::vector<std::string>& names)
 {
-	bool exists = false;
+	WaitForPendingLoad();
 
-	auto iter = std::find_if(g_waypoints.begin(), g_waypoints.end(),
-		[&waypoint](const Waypoint& wp) { return wp.name == waypoint.name; });
+	int count = RemoveWaypoints(names);
 
-	// store them
-	if (iter == g_waypoints.end())
+	if (count > 0)
 	{
-		g_waypoints.emplace_back(std::move(waypoint));
+		SortWaypoints();
+		SaveWaypointFile();
 	}
-	else
+
+	return count;
+}
+
+bool DeleteWaypoint(const std::string& name)
+{
+	return DeleteWaypoints({ name }) != 0;
+}
+
+int AddWaypoints(const std::vector<Waypoint>& waypoints)
+{
+	if (waypoints.empty())
+		return 0;
+
+	WaitForPendingLoad();
+
+	int replaced = 0;
+	for (const Waypoint& waypoint : waypoints)
 	{
-		*iter = std::move(waypoint);
-		exists = true;
+		if (InsertWaypoint(waypoint))
+			++replaced;
 	}
 
-	std::sort(g_waypoints.begin(), g_waypoints.end(),
-		[](const Waypoint& a, const Waypoint& b)
-	{
-		return strcmp(a.name.c_str(), b.name.c_str()) < 0;
-	});
+	SortWaypoints();
+	SaveWaypointFile();
 
-	// save data
-	SaveWaypoint(waypoint);
+	return replaced;
+}
 
-	return exists;
+bool AddWaypoint(const Waypoint& waypoint)
+{
+	return AddWaypoints({ waypoint }) != 0;
 }
 
 void DrawSplitter(bool split_vertically, float thickness, float* size0, float* size1, float min_size0, float min_size1)
@@ -360,21 +678,18 @@ void RenderWaypointsUI()
 
 				// delete old waypoint if name is different.
 				if (editWaypoint.name != newName && !editWaypoint.name.empty())
-					DeleteWaypoint(editWaypoint.name);
+					RemoveWaypoints({ editWaypoint.name });
 
-				// save the new waypoint.
+				// save the new waypoint, along with the delete in one write.
 				editWaypoint.name = editWaypointName;
 				editWaypoint.description = editWaypointDescription;
-				AddWaypoint(editWaypoint);
+				AddWaypoints({ editWaypoint });
 
 				// Resync current index
-				for (int i = 0; i < g_waypoints.size(); i++)
-				{
-					if (g_waypoints[i].name == newName) {
-						currentWaypoint = i;
-						changedForNext = true;
-						break;
-					}
+				auto iter = g_waypointIndex.find(newName);
+				if (iter != g_waypointIndex.end()) {
+					currentWaypoint = (int)iter->second;
+					changedForNext = true;
 				}
 			}
 		}
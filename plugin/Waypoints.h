@@ -11,6 +11,7 @@
 #include <string>
 #include <map>
 #include <sstream>
+#include <vector>
 
 namespace mq2nav {
 
@@ -32,15 +33,35 @@ public:
 	std::string description;
 };
 
-// Load/Save waypoints from .ini file
+// Load/Save waypoints from the per zone waypoint file. Waypoints in the .ini
+// are imported if the zone has no waypoint file yet.
 void LoadWaypoints(int zoneId);
 
+// Puts the waypoints in place once a file that's read in the background is done.
+// Until then, the zone has none.
+void CheckPendingWaypoints();
+
 // Returns true and fills in wp if waypoint with name is found
 bool GetWaypoint(const std::string& name, Waypoint& wp);
 
-// Add a new waypoint to the current zone
+// Add a new waypoint to the current zone. Returns true if it replaced one with
+// the same name.
 bool AddWaypoint(const Waypoint& waypoint);
 
+// Add or delete several waypoints, with a single write of the waypoint file.
+// Return the number of waypoints replaced or deleted.
+int AddWaypoints(const std::vector<Waypoint>& waypoints);
+int DeleteWaypoints(const std::vector<std::string>& names);
+
+// The waypoints of the current zone, sorted by name. The revision goes up every
+// time they change, including when another zone's are loaded.
+const std::vector<Waypoint>& GetWaypoints();
+uint32_t GetWaypointRevision();
+
+// Waits for the waypoint file to finish writing. Waypoints are written from a
+// worker thread.
+void FlushWaypoints();
+
 void RenderWaypointsUI();
 
 } // namespace mq2nav
@@ -0,0 +1,249 @@
+//
+// ZoneInTimeline.cpp
+//
+
+#include "ZoneInTimeline.h"
+#include "MQ2Nav_Settings.h"
+#include "MQ2Navigation.h"
+
+#include <imgui.h>
+
+#include <algorithm>
+
+// the zone-in is over once nothing has started or finished for this long
+static const double ZONE_IN_SETTLE_MS = 2000.0;
+
+// and reported regardless after this long, a stage can be left waiting on
+// something that never comes
+static const double ZONE_IN_TIMEOUT_MS = 30000.0;
+
+static const char* s_stageNames[] = {
+	"waypoints",
+	"read",
+	"parse",
+	"inflate",
+	"add tiles",
+	"mesh swap",
+	"doors",
+	"door models",
+	"overlay",
+};
+static_assert(sizeof(s_stageNames) / sizeof(s_stageNames[0]) == (int)ZoneInStage::Count,
+	"stage names don't match ZoneInStage");
+
+const char* GetZoneInStageName(ZoneInStage stage)
+{
+	return s_stageNames[(int)stage];
+}
+
+//============================================================================
+
+void ZoneInTimeline::Begin(const std::string& zoneShortName)
+{
+	m_zoneShortName = zoneShortName;
+	m_start = clock::now();
+	m_active = !zoneShortName.empty();
+
+	for (Stage& stage : m_stages)
+		stage = Stage();
+
+	m_lastChangeMs = 0;
+	m_pulseMs = 0;
+	m_pulseStages = 0;
+	m_maxPulseMs = 0;
+	m_pulses = 0;
+}
+
+void ZoneInTimeline::BeginPulse()
+{
+	m_pulseMs = 0;
+	m_pulseStages = 0;
+}
+
+void ZoneInTimeline::OnPulse()
+{
+	if (!m_active)
+		return;
+
+	double elapsedMs = GetElapsedMs();
+
+	bool running = std::any_of(std::begin(m_stages), std::end(m_stages),
+		[](const Stage& stage) { return stage.running; });
+
+	if ((!running && elapsedMs - m_lastChangeMs >= ZONE_IN_SETTLE_MS) || elapsedMs >= ZONE_IN_TIMEOUT_MS)
+	{
+		m_active = false;
+
+		if (mq2nav::GetSettings().zone_in_timings)
+			Report();
+	}
+}
+
+double ZoneInTimeline::GetElapsedMs() const
+{
+	return std::chrono::duration<double, std::milli>(clock::now() - m_start).count();
+}
+
+ZoneInTimeline::Stage& ZoneInTimeline::UseStage(ZoneInStage stage)
+{
+	Stage& s = m_stages[(int)stage];
+
+	m_lastChangeMs = GetElapsedMs();
+
+	if (!s.used)
+	{
+		s.used = true;
+		s.startMs = m_lastChangeMs;
+	}
+
+	s.endMs = m_lastChangeMs;
+	return s;
+}
+
+//----------------------------------------------------------------------------
+
+bool ZoneInTimeline::CanRunStage(ZoneInStage stage)
+{
+	float budgetMs = mq2nav::GetSettings().zone_in_budget;
+	if (!m_active || budgetMs <= 0.0f)
+		return true;
+
+	if (m_pulseStages == 0 || m_pulseMs < budgetMs)
+		return true;
+
+	++UseStage(stage).deferred;
+	return false;
+}
+
+bool ZoneInTimeline::ShouldRunInBackground(ZoneInStage stage) const
+{
+	return mq2nav::GetSettings().zone_in_budget > 0.0f && m_runInBackground[(int)stage];
+}
+
+void ZoneInTimeline::StartStage(ZoneInStage stage)
+{
+	if (!m_active)
+		return;
+
+	UseStage(stage).running = true;
+}
+
+void ZoneInTimeline::FinishStage(ZoneInStage stage)
+{
+	if (!m_active || !m_stages[(int)stage].used)
+		return;
+
+	UseStage(stage).running = false;
+}
+
+void ZoneInTimeline::AddMainThreadTime(ZoneInStage stage, double ms)
+{
+	if (!m_active)
+		return;
+
+	UseStage(stage).mainMs += ms;
+
+	if (m_pulseStages++ == 0)
+		++m_pulses;
+	m_pulseMs += ms;
+	m_maxPulseMs = std::max(m_maxPulseMs, m_pulseMs);
+
+	float budgetMs = mq2nav::GetSettings().zone_in_budget;
+	if (budgetMs > 0.0f && ms > budgetMs)
+		m_runInBackground[(int)stage] = true;
+}
+
+void ZoneInTimeline::AddBackgroundTime(ZoneInStage stage, double ms)
+{
+	if (!m_active)
+		return;
+
+	UseStage(stage).backgroundMs += ms;
+}
+
+//----------------------------------------------------------------------------
+
+void ZoneInTimeline::Report()
+{
+	double totalMs = 0, mainMs = 0;
+	std::string mainStages, backgroundStages;
+
+	for (int i = 0; i < (int)ZoneInStage::Count; ++i)
+	{
+		const Stage& stage = m_stages[i];
+		if (!stage.used)
+			continue;
+
+		totalMs = std::max(totalMs, stage.endMs);
+		mainMs += stage.mainMs;
+
+		char part[64];
+		if (stage.mainMs > 0)
+		{
+			if (stage.deferred)
+				sprintf_s(part, "%s%s %.1f (waited %d)", mainStages.empty() ? "" : ", ", s_stageNames[i], stage.mainMs, stage.deferred);
+			else
+				sprintf_s(part, "%s%s %.1f", mainStages.empty() ? "" : ", ", s_stageNames[i], stage.mainMs);
+			mainStages += part;
+		}
+		if (stage.backgroundMs > 0)
+		{
+			sprintf_s(part, "%s%s %.1f", backgroundStages.empty() ? "" : ", ", s_stageNames[i], stage.backgroundMs);
+			backgroundStages += part;
+		}
+	}
+
+	float budgetMs = mq2nav::GetSettings().zone_in_budget;
+	bool overBudget = budgetMs > 0.0f && m_maxPulseMs > budgetMs;
+
+	WriteChatf(PLUGIN_MSG "Zone-in for \am%s\ax took %.0f ms, %.1f ms on the main thread over %d pulses, %s%.1f ms\ax at most",
+		m_zoneShortName.c_str(), totalMs, mainMs, m_pulses, overBudget ? "\ar" : "\ag", m_maxPulseMs);
+	if (!mainStages.empty())
+		WriteChatf(PLUGIN_MSG "  main thread (ms): %s", mainStages.c_str());
+	if (!backgroundStages.empty())
+		WriteChatf(PLUGIN_MSG "  background (ms): %s", backgroundStages.c_str());
+}
+
+void ZoneInTimeline::RenderUI()
+{
+	if (!ImGui::CollapsingHeader("Zone-in"))
+		return;
+
+	if (m_zoneShortName.empty())
+	{
+		ImGui::Text("No zone-in yet");
+		return;
+	}
+
+	ImGui::Text("%s%s: %d pulses, at most %.1f ms in one", m_zoneShortName.c_str(),
+		m_active ? " (still going)" : "", m_pulses, m_maxPulseMs);
+
+	ImGui::Columns(6, "##zonein");
+	ImGui::Separator();
+	ImGui::Text("Stage"); ImGui::NextColumn();
+	ImGui::Text("Start"); ImGui::NextColumn();
+	ImGui::Text("End"); ImGui::NextColumn();
+	ImGui::Text("Main"); ImGui::NextColumn();
+	ImGui::Text("Background"); ImGui::NextColumn();
+	ImGui::Text("Waited"); ImGui::NextColumn();
+	ImGui::Separator();
+
+	for (int i = 0; i < (int)ZoneInStage::Count; ++i)
+	{
+		const Stage& stage = m_stages[i];
+		if (!stage.used)
+			continue;
+
+		ImGui::Text("%s%s", s_stageNames[i], m_runInBackground[i] ? " *" : ""); ImGui::NextColumn();
+		ImGui::Text("%.1f", stage.startMs); ImGui::NextColumn();
+		ImGui::Text("%.1f", stage.endMs); ImGui::NextColumn();
+		ImGui::Text("%.2f", stage.mainMs); ImGui::NextColumn();
+		ImGui::Text("%.1f", stage.backgroundMs); ImGui::NextColumn();
+		ImGui::Text("%d", stage.deferred); ImGui::NextColumn();
+	}
+
+	ImGui::Columns(1);
+	ImGui::Separator();
+
+	ImGui::TextDisabled("Milliseconds since the zone change. * went over the budget and runs in the background where it can");
+}
@@ -0,0 +1,136 @@
+//
+// ZoneInTimeline.h
+//
+
+#pragma once
+
+#include "common/NavModule.h"
+
+#include <chrono>
+#include <string>
+
+// the parts of entering a zone, in about the order they happen
+enum class ZoneInStage
+{
+	Waypoints,                 // reading the zone's waypoint file
+	MeshRead,                  // opening the mesh file and reading the headers
+	MeshParse,                 // the metadata
+	MeshInflate,               // tiles
+	MeshAddTiles,
+	MeshSwap,                  // putting the new mesh in place of the last zone's
+	Doors,                     // indexing the door table
+	DoorModels,
+	Overlay,                   // building the mesh overlay
+
+	Count
+};
+
+const char* GetZoneInStageName(ZoneInStage stage);
+
+// Times everything that happens on entering a zone, on the main thread and on
+// the workers, from the zone change until the last of it is done, and writes it
+// to chat with ZoneInTimings set.
+//
+// Main thread work of a zone-in is held to ZoneInBudget milliseconds a pulse.
+// Stages check CanRunStage before they start and wait for the next pulse when
+// the budget is used up. A stage that goes over the budget on its own is done
+// in the background from then on, where it can be.
+class ZoneInTimeline : public NavModule
+{
+public:
+	using clock = std::chrono::high_resolution_clock;
+
+	virtual void OnPulse() override;
+
+	// only reports, which can wait
+	virtual PulsePriority GetPulsePriority() const override { return PulsePriority::Background; }
+
+	// start over for a zone, before anything else is done for it
+	void Begin(const std::string& zoneShortName);
+
+	// at the start of every pulse, the budget is for each one
+	void BeginPulse();
+
+	// whether there is budget left in this pulse for a stage. The first stage of
+	// a pulse can always run, so nothing waits forever.
+	bool CanRunStage(ZoneInStage stage);
+
+	// whether the stage went over the budget on the main thread before
+	bool ShouldRunInBackground(ZoneInStage stage) const;
+
+	// a stage that was started on a worker, and isn't done until FinishStage
+	void StartStage(ZoneInStage stage);
+	void FinishStage(ZoneInStage stage);
+
+	void AddMainThreadTime(ZoneInStage stage, double ms);
+	void AddBackgroundTime(ZoneInStage stage, double ms);
+
+	// until the zone-in has been reported, everything is added to it
+	bool IsActive() const { return m_active; }
+
+	void RenderUI();
+
+private:
+	struct Stage
+	{
+		bool used = false;
+		bool running = false;
+
+		// since the zone change
+		double startMs = 0;
+		double endMs = 0;
+
+		double mainMs = 0;
+		double backgroundMs = 0;
+
+		// pulses it waited on the budget
+		int deferred = 0;
+	};
+
+	double GetElapsedMs() const;
+	Stage& UseStage(ZoneInStage stage);
+	void Report();
+
+	std::string m_zoneShortName;
+	clock::time_point m_start;
+	Stage m_stages[(size_t)ZoneInStage::Count];
+	bool m_active = false;
+
+	// when a stage last started or finished
+	double m_lastChangeMs = 0;
+
+	double m_pulseMs = 0;
+	int m_pulseStages = 0;
+	double m_maxPulseMs = 0;
+	int m_pulses = 0;
+
+	bool m_runInBackground[(size_t)ZoneInStage::Count] = {};
+};
+
+// times the enclosing scope as main thread work of a stage. Nothing is added if
+// the zone-in was already reported.
+class ScopedZoneInStage
+{
+public:
+	ScopedZoneInStage(ZoneInTimeline* timeline, ZoneInStage stage)
+		: m_timeline(timeline)
+		, m_stage(stage)
+		, m_start(ZoneInTimeline::clock::now())
+	{
+	}
+
+	~ScopedZoneInStage()
+	{
+		m_timeline->AddMainThreadTime(m_stage,
+			std::chrono::duration<double, std::milli>(ZoneInTimeline::clock::now() - m_start).count());
+		m_timeline->FinishStage(m_stage);
+	}
+
+	ScopedZoneInStage(const ScopedZoneInStage&) = delete;
+	ScopedZoneInStage& operator=(const ScopedZoneInStage&) = delete;
+
+private:
+	ZoneInTimeline* m_timeline;
+	ZoneInStage m_stage;
+	ZoneInTimeline::clock::time_point m_start;
+};
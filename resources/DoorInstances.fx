@@ -0,0 +1,51 @@
+//////////////////////
+// Instanced door bounding boxes. The box of each model is drawn once for all of
+// the doors that use it, with the world transform and color of each door coming
+// from a second vertex stream.
+
+float4x4 mViewProj : ViewProjection;
+
+struct TInputVertex
+{
+	float3 pos			: POSITION;		// corner of the box, in model space
+
+	// per instance
+	float4 world0		: TEXCOORD0;	// rows of the world transform
+	float4 world1		: TEXCOORD1;
+	float4 world2		: TEXCOORD2;
+	float4 world3		: TEXCOORD3;
+	float4 color		: COLOR0;
+};
+
+struct TOutputVertex
+{
+	float4 Pos : POSITION;
+	float4 Color : COLOR0;
+};
+
+TOutputVertex DoorInstanceVS(TInputVertex IN)
+{
+	TOutputVertex OUT = (TOutputVertex)0;
+
+	float4x4 world = float4x4(IN.world0, IN.world1, IN.world2, IN.world3);
+	float4 worldPos = mul(float4(IN.pos, 1.0f), world);
+
+	OUT.Pos = mul(worldPos, mViewProj);
+	OUT.Color = IN.color;
+
+	return OUT;
+}
+
+float4 DoorInstancePS(float4 color : COLOR0) : COLOR
+{
+	return color;
+}
+
+technique DoorInstances
+{
+	pass p0
+	{
+		VertexShader = compile vs_3_0 DoorInstanceVS();
+		PixelShader = compile ps_3_0 DoorInstancePS();
+	}
+}